@@ -932,6 +932,33 @@ bt_target_page_check(BtreeCheckState *state)
 										(uint32) state->targetlsn)));
 		}
 
+		/*
+		 * The heap TIDs of a posting list tuple must be in strictly
+		 * ascending order
+		 */
+		if (BTreeTupleIsPosting(itup))
+		{
+			ItemPointer current;
+			ItemPointer max = NULL;
+
+			for (int i = 0; i < BTreeTupleGetNPosting(itup); i++)
+			{
+				current = BTreeTupleGetPostingN(itup, i);
+
+				if (max != NULL && ItemPointerCompare(current, max) <= 0)
+					ereport(ERROR,
+							(errcode(ERRCODE_INDEX_CORRUPTED),
+							 errmsg("posting list contains misplaced TID in index \"%s\"",
+									RelationGetRelationName(state->rel)),
+							 errdetail_internal("Index tid=(%u,%u) posting list offset=%d page lsn=%X/%X.",
+												state->targetblock, offset, i,
+												(uint32) (state->targetlsn >> 32),
+												(uint32) state->targetlsn)));
+
+				max = current;
+			}
+		}
+
 		/* Fingerprint downlink blocks in heapallindexed + readonly case */
 		if (state->heapallindexed && state->readonly && !P_ISLEAF(topaque))
 		{
@@ -977,6 +1004,14 @@ bt_target_page_check(BtreeCheckState *state)
 		/* Build insertion scankey for current page offset */
 		skey = bt_mkscankey_pivotsearch(state->rel, itup);
 
+		/*
+		 * A posting list tuple stands for all of its heap TIDs.  Have the
+		 * high key check and the item order check use the greatest of them,
+		 * which are the ones that could violate those invariants.
+		 */
+		if (skey->heapkeyspace && BTreeTupleIsPosting(itup))
+			skey->scantid = BTreeTupleGetMaxHeapTID(itup);
+
 		/*
 		 * Make sure tuple size does not exceed the relevant BTREE_VERSION
 		 * specific limit.
@@ -1031,12 +1066,34 @@ bt_target_page_check(BtreeCheckState *state)
 		{
 			IndexTuple	norm;
 
-			norm = bt_normalize_tuple(state, itup);
-			bloom_add_element(state->filter, (unsigned char *) norm,
-							  IndexTupleSize(norm));
-			/* Be tidy */
-			if (norm != itup)
-				pfree(norm);
+			if (BTreeTupleIsPosting(itup))
+			{
+				/* Fingerprint each heap TID as a plain non-pivot tuple */
+				for (int i = 0; i < BTreeTupleGetNPosting(itup); i++)
+				{
+					IndexTuple	logtuple;
+
+					logtuple = _bt_form_posting(itup,
+												BTreeTupleGetPostingN(itup, i),
+												1);
+					norm = bt_normalize_tuple(state, logtuple);
+					bloom_add_element(state->filter, (unsigned char *) norm,
+									  IndexTupleSize(norm));
+					/* Be tidy */
+					if (norm != logtuple)
+						pfree(norm);
+					pfree(logtuple);
+				}
+			}
+			else
+			{
+				norm = bt_normalize_tuple(state, itup);
+				bloom_add_element(state->filter, (unsigned char *) norm,
+								  IndexTupleSize(norm));
+				/* Be tidy */
+				if (norm != itup)
+					pfree(norm);
+			}
 		}
 
 		/*
@@ -1911,9 +1968,10 @@ bt_tuple_present_callback(Relation index, HeapTuple htup, Datum *values,
  * datums with potentially distinct representations (e.g., btree/numeric_ops
  * index datums will not get their display scale normalized-away here).
  * Normalization may need to be expanded to handle more cases in the future,
- * though.  For example, it's possible that non-pivot tuples could in the
- * future have alternative logically equivalent representations due to using
- * the INDEX_ALT_TID_MASK bit to implement intelligent deduplication.
+ * though.
+ *
+ * Posting list tuples are never passed here: caller fingerprints each of
+ * their heap TIDs as a plain non-pivot tuple instead.
  */
 static IndexTuple
 bt_normalize_tuple(BtreeCheckState *state, IndexTuple itup)
@@ -1926,6 +1984,8 @@ bt_normalize_tuple(BtreeCheckState *state, IndexTuple itup)
 	IndexTuple	reformed;
 	int			i;
 
+	Assert(!BTreeTupleIsPosting(itup));
+
 	/* Easy case: It's immediately clear that tuple has no varlena datums */
 	if (!IndexTupleHasVarwidths(itup))
 		return itup;
@@ -2486,12 +2546,14 @@ PageGetItemIdCareful(BtreeCheckState *state, BlockNumber block, Page page,
 									ItemIdGetFlags(itemid))));
 
 	/*
-	 * Verify that line pointer isn't LP_REDIRECT or LP_UNUSED, since nbtree
-	 * never uses either.  Verify that line pointer has storage, too, since
-	 * even LP_DEAD items should within nbtree.
+	 * Verify that line pointer isn't LP_UNUSED, since nbtree never uses it.
+	 * LP_REDIRECT is only used to delete-mark tuples on leaf pages with
+	 * BTP_DELETE_MARKED set.  Verify that line pointer has storage, too,
+	 * since even LP_DEAD items should within nbtree.
 	 */
-	if (ItemIdIsRedirected(itemid) || !ItemIdIsUsed(itemid) ||
-		ItemIdGetLength(itemid) == 0)
+	if (!ItemIdIsUsed(itemid) || ItemIdGetLength(itemid) == 0 ||
+		(ItemIdIsRedirected(itemid) &&
+		 !P_HAS_DELETE_MARKED((BTPageOpaque) PageGetSpecialPointer(page))))
 		ereport(ERROR,
 				(errcode(ERRCODE_INDEX_CORRUPTED),
 				 errmsg("invalid line pointer storage in index \"%s\"",
@@ -2508,10 +2570,7 @@ PageGetItemIdCareful(BtreeCheckState *state, BlockNumber block, Page page,
  * BTreeTupleGetHeapTID() wrapper that lets caller enforce that a heap TID must
  * be present in cases where that is mandatory.
  *
- * This doesn't add much as of BTREE_VERSION 4, since the INDEX_ALT_TID_MASK
- * bit is effectively a proxy for whether or not the tuple is a pivot tuple.
- * It may become more useful in the future, when non-pivot tuples support their
- * own alternative INDEX_ALT_TID_MASK representation.
+ * For a posting list tuple, this is the first of its heap TIDs.
  */
 static inline ItemPointer
 BTreeTupleGetHeapTIDCareful(BtreeCheckState *state, IndexTuple itup,
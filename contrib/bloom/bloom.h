@@ -168,6 +168,8 @@ typedef struct BloomTuple
 typedef struct BloomScanOpaqueData
 {
 	BloomSignatureWord *sign;	/* Scan signature */
+	int		   *signWords;		/* indexes of nonzero words of sign */
+	int			nSignWords;		/* number of entries in signWords */
 	BloomState	state;
 } BloomScanOpaqueData;
 
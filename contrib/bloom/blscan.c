@@ -12,6 +12,8 @@
  */
 #include "postgres.h"
 
+#include <math.h>
+
 #include "access/relscan.h"
 #include "pgstat.h"
 #include "miscadmin.h"
@@ -19,6 +21,7 @@
 #include "storage/lmgr.h"
 #include "utils/memutils.h"
 #include "utils/rel.h"
+#include "utils/spccache.h"
 
 #include "bloom.h"
 
@@ -36,6 +39,8 @@ blbeginscan(Relation r, int nkeys, int norderbys)
 	so = (BloomScanOpaque) palloc(sizeof(BloomScanOpaqueData));
 	initBloomState(&so->state, scan->indexRelation);
 	so->sign = NULL;
+	so->signWords = NULL;
+	so->nSignWords = 0;
 
 	scan->opaque = so;
 
@@ -54,6 +59,9 @@ blrescan(IndexScanDesc scan, ScanKey scankey, int nscankeys,
 	if (so->sign)
 		pfree(so->sign);
 	so->sign = NULL;
+	if (so->signWords)
+		pfree(so->signWords);
+	so->signWords = NULL;
 
 	if (scankey && scan->numberOfKeys > 0)
 	{
@@ -73,6 +81,9 @@ blendscan(IndexScanDesc scan)
 	if (so->sign)
 		pfree(so->sign);
 	so->sign = NULL;
+	if (so->signWords)
+		pfree(so->signWords);
+	so->signWords = NULL;
 }
 
 /*
@@ -87,6 +98,11 @@ blgetbitmap(IndexScanDesc scan, TIDBitmap *tbm)
 	int			i;
 	BufferAccessStrategy bas;
 	BloomScanOpaque so = (BloomScanOpaque) scan->opaque;
+#ifdef USE_PREFETCH
+	BlockNumber prefetch_blkno;
+	int			prefetch_maximum = 0;
+	double		maximum;
+#endif
 
 	if (so->sign == NULL)
 	{
@@ -114,6 +130,19 @@ blgetbitmap(IndexScanDesc scan, TIDBitmap *tbm)
 
 			skey++;
 		}
+
+		/*
+		 * The scan signature has only a few bits set for each key, so most of
+		 * its words are zero and match any index tuple.  Remember which ones
+		 * are not, and check only those below.
+		 */
+		so->signWords = palloc(sizeof(int) * so->state.opts.bloomLength);
+		so->nSignWords = 0;
+		for (i = 0; i < so->state.opts.bloomLength; i++)
+		{
+			if (so->sign[i] != 0)
+				so->signWords[so->nSignWords++] = i;
+		}
 	}
 
 	/*
@@ -123,11 +152,34 @@ blgetbitmap(IndexScanDesc scan, TIDBitmap *tbm)
 	bas = GetAccessStrategy(BAS_BULKREAD);
 	npages = RelationGetNumberOfBlocks(scan->indexRelation);
 
+#ifdef USE_PREFETCH
+	/*
+	 * Keep prefetch_maximum pages ahead of the one being read, as many as
+	 * the tablespace's effective_io_concurrency asks for, so that reading
+	 * the index isn't left to the kernel's readahead alone.
+	 */
+	if (ComputeIoConcurrency(get_tablespace_io_concurrency(scan->indexRelation->rd_rel->reltablespace),
+							 &maximum))
+		prefetch_maximum = rint(maximum);
+
+	for (prefetch_blkno = BLOOM_HEAD_BLKNO;
+		 prefetch_blkno < npages &&
+		 prefetch_blkno < BLOOM_HEAD_BLKNO + prefetch_maximum;
+		 prefetch_blkno++)
+		PrefetchBuffer(scan->indexRelation, MAIN_FORKNUM, prefetch_blkno);
+#endif
+
 	for (blkno = BLOOM_HEAD_BLKNO; blkno < npages; blkno++)
 	{
 		Buffer		buffer;
 		Page		page;
 
+#ifdef USE_PREFETCH
+		/* Keep the prefetch window prefetch_maximum pages ahead. */
+		if (prefetch_maximum > 0 && prefetch_blkno < npages)
+			PrefetchBuffer(scan->indexRelation, MAIN_FORKNUM, prefetch_blkno++);
+#endif
+
 		buffer = ReadBufferExtended(scan->indexRelation, MAIN_FORKNUM,
 									blkno, RBM_NORMAL, bas);
 
@@ -143,20 +195,18 @@ blgetbitmap(IndexScanDesc scan, TIDBitmap *tbm)
 			for (offset = 1; offset <= maxOffset; offset++)
 			{
 				BloomTuple *itup = BloomPageGetTuple(&so->state, page, offset);
-				bool		res = true;
 
 				/* Check index signature with scan signature */
-				for (i = 0; i < so->state.opts.bloomLength; i++)
+				for (i = 0; i < so->nSignWords; i++)
 				{
-					if ((itup->sign[i] & so->sign[i]) != so->sign[i])
-					{
-						res = false;
+					int			w = so->signWords[i];
+
+					if ((itup->sign[w] & so->sign[w]) != so->sign[w])
 						break;
-					}
 				}
 
 				/* Add matching tuples to bitmap */
-				if (res)
+				if (i == so->nSignWords)
 				{
 					tbm_add_tuples(tbm, &itup->heapPtr, 1, true);
 					ntids++;
@@ -121,11 +121,13 @@ blhandler(PG_FUNCTION_ARGS)
 	amroutine->ampredlocks = false;
 	amroutine->amcanparallel = false;
 	amroutine->amcaninclude = false;
+	amroutine->amcandeletemark = false;
 	amroutine->amkeytype = InvalidOid;
 
 	amroutine->ambuild = blbuild;
 	amroutine->ambuildempty = blbuildempty;
 	amroutine->aminsert = blinsert;
+	amroutine->amdeletemark = NULL;
 	amroutine->ambulkdelete = blbulkdelete;
 	amroutine->amvacuumcleanup = blvacuumcleanup;
 	amroutine->amcanreturn = NULL;
@@ -216,27 +218,26 @@ static int32
 myRand(void)
 {
 	/*----------
-	 * Compute x = (7^5 * x) mod (2^31 - 1)
-	 * without overflowing 31 bits:
-	 *		(2^31 - 1) = 127773 * (7^5) + 2836
-	 * From "Random number generators: good ones are hard to find",
-	 * Park and Miller, Communications of the ACM, vol. 31, no. 10,
-	 * October 1988, p. 1195.
+	 * Compute x = (7^5 * x) mod (2^31 - 1), the generator from "Random
+	 * number generators: good ones are hard to find", Park and Miller,
+	 * Communications of the ACM, vol. 31, no. 10, October 1988, p. 1195.
+	 *
+	 * Since 2^31 is 1 modulo (2^31 - 1), the 64-bit product is reduced by
+	 * adding its bits above the 31st to the 31 below, which takes no
+	 * division and gives exactly the same sequence as before, so signatures
+	 * already on disk stay valid.
 	 *----------
 	 */
-	int32		hi,
-				lo,
-				x;
+	uint64		x;
 
 	/* Must be in [1, 0x7ffffffe] range at this point. */
-	hi = next / 127773;
-	lo = next % 127773;
-	x = 16807 * lo - 2836 * hi;
-	if (x < 0)
-		x += 0x7fffffff;
-	next = x;
+	x = (uint64) next * 16807;
+	x = (x & 0x7fffffff) + (x >> 31);
+	if (x >= 0x7fffffff)
+		x -= 0x7fffffff;
+	next = (int32) x;
 	/* Transform to [0, 0x7ffffffd] range. */
-	return (x - 1);
+	return (int32) x - 1;
 }
 
 static void
@@ -255,6 +256,7 @@ signValue(BloomState *state, BloomSignatureWord *sign, Datum value, int attno)
 {
 	uint32		hashVal;
 	int			nBit,
+				nBits = state->opts.bloomLength * SIGNWORDBITS,
 				j;
 
 	/*
@@ -275,7 +277,7 @@ signValue(BloomState *state, BloomSignatureWord *sign, Datum value, int attno)
 	for (j = 0; j < state->opts.bitSize[attno]; j++)
 	{
 		/* prevent multiple evaluation in SETBIT macro */
-		nBit = myRand() % (state->opts.bloomLength * SIGNWORDBITS);
+		nBit = myRand() % nBits;
 		SETBIT(sign, nBit);
 	}
 }
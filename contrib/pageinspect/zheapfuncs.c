@@ -186,16 +186,18 @@ zheap_page_items(PG_FUNCTION_ARGS)
 
 		/*
 		 * We cannot check whether this is a zheap page or not. But, we can
-		 * check whether pd_special is set correctly so that it contains the
-		 * expected number of transaction slots in the special space.
+		 * check whether pd_special is set correctly so that it contains a
+		 * valid number of transaction slots in the special space.
 		 */
 		num_trans_slots = (raw_page_size - ((PageHeader)
 											(inter_call_data->page))->pd_special)
 			/ sizeof(ZHeapPageOpaqueData);
 
-		if (num_trans_slots != ZHEAP_PAGE_TRANS_SLOTS)
-			elog(ERROR, "zheap page contains unexpected number of transaction"
-				 "slots: %d, expecting %d", num_trans_slots, ZHEAP_PAGE_TRANS_SLOTS);
+		if (num_trans_slots < ZHEAP_MIN_PAGE_TRANS_SLOTS ||
+			num_trans_slots > ZHEAP_MAX_PAGE_TRANS_SLOTS)
+			elog(ERROR, "zheap page contains unexpected number of transaction "
+				 "slots: %d, expecting between %d and %d", num_trans_slots,
+				 ZHEAP_MIN_PAGE_TRANS_SLOTS, ZHEAP_MAX_PAGE_TRANS_SLOTS);
 
 		MemoryContextSwitchTo(mctx);
 	}
@@ -371,16 +373,18 @@ zheap_page_slots(PG_FUNCTION_ARGS)
 
 		/*
 		 * We cannot check whether this is a zheap page or not. But, we can
-		 * check whether pd_special is set correctly so that it contains the
-		 * expected number of transaction slots in the special space.
+		 * check whether pd_special is set correctly so that it contains a
+		 * valid number of transaction slots in the special space.
 		 */
 		num_trans_slots = (raw_page_size - ((PageHeader)
 											(inter_call_data->page))->pd_special)
 			/ sizeof(ZHeapPageOpaqueData);
 
-		if (num_trans_slots != ZHEAP_PAGE_TRANS_SLOTS)
-			elog(ERROR, "zheap page contains unexpected number of transaction"
-				 "slots: %d, expecting %d", num_trans_slots, ZHEAP_PAGE_TRANS_SLOTS);
+		if (num_trans_slots < ZHEAP_MIN_PAGE_TRANS_SLOTS ||
+			num_trans_slots > ZHEAP_MAX_PAGE_TRANS_SLOTS)
+			elog(ERROR, "zheap page contains unexpected number of transaction "
+				 "slots: %d, expecting between %d and %d", num_trans_slots,
+				 ZHEAP_MIN_PAGE_TRANS_SLOTS, ZHEAP_MAX_PAGE_TRANS_SLOTS);
 
 		/*
 		 * If the page has tpd slot, last slot is used as tpd slot. In that
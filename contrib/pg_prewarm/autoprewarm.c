@@ -10,11 +10,20 @@
  *		and we need to lock the relations so that we don't try to prewarm
  *		pages from a relation that is in the process of being dropped.
  *
- *		While prewarming, autoprewarm will use two workers.  There's a
- *		master worker that reads and sorts the list of blocks to be
- *		prewarmed and then launches a per-database worker for each
- *		relevant database in turn.  The former keeps running after the
- *		initial prewarm is complete to update the dump file periodically.
+ *		While prewarming, there's a master worker that reads and sorts the
+ *		list of blocks to be prewarmed and then launches per-database
+ *		workers for each relevant database in turn.  Up to
+ *		pg_prewarm.autoprewarm_workers of them share the blocks of one
+ *		database, claiming them in chunks.  The master keeps running after
+ *		the initial prewarm is complete to update the dump file
+ *		periodically.
+ *
+ *		Undo log blocks are reloaded before anything else, followed by the
+ *		TPD pages of each database, because the first queries after a
+ *		restart otherwise spend their time reading back the undo and TPD
+ *		entries needed to check the visibility of zheap tuples.  Undo
+ *		doesn't belong to any database, so the workers that load it don't
+ *		connect to one.
  *
  *	Copyright (c) 2016-2019, PostgreSQL Global Development Group
  *
@@ -29,6 +38,8 @@
 #include <unistd.h>
 
 #include "access/relation.h"
+#include "access/tpd.h"
+#include "access/undolog.h"
 #include "access/xact.h"
 #include "catalog/pg_class.h"
 #include "catalog/pg_type.h"
@@ -54,6 +65,23 @@
 
 #define AUTOPREWARM_FILE "autoprewarm.blocks"
 
+/* Number of blocks a per-database worker claims at a time. */
+#define AUTOPREWARM_CHUNK_BLOCKS	1024
+
+/* Upper limit for pg_prewarm.autoprewarm_workers. */
+#define MAX_AUTOPREWARM_WORKERS		64
+
+/*
+ * Kinds of block we dump, in the order in which they're reloaded within a
+ * database.  Undo blocks are reloaded before those of any database.
+ */
+typedef enum BlockInfoKind
+{
+	BLOCKINFO_UNDO = 0,			/* undo log block */
+	BLOCKINFO_TPD,				/* page that looks like a zheap TPD page */
+	BLOCKINFO_RELATION			/* any other relation block */
+} BlockInfoKind;
+
 /* Metadata for each block we dump. */
 typedef struct BlockInfoRecord
 {
@@ -62,6 +90,7 @@ typedef struct BlockInfoRecord
 	Oid			filenode;
 	ForkNumber	forknum;
 	BlockNumber blocknum;
+	BlockInfoKind kind;
 } BlockInfoRecord;
 
 /* Shared state information for autoprewarm bgworker. */
@@ -71,12 +100,13 @@ typedef struct AutoPrewarmSharedState
 	pid_t		bgworker_pid;	/* for main bgworker */
 	pid_t		pid_using_dumpfile; /* for autoprewarm or block dump */
 
-	/* Following items are for communication with per-database worker */
+	/* Following items are for communication with per-database workers */
 	dsm_handle	block_info_handle;
 	Oid			database;
 	int			prewarm_start_idx;
 	int			prewarm_stop_idx;
-	int			prewarmed_blocks;
+	pg_atomic_uint32 prewarm_next_idx;	/* first block not yet claimed */
+	pg_atomic_uint32 prewarmed_blocks;
 } AutoPrewarmSharedState;
 
 void		_PG_init(void);
@@ -89,7 +119,12 @@ PG_FUNCTION_INFO_V1(autoprewarm_dump_now);
 static void apw_load_buffers(void);
 static int	apw_dump_now(bool is_bgworker, bool dump_unlogged);
 static void apw_start_master_worker(void);
-static void apw_start_database_worker(void);
+static void apw_start_database_workers(int nworkers);
+static int	apw_prewarm_relation_blocks(BlockInfoRecord *block_info,
+										int pos, int stop);
+static int	apw_prewarm_undo_blocks(BlockInfoRecord *block_info,
+									int pos, int stop);
+static UndoLogControl *apw_undo_block_is_live(BlockInfoRecord *blk);
 static bool apw_init_shmem(void);
 static void apw_detach_shmem(int code, Datum arg);
 static int	apw_compare_blockinfo(const void *p, const void *q);
@@ -106,6 +141,7 @@ static AutoPrewarmSharedState *apw_state = NULL;
 /* GUC variables. */
 static bool autoprewarm = true; /* start worker? */
 static int	autoprewarm_interval;	/* dump interval */
+static int	autoprewarm_workers;	/* workers per database while loading */
 
 /*
  * Module load callback.
@@ -125,6 +161,18 @@ _PG_init(void)
 							NULL,
 							NULL);
 
+	DefineCustomIntVariable("pg_prewarm.autoprewarm_workers",
+							"Sets the number of workers that reload the blocks of each database.",
+							NULL,
+							&autoprewarm_workers,
+							2,
+							1, MAX_AUTOPREWARM_WORKERS,
+							PGC_SIGHUP,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
 	if (!process_shared_preload_libraries_in_progress)
 		return;
 
@@ -324,18 +372,35 @@ apw_load_buffers(void)
 	seg = dsm_create(sizeof(BlockInfoRecord) * num_elements, 0);
 	blkinfo = (BlockInfoRecord *) dsm_segment_address(seg);
 
-	/* Read records, one per line. */
+	/*
+	 * Read records, one per line.  Files written before the block kind was
+	 * recorded have only five fields; undo blocks can still be recognized by
+	 * their database, but TPD pages can't.
+	 */
 	for (i = 0; i < num_elements; i++)
 	{
+		char		line[128];
 		unsigned	forknum;
+		unsigned	kind;
+		int			nfields;
 
-		if (fscanf(file, "%u,%u,%u,%u,%u\n", &blkinfo[i].database,
-				   &blkinfo[i].tablespace, &blkinfo[i].filenode,
-				   &forknum, &blkinfo[i].blocknum) != 5)
+		if (fgets(line, sizeof(line), file) == NULL)
+			nfields = 0;
+		else
+			nfields = sscanf(line, "%u,%u,%u,%u,%u,%u", &blkinfo[i].database,
+							 &blkinfo[i].tablespace, &blkinfo[i].filenode,
+							 &forknum, &blkinfo[i].blocknum, &kind);
+		if (nfields == 5)
+			kind = (blkinfo[i].database == UndoLogDatabaseOid) ?
+				BLOCKINFO_UNDO : BLOCKINFO_RELATION;
+		else if (nfields != 6 || kind > BLOCKINFO_RELATION ||
+				 (kind == BLOCKINFO_UNDO) !=
+				 (blkinfo[i].database == UndoLogDatabaseOid))
 			ereport(ERROR,
 					(errmsg("autoprewarm block dump file is corrupted at line %d",
 							i + 1)));
 		blkinfo[i].forknum = forknum;
+		blkinfo[i].kind = (BlockInfoKind) kind;
 	}
 
 	FreeFile(file);
@@ -347,17 +412,19 @@ apw_load_buffers(void)
 	/* Populate shared memory state. */
 	apw_state->block_info_handle = dsm_segment_handle(seg);
 	apw_state->prewarm_start_idx = apw_state->prewarm_stop_idx = 0;
-	apw_state->prewarmed_blocks = 0;
+	pg_atomic_write_u32(&apw_state->prewarmed_blocks, 0);
 
 	/* Get the info position of the first block of the next database. */
 	while (apw_state->prewarm_start_idx < num_elements)
 	{
 		int			j = apw_state->prewarm_start_idx;
 		Oid			current_db = blkinfo[j].database;
+		int			nworkers;
 
 		/*
 		 * Advance the prewarm_stop_idx to the first BlockRecordInfo that does
-		 * not belong to this database.
+		 * not belong to this database.  Undo blocks sort first and, having
+		 * a pseudo-database of their own, form a group by themselves.
 		 */
 		j++;
 		while (j < num_elements)
@@ -384,20 +451,27 @@ apw_load_buffers(void)
 		if (current_db == InvalidOid)
 			break;
 
-		/* Configure stop point and database for next per-database worker. */
+		/* Configure stop point and database for next per-database workers. */
 		apw_state->prewarm_stop_idx = j;
 		apw_state->database = current_db;
+		pg_atomic_write_u32(&apw_state->prewarm_next_idx,
+							apw_state->prewarm_start_idx);
 		Assert(apw_state->prewarm_start_idx < apw_state->prewarm_stop_idx);
 
 		/* If we've run out of free buffers, don't launch another worker. */
 		if (!have_free_buffer())
 			break;
 
+		/* There's no point in having more workers than chunks. */
+		nworkers = (apw_state->prewarm_stop_idx - apw_state->prewarm_start_idx +
+					AUTOPREWARM_CHUNK_BLOCKS - 1) / AUTOPREWARM_CHUNK_BLOCKS;
+		nworkers = Min(nworkers, autoprewarm_workers);
+
 		/*
-		 * Start a per-database worker to load blocks for this database; this
-		 * function will return once the per-database worker exits.
+		 * Start per-database workers to load blocks for this database; this
+		 * function will return once all of them have exited.
 		 */
-		apw_start_database_worker();
+		apw_start_database_workers(nworkers);
 
 		/* Prepare for next database. */
 		apw_state->prewarm_start_idx = apw_state->prewarm_stop_idx;
@@ -412,23 +486,25 @@ apw_load_buffers(void)
 
 	/* Report our success. */
 	ereport(LOG,
-			(errmsg("autoprewarm successfully prewarmed %d of %d previously-loaded blocks",
-					apw_state->prewarmed_blocks, num_elements)));
+			(errmsg("autoprewarm successfully prewarmed %u of %d previously-loaded blocks",
+					pg_atomic_read_u32(&apw_state->prewarmed_blocks),
+					num_elements)));
 }
 
 /*
  * Prewarm all blocks for one database (and possibly also global objects, if
- * those got grouped with this database).
+ * those got grouped with this database), or all undo blocks.  Several
+ * workers may be running for the same database; each claims chunks of the
+ * block list until there are none left.
  */
 void
 autoprewarm_database_main(Datum main_arg)
 {
-	int			pos;
 	BlockInfoRecord *block_info;
-	Relation	rel = NULL;
-	BlockNumber nblocks = 0;
-	BlockInfoRecord *old_blk = NULL;
 	dsm_segment *seg;
+	bool		is_undo;
+	uint32		pos;
+	int			prewarmed;
 
 	/* Establish signal handlers; once that's done, unblock signals. */
 	pqsignal(SIGTERM, die);
@@ -441,15 +517,54 @@ autoprewarm_database_main(Datum main_arg)
 		ereport(ERROR,
 				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
 				 errmsg("could not map dynamic shared memory segment")));
-	BackgroundWorkerInitializeConnectionByOid(apw_state->database, InvalidOid, 0);
 	block_info = (BlockInfoRecord *) dsm_segment_address(seg);
-	pos = apw_state->prewarm_start_idx;
+
+	/*
+	 * Undo logs don't belong to any database, so there's nothing to connect
+	 * to, but we still need a resource owner to keep track of buffer pins.
+	 */
+	is_undo = (apw_state->database == UndoLogDatabaseOid);
+	if (is_undo)
+		CurrentResourceOwner = ResourceOwnerCreate(NULL, "autoprewarm");
+	else
+		BackgroundWorkerInitializeConnectionByOid(apw_state->database,
+												  InvalidOid, 0);
 
 	/*
 	 * Loop until we run out of blocks to prewarm or until we run out of free
 	 * buffers.
 	 */
-	while (pos < apw_state->prewarm_stop_idx && have_free_buffer())
+	while ((pos = pg_atomic_fetch_add_u32(&apw_state->prewarm_next_idx,
+										  AUTOPREWARM_CHUNK_BLOCKS)) <
+		   (uint32) apw_state->prewarm_stop_idx &&
+		   have_free_buffer())
+	{
+		int			stop = Min(pos + AUTOPREWARM_CHUNK_BLOCKS,
+							   (uint32) apw_state->prewarm_stop_idx);
+
+		if (is_undo)
+			prewarmed = apw_prewarm_undo_blocks(block_info, pos, stop);
+		else
+			prewarmed = apw_prewarm_relation_blocks(block_info, pos, stop);
+		pg_atomic_fetch_add_u32(&apw_state->prewarmed_blocks, prewarmed);
+	}
+
+	dsm_detach(seg);
+}
+
+/*
+ * Prewarm the relation blocks from pos up to stop, returning the number of
+ * blocks read.
+ */
+static int
+apw_prewarm_relation_blocks(BlockInfoRecord *block_info, int pos, int stop)
+{
+	Relation	rel = NULL;
+	BlockNumber nblocks = 0;
+	BlockInfoRecord *old_blk = NULL;
+	int			prewarmed = 0;
+
+	while (pos < stop && have_free_buffer())
 	{
 		BlockInfoRecord *blk = &block_info[pos++];
 		Buffer		buf;
@@ -532,21 +647,98 @@ autoprewarm_database_main(Datum main_arg)
 								 NULL);
 		if (BufferIsValid(buf))
 		{
-			apw_state->prewarmed_blocks++;
+			prewarmed++;
 			ReleaseBuffer(buf);
 		}
 
 		old_blk = blk;
 	}
 
-	dsm_detach(seg);
-
 	/* Release lock on previous relation. */
 	if (rel)
 	{
 		relation_close(rel, AccessShareLock);
 		CommitTransactionCommand();
 	}
+
+	return prewarmed;
+}
+
+/*
+ * Prewarm the undo blocks from pos up to stop, returning the number of
+ * blocks read.  Blocks that have been discarded since the dump are skipped;
+ * we hold the log's discard_lock while reading so that the discard worker
+ * can't remove the segment from under us.
+ */
+static int
+apw_prewarm_undo_blocks(BlockInfoRecord *block_info, int pos, int stop)
+{
+	int			prewarmed = 0;
+
+	while (pos < stop && have_free_buffer())
+	{
+		BlockInfoRecord *blk = &block_info[pos++];
+		UndoLogControl *log;
+		RelFileNode rnode;
+		Buffer		buf;
+
+		CHECK_FOR_INTERRUPTS();
+
+		Assert(blk->kind == BLOCKINFO_UNDO);
+		log = apw_undo_block_is_live(blk);
+		if (log == NULL)
+			continue;
+
+		LWLockAcquire(&log->discard_lock, LW_SHARED);
+		if (apw_undo_block_is_live(blk) != NULL)
+		{
+			rnode.spcNode = blk->tablespace;
+			rnode.dbNode = UndoLogDatabaseOid;
+			rnode.relNode = blk->filenode;
+			buf = ReadBufferWithoutRelcache(rnode, UndoLogForkNum,
+											blk->blocknum, RBM_NORMAL, NULL,
+											RelPersistenceForUndoPersistence(log->meta.persistence));
+			if (BufferIsValid(buf))
+			{
+				prewarmed++;
+				ReleaseBuffer(buf);
+			}
+		}
+		LWLockRelease(&log->discard_lock);
+	}
+
+	return prewarmed;
+}
+
+/*
+ * Check whether an undo block still holds undo that we might need, that is
+ * whether it overlaps the range between its log's discard and insert
+ * pointers.  Returns the log's control object if so, or NULL.
+ */
+static UndoLogControl *
+apw_undo_block_is_live(BlockInfoRecord *blk)
+{
+	UndoLogControl *log;
+	UndoLogOffset start = (UndoLogOffset) blk->blocknum * BLCKSZ;
+	bool		live;
+
+	if (blk->filenode >= ((Oid) 1 << UndoLogNumberBits) ||
+		blk->forknum != UndoLogForkNum)
+		return NULL;
+	log = UndoLogGet((UndoLogNumber) blk->filenode);
+	if (log == NULL)
+		return NULL;
+
+	LWLockAcquire(&log->mutex, LW_SHARED);
+	live = (log->logno == (UndoLogNumber) blk->filenode &&
+			log->meta.status != UNDO_LOG_STATUS_UNUSED &&
+			log->meta.persistence != UNDO_TEMP &&
+			log->meta.tablespace == blk->tablespace &&
+			start + BLCKSZ > log->meta.discard &&
+			start < log->meta.insert);
+	LWLockRelease(&log->mutex);
+
+	return live ? log : NULL;
 }
 
 /*
@@ -559,7 +751,8 @@ static int
 apw_dump_now(bool is_bgworker, bool dump_unlogged)
 {
 	int			num_blocks;
-	int			i;
+	int			i,
+				j;
 	int			ret;
 	BlockInfoRecord *block_info_array;
 	BufferDesc *bufHdr;
@@ -613,12 +806,41 @@ apw_dump_now(bool is_bgworker, bool dump_unlogged)
 			block_info_array[num_blocks].filenode = bufHdr->tag.rnode.relNode;
 			block_info_array[num_blocks].forknum = bufHdr->tag.forkNum;
 			block_info_array[num_blocks].blocknum = bufHdr->tag.blockNum;
+
+			/*
+			 * Peeking at the special space size without a content lock is
+			 * good enough here, since it doesn't change while the page is in
+			 * use and we only use it to decide what to reload first.  Index
+			 * pages of some access methods look the same, but promoting
+			 * those does no harm.
+			 */
+			if (bufHdr->tag.rnode.dbNode == UndoLogDatabaseOid)
+				block_info_array[num_blocks].kind = BLOCKINFO_UNDO;
+			else if (bufHdr->tag.forkNum == MAIN_FORKNUM &&
+					 (buf_state & BM_VALID) &&
+					 IsTPDPage(BufferGetPage(BufferDescriptorGetBuffer(bufHdr))))
+				block_info_array[num_blocks].kind = BLOCKINFO_TPD;
+			else
+				block_info_array[num_blocks].kind = BLOCKINFO_RELATION;
 			++num_blocks;
 		}
 
 		UnlockBufHdr(bufHdr, buf_state);
 	}
 
+	/*
+	 * Undo blocks that have already been discarded will never be needed
+	 * again, so leave them out.
+	 */
+	for (i = 0, j = 0; i < num_blocks; i++)
+	{
+		if (block_info_array[i].kind == BLOCKINFO_UNDO &&
+			apw_undo_block_is_live(&block_info_array[i]) == NULL)
+			continue;
+		block_info_array[j++] = block_info_array[i];
+	}
+	num_blocks = j;
+
 	snprintf(transient_dump_file_path, MAXPGPATH, "%s.tmp", AUTOPREWARM_FILE);
 	file = AllocateFile(transient_dump_file_path, "w");
 	if (!file)
@@ -645,12 +867,13 @@ apw_dump_now(bool is_bgworker, bool dump_unlogged)
 	{
 		CHECK_FOR_INTERRUPTS();
 
-		ret = fprintf(file, "%u,%u,%u,%u,%u\n",
+		ret = fprintf(file, "%u,%u,%u,%u,%u,%u\n",
 					  block_info_array[i].database,
 					  block_info_array[i].tablespace,
 					  block_info_array[i].filenode,
 					  (uint32) block_info_array[i].forknum,
-					  block_info_array[i].blocknum);
+					  block_info_array[i].blocknum,
+					  (uint32) block_info_array[i].kind);
 		if (ret < 0)
 		{
 			int			save_errno = errno;
@@ -763,6 +986,8 @@ apw_init_shmem(void)
 		LWLockInitialize(&apw_state->lock, LWLockNewTrancheId());
 		apw_state->bgworker_pid = InvalidPid;
 		apw_state->pid_using_dumpfile = InvalidPid;
+		pg_atomic_init_u32(&apw_state->prewarm_next_idx, 0);
+		pg_atomic_init_u32(&apw_state->prewarmed_blocks, 0);
 	}
 	LWLockRelease(AddinShmemInitLock);
 
@@ -828,13 +1053,17 @@ apw_start_master_worker(void)
 }
 
 /*
- * Start autoprewarm per-database worker process.
+ * Start autoprewarm per-database worker processes, and wait for them to exit.
  */
 static void
-apw_start_database_worker(void)
+apw_start_database_workers(int nworkers)
 {
 	BackgroundWorker worker;
-	BackgroundWorkerHandle *handle;
+	BackgroundWorkerHandle *handles[MAX_AUTOPREWARM_WORKERS];
+	int			nlaunched;
+	int			i;
+
+	Assert(nworkers > 0 && nworkers <= MAX_AUTOPREWARM_WORKERS);
 
 	MemSet(&worker, 0, sizeof(BackgroundWorker));
 	worker.bgw_flags =
@@ -849,17 +1078,26 @@ apw_start_database_worker(void)
 	/* must set notify PID to wait for shutdown */
 	worker.bgw_notify_pid = MyProcPid;
 
-	if (!RegisterDynamicBackgroundWorker(&worker, &handle))
-		ereport(ERROR,
-				(errcode(ERRCODE_INSUFFICIENT_RESOURCES),
-				 errmsg("registering dynamic bgworker autoprewarm failed"),
-				 errhint("Consider increasing configuration parameter \"max_worker_processes\".")));
+	/* We can make do with fewer workers than requested, but not with none. */
+	for (nlaunched = 0; nlaunched < nworkers; nlaunched++)
+	{
+		if (!RegisterDynamicBackgroundWorker(&worker, &handles[nlaunched]))
+		{
+			if (nlaunched > 0)
+				break;
+			ereport(ERROR,
+					(errcode(ERRCODE_INSUFFICIENT_RESOURCES),
+					 errmsg("registering dynamic bgworker autoprewarm failed"),
+					 errhint("Consider increasing configuration parameter \"max_worker_processes\".")));
+		}
+	}
 
 	/*
 	 * Ignore return value; if it fails, postmaster has died, but we have
 	 * checks for that elsewhere.
 	 */
-	WaitForBackgroundWorkerShutdown(handle);
+	for (i = 0; i < nlaunched; i++)
+		WaitForBackgroundWorkerShutdown(handles[i]);
 }
 
 /* Compare member elements to check whether they are not equal. */
@@ -876,9 +1114,11 @@ do { \
  *
  * We depend on all records for a particular database being consecutive
  * in the dump file; each per-database worker will preload blocks until
- * it sees a block for some other database.  Sorting by tablespace,
- * filenode, forknum, and blocknum isn't critical for correctness, but
- * helps us get a sequential I/O pattern.
+ * it sees a block for some other database.  Undo blocks go first, and
+ * within each database TPD pages come before the rest, so that they're
+ * reloaded first.  Sorting by tablespace, filenode, forknum, and blocknum
+ * isn't critical for correctness, but helps us get a sequential I/O
+ * pattern.
  */
 static int
 apw_compare_blockinfo(const void *p, const void *q)
@@ -886,7 +1126,10 @@ apw_compare_blockinfo(const void *p, const void *q)
 	const BlockInfoRecord *a = (const BlockInfoRecord *) p;
 	const BlockInfoRecord *b = (const BlockInfoRecord *) q;
 
+	if ((a->kind == BLOCKINFO_UNDO) != (b->kind == BLOCKINFO_UNDO))
+		return (a->kind == BLOCKINFO_UNDO) ? -1 : 1;
 	cmp_member_elem(database);
+	cmp_member_elem(kind);
 	cmp_member_elem(tablespace);
 	cmp_member_elem(filenode);
 	cmp_member_elem(forknum);
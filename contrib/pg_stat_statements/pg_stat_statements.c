@@ -96,7 +96,7 @@ PG_MODULE_MAGIC;
 #define PGSS_TEXT_FILE	PG_STAT_TMP_DIR "/pgss_query_texts.stat"
 
 /* Magic number identifying the stats file format */
-static const uint32 PGSS_FILE_HEADER = 0x20171004;
+static const uint32 PGSS_FILE_HEADER = 0x20190524;
 
 /* PostgreSQL major version number, changes in which invalidate all entries */
 static const uint32 PGSS_PG_MAJOR_VERSION = PG_VERSION_NUM / 100;
@@ -120,7 +120,8 @@ typedef enum pgssVersion
 	PGSS_V1_0 = 0,
 	PGSS_V1_1,
 	PGSS_V1_2,
-	PGSS_V1_3
+	PGSS_V1_3,
+	PGSS_V1_8
 } pgssVersion;
 
 /*
@@ -163,6 +164,11 @@ typedef struct Counters
 	int64		temp_blks_written;	/* # of temp blocks written */
 	double		blk_read_time;	/* time spent reading, in msec */
 	double		blk_write_time; /* time spent writing, in msec */
+	int64		wal_records;	/* # of WAL records generated */
+	int64		wal_fpi;		/* # of WAL full page images generated */
+	uint64		wal_bytes;		/* total amount of WAL generated, in bytes */
+	int64		undo_records;	/* # of undo records generated */
+	uint64		undo_bytes;		/* total amount of undo generated, in bytes */
 	double		usage;			/* usage factor */
 } Counters;
 
@@ -293,6 +299,7 @@ PG_FUNCTION_INFO_V1(pg_stat_statements_reset);
 PG_FUNCTION_INFO_V1(pg_stat_statements_reset_1_7);
 PG_FUNCTION_INFO_V1(pg_stat_statements_1_2);
 PG_FUNCTION_INFO_V1(pg_stat_statements_1_3);
+PG_FUNCTION_INFO_V1(pg_stat_statements_1_8);
 PG_FUNCTION_INFO_V1(pg_stat_statements);
 
 static void pgss_shmem_startup(void);
@@ -1034,6 +1041,12 @@ pgss_ProcessUtility(PlannedStmt *pstmt, const char *queryString,
 			pgBufferUsage.shared_blks_dirtied - bufusage_start.shared_blks_dirtied;
 		bufusage.shared_blks_written =
 			pgBufferUsage.shared_blks_written - bufusage_start.shared_blks_written;
+		bufusage.undo_blks_hit =
+			pgBufferUsage.undo_blks_hit - bufusage_start.undo_blks_hit;
+		bufusage.undo_blks_read =
+			pgBufferUsage.undo_blks_read - bufusage_start.undo_blks_read;
+		bufusage.undo_blks_dirtied =
+			pgBufferUsage.undo_blks_dirtied - bufusage_start.undo_blks_dirtied;
 		bufusage.local_blks_hit =
 			pgBufferUsage.local_blks_hit - bufusage_start.local_blks_hit;
 		bufusage.local_blks_read =
@@ -1046,6 +1059,16 @@ pgss_ProcessUtility(PlannedStmt *pstmt, const char *queryString,
 			pgBufferUsage.temp_blks_read - bufusage_start.temp_blks_read;
 		bufusage.temp_blks_written =
 			pgBufferUsage.temp_blks_written - bufusage_start.temp_blks_written;
+		bufusage.undo_records =
+			pgBufferUsage.undo_records - bufusage_start.undo_records;
+		bufusage.undo_bytes =
+			pgBufferUsage.undo_bytes - bufusage_start.undo_bytes;
+		bufusage.wal_records =
+			pgBufferUsage.wal_records - bufusage_start.wal_records;
+		bufusage.wal_fpi =
+			pgBufferUsage.wal_fpi - bufusage_start.wal_fpi;
+		bufusage.wal_bytes =
+			pgBufferUsage.wal_bytes - bufusage_start.wal_bytes;
 		bufusage.blk_read_time = pgBufferUsage.blk_read_time;
 		INSTR_TIME_SUBTRACT(bufusage.blk_read_time, bufusage_start.blk_read_time);
 		bufusage.blk_write_time = pgBufferUsage.blk_write_time;
@@ -1278,9 +1301,13 @@ pgss_store(const char *query, uint64 queryId,
 				e->counters.max_time = total_time;
 		}
 		e->counters.rows += rows;
-		e->counters.shared_blks_hit += bufusage->shared_blks_hit;
-		e->counters.shared_blks_read += bufusage->shared_blks_read;
-		e->counters.shared_blks_dirtied += bufusage->shared_blks_dirtied;
+		/* undo blocks live in shared buffers too, so count them as shared */
+		e->counters.shared_blks_hit += bufusage->shared_blks_hit +
+			bufusage->undo_blks_hit;
+		e->counters.shared_blks_read += bufusage->shared_blks_read +
+			bufusage->undo_blks_read;
+		e->counters.shared_blks_dirtied += bufusage->shared_blks_dirtied +
+			bufusage->undo_blks_dirtied;
 		e->counters.shared_blks_written += bufusage->shared_blks_written;
 		e->counters.local_blks_hit += bufusage->local_blks_hit;
 		e->counters.local_blks_read += bufusage->local_blks_read;
@@ -1290,6 +1317,11 @@ pgss_store(const char *query, uint64 queryId,
 		e->counters.temp_blks_written += bufusage->temp_blks_written;
 		e->counters.blk_read_time += INSTR_TIME_GET_MILLISEC(bufusage->blk_read_time);
 		e->counters.blk_write_time += INSTR_TIME_GET_MILLISEC(bufusage->blk_write_time);
+		e->counters.wal_records += bufusage->wal_records;
+		e->counters.wal_fpi += bufusage->wal_fpi;
+		e->counters.wal_bytes += bufusage->wal_bytes;
+		e->counters.undo_records += bufusage->undo_records;
+		e->counters.undo_bytes += bufusage->undo_bytes;
 		e->counters.usage += USAGE_EXEC(total_time);
 
 		SpinLockRelease(&e->mutex);
@@ -1338,7 +1370,8 @@ pg_stat_statements_reset(PG_FUNCTION_ARGS)
 #define PG_STAT_STATEMENTS_COLS_V1_1	18
 #define PG_STAT_STATEMENTS_COLS_V1_2	19
 #define PG_STAT_STATEMENTS_COLS_V1_3	23
-#define PG_STAT_STATEMENTS_COLS			23	/* maximum of above */
+#define PG_STAT_STATEMENTS_COLS_V1_8	28
+#define PG_STAT_STATEMENTS_COLS			28	/* maximum of above */
 
 /*
  * Retrieve statement statistics.
@@ -1350,6 +1383,16 @@ pg_stat_statements_reset(PG_FUNCTION_ARGS)
  * expected API version is identified by embedding it in the C name of the
  * function.  Unfortunately we weren't bright enough to do that for 1.1.
  */
+Datum
+pg_stat_statements_1_8(PG_FUNCTION_ARGS)
+{
+	bool		showtext = PG_GETARG_BOOL(0);
+
+	pg_stat_statements_internal(fcinfo, PGSS_V1_8, showtext);
+
+	return (Datum) 0;
+}
+
 Datum
 pg_stat_statements_1_3(PG_FUNCTION_ARGS)
 {
@@ -1456,6 +1499,10 @@ pg_stat_statements_internal(FunctionCallInfo fcinfo,
 			if (api_version != PGSS_V1_3)
 				elog(ERROR, "incorrect number of output arguments");
 			break;
+		case PG_STAT_STATEMENTS_COLS_V1_8:
+			if (api_version != PGSS_V1_8)
+				elog(ERROR, "incorrect number of output arguments");
+			break;
 		default:
 			elog(ERROR, "incorrect number of output arguments");
 	}
@@ -1652,11 +1699,32 @@ pg_stat_statements_internal(FunctionCallInfo fcinfo,
 			values[i++] = Float8GetDatumFast(tmp.blk_read_time);
 			values[i++] = Float8GetDatumFast(tmp.blk_write_time);
 		}
+		if (api_version >= PGSS_V1_8)
+		{
+			char		buf[256];
+
+			values[i++] = Int64GetDatumFast(tmp.wal_records);
+			values[i++] = Int64GetDatumFast(tmp.wal_fpi);
+
+			/* The byte counts are unsigned, so show them as numeric. */
+			snprintf(buf, sizeof buf, UINT64_FORMAT, tmp.wal_bytes);
+			values[i++] = DirectFunctionCall3(numeric_in,
+											  CStringGetDatum(buf),
+											  ObjectIdGetDatum(0),
+											  Int32GetDatum(-1));
+			values[i++] = Int64GetDatumFast(tmp.undo_records);
+			snprintf(buf, sizeof buf, UINT64_FORMAT, tmp.undo_bytes);
+			values[i++] = DirectFunctionCall3(numeric_in,
+											  CStringGetDatum(buf),
+											  ObjectIdGetDatum(0),
+											  Int32GetDatum(-1));
+		}
 
 		Assert(i == (api_version == PGSS_V1_0 ? PG_STAT_STATEMENTS_COLS_V1_0 :
 					 api_version == PGSS_V1_1 ? PG_STAT_STATEMENTS_COLS_V1_1 :
 					 api_version == PGSS_V1_2 ? PG_STAT_STATEMENTS_COLS_V1_2 :
 					 api_version == PGSS_V1_3 ? PG_STAT_STATEMENTS_COLS_V1_3 :
+					 api_version == PGSS_V1_8 ? PG_STAT_STATEMENTS_COLS_V1_8 :
 					 -1 /* fail if you forget to update this assert */ ));
 
 		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
@@ -253,6 +253,23 @@ SELECT query, calls, rows FROM pg_stat_statements ORDER BY query COLLATE "C";
 SELECT pg_stat_statements_reset(0,0,0);
 SELECT query, calls, rows FROM pg_stat_statements ORDER BY query COLLATE "C";
 
+--
+-- WAL and undo generated by statements
+--
+SET pg_stat_statements.track_utility = FALSE;
+SELECT pg_stat_statements_reset();
+CREATE TABLE pgss_wal_tab (a int, b text) USING zheap;
+INSERT INTO pgss_wal_tab SELECT generate_series(1, 10), 'aaa';
+UPDATE pgss_wal_tab SET b = 'bbb' WHERE a > 5;
+DELETE FROM pgss_wal_tab WHERE a > 9;
+SELECT query, calls, rows,
+  wal_records > 0 AS wal_records_generated,
+  wal_bytes > 0 AS wal_bytes_generated,
+  undo_records > 0 AS undo_records_generated,
+  undo_bytes > 0 AS undo_bytes_generated
+  FROM pg_stat_statements ORDER BY query COLLATE "C";
+DROP TABLE pgss_wal_tab;
+
 --
 -- cleanup
 --
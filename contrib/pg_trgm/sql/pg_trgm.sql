@@ -155,3 +155,9 @@ SELECT DISTINCT city, similarity(city, 'Warsaw'), show_limit()
 SELECT set_limit(0.5);
 SELECT DISTINCT city, similarity(city, 'Warsaw'), show_limit()
   FROM restaurants WHERE city % 'Warsaw';
+
+-- The trigrams of the second argument are reused while it stays the same
+SELECT a, b, similarity(a, b), a % b AS sim
+  FROM (VALUES ('Warsaw', 'Warsaw'), ('warsaw', 'Warsaw'),
+               ('Warszawa', 'Warsaw'), ('Szczecin', 'Warsaw'),
+               ('foo-bar 42', 'bar foo 42'), ('Warsaw', 'bar foo 42')) v(a, b);
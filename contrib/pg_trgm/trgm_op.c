@@ -8,6 +8,7 @@
 #include "trgm.h"
 
 #include "catalog/pg_type.h"
+#include "port/simd.h"
 #include "tsearch/ts_locale.h"
 #include "utils/lsyscache.h"
 #include "utils/memutils.h"
@@ -48,6 +49,29 @@ typedef struct
 
 /* Trigram bound type */
 typedef uint8 TrgmBound;
+
+/*
+ * For a string made only of single-byte characters, whether each byte is a
+ * word character and what it folds to can be looked up in a table instead of
+ * being worked out character by character, which is most of the cost of
+ * extracting trigrams.  The table is filled on first use by the same
+ * functions the general code uses, so the trigrams come out the same; it
+ * depends only on the database encoding and LC_CTYPE, which can't change in
+ * a session.  A zero entry means the byte is not a word character.  In a
+ * multibyte encoding only ASCII bytes are covered.  If some word character
+ * doesn't fold to a single byte, the table is not used at all.
+ */
+static bool trgm_bytemap_valid = false;
+static bool trgm_bytemap_usable;
+static char trgm_bytemap[256];
+
+/* trigrams of the last second argument of similarity(), see below */
+typedef struct
+{
+	int			len;			/* length of the string */
+	char	   *str;			/* the string */
+	TRGM	   *trg;			/* its trigrams */
+} SimilarityCache;
 #define TRGM_BOUND_LEFT				0x01	/* trigram is left bound of word */
 #define TRGM_BOUND_RIGHT			0x02	/* trigram is right bound of word */
 
@@ -282,6 +306,73 @@ make_trigrams(trgm *tptr, char *str, int bytelen, int charlen)
 	return tptr;
 }
 
+/*
+ * Fill trgm_bytemap, see above.
+ */
+static void
+init_trgm_bytemap(void)
+{
+	int			nbytes = (pg_database_encoding_max_length() == 1) ? 256 : 128;
+	int			i;
+
+	memset(trgm_bytemap, 0, sizeof(trgm_bytemap));
+	trgm_bytemap_usable = true;
+
+	for (i = 1; i < nbytes; i++)
+	{
+		char		c[2];
+
+		c[0] = (char) i;
+		c[1] = '\0';
+		if (!ISWORDCHR(c))
+			continue;
+#ifdef IGNORECASE
+		{
+			char	   *folded = lowerstr_with_len(c, 1);
+
+			if (strlen(folded) == 1)
+				trgm_bytemap[i] = folded[0];
+			else
+				trgm_bytemap_usable = false;
+			pfree(folded);
+		}
+#else
+		trgm_bytemap[i] = c[0];
+#endif
+	}
+
+	trgm_bytemap_valid = true;
+}
+
+/*
+ * Can trgm_bytemap be used for the string str of length slen bytes?
+ */
+static bool
+use_trgm_bytemap(const char *str, int slen)
+{
+	const char *end = str + slen;
+
+	if (!trgm_bytemap_valid)
+		init_trgm_bytemap();
+	if (!trgm_bytemap_usable)
+		return false;
+	if (pg_database_encoding_max_length() == 1)
+		return true;
+
+	/* in a multibyte encoding, the string must be ASCII */
+	for (; end - str >= sizeof(Vector8); str += sizeof(Vector8))
+	{
+		if (vector8_is_highbit_set(vector8_load((const uint8 *) str)))
+			return false;
+	}
+	for (; str < end; str++)
+	{
+		if (IS_HIGHBIT_SET(*str))
+			return false;
+	}
+	return true;
+}
+
 /*
  * Make array of trigrams without sorting and removing duplicate items.
  *
@@ -306,6 +397,47 @@ generate_trgm_only(trgm *trg, char *str, int slen, TrgmBound *bounds)
 
 	tptr = trg;
 
+	if (use_trgm_bytemap(str, slen))
+	{
+		char	   *ptr = str;
+		char	   *end = str + slen;
+
+		buf = (char *) palloc(slen + 4);
+		if (LPADDING > 0)
+		{
+			*buf = ' ';
+			if (LPADDING > 1)
+				*(buf + 1) = ' ';
+		}
+
+		for (;;)
+		{
+			char	   *bufptr = buf + LPADDING;
+
+			while (ptr < end && trgm_bytemap[(unsigned char) *ptr] == 0)
+				ptr++;
+			if (ptr >= end)
+				break;
+			while (ptr < end && trgm_bytemap[(unsigned char) *ptr] != 0)
+				*bufptr++ = trgm_bytemap[(unsigned char) *ptr++];
+			bytelen = bufptr - (buf + LPADDING);
+
+			bufptr[0] = ' ';
+			bufptr[1] = ' ';
+
+			if (bounds)
+				bounds[tptr - trg] |= TRGM_BOUND_LEFT;
+			tptr = make_trigrams(tptr, buf, bytelen + LPADDING + RPADDING,
+								 bytelen + LPADDING + RPADDING);
+			if (bounds)
+				bounds[tptr - trg - 1] |= TRGM_BOUND_RIGHT;
+		}
+
+		pfree(buf);
+
+		return tptr - trg;
+	}
+
 	/* Allocate a buffer for case-folded, blank-padded words */
 	buf = (char *) palloc(slen * pg_database_encoding_max_length() + 4);
 
@@ -1140,26 +1272,74 @@ trgm_presence_map(TRGM *query, TRGM *key)
 	return result;
 }
 
-Datum
-similarity(PG_FUNCTION_ARGS)
+/*
+ * Compute the similarity of the arguments of similarity() and the functions
+ * behind the % and <-> operators.
+ *
+ * The second argument is usually the constant that rows are compared with,
+ * for example when an index scan rechecks its candidates, so its trigrams
+ * are remembered in fn_extra and reused while it stays the same.
+ */
+static float4
+calc_similarity(FunctionCallInfo fcinfo)
 {
 	text	   *in1 = PG_GETARG_TEXT_PP(0);
 	text	   *in2 = PG_GETARG_TEXT_PP(1);
+	char	   *str2 = VARDATA_ANY(in2);
+	int			len2 = VARSIZE_ANY_EXHDR(in2);
+	SimilarityCache *cache = NULL;
 	TRGM	   *trg1,
 			   *trg2;
 	float4		res;
 
+	if (fcinfo->flinfo != NULL)
+	{
+		cache = (SimilarityCache *) fcinfo->flinfo->fn_extra;
+		if (cache == NULL)
+			fcinfo->flinfo->fn_extra = cache =
+				MemoryContextAllocZero(fcinfo->flinfo->fn_mcxt,
+									   sizeof(SimilarityCache));
+
+		if (cache->trg == NULL || cache->len != len2 ||
+			memcmp(cache->str, str2, len2) != 0)
+		{
+			MemoryContext oldcontext;
+
+			if (cache->trg != NULL)
+			{
+				pfree(cache->str);
+				pfree(cache->trg);
+				cache->trg = NULL;
+			}
+			oldcontext = MemoryContextSwitchTo(fcinfo->flinfo->fn_mcxt);
+			cache->str = palloc(Max(len2, 1));
+			memcpy(cache->str, str2, len2);
+			cache->len = len2;
+			cache->trg = generate_trgm(str2, len2);
+			MemoryContextSwitchTo(oldcontext);
+		}
+		trg2 = cache->trg;
+	}
+	else
+		trg2 = generate_trgm(str2, len2);
+
 	trg1 = generate_trgm(VARDATA_ANY(in1), VARSIZE_ANY_EXHDR(in1));
-	trg2 = generate_trgm(VARDATA_ANY(in2), VARSIZE_ANY_EXHDR(in2));
 
 	res = cnt_sml(trg1, trg2, false);
 
 	pfree(trg1);
-	pfree(trg2);
+	if (cache == NULL)
+		pfree(trg2);
 	PG_FREE_IF_COPY(in1, 0);
 	PG_FREE_IF_COPY(in2, 1);
 
-	PG_RETURN_FLOAT4(res);
+	return res;
+}
+
+Datum
+similarity(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_FLOAT4(calc_similarity(fcinfo));
 }
 
 Datum
@@ -1197,9 +1377,7 @@ strict_word_similarity(PG_FUNCTION_ARGS)
 Datum
 similarity_dist(PG_FUNCTION_ARGS)
 {
-	float4		res = DatumGetFloat4(DirectFunctionCall2(similarity,
-														 PG_GETARG_DATUM(0),
-														 PG_GETARG_DATUM(1)));
+	float4		res = calc_similarity(fcinfo);
 
 	PG_RETURN_FLOAT4(1.0 - res);
 }
@@ -1207,9 +1385,7 @@ similarity_dist(PG_FUNCTION_ARGS)
 Datum
 similarity_op(PG_FUNCTION_ARGS)
 {
-	float4		res = DatumGetFloat4(DirectFunctionCall2(similarity,
-														 PG_GETARG_DATUM(0),
-														 PG_GETARG_DATUM(1)));
+	float4		res = calc_similarity(fcinfo);
 
 	PG_RETURN_BOOL(res >= similarity_threshold);
 }
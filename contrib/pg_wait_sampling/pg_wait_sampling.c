@@ -0,0 +1,802 @@
+/*-------------------------------------------------------------------------
+ *
+ * pg_wait_sampling.c
+ *		Sample the wait events of all processes at a fixed frequency.
+ *
+ *		A background worker, the collector, wakes up every sample_period
+ *		milliseconds and reads the wait_event_info of every PGPROC without
+ *		taking any locks, the same way pg_stat_activity does.  Each sample is
+ *		written to a ring buffer in shared memory (the history) and counted
+ *		in a shared hash table keyed by wait event, query identifier and
+ *		backend type (the profile).
+ *
+ *		Backends publish the identifier of the top-level query they are
+ *		executing in a per-PGPROC slot from the executor hooks, so that
+ *		waits can be attributed to queries.  Query identifiers are computed
+ *		by pg_stat_statements; without it they are all zero.
+ *
+ *	Copyright (c) 2019, PostgreSQL Global Development Group
+ *
+ *	IDENTIFICATION
+ *		contrib/pg_wait_sampling/pg_wait_sampling.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "access/twophase.h"
+#include "executor/executor.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "port/atomics.h"
+#include "postmaster/autovacuum.h"
+#include "postmaster/bgworker.h"
+#include "replication/walsender.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/lwlock.h"
+#include "storage/procsignal.h"
+#include "storage/proc.h"
+#include "storage/shmem.h"
+#include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+#include "utils/timestamp.h"
+
+PG_MODULE_MAGIC;
+
+/* One sample of one process's wait event. */
+typedef struct WaitSample
+{
+	int			pid;
+	BackendType backend_type;
+	uint32		wait_event_info;
+	uint64		queryid;
+	TimestampTz ts;
+} WaitSample;
+
+/*
+ * Key of the profile hash table.  This contains no padding; if you add any,
+ * it must be zeroed before lookups, because the table uses HASH_BLOBS.
+ */
+typedef struct WaitProfileKey
+{
+	uint32		wait_event_info;
+	BackendType backend_type;
+	uint64		queryid;
+} WaitProfileKey;
+
+typedef struct WaitProfileEntry
+{
+	WaitProfileKey key;			/* hash key of entry - MUST BE FIRST */
+	int64		count;			/* number of samples */
+} WaitProfileEntry;
+
+/* Shared state. */
+typedef struct WaitSamplingShared
+{
+	LWLock	   *lock;			/* protects everything below */
+	pid_t		collector_pid;
+	uint64		nsamples;		/* samples ever written to the history */
+	int64		profile_overflow;	/* samples lost because profile was full */
+	WaitSample	history[FLEXIBLE_ARRAY_MEMBER];
+} WaitSamplingShared;
+
+void		_PG_init(void);
+void		_PG_fini(void);
+void		pgws_collector_main(Datum main_arg);
+
+PG_FUNCTION_INFO_V1(pg_wait_sampling_get_history);
+PG_FUNCTION_INFO_V1(pg_wait_sampling_get_profile);
+PG_FUNCTION_INFO_V1(pg_wait_sampling_reset_profile);
+
+static void pgws_shmem_startup(void);
+static Size pgws_memsize(void);
+static int	pgws_max_procs(void);
+static void pgws_set_queryid(uint64 queryid);
+static void pgws_ExecutorStart(QueryDesc *queryDesc, int eflags);
+static void pgws_ExecutorRun(QueryDesc *queryDesc, ScanDirection direction,
+							 uint64 count, bool execute_once);
+static void pgws_ExecutorFinish(QueryDesc *queryDesc);
+static void pgws_ExecutorEnd(QueryDesc *queryDesc);
+static void pgws_take_samples(BackendType *types, int *pids, int nprocs);
+static void pgws_refresh_backend_types(BackendType *types, int *pids,
+									   int nprocs);
+static void pgws_sigterm_handler(SIGNAL_ARGS);
+static void pgws_sighup_handler(SIGNAL_ARGS);
+
+/* Saved hook values in case of unload */
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+static ExecutorStart_hook_type prev_ExecutorStart = NULL;
+static ExecutorRun_hook_type prev_ExecutorRun = NULL;
+static ExecutorFinish_hook_type prev_ExecutorFinish = NULL;
+static ExecutorEnd_hook_type prev_ExecutorEnd = NULL;
+
+/* Current nesting depth of ExecutorRun+ExecutorFinish calls */
+static int	nested_level = 0;
+
+/* Flags set by signal handlers */
+static volatile sig_atomic_t got_sigterm = false;
+static volatile sig_atomic_t got_sighup = false;
+
+/* Links to shared memory state */
+static WaitSamplingShared *pgws = NULL;
+static HTAB *pgws_profile = NULL;
+static pg_atomic_uint64 *pgws_queryids = NULL;
+
+/* GUC variables */
+static int	pgws_history_size;	/* # of samples kept in the history */
+static int	pgws_profile_max;	/* max # of entries in the profile */
+static int	pgws_sample_period; /* sampling interval, in ms */
+static bool pgws_profile_queries;	/* profile by query identifier? */
+
+/*
+ * Module load callback
+ */
+void
+_PG_init(void)
+{
+	BackgroundWorker worker;
+
+	/*
+	 * The shared memory and the collector can only be set up if we're loaded
+	 * via shared_preload_libraries.
+	 */
+	if (!process_shared_preload_libraries_in_progress)
+		return;
+
+	DefineCustomIntVariable("pg_wait_sampling.history_size",
+							"Sets the number of samples kept in the wait event history.",
+							NULL,
+							&pgws_history_size,
+							5000,
+							100,
+							INT_MAX / 2,
+							PGC_POSTMASTER,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("pg_wait_sampling.profile_max",
+							"Sets the maximum number of entries in the wait event profile.",
+							NULL,
+							&pgws_profile_max,
+							10000,
+							100,
+							INT_MAX,
+							PGC_POSTMASTER,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("pg_wait_sampling.sample_period",
+							"Sets the interval between wait event samples.",
+							NULL,
+							&pgws_sample_period,
+							10,
+							1,
+							60000,
+							PGC_SIGHUP,
+							GUC_UNIT_MS,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomBoolVariable("pg_wait_sampling.profile_queries",
+							 "Selects whether the wait event profile is kept per query.",
+							 NULL,
+							 &pgws_profile_queries,
+							 true,
+							 PGC_SIGHUP,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+
+	EmitWarningsOnPlaceholders("pg_wait_sampling");
+
+	RequestAddinShmemSpace(pgws_memsize());
+	RequestNamedLWLockTranche("pg_wait_sampling", 1);
+
+	/* Install hooks. */
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = pgws_shmem_startup;
+	prev_ExecutorStart = ExecutorStart_hook;
+	ExecutorStart_hook = pgws_ExecutorStart;
+	prev_ExecutorRun = ExecutorRun_hook;
+	ExecutorRun_hook = pgws_ExecutorRun;
+	prev_ExecutorFinish = ExecutorFinish_hook;
+	ExecutorFinish_hook = pgws_ExecutorFinish;
+	prev_ExecutorEnd = ExecutorEnd_hook;
+	ExecutorEnd_hook = pgws_ExecutorEnd;
+
+	/* Register the collector. */
+	MemSet(&worker, 0, sizeof(BackgroundWorker));
+	worker.bgw_flags = BGWORKER_SHMEM_ACCESS;
+	worker.bgw_start_time = BgWorkerStart_ConsistentState;
+	worker.bgw_restart_time = 1;
+	strcpy(worker.bgw_library_name, "pg_wait_sampling");
+	strcpy(worker.bgw_function_name, "pgws_collector_main");
+	strcpy(worker.bgw_name, "pg_wait_sampling collector");
+	strcpy(worker.bgw_type, "pg_wait_sampling collector");
+	RegisterBackgroundWorker(&worker);
+}
+
+/*
+ * Module unload callback
+ */
+void
+_PG_fini(void)
+{
+	/* Uninstall hooks. */
+	shmem_startup_hook = prev_shmem_startup_hook;
+	ExecutorStart_hook = prev_ExecutorStart;
+	ExecutorRun_hook = prev_ExecutorRun;
+	ExecutorFinish_hook = prev_ExecutorFinish;
+	ExecutorEnd_hook = prev_ExecutorEnd;
+}
+
+/*
+ * Number of PGPROCs we have query identifier slots for.  MaxBackends hasn't
+ * been computed yet when shared memory is requested, so we have to work it
+ * out the same way InitializeMaxBackends() and InitProcGlobal() will.
+ */
+static int
+pgws_max_procs(void)
+{
+	return MaxConnections + autovacuum_max_workers + 1 +
+		max_worker_processes + max_wal_senders + NUM_AUXILIARY_PROCS;
+}
+
+/*
+ * Estimate shared memory space needed.
+ */
+static Size
+pgws_memsize(void)
+{
+	Size		size;
+
+	size = MAXALIGN(offsetof(WaitSamplingShared, history) +
+					mul_size(pgws_history_size, sizeof(WaitSample)));
+	size = add_size(size, mul_size(pgws_max_procs(),
+								   sizeof(pg_atomic_uint64)));
+	size = add_size(size, hash_estimate_size(pgws_profile_max,
+											 sizeof(WaitProfileEntry)));
+
+	return size;
+}
+
+/*
+ * shmem_startup hook: allocate or attach to shared memory.
+ */
+static void
+pgws_shmem_startup(void)
+{
+	bool		found;
+	HASHCTL		info;
+	int			nprocs = pgws_max_procs();
+	int			i;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	pgws = ShmemInitStruct("pg_wait_sampling",
+						   offsetof(WaitSamplingShared, history) +
+						   mul_size(pgws_history_size, sizeof(WaitSample)),
+						   &found);
+	if (!found)
+	{
+		/* First time through ... */
+		pgws->lock = &(GetNamedLWLockTranche("pg_wait_sampling"))->lock;
+		pgws->collector_pid = InvalidPid;
+		pgws->nsamples = 0;
+		pgws->profile_overflow = 0;
+	}
+
+	pgws_queryids = ShmemInitStruct("pg_wait_sampling queryids",
+									mul_size(nprocs, sizeof(pg_atomic_uint64)),
+									&found);
+	if (!found)
+	{
+		for (i = 0; i < nprocs; i++)
+			pg_atomic_init_u64(&pgws_queryids[i], 0);
+	}
+
+	memset(&info, 0, sizeof(info));
+	info.keysize = sizeof(WaitProfileKey);
+	info.entrysize = sizeof(WaitProfileEntry);
+	pgws_profile = ShmemInitHash("pg_wait_sampling profile",
+								 pgws_profile_max, pgws_profile_max,
+								 &info,
+								 HASH_ELEM | HASH_BLOBS);
+
+	LWLockRelease(AddinShmemInitLock);
+}
+
+/*
+ * Publish the identifier of the query this process is executing.
+ */
+static void
+pgws_set_queryid(uint64 queryid)
+{
+	if (pgws_queryids && MyProc && MyProc->pgprocno < pgws_max_procs())
+		pg_atomic_write_u64(&pgws_queryids[MyProc->pgprocno], queryid);
+}
+
+/*
+ * ExecutorStart hook: publish the top-level query's identifier
+ */
+static void
+pgws_ExecutorStart(QueryDesc *queryDesc, int eflags)
+{
+	if (nested_level == 0)
+		pgws_set_queryid(queryDesc->plannedstmt->queryId);
+
+	if (prev_ExecutorStart)
+		prev_ExecutorStart(queryDesc, eflags);
+	else
+		standard_ExecutorStart(queryDesc, eflags);
+}
+
+/*
+ * ExecutorRun hook: all we need do is track nesting depth
+ */
+static void
+pgws_ExecutorRun(QueryDesc *queryDesc, ScanDirection direction, uint64 count,
+				 bool execute_once)
+{
+	nested_level++;
+	PG_TRY();
+	{
+		if (prev_ExecutorRun)
+			prev_ExecutorRun(queryDesc, direction, count, execute_once);
+		else
+			standard_ExecutorRun(queryDesc, direction, count, execute_once);
+		nested_level--;
+	}
+	PG_CATCH();
+	{
+		nested_level--;
+		if (nested_level == 0)
+			pgws_set_queryid(0);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+}
+
+/*
+ * ExecutorFinish hook: all we need do is track nesting depth
+ */
+static void
+pgws_ExecutorFinish(QueryDesc *queryDesc)
+{
+	nested_level++;
+	PG_TRY();
+	{
+		if (prev_ExecutorFinish)
+			prev_ExecutorFinish(queryDesc);
+		else
+			standard_ExecutorFinish(queryDesc);
+		nested_level--;
+	}
+	PG_CATCH();
+	{
+		nested_level--;
+		if (nested_level == 0)
+			pgws_set_queryid(0);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+}
+
+/*
+ * ExecutorEnd hook: the top-level query is done
+ */
+static void
+pgws_ExecutorEnd(QueryDesc *queryDesc)
+{
+	if (nested_level == 0)
+		pgws_set_queryid(0);
+
+	if (prev_ExecutorEnd)
+		prev_ExecutorEnd(queryDesc);
+	else
+		standard_ExecutorEnd(queryDesc);
+}
+
+/*
+ * Main entry point for the collector.
+ */
+void
+pgws_collector_main(Datum main_arg)
+{
+	BackendType *types;
+	int		   *pids;
+	int			nprocs;
+
+	/* Establish signal handlers; once that's done, unblock signals. */
+	pqsignal(SIGTERM, pgws_sigterm_handler);
+	pqsignal(SIGHUP, pgws_sighup_handler);
+	pqsignal(SIGUSR1, procsignal_sigusr1_handler);
+	BackgroundWorkerUnblockSignals();
+
+	LWLockAcquire(pgws->lock, LW_EXCLUSIVE);
+	pgws->collector_pid = MyProcPid;
+	LWLockRelease(pgws->lock);
+
+	/*
+	 * Remember the pid we last saw in each PGPROC together with the backend
+	 * type of that process, so that we only need to look at the backend
+	 * status array when a process has come or gone.
+	 */
+	nprocs = Min(ProcGlobal->allProcCount, pgws_max_procs());
+	types = (BackendType *) palloc0(nprocs * sizeof(BackendType));
+	pids = (int *) palloc0(nprocs * sizeof(int));
+
+	while (!got_sigterm)
+	{
+		/* In case of a SIGHUP, just reload the configuration. */
+		if (got_sighup)
+		{
+			got_sighup = false;
+			ProcessConfigFile(PGC_SIGHUP);
+		}
+
+		pgws_take_samples(types, pids, nprocs);
+
+		(void) WaitLatch(&MyProc->procLatch,
+						 WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
+						 pgws_sample_period,
+						 PG_WAIT_EXTENSION);
+		ResetLatch(&MyProc->procLatch);
+	}
+
+	LWLockAcquire(pgws->lock, LW_EXCLUSIVE);
+	pgws->collector_pid = InvalidPid;
+	LWLockRelease(pgws->lock);
+}
+
+/*
+ * Take one sample of every process, and add it to the history and profile.
+ */
+static void
+pgws_take_samples(BackendType *types, int *pids, int nprocs)
+{
+	TimestampTz now = GetCurrentTimestamp();
+	bool		refreshed = false;
+	int			i;
+
+	LWLockAcquire(pgws->lock, LW_EXCLUSIVE);
+	for (i = 0; i < nprocs; i++)
+	{
+		volatile PGPROC *proc = &ProcGlobal->allProcs[i];
+		WaitSample *sample;
+		WaitProfileKey key;
+		WaitProfileEntry *entry;
+		bool		found;
+		int			pid;
+
+		pid = proc->pid;
+		if (pid == 0 || pid == MyProcPid)
+			continue;
+
+		/*
+		 * A new process has taken this PGPROC since we last looked.  Look up
+		 * the backend types of all processes at once; if it isn't in the
+		 * backend status array yet, skip it for now.
+		 */
+		if (pids[i] != pid)
+		{
+			if (!refreshed)
+			{
+				LWLockRelease(pgws->lock);
+				pgws_refresh_backend_types(types, pids, nprocs);
+				LWLockAcquire(pgws->lock, LW_EXCLUSIVE);
+				refreshed = true;
+			}
+			if (pids[i] != pid)
+				continue;
+		}
+
+		sample = &pgws->history[pgws->nsamples % pgws_history_size];
+		sample->pid = pid;
+		sample->backend_type = types[i];
+		sample->wait_event_info = proc->wait_event_info;
+		sample->queryid = pg_atomic_read_u64(&pgws_queryids[i]);
+		sample->ts = now;
+		pgws->nsamples++;
+
+		key.wait_event_info = sample->wait_event_info;
+		key.backend_type = sample->backend_type;
+		key.queryid = pgws_profile_queries ? sample->queryid : 0;
+		if (hash_get_num_entries(pgws_profile) < pgws_profile_max)
+			entry = (WaitProfileEntry *) hash_search(pgws_profile, &key,
+													 HASH_ENTER, &found);
+		else
+			entry = (WaitProfileEntry *) hash_search(pgws_profile, &key,
+													 HASH_FIND, &found);
+		if (entry == NULL)
+		{
+			pgws->profile_overflow++;
+			continue;
+		}
+		if (!found)
+			entry->count = 0;
+		entry->count++;
+	}
+	LWLockRelease(pgws->lock);
+}
+
+/*
+ * Look up the backend type of every process in the backend status array.
+ * PGPROCs whose process isn't found there get a pid of zero, so that we'll
+ * try again next time.
+ */
+static void
+pgws_refresh_backend_types(BackendType *types, int *pids, int nprocs)
+{
+	int			nbackends;
+	int			i,
+				j;
+
+	pgstat_clear_snapshot();
+	nbackends = pgstat_fetch_stat_numbackends();
+
+	for (i = 0; i < nprocs; i++)
+	{
+		int			pid = ProcGlobal->allProcs[i].pid;
+
+		pids[i] = 0;
+		if (pid == 0)
+			continue;
+
+		for (j = 1; j <= nbackends; j++)
+		{
+			PgBackendStatus *beentry;
+
+			beentry = &pgstat_fetch_stat_local_beentry(j)->backendStatus;
+			if (beentry->st_procpid == pid)
+			{
+				pids[i] = pid;
+				types[i] = beentry->st_backendType;
+				break;
+			}
+		}
+	}
+}
+
+/*
+ * Retrieve the wait event history, oldest sample first.
+ */
+Datum
+pg_wait_sampling_get_history(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+	WaitSample *samples;
+	uint64		first;
+	int			nsamples;
+	int			i;
+
+	if (!pgws)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("pg_wait_sampling must be loaded via shared_preload_libraries")));
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not " \
+						"allowed in this context")));
+
+	/* Switch into long-lived context to construct returned data structures */
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	/* Build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	/* Copy the samples out, to keep the collector waiting only briefly. */
+	samples = (WaitSample *) palloc(pgws_history_size * sizeof(WaitSample));
+	LWLockAcquire(pgws->lock, LW_SHARED);
+	nsamples = (int) Min(pgws->nsamples, (uint64) pgws_history_size);
+	first = pgws->nsamples - nsamples;
+	for (i = 0; i < nsamples; i++)
+		samples[i] = pgws->history[(first + i) % pgws_history_size];
+	LWLockRelease(pgws->lock);
+
+	for (i = 0; i < nsamples; i++)
+	{
+		WaitSample *sample = &samples[i];
+		Datum		values[6];
+		bool		nulls[6];
+		const char *event_type;
+		const char *event;
+
+		memset(nulls, 0, sizeof(nulls));
+
+		values[0] = Int32GetDatum(sample->pid);
+		values[1] = TimestampTzGetDatum(sample->ts);
+		values[2] = CStringGetTextDatum(pgstat_get_backend_desc(sample->backend_type));
+		event_type = pgstat_get_wait_event_type(sample->wait_event_info);
+		event = pgstat_get_wait_event(sample->wait_event_info);
+		if (event_type)
+			values[3] = CStringGetTextDatum(event_type);
+		else
+			nulls[3] = true;
+		if (event)
+			values[4] = CStringGetTextDatum(event);
+		else
+			nulls[4] = true;
+		values[5] = Int64GetDatumFast((int64) sample->queryid);
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	pfree(samples);
+
+	tuplestore_donestoring(tupstore);
+
+	return (Datum) 0;
+}
+
+/*
+ * Retrieve the wait event profile.
+ */
+Datum
+pg_wait_sampling_get_profile(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+	HASH_SEQ_STATUS hash_seq;
+	WaitProfileEntry *entry;
+
+	if (!pgws)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("pg_wait_sampling must be loaded via shared_preload_libraries")));
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not " \
+						"allowed in this context")));
+
+	/* Switch into long-lived context to construct returned data structures */
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	/* Build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	LWLockAcquire(pgws->lock, LW_SHARED);
+
+	hash_seq_init(&hash_seq, pgws_profile);
+	while ((entry = hash_seq_search(&hash_seq)) != NULL)
+	{
+		Datum		values[5];
+		bool		nulls[5];
+		const char *event_type;
+		const char *event;
+
+		memset(nulls, 0, sizeof(nulls));
+
+		values[0] = CStringGetTextDatum(pgstat_get_backend_desc(entry->key.backend_type));
+		event_type = pgstat_get_wait_event_type(entry->key.wait_event_info);
+		event = pgstat_get_wait_event(entry->key.wait_event_info);
+		if (event_type)
+			values[1] = CStringGetTextDatum(event_type);
+		else
+			nulls[1] = true;
+		if (event)
+			values[2] = CStringGetTextDatum(event);
+		else
+			nulls[2] = true;
+		values[3] = Int64GetDatumFast((int64) entry->key.queryid);
+		values[4] = Int64GetDatumFast(entry->count);
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	LWLockRelease(pgws->lock);
+
+	tuplestore_donestoring(tupstore);
+
+	return (Datum) 0;
+}
+
+/*
+ * Discard the wait event profile.
+ */
+Datum
+pg_wait_sampling_reset_profile(PG_FUNCTION_ARGS)
+{
+	HASH_SEQ_STATUS hash_seq;
+	WaitProfileEntry *entry;
+
+	if (!pgws)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("pg_wait_sampling must be loaded via shared_preload_libraries")));
+
+	LWLockAcquire(pgws->lock, LW_EXCLUSIVE);
+
+	hash_seq_init(&hash_seq, pgws_profile);
+	while ((entry = hash_seq_search(&hash_seq)) != NULL)
+		hash_search(pgws_profile, &entry->key, HASH_REMOVE, NULL);
+	pgws->profile_overflow = 0;
+
+	LWLockRelease(pgws->lock);
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * Signal handler for SIGTERM
+ */
+static void
+pgws_sigterm_handler(SIGNAL_ARGS)
+{
+	int			save_errno = errno;
+
+	got_sigterm = true;
+
+	if (MyProc)
+		SetLatch(&MyProc->procLatch);
+
+	errno = save_errno;
+}
+
+/*
+ * Signal handler for SIGHUP
+ */
+static void
+pgws_sighup_handler(SIGNAL_ARGS)
+{
+	int			save_errno = errno;
+
+	got_sighup = true;
+
+	if (MyProc)
+		SetLatch(&MyProc->procLatch);
+
+	errno = save_errno;
+}
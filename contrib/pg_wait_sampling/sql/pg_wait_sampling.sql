@@ -0,0 +1,16 @@
+CREATE EXTENSION pg_wait_sampling;
+
+SELECT pg_wait_sampling_reset_profile();
+
+SELECT pg_sleep(0.5);
+
+-- the collector should have caught us sleeping several times
+SELECT count > 0 AS sampled
+  FROM pg_wait_sampling_profile
+ WHERE backend_type = 'client backend' AND event = 'PgSleep';
+
+SELECT count(*) > 0 AS sampled
+  FROM pg_wait_sampling_history
+ WHERE pid = pg_backend_pid() AND event_type = 'Timeout' AND event = 'PgSleep';
+
+DROP EXTENSION pg_wait_sampling;
@@ -14,11 +14,14 @@
 
 #include "access/heapam.h"
 #include "access/relation.h"
+#include "access/tpd.h"
 #include "access/transam.h"
 #include "access/visibilitymap.h"
 #include "access/xact.h"
 #include "access/multixact.h"
 #include "access/htup_details.h"
+#include "access/zheap.h"
+#include "access/zhtup.h"
 #include "catalog/namespace.h"
 #include "catalog/pg_am_d.h"
 #include "commands/vacuum.h"
@@ -29,6 +32,8 @@
 #include "storage/procarray.h"
 #include "storage/lmgr.h"
 #include "utils/builtins.h"
+#include "utils/sampling.h"
+#include "utils/ztqual.h"
 
 PG_FUNCTION_INFO_V1(pgstattuple_approx);
 PG_FUNCTION_INFO_V1(pgstattuple_approx_v1_5);
@@ -51,6 +56,28 @@ typedef struct output_type
 
 #define NUM_OUTPUT_COLUMNS 10
 
+/*
+ * Maximum number of zheap pages not marked all-visible that are read to
+ * estimate the tuples in all of them.
+ */
+#define ZHEAP_APPROX_SAMPLE_PAGES	10000
+
+/*
+ * Calculate percentages if the relation has one or more pages.
+ */
+static void
+statapprox_percentages(output_type *stat, BlockNumber nblocks,
+					   BlockNumber scanned)
+{
+	if (nblocks != 0)
+	{
+		stat->scanned_percent = 100 * scanned / nblocks;
+		stat->tuple_percent = 100.0 * stat->tuple_len / stat->table_len;
+		stat->dead_tuple_percent = 100.0 * stat->dead_tuple_len / stat->table_len;
+		stat->free_percent = 100.0 * stat->free_space / stat->table_len;
+	}
+}
+
 /*
  * This function takes an already open relation and scans its pages,
  * skipping those that have the corresponding visibility map bit set.
@@ -195,22 +222,311 @@ statapprox_heap(Relation rel, output_type *stat)
 	stat->tuple_count = vac_estimate_reltuples(rel, nblocks, scanned,
 											   stat->tuple_count);
 
+	statapprox_percentages(stat, nblocks, scanned);
+
+	if (BufferIsValid(vmbuffer))
+	{
+		ReleaseBuffer(vmbuffer);
+		vmbuffer = InvalidBuffer;
+	}
+}
+
+/*
+ * qsort comparator for BlockNumbers.
+ */
+static int
+blocknumber_cmp(const void *a, const void *b)
+{
+	BlockNumber aa = *(const BlockNumber *) a;
+	BlockNumber bb = *(const BlockNumber *) b;
+
+	if (aa < bb)
+		return -1;
+	if (aa > bb)
+		return 1;
+	return 0;
+}
+
+/*
+ * Follow a chain of TPD pages starting at blkno, adding their free space to
+ * the stats and their block numbers to *tpdblocks.  The chain can change
+ * under us, so we give up once we've seen more pages than the relation has.
+ */
+static void
+statapprox_zheap_tpd_chain(Relation rel, BlockNumber blkno,
+						   BlockNumber nblocks, BufferAccessStrategy bstrategy,
+						   output_type *stat, BlockNumber **tpdblocks,
+						   int *ntpd, int *maxtpd)
+{
+	while (BlockNumberIsValid(blkno) && blkno != ZHEAP_METAPAGE &&
+		   blkno < nblocks && *ntpd < nblocks)
+	{
+		Buffer		buf;
+		Page		page;
+
+		CHECK_FOR_INTERRUPTS();
+
+		buf = ReadBufferExtended(rel, MAIN_FORKNUM, blkno,
+								 RBM_NORMAL, bstrategy);
+		LockBuffer(buf, BUFFER_LOCK_SHARE);
+		page = BufferGetPage(buf);
+
+		if (PageIsNew(page) || !IsTPDPage(page))
+		{
+			UnlockReleaseBuffer(buf);
+			break;
+		}
+
+		if (*ntpd >= *maxtpd)
+		{
+			*maxtpd *= 2;
+			*tpdblocks = repalloc(*tpdblocks, *maxtpd * sizeof(BlockNumber));
+		}
+		(*tpdblocks)[(*ntpd)++] = blkno;
+		stat->free_space += PageGetTPDFreeSpace(page);
+
+		blkno = ((TPDPageOpaque) PageGetSpecialPointer(page))->tpd_nextblkno;
+		UnlockReleaseBuffer(buf);
+	}
+}
+
+/*
+ * This is the zheap counterpart of statapprox_heap.  Pages that have the
+ * visibility map bit set are accounted for from the free space map, as
+ * for heap.  The TPD pages, which hold transaction slots that don't fit on
+ * the data pages, are found by following the used and free lists of the
+ * metapage; they hold no tuples, so they only contribute free space.
+ *
+ * Deciding whether a zheap tuple is dead may need a visit to undo for its
+ * transaction slot, which is far more expensive than a heap visibility
+ * check, so we don't look at every page that isn't all-visible.  Instead
+ * we examine a random sample of at most ZHEAP_APPROX_SAMPLE_PAGES of them,
+ * taking the free space of the others from the free space map, and scale
+ * the live and dead tuples found in the sample up to all of them.
+ */
+static void
+statapprox_zheap(Relation rel, output_type *stat)
+{
+	BlockNumber scanned,
+				nblocks,
+				blkno,
+				nvisible,
+				nfrozen,
+				ntodo,
+				nskipped,
+				nnotvisible,
+				nsampled,
+				nextsample;
+	Buffer		vmbuffer = InvalidBuffer;
+	Buffer		metabuf;
+	ZHeapMetaPage metapage;
+	BlockNumber first_used_tpd_page,
+				free_tpd_page;
+	BlockNumber *tpdblocks;
+	int			ntpd,
+				maxtpd,
+				nexttpd;
+	BlockSamplerData bs;
+	BufferAccessStrategy bstrategy;
+	TransactionId OldestXmin;
+	output_type sample = {0};
+
+	nblocks = RelationGetNumberOfBlocks(rel);
+	stat->table_len = (uint64) nblocks * BLCKSZ;
+
+	if (nblocks == 0)
+		return;
+
+	OldestXmin = GetOldestXmin(rel, PROCARRAY_FLAGS_VACUUM);
+	bstrategy = GetAccessStrategy(BAS_BULKREAD);
+
+	metabuf = ReadBufferExtended(rel, MAIN_FORKNUM, ZHEAP_METAPAGE,
+								 RBM_NORMAL, bstrategy);
+	LockBuffer(metabuf, BUFFER_LOCK_SHARE);
+	metapage = ZHeapPageGetMeta(BufferGetPage(metabuf));
+	Assert(metapage->zhm_magic == ZHEAP_MAGIC);
+	first_used_tpd_page = metapage->zhm_first_used_tpd_page;
+	free_tpd_page = metapage->zhm_free_tpd_page;
+	UnlockReleaseBuffer(metabuf);
+	scanned = 1;
+
+	maxtpd = 64;
+	tpdblocks = palloc(maxtpd * sizeof(BlockNumber));
+	ntpd = 0;
+	statapprox_zheap_tpd_chain(rel, first_used_tpd_page, nblocks, bstrategy,
+							   stat, &tpdblocks, &ntpd, &maxtpd);
+	statapprox_zheap_tpd_chain(rel, free_tpd_page, nblocks, bstrategy,
+							   stat, &tpdblocks, &ntpd, &maxtpd);
+	qsort(tpdblocks, ntpd, sizeof(BlockNumber), blocknumber_cmp);
+	scanned += ntpd;
+
 	/*
-	 * Calculate percentages if the relation has one or more pages.
+	 * The TPD pages and the metapage are never marked all-visible, so this
+	 * is how many data pages we can pick our sample from.  Concurrent
+	 * activity may make it a bit off, which only affects which pages get
+	 * sampled.
 	 */
-	if (nblocks != 0)
+	visibilitymap_count(rel, &nvisible, &nfrozen);
+	if (nblocks > 1 + ntpd + nvisible)
+		ntodo = nblocks - 1 - ntpd - nvisible;
+	else
+		ntodo = 0;
+	BlockSampler_Init(&bs, ntodo, ZHEAP_APPROX_SAMPLE_PAGES, random());
+	nextsample = BlockSampler_HasMore(&bs) ? BlockSampler_Next(&bs) :
+		InvalidBlockNumber;
+
+	nskipped = 0;
+	nnotvisible = 0;
+	nsampled = 0;
+	nexttpd = 0;
+
+	for (blkno = ZHEAP_METAPAGE + 1; blkno < nblocks; blkno++)
 	{
-		stat->scanned_percent = 100 * scanned / nblocks;
-		stat->tuple_percent = 100.0 * stat->tuple_len / stat->table_len;
-		stat->dead_tuple_percent = 100.0 * stat->dead_tuple_len / stat->table_len;
-		stat->free_percent = 100.0 * stat->free_space / stat->table_len;
+		Buffer		buf;
+		Page		page;
+		OffsetNumber offnum,
+					maxoff;
+		Size		freespace;
+
+		CHECK_FOR_INTERRUPTS();
+
+		/* TPD pages are already accounted for */
+		while (nexttpd < ntpd && tpdblocks[nexttpd] < blkno)
+			nexttpd++;
+		if (nexttpd < ntpd && tpdblocks[nexttpd] == blkno)
+			continue;
+
+		if (VM_ALL_VISIBLE(rel, blkno, &vmbuffer))
+		{
+			freespace = GetRecordedFreeSpace(rel, blkno);
+			stat->tuple_len += BLCKSZ - freespace;
+			stat->free_space += freespace;
+			nskipped++;
+			continue;
+		}
+
+		/* Pages left out of the sample only contribute their free space */
+		if (nnotvisible++ != nextsample)
+		{
+			stat->free_space += GetRecordedFreeSpace(rel, blkno);
+			continue;
+		}
+		nextsample = BlockSampler_HasMore(&bs) ? BlockSampler_Next(&bs) :
+			InvalidBlockNumber;
+
+		buf = ReadBufferExtended(rel, MAIN_FORKNUM, blkno,
+								 RBM_NORMAL, bstrategy);
+
+		LockBuffer(buf, BUFFER_LOCK_SHARE);
+
+		page = BufferGetPage(buf);
+		scanned++;
+
+		if (PageIsNew(page))
+		{
+			stat->free_space += BLCKSZ - SizeOfPageHeaderData;
+			nsampled++;
+			UnlockReleaseBuffer(buf);
+			continue;
+		}
+
+		/*
+		 * A TPD page added since we followed the lists.  It stays among the
+		 * pages we scale the sample up to, as one without any tuples.
+		 */
+		if (IsTPDPage(page))
+		{
+			stat->free_space += PageGetTPDFreeSpace(page);
+			nsampled++;
+			UnlockReleaseBuffer(buf);
+			continue;
+		}
+
+		stat->free_space += PageGetZHeapFreeSpace(page);
+		nsampled++;
+
+		/*
+		 * Deleted and dead line pointers have no storage left, so only the
+		 * normal ones are counted.  We classify the tuples the same way as
+		 * statapprox_heap does, except that tuples whose rollback is pending
+		 * are counted as dead, too.
+		 */
+		maxoff = PageGetMaxOffsetNumber(page);
+
+		for (offnum = FirstOffsetNumber;
+			 offnum <= maxoff;
+			 offnum = OffsetNumberNext(offnum))
+		{
+			ItemId		itemid;
+			ZHeapTupleData tuple;
+			TransactionId xid;
+
+			itemid = PageGetItemId(page, offnum);
+
+			if (!ItemIdIsNormal(itemid))
+				continue;
+
+			ItemPointerSet(&(tuple.t_self), blkno, offnum);
+
+			tuple.t_data = (ZHeapTupleHeader) PageGetItem(page, itemid);
+			tuple.t_len = ItemIdGetLength(itemid);
+			tuple.t_tableOid = RelationGetRelid(rel);
+
+			switch (ZHeapTupleSatisfiesOldestXmin(&tuple, OldestXmin, buf,
+												  false, NULL, &xid, NULL))
+			{
+				case ZHEAPTUPLE_LIVE:
+				case ZHEAPTUPLE_DELETE_IN_PROGRESS:
+					sample.tuple_len += tuple.t_len;
+					sample.tuple_count++;
+					break;
+				case ZHEAPTUPLE_DEAD:
+				case ZHEAPTUPLE_RECENTLY_DEAD:
+				case ZHEAPTUPLE_INSERT_IN_PROGRESS:
+				case ZHEAPTUPLE_ABORT_IN_PROGRESS:
+					sample.dead_tuple_len += tuple.t_len;
+					sample.dead_tuple_count++;
+					break;
+				default:
+					elog(ERROR, "unexpected ZHeapTupleSatisfiesOldestXmin result");
+					break;
+			}
+		}
+
+		UnlockReleaseBuffer(buf);
+	}
+
+	/*
+	 * Scale the sample up to all the pages that aren't all-visible.  When
+	 * every such page was read, this is exact.
+	 */
+	if (nsampled > 0)
+	{
+		double		scale = (double) nnotvisible / nsampled;
+
+		stat->tuple_count += (uint64) (sample.tuple_count * scale + 0.5);
+		stat->tuple_len += (uint64) (sample.tuple_len * scale + 0.5);
+		stat->dead_tuple_count += (uint64) (sample.dead_tuple_count * scale + 0.5);
+		stat->dead_tuple_len += (uint64) (sample.dead_tuple_len * scale + 0.5);
 	}
 
+	/*
+	 * As in statapprox_heap, the live tuples in all-visible pages are
+	 * estimated the way VACUUM does it.  Everything but those pages counts
+	 * as seen here, since the sample was scaled up already.
+	 */
+	stat->tuple_count = vac_estimate_reltuples(rel, nblocks,
+											   nblocks - nskipped,
+											   stat->tuple_count);
+
+	statapprox_percentages(stat, nblocks, scanned);
+
 	if (BufferIsValid(vmbuffer))
 	{
 		ReleaseBuffer(vmbuffer);
 		vmbuffer = InvalidBuffer;
 	}
+	pfree(tpdblocks);
 }
 
 /*
@@ -289,11 +605,13 @@ pgstattuple_approx_internal(Oid relid, FunctionCallInfo fcinfo)
 				 errmsg("\"%s\" is not a table or materialized view",
 						RelationGetRelationName(rel))));
 
-	if (rel->rd_rel->relam != HEAP_TABLE_AM_OID)
+	if (rel->rd_rel->relam == HEAP_TABLE_AM_OID)
+		statapprox_heap(rel, &stat);
+	else if (rel->rd_rel->relam == ZHEAP_TABLE_AM_OID)
+		statapprox_zheap(rel, &stat);
+	else
 		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
-						errmsg("only heap AM is supported")));
-
-	statapprox_heap(rel, &stat);
+						errmsg("only heap and zheap AMs are supported")));
 
 	relation_close(rel, AccessShareLock);
 
@@ -117,3 +117,12 @@ drop view test_view;
 drop foreign table test_foreign_table;
 drop server dummy_server;
 drop foreign data wrapper dummy;
+
+-- pgstattuple_approx also works for zheap; small tables are read in full
+create table test_zheap (a int) using zheap with (autovacuum_enabled = off);
+insert into test_zheap select generate_series(1, 100);
+delete from test_zheap where a <= 10;
+select table_len / current_setting('block_size')::int as table_len,
+    scanned_percent, approx_tuple_count, dead_tuple_count
+    from pgstattuple_approx('test_zheap');
+drop table test_zheap;
@@ -0,0 +1,20 @@
+-- predictability
+SET synchronous_commit = on;
+
+SELECT 'init' FROM pg_create_logical_replication_slot('regression_slot', 'test_decoding');
+
+CREATE TABLE ztab (id int primary key, data text, num int) USING zheap;
+
+INSERT INTO ztab VALUES (1, 'one', 10), (2, 'two', NULL);
+UPDATE ztab SET num = 11 WHERE id = 1;
+UPDATE ztab SET data = 'a much longer second row' WHERE id = 2;
+DELETE FROM ztab WHERE id = 1;
+
+BEGIN;
+INSERT INTO ztab VALUES (3, 'rolled back', 30);
+ROLLBACK;
+
+SELECT data FROM pg_logical_slot_get_changes('regression_slot', NULL, NULL, 'include-xids', '0', 'skip-empty-xacts', '1');
+
+SELECT pg_drop_replication_slot('regression_slot');
+DROP TABLE ztab;
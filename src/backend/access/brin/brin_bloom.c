@@ -0,0 +1,459 @@
+/*
+ * brin_bloom.c
+ *		Implementation of Bloom opclass for BRIN
+ *
+ * A BRIN opclass summarizing page range into a bloom filter.
+ *
+ * Bloom filters allow efficient testing whether a given page range contains
+ * a particular value.  Therefore, if we summarize each page range into a
+ * bloom filter, we can easily and cheaply test whether it contains values
+ * we get later.
+ *
+ * The index only supports equality operators, similarly to hash indexes.
+ * Bloom indexes are however much smaller, and support only bitmap scans.
+ *
+ * Note: Don't confuse this with bloom indexes, implemented in a contrib
+ * module.  That extension implements an entirely new AM, building a bloom
+ * filter on multiple columns in a single row.  This opclass works with an
+ * existing AM (BRIN) and builds bloom filter on a column.
+ *
+ * The built-in operator classes have no way to accept parameters, so the
+ * filter is sized using fixed defaults: the number of distinct values per
+ * range is assumed to be a fraction (BLOOM_NDISTINCT_FRACTION) of the
+ * maximum number of tuples in the range, and the target false positive rate
+ * is BLOOM_FALSE_POSITIVE_RATE.  The filter is further capped so that the
+ * summaries of all indexed columns fit into a single index tuple.
+ *
+ * Each value is hashed by the opclass hash function (support procedure 11)
+ * and the resulting uint32 is then rehashed with two different seeds, to
+ * derive the values used by double hashing when setting the k bits.
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * IDENTIFICATION
+ *	  src/backend/access/brin/brin_bloom.c
+ */
+#include "postgres.h"
+
+#include <math.h>
+
+#include "access/brin.h"
+#include "access/brin_internal.h"
+#include "access/brin_page.h"
+#include "access/brin_tuple.h"
+#include "access/genam.h"
+#include "access/htup_details.h"
+#include "access/stratnum.h"
+#include "catalog/pg_type.h"
+#include "port/pg_bitutils.h"
+#include "utils/builtins.h"
+#include "utils/hashutils.h"
+#include "utils/rel.h"
+
+
+/*
+ * Additional SQL level support functions
+ *
+ * Procedure numbers must not use values reserved for BRIN itself; see
+ * brin_internal.h.
+ */
+#define		BLOOM_HASH_PROCNUM		11	/* required */
+
+/* only the equality strategy is supported */
+#define		BloomEqualStrategyNumber	1
+
+/*
+ * Fraction of the maximum number of tuples in a page range assumed to be
+ * distinct, and the minimum number of distinct values we size for.
+ */
+#define		BLOOM_NDISTINCT_FRACTION	0.1
+#define		BLOOM_MIN_NDISTINCT			16
+
+/* target false positive rate of the filter */
+#define		BLOOM_FALSE_POSITIVE_RATE	0.01
+
+/* seeds used to derive the two independent hashes from the value hash */
+#define		BLOOM_SEED_1	0x71d924af
+#define		BLOOM_SEED_2	0xba48b314
+
+/*
+ * Maximum size of the bloom filter, so that it fits into an index tuple on
+ * an otherwise empty BRIN page.  We also need to leave room for the other
+ * indexed columns, see bloom_filter_size().
+ */
+#define BloomMaxFilterSize \
+	MAXALIGN_DOWN(BLCKSZ - \
+				  (MAXALIGN(SizeOfPageHeaderData + \
+							sizeof(ItemIdData)) + \
+				   MAXALIGN(sizeof(BrinSpecialSpace)) + \
+				   SizeOfBrinTuple))
+
+/*
+ * Bloom filter, as stored in the index tuple (as a bytea value).
+ *
+ * nhashes is the number of hash functions (bits set per value), nbits the
+ * size of the bitmap, and nbits_set a running count of the bits set so far,
+ * useful when inspecting how saturated the filter is.
+ */
+typedef struct BloomFilter
+{
+	/* varlena header (do not touch directly!) */
+	int32		vl_len_;
+
+	/* space for various flags (unused for now) */
+	uint16		flags;
+
+	/* fields for the filter */
+	uint16		nhashes;		/* number of hash functions */
+	uint32		nbits;			/* number of bits in the bitmap */
+	uint32		nbits_set;		/* number of bits set to 1 */
+
+	/* data of the bloom filter */
+	char		data[FLEXIBLE_ARRAY_MEMBER];
+} BloomFilter;
+
+#define BloomFilterHeaderSize	offsetof(BloomFilter, data)
+
+
+/*
+ * Compute the size of the bloom filter (in bits) and the number of hash
+ * functions to use, for an index with the given number of pages per range
+ * and key columns.
+ */
+static void
+bloom_filter_size(Relation index, int *nbits, int *nhashes)
+{
+	double		ndistinct;
+	double		m;
+	int			maxbits;
+	int			k;
+
+	ndistinct = (double) MaxHeapTuplesPerPage * BrinGetPagesPerRange(index) *
+		BLOOM_NDISTINCT_FRACTION;
+	ndistinct = Max(ndistinct, BLOOM_MIN_NDISTINCT);
+
+	/* m = -(n * ln(p)) / ln(2)^2, rounded up to whole bytes */
+	m = ceil(-(ndistinct * log(BLOOM_FALSE_POSITIVE_RATE)) / pow(log(2.0), 2));
+	m = ceil(m / 8) * 8;
+
+	/* make sure the summaries of all key columns fit into an index tuple */
+	maxbits = (BloomMaxFilterSize / IndexRelationGetNumberOfKeyAttributes(index) -
+			   MAXALIGN(BloomFilterHeaderSize)) * 8;
+	m = Min(m, maxbits);
+
+	/* k = round(ln(2) * m / n) */
+	k = (int) rint(log(2.0) * m / ndistinct);
+	k = Max(k, 1);
+
+	*nbits = (int) m;
+	*nhashes = k;
+}
+
+/*
+ * Create an empty bloom filter, sized for the given index.
+ */
+static BloomFilter *
+bloom_init(Relation index)
+{
+	BloomFilter *filter;
+	int			nbits;
+	int			nhashes;
+	Size		len;
+
+	bloom_filter_size(index, &nbits, &nhashes);
+
+	len = BloomFilterHeaderSize + nbits / 8;
+
+	filter = (BloomFilter *) palloc0(len);
+	SET_VARSIZE(filter, len);
+	filter->nhashes = nhashes;
+	filter->nbits = nbits;
+
+	return filter;
+}
+
+/*
+ * Add a value (represented by its uint32 hash) to the filter.  Returns
+ * true if any new bit was set, i.e. if the filter was modified.
+ */
+static bool
+bloom_add_value(BloomFilter *filter, uint32 value)
+{
+	uint64		h1,
+				h2;
+	int			i;
+	bool		updated = false;
+
+	h1 = DatumGetUInt64(hash_uint32_extended(value, BLOOM_SEED_1)) % filter->nbits;
+	h2 = DatumGetUInt64(hash_uint32_extended(value, BLOOM_SEED_2)) % filter->nbits;
+
+	for (i = 0; i < filter->nhashes; i++)
+	{
+		/* double hashing to compute the bit position */
+		uint64		h = (h1 + i * h2) % filter->nbits;
+		uint32		byte = (h / 8);
+		uint32		bit = (h % 8);
+
+		/* if the bit is not set, set it and remember we did that */
+		if (!(filter->data[byte] & (0x01 << bit)))
+		{
+			filter->data[byte] |= (0x01 << bit);
+			filter->nbits_set++;
+			updated = true;
+		}
+	}
+
+	return updated;
+}
+
+/*
+ * Check if the filter contains a particular value (represented by its
+ * uint32 hash).  False positives are possible, false negatives are not.
+ */
+static bool
+bloom_contains_value(BloomFilter *filter, uint32 value)
+{
+	uint64		h1,
+				h2;
+	int			i;
+
+	h1 = DatumGetUInt64(hash_uint32_extended(value, BLOOM_SEED_1)) % filter->nbits;
+	h2 = DatumGetUInt64(hash_uint32_extended(value, BLOOM_SEED_2)) % filter->nbits;
+
+	for (i = 0; i < filter->nhashes; i++)
+	{
+		uint64		h = (h1 + i * h2) % filter->nbits;
+		uint32		byte = (h / 8);
+		uint32		bit = (h % 8);
+
+		/* if the bit is not set, the value is not there */
+		if (!(filter->data[byte] & (0x01 << bit)))
+			return false;
+	}
+
+	/* all hashes found in bloom filter */
+	return true;
+}
+
+/*
+ * Hash a value using the opclass hash function.
+ */
+static uint32
+bloom_hash_value(BrinDesc *bdesc, AttrNumber attno, Oid colloid, Datum value)
+{
+	FmgrInfo   *hashFn;
+
+	hashFn = index_getprocinfo(bdesc->bd_index, attno, BLOOM_HASH_PROCNUM);
+
+	return DatumGetUInt32(FunctionCall1Coll(hashFn, colloid, value));
+}
+
+
+Datum
+brin_bloom_opcinfo(PG_FUNCTION_ARGS)
+{
+	BrinOpcInfo *result;
+
+	/*
+	 * The summary is a single bytea value holding the filter, regardless of
+	 * the data type being indexed.
+	 */
+	result = palloc0(MAXALIGN(SizeofBrinOpcInfo(1)));
+	result->oi_nstored = 1;
+	result->oi_opaque = NULL;
+	result->oi_typcache[0] = lookup_type_cache(BYTEAOID, 0);
+
+	PG_RETURN_POINTER(result);
+}
+
+/*
+ * Examine the given index tuple (which contains partial status of a certain
+ * page range) by comparing it to the given value that comes from another heap
+ * tuple.  If the new value is not yet represented in the bloom filter,
+ * update the filter and return true.  Otherwise, return false and do not
+ * modify in this case.
+ */
+Datum
+brin_bloom_add_value(PG_FUNCTION_ARGS)
+{
+	BrinDesc   *bdesc = (BrinDesc *) PG_GETARG_POINTER(0);
+	BrinValues *column = (BrinValues *) PG_GETARG_POINTER(1);
+	Datum		newval = PG_GETARG_DATUM(2);
+	bool		isnull = PG_GETARG_DATUM(3);
+	Oid			colloid = PG_GET_COLLATION();
+	BloomFilter *filter;
+	bool		updated = false;
+
+	/*
+	 * If the new value is null, we record that we saw it if it's the first
+	 * one; otherwise, there's nothing to do.
+	 */
+	if (isnull)
+	{
+		if (column->bv_hasnulls)
+			PG_RETURN_BOOL(false);
+
+		column->bv_hasnulls = true;
+		PG_RETURN_BOOL(true);
+	}
+
+	/*
+	 * If this is the first non-null value, we need to initialize the bloom
+	 * filter.  Otherwise just extract the existing bloom filter from
+	 * BrinValues; the stored value may have a short varlena header, so make
+	 * sure we work on a properly aligned copy.
+	 */
+	if (column->bv_allnulls)
+	{
+		filter = bloom_init(bdesc->bd_index);
+		column->bv_values[0] = PointerGetDatum(filter);
+		column->bv_allnulls = false;
+		updated = true;
+	}
+	else
+	{
+		filter = (BloomFilter *) PG_DETOAST_DATUM(column->bv_values[0]);
+		if (PointerGetDatum(filter) != column->bv_values[0])
+		{
+			pfree(DatumGetPointer(column->bv_values[0]));
+			column->bv_values[0] = PointerGetDatum(filter);
+		}
+	}
+
+	updated |= bloom_add_value(filter,
+							   bloom_hash_value(bdesc, column->bv_attno,
+												colloid, newval));
+
+	PG_RETURN_BOOL(updated);
+}
+
+/*
+ * Given an index tuple corresponding to a certain page range and a scan key,
+ * return whether the scan key is consistent with the index tuple's bloom
+ * filter.  Return true if so, false otherwise.
+ */
+Datum
+brin_bloom_consistent(PG_FUNCTION_ARGS)
+{
+	BrinDesc   *bdesc = (BrinDesc *) PG_GETARG_POINTER(0);
+	BrinValues *column = (BrinValues *) PG_GETARG_POINTER(1);
+	ScanKey		key = (ScanKey) PG_GETARG_POINTER(2);
+	Oid			colloid = PG_GET_COLLATION();
+	BloomFilter *filter;
+	bool		matches;
+
+	Assert(key->sk_attno == column->bv_attno);
+
+	/* handle IS NULL/IS NOT NULL tests */
+	if (key->sk_flags & SK_ISNULL)
+	{
+		if (key->sk_flags & SK_SEARCHNULL)
+		{
+			if (column->bv_allnulls || column->bv_hasnulls)
+				PG_RETURN_BOOL(true);
+			PG_RETURN_BOOL(false);
+		}
+
+		/*
+		 * For IS NOT NULL, we can only skip ranges that are known to have
+		 * only nulls.
+		 */
+		if (key->sk_flags & SK_SEARCHNOTNULL)
+			PG_RETURN_BOOL(!column->bv_allnulls);
+
+		/*
+		 * Neither IS NULL nor IS NOT NULL was used; assume all indexable
+		 * operators are strict and return false.
+		 */
+		PG_RETURN_BOOL(false);
+	}
+
+	/* if the range is all empty, it cannot possibly be consistent */
+	if (column->bv_allnulls)
+		PG_RETURN_BOOL(false);
+
+	filter = (BloomFilter *) PG_DETOAST_DATUM(column->bv_values[0]);
+
+	switch (key->sk_strategy)
+	{
+		case BloomEqualStrategyNumber:
+
+			/*
+			 * In the equality case (WHERE col = someval), we want to return
+			 * the current page range if the bloom filter seems to contain
+			 * the value.
+			 */
+			matches = bloom_contains_value(filter,
+										   bloom_hash_value(bdesc, key->sk_attno,
+															colloid,
+															key->sk_argument));
+			break;
+		default:
+			/* shouldn't happen */
+			elog(ERROR, "invalid strategy number %d", key->sk_strategy);
+			matches = false;
+			break;
+	}
+
+	PG_RETURN_BOOL(matches);
+}
+
+/*
+ * Given two BrinValues, update the first of them as a union of the summary
+ * values contained in both.  The second one is untouched.
+ *
+ * Both filters were built for the same index, so they have the same size
+ * and number of hash functions, and the union is simply a bitwise OR.
+ */
+Datum
+brin_bloom_union(PG_FUNCTION_ARGS)
+{
+	BrinValues *col_a = (BrinValues *) PG_GETARG_POINTER(1);
+	BrinValues *col_b = (BrinValues *) PG_GETARG_POINTER(2);
+	BloomFilter *filter_a;
+	BloomFilter *filter_b;
+	uint32		i;
+	uint32		nbytes;
+
+	Assert(col_a->bv_attno == col_b->bv_attno);
+
+	/* Adjust "hasnulls" */
+	if (!col_a->bv_hasnulls && col_b->bv_hasnulls)
+		col_a->bv_hasnulls = true;
+
+	/* If there are no values in B, there's nothing left to do */
+	if (col_b->bv_allnulls)
+		PG_RETURN_VOID();
+
+	/*
+	 * Adjust "allnulls".  If A doesn't have values, just copy the filter
+	 * from B into A, and we're done.
+	 */
+	if (col_a->bv_allnulls)
+	{
+		col_a->bv_allnulls = false;
+		col_a->bv_values[0] = PointerGetDatum(PG_DETOAST_DATUM_COPY(col_b->bv_values[0]));
+		PG_RETURN_VOID();
+	}
+
+	filter_a = (BloomFilter *) PG_DETOAST_DATUM(col_a->bv_values[0]);
+	filter_b = (BloomFilter *) PG_DETOAST_DATUM(col_b->bv_values[0]);
+
+	Assert(filter_a->nbits == filter_b->nbits);
+	Assert(filter_a->nhashes == filter_b->nhashes);
+
+	nbytes = filter_a->nbits / 8;
+	for (i = 0; i < nbytes; i++)
+		filter_a->data[i] |= filter_b->data[i];
+
+	filter_a->nbits_set = pg_popcount(filter_a->data, nbytes);
+
+	if (PointerGetDatum(filter_a) != col_a->bv_values[0])
+	{
+		pfree(DatumGetPointer(col_a->bv_values[0]));
+		col_a->bv_values[0] = PointerGetDatum(filter_a);
+	}
+
+	PG_RETURN_VOID();
+}
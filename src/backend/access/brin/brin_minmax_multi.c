@@ -0,0 +1,953 @@
+/*
+ * brin_minmax_multi.c
+ *		Implementation of Multi Min/Max opclass for BRIN
+ *
+ * Implements a variant of minmax opclass, where the summary is composed of
+ * multiple smaller intervals.  This allows us to handle outliers, which
+ * usually make the simple minmax opclass inefficient: a single value far
+ * away from the rest of the range is enough to make the interval cover
+ * nearly everything, rendering the summary useless for pruning.
+ *
+ * The summary is a sorted list of disjoint intervals.  Each interval is
+ * either a regular range [lo, hi], or a single point (lo = hi), which only
+ * needs to store one value.  When a new value does not fall into any of the
+ * existing intervals, it's added as a new point.  When the number of stored
+ * values exceeds the limit (MINMAX_MULTI_MAX_VALUES), the two closest
+ * adjacent intervals are merged, using the opclass "distance" function
+ * (support procedure 11) to decide which intervals are closest.
+ *
+ * The built-in operator classes have no way to accept parameters, so the
+ * number of values per range is fixed.
+ *
+ * The summary is stored in the index tuple as a single bytea value, see
+ * SerializedRanges.  All the work on the deserialized form is done in a
+ * short-lived memory context, which is reset at the end of each call, so
+ * that summarizing a large table does not accumulate garbage.
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * IDENTIFICATION
+ *	  src/backend/access/brin/brin_minmax_multi.c
+ */
+#include "postgres.h"
+
+#include <math.h>
+
+#include "access/brin_internal.h"
+#include "access/brin_tuple.h"
+#include "access/genam.h"
+#include "access/stratnum.h"
+#include "access/tupmacs.h"
+#include "catalog/pg_amop.h"
+#include "catalog/pg_type.h"
+#include "utils/builtins.h"
+#include "utils/date.h"
+#include "utils/float.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/numeric.h"
+#include "utils/pg_lsn.h"
+#include "utils/rel.h"
+#include "utils/syscache.h"
+#include "utils/timestamp.h"
+#include "utils/uuid.h"
+
+
+/*
+ * Additional SQL level support functions
+ *
+ * Procedure numbers must not use values reserved for BRIN itself; see
+ * brin_internal.h.
+ */
+#define		MINMAX_MULTI_DISTANCE_PROCNUM	11	/* required */
+
+/* maximum number of boundary values stored per page range */
+#define		MINMAX_MULTI_MAX_VALUES		32
+
+typedef struct MinmaxMultiOpaque
+{
+	MemoryContext tmpcxt;		/* reset at the end of each call */
+	Oid			cached_subtype;
+	FmgrInfo	strategy_procinfos[BTMaxStrategyNumber];
+} MinmaxMultiOpaque;
+
+/*
+ * Serialized summary, as stored in the index tuple (as a bytea value).
+ *
+ * The data part contains one flag byte per interval (true for single
+ * points), followed by the boundary values of all intervals in ascending
+ * order.  Points store a single value, regular ranges store two.
+ */
+typedef struct SerializedRanges
+{
+	/* varlena header (do not touch directly!) */
+	int32		vl_len_;
+
+	Oid			typid;			/* type of the indexed values */
+	int32		maxvalues;		/* maximum number of values */
+	int32		nintervals;		/* number of intervals */
+
+	char		data[FLEXIBLE_ARRAY_MEMBER];
+} SerializedRanges;
+
+/* A single interval of the deserialized summary */
+typedef struct MinmaxMultiInterval
+{
+	Datum		lo;
+	Datum		hi;
+	bool		point;			/* single value, lo and hi are the same */
+} MinmaxMultiInterval;
+
+/* Deserialized summary */
+typedef struct Ranges
+{
+	Oid			typid;
+	int			maxvalues;
+	int			nintervals;
+	int			maxintervals;	/* allocated size of intervals[] */
+	MinmaxMultiInterval *intervals;
+} Ranges;
+
+/* Comparator state for qsort_arg */
+typedef struct compare_context
+{
+	FmgrInfo   *cmpFn;
+	Oid			colloid;
+} compare_context;
+
+static FmgrInfo *minmax_multi_get_strategy_procinfo(BrinDesc *bdesc,
+													uint16 attno, Oid subtype,
+													uint16 strategynum);
+
+
+/*
+ * Return the short-lived memory context for the given attribute, creating
+ * it if needed.
+ */
+static MemoryContext
+minmax_multi_get_tmpcxt(BrinDesc *bdesc, AttrNumber attno)
+{
+	MinmaxMultiOpaque *opaque;
+
+	opaque = (MinmaxMultiOpaque *) bdesc->bd_info[attno - 1]->oi_opaque;
+
+	if (opaque->tmpcxt == NULL)
+		opaque->tmpcxt = AllocSetContextCreate(bdesc->bd_context,
+											   "minmax-multi temporary context",
+											   ALLOCSET_DEFAULT_SIZES);
+
+	return opaque->tmpcxt;
+}
+
+/* Number of values needed to store the given intervals */
+static int
+ranges_nvalues(Ranges *ranges)
+{
+	int			i;
+	int			nvalues = 0;
+
+	for (i = 0; i < ranges->nintervals; i++)
+		nvalues += ranges->intervals[i].point ? 1 : 2;
+
+	return nvalues;
+}
+
+static Ranges *
+ranges_init(Oid typid, int maxintervals)
+{
+	Ranges	   *ranges = palloc0(sizeof(Ranges));
+
+	ranges->typid = typid;
+	ranges->maxvalues = MINMAX_MULTI_MAX_VALUES;
+	ranges->maxintervals = Max(maxintervals, 1);
+	ranges->intervals = palloc(sizeof(MinmaxMultiInterval) *
+							   ranges->maxintervals);
+
+	return ranges;
+}
+
+/* Size of a single serialized value */
+static Size
+serialized_value_size(Datum value, Form_pg_attribute attr)
+{
+	if (attr->attbyval || attr->attlen > 0)
+		return attr->attlen;
+	else if (attr->attlen == -1)
+		return VARSIZE_ANY(DatumGetPointer(value));
+
+	elog(ERROR, "unsupported type length %d", attr->attlen);
+	return 0;					/* keep compiler quiet */
+}
+
+static char *
+serialize_value(char *ptr, Datum value, Form_pg_attribute attr)
+{
+	Size		len = serialized_value_size(value, attr);
+
+	if (attr->attbyval)
+	{
+		Datum		tmp;
+
+		store_att_byval(&tmp, value, attr->attlen);
+		memcpy(ptr, &tmp, len);
+	}
+	else
+		memcpy(ptr, DatumGetPointer(value), len);
+
+	return ptr + len;
+}
+
+/*
+ * Serialize the summary into a bytea value, allocated in the current memory
+ * context.
+ */
+static SerializedRanges *
+serialize_ranges(Ranges *ranges, Form_pg_attribute attr)
+{
+	SerializedRanges *serialized;
+	Size		len;
+	char	   *ptr;
+	int			i;
+
+	len = offsetof(SerializedRanges, data) + ranges->nintervals;
+	for (i = 0; i < ranges->nintervals; i++)
+	{
+		MinmaxMultiInterval *interval = &ranges->intervals[i];
+
+		len += serialized_value_size(interval->lo, attr);
+		if (!interval->point)
+			len += serialized_value_size(interval->hi, attr);
+	}
+
+	serialized = (SerializedRanges *) palloc0(len);
+	SET_VARSIZE(serialized, len);
+	serialized->typid = ranges->typid;
+	serialized->maxvalues = ranges->maxvalues;
+	serialized->nintervals = ranges->nintervals;
+
+	ptr = serialized->data;
+	for (i = 0; i < ranges->nintervals; i++)
+		*ptr++ = ranges->intervals[i].point ? 1 : 0;
+
+	for (i = 0; i < ranges->nintervals; i++)
+	{
+		MinmaxMultiInterval *interval = &ranges->intervals[i];
+
+		ptr = serialize_value(ptr, interval->lo, attr);
+		if (!interval->point)
+			ptr = serialize_value(ptr, interval->hi, attr);
+	}
+
+	Assert(ptr == (char *) serialized + len);
+
+	return serialized;
+}
+
+/*
+ * Deserialize a single value.  By-reference values are copied to properly
+ * aligned memory, as the serialized form does not keep any alignment.
+ */
+static Datum
+deserialize_value(char **ptr, Form_pg_attribute attr)
+{
+	Datum		value;
+	Size		len;
+
+	if (attr->attbyval)
+	{
+		Datum		tmp = 0;
+
+		memcpy(&tmp, *ptr, attr->attlen);
+		value = fetch_att(&tmp, true, attr->attlen);
+		len = attr->attlen;
+	}
+	else
+	{
+		char	   *copy;
+
+		if (attr->attlen > 0)
+			len = attr->attlen;
+		else
+		{
+			/* copy the header first, to read the length without alignment */
+			union
+			{
+				varattrib_4b hdr;
+				char		bytes[VARHDRSZ];
+			}			hdr;
+
+			memcpy(hdr.bytes, *ptr, VARATT_IS_1B(*ptr) ? 1 : VARHDRSZ);
+			len = VARSIZE_ANY(&hdr);
+		}
+
+		copy = palloc(len);
+		memcpy(copy, *ptr, len);
+		value = PointerGetDatum(copy);
+	}
+
+	*ptr += len;
+
+	return value;
+}
+
+/*
+ * Deserialize the summary, allocating the result in the current memory
+ * context.  Room is left for extra intervals, to be added by the caller.
+ */
+static Ranges *
+deserialize_ranges(SerializedRanges *serialized, Form_pg_attribute attr,
+				   int extra)
+{
+	Ranges	   *ranges;
+	char	   *flags;
+	char	   *ptr;
+	int			i;
+
+	if (serialized->typid != attr->atttypid)
+		elog(ERROR, "minmax-multi summary type %u does not match column type %u",
+			 serialized->typid, attr->atttypid);
+
+	ranges = ranges_init(serialized->typid, serialized->nintervals + extra);
+	ranges->maxvalues = serialized->maxvalues;
+	ranges->nintervals = serialized->nintervals;
+
+	flags = serialized->data;
+	ptr = serialized->data + serialized->nintervals;
+	for (i = 0; i < serialized->nintervals; i++)
+	{
+		MinmaxMultiInterval *interval = &ranges->intervals[i];
+
+		interval->point = (flags[i] != 0);
+		interval->lo = deserialize_value(&ptr, attr);
+		interval->hi = interval->point ? interval->lo :
+			deserialize_value(&ptr, attr);
+	}
+
+	Assert(ptr == (char *) serialized + VARSIZE(serialized));
+
+	return ranges;
+}
+
+/*
+ * Merge the closest adjacent intervals until the summary fits into the
+ * maximum number of values.
+ */
+static void
+reduce_ranges(Ranges *ranges, FmgrInfo *distanceFn, Oid colloid)
+{
+	while (ranges->nintervals > 1 &&
+		   ranges_nvalues(ranges) > ranges->maxvalues)
+	{
+		MinmaxMultiInterval *intervals = ranges->intervals;
+		double		mindistance = 0;
+		int			minidx = -1;
+		int			i;
+
+		for (i = 0; i < ranges->nintervals - 1; i++)
+		{
+			double		distance;
+
+			distance = DatumGetFloat8(FunctionCall2Coll(distanceFn, colloid,
+														intervals[i].hi,
+														intervals[i + 1].lo));
+
+			/* treat NaN (e.g. from NaN float values) as infinitely far */
+			if (isnan(distance))
+				distance = get_float8_infinity();
+
+			if (minidx < 0 || distance < mindistance)
+			{
+				mindistance = distance;
+				minidx = i;
+			}
+		}
+
+		/* merge the two intervals, and remove the second one */
+		intervals[minidx].hi = intervals[minidx + 1].hi;
+		intervals[minidx].point = false;
+
+		memmove(&intervals[minidx + 1], &intervals[minidx + 2],
+				sizeof(MinmaxMultiInterval) *
+				(ranges->nintervals - minidx - 2));
+		ranges->nintervals--;
+	}
+}
+
+static int
+compare_intervals(const void *a, const void *b, void *arg)
+{
+	const MinmaxMultiInterval *ia = (const MinmaxMultiInterval *) a;
+	const MinmaxMultiInterval *ib = (const MinmaxMultiInterval *) b;
+	compare_context *cxt = (compare_context *) arg;
+
+	if (DatumGetBool(FunctionCall2Coll(cxt->cmpFn, cxt->colloid,
+									   ia->lo, ib->lo)))
+		return -1;
+	if (DatumGetBool(FunctionCall2Coll(cxt->cmpFn, cxt->colloid,
+									   ib->lo, ia->lo)))
+		return 1;
+	return 0;
+}
+
+
+Datum
+brin_minmax_multi_opcinfo(PG_FUNCTION_ARGS)
+{
+	BrinOpcInfo *result;
+
+	/*
+	 * opaque->strategy_procinfos is initialized lazily; here it is set to
+	 * all-uninitialized by palloc0 which sets fn_oid to InvalidOid.
+	 *
+	 * The summary is a single bytea value, regardless of the data type being
+	 * indexed.
+	 */
+	result = palloc0(MAXALIGN(SizeofBrinOpcInfo(1)) +
+					 sizeof(MinmaxMultiOpaque));
+	result->oi_nstored = 1;
+	result->oi_opaque = (MinmaxMultiOpaque *)
+		MAXALIGN((char *) result + SizeofBrinOpcInfo(1));
+	result->oi_typcache[0] = lookup_type_cache(BYTEAOID, 0);
+
+	PG_RETURN_POINTER(result);
+}
+
+/*
+ * Examine the given index tuple (which contains partial status of a certain
+ * page range) by comparing it to the given value that comes from another heap
+ * tuple.  If the new value is outside all the intervals of the existing
+ * summary, add it (merging intervals if needed) and return true.  Otherwise,
+ * return false and do not modify in this case.
+ */
+Datum
+brin_minmax_multi_add_value(PG_FUNCTION_ARGS)
+{
+	BrinDesc   *bdesc = (BrinDesc *) PG_GETARG_POINTER(0);
+	BrinValues *column = (BrinValues *) PG_GETARG_POINTER(1);
+	Datum		newval = PG_GETARG_DATUM(2);
+	bool		isnull = PG_GETARG_DATUM(3);
+	Oid			colloid = PG_GET_COLLATION();
+	AttrNumber	attno;
+	Form_pg_attribute attr;
+	MemoryContext tmpcxt;
+	MemoryContext oldcxt;
+	Ranges	   *ranges;
+	SerializedRanges *serialized;
+	FmgrInfo   *cmpFn;
+	FmgrInfo   *distanceFn;
+	int			lo,
+				hi;
+
+	/*
+	 * If the new value is null, we record that we saw it if it's the first
+	 * one; otherwise, there's nothing to do.
+	 */
+	if (isnull)
+	{
+		if (column->bv_hasnulls)
+			PG_RETURN_BOOL(false);
+
+		column->bv_hasnulls = true;
+		PG_RETURN_BOOL(true);
+	}
+
+	attno = column->bv_attno;
+	attr = TupleDescAttr(bdesc->bd_tupdesc, attno - 1);
+
+	cmpFn = minmax_multi_get_strategy_procinfo(bdesc, attno, attr->atttypid,
+											   BTLessStrategyNumber);
+	distanceFn = index_getprocinfo(bdesc->bd_index, attno,
+								   MINMAX_MULTI_DISTANCE_PROCNUM);
+
+	tmpcxt = minmax_multi_get_tmpcxt(bdesc, attno);
+	oldcxt = MemoryContextSwitchTo(tmpcxt);
+
+	/* we must not store toasted values in the summary */
+	if (attr->attlen == -1)
+		newval = PointerGetDatum(PG_DETOAST_DATUM_PACKED(newval));
+
+	if (column->bv_allnulls)
+		ranges = ranges_init(attr->atttypid, 1);
+	else
+	{
+		serialized = (SerializedRanges *) PG_DETOAST_DATUM(column->bv_values[0]);
+		ranges = deserialize_ranges(serialized, attr, 1);
+	}
+
+	/*
+	 * Find the first interval starting after the new value.  If the interval
+	 * just before it also ends at or after the new value, the value is
+	 * already covered by the summary.
+	 */
+	lo = 0;
+	hi = ranges->nintervals;
+	while (lo < hi)
+	{
+		int			mid = lo + (hi - lo) / 2;
+
+		if (DatumGetBool(FunctionCall2Coll(cmpFn, colloid, newval,
+										   ranges->intervals[mid].lo)))
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	if (lo > 0 &&
+		!DatumGetBool(FunctionCall2Coll(cmpFn, colloid,
+										ranges->intervals[lo - 1].hi, newval)))
+	{
+		MemoryContextSwitchTo(oldcxt);
+		MemoryContextReset(tmpcxt);
+		PG_RETURN_BOOL(false);
+	}
+
+	/* insert the value as a new point, and compact the summary if needed */
+	memmove(&ranges->intervals[lo + 1], &ranges->intervals[lo],
+			sizeof(MinmaxMultiInterval) * (ranges->nintervals - lo));
+	ranges->intervals[lo].lo = ranges->intervals[lo].hi = newval;
+	ranges->intervals[lo].point = true;
+	ranges->nintervals++;
+
+	reduce_ranges(ranges, distanceFn, colloid);
+
+	MemoryContextSwitchTo(oldcxt);
+
+	serialized = serialize_ranges(ranges, attr);
+
+	if (!column->bv_allnulls)
+		pfree(DatumGetPointer(column->bv_values[0]));
+	column->bv_values[0] = PointerGetDatum(serialized);
+	column->bv_allnulls = false;
+
+	MemoryContextReset(tmpcxt);
+
+	PG_RETURN_BOOL(true);
+}
+
+/*
+ * Given an index tuple corresponding to a certain page range and a scan key,
+ * return whether the scan key is consistent with the index tuple's summary.
+ * Return true if so, false otherwise.
+ */
+Datum
+brin_minmax_multi_consistent(PG_FUNCTION_ARGS)
+{
+	BrinDesc   *bdesc = (BrinDesc *) PG_GETARG_POINTER(0);
+	BrinValues *column = (BrinValues *) PG_GETARG_POINTER(1);
+	ScanKey		key = (ScanKey) PG_GETARG_POINTER(2);
+	Oid			colloid = PG_GET_COLLATION(),
+				subtype;
+	AttrNumber	attno;
+	Form_pg_attribute attr;
+	Datum		value;
+	bool		matches = false;
+	FmgrInfo   *finfo;
+	MemoryContext tmpcxt;
+	MemoryContext oldcxt;
+	Ranges	   *ranges;
+	int			i;
+
+	Assert(key->sk_attno == column->bv_attno);
+
+	/* handle IS NULL/IS NOT NULL tests */
+	if (key->sk_flags & SK_ISNULL)
+	{
+		if (key->sk_flags & SK_SEARCHNULL)
+		{
+			if (column->bv_allnulls || column->bv_hasnulls)
+				PG_RETURN_BOOL(true);
+			PG_RETURN_BOOL(false);
+		}
+
+		/*
+		 * For IS NOT NULL, we can only skip ranges that are known to have
+		 * only nulls.
+		 */
+		if (key->sk_flags & SK_SEARCHNOTNULL)
+			PG_RETURN_BOOL(!column->bv_allnulls);
+
+		/*
+		 * Neither IS NULL nor IS NOT NULL was used; assume all indexable
+		 * operators are strict and return false.
+		 */
+		PG_RETURN_BOOL(false);
+	}
+
+	/* if the range is all empty, it cannot possibly be consistent */
+	if (column->bv_allnulls)
+		PG_RETURN_BOOL(false);
+
+	attno = key->sk_attno;
+	attr = TupleDescAttr(bdesc->bd_tupdesc, attno - 1);
+	subtype = key->sk_subtype;
+	value = key->sk_argument;
+
+	tmpcxt = minmax_multi_get_tmpcxt(bdesc, attno);
+	oldcxt = MemoryContextSwitchTo(tmpcxt);
+
+	ranges = deserialize_ranges((SerializedRanges *)
+								PG_DETOAST_DATUM(column->bv_values[0]),
+								attr, 0);
+
+	switch (key->sk_strategy)
+	{
+		case BTLessStrategyNumber:
+		case BTLessEqualStrategyNumber:
+			/* only the minimum of the first interval matters */
+			finfo = minmax_multi_get_strategy_procinfo(bdesc, attno, subtype,
+													   key->sk_strategy);
+			matches = DatumGetBool(FunctionCall2Coll(finfo, colloid,
+													 ranges->intervals[0].lo,
+													 value));
+			break;
+		case BTEqualStrategyNumber:
+			{
+				FmgrInfo   *leFn;
+				FmgrInfo   *geFn;
+
+				/*
+				 * In the equality case (WHERE col = someval), we want to
+				 * return the current page range if any of the intervals
+				 * contains the scan key.
+				 */
+				leFn = minmax_multi_get_strategy_procinfo(bdesc, attno, subtype,
+														  BTLessEqualStrategyNumber);
+				geFn = minmax_multi_get_strategy_procinfo(bdesc, attno, subtype,
+														  BTGreaterEqualStrategyNumber);
+
+				for (i = 0; i < ranges->nintervals; i++)
+				{
+					MinmaxMultiInterval *interval = &ranges->intervals[i];
+
+					/* intervals are sorted, so stop once we're past value */
+					if (!DatumGetBool(FunctionCall2Coll(leFn, colloid,
+														interval->lo, value)))
+						break;
+
+					if (DatumGetBool(FunctionCall2Coll(geFn, colloid,
+													   interval->hi, value)))
+					{
+						matches = true;
+						break;
+					}
+				}
+			}
+			break;
+		case BTGreaterEqualStrategyNumber:
+		case BTGreaterStrategyNumber:
+			/* only the maximum of the last interval matters */
+			finfo = minmax_multi_get_strategy_procinfo(bdesc, attno, subtype,
+													   key->sk_strategy);
+			matches = DatumGetBool(FunctionCall2Coll(finfo, colloid,
+													 ranges->intervals[ranges->nintervals - 1].hi,
+													 value));
+			break;
+		default:
+			/* shouldn't happen */
+			elog(ERROR, "invalid strategy number %d", key->sk_strategy);
+			break;
+	}
+
+	MemoryContextSwitchTo(oldcxt);
+	MemoryContextReset(tmpcxt);
+
+	PG_RETURN_BOOL(matches);
+}
+
+/*
+ * Given two BrinValues, update the first of them as a union of the summary
+ * values contained in both.  The second one is untouched.
+ */
+Datum
+brin_minmax_multi_union(PG_FUNCTION_ARGS)
+{
+	BrinDesc   *bdesc = (BrinDesc *) PG_GETARG_POINTER(0);
+	BrinValues *col_a = (BrinValues *) PG_GETARG_POINTER(1);
+	BrinValues *col_b = (BrinValues *) PG_GETARG_POINTER(2);
+	Oid			colloid = PG_GET_COLLATION();
+	AttrNumber	attno;
+	Form_pg_attribute attr;
+	MemoryContext tmpcxt;
+	MemoryContext oldcxt;
+	Ranges	   *ranges_a;
+	Ranges	   *ranges_b;
+	SerializedRanges *serialized;
+	compare_context cxt;
+	int			i;
+	int			n;
+
+	Assert(col_a->bv_attno == col_b->bv_attno);
+
+	/* Adjust "hasnulls" */
+	if (!col_a->bv_hasnulls && col_b->bv_hasnulls)
+		col_a->bv_hasnulls = true;
+
+	/* If there are no values in B, there's nothing left to do */
+	if (col_b->bv_allnulls)
+		PG_RETURN_VOID();
+
+	/*
+	 * Adjust "allnulls".  If A doesn't have values, just copy the summary
+	 * from B into A, and we're done.
+	 */
+	if (col_a->bv_allnulls)
+	{
+		col_a->bv_allnulls = false;
+		col_a->bv_values[0] = PointerGetDatum(PG_DETOAST_DATUM_COPY(col_b->bv_values[0]));
+		PG_RETURN_VOID();
+	}
+
+	attno = col_a->bv_attno;
+	attr = TupleDescAttr(bdesc->bd_tupdesc, attno - 1);
+
+	cxt.cmpFn = minmax_multi_get_strategy_procinfo(bdesc, attno,
+												   attr->atttypid,
+												   BTLessStrategyNumber);
+	cxt.colloid = colloid;
+
+	tmpcxt = minmax_multi_get_tmpcxt(bdesc, attno);
+	oldcxt = MemoryContextSwitchTo(tmpcxt);
+
+	ranges_b = deserialize_ranges((SerializedRanges *)
+								  PG_DETOAST_DATUM(col_b->bv_values[0]),
+								  attr, 0);
+	ranges_a = deserialize_ranges((SerializedRanges *)
+								  PG_DETOAST_DATUM(col_a->bv_values[0]),
+								  attr, ranges_b->nintervals);
+
+	/* combine the intervals of both summaries, and sort them */
+	memcpy(&ranges_a->intervals[ranges_a->nintervals], ranges_b->intervals,
+		   sizeof(MinmaxMultiInterval) * ranges_b->nintervals);
+	ranges_a->nintervals += ranges_b->nintervals;
+
+	qsort_arg(ranges_a->intervals, ranges_a->nintervals,
+			  sizeof(MinmaxMultiInterval), compare_intervals, &cxt);
+
+	/* coalesce overlapping intervals, so that they are disjoint again */
+	n = 0;
+	for (i = 1; i < ranges_a->nintervals; i++)
+	{
+		MinmaxMultiInterval *cur = &ranges_a->intervals[n];
+		MinmaxMultiInterval *next = &ranges_a->intervals[i];
+
+		if (DatumGetBool(FunctionCall2Coll(cxt.cmpFn, colloid,
+										   cur->hi, next->lo)))
+		{
+			ranges_a->intervals[++n] = *next;
+			continue;
+		}
+
+		if (DatumGetBool(FunctionCall2Coll(cxt.cmpFn, colloid,
+										   cur->hi, next->hi)))
+			cur->hi = next->hi;
+		cur->point = cur->point && next->point;
+	}
+	ranges_a->nintervals = n + 1;
+
+	reduce_ranges(ranges_a,
+				  index_getprocinfo(bdesc->bd_index, attno,
+									MINMAX_MULTI_DISTANCE_PROCNUM),
+				  colloid);
+
+	MemoryContextSwitchTo(oldcxt);
+
+	serialized = serialize_ranges(ranges_a, attr);
+
+	pfree(DatumGetPointer(col_a->bv_values[0]));
+	col_a->bv_values[0] = PointerGetDatum(serialized);
+
+	MemoryContextReset(tmpcxt);
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * Cache and return the procedure for the given strategy.
+ *
+ * Note: this function mirrors minmax_get_strategy_procinfo; see notes
+ * there.  If changes are made here, see that function too.
+ */
+static FmgrInfo *
+minmax_multi_get_strategy_procinfo(BrinDesc *bdesc, uint16 attno, Oid subtype,
+								   uint16 strategynum)
+{
+	MinmaxMultiOpaque *opaque;
+
+	Assert(strategynum >= 1 &&
+		   strategynum <= BTMaxStrategyNumber);
+
+	opaque = (MinmaxMultiOpaque *) bdesc->bd_info[attno - 1]->oi_opaque;
+
+	/*
+	 * We cache the procedures for the previous subtype in the opaque struct,
+	 * to avoid repetitive syscache lookups.  If the subtype changed,
+	 * invalidate all the cached entries.
+	 */
+	if (opaque->cached_subtype != subtype)
+	{
+		uint16		i;
+
+		for (i = 1; i <= BTMaxStrategyNumber; i++)
+			opaque->strategy_procinfos[i - 1].fn_oid = InvalidOid;
+		opaque->cached_subtype = subtype;
+	}
+
+	if (opaque->strategy_procinfos[strategynum - 1].fn_oid == InvalidOid)
+	{
+		Form_pg_attribute attr;
+		HeapTuple	tuple;
+		Oid			opfamily,
+					oprid;
+		bool		isNull;
+
+		opfamily = bdesc->bd_index->rd_opfamily[attno - 1];
+		attr = TupleDescAttr(bdesc->bd_tupdesc, attno - 1);
+		tuple = SearchSysCache4(AMOPSTRATEGY, ObjectIdGetDatum(opfamily),
+								ObjectIdGetDatum(attr->atttypid),
+								ObjectIdGetDatum(subtype),
+								Int16GetDatum(strategynum));
+
+		if (!HeapTupleIsValid(tuple))
+			elog(ERROR, "missing operator %d(%u,%u) in opfamily %u",
+				 strategynum, attr->atttypid, subtype, opfamily);
+
+		oprid = DatumGetObjectId(SysCacheGetAttr(AMOPSTRATEGY, tuple,
+												 Anum_pg_amop_amopopr, &isNull));
+		ReleaseSysCache(tuple);
+		Assert(!isNull && RegProcedureIsValid(oprid));
+
+		fmgr_info_cxt(get_opcode(oprid),
+					  &opaque->strategy_procinfos[strategynum - 1],
+					  bdesc->bd_context);
+	}
+
+	return &opaque->strategy_procinfos[strategynum - 1];
+}
+
+/*
+ * Distance functions, used to decide which intervals to merge.
+ *
+ * Each computes the distance between two values a <= b of the given type,
+ * as a float8.  Only the relative magnitude of the distances matters, so
+ * the units are whatever is natural for the type.
+ */
+Datum
+brin_minmax_multi_distance_int2(PG_FUNCTION_ARGS)
+{
+	int16		a = PG_GETARG_INT16(0);
+	int16		b = PG_GETARG_INT16(1);
+
+	Assert(a <= b);
+
+	PG_RETURN_FLOAT8((double) b - (double) a);
+}
+
+Datum
+brin_minmax_multi_distance_int4(PG_FUNCTION_ARGS)
+{
+	int32		a = PG_GETARG_INT32(0);
+	int32		b = PG_GETARG_INT32(1);
+
+	Assert(a <= b);
+
+	PG_RETURN_FLOAT8((double) b - (double) a);
+}
+
+Datum
+brin_minmax_multi_distance_int8(PG_FUNCTION_ARGS)
+{
+	int64		a = PG_GETARG_INT64(0);
+	int64		b = PG_GETARG_INT64(1);
+
+	Assert(a <= b);
+
+	PG_RETURN_FLOAT8((double) b - (double) a);
+}
+
+Datum
+brin_minmax_multi_distance_float4(PG_FUNCTION_ARGS)
+{
+	float		a = PG_GETARG_FLOAT4(0);
+	float		b = PG_GETARG_FLOAT4(1);
+
+	PG_RETURN_FLOAT8((double) b - (double) a);
+}
+
+Datum
+brin_minmax_multi_distance_float8(PG_FUNCTION_ARGS)
+{
+	double		a = PG_GETARG_FLOAT8(0);
+	double		b = PG_GETARG_FLOAT8(1);
+
+	PG_RETURN_FLOAT8(b - a);
+}
+
+Datum
+brin_minmax_multi_distance_numeric(PG_FUNCTION_ARGS)
+{
+	Datum		a = PG_GETARG_DATUM(0);
+	Datum		b = PG_GETARG_DATUM(1);
+	Datum		d;
+
+	d = DirectFunctionCall2(numeric_sub, b, a);
+
+	PG_RETURN_DATUM(DirectFunctionCall1(numeric_float8, d));
+}
+
+Datum
+brin_minmax_multi_distance_date(PG_FUNCTION_ARGS)
+{
+	DateADT		a = PG_GETARG_DATEADT(0);
+	DateADT		b = PG_GETARG_DATEADT(1);
+
+	if (DATE_NOT_FINITE(a) || DATE_NOT_FINITE(b))
+		PG_RETURN_FLOAT8(get_float8_infinity());
+
+	PG_RETURN_FLOAT8((double) b - (double) a);
+}
+
+/* also used for timestamptz, which has the same representation */
+Datum
+brin_minmax_multi_distance_timestamp(PG_FUNCTION_ARGS)
+{
+	Timestamp	a = PG_GETARG_TIMESTAMP(0);
+	Timestamp	b = PG_GETARG_TIMESTAMP(1);
+
+	if (TIMESTAMP_NOT_FINITE(a) || TIMESTAMP_NOT_FINITE(b))
+		PG_RETURN_FLOAT8(get_float8_infinity());
+
+	PG_RETURN_FLOAT8((double) b - (double) a);
+}
+
+Datum
+brin_minmax_multi_distance_uuid(PG_FUNCTION_ARGS)
+{
+	pg_uuid_t  *a = PG_GETARG_UUID_P(0);
+	pg_uuid_t  *b = PG_GETARG_UUID_P(1);
+	double		delta = 0;
+	int			i;
+
+	/*
+	 * Compute an approximate difference, treating the UUIDs as big-endian
+	 * numbers; the least significant bytes hardly matter.
+	 */
+	for (i = UUID_LEN - 1; i >= 0; i--)
+	{
+		delta += (int) b->data[i] - (int) a->data[i];
+		delta /= 256;
+	}
+
+	PG_RETURN_FLOAT8(delta);
+}
+
+Datum
+brin_minmax_multi_distance_pg_lsn(PG_FUNCTION_ARGS)
+{
+	XLogRecPtr	a = PG_GETARG_LSN(0);
+	XLogRecPtr	b = PG_GETARG_LSN(1);
+
+	Assert(a <= b);
+
+	PG_RETURN_FLOAT8((double) b - (double) a);
+}
@@ -50,9 +50,13 @@ mask_page_hint_bits(Page page)
 	/* Ignore prune_xid (it's like a hint-bit) */
 	phdr->pd_prune_xid = MASK_MARKER;
 
-	/* Ignore PD_PAGE_FULL and PD_HAS_FREE_LINES flags, they are just hints. */
+	/*
+	 * Ignore PD_PAGE_FULL, PD_HAS_FREE_LINES and PD_UPDATES_GROW flags, they
+	 * are just hints.
+	 */
 	PageClearFull(page);
 	PageClearHasFreeLinePointers(page);
+	PageClearUpdatesGrow(page);
 
 	/*
 	 * During replay, if the page LSN has advanced past our XLOG record's LSN,
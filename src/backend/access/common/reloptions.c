@@ -23,6 +23,7 @@
 #include "access/nbtree.h"
 #include "access/reloptions.h"
 #include "access/spgist.h"
+#include "access/zheap.h"
 #include "access/tuptoaster.h"
 #include "catalog/pg_type.h"
 #include "commands/defrem.h"
@@ -161,6 +162,16 @@ static relopt_bool boolRelOpts[] =
 		},
 		true
 	},
+	{
+		{
+			"deduplicate_items",
+			"Enables \"deduplicate items\" feature for this btree index",
+			RELOPT_KIND_BTREE,
+			ShareUpdateExclusiveLock	/* since it applies only to later
+										 * inserts */
+		},
+		true
+	},
 	/* list terminator */
 	{{NULL}}
 };
@@ -314,6 +325,33 @@ static relopt_int intRelOpts[] =
 		},
 		TOAST_TUPLE_TARGET, 128, TOAST_TUPLE_TARGET_MAIN
 	},
+	{
+		{
+			"trans_slots",
+			"Number of transaction slots on each page of a zheap table",
+			RELOPT_KIND_HEAP,
+			ShareUpdateExclusiveLock
+		},
+		ZHEAP_PAGE_TRANS_SLOTS, ZHEAP_MIN_PAGE_TRANS_SLOTS, ZHEAP_MAX_PAGE_TRANS_SLOTS
+	},
+	{
+		{
+			"insert_spread_blocks",
+			"Number of blocks each backend extends a zheap table by for its own insertions",
+			RELOPT_KIND_HEAP,
+			ShareUpdateExclusiveLock
+		},
+		0, 0, ZHEAP_MAX_INSERT_SPREAD_BLOCKS
+	},
+	{
+		{
+			"growth_reserve",
+			"Percentage of space kept free for growing updates on zheap pages where an update didn't fit",
+			RELOPT_KIND_HEAP,
+			ShareUpdateExclusiveLock
+		},
+		0, 0, ZHEAP_MAX_GROWTH_RESERVE
+	},
 	{
 		{
 			"pages_per_range",
@@ -1415,7 +1453,15 @@ default_reloptions(Datum reloptions, bool validate, relopt_kind kind)
 		{"vacuum_index_cleanup", RELOPT_TYPE_BOOL,
 		offsetof(StdRdOptions, vacuum_index_cleanup)},
 		{"vacuum_truncate", RELOPT_TYPE_BOOL,
-		offsetof(StdRdOptions, vacuum_truncate)}
+		offsetof(StdRdOptions, vacuum_truncate)},
+		{"trans_slots", RELOPT_TYPE_INT,
+		offsetof(StdRdOptions, trans_slots)},
+		{"insert_spread_blocks", RELOPT_TYPE_INT,
+		offsetof(StdRdOptions, insert_spread_blocks)},
+		{"growth_reserve", RELOPT_TYPE_INT,
+		offsetof(StdRdOptions, growth_reserve)},
+		{"deduplicate_items", RELOPT_TYPE_BOOL,
+		offsetof(StdRdOptions, deduplicate_items)}
 	};
 
 	options = parseRelOptions(reloptions, validate, kind, &numoptions);
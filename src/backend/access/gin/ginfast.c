@@ -22,6 +22,7 @@
 #include "access/ginxlog.h"
 #include "access/xloginsert.h"
 #include "access/xlog.h"
+#include "access/relation.h"
 #include "commands/vacuum.h"
 #include "catalog/pg_am.h"
 #include "miscadmin.h"
@@ -40,6 +41,22 @@ int			gin_pending_list_limit = 0;
 #define GIN_PAGE_FREESIZE \
 	( BLCKSZ - MAXALIGN(SizeOfPageHeaderData) - MAXALIGN(sizeof(GinPageOpaqueData)) )
 
+/*
+ * When the pending list is this many times over its limit, inserters stop
+ * relying on autovacuum and clean it up themselves.
+ */
+#define GIN_PENDING_LIST_BACKSTOP	4
+
+/*
+ * The last pending list we asked autovacuum to clean up, identified by the
+ * index and the list's head page.  Once the head has moved on, the request
+ * has been (at least partly) served and another one may be made.
+ */
+static Oid	last_cleanup_request_rel = InvalidOid;
+static BlockNumber last_cleanup_request_head = InvalidBlockNumber;
+
+static bool ginRequestPendingListCleanup(Relation index, BlockNumber head);
+
 typedef struct KeyArray
 {
 	Datum	   *keys;			/* expansible array */
@@ -226,6 +243,8 @@ ginHeapTupleFastInsert(GinState *ginstate, GinTupleCollector *collector)
 	ginxlogUpdateMeta data;
 	bool		separateList = false;
 	bool		needCleanup = false;
+	bool		needForegroundCleanup = false;
+	BlockNumber pendingHead;
 	int			cleanupSize;
 	bool		needWal;
 
@@ -448,17 +467,62 @@ ginHeapTupleFastInsert(GinState *ginstate, GinTupleCollector *collector)
 	cleanupSize = GinGetPendingListCleanupSize(index);
 	if (metadata->nPendingPages * GIN_PAGE_FREESIZE > cleanupSize * 1024L)
 		needCleanup = true;
+	if (metadata->nPendingPages * GIN_PAGE_FREESIZE >
+		GIN_PENDING_LIST_BACKSTOP * cleanupSize * 1024L)
+		needForegroundCleanup = true;
+	pendingHead = metadata->head;
 
 	UnlockReleaseBuffer(metabuffer);
 
 	END_CRIT_SECTION();
 
+	if (!needCleanup)
+		return;
+
+	/*
+	 * Prefer to hand the cleanup over to autovacuum, so that this insert
+	 * doesn't have to pay for merging the whole pending list.  Inserters only
+	 * do the work themselves if no request could be queued, or if the list
+	 * has grown far past its limit anyway, meaning autovacuum isn't keeping
+	 * up.
+	 */
+	if (!needForegroundCleanup &&
+		ginRequestPendingListCleanup(index, pendingHead))
+		return;
+
 	/*
 	 * Since it could contend with concurrent cleanup process we cleanup
 	 * pending list not forcibly.
 	 */
-	if (needCleanup)
-		ginInsertCleanup(ginstate, false, true, false, NULL);
+	ginInsertCleanup(ginstate, false, true, false, NULL);
+}
+
+/*
+ * Ask autovacuum to clean up the pending list of the given index, whose
+ * current head page is "head".
+ *
+ * Returns true if a work item is queued (or was queued by us before), false
+ * if caller must do the cleanup itself.
+ */
+static bool
+ginRequestPendingListCleanup(Relation index, BlockNumber head)
+{
+	if (RecoveryInProgress() || RelationUsesLocalBuffers(index) ||
+		!AutoVacuumingActive())
+		return false;
+
+	/* Don't ask for the same list over and over again. */
+	if (RelationGetRelid(index) == last_cleanup_request_rel &&
+		head == last_cleanup_request_head)
+		return true;
+
+	if (!AutoVacuumRequestWork(AVW_GINCleanPendingList,
+							   RelationGetRelid(index), InvalidBlockNumber))
+		return false;
+
+	last_cleanup_request_rel = RelationGetRelid(index);
+	last_cleanup_request_head = head;
+	return true;
 }
 
 /*
@@ -1024,6 +1088,38 @@ ginInsertCleanup(GinState *ginstate, bool full_clean,
 	MemoryContextDelete(opCtx);
 }
 
+/*
+ * Clean up the pending list of the given index on behalf of
+ * ginRequestPendingListCleanup.  This is called by autovacuum workers.
+ *
+ * Only the pages present when we start are merged, so that we never chase
+ * inserters that keep appending to the list; whatever they add will get a
+ * request of its own.
+ */
+void
+ginCleanPendingListWork(Oid indexoid)
+{
+	Relation	indexRel;
+	GinState	ginstate;
+
+	/* The index might have been dropped meanwhile. */
+	indexRel = try_relation_open(indexoid, RowExclusiveLock);
+	if (indexRel == NULL)
+		return;
+
+	if (indexRel->rd_rel->relkind != RELKIND_INDEX ||
+		indexRel->rd_rel->relam != GIN_AM_OID)
+	{
+		relation_close(indexRel, RowExclusiveLock);
+		return;
+	}
+
+	initGinState(&ginstate, indexRel);
+	ginInsertCleanup(&ginstate, false, true, true, NULL);
+
+	relation_close(indexRel, RowExclusiveLock);
+}
+
 /*
  * SQL-callable function to clean the insert pending list
  */
@@ -24,6 +24,7 @@
 #include "utils/builtins.h"
 #include "utils/float.h"
 #include "utils/geo_decls.h"
+#include "utils/sortsupport.h"
 
 
 static bool gist_box_leaf_consistent(BOX *key, BOX *query,
@@ -1530,3 +1531,218 @@ gist_poly_distance(PG_FUNCTION_ARGS)
 
 	PG_RETURN_FLOAT8(distance);
 }
+
+/*
+ * Z-order routines for sorted GiST index build
+ *
+ * Z-order (also known as Morton order) maps a two-dimensional point to a
+ * single integer in a way that preserves locality: points that are close
+ * to each other in the plane mostly map to integers that are close to each
+ * other too.  That's done by interleaving the bits of the X and Y
+ * coordinates.  Sorting the index tuples in that order and packing them
+ * into pages gives a reasonable tree, without calling the penalty and
+ * picksplit functions at all.
+ *
+ * The coordinates are converted to 32-bit floats first, so that the Z-value
+ * fits in 64 bits.  The ordering needn't be exact, merely good enough to
+ * put nearby points on the same page.
+ */
+
+/* Interleave 32 bits with zeroes */
+static uint64
+part_bits32_by2(uint32 x)
+{
+	uint64		n = x;
+
+	n = (n | (n << 16)) & UINT64CONST(0x0000FFFF0000FFFF);
+	n = (n | (n << 8)) & UINT64CONST(0x00FF00FF00FF00FF);
+	n = (n | (n << 4)) & UINT64CONST(0x0F0F0F0F0F0F0F0F);
+	n = (n | (n << 2)) & UINT64CONST(0x3333333333333333);
+	n = (n | (n << 1)) & UINT64CONST(0x5555555555555555);
+
+	return n;
+}
+
+/*
+ * Convert a 32-bit IEEE float to uint32 in a way that preserves the ordering
+ *
+ * The bit pattern of an IEEE float, interpreted as an integer, sorts the same
+ * as the float itself, except for the sign.  So negative values are mapped
+ * to the range 0-7FFFFFFF by flipping all their bits, and positive values
+ * (and zero) to 80000000-FFFFFFFF by setting the sign bit.  Both zeroes end
+ * up next to each other in the middle.  All NaNs are mapped to FFFFFFFF,
+ * which no other value maps to.
+ */
+static uint32
+ieee_float32_to_uint32(float f)
+{
+	union
+	{
+		float		f;
+		uint32		i;
+	}			u;
+
+	if (isnan(f))
+		return 0xFFFFFFFF;
+
+	u.f = f;
+
+	/* Check the sign bit */
+	if ((u.i & 0x80000000) != 0)
+		u.i ^= 0xFFFFFFFF;
+	else
+		u.i |= 0x80000000;
+
+	return u.i;
+}
+
+/* Compute Z-value of a point */
+static uint64
+point_zorder_internal(float8 x, float8 y)
+{
+	uint32		ix = ieee_float32_to_uint32((float) x);
+	uint32		iy = ieee_float32_to_uint32((float) y);
+
+	/* Interleave the bits */
+	return part_bits32_by2(ix) | (part_bits32_by2(iy) << 1);
+}
+
+/*
+ * Compute Z-value of a box's center.  Halve before adding, so that huge
+ * coordinates don't overflow to infinity.
+ */
+static uint64
+box_zorder_internal(BOX *box)
+{
+	return point_zorder_internal(box->low.x / 2.0 + box->high.x / 2.0,
+								 box->low.y / 2.0 + box->high.y / 2.0);
+}
+
+static int
+zorder_cmp(uint64 z1, uint64 z2)
+{
+	if (z1 > z2)
+		return 1;
+	else if (z1 < z2)
+		return -1;
+	else
+		return 0;
+}
+
+/*
+ * Compare the Z-order of points.  The compressed representation of a point
+ * in point_ops is a degenerate box, so we just look at its lower corner.
+ */
+static int
+gist_point_zorder_cmp(Datum a, Datum b, SortSupport ssup)
+{
+	Point	   *p1 = &(DatumGetBoxP(a)->low);
+	Point	   *p2 = &(DatumGetBoxP(b)->low);
+
+	/*
+	 * Do a quick check for equality first.  This is worth it especially when
+	 * used as tie-breaker with abbreviated keys.
+	 */
+	if (p1->x == p2->x && p1->y == p2->y)
+		return 0;
+
+	return zorder_cmp(point_zorder_internal(p1->x, p1->y),
+					  point_zorder_internal(p2->x, p2->y));
+}
+
+/* Compare the Z-order of boxes' centers */
+static int
+gist_box_zorder_cmp(Datum a, Datum b, SortSupport ssup)
+{
+	return zorder_cmp(box_zorder_internal(DatumGetBoxP(a)),
+					  box_zorder_internal(DatumGetBoxP(b)));
+}
+
+/*
+ * Abbreviated versions of the above.  The abbreviated key is the Z-value
+ * itself, or its most significant bits if Datum is only 32 bits wide.
+ */
+static Datum
+zorder_abbrev(uint64 z)
+{
+#if SIZEOF_DATUM == 8
+	return (Datum) z;
+#else
+	return (Datum) (z >> 32);
+#endif
+}
+
+static Datum
+gist_point_zorder_abbrev_convert(Datum original, SortSupport ssup)
+{
+	Point	   *p = &(DatumGetBoxP(original)->low);
+
+	return zorder_abbrev(point_zorder_internal(p->x, p->y));
+}
+
+static Datum
+gist_box_zorder_abbrev_convert(Datum original, SortSupport ssup)
+{
+	return zorder_abbrev(box_zorder_internal(DatumGetBoxP(original)));
+}
+
+static int
+gist_zorder_cmp_abbrev(Datum z1, Datum z2, SortSupport ssup)
+{
+	/* Datum is an unsigned integer type, so compare directly */
+	if (z1 > z2)
+		return 1;
+	else if (z1 < z2)
+		return -1;
+	else
+		return 0;
+}
+
+/*
+ * We never consider aborting the abbreviation: on 64-bit systems, it isn't
+ * lossy at all, and computing the full Z-value is the expensive part anyway.
+ */
+static bool
+gist_zorder_abbrev_abort(int memtupcount, SortSupport ssup)
+{
+	return false;
+}
+
+/*
+ * Sort support routines for sorted GiST index build
+ */
+Datum
+gist_point_sortsupport(PG_FUNCTION_ARGS)
+{
+	SortSupport ssup = (SortSupport) PG_GETARG_POINTER(0);
+
+	if (ssup->abbreviate)
+	{
+		ssup->comparator = gist_zorder_cmp_abbrev;
+		ssup->abbrev_converter = gist_point_zorder_abbrev_convert;
+		ssup->abbrev_abort = gist_zorder_abbrev_abort;
+		ssup->abbrev_full_comparator = gist_point_zorder_cmp;
+	}
+	else
+		ssup->comparator = gist_point_zorder_cmp;
+
+	PG_RETURN_VOID();
+}
+
+Datum
+gist_box_sortsupport(PG_FUNCTION_ARGS)
+{
+	SortSupport ssup = (SortSupport) PG_GETARG_POINTER(0);
+
+	if (ssup->abbreviate)
+	{
+		ssup->comparator = gist_zorder_cmp_abbrev;
+		ssup->abbrev_converter = gist_box_zorder_abbrev_convert;
+		ssup->abbrev_abort = gist_zorder_abbrev_abort;
+		ssup->abbrev_full_comparator = gist_box_zorder_cmp;
+	}
+	else
+		ssup->comparator = gist_box_zorder_cmp;
+
+	PG_RETURN_VOID();
+}
@@ -7,6 +7,12 @@
  * number to improve locality of access to the index, and thereby avoid
  * thrashing.  We use tuplesort.c to sort the given index tuples into order.
  *
+ * When the buckets created for the estimated number of rows will hold all
+ * the tuples without needing to split, which is the usual case, the sorted
+ * tuples are written directly into the bucket pages and their overflow
+ * pages one page after another, and each page is WAL-logged once when it is
+ * full rather than with a record per tuple.  See _h_bulkload().
+ *
  * Note: if the number of rows in the table has been underestimated,
  * bucket splits may occur during the index build.  In that case we'd
  * be inserting into two or more buckets for each possible masked-off
@@ -26,9 +32,11 @@
 #include "postgres.h"
 
 #include "access/hash.h"
+#include "access/xloginsert.h"
 #include "commands/progress.h"
 #include "miscadmin.h"
 #include "pgstat.h"
+#include "utils/rel.h"
 #include "utils/tuplesort.h"
 
 
@@ -50,6 +58,9 @@ struct HSpool
 	uint32		max_buckets;
 };
 
+static void _h_bulkload(HSpool *hspool);
+static void _h_bulkload_page_done(Relation index, Buffer buf);
+
 
 /*
  * create and initialize a spool structure
@@ -112,19 +123,40 @@ _h_spool(HSpool *hspool, ItemPointer self, Datum *values, bool *isnull)
 
 /*
  * given a spool loaded by successive calls to _h_spool,
- * create an entire index.
+ * create an entire index.  ntuples is the number of tuples spooled.
  */
 void
-_h_indexbuild(HSpool *hspool, Relation heapRel)
+_h_indexbuild(HSpool *hspool, Relation heapRel, double ntuples)
 {
 	IndexTuple	itup;
 	int64		tups_done = 0;
+	Buffer		metabuf;
+	HashMetaPage metap;
+	bool		bulkload;
 #ifdef USE_ASSERT_CHECKING
 	uint32		hashkey = 0;
 #endif
 
 	tuplesort_performsort(hspool->sortstate);
 
+	/*
+	 * If inserting this many tuples would not make _hash_doinsert() split any
+	 * bucket, the index ends up the same shape if we write the tuples into
+	 * the bucket pages directly.
+	 */
+	metabuf = _hash_getbuf(hspool->index, HASH_METAPAGE, HASH_READ,
+						   LH_META_PAGE);
+	metap = HashPageGetMeta(BufferGetPage(metabuf));
+	bulkload = ntuples <=
+		(double) metap->hashm_ffactor * (metap->hashm_maxbucket + 1);
+	_hash_relbuf(hspool->index, metabuf);
+
+	if (bulkload)
+	{
+		_h_bulkload(hspool);
+		return;
+	}
+
 	while ((itup = tuplesort_getindextuple(hspool->sortstate, true)) != NULL)
 	{
 		/*
@@ -149,3 +181,124 @@ _h_indexbuild(HSpool *hspool, Relation heapRel)
 									 ++tups_done);
 	}
 }
+
+/*
+ * _h_bulkload() -- write the sorted tuples of a spool into the bucket pages
+ *
+ * The tuples come in bucket order, and within a bucket in hash key order, so
+ * each bucket's pages can be filled one after another by appending to them,
+ * adding overflow pages to the end of the bucket chain as the pages fill up.
+ * A page is WAL-logged as a full image once we are done adding to it, before
+ * any overflow page is chained to it, which keeps the WAL consistent with the
+ * page at every record.  The caller must have checked that no bucket needs
+ * to be split.
+ */
+static void
+_h_bulkload(HSpool *hspool)
+{
+	Relation	index = hspool->index;
+	Buffer		metabuf;
+	Buffer		bucketbuf = InvalidBuffer;
+	Buffer		buf = InvalidBuffer;
+	Page		metapage;
+	HashMetaPage metap;
+	Bucket		curbucket = 0;
+	IndexTuple	itup;
+	int64		tups_done = 0;
+
+	metabuf = _hash_getbuf(index, HASH_METAPAGE, HASH_NOLOCK, LH_META_PAGE);
+	metapage = BufferGetPage(metabuf);
+	metap = HashPageGetMeta(metapage);
+
+	while ((itup = tuplesort_getindextuple(hspool->sortstate, true)) != NULL)
+	{
+		Size		itemsz = MAXALIGN(IndexTupleSize(itup));
+		Bucket		bucket;
+
+		/* same check as _hash_doinsert() */
+		if (itemsz > HashMaxItemSize(metapage))
+			ereport(ERROR,
+					(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+					 errmsg("index row size %zu exceeds hash maximum %zu",
+							itemsz, HashMaxItemSize(metapage)),
+					 errhint("Values larger than a buffer page cannot be indexed.")));
+
+		bucket = _hash_hashkey2bucket(_hash_get_indextuple_hashkey(itup),
+									  hspool->max_buckets, hspool->high_mask,
+									  hspool->low_mask);
+
+		/* moving on to the next bucket? */
+		if (BufferIsValid(buf) && bucket != curbucket)
+		{
+			Assert(bucket > curbucket);
+			_h_bulkload_page_done(index, buf);
+			if (buf != bucketbuf)
+				_hash_relbuf(index, buf);
+			else
+				LockBuffer(buf, BUFFER_LOCK_UNLOCK);
+			_hash_dropbuf(index, bucketbuf);
+			buf = bucketbuf = InvalidBuffer;
+		}
+
+		if (!BufferIsValid(buf))
+		{
+			/*
+			 * No bucket is split, so the metapage still maps the buckets the
+			 * same way as when the spool was set up.  Overflow pages added to
+			 * the buckets only move the blocks of later splitpoints, which
+			 * don't exist yet.
+			 */
+			buf = bucketbuf = _hash_getbuf(index, BUCKET_TO_BLKNO(metap, bucket),
+										   HASH_WRITE, LH_BUCKET_PAGE);
+			curbucket = bucket;
+		}
+
+		if (PageGetFreeSpace(BufferGetPage(buf)) < itemsz)
+		{
+			/* this page is full; log it and chain a new overflow page */
+			_h_bulkload_page_done(index, buf);
+			LockBuffer(buf, BUFFER_LOCK_UNLOCK);
+			buf = _hash_addovflpage(index, metabuf, buf, buf == bucketbuf);
+			Assert(PageGetFreeSpace(BufferGetPage(buf)) >= itemsz);
+		}
+
+		(void) _hash_pgaddtup(index, buf, itemsz, itup);
+
+		pgstat_progress_update_param(PROGRESS_CREATEIDX_TUPLES_DONE,
+									 ++tups_done);
+	}
+
+	if (BufferIsValid(buf))
+	{
+		_h_bulkload_page_done(index, buf);
+		if (buf != bucketbuf)
+			_hash_relbuf(index, buf);
+		else
+			LockBuffer(buf, BUFFER_LOCK_UNLOCK);
+		_hash_dropbuf(index, bucketbuf);
+	}
+
+	/* finally, set the tuple count _hash_doinsert() would have kept */
+	LockBuffer(metabuf, BUFFER_LOCK_EXCLUSIVE);
+	START_CRIT_SECTION();
+	metap->hashm_ntuples = (double) tups_done;
+	MarkBufferDirty(metabuf);
+	if (RelationNeedsWAL(index))
+		log_newpage_buffer(metabuf, true);
+	END_CRIT_SECTION();
+	_hash_relbuf(index, metabuf);
+}
+
+/*
+ * Mark a page filled by _h_bulkload() dirty and WAL-log it.  The caller
+ * holds an exclusive lock on it.
+ */
+static void
+_h_bulkload_page_done(Relation index, Buffer buf)
+{
+	START_CRIT_SECTION();
+	MarkBufferDirty(buf);
+	if (RelationNeedsWAL(index))
+		log_newpage_buffer(buf, true);
+	END_CRIT_SECTION();
+}
@@ -490,9 +490,11 @@ heapgettup(HeapScanDesc scan,
 				(ParallelBlockTableScanDesc) scan->rs_base.rs_parallel;
 
 				table_block_parallelscan_startblock_init(scan->rs_base.rs_rd,
+														 &scan->rs_parallelworkerdata,
 														 pbscan);
 
 				page = table_block_parallelscan_nextpage(scan->rs_base.rs_rd,
+														 &scan->rs_parallelworkerdata,
 														 pbscan);
 
 				/* Other processes might have already finished the scan. */
@@ -690,6 +692,7 @@ heapgettup(HeapScanDesc scan,
 			(ParallelBlockTableScanDesc) scan->rs_base.rs_parallel;
 
 			page = table_block_parallelscan_nextpage(scan->rs_base.rs_rd,
+													 &scan->rs_parallelworkerdata,
 													 pbscan);
 			finished = (page == InvalidBlockNumber);
 		}
@@ -804,9 +807,11 @@ heapgettup_pagemode(HeapScanDesc scan,
 				(ParallelBlockTableScanDesc) scan->rs_base.rs_parallel;
 
 				table_block_parallelscan_startblock_init(scan->rs_base.rs_rd,
+														 &scan->rs_parallelworkerdata,
 														 pbscan);
 
 				page = table_block_parallelscan_nextpage(scan->rs_base.rs_rd,
+														 &scan->rs_parallelworkerdata,
 														 pbscan);
 
 				/* Other processes might have already finished the scan. */
@@ -989,6 +994,7 @@ heapgettup_pagemode(HeapScanDesc scan,
 			(ParallelBlockTableScanDesc) scan->rs_base.rs_parallel;
 
 			page = table_block_parallelscan_nextpage(scan->rs_base.rs_rd,
+													 &scan->rs_parallelworkerdata,
 													 pbscan);
 			finished = (page == InvalidBlockNumber);
 		}
@@ -2040,8 +2046,12 @@ heap_prepare_insert(Relation relation, HeapTuple tup, TransactionId xid,
 	 * relation extension or GIN page locks will not conflict between members
 	 * of a lock group, but we don't prohibit that case here because there are
 	 * useful special cases that we can safely allow, such as CREATE TABLE AS.
+	 *
+	 * Parallel COPY FROM passes HEAP_INSERT_PARALLEL; relation extension and
+	 * page locks do conflict within a lock group, and the leader has already
+	 * assigned the transaction ID and marked the command ID as used.
 	 */
-	if (IsParallelWorker())
+	if (IsParallelWorker() && !(options & HEAP_INSERT_PARALLEL))
 		ereport(ERROR,
 				(errcode(ERRCODE_INVALID_TRANSACTION_STATE),
 				 errmsg("cannot insert tuples in a parallel worker")));
@@ -103,6 +103,7 @@ RelationGetIndexScan(Relation indexRelation, int nkeys, int norderbys)
 		scan->orderByData = NULL;
 
 	scan->xs_want_itup = false; /* may be set later */
+	scan->xs_skipscan = false;	/* likewise */
 
 	/*
 	 * During recovery we ignore killed tuples and don't bother to kill them
@@ -120,6 +121,8 @@ RelationGetIndexScan(Relation indexRelation, int nkeys, int norderbys)
 
 	scan->opaque = NULL;
 
+	scan->xs_keycheck = false;
+
 	scan->xs_itup = NULL;
 	scan->xs_itupdesc = NULL;
 	scan->xs_hitup = NULL;
@@ -18,6 +18,7 @@
  *		index_rescan	- restart a scan of an index
  *		index_endscan	- end a scan
  *		index_insert	- insert an index tuple into a relation
+ *		index_deletemark - delete-mark an index entry for an in-place update
  *		index_markpos	- mark a scan position
  *		index_restrpos	- restore a scan position
  *		index_parallelscan_estimate - estimate shared memory for parallel scan
@@ -26,6 +27,7 @@
  *		index_beginscan_parallel - join parallel index scan
  *		index_getnext_tid	- get the next TID from a scan
  *		index_fetch_heap		- get the scan's next heap tuple
+ *		index_tuple_matches_slot - does an index tuple match a table tuple?
  *		index_getnext	- get the next heap tuple from a scan
  *		index_getbitmap - get all tuples from a scan
  *		index_bulk_delete	- bulk deletion of index tuples
@@ -45,6 +47,7 @@
 
 #include "access/amapi.h"
 #include "access/heapam.h"
+#include "access/itup.h"
 #include "access/relscan.h"
 #include "access/tableam.h"
 #include "access/transam.h"
@@ -55,6 +58,8 @@
 #include "storage/bufmgr.h"
 #include "storage/lmgr.h"
 #include "storage/predicate.h"
+#include "utils/datum.h"
+#include "utils/rel.h"
 #include "utils/snapmgr.h"
 
 
@@ -98,6 +103,7 @@ do { \
 			 CppAsString(pname), RelationGetRelationName(scan->indexRelation)); \
 } while(0)
 
+static bool index_keycheck(IndexScanDesc scan, TupleTableSlot *slot);
 static IndexScanDesc index_beginscan_internal(Relation indexRelation,
 											  int nkeys, int norderbys, Snapshot snapshot,
 											  ParallelIndexScanDesc pscan, bool temp_snap);
@@ -188,6 +194,38 @@ index_insert(Relation indexRelation,
 											 checkUnique, indexInfo);
 }
 
+/* ----------------
+ *		index_deletemark - delete-mark the entry of an in-place updated tuple
+ *
+ * The table AM calls this after updating the tuple at heap_t_ctid in place,
+ * for every index whose columns changed.  The entry for the old values is
+ * delete-marked and an entry for the new values is made to point at the same
+ * TID.
+ * ----------------
+ */
+void
+index_deletemark(Relation indexRelation,
+				 Datum *oldvalues,
+				 bool *oldisnull,
+				 Datum *newvalues,
+				 bool *newisnull,
+				 ItemPointer heap_t_ctid,
+				 Relation heapRelation)
+{
+	RELATION_CHECKS;
+	CHECK_REL_PROCEDURE(amdeletemark);
+
+	if (!(indexRelation->rd_indam->ampredlocks))
+		CheckForSerializableConflictIn(indexRelation,
+									   (ItemPointer) NULL,
+									   InvalidBuffer);
+
+	indexRelation->rd_indam->amdeletemark(indexRelation,
+										  oldvalues, oldisnull,
+										  newvalues, newisnull,
+										  heap_t_ctid, heapRelation);
+}
+
 /*
  * index_beginscan - start a scan of an index with amgettuple
  *
@@ -210,6 +248,15 @@ index_beginscan(Relation heapRelation,
 	scan->heapRelation = heapRelation;
 	scan->xs_snapshot = snapshot;
 
+	/*
+	 * Entries of an index that supports delete-marking may have to be
+	 * compared with the table tuple they lead to, which needs the index
+	 * tuple.
+	 */
+	if (indexRelation->rd_indam->amcandeletemark &&
+		RelationStorageIsZHeap(heapRelation))
+		scan->xs_want_itup = true;
+
 	/* prepare to fetch index matches from table */
 	scan->xs_heapfetch = table_index_fetch_begin(heapRelation);
 
@@ -389,9 +436,13 @@ index_restrpos(IndexScanDesc scan)
  * Currently, we don't pass any information to the AM-specific estimator,
  * so it can probably only return a constant.  In the future, we might need
  * to pass more information.
+ *
+ * The table AM can ask for space for state shared by the table fetches of
+ * the scan, too.
  */
 Size
-index_parallelscan_estimate(Relation indexRelation, Snapshot snapshot)
+index_parallelscan_estimate(Relation heapRelation, Relation indexRelation,
+							Snapshot snapshot)
 {
 	Size		nbytes;
 
@@ -401,6 +452,10 @@ index_parallelscan_estimate(Relation indexRelation, Snapshot snapshot)
 	nbytes = add_size(nbytes, EstimateSnapshotSpace(snapshot));
 	nbytes = MAXALIGN(nbytes);
 
+	nbytes = add_size(nbytes,
+					  table_index_fetch_parallel_estimate(heapRelation));
+	nbytes = MAXALIGN(nbytes);
+
 	/*
 	 * If amestimateparallelscan is not provided, assume there is no
 	 * AM-specific data needed.  (It's hard to believe that could work, but
@@ -428,6 +483,7 @@ index_parallelscan_initialize(Relation heapRelation, Relation indexRelation,
 							  Snapshot snapshot, ParallelIndexScanDesc target)
 {
 	Size		offset;
+	Size		tableam_size;
 
 	RELATION_CHECKS;
 
@@ -437,9 +493,22 @@ index_parallelscan_initialize(Relation heapRelation, Relation indexRelation,
 
 	target->ps_relid = RelationGetRelid(heapRelation);
 	target->ps_indexid = RelationGetRelid(indexRelation);
-	target->ps_offset = offset;
 	SerializeSnapshot(snapshot, target->ps_snapshot_data);
 
+	/* The table AM's shared state goes before the index AM's. */
+	tableam_size = table_index_fetch_parallel_estimate(heapRelation);
+	if (tableam_size > 0)
+	{
+		target->ps_tableam_offset = offset;
+		table_index_fetch_parallel_initialize(heapRelation,
+											  OffsetToPointer(target, offset));
+		offset = MAXALIGN(add_size(offset, tableam_size));
+	}
+	else
+		target->ps_tableam_offset = 0;
+
+	target->ps_offset = offset;
+
 	/* aminitparallelscan is optional; assume no-op if not provided by AM */
 	if (indexRelation->rd_indam->aminitparallelscan != NULL)
 	{
@@ -492,8 +561,16 @@ index_beginscan_parallel(Relation heaprel, Relation indexrel, int nkeys,
 	scan->heapRelation = heaprel;
 	scan->xs_snapshot = snapshot;
 
+	/* See index_beginscan. */
+	if (indexrel->rd_indam->amcandeletemark &&
+		RelationStorageIsZHeap(heaprel))
+		scan->xs_want_itup = true;
+
 	/* prepare to fetch index matches from table */
 	scan->xs_heapfetch = table_index_fetch_begin(heaprel);
+	if (pscan->ps_tableam_offset != 0)
+		scan->xs_heapfetch->pshared =
+			OffsetToPointer(pscan, pscan->ps_tableam_offset);
 
 	return scan;
 }
@@ -572,6 +649,17 @@ index_fetch_heap(IndexScanDesc scan, TupleTableSlot *slot)
 									scan->xs_snapshot, slot,
 									&scan->xs_heap_continue, &all_dead);
 
+	/*
+	 * An entry that may have been delete-marked, or inserted by an in-place
+	 * update, need not match the tuple version this snapshot sees.  In that
+	 * case it's not a valid entry for the scan, so pretend we found nothing.
+	 */
+	if (found && scan->xs_keycheck && !index_keycheck(scan, slot))
+	{
+		ExecClearTuple(slot);
+		return false;
+	}
+
 	if (found)
 		pgstat_count_heap_fetch(scan->indexRelation);
 
@@ -588,6 +676,60 @@ index_fetch_heap(IndexScanDesc scan, TupleTableSlot *slot)
 	return found;
 }
 
+/*
+ * index_keycheck - does the scan's current index tuple match the table tuple?
+ */
+static bool
+index_keycheck(IndexScanDesc scan, TupleTableSlot *slot)
+{
+	if (scan->xs_itup == NULL)
+		elog(ERROR, "index \"%s\" did not return an index tuple to check",
+			 RelationGetRelationName(scan->indexRelation));
+
+	return index_tuple_matches_slot(scan->indexRelation, scan->xs_itup,
+									scan->xs_itupdesc, slot);
+}
+
+/* ----------------
+ *		index_tuple_matches_slot - does an index tuple match a table tuple?
+ *
+ * Only used for indexes that support delete-marking, which are restricted to
+ * plain column references, so the index tuple's attributes can be compared
+ * directly with the corresponding table columns.
+ * ----------------
+ */
+bool
+index_tuple_matches_slot(Relation indexRelation, IndexTuple itup,
+						 TupleDesc itupdesc, TupleTableSlot *slot)
+{
+	int			natts = IndexRelationGetNumberOfAttributes(indexRelation);
+	int			i;
+
+	for (i = 0; i < natts; i++)
+	{
+		AttrNumber	heapattno = indexRelation->rd_index->indkey.values[i];
+		Form_pg_attribute att = TupleDescAttr(itupdesc, i);
+		Datum		idatum,
+					hdatum;
+		bool		iisnull,
+					hisnull;
+
+		Assert(heapattno > 0);
+
+		idatum = index_getattr(itup, i + 1, itupdesc, &iisnull);
+		hdatum = slot_getattr(slot, heapattno, &hisnull);
+
+		if (iisnull != hisnull)
+			return false;
+		if (iisnull)
+			continue;
+		if (!datum_image_eq(idatum, hdatum, att->attbyval, att->attlen))
+			return false;
+	}
+
+	return true;
+}
+
 /* ----------------
  *		index_getnext_slot - get the next tuple from a scan
  *
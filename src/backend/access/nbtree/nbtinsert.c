@@ -43,16 +43,20 @@ static OffsetNumber _bt_findinsertloc(Relation rel,
 									  BTStack stack,
 									  Relation heapRel);
 static void _bt_stepright(Relation rel, BTInsertState insertstate, BTStack stack);
+static bool _bt_insert_deletemarked(Relation rel, BTScanInsert itup_key,
+									IndexTuple itup, Relation heapRel);
 static void _bt_insertonpg(Relation rel, BTScanInsert itup_key,
 						   Buffer buf,
 						   Buffer cbuf,
 						   BTStack stack,
 						   IndexTuple itup,
 						   OffsetNumber newitemoff,
+						   int postingoff,
 						   bool split_only_page);
 static Buffer _bt_split(Relation rel, BTScanInsert itup_key, Buffer buf,
 						Buffer cbuf, OffsetNumber newitemoff, Size newitemsz,
-						IndexTuple newitem);
+						IndexTuple newitem, IndexTuple orignewitem,
+						IndexTuple nposting, uint16 postingoff);
 static void _bt_insert_parent(Relation rel, Buffer buf, Buffer rbuf,
 							  BTStack stack, bool is_root, bool is_only);
 static bool _bt_pgaddtup(Page page, Size itemsize, IndexTuple itup,
@@ -127,6 +131,7 @@ _bt_doinsert(Relation rel, IndexTuple itup,
 	insertstate.itup_key = itup_key;
 	insertstate.bounds_valid = false;
 	insertstate.buf = InvalidBuffer;
+	insertstate.postingoff = 0;
 
 	/*
 	 * It's very common to have an index on an auto-incremented or
@@ -307,7 +312,7 @@ top:
 		newitemoff = _bt_findinsertloc(rel, &insertstate, checkingunique,
 									   stack, heapRel);
 		_bt_insertonpg(rel, itup_key, insertstate.buf, InvalidBuffer, stack,
-					   itup, newitemoff, false);
+					   itup, newitemoff, insertstate.postingoff, false);
 	}
 	else
 	{
@@ -323,6 +328,105 @@ top:
 	return is_unique;
 }
 
+/*
+ *	_bt_deletemark() -- Replace the index tuple of an in-place updated tuple.
+ *
+ *		This routine is called by the public interface routine, btdeletemark.
+ *		olditup and newitup are filled in with the old and new key values,
+ *		and the TID of the heap tuple, which didn't change.
+ *
+ *		The old index tuple is delete-marked, since older snapshots can still
+ *		see the old heap tuple version through it.  If the heap tuple was
+ *		updated back to values it had before, a delete-marked index tuple for
+ *		them is still present, and we just remove its mark; otherwise we
+ *		insert newitup.  Either way, the pages involved get BTP_DELETE_MARKED,
+ *		so that scans compare their tuples with the heap tuple, and VACUUM
+ *		removes the tuples that turn out to be stale.
+ *
+ *		No undo is written for any of this.  A rollback of the in-place
+ *		update doesn't remove the marks or the new tuple, and undo discard
+ *		doesn't purge delete-marked tuples; that is left to VACUUM, see
+ *		btvacuumstale().
+ */
+void
+_bt_deletemark(Relation rel, IndexTuple olditup, IndexTuple newitup,
+			   Relation heapRel)
+{
+	BTScanInsert itup_key;
+	Buffer		buf;
+	OffsetNumber offnum;
+	bool		newlymarked = false;
+
+	Assert(ItemPointerEquals(&olditup->t_tid, &newitup->t_tid));
+
+	itup_key = _bt_mkscankey(rel, olditup);
+	buf = _bt_finditem(rel, itup_key, &olditup->t_tid, &offnum);
+	if (BufferIsValid(buf))
+	{
+		newlymarked |= _bt_deletemark_item(rel, buf, offnum, true);
+		_bt_relbuf(rel, buf);
+	}
+	pfree(itup_key);
+
+	itup_key = _bt_mkscankey(rel, newitup);
+	buf = _bt_finditem(rel, itup_key, &newitup->t_tid, &offnum);
+	if (BufferIsValid(buf))
+	{
+		newlymarked |= _bt_deletemark_item(rel, buf, offnum, false);
+		_bt_relbuf(rel, buf);
+	}
+	else
+		newlymarked |= _bt_insert_deletemarked(rel, itup_key, newitup,
+											   heapRel);
+	pfree(itup_key);
+
+	/* VACUUM must visit the pages we flagged, even if it deletes nothing */
+	if (newlymarked)
+		_bt_request_cleanup(rel);
+}
+
+/*
+ *	_bt_insert_deletemarked() -- Insert the new index tuple for _bt_deletemark
+ *
+ * This is a stripped-down _bt_doinsert() for a non-unique index.  The page
+ * we're about to insert on gets BTP_DELETE_MARKED before the tuple goes in,
+ * while we hold the lock, so no scan can see the tuple without the flag.  If
+ * the insertion splits the page, both halves inherit the flag.
+ *
+ * Returns true if the page didn't have the flag before.
+ */
+static bool
+_bt_insert_deletemarked(Relation rel, BTScanInsert itup_key, IndexTuple itup,
+						Relation heapRel)
+{
+	BTInsertStateData insertstate;
+	BTStack		stack;
+	OffsetNumber newitemoff;
+	bool		newlymarked;
+
+	insertstate.itup = itup;
+	insertstate.itemsz = MAXALIGN(IndexTupleSize(itup));
+	insertstate.itup_key = itup_key;
+	insertstate.bounds_valid = false;
+	insertstate.buf = InvalidBuffer;
+	insertstate.postingoff = 0;
+
+	stack = _bt_search(rel, itup_key, &insertstate.buf, BT_WRITE, NULL);
+
+	CheckForSerializableConflictIn(rel, NULL, insertstate.buf);
+
+	newitemoff = _bt_findinsertloc(rel, &insertstate, false, stack, heapRel);
+	newlymarked = _bt_deletemark_item(rel, insertstate.buf,
+									  InvalidOffsetNumber, false);
+	_bt_insertonpg(rel, itup_key, insertstate.buf, InvalidBuffer, stack,
+				   itup, newitemoff, insertstate.postingoff, false);
+
+	if (stack)
+		_bt_freestack(stack);
+
+	return newlymarked;
+}
+
 /*
  *	_bt_check_unique() -- Check for violation of unique index constraint
  *
@@ -442,6 +546,8 @@ _bt_check_unique(Relation rel, BTInsertState insertstate, Relation heapRel,
 
 				/* okay, we gotta fetch the heap tuple ... */
 				curitup = (IndexTuple) PageGetItem(page, curitemid);
+				/* unique indexes are never deduplicated */
+				Assert(!BTreeTupleIsPosting(curitup));
 				htid = curitup->t_tid;
 
 				/*
@@ -685,7 +791,12 @@ _bt_check_unique(Relation rel, BTInsertState insertstate, Relation heapRel,
  *		_bt_check_unique() already.
  *
  *		If there is not enough room on the page for the new tuple, we try to
- *		make room by removing any LP_DEAD tuples.
+ *		make room by removing any LP_DEAD tuples, and then by deduplicating
+ *		the page, where that's allowed.
+ *
+ *		If the new tuple's heap TID falls within the range of a posting list
+ *		tuple, insertstate->postingoff is set to the position within it where
+ *		the TID belongs; the caller must split the posting list.
  */
 static OffsetNumber
 _bt_findinsertloc(Relation rel,
@@ -697,6 +808,7 @@ _bt_findinsertloc(Relation rel,
 	BTScanInsert itup_key = insertstate->itup_key;
 	Page		page = BufferGetPage(insertstate->buf);
 	BTPageOpaque lpageop;
+	OffsetNumber newitemoff;
 
 	lpageop = (BTPageOpaque) PageGetSpecialPointer(page);
 
@@ -767,6 +879,18 @@ _bt_findinsertloc(Relation rel,
 			_bt_vacuum_one_page(rel, insertstate->buf, heapRel);
 			insertstate->bounds_valid = false;
 		}
+
+		/*
+		 * If the target page is still full, try to obtain enough space by
+		 * merging duplicates into posting list tuples, rather than splitting
+		 * the page
+		 */
+		if (PageGetFreeSpace(page) < insertstate->itemsz &&
+			_bt_dedup_allowed(rel))
+		{
+			_bt_dedup_one_page(rel, insertstate->buf);
+			insertstate->bounds_valid = false;
+		}
 	}
 	else
 	{
@@ -847,7 +971,24 @@ _bt_findinsertloc(Relation rel,
 	Assert(P_RIGHTMOST(lpageop) ||
 		   _bt_compare(rel, itup_key, page, P_HIKEY) <= 0);
 
-	return _bt_binsrch_insert(rel, insertstate);
+	newitemoff = _bt_binsrch_insert(rel, insertstate);
+
+	if (insertstate->postingoff == -1)
+	{
+		/*
+		 * There is an overlapping posting list tuple with its LP_DEAD bit
+		 * set.  We don't want to unnecessarily unset its LP_DEAD bit while
+		 * performing a posting list split, so remove it first, along with
+		 * any other LP_DEAD items on the page.
+		 */
+		_bt_vacuum_one_page(rel, insertstate->buf, heapRel);
+		insertstate->bounds_valid = false;
+		insertstate->postingoff = 0;
+		newitemoff = _bt_binsrch_insert(rel, insertstate);
+		Assert(insertstate->postingoff == 0);
+	}
+
+	return newitemoff;
 }
 
 /*
@@ -934,6 +1075,12 @@ _bt_stepright(Relation rel, BTInsertState insertstate, BTStack stack)
  *		inserting to a non-leaf page, 'cbuf' is the left-sibling of the page
  *		we're inserting the downlink for.  This function will clear the
  *		INCOMPLETE_SPLIT flag on it, and release the buffer.
+ *
+ *		If 'postingoff' is nonzero, the new tuple's heap TID falls within
+ *		the posting list tuple just before newitemoff.  We then insert a
+ *		copy of itup that gets the posting list's highest heap TID, while
+ *		itup's own TID takes its place in the posting list (see
+ *		_bt_swap_posting).
  *----------
  */
 static void
@@ -944,11 +1091,15 @@ _bt_insertonpg(Relation rel,
 			   BTStack stack,
 			   IndexTuple itup,
 			   OffsetNumber newitemoff,
+			   int postingoff,
 			   bool split_only_page)
 {
 	Page		page;
 	BTPageOpaque lpageop;
 	Size		itemsz;
+	IndexTuple	oposting = NULL;
+	IndexTuple	origitup = NULL;
+	IndexTuple	nposting = NULL;
 
 	page = BufferGetPage(buf);
 	lpageop = (BTPageOpaque) PageGetSpecialPointer(page);
@@ -972,6 +1123,33 @@ _bt_insertonpg(Relation rel,
 	itemsz = MAXALIGN(itemsz);	/* be safe, PageAddItem will do this but we
 								 * need to be consistent */
 
+	/*
+	 * Do we need to split an existing posting list item?
+	 */
+	if (postingoff != 0)
+	{
+		ItemId		itemid = PageGetItemId(page, newitemoff);
+
+		/*
+		 * The new tuple is a duplicate with a heap TID that falls inside the
+		 * range of an existing posting list tuple on a leaf page.  Prepare to
+		 * split an existing posting list.  Overwriting the posting list with
+		 * its post-split version is treated as an extra step in either the
+		 * insert or page split critical section.
+		 */
+		Assert(P_ISLEAF(lpageop) && ItemIdIsNormal(itemid));
+		oposting = (IndexTuple) PageGetItem(page, itemid);
+
+		/* use a mutable copy of itup as our itup from here on */
+		origitup = itup;
+		itup = CopyIndexTuple(origitup);
+		nposting = _bt_swap_posting(itup, oposting, postingoff);
+		/* itup now contains rightmost/max TID from oposting */
+
+		/* Alter offset so that newitem goes after posting list */
+		newitemoff = OffsetNumberNext(newitemoff);
+	}
+
 	/*
 	 * Do we need to split the page to fit the item on it?
 	 *
@@ -1004,7 +1182,8 @@ _bt_insertonpg(Relation rel,
 				 BlockNumberIsValid(RelationGetTargetBlock(rel))));
 
 		/* split the buffer into left and right halves */
-		rbuf = _bt_split(rel, itup_key, buf, cbuf, newitemoff, itemsz, itup);
+		rbuf = _bt_split(rel, itup_key, buf, cbuf, newitemoff, itemsz, itup,
+						 origitup, nposting, postingoff);
 		PredicateLockPageSplit(rel,
 							   BufferGetBlockNumber(buf),
 							   BufferGetBlockNumber(rbuf));
@@ -1079,6 +1258,9 @@ _bt_insertonpg(Relation rel,
 		/* Do the update.  No ereport(ERROR) until changes are logged */
 		START_CRIT_SECTION();
 
+		if (postingoff != 0)
+			memcpy(oposting, nposting, MAXALIGN(IndexTupleSize(nposting)));
+
 		if (!_bt_pgaddtup(page, itemsz, itup, newitemoff))
 			elog(PANIC, "failed to add new item to block %u in index \"%s\"",
 				 itup_blkno, RelationGetRelationName(rel));
@@ -1128,8 +1310,17 @@ _bt_insertonpg(Relation rel,
 			XLogBeginInsert();
 			XLogRegisterData((char *) &xlrec, SizeOfBtreeInsert);
 
-			if (P_ISLEAF(lpageop))
+			if (P_ISLEAF(lpageop) && postingoff == 0)
 				xlinfo = XLOG_BTREE_INSERT_LEAF;
+			else if (postingoff != 0)
+			{
+				/*
+				 * This insert is also a posting list split, which is logged
+				 * as a variant of an insert.
+				 */
+				Assert(P_ISLEAF(lpageop));
+				xlinfo = XLOG_BTREE_INSERT_POST;
+			}
 			else
 			{
 				/*
@@ -1160,7 +1351,27 @@ _bt_insertonpg(Relation rel,
 			}
 
 			XLogRegisterBuffer(0, buf, REGBUF_STANDARD);
-			XLogRegisterBufData(0, (char *) itup, IndexTupleSize(itup));
+			if (postingoff == 0)
+			{
+				/* Simple, common case -- log itup from caller */
+				XLogRegisterBufData(0, (char *) itup, IndexTupleSize(itup));
+			}
+			else
+			{
+				/*
+				 * Insert with posting list split (XLOG_BTREE_INSERT_POST
+				 * record) case.
+				 *
+				 * Log postingoff.  Also log origitup, not itup.  REDO routine
+				 * must reconstruct final itup (as well as nposting) using
+				 * _bt_swap_posting().
+				 */
+				uint16		upostingoff = postingoff;
+
+				XLogRegisterBufData(0, (char *) &upostingoff, sizeof(uint16));
+				XLogRegisterBufData(0, (char *) origitup,
+									IndexTupleSize(origitup));
+			}
 
 			recptr = XLogInsert(RM_BTREE_ID, xlinfo);
 
@@ -1202,6 +1413,14 @@ _bt_insertonpg(Relation rel,
 			_bt_getrootheight(rel) >= BTREE_FASTPATH_MIN_LEVEL)
 			RelationSetTargetBlock(rel, cachedBlock);
 	}
+
+	/* be tidy */
+	if (postingoff != 0)
+	{
+		/* itup is actually a modified copy of caller's original */
+		pfree(nposting);
+		pfree(itup);
+	}
 }
 
 /*
@@ -1217,12 +1436,24 @@ _bt_insertonpg(Relation rel,
  *		This function will clear the INCOMPLETE_SPLIT flag on it, and
  *		release the buffer.
  *
+ *		orignewitem, nposting, and postingoff are needed when an insert of
+ *		orignewitem results in both a posting list split and a page split.
+ *		These extra posting list split details are used here in the same
+ *		way as they are used in the more common case where a posting list
+ *		split does not coincide with a page split.  We need to deal with
+ *		posting list splits directly in order to ensure that everything
+ *		that follows from the insert of orignewitem is handled as a single
+ *		atomic operation (though caller's insert of a new pivot/downlink
+ *		into parent page will still be a separate operation).  See
+ *		nbtree/README for details on the design of posting list splits.
+ *
  *		Returns the new right sibling of buf, pinned and write-locked.
  *		The pin and lock on buf are maintained.
  */
 static Buffer
 _bt_split(Relation rel, BTScanInsert itup_key, Buffer buf, Buffer cbuf,
-		  OffsetNumber newitemoff, Size newitemsz, IndexTuple newitem)
+		  OffsetNumber newitemoff, Size newitemsz, IndexTuple newitem,
+		  IndexTuple orignewitem, IndexTuple nposting, uint16 postingoff)
 {
 	Buffer		rbuf;
 	Page		origpage;
@@ -1249,6 +1480,7 @@ _bt_split(Relation rel, BTScanInsert itup_key, Buffer buf, Buffer cbuf,
 	IndexTuple	lefthikey;
 	int			indnatts = IndexRelationGetNumberOfAttributes(rel);
 	int			indnkeyatts = IndexRelationGetNumberOfKeyAttributes(rel);
+	OffsetNumber origpagepostingoff = InvalidOffsetNumber;
 
 	/*
 	 * origpage is the original page to be split.  leftpage is a temporary
@@ -1267,6 +1499,18 @@ _bt_split(Relation rel, BTScanInsert itup_key, Buffer buf, Buffer cbuf,
 	oopaque = (BTPageOpaque) PageGetSpecialPointer(origpage);
 	origpagenumber = BufferGetBlockNumber(buf);
 
+	/*
+	 * The posting list tuple that the insert splits, if any, is the item
+	 * right before newitemoff.  It's replaced by nposting wherever it ends
+	 * up.  nposting is the same size as the original, so the choice of split
+	 * point isn't affected.
+	 */
+	if (postingoff != 0)
+	{
+		Assert(P_ISLEAF(oopaque));
+		origpagepostingoff = OffsetNumberPrev(newitemoff);
+	}
+
 	/*
 	 * Choose a point to split origpage at.
 	 *
@@ -1348,6 +1592,8 @@ _bt_split(Relation rel, BTScanInsert itup_key, Buffer buf, Buffer cbuf,
 		itemid = PageGetItemId(origpage, firstright);
 		itemsz = ItemIdGetLength(itemid);
 		item = (IndexTuple) PageGetItem(origpage, itemid);
+		if (firstright == origpagepostingoff)
+			item = nposting;
 	}
 
 	/*
@@ -1381,6 +1627,8 @@ _bt_split(Relation rel, BTScanInsert itup_key, Buffer buf, Buffer cbuf,
 			Assert(lastleftoff >= P_FIRSTDATAKEY(oopaque));
 			itemid = PageGetItemId(origpage, lastleftoff);
 			lastleft = (IndexTuple) PageGetItem(origpage, itemid);
+			if (lastleftoff == origpagepostingoff)
+				lastleft = nposting;
 		}
 
 		Assert(lastleft != item);
@@ -1488,6 +1736,14 @@ _bt_split(Relation rel, BTScanInsert itup_key, Buffer buf, Buffer cbuf,
 		itemsz = ItemIdGetLength(itemid);
 		item = (IndexTuple) PageGetItem(origpage, itemid);
 
+		/* replace original item with nposting due to posting split? */
+		if (i == origpagepostingoff)
+		{
+			Assert(BTreeTupleIsPosting(item));
+			Assert(itemsz == MAXALIGN(IndexTupleSize(nposting)));
+			item = nposting;
+		}
+
 		/* does new item belong before this one? */
 		if (i == newitemoff)
 		{
@@ -1658,6 +1914,10 @@ _bt_split(Relation rel, BTScanInsert itup_key, Buffer buf, Buffer cbuf,
 		xlrec.level = ropaque->btpo.level;
 		xlrec.firstright = firstright;
 		xlrec.newitemoff = newitemoff;
+		xlrec.postingoff = 0;
+		if (postingoff != 0 && origpagepostingoff < firstright)
+			xlrec.postingoff = postingoff;
+		xlrec.deletemarked = P_HAS_DELETE_MARKED(ropaque);
 
 		XLogBeginInsert();
 		XLogRegisterData((char *) &xlrec, SizeOfBtreeSplit);
@@ -1678,9 +1938,21 @@ _bt_split(Relation rel, BTScanInsert itup_key, Buffer buf, Buffer cbuf,
 		 * is not stored if XLogInsert decides it needs a full-page image of
 		 * the left page.  We store the offset anyway, though, to support
 		 * archive compression of these records.
+		 *
+		 * When the split of a posting list went to the left page, log the
+		 * original new item instead, even if it ended up on the right page
+		 * (that can only happen when it's the first item there).  Recovery
+		 * repeats the posting list split with it.
 		 */
-		if (newitemonleft)
+		if (newitemonleft && xlrec.postingoff == 0)
 			XLogRegisterBufData(0, (char *) newitem, MAXALIGN(newitemsz));
+		else if (xlrec.postingoff != 0)
+		{
+			Assert(isleaf);
+			Assert(newitemonleft || firstright == newitemoff);
+			Assert(MAXALIGN(newitemsz) == IndexTupleSize(orignewitem));
+			XLogRegisterBufData(0, (char *) orignewitem, MAXALIGN(newitemsz));
+		}
 
 		/* Log the left page's new high key */
 		itemid = PageGetItemId(origpage, P_HIKEY);
@@ -1840,7 +2112,7 @@ _bt_insert_parent(Relation rel,
 
 		/* Recursively update the parent */
 		_bt_insertonpg(rel, NULL, pbuf, buf, stack->bts_parent,
-					   new_item, stack->bts_offset + 1,
+					   new_item, stack->bts_offset + 1, 0,
 					   is_only);
 
 		/* be tidy */
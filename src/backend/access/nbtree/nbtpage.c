@@ -24,6 +24,7 @@
 
 #include "access/nbtree.h"
 #include "access/nbtxlog.h"
+#include "access/tableam.h"
 #include "access/transam.h"
 #include "access/xlog.h"
 #include "access/xloginsert.h"
@@ -261,6 +262,37 @@ _bt_update_meta_cleanup_info(Relation rel, TransactionId oldestBtpoXact,
 	_bt_relbuf(rel, metabuf);
 }
 
+/*
+ *	_bt_request_cleanup() -- Make sure the next VACUUM scans the index.
+ *
+ *		btvacuumcleanup() skips the index scan when there was nothing to
+ *		delete, unless the metapage says otherwise.  A leaf page that just got
+ *		BTP_DELETE_MARKED needs that scan to get rid of its stale tuples, so
+ *		forget the heap tuple count of the last cleanup, as if there had been
+ *		none.
+ */
+void
+_bt_request_cleanup(Relation rel)
+{
+	Buffer		metabuf;
+	BTMetaPageData *metad;
+	TransactionId oldestBtpoXact;
+	bool		requested;
+
+	metabuf = _bt_getbuf(rel, BTREE_METAPAGE, BT_READ);
+	metad = BTPageGetMeta(BufferGetPage(metabuf));
+
+	/* an outdated metapage always gets cleanup */
+	requested = (metad->btm_version < BTREE_NOVAC_VERSION ||
+				 metad->btm_last_cleanup_num_heap_tuples < 0);
+	oldestBtpoXact = metad->btm_oldest_btpo_xact;
+
+	_bt_relbuf(rel, metabuf);
+
+	if (!requested)
+		_bt_update_meta_cleanup_info(rel, oldestBtpoXact, -1);
+}
+
 /*
  *	_bt_getroot() -- Get the root page of the btree.
  *
@@ -1009,7 +1041,13 @@ _bt_page_recyclable(Page page)
  * deleting the page it points to.
  *
  * This routine assumes that the caller has pinned and locked the buffer.
- * Also, the given itemnos *must* appear in increasing order in the array.
+ * Also, the given deletable offsets *must* appear in increasing order in the
+ * array.
+ *
+ * Some of the heap TIDs of posting list tuples may be deleted, too.  Each
+ * entry of the updatable array describes the TIDs to remove from one such
+ * tuple; the tuple is replaced in place by a smaller one.  Posting list
+ * tuples that lose all of their TIDs are in the deletable array instead.
  *
  * We record VACUUMs and b-tree deletes differently in WAL. InHotStandby
  * we need to be able to pin all of the blocks in the btree in physical
@@ -1023,18 +1061,46 @@ _bt_page_recyclable(Page page)
  */
 void
 _bt_delitems_vacuum(Relation rel, Buffer buf,
-					OffsetNumber *itemnos, int nitems,
+					OffsetNumber *deletable, int ndeletable,
+					BTVacuumPosting *updatable, int nupdatable,
 					BlockNumber lastBlockVacuumed)
 {
 	Page		page = BufferGetPage(buf);
 	BTPageOpaque opaque;
+	OffsetNumber updatedoffsets[MaxIndexTuplesPerPage];
+	int			i;
+
+	/*
+	 * Form the replacement posting list tuples before entering the critical
+	 * section, as that allocates memory.
+	 */
+	for (i = 0; i < nupdatable; i++)
+	{
+		_bt_update_posting(updatable[i]);
+		updatedoffsets[i] = updatable[i]->updatedoffset;
+	}
 
 	/* No ereport(ERROR) until changes are logged */
 	START_CRIT_SECTION();
 
-	/* Fix the page */
-	if (nitems > 0)
-		PageIndexMultiDelete(page, itemnos, nitems);
+	/*
+	 * Fix the page.  Updates go first, as deleting items changes the offsets
+	 * of the items that follow them.
+	 */
+	for (i = 0; i < nupdatable; i++)
+	{
+		OffsetNumber updatedoffset = updatedoffsets[i];
+		IndexTuple	itup = updatable[i]->itup;
+		Size		itemsz = MAXALIGN(IndexTupleSize(itup));
+
+		if (!PageIndexTupleOverwrite(page, updatedoffset, (Item) itup,
+									 itemsz))
+			elog(PANIC, "failed to update partially dead item in block %u of index \"%s\"",
+				 BufferGetBlockNumber(buf), RelationGetRelationName(rel));
+	}
+
+	if (ndeletable > 0)
+		PageIndexMultiDelete(page, deletable, ndeletable);
 
 	/*
 	 * We can clear the vacuum cycle ID since this page has certainly been
@@ -1061,18 +1127,37 @@ _bt_delitems_vacuum(Relation rel, Buffer buf,
 		xl_btree_vacuum xlrec_vacuum;
 
 		xlrec_vacuum.lastBlockVacuumed = lastBlockVacuumed;
+		xlrec_vacuum.ndeleted = ndeletable;
+		xlrec_vacuum.nupdated = nupdatable;
 
 		XLogBeginInsert();
 		XLogRegisterBuffer(0, buf, REGBUF_STANDARD);
 		XLogRegisterData((char *) &xlrec_vacuum, SizeOfBtreeVacuum);
 
 		/*
-		 * The target-offsets array is not in the buffer, but pretend that it
-		 * is.  When XLogInsert stores the whole buffer, the offsets array
-		 * need not be stored too.
+		 * The target-offsets arrays are not in the buffer, but pretend that
+		 * they are.  When XLogInsert stores the whole buffer, the offsets
+		 * arrays need not be stored too.
 		 */
-		if (nitems > 0)
-			XLogRegisterBufData(0, (char *) itemnos, nitems * sizeof(OffsetNumber));
+		if (ndeletable > 0)
+			XLogRegisterBufData(0, (char *) deletable,
+								ndeletable * sizeof(OffsetNumber));
+
+		if (nupdatable > 0)
+		{
+			XLogRegisterBufData(0, (char *) updatedoffsets,
+								nupdatable * sizeof(OffsetNumber));
+
+			for (i = 0; i < nupdatable; i++)
+			{
+				BTVacuumPosting vacposting = updatable[i];
+
+				XLogRegisterBufData(0, (char *) &vacposting->ndeletedtids,
+									SizeOfBtreeUpdate);
+				XLogRegisterBufData(0, (char *) vacposting->deletetids,
+									vacposting->ndeletedtids * sizeof(uint16));
+			}
+		}
 
 		recptr = XLogInsert(RM_BTREE_ID, XLOG_BTREE_VACUUM);
 
@@ -1080,6 +1165,78 @@ _bt_delitems_vacuum(Relation rel, Buffer buf,
 	}
 
 	END_CRIT_SECTION();
+
+	/* can't leak memory here */
+	for (i = 0; i < nupdatable; i++)
+		pfree(updatable[i]->itup);
+}
+
+/*
+ * Get the latestRemovedXid from the heap pages pointed at by the index
+ * tuples being deleted.  Like index_compute_xid_horizon_for_tuples, except
+ * that every heap TID of a posting list tuple is considered.
+ */
+static TransactionId
+_bt_xid_horizon(Relation rel, Relation heapRel, Page page,
+				OffsetNumber *itemnos, int nitems)
+{
+	ItemPointer htids;
+	TransactionId latestRemovedXid;
+	int			arraynitems;
+	int			finalnitems = 0;
+	int			i;
+
+	arraynitems = Max(nitems, MaxIndexTuplesPerPage);
+	htids = (ItemPointer) palloc(sizeof(ItemPointerData) * arraynitems);
+
+	for (i = 0; i < nitems; i++)
+	{
+		ItemId		itemid;
+		IndexTuple	itup;
+
+		itemid = PageGetItemId(page, itemnos[i]);
+		itup = (IndexTuple) PageGetItem(page, itemid);
+
+		Assert(ItemIdIsDead(itemid));
+
+		if (!BTreeTupleIsPosting(itup))
+		{
+			/* Make sure that we have space for additional heap TID */
+			if (finalnitems + 1 > arraynitems)
+			{
+				arraynitems = arraynitems * 2;
+				htids = (ItemPointer)
+					repalloc(htids, sizeof(ItemPointerData) * arraynitems);
+			}
+
+			htids[finalnitems++] = itup->t_tid;
+		}
+		else
+		{
+			int			nposting = BTreeTupleGetNPosting(itup);
+
+			/* Make sure that we have space for additional heap TIDs */
+			if (finalnitems + nposting > arraynitems)
+			{
+				arraynitems = Max(arraynitems * 2, finalnitems + nposting);
+				htids = (ItemPointer)
+					repalloc(htids, sizeof(ItemPointerData) * arraynitems);
+			}
+
+			memcpy(htids + finalnitems, BTreeTupleGetPosting(itup),
+				   sizeof(ItemPointerData) * nposting);
+			finalnitems += nposting;
+		}
+	}
+
+	Assert(finalnitems >= nitems);
+
+	latestRemovedXid =
+		table_compute_xid_horizon_for_tuples(heapRel, htids, finalnitems);
+
+	pfree(htids);
+
+	return latestRemovedXid;
 }
 
 /*
@@ -1107,9 +1264,8 @@ _bt_delitems_delete(Relation rel, Buffer buf,
 	Assert(nitems > 0);
 
 	if (XLogStandbyInfoActive() && RelationNeedsWAL(rel))
-		latestRemovedXid =
-			index_compute_xid_horizon_for_tuples(rel, heapRel, buf,
-												 itemnos, nitems);
+		latestRemovedXid = _bt_xid_horizon(rel, heapRel, page,
+										   itemnos, nitems);
 
 	/* No ereport(ERROR) until changes are logged */
 	START_CRIT_SECTION();
@@ -1162,6 +1318,86 @@ _bt_delitems_delete(Relation rel, Buffer buf,
 	END_CRIT_SECTION();
 }
 
+/*
+ * Delete-mark the tuple at offnum on a leaf page, or remove its delete-mark,
+ * for an in-place update of the heap tuple it points to.  Either way the page
+ * gets BTP_DELETE_MARKED.  If offnum is InvalidOffsetNumber, or the tuple is
+ * a posting list tuple, only the page flag is set.
+ *
+ * Returns true if the page didn't have BTP_DELETE_MARKED before, in which
+ * case the caller should call _bt_request_cleanup() once it has released the
+ * page.
+ *
+ * The caller must hold a write lock on buf.
+ */
+bool
+_bt_deletemark_item(Relation rel, Buffer buf, OffsetNumber offnum,
+					bool marked)
+{
+	Page		page = BufferGetPage(buf);
+	BTPageOpaque opaque = (BTPageOpaque) PageGetSpecialPointer(page);
+	ItemId		itemid = NULL;
+	bool		newlymarked = !P_HAS_DELETE_MARKED(opaque);
+
+	Assert(P_ISLEAF(opaque));
+
+	if (OffsetNumberIsValid(offnum))
+	{
+		itemid = PageGetItemId(page, offnum);
+		Assert(!ItemIdIsDead(itemid));
+
+		/*
+		 * A posting list tuple holds more than one heap TID, so its line
+		 * pointer can't carry the delete-mark of one of them.  Only the page
+		 * flag is set; that's enough for scans to compare every tuple of the
+		 * page with the heap.
+		 */
+		if (BTreeTupleIsPosting((IndexTuple) PageGetItem(page, itemid)))
+			itemid = NULL;
+	}
+
+	/* Nothing to do if the page and the tuple are already in shape */
+	if (!newlymarked &&
+		(itemid == NULL || BTItemIdIsDeleteMarked(itemid) == marked))
+		return false;
+
+	/* No ereport(ERROR) until changes are logged */
+	START_CRIT_SECTION();
+
+	if (itemid != NULL)
+	{
+		if (marked)
+			BTItemIdSetDeleteMarked(itemid);
+		else
+			BTItemIdClearDeleteMarked(itemid);
+	}
+	opaque->btpo_flags |= BTP_DELETE_MARKED;
+
+	MarkBufferDirty(buf);
+
+	/* XLOG stuff */
+	if (RelationNeedsWAL(rel))
+	{
+		XLogRecPtr	recptr;
+		xl_btree_delete_mark xlrec;
+
+		xlrec.offnum = itemid != NULL ? offnum : InvalidOffsetNumber;
+		xlrec.marked = marked;
+
+		XLogBeginInsert();
+		XLogRegisterBuffer(0, buf, REGBUF_STANDARD);
+		XLogRegisterData((char *) &xlrec, SizeOfBtreeDeleteMark);
+
+		recptr = XLogInsert(RM_BTREE_ID, XLOG_BTREE_DELETE_MARK);
+
+		PageSetLSN(page, recptr);
+	}
+
+	END_CRIT_SECTION();
+
+	return newlymarked;
+}
+
 /*
  * Returns true, if the given block has the half-dead flag set.
  */
@@ -21,6 +21,9 @@
 #include "access/nbtree.h"
 #include "access/nbtxlog.h"
 #include "access/relscan.h"
+#include "access/table.h"
+#include "access/tableam.h"
+#include "access/visibilitymap.h"
 #include "access/xlog.h"
 #include "commands/progress.h"
 #include "commands/vacuum.h"
@@ -51,6 +54,12 @@ typedef struct
 	BlockNumber totFreePages;	/* true total # of free pages */
 	TransactionId oldestBtpoXact;
 	MemoryContext pagedelcontext;
+	Relation	heaprel;		/* table, to check delete-marked pages */
+	TupleTableSlot *heapslot;	/* slot to fetch the table's tuples into */
+	Buffer		vmbuffer;		/* table's visibility map page, if pinned */
+	bool		pagemarked;		/* current page has BTP_DELETE_MARKED? */
+	bool		pageverified;	/* ... and all its tuples checked out? */
+	bool		deletemarked;	/* some page keeps BTP_DELETE_MARKED */
 } BTVacState;
 
 /*
@@ -94,7 +103,16 @@ typedef struct BTParallelScanDescData *BTParallelScanDesc;
 
 static void btvacuumscan(IndexVacuumInfo *info, IndexBulkDeleteResult *stats,
 						 IndexBulkDeleteCallback callback, void *callback_state,
-						 BTCycleId cycleid, TransactionId *oldestBtpoXact);
+						 BTCycleId cycleid, TransactionId *oldestBtpoXact,
+						 bool *deletemarked);
+static bool btvacuumtid(BTVacState *vstate, IndexTuple itup,
+						ItemPointer htid);
+static bool btvacuumstale(BTVacState *vstate, IndexTuple itup,
+						  ItemPointer htid);
+static BTVacuumPosting btvacuumposting(BTVacState *vstate,
+										IndexTuple posting,
+										OffsetNumber updatedoffset,
+										int *nremaining);
 static void btvacuumpage(BTVacState *vstate, BlockNumber blkno,
 						 BlockNumber orig_blkno);
 
@@ -123,11 +141,13 @@ bthandler(PG_FUNCTION_ARGS)
 	amroutine->ampredlocks = true;
 	amroutine->amcanparallel = true;
 	amroutine->amcaninclude = true;
+	amroutine->amcandeletemark = true;
 	amroutine->amkeytype = InvalidOid;
 
 	amroutine->ambuild = btbuild;
 	amroutine->ambuildempty = btbuildempty;
 	amroutine->aminsert = btinsert;
+	amroutine->amdeletemark = btdeletemark;
 	amroutine->ambulkdelete = btbulkdelete;
 	amroutine->amvacuumcleanup = btvacuumcleanup;
 	amroutine->amcanreturn = btcanreturn;
@@ -209,6 +229,32 @@ btinsert(Relation rel, Datum *values, bool *isnull,
 	return result;
 }
 
+/*
+ *	btdeletemark() -- delete-mark the old index tuple of an in-place update
+ *
+ *		The heap tuple kept its TID, so the old index tuple is delete-marked
+ *		rather than removed, and a tuple with the new key values is added.
+ */
+void
+btdeletemark(Relation rel, Datum *oldvalues, bool *oldisnull,
+			 Datum *newvalues, bool *newisnull,
+			 ItemPointer ht_ctid, Relation heapRel)
+{
+	IndexTuple	olditup;
+	IndexTuple	newitup;
+
+	/* generate the old and new index tuples */
+	olditup = index_form_tuple(RelationGetDescr(rel), oldvalues, oldisnull);
+	olditup->t_tid = *ht_ctid;
+	newitup = index_form_tuple(RelationGetDescr(rel), newvalues, newisnull);
+	newitup->t_tid = *ht_ctid;
+
+	_bt_deletemark(rel, olditup, newitup, heapRel);
+
+	pfree(olditup);
+	pfree(newitup);
+}
+
 /*
  *	btgettuple() -- Get the next tuple in the scan.
  */
@@ -235,6 +281,13 @@ btgettuple(IndexScanDesc scan, ScanDirection dir)
 		_bt_start_array_keys(scan, dir);
 	}
 
+	/* Likewise, find the first value of the first column for a skip scan */
+	if (so->skipScan && !BTScanPosIsValid(so->currPos))
+	{
+		if (!_bt_start_skip_key(scan, dir))
+			return false;
+	}
+
 	/* This loop handles advancing to the next array elements, if any */
 	do
 	{
@@ -263,8 +316,8 @@ btgettuple(IndexScanDesc scan, ScanDirection dir)
 				 */
 				if (so->killedItems == NULL)
 					so->killedItems = (int *)
-						palloc(MaxIndexTuplesPerPage * sizeof(int));
-				if (so->numKilled < MaxIndexTuplesPerPage)
+						palloc(MaxTIDsPerBTreePage * sizeof(int));
+				if (so->numKilled < MaxTIDsPerBTreePage)
 					so->killedItems[so->numKilled++] = so->currPos.itemIndex;
 			}
 
@@ -278,7 +331,8 @@ btgettuple(IndexScanDesc scan, ScanDirection dir)
 		if (res)
 			break;
 		/* ... otherwise see if we have more array keys to deal with */
-	} while (so->numArrayKeys && _bt_advance_array_keys(scan, dir));
+	} while ((so->numArrayKeys && _bt_advance_array_keys(scan, dir)) ||
+			 (so->skipScan && _bt_advance_skip_key(scan, dir)));
 
 	return res;
 }
@@ -305,6 +359,13 @@ btgetbitmap(IndexScanDesc scan, TIDBitmap *tbm)
 		_bt_start_array_keys(scan, ForwardScanDirection);
 	}
 
+	/* Likewise, find the first value of the first column for a skip scan */
+	if (so->skipScan)
+	{
+		if (!_bt_start_skip_key(scan, ForwardScanDirection))
+			return ntids;
+	}
+
 	/* This loop handles advancing to the next array elements, if any */
 	do
 	{
@@ -313,7 +374,7 @@ btgetbitmap(IndexScanDesc scan, TIDBitmap *tbm)
 		{
 			/* Save tuple ID, and continue scanning */
 			heapTid = &scan->xs_heaptid;
-			tbm_add_tuples(tbm, heapTid, 1, false);
+			tbm_add_tuples(tbm, heapTid, 1, so->currPos.deletemarked);
 			ntids++;
 
 			for (;;)
@@ -331,12 +392,15 @@ btgetbitmap(IndexScanDesc scan, TIDBitmap *tbm)
 
 				/* Save tuple ID, and continue scanning */
 				heapTid = &so->currPos.items[so->currPos.itemIndex].heapTid;
-				tbm_add_tuples(tbm, heapTid, 1, false);
+				tbm_add_tuples(tbm, heapTid, 1, so->currPos.deletemarked);
 				ntids++;
 			}
 		}
 		/* Now see if we have more array keys to deal with */
-	} while (so->numArrayKeys && _bt_advance_array_keys(scan, ForwardScanDirection));
+	} while ((so->numArrayKeys &&
+			  _bt_advance_array_keys(scan, ForwardScanDirection)) ||
+			 (so->skipScan &&
+			  _bt_advance_skip_key(scan, ForwardScanDirection)));
 
 	return ntids;
 }
@@ -360,8 +424,9 @@ btbeginscan(Relation rel, int nkeys, int norderbys)
 	so = (BTScanOpaque) palloc(sizeof(BTScanOpaqueData));
 	BTScanPosInvalidate(so->currPos);
 	BTScanPosInvalidate(so->markPos);
+	/* leave room for the key a skip scan adds */
 	if (scan->numberOfKeys > 0)
-		so->keyData = (ScanKey) palloc(scan->numberOfKeys * sizeof(ScanKeyData));
+		so->keyData = (ScanKey) palloc((scan->numberOfKeys + 1) * sizeof(ScanKeyData));
 	else
 		so->keyData = NULL;
 
@@ -370,6 +435,14 @@ btbeginscan(Relation rel, int nkeys, int norderbys)
 	so->arrayKeys = NULL;
 	so->arrayContext = NULL;
 
+	so->skipScan = false;		/* likewise for skipping */
+	so->skipKeyData = NULL;
+	so->skipCur.valid = false;
+	so->skipNext.valid = false;
+	so->skipNextDir = NoMovementScanDirection;
+	so->skipMark.valid = false;
+	so->skipContext = NULL;
+
 	so->killedItems = NULL;		/* until needed */
 	so->numKilled = 0;
 
@@ -445,6 +518,9 @@ btrescan(IndexScanDesc scan, ScanKey scankey, int nscankeys,
 
 	/* If any keys are SK_SEARCHARRAY type, set up array-key info */
 	_bt_preprocess_array_keys(scan);
+
+	/* Set up the skip key, if we're to skip over first column values */
+	_bt_preprocess_skip_key(scan);
 }
 
 /*
@@ -475,6 +551,9 @@ btendscan(IndexScanDesc scan)
 	/* so->arrayKeyData and so->arrayKeys are in arrayContext */
 	if (so->arrayContext != NULL)
 		MemoryContextDelete(so->arrayContext);
+	/* so->skipKeyData and the skip values are in skipContext */
+	if (so->skipContext != NULL)
+		MemoryContextDelete(so->skipContext);
 	if (so->killedItems != NULL)
 		pfree(so->killedItems);
 	if (so->currTuples != NULL)
@@ -511,6 +590,8 @@ btmarkpos(IndexScanDesc scan)
 	/* Also record the current positions of any array keys */
 	if (so->numArrayKeys)
 		_bt_mark_array_keys(scan);
+	if (so->skipScan)
+		_bt_mark_skip_key(scan);
 }
 
 /*
@@ -524,6 +605,8 @@ btrestrpos(IndexScanDesc scan)
 	/* Restore the marked positions of any array keys */
 	if (so->numArrayKeys)
 		_bt_restore_array_keys(scan);
+	if (so->skipScan)
+		_bt_restore_skip_key(scan);
 
 	if (so->markItemIndex >= 0)
 	{
@@ -868,19 +951,21 @@ btbulkdelete(IndexVacuumInfo *info, IndexBulkDeleteResult *stats,
 	PG_ENSURE_ERROR_CLEANUP(_bt_end_vacuum_callback, PointerGetDatum(rel));
 	{
 		TransactionId oldestBtpoXact;
+		bool		deletemarked;
 
 		cycleid = _bt_start_vacuum(rel);
 
 		btvacuumscan(info, stats, callback, callback_state, cycleid,
-					 &oldestBtpoXact);
+					 &oldestBtpoXact, &deletemarked);
 
 		/*
 		 * Update cleanup-related information in metapage. This information is
 		 * used only for cleanup but keeping them up to date can avoid
-		 * unnecessary cleanup even after bulkdelete.
+		 * unnecessary cleanup even after bulkdelete.  If delete-marked pages
+		 * are left, the next cleanup must look at them again.
 		 */
 		_bt_update_meta_cleanup_info(info->index, oldestBtpoXact,
-									 info->num_heap_tuples);
+									 deletemarked ? -1 : info->num_heap_tuples);
 	}
 	PG_END_ENSURE_ERROR_CLEANUP(_bt_end_vacuum_callback, PointerGetDatum(rel));
 	_bt_end_vacuum(rel);
@@ -904,26 +989,31 @@ btvacuumcleanup(IndexVacuumInfo *info, IndexBulkDeleteResult *stats)
 	 * If btbulkdelete was called, we need not do anything, just return the
 	 * stats from the latest btbulkdelete call.  If it wasn't called, we might
 	 * still need to do a pass over the index, to recycle any newly-recyclable
-	 * pages or to obtain index statistics.  _bt_vacuum_needs_cleanup
-	 * determines if either are needed.
+	 * pages, to remove stale tuples of delete-marked pages, or to obtain
+	 * index statistics.  _bt_vacuum_needs_cleanup determines if any of that
+	 * is needed.
 	 *
-	 * Since we aren't going to actually delete any leaf items, there's no
-	 * need to go through all the vacuum-cycle-ID pushups.
+	 * The only leaf items we might delete are stale tuples of delete-marked
+	 * pages.  If a concurrent page split moves some of them to a page we have
+	 * already scanned, the next VACUUM will get them, so there's no need to
+	 * go through all the vacuum-cycle-ID pushups.
 	 */
 	if (stats == NULL)
 	{
 		TransactionId oldestBtpoXact;
+		bool		deletemarked;
 
 		/* Check if we need a cleanup */
 		if (!_bt_vacuum_needs_cleanup(info))
 			return NULL;
 
 		stats = (IndexBulkDeleteResult *) palloc0(sizeof(IndexBulkDeleteResult));
-		btvacuumscan(info, stats, NULL, NULL, 0, &oldestBtpoXact);
+		btvacuumscan(info, stats, NULL, NULL, 0, &oldestBtpoXact,
+					 &deletemarked);
 
 		/* Update cleanup-related information in the metapage */
 		_bt_update_meta_cleanup_info(info->index, oldestBtpoXact,
-									 info->num_heap_tuples);
+									 deletemarked ? -1 : info->num_heap_tuples);
 	}
 
 	/*
@@ -956,7 +1046,8 @@ btvacuumcleanup(IndexVacuumInfo *info, IndexBulkDeleteResult *stats)
 static void
 btvacuumscan(IndexVacuumInfo *info, IndexBulkDeleteResult *stats,
 			 IndexBulkDeleteCallback callback, void *callback_state,
-			 BTCycleId cycleid, TransactionId *oldestBtpoXact)
+			 BTCycleId cycleid, TransactionId *oldestBtpoXact,
+			 bool *deletemarked)
 {
 	Relation	rel = info->index;
 	BTVacState	vstate;
@@ -982,12 +1073,23 @@ btvacuumscan(IndexVacuumInfo *info, IndexBulkDeleteResult *stats,
 	vstate.lastBlockLocked = BTREE_METAPAGE;
 	vstate.totFreePages = 0;
 	vstate.oldestBtpoXact = InvalidTransactionId;
+	vstate.pagemarked = false;
+	vstate.pageverified = false;
+	vstate.deletemarked = false;
 
 	/* Create a temporary memory context to run _bt_pagedel in */
 	vstate.pagedelcontext = AllocSetContextCreate(CurrentMemoryContext,
 												  "_bt_pagedel",
 												  ALLOCSET_DEFAULT_SIZES);
 
+	/*
+	 * Tuples of delete-marked pages are checked against the table, see
+	 * btvacuumstale().  VACUUM already holds a lock on the table.
+	 */
+	vstate.heaprel = table_open(rel->rd_index->indrelid, AccessShareLock);
+	vstate.heapslot = table_slot_create(vstate.heaprel, NULL);
+	vstate.vmbuffer = InvalidBuffer;
+
 	/*
 	 * The outer loop iterates over all index pages except the metapage, in
 	 * physical order (we hope the kernel will cooperate in providing
@@ -1069,12 +1171,18 @@ btvacuumscan(IndexVacuumInfo *info, IndexBulkDeleteResult *stats,
 								 RBM_NORMAL, info->strategy);
 		LockBufferForCleanup(buf);
 		_bt_checkpage(rel, buf);
-		_bt_delitems_vacuum(rel, buf, NULL, 0, vstate.lastBlockVacuumed);
+		_bt_delitems_vacuum(rel, buf, NULL, 0, NULL, 0,
+							vstate.lastBlockVacuumed);
 		_bt_relbuf(rel, buf);
 	}
 
 	MemoryContextDelete(vstate.pagedelcontext);
 
+	if (BufferIsValid(vstate.vmbuffer))
+		ReleaseBuffer(vstate.vmbuffer);
+	ExecDropSingleTupleTableSlot(vstate.heapslot);
+	table_close(vstate.heaprel, AccessShareLock);
+
 	/*
 	 * If we found any recyclable pages (and recorded them in the FSM), then
 	 * forcibly update the upper-level FSM pages to ensure that searchers can
@@ -1096,6 +1204,8 @@ btvacuumscan(IndexVacuumInfo *info, IndexBulkDeleteResult *stats,
 
 	if (oldestBtpoXact)
 		*oldestBtpoXact = vstate.oldestBtpoXact;
+	if (deletemarked)
+		*deletemarked = vstate.deletemarked;
 }
 
 /*
@@ -1115,7 +1225,6 @@ btvacuumpage(BTVacState *vstate, BlockNumber blkno, BlockNumber orig_blkno)
 	IndexVacuumInfo *info = vstate->info;
 	IndexBulkDeleteResult *stats = vstate->stats;
 	IndexBulkDeleteCallback callback = vstate->callback;
-	void	   *callback_state = vstate->callback_state;
 	Relation	rel = info->index;
 	bool		delete_now;
 	BlockNumber recurse_to;
@@ -1190,9 +1299,13 @@ restart:
 	{
 		OffsetNumber deletable[MaxOffsetNumber];
 		int			ndeletable;
+		BTVacuumPosting updatable[MaxOffsetNumber];
+		int			nupdatable;
 		OffsetNumber offnum,
 					minoff,
 					maxoff;
+		int			nhtidsdead,
+					nhtidslive;
 
 		/*
 		 * Trade in the initial read lock for a super-exclusive write lock on
@@ -1224,14 +1337,21 @@ restart:
 			opaque->btpo_next < orig_blkno)
 			recurse_to = opaque->btpo_next;
 
+		/* Tuples of a delete-marked page may be stale, see btvacuumstale() */
+		vstate->pagemarked = P_HAS_DELETE_MARKED(opaque);
+		vstate->pageverified = true;
+
 		/*
 		 * Scan over all items to see which ones need deleted according to the
-		 * callback function.
+		 * callback function, or because they are stale.
 		 */
 		ndeletable = 0;
+		nupdatable = 0;
+		nhtidsdead = 0;
+		nhtidslive = 0;
 		minoff = P_FIRSTDATAKEY(opaque);
 		maxoff = PageGetMaxOffsetNumber(page);
-		if (callback)
+		if (callback || vstate->pagemarked)
 		{
 			for (offnum = minoff;
 				 offnum <= maxoff;
@@ -1244,6 +1364,38 @@ restart:
 												PageGetItemId(page, offnum));
 				htup = &(itup->t_tid);
 
+				if (BTreeTupleIsPosting(itup))
+				{
+					BTVacuumPosting vacposting;
+					int			nremaining;
+
+					/*
+					 * Ask the callback about each heap TID of the posting
+					 * list.  The tuple is deleted if none of them remains,
+					 * else it's replaced by a smaller posting list.
+					 */
+					vacposting = btvacuumposting(vstate, itup, offnum,
+												 &nremaining);
+					if (vacposting == NULL)
+					{
+						/* no TIDs to delete from this posting list */
+						nhtidslive += nremaining;
+					}
+					else if (nremaining > 0)
+					{
+						updatable[nupdatable++] = vacposting;
+						nhtidsdead += vacposting->ndeletedtids;
+						nhtidslive += nremaining;
+					}
+					else
+					{
+						deletable[ndeletable++] = offnum;
+						nhtidsdead += BTreeTupleGetNPosting(itup);
+						pfree(vacposting);
+					}
+					continue;
+				}
+
 				/*
 				 * During Hot Standby we currently assume that
 				 * XLOG_BTREE_VACUUM records do not produce conflicts. That is
@@ -1263,18 +1415,41 @@ restart:
 				 * worked out a way to pass a useful value for
 				 * latestRemovedXid on the XLOG_BTREE_VACUUM records. This
 				 * applies to *any* type of index that marks index tuples as
-				 * killed.
+				 * killed.  Stale tuples of delete-marked pages are deleted
+				 * based on the visibility map instead, see btvacuumstale().
 				 */
-				if (callback(htup, callback_state))
+				if (btvacuumtid(vstate, itup, htup))
+				{
 					deletable[ndeletable++] = offnum;
+					nhtidsdead++;
+				}
+				else
+					nhtidslive++;
+			}
+		}
+		else
+		{
+			/* count each heap TID of a posting list as a live tuple */
+			for (offnum = minoff;
+				 offnum <= maxoff;
+				 offnum = OffsetNumberNext(offnum))
+			{
+				IndexTuple	itup;
+
+				itup = (IndexTuple) PageGetItem(page,
+												PageGetItemId(page, offnum));
+				if (BTreeTupleIsPosting(itup))
+					nhtidslive += BTreeTupleGetNPosting(itup);
+				else
+					nhtidslive++;
 			}
 		}
 
 		/*
-		 * Apply any needed deletes.  We issue just one _bt_delitems_vacuum()
-		 * call per page, so as to minimize WAL traffic.
+		 * Apply any needed deletes or updates.  We issue just one
+		 * _bt_delitems_vacuum() call per page, so as to minimize WAL traffic.
 		 */
-		if (ndeletable > 0)
+		if (ndeletable > 0 || nupdatable > 0)
 		{
 			/*
 			 * Notice that the issued XLOG_BTREE_VACUUM WAL record includes
@@ -1291,6 +1466,7 @@ restart:
 			 * that.
 			 */
 			_bt_delitems_vacuum(rel, buf, deletable, ndeletable,
+								updatable, nupdatable,
 								vstate->lastBlockVacuumed);
 
 			/*
@@ -1300,9 +1476,13 @@ restart:
 			if (blkno > vstate->lastBlockVacuumed)
 				vstate->lastBlockVacuumed = blkno;
 
-			stats->tuples_removed += ndeletable;
+			stats->tuples_removed += nhtidsdead;
 			/* must recompute maxoff */
 			maxoff = PageGetMaxOffsetNumber(page);
+
+			/* can't leak memory here */
+			for (int i = 0; i < nupdatable; i++)
+				pfree(updatable[i]);
 		}
 		else
 		{
@@ -1323,6 +1503,34 @@ restart:
 			}
 		}
 
+		/*
+		 * If every tuple left on a delete-marked page matches the current
+		 * version of its table tuple, and that version is all-visible, scans
+		 * have no need to compare the page's tuples with the table anymore.
+		 * Remove the page flag and any remaining delete-marks.  We treat this
+		 * like a hint-bit update, as with BTP_HAS_GARBAGE: if the change is
+		 * lost, scans just keep checking the page.
+		 */
+		if (vstate->pagemarked)
+		{
+			if (vstate->pageverified)
+			{
+				for (offnum = minoff;
+					 offnum <= maxoff;
+					 offnum = OffsetNumberNext(offnum))
+				{
+					ItemId		itemid = PageGetItemId(page, offnum);
+
+					if (BTItemIdIsDeleteMarked(itemid))
+						BTItemIdClearDeleteMarked(itemid);
+				}
+				opaque->btpo_flags &= ~BTP_DELETE_MARKED;
+				MarkBufferDirtyHint(buf, true);
+			}
+			else
+				vstate->deletemarked = true;
+		}
+
 		/*
 		 * If it's now empty, try to delete; else count the live tuples. We
 		 * don't delete when recursing, though, to avoid putting entries into
@@ -1332,7 +1540,7 @@ restart:
 		if (minoff > maxoff)
 			delete_now = (blkno == orig_blkno);
 		else
-			stats->num_index_tuples += maxoff - minoff + 1;
+			stats->num_index_tuples += nhtidslive;
 	}
 
 	if (delete_now)
@@ -1375,6 +1583,123 @@ restart:
 	}
 }
 
+/*
+ * btvacuumtid --- should VACUUM delete the index entry for a heap TID?
+ *
+ * The callback tells us about the heap tuples this VACUUM removed.  On a
+ * delete-marked page, entries that no longer match their heap tuple go too.
+ */
+static bool
+btvacuumtid(BTVacState *vstate, IndexTuple itup, ItemPointer htid)
+{
+	if (vstate->callback && vstate->callback(htid, vstate->callback_state))
+		return true;
+
+	if (vstate->pagemarked)
+		return btvacuumstale(vstate, itup, htid);
+
+	return false;
+}
+
+/*
+ * btvacuumstale --- is an index entry of a delete-marked page stale?
+ *
+ * An in-place update of the heap tuple leaves its old index tuple behind,
+ * delete-marked, and rolling the update back leaves the new one behind.
+ * Either has to stay as long as some snapshot might see a heap tuple version
+ * it matches.  If the heap page is all-visible, every snapshot sees the
+ * current version, so an entry that doesn't match that one is of no use
+ * to anybody and can be deleted.  Standby queries that could still need it
+ * were already dealt with when the visibility map bit was set, which
+ * resolves recovery conflicts.
+ *
+ * We check the visibility map after fetching the tuple.  A concurrent
+ * update clears the bit before it releases the heap page, so if the bit is
+ * still set, we've seen the all-visible version.  An entry for the update's
+ * new key values has to wait for our lock on the index page.
+ *
+ * As in _bt_check_unique(), we visit the heap while holding the lock on the
+ * index page.  If we can't tell whether the entry matches, the page keeps
+ * BTP_DELETE_MARKED.
+ */
+static bool
+btvacuumstale(BTVacState *vstate, IndexTuple itup, ItemPointer htid)
+{
+	Relation	rel = vstate->info->index;
+	bool		stale;
+
+	if (!table_tuple_fetch_row_version(vstate->heaprel, htid, SnapshotAny,
+									   vstate->heapslot) ||
+		!VM_ALL_VISIBLE(vstate->heaprel, ItemPointerGetBlockNumber(htid),
+						&vstate->vmbuffer))
+	{
+		ExecClearTuple(vstate->heapslot);
+		vstate->pageverified = false;
+		return false;
+	}
+
+	stale = !index_tuple_matches_slot(rel, itup, RelationGetDescr(rel),
+									  vstate->heapslot);
+	ExecClearTuple(vstate->heapslot);
+
+	return stale;
+}
+
+/*
+ * btvacuumposting --- determine TIDs still needed in posting list
+ *
+ * Returns metadata describing how to build a replacement tuple without the
+ * TIDs that VACUUM needs to delete.  Returned value is NULL in the common
+ * case where no changes are needed to caller's posting list tuple (we avoid
+ * allocating memory here as an optimization).
+ *
+ * The number of TIDs that should remain in the posting list tuple is set
+ * for caller in *nremaining.
+ */
+static BTVacuumPosting
+btvacuumposting(BTVacState *vstate, IndexTuple posting,
+				OffsetNumber updatedoffset, int *nremaining)
+{
+	int			live = 0;
+	int			nitem = BTreeTupleGetNPosting(posting);
+	ItemPointer items = BTreeTupleGetPosting(posting);
+	BTVacuumPosting vacposting = NULL;
+
+	for (int i = 0; i < nitem; i++)
+	{
+		if (!btvacuumtid(vstate, posting, items + i))
+		{
+			/* live table TID */
+			live++;
+		}
+		else if (vacposting == NULL)
+		{
+			/*
+			 * First dead table TID encountered.
+			 *
+			 * It's now clear that we need to delete one or more dead table
+			 * TIDs, so start maintaining metadata describing how to update
+			 * existing posting list tuple.
+			 */
+			vacposting = palloc(offsetof(BTVacuumPostingData, deletetids) +
+								nitem * sizeof(uint16));
+
+			vacposting->itup = posting;
+			vacposting->updatedoffset = updatedoffset;
+			vacposting->ndeletedtids = 0;
+			vacposting->deletetids[vacposting->ndeletedtids++] = i;
+		}
+		else
+		{
+			/* Second or subsequent dead table TID */
+			vacposting->deletetids[vacposting->ndeletedtids++] = i;
+		}
+	}
+
+	*nremaining = live;
+	return vacposting;
+}
+
 /*
  *	btcanreturn() -- Check whether btree indexes support index-only scans.
  *
@@ -26,16 +26,26 @@
 
 static void _bt_drop_lock_and_maybe_pin(IndexScanDesc scan, BTScanPos sp);
 static OffsetNumber _bt_binsrch(Relation rel, BTScanInsert key, Buffer buf);
+static int	_bt_binsrch_posting(BTScanInsert key, Page page,
+								OffsetNumber offnum);
 static bool _bt_readpage(IndexScanDesc scan, ScanDirection dir,
 						 OffsetNumber offnum);
 static void _bt_saveitem(BTScanOpaque so, int itemIndex,
 						 OffsetNumber offnum, IndexTuple itup);
+static int	_bt_setuppostingitems(BTScanOpaque so, int itemIndex,
+								  OffsetNumber offnum, ItemPointer heapTid,
+								  IndexTuple itup);
+static inline void _bt_savepostingitem(BTScanOpaque so, int itemIndex,
+									   OffsetNumber offnum,
+									   ItemPointer heapTid, int tupleOffset);
 static bool _bt_steppage(IndexScanDesc scan, ScanDirection dir);
 static bool _bt_readnextpage(IndexScanDesc scan, BlockNumber blkno, ScanDirection dir);
 static bool _bt_parallel_readpage(IndexScanDesc scan, BlockNumber blkno,
 								  ScanDirection dir);
 static Buffer _bt_walk_left(Relation rel, Buffer buf, Snapshot snapshot);
 static bool _bt_endpoint(IndexScanDesc scan, ScanDirection dir);
+static void _bt_note_skip_value(IndexScanDesc scan, IndexTuple itup,
+								ScanDirection dir);
 static inline void _bt_initialize_more_data(BTScanOpaque so, ScanDirection dir);
 
 
@@ -458,6 +468,7 @@ _bt_binsrch_insert(Relation rel, BTInsertState insertstate)
 
 	Assert(P_ISLEAF(opaque));
 	Assert(!key->nextkey);
+	Assert(insertstate->postingoff == 0);
 
 	if (!insertstate->bounds_valid)
 	{
@@ -514,6 +525,16 @@ _bt_binsrch_insert(Relation rel, BTInsertState insertstate)
 			if (result != 0)
 				stricthigh = high;
 		}
+
+		/*
+		 * If tuple at offset located by binary search is a posting list whose
+		 * heap TID range includes caller's scantid, perform posting list
+		 * binary search to set postingoff for caller.  Caller must split the
+		 * posting list when postingoff is set.  This should happen
+		 * infrequently.
+		 */
+		if (unlikely(result == 0 && key->scantid != NULL))
+			insertstate->postingoff = _bt_binsrch_posting(key, page, mid);
 	}
 
 	/*
@@ -533,6 +554,77 @@ _bt_binsrch_insert(Relation rel, BTInsertState insertstate)
 	return low;
 }
 
+/*
+ *	_bt_finditem() -- Find the leaf tuple with the given key and heap TID.
+ *
+ * On success, the buffer containing the tuple is returned write-locked, and
+ * *offnum is set to the tuple's offset.  If there is no such tuple, or only
+ * an LP_DEAD one, InvalidBuffer is returned.
+ *
+ * In a heapkeyspace index, the scankey's scantid makes _bt_compare() exact,
+ * so we only look at a single tuple.  Otherwise we have to walk through the
+ * key's duplicates, possibly across several pages.
+ */
+Buffer
+_bt_finditem(Relation rel, BTScanInsert key, ItemPointer htid,
+			 OffsetNumber *offnum)
+{
+	BTStack		stack;
+	Buffer		buf;
+
+	Assert(key->scantid == NULL || ItemPointerEquals(key->scantid, htid));
+	Assert(!key->nextkey);
+
+	stack = _bt_search(rel, key, &buf, BT_WRITE, NULL);
+	_bt_freestack(stack);
+
+	for (;;)
+	{
+		Page		page = BufferGetPage(buf);
+		BTPageOpaque opaque = (BTPageOpaque) PageGetSpecialPointer(page);
+
+		if (!P_IGNORE(opaque))
+		{
+			OffsetNumber maxoff = PageGetMaxOffsetNumber(page);
+			OffsetNumber off;
+
+			for (off = _bt_binsrch(rel, key, buf);
+				 off <= maxoff;
+				 off = OffsetNumberNext(off))
+			{
+				ItemId		itemid;
+				IndexTuple	itup;
+
+				if (_bt_compare(rel, key, page, off) != 0)
+				{
+					_bt_relbuf(rel, buf);
+					return InvalidBuffer;
+				}
+
+				itemid = PageGetItemId(page, off);
+				itup = (IndexTuple) PageGetItem(page, itemid);
+				if (!ItemIdIsDead(itemid) &&
+					(BTreeTupleIsPosting(itup) ?
+					 _bt_posting_contains(itup, htid) :
+					 ItemPointerEquals(&itup->t_tid, htid)))
+				{
+					*offnum = off;
+					return buf;
+				}
+			}
+		}
+
+		/* Duplicates of the key could continue on the right sibling */
+		if (P_RIGHTMOST(opaque) ||
+			(!P_IGNORE(opaque) && _bt_compare(rel, key, page, P_HIKEY) < 0))
+			break;
+		buf = _bt_relandgetbuf(rel, buf, opaque->btpo_next, BT_WRITE);
+	}
+
+	_bt_relbuf(rel, buf);
+	return InvalidBuffer;
+}
+
 /*----------
  *	_bt_compare() -- Compare insertion-type scankey to tuple on a page.
  *
@@ -568,6 +660,7 @@ _bt_compare(Relation rel,
 	ScanKey		scankey;
 	int			ncmpkey;
 	int			ntupatts;
+	int32		result;
 
 	Assert(_bt_check_natts(rel, key->heapkeyspace, page, offnum));
 	Assert(key->keysz <= IndexRelationGetNumberOfKeyAttributes(rel));
@@ -602,7 +695,6 @@ _bt_compare(Relation rel,
 	{
 		Datum		datum;
 		bool		isNull;
-		int32		result;
 
 		datum = index_getattr(itup, scankey->sk_attno, itupdesc, &isNull);
 
@@ -719,7 +811,77 @@ _bt_compare(Relation rel,
 		return 1;
 
 	Assert(ntupatts >= IndexRelationGetNumberOfKeyAttributes(rel));
-	return ItemPointerCompare(key->scantid, heapTid);
+	result = ItemPointerCompare(key->scantid, heapTid);
+	if (result <= 0 || !BTreeTupleIsPosting(itup))
+		return result;
+
+	/*
+	 * A scantid that falls within the range of heap TIDs of a posting tuple
+	 * is considered equal to it.  Insertion splits the posting list in that
+	 * case (see _bt_binsrch_posting).
+	 */
+	result = ItemPointerCompare(key->scantid, BTreeTupleGetMaxHeapTID(itup));
+	if (result > 0)
+		return 1;
+
+	return 0;
+}
+
+/*
+ *	_bt_binsrch_posting() -- posting list binary search.
+ *
+ * Helper routine for _bt_binsrch_insert().  Returns the offset into the
+ * posting list of the leaf tuple at offnum where the scantid of caller's
+ * insertion scankey belongs, which is the position of the first heap TID
+ * that is greater than scantid.  Returns -1 if the tuple is LP_DEAD: caller
+ * must remove it before inserting.  Returns 0 if the tuple is not a posting
+ * tuple.
+ */
+static int
+_bt_binsrch_posting(BTScanInsert key, Page page, OffsetNumber offnum)
+{
+	IndexTuple	itup;
+	ItemId		itemid;
+	int			low,
+				high,
+				mid,
+				res;
+
+	itemid = PageGetItemId(page, offnum);
+	itup = (IndexTuple) PageGetItem(page, itemid);
+	if (!BTreeTupleIsPosting(itup))
+		return 0;
+
+	Assert(key->heapkeyspace && key->scantid != NULL);
+
+	/*
+	 * The posting list is split anyway if the tuple is LP_DEAD, so tell the
+	 * caller to get rid of it first.
+	 */
+	if (ItemIdIsDead(itemid))
+		return -1;
+
+	low = 0;
+	high = BTreeTupleGetNPosting(itup);
+	Assert(high >= 2);
+
+	while (high > low)
+	{
+		mid = low + ((high - low) / 2);
+		res = ItemPointerCompare(key->scantid,
+								 BTreeTupleGetPostingN(itup, mid));
+
+		if (res > 0)
+			low = mid + 1;
+		else if (res < 0)
+			high = mid;
+		else
+			elog(ERROR, "heap TID (%u,%u) is already in posting list tuple at offset %u",
+				 ItemPointerGetBlockNumber(key->scantid),
+				 ItemPointerGetOffsetNumber(key->scantid), offnum);
+	}
+
+	return low;
 }
 
 /*
@@ -1324,6 +1486,7 @@ readcomplete:
 	/* OK, itemIndex says what to return */
 	currItem = &so->currPos.items[so->currPos.itemIndex];
 	scan->xs_heaptid = currItem->heapTid;
+	scan->xs_keycheck = so->currPos.deletemarked;
 	if (scan->xs_want_itup)
 		scan->xs_itup = (IndexTuple) (so->currTuples + currItem->tupleOffset);
 
@@ -1374,6 +1537,7 @@ _bt_next(IndexScanDesc scan, ScanDirection dir)
 	/* OK, itemIndex says what to return */
 	currItem = &so->currPos.items[so->currPos.itemIndex];
 	scan->xs_heaptid = currItem->heapTid;
+	scan->xs_keycheck = so->currPos.deletemarked;
 	if (scan->xs_want_itup)
 		scan->xs_itup = (IndexTuple) (so->currTuples + currItem->tupleOffset);
 
@@ -1454,6 +1618,13 @@ _bt_readpage(IndexScanDesc scan, ScanDirection dir, OffsetNumber offnum)
 	 */
 	so->currPos.nextPage = opaque->btpo_next;
 
+	/*
+	 * Tuples on a page with delete-marked tuples must be checked against the
+	 * heap tuple.  An in-place update sets the flag before it commits, so if
+	 * our snapshot can see the update, we see the flag.
+	 */
+	so->currPos.deletemarked = P_HAS_DELETE_MARKED(opaque);
+
 	/* initialize tuple workspace to empty */
 	so->currPos.nextTupleOffset = 0;
 
@@ -1489,13 +1660,43 @@ _bt_readpage(IndexScanDesc scan, ScanDirection dir, OffsetNumber offnum)
 
 			if (_bt_checkkeys(scan, itup, indnatts, dir, &continuescan))
 			{
-				/* tuple passes all scan key conditions, so remember it */
-				_bt_saveitem(so, itemIndex, offnum, itup);
-				itemIndex++;
+				/* tuple passes all scan key conditions */
+				if (!BTreeTupleIsPosting(itup))
+				{
+					/* Remember it */
+					_bt_saveitem(so, itemIndex, offnum, itup);
+					itemIndex++;
+				}
+				else
+				{
+					int			tupleOffset;
+
+					/*
+					 * Set up state to return posting list, and remember first
+					 * TID
+					 */
+					tupleOffset =
+						_bt_setuppostingitems(so, itemIndex, offnum,
+											  BTreeTupleGetPostingN(itup, 0),
+											  itup);
+					itemIndex++;
+					/* Remember additional TIDs */
+					for (int i = 1; i < BTreeTupleGetNPosting(itup); i++)
+					{
+						_bt_savepostingitem(so, itemIndex, offnum,
+											BTreeTupleGetPostingN(itup, i),
+											tupleOffset);
+						itemIndex++;
+					}
+				}
 			}
 			/* When !continuescan, there can't be any more matches, so stop */
 			if (!continuescan)
+			{
+				if (so->skipScan)
+					_bt_note_skip_value(scan, itup, dir);
 				break;
+			}
 
 			offnum = OffsetNumberNext(offnum);
 		}
@@ -1519,12 +1720,19 @@ _bt_readpage(IndexScanDesc scan, ScanDirection dir, OffsetNumber offnum)
 
 			truncatt = BTreeTupleGetNAtts(itup, scan->indexRelation);
 			_bt_checkkeys(scan, itup, truncatt, dir, &continuescan);
+
+			/*
+			 * Everything on the right has a first column value >= the high
+			 * key's, so a skip scan may as well go on with that value.
+			 */
+			if (!continuescan && so->skipScan && truncatt >= 1)
+				_bt_note_skip_value(scan, itup, dir);
 		}
 
 		if (!continuescan)
 			so->currPos.moreRight = false;
 
-		Assert(itemIndex <= MaxIndexTuplesPerPage);
+		Assert(itemIndex <= MaxTIDsPerBTreePage);
 		so->currPos.firstItem = 0;
 		so->currPos.lastItem = itemIndex - 1;
 		so->currPos.itemIndex = 0;
@@ -1532,7 +1740,7 @@ _bt_readpage(IndexScanDesc scan, ScanDirection dir, OffsetNumber offnum)
 	else
 	{
 		/* load items[] in descending order */
-		itemIndex = MaxIndexTuplesPerPage;
+		itemIndex = MaxTIDsPerBTreePage;
 
 		offnum = Min(offnum, maxoff);
 
@@ -1573,14 +1781,43 @@ _bt_readpage(IndexScanDesc scan, ScanDirection dir, OffsetNumber offnum)
 										 &continuescan);
 			if (passes_quals && tuple_alive)
 			{
-				/* tuple passes all scan key conditions, so remember it */
-				itemIndex--;
-				_bt_saveitem(so, itemIndex, offnum, itup);
+				/* tuple passes all scan key conditions */
+				if (!BTreeTupleIsPosting(itup))
+				{
+					/* Remember it */
+					itemIndex--;
+					_bt_saveitem(so, itemIndex, offnum, itup);
+				}
+				else
+				{
+					int			tupleOffset;
+
+					/*
+					 * Set up state to return posting list, and remember last
+					 * TID first, so that items[] stays in TID order within
+					 * the tuple.
+					 */
+					itemIndex--;
+					tupleOffset =
+						_bt_setuppostingitems(so, itemIndex, offnum,
+											  BTreeTupleGetMaxHeapTID(itup),
+											  itup);
+					/* Remember additional TIDs */
+					for (int i = BTreeTupleGetNPosting(itup) - 2; i >= 0; i--)
+					{
+						itemIndex--;
+						_bt_savepostingitem(so, itemIndex, offnum,
+											BTreeTupleGetPostingN(itup, i),
+											tupleOffset);
+					}
+				}
 			}
 			if (!continuescan)
 			{
 				/* there can't be any more matches, so stop */
 				so->currPos.moreLeft = false;
+				if (so->skipScan)
+					_bt_note_skip_value(scan, itup, dir);
 				break;
 			}
 
@@ -1589,8 +1826,8 @@ _bt_readpage(IndexScanDesc scan, ScanDirection dir, OffsetNumber offnum)
 
 		Assert(itemIndex >= 0);
 		so->currPos.firstItem = itemIndex;
-		so->currPos.lastItem = MaxIndexTuplesPerPage - 1;
-		so->currPos.itemIndex = MaxIndexTuplesPerPage - 1;
+		so->currPos.lastItem = MaxTIDsPerBTreePage - 1;
+		so->currPos.itemIndex = MaxTIDsPerBTreePage - 1;
 	}
 
 	return (so->currPos.firstItem <= so->currPos.lastItem);
@@ -1603,6 +1840,8 @@ _bt_saveitem(BTScanOpaque so, int itemIndex,
 {
 	BTScanPosItem *currItem = &so->currPos.items[itemIndex];
 
+	Assert(!BTreeTupleIsPivot(itup) && !BTreeTupleIsPosting(itup));
+
 	currItem->heapTid = itup->t_tid;
 	currItem->indexOffset = offnum;
 	if (so->currTuples)
@@ -1615,6 +1854,72 @@ _bt_saveitem(BTScanOpaque so, int itemIndex,
 	}
 }
 
+/*
+ * Setup state to save TIDs/items from a single posting list tuple.
+ *
+ * Saves an index item into so->currPos.items[itemIndex] for TID that is
+ * returned to scan first.  Second or subsequent TIDs for posting list should
+ * be saved by calling _bt_savepostingitem().
+ *
+ * Returns an offset into tuple storage space that main tuple is stored at if
+ * needed.  For an index-only scan, that's a copy of the tuple without its
+ * posting list, which every item of the tuple shares.
+ */
+static int
+_bt_setuppostingitems(BTScanOpaque so, int itemIndex, OffsetNumber offnum,
+					  ItemPointer heapTid, IndexTuple itup)
+{
+	BTScanPosItem *currItem = &so->currPos.items[itemIndex];
+
+	Assert(BTreeTupleIsPosting(itup));
+
+	currItem->heapTid = *heapTid;
+	currItem->indexOffset = offnum;
+	if (so->currTuples)
+	{
+		/* Save base IndexTuple (truncate posting list) */
+		IndexTuple	base;
+		Size		itupsz = BTreeTupleGetPostingOffset(itup);
+
+		itupsz = MAXALIGN(itupsz);
+		currItem->tupleOffset = so->currPos.nextTupleOffset;
+		base = (IndexTuple) (so->currTuples + so->currPos.nextTupleOffset);
+		memcpy(base, itup, itupsz);
+		/* Defensively reduce work area index tuple header size */
+		base->t_info &= ~(INDEX_SIZE_MASK | INDEX_ALT_TID_MASK);
+		base->t_info |= itupsz;
+		so->currPos.nextTupleOffset += itupsz;
+
+		return currItem->tupleOffset;
+	}
+
+	return 0;
+}
+
+/*
+ * Save an index item into so->currPos.items[itemIndex] for current posting
+ * tuple.
+ *
+ * Assumes that _bt_setuppostingitems() has already been called for current
+ * posting list tuple.  Caller passes its return value as tupleOffset.
+ */
+static inline void
+_bt_savepostingitem(BTScanOpaque so, int itemIndex, OffsetNumber offnum,
+					ItemPointer heapTid, int tupleOffset)
+{
+	BTScanPosItem *currItem = &so->currPos.items[itemIndex];
+
+	currItem->heapTid = *heapTid;
+	currItem->indexOffset = offnum;
+
+	/*
+	 * Have index-only scans return the same base IndexTuple for every TID
+	 * that originates from the same posting list
+	 */
+	if (so->currTuples)
+		currItem->tupleOffset = tupleOffset;
+}
+
 /*
  *	_bt_steppage() -- Step to next page containing valid data for scan
  *
@@ -2222,12 +2527,177 @@ _bt_endpoint(IndexScanDesc scan, ScanDirection dir)
 	/* OK, itemIndex says what to return */
 	currItem = &so->currPos.items[so->currPos.itemIndex];
 	scan->xs_heaptid = currItem->heapTid;
+	scan->xs_keycheck = so->currPos.deletemarked;
 	if (scan->xs_want_itup)
 		scan->xs_itup = (IndexTuple) (so->currTuples + currItem->tupleOffset);
 
 	return true;
 }
 
+/*
+ * _bt_note_skip_value() -- Remember the next value of a skip scan
+ *
+ * Called by _bt_readpage when a tuple ends the current primitive scan of a
+ * skip scan.  If that's because the tuple's first column is beyond the skip
+ * key's value, it's the first tuple having the next value, because all the
+ * tuples we read before it had the current one.  Saving the value spares
+ * _bt_advance_skip_key a descent of the tree to find it.
+ */
+static void
+_bt_note_skip_value(IndexScanDesc scan, IndexTuple itup, ScanDirection dir)
+{
+	Relation	rel = scan->indexRelation;
+	BTScanOpaque so = (BTScanOpaque) scan->opaque;
+	Datum		value;
+	bool		isnull;
+
+	Assert(so->skipCur.valid);
+	value = index_getattr(itup, 1, RelationGetDescr(rel), &isnull);
+
+	/* Still the current value, so it was another key that ended the scan */
+	if (isnull && so->skipCur.isnull)
+		return;
+	if (!isnull && !so->skipCur.isnull &&
+		DatumGetInt32(FunctionCall2Coll(index_getprocinfo(rel, 1, BTORDER_PROC),
+										rel->rd_indcollation[0],
+										value, so->skipCur.value)) == 0)
+		return;
+
+	_bt_save_skip_value(scan, &so->skipNext, value, isnull);
+	so->skipNextDir = dir;
+}
+
+/*
+ *	_bt_find_skip_value() -- Find the next value of a skip scan
+ *
+ * Descends to the first leaf tuple, in scan direction, whose first column is
+ * beyond so->skipCur, or to the very first tuple if skipCur isn't set yet,
+ * and makes its value the new so->skipCur.  Returns false if there's no such
+ * tuple.
+ *
+ * The tuple may well be dead, in which case the primitive scan for its value
+ * finds nothing.  That costs another descent but is otherwise harmless.
+ */
+bool
+_bt_find_skip_value(IndexScanDesc scan, ScanDirection dir)
+{
+	Relation	rel = scan->indexRelation;
+	BTScanOpaque so = (BTScanOpaque) scan->opaque;
+	Buffer		buf;
+	Page		page;
+	BTPageOpaque opaque;
+	OffsetNumber offnum = InvalidOffsetNumber;
+	bool		wholepage;
+	IndexTuple	itup;
+	Datum		value;
+	bool		isnull;
+
+	if (!so->skipCur.valid)
+	{
+		/* Start at the first or last leaf page */
+		buf = _bt_get_endpoint(rel, 0, ScanDirectionIsBackward(dir),
+							   scan->xs_snapshot);
+		wholepage = true;
+	}
+	else
+	{
+		BTScanInsertData inskey;
+		BTStack		stack;
+		int			flags;
+
+		/*
+		 * Find the first item > skipCur for a forward scan.  For a backward
+		 * scan, find the first item >= skipCur: we want the one before it.
+		 */
+		flags = (so->skipCur.isnull ? SK_ISNULL : 0) |
+			(rel->rd_indoption[0] << SK_BT_INDOPTION_SHIFT);
+		ScanKeyEntryInitializeWithInfo(&inskey.scankeys[0],
+									   flags,
+									   1,
+									   InvalidStrategy,
+									   InvalidOid,
+									   rel->rd_indcollation[0],
+									   index_getprocinfo(rel, 1, BTORDER_PROC),
+									   so->skipCur.value);
+		inskey.heapkeyspace = _bt_heapkeyspace(rel);
+		inskey.anynullkeys = so->skipCur.isnull;
+		inskey.nextkey = ScanDirectionIsForward(dir);
+		inskey.pivotsearch = false;
+		inskey.scantid = NULL;
+		inskey.keysz = 1;
+
+		stack = _bt_search(rel, &inskey, &buf, BT_READ, scan->xs_snapshot);
+		_bt_freestack(stack);
+
+		if (BufferIsValid(buf))
+		{
+			offnum = _bt_binsrch(rel, &inskey, buf);
+			if (ScanDirectionIsBackward(dir))
+				offnum = OffsetNumberPrev(offnum);
+		}
+		wholepage = false;
+	}
+
+	if (!BufferIsValid(buf))
+	{
+		/* Empty index, see _bt_endpoint */
+		PredicateLockRelation(rel, scan->xs_snapshot);
+		return false;
+	}
+
+	/* Step over pages until we find an item */
+	for (;;)
+	{
+		page = BufferGetPage(buf);
+		TestForOldSnapshot(scan->xs_snapshot, rel, page);
+		opaque = (BTPageOpaque) PageGetSpecialPointer(page);
+
+		if (!P_IGNORE(opaque))
+		{
+			OffsetNumber minoff = P_FIRSTDATAKEY(opaque);
+			OffsetNumber maxoff = PageGetMaxOffsetNumber(page);
+
+			/*
+			 * We skip over whatever lies between the previous value and the
+			 * one we find here, so lock the page for serializable
+			 * transactions, as if we had scanned it.
+			 */
+			PredicateLockPage(rel, BufferGetBlockNumber(buf),
+							  scan->xs_snapshot);
+
+			if (wholepage)
+				offnum = ScanDirectionIsForward(dir) ? minoff : maxoff;
+			if (offnum >= minoff && offnum <= maxoff)
+				break;
+		}
+
+		if (ScanDirectionIsForward(dir))
+		{
+			if (P_RIGHTMOST(opaque))
+			{
+				_bt_relbuf(rel, buf);
+				return false;
+			}
+			buf = _bt_relandgetbuf(rel, buf, opaque->btpo_next, BT_READ);
+		}
+		else
+		{
+			buf = _bt_walk_left(rel, buf, scan->xs_snapshot);
+			if (!BufferIsValid(buf))
+				return false;
+		}
+		wholepage = true;
+	}
+
+	itup = (IndexTuple) PageGetItem(page, PageGetItemId(page, offnum));
+	value = index_getattr(itup, 1, RelationGetDescr(rel), &isnull);
+	_bt_save_skip_value(scan, &so->skipCur, value, isnull);
+
+	_bt_relbuf(rel, buf);
+
+	return true;
+}
+
 /*
  * _bt_initialize_more_data() -- initialize moreLeft/moreRight appropriately
  * for scan direction
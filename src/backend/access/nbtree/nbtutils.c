@@ -20,6 +20,7 @@
 #include "access/nbtree.h"
 #include "access/reloptions.h"
 #include "access/relscan.h"
+#include "catalog/pg_opfamily.h"
 #include "commands/progress.h"
 #include "miscadmin.h"
 #include "utils/array.h"
@@ -43,6 +44,8 @@ static int	_bt_sort_array_elements(IndexScanDesc scan, ScanKey skey,
 									bool reverse,
 									Datum *elems, int nelems);
 static int	_bt_compare_array_elements(const void *a, const void *b, void *arg);
+static void _bt_forget_skip_value(IndexScanDesc scan, BTSkipValue *skipval);
+static void _bt_set_skip_key(IndexScanDesc scan);
 static bool _bt_compare_scankey_args(IndexScanDesc scan, ScanKey op,
 									 ScanKey leftarg, ScanKey rightarg,
 									 bool *result);
@@ -51,6 +54,7 @@ static void _bt_mark_scankey_required(ScanKey skey);
 static bool _bt_check_rowcompare(ScanKey skey,
 								 IndexTuple tuple, int tupnatts, TupleDesc tupdesc,
 								 ScanDirection dir, bool *continuescan);
+static int	_bt_compare_int(const void *a, const void *b);
 static int	_bt_keep_natts(Relation rel, IndexTuple lastleft,
 						   IndexTuple firstright, BTScanInsert itup_key);
 
@@ -655,6 +659,240 @@ _bt_restore_array_keys(IndexScanDesc scan)
 	}
 }
 
+/*
+ *	_bt_preprocess_skip_key() -- Set up a skip scan, if the planner chose one
+ *
+ * A skip scan is done as a series of primitive index scans, one for each
+ * distinct value of the first index column, much as if the query had given
+ * an array of all of them.  We don't know the values up front, though; we
+ * find each one in the index when the previous primitive scan is done (see
+ * _bt_advance_skip_key).  That's only useful when there are no keys on the
+ * first column, and some on the second, which then bound each primitive
+ * scan.  We leave scans with array keys alone, and parallel scans too,
+ * since their workers would have to agree on the values.
+ *
+ * The keys are passed to _bt_preprocess_keys in so->skipKeyData, which has
+ * an equality (or IS NULL) key on the first column for the current value,
+ * followed by a copy of scan->keyData.
+ */
+void
+_bt_preprocess_skip_key(IndexScanDesc scan)
+{
+	BTScanOpaque so = (BTScanOpaque) scan->opaque;
+	Relation	rel = scan->indexRelation;
+
+	/* Forget any values of a previous rescan cycle */
+	_bt_forget_skip_value(scan, &so->skipCur);
+	_bt_forget_skip_value(scan, &so->skipNext);
+	_bt_forget_skip_value(scan, &so->skipMark);
+	so->skipScan = false;
+
+	if (!scan->xs_skipscan || scan->parallel_scan != NULL ||
+		so->numArrayKeys != 0 ||
+		IndexRelationGetNumberOfKeyAttributes(rel) < 2 ||
+		scan->numberOfKeys < 1 || scan->keyData[0].sk_attno != 2)
+		return;
+
+	/*
+	 * Make a scan-lifespan context to hold the skip key and values, and look
+	 * up the equality operator for the key, unless a previous rescan cycle
+	 * did it already.
+	 */
+	if (so->skipContext == NULL)
+	{
+		MemoryContext oldContext;
+		Oid			eqop;
+
+		so->skipContext = AllocSetContextCreate(CurrentMemoryContext,
+												"BTree skip context",
+												ALLOCSET_SMALL_SIZES);
+		oldContext = MemoryContextSwitchTo(so->skipContext);
+
+		eqop = get_opfamily_member(rel->rd_opfamily[0],
+								   rel->rd_opcintype[0],
+								   rel->rd_opcintype[0],
+								   BTEqualStrategyNumber);
+		if (!OidIsValid(eqop))
+			elog(ERROR, "missing operator %d(%u,%u) in opfamily %u",
+				 BTEqualStrategyNumber, rel->rd_opcintype[0],
+				 rel->rd_opcintype[0], rel->rd_opfamily[0]);
+		fmgr_info(get_opcode(eqop), &so->skipEqProc);
+
+		so->skipKeyData = (ScanKey)
+			palloc((scan->numberOfKeys + 1) * sizeof(ScanKeyData));
+
+		MemoryContextSwitchTo(oldContext);
+	}
+
+	memcpy(&so->skipKeyData[1],
+		   scan->keyData,
+		   scan->numberOfKeys * sizeof(ScanKeyData));
+	so->skipScan = true;
+}
+
+/*
+ * _bt_forget_skip_value() -- Release a skip scan value
+ */
+static void
+_bt_forget_skip_value(IndexScanDesc scan, BTSkipValue *skipval)
+{
+	Form_pg_attribute att = TupleDescAttr(RelationGetDescr(scan->indexRelation), 0);
+
+	if (skipval->valid && !skipval->isnull && !att->attbyval)
+		pfree(DatumGetPointer(skipval->value));
+	skipval->valid = false;
+}
+
+/*
+ * _bt_save_skip_value() -- Remember a value of the first index column
+ *
+ * The value is copied into the skip scan's context, so the caller may pass a
+ * datum pointing into a buffer page.
+ */
+void
+_bt_save_skip_value(IndexScanDesc scan, BTSkipValue *skipval,
+					Datum value, bool isnull)
+{
+	BTScanOpaque so = (BTScanOpaque) scan->opaque;
+	Form_pg_attribute att = TupleDescAttr(RelationGetDescr(scan->indexRelation), 0);
+
+	_bt_forget_skip_value(scan, skipval);
+
+	skipval->valid = true;
+	skipval->isnull = isnull;
+	if (isnull)
+		skipval->value = (Datum) 0;
+	else
+	{
+		MemoryContext oldContext = MemoryContextSwitchTo(so->skipContext);
+
+		skipval->value = datumCopy(value, att->attbyval, att->attlen);
+		MemoryContextSwitchTo(oldContext);
+	}
+}
+
+/*
+ * _bt_set_skip_key() -- Set up the skip key for so->skipCur
+ */
+static void
+_bt_set_skip_key(IndexScanDesc scan)
+{
+	BTScanOpaque so = (BTScanOpaque) scan->opaque;
+	Relation	rel = scan->indexRelation;
+	ScanKey		skey = &so->skipKeyData[0];
+
+	Assert(so->skipCur.valid);
+	if (so->skipCur.isnull)
+		ScanKeyEntryInitialize(skey,
+							   SK_ISNULL | SK_SEARCHNULL,
+							   1,
+							   InvalidStrategy,
+							   InvalidOid,
+							   InvalidOid,
+							   InvalidOid,
+							   (Datum) 0);
+	else
+		ScanKeyEntryInitializeWithInfo(skey,
+									   0,
+									   1,
+									   BTEqualStrategyNumber,
+									   rel->rd_opcintype[0],
+									   rel->rd_indcollation[0],
+									   &so->skipEqProc,
+									   so->skipCur.value);
+}
+
+/*
+ * _bt_start_skip_key() -- Find the first value of a skip scan
+ *
+ * Returns false if the index is empty.  We can't do this in btrescan because
+ * we don't know the scan direction at that time.
+ */
+bool
+_bt_start_skip_key(IndexScanDesc scan, ScanDirection dir)
+{
+	BTScanOpaque so = (BTScanOpaque) scan->opaque;
+
+	_bt_forget_skip_value(scan, &so->skipCur);
+	return _bt_advance_skip_key(scan, dir);
+}
+
+/*
+ * _bt_advance_skip_key() -- Advance to the next value of the first column
+ *
+ * Returns true if there is another value to consider, false if not.  On true
+ * result, the skip key is set to the new value.
+ */
+bool
+_bt_advance_skip_key(IndexScanDesc scan, ScanDirection dir)
+{
+	BTScanOpaque so = (BTScanOpaque) scan->opaque;
+
+	/* If the other keys are contradictory, no value is going to help */
+	if (so->skipCur.valid && !so->qual_ok)
+		return false;
+
+	if (so->skipCur.valid && so->skipNext.valid && so->skipNextDir == dir)
+	{
+		/* _bt_readpage already came across the next value */
+		_bt_forget_skip_value(scan, &so->skipCur);
+		so->skipCur = so->skipNext;
+		so->skipNext.valid = false;
+	}
+	else
+	{
+		/* Descend the tree to find it */
+		_bt_forget_skip_value(scan, &so->skipNext);
+		if (!_bt_find_skip_value(scan, dir))
+			return false;
+	}
+
+	_bt_set_skip_key(scan);
+	return true;
+}
+
+/*
+ * _bt_mark_skip_key() -- Handle the skip key during btmarkpos
+ */
+void
+_bt_mark_skip_key(IndexScanDesc scan)
+{
+	BTScanOpaque so = (BTScanOpaque) scan->opaque;
+
+	if (so->skipCur.valid)
+		_bt_save_skip_value(scan, &so->skipMark,
+							so->skipCur.value, so->skipCur.isnull);
+	else
+		_bt_forget_skip_value(scan, &so->skipMark);
+}
+
+/*
+ * _bt_restore_skip_key() -- Handle the skip key during btrestrpos
+ */
+void
+_bt_restore_skip_key(IndexScanDesc scan)
+{
+	BTScanOpaque so = (BTScanOpaque) scan->opaque;
+	Form_pg_attribute att = TupleDescAttr(RelationGetDescr(scan->indexRelation), 0);
+
+	if (!so->skipMark.valid)
+		return;
+	if (so->skipCur.valid && so->skipCur.isnull == so->skipMark.isnull &&
+		(so->skipCur.isnull ||
+		 datumIsEqual(so->skipCur.value, so->skipMark.value,
+					  att->attbyval, att->attlen)))
+		return;
+
+	_bt_save_skip_value(scan, &so->skipCur,
+						so->skipMark.value, so->skipMark.isnull);
+	_bt_forget_skip_value(scan, &so->skipNext);
+	_bt_set_skip_key(scan);
+
+	/* As in _bt_restore_array_keys, redo _bt_preprocess_keys */
+	_bt_preprocess_keys(scan);
+	Assert(so->qual_ok);
+}
+
 
 /*
  *	_bt_preprocess_keys() -- Preprocess scan keys
@@ -765,9 +1003,15 @@ _bt_preprocess_keys(IndexScanDesc scan)
 		return;					/* done if qual-less scan */
 
 	/*
-	 * Read so->arrayKeyData if array keys are present, else scan->keyData
+	 * Read so->skipKeyData for a skip scan, so->arrayKeyData if array keys
+	 * are present, else scan->keyData
 	 */
-	if (so->arrayKeyData != NULL)
+	if (so->skipScan)
+	{
+		inkeys = so->skipKeyData;
+		numberOfKeys++;
+	}
+	else if (so->arrayKeyData != NULL)
 		inkeys = so->arrayKeyData;
 	else
 		inkeys = scan->keyData;
@@ -1772,6 +2016,14 @@ _bt_killitems(IndexScanDesc scan)
 	minoff = P_FIRSTDATAKEY(opaque);
 	maxoff = PageGetMaxOffsetNumber(page);
 
+	/*
+	 * Consider the killed items in the order of currPos.items, which is the
+	 * order of the page, and of the heap TIDs within each posting list, when
+	 * scanning in either direction.
+	 */
+	if (numKilled > 1)
+		qsort(so->killedItems, numKilled, sizeof(int), _bt_compare_int);
+
 	for (i = 0; i < numKilled; i++)
 	{
 		int			itemIndex = so->killedItems[i];
@@ -1787,7 +2039,42 @@ _bt_killitems(IndexScanDesc scan)
 			ItemId		iid = PageGetItemId(page, offnum);
 			IndexTuple	ituple = (IndexTuple) PageGetItem(page, iid);
 
-			if (ItemPointerEquals(&ituple->t_tid, &kitem->heapTid))
+			if (BTreeTupleIsPosting(ituple))
+			{
+				int			nposting = BTreeTupleGetNPosting(ituple);
+				int			j;
+
+				/*
+				 * A posting list tuple can only be marked dead when every
+				 * one of its heap TIDs was killed.  Those are the next
+				 * nposting killed items, if the scan returned all of them.
+				 */
+				for (j = 0; j < nposting && i + j < numKilled; j++)
+				{
+					BTScanPosItem *pitem =
+					&so->currPos.items[so->killedItems[i + j]];
+
+					if (pitem->indexOffset != kitem->indexOffset ||
+						!ItemPointerEquals(BTreeTupleGetPostingN(ituple, j),
+										   &pitem->heapTid))
+						break;
+				}
+
+				if (j == nposting)
+				{
+					ItemIdMarkDead(iid);
+					killedsomething = true;
+					i += nposting - 1;
+					break;		/* out of inner search loop */
+				}
+				if (j > 0)
+				{
+					/* item found, but not all of its TIDs are dead */
+					i += j - 1;
+					break;
+				}
+			}
+			else if (ItemPointerEquals(&ituple->t_tid, &kitem->heapTid))
 			{
 				/* found the item */
 				ItemIdMarkDead(iid);
@@ -1813,6 +2100,22 @@ _bt_killitems(IndexScanDesc scan)
 	LockBuffer(so->currPos.buf, BUFFER_LOCK_UNLOCK);
 }
 
+/*
+ * qsort comparator for the killed items array
+ */
+static int
+_bt_compare_int(const void *a, const void *b)
+{
+	int			ia = *(const int *) a;
+	int			ib = *(const int *) b;
+
+	if (ia < ib)
+		return -1;
+	if (ia > ib)
+		return 1;
+	return 0;
+}
+
 
 /*
  * The following routines manage a shared-memory area in which we track
@@ -2145,6 +2448,19 @@ _bt_truncate(Relation rel, IndexTuple lastleft, IndexTuple firstright,
 
 		pivot = index_truncate_tuple(itupdesc, firstright, keepnatts);
 
+		/*
+		 * index_truncate_tuple() just returns a straight copy of firstright
+		 * when there are no attributes to truncate.  Truncate away a posting
+		 * list here instead, when firstright has one.  Deduplication is never
+		 * used with INCLUDE indexes, so only key attributes can be left.
+		 */
+		if (BTreeTupleIsPosting(pivot))
+		{
+			Assert(natts == nkeyatts);
+			pivot->t_info &= ~INDEX_SIZE_MASK;
+			pivot->t_info |= MAXALIGN(BTreeTupleGetPostingOffset(firstright));
+		}
+
 		/*
 		 * If there is a distinguishing key attribute within new pivot tuple,
 		 * there is no need to add an explicit heap TID attribute
@@ -2174,10 +2490,14 @@ _bt_truncate(Relation rel, IndexTuple lastleft, IndexTuple firstright,
 		 * No truncation was possible, since key attributes are all equal.
 		 * It's necessary to add a heap TID attribute to the new pivot tuple.
 		 */
+		Size		firstrightsz = IndexTupleSize(firstright);
+
 		Assert(natts == nkeyatts);
-		newsize = IndexTupleSize(firstright) + MAXALIGN(sizeof(ItemPointerData));
+		if (BTreeTupleIsPosting(firstright))
+			firstrightsz = MAXALIGN(BTreeTupleGetPostingOffset(firstright));
+		newsize = firstrightsz + MAXALIGN(sizeof(ItemPointerData));
 		pivot = palloc0(newsize);
-		memcpy(pivot, firstright, IndexTupleSize(firstright));
+		memcpy(pivot, firstright, firstrightsz);
 	}
 
 	/*
@@ -2201,11 +2521,12 @@ _bt_truncate(Relation rel, IndexTuple lastleft, IndexTuple firstright,
 	 * consider suffix truncation.  It seems like a good idea to follow that
 	 * example in cases where no truncation takes place -- use lastleft's heap
 	 * TID.  (This is also the closest value to negative infinity that's
-	 * legally usable.)
+	 * legally usable.)  When lastleft is a posting list tuple, that's the
+	 * greatest TID in its posting list.
 	 */
 	pivotheaptid = (ItemPointer) ((char *) pivot + newsize -
 								  sizeof(ItemPointerData));
-	ItemPointerCopy(&lastleft->t_tid, pivotheaptid);
+	ItemPointerCopy(BTreeTupleGetMaxHeapTID(lastleft), pivotheaptid);
 
 	/*
 	 * Lehman and Yao require that the downlink to the right page, which is to
@@ -2216,9 +2537,12 @@ _bt_truncate(Relation rel, IndexTuple lastleft, IndexTuple firstright,
 	 * tiebreaker.
 	 */
 #ifndef DEBUG_NO_TRUNCATE
-	Assert(ItemPointerCompare(&lastleft->t_tid, &firstright->t_tid) < 0);
-	Assert(ItemPointerCompare(pivotheaptid, &lastleft->t_tid) >= 0);
-	Assert(ItemPointerCompare(pivotheaptid, &firstright->t_tid) < 0);
+	Assert(ItemPointerCompare(BTreeTupleGetMaxHeapTID(lastleft),
+							  BTreeTupleGetHeapTID(firstright)) < 0);
+	Assert(ItemPointerCompare(pivotheaptid,
+							  BTreeTupleGetHeapTID(lastleft)) >= 0);
+	Assert(ItemPointerCompare(pivotheaptid,
+							  BTreeTupleGetHeapTID(firstright)) < 0);
 #else
 
 	/*
@@ -2231,7 +2555,7 @@ _bt_truncate(Relation rel, IndexTuple lastleft, IndexTuple firstright,
 	 * attribute values along with lastleft's heap TID value when lastleft's
 	 * TID happens to be greater than firstright's TID.
 	 */
-	ItemPointerCopy(&firstright->t_tid, pivotheaptid);
+	ItemPointerCopy(BTreeTupleGetHeapTID(firstright), pivotheaptid);
 
 	/*
 	 * Pivot heap TID should never be fully equal to firstright.  Note that
@@ -2240,7 +2564,8 @@ _bt_truncate(Relation rel, IndexTuple lastleft, IndexTuple firstright,
 	 */
 	ItemPointerSetOffsetNumber(pivotheaptid,
 							   OffsetNumberPrev(ItemPointerGetOffsetNumber(pivotheaptid)));
-	Assert(ItemPointerCompare(pivotheaptid, &firstright->t_tid) < 0);
+	Assert(ItemPointerCompare(pivotheaptid,
+							  BTreeTupleGetHeapTID(firstright)) < 0);
 #endif
 
 	BTreeTupleSetNAtts(pivot, nkeyatts);
@@ -2412,10 +2737,13 @@ _bt_check_natts(Relation rel, bool heapkeyspace, Page page, OffsetNumber offnum)
 		if (offnum >= P_FIRSTDATAKEY(opaque))
 		{
 			/*
-			 * Non-pivot tuples currently never use alternative heap TID
-			 * representation -- even those within heapkeyspace indexes
+			 * Non-pivot tuples never use the pivot representation of heap
+			 * TID.  Posting list tuples are only found in heapkeyspace
+			 * indexes.
 			 */
-			if ((itup->t_info & INDEX_ALT_TID_MASK) != 0)
+			if (BTreeTupleIsPivot(itup))
+				return false;
+			if (BTreeTupleIsPosting(itup) && !heapkeyspace)
 				return false;
 
 			/*
@@ -2497,7 +2825,7 @@ _bt_check_natts(Relation rel, bool heapkeyspace, Page page, OffsetNumber offnum)
 	 * heapkeyspace index pivot tuples, regardless of whether or not there are
 	 * non-key attributes.
 	 */
-	if ((itup->t_info & INDEX_ALT_TID_MASK) == 0)
+	if (!BTreeTupleIsPivot(itup))
 		return false;
 
 	/*
@@ -2575,3 +2903,54 @@ _bt_check_third_page(Relation rel, Relation heap, bool needheaptidspace,
 					 "or use full text indexing."),
 			 errtableconstraint(heap, RelationGetRelationName(rel))));
 }
+
+/*
+ * Are all of the index's key columns "equal image" columns, whose opclass
+ * never considers two datums equal unless they're bitwise equal?
+ *
+ * This is what makes it safe to deduplicate the index: a posting list
+ * tuple keeps only one copy of the key values for all of its heap TIDs,
+ * so any difference between equal values that's visible to a user (think
+ * of numeric display scale, or a nondeterministic collation) would be lost.
+ * There is no support function to ask the opclass, so we go by a list of
+ * builtin opfamilies that are known to qualify.
+ */
+bool
+_bt_allequalimage(Relation rel)
+{
+	int16		nkeyatts = IndexRelationGetNumberOfKeyAttributes(rel);
+	int			i;
+
+	if (IndexRelationGetNumberOfAttributes(rel) != nkeyatts)
+		return false;
+
+	for (i = 0; i < nkeyatts; i++)
+	{
+		Oid			opfamily = rel->rd_opfamily[i];
+		Oid			collation = rel->rd_indcollation[i];
+
+		switch (opfamily)
+		{
+			case INTEGER_BTREE_FAM_OID:
+			case OID_BTREE_FAM_OID:
+			case BOOL_BTREE_FAM_OID:
+			case CHAR_BTREE_FAM_OID:
+			case DATETIME_BTREE_FAM_OID:
+			case TIME_BTREE_FAM_OID:
+			case UUID_BTREE_FAM_OID:
+			case ENUM_BTREE_FAM_OID:
+			case BYTEA_BTREE_FAM_OID:
+			case TEXT_PATTERN_BTREE_FAM_OID:
+				break;
+			case TEXT_BTREE_FAM_OID:
+				if (!OidIsValid(collation) ||
+					!get_collation_isdeterministic(collation))
+					return false;
+				break;
+			default:
+				return false;
+		}
+	}
+
+	return true;
+}
@@ -34,8 +34,9 @@ tpd_desc(StringInfo buf, XLogReaderState *record)
 	{
 		xl_tpd_free_page *xlrec = (xl_tpd_free_page *) rec;
 
-		appendStringInfo(buf, "prevblk %u nextblk %u",
-						 xlrec->prevblkno, xlrec->nextblkno);
+		appendStringInfo(buf, "prevblk %u nextblk %u nextfreeblk %u",
+						 xlrec->prevblkno, xlrec->nextblkno,
+						 xlrec->nextfreeblkno);
 	}
 }
 
@@ -58,9 +58,10 @@ zheap_desc(StringInfo buf, XLogReaderState *record)
 		xl_undo_header *xlundohdr = (xl_undo_header *) rec;
 		xl_zheap_update *xlrec = (xl_zheap_update *) ((char *) xlundohdr + SizeOfUndoHeader);
 
-		appendStringInfo(buf, "oldoff %u, trans_slot %u, hasUndoTuple: %c, newoff: %u, blkprev %lu",
+		appendStringInfo(buf, "oldoff %u, trans_slot %u, hasUndoTuple: %c, undoTupleDelta: %c, newoff: %u, blkprev %lu",
 						 xlrec->old_offnum, xlrec->old_trans_slot_id,
 						 (xlrec->flags & XLZ_HAS_UPDATE_UNDOTUPLE) ? 'T' : 'F',
+						 (xlrec->flags & XLZ_UPDATE_UNDO_TUPLE_DELTA) ? 'T' : 'F',
 						 xlrec->new_offnum,
 						 xlundohdr->blkprev);
 	}
@@ -143,6 +144,18 @@ zundo_desc(StringInfo buf, XLogReaderState *record)
 							 xlrec->trans_slot_id);
 		}
 	}
+	else if (info == XLOG_ZUNDO_MULTI_PAGE)
+	{
+		uint8	   *flags = (uint8 *) rec;
+		int			block_id;
+
+		appendStringInfo(buf, "npages %d", record->max_block_id + 1);
+		for (block_id = 0; block_id <= record->max_block_id; block_id++)
+		{
+			if (flags[block_id] & XLU_INIT_PAGE)
+				appendStringInfo(buf, ", init blkref #%d", block_id);
+		}
+	}
 	else if (info == XLOG_ZUNDO_RESET_SLOT)
 	{
 		xl_zundo_reset_slot *xlrec = (xl_zundo_reset_slot *) rec;
@@ -231,6 +244,9 @@ zundo_identify(uint8 info)
 		case XLOG_ZUNDO_RESET_SLOT:
 			id = "UNDO RESET SLOT";
 			break;
+		case XLOG_ZUNDO_MULTI_PAGE:
+			id = "UNDO MULTI PAGE";
+			break;
 	}
 
 	return id;
@@ -22,9 +22,20 @@
 #include "access/heapam.h"		/* for ss_* */
 #include "access/tableam.h"
 #include "access/xact.h"
+#include "port/pg_bitutils.h"
 #include "storage/bufmgr.h"
 #include "storage/shmem.h"
 
+/*
+ * Constants for the chunked block allocation of parallel scans: the number
+ * of chunks to divide the relation into, the number of chunks before the end
+ * of the scan at which the chunk size starts to halve, and the largest chunk
+ * size.
+ */
+#define PARALLEL_SEQSCAN_NCHUNKS			2048
+#define PARALLEL_SEQSCAN_RAMPDOWN_CHUNKS	64
+#define PARALLEL_SEQSCAN_MAX_CHUNK_SIZE		8192
+
 
 /* GUC variables */
 char	   *default_table_access_method = DEFAULT_TABLE_ACCESS_METHOD;
@@ -397,12 +408,28 @@ table_block_parallelscan_reinitialize(Relation rel, ParallelTableScanDesc pscan)
  *
  * Determine where the parallel seq scan should start.  This function may be
  * called many times, once by each parallel worker.  We must be careful only
- * to set the startblock once.
+ * to set the startblock once.  It also sets up the worker's chunked
+ * allocation state in pbscanwork.
  */
 void
-table_block_parallelscan_startblock_init(Relation rel, ParallelBlockTableScanDesc pbscan)
+table_block_parallelscan_startblock_init(Relation rel,
+										 ParallelBlockTableScanWorker pbscanwork,
+										 ParallelBlockTableScanDesc pbscan)
 {
 	BlockNumber sync_startpage = InvalidBlockNumber;
+	uint32		chunk_size;
+
+	/*
+	 * Claim about PARALLEL_SEQSCAN_NCHUNKS chunks of the relation in all, so
+	 * that the workers still finish at about the same time, rounded up to a
+	 * power of two.
+	 */
+	chunk_size = Max(pbscan->phs_nblocks / PARALLEL_SEQSCAN_NCHUNKS, 1);
+	if (chunk_size > 1)
+		chunk_size = (uint32) 1 << (pg_leftmost_one_pos32(chunk_size - 1) + 1);
+	pbscanwork->phsw_chunk_size = Min(chunk_size, PARALLEL_SEQSCAN_MAX_CHUNK_SIZE);
+	pbscanwork->phsw_chunk_remaining = 0;
+	pbscanwork->phsw_nallocated = 0;
 
 retry:
 	/* Grab the spinlock. */
@@ -443,7 +470,9 @@ retry:
  * backend gets an InvalidBlockNumber return.
  */
 BlockNumber
-table_block_parallelscan_nextpage(Relation rel, ParallelBlockTableScanDesc pbscan)
+table_block_parallelscan_nextpage(Relation rel,
+								  ParallelBlockTableScanWorker pbscanwork,
+								  ParallelBlockTableScanDesc pbscan)
 {
 	BlockNumber page;
 	uint64		nallocated;
@@ -460,10 +489,33 @@ table_block_parallelscan_nextpage(Relation rel, ParallelBlockTableScanDesc pbsca
 	 * wide because of that, to avoid wrapping around when rs_nblocks is close
 	 * to 2^32.
 	 *
+	 * Each worker claims a chunk of consecutive blocks at a time, so that
+	 * it doesn't hit the shared counter for every block and the kernel's
+	 * read-ahead sees sequential reads.  Near the end of the scan the chunks
+	 * get smaller, so that the workers don't wait for one of them to finish a
+	 * large chunk.
+	 *
 	 * The actual page to return is calculated by adding the counter to the
 	 * starting block number, modulo nblocks.
 	 */
-	nallocated = pg_atomic_fetch_add_u64(&pbscan->phs_nallocated, 1);
+	if (pbscanwork->phsw_chunk_remaining > 0)
+	{
+		pbscanwork->phsw_chunk_remaining--;
+		nallocated = ++pbscanwork->phsw_nallocated;
+	}
+	else
+	{
+		if (pbscanwork->phsw_chunk_size > 1 &&
+			pbscanwork->phsw_nallocated + (uint64) pbscanwork->phsw_chunk_size *
+			PARALLEL_SEQSCAN_RAMPDOWN_CHUNKS > pbscan->phs_nblocks)
+			pbscanwork->phsw_chunk_size >>= 1;
+
+		nallocated = pbscanwork->phsw_nallocated =
+			pg_atomic_fetch_add_u64(&pbscan->phs_nallocated,
+									pbscanwork->phsw_chunk_size);
+		pbscanwork->phsw_chunk_remaining = pbscanwork->phsw_chunk_size - 1;
+	}
+
 	if (nallocated >= pbscan->phs_nblocks)
 		page = InvalidBlockNumber;	/* all blocks have been allocated */
 	else
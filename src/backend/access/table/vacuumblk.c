@@ -16,16 +16,27 @@
  */
 #include "postgres.h"
 
+#include "access/genam.h"
 #include "access/multixact.h"
+#include "access/parallel.h"
+#include "access/tpd.h"
 #include "access/vacuumblk.h"
+#include "access/xact.h"
+#include "access/zfreepages.h"
 #include "catalog/storage.h"
 #include "commands/progress.h"
 #include "commands/vacuum.h"
 #include "miscadmin.h"
 #include "pgstat.h"
+#include "port/atomics.h"
+#include "port/pg_bitutils.h"
+#include "postmaster/autovacuum.h"
 #include "storage/bufmgr.h"
 #include "storage/lmgr.h"
+#include "tcop/tcopprot.h"
+#include "utils/memutils.h"
 #include "utils/pg_rusage.h"
+#include "utils/rel.h"
 
 /*
  * Space/time tradeoff parameters: do these need to be user-tunable?
@@ -54,8 +65,139 @@
  */
 #define PREFETCH_SIZE			((BlockNumber) 32)
 
+/*
+ * Dead tuple TID storage.
+ *
+ * The TIDs of the dead tuples found by the first pass over the relation are
+ * kept in a compact per-block structure rather than a flat array of
+ * ItemPointerData, so that the same amount of memory remembers many more
+ * TIDs and the indexes have to be scanned less often.  Both heap and zheap
+ * vacuum add blocks in increasing block number order, and the offsets of a
+ * block in increasing offset order; we rely on that.
+ *
+ * Each block with dead tuples has an LVDeadTidsBlock entry, which points to
+ * the block's offsets in an array of 64-bit words.  A block uses whichever
+ * of two containers is smaller: a sorted array of OffsetNumbers packed four
+ * to a word, for pages with a few dead tuples, or a bitmap indexed by offset
+ * number for pages with many.  Once a block has switched to a bitmap it stays
+ * that way.  The words grow upwards from the start of a single allocation
+ * and the block entries grow downwards from its end, so memory is shared
+ * between them however the dead tuples are distributed.
+ *
+ * To make the lookups done by index vacuuming constant-time, there is also a
+ * chunk map covering the whole relation.  Each LVDeadTidsChunk covers
+ * DEAD_TIDS_CHUNK_BLOCKS consecutive blocks, with a bitmap of the blocks that
+ * have an entry and the index of the first such entry, so that a block's
+ * entry is found by counting the bits below its own.  The chunk map is not
+ * needed, and not allocated, when there are no indexes to vacuum.
+ */
+#define DEAD_TIDS_CHUNK_BLOCKS	256
+#define DEAD_TIDS_CHUNK_WORDS	(DEAD_TIDS_CHUNK_BLOCKS / 64)
+#define DEAD_TIDS_OFFSETS_PER_WORD	(sizeof(uint64) / sizeof(OffsetNumber))
+
+typedef struct LVDeadTidsChunk
+{
+	uint32		first_block;	/* index of the first entry in this chunk */
+	uint64		present[DEAD_TIDS_CHUNK_WORDS]; /* blocks having an entry */
+} LVDeadTidsChunk;
+
+typedef struct LVDeadTidsBlock
+{
+	BlockNumber blkno;
+	uint32		wordoff;		/* index of the first word of offsets */
+	uint16		nwords;			/* # of words used */
+	uint16		noffsets;		/* # of offsets in array, 0 for a bitmap */
+} LVDeadTidsBlock;
+
+struct LVDeadTids
+{
+	uint32		num_blocks;		/* # of block entries */
+	uint32		num_words;		/* # of words in use */
+	uint32		num_chunks;		/* # of chunks in use */
+	uint32		max_chunks;		/* # of chunks allocated, 0 if no map */
+	Size		space;			/* bytes for words and block entries */
+	Size		block_space;	/* worst-case bytes used by one block */
+	LVDeadTidsChunk *chunks;
+	uint64	   *words;
+	LVDeadTidsBlock *blocks_end;	/* entry i is at blocks_end[-1 - i] */
+};
+
+#define DeadTidsBlock(dt, i)	(&(dt)->blocks_end[-1 - (int64) (i)])
+#define DeadTidsFreeSpace(dt) \
+	((Size) ((char *) ((dt)->blocks_end - (dt)->num_blocks) - \
+			 (char *) ((dt)->words + (dt)->num_words)))
+
+/*
+ * DSM keys for parallel index vacuuming.  Unlike other parallel execution
+ * code, since we don't need to worry about DSM keys conflicting with
+ * plan_node_id we can use small integers.
+ */
+#define PARALLEL_VACUUM_KEY_SHARED			1
+#define PARALLEL_VACUUM_KEY_DEAD_TUPLES		2
+#define PARALLEL_VACUUM_KEY_QUERY_TEXT		3
+
+/*
+ * Per-index state of a parallel index vacuum.  The result of ambulkdelete or
+ * amvacuumcleanup is copied here, so that it can be passed to the next call
+ * for the same index, whichever process makes it.
+ */
+typedef struct LVSharedIndStats
+{
+	Oid			indexoid;
+	bool		updated;		/* is stats valid? */
+	IndexBulkDeleteResult stats;
+} LVSharedIndStats;
+
+/*
+ * Shared state of a parallel index vacuum, in the DSM segment.  The dead
+ * tuple TIDs are stored separately, under PARALLEL_VACUUM_KEY_DEAD_TUPLES.
+ */
+typedef struct LVShared
+{
+	int			elevel;
+	bool		for_cleanup;	/* amvacuumcleanup rather than ambulkdelete */
+
+	/* The fields of LVRelStats used by lazy_vacuum_index and friends */
+	double		old_live_tuples;
+	double		new_rel_tuples;
+	BlockNumber rel_pages;
+	BlockNumber tupcount_pages;
+	int64		num_dead_tuples;
+
+	/* Index of the next index to process */
+	pg_atomic_uint32 nextidx;
+
+	int			nindexes;
+	LVSharedIndStats indstats[FLEXIBLE_ARRAY_MEMBER];
+} LVShared;
+
+static IndexBulkDeleteResult *lazy_index_vacuum_cleanup(Relation indrel,
+														IndexBulkDeleteResult *stats,
+														LVRelStats *vacrelstats,
+														BufferAccessStrategy vac_strategy,
+														int elevel);
+static void lazy_update_index_stats(Relation indrel,
+									IndexBulkDeleteResult *stats,
+									PGRUsage *ru0, int elevel);
+static int	compute_parallel_vacuum_workers(Relation onerel, int nindexes,
+											int nrequested);
+static void lazy_parallel_vacuum_indexes(Relation onerel, Relation *Irel,
+										 IndexBulkDeleteResult **stats,
+										 int nindexes, LVRelStats *vacrelstats,
+										 BufferAccessStrategy vac_strategy,
+										 int elevel, int nworkers,
+										 bool for_cleanup);
+static void parallel_vacuum_index_loop(LVShared *shared, Relation *Irel,
+									   LVRelStats *vacrelstats,
+									   BufferAccessStrategy vac_strategy);
 static bool lazy_tid_reaped(ItemPointer itemptr, void *state);
-static int	vac_cmp_itemptr(const void *left, const void *right);
+static bool dead_tids_add(LVDeadTids *dt, BlockNumber blkno,
+						  OffsetNumber offnum);
+static LVDeadTidsBlock *dead_tids_find_block(LVDeadTids *dt,
+											 BlockNumber blkno);
+static Size dead_tids_serialized_size(LVDeadTids *dt);
+static void dead_tids_serialize(LVDeadTids *dt, char *dest);
+static LVDeadTids *dead_tids_attach(char *src);
 static BlockNumber count_nondeletable_pages(Relation onerel,
 											LVRelStats *vacrelstats,
 											BufferAccessStrategy vac_strategy,
@@ -65,7 +207,7 @@ static BlockNumber count_nondeletable_pages(Relation onerel,
  *	lazy_vacuum_index() -- vacuum one index relation.
  *
  *		Delete all the index entries pointing to tuples listed in
- *		vacrelstats->dead_tuples, and update running statistics.
+ *		vacrelstats->dead_tids, and update running statistics.
  */
 void
 lazy_vacuum_index(Relation indrel,
@@ -92,9 +234,9 @@ lazy_vacuum_index(Relation indrel,
 							   lazy_tid_reaped, (void *) vacrelstats);
 
 	ereport(elevel,
-			(errmsg("scanned index \"%s\" to remove %d row versions",
+			(errmsg("scanned index \"%s\" to remove %.0f row versions",
 					RelationGetRelationName(indrel),
-					vacrelstats->num_dead_tuples),
+					(double) vacrelstats->num_dead_tuples),
 			 errdetail_internal("%s", pg_rusage_show(&ru0))));
 }
 
@@ -108,11 +250,89 @@ lazy_cleanup_index(Relation indrel,
 				   BufferAccessStrategy vac_strategy,
 				   int elevel)
 {
-	IndexVacuumInfo ivinfo;
 	PGRUsage	ru0;
 
 	pg_rusage_init(&ru0);
 
+	stats = lazy_index_vacuum_cleanup(indrel, stats, vacrelstats,
+									  vac_strategy, elevel);
+
+	if (!stats)
+		return;
+
+	lazy_update_index_stats(indrel, stats, &ru0, elevel);
+}
+
+/*
+ *	lazy_vacuum_all_indexes() -- vacuum all indexes of a relation.
+ *
+ *		Like calling lazy_vacuum_index for each index, except that up to
+ *		nworkers parallel workers help with the work.
+ */
+void
+lazy_vacuum_all_indexes(Relation onerel, Relation *Irel,
+						IndexBulkDeleteResult **stats,
+						int nindexes, LVRelStats *vacrelstats,
+						BufferAccessStrategy vac_strategy,
+						int elevel, int nworkers)
+{
+	int			i;
+
+	nworkers = compute_parallel_vacuum_workers(onerel, nindexes, nworkers);
+	if (nworkers > 0)
+	{
+		lazy_parallel_vacuum_indexes(onerel, Irel, stats, nindexes,
+									 vacrelstats, vac_strategy, elevel,
+									 nworkers, false);
+		return;
+	}
+
+	for (i = 0; i < nindexes; i++)
+		lazy_vacuum_index(Irel[i], &stats[i], vacrelstats, vac_strategy,
+						  elevel);
+}
+
+/*
+ *	lazy_cleanup_all_indexes() -- do post-vacuum cleanup for all indexes.
+ *
+ *		Like calling lazy_cleanup_index for each index, except that up to
+ *		nworkers parallel workers help with the work.
+ */
+void
+lazy_cleanup_all_indexes(Relation onerel, Relation *Irel,
+						 IndexBulkDeleteResult **stats,
+						 int nindexes, LVRelStats *vacrelstats,
+						 BufferAccessStrategy vac_strategy,
+						 int elevel, int nworkers)
+{
+	int			i;
+
+	nworkers = compute_parallel_vacuum_workers(onerel, nindexes, nworkers);
+	if (nworkers > 0)
+	{
+		lazy_parallel_vacuum_indexes(onerel, Irel, stats, nindexes,
+									 vacrelstats, vac_strategy, elevel,
+									 nworkers, true);
+		return;
+	}
+
+	for (i = 0; i < nindexes; i++)
+		lazy_cleanup_index(Irel[i], stats[i], vacrelstats, vac_strategy,
+						   elevel);
+}
+
+/*
+ * Call amvacuumcleanup for one index, without updating its statistics.
+ */
+static IndexBulkDeleteResult *
+lazy_index_vacuum_cleanup(Relation indrel,
+						  IndexBulkDeleteResult *stats,
+						  LVRelStats *vacrelstats,
+						  BufferAccessStrategy vac_strategy,
+						  int elevel)
+{
+	IndexVacuumInfo ivinfo;
+
 	ivinfo.index = indrel;
 	ivinfo.analyze_only = false;
 	ivinfo.report_progress = false;
@@ -127,11 +347,20 @@ lazy_cleanup_index(Relation indrel,
 	ivinfo.num_heap_tuples = vacrelstats->new_rel_tuples;
 	ivinfo.strategy = vac_strategy;
 
-	stats = index_vacuum_cleanup(&ivinfo, stats);
-
-	if (!stats)
-		return;
+	return index_vacuum_cleanup(&ivinfo, stats);
+}
 
+/*
+ * Update pg_class statistics of an index after amvacuumcleanup, and report
+ * them.  The stats are freed.
+ *
+ * This can't be done in a parallel worker, as catalogs can't be updated
+ * in parallel mode.
+ */
+static void
+lazy_update_index_stats(Relation indrel, IndexBulkDeleteResult *stats,
+						PGRUsage *ru0, int elevel)
+{
 	/*
 	 * Now update statistics in pg_class, but only if the index says the count
 	 * is accurate.
@@ -156,11 +385,307 @@ lazy_cleanup_index(Relation indrel,
 					   "%s.",
 					   stats->tuples_removed,
 					   stats->pages_deleted, stats->pages_free,
-					   pg_rusage_show(&ru0))));
+					   pg_rusage_show(ru0))));
 
 	pfree(stats);
 }
 
+/*
+ * Compute the number of parallel workers for vacuuming the indexes of a
+ * relation, out of the nrequested asked for by the user.
+ *
+ * Each index is processed by one process, and the leader takes part, so
+ * there is no point in having more workers than indexes less one.  Parallel
+ * workers can't access the leader's temporary relations.
+ */
+static int
+compute_parallel_vacuum_workers(Relation onerel, int nindexes, int nrequested)
+{
+	int			nworkers;
+
+	if (nrequested <= 0 || nindexes < 2 || RelationUsesLocalBuffers(onerel))
+		return 0;
+
+	nworkers = Min(nrequested, nindexes - 1);
+
+	return Min(nworkers, max_parallel_maintenance_workers);
+}
+
+/*
+ * Vacuum, or clean up if for_cleanup is true, all indexes using parallel
+ * workers.
+ *
+ * The workers, and the leader, take the indexes one at a time from the
+ * shared state until none are left.  The dead tuple TIDs are copied to the
+ * DSM segment, which we set up afresh for each round: the leader must not be
+ * in parallel mode while it vacuums the heap, as that may need to assign a
+ * transaction id, and a round of index vacuuming costs much more than the
+ * copy.
+ */
+static void
+lazy_parallel_vacuum_indexes(Relation onerel, Relation *Irel,
+							 IndexBulkDeleteResult **stats,
+							 int nindexes, LVRelStats *vacrelstats,
+							 BufferAccessStrategy vac_strategy,
+							 int elevel, int nworkers, bool for_cleanup)
+{
+	ParallelContext *pcxt;
+	LVShared   *shared;
+	Size		est_shared;
+	Size		est_dead_tuples = 0;
+	int			querylen = 0;
+	int			nkeys = 1;
+	int			i;
+	IndexBulkDeleteResult **cleanup_stats = NULL;
+	PGRUsage	ru0;
+
+	pg_rusage_init(&ru0);
+
+	EnterParallelMode();
+	pcxt = CreateParallelContext("postgres", "lazy_parallel_vacuum_main",
+								 nworkers);
+
+	/* Estimate size for the shared state, PARALLEL_VACUUM_KEY_SHARED */
+	est_shared = add_size(offsetof(LVShared, indstats),
+						  mul_size(sizeof(LVSharedIndStats), nindexes));
+	shm_toc_estimate_chunk(&pcxt->estimator, est_shared);
+
+	/* Estimate size for the dead tuples, PARALLEL_VACUUM_KEY_DEAD_TUPLES */
+	if (!for_cleanup && vacrelstats->num_dead_tuples > 0)
+	{
+		est_dead_tuples = dead_tids_serialized_size(vacrelstats->dead_tids);
+		shm_toc_estimate_chunk(&pcxt->estimator, est_dead_tuples);
+		nkeys++;
+	}
+
+	/* Finally, estimate PARALLEL_VACUUM_KEY_QUERY_TEXT space */
+	if (debug_query_string)
+	{
+		querylen = strlen(debug_query_string);
+		shm_toc_estimate_chunk(&pcxt->estimator, querylen + 1);
+		nkeys++;
+	}
+	shm_toc_estimate_keys(&pcxt->estimator, nkeys);
+
+	InitializeParallelDSM(pcxt);
+
+	shared = (LVShared *) shm_toc_allocate(pcxt->toc, est_shared);
+	shared->elevel = elevel;
+	shared->for_cleanup = for_cleanup;
+	shared->old_live_tuples = vacrelstats->old_live_tuples;
+	shared->new_rel_tuples = vacrelstats->new_rel_tuples;
+	shared->rel_pages = vacrelstats->rel_pages;
+	shared->tupcount_pages = vacrelstats->tupcount_pages;
+	shared->num_dead_tuples = for_cleanup ? 0 : vacrelstats->num_dead_tuples;
+	pg_atomic_init_u32(&shared->nextidx, 0);
+	shared->nindexes = nindexes;
+	for (i = 0; i < nindexes; i++)
+	{
+		LVSharedIndStats *indstats = &shared->indstats[i];
+
+		indstats->indexoid = RelationGetRelid(Irel[i]);
+		indstats->updated = (stats[i] != NULL);
+		if (stats[i] != NULL)
+			memcpy(&indstats->stats, stats[i], sizeof(IndexBulkDeleteResult));
+	}
+	shm_toc_insert(pcxt->toc, PARALLEL_VACUUM_KEY_SHARED, shared);
+
+	if (est_dead_tuples > 0)
+	{
+		char	   *dead_tids;
+
+		dead_tids = (char *) shm_toc_allocate(pcxt->toc, est_dead_tuples);
+		dead_tids_serialize(vacrelstats->dead_tids, dead_tids);
+		shm_toc_insert(pcxt->toc, PARALLEL_VACUUM_KEY_DEAD_TUPLES,
+					   dead_tids);
+	}
+
+	if (debug_query_string)
+	{
+		char	   *sharedquery;
+
+		sharedquery = (char *) shm_toc_allocate(pcxt->toc, querylen + 1);
+		memcpy(sharedquery, debug_query_string, querylen + 1);
+		shm_toc_insert(pcxt->toc, PARALLEL_VACUUM_KEY_QUERY_TEXT, sharedquery);
+	}
+
+	LaunchParallelWorkers(pcxt);
+
+	if (for_cleanup)
+		ereport(elevel,
+				(errmsg(ngettext("launched %d parallel vacuum worker for index cleanup (planned: %d)",
+								 "launched %d parallel vacuum workers for index cleanup (planned: %d)",
+								 pcxt->nworkers_launched),
+						pcxt->nworkers_launched, nworkers)));
+	else
+		ereport(elevel,
+				(errmsg(ngettext("launched %d parallel vacuum worker for index vacuuming (planned: %d)",
+								 "launched %d parallel vacuum workers for index vacuuming (planned: %d)",
+								 pcxt->nworkers_launched),
+						pcxt->nworkers_launched, nworkers)));
+
+	/*
+	 * Join as a worker.  This also does all the work if no workers could be
+	 * launched.
+	 */
+	parallel_vacuum_index_loop(shared, Irel, vacrelstats, vac_strategy);
+
+	WaitForParallelWorkersToFinish(pcxt);
+
+	/* Copy the results out of the DSM segment before destroying it. */
+	if (for_cleanup)
+		cleanup_stats = (IndexBulkDeleteResult **)
+			palloc0(nindexes * sizeof(IndexBulkDeleteResult *));
+	for (i = 0; i < nindexes; i++)
+	{
+		LVSharedIndStats *indstats = &shared->indstats[i];
+		IndexBulkDeleteResult *result = NULL;
+
+		if (indstats->updated)
+		{
+			result = (IndexBulkDeleteResult *)
+				palloc(sizeof(IndexBulkDeleteResult));
+			memcpy(result, &indstats->stats, sizeof(IndexBulkDeleteResult));
+		}
+
+		if (for_cleanup)
+		{
+			/* The bulk-delete stats are consumed, as in lazy_cleanup_index */
+			if (stats[i] != NULL)
+				pfree(stats[i]);
+			stats[i] = NULL;
+			cleanup_stats[i] = result;
+		}
+		else if (result != NULL)
+		{
+			if (stats[i] != NULL)
+				pfree(stats[i]);
+			stats[i] = result;
+		}
+	}
+
+	DestroyParallelContext(pcxt);
+	ExitParallelMode();
+
+	/* Now that we're out of parallel mode, we can update pg_class. */
+	if (for_cleanup)
+	{
+		for (i = 0; i < nindexes; i++)
+		{
+			if (cleanup_stats[i] != NULL)
+				lazy_update_index_stats(Irel[i], cleanup_stats[i], &ru0,
+										elevel);
+		}
+		pfree(cleanup_stats);
+	}
+}
+
+/*
+ * Process indexes of a parallel index vacuum until there are none left.
+ * This is run by the leader as well as by all the workers.
+ */
+static void
+parallel_vacuum_index_loop(LVShared *shared, Relation *Irel,
+						   LVRelStats *vacrelstats,
+						   BufferAccessStrategy vac_strategy)
+{
+	for (;;)
+	{
+		uint32		idx;
+		LVSharedIndStats *indstats;
+		IndexBulkDeleteResult *stats;
+
+		idx = pg_atomic_fetch_add_u32(&shared->nextidx, 1);
+		if (idx >= shared->nindexes)
+			break;
+
+		indstats = &shared->indstats[idx];
+		stats = indstats->updated ? &indstats->stats : NULL;
+
+		if (shared->for_cleanup)
+			stats = lazy_index_vacuum_cleanup(Irel[idx], stats, vacrelstats,
+											  vac_strategy, shared->elevel);
+		else
+			lazy_vacuum_index(Irel[idx], &stats, vacrelstats, vac_strategy,
+							  shared->elevel);
+
+		/*
+		 * The index AM normally updates the stats in place, but allocates
+		 * them on the first call.
+		 */
+		if (stats == NULL)
+			indstats->updated = false;
+		else
+		{
+			if (stats != &indstats->stats)
+			{
+				memcpy(&indstats->stats, stats, sizeof(IndexBulkDeleteResult));
+				pfree(stats);
+			}
+			indstats->updated = true;
+		}
+	}
+}
+
+/*
+ * Main entry point of a parallel vacuum worker.
+ */
+void
+lazy_parallel_vacuum_main(dsm_segment *seg, shm_toc *toc)
+{
+	LVShared   *shared;
+	LVRelStats	vacrelstats;
+	Relation   *indrels;
+	BufferAccessStrategy bstrategy;
+	int			i;
+
+	/* Set debug_query_string for individual workers, if the leader had one */
+	debug_query_string = shm_toc_lookup(toc, PARALLEL_VACUUM_KEY_QUERY_TEXT,
+										true);
+	pgstat_report_activity(STATE_RUNNING, debug_query_string);
+
+	shared = (LVShared *) shm_toc_lookup(toc, PARALLEL_VACUUM_KEY_SHARED,
+										 false);
+
+	/*
+	 * Open the indexes.  The leader holds the same locks, and we're in its
+	 * lock group, so this can't block.
+	 */
+	indrels = (Relation *) palloc(shared->nindexes * sizeof(Relation));
+	for (i = 0; i < shared->nindexes; i++)
+		indrels[i] = index_open(shared->indstats[i].indexoid,
+								RowExclusiveLock);
+
+	/* Set up the parts of LVRelStats needed for index vacuuming */
+	memset(&vacrelstats, 0, sizeof(LVRelStats));
+	vacrelstats.old_live_tuples = shared->old_live_tuples;
+	vacrelstats.new_rel_tuples = shared->new_rel_tuples;
+	vacrelstats.rel_pages = shared->rel_pages;
+	vacrelstats.tupcount_pages = shared->tupcount_pages;
+	vacrelstats.num_dead_tuples = shared->num_dead_tuples;
+	if (shared->num_dead_tuples > 0)
+		vacrelstats.dead_tids = dead_tids_attach((char *)
+			shm_toc_lookup(toc, PARALLEL_VACUUM_KEY_DEAD_TUPLES, false));
+
+	/*
+	 * Each worker does its own cost-based vacuum delay accounting, with the
+	 * leader's settings.
+	 */
+	VacuumCostActive = (VacuumCostDelay > 0);
+	VacuumCostBalance = 0;
+	VacuumPageHit = 0;
+	VacuumPageMiss = 0;
+	VacuumPageDirty = 0;
+
+	bstrategy = GetAccessStrategy(BAS_VACUUM);
+	parallel_vacuum_index_loop(shared, indrels, &vacrelstats, bstrategy);
+	FreeAccessStrategy(bstrategy);
+
+	for (i = 0; i < shared->nindexes; i++)
+		index_close(indrels[i], RowExclusiveLock);
+	pfree(indrels);
+}
+
 /*
  * should_attempt_truncation - should we attempt to truncate the heap?
  *
@@ -302,6 +827,8 @@ lazy_truncate_heap(Relation onerel, LVRelStats *vacrelstats,
 		if (RelationStorageIsZHeap(onerel))
 			Assert(new_rel_pages > 0);
 
+		if (RelationStorageIsZHeap(onerel))
+			ZHeapForgetFreedPages(onerel, new_rel_pages);
 		RelationTruncate(onerel, new_rel_pages);
 
 		/*
@@ -340,69 +867,433 @@ lazy_record_dead_tuple(LVRelStats *vacrelstats,
 					   ItemPointer itemptr)
 {
 	/*
-	 * The array shouldn't overflow under normal behavior, but perhaps it
-	 * could if we are given a really small maintenance_work_mem. In that
-	 * case, just forget the last few tuples (we'll get 'em next time).
+	 * The store shouldn't overflow under normal behavior, as callers check
+	 * lazy_dead_tids_is_full() before each page, but perhaps it could if we
+	 * are given a really small maintenance_work_mem.  In that case, just
+	 * forget the last few tuples (we'll get 'em next time).
 	 */
-	if (vacrelstats->num_dead_tuples < vacrelstats->max_dead_tuples)
+	if (dead_tids_add(vacrelstats->dead_tids,
+					  ItemPointerGetBlockNumber(itemptr),
+					  ItemPointerGetOffsetNumber(itemptr)))
 	{
-		vacrelstats->dead_tuples[vacrelstats->num_dead_tuples] = *itemptr;
 		vacrelstats->num_dead_tuples++;
 		pgstat_progress_update_param(PROGRESS_VACUUM_NUM_DEAD_TUPLES,
 									 vacrelstats->num_dead_tuples);
 	}
 }
 
+/*
+ * lazy_forget_dead_tuples - forget all the remembered tuples
+ *
+ * The caller is expected to have vacuumed them already.  latestRemovedXid is
+ * left alone, since we want that value to stay valid.
+ */
+void
+lazy_forget_dead_tuples(LVRelStats *vacrelstats)
+{
+	LVDeadTids *dt = vacrelstats->dead_tids;
+
+	dt->num_blocks = 0;
+	dt->num_words = 0;
+	dt->num_chunks = 0;
+	vacrelstats->num_dead_tuples = 0;
+}
+
 /*
  *	lazy_tid_reaped() -- is a particular tid deletable?
  *
  *		This has the right signature to be an IndexBulkDeleteCallback.
- *
- *		Assumes dead_tuples array is in sorted order.
  */
 static bool
 lazy_tid_reaped(ItemPointer itemptr, void *state)
 {
 	LVRelStats *vacrelstats = (LVRelStats *) state;
-	ItemPointer res;
+	LVDeadTidsBlock *block;
+	OffsetNumber offnum = ItemPointerGetOffsetNumber(itemptr);
+	uint64	   *words;
+
+	if (vacrelstats->num_dead_tuples == 0)
+		return false;
+
+	block = dead_tids_find_block(vacrelstats->dead_tids,
+								 ItemPointerGetBlockNumber(itemptr));
+	if (block == NULL)
+		return false;
 
-	res = (ItemPointer) bsearch((void *) itemptr,
-								(void *) vacrelstats->dead_tuples,
-								vacrelstats->num_dead_tuples,
-								sizeof(ItemPointerData),
-								vac_cmp_itemptr);
+	words = &vacrelstats->dead_tids->words[block->wordoff];
+	if (block->noffsets == 0)
+	{
+		if (offnum / 64 >= block->nwords)
+			return false;
+		return (words[offnum / 64] & (UINT64CONST(1) << (offnum % 64))) != 0;
+	}
+	else
+	{
+		OffsetNumber *offsets = (OffsetNumber *) words;
+		int			i;
 
-	return (res != NULL);
+		/*
+		 * The array is only used while it's no bigger than a bitmap would
+		 * be, so it never has more than a handful of entries.
+		 */
+		for (i = 0; i < block->noffsets && offsets[i] <= offnum; i++)
+		{
+			if (offsets[i] == offnum)
+				return true;
+		}
+		return false;
+	}
 }
 
 /*
- * Comparator routines for use with qsort() and bsearch().
+ * lazy_dead_tids_create - allocate the dead tuple store for a lazy vacuum
+ *
+ * relblocks is the size of the relation, and maxtuples the largest number of
+ * tuples a page can have.  Without indexes we only ever need to remember the
+ * dead tuples of one page.
  */
-static int
-vac_cmp_itemptr(const void *left, const void *right)
+LVDeadTids *
+lazy_dead_tids_create(BlockNumber relblocks, int maxtuples, bool useindex)
+{
+	LVDeadTids *dt;
+	Size		block_space;
+	Size		chunk_space;
+	Size		space;
+	uint32		max_chunks;
+	char	   *base;
+	int			vac_work_mem = IsAutoVacuumWorkerProcess() &&
+	autovacuum_work_mem != -1 ?
+	autovacuum_work_mem : maintenance_work_mem;
+
+	block_space = sizeof(LVDeadTidsBlock) +
+		(maxtuples / 64 + 1) * sizeof(uint64);
+
+	if (useindex)
+	{
+		max_chunks = relblocks / DEAD_TIDS_CHUNK_BLOCKS + 1;
+		chunk_space = MAXALIGN(mul_size(max_chunks, sizeof(LVDeadTidsChunk)));
+
+		space = (Size) vac_work_mem * 1024;
+		space = space > chunk_space ? space - chunk_space : 0;
+
+		/* no point in allowing for more than every page full of dead tuples */
+		if (space / block_space > relblocks)
+			space = relblocks * block_space;
+
+		/* words are addressed with a uint32 */
+		if (space / sizeof(uint64) > PG_UINT32_MAX)
+			space = (Size) PG_UINT32_MAX * sizeof(uint64);
+
+		/* stay sane if small maintenance_work_mem */
+		space = Max(space, block_space);
+	}
+	else
+	{
+		max_chunks = 0;
+		chunk_space = 0;
+		space = block_space;
+	}
+	space = TYPEALIGN(sizeof(uint64), space);
+
+	base = MemoryContextAllocHuge(CurrentMemoryContext,
+								  add_size(chunk_space, space));
+
+	dt = (LVDeadTids *) palloc0(sizeof(LVDeadTids));
+	dt->max_chunks = max_chunks;
+	dt->space = space;
+	dt->block_space = block_space;
+	dt->chunks = (LVDeadTidsChunk *) base;
+	dt->words = (uint64 *) (base + chunk_space);
+	dt->blocks_end = (LVDeadTidsBlock *) (base + chunk_space + space);
+
+	return dt;
+}
+
+/*
+ * lazy_dead_tids_is_full - is there no longer room for another page?
+ */
+bool
+lazy_dead_tids_is_full(LVDeadTids *dt)
+{
+	return DeadTidsFreeSpace(dt) < dt->block_space;
+}
+
+/*
+ * lazy_dead_tids_max_tuples - number of dead tuples the store is sure to hold
+ *
+ * This assumes the worst case of a single dead tuple on every page; many more
+ * fit when dead tuples cluster on fewer pages.
+ */
+int64
+lazy_dead_tids_max_tuples(LVDeadTids *dt)
+{
+	return dt->space / (sizeof(LVDeadTidsBlock) + sizeof(uint64));
+}
+
+/*
+ * lazy_dead_tids_num_blocks - number of blocks having dead tuples
+ */
+uint32
+lazy_dead_tids_num_blocks(LVDeadTids *dt)
+{
+	return dt->num_blocks;
+}
+
+/*
+ * lazy_dead_tids_block_number - block number of the blockidx'th block
+ *
+ * Blocks are numbered in increasing block number order.
+ */
+BlockNumber
+lazy_dead_tids_block_number(LVDeadTids *dt, uint32 blockidx)
+{
+	Assert(blockidx < dt->num_blocks);
+
+	return DeadTidsBlock(dt, blockidx)->blkno;
+}
+
+/*
+ * lazy_dead_tids_get_offsets - fetch the dead tuple offsets of a block
+ *
+ * The offsets are stored into the caller's array, which must have room for
+ * MaxOffsetNumber entries, in increasing order.  Returns their number.
+ */
+int
+lazy_dead_tids_get_offsets(LVDeadTids *dt, BlockNumber blkno,
+						   OffsetNumber *offsets)
 {
-	BlockNumber lblk,
-				rblk;
-	OffsetNumber loff,
-				roff;
+	LVDeadTidsBlock *block = dead_tids_find_block(dt, blkno);
+	uint64	   *words;
+	int			n = 0;
+	int			i;
 
-	lblk = ItemPointerGetBlockNumber((ItemPointer) left);
-	rblk = ItemPointerGetBlockNumber((ItemPointer) right);
+	if (block == NULL)
+		return 0;
 
-	if (lblk < rblk)
-		return -1;
-	if (lblk > rblk)
-		return 1;
+	words = &dt->words[block->wordoff];
+	if (block->noffsets > 0)
+	{
+		n = block->noffsets;
+		memcpy(offsets, words, n * sizeof(OffsetNumber));
+		return n;
+	}
 
-	loff = ItemPointerGetOffsetNumber((ItemPointer) left);
-	roff = ItemPointerGetOffsetNumber((ItemPointer) right);
+	for (i = 0; i < block->nwords; i++)
+	{
+		uint64		word = words[i];
 
-	if (loff < roff)
-		return -1;
-	if (loff > roff)
-		return 1;
+		while (word != 0)
+		{
+			int			bit = pg_rightmost_one_pos64(word);
 
-	return 0;
+			offsets[n++] = (OffsetNumber) (i * 64 + bit);
+			word &= word - 1;
+		}
+	}
+
+	return n;
+}
+
+/*
+ * dead_tids_add - add one TID to the store
+ *
+ * Returns false if there was no room for it.
+ */
+static bool
+dead_tids_add(LVDeadTids *dt, BlockNumber blkno, OffsetNumber offnum)
+{
+	LVDeadTidsBlock *block = NULL;
+	uint64	   *words;
+	int			array_words;
+	int			bitmap_words;
+
+	if (dt->num_blocks > 0)
+	{
+		block = DeadTidsBlock(dt, dt->num_blocks - 1);
+		if (block->blkno != blkno)
+		{
+			Assert(block->blkno < blkno);
+			block = NULL;
+		}
+	}
+
+	if (block == NULL)
+	{
+		/* A new block always starts out with a single word. */
+		if (DeadTidsFreeSpace(dt) < sizeof(LVDeadTidsBlock) + sizeof(uint64))
+			return false;
+
+		if (dt->max_chunks > 0)
+		{
+			uint32		chunkno = blkno / DEAD_TIDS_CHUNK_BLOCKS;
+			uint32		bit = blkno % DEAD_TIDS_CHUNK_BLOCKS;
+			LVDeadTidsChunk *chunk;
+
+			Assert(chunkno < dt->max_chunks);
+			while (dt->num_chunks <= chunkno)
+			{
+				chunk = &dt->chunks[dt->num_chunks++];
+				chunk->first_block = dt->num_blocks;
+				memset(chunk->present, 0, sizeof(chunk->present));
+			}
+			chunk = &dt->chunks[chunkno];
+			chunk->present[bit / 64] |= UINT64CONST(1) << (bit % 64);
+		}
+
+		dt->num_blocks++;
+		block = DeadTidsBlock(dt, dt->num_blocks - 1);
+		block->blkno = blkno;
+		block->wordoff = dt->num_words;
+		block->nwords = 0;
+		block->noffsets = 0;
+	}
+
+	/* The entry being filled is always the last, so its words are too */
+	Assert(block->wordoff + block->nwords == dt->num_words);
+	words = &dt->words[block->wordoff];
+
+	bitmap_words = Max(offnum / 64 + 1, block->nwords);
+	if (block->nwords > 0 && block->noffsets == 0)
+		array_words = INT_MAX;	/* already a bitmap, keep it that way */
+	else
+		array_words = block->noffsets / DEAD_TIDS_OFFSETS_PER_WORD + 1;
+
+	if (array_words < bitmap_words)
+	{
+		/* append to the array */
+		if (array_words > block->nwords)
+		{
+			if (DeadTidsFreeSpace(dt) < sizeof(uint64))
+				return false;
+			words[block->nwords++] = 0;
+			dt->num_words++;
+		}
+		((OffsetNumber *) words)[block->noffsets++] = offnum;
+	}
+	else
+	{
+		int			extra = bitmap_words - block->nwords;
+
+		if (DeadTidsFreeSpace(dt) < extra * sizeof(uint64))
+			return false;
+
+		if (block->noffsets > 0)
+		{
+			/* convert the array to a bitmap */
+			OffsetNumber saved[MaxOffsetNumber];
+			int			noffsets = block->noffsets;
+			int			i;
+
+			memcpy(saved, words, noffsets * sizeof(OffsetNumber));
+			memset(words, 0, bitmap_words * sizeof(uint64));
+			for (i = 0; i < noffsets; i++)
+				words[saved[i] / 64] |= UINT64CONST(1) << (saved[i] % 64);
+			block->noffsets = 0;
+		}
+		else if (extra > 0)
+			memset(&words[block->nwords], 0, extra * sizeof(uint64));
+
+		block->nwords = bitmap_words;
+		dt->num_words += extra;
+		words[offnum / 64] |= UINT64CONST(1) << (offnum % 64);
+	}
+
+	return true;
+}
+
+/*
+ * dead_tids_find_block - find the entry of a block, or NULL if it has none
+ */
+static LVDeadTidsBlock *
+dead_tids_find_block(LVDeadTids *dt, BlockNumber blkno)
+{
+	LVDeadTidsChunk *chunk;
+	uint32		chunkno = blkno / DEAD_TIDS_CHUNK_BLOCKS;
+	uint32		bit = blkno % DEAD_TIDS_CHUNK_BLOCKS;
+	uint32		blockidx;
+	int			i;
+
+	if (dt->num_blocks == 0)
+		return NULL;
+
+	/* The page just scanned is the common case without indexes */
+	if (DeadTidsBlock(dt, dt->num_blocks - 1)->blkno == blkno)
+		return DeadTidsBlock(dt, dt->num_blocks - 1);
+
+	if (chunkno >= dt->num_chunks)
+		return NULL;
+	chunk = &dt->chunks[chunkno];
+	if ((chunk->present[bit / 64] & (UINT64CONST(1) << (bit % 64))) == 0)
+		return NULL;
+
+	blockidx = chunk->first_block;
+	for (i = 0; i < bit / 64; i++)
+		blockidx += pg_popcount64(chunk->present[i]);
+	blockidx += pg_popcount64(chunk->present[bit / 64] &
+							  ((UINT64CONST(1) << (bit % 64)) - 1));
+
+	Assert(DeadTidsBlock(dt, blockidx)->blkno == blkno);
+	return DeadTidsBlock(dt, blockidx);
+}
+
+/*
+ * Support for passing the dead tuple store to parallel vacuum workers.  The
+ * used part of the chunk map, words and block entries are copied after a
+ * copy of the LVDeadTids itself, whose pointers are rebuilt on attach.
+ */
+static Size
+dead_tids_serialized_size(LVDeadTids *dt)
+{
+	Size		size;
+
+	size = MAXALIGN(sizeof(LVDeadTids));
+	size = add_size(size, MAXALIGN(mul_size(dt->num_chunks,
+											sizeof(LVDeadTidsChunk))));
+	size = add_size(size, mul_size(dt->num_words, sizeof(uint64)));
+	size = add_size(size, mul_size(dt->num_blocks, sizeof(LVDeadTidsBlock)));
+
+	return size;
+}
+
+static void
+dead_tids_serialize(LVDeadTids *dt, char *dest)
+{
+	Size		chunk_space = dt->num_chunks * sizeof(LVDeadTidsChunk);
+	Size		word_space = dt->num_words * sizeof(uint64);
+	Size		block_space = dt->num_blocks * sizeof(LVDeadTidsBlock);
+
+	memcpy(dest, dt, sizeof(LVDeadTids));
+	dest += MAXALIGN(sizeof(LVDeadTids));
+	memcpy(dest, dt->chunks, chunk_space);
+	dest += MAXALIGN(chunk_space);
+	memcpy(dest, dt->words, word_space);
+	dest += word_space;
+	memcpy(dest, dt->blocks_end - dt->num_blocks, block_space);
+}
+
+static LVDeadTids *
+dead_tids_attach(char *src)
+{
+	LVDeadTids *dt = (LVDeadTids *) palloc(sizeof(LVDeadTids));
+	Size		chunk_space;
+	Size		word_space;
+	Size		block_space;
+
+	memcpy(dt, src, sizeof(LVDeadTids));
+	chunk_space = dt->num_chunks * sizeof(LVDeadTidsChunk);
+	word_space = dt->num_words * sizeof(uint64);
+	block_space = dt->num_blocks * sizeof(LVDeadTidsBlock);
+
+	src += MAXALIGN(sizeof(LVDeadTids));
+	dt->chunks = (LVDeadTidsChunk *) src;
+	dt->max_chunks = dt->num_chunks;
+	src += MAXALIGN(chunk_space);
+	dt->words = (uint64 *) src;
+	src += word_space;
+	dt->blocks_end = (LVDeadTidsBlock *) (src + block_space);
+	dt->space = word_space + block_space;
+
+	return dt;
 }
 
 /*
@@ -503,6 +1394,16 @@ count_nondeletable_pages(Relation onerel, LVRelStats *vacrelstats,
 
 		page = BufferGetPage(buf);
 
+		/*
+		 * A zheap TPD page can still be linked from the metapage even when
+		 * it's empty, so it's never truncated away.
+		 */
+		if (IsTPDPage(page))
+		{
+			UnlockReleaseBuffer(buf);
+			return blkno + 1;
+		}
+
 		if (PageIsNew(page) || PageIsEmpty(page))
 		{
 			UnlockReleaseBuffer(buf);
@@ -14,15 +14,19 @@
 
 #include "postgres.h"
 
+#include "access/gin.h"
 #include "access/nbtree.h"
 #include "access/parallel.h"
+#include "access/rewritezheap.h"
 #include "access/session.h"
+#include "access/vacuumblk.h"
 #include "access/xact.h"
 #include "access/xlog.h"
 #include "catalog/pg_enum.h"
 #include "catalog/index.h"
 #include "catalog/namespace.h"
 #include "commands/async.h"
+#include "commands/copy.h"
 #include "executor/execParallel.h"
 #include "libpq/libpq.h"
 #include "libpq/pqformat.h"
@@ -32,6 +36,7 @@
 #include "pgstat.h"
 #include "storage/ipc.h"
 #include "storage/predicate.h"
+#include "storage/shmem.h"
 #include "storage/sinval.h"
 #include "storage/spin.h"
 #include "tcop/tcopprot.h"
@@ -93,6 +98,7 @@ typedef struct FixedParallelState
 	TimestampTz xact_ts;
 	TimestampTz stmt_ts;
 	SerializableXactHandle serializable_xact_handle;
+	bool		xact_has_xid;
 
 	/* Mutex protects remaining fields. */
 	slock_t		mutex;
@@ -101,6 +107,41 @@ typedef struct FixedParallelState
 	XLogRecPtr	last_xlog_end;
 } FixedParallelState;
 
+/*
+ * A parallel worker that has finished its work may, instead of exiting, wait
+ * in the worker pool until a leader in the same database, connected as the
+ * same user, needs a worker.  That saves the new worker's startup, and lets
+ * it keep its caches.  The pool lives in shared memory, with one slot per
+ * pooled worker; the mutex protects all slots.
+ */
+typedef struct ParallelWorkerPoolSlot
+{
+	pid_t		pid;			/* PID of pooled worker, or 0 if slot unused */
+	PGPROC	   *proc;			/* the worker's PGPROC */
+	Oid			database_id;	/* database the worker is connected to */
+	Oid			authenticated_user_id;	/* user the worker is connected as */
+	bool		busy;			/* working for a parallel context? */
+	bool		exit_requested; /* should worker exit rather than wait? */
+	uint64		generation;		/* advanced at each assignment */
+
+	/* Assignment to a parallel context, valid while busy */
+	dsm_handle	seg_handle;		/* the context's DSM segment */
+	int			worker_number;	/* ParallelWorkerNumber to use */
+	PGPROC	   *leader;			/* the context's leader */
+} ParallelWorkerPoolSlot;
+
+typedef struct ParallelWorkerPoolData
+{
+	slock_t		mutex;
+	int			nslots;
+	ParallelWorkerPoolSlot slots[FLEXIBLE_ARRAY_MEMBER];
+} ParallelWorkerPoolData;
+
+static ParallelWorkerPoolData *ParallelWorkerPool = NULL;
+
+/* GUC variable */
+int			parallel_worker_pool_size = 0;
+
 /*
  * Our parallel worker number.  We initialize this to -1, meaning that we are
  * not a parallel worker.  In parallel workers, it will be set to a value >= 0
@@ -121,6 +162,15 @@ static FixedParallelState *MyFixedParallelState;
 /* List of active parallel contexts. */
 static dlist_head pcxt_list = DLIST_STATIC_INIT(pcxt_list);
 
+/* Our slot in the worker pool, or -1 if we are not a pooled worker. */
+static int	MyPoolSlot = -1;
+
+/* Must a pooled worker reset its system caches before its next job? */
+static bool ParallelWorkerCachesDirty = true;
+
+/* Leader of the job a worker is running. */
+static PGPROC *ParallelMasterProc = NULL;
+
 /* Backend-local copy of data from FixedParallelState. */
 static pid_t ParallelMasterPid;
 
@@ -140,14 +190,37 @@ static const struct
 	},
 	{
 		"_bt_parallel_build_main", _bt_parallel_build_main
+	},
+	{
+		"_gin_parallel_build_main", _gin_parallel_build_main
+	},
+	{
+		"ParallelCopyMain", ParallelCopyMain
+	},
+	{
+		"lazy_parallel_vacuum_main", lazy_parallel_vacuum_main
+	},
+	{
+		"zheap_parallel_cluster_main", zheap_parallel_cluster_main
+	},
+	{
+		"zheap_parallel_rewrite_main", zheap_parallel_rewrite_main
 	}
 };
 
 /* Private functions. */
 static void HandleParallelMessage(ParallelContext *pcxt, int i, StringInfo msg);
 static void WaitForParallelWorkersToExit(ParallelContext *pcxt);
+static BgwHandleStatus GetParallelWorkerStatus(ParallelContext *pcxt, int i);
+static void TerminateParallelWorker(ParallelContext *pcxt, int i);
+static bool ParallelWorkerRunJob(dsm_handle handle);
 static parallel_worker_main_type LookupParallelWorkerFunction(const char *libraryname, const char *funcname);
 static void ParallelWorkerShutdown(int code, Datum arg);
+static bool ParallelWorkerPoolAssign(ParallelContext *pcxt, int i);
+static void ParallelWorkerPoolShrink(bool make_room);
+static bool ParallelWorkerPoolJoin(void);
+static bool ParallelWorkerPoolWait(dsm_handle *handle);
+static void ParallelWorkerPoolShutdown(int code, Datum arg);
 
 
 /*
@@ -320,6 +393,7 @@ InitializeParallelDSM(ParallelContext *pcxt)
 	fps->xact_ts = GetCurrentTransactionStartTimestamp();
 	fps->stmt_ts = GetCurrentStatementStartTimestamp();
 	fps->serializable_xact_handle = ShareSerializableXact();
+	fps->xact_has_xid = TransactionIdIsValid(GetTopTransactionIdIfAny());
 	SpinLockInit(&fps->mutex);
 	fps->last_xlog_end = 0;
 	shm_toc_insert(pcxt->toc, PARALLEL_KEY_FIXED, fps);
@@ -526,8 +600,11 @@ LaunchParallelWorkers(ParallelContext *pcxt)
 	worker.bgw_main_arg = UInt32GetDatum(dsm_segment_handle(pcxt->seg));
 	worker.bgw_notify_pid = MyProcPid;
 
+	/* Keep the worker pool within its configured size. */
+	ParallelWorkerPoolShrink(false);
+
 	/*
-	 * Start workers.
+	 * Start workers, using idle workers from the pool where possible.
 	 *
 	 * The caller must be able to tolerate ending up with fewer workers than
 	 * expected, so there is no need to throw an error here if registration
@@ -536,10 +613,16 @@ LaunchParallelWorkers(ParallelContext *pcxt)
 	 */
 	for (i = 0; i < pcxt->nworkers; ++i)
 	{
+		pcxt->worker[i].pool_slot = -1;
 		memcpy(worker.bgw_extra, &i, sizeof(int));
-		if (!any_registrations_failed &&
-			RegisterDynamicBackgroundWorker(&worker,
-											&pcxt->worker[i].bgwhandle))
+		if (!any_registrations_failed && ParallelWorkerPoolAssign(pcxt, i))
+		{
+			pcxt->worker[i].bgwhandle = NULL;
+			pcxt->nworkers_launched++;
+		}
+		else if (!any_registrations_failed &&
+				 RegisterDynamicBackgroundWorker(&worker,
+												 &pcxt->worker[i].bgwhandle))
 		{
 			shm_mq_set_handle(pcxt->worker[i].error_mqh,
 							  pcxt->worker[i].bgwhandle);
@@ -555,7 +638,13 @@ LaunchParallelWorkers(ParallelContext *pcxt)
 			 * to make sure that we forget about the error queues we budgeted
 			 * for those workers.  Otherwise, we'll wait for them to start,
 			 * but they never will.
+			 *
+			 * Idle pooled workers that are of no use to us may be what's
+			 * taking up the slots, so ask one to exit for the benefit of
+			 * later parallel operations.
 			 */
+			if (!any_registrations_failed)
+				ParallelWorkerPoolShrink(true);
 			any_registrations_failed = true;
 			pcxt->worker[i].bgwhandle = NULL;
 			shm_mq_detach(pcxt->worker[i].error_mqh);
@@ -632,7 +721,6 @@ WaitForParallelWorkersToAttach(ParallelContext *pcxt)
 			BgwHandleStatus status;
 			shm_mq	   *mq;
 			int			rc;
-			pid_t		pid;
 
 			if (pcxt->known_attached_workers[i])
 				continue;
@@ -648,7 +736,7 @@ WaitForParallelWorkersToAttach(ParallelContext *pcxt)
 				continue;
 			}
 
-			status = GetBackgroundWorkerPid(pcxt->worker[i].bgwhandle, &pid);
+			status = GetParallelWorkerStatus(pcxt, i);
 			if (status == BGWH_STARTED)
 			{
 				/* Has the worker attached to the error queue? */
@@ -763,7 +851,6 @@ WaitForParallelWorkersToFinish(ParallelContext *pcxt)
 			 */
 			for (i = 0; i < pcxt->nworkers_launched; ++i)
 			{
-				pid_t		pid;
 				shm_mq	   *mq;
 
 				/*
@@ -772,9 +859,9 @@ WaitForParallelWorkersToFinish(ParallelContext *pcxt)
 				 * further investigation is needed.
 				 */
 				if (pcxt->worker[i].error_mqh == NULL ||
-					pcxt->worker[i].bgwhandle == NULL ||
-					GetBackgroundWorkerPid(pcxt->worker[i].bgwhandle,
-										   &pid) != BGWH_STOPPED)
+					(pcxt->worker[i].pool_slot < 0 &&
+					 pcxt->worker[i].bgwhandle == NULL) ||
+					GetParallelWorkerStatus(pcxt, i) != BGWH_STOPPED)
 					continue;
 
 				/*
@@ -826,21 +913,41 @@ WaitForParallelWorkersToFinish(ParallelContext *pcxt)
  * difference between WaitForParallelWorkersToFinish and this function is
  * that former just ensures that last message sent by worker backend is
  * received by master backend whereas this ensures the complete shutdown.
+ * A worker that goes back to the worker pool counts as shut down once it
+ * has let go of the parallel context.
  */
 static void
 WaitForParallelWorkersToExit(ParallelContext *pcxt)
 {
 	int			i;
 
-	/* Wait until the workers actually die. */
+	/* Wait until the workers actually die, or are back in the pool. */
 	for (i = 0; i < pcxt->nworkers_launched; ++i)
 	{
 		BgwHandleStatus status;
 
-		if (pcxt->worker == NULL || pcxt->worker[i].bgwhandle == NULL)
+		if (pcxt->worker == NULL ||
+			(pcxt->worker[i].pool_slot < 0 &&
+			 pcxt->worker[i].bgwhandle == NULL))
 			continue;
 
-		status = WaitForBackgroundWorkerShutdown(pcxt->worker[i].bgwhandle);
+		for (;;)
+		{
+			int			rc;
+
+			status = GetParallelWorkerStatus(pcxt, i);
+			if (status == BGWH_STOPPED)
+				break;
+
+			rc = WaitLatch(MyLatch, WL_LATCH_SET | WL_POSTMASTER_DEATH, -1,
+						   WAIT_EVENT_BGWORKER_SHUTDOWN);
+			if (rc & WL_POSTMASTER_DEATH)
+			{
+				status = BGWH_POSTMASTER_DIED;
+				break;
+			}
+			ResetLatch(MyLatch);
+		}
 
 		/*
 		 * If the postmaster kicked the bucket, we have no chance of cleaning
@@ -854,9 +961,96 @@ WaitForParallelWorkersToExit(ParallelContext *pcxt)
 					 errmsg("postmaster exited during a parallel transaction")));
 
 		/* Release memory. */
-		pfree(pcxt->worker[i].bgwhandle);
+		if (pcxt->worker[i].bgwhandle != NULL)
+			pfree(pcxt->worker[i].bgwhandle);
 		pcxt->worker[i].bgwhandle = NULL;
+		pcxt->worker[i].pool_slot = -1;
+	}
+}
+
+/*
+ * Get the status of worker i of a parallel context, as far as the context is
+ * concerned: a worker that has gone back to the worker pool after finishing
+ * its work is reported as stopped, though its process lives on.
+ */
+static BgwHandleStatus
+GetParallelWorkerStatus(ParallelContext *pcxt, int i)
+{
+	ParallelWorkerInfo *winfo = &pcxt->worker[i];
+	BgwHandleStatus status;
+	pid_t		pid;
+	int			n;
+
+	if (winfo->pool_slot >= 0)
+	{
+		ParallelWorkerPoolSlot *slot;
+
+		slot = &ParallelWorkerPool->slots[winfo->pool_slot];
+		SpinLockAcquire(&ParallelWorkerPool->mutex);
+		if (slot->busy && slot->generation == winfo->pool_generation)
+			status = BGWH_STARTED;
+		else
+			status = BGWH_STOPPED;
+		SpinLockRelease(&ParallelWorkerPool->mutex);
+
+		return status;
+	}
+
+	status = GetBackgroundWorkerPid(winfo->bgwhandle, &pid);
+
+	/*
+	 * A worker we registered joins the pool, if at all, only after it is
+	 * done with our parallel context.
+	 */
+	if (status == BGWH_STARTED)
+	{
+		SpinLockAcquire(&ParallelWorkerPool->mutex);
+		for (n = 0; n < ParallelWorkerPool->nslots; n++)
+		{
+			if (ParallelWorkerPool->slots[n].pid == pid)
+			{
+				status = BGWH_STOPPED;
+				break;
+			}
+		}
+		SpinLockRelease(&ParallelWorkerPool->mutex);
+	}
+
+	return status;
+}
+
+/*
+ * Terminate worker i of a parallel context, which has not finished its work.
+ */
+static void
+TerminateParallelWorker(ParallelContext *pcxt, int i)
+{
+	ParallelWorkerInfo *winfo = &pcxt->worker[i];
+	ParallelWorkerPoolSlot *slot;
+	pid_t		pid = 0;
+
+	if (winfo->pool_slot < 0)
+	{
+		TerminateBackgroundWorker(winfo->bgwhandle);
+		return;
 	}
+
+	/*
+	 * A pooled worker is killed directly.  Since it will not get to run
+	 * another job once asked to exit, the signal can't reach it while it is
+	 * working for somebody else.
+	 */
+	slot = &ParallelWorkerPool->slots[winfo->pool_slot];
+	SpinLockAcquire(&ParallelWorkerPool->mutex);
+	if (slot->busy && slot->generation == winfo->pool_generation)
+	{
+		slot->exit_requested = true;
+		pid = slot->pid;
+	}
+	SpinLockRelease(&ParallelWorkerPool->mutex);
+
+	if (pid != 0)
+		(void) kill(pid, SIGTERM);	/* ignore any error */
 }
 
 /*
@@ -887,7 +1081,7 @@ DestroyParallelContext(ParallelContext *pcxt)
 		{
 			if (pcxt->worker[i].error_mqh != NULL)
 			{
-				TerminateBackgroundWorker(pcxt->worker[i].bgwhandle);
+				TerminateParallelWorker(pcxt, i);
 
 				shm_mq_detach(pcxt->worker[i].error_mqh);
 				pcxt->worker[i].error_mqh = NULL;
@@ -1025,7 +1219,22 @@ HandleParallelMessages(void)
 				res = shm_mq_receive(pcxt->worker[i].error_mqh, &nbytes,
 									 &data, true);
 				if (res == SHM_MQ_WOULD_BLOCK)
+				{
+					/*
+					 * A pooled worker that exits before attaching to its
+					 * error queue will never detach from it either, and
+					 * there is no background worker handle for shm_mq to
+					 * check, so look out for that here.
+					 */
+					if (pcxt->worker[i].pool_slot >= 0 &&
+						GetParallelWorkerStatus(pcxt, i) == BGWH_STOPPED &&
+						shm_mq_get_sender(shm_mq_get_queue(pcxt->worker[i].error_mqh)) == NULL)
+						ereport(ERROR,
+								(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+								 errmsg("parallel worker failed to initialize"),
+								 errhint("More details may be available in the server log.")));
 					break;
+				}
 				else if (res == SHM_MQ_SUCCESS)
 				{
 					StringInfoData msg;
@@ -1205,6 +1414,37 @@ AtEOXact_Parallel(bool isCommit)
 void
 ParallelWorkerMain(Datum main_arg)
 {
+	dsm_handle	handle = DatumGetUInt32(main_arg);
+
+	/* Establish signal handlers. */
+	pqsignal(SIGTERM, die);
+	BackgroundWorkerUnblockSignals();
+
+	/* Determine and set our parallel worker number. */
+	Assert(ParallelWorkerNumber == -1);
+	memcpy(&ParallelWorkerNumber, MyBgworkerEntry->bgw_extra, sizeof(int));
+
+	/*
+	 * Do the work we were launched for, and then, if the worker pool has
+	 * room, wait there for more.
+	 */
+	while (ParallelWorkerRunJob(handle))
+	{
+		if (!ParallelWorkerPoolWait(&handle))
+			break;
+	}
+}
+
+/*
+ * Do the work of one parallel context, whose DSM segment is given.
+ *
+ * Returns true if this process may be reused for another parallel context
+ * afterwards, false if it should exit.
+ */
+static bool
+ParallelWorkerRunJob(dsm_handle handle)
+{
+	MemoryContext jobcontext;
 	dsm_segment *seg;
 	shm_toc    *toc;
 	FixedParallelState *fps;
@@ -1229,19 +1469,13 @@ ParallelWorkerMain(Datum main_arg)
 
 	/* Set flag to indicate that we're initializing a parallel worker. */
 	InitializingParallelWorker = true;
-
-	/* Establish signal handlers. */
-	pqsignal(SIGTERM, die);
-	BackgroundWorkerUnblockSignals();
-
-	/* Determine and set our parallel worker number. */
-	Assert(ParallelWorkerNumber == -1);
-	memcpy(&ParallelWorkerNumber, MyBgworkerEntry->bgw_extra, sizeof(int));
+	Assert(ParallelWorkerNumber >= 0);
 
 	/* Set up a memory context to work in, just for cleanliness. */
-	CurrentMemoryContext = AllocSetContextCreate(TopMemoryContext,
-												 "Parallel worker",
-												 ALLOCSET_DEFAULT_SIZES);
+	jobcontext = AllocSetContextCreate(TopMemoryContext,
+									   "Parallel worker",
+									   ALLOCSET_DEFAULT_SIZES);
+	MemoryContextSwitchTo(jobcontext);
 
 	/*
 	 * Attach to the dynamic shared memory segment for the parallel query, and
@@ -1252,7 +1486,7 @@ ParallelWorkerMain(Datum main_arg)
 	 * exit, which is fine.  If there were a ResourceOwner, it would acquire
 	 * ownership of the mapping, but we have no need for that.
 	 */
-	seg = dsm_attach(DatumGetUInt32(main_arg));
+	seg = dsm_attach(handle);
 	if (seg == NULL)
 		ereport(ERROR,
 				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
@@ -1267,10 +1501,15 @@ ParallelWorkerMain(Datum main_arg)
 	fps = shm_toc_lookup(toc, PARALLEL_KEY_FIXED, false);
 	MyFixedParallelState = fps;
 
-	/* Arrange to signal the leader if we exit. */
+	/*
+	 * Arrange to signal the leader if we exit.  A pooled worker has done that
+	 * already, and is connected to a database.
+	 */
+	ParallelMasterProc = fps->parallel_master_pgproc;
 	ParallelMasterPid = fps->parallel_master_pid;
 	ParallelMasterBackendId = fps->parallel_master_backend_id;
-	on_shmem_exit(ParallelWorkerShutdown, (Datum) 0);
+	if (!OidIsValid(MyDatabaseId))
+		on_shmem_exit(ParallelWorkerShutdown, (Datum) 0);
 
 	/*
 	 * Now we can find and attach to the error queue provided for us.  That's
@@ -1315,7 +1554,7 @@ ParallelWorkerMain(Datum main_arg)
 	 */
 	if (!BecomeLockGroupMember(fps->parallel_master_pgproc,
 							   fps->parallel_master_pid))
-		return;
+		return false;
 
 	/*
 	 * Restore transaction and statement start-time timestamps.  This must
@@ -1335,16 +1574,20 @@ ParallelWorkerMain(Datum main_arg)
 
 	entrypt = LookupParallelWorkerFunction(library_name, function_name);
 
-	/* Restore database connection. */
-	BackgroundWorkerInitializeConnectionByOid(fps->database_id,
-											  fps->authenticated_user_id,
-											  0);
+	/* Restore database connection, unless kept from an earlier job. */
+	if (!OidIsValid(MyDatabaseId))
+	{
+		BackgroundWorkerInitializeConnectionByOid(fps->database_id,
+												  fps->authenticated_user_id,
+												  0);
 
-	/*
-	 * Set the client encoding to the database encoding, since that is what
-	 * the leader will expect.
-	 */
-	SetClientEncoding(GetDatabaseEncoding());
+		/*
+		 * Set the client encoding to the database encoding, since that is
+		 * what the leader will expect.
+		 */
+		SetClientEncoding(GetDatabaseEncoding());
+	}
+	Assert(MyDatabaseId == fps->database_id);
 
 	/*
 	 * Load libraries that were loaded by original backend.  We want to do
@@ -1384,9 +1627,14 @@ ParallelWorkerMain(Datum main_arg)
 
 	/*
 	 * We've changed which tuples we can see, and must therefore invalidate
-	 * system caches.
+	 * system caches.  A pooled worker's caches were built from committed
+	 * catalog contents and have been kept current by invalidation messages,
+	 * so it can skip this unless this leader's transaction, or the one of the
+	 * leader before, may have modified the catalogs.
 	 */
-	InvalidateSystemCaches();
+	if (ParallelWorkerCachesDirty || fps->xact_has_xid)
+		InvalidateSystemCaches();
+	ParallelWorkerCachesDirty = fps->xact_has_xid;
 
 	/*
 	 * Restore current role id.  Skip verifying whether session user is
@@ -1444,6 +1692,27 @@ ParallelWorkerMain(Datum main_arg)
 
 	/* Report success. */
 	pq_putmessage('X', NULL, 0);
+
+	/* Exit, unless this process could go to the worker pool. */
+	if (MyPoolSlot < 0 && parallel_worker_pool_size == 0)
+		return false;
+
+	/* Let go of the leader and its parallel context. */
+	if (!LeaveLockGroup())
+		return false;
+	debug_query_string = NULL;
+	dsm_detach(seg);
+	MyFixedParallelState = NULL;
+	ParallelMasterPid = 0;
+	ParallelWorkerNumber = -1;
+
+	pgstat_report_stat(true);
+	pgstat_report_activity(STATE_IDLE, NULL);
+
+	MemoryContextSwitchTo(TopMemoryContext);
+	MemoryContextDelete(jobcontext);
+
+	return true;
 }
 
 /*
@@ -1471,6 +1740,10 @@ ParallelWorkerReportLastRecEnd(XLogRecPtr last_xlog_end)
 static void
 ParallelWorkerShutdown(int code, Datum arg)
 {
+	/* Nothing to do for a pooled worker between jobs */
+	if (ParallelMasterPid == 0)
+		return;
+
 	SendProcSignal(ParallelMasterPid,
 				   PROCSIG_PARALLEL_MESSAGE,
 				   ParallelMasterBackendId);
@@ -1519,3 +1792,311 @@ LookupParallelWorkerFunction(const char *libraryname, const char *funcname)
 	return (parallel_worker_main_type)
 		load_external_function(libraryname, funcname, true, NULL);
 }
+
+/*
+ * Report the amount of shared memory needed for the parallel worker pool.
+ */
+Size
+ParallelWorkerPoolShmemSize(void)
+{
+	Size		size;
+
+	/* Every background worker slot could hold a pooled worker. */
+	size = offsetof(ParallelWorkerPoolData, slots);
+	size = add_size(size, mul_size(max_worker_processes,
+								   sizeof(ParallelWorkerPoolSlot)));
+
+	return size;
+}
+
+/*
+ * Initialize the parallel worker pool in shared memory.
+ */
+void
+ParallelWorkerPoolShmemInit(void)
+{
+	bool		found;
+
+	ParallelWorkerPool = ShmemInitStruct("Parallel Worker Pool",
+										 ParallelWorkerPoolShmemSize(),
+										 &found);
+	if (!found)
+	{
+		SpinLockInit(&ParallelWorkerPool->mutex);
+		ParallelWorkerPool->nslots = max_worker_processes;
+		memset(ParallelWorkerPool->slots, 0,
+			   mul_size(max_worker_processes, sizeof(ParallelWorkerPoolSlot)));
+	}
+}
+
+/*
+ * Ask the pooled workers connected to the given database to exit, so that
+ * they don't stand in the way of dropping it.  Workers that are busy exit
+ * once done.
+ */
+void
+TerminatePooledParallelWorkers(Oid databaseId)
+{
+	PGPROC	  **procs;
+	int			nprocs = 0;
+	int			n;
+
+	procs = palloc(sizeof(PGPROC *) * ParallelWorkerPool->nslots);
+
+	SpinLockAcquire(&ParallelWorkerPool->mutex);
+	for (n = 0; n < ParallelWorkerPool->nslots; n++)
+	{
+		ParallelWorkerPoolSlot *slot = &ParallelWorkerPool->slots[n];
+
+		if (slot->pid != 0 && slot->database_id == databaseId &&
+			!slot->exit_requested)
+		{
+			slot->exit_requested = true;
+			procs[nprocs++] = slot->proc;
+		}
+	}
+	SpinLockRelease(&ParallelWorkerPool->mutex);
+
+	for (n = 0; n < nprocs; n++)
+		SetLatch(&procs[n]->procLatch);
+
+	pfree(procs);
+}
+
+/*
+ * Try to hand worker number i of a parallel context to an idle pooled worker
+ * connected to our database as our authenticated user.  Returns true if one
+ * was found.
+ */
+static bool
+ParallelWorkerPoolAssign(ParallelContext *pcxt, int i)
+{
+	Oid			userid = GetAuthenticatedUserId();
+	PGPROC	   *proc = NULL;
+	int			n;
+
+	SpinLockAcquire(&ParallelWorkerPool->mutex);
+	for (n = 0; n < ParallelWorkerPool->nslots; n++)
+	{
+		ParallelWorkerPoolSlot *slot = &ParallelWorkerPool->slots[n];
+
+		if (slot->pid == 0 || slot->busy || slot->exit_requested ||
+			slot->database_id != MyDatabaseId ||
+			slot->authenticated_user_id != userid)
+			continue;
+
+		slot->busy = true;
+		slot->generation++;
+		slot->seg_handle = dsm_segment_handle(pcxt->seg);
+		slot->worker_number = i;
+		slot->leader = MyProc;
+		pcxt->worker[i].pool_slot = n;
+		pcxt->worker[i].pool_generation = slot->generation;
+		proc = slot->proc;
+		break;
+	}
+	SpinLockRelease(&ParallelWorkerPool->mutex);
+
+	if (proc == NULL)
+		return false;
+
+	SetLatch(&proc->procLatch);
+
+	return true;
+}
+
+/*
+ * Ask idle pooled workers to exit while the pool has more workers than
+ * parallel_worker_pool_size, as happens when the setting is lowered.  If
+ * make_room is true, ask at least one to exit anyway, to free a background
+ * worker slot; the caller has already taken any idle worker it could use.
+ */
+static void
+ParallelWorkerPoolShrink(bool make_room)
+{
+	PGPROC	  **procs;
+	int			nprocs = 0;
+	int			nmembers = 0;
+	int			nexcess;
+	int			n;
+
+	procs = palloc(sizeof(PGPROC *) * ParallelWorkerPool->nslots);
+
+	SpinLockAcquire(&ParallelWorkerPool->mutex);
+	for (n = 0; n < ParallelWorkerPool->nslots; n++)
+	{
+		ParallelWorkerPoolSlot *slot = &ParallelWorkerPool->slots[n];
+
+		if (slot->pid != 0 && !slot->exit_requested)
+			nmembers++;
+	}
+
+	nexcess = nmembers - parallel_worker_pool_size;
+	if (make_room)
+		nexcess = Max(nexcess, 1);
+
+	for (n = 0; n < ParallelWorkerPool->nslots && nexcess > 0; n++)
+	{
+		ParallelWorkerPoolSlot *slot = &ParallelWorkerPool->slots[n];
+
+		if (slot->pid != 0 && !slot->busy && !slot->exit_requested)
+		{
+			slot->exit_requested = true;
+			procs[nprocs++] = slot->proc;
+			nexcess--;
+		}
+	}
+	SpinLockRelease(&ParallelWorkerPool->mutex);
+
+	for (n = 0; n < nprocs; n++)
+		SetLatch(&procs[n]->procLatch);
+
+	pfree(procs);
+}
+
+/*
+ * Join the worker pool, if it has room.  Returns true if successful.
+ */
+static bool
+ParallelWorkerPoolJoin(void)
+{
+	Oid			userid = GetAuthenticatedUserId();
+	int			nmembers = 0;
+	int			freeslot = -1;
+	int			n;
+
+	Assert(MyPoolSlot < 0);
+
+	SpinLockAcquire(&ParallelWorkerPool->mutex);
+	for (n = 0; n < ParallelWorkerPool->nslots; n++)
+	{
+		if (ParallelWorkerPool->slots[n].pid != 0)
+			nmembers++;
+		else if (freeslot < 0)
+			freeslot = n;
+	}
+
+	if (freeslot >= 0 && nmembers < parallel_worker_pool_size)
+	{
+		ParallelWorkerPoolSlot *slot = &ParallelWorkerPool->slots[freeslot];
+
+		slot->pid = MyProcPid;
+		slot->proc = MyProc;
+		slot->database_id = MyDatabaseId;
+		slot->authenticated_user_id = userid;
+		slot->busy = false;
+		slot->exit_requested = false;
+		slot->leader = NULL;
+		MyPoolSlot = freeslot;
+	}
+	SpinLockRelease(&ParallelWorkerPool->mutex);
+
+	if (MyPoolSlot < 0)
+		return false;
+
+	on_shmem_exit(ParallelWorkerPoolShutdown, (Datum) 0);
+
+	return true;
+}
+
+/*
+ * Wait in the worker pool for another parallel context to work for.
+ *
+ * This is called by a worker that has finished with its parallel context,
+ * and joins the pool first if it isn't in it yet.  Returns true, with
+ * *handle and ParallelWorkerNumber set, once a leader assigns us to its
+ * parallel context, or false if we should exit instead.
+ */
+static bool
+ParallelWorkerPoolWait(dsm_handle *handle)
+{
+	ParallelWorkerPoolSlot *slot;
+	bool		exit_requested;
+
+	if (MyPoolSlot < 0 && !ParallelWorkerPoolJoin())
+		return false;
+	slot = &ParallelWorkerPool->slots[MyPoolSlot];
+
+	/* Tell the leader we're done with its parallel context. */
+	SpinLockAcquire(&ParallelWorkerPool->mutex);
+	slot->busy = false;
+	slot->leader = NULL;
+	exit_requested = slot->exit_requested;
+	if (exit_requested)
+		slot->pid = 0;
+	SpinLockRelease(&ParallelWorkerPool->mutex);
+
+	SetLatch(&ParallelMasterProc->procLatch);
+	ParallelMasterProc = NULL;
+
+	if (exit_requested)
+	{
+		MyPoolSlot = -1;
+		return false;
+	}
+
+	for (;;)
+	{
+		bool		assigned = false;
+
+		SpinLockAcquire(&ParallelWorkerPool->mutex);
+		if (slot->busy)
+		{
+			assigned = true;
+			*handle = slot->seg_handle;
+			ParallelWorkerNumber = slot->worker_number;
+		}
+		else if (slot->exit_requested)
+		{
+			exit_requested = true;
+			slot->pid = 0;
+		}
+		SpinLockRelease(&ParallelWorkerPool->mutex);
+
+		if (assigned)
+			return true;
+		if (exit_requested)
+		{
+			MyPoolSlot = -1;
+			return false;
+		}
+
+		(void) WaitLatch(MyLatch, WL_LATCH_SET | WL_EXIT_ON_PM_DEATH, -1,
+						 WAIT_EVENT_PARALLEL_WORKER_POOL_MAIN);
+		ResetLatch(MyLatch);
+
+		CHECK_FOR_INTERRUPTS();
+
+		/* Keep up with invalidation messages, so that our caches stay valid. */
+		if (catchupInterruptPending)
+			ProcessCatchupInterrupt();
+	}
+}
+
+/*
+ * Leave the worker pool at process exit, and make sure a leader waiting for
+ * us notices, even if we never got as far as attaching to its segment.
+ */
+static void
+ParallelWorkerPoolShutdown(int code, Datum arg)
+{
+	ParallelWorkerPoolSlot *slot;
+	PGPROC	   *leader = NULL;
+
+	if (MyPoolSlot < 0)
+		return;
+
+	slot = &ParallelWorkerPool->slots[MyPoolSlot];
+	SpinLockAcquire(&ParallelWorkerPool->mutex);
+	if (slot->busy)
+		leader = slot->leader;
+	slot->busy = false;
+	slot->leader = NULL;
+	slot->pid = 0;
+	SpinLockRelease(&ParallelWorkerPool->mutex);
+	MyPoolSlot = -1;
+
+	if (leader != NULL)
+		SendProcSignal(leader->pid, PROCSIG_PARALLEL_MESSAGE,
+					   leader->backendId);
+}
@@ -7,17 +7,22 @@
  * buffers.  Under ordinary circumstances we expect that write
  * traffic will occur mostly to the latest page (and to the just-prior
  * page, soon after a page transition).  Read traffic will probably touch
- * a larger span of pages, but in any case a fairly small number of page
- * buffers should be sufficient.  So, we just search the buffers using plain
- * linear search; there's no need for a hashtable or anything fancy.
- * The management algorithm is straight LRU except that we will never swap
- * out the latest page (since we know it's going to be hit again eventually).
+ * a larger span of pages.  The buffers are divided into banks of
+ * SLRU_BANK_SIZE slots, and a given page can only live in one bank
+ * (pageno % num_banks), so we just search that bank using plain linear
+ * search; there's no need for a hashtable or anything fancy, even when the
+ * pool is configured to be large.  The management algorithm is straight LRU
+ * within the bank except that we will never swap out the latest page (since
+ * we know it's going to be hit again eventually).
  *
  * We use a control LWLock to protect the shared data structures, plus
- * per-buffer LWLocks that synchronize I/O for each buffer.  The control lock
- * must be held to examine or modify any shared state.  A process that is
- * reading in or writing out a page buffer does not hold the control lock,
- * only the per-buffer lock for the buffer it is working on.
+ * per-buffer LWLocks that synchronize I/O for each buffer.  An SLRU can
+ * either have a single control lock covering all banks, or one control lock
+ * per bank (see SimpleLruGetBankLock()); in the latter case accesses to
+ * pages in different banks don't contend with each other.  The control lock
+ * of a bank must be held to examine or modify its shared state.  A process
+ * that is reading in or writing out a page buffer does not hold the control
+ * lock, only the per-buffer lock for the buffer it is working on.
  *
  * "Holding the control lock" means exclusive lock in all cases except for
  * SimpleLruReadPage_ReadOnly(); see comments for SlruRecentlyUsed() for
@@ -58,6 +63,7 @@
 #include "storage/fd.h"
 #include "storage/shmem.h"
 #include "miscadmin.h"
+#include "utils/guc.h"
 
 
 #define SlruFileName(ctl, path, seg) \
@@ -93,7 +99,7 @@ typedef struct SlruFlushData *SlruFlush;
  * We allow this code to be executed concurrently by multiple processes within
  * SimpleLruReadPage_ReadOnly().  As long as int reads and writes are atomic,
  * this should not cause any completely-bogus values to enter the computation.
- * However, it is possible for either cur_lru_count or individual
+ * However, it is possible for either the bank's cur_lru_count or individual
  * page_lru_count entries to be "reset" to lower values than they should have,
  * in case a process is delayed while it executes this macro.  With care in
  * SlruSelectLRUPage(), this does little harm, and in any case the absolute
@@ -102,13 +108,26 @@ typedef struct SlruFlushData *SlruFlush;
  */
 #define SlruRecentlyUsed(shared, slotno)	\
 	do { \
-		int		new_lru_count = (shared)->cur_lru_count; \
+		int	   *cur_lru_count = \
+			&(shared)->bank_cur_lru_count[(slotno) / (shared)->bank_size]; \
+		int		new_lru_count = *cur_lru_count; \
 		if (new_lru_count != (shared)->page_lru_count[slotno]) { \
-			(shared)->cur_lru_count = ++new_lru_count; \
+			*cur_lru_count = ++new_lru_count; \
 			(shared)->page_lru_count[slotno] = new_lru_count; \
 		} \
 	} while (0)
 
+/*
+ * Control lock protecting the bank that holds the given slot.
+ */
+static inline LWLock *
+SlruSlotLock(SlruShared shared, int slotno)
+{
+	if (shared->ControlLock != NULL)
+		return shared->ControlLock;
+	return &shared->bank_locks[slotno / shared->bank_size].lock;
+}
+
 /* Saved info for SlruReportIOError */
 typedef enum
 {
@@ -137,6 +156,17 @@ static bool SlruScanDirCbDeleteCutoff(SlruCtl ctl, char *filename,
 									  int segpage, void *data);
 static void SlruInternalDeleteSegment(SlruCtl ctl, char *filename);
 
+/*
+ * Number of banks an SLRU with nslots buffers is divided into.
+ */
+static int
+SlruNumBanks(int nslots)
+{
+	if (nslots % SLRU_BANK_SIZE != 0)
+		return 1;
+	return nslots / SLRU_BANK_SIZE;
+}
+
 /*
  * Initialization of shared memory
  */
@@ -144,6 +174,7 @@ static void SlruInternalDeleteSegment(SlruCtl ctl, char *filename);
 Size
 SimpleLruShmemSize(int nslots, int nlsns)
 {
+	int			nbanks = SlruNumBanks(nslots);
 	Size		sz;
 
 	/* we assume nslots isn't so large as to risk overflow */
@@ -153,7 +184,9 @@ SimpleLruShmemSize(int nslots, int nlsns)
 	sz += MAXALIGN(nslots * sizeof(bool));	/* page_dirty[] */
 	sz += MAXALIGN(nslots * sizeof(int));	/* page_number[] */
 	sz += MAXALIGN(nslots * sizeof(int));	/* page_lru_count[] */
+	sz += MAXALIGN(nbanks * sizeof(int));	/* bank_cur_lru_count[] */
 	sz += MAXALIGN(nslots * sizeof(LWLockPadded));	/* buffer_locks[] */
+	sz += MAXALIGN(nbanks * sizeof(LWLockPadded));	/* bank_locks[] */
 
 	if (nlsns > 0)
 		sz += MAXALIGN(nslots * nlsns * sizeof(XLogRecPtr));	/* group_lsn[] */
@@ -161,12 +194,22 @@ SimpleLruShmemSize(int nslots, int nlsns)
 	return BUFFERALIGN(sz) + BLCKSZ * nslots;
 }
 
+/*
+ * Initialize, or attach to, a simple LRU cache in shared memory.
+ *
+ * If ctllock is NULL, each bank gets its own control lock in tranche
+ * bank_tranche_id; callers must then use SimpleLruGetBankLock() to find the
+ * lock protecting a page.  Otherwise ctllock protects the whole SLRU and
+ * bank_tranche_id is ignored.
+ */
 void
 SimpleLruInit(SlruCtl ctl, const char *name, int nslots, int nlsns,
-			  LWLock *ctllock, const char *subdir, int tranche_id)
+			  LWLock *ctllock, const char *subdir, int tranche_id,
+			  int bank_tranche_id)
 {
 	SlruShared	shared;
 	bool		found;
+	int			nbanks = SlruNumBanks(nslots);
 
 	shared = (SlruShared) ShmemInitStruct(name,
 										  SimpleLruShmemSize(nslots, nlsns),
@@ -178,6 +221,7 @@ SimpleLruInit(SlruCtl ctl, const char *name, int nslots, int nlsns,
 		char	   *ptr;
 		Size		offset;
 		int			slotno;
+		int			bankno;
 
 		Assert(!found);
 
@@ -186,10 +230,10 @@ SimpleLruInit(SlruCtl ctl, const char *name, int nslots, int nlsns,
 		shared->ControlLock = ctllock;
 
 		shared->num_slots = nslots;
+		shared->num_banks = nbanks;
+		shared->bank_size = nslots / nbanks;
 		shared->lsn_groups_per_page = nlsns;
 
-		shared->cur_lru_count = 0;
-
 		/* shared->latest_page_number will be set later */
 
 		ptr = (char *) shared;
@@ -204,10 +248,14 @@ SimpleLruInit(SlruCtl ctl, const char *name, int nslots, int nlsns,
 		offset += MAXALIGN(nslots * sizeof(int));
 		shared->page_lru_count = (int *) (ptr + offset);
 		offset += MAXALIGN(nslots * sizeof(int));
+		shared->bank_cur_lru_count = (int *) (ptr + offset);
+		offset += MAXALIGN(nbanks * sizeof(int));
 
 		/* Initialize LWLocks */
 		shared->buffer_locks = (LWLockPadded *) (ptr + offset);
 		offset += MAXALIGN(nslots * sizeof(LWLockPadded));
+		shared->bank_locks = (LWLockPadded *) (ptr + offset);
+		offset += MAXALIGN(nbanks * sizeof(LWLockPadded));
 
 		if (nlsns > 0)
 		{
@@ -215,9 +263,20 @@ SimpleLruInit(SlruCtl ctl, const char *name, int nslots, int nlsns,
 			offset += MAXALIGN(nslots * nlsns * sizeof(XLogRecPtr));
 		}
 
-		Assert(strlen(name) + 1 < SLRU_MAX_NAME_LENGTH);
+		Assert(strlen(name) + sizeof("_bank") < SLRU_MAX_NAME_LENGTH);
 		strlcpy(shared->lwlock_tranche_name, name, SLRU_MAX_NAME_LENGTH);
 		shared->lwlock_tranche_id = tranche_id;
+		snprintf(shared->bank_tranche_name, SLRU_MAX_NAME_LENGTH, "%s_bank",
+				 name);
+		shared->bank_tranche_id = bank_tranche_id;
+
+		for (bankno = 0; bankno < nbanks; bankno++)
+		{
+			if (ctllock == NULL)
+				LWLockInitialize(&shared->bank_locks[bankno].lock,
+								 shared->bank_tranche_id);
+			shared->bank_cur_lru_count[bankno] = 0;
+		}
 
 		ptr += BUFFERALIGN(offset);
 		for (slotno = 0; slotno < nslots; slotno++)
@@ -238,9 +297,12 @@ SimpleLruInit(SlruCtl ctl, const char *name, int nslots, int nlsns,
 	else
 		Assert(found);
 
-	/* Register SLRU tranche in the main tranches array */
+	/* Register SLRU tranches in the main tranches array */
 	LWLockRegisterTranche(shared->lwlock_tranche_id,
 						  shared->lwlock_tranche_name);
+	if (shared->ControlLock == NULL)
+		LWLockRegisterTranche(shared->bank_tranche_id,
+							  shared->bank_tranche_name);
 
 	/*
 	 * Initialize the unshared control struct, including directory path. We
@@ -251,13 +313,44 @@ SimpleLruInit(SlruCtl ctl, const char *name, int nslots, int nlsns,
 	StrNCpy(ctl->Dir, subdir, sizeof(ctl->Dir));
 }
 
+/*
+ * Pick a number of buffers for an SLRU whose size was left to be chosen
+ * automatically: 1/divisor of shared_buffers, rounded down to a whole number
+ * of banks, but at least one bank and at most max buffers.
+ */
+int
+SimpleLruAutotuneBuffers(int divisor, int max)
+{
+	int			nslots = Min(NBuffers / divisor, max);
+
+	nslots -= nslots % SLRU_BANK_SIZE;
+	return Max(nslots, SLRU_BANK_SIZE);
+}
+
+/*
+ * Helper for the check hooks of the *_buffers GUCs: the number of buffers
+ * must be a whole number of banks.  Zero is let through, for the GUCs that
+ * use it to request SimpleLruAutotuneBuffers().
+ */
+bool
+check_slru_buffers(const char *name, int *newval)
+{
+	if (*newval % SLRU_BANK_SIZE == 0)
+		return true;
+
+	GUC_check_errdetail("\"%s\" must be a multiple of %d.", name,
+						SLRU_BANK_SIZE);
+	return false;
+}
+
 /*
  * Initialize (or reinitialize) a page to zeroes.
  *
  * The page is not actually written, just set up in shared memory.
  * The slot number of the new page is returned.
  *
- * Control lock must be held at entry, and will be held at exit.
+ * Control lock for the page's bank must be held at entry, and will be held
+ * at exit.
  */
 int
 SimpleLruZeroPage(SlruCtl ctl, int pageno)
@@ -321,12 +414,13 @@ static void
 SimpleLruWaitIO(SlruCtl ctl, int slotno)
 {
 	SlruShared	shared = ctl->shared;
+	LWLock	   *lock = SlruSlotLock(shared, slotno);
 
 	/* See notes at top of file */
-	LWLockRelease(shared->ControlLock);
+	LWLockRelease(lock);
 	LWLockAcquire(&shared->buffer_locks[slotno].lock, LW_SHARED);
 	LWLockRelease(&shared->buffer_locks[slotno].lock);
-	LWLockAcquire(shared->ControlLock, LW_EXCLUSIVE);
+	LWLockAcquire(lock, LW_EXCLUSIVE);
 
 	/*
 	 * If the slot is still in an io-in-progress state, then either someone
@@ -421,7 +515,7 @@ SimpleLruReadPage(SlruCtl ctl, int pageno, bool write_ok,
 		LWLockAcquire(&shared->buffer_locks[slotno].lock, LW_EXCLUSIVE);
 
 		/* Release control lock while doing I/O */
-		LWLockRelease(shared->ControlLock);
+		LWLockRelease(SlruSlotLock(shared, slotno));
 
 		/* Do the read */
 		ok = SlruPhysicalReadPage(ctl, pageno, slotno);
@@ -430,7 +524,7 @@ SimpleLruReadPage(SlruCtl ctl, int pageno, bool write_ok,
 		SimpleLruZeroLSNs(ctl, slotno);
 
 		/* Re-acquire control lock and update page state */
-		LWLockAcquire(shared->ControlLock, LW_EXCLUSIVE);
+		LWLockAcquire(SlruSlotLock(shared, slotno), LW_EXCLUSIVE);
 
 		Assert(shared->page_number[slotno] == pageno &&
 			   shared->page_status[slotno] == SLRU_PAGE_READ_IN_PROGRESS &&
@@ -467,13 +561,16 @@ int
 SimpleLruReadPage_ReadOnly(SlruCtl ctl, int pageno, TransactionId xid)
 {
 	SlruShared	shared = ctl->shared;
+	LWLock	   *lock = SimpleLruGetBankLock(ctl, pageno);
+	int			bankstart = ((uint32) pageno % shared->num_banks) * shared->bank_size;
+	int			bankend = bankstart + shared->bank_size;
 	int			slotno;
 
 	/* Try to find the page while holding only shared lock */
-	LWLockAcquire(shared->ControlLock, LW_SHARED);
+	LWLockAcquire(lock, LW_SHARED);
 
 	/* See if page is already in a buffer */
-	for (slotno = 0; slotno < shared->num_slots; slotno++)
+	for (slotno = bankstart; slotno < bankend; slotno++)
 	{
 		if (shared->page_number[slotno] == pageno &&
 			shared->page_status[slotno] != SLRU_PAGE_EMPTY &&
@@ -486,8 +583,8 @@ SimpleLruReadPage_ReadOnly(SlruCtl ctl, int pageno, TransactionId xid)
 	}
 
 	/* No luck, so switch to normal exclusive lock and do regular read */
-	LWLockRelease(shared->ControlLock);
-	LWLockAcquire(shared->ControlLock, LW_EXCLUSIVE);
+	LWLockRelease(lock);
+	LWLockAcquire(lock, LW_EXCLUSIVE);
 
 	return SimpleLruReadPage(ctl, pageno, true, xid);
 }
@@ -537,7 +634,7 @@ SlruInternalWritePage(SlruCtl ctl, int slotno, SlruFlush fdata)
 	LWLockAcquire(&shared->buffer_locks[slotno].lock, LW_EXCLUSIVE);
 
 	/* Release control lock while doing I/O */
-	LWLockRelease(shared->ControlLock);
+	LWLockRelease(SlruSlotLock(shared, slotno));
 
 	/* Do the write */
 	ok = SlruPhysicalWritePage(ctl, pageno, slotno, fdata);
@@ -552,7 +649,7 @@ SlruInternalWritePage(SlruCtl ctl, int slotno, SlruFlush fdata)
 	}
 
 	/* Re-acquire control lock and update page state */
-	LWLockAcquire(shared->ControlLock, LW_EXCLUSIVE);
+	LWLockAcquire(SlruSlotLock(shared, slotno), LW_EXCLUSIVE);
 
 	Assert(shared->page_number[slotno] == pageno &&
 		   shared->page_status[slotno] == SLRU_PAGE_WRITE_IN_PROGRESS);
@@ -964,14 +1061,18 @@ SlruReportIOError(SlruCtl ctl, int pageno, TransactionId xid)
  * any slot already holds the target page, and return that slot if so.
  * Thus, the returned slot is *either* a slot already holding the pageno
  * (could be any state except EMPTY), *or* a freeable slot (state EMPTY
- * or CLEAN).
+ * or CLEAN).  Only the slots of the page's bank are considered.
  *
- * Control lock must be held at entry, and will be held at exit.
+ * Control lock for the page's bank must be held at entry, and will be held
+ * at exit.
  */
 static int
 SlruSelectLRUPage(SlruCtl ctl, int pageno)
 {
 	SlruShared	shared = ctl->shared;
+	int			bankno = (uint32) pageno % shared->num_banks;
+	int			bankstart = bankno * shared->bank_size;
+	int			bankend = bankstart + shared->bank_size;
 
 	/* Outer loop handles restart after I/O */
 	for (;;)
@@ -986,7 +1087,7 @@ SlruSelectLRUPage(SlruCtl ctl, int pageno)
 		int			best_invalid_page_number = 0;	/* keep compiler quiet */
 
 		/* See if page already has a buffer assigned */
-		for (slotno = 0; slotno < shared->num_slots; slotno++)
+		for (slotno = bankstart; slotno < bankend; slotno++)
 		{
 			if (shared->page_number[slotno] == pageno &&
 				shared->page_status[slotno] != SLRU_PAGE_EMPTY)
@@ -1012,16 +1113,16 @@ SlruSelectLRUPage(SlruCtl ctl, int pageno)
 		 * acquire the same lru_count values.  In that case we break ties by
 		 * choosing the furthest-back page.
 		 *
-		 * Notice that this next line forcibly advances cur_lru_count to a
-		 * value that is certainly beyond any value that will be in the
-		 * page_lru_count array after the loop finishes.  This ensures that
-		 * the next execution of SlruRecentlyUsed will mark the page newly
-		 * used, even if it's for a page that has the current counter value.
-		 * That gets us back on the path to having good data when there are
-		 * multiple pages with the same lru_count.
+		 * Notice that this next line forcibly advances the bank's
+		 * cur_lru_count to a value that is certainly beyond any value that
+		 * will be in the bank's page_lru_count entries after the loop
+		 * finishes.  This ensures that the next execution of SlruRecentlyUsed
+		 * will mark the page newly used, even if it's for a page that has the
+		 * current counter value.  That gets us back on the path to having
+		 * good data when there are multiple pages with the same lru_count.
 		 */
-		cur_count = (shared->cur_lru_count)++;
-		for (slotno = 0; slotno < shared->num_slots; slotno++)
+		cur_count = (shared->bank_cur_lru_count[bankno])++;
+		for (slotno = bankstart; slotno < bankend; slotno++)
 		{
 			int			this_delta;
 			int			this_page_number;
@@ -1114,16 +1215,24 @@ SimpleLruFlush(SlruCtl ctl, bool allow_redirtied)
 	int			pageno = 0;
 	int			i;
 	bool		ok;
+	LWLock	   *lock = NULL;
 
 	/*
-	 * Find and write dirty pages
+	 * Find and write dirty pages, holding each bank's lock while we process
+	 * its slots.
 	 */
 	fdata.num_files = 0;
 
-	LWLockAcquire(shared->ControlLock, LW_EXCLUSIVE);
-
 	for (slotno = 0; slotno < shared->num_slots; slotno++)
 	{
+		if (SlruSlotLock(shared, slotno) != lock)
+		{
+			if (lock != NULL)
+				LWLockRelease(lock);
+			lock = SlruSlotLock(shared, slotno);
+			LWLockAcquire(lock, LW_EXCLUSIVE);
+		}
+
 		SlruInternalWritePage(ctl, slotno, &fdata);
 
 		/*
@@ -1137,7 +1246,8 @@ SimpleLruFlush(SlruCtl ctl, bool allow_redirtied)
 				!shared->page_dirty[slotno]));
 	}
 
-	LWLockRelease(shared->ControlLock);
+	if (lock != NULL)
+		LWLockRelease(lock);
 
 	/*
 	 * Now fsync and close any files that were open
@@ -1175,6 +1285,7 @@ SimpleLruTruncate(SlruCtl ctl, int cutoffPage)
 {
 	SlruShared	shared = ctl->shared;
 	int			slotno;
+	int			bankno;
 
 	/*
 	 * The cutoff point is the start of the segment containing cutoffPage.
@@ -1185,59 +1296,67 @@ SimpleLruTruncate(SlruCtl ctl, int cutoffPage)
 	 * Scan shared memory and remove any pages preceding the cutoff page, to
 	 * ensure we won't rewrite them later.  (Since this is normally called in
 	 * or just after a checkpoint, any dirty pages should have been flushed
-	 * already ... we're just being extra careful here.)
-	 */
-	LWLockAcquire(shared->ControlLock, LW_EXCLUSIVE);
-
-restart:;
-
-	/*
-	 * While we are holding the lock, make an important safety check: the
-	 * planned cutoff point must be <= the current endpoint page. Otherwise we
-	 * have already wrapped around, and proceeding with the truncation would
-	 * risk removing the current segment.
+	 * already ... we're just being extra careful here.)  Banks are processed
+	 * one at a time, each under its own lock.
 	 */
-	if (ctl->PagePrecedes(shared->latest_page_number, cutoffPage))
+	for (bankno = 0; bankno < shared->num_banks; bankno++)
 	{
-		LWLockRelease(shared->ControlLock);
-		ereport(LOG,
-				(errmsg("could not truncate directory \"%s\": apparent wraparound",
-						ctl->Dir)));
-		return;
-	}
+		int			bankstart = bankno * shared->bank_size;
+		int			bankend = bankstart + shared->bank_size;
+		LWLock	   *lock = SlruSlotLock(shared, bankstart);
 
-	for (slotno = 0; slotno < shared->num_slots; slotno++)
-	{
-		if (shared->page_status[slotno] == SLRU_PAGE_EMPTY)
-			continue;
-		if (!ctl->PagePrecedes(shared->page_number[slotno], cutoffPage))
-			continue;
+		LWLockAcquire(lock, LW_EXCLUSIVE);
+
+restart:;
 
 		/*
-		 * If page is clean, just change state to EMPTY (expected case).
+		 * While we are holding the lock, make an important safety check: the
+		 * planned cutoff point must be <= the current endpoint page.
+		 * Otherwise we have already wrapped around, and proceeding with the
+		 * truncation would risk removing the current segment.
 		 */
-		if (shared->page_status[slotno] == SLRU_PAGE_VALID &&
-			!shared->page_dirty[slotno])
+		if (ctl->PagePrecedes(shared->latest_page_number, cutoffPage))
 		{
-			shared->page_status[slotno] = SLRU_PAGE_EMPTY;
-			continue;
+			LWLockRelease(lock);
+			ereport(LOG,
+					(errmsg("could not truncate directory \"%s\": apparent wraparound",
+							ctl->Dir)));
+			return;
 		}
 
-		/*
-		 * Hmm, we have (or may have) I/O operations acting on the page, so
-		 * we've got to wait for them to finish and then start again. This is
-		 * the same logic as in SlruSelectLRUPage.  (XXX if page is dirty,
-		 * wouldn't it be OK to just discard it without writing it?  For now,
-		 * keep the logic the same as it was.)
-		 */
-		if (shared->page_status[slotno] == SLRU_PAGE_VALID)
-			SlruInternalWritePage(ctl, slotno, NULL);
-		else
-			SimpleLruWaitIO(ctl, slotno);
-		goto restart;
-	}
+		for (slotno = bankstart; slotno < bankend; slotno++)
+		{
+			if (shared->page_status[slotno] == SLRU_PAGE_EMPTY)
+				continue;
+			if (!ctl->PagePrecedes(shared->page_number[slotno], cutoffPage))
+				continue;
 
-	LWLockRelease(shared->ControlLock);
+			/*
+			 * If page is clean, just change state to EMPTY (expected case).
+			 */
+			if (shared->page_status[slotno] == SLRU_PAGE_VALID &&
+				!shared->page_dirty[slotno])
+			{
+				shared->page_status[slotno] = SLRU_PAGE_EMPTY;
+				continue;
+			}
+
+			/*
+			 * Hmm, we have (or may have) I/O operations acting on the page,
+			 * so we've got to wait for them to finish and then start again.
+			 * This is the same logic as in SlruSelectLRUPage.  (XXX if page
+			 * is dirty, wouldn't it be OK to just discard it without writing
+			 * it?  For now, keep the logic the same as it was.)
+			 */
+			if (shared->page_status[slotno] == SLRU_PAGE_VALID)
+				SlruInternalWritePage(ctl, slotno, NULL);
+			else
+				SimpleLruWaitIO(ctl, slotno);
+			goto restart;
+		}
+
+		LWLockRelease(lock);
+	}
 
 	/* Now we can remove the old segment(s) */
 	(void) SlruScanDirectory(ctl, SlruScanDirCbDeleteCutoff, &cutoffPage);
@@ -1268,54 +1387,75 @@ SlruDeleteSegment(SlruCtl ctl, int segno)
 {
 	SlruShared	shared = ctl->shared;
 	int			slotno;
+	int			bankno;
 	char		path[MAXPGPATH];
 	bool		did_write;
 
-	/* Clean out any possibly existing references to the segment. */
-	LWLockAcquire(shared->ControlLock, LW_EXCLUSIVE);
-restart:
-	did_write = false;
-	for (slotno = 0; slotno < shared->num_slots; slotno++)
-	{
-		int			pagesegno = shared->page_number[slotno] / SLRU_PAGES_PER_SEGMENT;
+	/*
+	 * Clean out any possibly existing references to the segment, one bank at
+	 * a time.  If the SLRU has a single control lock, we keep holding it
+	 * until the file is gone; with per-bank locks, callers must already make
+	 * sure nobody reads pages of the segment anymore.
+	 */
+	if (shared->ControlLock != NULL)
+		LWLockAcquire(shared->ControlLock, LW_EXCLUSIVE);
 
-		if (shared->page_status[slotno] == SLRU_PAGE_EMPTY)
-			continue;
+	for (bankno = 0; bankno < shared->num_banks; bankno++)
+	{
+		int			bankstart = bankno * shared->bank_size;
+		int			bankend = bankstart + shared->bank_size;
 
-		/* not the segment we're looking for */
-		if (pagesegno != segno)
-			continue;
+		if (shared->ControlLock == NULL)
+			LWLockAcquire(SlruSlotLock(shared, bankstart), LW_EXCLUSIVE);
 
-		/* If page is clean, just change state to EMPTY (expected case). */
-		if (shared->page_status[slotno] == SLRU_PAGE_VALID &&
-			!shared->page_dirty[slotno])
+restart:
+		did_write = false;
+		for (slotno = bankstart; slotno < bankend; slotno++)
 		{
-			shared->page_status[slotno] = SLRU_PAGE_EMPTY;
-			continue;
+			int			pagesegno = shared->page_number[slotno] / SLRU_PAGES_PER_SEGMENT;
+
+			if (shared->page_status[slotno] == SLRU_PAGE_EMPTY)
+				continue;
+
+			/* not the segment we're looking for */
+			if (pagesegno != segno)
+				continue;
+
+			/* If page is clean, just change state to EMPTY (expected case). */
+			if (shared->page_status[slotno] == SLRU_PAGE_VALID &&
+				!shared->page_dirty[slotno])
+			{
+				shared->page_status[slotno] = SLRU_PAGE_EMPTY;
+				continue;
+			}
+
+			/* Same logic as SimpleLruTruncate() */
+			if (shared->page_status[slotno] == SLRU_PAGE_VALID)
+				SlruInternalWritePage(ctl, slotno, NULL);
+			else
+				SimpleLruWaitIO(ctl, slotno);
+
+			did_write = true;
 		}
 
-		/* Same logic as SimpleLruTruncate() */
-		if (shared->page_status[slotno] == SLRU_PAGE_VALID)
-			SlruInternalWritePage(ctl, slotno, NULL);
-		else
-			SimpleLruWaitIO(ctl, slotno);
+		/*
+		 * Be extra careful and re-check. The IO functions release the
+		 * control lock, so new pages could have been read in.
+		 */
+		if (did_write)
+			goto restart;
 
-		did_write = true;
+		if (shared->ControlLock == NULL)
+			LWLockRelease(SlruSlotLock(shared, bankstart));
 	}
 
-	/*
-	 * Be extra careful and re-check. The IO functions release the control
-	 * lock, so new pages could have been read in.
-	 */
-	if (did_write)
-		goto restart;
-
 	snprintf(path, MAXPGPATH, "%s/%04X", ctl->Dir, segno);
 	ereport(DEBUG2,
 			(errmsg("removing file \"%s\"", path)));
 	unlink(path);
 
-	LWLockRelease(shared->ControlLock);
+	if (shared->ControlLock != NULL)
+		LWLockRelease(shared->ControlLock);
 }
 
 /*
@@ -77,11 +77,13 @@
 #include <unistd.h>
 
 #include "access/commit_ts.h"
+#include "access/discardworker.h"
 #include "access/htup_details.h"
 #include "access/subtrans.h"
 #include "access/transam.h"
 #include "access/twophase.h"
 #include "access/twophase_rmgr.h"
+#include "access/undolog.h"
 #include "access/xact.h"
 #include "access/xlog.h"
 #include "access/xloginsert.h"
@@ -1487,6 +1489,7 @@ FinishPreparedTransaction(const char *gid, bool isCommit)
 	int			i;
 	UndoRecPtr	start_urec_ptr[UndoPersistenceLevels];
 	UndoRecPtr	end_urec_ptr[UndoPersistenceLevels];
+	bool		wrote_undo = false;
 
 	/*
 	 * Validate the GID, and lock the GXACT to ensure that two backends do not
@@ -1527,6 +1530,11 @@ FinishPreparedTransaction(const char *gid, bool isCommit)
 	/* save the start and end undo record pointers */
 	memcpy(start_urec_ptr, hdr->start_urec_ptr, sizeof(start_urec_ptr));
 	memcpy(end_urec_ptr, hdr->end_urec_ptr, sizeof(end_urec_ptr));
+	for (i = 0; i < UndoPersistenceLevels; i++)
+	{
+		if (UndoRecPtrIsValid(end_urec_ptr[i]))
+			wrote_undo = true;
+	}
 
 	/* compute latestXid among all children */
 	latestXid = TransactionIdLatest(xid, hdr->nsubxacts, children);
@@ -1556,6 +1564,12 @@ FinishPreparedTransaction(const char *gid, bool isCommit)
 
 	ProcArrayRemove(proc, latestXid);
 
+	/*
+	 * As at the end of any other transaction, let the discard worker know if
+	 * this may have made some undo discardable.
+	 */
+	DiscardWorkerWakeupIfNeeded(xid, InvalidTransactionId, wrote_undo);
+
 	/*
 	 * In case we fail while running the callbacks, mark the gxact invalid so
 	 * no one else will try to commit/rollback, and so it will be recycled if
@@ -1670,6 +1684,7 @@ FinishPreparedTransaction(const char *gid, bool isCommit)
 				ResetUndoRequestInfo(&urinfo);
 				urinfo.dbid = MyDatabaseId;
 				urinfo.full_xid = full_xid;
+				urinfo.start_urec_ptr = start_urec_ptr[i];
 
 				if (i != UNDO_TEMP)
 					result = RegisterRollbackReq(end_urec_ptr[i],
@@ -1713,6 +1728,10 @@ FinishPreparedTransaction(const char *gid, bool isCommit)
 			}
 			PG_END_TRY();
 		}
+
+		/* Let others write to the undo log that was left to us. */
+		if (UndoRecPtrIsValid(end_urec_ptr[i]))
+			UndoLogReleasePrepared(xid, end_urec_ptr[i]);
 	}
 
 	RESUME_INTERRUPTS();
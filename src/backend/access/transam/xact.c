@@ -21,6 +21,7 @@
 #include <unistd.h>
 
 #include "access/commit_ts.h"
+#include "access/discardworker.h"
 #include "access/multixact.h"
 #include "access/parallel.h"
 #include "access/subtrans.h"
@@ -33,6 +34,7 @@
 #include "access/xlogutils.h"
 #include "access/tpd.h"
 #include "access/undorequest.h"
+#include "access/zkeysharelock.h"
 #include "catalog/namespace.h"
 #include "catalog/pg_enum.h"
 #include "catalog/storage.h"
@@ -223,6 +225,7 @@ typedef struct SerializedTransactionState
 	FullTransactionId topFullTransactionId;
 	FullTransactionId currentFullTransactionId;
 	CommandId	currentCommandId;
+	bool		currentCommandIdUsed;
 	int			nParallelCurrentXids;
 	TransactionId parallelCurrentXids[FLEXIBLE_ARRAY_MEMBER];
 } SerializedTransactionState;
@@ -334,6 +337,8 @@ static void CheckTransactionBlock(bool isTopLevel, bool throwError,
 								  const char *stmtType);
 static void CommitTransaction(void);
 static TransactionId RecordTransactionAbort(bool isSubXact);
+static void EndTransactionInProcArray(TransactionState s,
+									  TransactionId latestXid);
 static void StartTransaction(void);
 
 static void StartSubTransaction(void);
@@ -679,6 +684,11 @@ AssignTransactionId(TransactionState s)
 	 *
 	 * This is correct even for the case where several levels above us didn't
 	 * have an xid assigned as we recursed up to them beforehand.
+	 *
+	 * With wal_level = logical, every assignment is logged right away, so
+	 * that logical decoding knows which toplevel transaction a subxact's
+	 * changes belong to before the commit, and can stream in-progress
+	 * transactions including their subtransactions.
 	 */
 	if (isSubXact && XLogStandbyInfoActive())
 	{
@@ -690,7 +700,7 @@ AssignTransactionId(TransactionState s)
 		 * RecoverPreparedTransactions()
 		 */
 		if (nUnreportedXids >= PGPROC_MAX_CACHED_SUBXIDS ||
-			log_unknown_top)
+			log_unknown_top || XLogLogicalInfoActive())
 		{
 			xl_xact_assignment xlrec;
 
@@ -803,11 +813,12 @@ GetCurrentCommandId(bool used)
 	{
 		/*
 		 * Forbid setting currentCommandIdUsed in a parallel worker, because
-		 * we have no provision for communicating this back to the master.  We
-		 * could relax this restriction when currentCommandIdUsed was already
-		 * true at the start of the parallel operation.
+		 * we have no provision for communicating this back to the master.
+		 * It's OK if currentCommandIdUsed was already true at the start of
+		 * the parallel operation, as then there is nothing to communicate;
+		 * parallel COPY FROM relies on that.
 		 */
-		Assert(!IsParallelWorker());
+		Assert(!IsParallelWorker() || currentCommandIdUsed);
 		currentCommandIdUsed = true;
 	}
 	return currentCommandId;
@@ -2125,6 +2136,31 @@ StartTransaction(void)
 }
 
 
+/*
+ *	EndTransactionInProcArray
+ *
+ * Remove our transaction from the proc array, and then let the discard
+ * worker know if that may have made some undo discardable.
+ */
+static void
+EndTransactionInProcArray(TransactionState s, TransactionId latestXid)
+{
+	TransactionId xid = MyPgXact->xid;
+	TransactionId xmin = MyPgXact->xmin;
+	bool		wrote_undo = false;
+	int			i;
+
+	for (i = 0; i < UndoPersistenceLevels; i++)
+	{
+		if (UndoRecPtrIsValid(s->start_urec_ptr[i]))
+			wrote_undo = true;
+	}
+
+	ProcArrayEndTransaction(MyProc, latestXid);
+
+	DiscardWorkerWakeupIfNeeded(xid, xmin, wrote_undo);
+}
+
 /*
  *	CommitTransaction
  *
@@ -2261,7 +2297,7 @@ CommitTransaction(void)
 	 * must be done _before_ releasing locks we hold and _after_
 	 * RecordTransactionCommit.
 	 */
-	ProcArrayEndTransaction(MyProc, latestXid);
+	EndTransactionInProcArray(s, latestXid);
 
 	/*
 	 * This is all post-commit cleanup.  Note that if an error is raised here,
@@ -2302,6 +2338,7 @@ CommitTransaction(void)
 	AtEOXact_Inval(true);
 
 	AtEOXact_MultiXact();
+	AtEOXact_ZHeapKeyShareLocks();
 
 	ResourceOwnerRelease(TopTransactionResourceOwner,
 						 RESOURCE_RELEASE_LOCKS,
@@ -2537,6 +2574,7 @@ PrepareTransaction(UndoRecPtr *start_urec_ptr, UndoRecPtr *end_urec_ptr)
 	AtPrepare_PredicateLocks();
 	AtPrepare_PgStat();
 	AtPrepare_MultiXact();
+	AtPrepare_ZHeapKeyShareLocks();
 	AtPrepare_RelationMap();
 
 	/*
@@ -2593,6 +2631,8 @@ PrepareTransaction(UndoRecPtr *start_urec_ptr, UndoRecPtr *end_urec_ptr)
 	PostPrepare_smgr();
 
 	PostPrepare_MultiXact(xid);
+	PostPrepare_ZHeapKeyShareLocks(xid);
+	PostPrepare_UndoLogs(xid);
 
 	PostPrepare_Locks(xid);
 	PostPrepare_PredicateLocks(xid);
@@ -2788,7 +2828,7 @@ AbortTransaction(void)
 	 * must be done _before_ releasing locks we hold and _after_
 	 * RecordTransactionAbort.
 	 */
-	ProcArrayEndTransaction(MyProc, latestXid);
+	EndTransactionInProcArray(s, latestXid);
 
 	/*
 	 * Post-abort cleanup.  See notes in CommitTransaction() concerning
@@ -2809,6 +2849,7 @@ AbortTransaction(void)
 		AtEOXact_RelationCache(false);
 		AtEOXact_Inval(false);
 		AtEOXact_MultiXact();
+		AtEOXact_ZHeapKeyShareLocks();
 		ResourceOwnerRelease(TopTransactionResourceOwner,
 							 RESOURCE_RELEASE_LOCKS,
 							 false, true);
@@ -3560,6 +3601,7 @@ ApplyUndoActions(void)
 				ResetUndoRequestInfo(&urinfo);
 				urinfo.dbid = MyDatabaseId;
 				urinfo.full_xid = GetTopFullTransactionId();
+				urinfo.start_urec_ptr = s->start_urec_ptr[per_level];
 
 				/*
 				 * If this request is not for a temp table and not aborting
@@ -5666,6 +5708,7 @@ SerializeTransactionState(Size maxsize, char *start_address)
 	result->currentFullTransactionId =
 		CurrentTransactionState->fullTransactionId;
 	result->currentCommandId = currentCommandId;
+	result->currentCommandIdUsed = currentCommandIdUsed;
 
 	/*
 	 * If we're running in a parallel worker and launching a parallel worker
@@ -5734,6 +5777,7 @@ StartParallelWorkerTransaction(char *tstatespace)
 	CurrentTransactionState->fullTransactionId =
 		tstate->currentFullTransactionId;
 	currentCommandId = tstate->currentCommandId;
+	currentCommandIdUsed = tstate->currentCommandIdUsed;
 	nParallelCurrentXids = tstate->nParallelCurrentXids;
 	ParallelCurrentXids = &tstate->parallelCurrentXids[0];
 
@@ -35,6 +35,7 @@
 #include "access/xact.h"
 #include "access/xlog_internal.h"
 #include "access/xloginsert.h"
+#include "access/xlogprefetch.h"
 #include "access/xlogreader.h"
 #include "access/xlogutils.h"
 #include "catalog/catversion.h"
@@ -46,6 +47,7 @@
 #include "pgstat.h"
 #include "port/atomics.h"
 #include "postmaster/bgwriter.h"
+#include "postmaster/walsummarizer.h"
 #include "postmaster/walwriter.h"
 #include "postmaster/startup.h"
 #include "replication/basebackup.h"
@@ -94,7 +96,7 @@ char	   *XLogArchiveCommand = NULL;
 bool		EnableHotStandby = false;
 bool		fullPageWrites = true;
 bool		wal_log_hints = false;
-bool		wal_compression = false;
+int			wal_compression = WAL_COMPRESSION_NONE;
 char	   *wal_consistency_checking_string = NULL;
 bool	   *wal_consistency_checking = NULL;
 bool		wal_init_zero = true;
@@ -104,6 +106,7 @@ int			sync_method = DEFAULT_SYNC_METHOD;
 int			wal_level = WAL_LEVEL_MINIMAL;
 int			CommitDelay = 0;	/* precommit delay in microseconds */
 int			CommitSiblings = 5; /* # concurrent xacts needed to sleep */
+bool		AdaptiveCommitDelay = false;	/* compute precommit delay? */
 int			wal_retrieve_retry_interval = 5000;
 
 #ifdef WAL_DEBUG
@@ -113,11 +116,11 @@ bool		XLOG_DEBUG = false;
 int			wal_segment_size = DEFAULT_XLOG_SEG_SIZE;
 
 /*
- * Number of WAL insertion locks to use. A higher value allows more insertions
- * to happen concurrently, but adds some CPU overhead to flushing the WAL,
- * which needs to iterate all the locks.
+ * Number of WAL insertion locks to use (the wal_insert_locks GUC). A higher
+ * value allows more insertions to happen concurrently, but adds some CPU
+ * overhead to flushing the WAL, which needs to iterate all the locks.
  */
-#define NUM_XLOGINSERT_LOCKS  8
+int			num_xloginsert_locks = 8;
 
 /*
  * Max distance from last checkpoint, before triggering a new xlog-based
@@ -526,29 +529,42 @@ typedef enum ExclusiveBackupState
  */
 static SessionBackupState sessionBackupState = SESSION_BACKUP_NONE;
 
+/*
+ * An entry in the prev-link table. Every inserter publishes the link from
+ * the end of the space it reserved to the start of its record, and the next
+ * inserter, whose record begins at that end position, looks it up to fill in
+ * its xl_prev. endbytepos is the key, zero when the slot is free;
+ * startbytepos holds the start position plus one, zero until it is set.
+ */
+typedef struct XLogPrevLink
+{
+	pg_atomic_uint64 endbytepos;
+	pg_atomic_uint64 startbytepos;
+} XLogPrevLink;
+
 /*
  * Shared state data for WAL insertion.
  */
 typedef struct XLogCtlInsert
 {
-	slock_t		insertpos_lck;	/* protects CurrBytePos and PrevBytePos */
-
 	/*
 	 * CurrBytePos is the end of reserved WAL. The next record will be
-	 * inserted at that position. PrevBytePos is the start position of the
-	 * previously inserted (or rather, reserved) record - it is copied to the
-	 * prev-link of the next record. These are stored as "usable byte
-	 * positions" rather than XLogRecPtrs (see XLogBytePosToRecPtr()).
+	 * inserted at that position. It is stored as a "usable byte position"
+	 * rather than an XLogRecPtr (see XLogBytePosToRecPtr()), and advanced
+	 * with an atomic fetch-and-add, so reserving space needs no lock.
+	 *
+	 * The start position of the previously reserved record, which is copied
+	 * to the prev-link of the next record, is not kept here; it is handed
+	 * from each inserter to its successor through the PrevLinks table below.
 	 */
-	uint64		CurrBytePos;
-	uint64		PrevBytePos;
+	pg_atomic_uint64 CurrBytePos;
 
 	/*
-	 * Make sure the above heavily-contended spinlock and byte positions are
-	 * on their own cache line. In particular, the RedoRecPtr and full page
-	 * write variables below should be on a different cache line. They are
-	 * read on every WAL insertion, but updated rarely, and we don't want
-	 * those reads to steal the cache line containing Curr/PrevBytePos.
+	 * Make sure the above heavily-contended byte position is on its own
+	 * cache line. In particular, the RedoRecPtr and full page write
+	 * variables below should be on a different cache line. They are read on
+	 * every WAL insertion, but updated rarely, and we don't want those reads
+	 * to steal the cache line containing CurrBytePos.
 	 */
 	char		pad[PG_CACHE_LINE_SIZE];
 
@@ -582,6 +598,13 @@ typedef struct XLogCtlInsert
 	 * WAL insertion locks.
 	 */
 	WALInsertLockPadded *WALInsertLocks;
+
+	/*
+	 * Hash table of prev-links, see ReserveXLogInsertLocation(). Its size is
+	 * a power of two, PrevLinksMask + 1.
+	 */
+	XLogPrevLink *PrevLinks;
+	uint32		PrevLinksMask;
 } XLogCtlInsert;
 
 /*
@@ -608,6 +631,18 @@ typedef struct XLogCtlData
 	pg_time_t	lastSegSwitchTime;
 	XLogRecPtr	lastSegSwitchLSN;
 
+	/*
+	 * Statistics used by adaptive_commit_delay.  flushRequests counts calls
+	 * to XLogFlush that found the WAL not yet flushed far enough, and is
+	 * protected by info_lck.  The rest are only maintained by the process
+	 * holding WALWriteLock to flush on behalf of a group.
+	 */
+	uint64		flushRequests;
+	uint64		lastFlushRequests;	/* flushRequests at last group flush */
+	TimestampTz lastFlushTime;	/* time of last group flush */
+	double		avgFlushInterval;	/* usecs between flush requests */
+	double		avgFlushDuration;	/* usecs to write and sync a group */
+
 	/*
 	 * Protected by info_lck and WALWriteLock (you must hold either lock to
 	 * read it, but both to update)
@@ -880,6 +915,7 @@ static XLogRecPtr XLogGetReplicationSlotMinimumLSN(void);
 static void AdvanceXLInsertBuffer(XLogRecPtr upto, bool opportunistic);
 static bool XLogCheckpointNeeded(XLogSegNo new_segno);
 static void XLogWrite(XLogwrtRqst WriteRqst, bool flexible);
+static int	GetAdaptiveCommitDelay(void);
 static bool InstallXLogFileSegment(XLogSegNo *segno, char *tmppath,
 								   bool find_free, XLogSegNo max_segno,
 								   bool use_lock);
@@ -1001,8 +1037,8 @@ XLogInsertRecord(XLogRecData *rdata,
 	 * record to the shared WAL buffer cache is a two-step process:
 	 *
 	 * 1. Reserve the right amount of space from the WAL. The current head of
-	 *	  reserved space is kept in Insert->CurrBytePos, and is protected by
-	 *	  insertpos_lck.
+	 *	  reserved space is kept in Insert->CurrBytePos, and is advanced
+	 *	  atomically.
 	 *
 	 * 2. Copy the record to the reserved WAL space. This involves finding the
 	 *	  correct WAL buffer containing the reserved space, and copying the
@@ -1012,7 +1048,7 @@ XLogInsertRecord(XLogRecData *rdata,
 	 * inserter acquires an insertion lock. In addition to just indicating that
 	 * an insertion is in progress, the lock tells others how far the inserter
 	 * has progressed. There is a small fixed number of insertion locks,
-	 * determined by NUM_XLOGINSERT_LOCKS. When an inserter crosses a page
+	 * determined by wal_insert_locks. When an inserter crosses a page
 	 * boundary, it updates the value stored in the lock to the how far it has
 	 * inserted, to allow the previous buffer to be flushed.
 	 *
@@ -1247,6 +1283,109 @@ XLogInsertRecord(XLogRecData *rdata,
 	return EndPos;
 }
 
+/*
+ * Number of slots in the prev-link table.
+ *
+ * A link is published by an inserter holding an insertion lock and consumed
+ * by the next one, so at most num_xloginsert_locks + 1 links are live at any
+ * time. Keep the table at most a quarter full so that probe sequences stay
+ * short.
+ */
+static uint32
+XLogPrevLinksSize(void)
+{
+	uint32		nslots = 64;
+
+	while (nslots < 4 * (uint32) (num_xloginsert_locks + 1))
+		nslots <<= 1;
+	return nslots;
+}
+
+/*
+ * Home slot of a byte position in the prev-link table.
+ */
+static inline uint32
+XLogPrevLinkSlot(uint64 bytepos)
+{
+	uint64		h = (bytepos / MAXIMUM_ALIGNOF) * UINT64CONST(0x9E3779B97F4A7C15);
+
+	return (uint32) (h >> 32) & XLogCtl->Insert.PrevLinksMask;
+}
+
+/*
+ * Publish the link from endbytepos, the end of a reserved record, to
+ * startbytepos, its start. The table always has free slots, so this never
+ * waits.
+ */
+static void
+XLogPublishPrevLink(uint64 endbytepos, uint64 startbytepos)
+{
+	XLogCtlInsert *Insert = &XLogCtl->Insert;
+	uint32		slot = XLogPrevLinkSlot(endbytepos);
+
+	Assert(endbytepos != 0);
+
+	for (;;)
+	{
+		XLogPrevLink *link = &Insert->PrevLinks[slot];
+		uint64		expected = 0;
+
+		if (pg_atomic_read_u64(&link->endbytepos) == 0 &&
+			pg_atomic_compare_exchange_u64(&link->endbytepos, &expected,
+										   endbytepos))
+		{
+			pg_atomic_write_u64(&link->startbytepos, startbytepos + 1);
+			return;
+		}
+		slot = (slot + 1) & Insert->PrevLinksMask;
+	}
+}
+
+/*
+ * Look up and remove the link published for a record ending at bytepos, and
+ * return the start position of that record.
+ *
+ * The predecessor has already reserved its space by the time we get here,
+ * but it may not have published the link yet, so we may have to wait for it
+ * briefly. It is in a critical section doing nothing but that, so the wait
+ * is short.
+ */
+static uint64
+XLogConsumePrevLink(uint64 bytepos)
+{
+	XLogCtlInsert *Insert = &XLogCtl->Insert;
+	uint32		home = XLogPrevLinkSlot(bytepos);
+	uint32		slot = home;
+	SpinDelayStatus delayStatus;
+
+	init_local_spin_delay(&delayStatus);
+
+	for (;;)
+	{
+		XLogPrevLink *link = &Insert->PrevLinks[slot];
+
+		if (pg_atomic_read_u64(&link->endbytepos) == bytepos)
+		{
+			uint64		startbytepos;
+
+			while ((startbytepos = pg_atomic_read_u64(&link->startbytepos)) == 0)
+				perform_spin_delay(&delayStatus);
+
+			/* clear the value before the key frees the slot for reuse */
+			pg_atomic_write_u64(&link->startbytepos, 0);
+			pg_write_barrier();
+			pg_atomic_write_u64(&link->endbytepos, 0);
+			finish_spin_delay(&delayStatus);
+
+			return startbytepos - 1;
+		}
+
+		slot = (slot + 1) & Insert->PrevLinksMask;
+		if (slot == home)
+			perform_spin_delay(&delayStatus);
+	}
+}
+
 /*
  * Reserves the right amount of space for a record of given size from the WAL.
  * *StartPos is set to the beginning of the reserved section, *EndPos to
@@ -1254,9 +1393,10 @@ XLogInsertRecord(XLogRecData *rdata,
  * used to set the xl_prev of this record.
  *
  * This is the performance critical part of XLogInsert that must be serialized
- * across backends. The rest can happen mostly in parallel. Try to keep this
- * section as short as possible, insertpos_lck can be heavily contended on a
- * busy system.
+ * across backends. The rest can happen mostly in parallel. The reservation
+ * itself is a single atomic fetch-and-add on CurrBytePos; the prev-link is
+ * exchanged with the neighbouring inserters through the PrevLinks table, so
+ * concurrent inserters never queue up behind a lock here.
  *
  * NB: The space calculation here must match the code in CopyXLogRecordToWAL,
  * where we actually copy the record to the reserved space.
@@ -1276,24 +1416,22 @@ ReserveXLogInsertLocation(int size, XLogRecPtr *StartPos, XLogRecPtr *EndPos,
 	Assert(size > SizeOfXLogRecord);
 
 	/*
-	 * The duration the spinlock needs to be held is minimized by minimizing
-	 * the calculations that have to be done while holding the lock. The
-	 * current tip of reserved WAL is kept in CurrBytePos, as a byte position
-	 * that only counts "usable" bytes in WAL, that is, it excludes all WAL
-	 * page headers. The mapping between "usable" byte positions and physical
-	 * positions (XLogRecPtrs) can be done outside the locked region, and
-	 * because the usable byte position doesn't include any headers, reserving
-	 * X bytes from WAL is almost as simple as "CurrBytePos += X".
+	 * The current tip of reserved WAL is kept in CurrBytePos, as a byte
+	 * position that only counts "usable" bytes in WAL, that is, it excludes
+	 * all WAL page headers. The mapping between "usable" byte positions and
+	 * physical positions (XLogRecPtrs) can be done afterwards, and because
+	 * the usable byte position doesn't include any headers, reserving X
+	 * bytes from WAL is just "CurrBytePos += X".
 	 */
-	SpinLockAcquire(&Insert->insertpos_lck);
-
-	startbytepos = Insert->CurrBytePos;
+	startbytepos = pg_atomic_fetch_add_u64(&Insert->CurrBytePos, size);
 	endbytepos = startbytepos + size;
-	prevbytepos = Insert->PrevBytePos;
-	Insert->CurrBytePos = endbytepos;
-	Insert->PrevBytePos = startbytepos;
 
-	SpinLockRelease(&Insert->insertpos_lck);
+	/*
+	 * Hand our start position to whoever reserves the space after us before
+	 * waiting for our own predecessor, so that the hand-offs never chain up.
+	 */
+	XLogPublishPrevLink(endbytepos, startbytepos);
+	prevbytepos = XLogConsumePrevLink(startbytepos);
 
 	*StartPos = XLogBytePosToRecPtr(startbytepos);
 	*EndPos = XLogBytePosToEndRecPtr(endbytepos);
@@ -1329,25 +1467,22 @@ ReserveXLogSwitch(XLogRecPtr *StartPos, XLogRecPtr *EndPos, XLogRecPtr *PrevPtr)
 	uint32		segleft;
 
 	/*
-	 * These calculations are a bit heavy-weight to be done while holding a
-	 * spinlock, but since we're holding all the WAL insertion locks, there
-	 * are no other inserters competing for it. GetXLogInsertRecPtr() does
-	 * compete for it, but that's not called very frequently.
+	 * Since we're holding all the WAL insertion locks, there are no other
+	 * inserters competing for CurrBytePos, and every earlier inserter has
+	 * already published its prev-link. So we can compute the new position
+	 * at leisure and store it with a plain atomic write.
 	 */
-	SpinLockAcquire(&Insert->insertpos_lck);
-
-	startbytepos = Insert->CurrBytePos;
+	startbytepos = pg_atomic_read_u64(&Insert->CurrBytePos);
 
 	ptr = XLogBytePosToEndRecPtr(startbytepos);
 	if (XLogSegmentOffset(ptr, wal_segment_size) == 0)
 	{
-		SpinLockRelease(&Insert->insertpos_lck);
 		*EndPos = *StartPos = ptr;
 		return false;
 	}
 
 	endbytepos = startbytepos + size;
-	prevbytepos = Insert->PrevBytePos;
+	prevbytepos = XLogConsumePrevLink(startbytepos);
 
 	*StartPos = XLogBytePosToRecPtr(startbytepos);
 	*EndPos = XLogBytePosToEndRecPtr(endbytepos);
@@ -1359,10 +1494,8 @@ ReserveXLogSwitch(XLogRecPtr *StartPos, XLogRecPtr *EndPos, XLogRecPtr *PrevPtr)
 		*EndPos += segleft;
 		endbytepos = XLogRecPtrToBytePos(*EndPos);
 	}
-	Insert->CurrBytePos = endbytepos;
-	Insert->PrevBytePos = startbytepos;
-
-	SpinLockRelease(&Insert->insertpos_lck);
+	XLogPublishPrevLink(endbytepos, startbytepos);
+	pg_atomic_write_u64(&Insert->CurrBytePos, endbytepos);
 
 	*PrevPtr = XLogBytePosToRecPtr(prevbytepos);
 
@@ -1649,7 +1782,7 @@ WALInsertLockAcquire(void)
 	static int	lockToTry = -1;
 
 	if (lockToTry == -1)
-		lockToTry = MyProc->pgprocno % NUM_XLOGINSERT_LOCKS;
+		lockToTry = MyProc->pgprocno % num_xloginsert_locks;
 	MyLockNo = lockToTry;
 
 	/*
@@ -1667,7 +1800,7 @@ WALInsertLockAcquire(void)
 		 * than locks, it still helps to distribute the inserters evenly
 		 * across the locks.
 		 */
-		lockToTry = (lockToTry + 1) % NUM_XLOGINSERT_LOCKS;
+		lockToTry = (lockToTry + 1) % num_xloginsert_locks;
 	}
 }
 
@@ -1685,7 +1818,7 @@ WALInsertLockAcquireExclusive(void)
 	 * indicator is set to 0xFFFFFFFFFFFFFFFF, which is higher than any real
 	 * XLogRecPtr value, to make sure that no-one blocks waiting on those.
 	 */
-	for (i = 0; i < NUM_XLOGINSERT_LOCKS - 1; i++)
+	for (i = 0; i < num_xloginsert_locks - 1; i++)
 	{
 		LWLockAcquire(&WALInsertLocks[i].l.lock, LW_EXCLUSIVE);
 		LWLockUpdateVar(&WALInsertLocks[i].l.lock,
@@ -1711,7 +1844,7 @@ WALInsertLockRelease(void)
 	{
 		int			i;
 
-		for (i = 0; i < NUM_XLOGINSERT_LOCKS; i++)
+		for (i = 0; i < num_xloginsert_locks; i++)
 			LWLockReleaseClearVar(&WALInsertLocks[i].l.lock,
 								  &WALInsertLocks[i].l.insertingAt,
 								  0);
@@ -1739,8 +1872,8 @@ WALInsertLockUpdateInsertingAt(XLogRecPtr insertingAt)
 		 * We use the last lock to mark our actual position, see comments in
 		 * WALInsertLockAcquireExclusive.
 		 */
-		LWLockUpdateVar(&WALInsertLocks[NUM_XLOGINSERT_LOCKS - 1].l.lock,
-						&WALInsertLocks[NUM_XLOGINSERT_LOCKS - 1].l.insertingAt,
+		LWLockUpdateVar(&WALInsertLocks[num_xloginsert_locks - 1].l.lock,
+						&WALInsertLocks[num_xloginsert_locks - 1].l.insertingAt,
 						insertingAt);
 	}
 	else
@@ -1776,9 +1909,7 @@ WaitXLogInsertionsToFinish(XLogRecPtr upto)
 		elog(PANIC, "cannot wait without a PGPROC structure");
 
 	/* Read the current insert position */
-	SpinLockAcquire(&Insert->insertpos_lck);
-	bytepos = Insert->CurrBytePos;
-	SpinLockRelease(&Insert->insertpos_lck);
+	bytepos = pg_atomic_read_u64(&Insert->CurrBytePos);
 	reservedUpto = XLogBytePosToEndRecPtr(bytepos);
 
 	/*
@@ -1807,7 +1938,7 @@ WaitXLogInsertionsToFinish(XLogRecPtr upto)
 	 * out for any insertion that's still in progress.
 	 */
 	finishedUpto = reservedUpto;
-	for (i = 0; i < NUM_XLOGINSERT_LOCKS; i++)
+	for (i = 0; i < num_xloginsert_locks; i++)
 	{
 		XLogRecPtr	insertingat = InvalidXLogRecPtr;
 
@@ -2511,7 +2642,10 @@ XLogWrite(XLogwrtRqst WriteRqst, bool flexible)
 			nleft = nbytes;
 			do
 			{
+				instr_time	io_start;
+
 				errno = 0;
+				io_start = pgstat_io_start();
 				pgstat_report_wait_start(WAIT_EVENT_WAL_WRITE);
 				written = pg_pwrite(openLogFile, from, nleft, startoffset);
 				pgstat_report_wait_end();
@@ -2526,6 +2660,8 @@ XLogWrite(XLogwrtRqst WriteRqst, bool flexible)
 									XLogFileNameP(ThisTimeLineID, openLogSegNo),
 									startoffset, nleft)));
 				}
+				pgstat_count_io(IOOBJECT_WAL, IOCONTEXT_NORMAL, IOOP_WRITE, 1,
+								io_start);
 				nleft -= written;
 				from += written;
 				startoffset += written;
@@ -2806,6 +2942,60 @@ UpdateMinRecoveryPoint(XLogRecPtr lsn, bool force)
 	LWLockRelease(ControlFileLock);
 }
 
+/*
+ * Weight of the newest measurement in the smoothed flush statistics used by
+ * adaptive_commit_delay, as a fraction 1 / ADAPTIVE_COMMIT_SMOOTHING.
+ */
+#define ADAPTIVE_COMMIT_SMOOTHING	8
+
+/*
+ * Compute how long a group commit leader should sleep before flushing, when
+ * adaptive_commit_delay is on.  Caller must hold WALWriteLock.
+ *
+ * Sleeping pays off only if other backends are likely to ask for a flush
+ * while we sleep, so that one flush serves them too.  But there's no point
+ * in sleeping for longer than about half a flush: a backend arriving later
+ * than that would have waited about as long for the next flush anyway.  So
+ * we sleep for half the recent average flush duration, provided at least two
+ * flush requests are expected to arrive in that time, judging by the recent
+ * average interval between requests; otherwise we don't sleep at all, which
+ * keeps a lone client's commits as fast as ever.  A nonzero commit_delay
+ * caps the sleep.
+ */
+static int
+GetAdaptiveCommitDelay(void)
+{
+	TimestampTz now = GetCurrentTimestamp();
+	uint64		requests;
+	double		delay;
+
+	SpinLockAcquire(&XLogCtl->info_lck);
+	requests = XLogCtl->flushRequests;
+	SpinLockRelease(&XLogCtl->info_lck);
+
+	/* account for the requests that arrived since the last group flush */
+	if (XLogCtl->lastFlushTime != 0 && requests > XLogCtl->lastFlushRequests)
+	{
+		double		interval;
+
+		interval = (double) (now - XLogCtl->lastFlushTime) /
+			(double) (requests - XLogCtl->lastFlushRequests);
+		XLogCtl->avgFlushInterval +=
+			(interval - XLogCtl->avgFlushInterval) / ADAPTIVE_COMMIT_SMOOTHING;
+	}
+	XLogCtl->lastFlushRequests = requests;
+	XLogCtl->lastFlushTime = now;
+
+	delay = XLogCtl->avgFlushDuration / 2;
+	if (CommitDelay > 0 && delay > CommitDelay)
+		delay = CommitDelay;
+
+	if (delay < 2 * XLogCtl->avgFlushInterval)
+		return 0;
+
+	return (int) Min(delay, USECS_PER_SEC / 10);
+}
+
 /*
  * Ensure that all XLOG data through the given position is flushed to disk.
  *
@@ -2817,6 +3007,7 @@ XLogFlush(XLogRecPtr record)
 {
 	XLogRecPtr	WriteRqstPtr;
 	XLogwrtRqst WriteRqst;
+	bool		counted = false;
 
 	/*
 	 * During REDO, we are reading not writing WAL.  Therefore, instead of
@@ -2864,12 +3055,19 @@ XLogFlush(XLogRecPtr record)
 	{
 		XLogRecPtr	insertpos;
 
+		int			delay = 0;
+		instr_time	flush_start;
+		instr_time	flush_time;
+
 		/* read LogwrtResult and update local state */
 		SpinLockAcquire(&XLogCtl->info_lck);
 		if (WriteRqstPtr < XLogCtl->LogwrtRqst.Write)
 			WriteRqstPtr = XLogCtl->LogwrtRqst.Write;
 		LogwrtResult = XLogCtl->LogwrtResult;
+		if (!counted)
+			XLogCtl->flushRequests++;
 		SpinLockRelease(&XLogCtl->info_lck);
+		counted = true;
 
 		/* done already? */
 		if (record <= LogwrtResult.Flush)
@@ -2914,11 +3112,21 @@ XLogFlush(XLogRecPtr record)
 		 *
 		 * We do not sleep if enableFsync is not turned on, nor if there are
 		 * fewer than CommitSiblings other backends with active transactions.
+		 * With adaptive_commit_delay, the rate of recent flush requests and
+		 * the duration of recent flushes decide instead.
 		 */
-		if (CommitDelay > 0 && enableFsync &&
-			MinimumActiveBackends(CommitSiblings))
+		if (enableFsync)
 		{
-			pg_usleep(CommitDelay);
+			if (AdaptiveCommitDelay)
+				delay = GetAdaptiveCommitDelay();
+			else if (CommitDelay > 0 &&
+					 MinimumActiveBackends(CommitSiblings))
+				delay = CommitDelay;
+		}
+
+		if (delay > 0)
+		{
+			pg_usleep(delay);
 
 			/*
 			 * Re-check how far we can now flush the WAL. It's generally not
@@ -2937,8 +3145,20 @@ XLogFlush(XLogRecPtr record)
 		WriteRqst.Write = insertpos;
 		WriteRqst.Flush = insertpos;
 
+		if (AdaptiveCommitDelay)
+			INSTR_TIME_SET_CURRENT(flush_start);
+
 		XLogWrite(WriteRqst, false);
 
+		if (AdaptiveCommitDelay)
+		{
+			INSTR_TIME_SET_CURRENT(flush_time);
+			INSTR_TIME_SUBTRACT(flush_time, flush_start);
+			XLogCtl->avgFlushDuration +=
+				(INSTR_TIME_GET_DOUBLE(flush_time) * USECS_PER_SEC -
+				 XLogCtl->avgFlushDuration) / ADAPTIVE_COMMIT_SMOOTHING;
+		}
+
 		LWLockRelease(WALWriteLock);
 		/* done */
 		break;
@@ -3006,6 +3226,7 @@ XLogBackgroundFlush(void)
 {
 	XLogwrtRqst WriteRqst;
 	bool		flexible = true;
+	bool		locked = true;
 	static TimestampTz lastflush;
 	TimestampTz now;
 	int			flushbytes;
@@ -3099,14 +3320,40 @@ XLogBackgroundFlush(void)
 
 	/* now wait for any in-progress insertions to finish and get write lock */
 	WaitXLogInsertionsToFinish(WriteRqst.Write);
-	LWLockAcquire(WALWriteLock, LW_EXCLUSIVE);
-	LogwrtResult = XLogCtl->LogwrtResult;
-	if (WriteRqst.Write > LogwrtResult.Write ||
-		WriteRqst.Flush > LogwrtResult.Flush)
+	if (!AdaptiveCommitDelay)
+		LWLockAcquire(WALWriteLock, LW_EXCLUSIVE);
+	else
 	{
-		XLogWrite(WriteRqst, flexible);
+		/*
+		 * With adaptive group commit, rather than queue up behind a backend
+		 * that is flushing a commit group, wait for it to finish and see if
+		 * it flushed what we wanted to anyway.  That avoids a second sync
+		 * right after the group's.
+		 */
+		while (!LWLockAcquireOrWait(WALWriteLock, LW_EXCLUSIVE))
+		{
+			SpinLockAcquire(&XLogCtl->info_lck);
+			LogwrtResult = XLogCtl->LogwrtResult;
+			SpinLockRelease(&XLogCtl->info_lck);
+
+			if (WriteRqst.Write <= LogwrtResult.Write &&
+				WriteRqst.Flush <= LogwrtResult.Flush)
+			{
+				locked = false;
+				break;
+			}
+		}
+	}
+	if (locked)
+	{
+		LogwrtResult = XLogCtl->LogwrtResult;
+		if (WriteRqst.Write > LogwrtResult.Write ||
+			WriteRqst.Flush > LogwrtResult.Flush)
+		{
+			XLogWrite(WriteRqst, flexible);
+		}
+		LWLockRelease(WALWriteLock);
 	}
-	LWLockRelease(WALWriteLock);
 
 	END_CRIT_SECTION();
 
@@ -3703,6 +3950,9 @@ XLogFileRead(XLogSegNo segno, int emode, TimeLineID tli,
 		if (source != XLOG_FROM_STREAM)
 			XLogReceiptTime = GetCurrentTimestamp();
 
+		/* The startup process never exits while replaying, report I/O now */
+		pgstat_send_io(false);
+
 		return fd;
 	}
 	if (errno != ENOENT || !notfoundOk) /* unexpected failure? */
@@ -4980,7 +5230,9 @@ XLOGShmemSize(void)
 	size = sizeof(XLogCtlData);
 
 	/* WAL insertion locks, plus alignment */
-	size = add_size(size, mul_size(sizeof(WALInsertLockPadded), NUM_XLOGINSERT_LOCKS + 1));
+	size = add_size(size, mul_size(sizeof(WALInsertLockPadded), num_xloginsert_locks + 1));
+	/* prev-link table */
+	size = add_size(size, mul_size(sizeof(XLogPrevLink), XLogPrevLinksSize()));
 	/* xlblocks array */
 	size = add_size(size, mul_size(sizeof(XLogRecPtr), XLOGbuffers));
 	/* extra alignment padding for XLOG I/O buffers */
@@ -5072,16 +5324,26 @@ XLOGShmemInit(void)
 		((uintptr_t) allocptr) % sizeof(WALInsertLockPadded);
 	WALInsertLocks = XLogCtl->Insert.WALInsertLocks =
 		(WALInsertLockPadded *) allocptr;
-	allocptr += sizeof(WALInsertLockPadded) * NUM_XLOGINSERT_LOCKS;
+	allocptr += sizeof(WALInsertLockPadded) * num_xloginsert_locks;
 
 	LWLockRegisterTranche(LWTRANCHE_WAL_INSERT, "wal_insert");
-	for (i = 0; i < NUM_XLOGINSERT_LOCKS; i++)
+	for (i = 0; i < num_xloginsert_locks; i++)
 	{
 		LWLockInitialize(&WALInsertLocks[i].l.lock, LWTRANCHE_WAL_INSERT);
 		WALInsertLocks[i].l.insertingAt = InvalidXLogRecPtr;
 		WALInsertLocks[i].l.lastImportantAt = InvalidXLogRecPtr;
 	}
 
+	/* prev-link table, initially empty */
+	XLogCtl->Insert.PrevLinks = (XLogPrevLink *) allocptr;
+	XLogCtl->Insert.PrevLinksMask = XLogPrevLinksSize() - 1;
+	for (i = 0; i <= XLogCtl->Insert.PrevLinksMask; i++)
+	{
+		pg_atomic_init_u64(&XLogCtl->Insert.PrevLinks[i].endbytepos, 0);
+		pg_atomic_init_u64(&XLogCtl->Insert.PrevLinks[i].startbytepos, 0);
+	}
+	allocptr += sizeof(XLogPrevLink) * XLogPrevLinksSize();
+
 	/*
 	 * Align the start of the page buffers to a full xlog block size boundary.
 	 * This simplifies some calculations in XLOG insertion. It is also
@@ -5099,8 +5361,8 @@ XLOGShmemInit(void)
 	XLogCtl->SharedRecoveryInProgress = true;
 	XLogCtl->SharedHotStandbyActive = false;
 	XLogCtl->WalWriterSleeping = false;
+	XLogCtl->avgFlushInterval = USECS_PER_SEC;
 
-	SpinLockInit(&XLogCtl->Insert.insertpos_lck);
 	SpinLockInit(&XLogCtl->info_lck);
 	SpinLockInit(&XLogCtl->ulsn_lck);
 	InitSharedLatch(&XLogCtl->recoveryWakeupLatch);
@@ -7049,9 +7311,12 @@ StartupXLOG(void)
 		{
 			ErrorContextCallback errcallback;
 			TimestampTz xtime;
+			XLogPrefetcher *prefetcher;
 
 			InRedo = true;
 
+			prefetcher = XLogPrefetcherAllocate(EndRecPtr);
+
 			ereport(LOG,
 					(errmsg("redo starts at %X/%X",
 							(uint32) (ReadRecPtr >> 32), (uint32) ReadRecPtr)));
@@ -7199,6 +7464,14 @@ StartupXLOG(void)
 					TransactionIdIsValid(record->xl_xid))
 					RecordKnownAssignedTransactionIds(record->xl_xid);
 
+				/*
+				 * Get the blocks of the upcoming records read in while we
+				 * replay this one.
+				 */
+				if (prefetcher != NULL)
+					XLogPrefetcherReadAhead(prefetcher, EndRecPtr,
+											ThisTimeLineID);
+
 				/* Now apply the WAL record itself */
 				RmgrTable[record->xl_rmid].rm_redo(xlogreader);
 
@@ -7273,6 +7546,9 @@ StartupXLOG(void)
 			 * end of main redo apply loop
 			 */
 
+			if (prefetcher != NULL)
+				XLogPrefetcherFree(prefetcher);
+
 			if (reachedStopPoint)
 			{
 				if (!reachedConsistency)
@@ -7332,6 +7608,14 @@ StartupXLOG(void)
 					(errmsg("redo is not required")));
 		}
 	}
+	else
+	{
+		/*
+		 * After a clean shutdown, bring back the table and function stats
+		 * saved by the shutdown checkpoint.
+		 */
+		pgstat_read_object_stats();
+	}
 
 	/*
 	 * Kill WAL receiver, if it's still running, before we continue to write
@@ -7515,8 +7799,9 @@ StartupXLOG(void)
 	 * previous incarnation.
 	 */
 	Insert = &XLogCtl->Insert;
-	Insert->PrevBytePos = XLogRecPtrToBytePos(LastRec);
-	Insert->CurrBytePos = XLogRecPtrToBytePos(EndOfLog);
+	XLogPublishPrevLink(XLogRecPtrToBytePos(EndOfLog),
+						XLogRecPtrToBytePos(LastRec));
+	pg_atomic_write_u64(&Insert->CurrBytePos, XLogRecPtrToBytePos(EndOfLog));
 
 	/*
 	 * Tricky point here: readBuf contains the *last* block that the LastRec
@@ -8279,7 +8564,7 @@ GetLastImportantRecPtr(void)
 	XLogRecPtr	res = InvalidXLogRecPtr;
 	int			i;
 
-	for (i = 0; i < NUM_XLOGINSERT_LOCKS; i++)
+	for (i = 0; i < num_xloginsert_locks; i++)
 	{
 		XLogRecPtr	last_important;
 
@@ -8360,6 +8645,12 @@ ShutdownXLOG(int code, Datum arg)
 			RequestXLogSwitch(false);
 
 		CreateCheckPoint(CHECKPOINT_IS_SHUTDOWN | CHECKPOINT_IMMEDIATE);
+
+		/*
+		 * Nothing updates the shared table and function stats any more, so
+		 * save them for the next startup.
+		 */
+		pgstat_write_object_stats();
 	}
 	ShutdownCLOG();
 	ShutdownCommitTs();
@@ -8637,7 +8928,7 @@ CreateCheckPoint(int flags)
 	 * determine the checkpoint REDO pointer.
 	 */
 	WALInsertLockAcquireExclusive();
-	curInsert = XLogBytePosToRecPtr(Insert->CurrBytePos);
+	curInsert = XLogBytePosToRecPtr(pg_atomic_read_u64(&Insert->CurrBytePos));
 
 	/*
 	 * If this isn't a shutdown or forced checkpoint, and if there has been no
@@ -9323,11 +9614,11 @@ CreateRestartPoint(int flags)
 
 /*
  * Retreat *logSegNo to the last segment that we need to retain because of
- * either wal_keep_segments or replication slots.
+ * wal_keep_segments, replication slots or the WAL summarizer.
  *
  * This is calculated by subtracting wal_keep_segments from the given xlog
  * location, recptr and by making sure that that result is below the
- * requirement of replication slots.
+ * requirement of replication slots and of WAL summarization.
  */
 static void
 KeepLogSeg(XLogRecPtr recptr, XLogSegNo *logSegNo)
@@ -9361,6 +9652,20 @@ KeepLogSeg(XLogRecPtr recptr, XLogSegNo *logSegNo)
 			segno = slotSegNo;
 	}
 
+	/* and whether the WAL summarizer still needs some */
+	keep = GetOldestUnsummarizedLSN();
+	if (keep != InvalidXLogRecPtr)
+	{
+		XLogSegNo	summarySegNo;
+
+		XLByteToSeg(keep, summarySegNo, wal_segment_size);
+
+		if (summarySegNo <= 0)
+			segno = 1;
+		else if (summarySegNo < segno)
+			segno = summarySegNo;
+	}
+
 	/* don't delete WAL segments newer than the calculated segment */
 	if (segno < *logSegNo)
 		*logSegNo = segno;
@@ -10046,10 +10351,18 @@ static int
 get_sync_bit(int method)
 {
 	int			o_direct_flag = 0;
+	int			io_direct_flag = 0;
+
+	/*
+	 * With io_direct = wal, bypass the kernel cache whatever the sync
+	 * method.  Walreceiver is excluded for the reasons given below.
+	 */
+	if ((io_direct_flags & IO_DIRECT_WAL) && !AmWalReceiverProcess())
+		io_direct_flag = o_direct_flag = PG_O_DIRECT;
 
 	/* If fsync is disabled, never open in sync mode */
 	if (!enableFsync)
-		return 0;
+		return io_direct_flag;
 
 	/*
 	 * Optimize writes by bypassing kernel cache with O_DIRECT when using
@@ -10079,7 +10392,7 @@ get_sync_bit(int method)
 		case SYNC_METHOD_FSYNC:
 		case SYNC_METHOD_FSYNC_WRITETHROUGH:
 		case SYNC_METHOD_FDATASYNC:
-			return 0;
+			return io_direct_flag;
 #ifdef OPEN_SYNC_FLAG
 		case SYNC_METHOD_OPEN:
 			return OPEN_SYNC_FLAG | o_direct_flag;
@@ -10134,6 +10447,8 @@ assign_xlog_sync_method(int new_sync_method, void *extra)
 void
 issue_xlog_fsync(int fd, XLogSegNo segno)
 {
+	instr_time	io_start = pgstat_io_start();
+
 	pgstat_report_wait_start(WAIT_EVENT_WAL_SYNC);
 	switch (sync_method)
 	{
@@ -10171,6 +10486,10 @@ issue_xlog_fsync(int fd, XLogSegNo segno)
 			break;
 	}
 	pgstat_report_wait_end();
+
+	if (sync_method != SYNC_METHOD_OPEN && sync_method != SYNC_METHOD_OPEN_DSYNC)
+		pgstat_count_io(IOOBJECT_WAL, IOCONTEXT_NORMAL, IOOP_FSYNC, 1,
+						io_start);
 }
 
 /*
@@ -11201,9 +11520,7 @@ GetXLogInsertRecPtr(void)
 	XLogCtlInsert *Insert = &XLogCtl->Insert;
 	uint64		current_bytepos;
 
-	SpinLockAcquire(&Insert->insertpos_lck);
-	current_bytepos = Insert->CurrBytePos;
-	SpinLockRelease(&Insert->insertpos_lck);
+	current_bytepos = pg_atomic_read_u64(&Insert->CurrBytePos);
 
 	return XLogBytePosToRecPtr(current_bytepos);
 }
@@ -11355,6 +11672,17 @@ read_backup_label(XLogRecPtr *checkPointLoc, bool *backupEndRequired,
 						tli_from_file, BACKUP_LABEL_FILE)));
 	}
 
+	/*
+	 * An incremental backup only holds the blocks changed since its reference
+	 * backup, so it can't be started until pg_combinebackup has reconstructed
+	 * a full data directory from it.
+	 */
+	if (fscanf(lfp, "INCREMENTAL FROM LSN: %X/%X\n", &hi, &lo) == 2)
+		ereport(FATAL,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("this is an incremental backup, not a data directory"),
+				 errhint("Use pg_combinebackup to reconstruct a valid data directory.")));
+
 	if (ferror(lfp) || FreeFile(lfp))
 		ereport(FATAL,
 				(errcode_for_file_access(),
@@ -11581,6 +11909,7 @@ XLogPageRead(XLogReaderState *xlogreader, XLogRecPtr targetPagePtr, int reqLen,
 	uint32		targetPageOff;
 	XLogSegNo	targetSegNo PG_USED_FOR_ASSERTS_ONLY;
 	int			r;
+	instr_time	io_start;
 
 	XLByteToSeg(targetPagePtr, targetSegNo, wal_segment_size);
 	targetPageOff = XLogSegmentOffset(targetPagePtr, wal_segment_size);
@@ -11660,6 +11989,7 @@ retry:
 	/* Read the requested page */
 	readOff = targetPageOff;
 
+	io_start = pgstat_io_start();
 	pgstat_report_wait_start(WAIT_EVENT_WAL_READ);
 	r = pg_pread(readFile, readBuf, XLOG_BLCKSZ, (off_t) readOff);
 	if (r != XLOG_BLCKSZ)
@@ -11685,6 +12015,7 @@ retry:
 		goto next_record_is_invalid;
 	}
 	pgstat_report_wait_end();
+	pgstat_count_io(IOOBJECT_WAL, IOCONTEXT_NORMAL, IOOP_READ, 1, io_start);
 
 	Assert(targetSegNo == readSegNo);
 	Assert(targetPageOff == readOff);
@@ -0,0 +1,453 @@
+/*-------------------------------------------------------------------------
+ *
+ * xlogprefetch.c
+ *	  prefetching of the blocks referenced by upcoming WAL records
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * src/backend/access/transam/xlogprefetch.c
+ *
+ * NOTES:
+ * The startup process replays WAL one record at a time, and whenever a
+ * record modifies a page that isn't in shared buffers, replay stops until
+ * the page has been read.  Records without a full-page image, which is most
+ * of them between checkpoints, make that the common case for a standby that
+ * follows a burst of random writes.  To have those reads done concurrently
+ * with replay, the prefetcher decodes the WAL up to recovery_prefetch_distance
+ * bytes ahead of the record being replayed, with an XLogReader of its own,
+ * and asks the kernel to read in the pages that the records it finds will
+ * need, whatever resource manager they belong to.
+ *
+ * A page is only prefetched if replay will actually read it, that is, if the
+ * record has no full-page image to restore for it and doesn't initialize it,
+ * if it isn't in shared buffers already, and if the relation already covers
+ * it.  Why each block was or wasn't prefetched is counted in shared memory
+ * and shown by pg_stat_recovery_prefetch.  Undo log pages are left alone:
+ * undo is written sequentially, so the pages replay needs are nearly always
+ * in shared buffers already, and undofile.c would create the segment of an
+ * undo log page that has been discarded in the meantime.
+ *
+ * The prefetcher only reads WAL segment files present in pg_wal, and never
+ * beyond what the WAL receiver has written.  When it can't decode the next
+ * record, because it's missing or hasn't been fully received yet, it simply
+ * tries again once replay has moved on.  Since the prefetcher has no effect
+ * other than issuing hints, a bogus record decoded from a recycled segment
+ * does no harm either.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include <unistd.h>
+
+#include "access/undolog.h"
+#include "access/xlog.h"
+#include "access/xlog_internal.h"
+#include "access/xlogprefetch.h"
+#include "access/xlogreader.h"
+#include "catalog/pg_class.h"
+#include "funcapi.h"
+#include "pgstat.h"
+#include "port/atomics.h"
+#include "replication/walreceiver.h"
+#include "storage/buf_internals.h"
+#include "storage/bufmgr.h"
+#include "storage/fd.h"
+#include "storage/shmem.h"
+#include "storage/smgr.h"
+#include "utils/builtins.h"
+#include "utils/timestamp.h"
+
+/* Number of recently prefetched blocks not to prefetch again. */
+#define XLOGPREFETCH_RECENT_BLOCKS	16
+
+struct XLogPrefetcher
+{
+	XLogReaderState *reader;
+
+	/* Timeline and segment of the WAL file open as fd, or -1. */
+	TimeLineID	tli;
+	XLogSegNo	segno;
+	int			fd;
+
+	/* Start of the next record to decode. */
+	XLogRecPtr	next_lsn;
+
+	/*
+	 * After failing to decode a record, we don't try again until replay has
+	 * reached this point.
+	 */
+	XLogRecPtr	retry_lsn;
+
+	/* Ring of the blocks prefetched last. */
+	BufferTag	recent[XLOGPREFETCH_RECENT_BLOCKS];
+	int			next_recent;
+
+	/* Value of XLogPrefetchStats->reset_request last acted upon. */
+	uint32		reset_handled;
+};
+
+/*
+ * Statistics shown by pg_stat_recovery_prefetch.  The counters are only
+ * written by the startup process, so it updates them without locked
+ * instructions.  Other backends ask for a reset by bumping reset_request,
+ * and the startup process does it the next time it reads ahead.
+ */
+typedef struct XLogPrefetchStats
+{
+	pg_atomic_uint64 reset_time;	/* TimestampTz of the last reset */
+	pg_atomic_uint64 prefetch;	/* blocks prefetched */
+	pg_atomic_uint64 skip_hit;	/* blocks already in shared buffers */
+	pg_atomic_uint64 skip_new;	/* blocks past the end of the relation */
+	pg_atomic_uint64 skip_fpw;	/* blocks restored from a full-page image */
+	pg_atomic_uint64 skip_init;	/* blocks initialized by the record */
+	pg_atomic_uint64 skip_rep;	/* blocks prefetched very recently */
+	pg_atomic_uint32 distance;	/* bytes decoded ahead of replay */
+	pg_atomic_uint32 reset_request;
+} XLogPrefetchStats;
+
+static XLogPrefetchStats *PrefetchStats = NULL;
+
+/* GUC: how far ahead of replay to look for blocks to prefetch, in kB. */
+int			recovery_prefetch_distance = 256;
+
+static int	XLogPrefetcherPageRead(XLogReaderState *reader,
+								   XLogRecPtr targetPagePtr, int reqLen,
+								   XLogRecPtr targetRecPtr, char *readBuf,
+								   TimeLineID *pageTLI);
+static void XLogPrefetcherScanRecord(XLogPrefetcher *prefetcher);
+
+/*
+ * Increment a counter in PrefetchStats.  Only the startup process does this.
+ */
+static inline void
+XLogPrefetchIncrement(pg_atomic_uint64 *counter)
+{
+	pg_atomic_write_u64(counter, pg_atomic_read_u64(counter) + 1);
+}
+
+/*
+ * Report the amount of shared memory needed for the prefetch statistics.
+ */
+Size
+XLogPrefetchShmemSize(void)
+{
+	return sizeof(XLogPrefetchStats);
+}
+
+/*
+ * Allocate and initialize the prefetch statistics in shared memory.
+ */
+void
+XLogPrefetchShmemInit(void)
+{
+	bool		found;
+
+	PrefetchStats = (XLogPrefetchStats *)
+		ShmemInitStruct("XLogPrefetchStats", sizeof(XLogPrefetchStats), &found);
+	if (!found)
+	{
+		pg_atomic_init_u64(&PrefetchStats->reset_time, GetCurrentTimestamp());
+		pg_atomic_init_u64(&PrefetchStats->prefetch, 0);
+		pg_atomic_init_u64(&PrefetchStats->skip_hit, 0);
+		pg_atomic_init_u64(&PrefetchStats->skip_new, 0);
+		pg_atomic_init_u64(&PrefetchStats->skip_fpw, 0);
+		pg_atomic_init_u64(&PrefetchStats->skip_init, 0);
+		pg_atomic_init_u64(&PrefetchStats->skip_rep, 0);
+		pg_atomic_init_u32(&PrefetchStats->distance, 0);
+		pg_atomic_init_u32(&PrefetchStats->reset_request, 0);
+	}
+}
+
+/*
+ * Ask the startup process to reset the prefetch statistics.
+ */
+void
+XLogPrefetchRequestResetStats(void)
+{
+	pg_atomic_fetch_add_u32(&PrefetchStats->reset_request, 1);
+}
+
+/*
+ * Reset the statistics if another backend asked for it.
+ */
+static void
+XLogPrefetcherResetStatsIfRequested(XLogPrefetcher *prefetcher)
+{
+	uint32		reset_request = pg_atomic_read_u32(&PrefetchStats->reset_request);
+
+	if (reset_request == prefetcher->reset_handled)
+		return;
+
+	pg_atomic_write_u64(&PrefetchStats->prefetch, 0);
+	pg_atomic_write_u64(&PrefetchStats->skip_hit, 0);
+	pg_atomic_write_u64(&PrefetchStats->skip_new, 0);
+	pg_atomic_write_u64(&PrefetchStats->skip_fpw, 0);
+	pg_atomic_write_u64(&PrefetchStats->skip_init, 0);
+	pg_atomic_write_u64(&PrefetchStats->skip_rep, 0);
+	pg_atomic_write_u64(&PrefetchStats->reset_time, GetCurrentTimestamp());
+	prefetcher->reset_handled = reset_request;
+}
+
+/*
+ * Create a prefetcher that starts decoding at lsn, which must be the start
+ * of a record.
+ */
+XLogPrefetcher *
+XLogPrefetcherAllocate(XLogRecPtr lsn)
+{
+	XLogPrefetcher *prefetcher;
+
+	prefetcher = palloc0(sizeof(XLogPrefetcher));
+	prefetcher->reader = XLogReaderAllocate(wal_segment_size,
+											XLogPrefetcherPageRead,
+											prefetcher);
+	if (prefetcher->reader == NULL)
+	{
+		pfree(prefetcher);
+		return NULL;
+	}
+	prefetcher->fd = -1;
+	prefetcher->next_lsn = lsn;
+	prefetcher->retry_lsn = InvalidXLogRecPtr;
+
+	prefetcher->reset_handled =
+		pg_atomic_read_u32(&PrefetchStats->reset_request);
+
+	return prefetcher;
+}
+
+/*
+ * Release a prefetcher.
+ */
+void
+XLogPrefetcherFree(XLogPrefetcher *prefetcher)
+{
+	pg_atomic_write_u32(&PrefetchStats->distance, 0);
+
+	if (prefetcher->fd >= 0)
+		CloseTransientFile(prefetcher->fd);
+	XLogReaderFree(prefetcher->reader);
+	pfree(prefetcher);
+}
+
+/*
+ * Prefetch the blocks of the records up to recovery_prefetch_distance past
+ * replay_lsn, the end of the record about to be replayed.  tli is the
+ * timeline being replayed.
+ */
+void
+XLogPrefetcherReadAhead(XLogPrefetcher *prefetcher, XLogRecPtr replay_lsn,
+						TimeLineID tli)
+{
+	XLogRecPtr	upto;
+
+	XLogPrefetcherResetStatsIfRequested(prefetcher);
+
+	if (recovery_prefetch_distance == 0)
+	{
+		pg_atomic_write_u32(&PrefetchStats->distance, 0);
+		return;
+	}
+
+	/*
+	 * If replay got ahead of us, e.g. with WAL restored from the archive, or
+	 * switched to another timeline, start over from where it is.
+	 */
+	if (prefetcher->next_lsn < replay_lsn || tli != prefetcher->tli)
+	{
+		prefetcher->next_lsn = replay_lsn;
+		prefetcher->retry_lsn = InvalidXLogRecPtr;
+		prefetcher->tli = tli;
+		XLogReaderInvalReadState(prefetcher->reader);
+	}
+
+	if (replay_lsn < prefetcher->retry_lsn)
+		return;
+	prefetcher->retry_lsn = InvalidXLogRecPtr;
+
+	upto = replay_lsn + (XLogRecPtr) recovery_prefetch_distance * 1024;
+
+	while (prefetcher->next_lsn < upto)
+	{
+		XLogRecord *record;
+		char	   *errormsg;
+
+		record = XLogReadRecord(prefetcher->reader, prefetcher->next_lsn,
+								&errormsg);
+		if (record == NULL)
+		{
+			/*
+			 * Whatever was wrong may be fixed by the time replay has
+			 * consumed another page of WAL.  The page we read must not be
+			 * used again, as it may have been incomplete.
+			 */
+			prefetcher->retry_lsn = replay_lsn + XLOG_BLCKSZ;
+			XLogReaderInvalReadState(prefetcher->reader);
+			break;
+		}
+
+		XLogPrefetcherScanRecord(prefetcher);
+		prefetcher->next_lsn = prefetcher->reader->EndRecPtr;
+	}
+
+	pg_atomic_write_u32(&PrefetchStats->distance,
+						(uint32) (prefetcher->next_lsn - replay_lsn));
+}
+
+/*
+ * Issue prefetch requests for the blocks of the record just decoded.
+ */
+static void
+XLogPrefetcherScanRecord(XLogPrefetcher *prefetcher)
+{
+	XLogReaderState *reader = prefetcher->reader;
+	int			block_id;
+
+	for (block_id = 0; block_id <= reader->max_block_id; block_id++)
+	{
+		DecodedBkpBlock *block = &reader->blocks[block_id];
+		SMgrRelation smgr;
+		BufferTag	tag;
+		int			i;
+
+		if (!block->in_use)
+			continue;
+
+		/* See above for why undo log pages are not prefetched. */
+		if (block->rnode.dbNode == UndoLogDatabaseOid)
+			continue;
+
+		if (block->apply_image)
+		{
+			XLogPrefetchIncrement(&PrefetchStats->skip_fpw);
+			continue;
+		}
+		if ((block->flags & BKPBLOCK_WILL_INIT) != 0)
+		{
+			XLogPrefetchIncrement(&PrefetchStats->skip_init);
+			continue;
+		}
+
+		INIT_BUFFERTAG(tag, block->rnode, block->forknum, block->blkno);
+		for (i = 0; i < XLOGPREFETCH_RECENT_BLOCKS; i++)
+		{
+			if (BUFFERTAGS_EQUAL(tag, prefetcher->recent[i]))
+				break;
+		}
+		if (i < XLOGPREFETCH_RECENT_BLOCKS)
+		{
+			XLogPrefetchIncrement(&PrefetchStats->skip_rep);
+			continue;
+		}
+
+		/*
+		 * The relation may have been dropped or truncated later in the WAL,
+		 * or the block may be one that replay is going to add.
+		 */
+		smgr = smgropen(block->rnode, InvalidBackendId);
+		if (!smgrexists(smgr, block->forknum) ||
+			block->blkno >= smgrnblocks(smgr, block->forknum))
+		{
+			XLogPrefetchIncrement(&PrefetchStats->skip_new);
+			continue;
+		}
+
+		if (PrefetchBufferWithoutRelcache(block->rnode, block->forknum,
+										  block->blkno,
+										  RELPERSISTENCE_PERMANENT))
+			XLogPrefetchIncrement(&PrefetchStats->prefetch);
+		else
+			XLogPrefetchIncrement(&PrefetchStats->skip_hit);
+
+		prefetcher->recent[prefetcher->next_recent] = tag;
+		prefetcher->next_recent = (prefetcher->next_recent + 1) %
+			XLOGPREFETCH_RECENT_BLOCKS;
+	}
+}
+
+/*
+ * XLogReader page read callback, which reads the WAL segment files in
+ * pg_wal directly and never waits for more WAL.
+ */
+static int
+XLogPrefetcherPageRead(XLogReaderState *reader, XLogRecPtr targetPagePtr,
+					   int reqLen, XLogRecPtr targetRecPtr, char *readBuf,
+					   TimeLineID *pageTLI)
+{
+	XLogPrefetcher *prefetcher = (XLogPrefetcher *) reader->private_data;
+	XLogRecPtr	received_upto;
+	XLogSegNo	segno;
+	off_t		offset;
+	int			len = XLOG_BLCKSZ;
+
+	/* Don't read what the WAL receiver hasn't written yet. */
+	received_upto = GetWalRcvWriteRecPtr(NULL, NULL);
+	if (!XLogRecPtrIsInvalid(received_upto))
+	{
+		if (targetPagePtr + reqLen > received_upto)
+			return -1;
+		if (targetPagePtr + XLOG_BLCKSZ > received_upto)
+			len = received_upto - targetPagePtr;
+	}
+
+	XLByteToSeg(targetPagePtr, segno, wal_segment_size);
+	if (prefetcher->fd >= 0 && segno != prefetcher->segno)
+	{
+		CloseTransientFile(prefetcher->fd);
+		prefetcher->fd = -1;
+	}
+	if (prefetcher->fd < 0)
+	{
+		char		path[MAXPGPATH];
+
+		XLogFilePath(path, prefetcher->tli, segno, wal_segment_size);
+		prefetcher->fd = OpenTransientFile(path, O_RDONLY | PG_BINARY);
+		if (prefetcher->fd < 0)
+			return -1;
+		prefetcher->segno = segno;
+	}
+
+	offset = XLogSegmentOffset(targetPagePtr, wal_segment_size);
+	pgstat_report_wait_start(WAIT_EVENT_WAL_READ);
+	if (pg_pread(prefetcher->fd, readBuf, len, offset) != len)
+	{
+		pgstat_report_wait_end();
+		return -1;
+	}
+	pgstat_report_wait_end();
+
+	*pageTLI = prefetcher->tli;
+
+	return len;
+}
+
+/*
+ * SQL-callable function for the pg_stat_recovery_prefetch view.
+ */
+Datum
+pg_stat_get_recovery_prefetch(PG_FUNCTION_ARGS)
+{
+#define PG_STAT_GET_RECOVERY_PREFETCH_COLS 8
+	TupleDesc	tupdesc;
+	Datum		values[PG_STAT_GET_RECOVERY_PREFETCH_COLS];
+	bool		nulls[PG_STAT_GET_RECOVERY_PREFETCH_COLS];
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	MemSet(nulls, 0, sizeof(nulls));
+
+	values[0] = TimestampTzGetDatum(pg_atomic_read_u64(&PrefetchStats->reset_time));
+	values[1] = Int64GetDatum(pg_atomic_read_u64(&PrefetchStats->prefetch));
+	values[2] = Int64GetDatum(pg_atomic_read_u64(&PrefetchStats->skip_hit));
+	values[3] = Int64GetDatum(pg_atomic_read_u64(&PrefetchStats->skip_new));
+	values[4] = Int64GetDatum(pg_atomic_read_u64(&PrefetchStats->skip_fpw));
+	values[5] = Int64GetDatum(pg_atomic_read_u64(&PrefetchStats->skip_init));
+	values[6] = Int64GetDatum(pg_atomic_read_u64(&PrefetchStats->skip_rep));
+	values[7] = Int32GetDatum(pg_atomic_read_u32(&PrefetchStats->distance));
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls)));
+}
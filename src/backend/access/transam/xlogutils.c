@@ -720,6 +720,7 @@ XLogRead(char *buf, int segsize, TimeLineID tli, XLogRecPtr startptr,
 		uint32		startoff;
 		int			segbytes;
 		int			readbytes;
+		instr_time	io_start;
 
 		startoff = XLogSegmentOffset(recptr, segsize);
 
@@ -779,9 +780,13 @@ XLogRead(char *buf, int segsize, TimeLineID tli, XLogRecPtr startptr,
 		else
 			segbytes = nbytes;
 
+		io_start = pgstat_io_start();
 		pgstat_report_wait_start(WAIT_EVENT_WAL_READ);
 		readbytes = read(sendFile, p, segbytes);
 		pgstat_report_wait_end();
+		if (readbytes > 0)
+			pgstat_count_io(IOOBJECT_WAL, IOCONTEXT_NORMAL, IOOP_READ, 1,
+							io_start);
 		if (readbytes <= 0)
 		{
 			char		path[MAXPGPATH];
@@ -26,13 +26,37 @@
  * separately if we encounter the corresponding log first.  If we want we can
  * combine the log for processing in that case as well, but there is no clear
  * advantage of the same.
+ *
+ * There can be several discard workers (see undo_discard_workers).  The undo
+ * logs are divided among them by log number modulo the number of workers, and
+ * each worker only ever looks at its own logs.  Each worker publishes the
+ * oldest transaction having undo in its logs, and the minimum of them is what
+ * becomes oldestXidWithEpochHavingUndo.
+ *
+ * When there is nothing to discard, a worker doesn't poll.  It publishes
+ * the oldest xid that still has undo and goes to sleep; a backend ending a
+ * transaction whose xid or xmin is not newer than that xid may be moving the
+ * global xmin horizon past it, so it wakes the worker through its latch.  If
+ * no undo is left in the worker's logs, the first transaction that wrote undo
+ * wakes it instead.  The worker still wakes up every MAX_NAPTIME_PER_CYCLE, to catch
+ * horizon changes that happen without a transaction ending (e.g. a snapshot
+ * being released) and to retry discarding undo of aborted transactions whose
+ * actions were applied meanwhile.
+ *
+ * The undo kept for old snapshots can be limited by size and age (see
+ * undo_retention_size and undo_retention_time).  The undo of a log beyond
+ * those limits is discarded even though the global xmin horizon hasn't moved
+ * past it, and queries whose snapshot would need it fail with "snapshot too
+ * old" when they find it gone.
  *-------------------------------------------------------------------------
  */
 
 #include "postgres.h"
 #include <unistd.h>
 
+#include "access/transam.h"
 #include "access/undodiscard.h"
+#include "access/undolog.h"
 #include "access/discardworker.h"
 #include "miscadmin.h"
 #include "pgstat.h"
@@ -48,15 +72,42 @@
 #include "utils/resowner.h"
 
 static void undoworker_sigterm_handler(SIGNAL_ARGS);
+static void DiscardWorkerSighup(SIGNAL_ARGS);
+static void DiscardWorkerOnExit(int code, Datum arg);
+static void DiscardWorkerArmWakeup(TransactionId wakeup_xid);
+static void DiscardWorkerAdvanceOldestXidHavingUndo(FullTransactionId oldest);
 
-/* max sleep time between cycles (100 milliseconds) */
+/* sleep time between cycles while there is work to do (100 milliseconds) */
 #define MIN_NAPTIME_PER_CYCLE 100L
-#define DELAYED_NAPTIME 10 * MIN_NAPTIME_PER_CYCLE
+/* max sleep time while waiting for a wakeup (10 seconds) */
 #define MAX_NAPTIME_PER_CYCLE 100 * MIN_NAPTIME_PER_CYCLE
 
+/*
+ * Per-worker shared state, used by backends to wake up the discard workers.
+ *
+ * wakeup_armed is set by the worker when it goes to sleep because there is
+ * nothing to discard, and cleared by whoever wakes it, so that a burst of
+ * transactions ending sets the latch only once.  wakeup_xid is the oldest xid
+ * that still has undo in the worker's logs, or InvalidTransactionId if there
+ * is none.  oldest_xid_having_undo is the worker's share of
+ * oldestXidWithEpochHavingUndo, or zero until the worker has computed it.
+ */
+typedef struct DiscardWorkerSlot
+{
+	Latch	   *latch;			/* discard worker's latch, or NULL */
+	pg_atomic_uint32 wakeup_armed;
+	pg_atomic_uint32 wakeup_xid;
+	pg_atomic_uint64 oldest_xid_having_undo;
+} DiscardWorkerSlot;
+
+/* GUC: number of discard workers. */
+int			undo_discard_workers = 1;
+
+static DiscardWorkerSlot *DiscardWorkerSlots = NULL;
+static DiscardWorkerSlot *MyDiscardWorkerSlot = NULL;
+
 static bool got_SIGTERM = false;
-static bool hibernate = false;
-static long wait_time = MIN_NAPTIME_PER_CYCLE;
+static volatile sig_atomic_t got_SIGHUP = false;
 static bool am_discard_worker = false;
 
 /* SIGTERM: set flag to exit at next convenient time */
@@ -69,41 +120,216 @@ undoworker_sigterm_handler(SIGNAL_ARGS)
 	SetLatch(MyLatch);
 }
 
+/* SIGHUP: set flag to reload configuration at next convenient time */
+static void
+DiscardWorkerSighup(SIGNAL_ARGS)
+{
+	int			save_errno = errno;
+
+	got_SIGHUP = true;
+
+	/* Waken anything waiting on the process latch */
+	SetLatch(MyLatch);
+
+	errno = save_errno;
+}
+
 /*
- * DiscardWorkerRegister -- Register a undo discard worker.
+ * DiscardWorkerShmemSize -- Report shared memory space needed by
+ * DiscardWorkerShmemInit.
+ */
+Size
+DiscardWorkerShmemSize(void)
+{
+	return mul_size(undo_discard_workers, sizeof(DiscardWorkerSlot));
+}
+
+/*
+ * DiscardWorkerShmemInit -- Allocate and initialize the discard workers'
+ * shared memory.
+ */
+void
+DiscardWorkerShmemInit(void)
+{
+	bool		found;
+	int			i;
+
+	DiscardWorkerSlots = (DiscardWorkerSlot *)
+		ShmemInitStruct("Discard Worker Data", DiscardWorkerShmemSize(),
+						&found);
+
+	if (!found)
+	{
+		for (i = 0; i < undo_discard_workers; i++)
+		{
+			DiscardWorkerSlot *slot = &DiscardWorkerSlots[i];
+
+			slot->latch = NULL;
+			pg_atomic_init_u32(&slot->wakeup_armed, 0);
+			pg_atomic_init_u32(&slot->wakeup_xid, InvalidTransactionId);
+			pg_atomic_init_u64(&slot->oldest_xid_having_undo, 0);
+		}
+	}
+}
+
+/*
+ * DiscardWorkerOnExit -- Forget our latch, so that nobody tries to set it
+ * after we're gone.
+ */
+static void
+DiscardWorkerOnExit(int code, Datum arg)
+{
+	pg_atomic_write_u32(&MyDiscardWorkerSlot->wakeup_armed, 0);
+	MyDiscardWorkerSlot->latch = NULL;
+}
+
+/*
+ * DiscardWorkerArmWakeup -- Ask backends to wake us up once the global xmin
+ * horizon may have moved past wakeup_xid, or once some undo is written if
+ * wakeup_xid is invalid.
+ */
+static void
+DiscardWorkerArmWakeup(TransactionId wakeup_xid)
+{
+	pg_atomic_write_u32(&MyDiscardWorkerSlot->wakeup_xid, wakeup_xid);
+	pg_write_barrier();
+	pg_atomic_write_u32(&MyDiscardWorkerSlot->wakeup_armed, 1);
+}
+
+/*
+ * DiscardWorkerAdvanceOldestXidHavingUndo -- Publish the oldest transaction
+ * having undo in our logs, and update oldestXidWithEpochHavingUndo.
+ *
+ * oldestXidWithEpochHavingUndo is the minimum of what all the workers have
+ * published.  It's left alone until every worker has published something,
+ * since the value we got from the checkpoint is the only safe one until then.
+ * Each worker's value only moves forward, so even if two workers race here,
+ * whatever ends up in shared memory can't be newer than the real minimum.
+ */
+static void
+DiscardWorkerAdvanceOldestXidHavingUndo(FullTransactionId oldest)
+{
+	uint64		result = U64FromFullTransactionId(oldest);
+	int			i;
+
+	pg_atomic_write_u64(&MyDiscardWorkerSlot->oldest_xid_having_undo, result);
+
+	for (i = 0; i < undo_discard_workers; i++)
+	{
+		uint64		value;
+
+		value = pg_atomic_read_u64(&DiscardWorkerSlots[i].oldest_xid_having_undo);
+		if (value == 0)
+			return;
+		if (value < result)
+			result = value;
+	}
+
+	pg_atomic_write_u64(&ProcGlobal->oldestXidWithEpochHavingUndo, result);
+}
+
+/*
+ * DiscardWorkerWakeupIfNeeded -- Wake up the discard workers if the end of a
+ * transaction can allow them to discard more undo.
+ *
+ * This is called by every transaction right after it has been removed from
+ * the set of running transactions, with the xid and xmin it had advertised.
+ * wrote_undo tells whether the transaction has written any undo.  Unless some
+ * worker is waiting for a wakeup, this costs one atomic read per worker.
+ */
+void
+DiscardWorkerWakeupIfNeeded(TransactionId xid, TransactionId xmin,
+							bool wrote_undo)
+{
+	int			i;
+
+	if (DiscardWorkerSlots == NULL)
+		return;
+
+	for (i = 0; i < undo_discard_workers; i++)
+	{
+		DiscardWorkerSlot *slot = &DiscardWorkerSlots[i];
+		TransactionId wakeup_xid;
+		Latch	   *latch;
+
+		if (pg_atomic_read_u32(&slot->wakeup_armed) == 0)
+			continue;
+
+		pg_read_barrier();
+		wakeup_xid = pg_atomic_read_u32(&slot->wakeup_xid);
+
+		if (TransactionIdIsValid(wakeup_xid))
+		{
+			/*
+			 * Only a transaction that was holding back the horizon at or
+			 * before the oldest transaction having undo can move the horizon
+			 * past it.
+			 */
+			if (!(TransactionIdIsNormal(xid) &&
+				  TransactionIdPrecedesOrEquals(xid, wakeup_xid)) &&
+				!(TransactionIdIsNormal(xmin) &&
+				  TransactionIdPrecedesOrEquals(xmin, wakeup_xid)))
+				continue;
+		}
+		else if (!wrote_undo)
+			continue;
+
+		/* Somebody else might have beaten us to it. */
+		if (pg_atomic_exchange_u32(&slot->wakeup_armed, 0) == 0)
+			continue;
+
+		latch = slot->latch;
+		if (latch)
+			SetLatch(latch);
+	}
+}
+
+/*
+ * DiscardWorkerRegister -- Register the undo discard workers.
  */
 void
 DiscardWorkerRegister(void)
 {
 	BackgroundWorker bgw;
+	int			i;
 
-	/* TODO: This should be configurable. */
-
-	memset(&bgw, 0, sizeof(bgw));
-	bgw.bgw_flags = BGWORKER_SHMEM_ACCESS |
-		BGWORKER_BACKEND_DATABASE_CONNECTION;
-	bgw.bgw_start_time = BgWorkerStart_RecoveryFinished;
-	snprintf(bgw.bgw_name, BGW_MAXLEN, "discard worker");
-	sprintf(bgw.bgw_library_name, "postgres");
-	sprintf(bgw.bgw_function_name, "DiscardWorkerMain");
-	bgw.bgw_restart_time = 5;
-	bgw.bgw_notify_pid = 0;
-	bgw.bgw_main_arg = (Datum) 0;
+	for (i = 0; i < undo_discard_workers; i++)
+	{
+		memset(&bgw, 0, sizeof(bgw));
+		bgw.bgw_flags = BGWORKER_SHMEM_ACCESS |
+			BGWORKER_BACKEND_DATABASE_CONNECTION;
+		bgw.bgw_start_time = BgWorkerStart_RecoveryFinished;
+		if (undo_discard_workers > 1)
+			snprintf(bgw.bgw_name, BGW_MAXLEN, "discard worker %d", i);
+		else
+			snprintf(bgw.bgw_name, BGW_MAXLEN, "discard worker");
+		sprintf(bgw.bgw_library_name, "postgres");
+		sprintf(bgw.bgw_function_name, "DiscardWorkerMain");
+		bgw.bgw_restart_time = 5;
+		bgw.bgw_notify_pid = 0;
+		bgw.bgw_main_arg = Int32GetDatum(i);
 
-	RegisterBackgroundWorker(&bgw);
+		RegisterBackgroundWorker(&bgw);
+	}
 }
 
 /*
  * DiscardWorkerMain -- Main loop for the undo discard worker.
+ *
+ * main_arg is the number of the worker, which decides the undo logs it owns.
  */
 void
 DiscardWorkerMain(Datum main_arg)
 {
+	int			worker_id = DatumGetInt32(main_arg);
+	TransactionId wakeup_xid = InvalidTransactionId;
+
 	ereport(LOG,
-			(errmsg("discard worker started")));
+			(errmsg("discard worker %d started", worker_id)));
 
 	/* Establish signal handlers. */
 	pqsignal(SIGTERM, undoworker_sigterm_handler);
+	pqsignal(SIGHUP, DiscardWorkerSighup);
 	BackgroundWorkerUnblockSignals();
 
 	am_discard_worker = true;
@@ -115,13 +341,26 @@ DiscardWorkerMain(Datum main_arg)
 	/* Establish connection to nailed catalogs. */
 	BackgroundWorkerInitializeConnection(NULL, NULL, 0);
 
+	/* Advertise our latch, so that backends can wake us up. */
+	Assert(worker_id >= 0 && worker_id < undo_discard_workers);
+	MyDiscardWorkerSlot = &DiscardWorkerSlots[worker_id];
+	pg_atomic_write_u32(&MyDiscardWorkerSlot->wakeup_armed, 0);
+	MyDiscardWorkerSlot->latch = &MyProc->procLatch;
+	before_shmem_exit(DiscardWorkerOnExit, (Datum) 0);
+
 	/* Enter main loop */
 	while (!got_SIGTERM)
 	{
 		int			rc;
+		bool		hibernate = true;
+		long		wait_time;
+		TransactionId OldestXmin;
 
-		TransactionId OldestXmin,
-					oldestXidHavingUndo;
+		if (got_SIGHUP)
+		{
+			got_SIGHUP = false;
+			ProcessConfigFile(PGC_SIGHUP);
+		}
 
 		/*
 		 * It is okay to ignore vacuum transaction here, as we can discard the
@@ -131,27 +370,65 @@ DiscardWorkerMain(Datum main_arg)
 		OldestXmin = GetOldestXmin(NULL, PROCARRAY_FLAGS_AUTOVACUUM |
 								   PROCARRAY_FLAGS_VACUUM);
 
-		oldestXidHavingUndo = GetXidFromEpochXid(
-												 pg_atomic_read_u64(&ProcGlobal->oldestXidWithEpochHavingUndo));
-
 		/*
-		 * Call the discard routine if there oldestXidHavingUndo is lagging
-		 * behind OldestXmin.
+		 * Call the discard routine unless we know that the oldest transaction
+		 * having undo is still not older than OldestXmin.  If we don't know
+		 * of any undo, some might have been written since the last cycle.
+		 * With the undo retention limited, undo can have to be discarded
+		 * without the horizon moving, so we always check.
 		 */
 		if (OldestXmin != InvalidTransactionId &&
-			TransactionIdPrecedes(oldestXidHavingUndo, OldestXmin))
+			(!TransactionIdIsValid(wakeup_xid) ||
+			 TransactionIdPrecedes(wakeup_xid, OldestXmin) ||
+			 undo_retention_size > 0 || undo_retention_time > 0))
+		{
+			FullTransactionId oldestXidHavingUndo;
+
+			wakeup_xid = UndoDiscard(OldestXmin, undo_discard_workers,
+									 worker_id, &oldestXidHavingUndo,
+									 &hibernate);
+			DiscardWorkerAdvanceOldestXidHavingUndo(oldestXidHavingUndo);
+		}
+
+		if (!hibernate)
 		{
-			UndoDiscard(OldestXmin, &hibernate);
+			/*
+			 * We got some undo logs to discard or discarded something, so
+			 * there might be more work soon.  Check again after a short nap,
+			 * rather than being woken up by every transaction that ends.
+			 */
+			wait_time = MIN_NAPTIME_PER_CYCLE;
+		}
+		else
+		{
+			/*
+			 * Nothing to do.  Ask backends to wake us up when the horizon can
+			 * move past wakeup_xid, then recheck it in case it already did
+			 * while we were busy.
+			 */
+			DiscardWorkerArmWakeup(wakeup_xid);
+
+			OldestXmin = GetOldestXmin(NULL, PROCARRAY_FLAGS_AUTOVACUUM |
+									   PROCARRAY_FLAGS_VACUUM);
+			if (TransactionIdIsValid(wakeup_xid) &&
+				TransactionIdIsValid(OldestXmin) &&
+				TransactionIdPrecedes(wakeup_xid, OldestXmin))
+			{
+				pg_atomic_write_u32(&MyDiscardWorkerSlot->wakeup_armed, 0);
+				continue;
+			}
 
 			/*
-			 * If we got some undo logs to discard or discarded something,
-			 * then reset the wait_time as we have got work to do. Note that
-			 * if there are some undologs that cannot be discarded, then above
-			 * condition will remain unsatisfied till oldestXmin remains
-			 * unchanged and the wait_time will not reset in that case.
+			 * Use the idle time to create free undo segments and undo logs
+			 * ahead of time; one worker is enough for that.
 			 */
-			if (!hibernate)
-				wait_time = MIN_NAPTIME_PER_CYCLE;
+			if (worker_id == 0)
+			{
+				UndoLogPreallocateSegments();
+				UndoLogPrecreateLogs();
+			}
+
+			wait_time = MAX_NAPTIME_PER_CYCLE;
 		}
 
 		/* Wait for more work. */
@@ -162,20 +439,8 @@ DiscardWorkerMain(Datum main_arg)
 
 		ResetLatch(&MyProc->procLatch);
 
-		/*
-		 * Increase the wait_time based on the length of inactivity. If
-		 * wait_time is within one second, then increment it by 100 ms at a
-		 * time. Henceforth, increment it one second at a time, till it
-		 * reaches ten seconds. Never increase the wait_time more than ten
-		 * seconds, it will be too much of waiting otherwise.
-		 */
-		if (rc & WL_TIMEOUT && hibernate)
-		{
-			wait_time += (wait_time < DELAYED_NAPTIME ?
-						  MIN_NAPTIME_PER_CYCLE : DELAYED_NAPTIME);
-			if (wait_time > MAX_NAPTIME_PER_CYCLE)
-				wait_time = MAX_NAPTIME_PER_CYCLE;
-		}
+		/* We'll rearm the wakeup if we find nothing to do again. */
+		pg_atomic_write_u32(&MyDiscardWorkerSlot->wakeup_armed, 0);
 
 		/* emergency bailout if postmaster has died */
 		if (rc & WL_POSTMASTER_DEATH)
@@ -184,7 +449,7 @@ DiscardWorkerMain(Datum main_arg)
 
 	/* we're done */
 	ereport(LOG,
-			(errmsg("discard worker shutting down")));
+			(errmsg("discard worker %d shutting down", worker_id)));
 
 	proc_exit(0);
 }
@@ -16,6 +16,7 @@
 #include "access/table.h"
 #include "access/tpd.h"
 #include "access/undoaction_xlog.h"
+#include "access/undolocal.h"
 #include "access/undolog.h"
 #include "access/undorequest.h"
 #include "access/xact.h"
@@ -68,6 +69,36 @@ PrefetchUndoPages(RelFileNode rnode, int prefetch_target, int *prefetch_pages,
 	}
 }
 
+/*
+ * UndoPrefetchRecord - Prefetch the undo page holding an undo record
+ *
+ * This is for callers that follow an undo chain in batches, so that the page
+ * the next batch starts on can be read in while they apply the current one.
+ * Nothing is done if the record has been discarded meanwhile.
+ */
+void
+UndoPrefetchRecord(UndoRecPtr urecptr)
+{
+	RelFileNode rnode;
+	UndoLogControl *log;
+
+	if (!UndoRecPtrIsValid(urecptr))
+		return;
+
+	log = UndoLogGet(UndoRecPtrGetLogNo(urecptr));
+	LWLockAcquire(&log->discard_lock, LW_SHARED);
+
+	/* UndoRecordIsValid releases the lock if the record is discarded. */
+	if (!UndoRecordIsValid(urecptr))
+		return;
+
+	UndoRecPtrAssignRelFileNode(rnode, urecptr);
+	PrefetchBufferWithoutRelcache(rnode, MAIN_FORKNUM,
+								  UndoRecPtrGetBlockNum(urecptr),
+								  RelPersistenceForUndoPersistence(log->meta.persistence));
+	LWLockRelease(&log->discard_lock);
+}
+
 /*
  * UndoRecordBulkFetch  - Read undo records in bulk
  *
@@ -324,68 +355,96 @@ undo_record_comparator(const void *left, const void *right)
 }
 
 /*
- * execute_undo_actions - Execute the undo actions
+ * UndoBlockInPartitions - Does the block belong to one of the given
+ * partitions?
  *
- * xid - Transaction id that is getting rolled back.
- * from_urecptr - undo record pointer from where to start applying undo action.
- * to_urecptr	- undo record pointer upto which point apply undo action.
- * nopartial	- true if rollback is for complete transaction.
+ * For parallel apply, the blocks of all the relations touched by a
+ * transaction are split into nparts partitions of runs of
+ * UNDO_APPLY_PARTITION_BLOCKS consecutive blocks, assigned round-robin.  All
+ * the undo records of a given block thus always belong to the same partition,
+ * which is what allows different workers to apply them independently.  Undo
+ * records that are not for a particular block go to the first partition.
  */
-void
-execute_undo_actions(FullTransactionId full_xid, UndoRecPtr from_urecptr,
-					 UndoRecPtr to_urecptr, bool nopartial)
+static inline bool
+UndoBlockInPartitions(BlockNumber blkno, int nparts, uint32 parts)
 {
-	UnpackedUndoRecord *uur = NULL;
-	UndoRecInfo *urp_array;
-	UndoRecPtr	urec_ptr;
-	ForkNumber	prev_fork = InvalidForkNumber;
-	BlockNumber prev_block = InvalidBlockNumber;
-	int			undo_apply_size = maintenance_work_mem * 1024L;
-	TransactionId xid PG_USED_FOR_ASSERTS_ONLY = XidFromFullTransactionId(full_xid);
+	int			part;
 
-	/* 'from' and 'to' pointers must be valid. */
-	Assert(from_urecptr != InvalidUndoRecPtr);
-	Assert(to_urecptr != InvalidUndoRecPtr);
+	if (nparts <= 1)
+		return true;
 
-	urec_ptr = from_urecptr;
+	if (!BlockNumberIsValid(blkno))
+		part = 0;
+	else
+		part = (blkno / UNDO_APPLY_PARTITION_BLOCKS) % nparts;
 
-	if (nopartial)
-	{
-		/*
-		 * It is important here to fetch the latest undo record and validate
-		 * if the actions are already executed.  The reason is that it is
-		 * possible that discard worker or backend might try to execute the
-		 * rollback request which is already executed.  For ex., after discard
-		 * worker fetches the record and found that this transaction need to
-		 * be rolledback, backend might concurrently execute the actions and
-		 * remove the request from rollback hash table. The similar problem
-		 * can happen if the discard worker first pushes the request, the undo
-		 * worker processed it and backend tries to process it some later
-		 * point.
-		 */
-		uur = UndoFetchRecord(to_urecptr, InvalidBlockNumber, InvalidOffsetNumber,
-							  InvalidTransactionId, NULL, NULL);
+	return (parts & (1U << part)) != 0;
+}
 
-		/* already processed. */
-		if (uur == NULL)
-			return;
+/*
+ * undo_actions_pending - Check whether the undo actions of the transaction
+ * still need to be applied.
+ *
+ * It is important here to fetch the latest undo record and validate if the
+ * actions are already executed.  The reason is that it is possible that
+ * discard worker or backend might try to execute the rollback request which
+ * is already executed.  For ex., after discard worker fetches the record and
+ * found that this transaction need to be rolledback, backend might
+ * concurrently execute the actions and remove the request from rollback hash
+ * table. The similar problem can happen if the discard worker first pushes
+ * the request, the undo worker processed it and backend tries to process it
+ * some later point.
+ */
+static bool
+undo_actions_pending(FullTransactionId full_xid, UndoRecPtr to_urecptr)
+{
+	UnpackedUndoRecord *uur;
+	TransactionId xid PG_USED_FOR_ASSERTS_ONLY = XidFromFullTransactionId(full_xid);
 
-		/*
-		 * We don't need to execute the undo actions if they are already
-		 * executed.
-		 */
-		if (uur->uur_progress != 0)
-		{
-			UndoRecordRelease(uur);
-			return;
-		}
+	uur = UndoFetchRecord(to_urecptr, InvalidBlockNumber, InvalidOffsetNumber,
+						  InvalidTransactionId, NULL, NULL);
 
-		Assert(xid == uur->uur_xid);
+	/* already processed. */
+	if (uur == NULL)
+		return false;
 
+	/*
+	 * We don't need to execute the undo actions if they are already
+	 * executed.
+	 */
+	if (uur->uur_progress != 0)
+	{
 		UndoRecordRelease(uur);
-		uur = NULL;
+		return false;
 	}
 
+	Assert(xid == uur->uur_xid);
+
+	UndoRecordRelease(uur);
+
+	return true;
+}
+
+/*
+ * apply_undo_actions - Apply the undo actions of the blocks that belong to
+ * the given partitions.
+ *
+ * See execute_undo_actions for the meaning of the other arguments.
+ */
+static void
+apply_undo_actions(FullTransactionId full_xid, UndoRecPtr from_urecptr,
+				   UndoRecPtr to_urecptr, bool nopartial, int nparts,
+				   uint32 parts)
+{
+	UndoRecInfo *urp_array;
+	UndoRecPtr	urec_ptr;
+	ForkNumber	prev_fork = InvalidForkNumber;
+	BlockNumber prev_block = InvalidBlockNumber;
+	int			undo_apply_size = maintenance_work_mem * 1024L;
+	TransactionId xid PG_USED_FOR_ASSERTS_ONLY = XidFromFullTransactionId(full_xid);
+
+	urec_ptr = from_urecptr;
+
 	/*
 	 * Fetch the multiple undo records which can fit into uur_segment; sort
 	 * them in order of reloid and block number then apply them together
@@ -399,6 +458,8 @@ execute_undo_actions(FullTransactionId full_xid, UndoRecPtr from_urecptr,
 		int			i;
 		int			nrecords;
 		int			last_index = 0;
+		int			run_index = 0;
+		int			run_pages = 0;
 		int			prefetch_pages = 0;
 
 		/*
@@ -409,6 +470,15 @@ execute_undo_actions(FullTransactionId full_xid, UndoRecPtr from_urecptr,
 		if (!UndoRecPtrIsValid(urec_ptr))
 			break;
 
+		/*
+		 * The records of a short rollback in our own backend are likely to
+		 * be still in the local buffer, in which case we needn't read them.
+		 */
+		urp_array = NULL;
+		if (urec_ptr == from_urecptr && nparts == 1)
+			urp_array = UndoLocalBufferFetch(from_urecptr, to_urecptr,
+											 &nrecords);
+
 		/*
 		 * Fetch multiple undo record in bulk.  This will return the array of
 		 * undo record which will holds undo record pointers and the pointers
@@ -419,8 +489,11 @@ execute_undo_actions(FullTransactionId full_xid, UndoRecPtr from_urecptr,
 		 * blocks for which undo actions are going to applied for this undo
 		 * record batch.
 		 */
-		urp_array = UndoRecordBulkFetch(&urec_ptr, to_urecptr, undo_apply_size,
-										&nrecords, false);
+		if (urp_array != NULL)
+			urec_ptr = InvalidUndoRecPtr;
+		else
+			urp_array = UndoRecordBulkFetch(&urec_ptr, to_urecptr,
+											undo_apply_size, &nrecords, false);
 		if (nrecords == 0)
 			break;
 
@@ -437,42 +510,79 @@ execute_undo_actions(FullTransactionId full_xid, UndoRecPtr from_urecptr,
 
 		/*
 		 * Now we have urp_array which is sorted in the block order so
-		 * traverse this array and apply the undo action block by block.
+		 * traverse this array and apply the undo actions of runs of
+		 * consecutive blocks of the same relation, up to
+		 * UNDO_APPLY_MAX_PAGES blocks at a time.  last_index is the first
+		 * record of the current block, and run_index that of the current
+		 * run.
 		 */
-		for (i = last_index; i < nrecords; i++)
+		for (i = last_index; i <= nrecords; i++)
 		{
-			UnpackedUndoRecord *uur = urp_array[i].uur;
+			UnpackedUndoRecord *uur = (i < nrecords) ? urp_array[i].uur : NULL;
+			bool		same_rel;
+
+			if (prev_rmid < 0)
+			{
+				Assert(uur != NULL);
+				prev_rmid = uur->uur_rmid;
+				prev_reloid = uur->uur_reloid;
+				prev_fork = uur->uur_fork;
+				prev_block = uur->uur_block;
+				continue;
+			}
+
+			same_rel = (uur != NULL &&
+						prev_rmid == uur->uur_rmid &&
+						prev_reloid == uur->uur_reloid &&
+						prev_fork == uur->uur_fork);
+
+			/* Nothing to do until we're past the records of this block. */
+			if (same_rel && prev_block == uur->uur_block)
+				continue;
 
 			/*
-			 * If this undo is not for the same block then apply all undo
-			 * actions for the previous block.
+			 * Add the block to the run, or apply the run if the block belongs
+			 * to another worker.
 			 */
-			if (prev_rmid >= 0 &&
-				(prev_rmid != uur->uur_rmid ||
-				 prev_reloid != uur->uur_reloid ||
-				 prev_fork != uur->uur_fork ||
-				 prev_block != uur->uur_block))
+			if (UndoBlockInPartitions(prev_block, nparts, parts))
+				run_pages++;
+			else
 			{
-				execute_undo_actions_page(urp_array, last_index, i - 1,
-										  prev_reloid, full_xid, prev_block,
-										  blk_chain_complete);
-				last_index = i;
+				if (run_pages > 0)
+					execute_undo_actions_page(urp_array, run_index,
+											  last_index - 1, prev_reloid,
+											  full_xid,
+											  urp_array[run_index].uur->uur_block,
+											  blk_chain_complete);
+				run_pages = 0;
+				run_index = i;
+			}
 
-				/* We have consumed one prefetched page. */
-				if (prefetch_pages > 0)
-					prefetch_pages--;
+			/* Apply the run if it is complete. */
+			if (run_pages > 0 &&
+				(!same_rel || run_pages == UNDO_APPLY_MAX_PAGES))
+			{
+				execute_undo_actions_page(urp_array, run_index, i - 1,
+										  prev_reloid, full_xid,
+										  urp_array[run_index].uur->uur_block,
+										  blk_chain_complete);
+				run_pages = 0;
+				run_index = i;
 			}
+			last_index = i;
 
-			prev_rmid = uur->uur_rmid;
-			prev_reloid = uur->uur_reloid;
-			prev_fork = uur->uur_fork;
-			prev_block = uur->uur_block;
-		}
+			/* We have consumed one prefetched page. */
+			if (prefetch_pages > 0)
+				prefetch_pages--;
 
-		/* Apply the last set of the actions. */
-		execute_undo_actions_page(urp_array, last_index, i - 1,
-								  prev_reloid, full_xid, prev_block,
-								  blk_chain_complete);
+			if (uur != NULL)
+			{
+				prev_rmid = uur->uur_rmid;
+				prev_reloid = uur->uur_reloid;
+				prev_fork = uur->uur_fork;
+				prev_block = uur->uur_block;
+			}
+		}
 
 		/* Free all undo records. */
 		for (i = 0; i < nrecords; i++)
@@ -484,49 +594,126 @@ execute_undo_actions(FullTransactionId full_xid, UndoRecPtr from_urecptr,
 		 */
 		pfree(urp_array);
 	} while (true);
+}
 
+/*
+ * complete_undo_actions - Mark the undo actions of the transaction as
+ * applied.
+ *
+ * Set undo action apply progress as completed in the transaction header and
+ * remove the rollback request from the hash table.
+ */
+static void
+complete_undo_actions(FullTransactionId full_xid, UndoRecPtr to_urecptr)
+{
 	/*
-	 * Set undo action apply progress as completed in the transaction header
-	 * if this is a main transaction.
+	 * Prepare and update the progress of the undo action apply in the
+	 * transaction header.
 	 */
-	if (nopartial)
+	PrepareUpdateUndoActionProgress(NULL, to_urecptr, 1);
+
+	START_CRIT_SECTION();
+
+	/* Update the progress in the transaction header. */
+	UndoRecordUpdateTransInfo(0);
+
+	/* WAL log the undo apply progress. */
 	{
-		/*
-		 * Prepare and update the progress of the undo action apply in the
-		 * transaction header.
-		 */
-		PrepareUpdateUndoActionProgress(NULL, to_urecptr, 1);
+		XLogRecPtr	lsn;
+		xl_undoapply_progress xlrec;
 
-		START_CRIT_SECTION();
+		xlrec.urec_ptr = to_urecptr;
+		xlrec.progress = 1;
 
-		/* Update the progress in the transaction header. */
-		UndoRecordUpdateTransInfo(0);
+		XLogBeginInsert();
+		XLogRegisterData((char *) &xlrec, sizeof(xlrec));
 
-		/* WAL log the undo apply progress. */
-		{
-			XLogRecPtr	lsn;
-			xl_undoapply_progress xlrec;
+		RegisterUndoLogBuffers(2);
+		lsn = XLogInsert(RM_UNDOACTION_ID, XLOG_UNDO_APPLY_PROGRESS);
+		UndoLogBuffersSetLSN(lsn);
+	}
 
-			xlrec.urec_ptr = to_urecptr;
-			xlrec.progress = 1;
+	END_CRIT_SECTION();
+	UnlockReleaseUndoBuffers();
 
-			XLogBeginInsert();
-			XLogRegisterData((char *) &xlrec, sizeof(xlrec));
+	/*
+	 * Undo action is applied so delete the hash table entry.
+	 */
+	Assert(FullTransactionIdIsValid(full_xid));
+	RollbackHTRemoveEntry(full_xid, to_urecptr);
+}
 
-			RegisterUndoLogBuffers(2);
-			lsn = XLogInsert(RM_UNDOACTION_ID, XLOG_UNDO_APPLY_PROGRESS);
-			UndoLogBuffersSetLSN(lsn);
-		}
+/*
+ * execute_undo_actions - Execute the undo actions
+ *
+ * xid - Transaction id that is getting rolled back.
+ * from_urecptr - undo record pointer from where to start applying undo action.
+ * to_urecptr	- undo record pointer upto which point apply undo action.
+ * nopartial	- true if rollback is for complete transaction.
+ */
+void
+execute_undo_actions(FullTransactionId full_xid, UndoRecPtr from_urecptr,
+					 UndoRecPtr to_urecptr, bool nopartial)
+{
+	/* 'from' and 'to' pointers must be valid. */
+	Assert(from_urecptr != InvalidUndoRecPtr);
+	Assert(to_urecptr != InvalidUndoRecPtr);
 
-		END_CRIT_SECTION();
-		UnlockReleaseUndoBuffers();
+	if (nopartial && !undo_actions_pending(full_xid, to_urecptr))
+		return;
 
-		/*
-		 * Undo action is applied so delete the hash table entry.
-		 */
-		Assert(TransactionIdIsValid(xid));
-		RollbackHTRemoveEntry(full_xid, to_urecptr);
-	}
+	apply_undo_actions(full_xid, from_urecptr, to_urecptr, nopartial, 1, 1);
+
+	/*
+	 * Set undo action apply progress as completed in the transaction header
+	 * if this is a main transaction.
+	 */
+	if (nopartial)
+		complete_undo_actions(full_xid, to_urecptr);
+}
+
+/*
+ * execute_undo_actions_parallel - Execute part of the undo actions of a
+ * complete transaction
+ *
+ * This is used when several undo workers cooperate to roll back a single
+ * large transaction.  Each participant applies the undo actions of the blocks
+ * in the partitions it has claimed (a bitmask of 'parts' out of 'nparts'
+ * partitions, see UndoBlockInPartitions), walking the whole undo of the
+ * transaction.  The progress in the transaction header is not updated here;
+ * once all the partitions are done the leader calls
+ * execute_undo_actions_finish.
+ *
+ * Returns false, if the undo actions are already applied.
+ */
+bool
+execute_undo_actions_parallel(FullTransactionId full_xid,
+							  UndoRecPtr from_urecptr, UndoRecPtr to_urecptr,
+							  int nparts, uint32 parts)
+{
+	Assert(from_urecptr != InvalidUndoRecPtr);
+	Assert(to_urecptr != InvalidUndoRecPtr);
+	Assert(nparts > 0 && nparts <= UNDO_APPLY_MAX_PARTITIONS);
+
+	if (!undo_actions_pending(full_xid, to_urecptr))
+		return false;
+
+	apply_undo_actions(full_xid, from_urecptr, to_urecptr, true, nparts,
+					   parts);
+
+	return true;
+}
+
+/*
+ * execute_undo_actions_finish - Mark the undo actions of a complete
+ * transaction as applied, after all the partitions have been applied by
+ * execute_undo_actions_parallel.
+ */
+void
+execute_undo_actions_finish(FullTransactionId full_xid, UndoRecPtr to_urecptr)
+{
+	if (undo_actions_pending(full_xid, to_urecptr))
+		complete_undo_actions(full_xid, to_urecptr);
 }
 
 /*
@@ -535,9 +722,12 @@ execute_undo_actions(FullTransactionId full_xid, UndoRecPtr from_urecptr,
  *	urp_array - array of undo records (along with their location) for which undo
  *				action needs to be applied.
  *	first_idx - index in the urp_array of the first undo action to be applied
- *	last_idx  - index in the urp_array of the first undo action to be applied
+ *	last_idx  - index in the urp_array of the last undo action to be applied
  *	reloid	- OID of relation on which undo actions needs to be applied.
- *	blkno	- block number on which undo actions needs to be applied.
+ *	blkno	- block number on which undo actions needs to be applied.  The
+ *			  records can also cover up to UNDO_APPLY_MAX_PAGES blocks of the
+ *			  relation in block number order, in which case this is the
+ *			  first of them.
  *	blk_chain_complete - indicates whether the undo chain for block is
  *						 complete.
  *
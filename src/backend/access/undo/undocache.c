@@ -0,0 +1,214 @@
+/*-------------------------------------------------------------------------
+ *
+ * undocache.c
+ *	  shared cache of unpacked undo records
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * src/backend/access/undo/undocache.c
+ *
+ * NOTES:
+ * Backends that reconstruct old tuple versions with the same snapshot tend to
+ * walk the same undo chains again and again.  To avoid pinning the undo
+ * buffer and unpacking the same record each time, UndoFetchRecord keeps the
+ * records it has unpacked while following a chain in a small direct-mapped
+ * cache in shared memory, keyed by UndoRecPtr.  A newer record that maps to
+ * the same slot simply evicts the older one, so the cache never needs to
+ * allocate memory after startup.
+ *
+ * Undo records are never modified after they are inserted, except for the
+ * next-transaction pointer and the undo apply progress stored in the first
+ * record of each transaction.  Those fields are only ever consumed by the
+ * discard and rollback machinery, which always fetches records without a
+ * block number and therefore bypasses the cache.  An undo record pointer is
+ * never reused, so a cache entry can only become stale by being discarded;
+ * UndoFetchRecord checks the discard pointer before it consults the cache,
+ * so entries that the discard pointer has moved past are never returned and
+ * are eventually overwritten.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "access/undocache.h"
+#include "miscadmin.h"
+#include "storage/bufmgr.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/hashutils.h"
+
+typedef struct UndoRecordCacheEntry
+{
+	UndoRecPtr	urp;			/* InvalidUndoRecPtr, if the entry is unused */
+	UnpackedUndoRecord uur;		/* record header; data pointers are unused */
+	char		data[UNDO_CACHE_MAX_DATA];	/* payload followed by tuple */
+} UndoRecordCacheEntry;
+
+typedef struct UndoRecordCacheCtl
+{
+	LWLockPadded locks[NUM_UNDO_CACHE_PARTITIONS];
+	UndoRecordCacheEntry entries[FLEXIBLE_ARRAY_MEMBER];
+} UndoRecordCacheCtl;
+
+/* GUC: number of cache entries, zero disables the cache. */
+int			undo_record_cache_size = 1024;
+
+static UndoRecordCacheCtl *UndoRecordCache = NULL;
+
+/*
+ * Map an undo record pointer to its cache slot.
+ */
+static inline int
+UndoRecordCacheSlot(UndoRecPtr urp)
+{
+	uint32		h;
+
+	h = murmurhash32((uint32) urp ^ (uint32) (urp >> 32));
+
+	return h % undo_record_cache_size;
+}
+
+#define UndoRecordCachePartitionLock(slot) \
+	(&UndoRecordCache->locks[(slot) % NUM_UNDO_CACHE_PARTITIONS].lock)
+
+/*
+ * Report shared-memory space needed by UndoRecordCacheShmemInit.
+ */
+Size
+UndoRecordCacheShmemSize(void)
+{
+	if (undo_record_cache_size == 0)
+		return 0;
+
+	return add_size(offsetof(UndoRecordCacheCtl, entries),
+					mul_size(undo_record_cache_size,
+							 sizeof(UndoRecordCacheEntry)));
+}
+
+/*
+ * Allocate and initialize the undo record cache in shared memory.
+ */
+void
+UndoRecordCacheShmemInit(void)
+{
+	bool		found;
+	int			i;
+
+	if (undo_record_cache_size == 0)
+		return;
+
+	UndoRecordCache = (UndoRecordCacheCtl *)
+		ShmemInitStruct("Undo Record Cache", UndoRecordCacheShmemSize(),
+						&found);
+
+	if (!IsUnderPostmaster)
+	{
+		Assert(!found);
+
+		for (i = 0; i < NUM_UNDO_CACHE_PARTITIONS; i++)
+			LWLockInitialize(&UndoRecordCache->locks[i].lock,
+							 LWTRANCHE_UNDO_RECORD_CACHE);
+		for (i = 0; i < undo_record_cache_size; i++)
+			UndoRecordCache->entries[i].urp = InvalidUndoRecPtr;
+	}
+	else
+		Assert(found);
+}
+
+/*
+ * Look up the undo record at urp in the cache.
+ *
+ * On a hit, fill in uur with a copy of the cached record and return true.
+ * The payload and tuple data are palloc'd and uur->uur_buffer is invalid, so
+ * the record can be reset or released the usual way.  The caller must have
+ * made sure that the record has not been discarded.
+ */
+bool
+UndoRecordCacheLookup(UndoRecPtr urp, UnpackedUndoRecord *uur)
+{
+	UndoRecordCacheEntry *entry;
+	LWLock	   *partitionLock;
+	int			slot;
+	uint32		payload_len;
+	uint32		tuple_len;
+
+	if (undo_record_cache_size == 0)
+		return false;
+
+	slot = UndoRecordCacheSlot(urp);
+	entry = &UndoRecordCache->entries[slot];
+	partitionLock = UndoRecordCachePartitionLock(slot);
+
+	LWLockAcquire(partitionLock, LW_SHARED);
+	if (entry->urp != urp)
+	{
+		LWLockRelease(partitionLock);
+		return false;
+	}
+
+	/* We're going to use our own copy of the data, so drop any buffer pin. */
+	if (BufferIsValid(uur->uur_buffer))
+		ReleaseBuffer(uur->uur_buffer);
+
+	payload_len = entry->uur.uur_payload.len;
+	tuple_len = entry->uur.uur_tuple.len;
+
+	memcpy(uur, &entry->uur, sizeof(UnpackedUndoRecord));
+	uur->uur_buffer = InvalidBuffer;
+	uur->uur_payload.data = NULL;
+	uur->uur_tuple.data = NULL;
+
+	if (payload_len > 0)
+	{
+		uur->uur_payload.data = palloc(payload_len);
+		memcpy(uur->uur_payload.data, entry->data, payload_len);
+	}
+	if (tuple_len > 0)
+	{
+		uur->uur_tuple.data = palloc(tuple_len);
+		memcpy(uur->uur_tuple.data, entry->data + payload_len, tuple_len);
+	}
+	LWLockRelease(partitionLock);
+
+	return true;
+}
+
+/*
+ * Remember the unpacked undo record at urp, evicting whatever record
+ * previously occupied its slot.  Records with more data than fits into a
+ * cache entry are silently skipped.
+ */
+void
+UndoRecordCacheInsert(UndoRecPtr urp, UnpackedUndoRecord *uur)
+{
+	UndoRecordCacheEntry *entry;
+	LWLock	   *partitionLock;
+	int			slot;
+
+	if (undo_record_cache_size == 0 ||
+		uur->uur_payload.len + uur->uur_tuple.len > UNDO_CACHE_MAX_DATA)
+		return;
+
+	slot = UndoRecordCacheSlot(urp);
+	entry = &UndoRecordCache->entries[slot];
+	partitionLock = UndoRecordCachePartitionLock(slot);
+
+	LWLockAcquire(partitionLock, LW_EXCLUSIVE);
+	if (entry->urp != urp)
+	{
+		memcpy(&entry->uur, uur, sizeof(UnpackedUndoRecord));
+		entry->uur.uur_buffer = InvalidBuffer;
+		entry->uur.uur_payload.data = NULL;
+		entry->uur.uur_tuple.data = NULL;
+
+		if (uur->uur_payload.len > 0)
+			memcpy(entry->data, uur->uur_payload.data, uur->uur_payload.len);
+		if (uur->uur_tuple.len > 0)
+			memcpy(entry->data + uur->uur_payload.len, uur->uur_tuple.data,
+				   uur->uur_tuple.len);
+		entry->urp = urp;
+	}
+	LWLockRelease(partitionLock);
+}
@@ -18,6 +18,7 @@
 #include "access/undolog.h"
 #include "access/undodiscard.h"
 #include "access/undorequest.h"
+#include "access/undospool.h"
 #include "catalog/pg_tablespace.h"
 #include "miscadmin.h"
 #include "storage/block.h"
@@ -25,7 +26,130 @@
 #include "storage/bufmgr.h"
 #include "storage/shmem.h"
 #include "storage/proc.h"
+#include "storage/procarray.h"
 #include "utils/resowner.h"
+#include "utils/timestamp.h"
+
+/* GUCs: how much undo is kept for old snapshots, zero means no limit. */
+int			undo_retention_size = 0;	/* in MB */
+int			undo_retention_time = 0;	/* in seconds */
+
+/*
+ * Step over committed transactions using the log's index of transaction
+ * starts.
+ *
+ * If the index knows about the transaction starting at *undo_recptr, advance
+ * *undo_recptr past all the consecutive transactions that committed before
+ * xmin, without reading any of their undo; *xid and *epoch are set to the
+ * last transaction skipped.  The newest transaction in the index is never
+ * skipped, since we don't know where it ends.  Return false if nothing could
+ * be skipped; the caller then has to read the transaction header.
+ */
+static bool
+UndoDiscardSkipCommitted(UndoLogControl *log, TransactionId xmin,
+						 UndoRecPtr *undo_recptr, TransactionId *xid,
+						 uint32 *epoch)
+{
+	UndoLogXactStart starts[UNDO_LOG_XACT_STARTS];
+	UndoLogOffset offset = UndoRecPtrGetOffset(*undo_recptr);
+	int			nstarts;
+	int			i;
+
+	nstarts = UndoLogGetXactStarts(log, offset, starts);
+	if (nstarts < 2 || starts[0].start != offset)
+		return false;
+
+	for (i = 0; i < nstarts - 1; i++)
+	{
+		if (!TransactionIdPrecedes(starts[i].xid, xmin) ||
+			!TransactionIdDidCommit(starts[i].xid))
+			break;
+	}
+
+	if (i == 0)
+		return false;
+
+	*undo_recptr = MakeUndoRecPtr(log->logno, starts[i].start);
+	*xid = starts[i - 1].xid;
+	*epoch = starts[i - 1].epoch;
+
+	return true;
+}
+
+/*
+ * Compute the horizon up to which the undo of a log is to be discarded.
+ *
+ * That's oldestXmin, unless the log retains more undo than
+ * undo_retention_size or undo_retention_time allow.  In that case, return
+ * the xid of the oldest transaction in the log's index of transaction starts
+ * that lies within both limits, so that the undo before it is discarded
+ * even though old snapshots might still need it; if the index has no such
+ * transaction, all the committed undo in the log can go.  The horizon never
+ * follows oldestRunningXid, so the undo of running transactions is always
+ * kept, and aborted transactions stop the discard until their undo actions
+ * are applied, as usual.
+ *
+ * The age of the log's undo is only known through the index, so a log whose
+ * oldest transaction fell out of the index is only limited by size until
+ * the discard catches up with the index.
+ */
+static TransactionId
+UndoRetentionHorizon(UndoLogControl *log, UndoLogOffset discard,
+					 UndoLogOffset insert, TransactionId oldestXmin,
+					 TransactionId oldestRunningXid, TimestampTz cutoff_time)
+{
+	UndoLogXactStart starts[UNDO_LOG_XACT_STARTS];
+	uint64		size_limit = (uint64) undo_retention_size * 1024 * 1024;
+	TransactionId horizon = oldestRunningXid;
+	int			nstarts;
+	int			i;
+
+	nstarts = UndoLogGetXactStarts(log, discard, starts);
+
+	if (!(size_limit > 0 && insert - discard > size_limit) &&
+		!(cutoff_time != 0 && nstarts > 0 && starts[0].start_time != 0 &&
+		  starts[0].start_time < cutoff_time))
+		return oldestXmin;
+
+	for (i = 0; i < nstarts; i++)
+	{
+		if ((size_limit == 0 || insert - starts[i].start <= size_limit) &&
+			(cutoff_time == 0 || starts[i].start_time == 0 ||
+			 starts[i].start_time >= cutoff_time))
+		{
+			if (TransactionIdPrecedes(starts[i].xid, horizon))
+				horizon = starts[i].xid;
+			break;
+		}
+	}
+
+	/* Never keep less than the old snapshots would allow anyway. */
+	if (TransactionIdPrecedes(horizon, oldestXmin))
+		return oldestXmin;
+
+	return horizon;
+}
+
+/*
+ * Advertise that undo has been discarded up to horizon even though older
+ * snapshots might need it.  This has to happen before the undo is actually
+ * discarded, so that readers which find the undo they need to be gone know
+ * to raise "snapshot too old" rather than take the tuple as all-visible.
+ */
+static void
+UndoRetentionAdvanceHorizon(FullTransactionId horizon)
+{
+	uint64		value = U64FromFullTransactionId(horizon);
+	uint64		current;
+
+	current = pg_atomic_read_u64(&ProcGlobal->undoRetentionHorizon);
+	while (current < value)
+	{
+		if (pg_atomic_compare_exchange_u64(&ProcGlobal->undoRetentionHorizon,
+										   &current, value))
+			break;
+	}
+}
 
 /*
  * Discard the undo for the given log
@@ -52,6 +176,7 @@ UndoDiscardOneLog(UndoLogControl *log, TransactionId xmin, bool *hibernate)
 	bool		log_complete = false;
 	TransactionId undoxid = InvalidTransactionId;
 	TransactionId latest_discardxid = InvalidTransactionId;
+	Oid			undodbid = InvalidOid;
 	uint32		epoch = 0;
 
 	if (UndoRecPtrIsValid(log->oldest_data))
@@ -69,6 +194,21 @@ UndoDiscardOneLog(UndoLogControl *log, TransactionId xmin, bool *hibernate)
 	{
 		bool		pending_abort = false;
 
+		/*
+		 * Skip the committed transactions that the log's index of
+		 * transaction starts knows about, as if we had followed their
+		 * headers' next pointers.  We stop at the first transaction that we
+		 * can't decide about without its header, which is read below.  If
+		 * dead tuples are to be spooled, every transaction has to be read.
+		 */
+		if (!undo_spool_dead_tids &&
+			UndoDiscardSkipCommitted(log, xmin, &undo_recptr, &undoxid,
+									 &epoch))
+		{
+			latest_discardxid = undoxid;
+			need_discard = true;
+		}
+
 		next_insert = UndoLogGetNextInsertPtr(log->logno, InvalidTransactionId);
 
 		if (next_insert == undo_recptr)
@@ -84,6 +224,11 @@ UndoDiscardOneLog(UndoLogControl *log, TransactionId xmin, bool *hibernate)
 		}
 		else
 		{
+			UndoRecPtr	last_xact_start;
+
+			/* This must be read first; see UndoRecordGetNextXact. */
+			last_xact_start = UndoLogGetLastXactStartPoint(log->logno);
+
 			/* Fetch the undo record for given undo_recptr. */
 			uur = UndoFetchRecord(undo_recptr, InvalidBlockNumber,
 								  InvalidOffsetNumber, InvalidTransactionId,
@@ -131,9 +276,11 @@ UndoDiscardOneLog(UndoLogControl *log, TransactionId xmin, bool *hibernate)
 					pending_abort = true;
 				}
 
-				next_urecptr = uur->uur_next;
+				next_urecptr = UndoRecordGetNextXact(undo_recptr, uur,
+													 last_xact_start);
 				undoxid = uur->uur_xid;
 				epoch = uur->uur_xidepoch;
+				undodbid = uur->uur_dbid;
 
 				UndoRecordRelease(uur);
 				uur = NULL;
@@ -177,6 +324,24 @@ UndoDiscardOneLog(UndoLogControl *log, TransactionId xmin, bool *hibernate)
 				if (!UndoRecPtrIsValid(next_insert))
 					continue;
 
+				/*
+				 * The transaction's undo in this log ends with the record
+				 * before the insert point, skipping the page header if the
+				 * insert point is at the start of a page.
+				 */
+				if (undo_spool_dead_tids && next_insert != undo_recptr &&
+					TransactionIdDidCommit(undoxid))
+				{
+					UndoRecPtr	end = next_insert;
+
+					if (UndoRecPtrGetPageOffset(end) == UndoLogBlockHeaderSize)
+						end -= UndoLogBlockHeaderSize;
+					UndoSpoolHarvest(undodbid, undo_recptr,
+									 UndoGetPrevUndoRecptr(end,
+														   InvalidUndoRecPtr,
+														   NULL));
+				}
+
 				undo_recptr = next_insert;
 				need_discard = true;
 				epoch = 0;
@@ -218,8 +383,13 @@ UndoDiscardOneLog(UndoLogControl *log, TransactionId xmin, bool *hibernate)
 
 		/*
 		 * This transaction is smaller than the xmin so lets jump to the next
-		 * transaction.
+		 * transaction, which starts in this log right after its last record.
 		 */
+		if (undo_spool_dead_tids && TransactionIdDidCommit(undoxid))
+			UndoSpoolHarvest(undodbid, undo_recptr,
+							 UndoGetPrevUndoRecptr(next_urecptr,
+												   InvalidUndoRecPtr, NULL));
+
 		undo_recptr = next_urecptr;
 		latest_discardxid = undoxid;
 
@@ -236,11 +406,25 @@ UndoDiscardOneLog(UndoLogControl *log, TransactionId xmin, bool *hibernate)
 /*
  * Discard the undo for all the transactions whose xid is smaller than
  * oldestXmin
+ *
+ * Only the undo logs whose number modulo nparts is part are processed, so
+ * that several discard workers can split the logs among themselves.  The
+ * oldest transaction having undo in those logs, which is oldestXmin if there
+ * is none, is returned in *oldestXidHavingUndo; it's up to the caller to
+ * combine it with those of the other parts.
+ *
+ * Return the oldest xid that still has undo in any of the logs we can
+ * process, or InvalidTransactionId if none of them has any undo left.  Once
+ * the global xmin horizon moves past that xid, there may be more to discard;
+ * the discard worker uses it to decide when it has to be woken up.
  */
-void
-UndoDiscard(TransactionId oldestXmin, bool *hibernate)
+TransactionId
+UndoDiscard(TransactionId oldestXmin, int nparts, int part,
+			FullTransactionId *oldestXidHavingUndo, bool *hibernate)
 {
-	FullTransactionId oldestXidHavingUndo;
+	TransactionId oldestRemainingXid = InvalidTransactionId;
+	TransactionId oldestRunningXid = InvalidTransactionId;
+	TimestampTz cutoff_time = 0;
 	UndoLogControl *log = NULL;
 	uint32		epoch;
 
@@ -250,11 +434,18 @@ UndoDiscard(TransactionId oldestXmin, bool *hibernate)
 	 * system, so we can rely on the epoch retrieved with GetEpochForXid.
 	 */
 	epoch = GetEpochForXid(oldestXmin);
-	oldestXidHavingUndo = FullTransactionIdFromEpochAndXid(epoch, oldestXmin);
+	*oldestXidHavingUndo = FullTransactionIdFromEpochAndXid(epoch, oldestXmin);
+
+	if (undo_retention_time > 0)
+		cutoff_time = TimestampTzPlusMilliseconds(GetCurrentTimestamp(),
+												  -(int64) undo_retention_time * 1000);
 
 	/*
 	 * Iterate through all the active logs and one-by-one try to discard the
-	 * transactions that are old enough to matter.
+	 * transactions that are old enough to matter.  Logs whose oldest
+	 * transaction is not yet older than oldestXmin are skipped without
+	 * reading any undo, so only the logs whose horizon actually moved are
+	 * processed.
 	 *
 	 * XXX Ideally we can arrange undo logs so that we can efficiently find
 	 * those with oldest_xid < oldestXmin, but for now we'll just scan all of
@@ -263,6 +454,13 @@ UndoDiscard(TransactionId oldestXmin, bool *hibernate)
 	while ((log = UndoLogNext(log)))
 	{
 		FullTransactionId oldest_xid = InvalidFullTransactionId;
+		TransactionId xmin = oldestXmin;
+		UndoLogOffset discard;
+		UndoLogOffset insert;
+
+		/* Skip the logs that belong to other discard workers. */
+		if (log->logno % nparts != part)
+			continue;
 
 		/*
 		 * If the log is already discarded, then we are done.  It is important
@@ -270,45 +468,59 @@ UndoDiscard(TransactionId oldestXmin, bool *hibernate)
 		 * doesn't get dropped concurrently.
 		 */
 		LWLockAcquire(&log->mutex, LW_SHARED);
-		if (log->meta.discard == log->meta.insert)
-		{
-			LWLockRelease(&log->mutex);
-			continue;
-		}
+		discard = log->meta.discard;
+		insert = log->meta.insert;
 		LWLockRelease(&log->mutex);
+		if (discard == insert)
+			continue;
 
 		/* We can't process temporary undo logs. */
 		if (log->meta.persistence == UNDO_TEMP)
 			continue;
 
+		/*
+		 * If the log retains more undo than the retention limits allow,
+		 * discard it up to a newer horizon than the old snapshots would.
+		 */
+		if (undo_retention_size > 0 || undo_retention_time > 0)
+		{
+			if (!TransactionIdIsValid(oldestRunningXid))
+				oldestRunningXid = GetOldestActiveTransactionId();
+
+			xmin = UndoRetentionHorizon(log, discard, insert, oldestXmin,
+										oldestRunningXid, cutoff_time);
+			if (xmin != oldestXmin)
+				UndoRetentionAdvanceHorizon(
+					FullTransactionIdFromEpochAndXid(GetEpochForXid(xmin),
+													 xmin));
+		}
+
 		/*
 		 * If the first xid of the undo log is smaller than the xmin the try
 		 * to discard the undo log.
 		 */
 		if (!TransactionIdIsValid(log->oldest_xid) ||
-			TransactionIdPrecedes(log->oldest_xid, oldestXmin))
+			TransactionIdPrecedes(log->oldest_xid, xmin))
 		{
 			/* Process the undo log. */
-			oldest_xid = UndoDiscardOneLog(log, oldestXmin, hibernate);
+			oldest_xid = UndoDiscardOneLog(log, xmin, hibernate);
 		}
 
+		/* Remember the oldest transaction that still has undo. */
+		if (TransactionIdIsValid(log->oldest_xid) &&
+			(!TransactionIdIsValid(oldestRemainingXid) ||
+			 TransactionIdPrecedes(log->oldest_xid, oldestRemainingXid)))
+			oldestRemainingXid = log->oldest_xid;
+
 		/* If oldestXidHavingUndo is not yet initialized, initialize it. */
-		if (!FullTransactionIdIsValid(oldestXidHavingUndo))
-			oldestXidHavingUndo = oldest_xid;
+		if (!FullTransactionIdIsValid(*oldestXidHavingUndo))
+			*oldestXidHavingUndo = oldest_xid;
 		else if (FullTransactionIdIsValid(oldest_xid) &&
-				 FullTransactionIdPrecedes(oldest_xid, oldestXidHavingUndo))
-			oldestXidHavingUndo = oldest_xid;
+				 FullTransactionIdPrecedes(oldest_xid, *oldestXidHavingUndo))
+			*oldestXidHavingUndo = oldest_xid;
 	}
 
-	/*
-	 * Update the oldestXidWithEpochHavingUndo in the shared memory.
-	 *
-	 * XXX In future if multiple worker can perform discard then we may need
-	 * to use compare and swap for updating the shared memory value.
-	 */
-	if (FullTransactionIdIsValid(oldestXidHavingUndo))
-		pg_atomic_write_u64(&ProcGlobal->oldestXidWithEpochHavingUndo,
-							U64FromFullTransactionId(oldestXidHavingUndo));
+	return oldestRemainingXid;
 }
 
 /*
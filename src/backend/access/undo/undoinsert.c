@@ -20,6 +20,18 @@
  * this is entirely maintained and used by undo record layer.   See
  * undorecord.h for detailed information about undo record header.
  *
+ * Linking transactions:
+ *
+ * Most transactions write all their undo with a single allocation.  Rather
+ * than leaving the next pointer of such a transaction's header unset and
+ * having the next transaction read and rewrite that header when it starts,
+ * the header is written pointing to the place the next transaction will
+ * start if nothing else is added to the log.  The next transaction then
+ * only goes back to the previous header if more undo was allocated after it.
+ * Until the next transaction has recorded its start in the undo log, that
+ * pointer is only a guess, so readers must use UndoRecordGetNextXact to
+ * interpret it.
+ *
  * Multiple logs:
  *
  * It is possible that the undo records for a transaction spans across
@@ -59,6 +71,9 @@
 #include "postgres.h"
 
 #include "access/subtrans.h"
+#include "access/undocache.h"
+#include "access/undolocal.h"
+#include "access/undommap.h"
 #include "access/xact.h"
 #include "access/xlog.h"
 #include "access/undorecord.h"
@@ -74,6 +89,8 @@
 #include "storage/bufmgr.h"
 #include "miscadmin.h"
 #include "commands/tablecmds.h"
+#include "executor/instrument.h"
+#include "utils/memutils.h"
 
 /*
  * XXX Do we want to support undo tuple size which is more than the BLCKSZ
@@ -105,6 +122,15 @@
  */
 #define MAX_UNDO_BUFFERS       (MAX_PREPARED_UNDO + MAX_XACT_UNDO_INFO) * MAX_BUFFER_PER_UNDO
 
+/*
+ * The highest first_block_id any caller passes to RegisterUndoLogBuffers.
+ * zheap_update registers up to two heap pages and their TPD pages, as block
+ * ids 0 to 3, and starts the undo buffers at 5.  Each pinned undo buffer takes
+ * the next block id, so we can't pin more than the block ids left after that.
+ */
+#define MAX_UNDO_FIRST_BLOCK_ID	5
+#define MAX_UNDO_BUFFER_SLOTS	(XLR_MAX_BLOCK_ID - MAX_UNDO_FIRST_BLOCK_ID + 1)
+
 /*
  * Previous top transaction id which inserted the undo.  Whenever a new main
  * transaction try to prepare an undo record we will check if its txid not the
@@ -138,6 +164,7 @@ typedef struct PreparedUndoSpace
 static PreparedUndoSpace def_prepared[MAX_PREPARED_UNDO];
 static int	prepare_idx;
 static int	max_prepared_undo = MAX_PREPARED_UNDO;
+static int	max_undo_buffers = MAX_UNDO_BUFFERS;
 static UndoRecPtr prepared_urec_ptr = InvalidUndoRecPtr;
 
 /*
@@ -147,7 +174,11 @@ static UndoRecPtr prepared_urec_ptr = InvalidUndoRecPtr;
  * Therein, dynamic memory will be allocated and prepared_undo and undo_buffer
  * will start pointing to newly allocated memory, which will be released by
  * UnlockReleaseUndoBuffers and these variables will again set back to their
- * default values.
+ * default values.  The undo_buffer array is also enlarged on demand by
+ * UndoGetBufferSlot, in case the records happen to span more undo blocks than
+ * we estimated.  Both arrays live in TopMemoryContext, so that they survive
+ * until ResetUndoBuffers even if the caller's memory context goes away first
+ * during an abort.
  */
 static PreparedUndoSpace *prepared_undo = def_prepared;
 static UndoBuffers *undo_buffer = def_buffers;
@@ -167,6 +198,17 @@ typedef struct XactUndoRecordInfo
 static XactUndoRecordInfo xact_urec_info[MAX_XACT_UNDO_INFO];
 static int	xact_urec_info_idx;
 
+/*
+ * Where the last undo record we inserted ended, and its length, to be stored
+ * in the header of the next page if the next record starts there.  See
+ * UndoPageGetBoundaryRecordLen.
+ */
+static UndoRecPtr last_insert_end = InvalidUndoRecPtr;
+static uint16 last_insert_len;
+
+/* GUC: whether undo pages get full-page images after a checkpoint. */
+bool		undo_full_page_writes = true;
+
 /* Prototypes for static functions. */
 static void UndoRecordPrepareTransInfo(XLogReaderState *xlog_record,
 									   UndoRecPtr urecptr, UndoRecPtr xact_urp);
@@ -175,6 +217,8 @@ static int	UndoGetBufferSlot(RelFileNode rnode, BlockNumber blk,
 							  UndoPersistence persistence,
 							  XLogReaderState *xlog_record);
 static uint16 UndoGetPrevRecordLen(UndoRecPtr urp, Buffer *input_buffer);
+static bool UndoBlockIsRegistered(XLogReaderState *xlog_record,
+								  RelFileNode rnode, BlockNumber blk);
 
 /*
  * Check whether the undo record is discarded or not.  If it's already discarded
@@ -217,6 +261,33 @@ UndoRecordIsValid(UndoRecPtr urp)
 	return true;
 }
 
+/*
+ * Does the WAL record being replayed carry a reference to the given undo
+ * block?
+ */
+static bool
+UndoBlockIsRegistered(XLogReaderState *xlog_record, RelFileNode rnode,
+					  BlockNumber blk)
+{
+	int			block_id;
+
+	for (block_id = 0; block_id <= xlog_record->max_block_id; block_id++)
+	{
+		RelFileNode blk_rnode;
+		ForkNumber	blk_forknum;
+		BlockNumber blk_blkno;
+
+		if (XLogRecGetBlockTag(xlog_record, block_id, &blk_rnode,
+							   &blk_forknum, &blk_blkno) &&
+			RelFileNodeEquals(blk_rnode, rnode) &&
+			blk_forknum == UndoLogForkNum &&
+			blk_blkno == blk)
+			return true;
+	}
+
+	return false;
+}
+
 /*
  * Prepare to update the previous transaction's next undo pointer to maintain
  * the transaction chain in the undo.  This will read the header of the first
@@ -273,6 +344,17 @@ UndoRecordPrepareTransInfo(XLogReaderState *xlog_record, UndoRecPtr urecptr,
 	cur_blk = UndoRecPtrGetBlockNum(xact_urp);
 	starting_byte = UndoRecPtrGetPageOffset(xact_urp);
 
+	/*
+	 * During recovery, follow whatever the original operation did: it didn't
+	 * register the header's page if it found the header already pointing to
+	 * the new transaction (see UndoRecordAllocate).
+	 */
+	if (InRecovery && !UndoBlockIsRegistered(xlog_record, rnode, cur_blk))
+	{
+		LWLockRelease(&log->discard_lock);
+		return;
+	}
+
 	/*
 	 * Read undo record header in by calling UnpackUndoRecord, if the undo
 	 * record header is split across buffers then we need to read the complete
@@ -499,6 +581,39 @@ UndoGetBufferSlot(RelFileNode rnode,
 	 */
 	if (i == buffer_idx)
 	{
+		/*
+		 * Every buffer we pin gets registered with the WAL record that goes
+		 * with the undo, so the record must have room for it.  That has to
+		 * be arranged here, as the registration happens in a critical
+		 * section.  A single WAL-logged operation needing more buffers than
+		 * that would have to be split by the caller; none of them come
+		 * close.
+		 */
+		if (buffer_idx == MAX_UNDO_BUFFER_SLOTS)
+			elog(ERROR, "too many undo buffers for one WAL record");
+		if (!InRecovery &&
+			MAX_UNDO_FIRST_BLOCK_ID + buffer_idx > XLR_NORMAL_MAX_BLOCK_ID)
+			XLogEnsureRecordSpace(MAX_UNDO_FIRST_BLOCK_ID + buffer_idx, 0);
+
+		/* Make room for one more buffer, if required. */
+		if (buffer_idx == max_undo_buffers)
+		{
+			int			new_max = Min(max_undo_buffers * 2,
+									  MAX_UNDO_BUFFER_SLOTS);
+
+			if (undo_buffer == def_buffers)
+			{
+				undo_buffer = MemoryContextAlloc(TopMemoryContext,
+												 new_max * sizeof(UndoBuffers));
+				memcpy(undo_buffer, def_buffers,
+					   buffer_idx * sizeof(UndoBuffers));
+			}
+			else
+				undo_buffer = repalloc(undo_buffer,
+									   new_max * sizeof(UndoBuffers));
+			max_undo_buffers = new_max;
+		}
+
 		/*
 		 * Fetch the buffer in which we want to insert the undo record.
 		 */
@@ -733,16 +848,33 @@ resize:
 		if (log_switched)
 			UndoRecordPrepareTransInfo(xlog_record, urecptr, prevlogurp);
 
-		/* Don't update our own start header. */
-		if (log->meta.last_xact_start != log->meta.insert)
+		/*
+		 * Don't update our own start header, nor a header that was written
+		 * pointing here because nothing was allocated after it.  During
+		 * recovery UndoRecordPrepareTransInfo decides from the WAL record
+		 * instead, as xact_hdr_end doesn't survive a restart.
+		 */
+		if (log->meta.last_xact_start != log->meta.insert &&
+			(InRecovery || log->xact_hdr_end != log->meta.insert))
 			UndoRecordPrepareTransInfo(xlog_record, urecptr,
 									   MakeUndoRecPtr(log->logno, log->meta.last_xact_start));
 
+		/*
+		 * Point our own header to where the next transaction will start if
+		 * we don't allocate any more undo.  See "Linking transactions" atop
+		 * this file.
+		 */
+		if (need_xact_hdr)
+			undorecords[0].uur_next =
+				MakeUndoRecPtr(log->logno,
+							   UndoLogOffsetPlusUsableBytes(log->meta.insert,
+															size));
+
 		/* Remember the current transaction's xid. */
 		prev_txid[upersistence] = txid;
 
 		/* Store the current transaction's start undorecptr in the undo log. */
-		UndoLogSetLastXactStartPoint(urecptr);
+		UndoLogSetLastXactStartPoint(urecptr, fxid);
 	}
 
 	/*
@@ -768,6 +900,9 @@ resize:
 
 	UndoLogAdvance(urecptr, size, upersistence);
 
+	if (need_xact_hdr)
+		log->xact_hdr_end = log->meta.insert;
+
 	/*
 	 * Write WAL for log switch.  This is required to identify the log switch
 	 * during recovery.
@@ -786,9 +921,11 @@ resize:
  * Call UndoSetPrepareSize to set the value of how many undo records can be
  * prepared before we can insert them.  If the size is greater than
  * MAX_PREPARED_UNDO then it will allocate extra memory to hold the extra
- * prepared undo.
+ * prepared undo.  The space for all the records is allocated from the undo
+ * log at once, so that the records are laid out contiguously.
  *
- * This is normally used when more than one undo record needs to be prepared.
+ * This is normally used when more than one undo record needs to be prepared;
+ * see also PrepareUndoInsertMulti.
  */
 void
 UndoSetPrepareSize(UnpackedUndoRecord *undorecords, int nrecords,
@@ -811,17 +948,35 @@ UndoSetPrepareSize(UnpackedUndoRecord *undorecords, int nrecords,
 		txid = fxid;
 	}
 
+	/* The size can only be set before preparing the first record. */
+	Assert(prepare_idx == 0);
+
 	if (nrecords > MAX_PREPARED_UNDO)
 	{
-		prepared_undo = palloc0(nrecords * sizeof(PreparedUndoSpace));
+		int			nbuffers;
+
+		prepared_undo = MemoryContextAllocZero(TopMemoryContext,
+											   nrecords * sizeof(PreparedUndoSpace));
+		max_prepared_undo = nrecords;
 
 		/*
 		 * Consider buffers needed for updating previous transaction's starting
-		 * undo record. Hence increased by 1.
+		 * undo record as well.  This is only an estimate, UndoGetBufferSlot
+		 * will enlarge the array if the records need more.
 		 */
-		undo_buffer = palloc0((nrecords + 1) * MAX_BUFFER_PER_UNDO *
-							  sizeof(UndoBuffers));
-		max_prepared_undo = nrecords;
+		nbuffers = (nrecords + MAX_XACT_UNDO_INFO) * MAX_BUFFER_PER_UNDO;
+		if (nbuffers > max_undo_buffers)
+		{
+			UndoBuffers *new_buffers;
+
+			new_buffers = MemoryContextAllocZero(TopMemoryContext,
+												 nbuffers * sizeof(UndoBuffers));
+			memcpy(new_buffers, undo_buffer, buffer_idx * sizeof(UndoBuffers));
+			if (undo_buffer != def_buffers)
+				pfree(undo_buffer);
+			undo_buffer = new_buffers;
+			max_undo_buffers = nbuffers;
+		}
 	}
 
 	prepared_urec_ptr = UndoRecordAllocate(undorecords, nrecords, txid,
@@ -862,6 +1017,8 @@ PrepareUndoInsert(UnpackedUndoRecord *urec, FullTransactionId fxid,
 	if (prepare_idx == max_prepared_undo)
 		elog(ERROR, "already reached the maximum prepared limit");
 
+	/* InsertPreparedUndo will copy the record to the local buffer. */
+	UndoLocalBufferPrepare();
 
 	if (!FullTransactionIdIsValid(fxid))
 	{
@@ -940,21 +1097,64 @@ PrepareUndoInsert(UnpackedUndoRecord *urec, FullTransactionId fxid,
 	prepared_undo[prepare_idx].urp = urecptr;
 	prepare_idx++;
 
+	/* InsertPreparedUndo will record the command id of block-level records. */
+	if (urec->uur_block != InvalidBlockNumber)
+		UndoLocalCidMapPrepare(urecptr, txid);
+
 	return urecptr;
 }
 
+/*
+ * PrepareUndoInsertMulti - prepare a caller-sized array of undo records.
+ *
+ * This is a shorthand for UndoSetPrepareSize followed by a PrepareUndoInsert
+ * call for each record, so the space for all of them is allocated from the
+ * undo log at once and all the required undo buffers are pinned and locked
+ * together.  The undo record pointer of each record is returned in urecptrs,
+ * which must have room for nrecords entries.  Since the pointers are only
+ * known after this call, fields that link the records with each other (such
+ * as uur_blkprev) can be filled in afterwards, as long as that doesn't change
+ * the size of the records; the records are not serialized until
+ * InsertPreparedUndo.
+ *
+ * Like PrepareUndoInsert, this must be called before entering the critical
+ * section.
+ */
+void
+PrepareUndoInsertMulti(UnpackedUndoRecord *urecs, int nrecords,
+					   UndoRecPtr *urecptrs, FullTransactionId fxid,
+					   UndoPersistence upersistence,
+					   XLogReaderState *xlog_record,
+					   xl_undolog_meta *undometa)
+{
+	int			i;
+
+	Assert(nrecords > 0);
+
+	UndoSetPrepareSize(urecs, nrecords, fxid, upersistence, xlog_record,
+					   undometa);
+
+	for (i = 0; i < nrecords; i++)
+		urecptrs[i] = PrepareUndoInsert(&urecs[i], fxid, upersistence,
+										xlog_record, NULL);
+}
+
 /*
  * Insert a previously-prepared undo record.  This will write the actual undo
  * record into the buffers already pinned and locked in PreparedUndoInsert,
  * and mark them dirty.  This step should be performed after entering a
  * criticalsection; it should never fail.
+ *
+ * Returns the total size of the undo records written.
  */
-void
+Size
 InsertPreparedUndo(void)
 {
 	Page		page = NULL;
+	Size		total_len = 0;
 	int			starting_byte;
 	int			already_written;
+	int			written_before;
 	int			bufidx = 0;
 	int			idx;
 	uint16		undo_len = 0;
@@ -980,6 +1180,7 @@ InsertPreparedUndo(void)
 		starting_byte = UndoRecPtrGetPageOffset(urp);
 
 		undo_len = remaining_bytes = UndoRecordExpectedSize(uur);
+		total_len += undo_len;
 
 		do
 		{
@@ -998,15 +1199,34 @@ InsertPreparedUndo(void)
 				 * block header.
 				 */
 				if (starting_byte == UndoLogBlockHeaderSize)
+				{
 					PageInit(page, BLCKSZ, 0);
 
+					/*
+					 * If the record before this one ended right at the end of
+					 * the previous page, remember its length here.
+					 */
+					if (bufidx == 0 && urp == last_insert_end)
+						UndoPageSetBoundaryRecordLen(page, last_insert_len);
+				}
+
 				/*
 				 * Try to insert the record into the current page. If it
 				 * doesn't succeed then recall the routine with the next page.
 				 */
+				written_before = already_written;
 				if (InsertUndoRecord(uur, page, starting_byte, &already_written,
 									 0, undo_len, false))
 				{
+					/*
+					 * Likewise if the length at the end of this record is
+					 * split across the page boundary.
+					 */
+					if (bufidx > 0 &&
+						starting_byte + undo_len - written_before ==
+						UndoLogBlockHeaderSize + 1)
+						UndoPageSetBoundaryRecordLen(page, undo_len);
+
 					MarkBufferDirty(buffer);
 					break;
 				}
@@ -1049,6 +1269,23 @@ InsertPreparedUndo(void)
 			Assert(bufidx < MAX_BUFFER_PER_UNDO);
 		} while (true);
 
+		last_insert_end =
+			MakeUndoRecPtr(UndoRecPtrGetLogNo(urp),
+						   UndoLogOffsetPlusUsableBytes(UndoRecPtrGetOffset(urp),
+														undo_len));
+		last_insert_len = undo_len;
+
+		/* Keep a copy for rolling back without reading the undo again. */
+		UndoLocalBufferRemember(urp, uur);
+		UndoLocalCidMapRemember(urp, uur);
+
+		/* The compressed tuple computed by UndoRecordSetInfo is written. */
+		if ((uur->uur_info & UREC_INFO_TUPLE_COMPRESSED) != 0)
+		{
+			pfree(uur->uur_packed_tuple);
+			uur->uur_packed_tuple = NULL;
+		}
+
 		/*
 		 * Set the current undo location for a transaction.  This is required
 		 * to perform rollback during abort of transaction.
@@ -1056,6 +1293,9 @@ InsertPreparedUndo(void)
 		SetCurrentUndoLocation(urp);
 	}
 
+	pgBufferUsage.undo_records += prepare_idx;
+	pgBufferUsage.undo_bytes += total_len;
+
 	/* Update previously prepared transaction headers. */
 	if (xact_urec_info_idx > 0)
 	{
@@ -1065,6 +1305,7 @@ InsertPreparedUndo(void)
 			UndoRecordUpdateTransInfo(i);
 	}
 
+	return total_len;
 }
 
 /*
@@ -1096,6 +1337,11 @@ UndoGetOneRecord(UnpackedUndoRecord *urec, UndoRecPtr urp, RelFileNode rnode,
 
 	cur_blk = UndoRecPtrGetBlockNum(urp);
 
+	/* Read the record without going through shared buffers, if we can. */
+	if (!BufferIsValid(buffer) && !keep_buffer &&
+		UndoMmapGetOneRecord(urec, urp, rnode, persistence))
+		return;
+
 	/* If we already have a buffer pin then no need to allocate a new one. */
 	if (!BufferIsValid(buffer))
 	{
@@ -1220,6 +1466,9 @@ ResetUndoRecord(UnpackedUndoRecord *urec, UndoRecPtr urp, RelFileNode *rnode,
  * callback function decides whether particular undo record satisfies the
  * condition of caller.
  *
+ * When following the undo chain of a particular block, the records are served
+ * from and added to the shared undo record cache (see undocache.c).
+ *
  * Returns the required undo record if found, otherwise, return NULL which
  * means either the record is already discarded or there is no such record
  * in the undo chain.
@@ -1233,6 +1482,7 @@ UndoFetchRecord(UndoRecPtr urp, BlockNumber blkno, OffsetNumber offset,
 				prevrec_rnode = {0};
 	UnpackedUndoRecord *urec = NULL;
 	int			logno;
+	bool		use_cache = (blkno != InvalidBlockNumber);
 
 	if (urec_ptr_out)
 		*urec_ptr_out = InvalidUndoRecPtr;
@@ -1268,8 +1518,17 @@ UndoFetchRecord(UndoRecPtr urp, BlockNumber blkno, OffsetNumber offset,
 			return NULL;
 		}
 
-		/* Fetch the current undo record. */
-		UndoGetOneRecord(urec, urp, rnode, log->meta.persistence, false);
+		/*
+		 * Fetch the current undo record, from the cache if we can.  Temporary
+		 * undo is private to its backend, so there's no point in caching it.
+		 */
+		if (!use_cache || log->meta.persistence == UNDO_TEMP ||
+			!UndoRecordCacheLookup(urp, urec))
+		{
+			UndoGetOneRecord(urec, urp, rnode, log->meta.persistence, false);
+			if (use_cache && log->meta.persistence != UNDO_TEMP)
+				UndoRecordCacheInsert(urp, urec);
+		}
 		LWLockRelease(&log->discard_lock);
 
 		if (blkno == InvalidBlockNumber)
@@ -1294,6 +1553,43 @@ UndoFetchRecord(UndoRecPtr urp, BlockNumber blkno, OffsetNumber offset,
 	return urec;
 }
 
+/*
+ * UndoPrefetchRecord - Start reading the undo block holding the record at urp.
+ *
+ * Undo chains are followed one record at a time, and each hop may need a
+ * synchronous read.  Callers that know where a chain continues before they
+ * are ready to follow it, or that are about to follow several chains, use
+ * this to issue the reads early so that they proceed in the background.
+ * Nothing is done if prefetching is disabled or if the record has already
+ * been discarded.
+ */
+void
+UndoPrefetchRecord(UndoRecPtr urp)
+{
+#ifdef USE_PREFETCH
+	UndoLogControl *log;
+	RelFileNode rnode;
+
+	if (target_prefetch_pages <= 0 || !UndoRecPtrIsValid(urp))
+		return;
+
+	log = UndoLogGet(UndoRecPtrGetLogNo(urp));
+	if (log == NULL)
+		return;
+
+	/* Prevent the undo from being discarded while we read it. */
+	LWLockAcquire(&log->discard_lock, LW_SHARED);
+	if (!UndoRecordIsValid(urp))
+		return;
+
+	UndoRecPtrAssignRelFileNode(rnode, urp);
+	PrefetchBufferWithoutRelcache(rnode, UndoLogForkNum,
+								  UndoRecPtrGetBlockNum(urp),
+								  RelPersistenceForUndoPersistence(log->meta.persistence));
+	LWLockRelease(&log->discard_lock);
+#endif							/* USE_PREFETCH */
+}
+
 /*
  * UndoGetPrevRecordLen - read length of the previous undo record.
  *
@@ -1341,6 +1637,17 @@ UndoGetPrevRecordLen(UndoRecPtr urp, Buffer *input_buffer)
 	/* Get page from buffer. */
 	page = (char *) BufferGetPage(buffer);
 
+	/*
+	 * If the length isn't entirely on this page, the page header may still
+	 * tell it.
+	 */
+	if (page_offset - UndoLogBlockHeaderSize < sizeof(uint16) &&
+		UndoPageGetBoundaryRecordLen(page) != 0)
+	{
+		prev_rec_len = UndoPageGetBoundaryRecordLen(page);
+		byte_to_read = 0;
+	}
+
 	/*
 	 * Length if the previous undo record is store at the end of that record
 	 * so just fetch last 2 bytes.
@@ -1377,7 +1684,8 @@ UndoGetPrevRecordLen(UndoRecPtr urp, Buffer *input_buffer)
 		}
 	}
 
-	prev_rec_len = *(uint16 *) (prevlen);
+	if (prev_rec_len == 0)
+		prev_rec_len = *(uint16 *) (prevlen);
 
 	/*
 	 * If previous undo record is not completely stored in this page then add
@@ -1403,6 +1711,32 @@ UndoGetPrevRecordLen(UndoRecPtr urp, Buffer *input_buffer)
 	return prev_rec_len;
 }
 
+/*
+ * Return the start of the transaction following the one whose first undo
+ * record, at urp, has been fetched into uur, or InvalidUndoRecPtr if there is
+ * none yet.
+ *
+ * last_xact_start must be the undo log's last transaction start as returned
+ * by UndoLogGetLastXactStartPoint before the record was fetched.  If that is
+ * still this transaction, a next pointer into the same log is only where the
+ * next transaction would start; see "Linking transactions" atop this file.
+ * A transaction that starts elsewhere because more undo was allocated first
+ * locks the header's buffer to update it before recording its own start, so
+ * the pointer can be trusted as soon as last_xact_start has moved on.
+ */
+UndoRecPtr
+UndoRecordGetNextXact(UndoRecPtr urp, UnpackedUndoRecord *uur,
+					  UndoRecPtr last_xact_start)
+{
+	Assert(uur->uur_info & UREC_INFO_TRANSACTION);
+
+	if (urp == last_xact_start &&
+		UndoRecPtrGetLogNo(uur->uur_next) == UndoRecPtrGetLogNo(urp))
+		return InvalidUndoRecPtr;
+
+	return uur->uur_next;
+}
+
 /*
  * Return the previous undo record pointer.
  *
@@ -1457,16 +1791,33 @@ UndoRecordRelease(UnpackedUndoRecord *urec)
 
 /*
  * RegisterUndoLogBuffers - Register the undo buffers.
+ *
+ * Unless undo_full_page_writes is on, the undo pages are registered without
+ * a full-page image.  Undo pages are only ever appended to, and the few
+ * fields that are updated in place are WAL-logged too, so whichever mix of
+ * old and new contents a torn write leaves on disk, the bytes from before
+ * the checkpoint are intact, and redo rewrites all the rest: undo records
+ * are inserted again during redo whatever the page LSN says.  That doesn't
+ * hold when data checksums are enabled, because a torn page then fails
+ * verification when redo reads it.
  */
 void
 RegisterUndoLogBuffers(uint8 first_block_id)
 {
 	int			idx;
 	int			flags;
+	bool		no_image;
+
+	Assert(first_block_id <= MAX_UNDO_FIRST_BLOCK_ID);
+
+	no_image = !undo_full_page_writes && !DataChecksumsEnabled();
 
 	for (idx = 0; idx < buffer_idx; idx++)
 	{
-		flags = undo_buffer[idx].zero ? REGBUF_WILL_INIT : 0;
+		if (undo_buffer[idx].zero)
+			flags = REGBUF_WILL_INIT;
+		else
+			flags = no_image ? REGBUF_NO_IMAGE : 0;
 		XLogRegisterBuffer(first_block_id + idx, undo_buffer[idx].buf, flags);
 	}
 }
@@ -1513,12 +1864,16 @@ ResetUndoBuffers(void)
 	 */
 	if (max_prepared_undo > MAX_PREPARED_UNDO)
 	{
-		pfree(undo_buffer);
 		pfree(prepared_undo);
-		undo_buffer = def_buffers;
 		prepared_undo = def_prepared;
 		max_prepared_undo = MAX_PREPARED_UNDO;
 	}
+	if (max_undo_buffers > MAX_UNDO_BUFFERS)
+	{
+		pfree(undo_buffer);
+		undo_buffer = def_buffers;
+		max_undo_buffers = MAX_UNDO_BUFFERS;
+	}
 }
 
 /*
@@ -0,0 +1,351 @@
+/*-------------------------------------------------------------------------
+ *
+ * undolocal.c
+ *	  backend-local copies of the undo records of the current transaction
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * src/backend/access/undo/undolocal.c
+ *
+ * NOTES:
+ * Rolling back a subtransaction, e.g. on leaving a PL/pgSQL exception block,
+ * typically has to undo just a handful of records that the backend itself
+ * inserted a moment ago.  To save reading and unpacking them again,
+ * InsertPreparedUndo copies each record it writes into a small ring of
+ * unpacked records in backend memory, and apply_undo_actions takes the
+ * records to apply from there when all of them are still in the ring.
+ *
+ * The ring holds the last undo_local_buffer_size records inserted by the
+ * backend, whatever their transaction or persistence level.  Undo record
+ * pointers are never reused and the records of a transaction in one undo log
+ * are contiguous, so the records between two pointers of the current
+ * transaction in the same log are exactly the entries of that log between
+ * them in the ring; if any of them has been overwritten or was too large to
+ * be copied, the undo is simply read as usual.  Records are copied once they
+ * are complete, so a copy is identical to what unpacking the record from the
+ * undo log would give, except that the tuple is never compressed.
+ *
+ * A transaction that modifies rows and reads them again has to compare the
+ * command id of each of its tuples with that of its snapshot, and the command
+ * id is only stored in the undo record.  So the backend also keeps a map from
+ * the undo record pointer to the header fields of every record the current
+ * top-level transaction inserts, up to undo_local_cid_map_size of them.  The
+ * entry of a record is made by PrepareUndoInsert, outside the critical
+ * section, and filled in by InsertPreparedUndo.  The undo of a running
+ * transaction can't be discarded, so the entries stay good until the
+ * transaction ends; the map is emptied when the next one prepares its first
+ * record.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "access/undolocal.h"
+#include "access/xact.h"
+#include "access/xlog.h"
+#include "miscadmin.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+
+typedef struct UndoLocalEntry
+{
+	UndoRecPtr	urp;			/* InvalidUndoRecPtr, if the entry is unused */
+	bool		copied;			/* false, if the record was too large */
+	UnpackedUndoRecord uur;		/* record header; data pointers are unused */
+	char		data[UNDO_LOCAL_MAX_DATA];	/* payload followed by tuple */
+} UndoLocalEntry;
+
+/* GUC: number of records kept, zero disables the local buffer. */
+int			undo_local_buffer_size = 32;
+
+static UndoLocalEntry *UndoLocalBuffer = NULL;
+static int	UndoLocalBufferEntries = 0;
+
+/* Slot the next record goes to. */
+static int	UndoLocalBufferNext = 0;
+
+/* GUC: number of records mapped, zero disables the command id map. */
+int			undo_local_cid_map_size = 16384;
+
+static HTAB *UndoLocalCidMap = NULL;
+
+/* Top-level transaction whose records are in the map. */
+static FullTransactionId UndoLocalCidMapXid = {0};
+
+/*
+ * Make sure the local buffer matches undo_local_buffer_size.
+ *
+ * This is called while preparing undo records, before the critical section
+ * in which UndoLocalBufferRemember is called, as it may allocate memory.
+ */
+void
+UndoLocalBufferPrepare(void)
+{
+	int			i;
+
+	if (InRecovery || UndoLocalBufferEntries == undo_local_buffer_size)
+		return;
+
+	if (UndoLocalBuffer != NULL)
+		pfree(UndoLocalBuffer);
+	UndoLocalBuffer = NULL;
+	UndoLocalBufferEntries = 0;
+	UndoLocalBufferNext = 0;
+
+	if (undo_local_buffer_size == 0)
+		return;
+
+	UndoLocalBuffer = MemoryContextAlloc(TopMemoryContext,
+										 undo_local_buffer_size *
+										 sizeof(UndoLocalEntry));
+	for (i = 0; i < undo_local_buffer_size; i++)
+		UndoLocalBuffer[i].urp = InvalidUndoRecPtr;
+	UndoLocalBufferEntries = undo_local_buffer_size;
+}
+
+/*
+ * Remember the undo record just written at urp.
+ *
+ * This runs in a critical section, so it must not allocate memory.
+ */
+void
+UndoLocalBufferRemember(UndoRecPtr urp, UnpackedUndoRecord *uur)
+{
+	UndoLocalEntry *entry;
+
+	if (UndoLocalBufferEntries == 0)
+		return;
+
+	entry = &UndoLocalBuffer[UndoLocalBufferNext];
+	UndoLocalBufferNext = (UndoLocalBufferNext + 1) % UndoLocalBufferEntries;
+
+	entry->urp = urp;
+	entry->copied = (uur->uur_payload.len + uur->uur_tuple.len <=
+					 UNDO_LOCAL_MAX_DATA);
+	if (!entry->copied)
+		return;
+
+	memcpy(&entry->uur, uur, sizeof(UnpackedUndoRecord));
+	entry->uur.uur_info &= ~UREC_INFO_TUPLE_COMPRESSED;
+	entry->uur.uur_buffer = InvalidBuffer;
+	entry->uur.uur_payload.data = NULL;
+	entry->uur.uur_tuple.data = NULL;
+	entry->uur.uur_packed_tuple = NULL;
+	entry->uur.uur_packed_len = 0;
+
+	if (uur->uur_payload.len > 0)
+		memcpy(entry->data, uur->uur_payload.data, uur->uur_payload.len);
+	if (uur->uur_tuple.len > 0)
+		memcpy(entry->data + uur->uur_payload.len, uur->uur_tuple.data,
+			   uur->uur_tuple.len);
+}
+
+/*
+ * Return a palloc'd copy of an entry's record, with its own data.
+ */
+static UnpackedUndoRecord *
+UndoLocalEntryCopy(UndoLocalEntry *entry)
+{
+	UnpackedUndoRecord *uur = palloc(sizeof(UnpackedUndoRecord));
+	uint32		payload_len = entry->uur.uur_payload.len;
+	uint32		tuple_len = entry->uur.uur_tuple.len;
+
+	memcpy(uur, &entry->uur, sizeof(UnpackedUndoRecord));
+
+	if (payload_len > 0)
+	{
+		uur->uur_payload.data = palloc(payload_len);
+		memcpy(uur->uur_payload.data, entry->data, payload_len);
+	}
+	if (tuple_len > 0)
+	{
+		uur->uur_tuple.data = palloc(tuple_len);
+		memcpy(uur->uur_tuple.data, entry->data + payload_len, tuple_len);
+	}
+
+	return uur;
+}
+
+/*
+ * Fetch the undo records from from_urecptr back to to_urecptr out of the
+ * local buffer.
+ *
+ * Returns an array of *nrecords records, like UndoRecordBulkFetch would for
+ * the same range, or NULL if some of them aren't in the local buffer.
+ */
+UndoRecInfo *
+UndoLocalBufferFetch(UndoRecPtr from_urecptr, UndoRecPtr to_urecptr,
+					 int *nrecords)
+{
+	UndoLogNumber logno = UndoRecPtrGetLogNo(from_urecptr);
+	UndoRecInfo *urp_array;
+	int			first = -1;
+	int			count = 0;
+	int			i;
+
+	*nrecords = 0;
+
+	if (UndoLocalBufferEntries == 0 ||
+		UndoRecPtrGetLogNo(to_urecptr) != logno || to_urecptr > from_urecptr)
+		return NULL;
+
+	/*
+	 * Walk the ring from the newest entry backwards, to check that every
+	 * record of the range has been copied.
+	 */
+	for (i = 0; i < UndoLocalBufferEntries; i++)
+	{
+		int			slot;
+		UndoLocalEntry *entry;
+
+		slot = (UndoLocalBufferNext - 1 - i + UndoLocalBufferEntries) %
+			UndoLocalBufferEntries;
+		entry = &UndoLocalBuffer[slot];
+
+		if (!UndoRecPtrIsValid(entry->urp))
+			return NULL;
+		if (UndoRecPtrGetLogNo(entry->urp) != logno)
+			continue;
+
+		if (first < 0)
+		{
+			if (entry->urp != from_urecptr)
+			{
+				/* Records newer than the range can be skipped. */
+				if (entry->urp > from_urecptr)
+					continue;
+				return NULL;
+			}
+			first = i;
+		}
+
+		if (!entry->copied || entry->urp < to_urecptr)
+			return NULL;
+
+		count++;
+
+		if (entry->urp == to_urecptr)
+			break;
+	}
+
+	/* Ran out of entries before reaching to_urecptr? */
+	if (i == UndoLocalBufferEntries)
+		return NULL;
+
+	urp_array = (UndoRecInfo *) palloc(sizeof(UndoRecInfo) * count);
+	for (i = first; *nrecords < count; i++)
+	{
+		int			slot;
+		UndoLocalEntry *entry;
+
+		slot = (UndoLocalBufferNext - 1 - i + UndoLocalBufferEntries) %
+			UndoLocalBufferEntries;
+		entry = &UndoLocalBuffer[slot];
+
+		if (UndoRecPtrGetLogNo(entry->urp) != logno)
+			continue;
+
+		urp_array[*nrecords].index = *nrecords;
+		urp_array[*nrecords].urp = entry->urp;
+		urp_array[*nrecords].uur = UndoLocalEntryCopy(entry);
+		(*nrecords)++;
+	}
+
+	return urp_array;
+}
+
+/*
+ * Make an entry for the undo record about to be prepared at urp by the
+ * top-level transaction fxid.
+ *
+ * This is called by PrepareUndoInsert, before the critical section in which
+ * UndoLocalCidMapRemember fills in the entry, as it may allocate memory.  If
+ * the record never gets inserted, the entry just stays invalid; the next
+ * record prepared reuses the same pointer anyway.
+ */
+void
+UndoLocalCidMapPrepare(UndoRecPtr urp, FullTransactionId fxid)
+{
+	UndoLocalRecord *entry;
+	bool		found;
+
+	if (InRecovery)
+		return;
+
+	if (UndoLocalCidMap != NULL &&
+		!FullTransactionIdEquals(fxid, UndoLocalCidMapXid))
+	{
+		hash_destroy(UndoLocalCidMap);
+		UndoLocalCidMap = NULL;
+	}
+
+	if (undo_local_cid_map_size == 0)
+		return;
+
+	if (UndoLocalCidMap == NULL)
+	{
+		HASHCTL		ctl;
+
+		memset(&ctl, 0, sizeof(ctl));
+		ctl.keysize = sizeof(UndoRecPtr);
+		ctl.entrysize = sizeof(UndoLocalRecord);
+		UndoLocalCidMap = hash_create("Undo local command id map", 256, &ctl,
+									  HASH_ELEM | HASH_BLOBS);
+		UndoLocalCidMapXid = fxid;
+	}
+	else if (hash_get_num_entries(UndoLocalCidMap) >= undo_local_cid_map_size)
+		return;
+
+	entry = hash_search(UndoLocalCidMap, &urp, HASH_ENTER, &found);
+	entry->valid = false;
+}
+
+/*
+ * Fill in the map entry of the undo record just written at urp, if it has
+ * one.
+ *
+ * This runs in a critical section, so it must not allocate memory.
+ */
+void
+UndoLocalCidMapRemember(UndoRecPtr urp, UnpackedUndoRecord *uur)
+{
+	UndoLocalRecord *entry;
+
+	if (UndoLocalCidMap == NULL)
+		return;
+
+	entry = hash_search(UndoLocalCidMap, &urp, HASH_FIND, NULL);
+	if (entry == NULL)
+		return;
+
+	entry->type = uur->uur_type;
+	entry->block = uur->uur_block;
+	entry->offset = uur->uur_offset;
+	entry->blkprev = uur->uur_blkprev;
+	entry->xid = uur->uur_xid;
+	entry->cid = uur->uur_cid;
+	entry->valid = true;
+}
+
+/*
+ * Return the map entry of the undo record at urp, or NULL if it's not a
+ * record inserted by the current transaction that the map knows about.
+ */
+UndoLocalRecord *
+UndoLocalCidMapLookup(UndoRecPtr urp)
+{
+	UndoLocalRecord *entry;
+
+	if (UndoLocalCidMap == NULL ||
+		!FullTransactionIdEquals(GetTopFullTransactionIdIfAny(),
+								 UndoLocalCidMapXid))
+		return NULL;
+
+	entry = hash_search(UndoLocalCidMap, &urp, HASH_FIND, NULL);
+	if (entry == NULL || !entry->valid)
+		return NULL;
+
+	return entry;
+}
@@ -46,6 +46,7 @@
 #include "utils/builtins.h"
 #include "utils/guc.h"
 #include "utils/memutils.h"
+#include "utils/timestamp.h"
 #include "utils/varlena.h"
 
 #include <sys/stat.h>
@@ -60,32 +61,65 @@
 #define UndoLogBankBits 14
 #define UndoLogBanks (1 << UndoLogBankBits)
 
+/* Number of UndoLogControl objects in each bank. */
+#define UndoLogsPerBank (1 << (UndoLogNumberBits - UndoLogBankBits))
+
 /* Extract the undo bank number from an undo log number (upper bits). */
 #define UndoLogNoGetBankNo(logno)				\
 	((logno) >> (UndoLogNumberBits - UndoLogBankBits))
 
 /* Extract the slot within a bank from an undo log number (lower bits). */
 #define UndoLogNoGetSlotNo(logno)				\
-	((logno) & ((1 << (UndoLogNumberBits - UndoLogBankBits)) - 1))
+	((logno) & (UndoLogsPerBank - 1))
 
 /*
  * During recovery we maintain a mapping of transaction ID to undo logs
- * numbers.  We do this with another two-level array, so that we use memory
- * only for chunks of the array that overlap with the range of active xids.
+ * numbers.  Xids are assigned almost sequentially, so we do this with a ring
+ * indexed by the low bits of the xid, covering the range of xids from the
+ * oldest one that might still insert undo to the newest one seen.  The ring
+ * starts out with this many entries and doubles when that range outgrows it.
+ */
+#define UndoLogXidMapInitialSize (1 << 16)
+
+/*
+ * Number of tablespaces whose undo write latency is tracked.  Tablespaces
+ * beyond that are treated as if nothing was known about them.
  */
-#define UndoLogXidLowBits 16
+#define UndoTablespaceLoadSlots 32
 
 /*
- * Number of high bits.
+ * The write latency of a tablespace is kept as an exponentially weighted
+ * moving average in microseconds, scaled up by 1 << UndoWriteLatencyShift;
+ * each new sample contributes 1 / (1 << UndoWriteLatencyShift) of it.
  */
-#define UndoLogXidHighBits \
-	(sizeof(TransactionId) * CHAR_BIT - UndoLogXidLowBits)
+#define UndoWriteLatencyShift 3
 
-/* Extract the upper bits of an xid, for undo log mapping purposes. */
-#define UndoLogGetXidHigh(xid) ((xid) >> UndoLogXidLowBits)
+/*
+ * Every UndoRebalanceInterval transactions a backend checks whether the
+ * tablespace of the undo log it's attached to has become much slower than
+ * the fastest undo tablespace, and if so moves to another undo log.  "Much
+ * slower" means more than UndoRebalanceRatio times as slow, and by at least
+ * UndoRebalanceMinLatency microseconds, so that small fluctuations don't
+ * bounce backends between logs.
+ */
+#define UndoRebalanceInterval 64
+#define UndoRebalanceRatio 2
+#define UndoRebalanceMinLatency 100
 
-/* Extract the lower bits of an xid, for undo log mapping purposes. */
-#define UndoLogGetXidLow(xid) ((xid) & ((1 << UndoLogXidLowBits) - 1))
+/* Minimum interval between samples of the write rate of an undo log. */
+#define UndoWriteRateInterval (10 * USECS_PER_SEC)
+
+/*
+ * Observed write latency of the undo files in one tablespace.  The slots are
+ * claimed by whichever process first writes undo to a tablespace, and the
+ * moving average is updated without locking: it's only a hint for placing
+ * undo logs, so an update lost to a concurrent writer doesn't matter.
+ */
+typedef struct UndoTablespaceLoad
+{
+	pg_atomic_uint32 tablespace;	/* InvalidOid, if the slot is unused */
+	pg_atomic_uint32 write_latency; /* scaled moving average, see above */
+} UndoTablespaceLoad;
 
 /*
  * Main control structure for undo log management in shared memory.
@@ -105,6 +139,18 @@ typedef struct UndoLogSharedData
 	 * 'banks'.
 	 */
 	dsm_handle	banks[UndoLogBanks];
+
+	/*
+	 * Number of segment files in the pools of free segments, over all
+	 * tablespaces.  This is only a hint used to avoid scanning directories
+	 * for pooled segments when there are none; see
+	 * take_undo_segment_from_pool.
+	 */
+	pg_atomic_uint32 pooled_segments;
+	pg_atomic_uint32 next_prealloc_segment;	/* for naming preallocated files */
+
+	/* Write latency of the undo tablespaces, for choose_undo_tablespace. */
+	UndoTablespaceLoad tablespace_load[UndoTablespaceLoadSlots];
 }			UndoLogSharedData;
 
 /*
@@ -142,20 +188,32 @@ struct
 	 */
 	bool		need_to_choose_tablespace;
 
+	/*
+	 * The undo tablespaces found in undo_tablespaces the last time we chose
+	 * one, and the number of transactions left before we check again whether
+	 * the tablespace we're attached to is overloaded.
+	 */
+	Oid			tablespaces[UndoTablespaceLoadSlots];
+	int			ntablespaces;
+	int			rebalance_countdown;
+
 	/*
 	 * During recovery, the startup process maintains a mapping of xid to undo
 	 * log number, instead of using 'log' above.  This is not used in regular
 	 * backends and can be in backend-private memory so long as recovery is
 	 * single-process.  This map references UNDO_PERMANENT logs only, since
 	 * temporary and unlogged relations don't have WAL to replay.
+	 *
+	 * The map is a ring of xid_map_size entries, a power of two, holding the
+	 * xids from xid_map_oldest up to but not including xid_map_next at index
+	 * (xid & (xid_map_size - 1)).  Entries outside that range are
+	 * InvalidUndoLogNumber.  We advance xid_map_oldest past transactions that
+	 * are no longer running, see undolog_xid_map_gc.
 	 */
-	UndoLogNumber **xid_map;
-
-	/*
-	 * The slot for the oldest xids still running.  We advance this during
-	 * checkpoints to free up chunks of the map.
-	 */
-	uint16		xid_map_oldest_chunk;
+	UndoLogNumber *xid_map;
+	uint32		xid_map_size;
+	TransactionId xid_map_oldest;
+	TransactionId xid_map_next;
 
 	/* Current dbid.  Used during recovery. */
 	Oid			dbid;
@@ -171,9 +229,57 @@ struct
 
 /* GUC variables */
 char	   *undo_tablespaces = NULL;
+int			undo_segment_pool_size = 16;
+int			undo_preallocate_segments = 0;
+int			undo_precreate_logs = 0;
+
+/*
+ * Discarded segment files that are kept for reuse are renamed by adding this
+ * prefix to their name, so they stay in the undo directory of their
+ * tablespace but can't be mistaken for segments of any undo log.
+ */
+#define UNDO_POOL_PREFIX "free."
+
+/*
+ * The undo log meta data is checkpointed in two kinds of files under pg_undo.
+ * A base file, named after the redo point of the checkpoint that wrote it
+ * with UNDO_BASE_SUFFIX appended, holds the meta data of every undo log in
+ * its range as a flat array indexed by log number, so that it can be loaded
+ * with a single read.  Each checkpoint writes a file named after its redo
+ * point that refers to a base file and holds only the meta data of the logs
+ * that have changed since that base was written.  With many idle or long
+ * exhausted undo logs, that keeps most checkpoints from rewriting and
+ * fsyncing all of them.
+ */
+#define UNDO_BASE_SUFFIX ".base"
+
+typedef struct UndoCheckPointHeader
+{
+	UndoLogNumber low_logno;	/* the lowest logno */
+	UndoLogNumber high_logno;	/* one past the highest logno */
+	XLogRecPtr	base_redo;		/* redo point naming the base file */
+	uint32		nentries;		/* number of UndoCheckPointEntry that follow */
+	pg_crc32c	crc;			/* CRC of the fields above */
+} UndoCheckPointHeader;
+
+typedef struct UndoCheckPointEntry
+{
+	UndoLogNumber logno;
+	UndoLogMetaData meta;
+} UndoCheckPointEntry;
+
+/*
+ * The checkpointer keeps a copy of the meta data in the most recent base
+ * file, to find the logs that have changed since.
+ */
+static XLogRecPtr undo_base_redo = InvalidXLogRecPtr;
+static UndoLogNumber undo_base_low_logno;
+static UndoLogNumber undo_base_high_logno;
+static UndoLogMetaData *undo_base_meta = NULL;
 
 static UndoLogControl *get_undo_log_by_number(UndoLogNumber logno);
 static void ensure_undo_log_number(UndoLogNumber logno);
+static UndoLogControl *create_undo_log(UndoPersistence level, Oid tablespace);
 static void attach_undo_log(UndoPersistence level, Oid tablespace);
 static void detach_current_undo_log(UndoPersistence level, bool exhausted);
 static void extend_undo_log(UndoLogNumber logno, UndoLogOffset new_end);
@@ -182,6 +288,8 @@ static void forget_undo_buffers(int logno, UndoLogOffset old_discard,
 								UndoLogOffset new_discard,
 								bool drop_tail);
 static bool choose_undo_tablespace(bool force_detach, Oid *oid);
+static bool undo_tablespace_overloaded(Oid tablespace);
+static UndoLogNumber undolog_xid_map_lookup(TransactionId xid);
 static void undolog_xid_map_gc(void);
 static void undolog_bank_gc(void);
 
@@ -224,6 +332,14 @@ UndoLogShmemInit(void)
 			shared->free_lists[i] = InvalidUndoLogNumber;
 		shared->low_bankno = 0;
 		shared->high_bankno = 0;
+		pg_atomic_init_u32(&shared->pooled_segments, 0);
+		pg_atomic_init_u32(&shared->next_prealloc_segment, 0);
+		for (i = 0; i < UndoTablespaceLoadSlots; ++i)
+		{
+			pg_atomic_init_u32(&shared->tablespace_load[i].tablespace,
+							   InvalidOid);
+			pg_atomic_init_u32(&shared->tablespace_load[i].write_latency, 0);
+		}
 	}
 	else
 		Assert(found);
@@ -355,14 +471,76 @@ UndoLogIsDiscarded(UndoRecPtr point)
  * its first undo.
  */
 void
-UndoLogSetLastXactStartPoint(UndoRecPtr point)
+UndoLogSetLastXactStartPoint(UndoRecPtr point, FullTransactionId fxid)
 {
 	UndoLogNumber logno = UndoRecPtrGetLogNo(point);
 	UndoLogControl *log = get_undo_log_by_number(logno);
+	UndoLogOffset offset = UndoRecPtrGetOffset(point);
+	UndoLogXactStart *entry;
+
+	LWLockAcquire(&log->mutex, LW_EXCLUSIVE);
+	log->meta.last_xact_start = offset;
+
+	/*
+	 * Also remember the transaction start in the log's index.  If the insert
+	 * point was rewound, the newest entries might be at or after this point;
+	 * those transaction headers are gone, so forget about them.
+	 */
+	while (log->xact_starts_count > 0)
+	{
+		entry = &log->xact_starts[(log->xact_starts_first +
+								   log->xact_starts_count - 1) %
+								  UNDO_LOG_XACT_STARTS];
+		if (entry->start < offset)
+			break;
+		log->xact_starts_count--;
+	}
+	if (log->xact_starts_count == UNDO_LOG_XACT_STARTS)
+	{
+		log->xact_starts_first =
+			(log->xact_starts_first + 1) % UNDO_LOG_XACT_STARTS;
+		log->xact_starts_count--;
+	}
+	entry = &log->xact_starts[(log->xact_starts_first +
+							   log->xact_starts_count) %
+							  UNDO_LOG_XACT_STARTS];
+	entry->start = offset;
+	entry->xid = XidFromFullTransactionId(fxid);
+	entry->epoch = EpochFromFullTransactionId(fxid);
+	entry->start_time = InRecovery ? 0 : GetCurrentTransactionStartTimestamp();
+	log->xact_starts_count++;
+	LWLockRelease(&log->mutex);
+}
+
+/*
+ * Copy the remembered transaction starts at or after offset 'from' into
+ * 'starts', which must have room for UNDO_LOG_XACT_STARTS entries, oldest
+ * first.  Return the number of entries copied.
+ *
+ * This is meant for the discard worker, which only ever asks about the oldest
+ * transaction that it has not discarded yet, so the entries before 'from' are
+ * forgotten.
+ */
+int
+UndoLogGetXactStarts(UndoLogControl *log, UndoLogOffset from,
+					 UndoLogXactStart *starts)
+{
+	int			n = 0;
 
 	LWLockAcquire(&log->mutex, LW_EXCLUSIVE);
-	log->meta.last_xact_start = UndoRecPtrGetOffset(point);
+	while (log->xact_starts_count > 0 &&
+		   log->xact_starts[log->xact_starts_first].start < from)
+	{
+		log->xact_starts_first =
+			(log->xact_starts_first + 1) % UNDO_LOG_XACT_STARTS;
+		log->xact_starts_count--;
+	}
+	for (n = 0; n < log->xact_starts_count; n++)
+		starts[n] = log->xact_starts[(log->xact_starts_first + n) %
+									 UNDO_LOG_XACT_STARTS];
 	LWLockRelease(&log->mutex);
+
+	return n;
 }
 
 /*
@@ -394,19 +572,12 @@ UndoLogGetLastXactStartPoint(UndoLogNumber logno)
 bool
 IsTransactionFirstRec(TransactionId xid)
 {
-	uint16		high_bits = UndoLogGetXidHigh(xid);
-	uint16		low_bits = UndoLogGetXidLow(xid);
 	UndoLogNumber logno;
 	UndoLogControl *log;
 
 	Assert(InRecovery);
 
-	if (MyUndoLogState.xid_map == NULL)
-		elog(ERROR, "xid to undo log number map not initialized");
-	if (MyUndoLogState.xid_map[high_bits] == NULL)
-		elog(ERROR, "cannot find undo log number for xid %u", xid);
-
-	logno = MyUndoLogState.xid_map[high_bits][low_bits];
+	logno = undolog_xid_map_lookup(xid);
 
 	log = get_undo_log_by_number(logno);
 	if (log == NULL)
@@ -446,6 +617,77 @@ detach_current_undo_log(UndoPersistence persistence, bool exhausted)
 	}
 }
 
+/*
+ * Detach from the undo logs holding the undo of the transaction xid, which is
+ * being prepared.
+ *
+ * The undo of a prepared transaction can't be discarded until it has been
+ * committed or rolled back, and neither can the undo of the transactions
+ * written after it in the same log.  So rather than going on in the same log
+ * with our next transaction, we leave the log to the prepared transaction
+ * and attach to another one when we need to.  The log is kept off the free
+ * lists until UndoLogReleasePrepared returns it.
+ */
+void
+PostPrepare_UndoLogs(TransactionId xid)
+{
+	int			i;
+
+	for (i = 0; i < UndoPersistenceLevels; ++i)
+	{
+		UndoLogControl *log = MyUndoLogState.logs[i];
+
+		/* Leave the logs this transaction hasn't written to alone. */
+		if (log == NULL || log->xid != xid)
+			continue;
+
+		MyUndoLogState.logs[i] = NULL;
+
+		LWLockAcquire(&log->mutex, LW_EXCLUSIVE);
+		log->pid = InvalidPid;
+		log->prepared_xid = xid;
+		LWLockRelease(&log->mutex);
+	}
+}
+
+/*
+ * Return the undo log that PostPrepare_UndoLogs left to the prepared
+ * transaction xid to the free list, now that the transaction has been
+ * committed or rolled back.  urp is the last undo record of the transaction
+ * at some persistence level.
+ *
+ * Nothing is done if the log wasn't left to the transaction, e.g. because
+ * it was prepared before a restart.
+ */
+void
+UndoLogReleasePrepared(TransactionId xid, UndoRecPtr urp)
+{
+	UndoLogSharedData *shared = MyUndoLogState.shared;
+	UndoLogControl *log;
+	bool		release = false;
+
+	log = get_undo_log_by_number(UndoRecPtrGetLogNo(urp));
+	if (log == NULL)
+		return;
+
+	LWLockAcquire(&log->mutex, LW_EXCLUSIVE);
+	if (log->prepared_xid == xid && log->pid == InvalidPid)
+	{
+		log->prepared_xid = InvalidTransactionId;
+		log->xid = InvalidTransactionId;
+		release = (log->meta.status == UNDO_LOG_STATUS_ACTIVE);
+	}
+	LWLockRelease(&log->mutex);
+
+	if (release)
+	{
+		LWLockAcquire(UndoLogLock, LW_EXCLUSIVE);
+		log->next_free = shared->free_lists[log->meta.persistence];
+		shared->free_lists[log->meta.persistence] = log->logno;
+		LWLockRelease(UndoLogLock);
+	}
+}
+
 static void
 undo_log_before_exit(int code, Datum arg)
 {
@@ -458,23 +700,328 @@ undo_log_before_exit(int code, Datum arg)
 	}
 }
 
+/*
+ * Count the pooled segment files in one undo directory.
+ */
+static uint32
+count_pooled_undo_segments(const char *undo_path)
+{
+	DIR		   *dir;
+	struct dirent *de;
+	uint32		count = 0;
+
+	dir = AllocateDir(undo_path);
+	if (dir == NULL)
+		return 0;
+	while ((de = ReadDirExtended(dir, undo_path, LOG)) != NULL)
+	{
+		if (strncmp(de->d_name, UNDO_POOL_PREFIX,
+					strlen(UNDO_POOL_PREFIX)) == 0)
+			count++;
+	}
+	FreeDir(dir);
+
+	return count;
+}
+
+/*
+ * Count the pooled segment files in the undo directories of all tablespaces.
+ */
+static uint32
+count_all_pooled_undo_segments(void)
+{
+	DIR		   *dir;
+	struct dirent *de;
+	char		undo_path[MAXPGPATH];
+	uint32		count;
+
+	UndoLogDirectory(DEFAULTTABLESPACE_OID, undo_path);
+	count = count_pooled_undo_segments(undo_path);
+
+	dir = AllocateDir("pg_tblspc");
+	while ((de = ReadDirExtended(dir, "pg_tblspc", LOG)) != NULL)
+	{
+		if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+			continue;
+		snprintf(undo_path, MAXPGPATH, "pg_tblspc/%s/%s/undo",
+				 de->d_name, TABLESPACE_VERSION_DIRECTORY);
+		count += count_pooled_undo_segments(undo_path);
+	}
+	FreeDir(dir);
+
+	return count;
+}
+
+/*
+ * Decrement the pooled segments hint, without wrapping around if it was
+ * already off.
+ */
+static void
+pooled_segments_decrement(void)
+{
+	UndoLogSharedData *shared = MyUndoLogState.shared;
+	uint32		count = pg_atomic_read_u32(&shared->pooled_segments);
+
+	while (count > 0)
+	{
+		if (pg_atomic_compare_exchange_u32(&shared->pooled_segments, &count,
+										   count - 1))
+			break;
+	}
+}
+
+/*
+ * Put the segment file at 'path', which is no longer needed, into the pool of
+ * free segments of its tablespace, so that allocate_empty_undo_segment can
+ * reuse it instead of writing a new file full of zeroes.  The content of a
+ * recycled segment doesn't matter, for the same reason that it doesn't matter
+ * when UndoLogDiscard renames a segment to the end of its own undo log.
+ *
+ * Return false if the pool is full, or the file couldn't be renamed; the
+ * caller should then get rid of the file.
+ */
+static bool
+put_undo_segment_in_pool(const char *path, Oid tablespace)
+{
+	UndoLogSharedData *shared = MyUndoLogState.shared;
+	char		dir[MAXPGPATH];
+	char		pool_path[MAXPGPATH];
+
+	if (pg_atomic_read_u32(&shared->pooled_segments) >= undo_segment_pool_size)
+		return false;
+
+	UndoLogDirectory(tablespace, dir);
+	snprintf(pool_path, MAXPGPATH, "%s/%s%s", dir, UNDO_POOL_PREFIX,
+			 last_dir_separator(path) + 1);
+	if (rename(path, pool_path) != 0)
+	{
+		elog(LOG, "could not rename \"%s\" to \"%s\": %m", path, pool_path);
+		return false;
+	}
+	pg_atomic_fetch_add_u32(&shared->pooled_segments, 1);
+
+	return true;
+}
+
+/*
+ * Try to move a segment file from the pool of free segments of the given
+ * tablespace to 'path'.  Return true on success.
+ */
+static bool
+take_undo_segment_from_pool(Oid tablespace, const char *path)
+{
+	UndoLogSharedData *shared = MyUndoLogState.shared;
+	char		undo_path[MAXPGPATH];
+	DIR		   *dir;
+	struct dirent *de;
+	bool		found = false;
+
+	if (pg_atomic_read_u32(&shared->pooled_segments) == 0)
+		return false;
+
+	UndoLogDirectory(tablespace, undo_path);
+	dir = AllocateDir(undo_path);
+	if (dir == NULL)
+		return false;
+	while ((de = ReadDirExtended(dir, undo_path, LOG)) != NULL)
+	{
+		char		pool_path[MAXPGPATH];
+
+		if (strncmp(de->d_name, UNDO_POOL_PREFIX,
+					strlen(UNDO_POOL_PREFIX)) != 0)
+			continue;
+
+		/* If someone else took this one first, try the next one. */
+		snprintf(pool_path, MAXPGPATH, "%s/%s", undo_path, de->d_name);
+		if (rename(pool_path, path) == 0)
+		{
+			found = true;
+			break;
+		}
+	}
+	FreeDir(dir);
+
+	if (found)
+		pooled_segments_decrement();
+
+	return found;
+}
+
+/*
+ * Write zeroes to the segment file open as 'fd' from 'size' up to its full
+ * size, and flush it to disk.
+ */
+static void
+zero_fill_undo_segment(int fd, off_t size, const char *path)
+{
+	void	   *zeroes;
+	size_t		nzeroes = 8192;
+
+	/* A buffer full of zeroes we'll use to fill up new segment files. */
+	zeroes = palloc0(nzeroes);
+
+	while (size < UndoLogSegmentSize)
+	{
+		ssize_t		written;
+
+		written = write(fd, zeroes, Min(nzeroes, UndoLogSegmentSize - size));
+		if (written < 0)
+			elog(ERROR, "cannot initialize undo log segment file \"%s\": %m",
+				 path);
+		size += written;
+	}
+
+	/* Flush the contents of the file to disk. */
+	if (pg_fsync(fd) != 0)
+		elog(ERROR, "cannot fsync file \"%s\": %m", path);
+
+	pfree(zeroes);
+}
+
+/*
+ * Make sure that the pool of free segments of the default tablespace holds
+ * at least undo_preallocate_segments files, creating new ones if needed.
+ * This is called by the discard worker in between discarding, so that
+ * backends extending their undo logs don't have to write out new segments
+ * themselves.
+ */
+void
+UndoLogPreallocateSegments(void)
+{
+	UndoLogSharedData *shared = MyUndoLogState.shared;
+	int			target;
+	char		undo_path[MAXPGPATH];
+	bool		created = false;
+
+	target = Min(undo_preallocate_segments, undo_segment_pool_size);
+	UndoLogDirectory(DEFAULTTABLESPACE_OID, undo_path);
+
+	while (pg_atomic_read_u32(&shared->pooled_segments) < target)
+	{
+		char		path[MAXPGPATH];
+		int			fd;
+
+		snprintf(path, MAXPGPATH, "%s/%sprealloc.%08X", undo_path,
+				 UNDO_POOL_PREFIX,
+				 pg_atomic_fetch_add_u32(&shared->next_prealloc_segment, 1));
+
+		/* Files left over from before a restart might be in the way. */
+		fd = OpenTransientFile(path, O_RDWR | O_CREAT | O_EXCL | PG_BINARY);
+		if (fd < 0)
+		{
+			if (errno == EEXIST)
+				continue;
+			elog(LOG, "could not create file \"%s\": %m", path);
+			break;
+		}
+		zero_fill_undo_segment(fd, 0, path);
+		CloseTransientFile(fd);
+
+		pg_atomic_fetch_add_u32(&shared->pooled_segments, 1);
+		created = true;
+	}
+
+	if (created)
+		fsync_fname(undo_path, true);
+}
+
+/*
+ * Make sure that at least undo_precreate_logs undo logs of the default
+ * tablespace are free for each of the permanent and unlogged persistence
+ * levels, creating new ones with their first segment if needed.  This is
+ * called by the discard worker in between discarding, so that backends
+ * writing undo for the first time, as every new connection does, can just
+ * take one instead of creating and extending a log themselves.
+ */
+void
+UndoLogPrecreateLogs(void)
+{
+	UndoLogSharedData *shared = MyUndoLogState.shared;
+	UndoPersistence persistence;
+
+	if (undo_precreate_logs <= 0 || RecoveryInProgress())
+		return;
+
+	for (persistence = UNDO_PERMANENT; persistence <= UNDO_UNLOGGED; persistence++)
+	{
+		for (;;)
+		{
+			UndoLogControl *log;
+			UndoLogNumber logno;
+			int			nfree = 0;
+
+			/* We never write undo ourselves, but let's not get confused. */
+			if (MyUndoLogState.logs[persistence] != NULL)
+				break;
+
+			LWLockAcquire(UndoLogLock, LW_EXCLUSIVE);
+			for (logno = shared->free_lists[persistence];
+				 logno != InvalidUndoLogNumber && nfree < undo_precreate_logs;
+				 logno = log->next_free)
+			{
+				log = get_undo_log_by_number(logno);
+				if (log == NULL)
+					elog(ERROR, "corrupted undo log freelist");
+				if (log->meta.tablespace == DEFAULTTABLESPACE_OID)
+					nfree++;
+			}
+			if (nfree >= undo_precreate_logs)
+			{
+				LWLockRelease(UndoLogLock);
+				break;
+			}
+			log = create_undo_log(persistence, DEFAULTTABLESPACE_OID);
+			LWLockRelease(UndoLogLock);
+
+			/*
+			 * Attach to it for as long as it takes to add the first segment,
+			 * then put it on the free list.
+			 */
+			LWLockAcquire(&log->mutex, LW_EXCLUSIVE);
+			log->pid = MyProcPid;
+			LWLockRelease(&log->mutex);
+			MyUndoLogState.logs[persistence] = log;
+
+			extend_undo_log(log->logno, UndoLogSegmentSize);
+			detach_current_undo_log(persistence, false);
+		}
+	}
+}
+
 /*
  * Create a fully allocated empty segment file on disk for the byte starting
  * at 'end'.
+ *
+ * The undo of temporary tables is private to its backend and thrown away on
+ * restart, and its pages live in local buffers that only reach the segment
+ * file when they are evicted.  So for those, we just create a sparse file,
+ * without writing zeroes, flushing it or drawing on the pool of free
+ * segments, which must only ever hold fully allocated files.
+ *
+ * Returns true if a segment from the pool was reused.
  */
-static void
+static bool
 allocate_empty_undo_segment(UndoLogNumber logno, Oid tablespace,
-							UndoLogOffset end)
+							UndoLogOffset end, UndoPersistence persistence)
 {
 	struct stat stat_buffer;
 	off_t		size;
 	char		path[MAXPGPATH];
-	void	   *zeroes;
-	size_t		nzeroes = 8192;
 	int			fd;
+	bool		recycled = false;
 
 	UndoLogSegmentPath(logno, end / UndoLogSegmentSize, tablespace, path);
 
+	/*
+	 * If the segment doesn't exist yet, try to reuse a file from the pool of
+	 * free segments, which saves us from writing a whole segment of zeroes.
+	 * We must never replace an existing file, since after a crash it may
+	 * hold undo data that we still need.
+	 */
+	if (persistence != UNDO_TEMP &&
+		stat(path, &stat_buffer) != 0 && errno == ENOENT)
+		recycled = take_undo_segment_from_pool(tablespace, path);
+
 	/*
 	 * Create and fully allocate a new file.  If we crashed and recovered then
 	 * the file might already exist, so use flags that tolerate that. It's
@@ -547,28 +1094,17 @@ allocate_empty_undo_segment(UndoLogNumber logno, Oid tablespace,
 		elog(ERROR, "could not stat \"%s\": %m", path);
 	size = stat_buffer.st_size;
 
-	/* A buffer full of zeroes we'll use to fill up new segment files. */
-	zeroes = palloc0(nzeroes);
-
-	while (size < UndoLogSegmentSize)
-	{
-		ssize_t		written;
-
-		written = write(fd, zeroes, Min(nzeroes, UndoLogSegmentSize - size));
-		if (written < 0)
-			elog(ERROR, "cannot initialize undo log segment file \"%s\": %m",
-				 path);
-		size += written;
-	}
-
-	/* Flush the contents of the file to disk. */
-	if (pg_fsync(fd) != 0)
-		elog(ERROR, "cannot fsync file \"%s\": %m", path);
+	if (persistence != UNDO_TEMP)
+		zero_fill_undo_segment(fd, size, path);
+	else if (size < UndoLogSegmentSize &&
+			 ftruncate(fd, UndoLogSegmentSize) < 0)
+		elog(ERROR, "cannot initialize undo log segment file \"%s\": %m",
+			 path);
 	CloseTransientFile(fd);
 
-	pfree(zeroes);
-
 	elog(LOG, "created undo segment \"%s\"", path); /* XXX: remove me */
+
+	return recycled;
 }
 
 /*
@@ -578,7 +1114,10 @@ void
 UndoLogNewSegment(UndoLogNumber logno, Oid tablespace, int segno)
 {
 	Assert(InRecovery);
-	allocate_empty_undo_segment(logno, tablespace, segno * UndoLogSegmentSize);
+
+	/* Temporary undo is never WAL-logged, so this isn't one of those. */
+	allocate_empty_undo_segment(logno, tablespace, segno * UndoLogSegmentSize,
+								UNDO_PERMANENT);
 }
 
 /*
@@ -591,6 +1130,8 @@ extend_undo_log(UndoLogNumber logno, UndoLogOffset new_end)
 	UndoLogControl *log;
 	char		dir[MAXPGPATH];
 	size_t		end;
+	uint64		created = 0;
+	uint64		recycled = 0;
 
 	log = get_undo_log_by_number(logno);
 
@@ -607,16 +1148,23 @@ extend_undo_log(UndoLogNumber logno, UndoLogOffset new_end)
 	end = log->meta.end;
 	while (end < new_end)
 	{
-		allocate_empty_undo_segment(logno, log->meta.tablespace, end);
+		if (allocate_empty_undo_segment(logno, log->meta.tablespace, end,
+										log->meta.persistence))
+			++recycled;
+		else
+			++created;
 		end += UndoLogSegmentSize;
 	}
 
 	/*
 	 * Flush the parent dir so that the directory metadata survives a crash
-	 * after this point.
+	 * after this point.  Temporary undo logs are reset after a crash anyway.
 	 */
-	UndoLogDirectory(log->meta.tablespace, dir);
-	fsync_fname(dir, true);
+	if (log->meta.persistence != UNDO_TEMP)
+	{
+		UndoLogDirectory(log->meta.tablespace, dir);
+		fsync_fname(dir, true);
+	}
 
 	/*
 	 * If we're not in recovery, we need to WAL-log the creation of the new
@@ -625,9 +1173,10 @@ extend_undo_log(UndoLogNumber logno, UndoLogOffset new_end)
 	 * src/backend/access/transam/README.  This means that it's possible for
 	 * us to crash having made some or all of the filesystem changes but
 	 * before WAL logging, but in that case we'll eventually try to create the
-	 * same segment(s) again which is tolerated.
+	 * same segment(s) again which is tolerated.  Nothing about temporary
+	 * undo logs needs to be replayed.
 	 */
-	if (!InRecovery)
+	if (!InRecovery && log->meta.persistence != UNDO_TEMP)
 	{
 		xl_undolog_extend xlrec;
 		XLogRecPtr	ptr;
@@ -654,6 +1203,8 @@ extend_undo_log(UndoLogNumber logno, UndoLogOffset new_end)
 	LWLockAcquire(&log->mutex, LW_EXCLUSIVE);
 	if (log->meta.end < end)
 		log->meta.end = end;
+	log->segments_created += created;
+	log->segments_recycled += recycled;
 	LWLockRelease(&log->mutex);
 }
 
@@ -700,6 +1251,7 @@ UndoLogAllocate(size_t size, UndoPersistence persistence)
 	UndoLogControl *log = MyUndoLogState.logs[persistence];
 	UndoLogOffset new_insert;
 	TransactionId logxid;
+	TimestampTz now;
 
 	/*
 	 * We may need to attach to an undo log, either because this is the first
@@ -726,25 +1278,56 @@ retry:
 	}
 
 	/*
-	 * If this is the first time we've allocated undo log space in this
-	 * transaction, we'll record the xid->undo log association so that it can
-	 * be replayed correctly. Before that, we set the first record flag to
-	 * false.
+	 * Only this backend changes the xid and is_first_rec of the undo log it
+	 * is attached to, while a transaction of ours is in progress (only
+	 * DetachUndoLogsInsTablespace or DropUndoLogsInTablespace can interfere,
+	 * and only between transactions), so we can read them without the mutex.
+	 * Once the log has been associated with the current transaction and its
+	 * first record has been allocated, there is nothing left to do under the
+	 * mutex, which is the common case.
 	 */
-	LWLockAcquire(&log->mutex, LW_EXCLUSIVE);
-	log->meta.is_first_rec = false;
 	logxid = log->xid;
-
-	if (logxid != GetTopTransactionId())
+	if (likely(logxid == GetTopTransactionId()))
+	{
+		if (log->meta.is_first_rec)
+		{
+			LWLockAcquire(&log->mutex, LW_EXCLUSIVE);
+			log->meta.is_first_rec = false;
+			LWLockRelease(&log->mutex);
+		}
+	}
+	else
 	{
 		xl_undolog_attach xlrec;
 
 		/*
+		 * Nothing of this transaction is in this undo log yet, so this is
+		 * our chance to move to a log in a less loaded tablespace, if the
+		 * one we're attached to has become overloaded.
+		 */
+		if (unlikely(MyUndoLogState.ntablespaces > 1 &&
+					 --MyUndoLogState.rebalance_countdown <= 0))
+		{
+			MyUndoLogState.rebalance_countdown = UndoRebalanceInterval;
+			if (undo_tablespace_overloaded(log->meta.tablespace))
+			{
+				detach_current_undo_log(persistence, false);
+				log = NULL;
+				goto retry;
+			}
+		}
+
+		/*
+		 * This is the first time we've allocated undo log space in this
+		 * transaction, so we'll record the xid->undo log association so that
+		 * it can be replayed correctly.
+		 *
 		 * While we have the lock, check if we have been forcibly detached by
 		 * DROP TABLESPACE.  That can only happen between transactions (see
 		 * DetachUndoLogsInsTablespace()) so we only have to check for it in
 		 * this branch.
 		 */
+		LWLockAcquire(&log->mutex, LW_EXCLUSIVE);
 		if (log->pid == InvalidPid)
 		{
 			LWLockRelease(&log->mutex);
@@ -753,6 +1336,25 @@ retry:
 		}
 		log->xid = GetTopTransactionId();
 		log->meta.is_first_rec = true;
+
+		/*
+		 * Sample the write rate of the log every UndoWriteRateInterval, using
+		 * the transaction start time as a cheap approximation of the current
+		 * time.
+		 */
+		now = GetCurrentTransactionStartTimestamp();
+		if (log->rate_time == 0)
+		{
+			log->rate_time = now;
+			log->rate_insert = log->meta.insert;
+		}
+		else if (now - log->rate_time >= UndoWriteRateInterval)
+		{
+			log->write_rate = (double) (log->meta.insert - log->rate_insert) *
+				USECS_PER_SEC / (now - log->rate_time);
+			log->rate_time = now;
+			log->rate_insert = log->meta.insert;
+		}
 		LWLockRelease(&log->mutex);
 
 		/* Skip the attach record for unlogged and temporary tables. */
@@ -767,10 +1369,6 @@ retry:
 			XLogInsert(RM_UNDOLOG_ID, XLOG_UNDOLOG_ATTACH);
 		}
 	}
-	else
-	{
-		LWLockRelease(&log->mutex);
-	}
 
 	/*
 	 * 'size' is expressed in usable non-header bytes.  Figure out how far we
@@ -816,8 +1414,6 @@ UndoRecPtr
 UndoLogAllocateInRecovery(TransactionId xid, size_t size,
 						  UndoPersistence level)
 {
-	uint16		high_bits = UndoLogGetXidHigh(xid);
-	uint16		low_bits = UndoLogGetXidLow(xid);
 	UndoLogNumber logno;
 	UndoLogControl *log;
 
@@ -839,14 +1435,7 @@ UndoLogAllocateInRecovery(TransactionId xid, size_t size,
 	 * first call to UndoLogAllocate for this xid after the most recent
 	 * checkpoint.
 	 */
-	if (MyUndoLogState.xid_map == NULL)
-		elog(ERROR, "xid to undo log number map not initialized");
-	if (MyUndoLogState.xid_map[high_bits] == NULL)
-		elog(ERROR, "cannot find undo log number for xid %u", xid);
-	logno = MyUndoLogState.xid_map[high_bits][low_bits];
-
-	if (logno == InvalidUndoLogNumber)
-		elog(ERROR, "cannot find undo log number for xid %u", xid);
+	logno = undolog_xid_map_lookup(xid);
 
 	/*
 	 * This log must already have been created by XLOG_UNDOLOG_CREATE records
@@ -898,9 +1487,23 @@ UndoLogAdvance(UndoRecPtr insertion_point, size_t size, UndoPersistence persiste
 	Assert(InRecovery || logno == log->logno);
 	Assert(UndoRecPtrGetOffset(insertion_point) == log->meta.insert);
 
+	/*
+	 * The insert pointer is only ever moved by the backend attached to the
+	 * log (or the startup process), so there is no need for the mutex if we
+	 * can store it in one go: other processes reading it, with or without
+	 * the mutex, see either the old or the new value.  That's no different
+	 * from what they'd see if we took the mutex, as it only orders us against
+	 * them, and saves the discard worker and pg_stat_get_undo_logs() readers
+	 * from contending with every undo insertion.
+	 */
+#ifdef PG_HAVE_8BYTE_SINGLE_COPY_ATOMICITY
+	*((volatile UndoLogOffset *) &log->meta.insert) =
+		UndoLogOffsetPlusUsableBytes(log->meta.insert, size);
+#else
 	LWLockAcquire(&log->mutex, LW_EXCLUSIVE);
 	log->meta.insert = UndoLogOffsetPlusUsableBytes(log->meta.insert, size);
 	LWLockRelease(&log->mutex);
+#endif
 }
 
 /*
@@ -938,6 +1541,7 @@ UndoLogDiscard(UndoRecPtr discard_point, TransactionId xid)
 	int			segno;
 	int			new_segno;
 	bool		need_to_flush_wal = false;
+	uint64		recycled = 0;
 
 	if (log == NULL)
 		elog(ERROR, "cannot advance discard pointer for unknown undo log %d",
@@ -1049,6 +1653,7 @@ UndoLogDiscard(UndoRecPtr discard_point, TransactionId xid)
 					elog(LOG, "recycled undo segment \"%s\" -> \"%s\"", discard_path, recycle_path);	/* XXX: remove me */
 					end += UndoLogSegmentSize;
 					--recycle;
+					++recycled;
 				}
 				else
 				{
@@ -1056,7 +1661,9 @@ UndoLogDiscard(UndoRecPtr discard_point, TransactionId xid)
 						 discard_path, recycle_path);
 				}
 			}
-			else
+			else if (log->meta.persistence == UNDO_TEMP ||
+					 !put_undo_segment_in_pool(discard_path,
+											   log->meta.tablespace))
 			{
 				if (unlink(discard_path) == 0)
 					elog(LOG, "unlinked undo segment \"%s\"", discard_path);	/* XXX: remove me */
@@ -1067,7 +1674,11 @@ UndoLogDiscard(UndoRecPtr discard_point, TransactionId xid)
 		}
 	}
 
-	/* WAL log the discard. */
+	/*
+	 * WAL log the discard.  Temporary undo logs are reset after a crash, so
+	 * their discards, which happen at every commit, needn't be logged.
+	 */
+	if (log->meta.persistence != UNDO_TEMP)
 	{
 		xl_undolog_discard xlrec;
 		XLogRecPtr	ptr;
@@ -1089,6 +1700,7 @@ UndoLogDiscard(UndoRecPtr discard_point, TransactionId xid)
 	LWLockAcquire(&log->mutex, LW_EXCLUSIVE);
 	log->meta.discard = discard;
 	log->meta.end = end;
+	log->segments_recycled += recycled;
 	LWLockRelease(&log->mutex);
 }
 
@@ -1172,7 +1784,8 @@ UndoLogRewind(UndoRecPtr insert_urp)
 	log->need_attach_wal_record = true;
 	LWLockRelease(&log->mutex);
 
-	/* WAL log the rewind. */
+	/* WAL log the rewind, unless it's a temporary undo log. */
+	if (log->meta.persistence != UNDO_TEMP)
 	{
 		xl_undolog_rewind xlrec;
 
@@ -1185,17 +1798,112 @@ UndoLogRewind(UndoRecPtr insert_urp)
 	}
 }
 
+/*
+ * Read the header of the undo checkpoint file for the given redo point.
+ * Returns false if the file doesn't exist; errors out if it's corrupted.
+ */
+static bool
+read_undo_checkpoint_header(XLogRecPtr redo, UndoCheckPointHeader *header,
+							int *fdp)
+{
+	char		path[MAXPGPATH];
+	pg_crc32c	crc;
+	int			fd;
+
+	snprintf(path, MAXPGPATH, "pg_undo/%016" INT64_MODIFIER "X", redo);
+	fd = OpenTransientFile(path, O_RDONLY | PG_BINARY);
+	if (fd < 0)
+	{
+		if (errno == ENOENT)
+			return false;
+		elog(ERROR, "cannot open undo checkpoint snapshot \"%s\": %m", path);
+	}
+
+	if (read(fd, header, sizeof(*header)) != sizeof(*header))
+		elog(ERROR, "pg_undo file \"%s\" is corrupted", path);
+
+	INIT_CRC32C(crc);
+	COMP_CRC32C(crc, header, offsetof(UndoCheckPointHeader, crc));
+	FIN_CRC32C(crc);
+	if (crc != header->crc)
+		elog(ERROR,
+			 "pg_undo file \"%s\" has incorrect checksum", path);
+
+	if (fdp != NULL)
+		*fdp = fd;
+	else
+		CloseTransientFile(fd);
+
+	return true;
+}
+
+/*
+ * Write out a file under pg_undo, made of the given parts followed by the
+ * CRC of all but the first one, which carries its own CRC.
+ */
+static void
+write_undo_checkpoint_file(const char *path, void *header, size_t header_size,
+						   void *data, size_t data_size)
+{
+	pg_crc32c	crc;
+	int			fd;
+
+	fd = OpenTransientFile(path, O_RDWR | O_CREAT | O_TRUNC | PG_BINARY);
+	if (fd < 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not create file \"%s\": %m", path)));
+
+	INIT_CRC32C(crc);
+	COMP_CRC32C(crc, data, data_size);
+	FIN_CRC32C(crc);
+
+	pgstat_report_wait_start(WAIT_EVENT_UNDO_CHECKPOINT_WRITE);
+	if (write(fd, header, header_size) != header_size)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not write to file \"%s\": %m", path)));
+	while (data_size > 0)
+	{
+		ssize_t		written;
+
+		written = write(fd, data, data_size);
+		if (written < 0)
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not write to file \"%s\": %m", path)));
+		data_size -= written;
+		data = (char *) data + written;
+	}
+	if (write(fd, &crc, sizeof(crc)) != sizeof(crc))
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not write to file \"%s\": %m", path)));
+	pgstat_report_wait_end();
+
+	pgstat_report_wait_start(WAIT_EVENT_UNDO_CHECKPOINT_SYNC);
+	pg_fsync(fd);
+	pgstat_report_wait_end();
+
+	CloseTransientFile(fd);
+}
+
 /*
  * Delete unreachable files under pg_undo.  Any files corresponding to LSN
- * positions before the previous checkpoint are no longer needed.
+ * positions before the previous checkpoint are no longer needed, and nor
+ * are base files that neither the current nor the previous checkpoint refers
+ * to.
  */
 static void
-CleanUpUndoCheckPointFiles(XLogRecPtr checkPointRedo)
+CleanUpUndoCheckPointFiles(XLogRecPtr checkPointRedo, XLogRecPtr baseRedo)
 {
 	DIR		   *dir;
 	struct dirent *de;
 	char		path[MAXPGPATH];
 	char		oldest_path[MAXPGPATH];
+	char		base_path[MAXPGPATH];
+	char		prior_base_path[MAXPGPATH];
+	UndoCheckPointHeader header;
 
 	/*
 	 * If a base backup is in progress, we can't delete any checkpoint
@@ -1205,27 +1913,51 @@ CleanUpUndoCheckPointFiles(XLogRecPtr checkPointRedo)
 	if (BackupInProgress())
 		return;
 
+	/*
+	 * If the previous checkpoint's file is missing, e.g. because this is the
+	 * first checkpoint after pg_resetwal, we can't tell which base file it
+	 * needs, so keep them all for now.
+	 */
+	prior_base_path[0] = '\0';
+	if (read_undo_checkpoint_header(checkPointRedo, &header, NULL))
+		snprintf(prior_base_path, MAXPGPATH, "%016" INT64_MODIFIER "X%s",
+				 header.base_redo, UNDO_BASE_SUFFIX);
+	snprintf(base_path, MAXPGPATH, "%016" INT64_MODIFIER "X%s",
+			 baseRedo, UNDO_BASE_SUFFIX);
+
 	/* Otherwise keep only those >= the previous checkpoint's redo point. */
 	snprintf(oldest_path, MAXPGPATH, "%016" INT64_MODIFIER "X",
 			 checkPointRedo);
 	dir = AllocateDir("pg_undo");
 	while ((de = ReadDir(dir, "pg_undo")) != NULL)
 	{
-		/*
-		 * Assume that fixed width uppercase hex strings sort the same way as
-		 * the values they represent, so we can use strcmp to identify undo
-		 * log snapshot files corresponding to checkpoints that we don't need
-		 * anymore.  This assumption holds for ASCII.
-		 */
-		if (!(strlen(de->d_name) == UNDO_CHECKPOINT_FILENAME_LENGTH))
-			continue;
-
-		if (UndoCheckPointFilenamePrecedes(de->d_name, oldest_path))
+		if (strlen(de->d_name) == UNDO_CHECKPOINT_FILENAME_LENGTH)
+		{
+			/*
+			 * Assume that fixed width uppercase hex strings sort the same way
+			 * as the values they represent, so we can use strcmp to identify
+			 * undo log snapshot files corresponding to checkpoints that we
+			 * don't need anymore.  This assumption holds for ASCII.
+			 */
+			if (!UndoCheckPointFilenamePrecedes(de->d_name, oldest_path))
+				continue;
+		}
+		else if (strlen(de->d_name) == UNDO_CHECKPOINT_FILENAME_LENGTH +
+				 strlen(UNDO_BASE_SUFFIX) &&
+				 strcmp(de->d_name + UNDO_CHECKPOINT_FILENAME_LENGTH,
+						UNDO_BASE_SUFFIX) == 0)
 		{
-			snprintf(path, MAXPGPATH, "pg_undo/%s", de->d_name);
-			if (unlink(path) != 0)
-				elog(ERROR, "could not unlink file \"%s\": %m", path);
+			if (prior_base_path[0] == '\0' ||
+				strcmp(de->d_name, base_path) == 0 ||
+				strcmp(de->d_name, prior_base_path) == 0)
+				continue;
 		}
+		else
+			continue;
+
+		snprintf(path, MAXPGPATH, "pg_undo/%s", de->d_name);
+		if (unlink(path) != 0)
+			elog(ERROR, "could not unlink file \"%s\": %m", path);
 	}
 	FreeDir(dir);
 }
@@ -1241,15 +1973,14 @@ CheckPointUndoLogs(XLogRecPtr checkPointRedo, XLogRecPtr priorCheckPointRedo)
 {
 	UndoLogSharedData *shared = MyUndoLogState.shared;
 	UndoLogMetaData *serialized = NULL;
+	UndoCheckPointEntry *entries;
+	UndoCheckPointHeader header;
 	UndoLogNumber low_logno;
 	UndoLogNumber high_logno;
 	UndoLogNumber logno;
-	size_t		serialized_size = 0;
-	char	   *data;
 	char		path[MAXPGPATH];
 	int			num_logs;
-	int			fd;
-	pg_crc32c	crc;
+	int			nentries = 0;
 
 	/*
 	 * Take this opportunity to check if we can free up any DSM segments and
@@ -1297,90 +2028,111 @@ CheckPointUndoLogs(XLogRecPtr checkPointRedo, XLogRecPtr priorCheckPointRedo)
 
 	/*
 	 * Rather than doing the file IO while we hold the lock, we'll copy it
-	 * into a palloc'd buffer.
+	 * into a palloc'd buffer.  It's allocated in TopMemoryContext because it
+	 * may become the copy of the next base file.
 	 */
-	if (num_logs > 0)
+	serialized = (UndoLogMetaData *)
+		MemoryContextAllocZero(TopMemoryContext,
+							   sizeof(UndoLogMetaData) * Max(num_logs, 1));
+	for (logno = low_logno; logno != high_logno; ++logno)
 	{
-		serialized_size = sizeof(UndoLogMetaData) * num_logs;
-		serialized = (UndoLogMetaData *) palloc0(serialized_size);
-
-		for (logno = low_logno; logno != high_logno; ++logno)
-		{
-			UndoLogControl *log;
+		UndoLogControl *log;
 
-			log = get_undo_log_by_number(logno);
-			if (log == NULL)	/* XXX can this happen? */
-				continue;
+		log = get_undo_log_by_number(logno);
+		if (log == NULL)	/* XXX can this happen? */
+			continue;
 
-			/* Capture snapshot while holding the mutex. */
-			LWLockAcquire(&log->mutex, LW_EXCLUSIVE);
-			log->need_attach_wal_record = true;
-			memcpy(&serialized[logno], &log->meta, sizeof(UndoLogMetaData));
-			LWLockRelease(&log->mutex);
-		}
+		/* Capture snapshot while holding the mutex. */
+		LWLockAcquire(&log->mutex, LW_EXCLUSIVE);
+		log->need_attach_wal_record = true;
+		memcpy(&serialized[logno - low_logno], &log->meta,
+			   sizeof(UndoLogMetaData));
+		LWLockRelease(&log->mutex);
 	}
 
 	LWLockRelease(UndoLogLock);
 
-	/* Dump into a file under pg_undo. */
-	snprintf(path, MAXPGPATH, "pg_undo/%016" INT64_MODIFIER "X",
-			 checkPointRedo);
-	pgstat_report_wait_start(WAIT_EVENT_UNDO_CHECKPOINT_WRITE);
-	fd = OpenTransientFile(path, O_RDWR | O_CREAT | PG_BINARY);
-	if (fd < 0)
-		ereport(ERROR,
-				(errcode_for_file_access(),
-				 errmsg("could not create file \"%s\": %m", path)));
+	/* Collect the logs whose meta data differs from the base file. */
+	entries = palloc(sizeof(UndoCheckPointEntry) * Max(num_logs, 1));
+	if (undo_base_meta != NULL)
+	{
+		for (logno = low_logno; logno != high_logno; ++logno)
+		{
+			UndoLogMetaData *meta = &serialized[logno - low_logno];
 
-	/* Compute header checksum. */
-	INIT_CRC32C(crc);
-	COMP_CRC32C(crc, &low_logno, sizeof(low_logno));
-	COMP_CRC32C(crc, &high_logno, sizeof(high_logno));
-	FIN_CRC32C(crc);
+			if (logno >= undo_base_low_logno &&
+				logno < undo_base_high_logno &&
+				memcmp(meta, &undo_base_meta[logno - undo_base_low_logno],
+					   sizeof(UndoLogMetaData)) == 0)
+				continue;
 
-	/* Write out range of active log numbers + crc. */
-	if ((write(fd, &low_logno, sizeof(low_logno)) != sizeof(low_logno)) ||
-		(write(fd, &high_logno, sizeof(high_logno)) != sizeof(high_logno)) ||
-		(write(fd, &crc, sizeof(crc)) != sizeof(crc)))
-		ereport(ERROR,
-				(errcode_for_file_access(),
-				 errmsg("could not write to file \"%s\": %m", path)));
+			memset(&entries[nentries], 0, sizeof(UndoCheckPointEntry));
+			entries[nentries].logno = logno;
+			memcpy(&entries[nentries].meta, meta, sizeof(UndoLogMetaData));
+			nentries++;
+		}
+	}
 
-	/* Write out the meta data for all undo logs in that range. */
-	data = (char *) serialized;
-	INIT_CRC32C(crc);
-	while (serialized_size > 0)
+	/*
+	 * Write a new base file if we don't have one yet, which is the case for
+	 * the first checkpoint after startup, or once the changes since the
+	 * last one amount to more than half of it.
+	 */
+	if (undo_base_meta == NULL || nentries * 2 > num_logs)
 	{
-		ssize_t		written;
-
-		written = write(fd, data, serialized_size);
-		if (written < 0)
-			ereport(ERROR,
-					(errcode_for_file_access(),
-					 errmsg("could not write to file \"%s\": %m", path)));
-		COMP_CRC32C(crc, data, written);
-		serialized_size -= written;
-		data += written;
+		pg_crc32c	crc;
+		char		base_header[sizeof(UndoLogNumber) * 2 + sizeof(pg_crc32c)];
+
+		INIT_CRC32C(crc);
+		COMP_CRC32C(crc, &low_logno, sizeof(low_logno));
+		COMP_CRC32C(crc, &high_logno, sizeof(high_logno));
+		FIN_CRC32C(crc);
+
+		memcpy(base_header, &low_logno, sizeof(low_logno));
+		memcpy(base_header + sizeof(low_logno), &high_logno,
+			   sizeof(high_logno));
+		memcpy(base_header + sizeof(low_logno) + sizeof(high_logno), &crc,
+			   sizeof(crc));
+
+		snprintf(path, MAXPGPATH, "pg_undo/%016" INT64_MODIFIER "X%s",
+				 checkPointRedo, UNDO_BASE_SUFFIX);
+		write_undo_checkpoint_file(path, base_header, sizeof(base_header),
+								   serialized,
+								   sizeof(UndoLogMetaData) * num_logs);
+
+		if (undo_base_meta != NULL)
+			pfree(undo_base_meta);
+		undo_base_meta = serialized;
+		undo_base_low_logno = low_logno;
+		undo_base_high_logno = high_logno;
+		undo_base_redo = checkPointRedo;
+		nentries = 0;
 	}
-	FIN_CRC32C(crc);
+	else
+		pfree(serialized);
 
-	if (write(fd, &crc, sizeof(crc)) != sizeof(crc))
-		ereport(ERROR,
-				(errcode_for_file_access(),
-				 errmsg("could not write to file \"%s\": %m", path)));
+	/* Write the file for this checkpoint, with what changed since the base. */
+	memset(&header, 0, sizeof(header));
+	header.low_logno = low_logno;
+	header.high_logno = high_logno;
+	header.base_redo = undo_base_redo;
+	header.nentries = nentries;
+	INIT_CRC32C(header.crc);
+	COMP_CRC32C(header.crc, &header, offsetof(UndoCheckPointHeader, crc));
+	FIN_CRC32C(header.crc);
 
+	snprintf(path, MAXPGPATH, "pg_undo/%016" INT64_MODIFIER "X",
+			 checkPointRedo);
+	write_undo_checkpoint_file(path, &header, sizeof(header), entries,
+							   sizeof(UndoCheckPointEntry) * nentries);
+	pfree(entries);
 
-	/* Flush file and directory entry. */
+	/* Flush the directory entries. */
 	pgstat_report_wait_start(WAIT_EVENT_UNDO_CHECKPOINT_SYNC);
-	pg_fsync(fd);
-	CloseTransientFile(fd);
 	fsync_fname("pg_undo", true);
 	pgstat_report_wait_end();
 
-	if (serialized)
-		pfree(serialized);
-
-	CleanUpUndoCheckPointFiles(priorCheckPointRedo);
+	CleanUpUndoCheckPointFiles(priorCheckPointRedo, undo_base_redo);
 	undolog_xid_map_gc();
 }
 
@@ -1388,9 +2140,16 @@ void
 StartupUndoLogs(XLogRecPtr checkPointRedo)
 {
 	UndoLogSharedData *shared = MyUndoLogState.shared;
+	UndoCheckPointHeader header;
+	UndoCheckPointEntry *entries;
+	UndoLogMetaData *base;
+	UndoLogNumber base_low_logno;
+	UndoLogNumber base_high_logno;
 	char		path[MAXPGPATH];
+	size_t		size;
 	int			logno;
 	int			fd;
+	int			i;
 	pg_crc32c	crc;
 	pg_crc32c	new_crc;
 
@@ -1399,33 +2158,75 @@ StartupUndoLogs(XLogRecPtr checkPointRedo)
 		return;
 
 	/* Open the pg_undo file corresponding to the given checkpoint. */
+	pgstat_report_wait_start(WAIT_EVENT_UNDO_CHECKPOINT_READ);
+	if (!read_undo_checkpoint_header(checkPointRedo, &header, &fd))
+		elog(ERROR, "cannot open undo checkpoint snapshot \"pg_undo/%016"
+			 INT64_MODIFIER "X\": %m", checkPointRedo);
 	snprintf(path, MAXPGPATH, "pg_undo/%016" INT64_MODIFIER "X",
 			 checkPointRedo);
-	pgstat_report_wait_start(WAIT_EVENT_UNDO_CHECKPOINT_READ);
+
+	/* Read the meta data of the logs that changed since the base file. */
+	size = sizeof(UndoCheckPointEntry) * header.nentries;
+	entries = palloc(Max(size, 1));
+	if (read(fd, entries, size) != size ||
+		read(fd, &crc, sizeof(crc)) != sizeof(crc))
+		elog(ERROR, "corrupted pg_undo meta data in file \"%s\": %m", path);
+	INIT_CRC32C(new_crc);
+	COMP_CRC32C(new_crc, entries, size);
+	FIN_CRC32C(new_crc);
+	if (crc != new_crc)
+		elog(ERROR,
+			 "pg_undo file \"%s\" has incorrect checksum", path);
+	CloseTransientFile(fd);
+
+	/* Now read the whole base file. */
+	snprintf(path, MAXPGPATH, "pg_undo/%016" INT64_MODIFIER "X%s",
+			 header.base_redo, UNDO_BASE_SUFFIX);
 	fd = OpenTransientFile(path, O_RDONLY | PG_BINARY);
 	if (fd < 0)
 		elog(ERROR, "cannot open undo checkpoint snapshot \"%s\": %m", path);
 
-	/* Read the active log number range. */
-	if ((read(fd, &shared->low_logno, sizeof(shared->low_logno))
-		 != sizeof(shared->low_logno)) ||
-		(read(fd, &shared->high_logno, sizeof(shared->high_logno))
-		 != sizeof(shared->high_logno)) ||
+	/* Read the log number range it covers. */
+	if ((read(fd, &base_low_logno, sizeof(base_low_logno))
+		 != sizeof(base_low_logno)) ||
+		(read(fd, &base_high_logno, sizeof(base_high_logno))
+		 != sizeof(base_high_logno)) ||
 		(read(fd, &crc, sizeof(crc)) != sizeof(crc)))
 		elog(ERROR, "pg_undo file \"%s\" is corrupted", path);
 
 	/* Verify the header checksum. */
 	INIT_CRC32C(new_crc);
-	COMP_CRC32C(new_crc, &shared->low_logno, sizeof(shared->low_logno));
-	COMP_CRC32C(new_crc, &shared->high_logno, sizeof(shared->high_logno));
+	COMP_CRC32C(new_crc, &base_low_logno, sizeof(base_low_logno));
+	COMP_CRC32C(new_crc, &base_high_logno, sizeof(base_high_logno));
 	FIN_CRC32C(new_crc);
 
-	if (crc != new_crc)
+	if (crc != new_crc || base_high_logno < base_low_logno)
 		elog(ERROR,
 			 "pg_undo file \"%s\" has incorrect checksum", path);
 
-	/* Initialize all the logs and set up the freelist. */
+	/* The meta data is a flat array, which we read in one go. */
+	size = sizeof(UndoLogMetaData) * (base_high_logno - base_low_logno);
+	base = palloc(Max(size, 1));
+	if (read(fd, base, size) != size)
+		elog(ERROR, "corrupted pg_undo meta data in file \"%s\": %m",
+			 path);
+
+	/* Verify body checksum. */
 	INIT_CRC32C(new_crc);
+	COMP_CRC32C(new_crc, base, size);
+	FIN_CRC32C(new_crc);
+	if (read(fd, &crc, sizeof(crc)) != sizeof(crc))
+		elog(ERROR, "pg_undo file \"%s\" is corrupted", path);
+	if (crc != new_crc)
+		elog(ERROR,
+			 "pg_undo file \"%s\" has incorrect checksum", path);
+
+	CloseTransientFile(fd);
+	pgstat_report_wait_end();
+
+	/* Initialize all the logs from the base file. */
+	shared->low_logno = header.low_logno;
+	shared->high_logno = header.high_logno;
 	for (logno = shared->low_logno; logno < shared->high_logno; ++logno)
 	{
 		UndoLogControl *log;
@@ -1434,11 +2235,32 @@ StartupUndoLogs(XLogRecPtr checkPointRedo)
 		ensure_undo_log_number(logno);
 		log = get_undo_log_by_number(logno);
 
-		/* Read in the meta data for this undo log. */
-		if (read(fd, &log->meta, sizeof(log->meta)) != sizeof(log->meta))
-			elog(ERROR, "corrupted pg_undo meta data in file \"%s\": %m",
-				 path);
-		COMP_CRC32C(new_crc, &log->meta, sizeof(log->meta));
+		if (logno >= base_low_logno && logno < base_high_logno)
+			memcpy(&log->meta, &base[logno - base_low_logno],
+				   sizeof(log->meta));
+	}
+
+	/* Apply the changes since. */
+	for (i = 0; i < header.nentries; i++)
+	{
+		UndoLogControl *log;
+
+		logno = entries[i].logno;
+		if (logno < shared->low_logno || logno >= shared->high_logno)
+			elog(ERROR, "pg_undo file \"pg_undo/%016" INT64_MODIFIER
+				 "X\" is corrupted", checkPointRedo);
+
+		log = get_undo_log_by_number(logno);
+		memcpy(&log->meta, &entries[i].meta, sizeof(log->meta));
+	}
+
+	pfree(base);
+	pfree(entries);
+
+	/* Set up the freelist. */
+	for (logno = shared->low_logno; logno < shared->high_logno; ++logno)
+	{
+		UndoLogControl *log = get_undo_log_by_number(logno);
 
 		/*
 		 * At normal start-up, or during recovery, all active undo logs start
@@ -1452,17 +2274,10 @@ StartupUndoLogs(XLogRecPtr checkPointRedo)
 			shared->free_lists[log->meta.persistence] = logno;
 		}
 	}
-	FIN_CRC32C(new_crc);
-
-	/* Verify body checksum. */
-	if (read(fd, &crc, sizeof(crc)) != sizeof(crc))
-		elog(ERROR, "pg_undo file \"%s\" is corrupted", path);
-	if (crc != new_crc)
-		elog(ERROR,
-			 "pg_undo file \"%s\" has incorrect checksum", path);
 
-	CloseTransientFile(fd);
-	pgstat_report_wait_end();
+	/* Find out how many recycled segments we have from before. */
+	pg_atomic_write_u32(&shared->pooled_segments,
+						count_all_pooled_undo_segments());
 }
 
 /*
@@ -1583,11 +2398,9 @@ static void
 initialize_undo_log_bank(int bankno, UndoLogControl *bank)
 {
 	int			i;
-	int			logs_per_bank = 1 << (UndoLogNumberBits - UndoLogBankBits);
-
-	for (i = 0; i < logs_per_bank; ++i)
+	for (i = 0; i < UndoLogsPerBank; ++i)
 	{
-		bank[i].logno = logs_per_bank * bankno + i;
+		bank[i].logno = UndoLogsPerBank * bankno + i;
 		LWLockInitialize(&bank[i].mutex, LWTRANCHE_UNDOLOG);
 		LWLockInitialize(&bank[i].discard_lock, LWTRANCHE_UNDODISCARD);
 		LWLockInitialize(&bank[i].discard_update_lock, LWTRANCHE_DISCARD_UPDATE);
@@ -1611,7 +2424,7 @@ ensure_undo_log_number(UndoLogNumber logno)
 		{
 			size_t		size;
 
-			size = sizeof(UndoLogControl) * (1 << UndoLogBankBits);
+			size = sizeof(UndoLogControl) * UndoLogsPerBank;
 			MyUndoLogState.banks[bankno] =
 			MemoryContextAllocZero(TopMemoryContext, size);
 
@@ -1626,7 +2439,7 @@ ensure_undo_log_number(UndoLogNumber logno)
 		dsm_segment *segment;
 		size_t		size;
 
-		size = sizeof(UndoLogControl) * (1 << UndoLogBankBits);
+		size = sizeof(UndoLogControl) * UndoLogsPerBank;
 		segment = dsm_create(size, 0);
 		dsm_pin_mapping(segment);
 		dsm_pin_segment(segment);
@@ -1638,6 +2451,73 @@ ensure_undo_log_number(UndoLogNumber logno)
 	}
 }
 
+/*
+ * Create a new undo log, without any segments.  The caller must hold
+ * UndoLogLock exclusively.
+ */
+static UndoLogControl *
+create_undo_log(UndoPersistence persistence, Oid tablespace)
+{
+	UndoLogSharedData *shared = MyUndoLogState.shared;
+	UndoLogControl *log;
+	UndoLogNumber logno;
+
+	Assert(LWLockHeldByMeInMode(UndoLogLock, LW_EXCLUSIVE));
+
+	if (shared->high_logno > (1 << UndoLogNumberBits))
+	{
+		/*
+		 * You've used up all 16 exabytes of undo log addressing space. This
+		 * is a difficult state to reach using only 16 exabytes of WAL.
+		 */
+		elog(ERROR, "cannot create new undo log");
+	}
+
+	logno = shared->high_logno;
+	ensure_undo_log_number(logno);
+
+	/* Get new zero-filled UndoLogControl object. */
+	log = get_undo_log_by_number(logno);
+
+	Assert(log->meta.persistence == 0);
+	Assert(log->meta.tablespace == InvalidOid);
+	Assert(log->meta.discard == 0);
+	Assert(log->meta.insert == 0);
+	Assert(log->meta.end == 0);
+	Assert(log->pid == 0);
+	Assert(log->xid == 0);
+
+	/*
+	 * The insert and discard pointers start after the first block's header.
+	 * XXX That means that insert is > end for a short time in a newly
+	 * created undo log.  Is there any problem with that?
+	 */
+	log->meta.insert = UndoLogBlockHeaderSize;
+	log->meta.discard = UndoLogBlockHeaderSize;
+
+	log->meta.tablespace = tablespace;
+	log->meta.persistence = persistence;
+	log->meta.status = UNDO_LOG_STATUS_ACTIVE;
+
+	/* Move the high log number pointer past this one. */
+	++shared->high_logno;
+
+	/* WAL-log the creation of this new undo log. */
+	{
+		xl_undolog_create xlrec;
+
+		xlrec.logno = logno;
+		xlrec.tablespace = log->meta.tablespace;
+		xlrec.persistence = log->meta.persistence;
+
+		XLogBeginInsert();
+		XLogRegisterData((char *) &xlrec, sizeof(xlrec));
+		XLogInsert(RM_UNDOLOG_ID, XLOG_UNDOLOG_CREATE);
+	}
+
+	return log;
+}
+
 /*
  * Attach to an undo log, possibly creating or recycling one.
  */
@@ -1646,7 +2526,6 @@ attach_undo_log(UndoPersistence persistence, Oid tablespace)
 {
 	UndoLogSharedData *shared = MyUndoLogState.shared;
 	UndoLogControl *log = NULL;
-	UndoLogNumber logno;
 	UndoLogNumber *place;
 
 	Assert(!InRecovery);
@@ -1672,7 +2551,6 @@ attach_undo_log(UndoPersistence persistence, Oid tablespace)
 			elog(ERROR, "corrupted undo log freelist");
 		if (candidate->meta.tablespace == tablespace)
 		{
-			logno = *place;
 			log = candidate;
 			*place = candidate->next_free;
 			break;
@@ -1682,67 +2560,11 @@ attach_undo_log(UndoPersistence persistence, Oid tablespace)
 
 	/*
 	 * All existing undo logs for this tablespace and persistence level are
-	 * busy, so we'll have to create a new one.
+	 * busy, so we'll have to create a new one.  It has no segments;
+	 * UndoLogAllocate will create the first one on demand.
 	 */
 	if (log == NULL)
-	{
-		if (shared->high_logno > (1 << UndoLogNumberBits))
-		{
-			/*
-			 * You've used up all 16 exabytes of undo log addressing space.
-			 * This is a difficult state to reach using only 16 exabytes of
-			 * WAL.
-			 */
-			elog(ERROR, "cannot create new undo log");
-		}
-
-		logno = shared->high_logno;
-		ensure_undo_log_number(logno);
-
-		/* Get new zero-filled UndoLogControl object. */
-		log = get_undo_log_by_number(logno);
-
-		Assert(log->meta.persistence == 0);
-		Assert(log->meta.tablespace == InvalidOid);
-		Assert(log->meta.discard == 0);
-		Assert(log->meta.insert == 0);
-		Assert(log->meta.end == 0);
-		Assert(log->pid == 0);
-		Assert(log->xid == 0);
-
-		/*
-		 * The insert and discard pointers start after the first block's
-		 * header.  XXX That means that insert is > end for a short time in a
-		 * newly created undo log.  Is there any problem with that?
-		 */
-		log->meta.insert = UndoLogBlockHeaderSize;
-		log->meta.discard = UndoLogBlockHeaderSize;
-
-		log->meta.tablespace = tablespace;
-		log->meta.persistence = persistence;
-		log->meta.status = UNDO_LOG_STATUS_ACTIVE;
-
-		/* Move the high log number pointer past this one. */
-		++shared->high_logno;
-
-		/* WAL-log the creation of this new undo log. */
-		{
-			xl_undolog_create xlrec;
-
-			xlrec.logno = logno;
-			xlrec.tablespace = log->meta.tablespace;
-			xlrec.persistence = log->meta.persistence;
-
-			XLogBeginInsert();
-			XLogRegisterData((char *) &xlrec, sizeof(xlrec));
-			XLogInsert(RM_UNDOLOG_ID, XLOG_UNDOLOG_CREATE);
-		}
-
-		/*
-		 * This undo log has no segments.  UndoLogAllocate will create the
-		 * first one on demand.
-		 */
-	}
+		log = create_undo_log(persistence, tablespace);
 	LWLockRelease(UndoLogLock);
 
 	LWLockAcquire(&log->mutex, LW_EXCLUSIVE);
@@ -1755,41 +2577,98 @@ attach_undo_log(UndoPersistence persistence, Oid tablespace)
 }
 
 /*
- * Free chunks of the xid/undo log map that relate to transactions that are no
- * longer running.  This is run at each checkpoint.
+ * Look up the undo log that a xid is using, during recovery.
+ */
+static UndoLogNumber
+undolog_xid_map_lookup(TransactionId xid)
+{
+	UndoLogNumber logno = InvalidUndoLogNumber;
+
+	if (MyUndoLogState.xid_map == NULL)
+		elog(ERROR, "xid to undo log number map not initialized");
+
+	if ((uint32) (xid - MyUndoLogState.xid_map_oldest) <
+		(uint32) (MyUndoLogState.xid_map_next - MyUndoLogState.xid_map_oldest))
+		logno = MyUndoLogState.xid_map[xid & (MyUndoLogState.xid_map_size - 1)];
+
+	if (logno == InvalidUndoLogNumber)
+		elog(ERROR, "cannot find undo log number for xid %u", xid);
+
+	return logno;
+}
+
+/*
+ * Forget the xid/undo log mappings of transactions that are no longer
+ * running.  This is run at each checkpoint, and by undolog_xid_map_add
+ * before it grows the map.
  */
 static void
 undolog_xid_map_gc(void)
 {
-	UndoLogNumber **xid_map = MyUndoLogState.xid_map;
 	TransactionId oldest_xid;
-	uint16		new_oldest_chunk;
-	uint16		oldest_chunk;
+	uint32		span;
+	uint32		advance;
+	uint32		i;
 
-	if (xid_map == NULL)
+	if (MyUndoLogState.xid_map == NULL)
 		return;
 
 	/*
 	 * During crash recovery, it may not be possible to call GetOldestXmin()
-	 * yet because latestCompletedXid is invalid.
+	 * yet because latestCompletedXid is invalid.  A standby only knows which
+	 * transactions are running once it has a snapshot.
 	 */
 	if (!TransactionIdIsNormal(ShmemVariableCache->latestCompletedXid))
 		return;
+	if (InRecovery && standbyState != STANDBY_SNAPSHOT_READY)
+		return;
 
 	oldest_xid = GetOldestXmin(NULL, PROCARRAY_FLAGS_DEFAULT);
-	new_oldest_chunk = UndoLogGetXidHigh(oldest_xid);
-	oldest_chunk = MyUndoLogState.xid_map_oldest_chunk;
+	span = MyUndoLogState.xid_map_next - MyUndoLogState.xid_map_oldest;
+	advance = oldest_xid - MyUndoLogState.xid_map_oldest;
 
-	while (oldest_chunk != new_oldest_chunk)
-	{
-		if (xid_map[oldest_chunk])
-		{
-			pfree(xid_map[oldest_chunk]);
-			xid_map[oldest_chunk] = NULL;
-		}
-		oldest_chunk = (oldest_chunk + 1) % (1 << UndoLogXidHighBits);
-	}
-	MyUndoLogState.xid_map_oldest_chunk = new_oldest_chunk;
+	/* Nothing to do if the oldest xid we have is still running. */
+	if (advance == 0 || advance > PG_INT32_MAX)
+		return;
+
+	for (i = 0; i < Min(advance, span); i++)
+		MyUndoLogState.xid_map[(MyUndoLogState.xid_map_oldest + i) &
+							   (MyUndoLogState.xid_map_size - 1)] =
+			InvalidUndoLogNumber;
+
+	MyUndoLogState.xid_map_oldest = oldest_xid;
+	if (advance > span)
+		MyUndoLogState.xid_map_next = oldest_xid;
+}
+
+/*
+ * Grow the xid/undo log map so that it can hold a range of 'span' xids.
+ */
+static void
+undolog_xid_map_grow(uint32 span)
+{
+	UndoLogNumber *xid_map;
+	uint32		size = MyUndoLogState.xid_map_size;
+	uint32		i;
+	TransactionId xid;
+
+	while (size < span)
+		size *= 2;
+
+	xid_map = MemoryContextAllocHuge(TopMemoryContext,
+									 sizeof(UndoLogNumber) * size);
+	for (i = 0; i < size; i++)
+		xid_map[i] = InvalidUndoLogNumber;
+
+	for (xid = MyUndoLogState.xid_map_oldest;
+		 xid != MyUndoLogState.xid_map_next;
+		 xid++)
+		xid_map[xid & (size - 1)] =
+			MyUndoLogState.xid_map[xid & (MyUndoLogState.xid_map_size - 1)];
+
+	pfree(MyUndoLogState.xid_map);
+	MyUndoLogState.xid_map = xid_map;
+	MyUndoLogState.xid_map_size = size;
 }
 
 /*
@@ -1835,33 +2714,56 @@ undolog_bank_gc(void)
 static void
 undolog_xid_map_add(TransactionId xid, UndoLogNumber logno)
 {
-	uint16		high_bits;
-	uint16		low_bits;
-
-	high_bits = UndoLogGetXidHigh(xid);
-	low_bits = UndoLogGetXidLow(xid);
+	uint32		offset;
 
 	if (unlikely(MyUndoLogState.xid_map == NULL))
 	{
+		uint32		i;
+
 		/* First time through.  Create mapping array. */
 		MyUndoLogState.xid_map =
-		MemoryContextAllocZero(TopMemoryContext,
-							   sizeof(UndoLogNumber *) *
-							   (1 << (32 - UndoLogXidLowBits)));
-		MyUndoLogState.xid_map_oldest_chunk = high_bits;
+			MemoryContextAlloc(TopMemoryContext,
+							   sizeof(UndoLogNumber) * UndoLogXidMapInitialSize);
+		for (i = 0; i < UndoLogXidMapInitialSize; i++)
+			MyUndoLogState.xid_map[i] = InvalidUndoLogNumber;
+		MyUndoLogState.xid_map_size = UndoLogXidMapInitialSize;
+		MyUndoLogState.xid_map_oldest = xid;
+		MyUndoLogState.xid_map_next = xid;
 	}
 
-	if (unlikely(MyUndoLogState.xid_map[high_bits] == NULL))
+	/* Before growing the map, see if old entries can be forgotten. */
+	offset = xid - MyUndoLogState.xid_map_oldest;
+	if (offset <= PG_INT32_MAX && offset >= MyUndoLogState.xid_map_size)
 	{
-		/* This bank of mappings doesn't exist yet.  Create it. */
-		MyUndoLogState.xid_map[high_bits] =
-		MemoryContextAllocZero(TopMemoryContext,
-							   sizeof(UndoLogNumber) *
-							   (1 << UndoLogXidLowBits));
+		undolog_xid_map_gc();
+		offset = xid - MyUndoLogState.xid_map_oldest;
+	}
+
+	if (offset <= PG_INT32_MAX)
+	{
+		/* At or after the oldest xid; extend the range forwards if needed. */
+		if (offset >= MyUndoLogState.xid_map_next - MyUndoLogState.xid_map_oldest)
+		{
+			if (offset >= MyUndoLogState.xid_map_size)
+				undolog_xid_map_grow(offset + 1);
+			MyUndoLogState.xid_map_next = xid + 1;
+		}
+	}
+	else
+	{
+		/*
+		 * Xids can attach to undo logs a little out of order, so this may be
+		 * older than any xid we have seen.  Extend the range backwards.
+		 */
+		uint32		span = MyUndoLogState.xid_map_next - xid;
+
+		if (span > MyUndoLogState.xid_map_size)
+			undolog_xid_map_grow(span);
+		MyUndoLogState.xid_map_oldest = xid;
 	}
 
 	/* Associate this xid with this undo log number. */
-	MyUndoLogState.xid_map[high_bits][low_bits] = logno;
+	MyUndoLogState.xid_map[xid & (MyUndoLogState.xid_map_size - 1)] = logno;
 }
 
 /* check_hook: validate new undo_tablespaces */
@@ -1918,6 +2820,128 @@ assign_undo_tablespaces(const char *newval, void *extra)
 	MyUndoLogState.need_to_choose_tablespace = true;
 }
 
+/*
+ * Find the load slot of a tablespace, claiming a free one if create is true.
+ * Returns NULL if the tablespace has no slot and none could be claimed.
+ */
+static UndoTablespaceLoad *
+get_undo_tablespace_load(Oid tablespace, bool create)
+{
+	UndoLogSharedData *shared = MyUndoLogState.shared;
+	int			i;
+
+	for (i = 0; i < UndoTablespaceLoadSlots; ++i)
+	{
+		UndoTablespaceLoad *load = &shared->tablespace_load[i];
+		uint32		oid = pg_atomic_read_u32(&load->tablespace);
+
+		if (oid == InvalidOid)
+		{
+			if (!create)
+				return NULL;
+			/* Claim it, unless someone else just did. */
+			if (pg_atomic_compare_exchange_u32(&load->tablespace, &oid,
+											   tablespace))
+				return load;
+		}
+		if (oid == tablespace)
+			return load;
+	}
+
+	return NULL;
+}
+
+/*
+ * Return the moving average of the write latency of a tablespace's undo
+ * files, in microseconds, or zero if it's not known.
+ */
+static uint32
+get_undo_tablespace_latency(Oid tablespace)
+{
+	UndoTablespaceLoad *load = get_undo_tablespace_load(tablespace, false);
+
+	if (load == NULL)
+		return 0;
+
+	return pg_atomic_read_u32(&load->write_latency) >> UndoWriteLatencyShift;
+}
+
+/*
+ * Account for a write of an undo block to a tablespace that took elapsed_us
+ * microseconds.  Called by undofile.c.
+ */
+void
+UndoLogReportWrite(Oid tablespace, uint64 elapsed_us)
+{
+	UndoTablespaceLoad *load = get_undo_tablespace_load(tablespace, true);
+	uint32		latency;
+
+	if (load == NULL)
+		return;
+
+	/* Clamp outliers, so that one stall doesn't dominate for long. */
+	elapsed_us = Min(elapsed_us, PG_INT32_MAX >> UndoWriteLatencyShift);
+
+	latency = pg_atomic_read_u32(&load->write_latency);
+	latency = latency - (latency >> UndoWriteLatencyShift) + elapsed_us;
+	pg_atomic_write_u32(&load->write_latency, latency);
+}
+
+/*
+ * Pick one of the given tablespaces at random, with odds inversely
+ * proportional to their observed write latency, so that the undo logs of
+ * backends sharing a multi-tablespace setting are striped over them in a way
+ * that keeps the slower devices from becoming the bottleneck.  Tablespaces
+ * without any observed writes have the best odds, so that they get tried.
+ */
+static Oid
+choose_undo_tablespace_by_load(Oid *tablespaces, int ntablespaces)
+{
+	double		weights[UndoTablespaceLoadSlots];
+	double		total = 0;
+	double		r;
+	int			i;
+
+	Assert(ntablespaces > 0);
+
+	if (ntablespaces == 1)
+		return tablespaces[0];
+
+	for (i = 0; i < ntablespaces; ++i)
+	{
+		weights[i] = 1.0 / (1.0 + get_undo_tablespace_latency(tablespaces[i]));
+		total += weights[i];
+	}
+
+	r = total * ((double) random() / ((double) MAX_RANDOM_VALUE + 1));
+	for (i = 0; i < ntablespaces - 1; ++i)
+	{
+		if (r < weights[i])
+			break;
+		r -= weights[i];
+	}
+
+	return tablespaces[i];
+}
+
+/*
+ * Is the given tablespace so much slower to write to than the fastest of
+ * undo_tablespaces that we'd better move away from it?
+ */
+static bool
+undo_tablespace_overloaded(Oid tablespace)
+{
+	uint32		latency = get_undo_tablespace_latency(tablespace);
+	uint32		best = latency;
+	int			i;
+
+	for (i = 0; i < MyUndoLogState.ntablespaces; ++i)
+		best = Min(best, get_undo_tablespace_latency(MyUndoLogState.tablespaces[i]));
+
+	return latency > best * UndoRebalanceRatio &&
+		latency - best >= UndoRebalanceMinLatency;
+}
+
 static bool
 choose_undo_tablespace(bool force_detach, Oid *tablespace)
 {
@@ -1943,59 +2967,55 @@ choose_undo_tablespace(bool force_detach, Oid *tablespace)
 		 * locking is required because it can't be dropped.
 		 */
 		*tablespace = DEFAULTTABLESPACE_OID;
+		MyUndoLogState.ntablespaces = 0;
 		need_to_unlock = false;
 	}
 	else
 	{
-		/*
-		 * Choose an OID using our pid, so that if several backends have the
-		 * same multi-tablespace setting they'll spread out.  We could easily
-		 * do better than this if more serious load balancing is judged
-		 * useful.
-		 */
-		int			index = MyProcPid % length;
-		int			first_index = index;
-		Oid			oid = InvalidOid;
+		ListCell   *lc;
+		const char *name = NULL;
+		int			ntablespaces = 0;
 
 		/*
-		 * Take the tablespace create/drop lock while we look the name up.
+		 * Take the tablespace create/drop lock while we look the names up.
 		 * This prevents the tablespace from being dropped while we're trying
 		 * to resolve the name, or while the called is trying to create an
 		 * undo log in it.  The caller will have to release this lock.
 		 */
 		LWLockAcquire(TablespaceCreateLock, LW_EXCLUSIVE);
-		for (;;)
+		foreach(lc, namelist)
 		{
-			const char *name = list_nth(namelist, index);
+			Oid			oid;
 
+			name = lfirst(lc);
+
+			/* Unknown tablespaces are skipped. */
 			oid = get_tablespace_oid(name, true);
 			if (oid == InvalidOid)
-			{
-				/* Unknown tablespace, try the next one. */
-				index = (index + 1) % length;
-
-				/*
-				 * But if we've tried them all, it's time to complain.  We'll
-				 * arbitrarily complain about the last one we tried in the
-				 * error message.
-				 */
-				if (index == first_index)
-					ereport(ERROR,
-							(errcode(ERRCODE_UNDEFINED_OBJECT),
-							 errmsg("tablespace \"%s\" does not exist", name),
-							 errhint("Create the tablespace or set undo_tablespaces to a valid or empty list.")));
 				continue;
-			}
 			if (oid == GLOBALTABLESPACE_OID)
 				ereport(ERROR,
 						(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
 						 errmsg("undo logs cannot be placed in pg_global tablespace")));
-			/* If we got here we succeeded in finding one. */
-			break;
+			if (ntablespaces < UndoTablespaceLoadSlots)
+				MyUndoLogState.tablespaces[ntablespaces++] = oid;
 		}
 
-		Assert(oid != InvalidOid);
-		*tablespace = oid;
+		/*
+		 * If none of them exists, it's time to complain.  We'll arbitrarily
+		 * complain about the last one in the error message.
+		 */
+		if (ntablespaces == 0)
+			ereport(ERROR,
+					(errcode(ERRCODE_UNDEFINED_OBJECT),
+					 errmsg("tablespace \"%s\" does not exist", name),
+					 errhint("Create the tablespace or set undo_tablespaces to a valid or empty list.")));
+
+		MyUndoLogState.ntablespaces = ntablespaces;
+		MyUndoLogState.rebalance_countdown = UndoRebalanceInterval;
+
+		*tablespace = choose_undo_tablespace_by_load(MyUndoLogState.tablespaces,
+													 ntablespaces);
 		need_to_unlock = true;
 	}
 
@@ -2264,7 +3284,7 @@ ResetUndoLogs(UndoPersistence persistence)
 Datum
 pg_stat_get_undo_logs(PG_FUNCTION_ARGS)
 {
-#define PG_STAT_GET_UNDO_LOGS_COLS 9
+#define PG_STAT_GET_UNDO_LOGS_COLS 15
 	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
 	TupleDesc	tupdesc;
 	Tuplestorestate *tupstore;
@@ -2276,6 +3296,7 @@ pg_stat_get_undo_logs(PG_FUNCTION_ARGS)
 	UndoLogSharedData *shared = MyUndoLogState.shared;
 	char	   *tablespace_name = NULL;
 	Oid			last_tablespace = InvalidOid;
+	TimestampTz now = GetCurrentTimestamp();
 
 	/* check to see if caller supports us returning a tuplestore */
 	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
@@ -2316,6 +3337,10 @@ pg_stat_get_undo_logs(PG_FUNCTION_ARGS)
 		Datum		values[PG_STAT_GET_UNDO_LOGS_COLS];
 		bool		nulls[PG_STAT_GET_UNDO_LOGS_COLS] = {false};
 		Oid			tablespace;
+		TimestampTz oldest_start_time = 0;
+		TransactionId oldest_xid;
+		int			oldest_xid_pid = 0;
+		int			i;
 
 		if (log == NULL)
 			continue;
@@ -2357,8 +3382,74 @@ pg_stat_get_undo_logs(PG_FUNCTION_ARGS)
 			nulls[7] = true;
 		else
 			values[7] = Int32GetDatum((int64) log->pid);
+
+		/*
+		 * The discard lag.  Its age is that of the oldest transaction whose
+		 * start we remember and whose undo hasn't been discarded; if older
+		 * ones were forgotten, the real age can only be larger.
+		 */
+		values[8] = Int64GetDatum(log->meta.insert - log->meta.discard);
+		if (log->meta.discard < log->meta.insert)
+		{
+			for (i = 0; i < log->xact_starts_count; i++)
+			{
+				UndoLogXactStart *entry;
+
+				entry = &log->xact_starts[(log->xact_starts_first + i) %
+										  UNDO_LOG_XACT_STARTS];
+				if (entry->start >= log->meta.discard)
+				{
+					oldest_start_time = entry->start_time;
+					break;
+				}
+			}
+		}
+		if (oldest_start_time == 0)
+			nulls[9] = true;
+		else
+		{
+			Interval   *lag = palloc(sizeof(Interval));
+
+			lag->month = 0;
+			lag->day = 0;
+			lag->time = Max(now - oldest_start_time, 0);
+			values[9] = IntervalPGetDatum(lag);
+		}
+
+		/*
+		 * The write rate is sampled by UndoLogAllocate at the start of
+		 * transactions.  If it hasn't done so lately, the log has been idle
+		 * or written by a single long transaction, so work it out over the
+		 * time since.
+		 */
+		if (log->rate_time == 0)
+			nulls[10] = true;
+		else if (now - log->rate_time >= UndoWriteRateInterval)
+			values[10] = Float8GetDatum((double) (log->meta.insert -
+												  log->rate_insert) *
+										USECS_PER_SEC /
+										(now - log->rate_time));
+		else
+			values[10] = Float8GetDatum(log->write_rate);
+
+		oldest_xid = log->oldest_xid;
+		values[13] = Int64GetDatum((int64) log->segments_created);
+		values[14] = Int64GetDatum((int64) log->segments_recycled);
 		LWLockRelease(&log->mutex);
 
+		/* Who holds back the discard of this log, if anyone. */
+		if (TransactionIdIsValid(oldest_xid))
+		{
+			values[11] = TransactionIdGetDatum(oldest_xid);
+			oldest_xid_pid = BackendXidGetPid(oldest_xid);
+		}
+		else
+			nulls[11] = true;
+		if (oldest_xid_pid == 0)
+			nulls[12] = true;
+		else
+			values[12] = Int32GetDatum(oldest_xid_pid);
+
 		/*
 		 * Deal with potentially slow tablespace name lookup without the lock.
 		 * Avoid making multiple calls to that expensive function for the
@@ -2597,7 +3688,8 @@ undolog_xlog_discard(XLogReaderState *record)
 					 discard_path, recycle_path);
 			}
 		}
-		else
+		else if (!put_undo_segment_in_pool(discard_path,
+										   log->meta.tablespace))
 		{
 			if (unlink(discard_path) == 0)
 				elog(LOG, "unlinked undo segment \"%s\"", discard_path);	/* XXX: remove me */
@@ -2610,7 +3702,8 @@ undolog_xlog_discard(XLogReaderState *record)
 	/* Create any further new segments that are needed the slow way. */
 	while (end < xlrec->end)
 	{
-		allocate_empty_undo_segment(xlrec->logno, log->meta.tablespace, end);
+		allocate_empty_undo_segment(xlrec->logno, log->meta.tablespace, end,
+									log->meta.persistence);
 		end += UndoLogSegmentSize;
 	}
 
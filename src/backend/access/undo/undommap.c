@@ -0,0 +1,176 @@
+/*-------------------------------------------------------------------------
+ *
+ * undommap.c
+ *	  read undo records through memory mappings of the undo segment files
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * src/backend/access/undo/undommap.c
+ *
+ * NOTES:
+ * Long walks along undo chains, as done on read-mostly standbys, pin and lock
+ * a buffer for every undo record they read.  When undo_read_mmap is enabled,
+ * the records on undo pages that aren't in shared buffers are unpacked
+ * straight from read-only mappings of the segment files instead.  Each
+ * backend keeps the mappings of the last few segments it read from.
+ *
+ * An undo record never changes once it has been inserted, except for the
+ * fields of the transaction header that are updated later on, so the records
+ * that carry one are always read through the buffer manager.  A page that
+ * isn't in shared buffers has been written out, as a buffer is only reused
+ * after writing it, and only the buffers of discarded undo are dropped
+ * without that.  The page can be read back in and get more records appended
+ * to it while we are reading it, but that doesn't touch the bytes of the
+ * record we're after.  The caller must hold the discard lock of the undo log
+ * and have checked that the record isn't discarded, so that the segment can't
+ * be recycled under us.
+ *
+ * This relies on the operating system keeping the mappings of a file
+ * coherent with write() calls to it, as the systems with a unified buffer
+ * cache do.  Page checksums aren't verified on this path.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include <unistd.h>
+#include <sys/stat.h>
+#ifndef WIN32
+#include <sys/mman.h>
+#endif
+
+#include "access/undommap.h"
+#include "storage/bufmgr.h"
+#include "storage/fd.h"
+
+/* Number of segment mappings each backend keeps. */
+#define UNDO_MMAP_SEGMENTS		16
+
+typedef struct UndoMmapSegment
+{
+	UndoLogNumber logno;
+	int			segno;
+	char	   *base;			/* NULL if the entry is unused */
+} UndoMmapSegment;
+
+/* GUC: whether undo records may be read through segment mappings. */
+bool		undo_read_mmap = false;
+
+#ifndef WIN32
+static UndoMmapSegment mmap_segments[UNDO_MMAP_SEGMENTS];
+static int	mmap_next_victim = 0;
+
+/*
+ * Return a pointer to the given block of an undo log, mapping its segment if
+ * it isn't mapped yet.  Returns NULL if the segment can't be mapped.
+ */
+static char *
+UndoMmapGetBlock(UndoLogNumber logno, Oid tablespace, BlockNumber blkno)
+{
+	UndoMmapSegment *seg;
+	char		path[MAXPGPATH];
+	struct stat st;
+	int			segno = blkno / UNDOSEG_SIZE;
+	char	   *base;
+	int			fd;
+	int			i;
+
+	for (i = 0; i < UNDO_MMAP_SEGMENTS; i++)
+	{
+		seg = &mmap_segments[i];
+		if (seg->base != NULL && seg->logno == logno && seg->segno == segno)
+			return seg->base + (blkno % UNDOSEG_SIZE) * BLCKSZ;
+	}
+
+	UndoLogSegmentPath(logno, segno, tablespace, path);
+	fd = OpenTransientFile(path, O_RDONLY | PG_BINARY);
+	if (fd < 0)
+		return NULL;
+
+	/* Touching a mapping beyond the end of the file would raise SIGBUS. */
+	if (fstat(fd, &st) < 0 || st.st_size < UndoLogSegmentSize)
+	{
+		CloseTransientFile(fd);
+		return NULL;
+	}
+
+	base = mmap(NULL, UndoLogSegmentSize, PROT_READ, MAP_SHARED, fd, 0);
+	CloseTransientFile(fd);
+	if (base == MAP_FAILED)
+		return NULL;
+
+	seg = &mmap_segments[mmap_next_victim];
+	mmap_next_victim = (mmap_next_victim + 1) % UNDO_MMAP_SEGMENTS;
+	if (seg->base != NULL)
+		munmap(seg->base, UndoLogSegmentSize);
+	seg->logno = logno;
+	seg->segno = segno;
+	seg->base = base;
+
+	return base + (blkno % UNDOSEG_SIZE) * BLCKSZ;
+}
+#endif							/* WIN32 */
+
+/*
+ * Unpack the undo record at urp from the mapping of its segment, like
+ * UndoGetOneRecord would from shared buffers.  The payload and tuple data are
+ * copied, and urec->uur_buffer is left invalid.
+ *
+ * Returns false, leaving urec as it was, if the record has to be read through
+ * the buffer manager, see the notes atop this file.
+ */
+bool
+UndoMmapGetOneRecord(UnpackedUndoRecord *urec, UndoRecPtr urp,
+					 RelFileNode rnode, UndoPersistence persistence)
+{
+#ifndef WIN32
+	BlockNumber blkno = UndoRecPtrGetBlockNum(urp);
+	int			starting_byte = UndoRecPtrGetPageOffset(urp);
+	int			already_decoded = 0;
+
+	/* Temporary undo lives in local buffers that are never written out. */
+	if (!undo_read_mmap || persistence == UNDO_TEMP)
+		return false;
+
+	Assert(!BufferIsValid(urec->uur_buffer));
+	Assert(urec->uur_payload.data == NULL && urec->uur_tuple.data == NULL);
+
+	for (;;)
+	{
+		char	   *page;
+
+		if (BufferBlockIsResident(rnode, UndoLogForkNum, blkno))
+			break;
+
+		page = UndoMmapGetBlock(rnode.relNode, rnode.spcNode, blkno);
+		if (page == NULL)
+			break;
+
+		if (UnpackUndoRecord(urec, (Page) page, starting_byte,
+							 &already_decoded, false, true))
+		{
+			if ((urec->uur_info & UREC_INFO_TRANSACTION) == 0)
+				return true;
+			break;
+		}
+
+		/* An undo record can be spread to two blocks max. */
+		Assert(blkno == UndoRecPtrGetBlockNum(urp));
+
+		starting_byte = UndoLogBlockHeaderSize;
+		blkno++;
+	}
+
+	/* Whatever has been unpacked will be read again. */
+	if (urec->uur_payload.data != NULL)
+		pfree(urec->uur_payload.data);
+	if (urec->uur_tuple.data != NULL)
+		pfree(urec->uur_tuple.data);
+	urec->uur_payload.data = NULL;
+	urec->uur_tuple.data = NULL;
+#endif							/* WIN32 */
+
+	return false;
+}
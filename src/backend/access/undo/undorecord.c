@@ -15,7 +15,9 @@
 #include "access/subtrans.h"
 #include "access/undorecord.h"
 #include "catalog/pg_tablespace.h"
+#include "common/pg_lzcompress.h"
 #include "storage/block.h"
+#include "storage/bufmgr.h"
 
 /* Workspace for InsertUndoRecord and UnpackUndoRecord. */
 static UndoRecordHeader work_hdr;
@@ -23,6 +25,7 @@ static UndoRecordRelationDetails work_rd;
 static UndoRecordBlock work_blk;
 static UndoRecordTransaction work_txn;
 static UndoRecordPayload work_payload;
+static char work_packed_hdr[UNDO_PACKED_HEADER_MAX_LEN];
 
 /* Prototypes for static functions. */
 static bool InsertUndoBytes(char *sourceptr, int sourcelen,
@@ -31,6 +34,24 @@ static bool InsertUndoBytes(char *sourceptr, int sourcelen,
 static bool ReadUndoBytes(char *destptr, int readlen,
 						  char **readptr, char *endptr,
 						  int *my_bytes_read, int *total_bytes_read, bool nocopy);
+static void UndoRecordCompressTuple(UnpackedUndoRecord *uur);
+static int	UndoRecordPackHeader(UnpackedUndoRecord *uur, char *buf);
+static void UndoRecordUnpackHeader(UnpackedUndoRecord *uur, const char *buf,
+								   int len);
+
+/* Size of the fields of the header following its prefix, unless packed. */
+#define SizeOfUndoRecordHeaderFields \
+	(SizeOfUndoRecordHeader - SizeOfUndoRecordHeaderPrefix)
+
+/*
+ * The tuple bytes that are actually stored for an undo record being inserted.
+ */
+#define UndoRecordStoredTuple(uur) \
+	(((uur)->uur_info & UREC_INFO_TUPLE_COMPRESSED) != 0 ? \
+	 (uur)->uur_packed_tuple : (uur)->uur_tuple.data)
+#define UndoRecordStoredTupleLen(uur) \
+	(((uur)->uur_info & UREC_INFO_TUPLE_COMPRESSED) != 0 ? \
+	 (uur)->uur_packed_len : (uur)->uur_tuple.len)
 
 /*
  * Compute and return the expected size of an undo record.
@@ -38,9 +59,17 @@ static bool ReadUndoBytes(char *destptr, int readlen,
 Size
 UndoRecordExpectedSize(UnpackedUndoRecord *uur)
 {
+	char		packed_hdr[UNDO_PACKED_HEADER_MAX_LEN];
+	int			packed_len;
 	Size		size;
 
-	size = SizeOfUndoRecordHeader + sizeof(uint16);
+	packed_len = UndoRecordPackHeader(uur, packed_hdr);
+
+	size = SizeOfUndoRecordHeaderPrefix + sizeof(uint16);
+	if (packed_len > 0)
+		size += packed_len;
+	else
+		size += SizeOfUndoRecordHeaderFields;
 	if ((uur->uur_info & UREC_INFO_RELATION_DETAILS) != 0)
 		size += SizeOfUndoRecordRelationDetails;
 	if ((uur->uur_info & UREC_INFO_BLOCK) != 0)
@@ -51,7 +80,7 @@ UndoRecordExpectedSize(UnpackedUndoRecord *uur)
 	{
 		size += SizeOfUndoRecordPayload;
 		size += uur->uur_payload.len;
-		size += uur->uur_tuple.len;
+		size += UndoRecordStoredTupleLen(uur);
 	}
 
 	return size;
@@ -136,6 +165,7 @@ InsertUndoRecord(UnpackedUndoRecord *uur, Page page,
 		work_hdr.urec_prevxid = uur->uur_prevxid;
 		work_hdr.urec_xid = uur->uur_xid;
 		work_hdr.urec_cid = uur->uur_cid;
+		work_hdr.urec_packed_len = UndoRecordPackHeader(uur, work_packed_hdr);
 		work_rd.urec_fork = uur->uur_fork;
 		work_blk.urec_blkprev = uur->uur_blkprev;
 		work_blk.urec_block = uur->uur_block;
@@ -146,7 +176,7 @@ InsertUndoRecord(UnpackedUndoRecord *uur, Page page,
 		work_txn.urec_prevurp = uur->uur_prevurp;
 		work_txn.urec_next = uur->uur_next;
 		work_payload.urec_payload_len = uur->uur_payload.len;
-		work_payload.urec_tuple_len = uur->uur_tuple.len;
+		work_payload.urec_tuple_len = UndoRecordStoredTupleLen(uur);
 	}
 	else
 	{
@@ -171,7 +201,7 @@ InsertUndoRecord(UnpackedUndoRecord *uur, Page page,
 		Assert(work_txn.urec_prevurp == uur->uur_prevurp);
 		Assert(work_txn.urec_next == uur->uur_next);
 		Assert(work_payload.urec_payload_len == uur->uur_payload.len);
-		Assert(work_payload.urec_tuple_len == uur->uur_tuple.len);
+		Assert(work_payload.urec_tuple_len == UndoRecordStoredTupleLen(uur));
 	}
 
 	/*
@@ -188,10 +218,22 @@ InsertUndoRecord(UnpackedUndoRecord *uur, Page page,
 	}
 
 	/* Write header (if not already done). */
-	if (!InsertUndoBytes((char *) &work_hdr, SizeOfUndoRecordHeader,
+	if (!InsertUndoBytes((char *) &work_hdr, SizeOfUndoRecordHeaderPrefix,
 						 &writeptr, endptr,
 						 &my_bytes_written, already_written))
 		return false;
+	if (work_hdr.urec_packed_len > 0)
+	{
+		if (!InsertUndoBytes(work_packed_hdr, work_hdr.urec_packed_len,
+							 &writeptr, endptr,
+							 &my_bytes_written, already_written))
+			return false;
+	}
+	else if (!InsertUndoBytes((char *) &work_hdr + SizeOfUndoRecordHeaderPrefix,
+							  SizeOfUndoRecordHeaderFields,
+							  &writeptr, endptr,
+							  &my_bytes_written, already_written))
+		return false;
 
 	/* Write relation details (if needed and not already done). */
 	if ((uur->uur_info & UREC_INFO_RELATION_DETAILS) != 0 &&
@@ -234,8 +276,9 @@ InsertUndoRecord(UnpackedUndoRecord *uur, Page page,
 			return false;
 
 		/* Tuple bytes. */
-		if (uur->uur_tuple.len > 0 &&
-			!InsertUndoBytes(uur->uur_tuple.data, uur->uur_tuple.len,
+		if (work_payload.urec_tuple_len > 0 &&
+			!InsertUndoBytes(UndoRecordStoredTuple(uur),
+							 work_payload.urec_tuple_len,
 							 &writeptr, endptr,
 							 &my_bytes_written, already_written))
 			return false;
@@ -332,18 +375,38 @@ UnpackUndoRecord(UnpackedUndoRecord *uur, Page page, int starting_byte,
 	bool		is_undo_splited = (my_bytes_decoded > 0) ? true : false;
 
 	/* Decode header (if not already done). */
-	if (!ReadUndoBytes((char *) &work_hdr, SizeOfUndoRecordHeader,
+	if (!ReadUndoBytes((char *) &work_hdr, SizeOfUndoRecordHeaderPrefix,
 					   &readptr, endptr,
 					   &my_bytes_decoded, already_decoded, false))
 		return false;
+	if (work_hdr.urec_packed_len > 0)
+	{
+		if (!ReadUndoBytes(work_packed_hdr, work_hdr.urec_packed_len,
+						   &readptr, endptr,
+						   &my_bytes_decoded, already_decoded, false))
+			return false;
+
+		UndoRecordUnpackHeader(uur, work_packed_hdr, work_hdr.urec_packed_len);
+	}
+	else
+	{
+		if (!ReadUndoBytes((char *) &work_hdr + SizeOfUndoRecordHeaderPrefix,
+						   SizeOfUndoRecordHeaderFields,
+						   &readptr, endptr,
+						   &my_bytes_decoded, already_decoded, false))
+			return false;
+
+		uur->uur_reloid = work_hdr.urec_reloid;
+		uur->uur_prevxid = work_hdr.urec_prevxid;
+		uur->uur_xid = work_hdr.urec_xid;
+		uur->uur_cid = work_hdr.urec_cid;
+	}
 
 	uur->uur_rmid = work_hdr.urec_rmid;
 	uur->uur_type = work_hdr.urec_type;
 	uur->uur_info = work_hdr.urec_info;
-	uur->uur_reloid = work_hdr.urec_reloid;
-	uur->uur_prevxid = work_hdr.urec_prevxid;
-	uur->uur_xid = work_hdr.urec_xid;
-	uur->uur_cid = work_hdr.urec_cid;
+	uur->uur_packed_tuple = NULL;
+	uur->uur_packed_len = 0;
 
 	if ((uur->uur_info & UREC_INFO_RELATION_DETAILS) != 0)
 	{
@@ -496,6 +559,97 @@ ReadUndoBytes(char *destptr, int readlen, char **readptr, char *endptr,
 	return (can_read == remaining);
 }
 
+/*
+ * Encode a value in the variable-length format of the packed fields of undo
+ * record headers: 7 bits per byte, least significant first, with the high
+ * bit set in every byte but the last.  Returns the number of bytes written,
+ * at most 5.
+ */
+static inline int
+encode_varbyte(uint32 val, char *ptr)
+{
+	int			len = 0;
+
+	while (val > 0x7F)
+	{
+		ptr[len++] = (char) ((val & 0x7F) | 0x80);
+		val >>= 7;
+	}
+	ptr[len++] = (char) val;
+
+	return len;
+}
+
+/*
+ * Decode a value encoded by encode_varbyte.  Returns the number of bytes
+ * read.
+ */
+static inline int
+decode_varbyte(const char *ptr, uint32 *val)
+{
+	uint32		result = 0;
+	int			shift = 0;
+	int			len = 0;
+	uint8		c;
+
+	do
+	{
+		c = (uint8) ptr[len++];
+		result |= (uint32) (c & 0x7F) << shift;
+		shift += 7;
+	} while ((c & 0x80) != 0);
+
+	*val = result;
+
+	return len;
+}
+
+/*
+ * Pack the fields of the header of an undo record being inserted that follow
+ * its prefix into buf, which must have room for UNDO_PACKED_HEADER_MAX_LEN
+ * bytes.  Returns the number of bytes they take up, or 0 if packing them
+ * doesn't save space, in which case they are to be stored as they are.
+ *
+ * urec_prevxid is stored as its distance to urec_xid, modulo 2^32, as it's
+ * usually a recent transaction if it's valid at all.  The outcome depends on
+ * nothing but the record, as UndoRecordExpectedSize relies on.
+ */
+static int
+UndoRecordPackHeader(UnpackedUndoRecord *uur, char *buf)
+{
+	int			len = 0;
+
+	len += encode_varbyte(uur->uur_reloid, buf + len);
+	len += encode_varbyte(uur->uur_xid, buf + len);
+	len += encode_varbyte(uur->uur_xid - uur->uur_prevxid, buf + len);
+	len += encode_varbyte(uur->uur_cid, buf + len);
+	Assert(len <= UNDO_PACKED_HEADER_MAX_LEN);
+
+	return (len < SizeOfUndoRecordHeaderFields) ? len : 0;
+}
+
+/*
+ * Unpack the len bytes of the packed fields of an undo record header.
+ */
+static void
+UndoRecordUnpackHeader(UnpackedUndoRecord *uur, const char *buf, int len)
+{
+	uint32		val;
+	int			off = 0;
+
+	off += decode_varbyte(buf + off, &val);
+	uur->uur_reloid = val;
+	off += decode_varbyte(buf + off, &val);
+	uur->uur_xid = val;
+	off += decode_varbyte(buf + off, &val);
+	uur->uur_prevxid = uur->uur_xid - val;
+	off += decode_varbyte(buf + off, &val);
+	uur->uur_cid = val;
+
+	if (off != len)
+		elog(ERROR, "undo record header is corrupt");
+}
+
 /*
  * Set uur_info for an UnpackedUndoRecord appropriately based on which
  * other fields are set.
@@ -511,4 +665,98 @@ UndoRecordSetInfo(UnpackedUndoRecord *uur)
 		uur->uur_info |= UREC_INFO_TRANSACTION;
 	if (uur->uur_payload.len || uur->uur_tuple.len)
 		uur->uur_info |= UREC_INFO_PAYLOAD;
+
+	/*
+	 * Compress the tuple, unless we already did so while computing the size
+	 * of this record earlier.
+	 */
+	if ((uur->uur_info & UREC_INFO_TUPLE_COMPRESSED) == 0 ||
+		uur->uur_packed_tuple == NULL)
+	{
+		uur->uur_info &= ~UREC_INFO_TUPLE_COMPRESSED;
+		UndoRecordCompressTuple(uur);
+	}
+}
+
+/*
+ * Store a compressed copy of the tuple of an undo record being inserted in
+ * uur_packed_tuple and set UREC_INFO_TUPLE_COMPRESSED, if the tuple is large
+ * enough and compressing it saves space.  Otherwise leave the record alone.
+ *
+ * The outcome depends on nothing but the tuple bytes, which matters because
+ * recovery must allocate exactly as much undo as the original insertion did.
+ * The compressed copy is freed by InsertPreparedUndo once it is written.
+ */
+static void
+UndoRecordCompressTuple(UnpackedUndoRecord *uur)
+{
+	char	   *packed;
+	int32		rawlen;
+	int32		packed_len;
+	uint16		tuple_len;
+
+	if (uur->uur_tuple.len < UNDO_TUPLE_COMPRESS_MIN)
+		return;
+
+	rawlen = uur->uur_tuple.len - UNDO_TUPLE_RAW_PREFIX;
+	packed = palloc(UNDO_TUPLE_RAW_PREFIX + sizeof(uint16) +
+					PGLZ_MAX_OUTPUT(rawlen));
+	packed_len = pglz_compress(uur->uur_tuple.data + UNDO_TUPLE_RAW_PREFIX,
+							   rawlen,
+							   packed + UNDO_TUPLE_RAW_PREFIX + sizeof(uint16),
+							   PGLZ_strategy_default);
+	if (packed_len < 0)
+	{
+		pfree(packed);
+		return;
+	}
+
+	tuple_len = uur->uur_tuple.len;
+	memcpy(packed, uur->uur_tuple.data, UNDO_TUPLE_RAW_PREFIX);
+	memcpy(packed + UNDO_TUPLE_RAW_PREFIX, &tuple_len, sizeof(uint16));
+
+	uur->uur_packed_tuple = packed;
+	uur->uur_packed_len = UNDO_TUPLE_RAW_PREFIX + sizeof(uint16) + packed_len;
+	uur->uur_info |= UREC_INFO_TUPLE_COMPRESSED;
+}
+
+/*
+ * Replace the compressed tuple of a decoded undo record with the tuple it
+ * represents.  This does nothing if the tuple isn't compressed, so it's
+ * cheap to call before any use of the tuple data; callers that only look at
+ * the first UNDO_TUPLE_RAW_PREFIX bytes need not call it at all.
+ *
+ * The decompressed tuple is palloc'd.  If the record doesn't hold a buffer
+ * pin, the compressed bytes were palloc'd as well and are freed here.
+ */
+void
+UndoRecordDecompressTuple(UnpackedUndoRecord *uur)
+{
+	char	   *tuple;
+	uint16		tuple_len;
+
+	if ((uur->uur_info & UREC_INFO_TUPLE_COMPRESSED) == 0)
+		return;
+
+	Assert(uur->uur_tuple.len > UNDO_TUPLE_RAW_PREFIX + sizeof(uint16));
+	memcpy(&tuple_len, uur->uur_tuple.data + UNDO_TUPLE_RAW_PREFIX,
+		   sizeof(uint16));
+
+	tuple = palloc(tuple_len);
+	memcpy(tuple, uur->uur_tuple.data, UNDO_TUPLE_RAW_PREFIX);
+	if (pglz_decompress(uur->uur_tuple.data + UNDO_TUPLE_RAW_PREFIX +
+						sizeof(uint16),
+						uur->uur_tuple.len - UNDO_TUPLE_RAW_PREFIX -
+						sizeof(uint16),
+						tuple + UNDO_TUPLE_RAW_PREFIX,
+						tuple_len - UNDO_TUPLE_RAW_PREFIX, true) < 0)
+		elog(ERROR, "compressed undo tuple is corrupt");
+
+	if (!BufferIsValid(uur->uur_buffer))
+		pfree(uur->uur_tuple.data);
+
+	uur->uur_tuple.data = tuple;
+	uur->uur_tuple.len = tuple_len;
+	uur->uur_tuple.maxlen = tuple_len;
+	uur->uur_info &= ~UREC_INFO_TUPLE_COMPRESSED;
 }
@@ -24,6 +24,11 @@
  *
  * The rollback requests exceeding a certain threshold are pushed into both
  * xid and size based queues.  They are also registered in the hash table.
+ * With rollback_policy = adaptive, the threshold is instead derived from the
+ * rate at which undo workers have recently been applying undo: a rollback is
+ * pushed if applying it in the foreground is estimated to take longer than
+ * rollback_foreground_latency, unless the workers already have so much undo
+ * to apply that the aborting backend had better do it by itself.
  *
  * To process the request, we get the request from one of the queues, search
  * it in hash table and mark it as in-progress and then remove from the
@@ -32,8 +37,19 @@
  * queue, it can just ignore the request (and remove it from that queue) if
  * the request is not found in the hash table or is marked as in-progress.
  *
- * Also note that, if the work queues are full, then we put backpressure on
- * backends to complete the requests by themselves.
+ * Requests whose pages foreground backends had to roll back by themselves,
+ * in zheap_exec_pending_rollback, are remembered as hot, and undo workers take
+ * the hottest of them before looking at the queues.  So that the queues don't
+ * starve, a worker goes back to them after UNDO_MAX_HOT_STREAK hot requests
+ * in a row.
+ *
+ * The queues and the hash table live in a DSA area, which starts out in the
+ * main shared memory segment and is extended with DSM segments as needed, so
+ * that a burst of aborts doesn't run out of room for their requests.  A full
+ * queue is first cleaned of the requests that have been processed from the
+ * other queues, and only enlarged if that doesn't make room.  Only if no more
+ * memory can be allocated do we put backpressure on backends to complete the
+ * requests by themselves.
  *-------------------------------------------------------------------------
  */
 
@@ -50,146 +66,153 @@
 #include "access/xact.h"
 #include "catalog/indexing.h"
 #include "catalog/pg_database.h"
-#include "lib/binaryheap.h"
 #include "storage/shmem.h"
+#include "utils/dsa.h"
 #include "utils/fmgroids.h"
+#include "utils/memutils.h"
 #include "access/xlog.h"
 
+/*
+ * Initial capacity of each of the request queues.  They are enlarged on
+ * demand.
+ */
 #define ROLLBACK_REQUEST_QUEUE_SIZE 1024
 #define	MAX_UNDO_WORK_QUEUES	3
 #define UNDO_PEEK_DEPTH		10
 
-typedef struct
+/*
+ * Weight of the older measurements in the smoothed undo apply rate, as the
+ * reciprocal of the weight of a new one.
+ */
+#define UNDO_APPLY_RATE_SMOOTHING	4
+
+/*
+ * Number of hot requests remembered, and the number of them an undo worker
+ * takes before taking one from the queues again.
+ */
+#define UNDO_HOT_REQUESTS		8
+#define UNDO_MAX_HOT_STREAK		4
+
+/*
+ * Room left in the initial space of the rollback request area for the
+ * rounding up of allocations and the bookkeeping of the DSA allocator.
+ */
+#define ROLLBACK_REQUEST_AREA_SLOP	(512 * 1024)
+
+/*
+ * A request queue is a binary heap, with the request to be processed first at
+ * the top.  The queue entries are stored by value in an array allocated in
+ * the rollback request area.
+ */
+typedef struct UndoWorkerQueue
 {
-	binaryheap *bh;
-	union
-	{
-		UndoXidQueue *xid_elems;
-		UndoSizeQueue *size_elems;
-		UndoErrorQueue *error_elems;
-	}			q_choice;
-}			UndoWorkerQueue;
+	dsa_pointer elems;			/* array of queue entries */
+	int			size;			/* number of entries in the queue */
+	int			capacity;		/* number of entries elems has room for */
+} UndoWorkerQueue;
+
+/* Any queue entry fits into this. */
+typedef union UndoWorkerQueueElem
+{
+	UndoXidQueue xid_elem;
+	UndoSizeQueue size_elem;
+	UndoErrorQueue error_elem;
+} UndoWorkerQueueElem;
+
+/* The rollback hash table chains its entries from the buckets. */
+typedef struct RollbackHashElem
+{
+	dsa_pointer next;			/* next entry in the same bucket */
+	RollbackHashEntry entry;
+} RollbackHashElem;
+
+/*
+ * A request that foreground backends keep running into.  The entry is unused
+ * if hits is 0.  It may refer to a request that has been processed meanwhile.
+ */
+typedef struct RollbackHotRequest
+{
+	RollbackHashKey key;
+	uint32		hits;			/* times its pages were rolled back inline */
+} RollbackHotRequest;
 
-/* This is the hash table to store all the rollabck requests. */
-static HTAB *RollbackHT;
-static UndoWorkerQueue UndoWorkerQueues[MAX_UNDO_WORK_QUEUES];
+/*
+ * The shared state of the rollback requests, in the main shared memory
+ * segment.  It's protected by RollbackRequestLock.
+ */
+typedef struct RollbackRequestControl
+{
+	dsa_pointer buckets;		/* array of nbuckets chains of entries */
+	uint32		nbuckets;		/* always a power of 2 */
+	uint32		nentries;		/* number of entries in the hash table */
+	uint64		pending_size;	/* sum of request_size of all those entries */
+	double		apply_rate;		/* undo applied by a worker, in bytes per
+								 * millisecond; 0 if not measured yet */
+	UndoWorkerQueue queues[MAX_UNDO_WORK_QUEUES];
+	RollbackHotRequest hot[UNDO_HOT_REQUESTS];
+} RollbackRequestControl;
+
+typedef int (*UndoWorkerQueueComparator) (const void *a, const void *b);
+
+static int	undo_age_comparator(const void *a, const void *b);
+static int	undo_size_comparator(const void *a, const void *b);
+static int	undo_err_time_comparator(const void *a, const void *b);
+
+/* Entry size and priority order of each queue, indexed by the queue type. */
+static const Size undo_queue_elem_size[MAX_UNDO_WORK_QUEUES] = {
+	sizeof(UndoXidQueue),
+	sizeof(UndoSizeQueue),
+	sizeof(UndoErrorQueue)
+};
+
+static const UndoWorkerQueueComparator undo_queue_comparator[MAX_UNDO_WORK_QUEUES] = {
+	undo_age_comparator,
+	undo_size_comparator,
+	undo_err_time_comparator
+};
+
+static RollbackRequestControl *RollbackRequests;
+
+/* GUCs */
+int			rollback_policy = ROLLBACK_POLICY_SIZE;
+int			rollback_foreground_latency = 1000;
+
+/* The space in the main shared memory segment to create the area in. */
+static void *RollbackRequestAreaSpace;
+
+/* This backend's attachment to the rollback request area, once needed. */
+static dsa_area *RollbackRequestArea = NULL;
 
 static uint32 cur_undo_queue = 0;
 
-/* Different operations for XID queue */
-#define InitXidQueue(bh, elems) \
-( \
-	UndoWorkerQueues[XID_QUEUE].bh = bh, \
-	UndoWorkerQueues[XID_QUEUE].q_choice.xid_elems = elems \
-)
-
-#define XidQueueIsEmpty() \
-	(binaryheap_empty(UndoWorkerQueues[XID_QUEUE].bh))
-
-#define GetXidQueueSize() \
-	(binaryheap_cur_size(UndoWorkerQueues[XID_QUEUE].bh))
-
-#define GetXidQueueElem(elem) \
-	(UndoWorkerQueues[XID_QUEUE].q_choice.xid_elems[elem])
-
-#define GetXidQueueTopElem() \
-( \
-	AssertMacro(!binaryheap_empty(UndoWorkerQueues[XID_QUEUE].bh)), \
-	DatumGetPointer(binaryheap_first(UndoWorkerQueues[XID_QUEUE].bh)) \
-)
-
-#define GetXidQueueNthElem(n) \
-( \
-	AssertMacro(!XidQueueIsEmpty()), \
-	DatumGetPointer(binaryheap_nth(UndoWorkerQueues[XID_QUEUE].bh, n)) \
-)
-
-#define SetXidQueueElem(elem, e_dbid, e_full_xid, e_start_urec_ptr) \
-( \
-	GetXidQueueElem(elem).dbid = e_dbid, \
-	GetXidQueueElem(elem).full_xid = e_full_xid, \
-	GetXidQueueElem(elem).start_urec_ptr = e_start_urec_ptr \
-)
-
-/* Different operations for SIZE queue */
-#define InitSizeQueue(bh, elems) \
-( \
-	UndoWorkerQueues[SIZE_QUEUE].bh = bh, \
-	UndoWorkerQueues[SIZE_QUEUE].q_choice.size_elems = elems \
-)
-
-#define SizeQueueIsEmpty() \
-	(binaryheap_empty(UndoWorkerQueues[SIZE_QUEUE].bh))
-
-#define GetSizeQueueSize() \
-	(binaryheap_cur_size(UndoWorkerQueues[SIZE_QUEUE].bh))
-
-#define GetSizeQueueElem(elem) \
-	(UndoWorkerQueues[SIZE_QUEUE].q_choice.size_elems[elem])
-
-#define GetSizeQueueTopElem() \
-( \
-	AssertMacro(!SizeQueueIsEmpty()), \
-	DatumGetPointer(binaryheap_first(UndoWorkerQueues[SIZE_QUEUE].bh)) \
-)
-
-#define GetSizeQueueNthElem(n) \
-( \
-	AssertMacro(!SizeQueueIsEmpty()), \
-	DatumGetPointer(binaryheap_nth(UndoWorkerQueues[SIZE_QUEUE].bh, n)) \
-)
-
-#define SetSizeQueueElem(elem, e_dbid, e_full_xid, e_size, e_start_urec_ptr) \
-( \
-	GetSizeQueueElem(elem).dbid = e_dbid, \
-	GetSizeQueueElem(elem).full_xid = e_full_xid, \
-	GetSizeQueueElem(elem).request_size = e_size, \
-	GetSizeQueueElem(elem).start_urec_ptr = e_start_urec_ptr \
-)
-
-/* Different operations for Error queue */
-#define InitErrorQueue(bh, elems) \
-( \
-	UndoWorkerQueues[ERROR_QUEUE].bh = bh, \
-	UndoWorkerQueues[ERROR_QUEUE].q_choice.error_elems = elems \
-)
-
-#define ErrorQueueIsEmpty() \
-	(binaryheap_empty(UndoWorkerQueues[ERROR_QUEUE].bh))
-
-#define GetErrorQueueSize() \
-	(binaryheap_cur_size(UndoWorkerQueues[ERROR_QUEUE].bh))
-
-#define GetErrorQueueElem(elem) \
-	(UndoWorkerQueues[ERROR_QUEUE].q_choice.error_elems[elem])
-
-#define GetErrorQueueTopElem() \
-( \
-	AssertMacro(!binaryheap_empty(UndoWorkerQueues[ERROR_QUEUE].bh)), \
-	DatumGetPointer(binaryheap_first(UndoWorkerQueues[ERROR_QUEUE].bh)) \
-)
-
-#define GetErrorQueueNthElem(n) \
-( \
-	AssertMacro(!ErrorQueueIsEmpty()), \
-	DatumGetPointer(binaryheap_nth(UndoWorkerQueues[ERROR_QUEUE].bh, n)) \
-)
-
-#define SetErrorQueueElem(elem, e_dbid, e_full_xid, e_occurred_at) \
-( \
-	GetErrorQueueElem(elem).dbid = e_dbid, \
-	GetErrorQueueElem(elem).full_xid = e_full_xid, \
-	GetErrorQueueElem(elem).err_occurred_at = e_occurred_at \
-)
+/* Number of hot requests this process took in a row. */
+static int	hot_streak = 0;
+
+#define GetQueue(type) \
+	(&RollbackRequests->queues[(type)])
+
+#define GetQueueSize(type) \
+	(GetQueue(type)->size)
+
+#define QueueIsEmpty(type) \
+	(GetQueueSize(type) == 0)
+
+#define XidQueueIsEmpty()		QueueIsEmpty(XID_QUEUE)
+#define SizeQueueIsEmpty()		QueueIsEmpty(SIZE_QUEUE)
+#define ErrorQueueIsEmpty()		QueueIsEmpty(ERROR_QUEUE)
+
+static int	RemoveOldElemsFromQueue(UndoWorkerQueueType type);
+static RollbackHashEntry *RollbackHTSearch(const RollbackHashKey *hkey,
+										   HASHACTION action, bool *found);
 
 /*
- * Binary heap comparison function to compare the age of transactions.
+ * Comparison function to compare the age of transactions.
  */
 static int
-undo_age_comparator(Datum a, Datum b, void *arg)
+undo_age_comparator(const void *a, const void *b)
 {
-	UndoXidQueue *xidQueueElem1 = (UndoXidQueue *) DatumGetPointer(a);
-	UndoXidQueue *xidQueueElem2 = (UndoXidQueue *) DatumGetPointer(b);
+	const UndoXidQueue *xidQueueElem1 = (const UndoXidQueue *) a;
+	const UndoXidQueue *xidQueueElem2 = (const UndoXidQueue *) b;
 
 	if (FullTransactionIdPrecedes(xidQueueElem1->full_xid,
 								  xidQueueElem2->full_xid))
@@ -201,13 +224,13 @@ undo_age_comparator(Datum a, Datum b, void *arg)
 }
 
 /*
- * Binary heap comparison function to compare the size of transactions.
+ * Comparison function to compare the size of transactions.
  */
 static int
-undo_size_comparator(Datum a, Datum b, void *arg)
+undo_size_comparator(const void *a, const void *b)
 {
-	UndoSizeQueue *sizeQueueElem1 = (UndoSizeQueue *) DatumGetPointer(a);
-	UndoSizeQueue *sizeQueueElem2 = (UndoSizeQueue *) DatumGetPointer(b);
+	const UndoSizeQueue *sizeQueueElem1 = (const UndoSizeQueue *) a;
+	const UndoSizeQueue *sizeQueueElem2 = (const UndoSizeQueue *) b;
 
 	if (sizeQueueElem1->request_size > sizeQueueElem2->request_size)
 		return 1;
@@ -217,14 +240,14 @@ undo_size_comparator(Datum a, Datum b, void *arg)
 }
 
 /*
- * Binary heap comparison function to compare the time at which an error
- * occurred for transactions.
+ * Comparison function to compare the time at which an error occurred for
+ * transactions.
  */
 static int
-undo_err_time_comparator(Datum a, Datum b, void *arg)
+undo_err_time_comparator(const void *a, const void *b)
 {
-	UndoErrorQueue *errQueueElem1 = (UndoErrorQueue *) DatumGetPointer(a);
-	UndoErrorQueue *errQueueElem2 = (UndoErrorQueue *) DatumGetPointer(b);
+	const UndoErrorQueue *errQueueElem1 = (const UndoErrorQueue *) a;
+	const UndoErrorQueue *errQueueElem2 = (const UndoErrorQueue *) b;
 
 	if (errQueueElem1->err_occurred_at < errQueueElem2->err_occurred_at)
 		return 1;
@@ -233,24 +256,6 @@ undo_err_time_comparator(Datum a, Datum b, void *arg)
 	return -1;
 }
 
-static int
-UndoXidQueueElemsShmSize(void)
-{
-	return mul_size(ROLLBACK_REQUEST_QUEUE_SIZE, sizeof(UndoXidQueue));
-}
-
-static int
-UndoSizeQueueElemsShmSize(void)
-{
-	return mul_size(ROLLBACK_REQUEST_QUEUE_SIZE, sizeof(UndoSizeQueue));
-}
-
-static int
-UndoErrorQueueElemsShmSize(void)
-{
-	return mul_size(ROLLBACK_REQUEST_QUEUE_SIZE, sizeof(UndoErrorQueue));
-}
-
 static int
 UndoRollbackHashTableSize()
 {
@@ -260,240 +265,290 @@ UndoRollbackHashTableSize()
 	 * active undo requests.  The undo requests must appear in both xid and
 	 * size requests queues or neither.  In same transaction, there can be two
 	 * requests one for logged relations and another for unlogged relations.
-	 * So, the rollback hash table size should be equal to two request queues,
+	 * So, the rollback hash table initially has room for two request queues,
 	 * an error queue (currently this is same as request queue) and max
-	 * backends. This will ensure that it won't get filled.
+	 * backends.  It's enlarged along with the queues.
 	 */
 	return ((2 * ROLLBACK_REQUEST_QUEUE_SIZE) + ROLLBACK_REQUEST_QUEUE_SIZE +
 			MaxBackends);
 }
 
-/* Get the first free element of xid based request array. */
-static int
-UndoXidQueueGetFreeElem(void)
+/* Initial number of buckets of the rollback hash table. */
+static uint32
+UndoRollbackHashTableBuckets(void)
 {
-	int			i;
-
-	for (i = 0; i < ROLLBACK_REQUEST_QUEUE_SIZE; i++)
-	{
-		if (FullTransactionIdEquals(GetXidQueueElem(i).full_xid,
-									InvalidFullTransactionId))
-			return i;
-	}
+	uint32		nbuckets = 1;
 
-	/* we should never call this function when the request queue is full. */
-	Assert(false);
+	while (nbuckets < UndoRollbackHashTableSize())
+		nbuckets <<= 1;
 
-	/* silence compiler. */
-	return -1;
+	return nbuckets;
 }
 
-/* Push an element in the xid based request queue */
+/*
+ * Attach to the rollback request area, if we haven't yet.  This must be done
+ * before acquiring RollbackRequestLock, as attaching can fail.
+ */
 static void
-PushXidQueueElem(UndoRequestInfo *urinfo)
+AttachRollbackRequestArea(void)
 {
-	int			elem = UndoXidQueueGetFreeElem();
+	MemoryContext oldcontext;
 
-	SetXidQueueElem(elem, urinfo->dbid, urinfo->full_xid, urinfo->start_urec_ptr);
+	if (RollbackRequestArea != NULL)
+		return;
 
-	binaryheap_add(UndoWorkerQueues[XID_QUEUE].bh,
-				   PointerGetDatum(&GetXidQueueElem(elem)));
+	oldcontext = MemoryContextSwitchTo(TopMemoryContext);
+	RollbackRequestArea = dsa_attach_in_place(RollbackRequestAreaSpace, NULL);
+	dsa_pin_mapping(RollbackRequestArea);
+	MemoryContextSwitchTo(oldcontext);
 }
 
-/* Pop nth element from the xid based request queue */
-static UndoXidQueue *
-PopXidQueueNthElem(int n)
+/* Get the nth entry of a request queue, in heap order. */
+static inline void *
+GetQueueNthElem(UndoWorkerQueueType type, int n)
 {
-	Datum		elem;
+	UndoWorkerQueue *queue = GetQueue(type);
 
-	Assert(!XidQueueIsEmpty());
-	elem = binaryheap_remove_nth(UndoWorkerQueues[XID_QUEUE].bh, n);
+	Assert(n >= 0 && n < queue->size);
 
-	return (UndoXidQueue *) (DatumGetPointer(elem));
+	return (char *) dsa_get_address(RollbackRequestArea, queue->elems) +
+		n * undo_queue_elem_size[type];
 }
 
-/* Get the first free element of size based request array. */
-static inline int
-UndoSizeQueueGetFreeElem(void)
+/* Get the hash key of the request the nth entry of a queue refers to. */
+static void
+GetQueueNthElemKey(UndoWorkerQueueType type, int n, RollbackHashKey *hkey)
 {
-	int			i;
+	void	   *elem = GetQueueNthElem(type, n);
 
-	for (i = 0; i < ROLLBACK_REQUEST_QUEUE_SIZE; i++)
+	if (type == XID_QUEUE)
 	{
-		if (FullTransactionIdEquals(GetSizeQueueElem(i).full_xid,
-									InvalidFullTransactionId))
-			return i;
+		hkey->full_xid = ((UndoXidQueue *) elem)->full_xid;
+		hkey->start_urec_ptr = ((UndoXidQueue *) elem)->start_urec_ptr;
+	}
+	else if (type == SIZE_QUEUE)
+	{
+		hkey->full_xid = ((UndoSizeQueue *) elem)->full_xid;
+		hkey->start_urec_ptr = ((UndoSizeQueue *) elem)->start_urec_ptr;
+	}
+	else
+	{
+		Assert(type == ERROR_QUEUE);
+		hkey->full_xid = ((UndoErrorQueue *) elem)->full_xid;
+		hkey->start_urec_ptr = ((UndoErrorQueue *) elem)->start_urec_ptr;
 	}
-
-	/* we should never call this function when the request queue is full. */
-	Assert(false);
-
-	/* silence compiler. */
-	return -1;
 }
 
 /*
- * Traverse the queue and remove dangling entries, if any.  The queue
- * entry is considered dangling if the hash table doesn't contain the
- * corresponding entry.
+ * Returns true if the ath entry of a queue is to be processed before the bth.
  */
-static int
-RemoveOldElemsFromXidQueue()
+static inline bool
+QueueElemPrecedes(UndoWorkerQueueType type, int a, int b)
 {
-	int			nCleaned = 0;
-	int			i = 0;
+	return undo_queue_comparator[type] (GetQueueNthElem(type, a),
+										GetQueueNthElem(type, b)) > 0;
+}
 
-	Assert(LWLockHeldByMeInMode(RollbackRequestLock, LW_EXCLUSIVE));
+static void
+SwapQueueElems(UndoWorkerQueueType type, int a, int b)
+{
+	UndoWorkerQueueElem tmp;
+	void	   *elem_a = GetQueueNthElem(type, a);
+	void	   *elem_b = GetQueueNthElem(type, b);
+	Size		size = undo_queue_elem_size[type];
+
+	memcpy(&tmp, elem_a, size);
+	memcpy(elem_a, elem_b, size);
+	memcpy(elem_b, &tmp, size);
+}
 
-	while (i < GetXidQueueSize())
+/* Move the nth entry of a queue up the heap till its parent precedes it. */
+static void
+SiftQueueUp(UndoWorkerQueueType type, int n)
+{
+	while (n > 0)
 	{
-		RollbackHashEntry *rh;
-		RollbackHashKey hkey;
-		UndoXidQueue *elem = (UndoXidQueue *) GetXidQueueNthElem(i);
+		int			parent = (n - 1) / 2;
 
-		hkey.full_xid = elem->full_xid;
-		hkey.start_urec_ptr = elem->start_urec_ptr;
-		rh = (RollbackHashEntry *) hash_search(RollbackHT,
-											   (void *) &hkey,
-											   HASH_FIND, NULL);
-
-		/*
-		 * If some undo worker is already processing the rollback request or
-		 * it is already processed, then we drop that request from the queue.
-		 */
-		if (!rh || rh->in_progress)
-		{
-			elem->dbid = InvalidOid;
-			elem->full_xid = InvalidFullTransactionId;
-			nCleaned++;
-			binaryheap_remove_nth_unordered(UndoWorkerQueues[XID_QUEUE].bh, i);
-
-			continue;
-		}
-
-		i++;
+		if (!QueueElemPrecedes(type, n, parent))
+			break;
+		SwapQueueElems(type, n, parent);
+		n = parent;
 	}
-
-	binaryheap_build(UndoWorkerQueues[XID_QUEUE].bh);
-
-	return nCleaned;
 }
 
-/* Push an element in the size based request queue */
+/* Move the nth entry of a queue down the heap till it precedes its children. */
 static void
-PushSizeQueueElem(UndoRequestInfo *urinfo)
+SiftQueueDown(UndoWorkerQueueType type, int n)
 {
-	int			elem = UndoSizeQueueGetFreeElem();
-
-	SetSizeQueueElem(elem, urinfo->dbid, urinfo->full_xid, urinfo->request_size,
-					 urinfo->start_urec_ptr);
+	int			size = GetQueueSize(type);
 
-	binaryheap_add(UndoWorkerQueues[SIZE_QUEUE].bh,
-				   PointerGetDatum(&GetSizeQueueElem(elem)));
+	while (true)
+	{
+		int			left = 2 * n + 1;
+		int			right = 2 * n + 2;
+		int			first = n;
+
+		if (left < size && QueueElemPrecedes(type, left, first))
+			first = left;
+		if (right < size && QueueElemPrecedes(type, right, first))
+			first = right;
+		if (first == n)
+			break;
+		SwapQueueElems(type, n, first);
+		n = first;
+	}
 }
 
-/* Pop nth element from the size based request queue */
-static UndoSizeQueue *
-PopSizeQueueNthElem(int n)
+/* Restore the heap order of a queue after unordered removals. */
+static void
+BuildQueue(UndoWorkerQueueType type)
 {
-	Datum		elem;
-
-	Assert(!binaryheap_empty(UndoWorkerQueues[SIZE_QUEUE].bh));
-	elem = binaryheap_remove_nth(UndoWorkerQueues[SIZE_QUEUE].bh, n);
+	int			i;
 
-	return (UndoSizeQueue *) DatumGetPointer(elem);
+	for (i = GetQueueSize(type) / 2 - 1; i >= 0; i--)
+		SiftQueueDown(type, i);
 }
 
 /*
- * Traverse the queue and remove dangling entries, if any.  The queue
- * entry is considered dangling if the hash table doesn't contain the
- * corresponding entry.
+ * Make sure there is room for one more entry in a queue.
+ *
+ * If the queue is full, remove its dangling entries first, and only enlarge
+ * it if there were none.  Returns false if the queue needs enlarging but
+ * there's no memory for that.
  */
-static int
-RemoveOldElemsFromSizeQueue()
+static bool
+ReserveQueueElem(UndoWorkerQueueType type)
 {
-	int			nCleaned = 0;
-	int			i = 0;
+	UndoWorkerQueue *queue = GetQueue(type);
+	Size		elem_size = undo_queue_elem_size[type];
+	dsa_pointer elems;
+	int			capacity;
 
 	Assert(LWLockHeldByMeInMode(RollbackRequestLock, LW_EXCLUSIVE));
 
-	while (i < GetSizeQueueSize())
-	{
-		RollbackHashEntry *rh;
-		RollbackHashKey hkey;
-		UndoSizeQueue *elem = (UndoSizeQueue *) GetSizeQueueNthElem(i);
+	if (queue->size < queue->capacity)
+		return true;
 
-		hkey.full_xid = elem->full_xid;
-		hkey.start_urec_ptr = elem->start_urec_ptr;
-		rh = (RollbackHashEntry *) hash_search(RollbackHT,
-											   (void *) &hkey,
-											   HASH_FIND, NULL);
+	/*
+	 * Traverse the queue and remove dangling entries, if any.  The queue
+	 * entry is considered dangling if the hash table doesn't contain the
+	 * corresponding entry.  It can happen due to two reasons (a) we have
+	 * processed the entry from one of the queues, but not from the other.
+	 * (b) the corresponding database has been dropped due to which we have
+	 * removed the entries from hash table, but not from the queues.  This is
+	 * just a lazy cleanup, if we want we can remove the entries from the
+	 * queues when we detect that the database is dropped and remove the
+	 * corresponding entries from hash table.
+	 */
+	if (RemoveOldElemsFromQueue(type) > 0)
+		return true;
 
-		/*
-		 * If some undo worker is already processing the rollback request or
-		 * it is already processed, then we drop that request from the queue.
-		 */
-		if (!rh || rh->in_progress)
-		{
-			elem->dbid = InvalidOid;
-			elem->full_xid = InvalidFullTransactionId;
-			elem->request_size = 0;
-			binaryheap_remove_nth_unordered(UndoWorkerQueues[SIZE_QUEUE].bh, i);
-			nCleaned++;
-			continue;
-		}
+	if (queue->capacity > MaxAllocHugeSize / elem_size / 2)
+		return false;
+	capacity = queue->capacity * 2;
 
-		i++;
-	}
+	elems = dsa_allocate_extended(RollbackRequestArea, capacity * elem_size,
+								  DSA_ALLOC_HUGE | DSA_ALLOC_NO_OOM);
+	if (!DsaPointerIsValid(elems))
+		return false;
 
-	binaryheap_build(UndoWorkerQueues[SIZE_QUEUE].bh);
+	memcpy(dsa_get_address(RollbackRequestArea, elems),
+		   dsa_get_address(RollbackRequestArea, queue->elems),
+		   queue->size * elem_size);
+	dsa_free(RollbackRequestArea, queue->elems);
 
-	return nCleaned;
+	queue->elems = elems;
+	queue->capacity = capacity;
+
+	elog(DEBUG1, "enlarged undo request queue %d to %d entries",
+		 type, capacity);
+
+	return true;
 }
 
-/* Get the first free element of error time based request array. */
-static int
-UndoErrorQueueGetFreeElem(void)
+/*
+ * Add an entry to a queue, which must have room for it.  See
+ * ReserveQueueElem.
+ */
+static void
+PushQueueElem(UndoWorkerQueueType type, const void *elem)
 {
-	int			i;
+	UndoWorkerQueue *queue = GetQueue(type);
+	int			n;
+
+	Assert(queue->size < queue->capacity);
+
+	n = queue->size++;
+	memcpy(GetQueueNthElem(type, n), elem, undo_queue_elem_size[type]);
+	SiftQueueUp(type, n);
+}
+
+/*
+ * Remove the nth entry from a queue.  If reorder is false, the heap order of
+ * the queue is not maintained, and the caller must restore it with
+ * BuildQueue before using the queue again.
+ */
+static void
+RemoveQueueNthElem(UndoWorkerQueueType type, int n, bool reorder)
+{
+	UndoWorkerQueue *queue = GetQueue(type);
+	int			last = queue->size - 1;
+
+	Assert(n <= last);
+
+	/* Move the last entry into the hole. */
+	if (n < last)
+		memcpy(GetQueueNthElem(type, n), GetQueueNthElem(type, last),
+			   undo_queue_elem_size[type]);
+	queue->size--;
 
-	for (i = 0; i < ROLLBACK_REQUEST_QUEUE_SIZE; i++)
+	if (reorder && n < last)
 	{
-		if (FullTransactionIdEquals(GetErrorQueueElem(i).full_xid,
-									InvalidFullTransactionId))
-			return i;
+		SiftQueueUp(type, n);
+		SiftQueueDown(type, n);
 	}
+}
 
-	/* we should never call this function when the request queue is full. */
-	Assert(false);
+/* Push an element in the xid based request queue */
+static void
+PushXidQueueElem(UndoRequestInfo *urinfo)
+{
+	UndoXidQueue elem;
 
-	/* silence compiler. */
-	return -1;
+	elem.dbid = urinfo->dbid;
+	elem.full_xid = urinfo->full_xid;
+	elem.start_urec_ptr = urinfo->start_urec_ptr;
+
+	PushQueueElem(XID_QUEUE, &elem);
 }
 
-/* Push an element in the error time based request queue */
+/* Push an element in the size based request queue */
 static void
-PushErrorQueueElem(volatile UndoRequestInfo *urinfo)
+PushSizeQueueElem(UndoRequestInfo *urinfo)
 {
-	int			elem = UndoErrorQueueGetFreeElem();
-	TimestampTz now = GetCurrentTimestamp();
+	UndoSizeQueue elem;
 
-	SetErrorQueueElem(elem, urinfo->dbid, urinfo->full_xid, now);
+	elem.dbid = urinfo->dbid;
+	elem.full_xid = urinfo->full_xid;
+	elem.request_size = urinfo->request_size;
+	elem.start_urec_ptr = urinfo->start_urec_ptr;
 
-	binaryheap_add(UndoWorkerQueues[ERROR_QUEUE].bh,
-				   PointerGetDatum(&GetErrorQueueElem(elem)));
+	PushQueueElem(SIZE_QUEUE, &elem);
 }
 
-/* Pop nth element from the error time based request queue */
-static UndoErrorQueue *
-PopErrorQueueNthElem(int n)
+/* Push an element in the error time based request queue */
+static void
+PushErrorQueueElem(volatile UndoRequestInfo *urinfo)
 {
-	Datum		elem;
+	UndoErrorQueue elem;
 
-	Assert(!ErrorQueueIsEmpty());
-	elem = binaryheap_remove_nth(UndoWorkerQueues[ERROR_QUEUE].bh, n);
+	elem.dbid = urinfo->dbid;
+	elem.full_xid = urinfo->full_xid;
+	elem.start_urec_ptr = urinfo->start_urec_ptr;
+	elem.err_occurred_at = GetCurrentTimestamp();
 
-	return (UndoErrorQueue *) (DatumGetPointer(elem));
+	PushQueueElem(ERROR_QUEUE, &elem);
 }
 
 /*
@@ -502,24 +557,20 @@ PopErrorQueueNthElem(int n)
  * corresponding entry.
  */
 static int
-RemoveOldElemsFromErrorQueue()
+RemoveOldElemsFromQueue(UndoWorkerQueueType type)
 {
 	int			nCleaned = 0;
 	int			i = 0;
 
 	Assert(LWLockHeldByMeInMode(RollbackRequestLock, LW_EXCLUSIVE));
 
-	while (i < GetErrorQueueSize())
+	while (i < GetQueueSize(type))
 	{
 		RollbackHashEntry *rh;
 		RollbackHashKey hkey;
-		UndoErrorQueue *elem = (UndoErrorQueue *) GetErrorQueueNthElem(i);
 
-		hkey.full_xid = elem->full_xid;
-		hkey.start_urec_ptr = elem->start_urec_ptr;
-		rh = (RollbackHashEntry *) hash_search(RollbackHT,
-											   (void *) &hkey,
-											   HASH_FIND, NULL);
+		GetQueueNthElemKey(type, i, &hkey);
+		rh = RollbackHTSearch(&hkey, HASH_FIND, NULL);
 
 		/*
 		 * If some undo worker is already processing the rollback request or
@@ -527,10 +578,7 @@ RemoveOldElemsFromErrorQueue()
 		 */
 		if (!rh || rh->in_progress)
 		{
-			elem->dbid = InvalidOid;
-			elem->full_xid = InvalidFullTransactionId;
-			elem->err_occurred_at = 0;
-			binaryheap_remove_nth_unordered(UndoWorkerQueues[ERROR_QUEUE].bh, i);
+			RemoveQueueNthElem(type, i, false);
 			nCleaned++;
 			continue;
 		}
@@ -538,45 +586,26 @@ RemoveOldElemsFromErrorQueue()
 		i++;
 	}
 
-	binaryheap_build(UndoWorkerQueues[ERROR_QUEUE].bh);
+	if (nCleaned > 0)
+		BuildQueue(type);
 
 	return nCleaned;
 }
 
 /*
- * Remove nth work item from queue and clear the array element as well from
- * the corresponding queue.
+ * Remove nth work item from queue.
  */
 static void
 RemoveRequestFromQueue(UndoWorkerQueueType type, int n)
 {
-	if (type == XID_QUEUE)
-	{
-		UndoXidQueue *uXidQueueElem = (UndoXidQueue *) PopXidQueueNthElem(n);
+#ifdef USE_ASSERT_CHECKING
+	RollbackHashKey hkey;
 
-		Assert(FullTransactionIdIsValid(uXidQueueElem->full_xid));
-		uXidQueueElem->dbid = InvalidOid;
-		uXidQueueElem->full_xid = InvalidFullTransactionId;
-	}
-	else if (type == SIZE_QUEUE)
-	{
-		UndoSizeQueue *uSizeQueueElem = (UndoSizeQueue *) PopSizeQueueNthElem(n);
+	GetQueueNthElemKey(type, n, &hkey);
+	Assert(FullTransactionIdIsValid(hkey.full_xid));
+#endif
 
-		Assert(FullTransactionIdIsValid(uSizeQueueElem->full_xid));
-		uSizeQueueElem->dbid = InvalidOid;
-		uSizeQueueElem->full_xid = InvalidFullTransactionId;
-		uSizeQueueElem->request_size = 0;
-	}
-	else
-	{
-		UndoErrorQueue *uErrorQueueElem = (UndoErrorQueue *) PopErrorQueueNthElem(n);
-
-		Assert(type == ERROR_QUEUE);
-		Assert(FullTransactionIdIsValid(uErrorQueueElem->full_xid));
-		uErrorQueueElem->dbid = InvalidOid;
-		uErrorQueueElem->full_xid = InvalidFullTransactionId;
-		uErrorQueueElem->err_occurred_at = 0;
-	}
+	RemoveQueueNthElem(type, n, true);
 }
 
 /*
@@ -587,50 +616,156 @@ static bool
 GetRollbackHashKeyFromQueue(UndoWorkerQueueType cur_queue, int n,
 							RollbackHashKey *hkey)
 {
-	if (cur_queue == XID_QUEUE)
+	/* check if there is a work in the next queue */
+	if (GetQueueSize(cur_queue) <= n)
 	{
-		UndoXidQueue *elem;
+		if (cur_queue == ERROR_QUEUE)
+			cur_undo_queue++;
+		return false;
+	}
 
-		/* check if there is a work in the next queue */
-		if (GetXidQueueSize() <= n)
-			return false;
+	GetQueueNthElemKey(cur_queue, n, hkey);
 
-		elem = (UndoXidQueue *) GetXidQueueNthElem(n);
-		hkey->full_xid = elem->full_xid;
-		hkey->start_urec_ptr = elem->start_urec_ptr;
-	}
-	else if (cur_queue == SIZE_QUEUE)
+	return true;
+}
+
+/*
+ * Get the bucket of the rollback hash table a key belongs to.  Only the
+ * transaction id is hashed, so that all the requests of a transaction can be
+ * found in the same bucket, see RollbackHTMarkHot.
+ */
+static inline uint32
+RollbackHTBucket(const RollbackHashKey *hkey, uint32 nbuckets)
+{
+	return tag_hash(&hkey->full_xid, sizeof(FullTransactionId)) &
+		(nbuckets - 1);
+}
+
+/*
+ * Double the number of buckets of the rollback hash table.  If there's no
+ * memory for that, the chains just get longer.
+ */
+static void
+RollbackHTGrow(void)
+{
+	dsa_pointer *old_buckets;
+	dsa_pointer *new_buckets;
+	dsa_pointer buckets;
+	uint32		nbuckets;
+	uint32		i;
+
+	if (RollbackRequests->nbuckets > (uint32) (MaxAllocHugeSize / sizeof(dsa_pointer) / 2))
+		return;
+	nbuckets = RollbackRequests->nbuckets * 2;
+
+	buckets = dsa_allocate_extended(RollbackRequestArea,
+									nbuckets * sizeof(dsa_pointer),
+									DSA_ALLOC_HUGE | DSA_ALLOC_NO_OOM |
+									DSA_ALLOC_ZERO);
+	if (!DsaPointerIsValid(buckets))
+		return;
+
+	old_buckets = dsa_get_address(RollbackRequestArea,
+								  RollbackRequests->buckets);
+	new_buckets = dsa_get_address(RollbackRequestArea, buckets);
+
+	for (i = 0; i < RollbackRequests->nbuckets; i++)
 	{
-		UndoSizeQueue *elem;
+		dsa_pointer elemp = old_buckets[i];
 
-		/* check if there is a work in the next queue */
-		if (GetSizeQueueSize() <= n)
-			return false;
+		while (DsaPointerIsValid(elemp))
+		{
+			RollbackHashElem *elem = dsa_get_address(RollbackRequestArea, elemp);
+			dsa_pointer next = elem->next;
+			RollbackHashKey hkey;
+			uint32		bucket;
 
-		elem = (UndoSizeQueue *) GetSizeQueueNthElem(n);
-		hkey->full_xid = elem->full_xid;
-		hkey->start_urec_ptr = elem->start_urec_ptr;
+			hkey.full_xid = elem->entry.full_xid;
+			hkey.start_urec_ptr = elem->entry.start_urec_ptr;
+			bucket = RollbackHTBucket(&hkey, nbuckets);
+
+			elem->next = new_buckets[bucket];
+			new_buckets[bucket] = elemp;
+			elemp = next;
+		}
 	}
-	else
+
+	dsa_free(RollbackRequestArea, RollbackRequests->buckets);
+	RollbackRequests->buckets = buckets;
+	RollbackRequests->nbuckets = nbuckets;
+}
+
+/*
+ * Find, enter or remove an entry of the rollback hash table, in the manner of
+ * hash_search.  HASH_ENTER_NULL is the only way to enter an entry that is
+ * supported; NULL is returned if there is no memory for it.  The caller must
+ * hold RollbackRequestLock, in exclusive mode unless it's just looking up.
+ */
+static RollbackHashEntry *
+RollbackHTSearch(const RollbackHashKey *hkey, HASHACTION action, bool *found)
+{
+	dsa_pointer *buckets;
+	dsa_pointer *link;
+	dsa_pointer elemp;
+	RollbackHashElem *elem;
+	uint32		bucket;
+
+	Assert(action == HASH_FIND || action == HASH_ENTER_NULL ||
+		   action == HASH_REMOVE);
+	Assert(LWLockHeldByMe(RollbackRequestLock));
+
+	buckets = dsa_get_address(RollbackRequestArea, RollbackRequests->buckets);
+	bucket = RollbackHTBucket(hkey, RollbackRequests->nbuckets);
+
+	for (link = &buckets[bucket]; DsaPointerIsValid(*link); link = &elem->next)
 	{
-		UndoErrorQueue *elem;
+		elem = dsa_get_address(RollbackRequestArea, *link);
 
-		/* It must be an error queue. */
-		Assert(cur_queue == ERROR_QUEUE);
+		if (!FullTransactionIdEquals(elem->entry.full_xid, hkey->full_xid) ||
+			elem->entry.start_urec_ptr != hkey->start_urec_ptr)
+			continue;
+
+		if (found)
+			*found = true;
 
-		/* check if there is a work in the next queue */
-		if (GetErrorQueueSize() <= n)
+		if (action == HASH_REMOVE)
 		{
-			cur_undo_queue++;
-			return false;
+			Assert(LWLockHeldByMeInMode(RollbackRequestLock, LW_EXCLUSIVE));
+
+			elemp = *link;
+			*link = elem->next;
+			RollbackRequests->pending_size -= elem->entry.request_size;
+			dsa_free(RollbackRequestArea, elemp);
+			RollbackRequests->nentries--;
+			return NULL;
 		}
 
-		elem = (UndoErrorQueue *) GetErrorQueueNthElem(n);
-		hkey->full_xid = elem->full_xid;
-		hkey->start_urec_ptr = elem->start_urec_ptr;
+		return &elem->entry;
 	}
 
-	return true;
+	if (found)
+		*found = false;
+
+	if (action != HASH_ENTER_NULL)
+		return NULL;
+
+	Assert(LWLockHeldByMeInMode(RollbackRequestLock, LW_EXCLUSIVE));
+
+	elemp = dsa_allocate_extended(RollbackRequestArea, sizeof(RollbackHashElem),
+								  DSA_ALLOC_NO_OOM | DSA_ALLOC_ZERO);
+	if (!DsaPointerIsValid(elemp))
+		return NULL;
+
+	elem = dsa_get_address(RollbackRequestArea, elemp);
+	elem->entry.full_xid = hkey->full_xid;
+	elem->entry.start_urec_ptr = hkey->start_urec_ptr;
+	elem->next = buckets[bucket];
+	buckets[bucket] = elemp;
+
+	if (++RollbackRequests->nentries > RollbackRequests->nbuckets)
+		RollbackHTGrow();
+
+	return &elem->entry;
 }
 
 /*
@@ -666,6 +801,7 @@ FindUndoEndLocationAndSize(UndoRecPtr start_urecptr,
 	while (true)
 	{
 		UndoRecPtr	next_urecptr = InvalidUndoRecPtr;
+		UndoRecPtr	last_xact_start;
 
 		if (*end_urecptr_out != InvalidUndoRecPtr)
 		{
@@ -691,6 +827,9 @@ FindUndoEndLocationAndSize(UndoRecPtr start_urecptr,
 		/* The corresponding log must be ahead urecptr. */
 		Assert(MakeUndoRecPtr(log->logno, log->meta.insert) >= urecptr);
 
+		/* This must be read first; see UndoRecordGetNextXact. */
+		last_xact_start = UndoLogGetLastXactStartPoint(log->logno);
+
 		uur = UndoFetchRecord(urecptr,
 							  InvalidBlockNumber,
 							  InvalidOffsetNumber,
@@ -714,7 +853,7 @@ FindUndoEndLocationAndSize(UndoRecPtr start_urecptr,
 		 * log, this must include the transaction header.
 		 */
 		Assert(uur->uur_info & UREC_INFO_TRANSACTION);
-		next_urecptr = uur->uur_next;
+		next_urecptr = UndoRecordGetNextXact(urecptr, uur, last_xact_start);
 
 		/*
 		 * Case 1: If this is the last transaction in the log then calculate
@@ -826,6 +965,9 @@ static bool
 CanPushReqToUndoWorker(UndoRecPtr start_urec_ptr, UndoRecPtr end_urec_ptr,
 					   uint64 req_size)
 {
+	uint64		overflow_size = (uint64) rollback_overflow_size * 1024 * 1024;
+	bool		push;
+
 	/*
 	 * This must be called after acquring RollbackRequestLock as we will check
 	 * the binary heaps which can change.
@@ -850,40 +992,65 @@ CanPushReqToUndoWorker(UndoRecPtr start_urec_ptr, UndoRecPtr end_urec_ptr,
 	 * avoid such a race as this won't lead to any problem and OTOH, we might
 	 * need some more trickery in the code to avoid such a race condition.
 	 */
-	if (req_size >= rollback_overflow_size * 1024 * 1024 ||
-		IsDiscardProcess())
+	if (IsDiscardProcess())
+		push = true;
+	else if (rollback_policy == ROLLBACK_POLICY_ADAPTIVE &&
+			 RollbackRequests->apply_rate > 0)
 	{
-		if (GetXidQueueSize() >= ROLLBACK_REQUEST_QUEUE_SIZE ||
-			GetSizeQueueSize() >= ROLLBACK_REQUEST_QUEUE_SIZE)
-		{
-			/*
-			 * If one of the queues is full traverse both the queues and
-			 * remove dangling entries, if any.  The queue entry is considered
-			 * dangling if the hash table doesn't contain the corresponding
-			 * entry.  It can happen due to two reasons (a) we have processed
-			 * the entry from one of the queues, but not from the other. (b)
-			 * the corresponding database has been dropped due to which we
-			 * have removed the entries from hash table, but not from the
-			 * queues.  This is just a lazy cleanup, if we want we can remove
-			 * the entries from the queues when we detect that the database is
-			 * dropped and remove the corresponding entries from hash table.
-			 */
-			if (GetXidQueueSize() >= ROLLBACK_REQUEST_QUEUE_SIZE)
-				RemoveOldElemsFromXidQueue();
-			if (GetSizeQueueSize() >= ROLLBACK_REQUEST_QUEUE_SIZE)
-				RemoveOldElemsFromSizeQueue();
-		}
+		double		apply_ms = req_size / RollbackRequests->apply_rate;
 
-		if ((GetXidQueueSize() < ROLLBACK_REQUEST_QUEUE_SIZE))
-		{
-			Assert(GetSizeQueueSize() < ROLLBACK_REQUEST_QUEUE_SIZE);
+		/*
+		 * Keep the rollbacks that are estimated to be quick in the
+		 * foreground.  A slower one is pushed, unless it's below the size
+		 * threshold and the workers are already behind by more than that
+		 * much undo each, in which case the backend applying it by itself
+		 * keeps the backlog from growing without bound.
+		 */
+		push = apply_ms > rollback_foreground_latency &&
+			(req_size >= overflow_size ||
+			 RollbackRequests->pending_size <
+			 overflow_size * Max(max_undo_workers, 1));
+	}
+	else
+		push = (req_size >= overflow_size);
+
+	if (push)
+	{
+		/*
+		 * Make room in both queues before pushing the request into either,
+		 * as it must appear in both of them or neither.
+		 */
+		if (ReserveQueueElem(XID_QUEUE) && ReserveQueueElem(SIZE_QUEUE))
 			return true;
-		}
 	}
 
 	return false;
 }
 
+/*
+ * The space needed for the rollback request area to start with.
+ */
+static Size
+RollbackRequestAreaSize(void)
+{
+	Size		size;
+
+	size = dsa_minimum_size();
+	size = add_size(size, mul_size(ROLLBACK_REQUEST_QUEUE_SIZE,
+								   sizeof(UndoXidQueue)));
+	size = add_size(size, mul_size(ROLLBACK_REQUEST_QUEUE_SIZE,
+								   sizeof(UndoSizeQueue)));
+	size = add_size(size, mul_size(ROLLBACK_REQUEST_QUEUE_SIZE,
+								   sizeof(UndoErrorQueue)));
+	size = add_size(size, mul_size(UndoRollbackHashTableBuckets(),
+								   sizeof(dsa_pointer)));
+	size = add_size(size, mul_size(UndoRollbackHashTableSize(),
+								   sizeof(RollbackHashElem)));
+	size = add_size(size, ROLLBACK_REQUEST_AREA_SLOP);
+
+	return size;
+}
+
 /*
  * To return the size of the request queues and hash-table for rollbacks.
  */
@@ -892,12 +1059,8 @@ PendingUndoShmemSize(void)
 {
 	Size		size;
 
-	size = hash_estimate_size(UndoRollbackHashTableSize(), sizeof(RollbackHashEntry));
-	size = add_size(size, mul_size(MAX_UNDO_WORK_QUEUES,
-								   binaryheap_shmem_size(ROLLBACK_REQUEST_QUEUE_SIZE)));
-	size = add_size(size, UndoXidQueueElemsShmSize());
-	size = add_size(size, UndoSizeQueueElemsShmSize());
-	size = add_size(size, UndoErrorQueueElemsShmSize());
+	size = MAXALIGN(sizeof(RollbackRequestControl));
+	size = add_size(size, RollbackRequestAreaSize());
 
 	return size;
 }
@@ -909,70 +1072,55 @@ PendingUndoShmemSize(void)
 void
 PendingUndoShmemInit(void)
 {
-	HASHCTL		info;
-	bool		foundXidQueue = false;
-	bool		foundSizeQueue = false;
-	bool		foundErrorQueue = false;
-	binaryheap *bh;
-	UndoXidQueue *xid_elems;
-	UndoSizeQueue *size_elems;
-	UndoErrorQueue *error_elems;
-
-	MemSet(&info, 0, sizeof(info));
-
-	info.keysize = sizeof(TransactionId);
-	info.entrysize = sizeof(RollbackHashEntry);
-	info.hash = tag_hash;
-
-	RollbackHT = ShmemInitHash("Undo Actions Lookup Table",
-							   UndoRollbackHashTableSize(),
-							   UndoRollbackHashTableSize(), &info,
-							   HASH_ELEM | HASH_FUNCTION | HASH_FIXED_SIZE);
-
-	bh = binaryheap_allocate_shm("Undo Xid Binary Heap",
-								 ROLLBACK_REQUEST_QUEUE_SIZE,
-								 undo_age_comparator,
-								 NULL);
-
-	xid_elems = (UndoXidQueue *) ShmemInitStruct("Undo Xid Queue Elements",
-												 UndoXidQueueElemsShmSize(),
-												 &foundXidQueue);
+	bool		foundControl;
+	bool		foundArea;
 
-	Assert(foundXidQueue || !IsUnderPostmaster);
+	RollbackRequests = (RollbackRequestControl *)
+		ShmemInitStruct("Undo Rollback Requests",
+						sizeof(RollbackRequestControl), &foundControl);
+	RollbackRequestAreaSpace = ShmemInitStruct("Undo Rollback Request Area",
+											   RollbackRequestAreaSize(),
+											   &foundArea);
 
 	if (!IsUnderPostmaster)
-		memset(xid_elems, 0, sizeof(UndoXidQueue));
-
-	InitXidQueue(bh, xid_elems);
-
-	bh = binaryheap_allocate_shm("Undo Size Binary Heap",
-								 ROLLBACK_REQUEST_QUEUE_SIZE,
-								 undo_size_comparator,
-								 NULL);
-	size_elems = (UndoSizeQueue *) ShmemInitStruct("Undo Size Queue Elements",
-												   UndoSizeQueueElemsShmSize(),
-												   &foundSizeQueue);
-	Assert(foundSizeQueue || !IsUnderPostmaster);
+	{
+		dsa_area   *area;
+		int			i;
 
-	if (!IsUnderPostmaster)
-		memset(size_elems, 0, sizeof(UndoSizeQueue));
+		Assert(!foundControl && !foundArea);
 
-	InitSizeQueue(bh, size_elems);
+		area = dsa_create_in_place(RollbackRequestAreaSpace,
+								   RollbackRequestAreaSize(),
+								   LWTRANCHE_ROLLBACK_REQUESTS, NULL);
 
-	bh = binaryheap_allocate_shm("Undo Error Binary Heap",
-								 ROLLBACK_REQUEST_QUEUE_SIZE,
-								 undo_err_time_comparator,
-								 NULL);
+		RollbackRequests->nbuckets = UndoRollbackHashTableBuckets();
+		RollbackRequests->nentries = 0;
+		RollbackRequests->pending_size = 0;
+		RollbackRequests->apply_rate = 0;
+		memset(RollbackRequests->hot, 0, sizeof(RollbackRequests->hot));
+		RollbackRequests->buckets =
+			dsa_allocate0(area,
+						  RollbackRequests->nbuckets * sizeof(dsa_pointer));
 
-	error_elems = (UndoErrorQueue *) ShmemInitStruct("Undo Size Queue Elements",
-													 UndoErrorQueueElemsShmSize(),
-													 &foundErrorQueue);
-	Assert(foundErrorQueue || !IsUnderPostmaster);
+		for (i = 0; i < MAX_UNDO_WORK_QUEUES; i++)
+		{
+			UndoWorkerQueue *queue = GetQueue(i);
 
-	if (!IsUnderPostmaster)
-		memset(error_elems, 0, sizeof(UndoSizeQueue));
+			queue->size = 0;
+			queue->capacity = ROLLBACK_REQUEST_QUEUE_SIZE;
+			queue->elems = dsa_allocate(area, ROLLBACK_REQUEST_QUEUE_SIZE *
+										undo_queue_elem_size[i]);
+		}
 
-	InitErrorQueue(bh, error_elems);
+		/*
+		 * Every process attaches to the area the first time it needs it, see
+		 * AttachRollbackRequestArea.  The area is never released, as it must
+		 * survive for as long as the shared memory.
+		 */
+		dsa_detach(area);
+	}
+	else
+		Assert(foundControl && foundArea);
 }
 
 /*
@@ -993,7 +1141,8 @@ InsertRequestIntoUndoQueues(UndoRequestInfo *urinfo)
 {
 	/*
 	 * This must be called after acquring RollbackRequestLock as we will
-	 * insert into the binary heaps which can change.
+	 * insert into the binary heaps which can change, and after making room
+	 * in them, see CanPushReqToUndoWorker.
 	 */
 	Assert(LWLockHeldByMeInMode(RollbackRequestLock, LW_EXCLUSIVE));
 	PushXidQueueElem(urinfo);
@@ -1010,30 +1159,30 @@ bool
 InsertRequestIntoErrorUndoQueue(volatile UndoRequestInfo *urinfo)
 {
 	RollbackHashEntry *rh;
+	RollbackHashKey hkey;
 
-	LWLockAcquire(RollbackRequestLock, LW_EXCLUSIVE);
-
-	/* We can't insert into an error queue if it is already full. */
-	if (GetErrorQueueSize() >= ROLLBACK_REQUEST_QUEUE_SIZE)
-	{
-		int			num_removed = 0;
-
-		/* Try to remove few elements */
-		num_removed = RemoveOldElemsFromErrorQueue();
+	AttachRollbackRequestArea();
 
-		if (num_removed == 0)
-		{
-			LWLockRelease(RollbackRequestLock);
-			return false;
-		}
-	}
+	LWLockAcquire(RollbackRequestLock, LW_EXCLUSIVE);
 
 	/*
 	 * Mark the undo request in hash table as not in_progress so that undo
 	 * launcher or other undo worker don't remove the entry from queues.
 	 */
-	rh = (RollbackHashEntry *) hash_search(RollbackHT, (void *) &urinfo->full_xid,
-										   HASH_FIND, NULL);
+	hkey.full_xid = urinfo->full_xid;
+	hkey.start_urec_ptr = urinfo->start_urec_ptr;
+	rh = RollbackHTSearch(&hkey, HASH_FIND, NULL);
+
+	/*
+	 * We can't insert into an error queue if the request isn't registered,
+	 * or if the queue is full and can't be enlarged.
+	 */
+	if (!rh || !ReserveQueueElem(ERROR_QUEUE))
+	{
+		LWLockRelease(RollbackRequestLock);
+		return false;
+	}
+
 	rh->in_progress = false;
 
 	/* Insert the request into error queue for processing it later. */
@@ -1058,6 +1207,66 @@ SetUndoWorkerQueueStart(UndoWorkerQueueType undo_worker_queue)
 	cur_undo_queue = undo_worker_queue;
 }
 
+/*
+ * Find the hottest request that the caller can process, see UndoGetWork for
+ * the arguments.  The caller must hold RollbackRequestLock exclusively.
+ */
+static bool
+UndoGetHotWork(bool remove_from_queue, UndoRequestInfo *urinfo,
+			   bool *in_other_db)
+{
+	RollbackHotRequest *best = NULL;
+	RollbackHashEntry *best_rh = NULL;
+	int			i;
+
+	Assert(LWLockHeldByMeInMode(RollbackRequestLock, LW_EXCLUSIVE));
+
+	for (i = 0; i < UNDO_HOT_REQUESTS; i++)
+	{
+		RollbackHotRequest *hot = &RollbackRequests->hot[i];
+		RollbackHashEntry *rh;
+
+		if (hot->hits == 0 || (best && hot->hits <= best->hits))
+			continue;
+
+		/* Forget the requests that are processed or being processed. */
+		rh = RollbackHTSearch(&hot->key, HASH_FIND, NULL);
+		if (!rh || rh->in_progress)
+		{
+			hot->hits = 0;
+			continue;
+		}
+
+		if (remove_from_queue && MyDatabaseId != InvalidOid &&
+			MyDatabaseId != rh->dbid)
+		{
+			*in_other_db = true;
+			continue;
+		}
+
+		best = hot;
+		best_rh = rh;
+	}
+
+	if (best == NULL)
+		return false;
+
+	SetUndoRequestInfoFromRHEntry(urinfo, best_rh,
+								  cur_undo_queue % MAX_UNDO_WORK_QUEUES);
+
+	/*
+	 * The request stays in the queues, from which it's dropped once it's
+	 * found to be in progress.
+	 */
+	if (remove_from_queue)
+	{
+		best_rh->in_progress = true;
+		best->hits = 0;
+	}
+
+	return true;
+}
+
 /*
  * Get the next set of pending rollback request for undo worker.
  *
@@ -1083,9 +1292,26 @@ UndoGetWork(bool allow_peek, bool remove_from_queue, UndoRequestInfo *urinfo,
 	/* Reset the undo request info */
 	ResetUndoRequestInfo(urinfo);
 
+	AttachRollbackRequestArea();
+
 	/* Search the queues under lock as they can be modified concurrently. */
 	LWLockAcquire(RollbackRequestLock, LW_EXCLUSIVE);
 
+	/*
+	 * Requests that hold up foreground backends go first, unless we've taken
+	 * too many of them in a row.
+	 */
+	if (hot_streak < UNDO_MAX_HOT_STREAK &&
+		UndoGetHotWork(remove_from_queue, urinfo, &in_other_db))
+	{
+		if (in_other_db_out)
+			*in_other_db_out = false;
+		hot_streak++;
+		LWLockRelease(RollbackRequestLock);
+		return true;
+	}
+	hot_streak = 0;
+
 	/* Here, we check each of the work queues in a round-robin way. */
 	for (i = 0; i < MAX_UNDO_WORK_QUEUES; i++)
 	{
@@ -1099,9 +1325,7 @@ UndoGetWork(bool allow_peek, bool remove_from_queue, UndoRequestInfo *urinfo,
 			continue;
 		}
 
-		rh = (RollbackHashEntry *) hash_search(RollbackHT,
-											   (void *) &hkey,
-											   HASH_FIND, NULL);
+		rh = RollbackHTSearch(&hkey, HASH_FIND, NULL);
 
 		/*
 		 * If some undo worker is already processing the rollback request or
@@ -1213,9 +1437,7 @@ UndoGetWork(bool allow_peek, bool remove_from_queue, UndoRequestInfo *urinfo,
 				if (!GetRollbackHashKeyFromQueue(cur_queue, depth, &hkey))
 					continue;
 
-				rh = (RollbackHashEntry *) hash_search(RollbackHT,
-													   (void *) &hkey,
-													   HASH_FIND, NULL);
+				rh = RollbackHTSearch(&hkey, HASH_FIND, NULL);
 
 				/*
 				 * If some undo worker is already processing the rollback
@@ -1302,18 +1524,14 @@ RegisterRollbackReq(UndoRecPtr end_urec_ptr, UndoRecPtr start_urec_ptr,
 	Assert(UndoRecPtrIsValid(start_urec_ptr));
 	Assert(dbid != InvalidOid);
 
-	/*
-	 * There must be space to accommodate the new request.  See
-	 * UndoRollbackHashTableSize.
-	 */
-	Assert(!RollbackHTIsFull());
-
 	req_size = FindUndoEndLocationAndSize(start_urec_ptr, &end_urec_ptr, full_xid);
 
 	/* The transaction got rolled back and rewound. */
 	if (!UndoRecPtrIsValid(end_urec_ptr))
 		return false;
 
+	AttachRollbackRequestArea();
+
 	LWLockAcquire(RollbackRequestLock, LW_EXCLUSIVE);
 
 	/*
@@ -1339,8 +1557,7 @@ RegisterRollbackReq(UndoRecPtr end_urec_ptr, UndoRecPtr start_urec_ptr,
 		hkey.full_xid = full_xid;
 		hkey.start_urec_ptr = start_urec_ptr;
 
-		rh = (RollbackHashEntry *) hash_search(RollbackHT, &hkey,
-											   HASH_ENTER_NULL, &found);
+		rh = RollbackHTSearch(&hkey, HASH_ENTER_NULL, &found);
 		if (!rh)
 		{
 			LWLockRelease(RollbackRequestLock);
@@ -1354,7 +1571,9 @@ RegisterRollbackReq(UndoRecPtr end_urec_ptr, UndoRecPtr start_urec_ptr,
 			rh->end_urec_ptr = end_urec_ptr;
 			rh->dbid = dbid;
 			rh->full_xid = full_xid;
+			rh->request_size = req_size;
 			rh->in_progress = false;
+			RollbackRequests->pending_size += req_size;
 
 			if (can_push)
 			{
@@ -1415,43 +1634,118 @@ RegisterRollbackReq(UndoRecPtr end_urec_ptr, UndoRecPtr start_urec_ptr,
 }
 
 /*
- * Remove the rollback request entry from the rollback hash table.
+ * Remember that a foreground backend had to apply the undo actions of an
+ * aborted transaction to a page by itself, so that undo workers take the
+ * pending rollback requests of the transaction before anything else.  An undo
+ * worker is woken up the first time a request becomes hot, as the rest of its
+ * pages are likely to be hit by foreground backends too.
  */
 void
-RollbackHTRemoveEntry(FullTransactionId full_xid, UndoRecPtr start_urec_ptr)
+RollbackHTMarkHot(FullTransactionId full_xid)
 {
 	RollbackHashKey hkey;
+	dsa_pointer *buckets;
+	dsa_pointer elemp;
+	Oid			wakeup_dbid = InvalidOid;
+
+	if (!IsUnderPostmaster)
+		return;
+
+	AttachRollbackRequestArea();
 
 	hkey.full_xid = full_xid;
-	hkey.start_urec_ptr = start_urec_ptr;
+	hkey.start_urec_ptr = InvalidUndoRecPtr;
 
 	LWLockAcquire(RollbackRequestLock, LW_EXCLUSIVE);
 
-	hash_search(RollbackHT, &hkey, HASH_REMOVE, NULL);
+	buckets = dsa_get_address(RollbackRequestArea, RollbackRequests->buckets);
+	elemp = buckets[RollbackHTBucket(&hkey, RollbackRequests->nbuckets)];
+	while (DsaPointerIsValid(elemp))
+	{
+		RollbackHashElem *elem = dsa_get_address(RollbackRequestArea, elemp);
+		RollbackHotRequest *hot = NULL;
+		bool		matched = false;
+		int			i;
+
+		elemp = elem->next;
+
+		if (!FullTransactionIdEquals(elem->entry.full_xid, full_xid) ||
+			elem->entry.in_progress)
+			continue;
+
+		/* Count a hit, or replace the coldest entry. */
+		for (i = 0; i < UNDO_HOT_REQUESTS && !matched; i++)
+		{
+			RollbackHotRequest *cur = &RollbackRequests->hot[i];
+
+			matched = (cur->hits > 0 &&
+					   FullTransactionIdEquals(cur->key.full_xid, full_xid) &&
+					   cur->key.start_urec_ptr == elem->entry.start_urec_ptr);
+			if (matched || hot == NULL || cur->hits < hot->hits)
+				hot = cur;
+		}
+
+		if (!matched)
+		{
+			hot->key.full_xid = full_xid;
+			hot->key.start_urec_ptr = elem->entry.start_urec_ptr;
+			hot->hits = 0;
+			wakeup_dbid = elem->entry.dbid;
+		}
+		hot->hits++;
+	}
 
 	LWLockRelease(RollbackRequestLock);
+
+	if (OidIsValid(wakeup_dbid))
+		WakeupUndoWorker(wakeup_dbid);
 }
 
 /*
- * To check if the rollback requests in the hash table are all
- * completed or not. This is required because we don't not want to
- * expose RollbackHT in xact.c, where it is required to ensure
- * that we push the resuests only when there is some space in
- * the hash-table.
+ * Report that an undo worker took from start_time until now to apply a
+ * rollback request of request_size bytes, to be accounted in the apply rate
+ * that the adaptive rollback policy goes by.
  */
-bool
-RollbackHTIsFull(void)
+void
+ReportUndoApplyRate(uint64 request_size, TimestampTz start_time)
 {
-	bool		result = false;
+	TimestampTz now = GetCurrentTimestamp();
+	double		elapsed_ms = (now - start_time) / 1000.0;
+	double		rate;
 
-	LWLockAcquire(RollbackRequestLock, LW_SHARED);
+	/* Too quick to be measured with any precision. */
+	if (elapsed_ms < 1.0 || request_size == 0)
+		return;
 
-	if (hash_get_num_entries(RollbackHT) >= UndoRollbackHashTableSize())
-		result = true;
+	rate = request_size / elapsed_ms;
 
+	LWLockAcquire(RollbackRequestLock, LW_EXCLUSIVE);
+	if (RollbackRequests->apply_rate == 0)
+		RollbackRequests->apply_rate = rate;
+	else
+		RollbackRequests->apply_rate +=
+			(rate - RollbackRequests->apply_rate) / UNDO_APPLY_RATE_SMOOTHING;
 	LWLockRelease(RollbackRequestLock);
+}
 
-	return result;
+/*
+ * Remove the rollback request entry from the rollback hash table.
+ */
+void
+RollbackHTRemoveEntry(FullTransactionId full_xid, UndoRecPtr start_urec_ptr)
+{
+	RollbackHashKey hkey;
+
+	hkey.full_xid = full_xid;
+	hkey.start_urec_ptr = start_urec_ptr;
+
+	AttachRollbackRequestArea();
+
+	LWLockAcquire(RollbackRequestLock, LW_EXCLUSIVE);
+
+	RollbackHTSearch(&hkey, HASH_REMOVE, NULL);
+
+	LWLockRelease(RollbackRequestLock);
 }
 
 /*
@@ -1462,25 +1756,33 @@ RollbackHTIsFull(void)
 void
 RollbackHTCleanup(Oid dbid)
 {
-	RollbackHashEntry *rh;
-	HASH_SEQ_STATUS status;
+	dsa_pointer *buckets;
+	uint32		i;
+
+	AttachRollbackRequestArea();
 
-	/* Fetch the rollback requests */
-	LWLockAcquire(RollbackRequestLock, LW_SHARED);
+	LWLockAcquire(RollbackRequestLock, LW_EXCLUSIVE);
 
-	Assert(hash_get_num_entries(RollbackHT) <= UndoRollbackHashTableSize());
-	hash_seq_init(&status, RollbackHT);
-	while (RollbackHT != NULL &&
-		   (rh = (RollbackHashEntry *) hash_seq_search(&status)) != NULL)
+	buckets = dsa_get_address(RollbackRequestArea, RollbackRequests->buckets);
+	for (i = 0; i < RollbackRequests->nbuckets; i++)
 	{
-		if (rh->dbid == dbid)
+		dsa_pointer *link = &buckets[i];
+
+		while (DsaPointerIsValid(*link))
 		{
-			RollbackHashKey hkey;
+			RollbackHashElem *elem = dsa_get_address(RollbackRequestArea, *link);
 
-			hkey.full_xid = rh->full_xid;
-			hkey.start_urec_ptr = rh->start_urec_ptr;
+			if (elem->entry.dbid == dbid)
+			{
+				dsa_pointer elemp = *link;
 
-			hash_search(RollbackHT, &hkey, HASH_REMOVE, NULL);
+				*link = elem->next;
+				RollbackRequests->pending_size -= elem->entry.request_size;
+				dsa_free(RollbackRequestArea, elemp);
+				RollbackRequests->nentries--;
+			}
+			else
+				link = &elem->next;
 		}
 	}
 
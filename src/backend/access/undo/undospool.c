@@ -0,0 +1,343 @@
+/*-------------------------------------------------------------------------
+ *
+ * undospool.c
+ *	  spool of dead tuple TIDs harvested from discarded undo
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * src/backend/access/undo/undospool.c
+ *
+ * NOTES:
+ * When undo_spool_dead_tids is enabled, the discard worker reads all the
+ * undo records of each committed transaction before discarding its undo, and
+ * appends the TIDs of the zheap tuples that the transaction deleted, or
+ * moved away by a non-in-place update, to a spool file for the relation.
+ * VACUUM (UNDO_SPOOL) then visits only the heap blocks listed in the spool
+ * instead of scanning the whole table, so that its index passes cost in
+ * proportion to the churn of the table rather than its size.
+ *
+ * The discard worker isn't connected to any database, so the spool files
+ * are simply named after the database and relation OIDs found in the undo.
+ * The spool is only a hint: vacuum still prunes each page it lists and only
+ * removes the items it finds dead, and a dead tuple missing from the spool,
+ * e.g. because its file was full or couldn't be written, is left to the next
+ * regular vacuum.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "access/rmgr.h"
+#include "access/undoinsert.h"
+#include "access/undorecord.h"
+#include "access/undospool.h"
+#include "pgstat.h"
+#include "storage/fd.h"
+#include "storage/itemptr.h"
+
+/* Number of TIDs collected before they are written out. */
+#define UNDO_SPOOL_BATCH_SIZE	8192
+
+typedef struct UndoSpoolItem
+{
+	Oid			reloid;
+	ItemPointerData tid;
+} UndoSpoolItem;
+
+/* GUC: whether the discard worker harvests dead tuple TIDs. */
+bool		undo_spool_dead_tids = false;
+
+static void UndoSpoolFlush(Oid dbid, UndoSpoolItem *items, int nitems);
+static void UndoSpoolAppend(Oid dbid, Oid reloid, ItemPointerData *tids,
+							int ntids);
+
+/*
+ * Construct the path of the spool file for the given relation.
+ */
+static void
+UndoSpoolFilePath(char *path, Oid dbid, Oid reloid)
+{
+	snprintf(path, MAXPGPATH, "%s/%u_%u", UNDO_SPOOL_DIR, dbid, reloid);
+}
+
+/*
+ * qsort comparator for UndoSpoolItem, by relation and TID.
+ */
+static int
+undo_spool_item_cmp(const void *a, const void *b)
+{
+	const UndoSpoolItem *ia = (const UndoSpoolItem *) a;
+	const UndoSpoolItem *ib = (const UndoSpoolItem *) b;
+
+	if (ia->reloid != ib->reloid)
+		return (ia->reloid < ib->reloid) ? -1 : 1;
+
+	return ItemPointerCompare((ItemPointer) &ia->tid, (ItemPointer) &ib->tid);
+}
+
+/*
+ * qsort comparator for BlockNumber.
+ */
+static int
+undo_spool_block_cmp(const void *a, const void *b)
+{
+	BlockNumber ba = *(const BlockNumber *) a;
+	BlockNumber bb = *(const BlockNumber *) b;
+
+	if (ba == bb)
+		return 0;
+	return (ba < bb) ? -1 : 1;
+}
+
+/*
+ * Harvest the dead tuple TIDs of a committed transaction into the spool.
+ *
+ * start and end are the first and the last undo record of the transaction
+ * in one undo log; the records are read from end back to start, which the
+ * caller must have kept from being discarded.  dbid is the database of the
+ * transaction.
+ */
+void
+UndoSpoolHarvest(Oid dbid, UndoRecPtr start, UndoRecPtr end)
+{
+	UndoSpoolItem *items;
+	UndoRecPtr	urp = end;
+	int			nitems = 0;
+
+	Assert(UndoRecPtrGetLogNo(start) == UndoRecPtrGetLogNo(end));
+
+	items = palloc(sizeof(UndoSpoolItem) * UNDO_SPOOL_BATCH_SIZE);
+
+	for (;;)
+	{
+		UnpackedUndoRecord *uur;
+		bool		xact_header;
+
+		uur = UndoFetchRecord(urp, InvalidBlockNumber, InvalidOffsetNumber,
+							  InvalidTransactionId, NULL, NULL);
+		if (uur == NULL)
+			break;
+
+		if (uur->uur_rmid == RM_ZHEAP_ID &&
+			(uur->uur_type == UNDO_DELETE || uur->uur_type == UNDO_UPDATE))
+		{
+			items[nitems].reloid = uur->uur_reloid;
+			ItemPointerSet(&items[nitems].tid, uur->uur_block,
+						   uur->uur_offset);
+			if (++nitems == UNDO_SPOOL_BATCH_SIZE)
+			{
+				UndoSpoolFlush(dbid, items, nitems);
+				nitems = 0;
+			}
+		}
+
+		xact_header = (uur->uur_info & UREC_INFO_TRANSACTION) != 0;
+		UndoRecordRelease(uur);
+
+		/* The first record of the transaction in this log carries its header. */
+		if (urp == start || xact_header)
+			break;
+
+		urp = UndoGetPrevUndoRecptr(urp, InvalidUndoRecPtr, NULL);
+	}
+
+	if (nitems > 0)
+		UndoSpoolFlush(dbid, items, nitems);
+
+	pfree(items);
+}
+
+/*
+ * Write out the collected TIDs, one append per relation.
+ */
+static void
+UndoSpoolFlush(Oid dbid, UndoSpoolItem *items, int nitems)
+{
+	ItemPointerData *tids;
+	int			ntids = 0;
+	int			i;
+
+	qsort(items, nitems, sizeof(UndoSpoolItem), undo_spool_item_cmp);
+
+	tids = palloc(sizeof(ItemPointerData) * nitems);
+
+	for (i = 0; i < nitems; i++)
+	{
+		/* A tuple can be updated and deleted again in the same transaction. */
+		if (ntids > 0 && items[i].reloid == items[i - 1].reloid &&
+			ItemPointerEquals(&items[i].tid, &items[i - 1].tid))
+			continue;
+
+		tids[ntids++] = items[i].tid;
+
+		if (i == nitems - 1 || items[i + 1].reloid != items[i].reloid)
+		{
+			UndoSpoolAppend(dbid, items[i].reloid, tids, ntids);
+			ntids = 0;
+		}
+	}
+
+	pfree(tids);
+}
+
+/*
+ * Append TIDs to the spool file of a relation, creating it if needed.
+ *
+ * This runs in the discard worker, which must not be held up by a spool it
+ * can't write, so failures are only logged.  All the TIDs are written with a
+ * single write() to a file opened in append mode, so that concurrent discard
+ * workers don't interleave partial entries.
+ */
+static void
+UndoSpoolAppend(Oid dbid, Oid reloid, ItemPointerData *tids, int ntids)
+{
+	char		path[MAXPGPATH];
+	int			len = sizeof(ItemPointerData) * ntids;
+	off_t		size;
+	int			fd;
+
+	UndoSpoolFilePath(path, dbid, reloid);
+
+	fd = OpenTransientFile(path, O_WRONLY | O_CREAT | O_APPEND | PG_BINARY);
+	if (fd < 0 && errno == ENOENT)
+	{
+		if (MakePGDirectory(UNDO_SPOOL_DIR) < 0 && errno != EEXIST)
+		{
+			ereport(LOG,
+					(errcode_for_file_access(),
+					 errmsg("could not create directory \"%s\": %m",
+							UNDO_SPOOL_DIR)));
+			return;
+		}
+		fd = OpenTransientFile(path, O_WRONLY | O_CREAT | O_APPEND | PG_BINARY);
+	}
+	if (fd < 0)
+	{
+		ereport(LOG,
+				(errcode_for_file_access(),
+				 errmsg("could not open file \"%s\": %m", path)));
+		return;
+	}
+
+	size = lseek(fd, 0, SEEK_END);
+	if (size >= 0 && size + len <= UNDO_SPOOL_MAX_FILE_SIZE)
+	{
+		errno = 0;
+		pgstat_report_wait_start(WAIT_EVENT_UNDO_SPOOL_WRITE);
+		if (write(fd, tids, len) != len)
+		{
+			/* if write didn't set errno, assume problem is no disk space */
+			if (errno == 0)
+				errno = ENOSPC;
+			ereport(LOG,
+					(errcode_for_file_access(),
+					 errmsg("could not write to file \"%s\": %m", path)));
+		}
+		pgstat_report_wait_end();
+	}
+
+	CloseTransientFile(fd);
+}
+
+/*
+ * Consume the spool of a relation.
+ *
+ * The spool file is removed, and the distinct heap blocks it mentions that
+ * lie in [minblock, maxblock) are returned in ascending order, their number
+ * in *nblocks.  An empty array is returned if there is no spool.
+ *
+ * The file is renamed away before it's read, so that TIDs the discard
+ * worker harvests meanwhile go to a new spool, to be consumed by the next
+ * vacuum.
+ */
+BlockNumber *
+UndoSpoolReadBlocks(Oid dbid, Oid relid, BlockNumber minblock,
+					BlockNumber maxblock, int *nblocks)
+{
+	char		path[MAXPGPATH];
+	char		tmppath[MAXPGPATH];
+	ItemPointerData *tids;
+	BlockNumber *blocks;
+	struct stat st;
+	int			ntids;
+	int			len;
+	int			fd;
+	int			i;
+	int			n = 0;
+
+	*nblocks = 0;
+
+	UndoSpoolFilePath(path, dbid, relid);
+	snprintf(tmppath, MAXPGPATH, "%s.vacuum", path);
+
+	if (rename(path, tmppath) < 0)
+	{
+		if (errno != ENOENT)
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not rename file \"%s\" to \"%s\": %m",
+							path, tmppath)));
+		return palloc(sizeof(BlockNumber));
+	}
+
+	fd = OpenTransientFile(tmppath, O_RDONLY | PG_BINARY);
+	if (fd < 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not open file \"%s\": %m", tmppath)));
+	if (fstat(fd, &st) < 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not stat file \"%s\": %m", tmppath)));
+
+	/* Ignore a torn entry at the end, if any. */
+	ntids = Min(st.st_size, UNDO_SPOOL_MAX_FILE_SIZE) / sizeof(ItemPointerData);
+	len = ntids * sizeof(ItemPointerData);
+	tids = palloc(Max(len, sizeof(ItemPointerData)));
+
+	pgstat_report_wait_start(WAIT_EVENT_UNDO_SPOOL_READ);
+	if (read(fd, tids, len) != len)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not read file \"%s\": %m", tmppath)));
+	pgstat_report_wait_end();
+
+	CloseTransientFile(fd);
+
+	if (unlink(tmppath) < 0)
+		ereport(WARNING,
+				(errcode_for_file_access(),
+				 errmsg("could not remove file \"%s\": %m", tmppath)));
+
+	blocks = palloc(sizeof(BlockNumber) * Max(ntids, 1));
+	for (i = 0; i < ntids; i++)
+	{
+		BlockNumber blkno = ItemPointerGetBlockNumberNoCheck(&tids[i]);
+
+		if (blkno >= minblock && blkno < maxblock)
+			blocks[n++] = blkno;
+	}
+	pfree(tids);
+
+	if (n > 1)
+	{
+		int			j = 0;
+
+		qsort(blocks, n, sizeof(BlockNumber), undo_spool_block_cmp);
+		for (i = 1; i < n; i++)
+		{
+			if (blocks[i] != blocks[j])
+				blocks[++j] = blocks[i];
+		}
+		n = j + 1;
+	}
+
+	*nblocks = n;
+
+	return blocks;
+}
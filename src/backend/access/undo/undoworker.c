@@ -20,6 +20,27 @@
  * less than undo_worker_quantum ms after starting.  Also, if there is no
  * work, it lingers for UNDO_WORKER_LINGER_MS.  This avoids restarting
  * the workers too frequently.
+ *
+ * The workers connected to a database form its pool.  When there is work for
+ * a database, a lingering worker of its pool is woken up to take it, and a
+ * new worker is only started if none of them is idle.  A worker that only
+ * sees work for other databases keeps lingering as long as there are free
+ * worker slots, since the launcher can start workers for those databases
+ * without it; it only steps aside for them once all the slots are taken.
+ * Likewise, a lingering worker is only stopped to make room for another
+ * database when no slot is free.  The first undo_worker_min_per_database
+ * workers of a database keep lingering however long they have been idle, so
+ * that its rollbacks don't have to wait for a new backend to start.
+ *
+ * A worker that picks a request bigger than undo_parallel_apply_size becomes
+ * the leader of a parallel apply: it splits the blocks touched by the
+ * transaction into partitions (see execute_undo_actions_parallel) and asks
+ * the launcher for helper workers.  Each participant claims one partition at
+ * a time and applies the undo actions of those blocks only.  Once the leader
+ * is done with its own partition it claims whatever is left, waits for the
+ * helpers to finish, and only then marks the undo actions of the transaction
+ * as applied.  If any participant fails, the whole request goes to the error
+ * queue, which is safe as applying undo actions again is harmless.
  *-------------------------------------------------------------------------
  */
 
@@ -69,6 +90,18 @@ int			max_undo_workers = 5;
  */
 int			undo_worker_quantum_ms = 10000;
 
+/*
+ * Rollback requests of more than undo_parallel_apply_size MB are applied by
+ * several undo workers.
+ */
+int			undo_parallel_apply_size = 1024;
+
+/*
+ * Number of idle undo workers a database keeps, once they have been started,
+ * instead of letting them exit after UNDO_WORKER_LINGER_MS.
+ */
+int			undo_worker_min_per_database = 0;
+
 /* max sleep time between cycles (100 milliseconds) */
 #define DEFAULT_NAPTIME_PER_CYCLE 100L
 
@@ -83,6 +116,31 @@ static volatile sig_atomic_t got_SIGHUP = false;
 static volatile sig_atomic_t got_SIGTERM = false;
 static TimestampTz last_xact_processed_at;
 
+/*
+ * State of a rollback request applied by several undo workers, kept in the
+ * slot of the leader.  A zero nparts means that the worker is not leading a
+ * parallel apply.
+ */
+typedef struct UndoParallelApply
+{
+	FullTransactionId full_xid;
+	UndoRecPtr	start_urec_ptr;
+	UndoRecPtr	end_urec_ptr;
+
+	/* Number of partitions the blocks of the transaction are split into. */
+	int			nparts;
+
+	/* Number of helpers the launcher should still start. */
+	int			nhelpers;
+
+	/* Partitions claimed by some participant, and those finished. */
+	uint32		claimed_parts;
+	uint32		done_parts;
+
+	/* Set if any participant failed to apply its partitions. */
+	bool		failed;
+} UndoParallelApply;
+
 typedef struct UndoApplyWorker
 {
 	/* Indicates if this slot is used or free. */
@@ -100,11 +158,28 @@ typedef struct UndoApplyWorker
 	/* this tells whether worker is lingering. */
 	bool		lingering;
 
+	/*
+	 * Set while the worker lingers as one of the undo_worker_min_per_database
+	 * workers of its database.
+	 */
+	bool		reserved;
+
 	/*
 	 * This tells the undo worker from which undo worker queue it should start
 	 * processing.
 	 */
 	UndoWorkerQueueType undo_worker_queue;
+
+	/*
+	 * Slot and generation of the leader this worker helps with a parallel
+	 * apply, or -1, along with the partitions it is applying.
+	 */
+	int			parallel_leader;
+	uint16		parallel_leader_generation;
+	uint32		parallel_parts;
+
+	/* Parallel apply led by this worker. */
+	UndoParallelApply parallel;
 }			UndoApplyWorker;
 
 UndoApplyWorker *MyUndoWorker = NULL;
@@ -125,9 +200,12 @@ UndoApplyCtxStruct *UndoApplyCtx;
 
 static void UndoWorkerOnExit(int code, Datum arg);
 static void UndoWorkerCleanup(UndoApplyWorker * worker);
-static void UndoWorkerIsLingering(bool sleep);
-static void UndoWorkerGetSlotInfo(int slot, UndoRequestInfo *urinfo);
+static bool UndoWorkerIsLingering(bool sleep);
+static void UndoWorkerGetSlotInfo(int slot, UndoRequestInfo *urinfo,
+								  int *parallel_leader);
 static void UndoworkerSigtermHandler(SIGNAL_ARGS);
+static bool UndoWorkerEndParallelApply(bool failed);
+static void UndoWorkerLeadParallelApply(UndoRequestInfo *urinfo);
 
 /*
  * Cleanup function for undo worker launcher.
@@ -291,20 +369,102 @@ IsUndoWorkerAvailable(void)
 	return (alive_workers < max_undo_workers);
 }
 
-static void
+/*
+ * Mark this worker as lingering or not.
+ *
+ * Returns true, if the worker lingers as one of the first
+ * undo_worker_min_per_database workers of its database, in which case it
+ * should not exit for lack of work.
+ */
+static bool
 UndoWorkerIsLingering(bool sleep)
 {
+	bool		reserved = false;
+
 	/* Block concurrent access. */
 	LWLockAcquire(UndoWorkerLock, LW_EXCLUSIVE);
 
 	MyUndoWorker->lingering = sleep;
 
+	if (sleep && undo_worker_min_per_database > 0)
+	{
+		int			nworkers = 0;
+		int			i;
+
+		/* Count the workers of our database in the slots before ours. */
+		for (i = 0; &UndoApplyCtx->workers[i] != MyUndoWorker; i++)
+		{
+			UndoApplyWorker *w = &UndoApplyCtx->workers[i];
+
+			if (w->in_use && w->dbid == MyUndoWorker->dbid &&
+				w->parallel_leader < 0)
+				nworkers++;
+		}
+
+		reserved = (nworkers < undo_worker_min_per_database);
+	}
+	MyUndoWorker->reserved = reserved;
+
 	LWLockRelease(UndoWorkerLock);
+
+	return reserved;
+}
+
+/*
+ * Wake up a lingering worker connected to the given database, if any.
+ *
+ * Returns true, if one was woken.  Otherwise, *free_slot is set if a new
+ * worker can be started, and if all the slots are taken, one lingering worker
+ * of another database is stopped to make room, preferring one that isn't
+ * kept by undo_worker_min_per_database.
+ *
+ * The caller must hold UndoWorkerLock exclusively.
+ */
+static bool
+UndoWorkerWakeupInDatabase(Oid dbid, bool *free_slot)
+{
+	UndoApplyWorker *victim = NULL;
+	int			i;
+
+	Assert(LWLockHeldByMeInMode(UndoWorkerLock, LW_EXCLUSIVE));
+
+	*free_slot = false;
+
+	for (i = 0; i < max_undo_workers; i++)
+	{
+		UndoApplyWorker *w = &UndoApplyCtx->workers[i];
+
+		if (!w->in_use)
+		{
+			*free_slot = true;
+			continue;
+		}
+
+		if (!w->lingering)
+			continue;
+
+		if (w->dbid == dbid)
+		{
+			SetLatch(&w->proc->procLatch);
+			return true;
+		}
+
+		if (victim == NULL || (victim->reserved && !w->reserved))
+			victim = w;
+	}
+
+	if (!*free_slot && victim != NULL)
+		kill(victim->proc->pid, SIGTERM);
+
+	return false;
 }
 
-/* Get the dbid and undo worker queue set by the undo launcher. */
+/*
+ * Get the dbid and undo worker queue set by the undo launcher, and the
+ * leader to help, if we were started for a parallel apply.
+ */
 static void
-UndoWorkerGetSlotInfo(int slot, UndoRequestInfo *urinfo)
+UndoWorkerGetSlotInfo(int slot, UndoRequestInfo *urinfo, int *parallel_leader)
 {
 	/* Block concurrent access. */
 	LWLockAcquire(UndoWorkerLock, LW_EXCLUSIVE);
@@ -322,15 +482,19 @@ UndoWorkerGetSlotInfo(int slot, UndoRequestInfo *urinfo)
 
 	urinfo->dbid = MyUndoWorker->dbid;
 	urinfo->undo_worker_queue = MyUndoWorker->undo_worker_queue;
+	*parallel_leader = MyUndoWorker->parallel_leader;
 
 	LWLockRelease(UndoWorkerLock);
 }
 
 /*
  * Start new undo apply background worker, if possible otherwise return false.
+ *
+ * parallel_leader is the slot of the worker the new worker should help with
+ * a parallel apply, or -1 to have it process the requests for urinfo.dbid.
  */
 static bool
-UndoWorkerLaunch(UndoRequestInfo urinfo)
+UndoWorkerLaunch(UndoRequestInfo urinfo, int parallel_leader)
 {
 	BackgroundWorker bgw;
 	BackgroundWorkerHandle *bgw_handle;
@@ -366,7 +530,14 @@ UndoWorkerLaunch(UndoRequestInfo urinfo)
 	worker->proc = NULL;
 	worker->dbid = urinfo.dbid;
 	worker->lingering = false;
+	worker->reserved = false;
 	worker->undo_worker_queue = urinfo.undo_worker_queue;
+	worker->parallel_leader = parallel_leader;
+	worker->parallel_leader_generation = 0;
+	if (parallel_leader >= 0)
+		worker->parallel_leader_generation =
+			UndoApplyCtx->workers[parallel_leader].generation;
+	worker->parallel_parts = 0;
 	worker->generation++;
 
 	generation = worker->generation;
@@ -428,7 +599,11 @@ UndoWorkerCleanup(UndoApplyWorker * worker)
 	worker->proc = NULL;
 	worker->dbid = InvalidOid;
 	worker->lingering = false;
+	worker->reserved = false;
 	worker->undo_worker_queue = InvalidUndoWorkerQueue;
+	worker->parallel_leader = -1;
+	worker->parallel_parts = 0;
+	memset(&worker->parallel, 0, sizeof(UndoParallelApply));
 }
 
 /*
@@ -439,9 +614,305 @@ UndoWorkerCleanup(UndoApplyWorker * worker)
 static void
 UndoWorkerOnExit(int code, Datum arg)
 {
+	/* Block concurrent access. */
+	LWLockAcquire(UndoWorkerLock, LW_EXCLUSIVE);
+
+	/*
+	 * If we exit while helping with a parallel apply, let the leader know
+	 * that our partitions could not be applied, so that it doesn't wait for
+	 * us forever.
+	 */
+	if (MyUndoWorker->parallel_parts != 0)
+	{
+		UndoApplyWorker *leader =
+		&UndoApplyCtx->workers[MyUndoWorker->parallel_leader];
+
+		if (leader->generation == MyUndoWorker->parallel_leader_generation &&
+			leader->parallel.nparts > 0)
+		{
+			leader->parallel.done_parts |= MyUndoWorker->parallel_parts;
+			leader->parallel.failed = true;
+			if (leader->proc)
+				SetLatch(&leader->proc->procLatch);
+		}
+	}
+
+	LWLockRelease(UndoWorkerLock);
+
 	UndoWorkerDetach();
 }
 
+/*
+ * Wait until all the claimed partitions of the parallel apply we lead are
+ * done, then reset its shared state.  If failed is set, we're bailing out
+ * because of an error, so no more helpers should be started.
+ *
+ * Returns true, if any participant has failed.
+ */
+static bool
+UndoWorkerEndParallelApply(bool failed)
+{
+	UndoParallelApply *papply = &MyUndoWorker->parallel;
+
+	for (;;)
+	{
+		int			rc;
+
+		LWLockAcquire(UndoWorkerLock, LW_EXCLUSIVE);
+		if (failed)
+		{
+			papply->nhelpers = 0;
+			papply->failed = true;
+		}
+		if (papply->done_parts == papply->claimed_parts)
+		{
+			failed = papply->failed;
+			memset(papply, 0, sizeof(UndoParallelApply));
+			LWLockRelease(UndoWorkerLock);
+			break;
+		}
+		LWLockRelease(UndoWorkerLock);
+
+		rc = WaitLatch(MyLatch,
+					   WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+					   DEFAULT_NAPTIME_PER_CYCLE,
+					   WAIT_EVENT_UNDO_WORKER_MAIN);
+
+		/* emergency bailout if postmaster has died */
+		if (rc & WL_POSTMASTER_DEATH)
+			proc_exit(1);
+
+		if (rc & WL_LATCH_SET)
+			ResetLatch(MyLatch);
+	}
+
+	return failed;
+}
+
+/*
+ * Apply the undo actions of a large rollback request together with helper
+ * workers started by the launcher.
+ *
+ * We apply the first partition ourselves; it also contains the undo records
+ * which are not for a particular block.  Afterwards, we take over all the
+ * partitions no helper has claimed so far, so that the apply never waits for
+ * helpers that could not be started.
+ */
+static void
+UndoWorkerLeadParallelApply(UndoRequestInfo *urinfo)
+{
+	UndoParallelApply *papply = &MyUndoWorker->parallel;
+	uint32		all_parts;
+	uint32		remaining;
+	int			nparts;
+
+	nparts = Min(max_undo_workers, UNDO_APPLY_MAX_PARTITIONS);
+	all_parts = (nparts == 32) ? PG_UINT32_MAX : ((1U << nparts) - 1);
+
+	LWLockAcquire(UndoWorkerLock, LW_EXCLUSIVE);
+	papply->full_xid = urinfo->full_xid;
+	papply->start_urec_ptr = urinfo->start_urec_ptr;
+	papply->end_urec_ptr = urinfo->end_urec_ptr;
+	papply->nparts = nparts;
+	papply->nhelpers = nparts - 1;
+	papply->claimed_parts = 1;
+	papply->done_parts = 0;
+	papply->failed = false;
+	if (UndoApplyCtx->undo_launcher_latch)
+		SetLatch(UndoApplyCtx->undo_launcher_latch);
+	LWLockRelease(UndoWorkerLock);
+
+	if (!execute_undo_actions_parallel(urinfo->full_xid, urinfo->end_urec_ptr,
+									   urinfo->start_urec_ptr, nparts, 1))
+	{
+		/* Already applied, so tell the helpers there's nothing to do. */
+		UndoWorkerEndParallelApply(true);
+		return;
+	}
+
+	LWLockAcquire(UndoWorkerLock, LW_EXCLUSIVE);
+	papply->done_parts |= 1;
+	papply->nhelpers = 0;
+	remaining = all_parts & ~papply->claimed_parts;
+	papply->claimed_parts |= remaining;
+	LWLockRelease(UndoWorkerLock);
+
+	if (remaining != 0)
+	{
+		execute_undo_actions_parallel(urinfo->full_xid, urinfo->end_urec_ptr,
+									  urinfo->start_urec_ptr, nparts,
+									  remaining);
+
+		LWLockAcquire(UndoWorkerLock, LW_EXCLUSIVE);
+		papply->done_parts |= remaining;
+		LWLockRelease(UndoWorkerLock);
+	}
+
+	/*
+	 * The progress in the transaction header can only be updated once every
+	 * block has been rolled back.
+	 */
+	if (UndoWorkerEndParallelApply(false))
+		ereport(ERROR,
+				(errmsg("could not apply undo actions of transaction " UINT64_FORMAT " in parallel",
+						U64FromFullTransactionId(urinfo->full_xid))));
+
+	execute_undo_actions_finish(urinfo->full_xid, urinfo->start_urec_ptr);
+}
+
+/*
+ * Help the leader in the given slot with its parallel apply, claiming and
+ * applying one partition at a time until none is left.
+ */
+static void
+UndoWorkerHelpParallelApply(int leader_slot)
+{
+	UndoApplyWorker *leader = &UndoApplyCtx->workers[leader_slot];
+
+	for (;;)
+	{
+		UndoParallelApply papply;
+		uint32		part = 0;
+		bool		error = false;
+		int			i;
+
+		LWLockAcquire(UndoWorkerLock, LW_EXCLUSIVE);
+
+		/* Has the leader moved on? */
+		if (leader->generation != MyUndoWorker->parallel_leader_generation ||
+			leader->parallel.nparts == 0 || leader->parallel.failed)
+		{
+			LWLockRelease(UndoWorkerLock);
+			break;
+		}
+
+		for (i = 0; i < leader->parallel.nparts; i++)
+		{
+			if ((leader->parallel.claimed_parts & (1U << i)) == 0)
+			{
+				part = 1U << i;
+				break;
+			}
+		}
+		if (part == 0)
+		{
+			LWLockRelease(UndoWorkerLock);
+			break;
+		}
+
+		leader->parallel.claimed_parts |= part;
+		MyUndoWorker->parallel_parts = part;
+		papply = leader->parallel;
+		LWLockRelease(UndoWorkerLock);
+
+		StartTransactionCommand();
+		PG_TRY();
+		{
+			execute_undo_actions_parallel(papply.full_xid,
+										  papply.end_urec_ptr,
+										  papply.start_urec_ptr,
+										  papply.nparts, part);
+		}
+		PG_CATCH();
+		{
+			error = true;
+
+			/* Prevent interrupts while cleaning up. */
+			HOLD_INTERRUPTS();
+
+			/* Send the error only to server log. */
+			err_out_to_client(false);
+			EmitErrorReport();
+
+			AbortOutOfAnyTransaction();
+			FlushErrorState();
+
+			RESUME_INTERRUPTS();
+		}
+		PG_END_TRY();
+
+		if (!error)
+			CommitTransactionCommand();
+
+		/*
+		 * The leader waits for all the claimed partitions, so it can only
+		 * have moved on in the meantime if it has exited.
+		 */
+		LWLockAcquire(UndoWorkerLock, LW_EXCLUSIVE);
+		if (leader->generation == MyUndoWorker->parallel_leader_generation &&
+			leader->parallel.nparts > 0)
+		{
+			leader->parallel.done_parts |= part;
+			if (error)
+				leader->parallel.failed = true;
+			if (leader->proc)
+				SetLatch(&leader->proc->procLatch);
+		}
+		MyUndoWorker->parallel_parts = 0;
+		LWLockRelease(UndoWorkerLock);
+	}
+
+	LWLockAcquire(UndoWorkerLock, LW_EXCLUSIVE);
+	MyUndoWorker->parallel_leader = -1;
+	LWLockRelease(UndoWorkerLock);
+}
+
+/*
+ * Start the helper workers requested by the leaders of parallel applies, as
+ * long as there are free worker slots.
+ */
+static void
+UndoLauncherStartHelpers(void)
+{
+	int			i;
+
+	for (i = 0; i < max_undo_workers; i++)
+	{
+		UndoApplyWorker *w = &UndoApplyCtx->workers[i];
+		UndoRequestInfo urinfo;
+		bool		wanted;
+
+		LWLockAcquire(UndoWorkerLock, LW_EXCLUSIVE);
+		wanted = (w->in_use && w->parallel.nhelpers > 0);
+		if (wanted)
+		{
+			w->parallel.nhelpers--;
+			ResetUndoRequestInfo(&urinfo);
+			urinfo.dbid = w->dbid;
+		}
+		LWLockRelease(UndoWorkerLock);
+
+		if (!wanted)
+			continue;
+
+		if (!IsUndoWorkerAvailable() || !UndoWorkerLaunch(urinfo, i))
+			break;
+
+		/* The leader may want more than one. */
+		i--;
+	}
+}
+
+/*
+ * Find a worker for a pending request.
+ *
+ * A lingering worker already connected to the database of the request takes
+ * it, if there is one; otherwise we start a new worker, if a slot is free.
+ */
+static void
+UndoLauncherAssignRequest(UndoRequestInfo *urinfo)
+{
+	bool		woken;
+	bool		free_slot;
+
+	LWLockAcquire(UndoWorkerLock, LW_EXCLUSIVE);
+	woken = UndoWorkerWakeupInDatabase(urinfo->dbid, &free_slot);
+	LWLockRelease(UndoWorkerLock);
+
+	if (!woken && free_slot)
+		UndoWorkerLaunch(*urinfo, -1);
+}
+
 /*
  * Perform rollback request.  We need to connect to the database for first
  * request and that is required because we access system tables while
@@ -458,8 +929,17 @@ UndoWorkerPerformRequest(UndoRequestInfo *urinfo)
 	StartTransactionCommand();
 	PG_TRY();
 	{
-		execute_undo_actions(urinfo->full_xid, urinfo->end_urec_ptr,
-							 urinfo->start_urec_ptr, true);
+		if (undo_parallel_apply_size > 0 && max_undo_workers > 1 &&
+			urinfo->request_size >= (uint64) undo_parallel_apply_size * 1024 * 1024)
+			UndoWorkerLeadParallelApply(urinfo);
+		else
+		{
+			TimestampTz start_time = GetCurrentTimestamp();
+
+			execute_undo_actions(urinfo->full_xid, urinfo->end_urec_ptr,
+								 urinfo->start_urec_ptr, true);
+			ReportUndoApplyRate(urinfo->request_size, start_time);
+		}
 	}
 	PG_CATCH();
 	{
@@ -469,7 +949,7 @@ UndoWorkerPerformRequest(UndoRequestInfo *urinfo)
 		 * Register the unprocessed request in an error queue, so that it can
 		 * be processed in a timely fashion.
 		 */
-		if (InsertRequestIntoErrorUndoQueue(urinfo))
+		if (!InsertRequestIntoErrorUndoQueue(urinfo))
 			RollbackHTRemoveEntry(urinfo->full_xid, urinfo->start_urec_ptr);
 
 		/* Prevent interrupts while cleaning up. */
@@ -487,6 +967,14 @@ UndoWorkerPerformRequest(UndoRequestInfo *urinfo)
 		FlushErrorState();
 
 		RESUME_INTERRUPTS();
+
+		/*
+		 * Let the helpers finish before we forget about the parallel apply.
+		 * This must wait until we have released our locks, as the helpers
+		 * might need them.
+		 */
+		if (MyUndoWorker->parallel.nparts > 0)
+			UndoWorkerEndParallelApply(true);
 	}
 	PG_END_TRY();
 
@@ -528,7 +1016,13 @@ UndoLauncherShmemInit(void)
 						&found);
 
 	if (!found)
+	{
+		int			i;
+
 		memset(UndoApplyCtx, 0, UndoLauncherShmemSize());
+		for (i = 0; i < max_undo_workers; i++)
+			UndoApplyCtx->workers[i].parallel_leader = -1;
+	}
 }
 
 /*
@@ -599,9 +1093,11 @@ UndoLauncherMain(Datum main_arg)
 
 		ResetUndoRequestInfo(&urinfo);
 
-		if (UndoGetWork(false, false, &urinfo, NULL) &&
-			IsUndoWorkerAvailable())
-			UndoWorkerLaunch(urinfo);
+		/* Helpers for parallel applies take precedence over new requests. */
+		UndoLauncherStartHelpers();
+
+		if (UndoGetWork(false, false, &urinfo, NULL))
+			UndoLauncherAssignRequest(&urinfo);
 
 		/* Wait for more work. */
 		rc = WaitLatch(MyLatch,
@@ -643,6 +1139,7 @@ UndoWorkerMain(Datum main_arg)
 	int			worker_slot = DatumGetInt32(main_arg);
 	bool		in_other_db;
 	bool		found_work;
+	int			parallel_leader;
 	TimestampTz started_at;
 
 	/* Setup signal handling */
@@ -657,7 +1154,7 @@ UndoWorkerMain(Datum main_arg)
 	 * request queue from which the worker should start looking for an undo
 	 * request.
 	 */
-	UndoWorkerGetSlotInfo(worker_slot, &urinfo);
+	UndoWorkerGetSlotInfo(worker_slot, &urinfo, &parallel_leader);
 
 	/* Connect to the requested database. */
 	BackgroundWorkerInitializeConnectionByOid(urinfo.dbid, 0, 0);
@@ -674,14 +1171,23 @@ UndoWorkerMain(Datum main_arg)
 	 * undo launcher from launching multiple workers for the same request.
 	 * But, it's possible that the undo request has already been processed by
 	 * other in-progress undo worker.  In that case, we enter the undo worker
-	 * main loop and fetch the next request.
+	 * main loop and fetch the next request.  A helper of a parallel apply
+	 * wasn't started for any request, so it just attaches and helps.
 	 */
-	found_work = UndoGetWork(false, true, &urinfo, &in_other_db);
+	if (parallel_leader >= 0)
+		found_work = false;
+	else
+		found_work = UndoGetWork(false, true, &urinfo, &in_other_db);
 
 	/* Attach to slot */
 	UndoWorkerAttach(worker_slot);
 
-	if (found_work && !in_other_db)
+	if (parallel_leader >= 0)
+	{
+		UndoWorkerHelpParallelApply(parallel_leader);
+		last_xact_processed_at = GetCurrentTimestamp();
+	}
+	else if (found_work && !in_other_db)
 	{
 		/* We must have got the pending undo request. */
 		Assert(FullTransactionIdIsValid(urinfo.full_xid));
@@ -693,18 +1199,25 @@ UndoWorkerMain(Datum main_arg)
 	{
 		int			rc;
 		bool		allow_peek;
+		bool		slot_available;
 
-		allow_peek = !TimestampDifferenceExceeds(started_at,
-												 GetCurrentTimestamp(),
-												 undo_worker_quantum_ms);
+		/*
+		 * As long as workers can be started for other databases, there's no
+		 * reason to yield to them, so look for work of our database deeper
+		 * in the queues.
+		 */
+		slot_available = IsUndoWorkerAvailable();
+		allow_peek = slot_available ||
+			!TimestampDifferenceExceeds(started_at, GetCurrentTimestamp(),
+										undo_worker_quantum_ms);
 
 		found_work = UndoGetWork(allow_peek, true, &urinfo, &in_other_db);
 
-		if (found_work && in_other_db)
+		if (found_work && in_other_db && !slot_available)
 		{
 			proc_exit(0);
 		}
-		else if (found_work)
+		else if (found_work && !in_other_db)
 		{
 			/* We must have got the pending undo request. */
 			Assert(FullTransactionIdIsValid(urinfo.full_xid));
@@ -714,26 +1227,28 @@ UndoWorkerMain(Datum main_arg)
 		else
 		{
 			TimestampTz timeout = 0;
+			bool		reserved;
+
+			/*
+			 * Update the shared state to reflect that this worker is
+			 * lingering so that if there is new work request, requester can
+			 * wake us up.
+			 */
+			reserved = UndoWorkerIsLingering(true);
 
 			timeout = TimestampTzPlusMilliseconds(last_xact_processed_at,
 												  UNDO_WORKER_LINGER_MS);
 
 			/*
 			 * We don't need to linger if we have already spent
-			 * UNDO_WORKER_LINGER_MS since last transaction has processed.
+			 * UNDO_WORKER_LINGER_MS since last transaction has processed,
+			 * unless our database wants to keep us.
 			 */
-			if (timeout <= GetCurrentTimestamp())
+			if (timeout <= GetCurrentTimestamp() && !reserved)
 			{
 				proc_exit(0);
 			}
 
-			/*
-			 * Update the shared state to reflect that this worker is
-			 * lingering so that if there is new work request, requester can
-			 * wake us up.
-			 */
-			UndoWorkerIsLingering(true);
-
 			/* Wait for more work. */
 			rc = WaitLatch(MyLatch,
 						   WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
@@ -771,45 +1286,26 @@ UndoWorkerMain(Datum main_arg)
  * We first try to wake up the lingering worker in the given database.  If we
  * found even one such worker, we are done.
  *
- * Next, we try to stop some worker which is lingering, but doesn't belong to
- * the given database.  We know that any worker which is lingering doesn't have
- * any pending work, so it is fine to stop it when we know that there is going
- * to be some work in the other database.
+ * Next, if all the worker slots are taken, we stop one worker which is
+ * lingering, but doesn't belong to the given database.  We know that any
+ * worker which is lingering doesn't have any pending work, so it is fine to
+ * stop it when we know that there is going to be some work in the other
+ * database.  Workers of other databases are left alone while there are free
+ * slots, so that they are still around when their database needs them again.
  *
- * Finally, we wakeup launcher so that it can either restart the worker we have
- * stopped or find some other worker who can take up this request.
+ * Finally, we wakeup launcher so that it can start a worker for this request.
  */
 void
 WakeupUndoWorker(Oid dbid)
 {
-	int			i;
+	bool		free_slot;
 
 	LWLockAcquire(UndoWorkerLock, LW_EXCLUSIVE);
 
-	/* wake up lingering worker in the given database. */
-	for (i = 0; i < max_undo_workers; i++)
-	{
-		UndoApplyWorker *w = &UndoApplyCtx->workers[i];
-
-		if (w->in_use && w->lingering && w->dbid == dbid)
-		{
-			SetLatch(&w->proc->procLatch);
-
-			LWLockRelease(UndoWorkerLock);
-			return;
-		}
-	}
-
-	/*
-	 * Stop one of the lingering worker which is not processing the requests
-	 * in the given database.
-	 */
-	for (i = 0; i < max_undo_workers; i++)
+	if (UndoWorkerWakeupInDatabase(dbid, &free_slot))
 	{
-		UndoApplyWorker *w = &UndoApplyCtx->workers[i];
-
-		if (w->in_use && w->lingering && w->dbid != dbid)
-			kill(w->proc->pid, SIGTERM);
+		LWLockRelease(UndoWorkerLock);
+		return;
 	}
 
 	if (UndoApplyCtx->undo_launcher_latch)
@@ -71,6 +71,10 @@ TPDPagePrune(Relation rel, Buffer tpdbuf, BufferAccessStrategy strategy,
 	if (tpd_e_pruned)
 		*tpd_e_pruned = false;
 
+	/* There is nothing to prune on a page that has been freed already. */
+	if (TPDPageIsFree(tpdpage))
+		return 0;
+
 	/* Can we prune the entire page? */
 	tpdopaque = (TPDPageOpaque) PageGetSpecialPointer(tpdpage);
 	oldest_fxid_having_undo = FullTransactionIdFromU64(
@@ -181,25 +185,15 @@ TPDPagePrune(Relation rel, Buffer tpdbuf, BufferAccessStrategy strategy,
 free_tpd_page:
 	if (can_free && PageIsEmpty(tpdpage))
 	{
-		Size		freespace;
-
 		/* If the page is empty, we have certainly pruned all the tpd entries. */
 		if (tpd_e_pruned)
 			*tpd_e_pruned = true;
 
 		/*
-		 * We can reuse empty page as either a heap page or a TPD page, so no
-		 * need to consider opaque space.
-		 */
-		freespace = BLCKSZ - SizeOfPageHeaderData;
-
-		/*
-		 * TPD page is empty, remove it from TPD used page list and record it
-		 * in FSM.
+		 * TPD page is empty, move it from TPD used page list to the free
+		 * list, from where it's reused for new TPD pages.
 		 */
-		if (TPDFreePage(rel, tpdbuf, strategy))
-			RecordPageWithFreeSpace(rel, BufferGetBlockNumber(tpdbuf),
-									freespace);
+		TPDFreePage(rel, tpdbuf, strategy);
 	}
 
 	return prstate.nunused;
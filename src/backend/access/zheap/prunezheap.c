@@ -25,16 +25,28 @@
  */
 #include "postgres.h"
 
+#include "access/relation.h"
 #include "access/tpd.h"
+#include "access/visibilitymap.h"
+#include "access/zfreepages.h"
 #include "access/zheap.h"
 #include "access/zheapam_xlog.h"
 #include "utils/ztqual.h"
 #include "catalog/catalog.h"
 #include "miscadmin.h"
 #include "pgstat.h"
+#include "postmaster/autovacuum.h"
 #include "storage/bufmgr.h"
+#include "storage/freespace.h"
 #include "storage/procarray.h"
 
+/* GUC: whether scans leave the pruning of pages to autovacuum. */
+bool		zheap_background_prune = false;
+
+/* The page this backend last asked autovacuum to prune. */
+static Oid	last_prune_request_rel = InvalidOid;
+static BlockNumber last_prune_request_blk = InvalidBlockNumber;
+
 /* Working data for zheap_page_prune and subroutines */
 typedef struct
 {
@@ -64,6 +76,10 @@ static void zheap_prune_record_prunable(ZPruneState *prstate,
 static void zheap_prune_record_dead(ZPruneState *prstate, OffsetNumber offnum);
 static void zheap_prune_record_deleted(ZPruneState *prstate,
 									   OffsetNumber offnum);
+static bool zheap_page_slots_all_visible(Page page);
+static bool zheap_page_tuples_all_visible(Relation relation, Buffer buffer,
+										  TransactionId OldestXmin,
+										  TransactionId *visibility_cutoff_xid);
 
 /*
  * Optionally prune and repair fragmentation in the specified page.
@@ -161,6 +177,287 @@ zheap_page_prune_opt(Relation relation, Buffer buffer,
 	return false;
 }
 
+/*
+ * Ask autovacuum to prune the specified page, if it has become prunable.
+ *
+ * Caller must have a pin on the page; a lock is not required, since we only
+ * look at the prune hint.  This is called from scans, which don't prune
+ * pages themselves, so that the page gets its free space back before an
+ * update or insert needs it, and without making the scan wait for it.  The
+ * requests are processed by zheap_page_prune_work in the next autovacuum
+ * worker to visit our database; requests that don't fit in its work item
+ * array are silently dropped.
+ */
+void
+zheap_page_prune_request(Relation relation, Buffer buffer)
+{
+	Page		page = BufferGetPage(buffer);
+	BlockNumber blkno = BufferGetBlockNumber(buffer);
+	TransactionId prune_xid;
+
+	if (!zheap_background_prune || RecoveryInProgress() ||
+		RelationUsesLocalBuffers(relation) || !AutoVacuumingActive())
+		return;
+
+	/* Don't ask for the same page over and over again. */
+	if (RelationGetRelid(relation) == last_prune_request_rel &&
+		blkno == last_prune_request_blk)
+		return;
+
+	/*
+	 * Unlike ZPageIsPrunable, which would need to check the proc array, only
+	 * consider the page once its prune hint has become older than anyone's
+	 * xmin.  The hint is read without a lock, but a torn value only means
+	 * that we ask for an unneeded prune, or don't ask for a needed one.
+	 */
+	prune_xid = ((PageHeader) page)->pd_prune_xid;
+	if (!TransactionIdIsNormal(prune_xid) ||
+		!TransactionIdPrecedes(prune_xid, RecentGlobalXmin))
+		return;
+
+	if (AutoVacuumRequestWork(AVW_ZHeapPrunePage, RelationGetRelid(relation),
+							  blkno))
+	{
+		last_prune_request_rel = RelationGetRelid(relation);
+		last_prune_request_blk = blkno;
+	}
+}
+
+/*
+ * Prune the specified page on behalf of zheap_page_prune_request.
+ *
+ * This is run by autovacuum workers.  The freed page is made known to
+ * inserters right away, but entered into the FSM in batches; the worker
+ * flushes the last batch with ZHeapFlushFreedPages.
+ */
+void
+zheap_page_prune_work(Oid relid, BlockNumber blkno)
+{
+	Relation	relation;
+	Buffer		buffer;
+	Page		page;
+	TransactionId OldestXmin;
+	TransactionId ignore = InvalidTransactionId;
+	bool		pruned = false;
+	Size		freespace = 0;
+
+	/* The relation might have been dropped or rewritten meanwhile. */
+	relation = try_relation_open(relid, AccessShareLock);
+	if (relation == NULL)
+		return;
+
+	if (!RelationStorageIsZHeap(relation) ||
+		blkno == ZHEAP_METAPAGE ||
+		blkno >= RelationGetNumberOfBlocks(relation))
+	{
+		relation_close(relation, AccessShareLock);
+		return;
+	}
+
+	OldestXmin = GetOldestXmin(relation, PROCARRAY_FLAGS_VACUUM);
+
+	buffer = ReadBufferExtended(relation, MAIN_FORKNUM, blkno, RBM_NORMAL,
+								NULL);
+	LockBuffer(buffer, BUFFER_LOCK_EXCLUSIVE);
+	page = BufferGetPage(buffer);
+
+	if (!PageIsNew(page) && !IsTPDPage(page) && ZPageIsPrunable(page))
+	{
+		zheap_page_prune_guts(relation, buffer, OldestXmin,
+							  InvalidOffsetNumber, 0, true, false,
+							  &ignore, &pruned);
+		freespace = PageGetZHeapFreeSpace(page);
+	}
+
+	UnlockReleaseBuffer(buffer);
+
+	if (pruned)
+		ZHeapRecordFreedPage(relation, blkno, freespace);
+
+	relation_close(relation, AccessShareLock);
+}
+
+/*
+ * Optionally mark the specified page all-visible in the visibility map.
+ *
+ * Caller must have a pin on the page, but no lock.  *vmbuffer is a pin on a
+ * visibility map page that the caller keeps across calls, and must release
+ * once done; it can be InvalidBuffer initially.
+ *
+ * Since zheap reclaims space without vacuum, a zheap table may never get
+ * vacuumed, and so its visibility map bits would never be set.  However, once
+ * the undo of all the transactions that have a slot on the page has been
+ * discarded, and no tuple or line pointer on it is waiting for vacuum,
+ * everything on the page is visible to everyone until the page is modified
+ * again, which clears the bit.  This is an opportunistic function: it is
+ * called while fetching tuples via an index, so that index-only scans need
+ * to visit a page only until the discard worker has caught up with it.
+ */
+void
+zheap_page_set_all_visible_opt(Relation relation, Buffer buffer,
+							   Buffer *vmbuffer)
+{
+	Page		page = BufferGetPage(buffer);
+	BlockNumber blkno = BufferGetBlockNumber(buffer);
+	TransactionId OldestXmin;
+	TransactionId visibility_cutoff_xid;
+	uint8		vm_status;
+
+	/*
+	 * We can't write WAL in recovery mode.  For temporary tables, the oldest
+	 * xid having undo isn't relevant, see PageReserveTransactionSlot.
+	 */
+	if (RecoveryInProgress() || RelationUsesLocalBuffers(relation))
+		return;
+
+	/* Use the same horizon as zheap_page_prune_opt. */
+	if (IsCatalogRelation(relation) ||
+		RelationIsAccessibleInLogicalDecoding(relation))
+		OldestXmin = RecentGlobalXmin;
+	else
+		OldestXmin = RecentGlobalDataXmin;
+
+	Assert(TransactionIdIsValid(OldestXmin));
+
+	/* Pin the visibility map page before locking the heap page. */
+	visibilitymap_pin(relation, blkno, vmbuffer);
+	vm_status = visibilitymap_get_status(relation, blkno, vmbuffer);
+	if (vm_status & VISIBILITYMAP_ALL_VISIBLE)
+		return;
+
+	/*
+	 * A share lock is enough, since anyone modifying the page needs an
+	 * exclusive lock, and clears the visibility map bit while holding it.
+	 */
+	LockBuffer(buffer, BUFFER_LOCK_SHARE);
+
+	if (!PageIsNew(page) &&
+		zheap_page_slots_all_visible(page) &&
+		zheap_page_tuples_all_visible(relation, buffer, OldestXmin,
+									  &visibility_cutoff_xid))
+	{
+		/*
+		 * A leftover potentially all-visible bit would make the page look
+		 * all-frozen; that's for vacuum to decide.
+		 */
+		if (vm_status & VISIBILITYMAP_POTENTIAL_ALL_VISIBLE)
+			visibilitymap_clear(relation, blkno, *vmbuffer,
+								VISIBILITYMAP_VALID_BITS);
+		visibilitymap_set(relation, blkno, buffer, InvalidXLogRecPtr,
+						  *vmbuffer, visibility_cutoff_xid,
+						  VISIBILITYMAP_ALL_VISIBLE);
+	}
+
+	LockBuffer(buffer, BUFFER_LOCK_UNLOCK);
+}
+
+/*
+ * Check whether the undo of all the transactions having a slot on the page
+ * has been discarded.
+ *
+ * Pages whose slots overflowed into a TPD entry are not considered; we would
+ * have to lock the TPD page, and such pages are busy anyway.
+ */
+static bool
+zheap_page_slots_all_visible(Page page)
+{
+	ZHeapPageOpaque opaque;
+	int			slot_no;
+
+	if (ZHeapPageHasTPDSlot((PageHeader) page))
+		return false;
+
+	opaque = (ZHeapPageOpaque) PageGetSpecialPointer(page);
+
+	for (slot_no = 0; slot_no < ZHeapPageGetNumTransSlots(page); slot_no++)
+	{
+		FullTransactionId slot_fxid = opaque->transinfo[slot_no].fxid;
+		UndoRecPtr	urec_ptr = opaque->transinfo[slot_no].urec_ptr;
+
+		/* See prune_tpd_entry for the conditions. */
+		if (FullTransactionIdIsValid(slot_fxid))
+		{
+			if (!FullTransactionIdOlderThanAllUndo(slot_fxid))
+				return false;
+		}
+		else if (UndoRecPtrIsValid(urec_ptr) && !UndoLogIsDiscarded(urec_ptr))
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Check if every tuple in the given page is visible to all current and future
+ * transactions, and return the newest inserting xid in
+ * *visibility_cutoff_xid.
+ *
+ * Unlike zheap_page_is_all_visible in zvacuumlazy.c, we don't get to remove
+ * index entries first, so dead and deleted line pointers, which still may
+ * have index entries, make the page not all-visible.
+ */
+static bool
+zheap_page_tuples_all_visible(Relation relation, Buffer buffer,
+							  TransactionId OldestXmin,
+							  TransactionId *visibility_cutoff_xid)
+{
+	Page		page = BufferGetPage(buffer);
+	BlockNumber blkno = BufferGetBlockNumber(buffer);
+	OffsetNumber offnum,
+				maxoff;
+
+	*visibility_cutoff_xid = InvalidTransactionId;
+
+	/* Check the line pointers first, that's cheap. */
+	maxoff = PageGetMaxOffsetNumber(page);
+	for (offnum = FirstOffsetNumber;
+		 offnum <= maxoff;
+		 offnum = OffsetNumberNext(offnum))
+	{
+		ItemId		itemid = PageGetItemId(page, offnum);
+
+		if (ItemIdIsUsed(itemid) && !ItemIdIsNormal(itemid))
+			return false;
+	}
+
+	for (offnum = FirstOffsetNumber;
+		 offnum <= maxoff;
+		 offnum = OffsetNumberNext(offnum))
+	{
+		ItemId		itemid = PageGetItemId(page, offnum);
+		ZHeapTupleData tuple;
+		TransactionId xid;
+
+		if (!ItemIdIsUsed(itemid))
+			continue;
+
+		ItemPointerSet(&(tuple.t_self), blkno, offnum);
+		tuple.t_data = (ZHeapTupleHeader) PageGetItem(page, itemid);
+		tuple.t_len = ItemIdGetLength(itemid);
+		tuple.t_tableOid = RelationGetRelid(relation);
+
+		if (ZHeapTupleSatisfiesOldestXmin(&tuple, OldestXmin, buffer, false,
+										  NULL, &xid, NULL) != ZHEAPTUPLE_LIVE)
+			return false;
+
+		/*
+		 * The inserter definitely committed.  But is it old enough that
+		 * everyone sees it as committed?
+		 */
+		if (TransactionIdIsValid(xid))
+		{
+			if (!TransactionIdPrecedes(xid, OldestXmin))
+				return false;
+
+			/* Track newest xmin on page. */
+			if (TransactionIdFollows(xid, *visibility_cutoff_xid))
+				*visibility_cutoff_xid = xid;
+		}
+	}
+
+	return true;
+}
+
 /*
  * Prune and repair fragmentation in the specified page.
  *
@@ -381,6 +678,9 @@ zheap_page_prune_guts(Relation relation, Buffer buffer,
 
 	END_CRIT_SECTION();
 
+	if (execute_pruning)
+		pgstat_count_zheap_prune(relation);
+
 	/*
 	 * Report the number of tuples reclaimed to pgstats. This is ndeleted
 	 * minus ndead, because we don't want to count a now-DEAD item or a
@@ -698,13 +998,49 @@ log_zheap_clean(Relation reln, Buffer buffer, OffsetNumber target_offnum,
 	return recptr;
 }
 
+/*
+ * Check whether compactify_ztuples can move the tuples within the page.
+ *
+ * That is the case when the tuples are already laid out in itemid order,
+ * either ascending, as left by an earlier compaction, or descending, as left
+ * by a run of inserts, and none of them has to move towards the start of the
+ * page, which could overwrite a tuple not yet moved.  A tuple can only move
+ * down if it is given more space than it occupies now, e.g. the target tuple
+ * of ZPageRepairFragmentation.  *ascending is set to the direction found.
+ */
+static bool
+compactify_ztuples_inplace(itemIdSort itemidbase, int nitems, Offset upper,
+						   bool *ascending)
+{
+	int			i;
+
+	*ascending = (nitems > 1 && itemidbase[0].itemoff < itemidbase[1].itemoff);
+
+	for (i = 0; i < nitems; i++)
+	{
+		itemIdSort	itemidptr;
+
+		itemidptr = &itemidbase[*ascending ? nitems - 1 - i : i];
+		if (i > 0 && itemidptr->itemoff >= itemidptr[*ascending ? 1 : -1].itemoff)
+			return false;
+
+		upper -= itemidptr->alignedlen;
+		if (upper < itemidptr->itemoff)
+			return false;
+	}
+
+	return true;
+}
+
 /*
  * After removing or marking some line pointers unused, move the tuples to
  * remove the gaps caused by the removed items.  Here, we are rearranging
  * the page such that tuples will be placed in itemid order.  It will help
  * in the speedup of future sequential scans.
  *
- * Note that we use the temporary copy of the page to copy the tuples as
+ * If the tuples are in itemid order already, they are simply slid up towards
+ * the end of the page, which leaves the tuples above the first gap alone.
+ * Otherwise we use the temporary copy of the page to copy the tuples as
  * writing in itemid order will overwrite some tuples.
  */
 void
@@ -712,10 +1048,35 @@ compactify_ztuples(itemIdSort itemidbase, int nitems, Page page, Page tmppage)
 {
 	PageHeader	phdr = (PageHeader) page;
 	Offset		upper;
+	bool		ascending;
 	int			i;
 
 	Assert(PageIsValid(tmppage));
 	upper = phdr->pd_special;
+
+	if (compactify_ztuples_inplace(itemidbase, nitems, upper, &ascending))
+	{
+		for (i = 0; i < nitems; i++)
+		{
+			itemIdSort	itemidptr;
+			ItemId		lp;
+
+			itemidptr = &itemidbase[ascending ? nitems - 1 - i : i];
+			lp = PageGetItemId(page, itemidptr->offsetindex + 1);
+			upper -= itemidptr->alignedlen;
+			if (upper != itemidptr->itemoff)
+			{
+				memmove((char *) page + upper,
+						(char *) page + itemidptr->itemoff,
+						lp->lp_len);
+				lp->lp_off = upper;
+			}
+		}
+
+		phdr->pd_upper = upper;
+		return;
+	}
+
 	for (i = nitems - 1; i >= 0; i--)
 	{
 		itemIdSort	itemidptr = &itemidbase[i];
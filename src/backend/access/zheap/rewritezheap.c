@@ -58,6 +58,17 @@
  * directly through smgr.  Note, however, that any data sent to the new
  * heap's TOAST table will go through the normal bufmgr.
  *
+ * When CLUSTER sorts the table, the scan and the sort can be done by parallel
+ * workers, see begin_zheap_parallel_cluster.  Each participant scans a
+ * disjoint set of blocks of the old heap and sorts what it has read, and the
+ * leader merges the sorted runs and writes the new heap itself, since the
+ * new heap has to be written in the order of the merged output anyway.
+ *
+ * ALTER TABLE SET ACCESS METHOD zheap doesn't care about the order of the
+ * tuples, so zheap_rewrite_table lets each participant build pages from the
+ * blocks of the old heap it scans, and write them out itself.  Only the
+ * writes are serialized, so that the new heap is extended in order.
+ *
  * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
  * Portions Copyright (c) 1994-5, Regents of the University of California
  *
@@ -71,15 +82,35 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include "access/genam.h"
 #include "access/heapam.h"		/* for heap_sync() */
+#include "access/multixact.h"
+#include "access/parallel.h"
 #include "access/rewritezheap.h"
+#include "access/table.h"
+#include "access/tableam.h"
 #include "access/tuptoaster.h"
+#include "access/xact.h"
 #include "access/zheap.h"
+#include "executor/tuptable.h"
 #include "miscadmin.h"
+#include "optimizer/paths.h"
+#include "pgstat.h"
 #include "storage/bufmgr.h"
+#include "storage/condition_variable.h"
 #include "storage/smgr.h"
+#include "storage/spin.h"
 #include "storage/procarray.h"
+#include "tcop/tcopprot.h"
 #include "utils/memutils.h"
+#include "utils/rel.h"
+#include "utils/sharedtuplestore.h"
+#include "utils/snapmgr.h"
+
+/* Magic numbers for parallel state sharing */
+#define PARALLEL_KEY_ZCLUSTER_SHARED	UINT64CONST(0xA000000000000001)
+#define PARALLEL_KEY_QUERY_TEXT			UINT64CONST(0xA000000000000002)
+#define PARALLEL_KEY_ZREWRITE_SHARED	UINT64CONST(0xA000000000000003)
 
 
 /*
@@ -93,13 +124,153 @@ typedef struct RewriteZheapStateData
 	BlockNumber rs_blockno;		/* block where page will go */
 	bool		rs_buffer_valid;	/* T if any tuples in buffer */
 	bool		rs_use_wal;		/* must we WAL-log inserts? */
+	int			rs_trans_slots; /* transaction slots on each new page */
+	LWLock	   *rs_writelock;	/* serializes writes of a parallel rewrite */
+	BlockNumber *rs_nextblock;	/* next block of a parallel rewrite */
 	MemoryContext rs_cxt;		/* for hash tables and entries and tuples in
 								 * them */
 }			RewriteZheapStateData;
 
 
+/*
+ * Status for a CLUSTER whose scan and sort are performed in parallel.  This
+ * is allocated in the dynamic shared memory segment of the parallel context.
+ *
+ * The shared tuplesort state lives in a separate segment, whose handle is
+ * stored here, because the leader has to keep reading the sorted runs of the
+ * workers after it has left parallel mode: writing the new heap may need to
+ * toast values, which needs new OIDs, and those can't be assigned during a
+ * parallel operation.
+ */
+typedef struct ZClusterShared
+{
+	/* These fields are not modified during the scan. */
+	Oid			heaprelid;
+	Oid			indexrelid;
+	int			scantuplesortstates;
+	dsm_handle	sortseg;
+
+	/*
+	 * workersdonecv is used to monitor the progress of workers.  All
+	 * participants must indicate that they are done before the leader can
+	 * merge their sorted runs.
+	 */
+	ConditionVariable workersdonecv;
+
+	/*
+	 * mutex protects the fields below.  reltuples is the total number of live
+	 * tuples read from the old heap.
+	 */
+	slock_t		mutex;
+	int			nparticipantsdone;
+	double		reltuples;
+
+	/*
+	 * ParallelTableScanDescData data follows. Can't directly embed here, as
+	 * implementations of the parallel table scan desc interface might need
+	 * stronger alignment.
+	 */
+} ZClusterShared;
+
+/*
+ * Return pointer to a ZClusterShared's parallel table scan.
+ *
+ * c.f. shm_toc_allocate as to why BUFFERALIGN is used, rather than just
+ * MAXALIGN.
+ */
+#define ParallelTableScanFromZClusterShared(shared) \
+	(ParallelTableScanDesc) ((char *) (shared) + BUFFERALIGN(sizeof(ZClusterShared)))
+
+/*
+ * Status for the leader of a parallel CLUSTER.
+ */
+typedef struct ZHeapParallelClusterData
+{
+	ParallelContext *pcxt;
+	Relation	heap;
+	Relation	index;
+
+	/*
+	 * nparticipanttuplesorts is the number of worker processes successfully
+	 * launched, plus one for the leader, which always participates.
+	 */
+	int			nparticipanttuplesorts;
+
+	ZClusterShared *shared;
+	dsm_segment *sortseg;
+	Sharedsort *sharedsort;
+	Snapshot	snapshot;
+}			ZHeapParallelClusterData;
+
+
+/*
+ * Status for a rewrite of a table into zheap that is performed in parallel.
+ * This is allocated in the dynamic shared memory segment of the parallel
+ * context.
+ *
+ * Tuples that have to be toasted can't be written by the workers, because
+ * toasting needs new OIDs, so they are spilled to a shared tuplestore, to be
+ * written by the leader once parallel mode is over.  Like the sorted runs of
+ * a parallel CLUSTER, that lives in a separate segment, whose handle is
+ * stored here.
+ */
+typedef struct ZRewriteShared
+{
+	/* These fields are not modified during the rewrite. */
+	Oid			oldheaprelid;
+	Oid			newheaprelid;
+	bool		use_wal;
+	dsm_handle	spillseg;
+
+	/*
+	 * writelock is held while a participant writes out a page it has built,
+	 * and protects nextblock, the block number of the next page to write.
+	 */
+	LWLock		writelock;
+	BlockNumber nextblock;
+
+	/*
+	 * workersdonecv is used to monitor the progress of workers.  All
+	 * participants must indicate that they are done before the leader can
+	 * write the spilled tuples.
+	 */
+	ConditionVariable workersdonecv;
+
+	/*
+	 * mutex protects the fields below.  reltuples is the total number of live
+	 * tuples read from the old heap.
+	 */
+	slock_t		mutex;
+	int			nparticipantsdone;
+	double		reltuples;
+
+	/*
+	 * ParallelTableScanDescData data follows, see ZClusterShared.
+	 */
+} ZRewriteShared;
+
+#define ParallelTableScanFromZRewriteShared(shared) \
+	(ParallelTableScanDesc) ((char *) (shared) + BUFFERALIGN(sizeof(ZRewriteShared)))
+
+/* The spill segment holds the shared fileset, then the tuplestore. */
+#define SharedTuplestoreFromSpill(fileset) \
+	(SharedTuplestore *) ((char *) (fileset) + MAXALIGN(sizeof(SharedFileSet)))
+
+
 /* prototypes for internal functions */
 static void raw_zheap_insert(RewriteZheapState state, ZHeapTuple tup);
+static void raw_zheap_write_page(RewriteZheapState state);
+static bool zheap_parallel_rewrite(Relation OldHeap, Relation NewHeap,
+								   Snapshot snapshot, bool use_wal,
+								   int request, double *num_tuples);
+static int	zheap_rewrite_plan_workers(Relation rel);
+static void zheap_parallel_rewrite_scan(Relation OldHeap, Relation NewHeap,
+										ZRewriteShared *shared,
+										SharedTuplestoreAccessor *spill);
+static void zheap_parallel_cluster_scan_and_sort(Relation heap, Relation index,
+												 ZClusterShared *shared,
+												 Sharedsort *sharedsort,
+												 int sortmem);
 
 /*
  * Begin a rewrite of a table
@@ -143,6 +314,7 @@ begin_zheap_rewrite(Relation old_heap, Relation new_heap,
 	state->rs_blockno = RelationGetNumberOfBlocks(new_heap);
 	state->rs_buffer_valid = false;
 	state->rs_use_wal = use_wal;
+	state->rs_trans_slots = RelationGetZHeapTransSlots(new_heap);
 	state->rs_cxt = rw_cxt;
 
 	MemoryContextSwitchTo(old_cxt);
@@ -160,20 +332,7 @@ end_zheap_rewrite(RewriteZheapState state)
 {
 	/* Write the last page, if any */
 	if (state->rs_buffer_valid)
-	{
-		if (state->rs_use_wal)
-			log_newpage(&state->rs_new_rel->rd_node,
-						MAIN_FORKNUM,
-						state->rs_blockno,
-						state->rs_buffer,
-						true);
-		RelationOpenSmgr(state->rs_new_rel);
-
-		PageSetChecksumInplace(state->rs_buffer, state->rs_blockno);
-
-		smgrextend(state->rs_new_rel->rd_smgr, MAIN_FORKNUM, state->rs_blockno,
-				   (char *) state->rs_buffer, true);
-	}
+		raw_zheap_write_page(state);
 
 	/*
 	 * If the rel is WAL-logged, must fsync before commit.  We use heap_sync
@@ -185,8 +344,11 @@ end_zheap_rewrite(RewriteZheapState state)
 	 * writing data that's not in shared buffers, and so a CHECKPOINT
 	 * occurring during the rewritezheap operation won't have fsync'd data we
 	 * wrote before the checkpoint.
+	 *
+	 * The participants of a parallel rewrite leave that to the leader, which
+	 * writes the spilled tuples at the end.
 	 */
-	if (RelationNeedsWAL(state->rs_new_rel))
+	if (RelationNeedsWAL(state->rs_new_rel) && state->rs_writelock == NULL)
 		heap_sync(state->rs_new_rel);
 
 	/* Deleting the context frees everything */
@@ -248,7 +410,7 @@ rewrite_zheap_tuple(RewriteZheapState state, ZHeapTuple new_tuple)
 	 */
 	new_tuple->t_data->t_infomask &= ~ZHEAP_VIS_STATUS_MASK;
 	new_tuple->t_data->t_infomask2 &= ~ZHEAP_XACT_SLOT;
-	ZHeapTupleHeaderSetXactSlot(new_tuple->t_data, ZHTUP_SLOT_FROZEN);
+	ZHeapTupleHeaderSetXactSlotFrozen(new_tuple->t_data);
 
 	raw_zheap_insert(state, new_tuple);
 
@@ -304,11 +466,11 @@ raw_zheap_insert(RewriteZheapState state, ZHeapTuple tup)
 	/*
 	 * If we're gonna fail for oversize tuple, do it right away
 	 */
-	if (len > MaxZHeapTupleSize)
+	if (len > MaxZHeapTupleSizeForSlots(state->rs_trans_slots))
 		ereport(ERROR,
 				(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
 				 errmsg("row is too big: size %zu, maximum size %zu",
-						len, MaxZHeapTupleSize)));
+						len, MaxZHeapTupleSizeForSlots(state->rs_trans_slots))));
 
 	/* Compute desired extra freespace due to fillfactor option */
 	saveFreeSpace = RelationGetTargetPageFreeSpace(state->rs_new_rel,
@@ -322,28 +484,7 @@ raw_zheap_insert(RewriteZheapState state, ZHeapTuple tup)
 		if (len + saveFreeSpace > pageFreeSpace)
 		{
 			/* Doesn't fit, so write out the existing page */
-
-			/* XLOG stuff */
-			if (state->rs_use_wal)
-				log_newpage(&state->rs_new_rel->rd_node,
-							MAIN_FORKNUM,
-							state->rs_blockno,
-							page,
-							true);
-
-			/*
-			 * Now write the page. We say isTemp = true even if it's not a
-			 * temp table, because there's no need for smgr to schedule an
-			 * fsync for this write; we'll do it ourselves in
-			 * end_zheap_rewrite.
-			 */
-			RelationOpenSmgr(state->rs_new_rel);
-
-			PageSetChecksumInplace(page, state->rs_blockno);
-
-			smgrextend(state->rs_new_rel->rd_smgr, MAIN_FORKNUM,
-					   state->rs_blockno, (char *) page, true);
-
+			raw_zheap_write_page(state);
 			state->rs_blockno++;
 			state->rs_buffer_valid = false;
 		}
@@ -352,7 +493,7 @@ raw_zheap_insert(RewriteZheapState state, ZHeapTuple tup)
 	if (!state->rs_buffer_valid)
 	{
 		/* Initialize a new empty page */
-		ZheapInitPage(page, BLCKSZ);
+		ZheapInitPage(page, BLCKSZ, state->rs_trans_slots);
 		state->rs_buffer_valid = true;
 	}
 
@@ -363,10 +504,773 @@ raw_zheap_insert(RewriteZheapState state, ZHeapTuple tup)
 	if (newoff == InvalidOffsetNumber)
 		elog(ERROR, "failed to add tuple");
 
-	/* Update caller's t_self to the actual position where it was stored */
+	/*
+	 * Update caller's t_self to the actual position where it was stored.  In
+	 * a parallel rewrite, the block number is only decided when the page is
+	 * written, but no one needs to know it there.
+	 */
 	ItemPointerSet(&(tup->t_self), state->rs_blockno, newoff);
 
 	/* If heaptup is a private copy, release it. */
 	if (heaptup != tup)
 		zheap_freetuple(heaptup);
 }
+
+/*
+ * Write out the page currently being built.
+ *
+ * In a parallel rewrite, the participants take turns to write their pages,
+ * each at the next block of the new heap, so that it is extended in order.
+ */
+static void
+raw_zheap_write_page(RewriteZheapState state)
+{
+	Page		page = state->rs_buffer;
+
+	if (state->rs_writelock != NULL)
+	{
+		LWLockAcquire(state->rs_writelock, LW_EXCLUSIVE);
+		state->rs_blockno = (*state->rs_nextblock)++;
+	}
+
+	/* XLOG stuff */
+	if (state->rs_use_wal)
+		log_newpage(&state->rs_new_rel->rd_node,
+					MAIN_FORKNUM,
+					state->rs_blockno,
+					page,
+					true);
+
+	/*
+	 * Now write the page. We say isTemp = true even if it's not a temp table,
+	 * because there's no need for smgr to schedule an fsync for this write;
+	 * we'll do it ourselves in end_zheap_rewrite.
+	 */
+	RelationOpenSmgr(state->rs_new_rel);
+
+	PageSetChecksumInplace(page, state->rs_blockno);
+
+	smgrextend(state->rs_new_rel->rd_smgr, MAIN_FORKNUM,
+			   state->rs_blockno, (char *) page, true);
+
+	if (state->rs_writelock != NULL)
+		LWLockRelease(state->rs_writelock);
+}
+
+/*
+ * Create a parallel context, and launch workers to scan and sort the old heap
+ * for CLUSTER.
+ *
+ * request is the target number of parallel worker processes to launch.
+ * Returns NULL, if not even a single worker process can be launched, in
+ * which case the caller should proceed with a serial scan and sort.
+ * Otherwise, the caller must fetch the sorted tuples with
+ * zheap_parallel_cluster_sort and then pass them to
+ * end_zheap_parallel_cluster.
+ */
+ZHeapParallelCluster
+begin_zheap_parallel_cluster(Relation OldHeap, Relation OldIndex, int request)
+{
+	ZHeapParallelCluster pcluster;
+	ParallelContext *pcxt;
+	ZClusterShared *shared;
+	Snapshot	snapshot;
+	Size		estshared;
+	Size		estsort;
+	int			scantuplesortstates;
+	int			querylen = 0;
+	int			nkeys = 1;
+
+	Assert(request > 0);
+
+	EnterParallelMode();
+	pcxt = CreateParallelContext("postgres", "zheap_parallel_cluster_main",
+								 request);
+	scantuplesortstates = request + 1;
+
+	/* The scan must see the same live tuples as a serial CLUSTER would. */
+	snapshot = RegisterSnapshot(GetTransactionSnapshot());
+
+	/* c.f. shm_toc_allocate as to why BUFFERALIGN is used */
+	estshared = add_size(BUFFERALIGN(sizeof(ZClusterShared)),
+						 table_parallelscan_estimate(OldHeap, snapshot));
+	shm_toc_estimate_chunk(&pcxt->estimator, estshared);
+
+	if (debug_query_string)
+	{
+		querylen = strlen(debug_query_string);
+		shm_toc_estimate_chunk(&pcxt->estimator, querylen + 1);
+		nkeys++;
+	}
+	shm_toc_estimate_keys(&pcxt->estimator, nkeys);
+
+	InitializeParallelDSM(pcxt);
+
+	pcluster = (ZHeapParallelCluster) palloc0(sizeof(ZHeapParallelClusterData));
+	pcluster->pcxt = pcxt;
+	pcluster->heap = OldHeap;
+	pcluster->index = OldIndex;
+	pcluster->snapshot = snapshot;
+
+	/* Set up the shared tuplesort state in a segment of its own. */
+	estsort = tuplesort_estimate_shared(scantuplesortstates);
+	pcluster->sortseg = dsm_create(estsort, 0);
+	pcluster->sharedsort = (Sharedsort *) dsm_segment_address(pcluster->sortseg);
+	tuplesort_initialize_shared(pcluster->sharedsort, scantuplesortstates,
+								pcluster->sortseg);
+
+	shared = (ZClusterShared *) shm_toc_allocate(pcxt->toc, estshared);
+	shared->heaprelid = RelationGetRelid(OldHeap);
+	shared->indexrelid = RelationGetRelid(OldIndex);
+	shared->scantuplesortstates = scantuplesortstates;
+	shared->sortseg = dsm_segment_handle(pcluster->sortseg);
+	ConditionVariableInit(&shared->workersdonecv);
+	SpinLockInit(&shared->mutex);
+	shared->nparticipantsdone = 0;
+	shared->reltuples = 0.0;
+	table_parallelscan_initialize(OldHeap,
+								  ParallelTableScanFromZClusterShared(shared),
+								  snapshot);
+	shm_toc_insert(pcxt->toc, PARALLEL_KEY_ZCLUSTER_SHARED, shared);
+	pcluster->shared = shared;
+
+	if (debug_query_string)
+	{
+		char	   *sharedquery;
+
+		sharedquery = (char *) shm_toc_allocate(pcxt->toc, querylen + 1);
+		memcpy(sharedquery, debug_query_string, querylen + 1);
+		shm_toc_insert(pcxt->toc, PARALLEL_KEY_QUERY_TEXT, sharedquery);
+	}
+
+	LaunchParallelWorkers(pcxt);
+	pcluster->nparticipanttuplesorts = pcxt->nworkers_launched + 1;
+
+	/* If no workers were successfully launched, back out */
+	if (pcxt->nworkers_launched == 0)
+	{
+		WaitForParallelWorkersToFinish(pcxt);
+		UnregisterSnapshot(snapshot);
+		DestroyParallelContext(pcxt);
+		ExitParallelMode();
+		dsm_detach(pcluster->sortseg);
+		pfree(pcluster);
+		return NULL;
+	}
+
+	return pcluster;
+}
+
+/*
+ * Within the leader, join the parallel scan and sort, wait for the workers to
+ * finish theirs and merge all the sorted runs.
+ *
+ * Parallel mode is over when this returns.  *num_tuples is set to the number
+ * of live tuples read from the old heap, and the returned tuplesort yields
+ * them in index order.
+ */
+Tuplesortstate *
+zheap_parallel_cluster_sort(ZHeapParallelCluster pcluster, double *num_tuples)
+{
+	ZClusterShared *shared = pcluster->shared;
+	SortCoordinate coordinate;
+	Tuplesortstate *tuplesort;
+	int			sortmem;
+
+	/*
+	 * Might as well use reliable figure when doling out maintenance_work_mem
+	 * (when requested number of workers were not launched, this will be
+	 * somewhat higher than it is for other workers).
+	 */
+	sortmem = maintenance_work_mem / pcluster->nparticipanttuplesorts;
+	zheap_parallel_cluster_scan_and_sort(pcluster->heap, pcluster->index,
+										 shared, pcluster->sharedsort,
+										 sortmem);
+
+	/* Make sure that the failure-to-start case will not hang forever. */
+	WaitForParallelWorkersToAttach(pcluster->pcxt);
+
+	for (;;)
+	{
+		SpinLockAcquire(&shared->mutex);
+		if (shared->nparticipantsdone == pcluster->nparticipanttuplesorts)
+		{
+			*num_tuples = shared->reltuples;
+			SpinLockRelease(&shared->mutex);
+			break;
+		}
+		SpinLockRelease(&shared->mutex);
+
+		ConditionVariableSleep(&shared->workersdonecv,
+							   WAIT_EVENT_PARALLEL_CLUSTER_SCAN);
+	}
+	ConditionVariableCancelSleep();
+
+	/*
+	 * The sorted runs of the workers are in the separate sort segment, so we
+	 * can leave parallel mode before the new heap is written.
+	 */
+	WaitForParallelWorkersToFinish(pcluster->pcxt);
+	UnregisterSnapshot(pcluster->snapshot);
+	DestroyParallelContext(pcluster->pcxt);
+	ExitParallelMode();
+	pcluster->pcxt = NULL;
+	pcluster->shared = NULL;
+
+	coordinate = (SortCoordinate) palloc0(sizeof(SortCoordinateData));
+	coordinate->isWorker = false;
+	coordinate->nParticipants = pcluster->nparticipanttuplesorts;
+	coordinate->sharedsort = pcluster->sharedsort;
+
+	tuplesort = tuplesort_begin_cluster(RelationGetDescr(pcluster->heap),
+										pcluster->index, maintenance_work_mem,
+										coordinate, false);
+	tuplesort_performsort(tuplesort);
+
+	return tuplesort;
+}
+
+/*
+ * Release the resources of a parallel CLUSTER, once the caller has read all
+ * the tuples from the tuplesort returned by zheap_parallel_cluster_sort.
+ */
+void
+end_zheap_parallel_cluster(ZHeapParallelCluster pcluster,
+						   Tuplesortstate *tuplesort)
+{
+	tuplesort_end(tuplesort);
+
+	/* This removes the temporary files holding the sorted runs. */
+	dsm_detach(pcluster->sortseg);
+	pfree(pcluster);
+}
+
+/*
+ * Perform a participant's portion of the parallel scan and sort.
+ *
+ * sortmem is the amount of working memory to use, expressed in KBs.
+ */
+static void
+zheap_parallel_cluster_scan_and_sort(Relation heap, Relation index,
+									 ZClusterShared *shared,
+									 Sharedsort *sharedsort, int sortmem)
+{
+	SortCoordinate coordinate;
+	Tuplesortstate *tuplesort;
+	TableScanDesc scan;
+	TupleTableSlot *slot;
+	double		reltuples = 0;
+
+	coordinate = palloc0(sizeof(SortCoordinateData));
+	coordinate->isWorker = true;
+	coordinate->nParticipants = -1;
+	coordinate->sharedsort = sharedsort;
+
+	tuplesort = tuplesort_begin_cluster(RelationGetDescr(heap), index,
+										sortmem, coordinate, false);
+
+	/*
+	 * As in the serial case, we only get the LIVE tuples from the scan, see
+	 * zheap_copy_for_cluster.
+	 */
+	scan = table_beginscan_parallel(heap,
+									ParallelTableScanFromZClusterShared(shared));
+	slot = table_slot_create(heap, NULL);
+
+	while (table_scan_getnextslot(scan, ForwardScanDirection, slot))
+	{
+		HeapTuple	tuple;
+		bool		shouldFree;
+
+		CHECK_FOR_INTERRUPTS();
+
+		reltuples += 1;
+		tuple = ExecFetchSlotHeapTuple(slot, false, &shouldFree);
+		tuplesort_putheaptuple(tuplesort, tuple);
+		if (shouldFree)
+			heap_freetuple(tuple);
+	}
+
+	ExecDropSingleTupleTableSlot(slot);
+	table_endscan(scan);
+
+	tuplesort_performsort(tuplesort);
+
+	SpinLockAcquire(&shared->mutex);
+	shared->nparticipantsdone++;
+	shared->reltuples += reltuples;
+	SpinLockRelease(&shared->mutex);
+
+	/* Notify leader */
+	ConditionVariableSignal(&shared->workersdonecv);
+
+	tuplesort_end(tuplesort);
+}
+
+/*
+ * Perform work within a launched parallel process.
+ */
+void
+zheap_parallel_cluster_main(dsm_segment *seg, shm_toc *toc)
+{
+	ZClusterShared *shared;
+	dsm_segment *sortseg;
+	Sharedsort *sharedsort;
+	Relation	heap;
+	Relation	index;
+	char	   *sharedquery;
+
+	/* Set debug_query_string for individual workers first */
+	sharedquery = shm_toc_lookup(toc, PARALLEL_KEY_QUERY_TEXT, true);
+	debug_query_string = sharedquery;
+
+	/* Report the query string from leader */
+	pgstat_report_activity(STATE_RUNNING, debug_query_string);
+
+	shared = shm_toc_lookup(toc, PARALLEL_KEY_ZCLUSTER_SHARED, false);
+
+	/*
+	 * Open relations with the lock mode obtained by cluster.c; the leader
+	 * already holds it, so we won't conflict with it.
+	 */
+	heap = table_open(shared->heaprelid, AccessExclusiveLock);
+	index = index_open(shared->indexrelid, AccessExclusiveLock);
+
+	sortseg = dsm_attach(shared->sortseg);
+	if (sortseg == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("could not map dynamic shared memory segment")));
+	sharedsort = (Sharedsort *) dsm_segment_address(sortseg);
+	tuplesort_attach_shared(sharedsort, sortseg);
+
+	zheap_parallel_cluster_scan_and_sort(heap, index, shared, sharedsort,
+										 maintenance_work_mem /
+										 shared->scantuplesortstates);
+
+	dsm_detach(sortseg);
+	index_close(index, AccessExclusiveLock);
+	table_close(heap, AccessExclusiveLock);
+}
+
+/*
+ * Decide how many parallel workers to request for rewriting a table into
+ * zheap.  This follows compute_parallel_worker, as for a parallel scan of the
+ * table, but the result is limited by max_parallel_maintenance_workers.
+ */
+static int
+zheap_rewrite_plan_workers(Relation rel)
+{
+	BlockNumber heap_pages;
+	int			heap_parallel_threshold;
+	int			parallel_workers;
+
+	if (max_parallel_maintenance_workers == 0 || !IsUnderPostmaster ||
+		RelationUsesLocalBuffers(rel))
+		return 0;
+
+	parallel_workers = RelationGetParallelWorkers(rel, -1);
+	if (parallel_workers < 0)
+	{
+		heap_pages = RelationGetNumberOfBlocks(rel);
+		if (heap_pages < (BlockNumber) min_parallel_table_scan_size)
+			return 0;
+
+		parallel_workers = 1;
+		heap_parallel_threshold = Max(min_parallel_table_scan_size, 1);
+		while (heap_pages >= (BlockNumber) (heap_parallel_threshold * 3))
+		{
+			parallel_workers++;
+			heap_parallel_threshold *= 3;
+			if (heap_parallel_threshold > INT_MAX / 3)
+				break;			/* avoid overflow */
+		}
+	}
+
+	return Min(parallel_workers, max_parallel_maintenance_workers);
+}
+
+/*
+ * Copy the live tuples of OldHeap, a table of another access method, to
+ * NewHeap, for ALTER TABLE SET ACCESS METHOD zheap.
+ *
+ * As in CLUSTER, the tuples are frozen and no undo is written for them, so
+ * NewHeap must have been created in the current transaction, and the caller
+ * must hold AccessExclusiveLock on OldHeap.  If the table is large enough,
+ * the work is split among parallel workers.  The caller rebuilds the indexes
+ * afterwards, which can also be done in parallel.
+ *
+ * Returns the number of tuples copied.
+ */
+double
+zheap_rewrite_table(Relation OldHeap, Relation NewHeap)
+{
+	RewriteZheapState rwstate;
+	TableScanDesc scan;
+	TupleTableSlot *slot;
+	TupleDesc	tupdesc = RelationGetDescr(OldHeap);
+	Snapshot	snapshot;
+	Datum	   *values;
+	bool	   *isnull;
+	bool		use_wal;
+	int			nworkers;
+	double		num_tuples = 0;
+
+	Assert(RelationStorageIsZHeap(NewHeap));
+
+	/*
+	 * We need to log the copied data in WAL iff WAL archiving/streaming is
+	 * enabled AND it's a WAL-logged rel.
+	 */
+	use_wal = XLogIsNeeded() && RelationNeedsWAL(NewHeap);
+
+	/* use_wal off requires smgr_targblock be initially invalid */
+	Assert(RelationGetTargetBlock(NewHeap) == InvalidBlockNumber);
+
+	snapshot = RegisterSnapshot(GetLatestSnapshot());
+
+	nworkers = zheap_rewrite_plan_workers(OldHeap);
+	if (nworkers > 0 &&
+		zheap_parallel_rewrite(OldHeap, NewHeap, snapshot, use_wal, nworkers,
+							   &num_tuples))
+	{
+		UnregisterSnapshot(snapshot);
+		return num_tuples;
+	}
+
+	/* Not even a single worker could be launched, so do it ourselves. */
+	values = (Datum *) palloc(tupdesc->natts * sizeof(Datum));
+	isnull = (bool *) palloc(tupdesc->natts * sizeof(bool));
+
+	rwstate = begin_zheap_rewrite(OldHeap, NewHeap, InvalidTransactionId,
+								  InvalidTransactionId, InvalidMultiXactId,
+								  use_wal);
+
+	scan = table_beginscan(OldHeap, snapshot, 0, NULL);
+	slot = table_slot_create(OldHeap, NULL);
+
+	while (table_scan_getnextslot(scan, ForwardScanDirection, slot))
+	{
+		CHECK_FOR_INTERRUPTS();
+
+		num_tuples += 1;
+		slot_getallattrs(slot);
+		memcpy(values, slot->tts_values, tupdesc->natts * sizeof(Datum));
+		memcpy(isnull, slot->tts_isnull, tupdesc->natts * sizeof(bool));
+		reform_and_rewrite_ztuple(tupdesc, tupdesc, values, isnull, rwstate);
+	}
+
+	ExecDropSingleTupleTableSlot(slot);
+	table_endscan(scan);
+	UnregisterSnapshot(snapshot);
+
+	end_zheap_rewrite(rwstate);
+
+	pfree(values);
+	pfree(isnull);
+
+	return num_tuples;
+}
+
+/*
+ * Rewrite OldHeap into NewHeap with the help of parallel workers.
+ *
+ * request is the target number of parallel worker processes to launch.
+ * Returns false, without having copied anything, if not even a single worker
+ * process can be launched.  Otherwise, *num_tuples is set to the number of
+ * tuples copied.
+ */
+static bool
+zheap_parallel_rewrite(Relation OldHeap, Relation NewHeap, Snapshot snapshot,
+					   bool use_wal, int request, double *num_tuples)
+{
+	ParallelContext *pcxt;
+	ZRewriteShared *shared;
+	dsm_segment *spillseg;
+	SharedFileSet *fileset;
+	SharedTuplestoreAccessor *spill;
+	RewriteZheapState rwstate;
+	TupleTableSlot *slot;
+	TupleDesc	tupdesc = RelationGetDescr(OldHeap);
+	MinimalTuple tuple;
+	Datum	   *values;
+	bool	   *isnull;
+	Size		estshared;
+	Size		estspill;
+	int			nparticipants;
+	int			querylen = 0;
+	int			nkeys = 1;
+
+	Assert(request > 0);
+
+	EnterParallelMode();
+	pcxt = CreateParallelContext("postgres", "zheap_parallel_rewrite_main",
+								 request);
+
+	/* c.f. shm_toc_allocate as to why BUFFERALIGN is used */
+	estshared = add_size(BUFFERALIGN(sizeof(ZRewriteShared)),
+						 table_parallelscan_estimate(OldHeap, snapshot));
+	shm_toc_estimate_chunk(&pcxt->estimator, estshared);
+
+	if (debug_query_string)
+	{
+		querylen = strlen(debug_query_string);
+		shm_toc_estimate_chunk(&pcxt->estimator, querylen + 1);
+		nkeys++;
+	}
+	shm_toc_estimate_keys(&pcxt->estimator, nkeys);
+
+	InitializeParallelDSM(pcxt);
+
+	/* Set up the tuplestore for the spilled tuples in a segment of its own. */
+	estspill = add_size(MAXALIGN(sizeof(SharedFileSet)),
+						sts_estimate(request + 1));
+	spillseg = dsm_create(estspill, 0);
+	fileset = (SharedFileSet *) dsm_segment_address(spillseg);
+	SharedFileSetInit(fileset, spillseg);
+	spill = sts_initialize(SharedTuplestoreFromSpill(fileset), request + 1,
+						   0, 0, 0, fileset, "zheap_rewrite");
+
+	shared = (ZRewriteShared *) shm_toc_allocate(pcxt->toc, estshared);
+	shared->oldheaprelid = RelationGetRelid(OldHeap);
+	shared->newheaprelid = RelationGetRelid(NewHeap);
+	shared->use_wal = use_wal;
+	shared->spillseg = dsm_segment_handle(spillseg);
+	LWLockInitialize(&shared->writelock, LWTRANCHE_ZHEAP_PARALLEL_REWRITE);
+	/* new_heap needn't be empty, just locked */
+	shared->nextblock = RelationGetNumberOfBlocks(NewHeap);
+	ConditionVariableInit(&shared->workersdonecv);
+	SpinLockInit(&shared->mutex);
+	shared->nparticipantsdone = 0;
+	shared->reltuples = 0.0;
+	table_parallelscan_initialize(OldHeap,
+								  ParallelTableScanFromZRewriteShared(shared),
+								  snapshot);
+	shm_toc_insert(pcxt->toc, PARALLEL_KEY_ZREWRITE_SHARED, shared);
+
+	if (debug_query_string)
+	{
+		char	   *sharedquery;
+
+		sharedquery = (char *) shm_toc_allocate(pcxt->toc, querylen + 1);
+		memcpy(sharedquery, debug_query_string, querylen + 1);
+		shm_toc_insert(pcxt->toc, PARALLEL_KEY_QUERY_TEXT, sharedquery);
+	}
+
+	LaunchParallelWorkers(pcxt);
+
+	/* If no workers were successfully launched, back out */
+	if (pcxt->nworkers_launched == 0)
+	{
+		WaitForParallelWorkersToFinish(pcxt);
+		DestroyParallelContext(pcxt);
+		ExitParallelMode();
+		dsm_detach(spillseg);
+		return false;
+	}
+	nparticipants = pcxt->nworkers_launched + 1;
+
+	/* Join the rewrite, then wait for the workers to finish theirs. */
+	zheap_parallel_rewrite_scan(OldHeap, NewHeap, shared, spill);
+
+	/* Make sure that the failure-to-start case will not hang forever. */
+	WaitForParallelWorkersToAttach(pcxt);
+
+	for (;;)
+	{
+		SpinLockAcquire(&shared->mutex);
+		if (shared->nparticipantsdone == nparticipants)
+		{
+			*num_tuples = shared->reltuples;
+			SpinLockRelease(&shared->mutex);
+			break;
+		}
+		SpinLockRelease(&shared->mutex);
+
+		ConditionVariableSleep(&shared->workersdonecv,
+							   WAIT_EVENT_PARALLEL_ZHEAP_REWRITE);
+	}
+	ConditionVariableCancelSleep();
+
+	/*
+	 * The spilled tuples are in the separate spill segment, so we can leave
+	 * parallel mode before writing them.
+	 */
+	WaitForParallelWorkersToFinish(pcxt);
+	DestroyParallelContext(pcxt);
+	ExitParallelMode();
+
+	/* Now write the spilled tuples, toasting them on the way. */
+	values = (Datum *) palloc(tupdesc->natts * sizeof(Datum));
+	isnull = (bool *) palloc(tupdesc->natts * sizeof(bool));
+
+	rwstate = begin_zheap_rewrite(OldHeap, NewHeap, InvalidTransactionId,
+								  InvalidTransactionId, InvalidMultiXactId,
+								  use_wal);
+
+	slot = MakeSingleTupleTableSlot(tupdesc, &TTSOpsMinimalTuple);
+
+	sts_begin_parallel_scan(spill);
+	while ((tuple = sts_parallel_scan_next(spill, NULL)) != NULL)
+	{
+		CHECK_FOR_INTERRUPTS();
+
+		ExecStoreMinimalTuple(tuple, slot, false);
+		slot_getallattrs(slot);
+		memcpy(values, slot->tts_values, tupdesc->natts * sizeof(Datum));
+		memcpy(isnull, slot->tts_isnull, tupdesc->natts * sizeof(bool));
+		reform_and_rewrite_ztuple(tupdesc, tupdesc, values, isnull, rwstate);
+	}
+	sts_end_parallel_scan(spill);
+
+	ExecDropSingleTupleTableSlot(slot);
+
+	/* This also syncs what the workers have written. */
+	end_zheap_rewrite(rwstate);
+
+	/* This removes the temporary files holding the spilled tuples. */
+	dsm_detach(spillseg);
+
+	pfree(values);
+	pfree(isnull);
+
+	return true;
+}
+
+/*
+ * Perform a participant's portion of a parallel rewrite into zheap.
+ *
+ * The tuples read from the blocks of the old heap handed out to us are
+ * written to pages of our own, except for those that have to be toasted,
+ * which go to the spill tuplestore.
+ */
+static void
+zheap_parallel_rewrite_scan(Relation OldHeap, Relation NewHeap,
+							ZRewriteShared *shared,
+							SharedTuplestoreAccessor *spill)
+{
+	RewriteZheapState rwstate;
+	TableScanDesc scan;
+	TupleTableSlot *slot;
+	TupleDesc	tupdesc = RelationGetDescr(OldHeap);
+	Datum	   *values;
+	bool	   *isnull;
+	double		reltuples = 0;
+	int			i;
+
+	values = (Datum *) palloc(tupdesc->natts * sizeof(Datum));
+	isnull = (bool *) palloc(tupdesc->natts * sizeof(bool));
+
+	rwstate = begin_zheap_rewrite(OldHeap, NewHeap, InvalidTransactionId,
+								  InvalidTransactionId, InvalidMultiXactId,
+								  shared->use_wal);
+	rwstate->rs_writelock = &shared->writelock;
+	rwstate->rs_nextblock = &shared->nextblock;
+
+	scan = table_beginscan_parallel(OldHeap,
+									ParallelTableScanFromZRewriteShared(shared));
+	slot = table_slot_create(OldHeap, NULL);
+
+	while (table_scan_getnextslot(scan, ForwardScanDirection, slot))
+	{
+		ZHeapTuple	tuple;
+
+		CHECK_FOR_INTERRUPTS();
+
+		reltuples += 1;
+		slot_getallattrs(slot);
+		memcpy(values, slot->tts_values, tupdesc->natts * sizeof(Datum));
+		memcpy(isnull, slot->tts_isnull, tupdesc->natts * sizeof(bool));
+
+		/* Be sure to null out any dropped columns */
+		for (i = 0; i < tupdesc->natts; i++)
+		{
+			if (TupleDescAttr(tupdesc, i)->attisdropped)
+				isnull[i] = true;
+		}
+
+		tuple = zheap_form_tuple(tupdesc, values, isnull);
+
+		/* Would raw_zheap_insert invoke the toaster? */
+		if (ZHeapTupleHasExternal(tuple) ||
+			tuple->t_len > TOAST_TUPLE_THRESHOLD)
+		{
+			MinimalTuple mtuple;
+			bool		shouldFree;
+
+			mtuple = ExecFetchSlotMinimalTuple(slot, &shouldFree);
+			sts_puttuple(spill, NULL, mtuple);
+			if (shouldFree)
+				pfree(mtuple);
+		}
+		else
+			rewrite_zheap_tuple(rwstate, tuple);
+
+		zheap_freetuple(tuple);
+	}
+
+	ExecDropSingleTupleTableSlot(slot);
+	table_endscan(scan);
+
+	sts_end_write(spill);
+	end_zheap_rewrite(rwstate);
+
+	pfree(values);
+	pfree(isnull);
+
+	SpinLockAcquire(&shared->mutex);
+	shared->nparticipantsdone++;
+	shared->reltuples += reltuples;
+	SpinLockRelease(&shared->mutex);
+
+	/* Notify leader */
+	ConditionVariableSignal(&shared->workersdonecv);
+}
+
+/*
+ * Perform work of a parallel rewrite into zheap within a launched parallel
+ * process.
+ */
+void
+zheap_parallel_rewrite_main(dsm_segment *seg, shm_toc *toc)
+{
+	ZRewriteShared *shared;
+	dsm_segment *spillseg;
+	SharedFileSet *fileset;
+	SharedTuplestoreAccessor *spill;
+	Relation	OldHeap;
+	Relation	NewHeap;
+	char	   *sharedquery;
+
+	/* Set debug_query_string for individual workers first */
+	sharedquery = shm_toc_lookup(toc, PARALLEL_KEY_QUERY_TEXT, true);
+	debug_query_string = sharedquery;
+
+	/* Report the query string from leader */
+	pgstat_report_activity(STATE_RUNNING, debug_query_string);
+
+	shared = shm_toc_lookup(toc, PARALLEL_KEY_ZREWRITE_SHARED, false);
+
+	/*
+	 * Open relations with the lock mode obtained by ALTER TABLE; the leader
+	 * already holds it, so we won't conflict with it.
+	 */
+	OldHeap = table_open(shared->oldheaprelid, AccessExclusiveLock);
+	NewHeap = table_open(shared->newheaprelid, AccessExclusiveLock);
+
+	spillseg = dsm_attach(shared->spillseg);
+	if (spillseg == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("could not map dynamic shared memory segment")));
+	fileset = (SharedFileSet *) dsm_segment_address(spillseg);
+	SharedFileSetAttach(fileset, spillseg);
+	spill = sts_attach(SharedTuplestoreFromSpill(fileset),
+					   ParallelWorkerNumber + 1, fileset);
+
+	zheap_parallel_rewrite_scan(OldHeap, NewHeap, shared, spill);
+
+	dsm_detach(spillseg);
+	table_close(NewHeap, AccessExclusiveLock);
+	table_close(OldHeap, AccessExclusiveLock);
+}
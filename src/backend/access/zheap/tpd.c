@@ -37,11 +37,14 @@
 #include "access/zheap.h"
 #include "access/zheapam_xlog.h"
 #include "miscadmin.h"
+#include "pgstat.h"
 #include "storage/bufmgr.h"
 #include "storage/buf_internals.h"
 #include "storage/lmgr.h"
 #include "storage/proc.h"
+#include "utils/hashutils.h"
 #include "utils/lsyscache.h"
+#include "utils/memutils.h"
 #include "utils/relfilenodemap.h"
 
 /*
@@ -89,6 +92,37 @@ typedef enum
 	TPD_BUF_ENTER
 } TPDACTION;
 
+/*
+ * Backend-local cache of TPD entries, used by TPDPageGetTransactionSlotInfo
+ * when the caller doesn't hold a lock on the TPD buffer, so that repeated
+ * visibility checks on tuples of the same heap page don't have to look up
+ * the relation, then read and lock the TPD page each time.
+ *
+ * Each entry is a copy of the offset map and transaction slots of the TPD
+ * entry of one heap block, and is valid as long as the LSN of the heap page
+ * hasn't changed: whenever the TPD entry of a heap page is modified or
+ * moved, the heap page is modified by the same WAL record.  A TPD entry can
+ * also be pruned without touching its heap page, but only once all of its
+ * transactions are older than oldestXidHavingUndo, so we treat slots of such
+ * transactions as frozen, as the caller would have seen if it read the TPD
+ * page.  Pages that aren't WAL-logged have no LSN to check and are never
+ * cached.
+ */
+#define TPD_ENTRY_CACHE_SIZE		64
+#define TPD_ENTRY_CACHE_MAX_DATA	1024
+
+typedef struct TPDEntryCacheEntry
+{
+	RelFileNode rnode;
+	ForkNumber	forknum;
+	BlockNumber heapblk;
+	XLogRecPtr	heap_lsn;		/* InvalidXLogRecPtr, if the entry is unused */
+	TPDEntryHeaderData tpd_e_hdr;
+	char		data[TPD_ENTRY_CACHE_MAX_DATA];	/* offset map and slots */
+} TPDEntryCacheEntry;
+
+static TPDEntryCacheEntry *TPDEntryCache = NULL;
+
 static Buffer registered_tpd_buffers[MAX_TPD_BUFFERS];
 static TPDBuffers tpd_buffers[MAX_TPD_BUFFERS];
 static int	tpd_buf_idx;
@@ -112,6 +146,15 @@ static bool TPDPageIsValid(Relation relation, Buffer heapbuf,
 						   TPDEntryHeaderData *tpd_e_hdr,
 						   bool clean_tpd_loc,
 						   bool is_tpd_buf_locked);
+static TPDEntryCacheEntry *TPDEntryCacheGetEntry(RelFileNode *rnode,
+												 ForkNumber forknum,
+												 BlockNumber heapblk);
+static int	TPDEntryGetTransactionSlotInfo(TPDEntryHeaderData *tpd_e_hdr,
+										   char *tpd_entry_data,
+										   Page heappage, int trans_slot,
+										   OffsetNumber offset,
+										   FullTransactionId *fxid,
+										   UndoRecPtr *urec_ptr);
 
 void
 ResetRegisteredTPDBuffers()
@@ -300,7 +343,7 @@ AllocateAndFormTPDEntry(Buffer buf, OffsetNumber offset,
 	 * transaction slot in TPD entry.
 	 */
 	zopaque = (ZHeapPageOpaque) PageGetSpecialPointer(page);
-	last_trans_slot_info = zopaque->transinfo[ZHEAP_PAGE_TRANS_SLOTS - 1];
+	last_trans_slot_info = zopaque->transinfo[ZHeapPageGetNumTransSlots(page) - 1];
 
 	tpd_e_trans_slots[0].fxid = last_trans_slot_info.fxid;
 	tpd_e_trans_slots[0].urec_ptr = last_trans_slot_info.urec_ptr;
@@ -353,11 +396,11 @@ AllocateAndFormTPDEntry(Buffer buf, OffsetNumber offset,
 		 * offsets corresponding to tuples that were pointing to last slot in
 		 * heap page will now point to first slot in TPD entry.
 		 */
-		if (trans_slot == ZHEAP_PAGE_TRANS_SLOTS)
+		if (trans_slot == ZHeapPageGetNumTransSlots(page))
 		{
 			uint8		offset_tpd_e_loc;
 
-			offset_tpd_e_loc = ZHEAP_PAGE_TRANS_SLOTS + 1;
+			offset_tpd_e_loc = ZHeapPageGetNumTransSlots(page) + 1;
 
 			/*
 			 * One byte access shouldn't cause unaligned access, but using
@@ -376,7 +419,7 @@ AllocateAndFormTPDEntry(Buffer buf, OffsetNumber offset,
 	 * from heap page.  We can safely reserve the second slot location in new
 	 * TPD entry.
 	 */
-	*reserved_slot = ZHEAP_PAGE_TRANS_SLOTS + 2;
+	*reserved_slot = ZHeapPageGetNumTransSlots(page) + 2;
 
 	/* be tidy */
 	pfree(tpd_e_trans_slots);
@@ -479,7 +522,7 @@ ExtendTPDEntry(Relation relation, Buffer heapbuf, TransInfo *trans_slots,
 	 * in the heap page. The one-byte offset-map can store maximum up to 255
 	 * transaction slot number.
 	 */
-	if (max_reqd_slots + ZHEAP_PAGE_TRANS_SLOTS < 256)
+	if (max_reqd_slots + ZHeapPageGetNumTransSlots(heappage) < 256)
 		new_size_tpd_e_map = max_reqd_map_entries * sizeof(uint8);
 	else
 		new_size_tpd_e_map = max_reqd_map_entries * sizeof(uint32);
@@ -596,7 +639,7 @@ ExtendTPDEntry(Relation relation, Buffer heapbuf, TransInfo *trans_slots,
 	 * in the heap page. The one-byte offset-map can store maximum up to 255
 	 * transaction slot number.
 	 */
-	if (max_reqd_slots + ZHEAP_PAGE_TRANS_SLOTS < 256)
+	if (max_reqd_slots + ZHeapPageGetNumTransSlots(heappage) < 256)
 		tpd_e_header.tpe_flags = TPE_ONE_BYTE;
 	else
 		tpd_e_header.tpe_flags = TPE_FOUR_BYTE;
@@ -888,7 +931,7 @@ SetTPDLocation(Buffer heapbuffer, Buffer tpdbuffer, OffsetNumber offset)
 	phdr = (PageHeader) heappage;
 
 	opaque = (ZHeapPageOpaque) PageGetSpecialPointer(heappage);
-	transinfo = &opaque->transinfo[ZHEAP_PAGE_TRANS_SLOTS - 1];
+	transinfo = &opaque->transinfo[ZHeapPageGetNumTransSlots(heappage) - 1];
 
 	/* clear the last transaction slot info */
 	transinfo->fxid = InvalidFullTransactionId;
@@ -910,11 +953,12 @@ ClearTPDLocation(Buffer heapbuf)
 	PageHeader	phdr;
 	ZHeapPageOpaque opaque;
 	Page		heappage;
-	int			frozen_slots = ZHEAP_PAGE_TRANS_SLOTS - 1;
+	int			frozen_slots;
 	TransInfo  *transinfo;
 
 	heappage = BufferGetPage(heapbuf);
 	phdr = (PageHeader) heappage;
+	frozen_slots = ZHeapPageGetNumTransSlots(heappage) - 1;
 
 	/*
 	 * Before clearing the TPD slot, mark all the tuples pointing to TPD slot
@@ -924,7 +968,7 @@ ClearTPDLocation(Buffer heapbuf)
 									  true, false);
 
 	opaque = (ZHeapPageOpaque) PageGetSpecialPointer(heappage);
-	transinfo = &opaque->transinfo[ZHEAP_PAGE_TRANS_SLOTS - 1];
+	transinfo = &opaque->transinfo[ZHeapPageGetNumTransSlots(heappage) - 1];
 
 	/* clear the last transaction slot info */
 	transinfo->fxid = InvalidFullTransactionId;
@@ -988,7 +1032,10 @@ TPDInitPage(Page page, Size pageSize)
 /*
  * TPDFreePage - Remove the TPD page from the chain.
  *
- * Initialize the empty page and remove it from the chain.  This function
+ * Initialize the empty page, remove it from the chain and put it on the free
+ * list of the metapage, from where TPDAllocatePageAndAddEntry takes it again
+ * before extending the relation.  The page keeps being a TPD page, so that
+ * vacuum neither hands it out through the FSM nor truncates it.  This function
  * ensures that the buffers are locked such that the block that exists prior
  * in chain gets locked first and meta page is locked at end after which no
  * existing page is locked.  This is to avoid deadlocks, see comments atop
@@ -1013,10 +1060,10 @@ TPDFreePage(Relation rel, Buffer buf, BufferAccessStrategy bstrategy)
 	BlockNumber curblkno PG_USED_FOR_ASSERTS_ONLY = InvalidBlockNumber;
 	BlockNumber prevblkno = InvalidBlockNumber;
 	BlockNumber nextblkno = InvalidBlockNumber;
+	BlockNumber nextfreeblkno;
 	Buffer		prevbuf = InvalidBuffer;
 	Buffer		nextbuf = InvalidBuffer;
 	Buffer		metabuf = InvalidBuffer;
-	bool		update_meta = false;
 
 	/* Get the page from buffer. */
 	page = BufferGetPage(buf);
@@ -1024,6 +1071,10 @@ TPDFreePage(Relation rel, Buffer buf, BufferAccessStrategy bstrategy)
 	/* Page should be an empty TPD page. */
 	Assert(IsTPDPage(page) && PageIsEmpty(page));
 
+	/* Nothing to do, if it's been freed already. */
+	if (TPDPageIsFree(page))
+		return false;
+
 	/*
 	 * We must acquire the cleanup lock here to wait for backends that have
 	 * already read this buffer and might be in the process of deciding
@@ -1047,8 +1098,8 @@ TPDFreePage(Relation rel, Buffer buf, BufferAccessStrategy bstrategy)
 	 *
 	 * One can imagine that after we release the lock, vacuum or some other
 	 * process can record this page in FSM, but that is not possible as we
-	 * haven't cleared the special space which will make it appear as a TPD
-	 * page and it will just ignore this page.  See lazy_scan_zheap.
+	 * never clear the special space which will make it appear as a TPD page
+	 * and it will just ignore this page.  See lazy_scan_zheap.
 	 */
 	LockBuffer(buf, BUFFER_LOCK_UNLOCK);
 	LockBufferForCleanup(buf);
@@ -1065,7 +1116,7 @@ TPDFreePage(Relation rel, Buffer buf, BufferAccessStrategy bstrategy)
 	 * that the empty page in the chain can be reused, however, in future, we
 	 * can use it.
 	 */
-	if (!PageIsEmpty(page))
+	if (!PageIsEmpty(page) || TPDPageIsFree(page))
 		return false;
 
 	curblkno = BufferGetBlockNumber(buf);
@@ -1097,7 +1148,7 @@ TPDFreePage(Relation rel, Buffer buf, BufferAccessStrategy bstrategy)
 		 * re-acquiried the lock.
 		 */
 		Assert(IsTPDPage(page));
-		if (!PageIsEmpty(page))
+		if (!PageIsEmpty(page) || TPDPageIsFree(page))
 		{
 			UnlockReleaseBuffer(prevbuf);
 			return false;
@@ -1123,16 +1174,13 @@ TPDFreePage(Relation rel, Buffer buf, BufferAccessStrategy bstrategy)
 
 	START_CRIT_SECTION();
 
-	/*
-	 * Update the current page so that it can be reused as new TPD or zheap
-	 * page from FSM.
-	 * Here, we will meset full page as zero because if we will not do this,
-	 * then from RelationGetBufferForZTuple, it will be costly to decide that
-	 * page is still in meta list or not because it is possible that empty TPD
-	 * page is still in meta list(see ExtendTPDEntry, there we can make page
-	 * as empty and will not remove from mera list to avoid deadlock).
-	 */
-	MemSet((PageHeader) page, 0, BufferGetPageSize(buf));
+	/* Reinitialize the current page and push it onto the free list. */
+	nextfreeblkno = metapage->zhm_free_tpd_page;
+	TPDInitPage(page, BufferGetPageSize(buf));
+	tpdopaque = (TPDPageOpaque) PageGetSpecialPointer(page);
+	tpdopaque->tpd_prevblkno = ZHEAP_METAPAGE;
+	tpdopaque->tpd_nextblkno = nextfreeblkno;
+	metapage->zhm_free_tpd_page = curblkno;
 
 	MarkBufferDirty(buf);
 
@@ -1197,9 +1245,6 @@ TPDFreePage(Relation rel, Buffer buf, BufferAccessStrategy bstrategy)
 			/* one of the above two conditions must be satisfied. */
 			Assert(false);
 		}
-
-		MarkBufferDirty(metabuf);
-		update_meta = true;
 	}
 	else
 	{
@@ -1210,14 +1255,18 @@ TPDFreePage(Relation rel, Buffer buf, BufferAccessStrategy bstrategy)
 		Assert(metapage->zhm_last_used_tpd_page != curblkno);
 	}
 
+	MarkBufferDirty(metabuf);
+
 	if (RelationNeedsWAL(rel))
 	{
 		XLogRecPtr	recptr;
 		xl_tpd_free_page xlrec;
-		uint8		info = XLOG_TPD_FREE_PAGE;
+		xl_zheap_metadata xl_meta;
+		uint8		info = XLOG_TPD_FREE_PAGE | XLOG_TPD_INIT_PAGE;
 
 		xlrec.prevblkno = prevblkno;
 		xlrec.nextblkno = nextblkno;
+		xlrec.nextfreeblkno = nextfreeblkno;
 
 		XLogBeginInsert();
 		XLogRegisterData((char *) &xlrec, SizeOfTPDFreePage);
@@ -1226,25 +1275,22 @@ TPDFreePage(Relation rel, Buffer buf, BufferAccessStrategy bstrategy)
 		XLogRegisterBuffer(1, buf, REGBUF_STANDARD);
 		if (BufferIsValid(nextbuf))
 			XLogRegisterBuffer(2, nextbuf, REGBUF_STANDARD);
-		if (update_meta)
-		{
-			xl_zheap_metadata xl_meta;
 
-			info |= XLOG_TPD_INIT_PAGE;
-			xl_meta.first_used_tpd_page = metapage->zhm_first_used_tpd_page;
-			xl_meta.last_used_tpd_page = metapage->zhm_last_used_tpd_page;
-			XLogRegisterBuffer(3, metabuf, REGBUF_STANDARD | REGBUF_WILL_INIT);
-			XLogRegisterBufData(3, (char *) &xl_meta, SizeOfMetaData);
-		}
+		xl_meta.first_used_tpd_page = metapage->zhm_first_used_tpd_page;
+		xl_meta.last_used_tpd_page = metapage->zhm_last_used_tpd_page;
+		xl_meta.free_tpd_page = metapage->zhm_free_tpd_page;
+		xl_meta.trans_slots = metapage->zhm_trans_slots;
+		XLogRegisterBuffer(3, metabuf, REGBUF_STANDARD | REGBUF_WILL_INIT);
+		XLogRegisterBufData(3, (char *) &xl_meta, SizeOfMetaData);
 
 		recptr = XLogInsert(RM_TPD_ID, info);
 
 		if (BufferIsValid(prevbuf))
 			PageSetLSN(prevpage, recptr);
+		PageSetLSN(page, recptr);
 		if (BufferIsValid(nextbuf))
 			PageSetLSN(nextpage, recptr);
-		if (update_meta)
-			PageSetLSN(BufferGetPage(metabuf), recptr);
+		PageSetLSN(BufferGetPage(metabuf), recptr);
 	}
 
 	END_CRIT_SECTION();
@@ -1296,6 +1342,49 @@ TPDEntryUpdate(Relation relation, TPDEntryInfo *tpd_info, uint16 tpd_e_offset)
 	END_CRIT_SECTION();
 }
 
+/*
+ * TPDReuseFreePage - Take a page from the free list of the metapage.
+ *
+ * The caller must hold an exclusive lock on the metapage.  Returns the page
+ * locked, or InvalidBuffer if the list is empty or its first page can't be
+ * locked right away.  The latter happens when another backend still looks at
+ * the page through a pruned TPD location; as we're already holding the
+ * metapage lock, waiting for it could deadlock.  The page stays on the list
+ * until the caller unlinks it, see TPDAllocatePageAndAddEntry.
+ */
+static Buffer
+TPDReuseFreePage(Relation relation, Buffer metabuf)
+{
+	ZHeapMetaPage metapage = ZHeapPageGetMeta(BufferGetPage(metabuf));
+	BlockNumber blkno = metapage->zhm_free_tpd_page;
+	Buffer		buf;
+	bool		already_exists;
+
+	if (!BlockNumberIsValid(blkno))
+		return InvalidBuffer;
+
+	/* We might be holding it ourselves, as the TPD page of another page. */
+	if (GetTPDBuffer(relation, blkno, InvalidBuffer, TPD_BUF_FIND,
+					 &already_exists) != -1)
+		return InvalidBuffer;
+
+	buf = ReadBuffer(relation, blkno);
+	if (!ConditionalLockBuffer(buf))
+	{
+		ReleaseBuffer(buf);
+		return InvalidBuffer;
+	}
+
+	Assert(IsTPDPage(BufferGetPage(buf)) &&
+		   TPDPageIsFree(BufferGetPage(buf)) &&
+		   PageIsEmpty(BufferGetPage(buf)));
+
+	GetTPDBuffer(relation, blkno, buf, TPD_BUF_FIND_OR_KNOWN_ENTER,
+				 &already_exists);
+
+	return buf;
+}
+
 /*
  * TPDAllocatePageAndAddEntry - Allocates a new tpd page if required and adds
  *								tpd entry.
@@ -1318,7 +1407,9 @@ TPDEntryUpdate(Relation relation, TPDEntryInfo *tpd_info, uint16 tpd_e_offset)
  * old buffer block will always be lesser (or equal) than last buffer block.
  * However, if anytime we change our strategy such that after acquiring
  * metapage lock we try to acquire lock on any existing page, then we might
- * need to reconsider our locking order.
+ * need to reconsider our locking order.  The only exception is a page taken
+ * from the free list, which is locked without waiting; if that fails, we
+ * release the locks and extend the relation instead.
  *
  * always_extend, this parameter indicates whether we can use FSM to get the
  * new TPD page or not.  This is required to avoid some deadlock hazards by
@@ -1341,8 +1432,11 @@ TPDAllocatePageAndAddEntry(Relation relation, Buffer metabuf, Buffer pagebuf,
 	BlockNumber prevblk = InvalidBlockNumber;
 	BlockNumber nextblk = InvalidBlockNumber;
 	BlockNumber last_used_tpd_page;
+	BlockNumber nextfreeblkno = InvalidBlockNumber;
 	OffsetNumber offset_num;
 	bool		free_last_used_tpd_buf = false;
+	bool		try_free_page = true;
+	bool		reuse_free_page = false;
 
 	if (add_new_tpd_page)
 	{
@@ -1430,8 +1524,24 @@ TPDAllocatePageAndAddEntry(Relation relation, Buffer metabuf, Buffer pagebuf,
 			}
 		}
 
+		metapage = ZHeapPageGetMeta(BufferGetPage(metabuf));
+		Assert(metapage->zhm_magic == ZHEAP_MAGIC);
+
+retry:
+
+		/*
+		 * Prefer a page from the free list over extending the relation.  We
+		 * have to lock the last used page before the free one, so it's taken
+		 * below.  An unlocked peek at the list is fine, we look again once we
+		 * hold the metapage lock.
+		 */
+		reuse_free_page = try_free_page && targetBlock == InvalidBlockNumber &&
+			BlockNumberIsValid(metapage->zhm_free_tpd_page);
+		if (reuse_free_page)
+			LockBuffer(metabuf, BUFFER_LOCK_EXCLUSIVE);
+
 		/* Extend the relation, if required? */
-		if (targetBlock == InvalidBlockNumber)
+		else if (targetBlock == InvalidBlockNumber)
 		{
 			/* Acquire the extension lock, if extension is required. */
 			needLock = !RELATION_IS_LOCAL(relation);
@@ -1456,15 +1566,13 @@ TPDAllocatePageAndAddEntry(Relation relation, Buffer metabuf, Buffer pagebuf,
 		 * available freespace which is zero in this case. This restricts
 		 * other backends from getting the same page from FSM.
 		 */
-		RecordPageWithFreeSpace(relation, targetBlock, 0);
+		if (!reuse_free_page)
+			RecordPageWithFreeSpace(relation, targetBlock, 0);
 
 		/*
 		 * Lock the last tpd page in list, so that we can append new page to
 		 * it.
 		 */
-		metapage = ZHeapPageGetMeta(BufferGetPage(metabuf));
-		Assert(metapage->zhm_magic == ZHEAP_MAGIC);
-
 recheck_meta:
 		last_used_tpd_page = metapage->zhm_last_used_tpd_page;
 		if (metapage->zhm_last_used_tpd_page != InvalidBlockNumber)
@@ -1501,6 +1609,24 @@ recheck_meta:
 				last_used_tpd_buf = tpd_buffers[buf_idx].buf;
 			}
 		}
+
+		/* Now that we won't release the metapage lock anymore, reuse. */
+		if (reuse_free_page)
+		{
+			tpd_buf = TPDReuseFreePage(relation, metabuf);
+			if (!BufferIsValid(tpd_buf))
+			{
+				LockBuffer(metabuf, BUFFER_LOCK_UNLOCK);
+				if (free_last_used_tpd_buf)
+					UnlockReleaseBuffer(last_used_tpd_buf);
+				last_used_tpd_buf = InvalidBuffer;
+				free_last_used_tpd_buf = false;
+				try_free_page = false;
+				goto retry;
+			}
+			nextfreeblkno = ((TPDPageOpaque)
+							 PageGetSpecialPointer(BufferGetPage(tpd_buf)))->tpd_nextblkno;
+		}
 	}
 	else
 	{
@@ -1526,6 +1652,13 @@ recheck_meta:
 		tpdblkno = BufferGetBlockNumber(tpd_buf);
 		tpdopaque = (TPDPageOpaque) PageGetSpecialPointer(tpdpage);
 
+		/* Unlink the page from the free list, if it came from there. */
+		if (reuse_free_page)
+		{
+			Assert(metapage->zhm_free_tpd_page == tpdblkno);
+			metapage->zhm_free_tpd_page = nextfreeblkno;
+		}
+
 		if (metapage->zhm_first_used_tpd_page == InvalidBlockNumber)
 			metapage->zhm_first_used_tpd_page = tpdblkno;
 		else
@@ -1623,6 +1756,8 @@ recheck_meta:
 			XLogRegisterBuffer(2, metabuf, REGBUF_WILL_INIT | REGBUF_STANDARD);
 			metadata.first_used_tpd_page = metapage->zhm_first_used_tpd_page;
 			metadata.last_used_tpd_page = metapage->zhm_last_used_tpd_page;
+			metadata.free_tpd_page = metapage->zhm_free_tpd_page;
+			metadata.trans_slots = metapage->zhm_trans_slots;
 			XLogRegisterBufData(2, (char *) &metadata, SizeOfMetaData);
 
 			if (BufferIsValid(last_used_tpd_buf))
@@ -1809,6 +1944,8 @@ TPDAllocateAndReserveTransSlot(Relation relation, Buffer pagebuf,
 
 	ReleaseBuffer(metabuf);
 
+	pgstat_count_zheap_tpd_alloc(relation);
+
 	/*
 	 * Here, we don't release the tpd buffer in which we have added the newly
 	 * allocated TPD entry as that will be released once we update the
@@ -2225,7 +2362,7 @@ extend_entry_if_required:
 	 * in the heap page.
 	 */
 	if (result_slot_no != InvalidXactSlotId)
-		result_slot_no += (ZHEAP_PAGE_TRANS_SLOTS + 1);
+		result_slot_no += (ZHeapPageGetNumTransSlots(BufferGetPage(buf)) + 1);
 	else if (buf_idx != -1)
 		ReleaseLastTPDBuffer(tpd_buffers[buf_idx].buf, true);
 
@@ -2236,7 +2373,7 @@ extend_entry_if_required:
 	if (tpd_e_pruned)
 	{
 		Assert(result_slot_no == InvalidXactSlotId);
-		result_slot_no = ZHEAP_PAGE_TRANS_SLOTS;
+		result_slot_no = ZHeapPageGetNumTransSlots(BufferGetPage(buf));
 		*urec_ptr = InvalidUndoRecPtr;
 	}
 
@@ -2319,7 +2456,7 @@ TPDPageGetSlotIfExists(Relation relation, Buffer heapbuf, OffsetNumber offnum,
 	 * in the heap page.
 	 */
 	if (result_slot_no != InvalidXactSlotId)
-		result_slot_no += (ZHEAP_PAGE_TRANS_SLOTS + 1);
+		result_slot_no += (ZHeapPageGetNumTransSlots(BufferGetPage(heapbuf)) + 1);
 	else if (buf_idx != -1)
 		ReleaseLastTPDBuffer(tpd_buffers[buf_idx].buf, true);
 
@@ -2356,7 +2493,6 @@ TPDPageGetTransactionSlotInfo(Buffer heapbuf, int trans_slot,
 							  UndoRecPtr *urec_ptr, bool NoTPDBufLock,
 							  bool keepTPDBufLock)
 {
-	TransInfo	trans_slot_info;
 	RelFileNode rnode;
 	Buffer		tpdbuffer;
 	Page		tpdpage;
@@ -2365,19 +2501,51 @@ TPDPageGetTransactionSlotInfo(Buffer heapbuf, int trans_slot,
 				heapblk;
 	ForkNumber	forknum;
 	TPDEntryHeaderData tpd_e_hdr;
-	Size		size_tpd_e_map;
-	uint32		tpd_e_num_map_entries;
-	int			trans_slot_loc;
-	int			trans_slot_id = trans_slot;
+	Size		size_tpd_e_data;
+	int			trans_slot_id;
 	char	   *tpd_entry_data;
 	OffsetNumber tpdItemOff;
 	ItemId		itemId;
 	uint16		tpd_e_offset;
 	char		relpersistence;
 	bool		valid;
+	TPDEntryCacheEntry *centry = NULL;
+	XLogRecPtr	heap_lsn = InvalidXLogRecPtr;
 
 	heappage = BufferGetPage(heapbuf);
 
+	/*
+	 * If we would have to read the TPD page ourselves, first check whether we
+	 * have a copy of the entry that is still valid.
+	 */
+	if (NoTPDBufLock && !keepTPDBufLock && !InRecovery)
+	{
+		heap_lsn = BufferGetLSNAtomic(heapbuf);
+		if (!XLogRecPtrIsInvalid(heap_lsn))
+		{
+			BufferGetTag(heapbuf, &rnode, &forknum, &heapblk);
+			centry = TPDEntryCacheGetEntry(&rnode, forknum, heapblk);
+			if (centry->heap_lsn == heap_lsn &&
+				RelFileNodeEquals(centry->rnode, rnode) &&
+				centry->forknum == forknum && centry->heapblk == heapblk)
+			{
+				FullTransactionId slot_fxid;
+
+				trans_slot_id =
+					TPDEntryGetTransactionSlotInfo(&centry->tpd_e_hdr,
+												   centry->data, heappage,
+												   trans_slot, offset,
+												   &slot_fxid, urec_ptr);
+				if (FullTransactionIdIsValid(slot_fxid) &&
+					FullTransactionIdOlderThanAllUndo(slot_fxid))
+					goto slot_is_frozen_and_buf_not_locked;
+				if (fxid)
+					*fxid = slot_fxid;
+				return trans_slot_id;
+			}
+		}
+	}
+
 	GetTPDBlockAndOffset(heappage, &tpdblk, &tpdItemOff);
 
 	if (NoTPDBufLock)
@@ -2474,13 +2642,67 @@ TPDPageGetTransactionSlotInfo(Buffer heapbuf, int trans_slot,
 	/* We should never access deleted entry. */
 	Assert(!TPDEntryIsDeleted(tpd_e_hdr));
 
-	tpd_e_num_map_entries = tpd_e_hdr.tpe_num_map_entries;
 	tpd_entry_data = tpdpage + tpd_e_offset + SizeofTPDEntryHeader;
-	if (tpd_e_hdr.tpe_flags & TPE_ONE_BYTE)
+	trans_slot_id = TPDEntryGetTransactionSlotInfo(&tpd_e_hdr, tpd_entry_data,
+												   heappage, trans_slot,
+												   offset, fxid, urec_ptr);
+
+	/* Remember the entry, if it's small enough. */
+	size_tpd_e_data = ItemIdGetLength(itemId) - SizeofTPDEntryHeader;
+	if (centry != NULL && size_tpd_e_data <= TPD_ENTRY_CACHE_MAX_DATA)
+	{
+		centry->rnode = rnode;
+		centry->forknum = forknum;
+		centry->heapblk = heapblk;
+		centry->heap_lsn = heap_lsn;
+		centry->tpd_e_hdr = tpd_e_hdr;
+		memcpy(centry->data, tpd_entry_data, size_tpd_e_data);
+	}
+
+	if (NoTPDBufLock && !keepTPDBufLock)
+		UnlockReleaseBuffer(tpdbuffer);
+
+	return trans_slot_id;
+
+slot_is_frozen:
+	if (NoTPDBufLock && !keepTPDBufLock)
+		UnlockReleaseBuffer(tpdbuffer);
+
+slot_is_frozen_and_buf_not_locked:
+	trans_slot_id = ZHTUP_SLOT_FROZEN;
+	if (fxid)
+		*fxid = InvalidFullTransactionId;
+	if (urec_ptr)
+		*urec_ptr = InvalidUndoRecPtr;
+
+	return trans_slot_id;
+}
+
+/*
+ * TPDEntryGetTransactionSlotInfo - Get the transaction information of the
+ *		given slot, or of the slot of the given offset, from the offset map
+ *		and slots of a TPD entry.
+ *
+ * Returns the TPD slot number.
+ */
+static int
+TPDEntryGetTransactionSlotInfo(TPDEntryHeaderData *tpd_e_hdr,
+							   char *tpd_entry_data, Page heappage,
+							   int trans_slot, OffsetNumber offset,
+							   FullTransactionId *fxid, UndoRecPtr *urec_ptr)
+{
+	TransInfo	trans_slot_info;
+	Size		size_tpd_e_map;
+	uint32		tpd_e_num_map_entries;
+	int			trans_slot_loc;
+	int			trans_slot_id = trans_slot;
+
+	tpd_e_num_map_entries = tpd_e_hdr->tpe_num_map_entries;
+	if (tpd_e_hdr->tpe_flags & TPE_ONE_BYTE)
 		size_tpd_e_map = tpd_e_num_map_entries * sizeof(uint8);
 	else
 	{
-		Assert(tpd_e_hdr.tpe_flags & TPE_FOUR_BYTE);
+		Assert(tpd_e_hdr->tpe_flags & TPE_FOUR_BYTE);
 		size_tpd_e_map = tpd_e_num_map_entries * sizeof(uint32);
 	}
 
@@ -2497,7 +2719,7 @@ TPDPageGetTransactionSlotInfo(Buffer heapbuf, int trans_slot,
 		Assert(offset <= tpd_e_num_map_entries);
 
 		/* Get TPD entry map */
-		if (tpd_e_hdr.tpe_flags & TPE_ONE_BYTE)
+		if (tpd_e_hdr->tpe_flags & TPE_ONE_BYTE)
 		{
 			uint8		offset_tpd_e_loc;
 
@@ -2521,10 +2743,10 @@ TPDPageGetTransactionSlotInfo(Buffer heapbuf, int trans_slot,
 	}
 
 	/* Transaction must belong to TPD entry. */
-	Assert(trans_slot_id > ZHEAP_PAGE_TRANS_SLOTS);
+	Assert(trans_slot_id > ZHeapPageGetNumTransSlots(heappage));
 
 	/* Get the required transaction slot information. */
-	trans_slot_loc = (trans_slot_id - ZHEAP_PAGE_TRANS_SLOTS - 1) *
+	trans_slot_loc = (trans_slot_id - ZHeapPageGetNumTransSlots(heappage) - 1) *
 		sizeof(TransInfo);
 	memcpy((char *) &trans_slot_info,
 		   tpd_entry_data + size_tpd_e_map + trans_slot_loc,
@@ -2536,23 +2758,28 @@ TPDPageGetTransactionSlotInfo(Buffer heapbuf, int trans_slot,
 	if (urec_ptr)
 		*urec_ptr = trans_slot_info.urec_ptr;
 
-	if (NoTPDBufLock && !keepTPDBufLock)
-		UnlockReleaseBuffer(tpdbuffer);
-
 	return trans_slot_id;
+}
 
-slot_is_frozen:
-	if (NoTPDBufLock && !keepTPDBufLock)
-		UnlockReleaseBuffer(tpdbuffer);
+/*
+ * TPDEntryCacheGetEntry - Get the TPD entry cache entry that the given heap
+ *		block maps to, whichever heap block it currently holds.
+ */
+static TPDEntryCacheEntry *
+TPDEntryCacheGetEntry(RelFileNode *rnode, ForkNumber forknum,
+					  BlockNumber heapblk)
+{
+	uint32		h;
 
-slot_is_frozen_and_buf_not_locked:
-	trans_slot_id = ZHTUP_SLOT_FROZEN;
-	if (fxid)
-		*fxid = InvalidFullTransactionId;
-	if (urec_ptr)
-		*urec_ptr = InvalidUndoRecPtr;
+	if (TPDEntryCache == NULL)
+		TPDEntryCache = (TPDEntryCacheEntry *)
+			MemoryContextAllocZero(TopMemoryContext,
+								   TPD_ENTRY_CACHE_SIZE *
+								   sizeof(TPDEntryCacheEntry));
 
-	return trans_slot_id;
+	h = murmurhash32(rnode->relNode ^ murmurhash32(heapblk) ^ forknum);
+
+	return &TPDEntryCache[h % TPD_ENTRY_CACHE_SIZE];
 }
 
 /*
@@ -2630,7 +2857,7 @@ TPDPageSetTransactionSlotInfo(Buffer heapbuf, int trans_slot_id,
 		size_tpd_e_map = tpd_e_hdr.tpe_num_map_entries * sizeof(uint32);
 
 	/* Set the required transaction slot information. */
-	trans_slot_loc = (trans_slot_id - ZHEAP_PAGE_TRANS_SLOTS - 1) *
+	trans_slot_loc = (trans_slot_id - ZHeapPageGetNumTransSlots(heappage) - 1) *
 		sizeof(TransInfo);
 	trans_slot_info.fxid = fxid;
 	trans_slot_info.urec_ptr = urec_ptr;
@@ -2798,6 +3025,24 @@ TPDPageGetOffsetMap(Buffer heapbuf, char *tpd_offset_map, int map_size)
 	memcpy(tpd_offset_map, tpd_entry_data, map_size);
 }
 
+/*
+ * TPDPageGetOffsetMapData - Get the Offset map array of the TPD entry without
+ *							 copying it.
+ *
+ * This is for callers that need the slot of every item on the heap page, so
+ * that they can locate the TPD entry once rather than once per item.  The
+ * returned pointer points into the TPD page, so it's only valid as long as the
+ * caller holds the lock on the TPD buffer.  The number of map entries and the
+ * size of each are returned in *num_entries and *entry_size.
+ *
+ * Returns NULL, if the tpd entry gets pruned away.
+ */
+char *
+TPDPageGetOffsetMapData(Buffer heapbuf, int *num_entries, int *entry_size)
+{
+	return GetTPDEntryData(heapbuf, num_entries, entry_size, NULL);
+}
+
 /*
  * TPDPageGetOffsetMapSize - Get the Offset map size of the TPD entry.
  *
@@ -2990,7 +3235,7 @@ TPDPageSetUndo(Buffer heapbuf, int trans_slot_id, bool set_tpd_map_slot,
 	}
 
 	/* Update the required transaction slot information. */
-	trans_slot_loc = (trans_slot_id - ZHEAP_PAGE_TRANS_SLOTS - 1) *
+	trans_slot_loc = (trans_slot_id - ZHeapPageGetNumTransSlots(heappage) - 1) *
 		sizeof(TransInfo);
 	trans_slot_info.fxid = fxid;
 	trans_slot_info.urec_ptr = urec_ptr;
@@ -3102,7 +3347,7 @@ GetTPDBlockAndOffset(Page heap_page, BlockNumber *tpd_blk,
 
 	/* The last slot in page has the address of the required TPD entry. */
 	zopaque = (ZHeapPageOpaque) PageGetSpecialPointer(heap_page);
-	trans_info = zopaque->transinfo[ZHEAP_PAGE_TRANS_SLOTS - 1];
+	trans_info = zopaque->transinfo[ZHeapPageGetNumTransSlots(heap_page) - 1];
 
 	/*
 	 * ZBORKED: This should be done through a union, not an undocumented hack
@@ -115,7 +115,9 @@ tpd_xlog_allocate_entry(XLogReaderState *record)
 		xlrecmeta = (xl_zheap_metadata *) ptr;
 
 		zheap_init_meta_page(metabuf, xlrecmeta->first_used_tpd_page,
-							 xlrecmeta->last_used_tpd_page);
+							 xlrecmeta->last_used_tpd_page,
+							 xlrecmeta->free_tpd_page,
+							 xlrecmeta->trans_slots);
 		MarkBufferDirty(metabuf);
 		PageSetLSN(BufferGetPage(metabuf), lsn);
 
@@ -372,10 +374,9 @@ tpd_xlog_free_page(XLogReaderState *record)
 				prevbuf = InvalidBuffer,
 				nextbuf = InvalidBuffer,
 				metabuf = InvalidBuffer;
-	BlockNumber blkno;
+	BlockNumber blkno PG_USED_FOR_ASSERTS_ONLY;
 	Page		page;
 	XLogRedoAction action;
-	Size		freespace;
 
 	if (XLogRecHasBlockRef(record, 0))
 	{
@@ -409,15 +410,19 @@ tpd_xlog_free_page(XLogReaderState *record)
 	 */
 	if (action == BLK_NEEDS_REDO || action == BLK_RESTORED)
 	{
-		MemSet((PageHeader) page, 0, BufferGetPageSize(buffer));
+		TPDPageOpaque tpdopaque;
+
+		/* Put the page on the free list. */
+		TPDInitPage(page, BufferGetPageSize(buffer));
+		tpdopaque = (TPDPageOpaque) PageGetSpecialPointer(page);
+		tpdopaque->tpd_prevblkno = ZHEAP_METAPAGE;
+		tpdopaque->tpd_nextblkno = xlrec->nextfreeblkno;
 
 		MarkBufferDirty(buffer);
+		PageSetLSN(page, lsn);
 	}
 
-	/* Page should be marked as NEW. */
-	Assert(PageIsNew(page));
 	Assert(blkno == BufferGetBlockNumber(buffer));
-	freespace = BLCKSZ - SizeOfPageHeaderData;
 
 	if (XLogRecHasBlockRef(record, 2))
 	{
@@ -450,7 +455,9 @@ tpd_xlog_free_page(XLogReaderState *record)
 		xlrecmeta = (xl_zheap_metadata *) ptr;
 
 		zheap_init_meta_page(metabuf, xlrecmeta->first_used_tpd_page,
-							 xlrecmeta->last_used_tpd_page);
+							 xlrecmeta->last_used_tpd_page,
+							 xlrecmeta->free_tpd_page,
+							 xlrecmeta->trans_slots);
 		MarkBufferDirty(metabuf);
 		PageSetLSN(BufferGetPage(metabuf), lsn);
 	}
@@ -463,9 +470,6 @@ tpd_xlog_free_page(XLogReaderState *record)
 		UnlockReleaseBuffer(nextbuf);
 	if (BufferIsValid(metabuf))
 		UnlockReleaseBuffer(metabuf);
-
-	/* Record the empty page in FSM. */
-	XLogRecordPageWithFreeSpace(rnode, blkno, freespace);
 }
 
 /*
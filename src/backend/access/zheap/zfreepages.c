@@ -0,0 +1,312 @@
+/*-------------------------------------------------------------------------
+ *
+ * zfreepages.c
+ *	  hints of recently freed zheap pages, and batched FSM updates
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ *
+ * IDENTIFICATION
+ *	  src/backend/access/zheap/zfreepages.c
+ *
+ * NOTES
+ *	  Zheap gets the space of deleted tuples back as soon as the deleting
+ *	  transaction is all-visible and the page is pruned, which autovacuum
+ *	  does on behalf of the scans that notice it.  Entering each such page
+ *	  into the FSM right away means one update of the FSM leaf and its upper
+ *	  levels per page, and inserters only find the space once the upper
+ *	  levels say so.  Instead, ZHeapRecordFreedPage queues the pages of one
+ *	  relation in backend-local memory and writes them to the FSM in
+ *	  batches, vacuuming the FSM only once over the range they span.
+ *
+ *	  Meanwhile, the page is also entered into a small table in shared
+ *	  memory, where each relation maps to a bucket of a few entries, and
+ *	  RelationGetBufferForZTuple asks ZHeapGetFreedPage before it asks the
+ *	  FSM.  An inserter takes the entry it uses out of the table, so that
+ *	  concurrent inserters don't all pile onto the same page.  The entries
+ *	  are only hints: the inserter still checks the page, and corrects the
+ *	  FSM if there's not enough room.  A newer page evicts the one with the
+ *	  least free space from a full bucket, and vacuum forgets the entries of
+ *	  the pages it truncates.
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "access/relation.h"
+#include "access/zfreepages.h"
+#include "miscadmin.h"
+#include "storage/freespace.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/hashutils.h"
+#include "utils/rel.h"
+
+typedef struct ZHeapFreedPageEntry
+{
+	RelFileNode rnode;
+	BlockNumber blkno;
+	uint32		freespace;		/* zero, if the entry is unused */
+} ZHeapFreedPageEntry;
+
+typedef struct ZHeapFreedPagesCtl
+{
+	LWLockPadded locks[NUM_ZFREEDPAGES_PARTITIONS];
+	ZHeapFreedPageEntry entries[FLEXIBLE_ARRAY_MEMBER];
+} ZHeapFreedPagesCtl;
+
+/* GUC: number of entries in the freed page table, zero disables it. */
+int			zheap_freed_page_hints = 1024;
+
+static ZHeapFreedPagesCtl *ZHeapFreedPages = NULL;
+
+/* FSM updates held back, all for the relation pending_relid. */
+static Oid	pending_relid = InvalidOid;
+static int	npending = 0;
+static BlockNumber pending_blocks[ZFREEDPAGES_BATCH_SIZE];
+static Size pending_space[ZFREEDPAGES_BATCH_SIZE];
+
+#define ZHeapFreedPagesNumBuckets() \
+	(zheap_freed_page_hints / ZFREEDPAGES_BUCKET_SIZE)
+
+#define ZHeapFreedPagesPartitionLock(bucket) \
+	(&ZHeapFreedPages->locks[(bucket) % NUM_ZFREEDPAGES_PARTITIONS].lock)
+
+/*
+ * Map a relation to its bucket in the table.
+ */
+static inline int
+ZHeapFreedPagesBucket(RelFileNode *rnode)
+{
+	uint32		h;
+
+	h = hash_combine(murmurhash32(rnode->relNode),
+					 murmurhash32(rnode->dbNode));
+
+	return h % ZHeapFreedPagesNumBuckets();
+}
+
+/*
+ * Report shared-memory space needed by ZHeapFreedPagesShmemInit.
+ */
+Size
+ZHeapFreedPagesShmemSize(void)
+{
+	if (ZHeapFreedPagesNumBuckets() == 0)
+		return 0;
+
+	return add_size(offsetof(ZHeapFreedPagesCtl, entries),
+					mul_size(ZHeapFreedPagesNumBuckets() *
+							 ZFREEDPAGES_BUCKET_SIZE,
+							 sizeof(ZHeapFreedPageEntry)));
+}
+
+/*
+ * Allocate and initialize the freed page table in shared memory.
+ */
+void
+ZHeapFreedPagesShmemInit(void)
+{
+	bool		found;
+	int			i;
+
+	if (ZHeapFreedPagesNumBuckets() == 0)
+		return;
+
+	ZHeapFreedPages = (ZHeapFreedPagesCtl *)
+		ShmemInitStruct("ZHeap Freed Pages", ZHeapFreedPagesShmemSize(),
+						&found);
+
+	if (!IsUnderPostmaster)
+	{
+		Assert(!found);
+
+		for (i = 0; i < NUM_ZFREEDPAGES_PARTITIONS; i++)
+			LWLockInitialize(&ZHeapFreedPages->locks[i].lock,
+							 LWTRANCHE_ZHEAP_FREED_PAGES);
+		for (i = 0; i < ZHeapFreedPagesNumBuckets() * ZFREEDPAGES_BUCKET_SIZE;
+			 i++)
+			ZHeapFreedPages->entries[i].freespace = 0;
+	}
+	else
+		Assert(found);
+}
+
+/*
+ * Remember that blkno of the relation has got freespace bytes free.
+ *
+ * The page is entered into the shared table right away, and into the FSM
+ * with the next flush, which happens once ZFREEDPAGES_BATCH_SIZE pages are
+ * queued, or a page of another relation comes along, or the caller calls
+ * ZHeapFlushFreedPages.
+ */
+void
+ZHeapRecordFreedPage(Relation relation, BlockNumber blkno, Size freespace)
+{
+	if (freespace == 0)
+		return;
+
+	if (ZHeapFreedPagesNumBuckets() > 0 && !RelationUsesLocalBuffers(relation))
+	{
+		ZHeapFreedPageEntry *entries;
+		ZHeapFreedPageEntry *victim = NULL;
+		bool		found = false;
+		int			bucket;
+		int			i;
+
+		bucket = ZHeapFreedPagesBucket(&relation->rd_node);
+		entries = &ZHeapFreedPages->entries[bucket * ZFREEDPAGES_BUCKET_SIZE];
+
+		LWLockAcquire(ZHeapFreedPagesPartitionLock(bucket), LW_EXCLUSIVE);
+		for (i = 0; i < ZFREEDPAGES_BUCKET_SIZE; i++)
+		{
+			ZHeapFreedPageEntry *entry = &entries[i];
+
+			if (entry->freespace != 0 && entry->blkno == blkno &&
+				RelFileNodeEquals(entry->rnode, relation->rd_node))
+			{
+				victim = entry;
+				found = true;
+				break;
+			}
+			if (victim == NULL || entry->freespace < victim->freespace)
+				victim = entry;
+		}
+		if (found || victim->freespace < freespace)
+		{
+			victim->rnode = relation->rd_node;
+			victim->blkno = blkno;
+			victim->freespace = (uint32) freespace;
+		}
+		LWLockRelease(ZHeapFreedPagesPartitionLock(bucket));
+	}
+
+	if (npending > 0 &&
+		(pending_relid != RelationGetRelid(relation) ||
+		 npending == ZFREEDPAGES_BATCH_SIZE))
+		ZHeapFlushFreedPages();
+
+	pending_relid = RelationGetRelid(relation);
+	pending_blocks[npending] = blkno;
+	pending_space[npending] = freespace;
+	npending++;
+}
+
+/*
+ * Write the queued free space to the FSM.
+ *
+ * This must be called within a transaction, as the relation is opened again
+ * here; if it has been dropped meanwhile, the updates are just forgotten.
+ */
+void
+ZHeapFlushFreedPages(void)
+{
+	Relation	relation;
+	BlockNumber minblk = InvalidBlockNumber;
+	BlockNumber maxblk = 0;
+	int			i;
+
+	if (npending == 0)
+		return;
+
+	relation = try_relation_open(pending_relid, AccessShareLock);
+	if (relation != NULL)
+	{
+		for (i = 0; i < npending; i++)
+		{
+			RecordPageWithFreeSpace(relation, pending_blocks[i],
+									pending_space[i]);
+			minblk = Min(minblk, pending_blocks[i]);
+			maxblk = Max(maxblk, pending_blocks[i]);
+		}
+		FreeSpaceMapVacuumRange(relation, minblk, maxblk + 1);
+		relation_close(relation, AccessShareLock);
+	}
+
+	npending = 0;
+	pending_relid = InvalidOid;
+}
+
+/*
+ * Find a recently freed page of the relation with at least spaceNeeded
+ * bytes free, according to the freed page table.  The entry is removed, and
+ * the page returned; InvalidBlockNumber if there is none.
+ */
+BlockNumber
+ZHeapGetFreedPage(Relation relation, Size spaceNeeded)
+{
+	ZHeapFreedPageEntry *entries;
+	BlockNumber blkno = InvalidBlockNumber;
+	int			bucket;
+	int			i;
+
+	if (ZHeapFreedPagesNumBuckets() == 0 || RelationUsesLocalBuffers(relation))
+		return InvalidBlockNumber;
+
+	bucket = ZHeapFreedPagesBucket(&relation->rd_node);
+	entries = &ZHeapFreedPages->entries[bucket * ZFREEDPAGES_BUCKET_SIZE];
+
+	LWLockAcquire(ZHeapFreedPagesPartitionLock(bucket), LW_EXCLUSIVE);
+	for (i = 0; i < ZFREEDPAGES_BUCKET_SIZE; i++)
+	{
+		ZHeapFreedPageEntry *entry = &entries[i];
+
+		if (entry->freespace >= spaceNeeded &&
+			RelFileNodeEquals(entry->rnode, relation->rd_node))
+		{
+			blkno = entry->blkno;
+			entry->freespace = 0;
+			break;
+		}
+	}
+	LWLockRelease(ZHeapFreedPagesPartitionLock(bucket));
+
+	return blkno;
+}
+
+/*
+ * Forget the pages at or beyond nblocks, as the relation is being truncated
+ * to that length.
+ */
+void
+ZHeapForgetFreedPages(Relation relation, BlockNumber nblocks)
+{
+	ZHeapFreedPageEntry *entries;
+	int			bucket;
+	int			i;
+
+	/* Drop our own queued updates of those pages, too. */
+	if (npending > 0 && pending_relid == RelationGetRelid(relation))
+	{
+		int			n = 0;
+
+		for (i = 0; i < npending; i++)
+		{
+			if (pending_blocks[i] < nblocks)
+			{
+				pending_blocks[n] = pending_blocks[i];
+				pending_space[n] = pending_space[i];
+				n++;
+			}
+		}
+		npending = n;
+	}
+
+	if (ZHeapFreedPagesNumBuckets() == 0 || RelationUsesLocalBuffers(relation))
+		return;
+
+	bucket = ZHeapFreedPagesBucket(&relation->rd_node);
+	entries = &ZHeapFreedPages->entries[bucket * ZFREEDPAGES_BUCKET_SIZE];
+
+	LWLockAcquire(ZHeapFreedPagesPartitionLock(bucket), LW_EXCLUSIVE);
+	for (i = 0; i < ZFREEDPAGES_BUCKET_SIZE; i++)
+	{
+		ZHeapFreedPageEntry *entry = &entries[i];
+
+		if (entry->blkno >= nblocks &&
+			RelFileNodeEquals(entry->rnode, relation->rd_node))
+			entry->freespace = 0;
+	}
+	LWLockRelease(ZHeapFreedPagesPartitionLock(bucket));
+}
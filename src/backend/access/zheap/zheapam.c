@@ -32,6 +32,8 @@
 #include "postgres.h"
 
 #include "access/bufmask.h"
+#include "access/genam.h"
+#include "access/heapam.h"		/* for heap_sync() */
 #include "access/htup_details.h"
 #include "access/parallel.h"
 #include "access/relscan.h"
@@ -54,7 +56,9 @@
 #include "access/zheapam_xlog.h"
 #include "access/zheap.h"
 #include "access/zheapscan.h"
+#include "access/zkeysharelock.h"
 #include "access/zmultilocker.h"
+#include "access/zspectoken.h"
 #include "catalog/catalog.h"
 #include "executor/tuptable.h"
 #include "miscadmin.h"
@@ -133,14 +137,19 @@ static void compute_new_xid_infomask(ZHeapTuple zhtup, Buffer buf,
 									 uint16 *result_infomask, int *result_trans_slot);
 static void log_zheap_insert(ZHeapWALInfo *walinfo, Relation relation,
 							 int options, bool skip_undo);
-static void log_zheap_update(ZHeapWALInfo *oldinfo, ZHeapWALInfo *newinfo, bool inplace_update);
-static void log_zheap_delete(ZHeapWALInfo *walinfo, bool changingPart,
+static void log_zheap_update(ZHeapWALInfo *oldinfo, ZHeapWALInfo *newinfo,
+							 Relation relation, bool inplace_update);
+static void log_zheap_delete(ZHeapWALInfo *walinfo, Relation relation,
+							 bool changingPart,
 							 SubTransactionId subxid, TransactionId tup_xid);
 static void log_zheap_multi_insert(ZHeapMultiInsertWALInfo *walinfo, bool skip_undo, char *scratch);
 static void log_zheap_lock_tuple(ZHeapWALInfo *walinfo, TransactionId tup_xid,
 								 int trans_slot_id, bool hasSubXactLock, LockTupleMode mode);
 static Bitmapset *ZHeapDetermineModifiedColumns(Relation relation, Bitmapset *interesting_cols,
 												ZHeapTuple oldtup, ZHeapTuple newtup);
+static void ZHeapDeleteMarkIndexEntries(Relation relation, ZHeapTuple oldtup,
+										ZHeapTuple newtup,
+										Bitmapset *modified_attrs);
 static inline void CheckAndLockTPDPage(Relation relation, int new_trans_slot_id,
 									   int old_trans_slot_id, Buffer newbuf,
 									   Buffer oldbuf);
@@ -163,17 +172,17 @@ zheap_prepare_insert(Relation relation, ZHeapTuple tup, int options,
 {
 
 	/*
-	 * In zheap, we don't support the optimization for TABLE_INSERT_SKIP_WAL.
-	 * If we skip writing/using WAL, we must force the relation down to disk
-	 * (using heap_sync) before it's safe to commit the transaction. This
-	 * requires writing out any dirty buffers of that relation and then doing
-	 * a forced fsync. For zheap, we've to fsync the corresponding undo
-	 * buffers as well. It is difficult to keep track of dirty undo buffers
-	 * and fsync them at end of the operation in some function similar to
-	 * heap_sync. But, if we're freezing the tuple during insertion, we can
-	 * use the TABLE_INSERT_SKIP_WAL optimization since we don't write undo
-	 * for the same. Thus just skip the optimization if only
-	 * TABLE_INSERT_SKIP_WAL is specified.
+	 * In zheap, we support the optimization for TABLE_INSERT_SKIP_WAL only
+	 * for frozen inserts.  If we skip writing/using WAL, we must force the
+	 * relation down to disk (using heap_sync) before it's safe to commit the
+	 * transaction. This requires writing out any dirty buffers of that
+	 * relation and then doing a forced fsync. For zheap, we've to fsync the
+	 * corresponding undo buffers as well. It is difficult to keep track of
+	 * dirty undo buffers and fsync them at end of the operation in some
+	 * function similar to heap_sync. But, if we're freezing the tuple during
+	 * insertion, we don't write undo for the same, so heap_sync is enough.
+	 * Thus just skip the optimization if only TABLE_INSERT_SKIP_WAL is
+	 * specified, see ZHeapInsertNeedsWAL.
 	 */
 
 	/*
@@ -193,7 +202,7 @@ zheap_prepare_insert(Relation relation, ZHeapTuple tup, int options,
 	tup->t_data->t_infomask2 &= ~ZHEAP_XACT_SLOT;
 
 	if (options & ZHEAP_INSERT_FROZEN)
-		ZHeapTupleHeaderSetXactSlot(tup->t_data, ZHTUP_SLOT_FROZEN);
+		ZHeapTupleHeaderSetXactSlotFrozen(tup->t_data);
 	tup->t_tableOid = RelationGetRelid(relation);
 
 	/*
@@ -234,6 +243,22 @@ xid_infomask_changed(uint16 new_infomask, uint16 old_infomask)
 	return false;
 }
 
+/*
+ * Does an insertion with the given options need to be WAL-logged?
+ *
+ * TABLE_INSERT_SKIP_WAL is honored only together with TABLE_INSERT_FROZEN,
+ * see zheap_prepare_insert.  The caller must then heap_sync the relation
+ * before commit, like zheapam_finish_bulk_insert does.
+ */
+static inline bool
+ZHeapInsertNeedsWAL(Relation relation, int options)
+{
+	if ((options & ZHEAP_INSERT_FROZEN) && (options & ZHEAP_INSERT_SKIP_WAL))
+		return false;
+
+	return RelationNeedsWAL(relation);
+}
+
 /*
  * zheap_insert - insert tuple into a zheap
  *
@@ -262,6 +287,7 @@ zheap_insert(Relation relation, ZHeapTuple tup, CommandId cid,
 	uint8		vm_status = 0;
 	bool		lock_reacquired;
 	bool		skip_undo;
+	Size		undo_bytes = 0;
 	ZHeapPrepareUndoInfo zh_undo_info;
 
 	/*
@@ -330,6 +356,7 @@ reacquire_buffer:
 		{
 			UnlockReleaseBuffer(buffer);
 
+			pgstat_count_zheap_slot_wait(relation);
 			pgstat_report_wait_start(PG_WAIT_PAGE_TRANS_SLOT);
 			pg_usleep(10000L);	/* 10 ms */
 			pgstat_report_wait_end();
@@ -369,6 +396,7 @@ reacquire_buffer:
 		zh_undo_info.fxid = fxid;
 		zh_undo_info.cid = cid;
 		zh_undo_info.undo_persistence = UndoPersistenceForRelation(relation);
+		zh_undo_info.trans_slots = ZHeapPageGetNumTransSlots(BufferGetPage(buffer));
 
 		urecptr = zheap_prepare_undoinsert(&zh_undo_info, specToken,
 										   (options & ZHEAP_INSERT_SPECULATIVE) ? true : false,
@@ -397,7 +425,7 @@ reacquire_buffer:
 	 * has some unused item which requires us to fetch the transaction
 	 * information from TPD.
 	 */
-	if (trans_slot_id <= ZHEAP_PAGE_TRANS_SLOTS &&
+	if (trans_slot_id <= ZHeapPageGetNumTransSlots(page) &&
 		ZHeapPageHasTPDSlot((PageHeader) page) &&
 		PageHasFreeLinePointers((PageHeader) page))
 		TPDPageLock(relation, buffer);
@@ -406,7 +434,8 @@ reacquire_buffer:
 	START_CRIT_SECTION();
 
 	if (!(options & ZHEAP_INSERT_FROZEN))
-		ZHeapTupleHeaderSetXactSlot(zheaptup->t_data, trans_slot_id);
+		ZHeapTupleHeaderSetXactSlot(zheaptup->t_data, trans_slot_id,
+									ZHeapPageGetNumTransSlots(page));
 
 	RelationPutZHeapTuple(relation, buffer, zheaptup);
 
@@ -423,7 +452,7 @@ reacquire_buffer:
 	{
 		Assert(undorecord.uur_block == ItemPointerGetBlockNumber(&(zheaptup->t_self)));
 		undorecord.uur_offset = ItemPointerGetOffsetNumber(&(zheaptup->t_self));
-		InsertPreparedUndo();
+		undo_bytes = InsertPreparedUndo();
 		PageSetUNDO(undorecord, buffer, trans_slot_id, true, fxid,
 					urecptr, NULL, 0);
 	}
@@ -431,7 +460,7 @@ reacquire_buffer:
 	MarkBufferDirty(buffer);
 
 	/* XLOG stuff */
-	if (RelationNeedsWAL(relation))
+	if (ZHeapInsertNeedsWAL(relation, options))
 	{
 		ZHeapWALInfo ins_wal_info;
 
@@ -450,6 +479,15 @@ reacquire_buffer:
 
 	END_CRIT_SECTION();
 
+	/*
+	 * Publish the speculative token before anyone can see the tuple, so that
+	 * conflicting inserters don't have to fetch it from undo.
+	 */
+	if (options & ZHEAP_INSERT_SPECULATIVE)
+		ZHeapSpecTokenRemember(buffer,
+							   ItemPointerGetOffsetNumber(&(zheaptup->t_self)),
+							   XidFromFullTransactionId(fxid), specToken);
+
 	UnlockReleaseBuffer(buffer);
 	if (vmbuffer != InvalidBuffer)
 		ReleaseBuffer(vmbuffer);
@@ -464,6 +502,7 @@ reacquire_buffer:
 
 	/* Note: speculative insertions are counted too, even if aborted later */
 	pgstat_count_heap_insert(relation, 1);
+	pgstat_count_zheap_undo_bytes(relation, undo_bytes);
 
 	/*
 	 * If zheaptup is a private copy, release it.  Don't forget to copy t_self
@@ -573,6 +612,7 @@ zheap_delete(Relation relation, ItemPointer tid,
 	bool		lock_reacquired;
 	xl_undolog_meta undometa;
 	uint8		vm_status;
+	Size		undo_bytes;
 	ZHeapTupleTransInfo zinfo;
 
 	Assert(ItemPointerIsValid(tid));
@@ -674,13 +714,36 @@ check_tup_satisfies_update:
 			result = TM_Updated;
 	}
 
+	/*
+	 * The tuple might also be key share locked in the shared lock table,
+	 * which leaves no trace on the page.
+	 */
+	if (result == TM_Ok)
+	{
+		TransactionId keyshare_xid = ZHeapKeyShareLockGetHolder(relation, tid);
+
+		if (TransactionIdIsValid(keyshare_xid))
+		{
+			if (wait)
+			{
+				LockBuffer(buffer, BUFFER_LOCK_UNLOCK);
+				XactLockTableWait(keyshare_xid, relation, tid, XLTW_Delete);
+				LockBuffer(buffer, BUFFER_LOCK_EXCLUSIVE);
+				goto check_tup_satisfies_update;
+			}
+
+			result = TM_BeingModified;
+			zinfo.xid = keyshare_xid;
+		}
+	}
+
 	if (result != TM_Ok)
 	{
 		Assert(result == TM_SelfModified ||
 			   result == TM_Updated ||
 			   result == TM_Deleted ||
 			   result == TM_BeingModified);
-		Assert(ItemIdIsDeleted(lp) ||
+		Assert(ItemIdIsDeleted(lp) || result == TM_BeingModified ||
 			   IsZHeapTupleModified(zheaptup.t_data->t_infomask));
 
 		/* If item id is deleted, tuple can't be marked as moved. */
@@ -731,6 +794,7 @@ check_tup_satisfies_update:
 	{
 		LockBuffer(buffer, BUFFER_LOCK_UNLOCK);
 
+		pgstat_count_zheap_slot_wait(relation);
 		pgstat_report_wait_start(PG_WAIT_PAGE_TRANS_SLOT);
 		pg_usleep(10000L);		/* 10 ms */
 		pgstat_report_wait_end();
@@ -804,6 +868,7 @@ check_tup_satisfies_update:
 	zh_undo_info.fxid = fxid;
 	zh_undo_info.cid = cid;
 	zh_undo_info.undo_persistence = UndoPersistenceForRelation(relation);
+	zh_undo_info.trans_slots = ZHeapPageGetNumTransSlots(page);
 	urecptr = zheap_prepare_undodelete(&zh_undo_info,
 									   &zheaptup,
 									   zinfo.xid,
@@ -826,7 +891,7 @@ check_tup_satisfies_update:
 							vmbuffer, VISIBILITYMAP_VALID_BITS);
 	}
 
-	InsertPreparedUndo();
+	undo_bytes = InsertPreparedUndo();
 	PageSetUNDO(undorecord, buffer, trans_slot_id, true, fxid,
 				urecptr, NULL, 0);
 
@@ -837,7 +902,8 @@ check_tup_satisfies_update:
 	 */
 	ZPageSetPrunable(page, xid);
 
-	ZHeapTupleHeaderSetXactSlot(zheaptup.t_data, new_trans_slot_id);
+	ZHeapTupleHeaderSetXactSlot(zheaptup.t_data, new_trans_slot_id,
+								ZHeapPageGetNumTransSlots(page));
 	zheaptup.t_data->t_infomask &= ~ZHEAP_VIS_STATUS_MASK;
 	zheaptup.t_data->t_infomask |= ZHEAP_DELETED | new_infomask;
 
@@ -862,7 +928,8 @@ check_tup_satisfies_update:
 		del_wal_info.all_visible_cleared = all_visible_cleared;
 		del_wal_info.undorecord = &undorecord;
 
-		log_zheap_delete(&del_wal_info, changingPart, subxid, zinfo.xid);
+		log_zheap_delete(&del_wal_info, relation, changingPart, subxid,
+						 zinfo.xid);
 	}
 
 	END_CRIT_SECTION();
@@ -905,6 +972,7 @@ check_tup_satisfies_update:
 		UnlockTupleTuplock(relation, &(zheaptup.t_self), LockTupleExclusive);
 
 	pgstat_count_heap_delete(relation);
+	pgstat_count_zheap_undo_bytes(relation, undo_bytes);
 
 	return TM_Ok;
 }
@@ -1219,12 +1287,14 @@ zheap_update(Relation relation, ItemPointer otid, ZHeapTuple newtup,
 				single_locker_xid;
 	SubTransactionId tup_subxid = InvalidSubTransactionId;
 	Bitmapset  *inplace_upd_attrs = NULL;
+	Bitmapset  *nodelmark_attrs = NULL;
 	Bitmapset  *key_attrs = NULL;
 	Bitmapset  *interesting_attrs = NULL;
 	bool		computed_modified_attrs = false;
 	Bitmapset  *modified_attrs = NULL;
 	ItemId		lp;
 	ZHeapTupleData oldtup;
+	ZHeapTuple	oldtup_copy = NULL;
 	ZHeapTuple	zheaptup;
 	UndoRecPtr	urecptr,
 				prev_urecptr,
@@ -1258,6 +1328,7 @@ zheap_update(Relation relation, ItemPointer otid, ZHeapTuple newtup,
 	bool		have_tuple_lock = false;
 	bool		is_index_updated = false;
 	bool		use_inplace_update;
+	bool		prune_tried = false;
 	bool		in_place_updated_or_locked = false;
 	bool		key_intact = false;
 	bool		checked_lockers = false;
@@ -1270,6 +1341,7 @@ zheap_update(Relation relation, ItemPointer otid, ZHeapTuple newtup,
 	uint8		vm_status;
 	uint8		vm_status_new = 0;
 	bool		slot_reused_or_TPD_slot = false;
+	Size		undo_bytes;
 	ZHeapTupleTransInfo zinfo;
 	ZHeapPrepareUndoInfo gen_undo_info;
 	ZHeapPrepareUpdateUndoInfo zh_up_undo_info;
@@ -1302,6 +1374,8 @@ zheap_update(Relation relation, ItemPointer otid, ZHeapTuple newtup,
 	 * happening midway through.
 	 */
 	inplace_upd_attrs = RelationGetIndexAttrBitmap(relation, INDEX_ATTR_BITMAP_ALL);
+	nodelmark_attrs = RelationGetIndexAttrBitmap(relation,
+												 INDEX_ATTR_BITMAP_NOT_DELETE_MARKABLE);
 	key_attrs = RelationGetIndexAttrBitmap(relation, INDEX_ATTR_BITMAP_KEY);
 
 	block = ItemPointerGetBlockNumber(otid);
@@ -1456,13 +1530,38 @@ check_tup_satisfies_update:
 			result = TM_Updated;
 	}
 
+	/*
+	 * A key share lock in the shared lock table conflicts with key updates.
+	 * Whether other updates conflict with it depends on whether they can be
+	 * done in place, which we only know later on, so we don't even try if we
+	 * can't wait.
+	 */
+	if (result == TM_Ok && (!key_intact || !wait))
+	{
+		TransactionId keyshare_xid = ZHeapKeyShareLockGetHolder(relation, otid);
+
+		if (TransactionIdIsValid(keyshare_xid))
+		{
+			if (wait)
+			{
+				LockBuffer(buffer, BUFFER_LOCK_UNLOCK);
+				XactLockTableWait(keyshare_xid, relation, otid, XLTW_Update);
+				LockBuffer(buffer, BUFFER_LOCK_EXCLUSIVE);
+				goto check_tup_satisfies_update;
+			}
+
+			result = TM_BeingModified;
+			zinfo.xid = keyshare_xid;
+		}
+	}
+
 	if (result != TM_Ok)
 	{
 		Assert(result == TM_SelfModified ||
 			   result == TM_Updated ||
 			   result == TM_Deleted ||
 			   result == TM_BeingModified);
-		Assert(ItemIdIsDeleted(lp) ||
+		Assert(ItemIdIsDeleted(lp) || result == TM_BeingModified ||
 			   IsZHeapTupleModified(oldtup.t_data->t_infomask));
 
 		/* If item id is deleted, tuple can't be marked as moved. */
@@ -1483,6 +1582,7 @@ check_tup_satisfies_update:
 		if (vmbuffer != InvalidBuffer)
 			ReleaseBuffer(vmbuffer);
 		bms_free(inplace_upd_attrs);
+		bms_free(nodelmark_attrs);
 		bms_free(key_attrs);
 		return result;
 	}
@@ -1509,13 +1609,14 @@ check_tup_satisfies_update:
 	newtupsize = SHORTALIGN(newtup->t_len);
 
 	/*
-	 * An in-place update is only possible if there are no index column
-	 * updates and no attribute that have been moved to an external TOAST
-	 * table.  If the new tuple is no larger than the old one, that's enough;
-	 * otherwise, we also need sufficient free space to be available in the
-	 * page.
+	 * An in-place update is only possible if no attribute has been moved to
+	 * an external TOAST table, and all the indexes on updated columns can
+	 * delete-mark their old entries (see ZHeapDeleteMarkIndexEntries).  If
+	 * the new tuple is no larger than the old one, that's enough; otherwise,
+	 * we also need sufficient free space to be available in the page.
 	 */
-	if (is_index_updated || need_toast)
+	if ((is_index_updated && bms_overlap(modified_attrs, nodelmark_attrs)) ||
+		need_toast)
 		use_inplace_update = false;
 	else if (newtupsize <= oldtupsize)
 		use_inplace_update = true;
@@ -1525,9 +1626,20 @@ check_tup_satisfies_update:
 		use_inplace_update =
 			zheap_page_prune_opt(relation, buffer, old_offnum,
 								 newtupsize - oldtupsize);
+		prune_tried = true;
 
 		/* The page might have been modified, so refresh t_data */
 		oldtup.t_data = (ZHeapTupleHeader) PageGetItem(page, lp);
+
+		/*
+		 * Remember that the tuples on this page grow, so that inserts leave
+		 * room for their updates if the relation has a growth_reserve.
+		 */
+		if (!use_inplace_update && !PageUpdatesGrow(page))
+		{
+			PageSetUpdatesGrow(page);
+			MarkBufferDirtyHint(buffer, true);
+		}
 	}
 
 	/*
@@ -1567,6 +1679,7 @@ check_tup_satisfies_update:
 	{
 		LockBuffer(buffer, BUFFER_LOCK_UNLOCK);
 
+		pgstat_count_zheap_slot_wait(relation);
 		pgstat_report_wait_start(PG_WAIT_PAGE_TRANS_SLOT);
 		pg_usleep(10000L);		/* 10 ms */
 		pgstat_report_wait_end();
@@ -1609,6 +1722,24 @@ check_tup_satisfies_update:
 			slot_reused_or_TPD_slot = false;
 	}
 
+	/*
+	 * A key share lock held in the shared lock table stays with the old
+	 * version of the tuple, so it would no longer protect the row once the
+	 * update moves it elsewhere.  Wait for such lockers to go away.
+	 */
+	if (!use_inplace_update && key_intact && wait)
+	{
+		TransactionId keyshare_xid = ZHeapKeyShareLockGetHolder(relation, otid);
+
+		if (TransactionIdIsValid(keyshare_xid))
+		{
+			LockBuffer(buffer, BUFFER_LOCK_UNLOCK);
+			XactLockTableWait(keyshare_xid, relation, otid, XLTW_Update);
+			LockBuffer(buffer, BUFFER_LOCK_EXCLUSIVE);
+			goto check_tup_satisfies_update;
+		}
+	}
+
 	/*
 	 * If the slot is marked as frozen, the latest modifier of the tuple must
 	 * be frozen.
@@ -1660,6 +1791,7 @@ check_tup_satisfies_update:
 		zh_undo_info.fxid = fxid;
 		zh_undo_info.cid = cid;
 		zh_undo_info.undo_persistence = UndoPersistenceForRelation(relation);
+		zh_undo_info.trans_slots = ZHeapPageGetNumTransSlots(BufferGetPage(buffer));
 
 		latest_urecptr = zheap_lock_tuple_guts(buffer, &oldtup, &zinfo,
 											   single_locker_xid, fxid, oldtup_new_trans_slot,
@@ -1704,8 +1836,14 @@ reacquire_buffer:
 		 * If we have reused the transaction slot, we must use new page to
 		 * perform non-inplace update in a separate page so as to reduce
 		 * contention on transaction slots.
+		 *
+		 * Otherwise keep the new version on the same page if we can, even if
+		 * that takes pruning it, to preserve the locality of the row.  If we
+		 * already pruned the page above to try an in-place update, don't
+		 * bother again, unless the new version doesn't fit anymore.
 		 */
-		if (slot_reused_or_TPD_slot || newtupsize > pagefree)
+		if (slot_reused_or_TPD_slot ||
+			(newtupsize > pagefree && prune_tried))
 		{
 			Assert(!use_inplace_update);
 			newbuf = RelationGetBufferForZTuple(relation, zheaptup->t_len,
@@ -1718,6 +1856,18 @@ reacquire_buffer:
 			LockBuffer(buffer, BUFFER_LOCK_EXCLUSIVE);
 			/* Re-check using the up-to-date free space */
 			pagefree = PageGetZHeapFreeSpace(page);
+			if (newtupsize > pagefree && !prune_tried)
+			{
+				/*
+				 * Try to make room by pruning the page, once.  Our tuple is
+				 * locked, so it stays, but it may move within the page; it's
+				 * refetched below.
+				 */
+				prune_tried = true;
+				if (zheap_page_prune_opt(relation, buffer, InvalidOffsetNumber,
+										 newtupsize))
+					pagefree = PageGetZHeapFreeSpace(page);
+			}
 			if (newtupsize > pagefree)
 			{
 				/*
@@ -1825,6 +1975,7 @@ reacquire_buffer:
 
 			if (newtup_trans_slot == InvalidXactSlotId)
 			{
+				pgstat_count_zheap_slot_wait(relation);
 				pgstat_report_wait_start(PG_WAIT_PAGE_TRANS_SLOT);
 				pg_usleep(10000L);	/* 10 ms */
 				pgstat_report_wait_end();
@@ -1881,6 +2032,7 @@ reacquire_buffer:
 	gen_undo_info.fxid = fxid;
 	gen_undo_info.cid = cid;
 	gen_undo_info.undo_persistence = UndoPersistenceForRelation(relation);
+	gen_undo_info.trans_slots = ZHeapPageGetNumTransSlots(page);
 
 	zh_up_undo_info.gen_info = &gen_undo_info;
 	zh_up_undo_info.inplace_update = use_inplace_update;
@@ -1894,6 +2046,14 @@ reacquire_buffer:
 	zh_up_undo_info.new_block = BufferGetBlockNumber(newbuf);
 	zh_up_undo_info.new_prev_urecptr = new_prev_urecptr;
 	zh_up_undo_info.recovery_tid = NULL;
+	/*
+	 * Logical decoding needs the complete old tuple, so don't diff-encode it
+	 * against the new one if the relation is logically logged.
+	 */
+	zh_up_undo_info.inplace_newtup =
+		(use_inplace_update && !RelationIsLogicallyLogged(relation)) ?
+		zheaptup : NULL;
+	zh_up_undo_info.undo_tuple_delta = false;
 
 	urecptr = zheap_prepare_undoupdate(&zh_up_undo_info, &oldtup, NULL,
 									   &undometa, &new_urecptr);
@@ -1984,6 +2144,13 @@ reacquire_buffer:
 	 */
 	XLogEnsureRecordSpace(8, 0);
 
+	/*
+	 * The index entries of an in-place update are maintained once the page
+	 * is unlocked, and that needs the old key values.
+	 */
+	if (use_inplace_update && is_index_updated)
+		oldtup_copy = zheap_copytuple(&oldtup);
+
 	START_CRIT_SECTION();
 
 	if ((vm_status & VISIBILITYMAP_ALL_VISIBLE) ||
@@ -2017,12 +2184,14 @@ reacquire_buffer:
 	/* oldtup should be pointing to right place in page */
 	Assert(oldtup.t_data == (ZHeapTupleHeader) PageGetItem(page, lp));
 
-	ZHeapTupleHeaderSetXactSlot(oldtup.t_data, result_trans_slot_id);
+	ZHeapTupleHeaderSetXactSlot(oldtup.t_data, result_trans_slot_id,
+								ZHeapPageGetNumTransSlots(page));
 	oldtup.t_data->t_infomask &= ~ZHEAP_VIS_STATUS_MASK;
 	oldtup.t_data->t_infomask |= infomask_old_tuple;
 
 	/* keep the new tuple copy updated for the caller */
-	ZHeapTupleHeaderSetXactSlot(zheaptup->t_data, newtup_trans_slot);
+	ZHeapTupleHeaderSetXactSlot(zheaptup->t_data, newtup_trans_slot,
+								ZHeapPageGetNumTransSlots(BufferGetPage(newbuf)));
 	zheaptup->t_data->t_infomask &= ~ZHEAP_VIS_STATUS_MASK;
 	zheaptup->t_data->t_infomask |= infomask_new_tuple;
 
@@ -2067,7 +2236,7 @@ reacquire_buffer:
 		appendBinaryStringInfoNoExtend(&undorecord.uur_payload,
 									   (char *) &zheaptup->t_self,
 									   sizeof(ItemPointerData));
-		if (zinfo.trans_slot > ZHEAP_PAGE_TRANS_SLOTS)
+		if (zinfo.trans_slot > ZHeapPageGetNumTransSlots(page))
 			appendBinaryStringInfoNoExtend(&undorecord.uur_payload,
 										   (char *) &zinfo.trans_slot,
 										   sizeof(zinfo.trans_slot));
@@ -2083,7 +2252,7 @@ reacquire_buffer:
 		new_undorecord.uur_offset = ItemPointerGetOffsetNumber(&(zheaptup->t_self));
 	}
 
-	InsertPreparedUndo();
+	undo_bytes = InsertPreparedUndo();
 	if (use_inplace_update)
 		PageSetUNDO(undorecord, buffer, oldtup_new_trans_slot, true,
 					fxid, urecptr, NULL, 0);
@@ -2161,7 +2330,7 @@ reacquire_buffer:
 		newup_wal_info.prev_urecptr = InvalidUndoRecPtr;
 		newup_wal_info.prior_trans_slot_id = InvalidXactSlotId;
 
-		log_zheap_update(&oldup_wal_info, &newup_wal_info,
+		log_zheap_update(&oldup_wal_info, &newup_wal_info, relation,
 						 use_inplace_update);
 	}
 
@@ -2195,6 +2364,13 @@ reacquire_buffer:
 	if (have_tuple_lock)
 		UnlockTupleTuplock(relation, &(oldtup.t_self), *lockmode);
 
+	if (oldtup_copy != NULL)
+	{
+		ZHeapDeleteMarkIndexEntries(relation, oldtup_copy, zheaptup,
+									modified_attrs);
+		zheap_freetuple(oldtup_copy);
+	}
+
 	/*
 	 * As of now, we only count non-inplace updates as that are required to
 	 * decide whether to trigger autovacuum.
@@ -2215,6 +2391,7 @@ reacquire_buffer:
 	}
 	else
 		pgstat_count_zheap_update(relation);
+	pgstat_count_zheap_undo_bytes(relation, undo_bytes);
 
 	/*
 	 * If heaptup is a private copy, release it.  Don't forget to copy t_self
@@ -2226,6 +2403,7 @@ reacquire_buffer:
 		zheap_freetuple(zheaptup);
 	}
 	bms_free(inplace_upd_attrs);
+	bms_free(nodelmark_attrs);
 	bms_free(interesting_attrs);
 	bms_free(modified_attrs);
 
@@ -2233,6 +2411,86 @@ reacquire_buffer:
 	return TM_Ok;
 }
 
+/*
+ * ZHeapDeleteMarkIndexEntries - maintain indexes after an in-place update
+ *
+ * An in-place update keeps the TID of the tuple, so the index entries for the
+ * old key values can't simply be left behind for vacuum to clean up: a scan
+ * with the new snapshot would find the tuple through them.  Instead, each
+ * index that covers one of the modified columns delete-marks the old entry
+ * and adds one for the new values.  zheap_update only updates in place if
+ * every such index supports this, see INDEX_ATTR_BITMAP_NOT_DELETE_MARKABLE.
+ */
+static void
+ZHeapDeleteMarkIndexEntries(Relation relation, ZHeapTuple oldtup,
+							ZHeapTuple newtup, Bitmapset *modified_attrs)
+{
+	TupleDesc	tupdesc = RelationGetDescr(relation);
+	Datum	   *oldvalues;
+	bool	   *oldisnull;
+	Datum	   *newvalues;
+	bool	   *newisnull;
+	List	   *indexoidlist;
+	ListCell   *l;
+
+	oldvalues = (Datum *) palloc(tupdesc->natts * sizeof(Datum));
+	oldisnull = (bool *) palloc(tupdesc->natts * sizeof(bool));
+	newvalues = (Datum *) palloc(tupdesc->natts * sizeof(Datum));
+	newisnull = (bool *) palloc(tupdesc->natts * sizeof(bool));
+
+	zheap_deform_tuple(oldtup, tupdesc, oldvalues, oldisnull, tupdesc->natts);
+	zheap_deform_tuple(newtup, tupdesc, newvalues, newisnull, tupdesc->natts);
+
+	indexoidlist = RelationGetIndexList(relation);
+	foreach(l, indexoidlist)
+	{
+		Relation	indexRel;
+		Datum		ioldvalues[INDEX_MAX_KEYS];
+		bool		ioldisnull[INDEX_MAX_KEYS];
+		Datum		inewvalues[INDEX_MAX_KEYS];
+		bool		inewisnull[INDEX_MAX_KEYS];
+		bool		modified = false;
+		int			i;
+
+		indexRel = index_open(lfirst_oid(l), RowExclusiveLock);
+		if (!indexRel->rd_index->indisready)
+		{
+			index_close(indexRel, RowExclusiveLock);
+			continue;
+		}
+
+		for (i = 0; i < indexRel->rd_index->indnatts; i++)
+		{
+			AttrNumber	attnum = indexRel->rd_index->indkey.values[i];
+
+			/* expression indexes are never delete-marked */
+			Assert(attnum > 0);
+
+			ioldvalues[i] = oldvalues[attnum - 1];
+			ioldisnull[i] = oldisnull[attnum - 1];
+			inewvalues[i] = newvalues[attnum - 1];
+			inewisnull[i] = newisnull[attnum - 1];
+
+			if (bms_is_member(attnum - FirstLowInvalidHeapAttributeNumber,
+							  modified_attrs))
+				modified = true;
+		}
+
+		if (modified)
+			index_deletemark(indexRel, ioldvalues, ioldisnull,
+							 inewvalues, inewisnull, &newtup->t_self,
+							 relation);
+
+		index_close(indexRel, RowExclusiveLock);
+	}
+	list_free(indexoidlist);
+
+	pfree(oldvalues);
+	pfree(oldisnull);
+	pfree(newvalues);
+	pfree(newisnull);
+}
+
 /*
  * zheap_update_wait_helper
  *
@@ -2822,6 +3080,68 @@ failed:
 		goto out_locked;
 	}
 
+	/*
+	 * An exclusive lock conflicts with the key share locks held in the
+	 * shared lock table, which aren't visible on the page.
+	 */
+	if (mode == LockTupleExclusive)
+	{
+		TransactionId keyshare_xid = ZHeapKeyShareLockGetHolder(relation, tid);
+
+		if (TransactionIdIsValid(keyshare_xid))
+		{
+			LockBuffer(*buffer, BUFFER_LOCK_UNLOCK);
+			switch (wait_policy)
+			{
+				case LockWaitBlock:
+					XactLockTableWait(keyshare_xid, relation, tid, XLTW_Lock);
+					break;
+				case LockWaitSkip:
+					if (!ConditionalXactLockTableWait(keyshare_xid))
+					{
+						LockBuffer(*buffer, BUFFER_LOCK_EXCLUSIVE);
+						tuple->t_tableOid = RelationGetRelid(relation);
+						tuple->t_len = zhtup.t_len;
+						tuple->t_self = zhtup.t_self;
+						tuple->t_data = palloc0(tuple->t_len);
+						memcpy(tuple->t_data, zhtup.t_data, zhtup.t_len);
+						result = TM_WouldBlock;
+						goto out_locked;
+					}
+					break;
+				case LockWaitError:
+					if (!ConditionalXactLockTableWait(keyshare_xid))
+						ereport(ERROR,
+								(errcode(ERRCODE_LOCK_NOT_AVAILABLE),
+								 errmsg("could not obtain lock on row in relation \"%s\"",
+										RelationGetRelationName(relation))));
+					break;
+			}
+			LockBuffer(*buffer, BUFFER_LOCK_EXCLUSIVE);
+			goto check_tup_satisfies_update;
+		}
+	}
+
+	/*
+	 * A key share lock taken by a transaction that has no slot on the page
+	 * yet goes into the shared lock table, if there is room for it, which
+	 * saves reserving a slot and writing undo and WAL for it.  Tuples with
+	 * multiple lockers, and the locks of subtransactions, stay on the page.
+	 */
+	if (mode == LockTupleKeyShare && trans_slot_id == InvalidXactSlotId &&
+		!IsSubTransaction() &&
+		!ZHeapTupleHasMultiLockers(zhtup.t_data->t_infomask) &&
+		ZHeapKeyShareLockAcquire(relation, tid))
+	{
+		tuple->t_tableOid = RelationGetRelid(relation);
+		tuple->t_len = zhtup.t_len;
+		tuple->t_self = zhtup.t_self;
+		tuple->t_data = palloc0(tuple->t_len);
+		memcpy(tuple->t_data, zhtup.t_data, zhtup.t_len);
+		result = TM_Ok;
+		goto out_locked;
+	}
+
 	/*
 	 * The transaction information of tuple needs to be set in transaction
 	 * slot, so needs to reserve the slot before proceeding with the actual
@@ -2840,6 +3160,7 @@ failed:
 	{
 		LockBuffer(*buffer, BUFFER_LOCK_UNLOCK);
 
+		pgstat_count_zheap_slot_wait(relation);
 		pgstat_report_wait_start(PG_WAIT_PAGE_TRANS_SLOT);
 		pg_usleep(10000L);		/* 10 ms */
 		pgstat_report_wait_end();
@@ -2892,6 +3213,7 @@ failed:
 	zh_undo_info.fxid = fxid;
 	zh_undo_info.cid = FirstCommandId;
 	zh_undo_info.undo_persistence = UndoPersistenceForRelation(relation);
+	zh_undo_info.trans_slots = ZHeapPageGetNumTransSlots(BufferGetPage(*buffer));
 
 	/*
 	 * If all the members were lockers and are all gone, we can do away with
@@ -3955,6 +4277,7 @@ lock_tuple:
 		{
 			LockBuffer(buf, BUFFER_LOCK_UNLOCK);
 
+			pgstat_count_zheap_slot_wait(rel);
 			pgstat_report_wait_start(PG_WAIT_PAGE_TRANS_SLOT);
 			pg_usleep(10000L);	/* 10 ms */
 			pgstat_report_wait_end();
@@ -4011,6 +4334,7 @@ lock_tuple:
 		zh_undo_info.fxid = fxid;
 		zh_undo_info.cid = FirstCommandId;
 		zh_undo_info.undo_persistence = UndoPersistenceForRelation(rel);
+		zh_undo_info.trans_slots = ZHeapPageGetNumTransSlots(BufferGetPage(buf));
 
 		(void) zheap_lock_tuple_guts(buf, &zhtup, &zinfo,
 									 InvalidTransactionId, fxid, trans_slot_id,
@@ -4149,7 +4473,8 @@ zheap_lock_tuple_guts(Buffer buf, ZHeapTuple zhtup, ZHeapTupleTransInfo *tup_inf
 				(undorecord.uur_type == UNDO_XID_LOCK_FOR_UPDATE),
 				current_fxid, urecptr, NULL, 0);
 
-	ZHeapTupleHeaderSetXactSlot(zhtup->t_data, result_trans_slot);
+	ZHeapTupleHeaderSetXactSlot(zhtup->t_data, result_trans_slot,
+								ZHeapPageGetNumTransSlots(BufferGetPage(buf)));
 	zhtup->t_data->t_infomask &= ~ZHEAP_VIS_STATUS_MASK;
 	zhtup->t_data->t_infomask |= new_infomask;
 
@@ -4517,7 +4842,7 @@ compute_new_xid_infomask(ZHeapTuple zhtup, Buffer buf, TransactionId tup_xid,
 	Assert(is_update || new_trans_slot == tup_trans_slot ||
 		   (tup_xid == add_to_xid &&
 			ZHeapPageHasTPDSlot((PageHeader) BufferGetPage(buf)) &&
-			tup_trans_slot == ZHEAP_PAGE_TRANS_SLOTS &&
+			tup_trans_slot == ZHeapPageGetNumTransSlots(BufferGetPage(buf)) &&
 			new_trans_slot == tup_trans_slot + 1));
 }
 
@@ -4584,6 +4909,8 @@ zheap_finish_speculative(Relation relation, ItemPointer tid)
 
 	END_CRIT_SECTION();
 
+	ZHeapSpecTokenForget(buffer, offnum, GetTopTransactionId());
+
 	UnlockReleaseBuffer(buffer);
 }
 
@@ -4660,7 +4987,7 @@ zheap_abort_speculative(Relation relation, ItemPointer tid)
 	 * pruning.  The action here is exactly same as what we do for rolling
 	 * back insert.
 	 */
-	ItemIdSetDeadExtended(lp, trans_slot_id);
+	ItemIdSetDeadExtended(lp, trans_slot_id, ZHeapPageGetNumTransSlots(page));
 	ZPageSetPrunable(page, xid);
 
 	MarkBufferDirty(buffer);
@@ -4694,6 +5021,8 @@ zheap_abort_speculative(Relation relation, ItemPointer tid)
 
 	END_CRIT_SECTION();
 
+	ZHeapSpecTokenForget(buffer, offnum, xid);
+
 	LockBuffer(buffer, BUFFER_LOCK_UNLOCK);
 
 	if (ZHeapTupleHasExternal(&tp))
@@ -4893,16 +5222,33 @@ zheap_prepare_undoupdate(ZHeapPrepareUpdateUndoInfo *zh_undoinfo, ZHeapTuple zht
 	initStringInfo(&(zh_undoinfo->old_undorec->uur_tuple));
 
 	/*
-	 * Copy the entire old tuple into the undo record. We need this to
-	 * reconstruct the old tuple if current tuple is not visible to some other
+	 * Copy the old tuple into the undo record. We need this to reconstruct
+	 * the old tuple if current tuple is not visible to some other
 	 * transaction.  We choose to write the complete tuple in undo record for
-	 * update operation so that we can reuse the space of old tuples for
-	 * non-inplace-updates after the transaction performing the operation
-	 * commits.
-	 */
-	appendBinaryStringInfo(&(zh_undoinfo->old_undorec->uur_tuple),
-						   (char *) zhtup->t_data,
-						   zhtup->t_len);
+	 * non-inplace-updates so that we can reuse the space of old tuples after
+	 * the transaction performing the operation commits.  An in-place update
+	 * leaves the new version at the same place, and anyone following the
+	 * undo chain to the old version has it at hand, so it's enough to store
+	 * the part of the old tuple that differs from it.  During replay, we get
+	 * the undo tuple from WAL in whatever form the original operation chose.
+	 */
+	if (zh_undoinfo->inplace_update && zh_undoinfo->undo_tuple_delta)
+	{
+		Assert(InRecovery);
+		zh_undoinfo->old_undorec->uur_info |= UREC_INFO_TUPLE_IS_DELTA;
+		appendBinaryStringInfo(&(zh_undoinfo->old_undorec->uur_tuple),
+							   (char *) zhtup->t_data,
+							   zhtup->t_len);
+	}
+	else if (zh_undoinfo->inplace_update &&
+			 zh_undoinfo->inplace_newtup != NULL &&
+			 EncodeInplaceUpdateUndoTuple(&(zh_undoinfo->old_undorec->uur_tuple),
+										  zhtup, zh_undoinfo->inplace_newtup))
+		zh_undoinfo->old_undorec->uur_info |= UREC_INFO_TUPLE_IS_DELTA;
+	else
+		appendBinaryStringInfo(&(zh_undoinfo->old_undorec->uur_tuple),
+							   (char *) zhtup->t_data,
+							   zhtup->t_len);
 
 	if (zh_undoinfo->inplace_update)
 	{
@@ -4916,7 +5262,7 @@ zheap_prepare_undoupdate(ZHeapPrepareUpdateUndoInfo *zh_undoinfo, ZHeapTuple zht
 		 * tuple's transaction slot number by referring offset->slot map in
 		 * TPD entry, however that won't be true for tuple in undo.
 		 */
-		if (zh_undoinfo->tup_trans_slot_id > ZHEAP_PAGE_TRANS_SLOTS)
+		if (zh_undoinfo->tup_trans_slot_id > zh_undoinfo->gen_info->trans_slots)
 		{
 			zh_undoinfo->old_undorec->uur_info |= UREC_INFO_PAYLOAD_CONTAINS_SLOT;
 			initStringInfo(&(zh_undoinfo->old_undorec->uur_payload));
@@ -4979,7 +5325,7 @@ zheap_prepare_undoupdate(ZHeapPrepareUpdateUndoInfo *zh_undoinfo, ZHeapTuple zht
 			 * in undo.
 			 */
 			payload_len = sizeof(ItemPointerData);
-			if (zh_undoinfo->tup_trans_slot_id > ZHEAP_PAGE_TRANS_SLOTS)
+			if (zh_undoinfo->tup_trans_slot_id > zh_undoinfo->gen_info->trans_slots)
 			{
 				zh_undoinfo->old_undorec->uur_info |= UREC_INFO_PAYLOAD_CONTAINS_SLOT;
 				payload_len += sizeof(zh_undoinfo->tup_trans_slot_id);
@@ -5010,7 +5356,7 @@ zheap_prepare_undoupdate(ZHeapPrepareUpdateUndoInfo *zh_undoinfo, ZHeapTuple zht
 			/* add the TPD slot id */
 			if (zh_undoinfo->tup_trans_slot_id != InvalidXactSlotId)
 			{
-				Assert(zh_undoinfo->tup_trans_slot_id > ZHEAP_PAGE_TRANS_SLOTS);
+				Assert(zh_undoinfo->tup_trans_slot_id > zh_undoinfo->gen_info->trans_slots);
 				appendBinaryStringInfo(&zh_undoinfo->old_undorec->uur_payload,
 									   (char *) &(zh_undoinfo->tup_trans_slot_id),
 									   sizeof(zh_undoinfo->tup_trans_slot_id));
@@ -5050,7 +5396,7 @@ zheap_prepare_undoupdate(ZHeapPrepareUpdateUndoInfo *zh_undoinfo, ZHeapTuple zht
 		zh_undoinfo->new_undorec->uur_payload.len = 0;
 		zh_undoinfo->new_undorec->uur_tuple.len = 0;
 
-		if (zh_undoinfo->new_trans_slot_id > ZHEAP_PAGE_TRANS_SLOTS)
+		if (zh_undoinfo->new_trans_slot_id > zh_undoinfo->gen_info->trans_slots)
 		{
 			zh_undoinfo->new_undorec->uur_info |= UREC_INFO_PAYLOAD_CONTAINS_SLOT;
 
@@ -5153,7 +5499,7 @@ zheap_prepare_undodelete(ZHeapPrepareUndoInfo *zhUndoInfo, ZHeapTuple zhtup,
 	 * transaction slot number by referring offset->slot map in TPD entry,
 	 * however that won't be true for tuple in undo.
 	 */
-	if (tup_trans_slot_id > ZHEAP_PAGE_TRANS_SLOTS)
+	if (tup_trans_slot_id > zhUndoInfo->trans_slots)
 	{
 		undorecord->uur_info |= UREC_INFO_PAYLOAD_CONTAINS_SLOT;
 		initStringInfo(&undorecord->uur_payload);
@@ -5249,7 +5595,7 @@ zheap_prepare_undolock(ZHeapPrepareLockUndoInfo *zh_undo_info,
 						   (char *) &(zh_undo_info->mode),
 						   sizeof(LockTupleMode));
 
-	if (zh_undo_info->tup_trans_slot > ZHEAP_PAGE_TRANS_SLOTS)
+	if (zh_undo_info->tup_trans_slot > zh_undo_info->gen_info->trans_slots)
 	{
 		undorecord->uur_info |= UREC_INFO_PAYLOAD_CONTAINS_SLOT;
 		appendBinaryStringInfo(&undorecord->uur_payload,
@@ -5299,6 +5645,7 @@ zheap_prepare_undo_multi_insert(ZHeapPrepareUndoInfo *zh_undo_info,
 								xl_undolog_meta *undometa)
 {
 	UndoRecPtr	urecptr;
+	UndoRecPtr *urecptrs;
 	int			i;
 	UnpackedUndoRecord *undorecord;
 
@@ -5329,23 +5676,26 @@ zheap_prepare_undo_multi_insert(ZHeapPrepareUndoInfo *zh_undo_info,
 		undorecord[i].uur_payload.len = 2 * sizeof(OffsetNumber);
 	}
 
-	UndoSetPrepareSize(undorecord, nranges,
-					   InRecovery ? zh_undo_info->fxid : InvalidFullTransactionId,
-					   zh_undo_info->undo_persistence,
-					   xlog_record, undometa);
+	/*
+	 * Prepare all the records at once; this allocates the undo space for the
+	 * whole page in one go.  Each record is then chained to the previous one,
+	 * which doesn't change its size.
+	 */
+	urecptrs = (UndoRecPtr *) palloc(nranges * sizeof(UndoRecPtr));
+	PrepareUndoInsertMulti(undorecord, nranges, urecptrs,
+						   InRecovery ? zh_undo_info->fxid : InvalidFullTransactionId,
+						   zh_undo_info->undo_persistence,
+						   xlog_record, undometa);
 
 	urecptr = zh_undo_info->prev_urecptr;
 	for (i = 0; i < nranges; i++)
 	{
 		undorecord[i].uur_blkprev = urecptr;
-		urecptr = PrepareUndoInsert(&(undorecord[i]),
-									InRecovery ? zh_undo_info->fxid : InvalidFullTransactionId,
-									zh_undo_info->undo_persistence,
-									xlog_record,
-									NULL);
+		urecptr = urecptrs[i];
 
 		initStringInfo(&(undorecord[i].uur_payload));
 	}
+	pfree(urecptrs);
 
 	Assert(UndoRecPtrIsValid(urecptr));
 	elog(DEBUG1, "Undo record prepared: %d for Block Number: %d",
@@ -5390,8 +5740,18 @@ log_zheap_insert(ZHeapWALInfo *walinfo, Relation relation,
 		PageGetMaxOffsetNumber(page) == FirstOffsetNumber &&
 		CheckZheapPageSlotsAreEmpty(page))
 	{
-		info |= XLOG_ZHEAP_INIT_PAGE;
-		bufflags |= REGBUF_WILL_INIT;
+		/*
+		 * Redo reinitializes the page with the default number of transaction
+		 * slots, so a page with any other slot count is logged as a full
+		 * page image instead.  That's cheap as the page is nearly empty.
+		 */
+		if (ZHeapPageGetNumTransSlots(page) == ZHEAP_PAGE_TRANS_SLOTS)
+		{
+			info |= XLOG_ZHEAP_INIT_PAGE;
+			bufflags |= REGBUF_WILL_INIT;
+		}
+		else
+			bufflags |= REGBUF_FORCE_IMAGE;
 	}
 
 	/*
@@ -5446,7 +5806,7 @@ prepare_xlog:
 	if (!skip_undo)
 		XLogRegisterData((char *) &xlundohdr, SizeOfUndoHeader);
 
-	if (walinfo->new_trans_slot_id > ZHEAP_PAGE_TRANS_SLOTS)
+	if (walinfo->new_trans_slot_id > ZHeapPageGetNumTransSlots(page))
 	{
 		/*
 		 * We can't have a valid transaction slot when we are skipping undo.
@@ -5507,7 +5867,7 @@ prepare_xlog:
  */
 static void
 log_zheap_update(ZHeapWALInfo *old_walinfo, ZHeapWALInfo *new_walinfo,
-				 bool inplace_update)
+				 Relation relation, bool inplace_update)
 {
 	xl_undo_header xlundohdr,
 				xlnewundohdr;
@@ -5528,17 +5888,40 @@ log_zheap_update(ZHeapWALInfo *old_walinfo, ZHeapWALInfo *new_walinfo,
 				newlen;
 	int			bufflags = REGBUF_STANDARD;
 	uint8		info = XLOG_ZHEAP_UPDATE;
+	bool		undo_tuple_delta;
+	bool		need_tuple_data = RelationIsLogicallyLogged(relation);
+	union
+	{
+		ZHeapTupleHeaderData hdr;
+		char		data[MaxZHeapTupleSize];
+	}			tbuf;
 
 	zhtuphdr = (ZHeapTupleHeader) old_walinfo->undorecord->uur_tuple.data;
+	undo_tuple_delta =
+		(old_walinfo->undorecord->uur_info & UREC_INFO_TUPLE_IS_DELTA) != 0;
 
 	if (inplace_update)
 	{
 		/*
 		 * For inplace updates the old tuple is in undo record and the new
-		 * tuple is replaced in page where old tuple was present.
+		 * tuple is replaced in page where old tuple was present.  If the
+		 * undo record only has the difference between the two, rebuild the
+		 * old tuple to compute the prefix and suffix.
 		 */
-		oldp = (char *) zhtuphdr + zhtuphdr->t_hoff;
-		oldlen = old_walinfo->undorecord->uur_tuple.len - zhtuphdr->t_hoff;
+		if (undo_tuple_delta)
+		{
+			oldlen = DecodeInplaceUpdateUndoTuple(old_walinfo->undorecord,
+												  old_walinfo->ztuple->t_data,
+												  old_walinfo->ztuple->t_len,
+												  tbuf.data);
+			oldp = tbuf.data + tbuf.hdr.t_hoff;
+			oldlen -= tbuf.hdr.t_hoff;
+		}
+		else
+		{
+			oldp = (char *) zhtuphdr + zhtuphdr->t_hoff;
+			oldlen = old_walinfo->undorecord->uur_tuple.len - zhtuphdr->t_hoff;
+		}
 		newp = (char *) old_walinfo->ztuple->t_data + old_walinfo->ztuple->t_data->t_hoff;
 		newlen = old_walinfo->ztuple->t_len - old_walinfo->ztuple->t_data->t_hoff;
 
@@ -5562,7 +5945,7 @@ log_zheap_update(ZHeapWALInfo *old_walinfo, ZHeapWALInfo *new_walinfo,
 	 * See log_heap_update to know under what some circumstances we can use
 	 * prefix-suffix compression.
 	 */
-	if (old_walinfo->buffer == new_walinfo->buffer
+	if (old_walinfo->buffer == new_walinfo->buffer && !need_tuple_data
 		&& !XLogCheckBufferNeedsBackup(new_walinfo->buffer))
 	{
 		Assert(oldp != NULL && newp != NULL);
@@ -5615,6 +5998,17 @@ log_zheap_update(ZHeapWALInfo *old_walinfo, ZHeapWALInfo *new_walinfo,
 	if (old_walinfo->undorecord->uur_info & UREC_INFO_PAYLOAD_CONTAINS_SUBXACT)
 		xlrec.flags |= XLZ_UPDATE_CONTAINS_SUBXACT;
 
+	/*
+	 * For logical decoding we need the new tuple even if we're doing a full
+	 * page write, so make sure it's included even if we take a full-page
+	 * image.
+	 */
+	if (need_tuple_data)
+	{
+		xlrec.flags |= XLZ_UPDATE_CONTAINS_NEW_TUPLE;
+		bufflags |= REGBUF_KEEP_DATA;
+	}
+
 	if (!inplace_update)
 	{
 		Page		page = BufferGetPage(new_walinfo->buffer);
@@ -5631,8 +6025,14 @@ log_zheap_update(ZHeapWALInfo *old_walinfo, ZHeapWALInfo *new_walinfo,
 			PageGetMaxOffsetNumber(page) == FirstOffsetNumber &&
 			CheckZheapPageSlotsAreEmpty(page))
 		{
-			info |= XLOG_ZHEAP_INIT_PAGE;
-			bufflags |= REGBUF_WILL_INIT;
+			/* See log_zheap_insert. */
+			if (ZHeapPageGetNumTransSlots(page) == ZHEAP_PAGE_TRANS_SLOTS)
+			{
+				info |= XLOG_ZHEAP_INIT_PAGE;
+				bufflags |= REGBUF_WILL_INIT;
+			}
+			else
+				bufflags |= REGBUF_FORCE_IMAGE;
 		}
 	}
 
@@ -5648,7 +6048,17 @@ prepare_xlog:
 	LogUndoMetaData(new_walinfo->undometa);
 
 	GetFullPageWriteInfo(&RedoRecPtr, &doPageWrites);
-	if (!doPageWrites || XLogCheckBufferNeedsBackup(old_walinfo->buffer))
+
+	/*
+	 * A diff-encoded undo tuple can't be regenerated from the page, since
+	 * replay may not be able to reconstruct the new tuple first, but it's
+	 * small, so we always include it.  Logical decoding reads the old tuple
+	 * from the WAL, too.
+	 */
+	if (undo_tuple_delta)
+		xlrec.flags |= XLZ_UPDATE_UNDO_TUPLE_DELTA;
+	if (!doPageWrites || undo_tuple_delta || need_tuple_data ||
+		XLogCheckBufferNeedsBackup(old_walinfo->buffer))
 	{
 		xlrec.flags |= XLZ_HAS_UPDATE_UNDOTUPLE;
 
@@ -5660,7 +6070,7 @@ prepare_xlog:
 	XLogBeginInsert();
 	XLogRegisterData((char *) &xlundohdr, SizeOfUndoHeader);
 	XLogRegisterData((char *) &xlrec, SizeOfZHeapUpdate);
-	if (old_walinfo->prior_trans_slot_id > ZHEAP_PAGE_TRANS_SLOTS)
+	if (old_walinfo->prior_trans_slot_id > ZHeapPageGetNumTransSlots(BufferGetPage(old_walinfo->buffer)))
 	{
 		xlrec.flags |= XLZ_UPDATE_OLD_CONTAINS_TPD_SLOT;
 		XLogRegisterData((char *) &(old_walinfo->prior_trans_slot_id),
@@ -5669,7 +6079,7 @@ prepare_xlog:
 	if (!inplace_update)
 	{
 		XLogRegisterData((char *) &xlnewundohdr, SizeOfUndoHeader);
-		if (new_walinfo->new_trans_slot_id > ZHEAP_PAGE_TRANS_SLOTS)
+		if (new_walinfo->new_trans_slot_id > ZHeapPageGetNumTransSlots(BufferGetPage(new_walinfo->buffer)))
 		{
 			xlrec.flags |= XLZ_UPDATE_NEW_CONTAINS_TPD_SLOT;
 			XLogRegisterData((char *) &new_walinfo->new_trans_slot_id,
@@ -5691,14 +6101,14 @@ prepare_xlog:
 
 		XLogRegisterBuffer(1, old_walinfo->buffer, REGBUF_STANDARD);
 		block_id = 2;
-		if (old_walinfo->new_trans_slot_id > ZHEAP_PAGE_TRANS_SLOTS)
+		if (old_walinfo->new_trans_slot_id > ZHeapPageGetNumTransSlots(BufferGetPage(old_walinfo->buffer)))
 			block_id = RegisterTPDBuffer(BufferGetPage(old_walinfo->buffer), block_id);
-		if (new_walinfo->new_trans_slot_id > ZHEAP_PAGE_TRANS_SLOTS)
+		if (new_walinfo->new_trans_slot_id > ZHeapPageGetNumTransSlots(BufferGetPage(new_walinfo->buffer)))
 			RegisterTPDBuffer(BufferGetPage(new_walinfo->buffer), block_id);
 	}
 	else
 	{
-		if (old_walinfo->new_trans_slot_id > ZHEAP_PAGE_TRANS_SLOTS)
+		if (old_walinfo->new_trans_slot_id > ZHeapPageGetNumTransSlots(BufferGetPage(old_walinfo->buffer)))
 		{
 			/*
 			 * Block id '1' is reserved for old_walinfo->buffer if that is
@@ -5780,11 +6190,11 @@ prepare_xlog:
 	if (new_walinfo->buffer != old_walinfo->buffer)
 	{
 		PageSetLSN(BufferGetPage(new_walinfo->buffer), recptr);
-		if (new_walinfo->new_trans_slot_id > ZHEAP_PAGE_TRANS_SLOTS)
+		if (new_walinfo->new_trans_slot_id > ZHeapPageGetNumTransSlots(BufferGetPage(new_walinfo->buffer)))
 			TPDPageSetLSN(BufferGetPage(new_walinfo->buffer), recptr);
 	}
 	PageSetLSN(BufferGetPage(old_walinfo->buffer), recptr);
-	if (old_walinfo->new_trans_slot_id > ZHEAP_PAGE_TRANS_SLOTS)
+	if (old_walinfo->new_trans_slot_id > ZHeapPageGetNumTransSlots(BufferGetPage(old_walinfo->buffer)))
 		TPDPageSetLSN(BufferGetPage(old_walinfo->buffer), recptr);
 	UndoLogBuffersSetLSN(recptr);
 }
@@ -5809,7 +6219,7 @@ CheckZheapPageSlotsAreEmpty(Page page)
 	fxid = GetTopFullTransactionId();
 	opaque = (ZHeapPageOpaque) PageGetSpecialPointer(page);
 
-	for (i = 0; i < ZHEAP_PAGE_TRANS_SLOTS; i++)
+	for (i = 0; i < ZHeapPageGetNumTransSlots(page); i++)
 	{
 		thistrans = &opaque->transinfo[i];
 
@@ -5835,7 +6245,7 @@ CheckZheapPageSlotsAreEmpty(Page page)
  * log_zheap_delete - Perform XLogInsert for a zheap-delete operation.
  */
 static void
-log_zheap_delete(ZHeapWALInfo *walinfo, bool changingPart,
+log_zheap_delete(ZHeapWALInfo *walinfo, Relation relation, bool changingPart,
 				 SubTransactionId subxid, TransactionId tup_xid)
 {
 	ZHeapTupleHeader zhtuphdr = NULL;
@@ -5871,14 +6281,16 @@ log_zheap_delete(ZHeapWALInfo *walinfo, bool changingPart,
 	 *
 	 * Since we don't yet have the insert lock, including the page image
 	 * decision could change later and in that case we need prepare the WAL
-	 * record again.
+	 * record again.  Logical decoding reads the old tuple from the WAL, so
+	 * it's always included if the relation is logically logged.
 	 */
 prepare_xlog:
 	/* LOG undolog meta if this is the first WAL after the checkpoint. */
 	LogUndoMetaData(walinfo->undometa);
 
 	GetFullPageWriteInfo(&RedoRecPtr, &doPageWrites);
-	if (!doPageWrites || XLogCheckBufferNeedsBackup(walinfo->buffer))
+	if (!doPageWrites || RelationIsLogicallyLogged(relation) ||
+		XLogCheckBufferNeedsBackup(walinfo->buffer))
 	{
 		xlrec.flags |= XLZ_HAS_DELETE_UNDOTUPLE;
 
@@ -5888,7 +6300,7 @@ prepare_xlog:
 		xlhdr.t_infomask = zhtuphdr->t_infomask;
 		xlhdr.t_hoff = zhtuphdr->t_hoff;
 	}
-	if (walinfo->prior_trans_slot_id > ZHEAP_PAGE_TRANS_SLOTS)
+	if (walinfo->prior_trans_slot_id > ZHeapPageGetNumTransSlots(page))
 		xlrec.flags |= XLZ_DELETE_CONTAINS_TPD_SLOT;
 
 	XLogBeginInsert();
@@ -5906,7 +6318,7 @@ prepare_xlog:
 	}
 
 	XLogRegisterBuffer(0, walinfo->buffer, REGBUF_STANDARD);
-	if (walinfo->new_trans_slot_id > ZHEAP_PAGE_TRANS_SLOTS)
+	if (walinfo->new_trans_slot_id > ZHeapPageGetNumTransSlots(page))
 		(void) RegisterTPDBuffer(page, 1);
 	RegisterUndoLogBuffers(2);
 
@@ -5921,7 +6333,7 @@ prepare_xlog:
 		goto prepare_xlog;
 	}
 	PageSetLSN(page, recptr);
-	if (walinfo->new_trans_slot_id > ZHEAP_PAGE_TRANS_SLOTS)
+	if (walinfo->new_trans_slot_id > ZHeapPageGetNumTransSlots(page))
 		TPDPageSetLSN(page, recptr);
 	UndoLogBuffersSetLSN(recptr);
 }
@@ -6048,8 +6460,14 @@ log_zheap_multi_insert(ZHeapMultiInsertWALInfo *multi_walinfo, bool skip_undo,
 
 	if (init)
 	{
-		info |= XLOG_ZHEAP_INIT_PAGE;
-		bufflags |= REGBUF_WILL_INIT;
+		/* See log_zheap_insert. */
+		if (ZHeapPageGetNumTransSlots(page) == ZHEAP_PAGE_TRANS_SLOTS)
+		{
+			info |= XLOG_ZHEAP_INIT_PAGE;
+			bufflags |= REGBUF_WILL_INIT;
+		}
+		else
+			bufflags |= REGBUF_FORCE_IMAGE;
 	}
 
 	/*
@@ -6072,7 +6490,7 @@ prepare_xlog:
 
 	/* If we've skipped undo insertion, we don't need a slot in page. */
 	if (!skip_undo &&
-		multi_walinfo->gen_walinfo->new_trans_slot_id > ZHEAP_PAGE_TRANS_SLOTS)
+		multi_walinfo->gen_walinfo->new_trans_slot_id > ZHeapPageGetNumTransSlots(page))
 	{
 		xlrec->flags |= XLZ_INSERT_CONTAINS_TPD_SLOT;
 		XLogRegisterData((char *) &multi_walinfo->gen_walinfo->new_trans_slot_id,
@@ -6137,7 +6555,7 @@ log_zheap_lock_tuple(ZHeapWALInfo *walinfo, TransactionId tup_xid,
 		Assert(walinfo->new_trans_slot_id == walinfo->prior_trans_slot_id);
 		xlrec.flags |= XLZ_LOCK_TRANS_SLOT_FOR_UREC;
 	}
-	else if (walinfo->prior_trans_slot_id > ZHEAP_PAGE_TRANS_SLOTS)
+	else if (walinfo->prior_trans_slot_id > ZHeapPageGetNumTransSlots(page))
 		xlrec.flags |= XLZ_LOCK_CONTAINS_TPD_SLOT;
 
 	if (hasSubXactLock)
@@ -6153,7 +6571,7 @@ prepare_xlog:
 	GetFullPageWriteInfo(&RedoRecPtr, &doPageWrites);
 	XLogBeginInsert();
 	XLogRegisterBuffer(0, walinfo->buffer, REGBUF_STANDARD);
-	if (trans_slot_id > ZHEAP_PAGE_TRANS_SLOTS)
+	if (trans_slot_id > ZHeapPageGetNumTransSlots(page))
 		(void) RegisterTPDBuffer(page, 1);
 	XLogRegisterData((char *) &xlundohdr, SizeOfUndoHeader);
 	XLogRegisterData((char *) &xlrec, SizeOfZHeapLock);
@@ -6187,7 +6605,7 @@ prepare_xlog:
 
 	PageSetLSN(page, recptr);
 
-	if (trans_slot_id > ZHEAP_PAGE_TRANS_SLOTS)
+	if (trans_slot_id > ZHeapPageGetNumTransSlots(page))
 		TPDPageSetLSN(page, recptr);
 
 	UndoLogBuffersSetLSN(recptr);
@@ -6252,8 +6670,8 @@ GetTransactionSlotInfo(Buffer buf, OffsetNumber offset, int trans_slot_id,
 		zinfo->epoch_xid = InvalidFullTransactionId;
 		zinfo->urec_ptr = InvalidUndoRecPtr;
 	}
-	else if (trans_slot_id < ZHEAP_PAGE_TRANS_SLOTS ||
-			 (trans_slot_id == ZHEAP_PAGE_TRANS_SLOTS &&
+	else if (trans_slot_id < ZHeapPageGetNumTransSlots(page) ||
+			 (trans_slot_id == ZHeapPageGetNumTransSlots(page) &&
 			  !ZHeapPageHasTPDSlot(phdr)))
 	{
 		TransInfo  *thistrans = &opaque->transinfo[trans_slot_id - 1];
@@ -6271,8 +6689,8 @@ GetTransactionSlotInfo(Buffer buf, OffsetNumber offset, int trans_slot_id,
 			 * first slot in TPD entry, so we need fetch it from there.  See
 			 * AllocateAndFormTPDEntry.
 			 */
-			if (trans_slot_id == ZHEAP_PAGE_TRANS_SLOTS)
-				trans_slot_id = ZHEAP_PAGE_TRANS_SLOTS + 1;
+			if (trans_slot_id == ZHeapPageGetNumTransSlots(page))
+				trans_slot_id = ZHeapPageGetNumTransSlots(page) + 1;
 			zinfo->trans_slot =
 				TPDPageGetTransactionSlotInfo(buf,
 											  trans_slot_id,
@@ -6324,8 +6742,8 @@ PageSetUNDO(UnpackedUndoRecord undorecord, Buffer buffer, int trans_slot_id,
 	 * During recovery, we set the required information in TPD separately only
 	 * if required.
 	 */
-	if (trans_slot_id < ZHEAP_PAGE_TRANS_SLOTS ||
-		(trans_slot_id == ZHEAP_PAGE_TRANS_SLOTS &&
+	if (trans_slot_id < ZHeapPageGetNumTransSlots(page) ||
+		(trans_slot_id == ZHeapPageGetNumTransSlots(page) &&
 		 !ZHeapPageHasTPDSlot(phdr)))
 	{
 		TransInfo  *thistrans = &opaque->transinfo[trans_slot_id - 1];
@@ -6374,8 +6792,8 @@ PageSetTransactionSlotInfo(Buffer buf, int trans_slot_id,
 	phdr = (PageHeader) page;
 	opaque = (ZHeapPageOpaque) PageGetSpecialPointer(page);
 
-	if (trans_slot_id < ZHEAP_PAGE_TRANS_SLOTS ||
-		(trans_slot_id == ZHEAP_PAGE_TRANS_SLOTS &&
+	if (trans_slot_id < ZHeapPageGetNumTransSlots(page) ||
+		(trans_slot_id == ZHeapPageGetNumTransSlots(page) &&
 		 !ZHeapPageHasTPDSlot(phdr)))
 	{
 		TransInfo  *thistrans = &opaque->transinfo[trans_slot_id - 1];
@@ -6416,12 +6834,12 @@ PageGetTransactionSlotId(Relation rel, Buffer buf, FullTransactionId fxid,
 
 	if (ZHeapPageHasTPDSlot(phdr))
 	{
-		total_slots_in_page = ZHEAP_PAGE_TRANS_SLOTS - 1;
+		total_slots_in_page = ZHeapPageGetNumTransSlots(page) - 1;
 		check_tpd = true;
 	}
 	else
 	{
-		total_slots_in_page = ZHEAP_PAGE_TRANS_SLOTS;
+		total_slots_in_page = ZHeapPageGetNumTransSlots(page);
 		check_tpd = false;
 	}
 
@@ -6516,7 +6934,7 @@ MultiPageReserveTransSlot(Relation relation,
 	 * If previously reserved slot is from TPD then we should have TPD page
 	 * into heap buffer.
 	 */
-	Assert(*oldbuf_trans_slot_id <= ZHEAP_PAGE_TRANS_SLOTS ||
+	Assert(*oldbuf_trans_slot_id <= ZHeapPageGetNumTransSlots(old_heap_page) ||
 		   ZHeapPageHasTPDSlot((PageHeader) old_heap_page));
 
 	/* If TPD exist, then get corresponding TPD block number for old buffer. */
@@ -6535,7 +6953,7 @@ retry_tpd_lock:
 	 * have TPD, then we will check that we can verify slot on old buffer
 	 * first or we should get slot for new buffer first.
 	 */
-	if (*oldbuf_trans_slot_id >= ZHEAP_PAGE_TRANS_SLOTS &&
+	if (*oldbuf_trans_slot_id >= ZHeapPageGetNumTransSlots(old_heap_page) &&
 		ZHeapPageHasTPDSlot((PageHeader) old_heap_page))
 	{
 		/*
@@ -6589,7 +7007,7 @@ retry_tpd_lock:
 		 * will extend to get new TPD buffer with higher block number to avoid
 		 * deadlock.
 		 */
-		if (slot_id > ZHEAP_PAGE_TRANS_SLOTS)
+		if (slot_id > ZHeapPageGetNumTransSlots(old_heap_page))
 			always_extend = true;
 
 		/* Reserve the transaction slot for new buffer. */
@@ -6630,7 +7048,7 @@ retry_tpd_lock:
 		 * may get a new TPD page from FSM or by extending the relation that
 		 * may have greater block number as compared to old buffer TPD block.
 		 */
-		if (*newbuf_trans_slot_id > ZHEAP_PAGE_TRANS_SLOTS)
+		if (*newbuf_trans_slot_id > ZHeapPageGetNumTransSlots(new_heap_page))
 		{
 			GetTPDBlockAndOffset(new_heap_page, &tmp_new_tpd_blk, NULL);
 
@@ -6724,12 +7142,12 @@ PageReserveTransactionSlot(Relation relation, Buffer buf, OffsetNumber offset,
 
 	if (ZHeapPageHasTPDSlot(phdr))
 	{
-		total_slots_in_page = ZHEAP_PAGE_TRANS_SLOTS - 1;
+		total_slots_in_page = ZHeapPageGetNumTransSlots(page) - 1;
 		check_tpd = true;
 	}
 	else
 	{
-		total_slots_in_page = ZHEAP_PAGE_TRANS_SLOTS;
+		total_slots_in_page = ZHeapPageGetNumTransSlots(page);
 		check_tpd = false;
 	}
 
@@ -6815,9 +7233,9 @@ PageReserveTransactionSlot(Relation relation, Buffer buf, OffsetNumber offset,
 		 * it.
 		 */
 		if (ZHeapPageHasTPDSlot(phdr))
-			total_slots_in_page = ZHEAP_PAGE_TRANS_SLOTS - 1;
+			total_slots_in_page = ZHeapPageGetNumTransSlots(page) - 1;
 		else
-			total_slots_in_page = ZHEAP_PAGE_TRANS_SLOTS;
+			total_slots_in_page = ZHeapPageGetNumTransSlots(page);
 
 		for (slot_no = 0; slot_no < total_slots_in_page; slot_no++)
 		{
@@ -6883,6 +7301,12 @@ PageReserveTransactionSlot(Relation relation, Buffer buf, OffsetNumber offset,
 	return InvalidXactSlotId;
 }
 
+/*
+ * Upper bound on the number of transaction slots of a TPD entry, and hence
+ * on any slot index zheap_freeze_or_invalidate_tuples can be asked about.
+ */
+#define MaxFreezeSlotIndex	((int) (MaxTPDEntrySize / sizeof(TransInfo)))
+
 /*
  * zheap_freeze_or_invalidate_tuples - Clear the slot information or set
  *									   invalid_xact flags.
@@ -6891,6 +7315,11 @@ PageReserveTransactionSlot(Relation relation, Buffer buf, OffsetNumber offset,
  *	the input slot array, if tuple is pointing to the slot then set the tuple
  *  slot as ZHTUP_SLOT_FROZEN if is frozen is true otherwise set
  *  ZHEAP_INVALID_XACT_SLOT flag on the tuple
+ *
+ *	The input slots are turned into a bitmap, and for TPD slots the offset map
+ *	of the TPD entry is located just once, so that the cost of the page scan
+ *	doesn't depend on the number of slots being processed.  This is called
+ *	inside a critical section, so we can't allocate memory here.
  */
 void
 zheap_freeze_or_invalidate_tuples(Buffer buf, int nSlots, int *slots,
@@ -6899,8 +7328,33 @@ zheap_freeze_or_invalidate_tuples(Buffer buf, int nSlots, int *slots,
 	OffsetNumber offnum,
 				maxoff;
 	Page		page = BufferGetPage(buf);
+	bits8		slotmap[MaxFreezeSlotIndex / BITS_PER_BYTE + 1];
+	char	   *tpd_offset_map = NULL;
+	int			tpd_map_entries = 0;
+	int			tpd_map_entry_size = 0;
+	int			num_page_slots = ZHeapPageGetNumTransSlots(page);
 	int			i;
 
+	memset(slotmap, 0, sizeof(slotmap));
+	for (i = 0; i < nSlots; i++)
+	{
+		Assert(slots[i] >= 0 && slots[i] <= MaxFreezeSlotIndex);
+		slotmap[slots[i] / BITS_PER_BYTE] |= (1 << (slots[i] % BITS_PER_BYTE));
+	}
+
+	if (TPDSlot)
+	{
+		tpd_offset_map = TPDPageGetOffsetMapData(buf, &tpd_map_entries,
+												 &tpd_map_entry_size);
+
+		/*
+		 * If the TPD entry is pruned away, all its slots are frozen and no
+		 * tuple can be pointing to the slots we are asked for.
+		 */
+		if (tpd_offset_map == NULL)
+			return;
+	}
+
 	/* clear the slot info from tuples */
 	maxoff = PageGetMaxOffsetNumber(page);
 
@@ -6937,23 +7391,39 @@ zheap_freeze_or_invalidate_tuples(Buffer buf, int nSlots, int *slots,
 		if (TPDSlot)
 		{
 			/* Tuple is not pointing to TPD slot so skip it. */
-			if (trans_slot < ZHEAP_PAGE_TRANS_SLOTS)
+			if (trans_slot < num_page_slots)
 				continue;
 
 			/*
 			 * If we come for freezing the TPD slot the fetch the exact slot
-			 * info from the TPD.
+			 * info from the offset map of the TPD entry.
 			 */
-			trans_slot = TPDPageGetTransactionSlotInfo(buf, trans_slot, offnum,
-													   NULL, NULL, false,
-													   false);
+			if (offnum > tpd_map_entries)
+				continue;
+			if (tpd_map_entry_size == sizeof(uint8))
+			{
+				uint8		offset_tpd_e_loc;
+
+				memcpy((char *) &offset_tpd_e_loc,
+					   tpd_offset_map + (offnum - 1), sizeof(uint8));
+				trans_slot = offset_tpd_e_loc;
+			}
+			else
+			{
+				uint32		offset_tpd_e_loc;
+
+				memcpy((char *) &offset_tpd_e_loc,
+					   tpd_offset_map + (sizeof(uint32) * (offnum - 1)),
+					   sizeof(uint32));
+				trans_slot = offset_tpd_e_loc;
+			}
 
 			/*
 			 * The input slots array always stores the slot index which starts
 			 * from 0, even for TPD slots, the index will start from 0. So
 			 * convert it into the slot index.
 			 */
-			trans_slot -= (ZHEAP_PAGE_TRANS_SLOTS + 1);
+			trans_slot -= (num_page_slots + 1);
 		}
 		else
 		{
@@ -6965,81 +7435,78 @@ zheap_freeze_or_invalidate_tuples(Buffer buf, int nSlots, int *slots,
 			trans_slot -= 1;
 		}
 
-		for (i = 0; i < nSlots; i++)
+		if (trans_slot < 0 || trans_slot > MaxFreezeSlotIndex ||
+			(slotmap[trans_slot / BITS_PER_BYTE] &
+			 (1 << (trans_slot % BITS_PER_BYTE))) == 0)
+			continue;
+
+		/*
+		 * Set transaction slots of tuple as frozen to indicate tuple
+		 * is all visible and mark the deleted itemids as dead.
+		 */
+		if (isFrozen)
 		{
-			if (trans_slot == slots[i])
+			if (!ItemIdIsUsed(itemid))
 			{
 				/*
-				 * Set transaction slots of tuple as frozen to indicate tuple
-				 * is all visible and mark the deleted itemids as dead.
+				 * This must be unused entry which has xact
+				 * information.
 				 */
-				if (isFrozen)
-				{
-					if (!ItemIdIsUsed(itemid))
-					{
-						/*
-						 * This must be unused entry which has xact
-						 * information.
-						 */
-						Assert(ItemIdHasPendingXact(itemid));
-
-						/*
-						 * The pending xact must be committed if the
-						 * corresponding slot is being marked as frozen.  So,
-						 * clear the pending xact and transaction slot
-						 * information from itemid.
-						 */
-						ItemIdSetUnused(itemid);
-					}
-					else if (ItemIdIsDeleted(itemid))
-					{
-						/*
-						 * The deleted item must not be visible to anyone if
-						 * the corresponding slot is being marked as frozen.
-						 * So, marking it as dead.
-						 */
-						ItemIdSetDead(itemid);
-					}
-					else
-					{
-						tup_hdr = (ZHeapTupleHeader) PageGetItem(page, itemid);
-						ZHeapTupleHeaderSetXactSlot(tup_hdr, ZHTUP_SLOT_FROZEN);
-					}
-				}
-				else
-				{
-					/*
-					 * We just append the invalid xact flag in the
-					 * tuple/itemid to indicate that for this tuple/itemid we
-					 * need to fetch the transaction information from undo
-					 * record.  Also, we ensure to clear the transaction
-					 * information from unused itemid.
-					 */
-					if (!ItemIdIsUsed(itemid))
-					{
-						/*
-						 * This must be unused entry which has xact
-						 * information.
-						 */
-						Assert(ItemIdHasPendingXact(itemid));
-
-						/*
-						 * The pending xact is committed.  So, clear the
-						 * pending xact and transaction slot information from
-						 * itemid.
-						 */
-						ItemIdSetUnused(itemid);
-					}
-					else if (ItemIdIsDeleted(itemid))
-						ItemIdSetInvalidXact(itemid);
-					else
-					{
-						tup_hdr = (ZHeapTupleHeader) PageGetItem(page, itemid);
-						tup_hdr->t_infomask |= ZHEAP_INVALID_XACT_SLOT;
-					}
-					break;
-				}
-				break;
+				Assert(ItemIdHasPendingXact(itemid));
+
+				/*
+				 * The pending xact must be committed if the
+				 * corresponding slot is being marked as frozen.  So,
+				 * clear the pending xact and transaction slot
+				 * information from itemid.
+				 */
+				ItemIdSetUnused(itemid);
+			}
+			else if (ItemIdIsDeleted(itemid))
+			{
+				/*
+				 * The deleted item must not be visible to anyone if
+				 * the corresponding slot is being marked as frozen.
+				 * So, marking it as dead.
+				 */
+				ItemIdSetDead(itemid);
+			}
+			else
+			{
+				tup_hdr = (ZHeapTupleHeader) PageGetItem(page, itemid);
+				ZHeapTupleHeaderSetXactSlotFrozen(tup_hdr);
+			}
+		}
+		else
+		{
+			/*
+			 * We just append the invalid xact flag in the
+			 * tuple/itemid to indicate that for this tuple/itemid we
+			 * need to fetch the transaction information from undo
+			 * record.  Also, we ensure to clear the transaction
+			 * information from unused itemid.
+			 */
+			if (!ItemIdIsUsed(itemid))
+			{
+				/*
+				 * This must be unused entry which has xact
+				 * information.
+				 */
+				Assert(ItemIdHasPendingXact(itemid));
+
+				/*
+				 * The pending xact is committed.  So, clear the
+				 * pending xact and transaction slot information from
+				 * itemid.
+				 */
+				ItemIdSetUnused(itemid);
+			}
+			else if (ItemIdIsDeleted(itemid))
+				ItemIdSetInvalidXact(itemid);
+			else
+			{
+				tup_hdr = (ZHeapTupleHeader) PageGetItem(page, itemid);
+				tup_hdr->t_infomask |= ZHEAP_INVALID_XACT_SLOT;
 			}
 		}
 	}
@@ -7135,9 +7602,9 @@ PageFreezeTransSlots(Relation relation, Buffer buf, bool *lock_reacquired,
 		opaque = (ZHeapPageOpaque) PageGetSpecialPointer(page);
 
 		if (ZHeapPageHasTPDSlot(phdr))
-			num_slots = ZHEAP_PAGE_TRANS_SLOTS - 1;
+			num_slots = ZHeapPageGetNumTransSlots(page) - 1;
 		else
-			num_slots = ZHEAP_PAGE_TRANS_SLOTS;
+			num_slots = ZHeapPageGetNumTransSlots(page);
 
 		transinfo = opaque->transinfo;
 		TPDSlot = false;
@@ -7208,7 +7675,7 @@ PageFreezeTransSlots(Relation relation, Buffer buf, bool *lock_reacquired,
 					latestfxid = thistrans->fxid;
 
 				/* Calculate the actual slot no. */
-				tpd_slot_id = slot_no + ZHEAP_PAGE_TRANS_SLOTS + 1;
+				tpd_slot_id = slot_no + ZHeapPageGetNumTransSlots(page) + 1;
 
 				/* Initialize the TPD slot. */
 				TPDPageSetTransactionSlotInfo(buf, tpd_slot_id,
@@ -7334,7 +7801,7 @@ PageFreezeTransSlots(Relation relation, Buffer buf, bool *lock_reacquired,
 
 				slot_no = completed_xact_slots[i];
 				/* calculate the actual slot no. */
-				tpd_slot_id = slot_no + ZHEAP_PAGE_TRANS_SLOTS + 1;
+				tpd_slot_id = slot_no + ZHeapPageGetNumTransSlots(page) + 1;
 
 				/* Clear xid from the TPD slot but keep the urec_ptr intact. */
 				TPDPageSetTransactionSlotInfo(buf, tpd_slot_id,
@@ -7481,6 +7948,7 @@ ZHeapTupleGetCid(ZHeapTuple zhtup, Buffer buf, UndoRecPtr urec_ptr,
 				 int trans_slot_id)
 {
 	UnpackedUndoRecord *urec;
+	UndoLocalRecord *lrec;
 	CommandId	current_cid;
 	bool		TPDSlot = true;
 	ZHeapTupleTransInfo zinfo;
@@ -7526,6 +7994,15 @@ ZHeapTupleGetCid(ZHeapTuple zhtup, Buffer buf, UndoRecPtr urec_ptr,
 		return InvalidCommandId;
 
 	Assert(UndoRecPtrIsValid(zinfo.urec_ptr));
+
+	/* Our own transaction's records are usually known without reading them. */
+	lrec = ZHeapLocalUndoRecord(&zinfo.urec_ptr,
+								ItemPointerGetBlockNumber(&zhtup->t_self),
+								ItemPointerGetOffsetNumber(&zhtup->t_self),
+								InvalidTransactionId);
+	if (lrec != NULL)
+		return lrec->cid;
+
 	urec = UndoFetchRecord(zinfo.urec_ptr,
 						   ItemPointerGetBlockNumber(&zhtup->t_self),
 						   ItemPointerGetOffsetNumber(&zhtup->t_self),
@@ -7623,18 +8100,25 @@ ZHeapTupleGetSubXid(Buffer buf, OffsetNumber offnum, UndoRecPtr urec_ptr,
 }
 
 /*
- * ZHeapTupleGetSpecToken - Retrieve speculative token from tuple's undo
- *			record.
+ * ZHeapTupleGetSpecToken - Retrieve speculative token of the tuple inserted
+ *			by xid, from the speculative token table or else from the
+ *			tuple's undo record.
  *
  * It is expected that caller of this function has at least read lock
  * on the buffer.
  */
 void
 ZHeapTupleGetSpecToken(ZHeapTuple zhtup, Buffer buf, UndoRecPtr urec_ptr,
-					   uint32 *specToken)
+					   TransactionId xid, uint32 *specToken)
 {
 	UnpackedUndoRecord *urec;
 
+	*specToken = ZHeapSpecTokenLookup(buf,
+									  ItemPointerGetOffsetNumber(&zhtup->t_self),
+									  xid);
+	if (*specToken != 0)
+		return;
+
 	urec = UndoFetchRecord(urec_ptr,
 						   ItemPointerGetBlockNumber(&zhtup->t_self),
 						   ItemPointerGetOffsetNumber(&zhtup->t_self),
@@ -7704,14 +8188,18 @@ zheap_multi_insert(Relation relation, TupleTableSlot **slots, int ntuples,
 	bool		needwal;
 	bool		need_cids = RelationIsAccessibleInLogicalDecoding(relation);
 	Size		saveFreeSpace;
+	Size		growthReserve;
 	FullTransactionId fxid = GetTopFullTransactionId();
 	xl_undolog_meta undometa;
 	bool		lock_reacquired;
 	bool		skip_undo;
+	bool		log_full_pages;
+	Size		undo_bytes = 0;
 
-	needwal = RelationNeedsWAL(relation);
+	needwal = ZHeapInsertNeedsWAL(relation, options);
 	saveFreeSpace = RelationGetTargetPageFreeSpace(relation,
 												   HEAP_DEFAULT_FILLFACTOR);
+	growthReserve = RelationGetGrowthReserve(relation);
 
 	/*
 	 * We can skip inserting undo records if the tuples are to be marked as
@@ -7719,6 +8207,14 @@ zheap_multi_insert(Relation relation, TupleTableSlot **slots, int ntuples,
 	 */
 	skip_undo = (options & ZHEAP_INSERT_FROZEN);
 
+	/*
+	 * A bulk load of frozen tuples doesn't need the individual tuples in WAL,
+	 * except for logical decoding.  Instead, we log a full-page image of each
+	 * page once we have filled it, see below.
+	 */
+	log_full_pages = needwal && skip_undo &&
+		!RelationIsLogicallyLogged(relation);
+
 	/* Toast and set header data in all the tuples */
 	zheaptuples = palloc(ntuples * sizeof(ZHeapTuple));
 	for (i = 0; i < ntuples; i++)
@@ -7765,6 +8261,7 @@ zheap_multi_insert(Relation relation, TupleTableSlot **slots, int ntuples,
 		OffsetNumber usedoff[MaxOffsetNumber];
 		OffsetNumber max_required_offset;
 		uint8		vm_status;
+		Size		pageSaveFreeSpace;
 
 		CHECK_FOR_INTERRUPTS();
 
@@ -7785,6 +8282,11 @@ reacquire_buffer:
 											&vmbuffer, NULL);
 		page = BufferGetPage(buffer);
 
+		/* Leave the growth reserve alone, like RelationGetBufferForZTuple. */
+		pageSaveFreeSpace = saveFreeSpace;
+		if (PageUpdatesGrow(page))
+			pageSaveFreeSpace += growthReserve;
+
 		/*
 		 * Get the unused offset ranges in the page. This is required for
 		 * deciding the number of undo records to be prepared later.
@@ -7792,7 +8294,7 @@ reacquire_buffer:
 		zfree_offset_ranges = ZHeapGetUsableOffsetRanges(buffer,
 														 &zheaptuples[ndone],
 														 ntuples - ndone,
-														 saveFreeSpace);
+														 pageSaveFreeSpace);
 
 		/*
 		 * We've ensured at least one tuple fits in the page. So, there'll be
@@ -7834,6 +8336,7 @@ reacquire_buffer:
 			{
 				UnlockReleaseBuffer(buffer);
 
+				pgstat_count_zheap_slot_wait(relation);
 				pgstat_report_wait_start(PG_WAIT_PAGE_TRANS_SLOT);
 				pg_usleep(10000L);	/* 10 ms */
 				pgstat_report_wait_end();
@@ -7852,6 +8355,7 @@ reacquire_buffer:
 			zh_undo_info.fxid = fxid;
 			zh_undo_info.cid = cid;
 			zh_undo_info.undo_persistence = UndoPersistenceForRelation(relation);
+			zh_undo_info.trans_slots = ZHeapPageGetNumTransSlots(BufferGetPage(buffer));
 
 			urecptr = zheap_prepare_undo_multi_insert(&zh_undo_info, zfree_offset_ranges->nranges, &undorecord,
 													  NULL, &undometa);
@@ -7881,7 +8385,7 @@ reacquire_buffer:
 		 * page has some unused item which requires us to fetch the
 		 * transaction information from TPD.
 		 */
-		if (trans_slot_id <= ZHEAP_PAGE_TRANS_SLOTS &&
+		if (trans_slot_id <= ZHeapPageGetNumTransSlots(page) &&
 			ZHeapPageHasTPDSlot((PageHeader) page) &&
 			PageHasFreeLinePointers((PageHeader) page))
 			TPDPageLock(relation, buffer);
@@ -7911,11 +8415,12 @@ reacquire_buffer:
 				zheaptup = zheaptuples[ndone + nthispage];
 
 				/* Make sure that the tuple fits in the page. */
-				if (PageGetZHeapFreeSpace(page) < zheaptup->t_len + saveFreeSpace)
+				if (PageGetZHeapFreeSpace(page) < zheaptup->t_len + pageSaveFreeSpace)
 					break;
 
 				if (!(options & ZHEAP_INSERT_FROZEN))
-					ZHeapTupleHeaderSetXactSlot(zheaptup->t_data, trans_slot_id);
+					ZHeapTupleHeaderSetXactSlot(zheaptup->t_data, trans_slot_id,
+												ZHeapPageGetNumTransSlots(page));
 
 				RelationPutZHeapTuple(relation, buffer, zheaptup);
 
@@ -7978,13 +8483,13 @@ reacquire_buffer:
 		if (!skip_undo)
 		{
 			/* Insert the undo */
-			InsertPreparedUndo();
+			undo_bytes += InsertPreparedUndo();
 
 			/*
 			 * We're sending the undo record for debugging purpose. So, just
 			 * send the last one.
 			 */
-			if (trans_slot_id > ZHEAP_PAGE_TRANS_SLOTS)
+			if (trans_slot_id > ZHeapPageGetNumTransSlots(page))
 			{
 				PageSetUNDO(undorecord[zfree_offset_ranges->nranges - 1],
 							buffer,
@@ -8008,8 +8513,19 @@ reacquire_buffer:
 			}
 		}
 
-		/* XLOG stuff */
-		if (needwal)
+		/*
+		 * XLOG stuff.  If we're bulk loading frozen tuples and the page is
+		 * full, i.e. the next tuple didn't fit, log the whole page rather
+		 * than the tuples we added.  Tuples added later to the same page, if
+		 * any, are logged as usual.  As we don't have undo to replay, the
+		 * only other change to remember is the visibility map bit; leave the
+		 * pages that had it set, or that have TPD entries, to the normal
+		 * path.
+		 */
+		if (log_full_pages && ndone + nthispage < ntuples &&
+			!all_visible_cleared && !ZHeapPageHasTPDSlot((PageHeader) page))
+			log_newpage_buffer(buffer, true);
+		else if (needwal)
 		{
 			ZHeapMultiInsertWALInfo ins_wal_info;
 			ZHeapWALInfo gen_wal_info;
@@ -8080,6 +8596,21 @@ reacquire_buffer:
 		slots[i]->tts_tid = zheaptuples[i]->t_self;
 
 	pgstat_count_heap_insert(relation, ntuples);
+	pgstat_count_zheap_undo_bytes(relation, undo_bytes);
+}
+
+/*
+ * zheap_finish_bulk_insert - finish a bulk load into a zheap
+ *
+ * If we skipped writing WAL for a frozen bulk load, we need to sync the
+ * relation, along with its toast table.  There is no undo to sync, as
+ * frozen insertions don't write any.
+ */
+void
+zheap_finish_bulk_insert(Relation relation, int options)
+{
+	if (!ZHeapInsertNeedsWAL(relation, options))
+		heap_sync(relation);
 }
 
 /*
@@ -8318,23 +8849,23 @@ GetTransactionsSlotsForPage(Relation rel, Buffer buf, int *total_trans_slots,
 			 * The last slot in page contains TPD information, so we don't
 			 * need to include it.
 			 */
-			*total_trans_slots = num_tpd_trans_slots + ZHEAP_PAGE_TRANS_SLOTS - 1;
+			*total_trans_slots = num_tpd_trans_slots + ZHeapPageGetNumTransSlots(page) - 1;
 			trans_slots = (TransInfo *)
 				palloc(*total_trans_slots * sizeof(TransInfo));
 			/* Copy the transaction slots from the page. */
 			memcpy(trans_slots, page + phdr->pd_special,
-				   (ZHEAP_PAGE_TRANS_SLOTS - 1) * sizeof(TransInfo));
+				   (ZHeapPageGetNumTransSlots(page) - 1) * sizeof(TransInfo));
 			/* Copy the transaction slots from the tpd entry. */
-			memcpy((char *) trans_slots + ((ZHEAP_PAGE_TRANS_SLOTS - 1) * sizeof(TransInfo)),
+			memcpy((char *) trans_slots + ((ZHeapPageGetNumTransSlots(page) - 1) * sizeof(TransInfo)),
 				   tpd_trans_slots, num_tpd_trans_slots * sizeof(TransInfo));
 
 			pfree(tpd_trans_slots);
-			Assert(*total_trans_slots >= ZHEAP_PAGE_TRANS_SLOTS);
+			Assert(*total_trans_slots >= ZHeapPageGetNumTransSlots(page));
 			return trans_slots;
 		}
 		else if (num_tpd_trans_slots == 0)
 		{
-			*total_trans_slots = ZHEAP_PAGE_TRANS_SLOTS - 1;
+			*total_trans_slots = ZHeapPageGetNumTransSlots(page) - 1;
 			trans_slots = (TransInfo *)
 				palloc(*total_trans_slots * sizeof(TransInfo));
 			memcpy(trans_slots, page + phdr->pd_special,
@@ -8346,7 +8877,7 @@ GetTransactionsSlotsForPage(Relation rel, Buffer buf, int *total_trans_slots,
 	Assert(!ZHeapPageHasTPDSlot(phdr) || tpd_e_pruned);
 	Assert(trans_slots == NULL);
 
-	*total_trans_slots = ZHEAP_PAGE_TRANS_SLOTS;
+	*total_trans_slots = ZHeapPageGetNumTransSlots(page);
 	trans_slots = (TransInfo *)
 		palloc(*total_trans_slots * sizeof(TransInfo));
 	memcpy(trans_slots, page + phdr->pd_special,
@@ -8355,6 +8886,31 @@ GetTransactionsSlotsForPage(Relation rel, Buffer buf, int *total_trans_slots,
 	return trans_slots;
 }
 
+/*
+ * PrefetchTransactionSlotsUndo - start reading the undo of transaction slots
+ *
+ * Callers that walk the undo chains of all the transaction slots of a page
+ * read the latest undo record of each slot one after the other.  Issuing
+ * those reads up front lets them be served in parallel.  Slots whose
+ * transaction is older than all the undo have nothing to read.
+ */
+void
+PrefetchTransactionSlotsUndo(TransInfo *trans_slots, int total_trans_slots)
+{
+	int			slot_no;
+
+	if (target_prefetch_pages <= 0)
+		return;
+
+	for (slot_no = 0; slot_no < total_trans_slots; slot_no++)
+	{
+		if (FullTransactionIdOlderThanAllUndo(trans_slots[slot_no].fxid))
+			continue;
+
+		UndoPrefetchRecord(trans_slots[slot_no].urec_ptr);
+	}
+}
+
 /*
  * CheckAndLockTPDPage - Check and lock the TPD page before starting critical
  * section.
@@ -8373,7 +8929,7 @@ static inline void
 CheckAndLockTPDPage(Relation relation, int new_trans_slot_id, int old_trans_slot_id,
 					Buffer newbuf, Buffer oldbuf)
 {
-	if (new_trans_slot_id <= ZHEAP_PAGE_TRANS_SLOTS &&
+	if (new_trans_slot_id <= ZHeapPageGetNumTransSlots(BufferGetPage(newbuf)) &&
 		ZHeapPageHasTPDSlot((PageHeader) BufferGetPage(newbuf)) &&
 		PageHasFreeLinePointers((PageHeader) BufferGetPage(newbuf)))
 	{
@@ -8393,7 +8949,7 @@ CheckAndLockTPDPage(Relation relation, int new_trans_slot_id, int old_trans_slot
 		 * the old transaction slot corresponds to a TPD slot, we must have
 		 * locked the TPD page during slot reservation.
 		 */
-		if (old_trans_slot_id > ZHEAP_PAGE_TRANS_SLOTS)
+		if (old_trans_slot_id > ZHeapPageGetNumTransSlots(BufferGetPage(oldbuf)))
 		{
 			/* old page must point to valid TPD block */
 			Assert(oldbuf_tpd_blk != InvalidBlockNumber);
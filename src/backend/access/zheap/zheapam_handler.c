@@ -40,8 +40,10 @@
 #include "catalog/pg_am_d.h"
 #include "catalog/storage.h"
 #include "catalog/storage_xlog.h"
+#include "commands/progress.h"
 #include "commands/vacuum.h"
 #include "executor/executor.h"
+#include "optimizer/optimizer.h"
 #include "optimizer/plancat.h"
 #include "pgstat.h"
 #include "storage/lmgr.h"
@@ -557,6 +559,7 @@ zheapam_begin_index_fetch(Relation rel)
 
 	hscan->xs_base.rel = rel;
 	hscan->xs_cbuf = InvalidBuffer;
+	hscan->xs_vmbuf = InvalidBuffer;
 	/* hscan->xs_continue_hot = false; */
 
 	return &hscan->xs_base;
@@ -574,6 +577,18 @@ zheapam_reset_index_fetch(IndexFetchTableData *scan)
 		hscan->xs_cbuf = InvalidBuffer;
 	}
 
+	if (BufferIsValid(hscan->xs_vmbuf))
+	{
+		ReleaseBuffer(hscan->xs_vmbuf);
+		hscan->xs_vmbuf = InvalidBuffer;
+	}
+
+	if (hscan->xs_batched)
+	{
+		MemoryContextReset(hscan->xs_batchcxt);
+		hscan->xs_batched = false;
+	}
+
 	/* hscan->xs_continue_hot = false; */
 }
 
@@ -584,9 +599,132 @@ zheapam_end_index_fetch(IndexFetchTableData *scan)
 
 	zheapam_reset_index_fetch(scan);
 
+	if (hscan->xs_batchcxt != NULL)
+	{
+		MemoryContextDelete(hscan->xs_batchcxt);
+		pfree(hscan->xs_batchtups);
+		pfree(hscan->xs_batchdead);
+	}
+
 	pfree(hscan);
 }
 
+static Size
+zheapam_index_fetch_parallel_estimate(Relation rel)
+{
+	return sizeof(ZHeapIndexFetchShared);
+}
+
+static void
+zheapam_index_fetch_parallel_initialize(Relation rel, void *pshared)
+{
+	ZHeapIndexFetchShared *shared = (ZHeapIndexFetchShared *) pshared;
+	int			i;
+
+	for (i = 0; i < ZHEAP_FETCH_SHARED_BLOCKS; i++)
+		pg_atomic_init_u32(&shared->visited[i], InvalidBlockNumber);
+}
+
+/*
+ * Check whether the index fetch is the first to visit the given page, among
+ * the participants of a parallel index scan.  This is lossy: if pages that
+ * share an entry of the shared array are visited in turn, they are reported
+ * as first visits again.  Always true if the scan is not parallel.
+ */
+static bool
+zheapam_index_fetch_first_visit(IndexFetchZHeapData *hscan, BlockNumber blkno)
+{
+	ZHeapIndexFetchShared *shared = hscan->xs_base.pshared;
+
+	if (shared == NULL)
+		return true;
+
+	return pg_atomic_exchange_u32(&shared->visited[blkno % ZHEAP_FETCH_SHARED_BLOCKS],
+								  blkno) != blkno;
+}
+
+/*
+ * Copy all the tuples of the index fetch's current page that are visible to
+ * the snapshot, under a single share lock.  The transaction slots of the
+ * page are checked against the snapshot once rather than for each tuple.
+ *
+ * This is only done for MVCC snapshots, whose view of a tuple can't change
+ * once the tuple was looked at, so the copies stay good for as long as the
+ * snapshot is used by the scan.
+ */
+static void
+zheapam_index_fetch_batch(IndexFetchZHeapData *hscan, Snapshot snapshot)
+{
+	Relation	rel = hscan->xs_base.rel;
+	Buffer		buffer = hscan->xs_cbuf;
+	Page		page;
+	OffsetNumber maxoff;
+	OffsetNumber offnum;
+	ZHeapSlotVisCache slotvis;
+	bool		all_visible;
+	MemoryContext oldcxt;
+
+	Assert(snapshot->snapshot_type == SNAPSHOT_MVCC);
+
+	if (hscan->xs_batchcxt == NULL)
+	{
+		MemoryContext cxt = GetMemoryChunkContext(hscan);
+
+		hscan->xs_batchcxt = AllocSetContextCreate(cxt,
+												   "ZHeap index fetch batch",
+												   ALLOCSET_DEFAULT_SIZES);
+		hscan->xs_batchtups = MemoryContextAlloc(cxt, sizeof(ZHeapTuple) *
+												 (MaxZHeapTuplesPerPage + 1));
+		hscan->xs_batchdead = MemoryContextAlloc(cxt, sizeof(bool) *
+												 (MaxZHeapTuplesPerPage + 1));
+	}
+	else
+		MemoryContextReset(hscan->xs_batchcxt);
+
+	all_visible = VM_ALL_VISIBLE(rel, BufferGetBlockNumber(buffer),
+								 &hscan->xs_vmbuf);
+
+	/* Visibility is decided once per transaction slot of the page. */
+	memset(&slotvis, 0, sizeof(slotvis));
+
+	oldcxt = MemoryContextSwitchTo(hscan->xs_batchcxt);
+
+	LockBuffer(buffer, BUFFER_LOCK_SHARE);
+
+	page = BufferGetPage(buffer);
+	maxoff = PageGetMaxOffsetNumber(page);
+	Assert(maxoff <= MaxZHeapTuplesPerPage);
+
+	for (offnum = FirstOffsetNumber; offnum <= maxoff; offnum++)
+	{
+		ItemId		lp = PageGetItemId(page, offnum);
+		ZHeapTuple	tuple = NULL;
+
+		if (ItemIdIsNormal(lp) || ItemIdIsDeleted(lp))
+		{
+			if (!all_visible)
+				(void) ZHeapTupleFetchPageMode(rel, buffer, offnum, snapshot,
+											   &tuple, &slotvis);
+			else if (!ItemIdIsDeleted(lp))
+				tuple = zheap_gettuple(rel, buffer, offnum);
+			hscan->xs_batchdead[offnum] = false;
+		}
+		else
+			hscan->xs_batchdead[offnum] = true;
+
+		hscan->xs_batchtups[offnum] = tuple;
+	}
+
+	LockBuffer(buffer, BUFFER_LOCK_UNLOCK);
+
+	MemoryContextSwitchTo(oldcxt);
+
+	hscan->xs_batched = true;
+	hscan->xs_batchsnap = snapshot;
+	hscan->xs_batchcid = snapshot->curcid;
+	hscan->xs_batchmaxoff = maxoff;
+}
+
 static bool
 zheapam_index_fetch_tuple(struct IndexFetchTableData *scan,
 						  ItemPointer tid,
@@ -596,6 +734,8 @@ zheapam_index_fetch_tuple(struct IndexFetchTableData *scan,
 {
 	IndexFetchZHeapData *hscan = (IndexFetchZHeapData *) scan;
 	ZHeapTuple	zheapTuple = NULL;
+	Buffer		prev_buf = hscan->xs_cbuf;
+	OffsetNumber offnum = ItemPointerGetOffsetNumber(tid);
 
 	/*
 	 * No HOT chains in zheap.
@@ -607,6 +747,95 @@ zheapam_index_fetch_tuple(struct IndexFetchTableData *scan,
 										  hscan->xs_base.rel,
 										  ItemPointerGetBlockNumber(tid));
 
+	/*
+	 * When we visit a new page, see if it can be marked all-visible, so that
+	 * index-only scans don't need to visit it again, or if it should be
+	 * pruned.  In a parallel scan, that's left to whichever participant gets
+	 * to the page first; the visibility map bit it sets serves the others.
+	 */
+	if (hscan->xs_cbuf != prev_buf)
+	{
+		/* The slot might still point to a copy of the previous page. */
+		if (hscan->xs_batched)
+		{
+			ExecClearTuple(slot);
+			MemoryContextReset(hscan->xs_batchcxt);
+			hscan->xs_batched = false;
+		}
+
+		if (zheapam_index_fetch_first_visit(hscan,
+											ItemPointerGetBlockNumber(tid)))
+		{
+			zheap_page_set_all_visible_opt(hscan->xs_base.rel, hscan->xs_cbuf,
+										   &hscan->xs_vmbuf);
+			zheap_page_prune_request(hscan->xs_base.rel, hscan->xs_cbuf);
+		}
+	}
+	else if (!hscan->xs_batched &&
+			 snapshot->snapshot_type == SNAPSHOT_MVCC &&
+			 !IsolationIsSerializable())
+	{
+		/*
+		 * The index returns a second TID of this page in a row, so it's
+		 * likely to return more of them.  Copy all the visible tuples of the
+		 * page now.  Serializable transactions need predicate locks for each
+		 * tuple they read, so they always go through zheap_search_buffer.
+		 */
+		zheapam_index_fetch_batch(hscan, snapshot);
+	}
+
+	/*
+	 * Return the copy of the tuple, if we have copied the page.  Items added
+	 * to the page afterwards, and tuples that the snapshot can't see while
+	 * the caller asks whether they are dead to everyone, are looked up the
+	 * regular way.
+	 */
+	if (hscan->xs_batched && hscan->xs_batchsnap == snapshot &&
+		hscan->xs_batchcid == snapshot->curcid &&
+		offnum >= FirstOffsetNumber && offnum <= hscan->xs_batchmaxoff)
+	{
+		zheapTuple = hscan->xs_batchtups[offnum];
+
+		if (zheapTuple != NULL)
+		{
+			*tid = zheapTuple->t_self;
+			if (all_dead)
+				*all_dead = false;
+			slot->tts_tableOid = RelationGetRelid(scan->rel);
+			ExecStoreZHeapTuple(zheapTuple, slot, false);
+			return true;
+		}
+
+		if (all_dead == NULL)
+			return false;
+		if (hscan->xs_batchdead[offnum])
+		{
+			*all_dead = true;
+			return false;
+		}
+	}
+
+	/*
+	 * Usually, the current version of the tuple is visible to us, and we
+	 * can tell without locking the buffer.  Serializable transactions need
+	 * the predicate locks taken by zheap_search_buffer.
+	 */
+	if (snapshot->snapshot_type == SNAPSHOT_MVCC &&
+		!IsolationIsSerializable())
+	{
+		zheapTuple = zheap_search_buffer_optimistic(tid, hscan->xs_base.rel,
+													hscan->xs_cbuf,
+													snapshot);
+		if (zheapTuple)
+		{
+			if (all_dead)
+				*all_dead = false;
+			slot->tts_tableOid = RelationGetRelid(scan->rel);
+			ExecStoreZHeapTuple(zheapTuple, slot, false);
+			return true;
+		}
+	}
+
 	LockBuffer(hscan->xs_cbuf, BUFFER_LOCK_SHARE);
 	zheapTuple = zheap_search_buffer(tid, hscan->xs_base.rel,
 									 hscan->xs_cbuf,
@@ -623,8 +852,50 @@ zheapam_index_fetch_tuple(struct IndexFetchTableData *scan,
 	return zheapTuple != NULL;
 }
 
+/*
+ * Return the number of blocks that have been read by this scan since
+ * starting.  This is meant for progress reporting rather than be fully
+ * accurate: in a parallel scan, workers can be concurrently reading blocks
+ * further ahead than what we report.
+ */
+static BlockNumber
+zheap_scan_get_blocks_done(ZHeapScanDesc scan)
+{
+	ParallelBlockTableScanDesc bpscan = NULL;
+	BlockNumber startblock;
+	BlockNumber blocks_done;
+
+	if (scan->rs_base.rs_parallel != NULL)
+	{
+		bpscan = (ParallelBlockTableScanDesc) scan->rs_base.rs_parallel;
+		startblock = bpscan->phs_startblock;
+	}
+	else
+		startblock = scan->rs_startblock;
+
+	/*
+	 * Might have wrapped around the end of the relation, if startblock was
+	 * not zero.
+	 */
+	if (scan->rs_cblock > startblock)
+		blocks_done = scan->rs_cblock - startblock;
+	else
+	{
+		BlockNumber nblocks;
+
+		nblocks = bpscan != NULL ? bpscan->phs_nblocks : scan->rs_nblocks;
+		blocks_done = nblocks - startblock + scan->rs_cblock;
+	}
+
+	return blocks_done;
+}
+
 /*
  * Similar to IndexBuildHeapRangeScan, but for zheap relations.
+ *
+ * In a parallel index build, sscan is the caller's scan on the shared
+ * ParallelTableScanDesc, and each participant indexes the blocks that the
+ * parallel scan hands out to it.
  */
 static double
 IndexBuildZHeapRangeScan(Relation heapRelation,
@@ -656,6 +927,7 @@ IndexBuildZHeapRangeScan(Relation heapRelation,
 	TransactionId OldestXmin;
 	bool		need_unregister_snapshot = false;
 	SubTransactionId subxid_xwait = InvalidSubTransactionId;
+	BlockNumber previous_blkno = InvalidBlockNumber;
 
 	/*
 	 * sanity checks
@@ -745,6 +1017,25 @@ IndexBuildZHeapRangeScan(Relation heapRelation,
 		snapshot = scan->rs_base.rs_snapshot;
 	}
 
+	/* Publish number of blocks to scan */
+	if (progress)
+	{
+		BlockNumber nblocks;
+
+		if (scan->rs_base.rs_parallel != NULL)
+		{
+			ParallelBlockTableScanDesc pbscan;
+
+			pbscan = (ParallelBlockTableScanDesc) scan->rs_base.rs_parallel;
+			nblocks = pbscan->phs_nblocks;
+		}
+		else
+			nblocks = scan->rs_nblocks;
+
+		pgstat_progress_update_param(PROGRESS_SCAN_BLOCKS_TOTAL,
+									 nblocks);
+	}
+
 	/*
 	 * Must call GetOldestXmin() with SnapshotAny.  Should never call
 	 * GetOldestXmin() with MVCC snapshot. (It's especially worth checking
@@ -781,6 +1072,19 @@ IndexBuildZHeapRangeScan(Relation heapRelation,
 
 		CHECK_FOR_INTERRUPTS();
 
+		/* Report scan progress, if asked to. */
+		if (progress)
+		{
+			BlockNumber blocks_done = zheap_scan_get_blocks_done(scan);
+
+			if (blocks_done != previous_blkno)
+			{
+				pgstat_progress_update_param(PROGRESS_SCAN_BLOCKS_DONE,
+											 blocks_done);
+				previous_blkno = blocks_done;
+			}
+		}
+
 		if (snapshot == SnapshotAny)
 		{
 			/* do our own time qual check */
@@ -1033,6 +1337,25 @@ IndexBuildZHeapRangeScan(Relation heapRelation,
 			pfree(targztuple);
 	}
 
+	/* Report scan progress one last time. */
+	if (progress)
+	{
+		BlockNumber blks_done;
+
+		if (scan->rs_base.rs_parallel != NULL)
+		{
+			ParallelBlockTableScanDesc pbscan;
+
+			pbscan = (ParallelBlockTableScanDesc) scan->rs_base.rs_parallel;
+			blks_done = pbscan->phs_nblocks;
+		}
+		else
+			blks_done = scan->rs_nblocks;
+
+		pgstat_progress_update_param(PROGRESS_SCAN_BLOCKS_DONE,
+									 blks_done);
+	}
+
 	table_endscan(sscan);
 
 	/* we can now forget our snapshot, if set and registered by us */
@@ -1295,6 +1618,7 @@ zheapam_scan_analyze_next_tuple(TableScanDesc sscan, TransactionId OldestXmin, d
 	for (; scan->rs_cindex <= maxoffset; scan->rs_cindex++)
 	{
 		ItemId		itemid;
+		ZHeapTupleData loctup;
 		ZHeapTuple	targtuple;
 		bool		sample_it = false;
 		TransactionId xid;
@@ -1324,9 +1648,18 @@ zheapam_scan_analyze_next_tuple(TableScanDesc sscan, TransactionId OldestXmin, d
 			continue;
 		}
 
-		/* Allocate memory for target tuple. */
-		targtuple = zheap_gettuple(scan->rs_base.rs_rd, scan->rs_cbuf,
-								   scan->rs_cindex);
+		/*
+		 * Judge the tuple where it lies on the page; it's copied only if it
+		 * ends up in the sample.  Most of the tuples that are merely counted
+		 * are classified from their transaction slot alone, and only the
+		 * tuples of aborted transactions whose undo is still pending need a
+		 * trip to undo, to find the version that is going to be restored.
+		 */
+		loctup.t_tableOid = RelationGetRelid(scan->rs_base.rs_rd);
+		loctup.t_len = ItemIdGetLength(itemid);
+		loctup.t_data = (ZHeapTupleHeader) PageGetItem(targpage, itemid);
+		ItemPointerSet(&loctup.t_self, scan->rs_cblock, scan->rs_cindex);
+		targtuple = &loctup;
 
 		switch (ZHeapTupleSatisfiesOldestXmin(targtuple, OldestXmin,
 											  scan->rs_cbuf, true,
@@ -1396,6 +1729,8 @@ zheapam_scan_analyze_next_tuple(TableScanDesc sscan, TransactionId OldestXmin, d
 
 		if (sample_it)
 		{
+			if (targtuple == &loctup)
+				targtuple = zheap_copytuple(&loctup);
 			ExecStoreZHeapTuple(targtuple, slot, false);
 			scan->rs_cindex++;
 
@@ -1403,8 +1738,8 @@ zheapam_scan_analyze_next_tuple(TableScanDesc sscan, TransactionId OldestXmin, d
 			return true;
 		}
 
-		/* Free memory for target tuple. */
-		if (targtuple)
+		/* Free the version fetched from undo, if any. */
+		if (targtuple && targtuple != &loctup)
 			zheap_freetuple(targtuple);
 	}
 
@@ -1527,22 +1862,18 @@ zheap_scan_sample_next_tuple(TableScanDesc sscan, struct SampleScanState *scanst
 		page = (Page) BufferGetPage(scan->rs_cbuf);
 		maxoffset = PageGetMaxOffsetNumber(page);
 
-		if (!scan->rs_base.rs_snapshot->takenDuringRecovery)
-		{
-			vmstatus = visibilitymap_get_status(scan->rs_base.rs_rd,
-												BufferGetBlockNumber(scan->rs_cbuf),
-												&vmbuffer);
+		/* See zheapgetpage for why this is safe in hot standby too. */
+		vmstatus = visibilitymap_get_status(scan->rs_base.rs_rd,
+											BufferGetBlockNumber(scan->rs_cbuf),
+											&vmbuffer);
 
-			all_visible = vmstatus;
+		all_visible = (vmstatus & VISIBILITYMAP_ALL_VISIBLE) != 0;
 
-			if (BufferIsValid(vmbuffer))
-			{
-				ReleaseBuffer(vmbuffer);
-				vmbuffer = InvalidBuffer;
-			}
+		if (BufferIsValid(vmbuffer))
+		{
+			ReleaseBuffer(vmbuffer);
+			vmbuffer = InvalidBuffer;
 		}
-		else
-			all_visible = false;
 	}
 	else
 	{
@@ -1653,11 +1984,18 @@ zheapam_relation_nontransactional_truncate(Relation rel)
 	RelationTruncate(rel, ZHEAP_METAPAGE + 1);
 
 	/*
-	 * Re-Initialize the existing meta page.
+	 * Re-Initialize the existing meta page.  As all the data pages are gone,
+	 * this is also the time to pick up a changed trans_slots setting.
 	 */
 	ZheapInitMetaPage(rel->rd_node, MAIN_FORKNUM,
 					  rel->rd_rel->relpersistence,
-					  true);
+					  true,
+					  RelationGetTransSlots(rel, ZHEAP_PAGE_TRANS_SLOTS));
+
+	/* Forget the slot count cached by RelationGetZHeapTransSlots. */
+	if (rel->rd_amcache)
+		pfree(rel->rd_amcache);
+	rel->rd_amcache = NULL;
 }
 
 static void
@@ -1675,6 +2013,7 @@ zheap_copy_for_cluster(Relation OldHeap, Relation NewHeap,
 	TableScanDesc heapScan;
 	bool		use_wal;
 	Tuplesortstate *tuplesort;
+	ZHeapParallelCluster pcluster = NULL;
 	TupleDesc	oldTupDesc = RelationGetDescr(OldHeap);
 	TupleDesc	newTupDesc = RelationGetDescr(NewHeap);
 	TupleTableSlot *slot;
@@ -1704,8 +2043,24 @@ zheap_copy_for_cluster(Relation OldHeap, Relation NewHeap,
 								  *multi_cutoff, use_wal);
 
 
-	/* Set up sorting if wanted */
+	/*
+	 * Set up sorting if wanted.  If enough parallel workers are allowed for
+	 * an index build on the table, let them scan and sort it.
+	 */
 	if (use_sort)
+	{
+		int			nworkers;
+
+		nworkers = plan_create_index_workers(RelationGetRelid(OldHeap),
+											 RelationGetRelid(OldIndex));
+		if (nworkers > 0)
+			pcluster = begin_zheap_parallel_cluster(OldHeap, OldIndex,
+													nworkers);
+	}
+
+	if (pcluster != NULL)
+		tuplesort = zheap_parallel_cluster_sort(pcluster, num_tuples);
+	else if (use_sort)
 		tuplesort = tuplesort_begin_cluster(oldTupDesc, OldIndex,
 											maintenance_work_mem,
 											NULL, false);
@@ -1723,7 +2078,13 @@ zheap_copy_for_cluster(Relation OldHeap, Relation NewHeap,
 	 * extend current implementation to copy visibility information of tuples,
 	 * we would require to copy meta page and or TPD page information as well
 	 */
-	if (OldIndex != NULL && !use_sort)
+	if (pcluster != NULL)
+	{
+		/* The old heap has already been scanned by the parallel sort. */
+		heapScan = NULL;
+		indexScan = NULL;
+	}
+	else if (OldIndex != NULL && !use_sort)
 	{
 		heapScan = NULL;
 		indexScan = index_beginscan(OldHeap, OldIndex, GetTransactionSnapshot(), 0, 0);
@@ -1747,7 +2108,7 @@ zheap_copy_for_cluster(Relation OldHeap, Relation NewHeap,
 	 * visibility information of tuples, we would require to copy meta page
 	 * and or TPD page information as well.
 	 */
-	for (;;)
+	while (pcluster == NULL)
 	{
 		CHECK_FOR_INTERRUPTS();
 
@@ -1766,7 +2127,7 @@ zheap_copy_for_cluster(Relation OldHeap, Relation NewHeap,
 				break;
 		}
 
-		num_tuples += 1;
+		*num_tuples += 1;
 		if (tuplesort != NULL)
 			tuplesort_putheaptuple(tuplesort, ExecFetchSlotHeapTuple(slot, false, NULL));
 		else
@@ -1791,7 +2152,9 @@ zheap_copy_for_cluster(Relation OldHeap, Relation NewHeap,
 	 */
 	if (tuplesort != NULL)
 	{
-		tuplesort_performsort(tuplesort);
+		/* A parallel sort has already been performed. */
+		if (pcluster == NULL)
+			tuplesort_performsort(tuplesort);
 
 		for (;;)
 		{
@@ -1809,7 +2172,10 @@ zheap_copy_for_cluster(Relation OldHeap, Relation NewHeap,
 									  values, isnull, rwstate);
 		}
 
-		tuplesort_end(tuplesort);
+		if (pcluster != NULL)
+			end_zheap_parallel_cluster(pcluster, tuplesort);
+		else
+			tuplesort_end(tuplesort);
 	}
 
 	/* Write out any remaining tuples, and fsync if needed */
@@ -1826,14 +2192,20 @@ zheapam_set_new_filenode(Relation rel, const RelFileNode *newrnode,
 						 TransactionId *freezeXid, MultiXactId *minmulti)
 {
 	SMgrRelation srel;
+	int			trans_slots;
 
 	*freezeXid = InvalidTransactionId;
 	*minmulti = InvalidMultiXactId;
 
 	srel = RelationCreateStorage(*newrnode, persistence);
 
-	/* initialize the meta page for zheap */
-	ZheapInitMetaPage(*newrnode, MAIN_FORKNUM, persistence, false);
+	/*
+	 * Initialize the meta page for zheap.  The number of transaction slots on
+	 * the data pages is fixed for the lifetime of this relfilenode.
+	 */
+	trans_slots = RelationGetTransSlots(rel, ZHEAP_PAGE_TRANS_SLOTS);
+	ZheapInitMetaPage(*newrnode, MAIN_FORKNUM, persistence, false,
+					  trans_slots);
 
 	/*
 	 * If required, set up an init fork for an unlogged table so that it can
@@ -1855,7 +2227,8 @@ zheapam_set_new_filenode(Relation rel, const RelFileNode *newrnode,
 		smgrimmedsync(srel, INIT_FORKNUM);
 
 		/* ZBORKED: This causes separate WAL, which doesn't seem optimal */
-		ZheapInitMetaPage(*newrnode, INIT_FORKNUM, persistence, false);
+		ZheapInitMetaPage(*newrnode, INIT_FORKNUM, persistence, false,
+						  trans_slots);
 	}
 
 	smgrclose(srel);
@@ -2119,6 +2492,8 @@ static const TableAmRoutine zheapam_methods = {
 	.index_fetch_begin = zheapam_begin_index_fetch,
 	.index_fetch_reset = zheapam_reset_index_fetch,
 	.index_fetch_end = zheapam_end_index_fetch,
+	.index_fetch_parallel_estimate = zheapam_index_fetch_parallel_estimate,
+	.index_fetch_parallel_initialize = zheapam_index_fetch_parallel_initialize,
 	.index_fetch_tuple = zheapam_index_fetch_tuple,
 
 	.tuple_insert = zheapam_insert,
@@ -2128,7 +2503,7 @@ static const TableAmRoutine zheapam_methods = {
 	.tuple_delete = zheapam_delete,
 	.tuple_update = zheapam_update,
 	.tuple_lock = zheapam_lock_tuple,
-	/* finish_bulk_insert is currently not needed */
+	.finish_bulk_insert = zheap_finish_bulk_insert,
 
 	.tuple_fetch_row_version = zheapam_fetch_row_version,
 	.tuple_get_latest_tid = zheap_get_latest_tid,
@@ -60,6 +60,8 @@ static bool GetTupleFromUndo(UndoRecPtr urec_ptr,
 							 ZHeapTuple current_tuple, ZHeapTuple *visible_tuple,
 							 Snapshot snapshot, CommandId curcid, Buffer buffer,
 							 OffsetNumber offnum, ItemPointer ctid, int trans_slot);
+static void ZHeapCheckSnapshotTooOld(Snapshot snapshot, TransactionId xid,
+									 UndoRecPtr urec_ptr);
 static ZTupleTidOp ZHeapTidOpFromInfomask(uint16 infomask);
 static ZVersionSelector ZHeapSelectVersionMVCC(ZTupleTidOp op,
 											   TransactionId xid, Snapshot snapshot);
@@ -72,6 +74,11 @@ static ZVersionSelector ZHeapSelectVersionSelf(ZTupleTidOp op,
 static ZVersionSelector ZHeapSelectVersionDirty(ZTupleTidOp op,
 												bool locked_only, ZHeapTupleTransInfo *zinfo,
 												Snapshot snapshot, int *snapshot_requests);
+static bool ZHeapTupleFetchInternal(Relation rel, Buffer buffer,
+									OffsetNumber offnum, Snapshot snapshot,
+									ZHeapTuple *visible_tuple,
+									ItemPointer new_ctid,
+									ZHeapSlotVisCache *slotvis);
 static ZVersionSelector ZHeapTupleSatisfies(ZTupleTidOp op, bool locked_only,
 											Snapshot snapshot, ZHeapTupleTransInfo *zinfo,
 											int *snapshot_requests);
@@ -100,6 +107,33 @@ FetchTransInfoFromUndo(BlockNumber blocknum, OffsetNumber offnum,
 
 	while (1)
 	{
+		UndoLocalRecord *lrec;
+
+		/*
+		 * The records of our own transaction are usually in its map of them,
+		 * which saves reading the undo to check the command ids of the tuples
+		 * we have modified.  The new ctid of a non-in-place update is only
+		 * stored in the record itself, though.
+		 */
+		lrec = ZHeapLocalUndoRecord(&zinfo->urec_ptr, blocknum, offnum, xid);
+		if (lrec != NULL && !(new_ctid && lrec->type == UNDO_UPDATE))
+		{
+			if (lrec->type != UNDO_XID_LOCK_ONLY &&
+				lrec->type != UNDO_XID_MULTI_LOCK_ONLY)
+			{
+				zinfo->xid = lrec->xid;
+				zinfo->epoch_xid =
+					FullTransactionIdFromEpochAndXid(GetEpochForXid(lrec->xid),
+													 lrec->xid);
+				zinfo->cid = lrec->cid;
+				return;
+			}
+
+			xid = InvalidTransactionId;
+			zinfo->urec_ptr = lrec->blkprev;
+			continue;
+		}
+
 		/*
 		 * The transaction slot referred by the undo tuple could have been
 		 * reused multiple times, so to ensure that we have fetched the right
@@ -400,7 +434,9 @@ GetTupleFromUndoRecord(UndoRecPtr urec_ptr, TransactionId xid, Buffer buffer,
 
 	/*
 	 * If the tuple is being updated or deleted, the payload contains a whole
-	 * new tuple.  If the caller wants it, extract it.
+	 * new tuple.  If the caller wants it, extract it.  For an in-place update,
+	 * the payload may only contain what differs from the version that
+	 * replaced it, which is the tuple the caller passed in.
 	 */
 	if (ztuple != NULL &&
 		(urec->uur_type == UNDO_UPDATE ||
@@ -409,12 +445,28 @@ GetTupleFromUndoRecord(UndoRecPtr urec_ptr, TransactionId xid, Buffer buffer,
 	{
 		ZHeapTuple	zhtup;
 
-		zhtup = palloc(ZHEAPTUPLESIZE + urec->uur_tuple.len);
-		zhtup->t_len = urec->uur_tuple.len;
+		if (urec->uur_info & UREC_INFO_TUPLE_IS_DELTA)
+		{
+			if (*ztuple == NULL)
+				elog(ERROR, "cannot rebuild tuple from undo record without its newer version");
+
+			zhtup = palloc(ZHEAPTUPLESIZE + MaxZHeapTupleSize);
+			zhtup->t_data = (ZHeapTupleHeader) ((char *) zhtup + ZHEAPTUPLESIZE);
+			zhtup->t_len = DecodeInplaceUpdateUndoTuple(urec,
+														(*ztuple)->t_data,
+														(*ztuple)->t_len,
+														(char *) zhtup->t_data);
+		}
+		else
+		{
+			UndoRecordDecompressTuple(urec);
+			zhtup = palloc(ZHEAPTUPLESIZE + urec->uur_tuple.len);
+			zhtup->t_len = urec->uur_tuple.len;
+			zhtup->t_data = (ZHeapTupleHeader) ((char *) zhtup + ZHEAPTUPLESIZE);
+			memcpy(zhtup->t_data, urec->uur_tuple.data, urec->uur_tuple.len);
+		}
 		ItemPointerSet(&zhtup->t_self, urec->uur_block, urec->uur_offset);
 		zhtup->t_tableOid = urec->uur_reloid;
-		zhtup->t_data = (ZHeapTupleHeader) ((char *) zhtup + ZHEAPTUPLESIZE);
-		memcpy(zhtup->t_data, urec->uur_tuple.data, urec->uur_tuple.len);
 
 		if (*free_ztuple)
 			pfree(*ztuple);
@@ -459,6 +511,30 @@ GetTupleFromUndoRecord(UndoRecPtr urec_ptr, TransactionId xid, Buffer buffer,
 	return true;
 }
 
+/*
+ * ZHeapCheckSnapshotTooOld
+ *
+ * Raise "snapshot too old" if an MVCC snapshot needs undo that was discarded
+ * past its xmin to stay within the undo retention limits.  That's the case
+ * if the snapshot can't see the changes of xid although they are taken as
+ * all-visible, or if the undo at urec_ptr, which the snapshot needs to look
+ * up, is gone.  Either of xid and urec_ptr can be invalid.
+ */
+static void
+ZHeapCheckSnapshotTooOld(Snapshot snapshot, TransactionId xid,
+						 UndoRecPtr urec_ptr)
+{
+	if (snapshot == NULL || !IsMVCCSnapshot(snapshot) ||
+		!UndoRetentionPassedXmin(snapshot->xmin))
+		return;
+
+	if ((TransactionIdIsNormal(xid) && XidInMVCCSnapshot(xid, snapshot)) ||
+		(UndoRecPtrIsValid(urec_ptr) && UndoLogIsDiscarded(urec_ptr)))
+		ereport(ERROR,
+				(errcode(ERRCODE_SNAPSHOT_TOO_OLD),
+				 errmsg("snapshot too old")));
+}
+
 /*
  * GetTupleFromUndo
  *
@@ -542,6 +618,13 @@ GetTupleFromUndo(UndoRecPtr urec_ptr, ZHeapTuple current_tuple,
 		ZVersionSelector zselect;
 		bool		have_cid = false;
 
+		/*
+		 * We only get here because the version we have is not visible to us,
+		 * so its undo must not have been discarded, unless that was forced
+		 * by the undo retention limits.
+		 */
+		ZHeapCheckSnapshotTooOld(snapshot, InvalidTransactionId, urec_ptr);
+
 		if (!GetTupleFromUndoRecord(urec_ptr, prev_undo_xid, buffer,
 									offnum, &hdr, visible_tuple,
 									&free_ztuple, &zinfo, ctid))
@@ -579,9 +662,13 @@ GetTupleFromUndo(UndoRecPtr urec_ptr, ZHeapTuple current_tuple,
 		 * all-visible or it precedes smallest xid that has undo.
 		 */
 		if (zinfo.trans_slot == ZHTUP_SLOT_FROZEN ||
-			TransactionIdEquals(zinfo.xid, FrozenTransactionId) ||
-			FullTransactionIdOlderThanAllUndo(zinfo.epoch_xid))
+			TransactionIdEquals(zinfo.xid, FrozenTransactionId))
+			break;
+		if (FullTransactionIdOlderThanAllUndo(zinfo.epoch_xid))
+		{
+			ZHeapCheckSnapshotTooOld(snapshot, zinfo.xid, InvalidUndoRecPtr);
 			break;
+		}
 
 		/* Preliminary visibility check, without relying on the CID. */
 		if (snapshot == NULL)
@@ -844,6 +931,75 @@ bool
 ZHeapTupleFetch(Relation rel, Buffer buffer, OffsetNumber offnum,
 				Snapshot snapshot, ZHeapTuple *visible_tuple,
 				ItemPointer new_ctid)
+{
+	return ZHeapTupleFetchInternal(rel, buffer, offnum, snapshot,
+								   visible_tuple, new_ctid, NULL);
+}
+
+/*
+ * ZHeapTupleFetchPageMode
+ *
+ * Like ZHeapTupleFetch, for page-at-a-time scans that fetch many tuples from
+ * the same buffer while holding its lock.  For MVCC snapshots, the decision
+ * whether a transaction slot of the page is visible to the snapshot is made
+ * once per slot and remembered in *slotvis, so tuples belonging to a
+ * visible slot are accepted without looking up their transaction again.
+ */
+bool
+ZHeapTupleFetchPageMode(Relation rel, Buffer buffer, OffsetNumber offnum,
+						Snapshot snapshot, ZHeapTuple *visible_tuple,
+						ZHeapSlotVisCache *slotvis)
+{
+	return ZHeapTupleFetchInternal(rel, buffer, offnum, snapshot,
+								   visible_tuple, NULL, slotvis);
+}
+
+/*
+ * ZHeapTransSlotIsVisible
+ *
+ * Decide whether all the changes made through a transaction slot, whose
+ * contents are in *zinfo, are visible to the given MVCC snapshot.  If the
+ * slot's xid is visible, all of them are, as any earlier xid the slot held
+ * must have committed before it.  A tuple whose slot is visible is then to
+ * be treated as if its slot was frozen.
+ *
+ * This needs no access to the page, so it can be used for transaction slots
+ * copied out of it as well.
+ */
+bool
+ZHeapTransSlotIsVisible(ZHeapTupleTransInfo *zinfo, Snapshot snapshot)
+{
+	uint64		oldestXidHavingUndo;
+
+	Assert(snapshot->snapshot_type == SNAPSHOT_MVCC);
+
+	if (!TransactionIdIsValid(zinfo->xid))
+		return false;
+
+	oldestXidHavingUndo =
+		pg_atomic_read_u64(&ProcGlobal->oldestXidWithEpochHavingUndo);
+
+	if (U64FromFullTransactionId(zinfo->epoch_xid) < oldestXidHavingUndo)
+	{
+		ZHeapCheckSnapshotTooOld(snapshot, zinfo->xid, InvalidUndoRecPtr);
+		return true;
+	}
+
+	return !TransactionIdIsCurrentTransactionId(zinfo->xid) &&
+		!XidInMVCCSnapshot(zinfo->xid, snapshot) &&
+		TransactionIdDidCommit(zinfo->xid);
+}
+
+/*
+ * ZHeapTupleFetchInternal
+ *
+ * Workhorse for ZHeapTupleFetch and ZHeapTupleFetchPageMode.  slotvis is
+ * NULL if the caller doesn't cache slot visibility.
+ */
+static bool
+ZHeapTupleFetchInternal(Relation rel, Buffer buffer, OffsetNumber offnum,
+						Snapshot snapshot, ZHeapTuple *visible_tuple,
+						ItemPointer new_ctid, ZHeapSlotVisCache *slotvis)
 {
 	Page		dp = BufferGetPage(buffer);
 	ItemId		lp = PageGetItemId(dp, offnum);
@@ -856,6 +1012,7 @@ ZHeapTupleFetch(Relation rel, Buffer buffer, OffsetNumber offnum,
 	bool		locked_only;
 	ZHeapTupleTransInfo zinfo;
 	ZVersionSelector zselect;
+	uint8	   *slot_status = NULL;
 
 	/*
 	 * If caller wants SNAPSHOT_DIRTY semantics, certain fields need to be
@@ -944,9 +1101,49 @@ ZHeapTupleFetch(Relation rel, Buffer buffer, OffsetNumber offnum,
 		goto out;
 	}
 
+	/*
+	 * If the caller caches slot visibility and this tuple's slot is stored
+	 * on the page, we might already know that all of its changes are
+	 * visible, in which case it's as good as frozen.
+	 */
+	if (slotvis != NULL && snapshot->snapshot_type == SNAPSHOT_MVCC &&
+		trans_slot != ZHTUP_SLOT_FROZEN &&
+		(trans_slot < ZHeapPageGetNumTransSlots(dp) ||
+		 (trans_slot == ZHeapPageGetNumTransSlots(dp) &&
+		  !ZHeapPageHasTPDSlot((PageHeader) dp))))
+	{
+		Assert(trans_slot <= ZHEAP_PAGE_TRANS_SLOTS);
+		slot_status = &slotvis->status[trans_slot];
+
+		if (*slot_status == ZSLOTVIS_VISIBLE)
+		{
+			zinfo.trans_slot = ZHTUP_SLOT_FROZEN;
+			zinfo.epoch_xid = InvalidFullTransactionId;
+			zinfo.xid = InvalidTransactionId;
+			zinfo.cid = InvalidCommandId;
+			zinfo.urec_ptr = InvalidUndoRecPtr;
+			goto satisfies;
+		}
+	}
+
 	/* Look up the transaction slot information. */
 	GetTransactionSlotInfo(buffer, offnum, trans_slot, true, false, &zinfo);
 
+	/*
+	 * Decide the visibility of the slot for the cache.  That's the same
+	 * conclusion reached below for each tuple.
+	 */
+	if (slot_status != NULL && *slot_status == ZSLOTVIS_UNKNOWN)
+	{
+		if (ZHeapTransSlotIsVisible(&zinfo, snapshot))
+		{
+			*slot_status = ZSLOTVIS_VISIBLE;
+			zinfo.trans_slot = ZHTUP_SLOT_FROZEN;
+			goto satisfies;
+		}
+		*slot_status = ZSLOTVIS_CHECK;
+	}
+
 	/*
 	 * Check whether the transaction slot is frozen.  If not, and it is
 	 * invalid (i.e. reused), pull transaction information from the undo log.
@@ -962,6 +1159,7 @@ ZHeapTupleFetch(Relation rel, Buffer buffer, OffsetNumber offnum,
 			U64FromFullTransactionId(zinfo.epoch_xid) < oldestXidHavingUndo)
 		{
 			/* The slot is old enough that we can treat it as frozen. */
+			ZHeapCheckSnapshotTooOld(snapshot, zinfo.xid, InvalidUndoRecPtr);
 			zinfo.trans_slot = ZHTUP_SLOT_FROZEN;
 		}
 		else if (is_invalid_slot)
@@ -988,6 +1186,7 @@ ZHeapTupleFetch(Relation rel, Buffer buffer, OffsetNumber offnum,
 	}
 
 	/* Attempt to make a visibility determination. */
+satisfies:
 	if (tuple == NULL)
 	{
 		op = ZTUPLETID_GONE;
@@ -1049,7 +1248,7 @@ ZHeapTupleFetch(Relation rel, Buffer buffer, OffsetNumber offnum,
 	if ((snapshot_requests & SNAPSHOT_REQUESTS_SPECTOKEN) != 0 &&
 		ZHeapTupleHeaderIsSpeculative(tuple->t_data))
 	{
-		ZHeapTupleGetSpecToken(tuple, buffer, zinfo.urec_ptr,
+		ZHeapTupleGetSpecToken(tuple, buffer, zinfo.urec_ptr, zinfo.xid,
 							   &snapshot->speculativeToken);
 		Assert(snapshot->speculativeToken != 0);
 	}
@@ -1485,7 +1684,11 @@ ZHeapTupleSatisfiesUpdate(Relation rel, ItemPointer tid, ZHeapTuple zhtup,
 /*
  * ZHeapTupleIsSurelyDead
  *
- * Similar to HeapTupleIsSurelyDead, but for zheap tuples.
+ * Similar to HeapTupleIsSurelyDead, but for zheap tuples.  zhtup is the
+ * current version of the tuple, or NULL if its item is deleted.  Index scans
+ * use this to mark the index entries of deleted and moved tuples dead, which
+ * zheap relies on more than heap does, as the space of such tuples is reused
+ * long before vacuum gets rid of their index entries.
  */
 bool
 ZHeapTupleIsSurelyDead(ZHeapTuple zhtup, Buffer buffer, OffsetNumber offnum)
@@ -1508,6 +1711,16 @@ ZHeapTupleIsSurelyDead(ZHeapTuple zhtup, Buffer buffer, OffsetNumber offnum)
 		FullTransactionIdOlderThanAllUndo(zinfo.epoch_xid))
 		return true;
 
+	/*
+	 * Otherwise, the deleting transaction might have committed before anyone
+	 * still running started, in which case no snapshot can see the tuple,
+	 * even though its undo hasn't been discarded yet.
+	 */
+	if (TransactionIdIsNormal(zinfo.xid) &&
+		TransactionIdPrecedes(zinfo.xid, RecentGlobalXmin) &&
+		TransactionIdDidCommit(zinfo.xid))
+		return true;
+
 	return false;				/* Tuple is still alive */
 }
 
@@ -1794,6 +2007,50 @@ ZHeapTupleSatisfiesOldestXmin(ZHeapTuple zhtup, TransactionId OldestXmin,
 	return ZHEAPTUPLE_LIVE;
 }
 
+/*
+ * ZHeapPageHasSerializableConflictOut - can any tuple on the page have a
+ * rw-conflict out?
+ *
+ * A tuple, or any of its prior versions in undo, can only conflict with our
+ * transaction if it was written by a transaction whose xid is on one of the
+ * page's transaction slots.  If all those transactions had ended before our
+ * snapshot was taken, i.e. precede TransactionXmin, none of them can be
+ * concurrent with us, so the caller can skip calling
+ * CheckForSerializableConflictOut for each tuple of the page.  A slot that
+ * is unused, or that was reused for a later transaction, only ever carries
+ * older xids, so it can't hide a concurrent one.  Pages with slots in a TPD
+ * page are not looked into and always report a possible conflict.
+ *
+ * The caller should have a share lock on the buffer.
+ */
+bool
+ZHeapPageHasSerializableConflictOut(Buffer buffer)
+{
+	Page		page = BufferGetPage(buffer);
+	TransInfo  *trans_slots;
+	FullTransactionId fxmin;
+	int			nslots;
+	int			slot_no;
+
+	Assert(TransactionIdIsNormal(TransactionXmin));
+
+	if (ZHeapPageHasTPDSlot((PageHeader) page))
+		return true;
+
+	fxmin = FullTransactionIdFromEpochAndXid(GetEpochForXid(TransactionXmin),
+											 TransactionXmin);
+	trans_slots = (TransInfo *) PageGetSpecialPointer(page);
+	nslots = ZHeapPageGetNumTransSlots(page);
+
+	for (slot_no = 0; slot_no < nslots; slot_no++)
+	{
+		if (!FullTransactionIdPrecedes(trans_slots[slot_no].fxid, fxmin))
+			return true;
+	}
+
+	return false;
+}
+
 /*
  * This is a helper function for CheckForSerializableConflictOut.
  *
@@ -112,6 +112,8 @@ zheap_xlog_insert(XLogReaderState *record)
 		zh_undo_info.fxid = fxid;
 		zh_undo_info.cid = FirstCommandId;
 		zh_undo_info.undo_persistence = UNDO_PERMANENT;
+		/* The insert undo record doesn't depend on the page's slot count. */
+		zh_undo_info.trans_slots = ZHEAP_PAGE_TRANS_SLOTS;
 
 		/* prepare an undo record */
 		urecptr = zheap_prepare_undoinsert(&zh_undo_info,
@@ -130,7 +132,8 @@ zheap_xlog_insert(XLogReaderState *record)
 
 	/*
 	 * If we inserted the first and only tuple on the page, re-initialize the
-	 * page from scratch.
+	 * page from scratch.  This is only logged for pages with the default
+	 * number of transaction slots, see log_zheap_insert.
 	 */
 	if (XLogRecGetInfo(record) & XLOG_ZHEAP_INIT_PAGE)
 	{
@@ -138,7 +141,7 @@ zheap_xlog_insert(XLogReaderState *record)
 		Assert(!(xlrec->flags & XLZ_INSERT_CONTAINS_TPD_SLOT));
 		buffer = XLogInitBufferForRedo(record, 0);
 		page = BufferGetPage(buffer);
-		ZheapInitPage(page, BufferGetPageSize(buffer));
+		ZheapInitPage(page, BufferGetPageSize(buffer), ZHEAP_PAGE_TRANS_SLOTS);
 		action = BLK_NEEDS_REDO;
 	}
 	else
@@ -357,6 +360,7 @@ zheap_xlog_delete(XLogReaderState *record)
 	zh_undo_info.fxid = fxid;
 	zh_undo_info.cid = FirstCommandId;
 	zh_undo_info.undo_persistence = UNDO_PERMANENT;
+	zh_undo_info.trans_slots = ZHeapPageGetNumTransSlots(page);
 	urecptr = zheap_prepare_undodelete(&zh_undo_info,
 									   &zheaptup,
 									   xlrec->prevxid,
@@ -375,7 +379,8 @@ zheap_xlog_delete(XLogReaderState *record)
 	{
 		zheaptup.t_data = (ZHeapTupleHeader) PageGetItem(page, lp);
 		zheaptup.t_len = ItemIdGetLength(lp);
-		ZHeapTupleHeaderSetXactSlot(zheaptup.t_data, xlrec->trans_slot_id);
+		ZHeapTupleHeaderSetXactSlot(zheaptup.t_data, xlrec->trans_slot_id,
+									ZHeapPageGetNumTransSlots(page));
 		zheaptup.t_data->t_infomask &= ~ZHEAP_VIS_STATUS_MASK;
 		zheaptup.t_data->t_infomask = xlrec->infomask;
 
@@ -531,8 +536,11 @@ zheap_xlog_update(XLogReaderState *record)
 
 	/*
 	 * If the WAL stream contains undo tuple, then replace it with the
-	 * explicitly stored tuple.
+	 * explicitly stored tuple.  It's always there if the undo tuple is
+	 * diff-encoded, in which case it's stored just like that.
 	 */
+	Assert(!(xlrec->flags & XLZ_UPDATE_UNDO_TUPLE_DELTA) ||
+		   (xlrec->flags & XLZ_HAS_UPDATE_UNDOTUPLE));
 	if (xlrec->flags & XLZ_HAS_UPDATE_UNDOTUPLE)
 	{
 		ZHeapTupleHeader zhtup;
@@ -609,6 +617,7 @@ zheap_xlog_update(XLogReaderState *record)
 	gen_undo_info.fxid = fxid;
 	gen_undo_info.cid = FirstCommandId;
 	gen_undo_info.undo_persistence = UNDO_PERMANENT;
+	gen_undo_info.trans_slots = ZHeapPageGetNumTransSlots(oldpage);
 
 	zh_up_undo_info.gen_info = &gen_undo_info;
 	zh_up_undo_info.inplace_update = inplace_update;
@@ -625,6 +634,9 @@ zheap_xlog_update(XLogReaderState *record)
 		*old_tup_trans_slot_id : InvalidXactSlotId;
 	zh_up_undo_info.new_prev_urecptr = (xlnewundohdr) ?
 		(xlnewundohdr->blkprev) : InvalidUndoRecPtr;
+	zh_up_undo_info.inplace_newtup = NULL;
+	zh_up_undo_info.undo_tuple_delta =
+		(xlrec->flags & XLZ_UPDATE_UNDO_TUPLE_DELTA) != 0;
 
 	urecptr = zheap_prepare_undoupdate(&zh_up_undo_info, &oldtup, record,
 									   NULL, &newurecptr);
@@ -647,7 +659,8 @@ zheap_xlog_update(XLogReaderState *record)
 	{
 		oldtup.t_data->t_infomask &= ~ZHEAP_VIS_STATUS_MASK;
 		oldtup.t_data->t_infomask = xlrec->old_infomask;
-		ZHeapTupleHeaderSetXactSlot(oldtup.t_data, xlrec->old_trans_slot_id);
+		ZHeapTupleHeaderSetXactSlot(oldtup.t_data, xlrec->old_trans_slot_id,
+									ZHeapPageGetNumTransSlots(oldpage));
 
 		if (oldblk != newblk)
 			PageSetUNDO(undorecord, oldbuffer, xlrec->old_trans_slot_id,
@@ -673,7 +686,8 @@ zheap_xlog_update(XLogReaderState *record)
 	{
 		newbuffer = XLogInitBufferForRedo(record, 0);
 		newpage = (Page) BufferGetPage(newbuffer);
-		ZheapInitPage(newpage, BufferGetPageSize(newbuffer));
+		ZheapInitPage(newpage, BufferGetPageSize(newbuffer),
+					  ZHEAP_PAGE_TRANS_SLOTS);
 		newaction = BLK_NEEDS_REDO;
 	}
 	else
@@ -838,7 +852,7 @@ zheap_xlog_update(XLogReaderState *record)
 				usedoff[0] = undorecord.uur_offset;
 				ucnt = 1;
 			}
-			if (xlrec->old_trans_slot_id > ZHEAP_PAGE_TRANS_SLOTS)
+			if (xlrec->old_trans_slot_id > ZHeapPageGetNumTransSlots(oldpage))
 			{
 				if (inplace_update)
 				{
@@ -880,7 +894,7 @@ zheap_xlog_update(XLogReaderState *record)
 			TPDPageSetLSN(newpage, lsn);
 		}
 	}
-	else if (new_trans_slot_id && (*new_trans_slot_id > ZHEAP_PAGE_TRANS_SLOTS))
+	else if (new_trans_slot_id && (*new_trans_slot_id > ZHeapPageGetNumTransSlots(newpage)))
 	{
 		TPDPageSetUndo(newbuffer,
 					   *new_trans_slot_id,
@@ -1003,7 +1017,7 @@ zheap_xlog_freeze_xact_slot(XLogReaderState *record)
 			int			tpd_slot_id;
 
 			/* Calculate the actual slot no. */
-			tpd_slot_id = frozen[i] + ZHEAP_PAGE_TRANS_SLOTS + 1;
+			tpd_slot_id = frozen[i] + ZHeapPageGetNumTransSlots(BufferGetPage(buffer)) + 1;
 
 			/* Clear slot information from the TPD slot. */
 			TPDPageSetTransactionSlotInfo(buffer, tpd_slot_id,
@@ -1098,7 +1112,7 @@ zheap_xlog_invalid_xact_slot(XLogReaderState *record)
 			int			tpd_slot_id;
 
 			/* Calculate the actual slot no. */
-			tpd_slot_id = completed_slots[i] + ZHEAP_PAGE_TRANS_SLOTS + 1;
+			tpd_slot_id = completed_slots[i] + ZHeapPageGetNumTransSlots(BufferGetPage(buffer)) + 1;
 
 			/* Clear the XID information from the TPD. */
 			TPDPageSetTransactionSlotInfo(buffer, tpd_slot_id,
@@ -1175,6 +1189,7 @@ zheap_xlog_lock(XLogReaderState *record)
 	zh_gen_undo_info.fxid = fxid;
 	zh_gen_undo_info.cid = FirstCommandId;
 	zh_gen_undo_info.undo_persistence = UNDO_PERMANENT;
+	zh_gen_undo_info.trans_slots = ZHeapPageGetNumTransSlots(page);
 
 	/* Get the trans slot number */
 	if (xlrec->flags & XLZ_LOCK_TRANS_SLOT_FOR_UREC)
@@ -1192,7 +1207,7 @@ zheap_xlog_lock(XLogReaderState *record)
 		tup_trans_slot_id = (int *) ((char *) tup_hdr +
 									 SizeofZHeapTupleHeader + sizeof(LockTupleMode));
 		trans_slot = *tup_trans_slot_id;
-		Assert(trans_slot > ZHEAP_PAGE_TRANS_SLOTS);
+		Assert(trans_slot > ZHeapPageGetNumTransSlots(page));
 	}
 
 	zh_lock_undo_info.gen_info = &zh_gen_undo_info;
@@ -1224,7 +1239,8 @@ zheap_xlog_lock(XLogReaderState *record)
 	{
 		zheaptup.t_data = (ZHeapTupleHeader) PageGetItem(page, lp);
 		zheaptup.t_len = ItemIdGetLength(lp);
-		ZHeapTupleHeaderSetXactSlot(zheaptup.t_data, xlrec->trans_slot_id);
+		ZHeapTupleHeaderSetXactSlot(zheaptup.t_data, xlrec->trans_slot_id,
+									ZHeapPageGetNumTransSlots(page));
 		zheaptup.t_data->t_infomask = xlrec->infomask;
 		PageSetUNDO(undorecord, buffer, undo_slot_no, false,
 					fxid, urecptr, NULL, 0);
@@ -1319,7 +1335,7 @@ zheap_xlog_multi_insert(XLogReaderState *record)
 		Assert(!(xlrec->flags & XLZ_INSERT_CONTAINS_TPD_SLOT));
 		buffer = XLogInitBufferForRedo(record, 0);
 		page = BufferGetPage(buffer);
-		ZheapInitPage(page, BufferGetPageSize(buffer));
+		ZheapInitPage(page, BufferGetPageSize(buffer), ZHEAP_PAGE_TRANS_SLOTS);
 		action = BLK_NEEDS_REDO;
 	}
 	else
@@ -1362,6 +1378,8 @@ zheap_xlog_multi_insert(XLogReaderState *record)
 		zh_undo_info.fxid = fxid;
 		zh_undo_info.cid = FirstCommandId;
 		zh_undo_info.undo_persistence = UNDO_PERMANENT;
+		/* The insert undo record doesn't depend on the page's slot count. */
+		zh_undo_info.trans_slots = ZHEAP_PAGE_TRANS_SLOTS;
 
 		urecptr = zheap_prepare_undo_multi_insert(&zh_undo_info, nranges,
 												  &undorecord, record, NULL);
@@ -1716,7 +1734,8 @@ zheap_xlog_confirm(XLogReaderState *record)
 		{
 			Assert(xlrec->flags == XLZ_SPEC_INSERT_FAILED ||
 				   xlrec->flags == XLZ_INSERT_IS_SPECULATIVE);
-			ItemIdSetDeadExtended(lp, xlrec->trans_slot_id);
+			ItemIdSetDeadExtended(lp, xlrec->trans_slot_id,
+								  ZHeapPageGetNumTransSlots(page));
 			ZPageSetPrunable(page, XLogRecGetXid(record));
 		}
 
@@ -1816,7 +1835,8 @@ zheap_xlog_unused(XLogReaderState *record)
 			ItemId		itemid;
 
 			itemid = PageGetItemId(page, unused[i]);
-			ItemIdSetUnusedExtended(itemid, xlrec->trans_slot_id);
+			ItemIdSetUnusedExtended(itemid, xlrec->trans_slot_id,
+									ZHeapPageGetNumTransSlots(page));
 		}
 
 		/*
@@ -1965,21 +1985,27 @@ zheap_xlog_visible(XLogReaderState *record)
 }
 
 /*
- * replay of undo page operation
+ * replay of undo page operation, for a single page or a batch of them
  */
 static void
 zheap_undo_xlog_page(XLogReaderState *record)
 {
 	XLogRecPtr	lsn = record->EndRecPtr;
+	uint8		info = XLogRecGetInfo(record) & ~XLR_INFO_MASK;
 	Buffer		buf;
 	xl_zundo_page *xlrec = NULL;
 	char	   *offsetmap = NULL,
 			   *data = NULL;
 	XLogRedoAction action;
 	uint8	   *flags = (uint8 *) XLogRecGetData(record);
-
-	if (*flags & XLU_PAGE_CONTAINS_TPD_SLOT ||
-		*flags & XLU_CONTAINS_TPD_OFFSET_MAP)
+	int			npages = 1;
+	int			block_id;
+
+	/* A multi-page record has a flags byte per page and no TPD details. */
+	if (info == XLOG_ZUNDO_MULTI_PAGE)
+		npages = record->max_block_id + 1;
+	else if (*flags & XLU_PAGE_CONTAINS_TPD_SLOT ||
+			 *flags & XLU_CONTAINS_TPD_OFFSET_MAP)
 	{
 		data = (char *) flags + sizeof(uint8);
 		if (*flags & XLU_PAGE_CONTAINS_TPD_SLOT)
@@ -1991,55 +2017,62 @@ zheap_undo_xlog_page(XLogReaderState *record)
 			offsetmap = data;
 	}
 
-	if (XLogReadBufferForRedo(record, 0, &buf) != BLK_RESTORED)
-		elog(ERROR, "Undo page record did not contain a full-page image");
-
-	/* replay the record for tpd buffer */
-	if (XLogRecHasBlockRef(record, 1))
+	for (block_id = 0; block_id < npages; block_id++)
 	{
-		/*
-		 * We need to replay the record for TPD only when this record contains
-		 * slot from TPD.
-		 */
-		Assert(*flags & XLU_PAGE_CONTAINS_TPD_SLOT ||
-			   *flags & XLU_CONTAINS_TPD_OFFSET_MAP);
-		action = XLogReadTPDBuffer(record, 1);
-		if (action == BLK_NEEDS_REDO)
+		uint8		pageflags = flags[block_id];
+
+		if (XLogReadBufferForRedo(record, block_id, &buf) != BLK_RESTORED)
+			elog(ERROR, "Undo page record did not contain a full-page image");
+
+		/* replay the record for tpd buffer */
+		if (info == XLOG_ZUNDO_PAGE && XLogRecHasBlockRef(record, 1))
 		{
-			if (*flags & XLU_PAGE_CONTAINS_TPD_SLOT)
-				TPDPageSetTransactionSlotInfo(buf, xlrec->trans_slot_id,
-											  xlrec->fxid, xlrec->urec_ptr);
+			/*
+			 * We need to replay the record for TPD only when this record
+			 * contains slot from TPD.
+			 */
+			Assert(pageflags & XLU_PAGE_CONTAINS_TPD_SLOT ||
+				   pageflags & XLU_CONTAINS_TPD_OFFSET_MAP);
+			action = XLogReadTPDBuffer(record, 1);
+			if (action == BLK_NEEDS_REDO)
+			{
+				if (pageflags & XLU_PAGE_CONTAINS_TPD_SLOT)
+					TPDPageSetTransactionSlotInfo(buf, xlrec->trans_slot_id,
+												  xlrec->fxid, xlrec->urec_ptr);
 
-			if (offsetmap)
-				TPDPageSetOffsetMap(buf, offsetmap);
+				if (offsetmap)
+					TPDPageSetOffsetMap(buf, offsetmap);
 
-			TPDPageSetLSN(BufferGetPage(buf), lsn);
+				TPDPageSetLSN(BufferGetPage(buf), lsn);
+			}
 		}
-	}
-
-	if (*flags & XLU_PAGE_CLEAR_VISIBILITY_MAP)
-	{
-		Relation	reln;
-		Buffer		vmbuffer = InvalidBuffer;
-		RelFileNode target_node;
-		BlockNumber blkno;
 
-		XLogRecGetBlockTag(record, 0, &target_node, NULL, &blkno);
-		reln = CreateFakeRelcacheEntry(target_node);
-		visibilitymap_pin(reln, blkno, &vmbuffer);
-		visibilitymap_clear(reln, blkno, vmbuffer, VISIBILITYMAP_VALID_BITS);
-		ReleaseBuffer(vmbuffer);
-		FreeFakeRelcacheEntry(reln);
-	}
+		if (pageflags & XLU_PAGE_CLEAR_VISIBILITY_MAP)
+		{
+			Relation	reln;
+			Buffer		vmbuffer = InvalidBuffer;
+			RelFileNode target_node;
+			BlockNumber blkno;
+
+			XLogRecGetBlockTag(record, block_id, &target_node, NULL, &blkno);
+			reln = CreateFakeRelcacheEntry(target_node);
+			visibilitymap_pin(reln, blkno, &vmbuffer);
+			visibilitymap_clear(reln, blkno, vmbuffer, VISIBILITYMAP_VALID_BITS);
+			ReleaseBuffer(vmbuffer);
+			FreeFakeRelcacheEntry(reln);
+		}
 
-	/*
-	 * Reset Page only at the end if asked, page level flag
-	 * PD_PAGE_HAS_TPD_SLOT and TPD slot are needed before that TPD routines.
-	 */
-	if (*flags & XLU_INIT_PAGE)
-		ZheapInitPage(BufferGetPage(buf), (Size) BLCKSZ);
+		/*
+		 * Reset Page only at the end if asked, page level flag
+		 * PD_PAGE_HAS_TPD_SLOT and TPD slot are needed before that TPD
+		 * routines.
+		 */
+		if (pageflags & XLU_INIT_PAGE)
+			ZheapInitPage(BufferGetPage(buf), (Size) BLCKSZ,
+						  ZHeapPageGetNumTransSlots(BufferGetPage(buf)));
 
-	UnlockReleaseBuffer(buf);
+		UnlockReleaseBuffer(buf);
+	}
 	UnlockReleaseTPDBuffers();
 }
 
@@ -2061,7 +2094,7 @@ zheap_undo_xlog_reset_xid(XLogReaderState *record)
 	 * slot here.
 	 */
 	if (action == BLK_NEEDS_REDO &&
-		xlrec->trans_slot_id <= ZHEAP_PAGE_TRANS_SLOTS)
+		xlrec->trans_slot_id <= ZHeapPageGetNumTransSlots(BufferGetPage(buf)))
 	{
 		Page		page;
 		ZHeapPageOpaque opaque;
@@ -2163,6 +2196,7 @@ zundo_redo(XLogReaderState *record)
 	switch (info)
 	{
 		case XLOG_ZUNDO_PAGE:
+		case XLOG_ZUNDO_MULTI_PAGE:
 			zheap_undo_xlog_page(record);
 			break;
 		case XLOG_ZUNDO_RESET_SLOT:
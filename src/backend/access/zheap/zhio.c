@@ -17,6 +17,7 @@
 
 #include "access/tpd.h"
 #include "access/visibilitymap.h"
+#include "access/zfreepages.h"
 #include "access/zheap.h"
 #include "access/zhio.h"
 #include "access/zhtup.h"
@@ -25,6 +26,76 @@
 #include "storage/lmgr.h"
 #include "storage/smgr.h"
 
+/*
+ * The blocks this backend has extended a relation by for its own insertions,
+ * when the relation's insert_spread_blocks is set.  These blocks are not
+ * entered into the FSM until this backend has filled them, so concurrent
+ * inserters, each working in its own range, don't compete for the content
+ * locks and transaction slots of the same few pages.  Only the range of one
+ * relation is remembered; blocks left unused in a range that is abandoned
+ * are found by the next vacuum, which enters them into the FSM.
+ */
+typedef struct ZHeapInsertRange
+{
+	RelFileNode rnode;			/* relation the range belongs to */
+	BlockNumber next;			/* next block to use */
+	BlockNumber end;			/* first block past the range */
+} ZHeapInsertRange;
+
+/* All-zeroes matches no relation. */
+static ZHeapInsertRange insert_range;
+
+/*
+ * Take the next block of this backend's insertion range for the relation.
+ *
+ * Returns InvalidBlockNumber if the range is used up, or belongs to another
+ * relation.  The relation might also have been truncated since the range was
+ * handed out, so we make sure the block still exists.
+ */
+static BlockNumber
+ZHeapInsertRangeNext(Relation relation)
+{
+	BlockNumber blkno;
+
+	if (!RelFileNodeEquals(insert_range.rnode, relation->rd_node) ||
+		insert_range.next >= insert_range.end)
+		return InvalidBlockNumber;
+
+	blkno = insert_range.next++;
+	if (blkno >= RelationGetNumberOfBlocks(relation))
+	{
+		insert_range.next = insert_range.end = 0;
+		return InvalidBlockNumber;
+	}
+
+	return blkno;
+}
+
+/*
+ * Extend the relation by nblocks blocks and make them this backend's
+ * insertion range.  The caller must hold the relation extension lock.
+ *
+ * Like RelationAddExtraBlocks, we don't initialize the new pages, which is
+ * done when they're first used.
+ */
+static void
+ZHeapAddInsertRange(Relation relation, BulkInsertState bistate, int nblocks)
+{
+	BlockNumber firstBlock;
+
+	if (nblocks <= 0)
+		return;
+
+	RelationOpenSmgr(relation);
+	firstBlock = smgrnblocks(relation->rd_smgr, MAIN_FORKNUM);
+	smgrzeroextend(relation->rd_smgr, MAIN_FORKNUM, firstBlock, nblocks,
+				   false);
+
+	insert_range.rnode = relation->rd_node;
+	insert_range.next = firstBlock;
+	insert_range.end = firstBlock + nblocks;
+}
+
 /*
  * RelationGetBufferForZTuple
  *
@@ -48,34 +119,47 @@ RelationGetBufferForZTuple(Relation relation, Size len,
 	Buffer		buffer = InvalidBuffer;
 	Page		page;
 	Size		pageFreeSpace = 0,
-				saveFreeSpace = 0;
+				saveFreeSpace = 0,
+				growthReserve;
 	BlockNumber targetBlock,
 				otherBlock;
 	bool		needLock = false;
+	int			trans_slots;
+	int			spread_blocks = 0;
 
 	/* Bulk insert is not supported for updates, only inserts. */
 	Assert(otherBuffer == InvalidBuffer || !bistate);
 
 	len = SHORTALIGN(len);
 
+	/* New pages get the number of transaction slots set for the relation. */
+	trans_slots = RelationGetZHeapTransSlots(relation);
+
 	/*
 	 * If we're gonna fail for oversize tuple, do it right away
 	 */
-	if (len > MaxZHeapTupleSize)
+	if (len > MaxZHeapTupleSizeForSlots(trans_slots))
 		ereport(ERROR,
 				(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
 				 errmsg("row is too big: size %zu, maximum size %zu",
-						len, MaxZHeapTupleSize)));
+						len, MaxZHeapTupleSizeForSlots(trans_slots))));
 
 	/* Compute desired extra freespace due to fillfactor option */
 	saveFreeSpace = RelationGetTargetPageFreeSpace(relation,
 												   HEAP_DEFAULT_FILLFACTOR);
 
+	/* And on pages whose updates grow tuples, due to growth_reserve */
+	growthReserve = RelationGetGrowthReserve(relation);
+
 	if (otherBuffer != InvalidBuffer)
 		otherBlock = BufferGetBlockNumber(otherBuffer);
 	else
 		otherBlock = InvalidBlockNumber;	/* just to keep compiler quiet */
 
+	/* Nobody else inserts into local relations, so there's no contention. */
+	if (!RELATION_IS_LOCAL(relation))
+		spread_blocks = RelationGetInsertSpreadBlocks(relation);
+
 	/*
 	 * We first try to put the tuple on the same page we last inserted a tuple
 	 * on, as cached in the BulkInsertState or relcache entry.  If that
@@ -88,8 +172,16 @@ RelationGetBufferForZTuple(Relation relation, Size len,
 	 *
 	 * When use_fsm is false, we either put the tuple onto the existing target
 	 * page or extend the relation.
+	 *
+	 * If the relation has insert_spread_blocks set, we prefer the blocks of
+	 * this backend's insertion range over those the FSM knows about, and when
+	 * we have to extend, we extend by a new range.
+	 *
+	 * The new version of a tuple moved by a non-in-place update is rather
+	 * placed as close to the old version as the FSM allows, ignoring the
+	 * cached target, so that updates keep the physical order of the table.
 	 */
-	if (len + saveFreeSpace > MaxZHeapTupleSize)
+	if (len + saveFreeSpace > MaxZHeapTupleSizeForSlots(trans_slots))
 	{
 		/* can't fit, don't bother asking FSM */
 		targetBlock = InvalidBlockNumber;
@@ -97,24 +189,40 @@ RelationGetBufferForZTuple(Relation relation, Size len,
 	}
 	else if (bistate && bistate->current_buf != InvalidBuffer)
 		targetBlock = BufferGetBlockNumber(bistate->current_buf);
+	else if (otherBuffer != InvalidBuffer && use_fsm)
+		targetBlock = InvalidBlockNumber;
 	else
+	{
 		targetBlock = RelationGetTargetBlock(relation);
+		if (targetBlock == InvalidBlockNumber && spread_blocks > 0)
+			targetBlock = ZHeapInsertRangeNext(relation);
+	}
 
 	if (targetBlock == InvalidBlockNumber && use_fsm)
 	{
 		/*
 		 * We have no cached target page, so ask the FSM for an initial
-		 * target.
+		 * target, unless a page that has just been pruned will do.
 		 */
-		targetBlock = GetPageWithFreeSpace(relation,
-										   len + saveFreeSpace);
+		if (otherBuffer != InvalidBuffer)
+			targetBlock = GetPageWithFreeSpaceNear(relation, otherBlock,
+												   len + saveFreeSpace);
+		else
+		{
+			targetBlock = ZHeapGetFreedPage(relation, len + saveFreeSpace);
+			if (targetBlock == InvalidBlockNumber)
+				targetBlock = GetPageWithFreeSpace(relation,
+												   len + saveFreeSpace);
+		}
 
 		/*
 		 * If the FSM knows nothing of the rel, try the last page before we
 		 * give up and extend.  This avoids one-tuple-per-page syndrome during
-		 * bootstrapping or in a recently-started system.
+		 * bootstrapping or in a recently-started system.  That page is where
+		 * all the concurrent inserters would meet, though, so don't when
+		 * spreading insertions.
 		 */
-		if (targetBlock == InvalidBlockNumber)
+		if (targetBlock == InvalidBlockNumber && spread_blocks == 0)
 		{
 			BlockNumber nblocks = RelationGetNumberOfBlocks(relation);
 
@@ -287,11 +395,22 @@ loop:
 			 */
 			if (PageIsNew(page))
 			{
-				ZheapInitPage(page, BufferGetPageSize(buffer));
+				ZheapInitPage(page, BufferGetPageSize(buffer), trans_slots);
 				MarkBufferDirty(buffer);
 			}
 
 			pageFreeSpace = PageGetZHeapFreeSpace(page);
+
+			/*
+			 * The growth reserve of a page isn't available to new tuples.
+			 * If the page is rejected, the FSM is told only about what's left
+			 * besides, which steers other inserts away from the page, until
+			 * vacuum records its actual free space again.
+			 */
+			if (growthReserve > 0 && PageUpdatesGrow(page))
+				pageFreeSpace = (pageFreeSpace > growthReserve) ?
+					pageFreeSpace - growthReserve : 0;
+
 			if (len + saveFreeSpace <= pageFreeSpace)
 			{
 				/* use this page as future insert target, too */
@@ -316,6 +435,21 @@ loop:
 			ReleaseBuffer(buffer);
 		}
 
+		/* Move on to the next block of our insertion range, if any. */
+		if (spread_blocks > 0)
+		{
+			BlockNumber nextBlock = ZHeapInsertRangeNext(relation);
+
+			if (nextBlock != InvalidBlockNumber)
+			{
+				if (use_fsm)
+					RecordPageWithFreeSpace(relation, targetBlock,
+											pageFreeSpace);
+				targetBlock = nextBlock;
+				continue;
+			}
+		}
+
 		/* Without FSM, always fall out of the loop and extend */
 		if (!use_fsm)
 			break;
@@ -324,10 +458,17 @@ loop:
 		 * Update FSM as to condition of this page, and ask for another page
 		 * to try.
 		 */
-		targetBlock = RecordAndGetPageWithFreeSpace(relation,
-													targetBlock,
-													pageFreeSpace,
-													len + saveFreeSpace);
+		if (otherBuffer != InvalidBuffer)
+		{
+			RecordPageWithFreeSpace(relation, targetBlock, pageFreeSpace);
+			targetBlock = GetPageWithFreeSpaceNear(relation, otherBlock,
+												   len + saveFreeSpace);
+		}
+		else
+			targetBlock = RecordAndGetPageWithFreeSpace(relation,
+														targetBlock,
+														pageFreeSpace,
+														len + saveFreeSpace);
 	}
 
 	/*
@@ -348,7 +489,7 @@ loop:
 	 */
 	if (needLock)
 	{
-		if (!use_fsm)
+		if (!use_fsm || spread_blocks > 0)
 			LockRelationForExtension(relation, ExclusiveLock);
 		else if (!ConditionalLockRelationForExtension(relation, ExclusiveLock))
 		{
@@ -377,6 +518,13 @@ loop:
 		}
 	}
 
+	/*
+	 * When spreading insertions, also add a new insertion range for our next
+	 * insertions, one block short of insert_spread_blocks in total.
+	 */
+	if (spread_blocks > 1)
+		ZHeapAddInsertRange(relation, bistate, spread_blocks - 1);
+
 	/*
 	 * In addition to whatever extension we performed above, we always add at
 	 * least one block to satisfy our own request.
@@ -401,7 +549,7 @@ loop:
 			 RelationGetRelationName(relation));
 
 	Assert(BufferGetBlockNumber(buffer) != ZHEAP_METAPAGE);
-	ZheapInitPage(page, BufferGetPageSize(buffer));
+	ZheapInitPage(page, BufferGetPageSize(buffer), trans_slots);
 	MarkBufferDirty(buffer);
 
 	/*
@@ -0,0 +1,435 @@
+/*-------------------------------------------------------------------------
+ *
+ * zkeysharelock.c
+ *	  shared-memory table of zheap key share tuple locks
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ *
+ * IDENTIFICATION
+ *	  src/backend/access/zheap/zkeysharelock.c
+ *
+ * NOTES
+ *	  Foreign key checks take a FOR KEY SHARE lock on the referenced row.
+ *	  Locking a zheap tuple on the page takes a transaction slot, writes an
+ *	  undo record and WAL, which is a lot of work for a lock that conflicts
+ *	  with nothing but deletes, key updates and FOR UPDATE.  Instead, a key
+ *	  share lock requested by a transaction that has no slot on the page yet
+ *	  is kept in a table in shared memory, keyed by the tuple's TID.  The
+ *	  operations that conflict with it check the table while holding the
+ *	  buffer lock, which the locker also held when it added its entry, and
+ *	  wait for the transactions they find there to finish.  A lock that
+ *	  doesn't fit into the table is taken on the page, as before.
+ *
+ *	  The table is a fixed array of small buckets, each covering the TIDs
+ *	  that hash to it.  An entry is released when its transaction ends, and
+ *	  one whose transaction is found to be over, e.g. after a crash, is
+ *	  reclaimed on sight.  A lock follows neither a non-in-place
+ *	  update nor a move to another partition, so updates that don't happen
+ *	  in place wait for the holders as well.
+ *
+ *	  The locks of a prepared transaction are saved in its state file, so
+ *	  that they can be put back after a restart.
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "access/transam.h"
+#include "access/twophase_rmgr.h"
+#include "access/xact.h"
+#include "access/zkeysharelock.h"
+#include "miscadmin.h"
+#include "storage/lwlock.h"
+#include "storage/procarray.h"
+#include "storage/shmem.h"
+#include "utils/hashutils.h"
+#include "utils/memutils.h"
+
+typedef struct ZHeapKeyShareLockTag
+{
+	Oid			dbid;
+	Oid			relid;
+	BlockNumber blkno;
+	OffsetNumber offnum;
+	uint16		pad;			/* always zero */
+} ZHeapKeyShareLockTag;
+
+typedef struct ZHeapKeyShareLockEntry
+{
+	ZHeapKeyShareLockTag tag;
+	TransactionId xid;			/* InvalidTransactionId, if unused */
+} ZHeapKeyShareLockEntry;
+
+typedef struct ZHeapKeyShareLockCtl
+{
+	LWLockPadded locks[NUM_ZHEAP_KEYSHARE_PARTITIONS];
+	ZHeapKeyShareLockEntry entries[FLEXIBLE_ARRAY_MEMBER];
+} ZHeapKeyShareLockCtl;
+
+/* A lock held by this backend, for release at end of transaction. */
+typedef struct ZHeapKeyShareLockHeld
+{
+	ZHeapKeyShareLockTag tag;
+	TransactionId xid;
+} ZHeapKeyShareLockHeld;
+
+/* GUC: number of entries in the lock table, zero disables it. */
+int			zheap_key_share_lock_table_size = 0;
+
+static ZHeapKeyShareLockCtl *ZHeapKeyShareLocks = NULL;
+static int	ZHeapKeyShareLockBuckets = 0;
+
+static ZHeapKeyShareLockHeld *held_locks = NULL;
+static int	num_held_locks = 0;
+static int	max_held_locks = 0;
+
+#define ZHeapKeyShareLockPartitionLock(bucket) \
+	(&ZHeapKeyShareLocks->locks[(bucket) % NUM_ZHEAP_KEYSHARE_PARTITIONS].lock)
+
+#define ZHeapKeyShareLockTagsEqual(a, b) \
+	((a).dbid == (b).dbid && (a).relid == (b).relid && \
+	 (a).blkno == (b).blkno && (a).offnum == (b).offnum)
+
+static bool ZHeapKeyShareLockInsert(ZHeapKeyShareLockTag *tag,
+									TransactionId xid);
+static void ZHeapKeyShareLockRemove(ZHeapKeyShareLockTag *tag,
+									TransactionId xid);
+
+/*
+ * Map a lock tag to its bucket.
+ */
+static inline int
+ZHeapKeyShareLockBucket(ZHeapKeyShareLockTag *tag)
+{
+	uint32		h;
+
+	h = hash_combine(murmurhash32(tag->dbid), murmurhash32(tag->relid));
+	h = hash_combine(h, murmurhash32(tag->blkno));
+	h = hash_combine(h, murmurhash32(tag->offnum));
+
+	return h % ZHeapKeyShareLockBuckets;
+}
+
+static inline void
+ZHeapKeyShareLockSetTag(ZHeapKeyShareLockTag *tag, Relation rel,
+						ItemPointer tid)
+{
+	tag->dbid = MyDatabaseId;
+	tag->relid = RelationGetRelid(rel);
+	tag->blkno = ItemPointerGetBlockNumber(tid);
+	tag->offnum = ItemPointerGetOffsetNumber(tid);
+	tag->pad = 0;
+}
+
+/*
+ * Report shared-memory space needed by ZHeapKeyShareLockShmemInit.
+ */
+Size
+ZHeapKeyShareLockShmemSize(void)
+{
+	int			nbuckets;
+
+	nbuckets = zheap_key_share_lock_table_size / ZHEAP_KEYSHARE_BUCKET_SIZE;
+	if (nbuckets == 0)
+		return 0;
+
+	return add_size(offsetof(ZHeapKeyShareLockCtl, entries),
+					mul_size(nbuckets * ZHEAP_KEYSHARE_BUCKET_SIZE,
+							 sizeof(ZHeapKeyShareLockEntry)));
+}
+
+/*
+ * Allocate and initialize the key share lock table in shared memory.
+ */
+void
+ZHeapKeyShareLockShmemInit(void)
+{
+	bool		found;
+	int			nentries;
+	int			i;
+
+	ZHeapKeyShareLockBuckets =
+		zheap_key_share_lock_table_size / ZHEAP_KEYSHARE_BUCKET_SIZE;
+	if (ZHeapKeyShareLockBuckets == 0)
+		return;
+
+	ZHeapKeyShareLocks = (ZHeapKeyShareLockCtl *)
+		ShmemInitStruct("ZHeap Key Share Locks", ZHeapKeyShareLockShmemSize(),
+						&found);
+
+	if (!IsUnderPostmaster)
+	{
+		Assert(!found);
+
+		nentries = ZHeapKeyShareLockBuckets * ZHEAP_KEYSHARE_BUCKET_SIZE;
+		for (i = 0; i < NUM_ZHEAP_KEYSHARE_PARTITIONS; i++)
+			LWLockInitialize(&ZHeapKeyShareLocks->locks[i].lock,
+							 LWTRANCHE_ZHEAP_KEYSHARE_LOCKS);
+		for (i = 0; i < nentries; i++)
+			ZHeapKeyShareLocks->entries[i].xid = InvalidTransactionId;
+	}
+	else
+		Assert(found);
+}
+
+/*
+ * Add an entry for the tuple lock to the table, unless there is one
+ * already.  Returns false if the bucket is full.
+ */
+static bool
+ZHeapKeyShareLockInsert(ZHeapKeyShareLockTag *tag, TransactionId xid)
+{
+	ZHeapKeyShareLockEntry *bucket;
+	LWLock	   *partitionLock;
+	int			bucketno;
+	int			freeidx = -1;
+	int			i;
+
+	bucketno = ZHeapKeyShareLockBucket(tag);
+	bucket = &ZHeapKeyShareLocks->entries[bucketno * ZHEAP_KEYSHARE_BUCKET_SIZE];
+	partitionLock = ZHeapKeyShareLockPartitionLock(bucketno);
+
+	LWLockAcquire(partitionLock, LW_EXCLUSIVE);
+	for (i = 0; i < ZHEAP_KEYSHARE_BUCKET_SIZE; i++)
+	{
+		if (!TransactionIdIsValid(bucket[i].xid))
+		{
+			if (freeidx < 0)
+				freeidx = i;
+		}
+		else if (bucket[i].xid == xid &&
+				 ZHeapKeyShareLockTagsEqual(bucket[i].tag, *tag))
+		{
+			LWLockRelease(partitionLock);
+			return true;
+		}
+	}
+
+	/* If the bucket is full, reclaim the entry of a finished transaction. */
+	for (i = 0; freeidx < 0 && i < ZHEAP_KEYSHARE_BUCKET_SIZE; i++)
+	{
+		if (!TransactionIdIsInProgress(bucket[i].xid))
+			freeidx = i;
+	}
+
+	if (freeidx >= 0)
+	{
+		bucket[freeidx].tag = *tag;
+		bucket[freeidx].xid = xid;
+	}
+	LWLockRelease(partitionLock);
+
+	return freeidx >= 0;
+}
+
+/*
+ * Remove the entry for the tuple lock from the table, if it's there.
+ */
+static void
+ZHeapKeyShareLockRemove(ZHeapKeyShareLockTag *tag, TransactionId xid)
+{
+	ZHeapKeyShareLockEntry *bucket;
+	LWLock	   *partitionLock;
+	int			bucketno;
+	int			i;
+
+	bucketno = ZHeapKeyShareLockBucket(tag);
+	bucket = &ZHeapKeyShareLocks->entries[bucketno * ZHEAP_KEYSHARE_BUCKET_SIZE];
+	partitionLock = ZHeapKeyShareLockPartitionLock(bucketno);
+
+	LWLockAcquire(partitionLock, LW_EXCLUSIVE);
+	for (i = 0; i < ZHEAP_KEYSHARE_BUCKET_SIZE; i++)
+	{
+		if (bucket[i].xid == xid &&
+			ZHeapKeyShareLockTagsEqual(bucket[i].tag, *tag))
+		{
+			bucket[i].xid = InvalidTransactionId;
+			break;
+		}
+	}
+	LWLockRelease(partitionLock);
+}
+
+/*
+ * Take a key share lock on the tuple for the current top-level transaction,
+ * which must already have an xid.
+ *
+ * The caller must hold an exclusive lock on the tuple's buffer, and must
+ * have checked that the lock doesn't conflict with any lock or update on the
+ * page.  Returns false if the lock table is disabled or full, in which case
+ * the caller has to lock the tuple on the page.
+ *
+ * Subtransactions lock their tuples on the page, so that the lock goes away
+ * if they are rolled back.
+ */
+bool
+ZHeapKeyShareLockAcquire(Relation rel, ItemPointer tid)
+{
+	ZHeapKeyShareLockTag tag;
+	TransactionId xid;
+
+	Assert(!IsSubTransaction());
+
+	if (ZHeapKeyShareLockBuckets == 0)
+		return false;
+
+	/* Make sure that we can remember the lock, before we take it. */
+	if (num_held_locks == max_held_locks)
+	{
+		int			new_max = Max(max_held_locks * 2, 16);
+
+		if (held_locks == NULL)
+			held_locks = MemoryContextAlloc(TopMemoryContext,
+											new_max * sizeof(ZHeapKeyShareLockHeld));
+		else
+			held_locks = repalloc(held_locks,
+								  new_max * sizeof(ZHeapKeyShareLockHeld));
+		max_held_locks = new_max;
+	}
+
+	xid = GetTopTransactionIdIfAny();
+	Assert(TransactionIdIsValid(xid));
+	ZHeapKeyShareLockSetTag(&tag, rel, tid);
+	if (!ZHeapKeyShareLockInsert(&tag, xid))
+		return false;
+
+	held_locks[num_held_locks].tag = tag;
+	held_locks[num_held_locks].xid = xid;
+	num_held_locks++;
+
+	return true;
+}
+
+/*
+ * Return a transaction, other than the current one, holding a key share lock
+ * on the tuple in the lock table, or InvalidTransactionId if there is none.
+ *
+ * The caller must hold an exclusive lock on the tuple's buffer, which keeps
+ * new locks from being added until it has modified the tuple.
+ */
+TransactionId
+ZHeapKeyShareLockGetHolder(Relation rel, ItemPointer tid)
+{
+	ZHeapKeyShareLockEntry *bucket;
+	ZHeapKeyShareLockTag tag;
+	LWLock	   *partitionLock;
+	TransactionId holder = InvalidTransactionId;
+	int			bucketno;
+	int			i;
+
+	if (ZHeapKeyShareLockBuckets == 0)
+		return InvalidTransactionId;
+
+	ZHeapKeyShareLockSetTag(&tag, rel, tid);
+	bucketno = ZHeapKeyShareLockBucket(&tag);
+	bucket = &ZHeapKeyShareLocks->entries[bucketno * ZHEAP_KEYSHARE_BUCKET_SIZE];
+	partitionLock = ZHeapKeyShareLockPartitionLock(bucketno);
+
+	LWLockAcquire(partitionLock, LW_EXCLUSIVE);
+	for (i = 0; i < ZHEAP_KEYSHARE_BUCKET_SIZE; i++)
+	{
+		TransactionId xid = bucket[i].xid;
+
+		if (!TransactionIdIsValid(xid) ||
+			!ZHeapKeyShareLockTagsEqual(bucket[i].tag, tag) ||
+			TransactionIdIsCurrentTransactionId(xid))
+			continue;
+
+		if (TransactionIdIsInProgress(xid))
+		{
+			holder = xid;
+			break;
+		}
+
+		/* The lock went away with its transaction. */
+		bucket[i].xid = InvalidTransactionId;
+	}
+	LWLockRelease(partitionLock);
+
+	return holder;
+}
+
+/*
+ * Release the locks taken by the transaction that has just ended.
+ *
+ * This must happen only once the transaction has ceased to be running, so
+ * that anyone who found our entries waits for us.
+ */
+void
+AtEOXact_ZHeapKeyShareLocks(void)
+{
+	int			i;
+
+	for (i = 0; i < num_held_locks; i++)
+	{
+		if (TransactionIdIsValid(held_locks[i].xid))
+			ZHeapKeyShareLockRemove(&held_locks[i].tag, held_locks[i].xid);
+	}
+	num_held_locks = 0;
+}
+
+/*
+ * Save the locks held by the transaction in its 2PC state file.
+ */
+void
+AtPrepare_ZHeapKeyShareLocks(void)
+{
+	int			i;
+
+	for (i = 0; i < num_held_locks; i++)
+		RegisterTwoPhaseRecord(TWOPHASE_RM_ZHEAP_KEYSHARE_ID, 0,
+							   &held_locks[i].tag,
+							   sizeof(ZHeapKeyShareLockTag));
+}
+
+/*
+ * Hand our locks over to the prepared transaction.
+ *
+ * The entries are already stored under the top-level xid, which the
+ * prepared transaction keeps, so we just forget about them.
+ */
+void
+PostPrepare_ZHeapKeyShareLocks(TransactionId xid)
+{
+#ifdef USE_ASSERT_CHECKING
+	int			i;
+
+	for (i = 0; i < num_held_locks; i++)
+		Assert(held_locks[i].xid == xid);
+#endif
+
+	num_held_locks = 0;
+}
+
+/*
+ * Put back a lock of a prepared transaction at startup.
+ */
+void
+zheap_keyshare_twophase_recover(TransactionId xid, uint16 info,
+								void *recdata, uint32 len)
+{
+	Assert(len == sizeof(ZHeapKeyShareLockTag));
+
+	if (ZHeapKeyShareLockBuckets == 0 ||
+		!ZHeapKeyShareLockInsert((ZHeapKeyShareLockTag *) recdata, xid))
+		ereport(WARNING,
+				(errmsg("could not restore key share tuple lock of prepared transaction %u",
+						xid),
+				 errhint("You might need to increase zheap_key_share_lock_table_size.")));
+}
+
+/*
+ * Release a lock of a prepared transaction at COMMIT PREPARED or ROLLBACK
+ * PREPARED.
+ */
+void
+zheap_keyshare_twophase_postcommit(TransactionId xid, uint16 info,
+								   void *recdata, uint32 len)
+{
+	Assert(len == sizeof(ZHeapKeyShareLockTag));
+
+	if (ZHeapKeyShareLockBuckets > 0)
+		ZHeapKeyShareLockRemove((ZHeapKeyShareLockTag *) recdata, xid);
+}
@@ -13,6 +13,15 @@
  * NOTES
  *	  This file contains functions for the multi locker facility of zheap.
  *
+ *	  Finding the members of a multi lock means walking the undo chains of
+ *	  all the transaction slots of the page, and under contention on a
+ *	  popular row every waiter that wakes up walks the same chains again.
+ *	  ZGetMultiLockMembers therefore remembers the members it has found in a
+ *	  small direct-mapped cache in shared memory.  An entry is keyed by the
+ *	  tuple and by the transaction slots it was computed from; every change
+ *	  to the tuple's lockers writes undo and so moves the undo pointer of
+ *	  some slot, which makes the old entry unreachable.
+ *
  *-------------------------------------------------------------------------
  */
 #include "postgres.h"
@@ -20,12 +29,247 @@
 #include "access/tpd.h"
 #include "access/xact.h"
 #include "access/zmultilocker.h"
+#include "miscadmin.h"
 #include "storage/bufmgr.h"
 #include "storage/buf_internals.h"
+#include "storage/lwlock.h"
 #include "storage/proc.h"
+#include "storage/shmem.h"
+#include "utils/hashutils.h"
 #include "utils/ztqual.h"
 
+typedef struct ZMultiLockCacheEntry
+{
+	RelFileNode rnode;
+	BlockNumber blkno;			/* InvalidBlockNumber, if the entry is unused */
+	OffsetNumber offnum;
+	uint16		t_infomask2;	/* header of the tuple on the page */
+	uint16		t_infomask;
+	int			nslots;			/* number of transaction slots of the page */
+	uint32		walked;			/* bitmap of the slots whose chain was walked */
+	int			nmembers;
+	TransInfo	slots[ZMULTILOCK_CACHE_MAX_SLOTS];
+	ZMultiLockMember members[ZMULTILOCK_CACHE_MAX_MEMBERS];
+} ZMultiLockCacheEntry;
+
+typedef struct ZMultiLockCacheCtl
+{
+	LWLockPadded locks[NUM_ZMULTILOCK_CACHE_PARTITIONS];
+	ZMultiLockCacheEntry entries[FLEXIBLE_ARRAY_MEMBER];
+} ZMultiLockCacheCtl;
+
+/* GUC: number of cache entries, zero disables the cache. */
+int			zheap_multilocker_cache_size = 256;
+
+static ZMultiLockCacheCtl *ZMultiLockCache = NULL;
+
+#define ZMultiLockCachePartitionLock(slot) \
+	(&ZMultiLockCache->locks[(slot) % NUM_ZMULTILOCK_CACHE_PARTITIONS].lock)
+
 static bool IsZMultiLockListMember(List *members, ZMultiLockMember *mlmember);
+static uint32 ZMultiLockCacheWalkedSlots(TransInfo *trans_slots, int nslots);
+static List *ZMultiLockCacheLookup(Relation rel, ZHeapTuple zhtup,
+								   TransInfo *trans_slots, int nslots,
+								   bool *found);
+static void ZMultiLockCacheInsert(Relation rel, ZHeapTuple zhtup,
+								  TransInfo *trans_slots, int nslots,
+								  List *members);
+
+/*
+ * Report shared-memory space needed by ZMultiLockCacheShmemInit.
+ */
+Size
+ZMultiLockCacheShmemSize(void)
+{
+	if (zheap_multilocker_cache_size == 0)
+		return 0;
+
+	return add_size(offsetof(ZMultiLockCacheCtl, entries),
+					mul_size(zheap_multilocker_cache_size,
+							 sizeof(ZMultiLockCacheEntry)));
+}
+
+/*
+ * Allocate and initialize the multi locker cache in shared memory.
+ */
+void
+ZMultiLockCacheShmemInit(void)
+{
+	bool		found;
+	int			i;
+
+	if (zheap_multilocker_cache_size == 0)
+		return;
+
+	ZMultiLockCache = (ZMultiLockCacheCtl *)
+		ShmemInitStruct("ZHeap Multi Locker Cache", ZMultiLockCacheShmemSize(),
+						&found);
+
+	if (!IsUnderPostmaster)
+	{
+		Assert(!found);
+
+		for (i = 0; i < NUM_ZMULTILOCK_CACHE_PARTITIONS; i++)
+			LWLockInitialize(&ZMultiLockCache->locks[i].lock,
+							 LWTRANCHE_ZHEAP_MULTILOCKER_CACHE);
+		for (i = 0; i < zheap_multilocker_cache_size; i++)
+			ZMultiLockCache->entries[i].blkno = InvalidBlockNumber;
+	}
+	else
+		Assert(found);
+}
+
+/*
+ * Map a tuple to its cache slot.
+ */
+static inline int
+ZMultiLockCacheSlot(Relation rel, ZHeapTuple zhtup)
+{
+	uint32		h;
+
+	h = hash_combine(murmurhash32(rel->rd_node.relNode),
+					 murmurhash32(ItemPointerGetBlockNumber(&zhtup->t_self)));
+	h = hash_combine(h, murmurhash32(ItemPointerGetOffsetNumber(&zhtup->t_self)));
+
+	return h % zheap_multilocker_cache_size;
+}
+
+/*
+ * Return the bitmap of the transaction slots whose undo chains
+ * ZGetMultiLockMembers walks, or zero if the members it finds can't be
+ * cached.
+ *
+ * The records of the current transaction are left out of the members, which
+ * makes the result depend on who asks, so pages on which we hold a slot are
+ * not cached.
+ */
+static uint32
+ZMultiLockCacheWalkedSlots(TransInfo *trans_slots, int nslots)
+{
+	FullTransactionId fxid = GetTopFullTransactionIdIfAny();
+	uint32		walked = 0;
+	int			slot_no;
+
+	if (zheap_multilocker_cache_size == 0 ||
+		nslots > ZMULTILOCK_CACHE_MAX_SLOTS)
+		return 0;
+
+	for (slot_no = 0; slot_no < nslots; slot_no++)
+	{
+		if (FullTransactionIdEquals(trans_slots[slot_no].fxid, fxid))
+			return 0;
+		if (!FullTransactionIdOlderThanAllUndo(trans_slots[slot_no].fxid))
+			walked |= (1U << slot_no);
+	}
+
+	return walked;
+}
+
+/*
+ * Look up the members of the multi lock on the tuple in the cache.
+ *
+ * On a hit, *found is set and a freshly allocated list of the members is
+ * returned.  trans_slots are the transaction slots of the tuple's page.
+ */
+static List *
+ZMultiLockCacheLookup(Relation rel, ZHeapTuple zhtup, TransInfo *trans_slots,
+					  int nslots, bool *found)
+{
+	ZMultiLockCacheEntry *entry;
+	LWLock	   *partitionLock;
+	List	   *members = NIL;
+	TransactionId oldestXidHavingUndo;
+	uint32		walked;
+	int			slot;
+	int			i;
+
+	*found = false;
+
+	walked = ZMultiLockCacheWalkedSlots(trans_slots, nslots);
+	if (walked == 0)
+		return NIL;
+
+	oldestXidHavingUndo = GetXidFromEpochXid(
+											 pg_atomic_read_u64(&ProcGlobal->oldestXidWithEpochHavingUndo));
+
+	slot = ZMultiLockCacheSlot(rel, zhtup);
+	entry = &ZMultiLockCache->entries[slot];
+	partitionLock = ZMultiLockCachePartitionLock(slot);
+
+	LWLockAcquire(partitionLock, LW_SHARED);
+	if (entry->blkno != ItemPointerGetBlockNumber(&zhtup->t_self) ||
+		entry->offnum != ItemPointerGetOffsetNumber(&zhtup->t_self) ||
+		!RelFileNodeEquals(entry->rnode, rel->rd_node) ||
+		entry->t_infomask2 != zhtup->t_data->t_infomask2 ||
+		entry->t_infomask != zhtup->t_data->t_infomask ||
+		entry->nslots != nslots || entry->walked != walked ||
+		memcmp(entry->slots, trans_slots, sizeof(TransInfo) * nslots) != 0)
+	{
+		LWLockRelease(partitionLock);
+		return NIL;
+	}
+
+	for (i = 0; i < entry->nmembers; i++)
+	{
+		ZMultiLockMember *mlmember;
+
+		/*
+		 * A fresh walk wouldn't find the members whose undo has been
+		 * discarded meanwhile.  They are all-visible, so they don't matter
+		 * for anyone anyway.
+		 */
+		if (TransactionIdPrecedes(entry->members[i].xid, oldestXidHavingUndo))
+			continue;
+
+		mlmember = (ZMultiLockMember *) palloc(sizeof(ZMultiLockMember));
+		*mlmember = entry->members[i];
+		members = lappend(members, mlmember);
+	}
+	LWLockRelease(partitionLock);
+
+	*found = true;
+
+	return members;
+}
+
+/*
+ * Remember the members of the multi lock on the tuple, evicting whatever
+ * tuple previously occupied the cache slot.  Lists too long to fit into an
+ * entry are silently skipped.
+ */
+static void
+ZMultiLockCacheInsert(Relation rel, ZHeapTuple zhtup, TransInfo *trans_slots,
+					  int nslots, List *members)
+{
+	ZMultiLockCacheEntry *entry;
+	LWLock	   *partitionLock;
+	ListCell   *lc;
+	uint32		walked;
+	int			slot;
+	int			i = 0;
+
+	walked = ZMultiLockCacheWalkedSlots(trans_slots, nslots);
+	if (walked == 0 || list_length(members) > ZMULTILOCK_CACHE_MAX_MEMBERS)
+		return;
+
+	slot = ZMultiLockCacheSlot(rel, zhtup);
+	entry = &ZMultiLockCache->entries[slot];
+	partitionLock = ZMultiLockCachePartitionLock(slot);
+
+	LWLockAcquire(partitionLock, LW_EXCLUSIVE);
+	entry->rnode = rel->rd_node;
+	entry->blkno = ItemPointerGetBlockNumber(&zhtup->t_self);
+	entry->offnum = ItemPointerGetOffsetNumber(&zhtup->t_self);
+	entry->t_infomask2 = zhtup->t_data->t_infomask2;
+	entry->t_infomask = zhtup->t_data->t_infomask;
+	entry->nslots = nslots;
+	entry->walked = walked;
+	memcpy(entry->slots, trans_slots, sizeof(TransInfo) * nslots);
+	foreach(lc, members)
+		entry->members[i++] = *(ZMultiLockMember *) lfirst(lc);
+	entry->nmembers = i;
+	LWLockRelease(partitionLock);
+}
 
 /*
  * ZCurrentXactHasTupleLockMode
@@ -185,6 +429,23 @@ ZGetMultiLockMembers(Relation rel, ZHeapTuple zhtup, Buffer buf,
 	if (nobuflock)
 		LockBuffer(buf, BUFFER_LOCK_UNLOCK);
 
+	/* See if someone has found the members already. */
+	if (!BufferIsLocal(buf))
+	{
+		bool		found;
+
+		multilockmembers = ZMultiLockCacheLookup(rel, zhtup, trans_slots,
+												 total_trans_slots, &found);
+		if (found)
+		{
+			pfree(trans_slots);
+			return multilockmembers;
+		}
+	}
+
+	/* We're going to walk the undo chain of every slot, so read ahead. */
+	PrefetchTransactionSlotsUndo(trans_slots, total_trans_slots);
+
 	for (slot_no = 0; slot_no < total_trans_slots; slot_no++)
 	{
 		FullTransactionId epoch_xid = trans_slots[slot_no].fxid;
@@ -206,7 +467,7 @@ ZGetMultiLockMembers(Relation rel, ZHeapTuple zhtup, Buffer buf,
 		 * if current slot refers to some TPD slot, we should skip the last
 		 * slot in the page by increasing the slot index by 1.
 		 */
-		if ((trans_slot_id >= ZHEAP_PAGE_TRANS_SLOTS) &&
+		if ((trans_slot_id >= ZHeapPageGetNumTransSlots(BufferGetPage(buf))) &&
 			BlockNumberIsValid(tpd_blkno))
 			trans_slot_id += 1;
 
@@ -324,6 +585,10 @@ ZGetMultiLockMembers(Relation rel, ZHeapTuple zhtup, Buffer buf,
 		}
 	}
 
+	if (!BufferIsLocal(buf))
+		ZMultiLockCacheInsert(rel, zhtup, trans_slots, total_trans_slots,
+							  multilockmembers);
+
 	/* be tidy */
 	pfree(trans_slots);
 
@@ -661,6 +926,9 @@ GetLockerTransInfo(Relation rel, ItemPointer tid, Buffer buf,
 	trans_slots = GetTransactionsSlotsForPage(rel, buf, &total_trans_slots,
 											  &tpd_blkno);
 
+	/* We're going to walk the undo chain of every slot, so read ahead. */
+	PrefetchTransactionSlotsUndo(trans_slots, total_trans_slots);
+
 	for (slot_no = 0; slot_no < total_trans_slots; slot_no++)
 	{
 		TransactionId xid;
@@ -762,7 +1030,7 @@ GetLockerTransInfo(Relation rel, ItemPointer tid, Buffer buf,
 			 * should skip the last slot in the page by increasing the slot
 			 * index by 1.
 			 */
-			if ((trans_slot_id >= ZHEAP_PAGE_TRANS_SLOTS) &&
+			if ((trans_slot_id >= ZHeapPageGetNumTransSlots(BufferGetPage(buf))) &&
 				BlockNumberIsValid(tpd_blkno))
 				trans_slot_id += 1;
 
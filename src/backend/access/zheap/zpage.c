@@ -31,6 +31,8 @@
 #include "access/tpd.h"
 #include "miscadmin.h"
 #include "utils/memdebug.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
 #include "utils/ztqual.h"
 
 /*
@@ -467,24 +469,27 @@ ZHeapGetUsableOffsetRanges(Buffer buffer,
 }
 
 /*
- * Initialize zheap page.
+ * Initialize zheap page with nslots transaction slots.
  */
 void
-ZheapInitPage(Page page, Size pageSize)
+ZheapInitPage(Page page, Size pageSize, int nslots)
 {
 	ZHeapPageOpaque opaque;
 	TransInfo  *thistrans;
 	int			i;
 
+	Assert(nslots >= ZHEAP_MIN_PAGE_TRANS_SLOTS &&
+		   nslots <= ZHEAP_MAX_PAGE_TRANS_SLOTS);
+
 	/*
 	 * The size of the opaque space depends on the number of transaction slots
-	 * in a page. We set it to default here.
+	 * in a page, which is how the rest of the code finds the slot count.
 	 */
-	PageInit(page, pageSize, ZHEAP_PAGE_TRANS_SLOTS * sizeof(TransInfo));
+	PageInit(page, pageSize, SizeOfZHeapPageOpaqueDataForSlots(nslots));
 
 	opaque = (ZHeapPageOpaque) PageGetSpecialPointer(page);
 
-	for (i = 0; i < ZHEAP_PAGE_TRANS_SLOTS; i++)
+	for (i = 0; i < nslots; i++)
 	{
 		thistrans = &opaque->transinfo[i];
 		thistrans->fxid = InvalidFullTransactionId;
@@ -500,7 +505,7 @@ ZheapInitPage(Page page, Size pageSize)
  */
 void
 ZheapInitMetaPage(RelFileNode rnode, ForkNumber forkNum,
-				  char persistence, bool already_exists)
+				  char persistence, bool already_exists, int trans_slots)
 {
 	Buffer		buf;
 	bool		use_wal;
@@ -516,7 +521,8 @@ ZheapInitMetaPage(RelFileNode rnode, ForkNumber forkNum,
 
 	START_CRIT_SECTION();
 
-	zheap_init_meta_page(buf, InvalidBlockNumber, InvalidBlockNumber);
+	zheap_init_meta_page(buf, InvalidBlockNumber, InvalidBlockNumber,
+						 InvalidBlockNumber, trans_slots);
 	MarkBufferDirty(buf);
 
 	/*
@@ -540,7 +546,8 @@ ZheapInitMetaPage(RelFileNode rnode, ForkNumber forkNum,
  */
 void
 zheap_init_meta_page(Buffer metabuf, BlockNumber first_blkno,
-					 BlockNumber last_blkno)
+					 BlockNumber last_blkno, BlockNumber free_blkno,
+					 int trans_slots)
 {
 	ZHeapMetaPage metap;
 	Page		page;
@@ -553,6 +560,8 @@ zheap_init_meta_page(Buffer metabuf, BlockNumber first_blkno,
 	metap->zhm_version = ZHEAP_VERSION;
 	metap->zhm_first_used_tpd_page = first_blkno;
 	metap->zhm_last_used_tpd_page = last_blkno;
+	metap->zhm_free_tpd_page = free_blkno;
+	metap->zhm_trans_slots = trans_slots;
 
 	/*
 	 * Set pd_lower just past the end of the metadata.  This is essential,
@@ -563,6 +572,41 @@ zheap_init_meta_page(Buffer metabuf, BlockNumber first_blkno,
 		((char *) metap + sizeof(ZHeapMetaPageData)) - (char *) page;
 }
 
+/*
+ * RelationGetZHeapTransSlots - Number of transaction slots for new pages.
+ *
+ * The count is fixed when the relation's storage is created, so we read it
+ * from the metapage once and remember it in the relcache entry; rd_amcache
+ * is reset whenever the relation gets a new relfilenode.
+ */
+int
+RelationGetZHeapTransSlots(Relation relation)
+{
+	Buffer		metabuf;
+	ZHeapMetaPage metap;
+	int			trans_slots;
+
+	if (relation->rd_amcache != NULL)
+		return *(int *) relation->rd_amcache;
+
+	metabuf = ReadBuffer(relation, ZHEAP_METAPAGE);
+	LockBuffer(metabuf, BUFFER_LOCK_SHARE);
+	metap = ZHeapPageGetMeta(BufferGetPage(metabuf));
+	Assert(metap->zhm_magic == ZHEAP_MAGIC);
+	trans_slots = metap->zhm_trans_slots;
+	UnlockReleaseBuffer(metabuf);
+
+	if (trans_slots < ZHEAP_MIN_PAGE_TRANS_SLOTS ||
+		trans_slots > ZHEAP_MAX_PAGE_TRANS_SLOTS)
+		elog(ERROR, "invalid number of transaction slots %d in metapage of relation \"%s\"",
+			 trans_slots, RelationGetRelationName(relation));
+
+	relation->rd_amcache = MemoryContextAlloc(CacheMemoryContext, sizeof(int));
+	*(int *) relation->rd_amcache = trans_slots;
+
+	return trans_slots;
+}
+
 /*
  * zheap_gettuple
  *
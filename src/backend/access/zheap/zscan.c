@@ -25,13 +25,21 @@
 #include "access/tableam.h"
 #include "access/tpd.h"
 #include "access/visibilitymap.h"
+#include "access/xact.h"
 #include "access/zheapscan.h"
 #include "miscadmin.h"
 #include "nodes/tidbitmap.h"
 #include "pgstat.h"
 #include "storage/predicate.h"
+#include "utils/memutils.h"
 #include "utils/ztqual.h"
 
+/*
+ * Number of times zheap_search_buffer_optimistic tries to read a page that
+ * keeps changing, before it leaves the tuple to zheap_search_buffer.
+ */
+#define ZHEAP_OPTIMISTIC_READ_ATTEMPTS	3
+
 /*
  * ZBORKED: don't want to include heapam.h to avoid mistakes - the syncscan
  * stuff should probably be moved to a different header.
@@ -191,6 +199,8 @@ zheap_beginscan(Relation relation, Snapshot snapshot,
 	scan->rs_strategy = NULL;	/* set in zinitscan */
 	scan->rs_startblock = 0;	/* set in initscan */
 	scan->rs_ntuples = 0;
+	scan->rs_arenapage = false;
+	scan->rs_arena = NULL;	/* allocated in zheapgetpage, if needed */
 
 	/*
 	 * Disable page-at-a-time mode if it's not a MVCC-safe snapshot.
@@ -263,6 +273,9 @@ zheap_endscan(TableScanDesc sscan)
 	if (scan->rs_strategy != NULL)
 		FreeAccessStrategy(scan->rs_strategy);
 
+	if (scan->rs_arena != NULL)
+		pfree(scan->rs_arena);
+
 	if (scan->rs_base.rs_flags & SO_TEMP_SNAPSHOT)
 		UnregisterSnapshot(scan->rs_base.rs_snapshot);
 
@@ -336,9 +349,78 @@ zheap_setscanlimits(TableScanDesc sscan, BlockNumber startBlk, BlockNumber numBl
 	scan->rs_numblocks = numBlks;
 }
 
+/*
+ * zheap_arena_gettuple - Same as zheap_gettuple, but copy the tuple into the
+ * scan's arena.
+ *
+ * *arenaoff is the first free byte of the arena and is advanced past the
+ * copied tuple.  The returned tuple is only valid until the arena is reused
+ * for the next page, so it must never be passed to zheap_freetuple.
+ */
+static ZHeapTuple
+zheap_arena_gettuple(ZHeapScanDesc scan, Buffer buffer, Page dp,
+					 OffsetNumber offnum, int ntup, Size *arenaoff)
+{
+	ItemId		lp = PageGetItemId(dp, offnum);
+	ZHeapTuple	tuple = &scan->rs_arenatuples[ntup];
+	Size		tuple_len;
+
+	Assert(ItemIdIsNormal(lp));
+
+	tuple_len = ItemIdGetLength(lp);
+	Assert(*arenaoff + tuple_len <= ZHEAP_SCAN_ARENA_SIZE);
+
+	tuple->t_tableOid = RelationGetRelid(scan->rs_base.rs_rd);
+	tuple->t_len = tuple_len;
+	ItemPointerSet(&tuple->t_self, BufferGetBlockNumber(buffer), offnum);
+	tuple->t_data = (ZHeapTupleHeader) (scan->rs_arena + *arenaoff);
+	memcpy(tuple->t_data, PageGetItem(dp, lp), tuple_len);
+
+	/* keep the next tuple MAXALIGN'd, same as a palloc'd copy */
+	*arenaoff += MAXALIGN(tuple_len);
+
+	return tuple;
+}
+
+/*
+ * zheap_prefetch_page_undo - start reading the undo needed to check the
+ * visibility of the tuples on the page.
+ *
+ * Only the transaction slots on the page itself are considered; slots that
+ * spilled into a TPD page are left alone.
+ */
+static void
+zheap_prefetch_page_undo(Page page, Snapshot snapshot)
+{
+	TransInfo  *trans_slots;
+	int			nslots;
+	int			slot_no;
+
+	if (target_prefetch_pages <= 0)
+		return;
+
+	trans_slots = (TransInfo *) PageGetSpecialPointer(page);
+	nslots = ZHeapPageGetNumTransSlots(page);
+	if (ZHeapPageHasTPDSlot((PageHeader) page))
+		nslots--;
+
+	for (slot_no = 0; slot_no < nslots; slot_no++)
+	{
+		FullTransactionId fxid = trans_slots[slot_no].fxid;
+
+		if (FullTransactionIdOlderThanAllUndo(fxid) ||
+			!XidInMVCCSnapshot(XidFromFullTransactionId(fxid), snapshot))
+			continue;
+
+		UndoPrefetchRecord(trans_slots[slot_no].urec_ptr);
+	}
+}
+
 /*
  * zheapgetpage - Same as heapgetpage, but operate on zheap page and
- * in page-at-a-time mode, visible tuples are stored in rs_visztuples.
+ * in page-at-a-time mode, visible tuples are stored in rs_visztuples.  For
+ * all-visible pages, those point into the scan's arena (see
+ * zheap_arena_gettuple).
  *
  * It returns false, if we can't scan the page (like in case of TPD page),
  * otherwise, return true.
@@ -355,8 +437,11 @@ zheapgetpage(TableScanDesc sscan, BlockNumber page)
 	OffsetNumber lineoff;
 	ItemId		lpp;
 	bool		all_visible;
+	bool		check_conflict_out;
 	uint8		vmstatus;
 	Buffer		vmbuffer = InvalidBuffer;
+	Size		arenaoff = 0;
+	ZHeapSlotVisCache slotvis;
 
 	Assert(page < scan->rs_nblocks);
 
@@ -409,7 +494,11 @@ zheapgetpage(TableScanDesc sscan, BlockNumber page)
 		UnlockReleaseBuffer(buffer);
 		return false;
 	}
-	else if (!(scan->rs_base.rs_flags & SO_ALLOW_PAGEMODE))
+
+	/* If the page has become prunable, leave that to autovacuum. */
+	zheap_page_prune_request(scan->rs_base.rs_rd, buffer);
+
+	if (!(scan->rs_base.rs_flags & SO_ALLOW_PAGEMODE))
 	{
 		LockBuffer(buffer, BUFFER_LOCK_UNLOCK);
 		scan->rs_cbuf = buffer;
@@ -428,18 +517,21 @@ zheapgetpage(TableScanDesc sscan, BlockNumber page)
 	 *
 	 * Note: In hot standby, a tuple that's already visible to all
 	 * transactions in the master might still be invisible to a read-only
-	 * transaction in the standby. We partly handle this problem by tracking
-	 * the minimum xmin of visible tuples as the cut-off XID while marking a
-	 * page all-visible on master and WAL log that along with the visibility
-	 * map SET operation. In hot standby, we wait for (or abort) all
-	 * transactions that can potentially may not see one or more tuples on the
-	 * page. That's how index-only scans work fine in hot standby.
+	 * transaction in the standby. We handle this problem by tracking the
+	 * minimum xmin of visible tuples as the cut-off XID while marking a page
+	 * all-visible on master and WAL log that along with the visibility map
+	 * SET operation. In hot standby, we wait for (or abort) all transactions
+	 * that can potentially may not see one or more tuples on the page. That's
+	 * how index-only scans work fine in hot standby.  Unlike heap, zheap has
+	 * no page-level all-visible flag that could reach the standby through a
+	 * full-page image without that conflict being resolved, and the bit is
+	 * only ever set by XLOG_ZHEAP_VISIBLE, so the visibility map can be
+	 * trusted in hot standby too.
 	 */
 
 	vmstatus = visibilitymap_get_status(scan->rs_base.rs_rd, page, &vmbuffer);
 
-	all_visible = (vmstatus & VISIBILITYMAP_ALL_VISIBLE) &&
-		!snapshot->takenDuringRecovery;
+	all_visible = (vmstatus & VISIBILITYMAP_ALL_VISIBLE) != 0;
 
 	if (BufferIsValid(vmbuffer))
 	{
@@ -447,6 +539,33 @@ zheapgetpage(TableScanDesc sscan, BlockNumber page)
 		vmbuffer = InvalidBuffer;
 	}
 
+	/*
+	 * Tuples last modified by a transaction that our snapshot can't see have
+	 * to be reconstructed from undo, so start reading the latest undo record
+	 * of each such transaction before we look at the tuples.
+	 */
+	if (!all_visible && IsMVCCSnapshot(snapshot))
+		zheap_prefetch_page_undo(dp, snapshot);
+
+	/*
+	 * All the tuples of an all-visible page are copied into the scan's arena,
+	 * which saves us a palloc and pfree for each of them.
+	 */
+	scan->rs_arenapage = all_visible;
+	if (all_visible && scan->rs_arena == NULL)
+		scan->rs_arena = MemoryContextAlloc(GetMemoryChunkContext(scan),
+											ZHEAP_SCAN_ARENA_SIZE);
+
+	/* Visibility is decided once per transaction slot of the page. */
+	memset(&slotvis, 0, sizeof(slotvis));
+
+	/*
+	 * Tuples on an all-visible page, or on a page whose transaction slots
+	 * all precede our snapshot, can't be in rw-conflict with us.
+	 */
+	check_conflict_out = IsolationIsSerializable() && !all_visible &&
+		ZHeapPageHasSerializableConflictOut(buffer);
+
 	for (lineoff = FirstOffsetNumber, lpp = PageGetItemId(dp, lineoff);
 		 lineoff <= lines;
 		 lineoff++, lpp++)
@@ -460,13 +579,14 @@ zheapgetpage(TableScanDesc sscan, BlockNumber page)
 			ItemPointerSet(&tid, page, lineoff);
 
 			if (!all_visible)
-				valid = ZHeapTupleFetch(scan->rs_base.rs_rd, buffer,
-										lineoff, snapshot, &resulttup, NULL);
+				valid = ZHeapTupleFetchPageMode(scan->rs_base.rs_rd, buffer,
+												lineoff, snapshot, &resulttup,
+												&slotvis);
 			else if (!ItemIdIsDeleted(lpp))
 			{
 				valid = true;
-				resulttup =
-					zheap_gettuple(scan->rs_base.rs_rd, buffer, lineoff);
+				resulttup = zheap_arena_gettuple(scan, buffer, dp, lineoff,
+												 ntup, &arenaoff);
 			}
 
 			/*
@@ -478,8 +598,10 @@ zheapgetpage(TableScanDesc sscan, BlockNumber page)
 			 * we're seeing some prior version of that. We handle that case in
 			 * ZHeapTupleHasSerializableConflictOut.
 			 */
-			CheckForSerializableConflictOut(valid, scan->rs_base.rs_rd, (void *) &tid,
-											buffer, snapshot);
+			if (check_conflict_out)
+				CheckForSerializableConflictOut(valid, scan->rs_base.rs_rd,
+												(void *) &tid, buffer,
+												snapshot);
 
 			if (valid)
 				scan->rs_visztuples[ntup++] = resulttup;
@@ -538,14 +660,17 @@ zheapgettup_pagemode(ZHeapScanDesc scan,
 				(ParallelBlockTableScanDesc) scan->rs_base.rs_parallel;
 
 				table_block_parallelscan_startblock_init(scan->rs_base.rs_rd,
+														 &scan->rs_parallelworkerdata,
 														 pbscan);
 
 				page = table_block_parallelscan_nextpage(scan->rs_base.rs_rd,
+														 &scan->rs_parallelworkerdata,
 														 pbscan);
 
 				/* Skip metapage */
 				if (page == ZHEAP_METAPAGE)
 					page = table_block_parallelscan_nextpage(scan->rs_base.rs_rd,
+															 &scan->rs_parallelworkerdata,
 															 pbscan);
 
 				/* Other processes might have already finished the scan. */
@@ -658,12 +783,15 @@ get_next_tuple:
 
 	/*
 	 * if we get here, it means we've exhausted the items on this page and
-	 * it's time to move to the next. For now we shall free all of the zheap
-	 * tuples stored in rs_visztuples. Later a better memory management is
-	 * required.
+	 * it's time to move to the next.  Free all of the zheap tuples stored in
+	 * rs_visztuples, unless they live in the scan's arena, which is simply
+	 * reused for the next page.
 	 */
-	for (i = 0; i < scan->rs_ntuples; i++)
-		zheap_freetuple(scan->rs_visztuples[i]);
+	if (!scan->rs_arenapage)
+	{
+		for (i = 0; i < scan->rs_ntuples; i++)
+			zheap_freetuple(scan->rs_visztuples[i]);
+	}
 	scan->rs_ntuples = 0;
 
 get_next_page:
@@ -683,10 +811,12 @@ get_next_page:
 			(ParallelBlockTableScanDesc) scan->rs_base.rs_parallel;
 
 			page = table_block_parallelscan_nextpage(scan->rs_base.rs_rd,
+													 &scan->rs_parallelworkerdata,
 													 pbscan);
 			/* Skip metapage */
 			if (page == ZHEAP_METAPAGE)
 				page = table_block_parallelscan_nextpage(scan->rs_base.rs_rd,
+														 &scan->rs_parallelworkerdata,
 														 pbscan);
 			finished = (page == InvalidBlockNumber);
 		}
@@ -801,14 +931,17 @@ zheapgettup(ZHeapScanDesc scan,
 				(ParallelBlockTableScanDesc) scan->rs_base.rs_parallel;
 
 				table_block_parallelscan_startblock_init(scan->rs_base.rs_rd,
+														 &scan->rs_parallelworkerdata,
 														 pbscan);
 
 				page = table_block_parallelscan_nextpage(scan->rs_base.rs_rd,
+														 &scan->rs_parallelworkerdata,
 														 pbscan);
 
 				/* Skip metapage */
 				if (page == ZHEAP_METAPAGE)
 					page = table_block_parallelscan_nextpage(scan->rs_base.rs_rd,
+															 &scan->rs_parallelworkerdata,
 															 pbscan);
 
 				/* Other processes might have already finished the scan. */
@@ -992,10 +1125,12 @@ get_next_page:
 			(ParallelBlockTableScanDesc) scan->rs_base.rs_parallel;
 
 			page = table_block_parallelscan_nextpage(scan->rs_base.rs_rd,
+													 &scan->rs_parallelworkerdata,
 													 pbscan);
 			/* Skip metapage */
 			if (page == ZHEAP_METAPAGE)
 				page = table_block_parallelscan_nextpage(scan->rs_base.rs_rd,
+														 &scan->rs_parallelworkerdata,
 														 pbscan);
 			finished = (page == InvalidBlockNumber);
 		}
@@ -1143,11 +1278,19 @@ zheap_scan_bitmap_next_block(TableScanDesc sscan,
 	BlockNumber page = tbmres->blockno;
 	Page		dp;
 	Buffer		buffer;
+	Buffer		vmbuffer = InvalidBuffer;
 	Snapshot	snapshot;
+	OffsetNumber maxoff;
+	uint8		vmstatus;
+	bool		check_conflict_out;
+	ZHeapSlotVisCache slotvis;
+	int			nitems;
+	int			curslot;
 	int			ntup;
 
 	scan->rs_cindex = 0;
 	scan->rs_ntuples = 0;
+	scan->rs_arenapage = false;
 
 	/*
 	 * Ignore any claimed entries past what we think is the end of the
@@ -1193,75 +1336,79 @@ zheap_scan_bitmap_next_block(TableScanDesc sscan,
 	}
 
 	/*
-	 * We need two separate strategies for lossy and non-lossy cases.
+	 * Start reading the undo of the transactions our snapshot can't see, as
+	 * zheapgetpage does, unless the page is all-visible.
 	 */
-	if (tbmres->ntuples >= 0)
-	{
-		/*
-		 * Bitmap is non-lossy, so we just look through the offsets listed in
-		 * tbmres;
-		 */
-		int			curslot;
+	vmstatus = visibilitymap_get_status(scan->rs_base.rs_rd, page, &vmbuffer);
+	if (BufferIsValid(vmbuffer))
+		ReleaseBuffer(vmbuffer);
+	if ((vmstatus & VISIBILITYMAP_ALL_VISIBLE) == 0 && IsMVCCSnapshot(snapshot))
+		zheap_prefetch_page_undo(dp, snapshot);
 
-		for (curslot = 0; curslot < tbmres->ntuples; curslot++)
-		{
-			OffsetNumber offnum = tbmres->offsets[curslot];
-			ItemPointerData tid;
-			ZHeapTuple	ztuple;
+	/* Visibility is decided once per transaction slot of the page. */
+	memset(&slotvis, 0, sizeof(slotvis));
 
-			ItemPointerSet(&tid, page, offnum);
-			ztuple = zheap_search_buffer(&tid, scan->rs_base.rs_rd, buffer, snapshot, NULL);
-			if (ztuple != NULL)
-				scan->rs_visztuples[ntup++] = ztuple;
-		}
-	}
-	else
+	/* See zheapgetpage. */
+	check_conflict_out = IsolationIsSerializable() &&
+		ZHeapPageHasSerializableConflictOut(buffer);
+
+	/*
+	 * If the bitmap is non-lossy, we just look through the offsets listed in
+	 * tbmres, otherwise we must examine each item pointer on the page.
+	 */
+	maxoff = PageGetMaxOffsetNumber(dp);
+	nitems = (tbmres->ntuples >= 0) ? tbmres->ntuples : maxoff;
+
+	for (curslot = 0; curslot < nitems; curslot++)
 	{
-		/*
-		 * Bitmap is lossy, so we must examine each item pointer on the page.
-		 */
-		OffsetNumber maxoff = PageGetMaxOffsetNumber(dp);
 		OffsetNumber offnum;
+		ItemId		lpp;
+		ZHeapTuple	resulttup;
+		bool		valid;
+		ItemPointerData tid;
 
-		for (offnum = FirstOffsetNumber; offnum <= maxoff; offnum = OffsetNumberNext(offnum))
+		if (tbmres->ntuples >= 0)
 		{
-			ItemId		lpp;
-			ZHeapTuple	resulttup;
-			bool		valid;
-			ItemPointerData tid;
-
-			lpp = PageGetItemId(dp, offnum);
-			if (!ItemIdIsNormal(lpp))
+			offnum = tbmres->offsets[curslot];
+			/* check for bogus TID */
+			if (offnum < FirstOffsetNumber || offnum > maxoff)
 				continue;
+		}
+		else
+			offnum = FirstOffsetNumber + curslot;
 
-			ItemPointerSet(&tid, page, offnum);
-
-			valid = ZHeapTupleFetch(scan->rs_base.rs_rd, buffer,
-									offnum, snapshot, &resulttup, NULL);
+		lpp = PageGetItemId(dp, offnum);
+		if (!(ItemIdIsNormal(lpp) || ItemIdIsDeleted(lpp)))
+			continue;
 
-			if (valid)
-			{
-				PredicateLockTid(scan->rs_base.rs_rd, &(resulttup->t_self), snapshot,
-								 IsSerializableXact() ?
-								 zheap_fetchinsertxid(resulttup, buffer) :
-								 InvalidTransactionId);
-			}
+		ItemPointerSet(&tid, page, offnum);
 
-			/*
-			 * If any prior version is visible, we pass latest visible as
-			 * true. The state of latest version of tuple is determined by the
-			 * called function.
-			 *
-			 * Note that, it's possible that tuple is updated in-place and
-			 * we're seeing some prior version of that. We handle that case in
-			 * ZHeapTupleHasSerializableConflictOut.
-			 */
-			CheckForSerializableConflictOut(valid, scan->rs_base.rs_rd, (void *) &tid,
-											buffer, snapshot);
+		valid = ZHeapTupleFetchPageMode(scan->rs_base.rs_rd, buffer, offnum,
+										snapshot, &resulttup, &slotvis);
 
-			if (valid)
-				scan->rs_visztuples[ntup++] = resulttup;
+		if (valid)
+		{
+			PredicateLockTid(scan->rs_base.rs_rd, &(resulttup->t_self), snapshot,
+							 IsSerializableXact() ?
+							 zheap_fetchinsertxid(resulttup, buffer) :
+							 InvalidTransactionId);
 		}
+
+		/*
+		 * If any prior version is visible, we pass latest visible as true.
+		 * The state of latest version of tuple is determined by the called
+		 * function.
+		 *
+		 * Note that, it's possible that tuple is updated in-place and we're
+		 * seeing some prior version of that. We handle that case in
+		 * ZHeapTupleHasSerializableConflictOut.
+		 */
+		if (check_conflict_out)
+			CheckForSerializableConflictOut(valid, scan->rs_base.rs_rd,
+											(void *) &tid, buffer, snapshot);
+
+		if (valid)
+			scan->rs_visztuples[ntup++] = resulttup;
 	}
 
 	LockBuffer(buffer, BUFFER_LOCK_UNLOCK);
@@ -1404,6 +1551,134 @@ zheap_search_buffer(ItemPointer tid, Relation relation, Buffer buffer,
 	return resulttup;
 }
 
+/*
+ *	zheap_search_buffer_optimistic - search tuple without locking the buffer
+ *
+ * This is a shortcut for zheap_search_buffer, for the common case that the
+ * current version of the tuple is visible to an MVCC snapshot, and that can
+ * be told from the tuple header and a transaction slot on the page itself.
+ * The tuple and its transaction slot are copied without holding the buffer
+ * content lock, which could otherwise be contended on pages that are
+ * updated constantly, and the copy is used only if no one locked the buffer
+ * exclusively meanwhile; see BufferBeginOptimisticRead.  If the page changes
+ * under us a few times in a row, we give up.
+ *
+ * Returns the tuple, or NULL if the shortcut doesn't apply, in which case the
+ * caller must lock the buffer and use zheap_search_buffer.  The caller must
+ * hold a pin on the buffer.  No predicate locks are taken, so serializable
+ * transactions must not use this.
+ */
+ZHeapTuple
+zheap_search_buffer_optimistic(ItemPointer tid, Relation relation,
+							   Buffer buffer, Snapshot snapshot)
+{
+	Page		dp = BufferGetPage(buffer);
+	OffsetNumber offnum = ItemPointerGetOffsetNumber(tid);
+	int			attempt;
+
+	Assert(snapshot->snapshot_type == SNAPSHOT_MVCC);
+	Assert(ItemPointerGetBlockNumber(tid) == BufferGetBlockNumber(buffer));
+
+	for (attempt = 0; attempt < ZHEAP_OPTIMISTIC_READ_ATTEMPTS; attempt++)
+	{
+		uint32		version;
+		PageHeaderData phdr;
+		ItemIdData	lp;
+		Size		tuple_len;
+		ZHeapTuple	tuple;
+		int			trans_slot;
+		int			nslots;
+		TransInfo	transinfo;
+		ZHeapTupleTransInfo zinfo;
+
+		if (!BufferBeginOptimisticRead(buffer, &version))
+			return NULL;
+
+		/*
+		 * Until the copy is known to be consistent, anything we read may be
+		 * garbage, so check all offsets before following them.  When they
+		 * don't make sense, we leave it to zheap_search_buffer to find out
+		 * whether the page was changing or the TID is bogus.
+		 */
+		memcpy(&phdr, dp, SizeOfPageHeaderData);
+		if (phdr.pd_lower > BLCKSZ || phdr.pd_special > BLCKSZ ||
+			offnum < FirstOffsetNumber ||
+			offnum > PageGetMaxOffsetNumber((Page) &phdr))
+			return NULL;
+
+		memcpy(&lp, PageGetItemId(dp, offnum), sizeof(ItemIdData));
+		if (!ItemIdIsNormal(&lp))
+			return NULL;
+
+		tuple_len = ItemIdGetLength(&lp);
+		if (tuple_len < SizeofZHeapTupleHeader ||
+			ItemIdGetOffset(&lp) + tuple_len > BLCKSZ)
+			return NULL;
+
+		tuple = palloc(ZHEAPTUPLESIZE + tuple_len);
+		tuple->t_tableOid = RelationGetRelid(relation);
+		tuple->t_len = tuple_len;
+		tuple->t_self = *tid;
+		tuple->t_data = (ZHeapTupleHeader) ((char *) tuple + ZHEAPTUPLESIZE);
+		memcpy(tuple->t_data, (char *) dp + ItemIdGetOffset(&lp), tuple_len);
+
+		/*
+		 * If the tuple was deleted or moved by a non-in-place update, the
+		 * snapshot sees no version or an older one.
+		 */
+		if ((tuple->t_data->t_infomask & (ZHEAP_DELETED | ZHEAP_UPDATED)) != 0)
+		{
+			pfree(tuple);
+			return NULL;
+		}
+
+		/* Slots kept in a TPD entry need the TPD page to be locked. */
+		trans_slot = ZHeapTupleHeaderGetXactSlot(tuple->t_data);
+		nslots = (BLCKSZ - phdr.pd_special) / sizeof(TransInfo);
+		if (trans_slot != ZHTUP_SLOT_FROZEN &&
+			(trans_slot > nslots ||
+			 (trans_slot == nslots && ZHeapPageHasTPDSlot(&phdr))))
+		{
+			pfree(tuple);
+			return NULL;
+		}
+
+		if (trans_slot != ZHTUP_SLOT_FROZEN)
+			memcpy(&transinfo,
+				   (char *) dp + phdr.pd_special +
+				   (trans_slot - 1) * sizeof(TransInfo),
+				   sizeof(TransInfo));
+
+		if (!BufferEndOptimisticRead(buffer, version))
+		{
+			pfree(tuple);
+			continue;
+		}
+
+		/*
+		 * The current version is visible if all the changes made through its
+		 * slot are, just like in ZHeapTupleFetch.  That holds whether or not
+		 * the slot has been reused since the tuple was last changed, and
+		 * whether the tuple was inserted, updated in place or locked.
+		 */
+		if (trans_slot == ZHTUP_SLOT_FROZEN)
+			return tuple;
+
+		zinfo.trans_slot = trans_slot;
+		zinfo.epoch_xid = transinfo.fxid;
+		zinfo.xid = XidFromFullTransactionId(transinfo.fxid);
+		zinfo.cid = InvalidCommandId;
+		zinfo.urec_ptr = transinfo.urec_ptr;
+		if (ZHeapTransSlotIsVisible(&zinfo, snapshot))
+			return tuple;
+
+		pfree(tuple);
+		return NULL;
+	}
+
+	return NULL;
+}
+
 /*
  * zheap_fetch - Fetch a tuple based on TID.
  *
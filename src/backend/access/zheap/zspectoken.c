@@ -0,0 +1,221 @@
+/*-------------------------------------------------------------------------
+ *
+ * zspectoken.c
+ *	  shared-memory table of zheap speculative insertion tokens
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ *
+ * IDENTIFICATION
+ *	  src/backend/access/zheap/zspectoken.c
+ *
+ * NOTES
+ *	  A zheap tuple has no room for the speculative insertion token, so it
+ *	  is stored in the payload of the insert's undo record, and every
+ *	  INSERT .. ON CONFLICT that runs into a speculatively inserted tuple
+ *	  has to fetch that record to learn which token to wait for.  To avoid
+ *	  that, zheap_insert also puts the token into a small direct-mapped table
+ *	  in shared memory, keyed by the buffer tag and offset of the tuple and
+ *	  by the inserting transaction.  A newer token that maps to the same slot
+ *	  simply evicts the older one, and a lookup that misses falls back to the
+ *	  undo record, so the table is only a cache.
+ *
+ *	  The entry is made before the inserter releases the buffer lock, and
+ *	  looked up by backends holding at least a share lock on the buffer, so
+ *	  any entry found for a tuple belongs to its latest insertion: an older
+ *	  insertion into the same item by the same transaction had its entry
+ *	  overwritten, or evicted, before the new tuple could be seen.  Entries
+ *	  are dropped when the insertion is confirmed or killed; those of
+ *	  transactions that ended otherwise are never matched again, as the
+ *	  tuple they describe isn't speculative anymore, and are eventually
+ *	  overwritten.
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "access/transam.h"
+#include "access/zspectoken.h"
+#include "miscadmin.h"
+#include "storage/bufmgr.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/hashutils.h"
+
+typedef struct ZHeapSpecTokenEntry
+{
+	RelFileNode rnode;
+	BlockNumber blkno;
+	OffsetNumber offnum;
+	TransactionId xid;
+	uint32		token;			/* zero, if the entry is unused */
+} ZHeapSpecTokenEntry;
+
+typedef struct ZHeapSpecTokenCtl
+{
+	LWLockPadded locks[NUM_ZSPECTOKEN_PARTITIONS];
+	ZHeapSpecTokenEntry entries[FLEXIBLE_ARRAY_MEMBER];
+} ZHeapSpecTokenCtl;
+
+/* GUC: number of entries in the token table, zero disables it. */
+int			zheap_spec_token_table_size = 1024;
+
+static ZHeapSpecTokenCtl *ZHeapSpecTokens = NULL;
+
+#define ZHeapSpecTokenPartitionLock(slot) \
+	(&ZHeapSpecTokens->locks[(slot) % NUM_ZSPECTOKEN_PARTITIONS].lock)
+
+#define ZHeapSpecTokenEntryMatches(entry, rn, blk, off, x) \
+	((entry)->token != 0 && RelFileNodeEquals((entry)->rnode, rn) && \
+	 (entry)->blkno == (blk) && (entry)->offnum == (off) && \
+	 TransactionIdEquals((entry)->xid, x))
+
+/*
+ * Map a tuple to its slot in the table.
+ */
+static inline int
+ZHeapSpecTokenSlot(RelFileNode *rnode, BlockNumber blkno, OffsetNumber offnum)
+{
+	uint32		h;
+
+	h = hash_combine(murmurhash32(rnode->relNode),
+					 murmurhash32(rnode->dbNode));
+	h = hash_combine(h, murmurhash32(blkno));
+	h = hash_combine(h, murmurhash32(offnum));
+
+	return h % zheap_spec_token_table_size;
+}
+
+/*
+ * Report shared-memory space needed by ZHeapSpecTokenShmemInit.
+ */
+Size
+ZHeapSpecTokenShmemSize(void)
+{
+	if (zheap_spec_token_table_size == 0)
+		return 0;
+
+	return add_size(offsetof(ZHeapSpecTokenCtl, entries),
+					mul_size(zheap_spec_token_table_size,
+							 sizeof(ZHeapSpecTokenEntry)));
+}
+
+/*
+ * Allocate and initialize the speculative token table in shared memory.
+ */
+void
+ZHeapSpecTokenShmemInit(void)
+{
+	bool		found;
+	int			i;
+
+	if (zheap_spec_token_table_size == 0)
+		return;
+
+	ZHeapSpecTokens = (ZHeapSpecTokenCtl *)
+		ShmemInitStruct("ZHeap Speculative Tokens", ZHeapSpecTokenShmemSize(),
+						&found);
+
+	if (!IsUnderPostmaster)
+	{
+		Assert(!found);
+
+		for (i = 0; i < NUM_ZSPECTOKEN_PARTITIONS; i++)
+			LWLockInitialize(&ZHeapSpecTokens->locks[i].lock,
+							 LWTRANCHE_ZHEAP_SPEC_TOKENS);
+		for (i = 0; i < zheap_spec_token_table_size; i++)
+			ZHeapSpecTokens->entries[i].token = 0;
+	}
+	else
+		Assert(found);
+}
+
+/*
+ * Remember the speculative insertion token of the tuple at offnum of buf,
+ * inserted by xid.  The caller must hold an exclusive lock on the buffer.
+ */
+void
+ZHeapSpecTokenRemember(Buffer buf, OffsetNumber offnum, TransactionId xid,
+					   uint32 token)
+{
+	ZHeapSpecTokenEntry *entry;
+	RelFileNode rnode;
+	ForkNumber	forknum;
+	BlockNumber blkno;
+	int			slot;
+
+	Assert(token != 0);
+
+	if (zheap_spec_token_table_size == 0)
+		return;
+
+	BufferGetTag(buf, &rnode, &forknum, &blkno);
+	slot = ZHeapSpecTokenSlot(&rnode, blkno, offnum);
+	entry = &ZHeapSpecTokens->entries[slot];
+
+	LWLockAcquire(ZHeapSpecTokenPartitionLock(slot), LW_EXCLUSIVE);
+	entry->rnode = rnode;
+	entry->blkno = blkno;
+	entry->offnum = offnum;
+	entry->xid = xid;
+	entry->token = token;
+	LWLockRelease(ZHeapSpecTokenPartitionLock(slot));
+}
+
+/*
+ * Drop the entry of the tuple at offnum of buf, once its speculative
+ * insertion by xid has been confirmed or killed.  The caller must hold an
+ * exclusive lock on the buffer.
+ */
+void
+ZHeapSpecTokenForget(Buffer buf, OffsetNumber offnum, TransactionId xid)
+{
+	ZHeapSpecTokenEntry *entry;
+	RelFileNode rnode;
+	ForkNumber	forknum;
+	BlockNumber blkno;
+	int			slot;
+
+	if (zheap_spec_token_table_size == 0)
+		return;
+
+	BufferGetTag(buf, &rnode, &forknum, &blkno);
+	slot = ZHeapSpecTokenSlot(&rnode, blkno, offnum);
+	entry = &ZHeapSpecTokens->entries[slot];
+
+	LWLockAcquire(ZHeapSpecTokenPartitionLock(slot), LW_EXCLUSIVE);
+	if (ZHeapSpecTokenEntryMatches(entry, rnode, blkno, offnum, xid))
+		entry->token = 0;
+	LWLockRelease(ZHeapSpecTokenPartitionLock(slot));
+}
+
+/*
+ * Look up the speculative insertion token of the tuple at offnum of buf,
+ * inserted by xid.  Returns zero if the table doesn't have it.  The caller
+ * must hold at least a share lock on the buffer.
+ */
+uint32
+ZHeapSpecTokenLookup(Buffer buf, OffsetNumber offnum, TransactionId xid)
+{
+	ZHeapSpecTokenEntry *entry;
+	RelFileNode rnode;
+	ForkNumber	forknum;
+	BlockNumber blkno;
+	uint32		token = 0;
+	int			slot;
+
+	if (zheap_spec_token_table_size == 0)
+		return 0;
+
+	BufferGetTag(buf, &rnode, &forknum, &blkno);
+	slot = ZHeapSpecTokenSlot(&rnode, blkno, offnum);
+	entry = &ZHeapSpecTokens->entries[slot];
+
+	LWLockAcquire(ZHeapSpecTokenPartitionLock(slot), LW_SHARED);
+	if (ZHeapSpecTokenEntryMatches(entry, rnode, blkno, offnum, xid))
+		token = entry->token;
+	LWLockRelease(ZHeapSpecTokenPartitionLock(slot));
+
+	return token;
+}
@@ -603,43 +603,43 @@ zheap_attisnull(ZHeapTuple tup, int attnum, TupleDesc tupleDesc)
 }
 
 /*
- * zheap_tuple_attr_equals
- *		Subroutine for ZHeapDetermineModifiedColumns which returns the set of
- *		attributes from the given att_list that are different in tup1 and tup2.
+ * zheap_att_align
+ *		Return the offset at which the given attribute's value starts, if the
+ *		previous one ended at off; the same as zheap_deform_tuple computes.
  */
-Bitmapset *
-zheap_tuple_attr_equals(TupleDesc tupdesc, Bitmapset *att_list,
-						ZHeapTuple tup1, ZHeapTuple tup2)
+static inline long
+zheap_att_align(Form_pg_attribute att, char *tp, long off)
 {
-	int			l_attno = 0,
-				col = -1;
+	if (att->attlen == -1)
+		return att_align_pointer(off, att->attalign, -1, tp + off);
+	else if (!att->attbyval)
+		return att_align_nominal(off, att->attalign);
+	return off;
+}
+
+/*
+ * zheap_tuple_attr_equals_deformed
+ *		Workhorse for zheap_tuple_attr_equals when either tuple lacks some of
+ *		the attributes to compare, which must then be filled in from the
+ *		tuple descriptor.
+ */
+static Bitmapset *
+zheap_tuple_attr_equals_deformed(TupleDesc tupdesc, Bitmapset *att_list,
+								 ZHeapTuple tup1, ZHeapTuple tup2,
+								 int l_attno)
+{
+	int			col = -1;
 	bool		old_isnull[MaxHeapAttributeNumber],
 				new_isnull[MaxHeapAttributeNumber];
 	Datum		old_values[MaxHeapAttributeNumber],
 				new_values[MaxHeapAttributeNumber];
 	Bitmapset  *modified = NULL;
 
-	/* Find the largest attno in the given Bitmapset. */
-	while ((col = bms_next_member(att_list, col)) >= 0)
-	{
-		/* bit numbers are offset by FirstLowInvalidHeapAttributeNumber */
-		AttrNumber	attno = col + FirstLowInvalidHeapAttributeNumber;
-
-		if (attno <= InvalidAttrNumber) /* shouldn't happen */
-			elog(ERROR, "system-column update is not supported");
-
-		if (l_attno < attno)
-			l_attno = attno;
-	}
-
-	Assert(l_attno <= tupdesc->natts);
-
 	/* Deform both the old and new tuple. */
 	zheap_deform_tuple(tup1, tupdesc, old_values, old_isnull, l_attno);
 	zheap_deform_tuple(tup2, tupdesc, new_values, new_isnull, l_attno);
 
 	/* Loop through atts and add every non-equal attno to modified. */
-	col = -1;
 	while ((col = bms_next_member(att_list, col)) >= 0)
 	{
 		/* bit numbers are offset by FirstLowInvalidHeapAttributeNumber */
@@ -657,16 +657,7 @@ zheap_tuple_attr_equals(TupleDesc tupdesc, Bitmapset *att_list,
 		{
 			Form_pg_attribute att = TupleDescAttr(tupdesc, attno - 1);
 
-			/*
-			 * We do simple binary comparison of the two datums.  This may be
-			 * overly strict because there can be multiple binary
-			 * representations for the same logical value.  But we should be
-			 * OK as long as there are no false positives.  Using a
-			 * type-specific equality operator is messy because there could be
-			 * multiple notions of equality in different operator classes;
-			 * furthermore, we cannot safely invoke user-defined functions
-			 * while holding exclusive buffer lock.
-			 */
+			/* See zheap_tuple_attr_equals. */
 			if (!datumIsEqual(old_values[attno - 1], new_values[attno - 1],
 							  att->attbyval, att->attlen))
 				modified = bms_add_member(modified,
@@ -677,6 +668,98 @@ zheap_tuple_attr_equals(TupleDesc tupdesc, Bitmapset *att_list,
 	return modified;
 }
 
+/*
+ * zheap_tuple_attr_equals
+ *		Subroutine for ZHeapDetermineModifiedColumns which returns the set of
+ *		attributes from the given att_list that are different in tup1 and tup2.
+ *
+ * Rather than deforming both tuples, we walk them side by side and compare
+ * the stored bytes of the interesting attributes where they lie, so that the
+ * other attributes cost no more than stepping over them.
+ */
+Bitmapset *
+zheap_tuple_attr_equals(TupleDesc tupdesc, Bitmapset *att_list,
+						ZHeapTuple tup1, ZHeapTuple tup2)
+{
+	ZHeapTupleHeader hdr1 = tup1->t_data,
+				hdr2 = tup2->t_data;
+	bool		hasnulls1 = ZHeapTupleHasNulls(tup1),
+				hasnulls2 = ZHeapTupleHasNulls(tup2);
+	char	   *tp1 = (char *) hdr1,
+			   *tp2 = (char *) hdr2;
+	long		off1 = hdr1->t_hoff,
+				off2 = hdr2->t_hoff;
+	int			l_attno = 0,
+				col = -1;
+	int			attnum;
+	Bitmapset  *modified = NULL;
+
+	/* Find the largest attno in the given Bitmapset. */
+	while ((col = bms_next_member(att_list, col)) >= 0)
+	{
+		/* bit numbers are offset by FirstLowInvalidHeapAttributeNumber */
+		AttrNumber	attno = col + FirstLowInvalidHeapAttributeNumber;
+
+		if (attno <= InvalidAttrNumber) /* shouldn't happen */
+			elog(ERROR, "system-column update is not supported");
+
+		if (l_attno < attno)
+			l_attno = attno;
+	}
+
+	Assert(l_attno <= tupdesc->natts);
+
+	if (ZHeapTupleHeaderGetNatts(hdr1) < l_attno ||
+		ZHeapTupleHeaderGetNatts(hdr2) < l_attno)
+		return zheap_tuple_attr_equals_deformed(tupdesc, att_list, tup1, tup2,
+												l_attno);
+
+	for (attnum = 0; attnum < l_attno; attnum++)
+	{
+		Form_pg_attribute att = TupleDescAttr(tupdesc, attnum);
+		bool		isnull1 = hasnulls1 && att_isnull(attnum, hdr1->t_bits);
+		bool		isnull2 = hasnulls2 && att_isnull(attnum, hdr2->t_bits);
+		Size		len1 = 0,
+					len2 = 0;
+
+		if (!isnull1)
+		{
+			off1 = zheap_att_align(att, tp1, off1);
+			len1 = att_addlength_pointer(0, att->attlen, tp1 + off1);
+		}
+		if (!isnull2)
+		{
+			off2 = zheap_att_align(att, tp2, off2);
+			len2 = att_addlength_pointer(0, att->attlen, tp2 + off2);
+		}
+
+		/*
+		 * If one value is NULL and other is not, they are not equal, but if
+		 * both are NULL, they can be considered equal.  Otherwise, we do
+		 * simple binary comparison of the two datums, like datumIsEqual.
+		 * This may be overly strict because there can be multiple binary
+		 * representations for the same logical value.  But we should be OK
+		 * as long as there are no false positives.  Using a type-specific
+		 * equality operator is messy because there could be multiple notions
+		 * of equality in different operator classes; furthermore, we cannot
+		 * safely invoke user-defined functions while holding exclusive
+		 * buffer lock.
+		 */
+		if (bms_is_member(attnum + 1 - FirstLowInvalidHeapAttributeNumber,
+						  att_list) &&
+			(isnull1 != isnull2 ||
+			 (!isnull1 &&
+			  (len1 != len2 || memcmp(tp1 + off1, tp2 + off2, len1) != 0))))
+			modified = bms_add_member(modified,
+									  attnum + 1 - FirstLowInvalidHeapAttributeNumber);
+
+		off1 += len1;
+		off2 += len2;
+	}
+
+	return modified;
+}
+
 
 /*
  * TupleTableSlotOps implementation for ZheapHeapTupleTableSlot.
@@ -53,6 +53,8 @@
 #include "access/zheap.h"
 
 static void ztoast_delete_datum(Relation rel, Datum value, bool is_speculative);
+static bool ztoast_external_equals(Relation rel, struct varlena *oldexternal,
+								   struct varlena *new_value);
 static Datum ztoast_save_datum(Relation rel, Datum value,
 							   struct varlena *oldexternal, int options, uint32 specToken);
 
@@ -144,9 +146,22 @@ ztoast_insert_or_update(Relation rel, ZHeapTuple newtup, ZHeapTuple oldtup,
 			if (att->attlen == -1 && !toast_oldisnull[i] &&
 				VARATT_IS_EXTERNAL_ONDISK(old_value))
 			{
-				if (toast_isnull[i] || !VARATT_IS_EXTERNAL_ONDISK(new_value) ||
-					memcmp((char *) old_value, (char *) new_value,
-						   VARSIZE_EXTERNAL(old_value)) != 0)
+				if (!toast_isnull[i] &&
+					ztoast_external_equals(rel, old_value, new_value))
+				{
+					/*
+					 * The new value was passed in full, but it's the same as
+					 * the old one, so store the old reference instead of
+					 * writing the value out again.
+					 */
+					toast_values[i] = PointerGetDatum(old_value);
+					toast_action[i] = 'p';
+					need_change = true;
+					continue;
+				}
+				else if (toast_isnull[i] || !VARATT_IS_EXTERNAL_ONDISK(new_value) ||
+						 memcmp((char *) old_value, (char *) new_value,
+								VARSIZE_EXTERNAL(old_value)) != 0)
 				{
 					/*
 					 * The old external stored value isn't needed any more
@@ -294,7 +309,8 @@ ztoast_insert_or_update(Relation rel, ZHeapTuple newtup, ZHeapTuple oldtup,
 		if (TupleDescAttr(tupleDesc, i)->attstorage == 'x')
 		{
 			old_value = toast_values[i];
-			new_value = toast_compress_datum(old_value);
+			new_value = toast_compress_datum(old_value,
+											 TupleDescAttr(tupleDesc, i)->attcompression);
 
 			if (DatumGetPointer(new_value) != NULL)
 			{
@@ -437,7 +453,8 @@ ztoast_insert_or_update(Relation rel, ZHeapTuple newtup, ZHeapTuple oldtup,
 		 */
 		i = biggest_attno;
 		old_value = toast_values[i];
-		new_value = toast_compress_datum(old_value);
+		new_value = toast_compress_datum(old_value,
+										 TupleDescAttr(tupleDesc, i)->attcompression);
 
 		if (DatumGetPointer(new_value) != NULL)
 		{
@@ -589,6 +606,59 @@ ztoast_insert_or_update(Relation rel, ZHeapTuple newtup, ZHeapTuple oldtup,
 	return result_tuple;
 }
 
+/*
+ * ztoast_external_equals
+ *		Check whether an inline new value of an attribute holds the same data
+ *		as its old, externally stored value.
+ *
+ * An UPDATE that passes the unchanged value of a toasted attribute in full,
+ * rather than the toast pointer, would otherwise delete all the old chunks
+ * and insert new ones, writing undo for each of them.  Fetching the old value
+ * to compare costs about as much as the scan that deletes its chunks, so we
+ * only do it when the sizes are the same.
+ */
+static bool
+ztoast_external_equals(Relation rel, struct varlena *oldexternal,
+					   struct varlena *new_value)
+{
+	struct varatt_external toast_pointer;
+	struct varlena *old_raw;
+	struct varlena *new_raw;
+	Size		new_rawsize;
+	bool		result;
+
+	if (VARATT_IS_EXTERNAL(new_value))
+		return false;
+
+	/* Must copy to access aligned fields */
+	VARATT_EXTERNAL_GET_POINTER(toast_pointer, oldexternal);
+
+	/* During a rewrite, the value must go to the new toast table. */
+	if (OidIsValid(rel->rd_toastoid) ||
+		toast_pointer.va_toastrelid != rel->rd_rel->reltoastrelid)
+		return false;
+
+	if (VARATT_IS_COMPRESSED(new_value))
+		new_rawsize = VARRAWSIZE_4B_C(new_value);
+	else
+		new_rawsize = VARSIZE_ANY_EXHDR(new_value);
+	if (new_rawsize != toast_pointer.va_rawsize - VARHDRSZ)
+		return false;
+
+	old_raw = heap_tuple_untoast_attr(oldexternal);
+	new_raw = heap_tuple_untoast_attr(new_value);
+
+	result = (VARSIZE_ANY_EXHDR(old_raw) == VARSIZE_ANY_EXHDR(new_raw) &&
+			  memcmp(VARDATA_ANY(old_raw), VARDATA_ANY(new_raw),
+					 VARSIZE_ANY_EXHDR(new_raw)) == 0);
+
+	pfree(old_raw);
+	if (new_raw != new_value)
+		pfree(new_raw);
+
+	return result;
+}
+
 /*
  * ztoast_save_datum
  *		Just like toast_save_datum but for zheap relations.
@@ -642,19 +712,21 @@ ztoast_save_datum(Relation rel, Datum value,
 									&num_indexes);
 
 	/*
-	 * Get the data pointer and length, and compute va_rawsize and va_extsize.
+	 * Get the data pointer and length, and compute va_rawsize and
+	 * va_extinfo.
 	 *
 	 * va_rawsize is the size of the equivalent fully uncompressed datum, so
 	 * we have to adjust for short headers.
 	 *
-	 * va_extsize is the actual size of the data payload in the toast records.
+	 * va_extinfo holds the actual size of the data payload in the toast
+	 * records, and the compression method if the data is compressed.
 	 */
 	if (VARATT_IS_SHORT(dval))
 	{
 		data_p = VARDATA_SHORT(dval);
 		data_todo = VARSIZE_SHORT(dval) - VARHDRSZ_SHORT;
 		toast_pointer.va_rawsize = data_todo + VARHDRSZ;	/* as if not short */
-		toast_pointer.va_extsize = data_todo;
+		toast_pointer.va_extinfo = data_todo;
 	}
 	else if (VARATT_IS_COMPRESSED(dval))
 	{
@@ -662,7 +734,8 @@ ztoast_save_datum(Relation rel, Datum value,
 		data_todo = VARSIZE(dval) - VARHDRSZ;
 		/* rawsize in a compressed datum is just the size of the payload */
 		toast_pointer.va_rawsize = VARRAWSIZE_4B_C(dval) + VARHDRSZ;
-		toast_pointer.va_extsize = data_todo;
+		VARATT_EXTERNAL_SET_SIZE_AND_COMPRESS_METHOD(toast_pointer, data_todo,
+													 VARCOMPRESS_4B_C(dval));
 		/* Assert that the numbers look like it's compressed */
 		Assert(VARATT_EXTERNAL_IS_COMPRESSED(toast_pointer));
 	}
@@ -671,7 +744,7 @@ ztoast_save_datum(Relation rel, Datum value,
 		data_p = VARDATA(dval);
 		data_todo = VARSIZE(dval) - VARHDRSZ;
 		toast_pointer.va_rawsize = VARSIZE(dval);
-		toast_pointer.va_extsize = data_todo;
+		toast_pointer.va_extinfo = data_todo;
 	}
 
 	/*
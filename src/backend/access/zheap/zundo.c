@@ -32,6 +32,35 @@
 #include "utils/ztqual.h"
 #include "access/relation.h"
 
+/*
+ * A foreground backend applies the pending undo of a page in batches of at
+ * most this many bytes of undo records; see
+ * process_and_execute_undo_actions_page.
+ */
+#define ZHEAP_PAGE_UNDO_BATCH_SIZE	(4 * BLCKSZ)
+
+/*
+ * State of a page whose undo actions are being applied by zheap_undo_actions.
+ * The page stays locked from the time its transaction slot is found until it
+ * has been WAL-logged.
+ */
+typedef struct ZHeapUndoPage
+{
+	BlockNumber blkno;
+	int			first_idx;		/* first undo record for the page */
+	int			last_idx;		/* last undo record for the page */
+	Buffer		buffer;
+	Buffer		vmbuffer;
+	int			slot_no;
+	UndoRecPtr	slot_urec_ptr;
+	UndoRecPtr	prev_urec_ptr;
+	bool		tpd_page_locked;
+	bool		is_tpd_map_updated;
+	bool		need_init;
+	char	   *tpd_offset_map;
+	int			tpd_map_size;
+} ZHeapUndoPage;
+
 static ZHeapTupleHeader RestoreTupleFromUndoRecord(UnpackedUndoRecord *urec,
 												   Page page, ZHeapTupleHeader page_tup_hdr);
 static void RestoreXactFromUndoRecord(UnpackedUndoRecord *urec, Buffer buffer,
@@ -41,6 +70,7 @@ static void RestoreXactFromUndoRecord(UnpackedUndoRecord *urec, Buffer buffer,
 static int	TransSlotFromUndoRecord(UnpackedUndoRecord *urec,
 									ZHeapTupleHeader hdr, Page page);
 static void log_zheap_undo_actions(ZHeapUndoActionWALInfo *wal_info);
+static void log_zheap_undo_actions_multi(ZHeapUndoPage *upages, int npages);
 
 /*
  * Per-undorecord callback from UndoFetchRecord to check whether
@@ -92,6 +122,36 @@ ZHeapSatisfyUndoRecord(UnpackedUndoRecord *urec, BlockNumber blkno,
 	return false;
 }
 
+/*
+ * ZHeapLocalUndoRecord
+ *
+ * Find the undo record that UndoFetchRecord would return for the given
+ * tuple and xid with ZHeapSatisfyUndoRecord, starting at *urec_ptr, in the
+ * current transaction's map of its own undo records (see undolocal.c).
+ * Return NULL if the chain leads to a record that's not in the map, or that
+ * can't be matched without its payload; *urec_ptr is then advanced to that
+ * record, so that the caller can carry on with UndoFetchRecord from there.
+ */
+UndoLocalRecord *
+ZHeapLocalUndoRecord(UndoRecPtr *urec_ptr, BlockNumber blkno,
+					 OffsetNumber offset, TransactionId xid)
+{
+	for (;;)
+	{
+		UndoLocalRecord *lrec = UndoLocalCidMapLookup(*urec_ptr);
+
+		if (lrec == NULL || lrec->type == UNDO_MULTI_INSERT)
+			return NULL;
+
+		if (lrec->block == blkno &&
+			(!TransactionIdIsValid(xid) || TransactionIdEquals(xid, lrec->xid)) &&
+			lrec->type != UNDO_ITEMID_UNUSED && lrec->offset == offset)
+			return lrec;
+
+		*urec_ptr = lrec->blkprev;
+	}
+}
+
 /*
  * UpdateTupleHeaderFromUndoRecord
  *
@@ -128,12 +188,108 @@ UpdateTupleHeaderFromUndoRecord(UnpackedUndoRecord *urec, ZHeapTupleHeader hdr,
 		 * UNDO_XID_MULTI_LOCK_ONLY).
 		 */
 		Assert(urec->uur_tuple.len >= SizeofZHeapTupleHeader);
+
+		/* The header is readable even if the tuple is compressed. */
+		StaticAssertStmt(SizeofZHeapTupleHeader <= UNDO_TUPLE_RAW_PREFIX,
+						 "undo tuple header must not be compressed");
 		memcpy(hdr, urec->uur_tuple.data, SizeofZHeapTupleHeader);
 	}
 
 	return TransSlotFromUndoRecord(urec, hdr, page);
 }
 
+/*
+ * EncodeInplaceUpdateUndoTuple
+ *
+ * An in-place update usually changes only a small part of a tuple, so rather
+ * than the complete old tuple, its undo record can store just enough to turn
+ * the new version back into the old one: the old tuple header, the lengths of
+ * the prefix and suffix which both versions share (both as uint16) and the old
+ * bytes in between.  Prefix and suffix are computed over everything after the
+ * tuple header, including the null bitmap.
+ *
+ * Appends the encoded old tuple to buf and returns true, or returns false
+ * without touching buf if the encoding wouldn't save any space.  The result
+ * depends only on the two tuples, which is what lets WAL replay see the same
+ * undo record sizes as the original operation.
+ */
+bool
+EncodeInplaceUpdateUndoTuple(StringInfo buf, ZHeapTuple oldtup,
+							 ZHeapTuple newtup)
+{
+	char	   *oldp = (char *) oldtup->t_data + SizeofZHeapTupleHeader;
+	char	   *newp = (char *) newtup->t_data + SizeofZHeapTupleHeader;
+	int			oldlen = oldtup->t_len - SizeofZHeapTupleHeader;
+	int			newlen = newtup->t_len - SizeofZHeapTupleHeader;
+	uint16		prefixlen;
+	uint16		suffixlen;
+
+	for (prefixlen = 0; prefixlen < Min(oldlen, newlen); prefixlen++)
+	{
+		if (oldp[prefixlen] != newp[prefixlen])
+			break;
+	}
+	for (suffixlen = 0; suffixlen < Min(oldlen, newlen) - prefixlen; suffixlen++)
+	{
+		if (oldp[oldlen - suffixlen - 1] != newp[newlen - suffixlen - 1])
+			break;
+	}
+
+	/* Storing the lengths takes 4 bytes, so we must save more than that. */
+	if (prefixlen + suffixlen <= 2 * sizeof(uint16))
+		return false;
+
+	appendBinaryStringInfo(buf, (char *) oldtup->t_data,
+						   SizeofZHeapTupleHeader);
+	appendBinaryStringInfo(buf, (char *) &prefixlen, sizeof(uint16));
+	appendBinaryStringInfo(buf, (char *) &suffixlen, sizeof(uint16));
+	appendBinaryStringInfo(buf, oldp + prefixlen,
+						   oldlen - prefixlen - suffixlen);
+
+	return true;
+}
+
+/*
+ * DecodeInplaceUpdateUndoTuple
+ *
+ * Rebuild the old tuple stored in an in-place update undo record by
+ * EncodeInplaceUpdateUndoTuple into dest, which must not overlap with the new
+ * tuple version newtup of length newlen.  Returns the length of the old tuple,
+ * which is at most MaxZHeapTupleSize.
+ */
+uint32
+DecodeInplaceUpdateUndoTuple(UnpackedUndoRecord *urec, ZHeapTupleHeader newtup,
+							 uint32 newlen, char *dest)
+{
+	char	   *data;
+	char	   *newp = (char *) newtup + SizeofZHeapTupleHeader;
+	uint16		prefixlen;
+	uint16		suffixlen;
+	uint32		midlen;
+
+	Assert(urec->uur_info & UREC_INFO_TUPLE_IS_DELTA);
+	UndoRecordDecompressTuple(urec);
+	data = urec->uur_tuple.data;
+	Assert(urec->uur_tuple.len >= SizeofInplaceUpdateUndoTuple);
+
+	memcpy(&prefixlen, data + SizeofZHeapTupleHeader, sizeof(uint16));
+	memcpy(&suffixlen, data + SizeofZHeapTupleHeader + sizeof(uint16),
+		   sizeof(uint16));
+	midlen = urec->uur_tuple.len - SizeofInplaceUpdateUndoTuple;
+
+	Assert(SizeofZHeapTupleHeader + prefixlen + suffixlen <= newlen);
+
+	memcpy(dest, data, SizeofZHeapTupleHeader);
+	dest += SizeofZHeapTupleHeader;
+	memcpy(dest, newp, prefixlen);
+	dest += prefixlen;
+	memcpy(dest, data + SizeofInplaceUpdateUndoTuple, midlen);
+	dest += midlen;
+	memcpy(dest, (char *) newtup + newlen - suffixlen, suffixlen);
+
+	return SizeofZHeapTupleHeader + prefixlen + midlen + suffixlen;
+}
+
 /*
  * Extract transaction slot information from an undo record.
  *
@@ -198,9 +354,9 @@ TransSlotFromUndoRecord(UnpackedUndoRecord *urec, ZHeapTupleHeader hdr,
 	 * has TPD slots that means the last slot information must move to the
 	 * first slot of the TPD page so change the slot number as per that.
 	 */
-	if (page && trans_slot_id == ZHEAP_PAGE_TRANS_SLOTS &&
+	if (page && trans_slot_id == ZHeapPageGetNumTransSlots(page) &&
 		ZHeapPageHasTPDSlot((PageHeader) page))
-		trans_slot_id = ZHEAP_PAGE_TRANS_SLOTS + 1;
+		trans_slot_id = ZHeapPageGetNumTransSlots(page) + 1;
 
 	return trans_slot_id;
 }
@@ -384,7 +540,7 @@ zheap_exec_pending_rollback(Relation rel, Buffer buf, int trans_slot_id,
 		 * rollback could have been performed by some other backend or the
 		 * undo-worker.  In that case, the TPD entry can be pruned away.
 		 */
-		if (trans_slot_id > ZHEAP_PAGE_TRANS_SLOTS &&
+		if (trans_slot_id > ZHeapPageGetNumTransSlots(page) &&
 			!ZHeapPageHasTPDSlot(phdr))
 			return false;
 
@@ -434,10 +590,14 @@ zheap_exec_pending_rollback(Relation rel, Buffer buf, int trans_slot_id,
 		if (TransactionIdIsValid(xid) && TransactionIdDidAbort(xid))
 		{
 			/* Remember if we've rolled back a transaction from a TPD-slot. */
-			if (tpd_blkno != NULL && (slot_no >= ZHEAP_PAGE_TRANS_SLOTS - 1) &&
+			if (tpd_blkno != NULL && (slot_no >= ZHeapPageGetNumTransSlots(BufferGetPage(buf)) - 1) &&
 				BlockNumberIsValid(*tpd_blkno))
 				any_tpd_slot_rolled_back = true;
 
+			/* Have undo workers get to the rest of it soon. */
+			if (!TransactionIdIsCurrentTransactionId(xid))
+				RollbackHTMarkHot(fxid);
+
 			process_and_execute_undo_actions_page(urec_ptr, rel, buf, fxid);
 		}
 	}
@@ -481,9 +641,16 @@ process_and_execute_undo_actions_page(UndoRecPtr from_urecptr, Relation rel,
 	Page		page;
 	bool		actions_applied = false;
 	int			nrecords;
-	int			undo_apply_size = maintenance_work_mem * 1024L;
+	int			undo_apply_size;
 	int			i;
 
+	/*
+	 * The page is locked while each batch is applied, and other backends
+	 * may be waiting for it, so keep the batches small.
+	 */
+	undo_apply_size = Min(maintenance_work_mem * 1024L,
+						  ZHEAP_PAGE_UNDO_BATCH_SIZE);
+
 	/*
 	 * Fetch the multiple undo records which can fit into uur_segment; sort
 	 * them in order of block number then apply them together page-wise.
@@ -499,6 +666,12 @@ process_and_execute_undo_actions_page(UndoRecPtr from_urecptr, Relation rel,
 		if (nrecords == 0)
 			break;
 
+		/*
+		 * Have the undo page the next batch starts on read in while we apply
+		 * this one.
+		 */
+		UndoPrefetchRecord(urec_ptr);
+
 		/* Apply the last set of the actions. */
 		execute_undo_actions_page(urp_array, 0, nrecords - 1, rel->rd_id,
 								  fxid, BufferGetBlockNumber(buffer),
@@ -554,7 +727,7 @@ process_and_execute_undo_actions_page(UndoRecPtr from_urecptr, Relation rel,
 				XLogRegisterBuffer(0, buffer, REGBUF_STANDARD);
 
 				/* Register tpd buffer if the slot belongs to tpd page. */
-				if (slot_no > ZHEAP_PAGE_TRANS_SLOTS)
+				if (slot_no > ZHeapPageGetNumTransSlots(page))
 				{
 					xlrec.flags |= XLU_RESET_CONTAINS_TPD_SLOT;
 					RegisterTPDBuffer(page, 1);
@@ -611,96 +784,16 @@ undo_action_insert(Relation rel, Page page, OffsetNumber off,
 }
 
 /*
- * zheap_undo_actions - Execute the undo actions for a zheap page
- *
- *	urp_array - array of undo records (along with their location) for which undo
- *				action needs to be applied.
- *	first_idx - index in the urp_array of the first undo action to be applied
- *	last_idx  - index in the urp_array of the first undo action to be applied
- *	reloid	- OID of relation on which undo actions needs to be applied.
- *	blkno	- block number on which undo actions needs to be applied.
- *	blk_chain_complete - indicates whether the undo chain for block is
- *						 complete.
+ * zheap_undo_find_slot - Find the transaction slot of a locked page whose
+ * undo actions are to be applied.
  *
- *	returns true, if successfully applied the undo actions, otherwise, false.
+ * Returns false, after releasing the page, if there is nothing to undo on it.
  */
-bool
-zheap_undo_actions(UndoRecInfo *urp_array, int first_idx, int last_idx,
-				   Oid reloid, FullTransactionId full_xid, BlockNumber blkno,
-				   bool blk_chain_complete)
+static bool
+zheap_undo_find_slot(Relation rel, UndoRecInfo *urp_array,
+					 ZHeapUndoPage *upage, FullTransactionId full_xid)
 {
-	Relation	rel;
-	Buffer		buffer;
-	Buffer		vmbuffer = InvalidBuffer;
-	Page		page;
-	UndoRecPtr	slot_urec_ptr;
-	UndoRecPtr	prev_urec_ptr,
-				block_prev_urp;
 	UndoRecPtr	first_urp;
-	bool		need_init = false;
-	bool		tpd_page_locked = false;
-	bool		is_tpd_map_updated = false;
-	char	   *tpd_offset_map = NULL;
-	int			i;
-	int			slot_no = 0;
-	int			tpd_map_size = 0;
-	uint32		epoch = EpochFromFullTransactionId(full_xid);
-	TransactionId xid = XidFromFullTransactionId(full_xid);
-
-	/*
-	 * FIXME: If reloid is not valid then we have nothing to do. In future, we
-	 * might want to do it differently for transactions that perform both DDL
-	 * and DML operations.
-	 */
-	if (!OidIsValid(reloid))
-	{
-		elog(LOG, "ignoring undo for invalid reloid");
-		return false;
-	}
-
-	/*
-	 * We always try to lock the relation.  If the relation is already gone,
-	 * then we can skip processing the undo actions.
-	 */
-	rel = try_relation_open(reloid, RowExclusiveLock);
-	if (rel == NULL)
-	{
-		elog(LOG, "relation is already dropped.");
-		return false;
-	}
-
-	if (RelationGetNumberOfBlocks(rel) <= blkno)
-	{
-		/*
-		 * This is possible if the underlying relation is truncated just
-		 * before taking the relation lock above.
-		 */
-		relation_close(rel, RowExclusiveLock);
-		return false;
-	}
-
-	buffer = ReadBuffer(rel, blkno);
-
-	/*
-	 * If there is a undo action of type UNDO_ITEMID_UNUSED then might need to
-	 * clear visibility_map. Since we cannot call visibilitymap_pin or
-	 * visibilitymap_status within a critical section it shall be called here
-	 * and let it be before taking the buffer lock on page.
-	 */
-	for (i = first_idx; i <= last_idx; i++)
-	{
-		UndoRecInfo *urec_info = (UndoRecInfo *) urp_array + i;
-		UnpackedUndoRecord *uur = urec_info->uur;
-
-		if (uur->uur_type == UNDO_ITEMID_UNUSED)
-		{
-			visibilitymap_pin(rel, blkno, &vmbuffer);
-			break;
-		}
-	}
-
-	LockBuffer(buffer, BUFFER_LOCK_EXCLUSIVE);
-	page = BufferGetPage(buffer);
 
 	/*
 	 * Identify the slot number for this transaction.
@@ -713,9 +806,10 @@ zheap_undo_actions(UndoRecInfo *urp_array, int first_idx, int last_idx,
 	 * for rollback it became a TPD slot which means this information won't be
 	 * even recorded in undo.
 	 */
-	slot_no = PageGetTransactionSlotId(rel, buffer, full_xid,
-									   &slot_urec_ptr, true, true,
-									   &tpd_page_locked);
+	upage->tpd_page_locked = false;
+	upage->slot_no = PageGetTransactionSlotId(rel, upage->buffer, full_xid,
+											  &upage->slot_urec_ptr, true, true,
+											  &upage->tpd_page_locked);
 
 	/*
 	 * If undo action has been already applied for this page then skip the
@@ -725,20 +819,20 @@ zheap_undo_actions(UndoRecInfo *urp_array, int first_idx, int last_idx,
 	 * The logno of slot's undo record pointer must be same as the logno of
 	 * undo record to be applied.
 	 */
-	prev_urec_ptr = urp_array[last_idx].uur->uur_blkprev;
-	first_urp = urp_array[first_idx].urp;
-
-	if (slot_no == InvalidXactSlotId ||
-		(UndoRecPtrGetLogNo(slot_urec_ptr) != UndoRecPtrGetLogNo(first_urp)) ||
-		(UndoRecPtrGetLogNo(slot_urec_ptr) ==
-		 UndoRecPtrGetLogNo(prev_urec_ptr) && slot_urec_ptr <= prev_urec_ptr))
+	upage->prev_urec_ptr = urp_array[upage->last_idx].uur->uur_blkprev;
+	first_urp = urp_array[upage->first_idx].urp;
+
+	if (upage->slot_no == InvalidXactSlotId ||
+		(UndoRecPtrGetLogNo(upage->slot_urec_ptr) != UndoRecPtrGetLogNo(first_urp)) ||
+		(UndoRecPtrGetLogNo(upage->slot_urec_ptr) ==
+		 UndoRecPtrGetLogNo(upage->prev_urec_ptr) &&
+		 upage->slot_urec_ptr <= upage->prev_urec_ptr))
 	{
-		UnlockReleaseBuffer(buffer);
+		if (BufferIsValid(upage->vmbuffer))
+			ReleaseBuffer(upage->vmbuffer);
+		UnlockReleaseBuffer(upage->buffer);
 		UnlockReleaseTPDBuffers();
 
-		/* Close the relation. */
-		relation_close(rel, RowExclusiveLock);
-
 		return false;
 	}
 
@@ -755,19 +849,41 @@ zheap_undo_actions(UndoRecInfo *urp_array, int first_idx, int last_idx,
 	 * process the undo records partially outside critical section such that
 	 * we know whether we need TPD map or not, but that seems to be overkill.
 	 */
-	if (tpd_page_locked)
+	upage->tpd_offset_map = NULL;
+	upage->tpd_map_size = 0;
+	upage->is_tpd_map_updated = false;
+	upage->need_init = false;
+	if (upage->tpd_page_locked)
 	{
-		tpd_map_size = TPDPageGetOffsetMapSize(buffer);
-		if (tpd_map_size > 0)
-			tpd_offset_map = palloc(tpd_map_size);
+		upage->tpd_map_size = TPDPageGetOffsetMapSize(upage->buffer);
+		if (upage->tpd_map_size > 0)
+			upage->tpd_offset_map = palloc(upage->tpd_map_size);
 	}
 
-	START_CRIT_SECTION();
+	return true;
+}
+
+/*
+ * zheap_undo_apply_page - Apply the undo records of a locked page
+ *
+ * Must be called in a critical section; the caller takes care of WAL.
+ */
+static void
+zheap_undo_apply_page(Relation rel, UndoRecInfo *urp_array,
+					  ZHeapUndoPage *upage, FullTransactionId full_xid,
+					  FullTransactionId slot_fxid)
+{
+	Buffer		buffer = upage->buffer;
+	Page		page = BufferGetPage(buffer);
+	UndoRecPtr	block_prev_urp;
+	int			i;
+	uint32		epoch = EpochFromFullTransactionId(full_xid);
+	TransactionId xid = XidFromFullTransactionId(full_xid);
 
 	/* Set the already applied undo ptr. */
-	block_prev_urp = slot_urec_ptr;
+	block_prev_urp = upage->slot_urec_ptr;
 
-	for (i = first_idx; i <= last_idx; i++)
+	for (i = upage->first_idx; i <= upage->last_idx; i++)
 	{
 		UndoRecInfo *urec_info = (UndoRecInfo *) urp_array + i;
 		UnpackedUndoRecord *uur = urec_info->uur;
@@ -783,7 +899,7 @@ zheap_undo_actions(UndoRecInfo *urp_array, int first_idx, int last_idx,
 			 "TransSlot: %d, Epoch: %d, TransactionId: %d, urec: " UndoRecPtrFormat ", "
 			 "prev_urec: " UndoRecPtrFormat ", block: %d, offset: %d, undo_op: %d, "
 			 "xid_tup: %d, reloid: %d",
-			 slot_no, epoch, xid, slot_urec_ptr,
+			 upage->slot_no, epoch, xid, upage->slot_urec_ptr,
 			 uur->uur_blkprev, uur->uur_block,
 			 uur->uur_offset, uur->uur_type,
 			 uur->uur_prevxid, uur->uur_reloid);
@@ -819,13 +935,13 @@ zheap_undo_actions(UndoRecInfo *urp_array, int first_idx, int last_idx,
 					undo_action_insert(rel, page, uur->uur_offset, xid);
 
 					nline = PageGetMaxOffsetNumber(page);
-					need_init = true;
+					upage->need_init = true;
 					for (i = FirstOffsetNumber; i <= nline; i++)
 					{
 						lp = PageGetItemId(page, i);
 						if (ItemIdIsUsed(lp) || ItemIdHasPendingXact(lp))
 						{
-							need_init = false;
+							upage->need_init = false;
 							break;
 						}
 					}
@@ -851,13 +967,13 @@ zheap_undo_actions(UndoRecInfo *urp_array, int first_idx, int last_idx,
 					}
 
 					nline = PageGetMaxOffsetNumber(page);
-					need_init = true;
+					upage->need_init = true;
 					for (i = FirstOffsetNumber; i <= nline; i++)
 					{
 						lp = PageGetItemId(page, i);
 						if (ItemIdIsUsed(lp) || ItemIdHasPendingXact(lp))
 						{
-							need_init = false;
+							upage->need_init = false;
 							break;
 						}
 					}
@@ -872,8 +988,9 @@ zheap_undo_actions(UndoRecInfo *urp_array, int first_idx, int last_idx,
 					ZHeapTupleHeaderData old_tup;
 
 					zhtup = RestoreTupleFromUndoRecord(uur, page, &old_tup);
-					RestoreXactFromUndoRecord(uur, buffer, zhtup, tpd_offset_map,
-											  &is_tpd_map_updated);
+					RestoreXactFromUndoRecord(uur, buffer, zhtup,
+											  upage->tpd_offset_map,
+											  &upage->is_tpd_map_updated);
 
 					/*
 					 * We always need to retain the strongest locker
@@ -998,8 +1115,8 @@ zheap_undo_actions(UndoRecInfo *urp_array, int first_idx, int last_idx,
 					}
 
 					/* clear visibility map */
-					Assert(BufferIsValid(vmbuffer));
-					visibilitymap_clear(rel, blkno, vmbuffer,
+					Assert(BufferIsValid(upage->vmbuffer));
+					visibilitymap_clear(rel, upage->blkno, upage->vmbuffer,
 										VISIBILITYMAP_VALID_BITS);
 
 				}
@@ -1009,6 +1126,26 @@ zheap_undo_actions(UndoRecInfo *urp_array, int first_idx, int last_idx,
 		}
 	}
 
+	PageSetTransactionSlotInfo(buffer, upage->slot_no, slot_fxid,
+							   upage->prev_urec_ptr);
+
+	MarkBufferDirty(buffer);
+}
+
+/*
+ * zheap_undo_apply_pages - Apply the undo actions to a batch of locked pages
+ *
+ * All the pages are modified and WAL-logged in the same critical section,
+ * and then released.
+ */
+static void
+zheap_undo_apply_pages(Relation rel, UndoRecInfo *urp_array,
+					   ZHeapUndoPage *upages, int npages,
+					   FullTransactionId full_xid, bool blk_chain_complete)
+{
+	FullTransactionId slot_fxid = full_xid;
+	int			i;
+
 	/*
 	 * If the undo chain for the block is complete then set the xid in the
 	 * slot as InvalidTransactionId.  But, rewind the slot urec_ptr to the
@@ -1017,27 +1154,33 @@ zheap_undo_actions(UndoRecInfo *urp_array, int first_idx, int last_idx,
 	 * transaction's urec_ptr.
 	 */
 	if (blk_chain_complete)
-		full_xid = InvalidFullTransactionId;
+		slot_fxid = InvalidFullTransactionId;
 
-	PageSetTransactionSlotInfo(buffer, slot_no, full_xid, prev_urec_ptr);
+	START_CRIT_SECTION();
 
-	MarkBufferDirty(buffer);
+	for (i = 0; i < npages; i++)
+		zheap_undo_apply_page(rel, urp_array, &upages[i], full_xid, slot_fxid);
 
 	if (RelationNeedsWAL(rel))
 	{
-		ZHeapUndoActionWALInfo wal_info;
-
-		wal_info.buffer = buffer;
-		wal_info.vmbuffer = vmbuffer;
-		wal_info.prev_urecptr = prev_urec_ptr;
-		wal_info.slot_id = slot_no;
-		wal_info.tpd_page_locked = tpd_page_locked;
-		wal_info.tpd_offset_map = tpd_offset_map;
-		wal_info.is_tpd_map_updated = is_tpd_map_updated;
-		wal_info.tpd_map_size = tpd_map_size;
-		wal_info.fxid = full_xid;
-		wal_info.need_init = need_init;
-		log_zheap_undo_actions(&wal_info);
+		if (npages == 1)
+		{
+			ZHeapUndoActionWALInfo wal_info;
+
+			wal_info.buffer = upages[0].buffer;
+			wal_info.vmbuffer = upages[0].vmbuffer;
+			wal_info.prev_urecptr = upages[0].prev_urec_ptr;
+			wal_info.slot_id = upages[0].slot_no;
+			wal_info.tpd_page_locked = upages[0].tpd_page_locked;
+			wal_info.tpd_offset_map = upages[0].tpd_offset_map;
+			wal_info.is_tpd_map_updated = upages[0].is_tpd_map_updated;
+			wal_info.tpd_map_size = upages[0].tpd_map_size;
+			wal_info.fxid = slot_fxid;
+			wal_info.need_init = upages[0].need_init;
+			log_zheap_undo_actions(&wal_info);
+		}
+		else
+			log_zheap_undo_actions_multi(upages, npages);
 	}
 
 	/*
@@ -1051,28 +1194,180 @@ zheap_undo_actions(UndoRecInfo *urp_array, int first_idx, int last_idx,
 	 * Note that we initialize the page after writing WAL because the TPD
 	 * routines use last slot in page to determine TPD block number.
 	 */
-	if (need_init)
-		ZheapInitPage(page, (Size) BLCKSZ);
+	for (i = 0; i < npages; i++)
+	{
+		if (upages[i].need_init)
+		{
+			Page		page = BufferGetPage(upages[i].buffer);
+
+			ZheapInitPage(page, (Size) BLCKSZ, ZHeapPageGetNumTransSlots(page));
+		}
+	}
 
 	END_CRIT_SECTION();
 
-	/* Free TPD offset map memory. */
-	if (tpd_offset_map)
-		pfree(tpd_offset_map);
+	for (i = 0; i < npages; i++)
+	{
+		/* Free TPD offset map memory. */
+		if (upages[i].tpd_offset_map)
+			pfree(upages[i].tpd_offset_map);
+
+		/*
+		 * Release any remaining pin on visibility map page.
+		 */
+		if (BufferIsValid(upages[i].vmbuffer))
+			ReleaseBuffer(upages[i].vmbuffer);
+
+		UnlockReleaseBuffer(upages[i].buffer);
+	}
+	UnlockReleaseTPDBuffers();
+}
+
+/*
+ * zheap_undo_actions - Execute the undo actions for zheap pages
+ *
+ *	urp_array - array of undo records (along with their location) for which undo
+ *				action needs to be applied.
+ *	first_idx - index in the urp_array of the first undo action to be applied
+ *	last_idx  - index in the urp_array of the last undo action to be applied
+ *	reloid	- OID of relation on which undo actions needs to be applied.
+ *	blkno	- first block number on which undo actions needs to be applied.
+ *	blk_chain_complete - indicates whether the undo chain for block is
+ *						 complete.
+ *
+ *	The undo records can be for several blocks of the relation, sorted by
+ *	block number.  The pages are locked in that order and applied in batches
+ *	covered by a single WAL record, so that a rollback doesn't pay for a
+ *	separate record for every page it touches.  A page with a TPD slot is
+ *	applied and logged on its own, as the TPD buffers are registered along
+ *	with it.
+ *
+ *	returns true, if successfully applied the undo actions, otherwise, false.
+ */
+bool
+zheap_undo_actions(UndoRecInfo *urp_array, int first_idx, int last_idx,
+				   Oid reloid, FullTransactionId full_xid, BlockNumber blkno,
+				   bool blk_chain_complete)
+{
+	Relation	rel;
+	ZHeapUndoPage upages[UNDO_APPLY_MAX_PAGES];
+	BlockNumber nblocks;
+	bool		applied = false;
+	int			npages = 0;
+	int			start,
+				end;
+
+	Assert(urp_array[first_idx].uur->uur_block == blkno);
 
 	/*
-	 * Release any remaining pin on visibility map page.
+	 * FIXME: If reloid is not valid then we have nothing to do. In future, we
+	 * might want to do it differently for transactions that perform both DDL
+	 * and DML operations.
 	 */
-	if (BufferIsValid(vmbuffer))
-		ReleaseBuffer(vmbuffer);
+	if (!OidIsValid(reloid))
+	{
+		elog(LOG, "ignoring undo for invalid reloid");
+		return false;
+	}
 
-	UnlockReleaseBuffer(buffer);
-	UnlockReleaseTPDBuffers();
+	/*
+	 * We always try to lock the relation.  If the relation is already gone,
+	 * then we can skip processing the undo actions.
+	 */
+	rel = try_relation_open(reloid, RowExclusiveLock);
+	if (rel == NULL)
+	{
+		elog(LOG, "relation is already dropped.");
+		return false;
+	}
+
+	/* A batch of pages is registered with a single WAL record. */
+	if (RelationNeedsWAL(rel))
+		XLogEnsureRecordSpace(UNDO_APPLY_MAX_PAGES - 1, 0);
+
+	/*
+	 * Blocks beyond the end of the relation are possible if the underlying
+	 * relation is truncated just before taking the relation lock above.
+	 */
+	nblocks = RelationGetNumberOfBlocks(rel);
+
+	for (start = first_idx; start <= last_idx; start = end + 1)
+	{
+		ZHeapUndoPage *upage = &upages[npages];
+		BlockNumber blk = urp_array[start].uur->uur_block;
+		bool		has_tpd_slot;
+		int			i;
+
+		for (end = start; end < last_idx; end++)
+		{
+			if (urp_array[end + 1].uur->uur_block != blk)
+				break;
+		}
+
+		if (blk >= nblocks)
+			continue;
+
+		upage->blkno = blk;
+		upage->first_idx = start;
+		upage->last_idx = end;
+		upage->buffer = ReadBuffer(rel, blk);
+		upage->vmbuffer = InvalidBuffer;
+
+		/*
+		 * If there is a undo action of type UNDO_ITEMID_UNUSED then might
+		 * need to clear visibility_map. Since we cannot call
+		 * visibilitymap_pin or visibilitymap_status within a critical section
+		 * it shall be called here and let it be before taking the buffer
+		 * lock on page.
+		 */
+		for (i = start; i <= end; i++)
+		{
+			if (urp_array[i].uur->uur_type == UNDO_ITEMID_UNUSED)
+			{
+				visibilitymap_pin(rel, blk, &upage->vmbuffer);
+				break;
+			}
+		}
+
+		LockBuffer(upage->buffer, BUFFER_LOCK_EXCLUSIVE);
+		has_tpd_slot = ZHeapPageHasTPDSlot((PageHeader) BufferGetPage(upage->buffer));
+
+		/*
+		 * Finish the pages collected so far before the TPD page of this one
+		 * gets locked, so that a TPD page is never locked while holding the
+		 * lock on any zheap page but its own.
+		 */
+		if (has_tpd_slot && npages > 0)
+		{
+			zheap_undo_apply_pages(rel, urp_array, upages, npages, full_xid,
+								   blk_chain_complete);
+			upages[0] = *upage;
+			upage = &upages[0];
+			npages = 0;
+		}
+
+		if (!zheap_undo_find_slot(rel, urp_array, upage, full_xid))
+			continue;
+
+		applied = true;
+		npages++;
+
+		if (has_tpd_slot || npages == UNDO_APPLY_MAX_PAGES)
+		{
+			zheap_undo_apply_pages(rel, urp_array, upages, npages, full_xid,
+								   blk_chain_complete);
+			npages = 0;
+		}
+	}
+
+	if (npages > 0)
+		zheap_undo_apply_pages(rel, urp_array, upages, npages, full_xid,
+							   blk_chain_complete);
 
 	/* Close the relation. */
 	relation_close(rel, RowExclusiveLock);
 
-	return true;
+	return applied;
 }
 
  /*
@@ -1091,7 +1386,7 @@ log_zheap_undo_actions(ZHeapUndoActionWALInfo *wal_info)
 	uint8		flags = 0;
 	Page		page = BufferGetPage(wal_info->buffer);
 
-	if (wal_info->slot_id > ZHEAP_PAGE_TRANS_SLOTS)
+	if (wal_info->slot_id > ZHeapPageGetNumTransSlots(page))
 		flags |= XLU_PAGE_CONTAINS_TPD_SLOT;
 	if (BufferIsValid(wal_info->vmbuffer))
 		flags |= XLU_PAGE_CLEAR_VISIBILITY_MAP;
@@ -1150,6 +1445,46 @@ log_zheap_undo_actions(ZHeapUndoActionWALInfo *wal_info)
 		TPDPageSetLSN(page, recptr);
 }
 
+/*
+ * log_zheap_undo_actions_multi - Perform XLogInsert for a batch of pages.
+ *
+ * As in log_zheap_undo_actions, the complete pages are logged, but a single
+ * record covers all of them.  None of the pages has a TPD slot, so the only
+ * other thing to record is the flags of each page.
+ */
+static void
+log_zheap_undo_actions_multi(ZHeapUndoPage *upages, int npages)
+{
+	XLogRecPtr	recptr;
+	uint8		flags[UNDO_APPLY_MAX_PAGES];
+	int			i;
+
+	Assert(npages > 1 && npages <= UNDO_APPLY_MAX_PAGES);
+
+	XLogBeginInsert();
+
+	for (i = 0; i < npages; i++)
+	{
+		Assert(!upages[i].tpd_page_locked);
+
+		flags[i] = 0;
+		if (BufferIsValid(upages[i].vmbuffer))
+			flags[i] |= XLU_PAGE_CLEAR_VISIBILITY_MAP;
+		if (upages[i].need_init)
+			flags[i] |= XLU_INIT_PAGE;
+
+		XLogRegisterBuffer(i, upages[i].buffer,
+						   REGBUF_FORCE_IMAGE | REGBUF_STANDARD);
+	}
+
+	XLogRegisterData((char *) flags, npages * sizeof(uint8));
+
+	recptr = XLogInsert(RM_ZUNDO_ID, XLOG_ZUNDO_MULTI_PAGE);
+
+	for (i = 0; i < npages; i++)
+		PageSetLSN(BufferGetPage(upages[i].buffer), recptr);
+}
+
 /*
  * RestoreTupleFromUndoRecord - restore tuple from undorecord in page
  *
@@ -1210,11 +1545,33 @@ RestoreTupleFromUndoRecord(UnpackedUndoRecord *urec, Page page,
 				zhtup->t_hoff = undo_tup_hdr->t_hoff;
 			}
 			break;
+		case UNDO_INPLACE_UPDATE:
+			if (urec->uur_info & UREC_INFO_TUPLE_IS_DELTA)
+			{
+				union
+				{
+					ZHeapTupleHeaderData hdr;
+					char		data[MaxZHeapTupleSize];
+				}			tbuf;
+				uint32		undo_tup_len;
+
+				/* the page still holds the version that replaced it */
+				undo_tup_len = DecodeInplaceUpdateUndoTuple(urec, zhtup,
+															ItemIdGetLength(lp),
+															tbuf.data);
+
+				ItemIdChangeLen(lp, undo_tup_len);
+				memcpy(zhtup, tbuf.data, undo_tup_len);
+				break;
+			}
+			/* FALLTHROUGH */
 		case UNDO_DELETE:
 		case UNDO_UPDATE:
-		case UNDO_INPLACE_UPDATE:
 			{
-				uint32		undo_tup_len = urec->uur_tuple.len;
+				uint32		undo_tup_len;
+
+				UndoRecordDecompressTuple(urec);
+				undo_tup_len = urec->uur_tuple.len;
 
 				/* change the item id length */
 				ItemIdChangeLen(lp, undo_tup_len);
@@ -1304,7 +1661,7 @@ RestoreXactFromUndoRecord(UnpackedUndoRecord *urec, Buffer buffer,
 			tup_trans_slot = ZHTUP_SLOT_FROZEN;
 		}
 	}
-	else if (tup_trans_slot == ZHEAP_PAGE_TRANS_SLOTS &&
+	else if (tup_trans_slot == ZHeapPageGetNumTransSlots(page) &&
 			 ZHeapPageHasTPDSlot((PageHeader) page))
 	{
 		if (tpd_offset_map)
@@ -1354,8 +1711,8 @@ RestoreXactFromUndoRecord(UnpackedUndoRecord *urec, Buffer buffer,
 				   zinfo.trans_slot == ZHTUP_SLOT_FROZEN);
 
 			/* But, it can't be a TPD slot. */
-			Assert((zinfo.trans_slot < ZHEAP_PAGE_TRANS_SLOTS) ||
-				   (zinfo.trans_slot == ZHEAP_PAGE_TRANS_SLOTS &&
+			Assert((zinfo.trans_slot < ZHeapPageGetNumTransSlots(page)) ||
+				   (zinfo.trans_slot == ZHeapPageGetNumTransSlots(page) &&
 					!ZHeapPageHasTPDSlot((PageHeader) page)));
 
 			tup_trans_slot = zinfo.trans_slot;
@@ -1370,7 +1727,7 @@ RestoreXactFromUndoRecord(UnpackedUndoRecord *urec, Buffer buffer,
 	{
 		/* It should be a TPD slot. */
 		Assert(tup_trans_slot == ZHTUP_SLOT_FROZEN ||
-			   tup_trans_slot > ZHEAP_PAGE_TRANS_SLOTS);
+			   tup_trans_slot > ZHeapPageGetNumTransSlots(page));
 
 		TPDPageSetOffsetMapSlot(buffer,
 								tup_trans_slot,
@@ -1382,7 +1739,7 @@ RestoreXactFromUndoRecord(UnpackedUndoRecord *urec, Buffer buffer,
 	}
 
 	if (tup_trans_slot == ZHTUP_SLOT_FROZEN)
-		ZHeapTupleHeaderSetXactSlot(zhtup, ZHTUP_SLOT_FROZEN);
+		ZHeapTupleHeaderSetXactSlotFrozen(zhtup);
 	else if (urec->uur_prevxid != zinfo.xid)
 	{
 		/*
@@ -36,6 +36,7 @@
 #include "access/genam.h"
 #include "access/multixact.h"
 #include "access/tpd.h"
+#include "access/undospool.h"
 #include "access/vacuumblk.h"
 #include "access/visibilitymap.h"
 #include "access/xact.h"
@@ -67,19 +68,13 @@
 static int	elevel = -1;
 static TransactionId OldestXmin;
 static BufferAccessStrategy vac_strategy;
-
-/*
- * Guesstimate the number of dead tuples per page.  This is used to
- * provide an upper limit to memory allocated when vacuuming small
- * tables.
- */
-#define LAZY_ALLOC_TUPLES		MaxZHeapTuplesPerPage
+static int	nworkers;			/* parallel workers for index vacuuming */
 
 /* non-export function prototypes */
-static int	lazy_vacuum_zpage(Relation onerel, BlockNumber blkno, Buffer buffer,
-							  int tupindex, LVRelStats *vacrelstats, Buffer *vmbuffer);
-static int	lazy_vacuum_zpage_with_undo(Relation onerel, BlockNumber blkno, Buffer buffer,
-										int tupindex, LVRelStats *vacrelstats,
+static void lazy_vacuum_zpage(Relation onerel, BlockNumber blkno, Buffer buffer,
+							  LVRelStats *vacrelstats, Buffer *vmbuffer);
+static void lazy_vacuum_zpage_with_undo(Relation onerel, BlockNumber blkno, Buffer buffer,
+										LVRelStats *vacrelstats,
 										Buffer *vmbuffer,
 										TransactionId *global_visibility_cutoff_xid);
 static void
@@ -88,7 +83,13 @@ static void lazy_scan_zheap(Relation onerel, VacuumParams *params, LVRelStats *v
 							Relation *Irel, int nindexes,
 							BufferAccessStrategy vac_strategy, bool aggressive);
 static bool zheap_page_is_all_visible(Relation rel, Buffer buf,
-									  TransactionId *visibility_cutoff_xid);
+									  TransactionId *visibility_cutoff_xid,
+									  bool *all_frozen);
+static bool zheap_page_is_all_frozen(Page page);
+static void zheap_vm_set_all_visible(Relation rel, BlockNumber blkno,
+									 Buffer buf, Buffer *vmbuffer,
+									 TransactionId cutoff_xid,
+									 bool all_frozen);
 
 /*
  *	lazy_vacuum_zpage() -- free dead tuples on a page
@@ -96,19 +97,19 @@ static bool zheap_page_is_all_visible(Relation rel, Buffer buf,
  *
  * Caller must hold pin and buffer exclusive lock on the buffer.
  *
- * tupindex is the index in vacrelstats->dead_tuples of the first dead
- * tuple for this page.  We assume the rest follow sequentially.
- * The return value is the first tupindex after the tuples of this page.
+ * The dead tuples of the page are taken from vacrelstats->dead_tids.
  */
-static int
+static void
 lazy_vacuum_zpage(Relation onerel, BlockNumber blkno, Buffer buffer,
-				  int tupindex, LVRelStats *vacrelstats, Buffer *vmbuffer)
+				  LVRelStats *vacrelstats, Buffer *vmbuffer)
 {
 	Page		page = BufferGetPage(buffer);
 	Page		tmppage;
 	OffsetNumber unused[MaxOffsetNumber];
-	int			uncnt = 0;
+	int			uncnt;
+	int			i;
 	TransactionId visibility_cutoff_xid;
+	bool		all_frozen;
 	bool		pruned = false;
 
 	/*
@@ -128,21 +129,15 @@ lazy_vacuum_zpage(Relation onerel, BlockNumber blkno, Buffer buffer,
 	/* Report the number of blocks vacuumed. */
 	pgstat_progress_update_param(PROGRESS_VACUUM_HEAP_BLKS_VACUUMED, blkno - 1);
 
+	uncnt = lazy_dead_tids_get_offsets(vacrelstats->dead_tids, blkno, unused);
+
 	START_CRIT_SECTION();
 
-	for (; tupindex < vacrelstats->num_dead_tuples; tupindex++)
+	for (i = 0; i < uncnt; i++)
 	{
-		BlockNumber tblk;
-		OffsetNumber toff;
-		ItemId		itemid;
+		ItemId		itemid = PageGetItemId(page, unused[i]);
 
-		tblk = ItemPointerGetBlockNumber(&vacrelstats->dead_tuples[tupindex]);
-		if (tblk != blkno)
-			break;				/* past end of tuples for this block */
-		toff = ItemPointerGetOffsetNumber(&vacrelstats->dead_tuples[tupindex]);
-		itemid = PageGetItemId(page, toff);
 		ItemIdSetUnused(itemid);
-		unused[uncnt++] = toff;
 	}
 
 	ZPageRepairFragmentation(buffer, tmppage, InvalidOffsetNumber, 0, false,
@@ -176,22 +171,13 @@ lazy_vacuum_zpage(Relation onerel, BlockNumber blkno, Buffer buffer,
 	 * check if the page has become all-visible.  The page is already marked
 	 * dirty, exclusively locked.
 	 */
-	if (zheap_page_is_all_visible(onerel, buffer, &visibility_cutoff_xid))
+	if (zheap_page_is_all_visible(onerel, buffer, &visibility_cutoff_xid,
+								  &all_frozen))
 	{
-		uint8		vm_status = visibilitymap_get_status(onerel, blkno, vmbuffer);
-		uint8		flags = 0;
-
-		/* Set the VM all-visible bit to flag, if needed */
-		if ((vm_status & VISIBILITYMAP_ALL_VISIBLE) == 0)
-			flags |= VISIBILITYMAP_ALL_VISIBLE;
-
 		Assert(BufferIsValid(*vmbuffer));
-		if (flags != 0)
-			visibilitymap_set(onerel, blkno, buffer, InvalidXLogRecPtr,
-							  *vmbuffer, visibility_cutoff_xid, flags);
+		zheap_vm_set_all_visible(onerel, blkno, buffer, vmbuffer,
+								 visibility_cutoff_xid, all_frozen);
 	}
-
-	return tupindex;
 }
 
 /*
@@ -200,13 +186,14 @@ lazy_vacuum_zpage(Relation onerel, BlockNumber blkno, Buffer buffer,
  *
  * Caller must hold pin and buffer exclusive lock on the buffer.
  */
-static int
+static void
 lazy_vacuum_zpage_with_undo(Relation onerel, BlockNumber blkno, Buffer buffer,
-							int tupindex, LVRelStats *vacrelstats,
+							LVRelStats *vacrelstats,
 							Buffer *vmbuffer,
 							TransactionId *global_visibility_cutoff_xid)
 {
 	TransactionId visibility_cutoff_xid;
+	bool		all_frozen;
 	FullTransactionId fxid = GetTopFullTransactionId();
 	TransactionId xid = XidFromFullTransactionId(fxid);
 	Page		page = BufferGetPage(buffer);
@@ -216,33 +203,23 @@ lazy_vacuum_zpage_with_undo(Relation onerel, BlockNumber blkno, Buffer buffer,
 	UndoRecPtr	urecptr,
 				prev_urecptr;
 	int			i,
-				uncnt = 0;
+				uncnt;
 	int			trans_slot_id;
 	xl_undolog_meta undometa;
 	XLogRecPtr	RedoRecPtr;
 	bool		doPageWrites;
 	bool		lock_reacquired;
 	bool		pruned = false;
+	Size		undo_bytes;
 
-	for (; tupindex < vacrelstats->num_dead_tuples; tupindex++)
-	{
-		BlockNumber tblk PG_USED_FOR_ASSERTS_ONLY;
-		OffsetNumber toff;
-
-		tblk = ItemPointerGetBlockNumber(&vacrelstats->dead_tuples[tupindex]);
-
-		/*
-		 * We should never pass the end of tuples for this block as we clean
-		 * the tuples in the current block before moving to next block.
-		 */
-		Assert(tblk == blkno);
-
-		toff = ItemPointerGetOffsetNumber(&vacrelstats->dead_tuples[tupindex]);
-		unused[uncnt++] = toff;
-	}
+	/*
+	 * The current block is the last one in the store, as we clean the tuples
+	 * in the current block before moving to next block.
+	 */
+	uncnt = lazy_dead_tids_get_offsets(vacrelstats->dead_tids, blkno, unused);
 
 	if (uncnt <= 0)
-		return tupindex;
+		return;
 
 reacquire_slot:
 
@@ -268,6 +245,7 @@ reacquire_slot:
 	{
 		LockBuffer(buffer, BUFFER_LOCK_UNLOCK);
 
+		pgstat_count_zheap_slot_wait(onerel);
 		pgstat_report_wait_start(PG_WAIT_PAGE_TRANS_SLOT);
 		pg_usleep(10000L);		/* 10 ms */
 		pgstat_report_wait_end();
@@ -309,7 +287,7 @@ reacquire_slot:
 	 * transaction slot belongs to TPD entry, then the TPD page must be locked
 	 * during slot reservation.
 	 */
-	if (trans_slot_id <= ZHEAP_PAGE_TRANS_SLOTS &&
+	if (trans_slot_id <= ZHeapPageGetNumTransSlots(page) &&
 		ZHeapPageHasTPDSlot((PageHeader) page))
 		TPDPageLock(onerel, buffer);
 
@@ -327,13 +305,14 @@ reacquire_slot:
 	START_CRIT_SECTION();
 
 	memcpy(undorecord.uur_payload.data, unused, uncnt * sizeof(OffsetNumber));
-	InsertPreparedUndo();
+	undo_bytes = InsertPreparedUndo();
+	pgstat_count_zheap_undo_bytes(onerel, undo_bytes);
 
 	/*
 	 * We're sending the undo record for debugging purpose. So, just send the
 	 * last one.
 	 */
-	if (trans_slot_id > ZHEAP_PAGE_TRANS_SLOTS)
+	if (trans_slot_id > ZHeapPageGetNumTransSlots(page))
 	{
 		PageSetUNDO(undorecord,
 					buffer,
@@ -361,7 +340,8 @@ reacquire_slot:
 		ItemId		itemid;
 
 		itemid = PageGetItemId(page, unused[i]);
-		ItemIdSetUnusedExtended(itemid, trans_slot_id);
+		ItemIdSetUnusedExtended(itemid, trans_slot_id,
+								ZHeapPageGetNumTransSlots(page));
 	}
 
 	ZPageRepairFragmentation(buffer, tmppage, InvalidOffsetNumber, 0, false,
@@ -410,7 +390,7 @@ prepare_xlog:
 
 		XLogRegisterData((char *) unused, uncnt * sizeof(OffsetNumber));
 		XLogRegisterBuffer(0, buffer, REGBUF_STANDARD);
-		if (trans_slot_id > ZHEAP_PAGE_TRANS_SLOTS)
+		if (trans_slot_id > ZHeapPageGetNumTransSlots(page))
 			(void) RegisterTPDBuffer(page, 1);
 
 		RegisterUndoLogBuffers(2);
@@ -424,7 +404,7 @@ prepare_xlog:
 		}
 
 		PageSetLSN(page, recptr);
-		if (trans_slot_id > ZHEAP_PAGE_TRANS_SLOTS)
+		if (trans_slot_id > ZHeapPageGetNumTransSlots(page))
 			TPDPageSetLSN(page, recptr);
 		UndoLogBuffersSetLSN(recptr);
 	}
@@ -444,9 +424,12 @@ prepare_xlog:
 	 * all-visible here because we have yet to remove index entries
 	 * corresponding dead tuples.  So, we mark them potentially all-visible
 	 * and later after removing index entries, if still the bit is set, we
-	 * mark them as all-visible.
+	 * mark them as all-visible.  The potentially all-visible bit is the
+	 * all-frozen bit, so the page can't be marked all-frozen until the next
+	 * vacuum finds it all-visible.
 	 */
-	if (zheap_page_is_all_visible(onerel, buffer, &visibility_cutoff_xid))
+	if (zheap_page_is_all_visible(onerel, buffer, &visibility_cutoff_xid,
+								  &all_frozen))
 	{
 		uint8		vm_status = visibilitymap_get_status(onerel, blkno, vmbuffer);
 		uint8		flags = 0;
@@ -464,8 +447,6 @@ prepare_xlog:
 			visibilitymap_set(onerel, blkno, buffer, InvalidXLogRecPtr,
 							  *vmbuffer, InvalidTransactionId, flags);
 	}
-
-	return tupindex;
 }
 
 /*
@@ -479,24 +460,20 @@ static void
 MarkPagesAsAllVisible(Relation rel, LVRelStats *vacrelstats,
 					  TransactionId visibility_cutoff_xid)
 {
-	int			idx = 0;
+	uint32		blockidx;
+	uint32		nblocks = lazy_dead_tids_num_blocks(vacrelstats->dead_tids);
 
-	for (; idx < vacrelstats->num_dead_tuples; idx++)
+	for (blockidx = 0; blockidx < nblocks; blockidx++)
 	{
 		BlockNumber tblk;
-		BlockNumber prev_tblk = InvalidBlockNumber;
 		Buffer		vmbuffer = InvalidBuffer;
 		Buffer		buf = InvalidBuffer;
 		uint8		vm_status;
 
-		tblk = ItemPointerGetBlockNumber(&vacrelstats->dead_tuples[idx]);
+		tblk = lazy_dead_tids_block_number(vacrelstats->dead_tids, blockidx);
 		buf = ReadBufferExtended(rel, MAIN_FORKNUM, tblk,
 								 RBM_NORMAL, NULL);
 
-		/* Avoid processing same block again and again. */
-		if (tblk == prev_tblk)
-			continue;
-
 		visibilitymap_pin(rel, tblk, &vmbuffer);
 		vm_status = visibilitymap_get_status(rel, tblk, &vmbuffer);
 
@@ -527,8 +504,6 @@ MarkPagesAsAllVisible(Relation rel, LVRelStats *vacrelstats,
 			ReleaseBuffer(buf);
 			buf = InvalidBuffer;
 		}
-
-		prev_tblk = tblk;
 	}
 }
 
@@ -571,11 +546,14 @@ lazy_scan_zheap(Relation onerel, VacuumParams *params, LVRelStats *vacrelstats,
 				nunused;
 	IndexBulkDeleteResult **indstats;
 	StringInfoData infobuf;
-	int			i;
-	int			tupindex = 0;
 	PGRUsage	ru0;
 	BlockNumber next_unskippable_block;
+	uint8		skip_flags;
+	bool		skip_pages;
 	bool		skipping_blocks;
+	BlockNumber *spool_blocks = NULL;
+	int			nspool_blocks = 0;
+	int			spool_index = 0;
 	Buffer		vmbuffer = InvalidBuffer;
 	TransactionId visibility_cutoff_xid = InvalidTransactionId;
 	const int	initprog_index[] = {
@@ -623,14 +601,41 @@ lazy_scan_zheap(Relation onerel, VacuumParams *params, LVRelStats *vacrelstats,
 	 */
 	initprog_val[0] = PROGRESS_VACUUM_PHASE_VACUUM_HEAP;
 	initprog_val[1] = nblocks - 1;
-	initprog_val[2] = vacrelstats->max_dead_tuples;
+	initprog_val[2] = lazy_dead_tids_max_tuples(vacrelstats->dead_tids);
 	pgstat_progress_update_multi_param(3, initprog_index, initprog_val);
 
-	next_unskippable_block = ZHEAP_METAPAGE + 1;
-	if (!aggressive)
+	/*
+	 * With UNDO_SPOOL, only the blocks in which the discard worker has seen
+	 * tuples get deleted are visited, and the visibility map is irrelevant.
+	 */
+	if (params->options & VACOPT_UNDO_SPOOL)
 	{
+		spool_blocks = UndoSpoolReadBlocks(MyDatabaseId,
+										   RelationGetRelid(onerel),
+										   ZHEAP_METAPAGE + 1, nblocks,
+										   &nspool_blocks);
+		ereport(elevel,
+				(errmsg("\"%s\": %d pages found in undo spool",
+						relname, nspool_blocks)));
+	}
 
-		Assert((params->options & VACOPT_DISABLE_PAGE_SKIPPING) == 0);
+	/*
+	 * Except with DISABLE_PAGE_SKIPPING, we skip all-visible pages, or, in an
+	 * aggressive scan, only the all-frozen ones.  A zheap page is never
+	 * marked all-frozen without being marked all-visible too, as the
+	 * all-frozen bit alone means potentially all-visible, so an all-frozen
+	 * page has both bits set.
+	 */
+	if (aggressive)
+		skip_flags = VISIBILITYMAP_ALL_VISIBLE | VISIBILITYMAP_ALL_FROZEN;
+	else
+		skip_flags = VISIBILITYMAP_ALL_VISIBLE;
+	skip_pages = (params->options & VACOPT_DISABLE_PAGE_SKIPPING) == 0 &&
+		spool_blocks == NULL;
+
+	next_unskippable_block = ZHEAP_METAPAGE + 1;
+	if (skip_pages)
+	{
 		while (next_unskippable_block < nblocks)
 		{
 			uint8		vmstatus;
@@ -638,7 +643,7 @@ lazy_scan_zheap(Relation onerel, VacuumParams *params, LVRelStats *vacrelstats,
 			vmstatus = visibilitymap_get_status(onerel, next_unskippable_block,
 												&vmbuffer);
 
-			if ((vmstatus & VISIBILITYMAP_ALL_VISIBLE) == 0)
+			if ((vmstatus & skip_flags) != skip_flags)
 				break;
 
 			vacuum_delay_point();
@@ -663,16 +668,32 @@ lazy_scan_zheap(Relation onerel, VacuumParams *params, LVRelStats *vacrelstats,
 					hastup;
 		bool		all_visible_according_to_vm = false;
 		bool		all_visible;
+		bool		all_frozen;
 		bool		has_dead_tuples;
 
+		if (spool_blocks != NULL)
+		{
+			/* Jump to the next spooled block, if any. */
+			if (spool_index >= nspool_blocks)
+			{
+				blkno = nblocks;
+				break;
+			}
+			Assert(spool_blocks[spool_index] >= blkno);
+			blkno = spool_blocks[spool_index++];
+		}
+
 		/* Report the number of blocks scanned. */
 		pgstat_progress_update_param(PROGRESS_VACUUM_HEAP_BLKS_SCANNED, blkno - 1);
 
-		if (blkno == next_unskippable_block)
+		if (spool_blocks != NULL)
+			all_visible_according_to_vm = VM_ALL_VISIBLE(onerel, blkno,
+														 &vmbuffer);
+		else if (blkno == next_unskippable_block)
 		{
 			/* Time to advance next_unskippable_block */
 			next_unskippable_block++;
-			if (!aggressive)
+			if (skip_pages)
 			{
 				while (next_unskippable_block < nblocks)
 				{
@@ -681,7 +702,7 @@ lazy_scan_zheap(Relation onerel, VacuumParams *params, LVRelStats *vacrelstats,
 					vmskipflags = visibilitymap_get_status(onerel,
 														   next_unskippable_block,
 														   &vmbuffer);
-					if ((vmskipflags & VISIBILITYMAP_ALL_VISIBLE) == 0)
+					if ((vmskipflags & skip_flags) != skip_flags)
 						break;
 
 					vacuum_delay_point();
@@ -715,7 +736,7 @@ lazy_scan_zheap(Relation onerel, VacuumParams *params, LVRelStats *vacrelstats,
 		 * If we are close to overrunning the available space for dead-tuple
 		 * TIDs, pause and do a cycle of vacuuming before we tackle this page.
 		 */
-		if ((vacrelstats->max_dead_tuples - vacrelstats->num_dead_tuples) < MaxZHeapTuplesPerPage &&
+		if (lazy_dead_tids_is_full(vacrelstats->dead_tids) &&
 			vacrelstats->num_dead_tuples > 0)
 		{
 			/*
@@ -741,12 +762,9 @@ lazy_scan_zheap(Relation onerel, VacuumParams *params, LVRelStats *vacrelstats,
 			 * the first pass itself and we don't need another pass on heap
 			 * after index.
 			 */
-			for (i = 0; i < nindexes; i++)
-				lazy_vacuum_index(Irel[i],
-								  &indstats[i],
-								  vacrelstats,
-								  vac_strategy,
-								  elevel);
+			lazy_vacuum_all_indexes(onerel, Irel, indstats, nindexes,
+									vacrelstats, vac_strategy, elevel,
+									nworkers);
 
 			pgstat_progress_update_param(PROGRESS_VACUUM_NUM_INDEX_VACUUMS,
 										 vacrelstats->num_index_scans + 1);
@@ -767,8 +785,7 @@ lazy_scan_zheap(Relation onerel, VacuumParams *params, LVRelStats *vacrelstats,
 			 * not to reset latestRemovedXid since we want that value to be
 			 * valid.
 			 */
-			tupindex = 0;
-			vacrelstats->num_dead_tuples = 0;
+			lazy_forget_dead_tuples(vacrelstats);
 			vacrelstats->num_index_scans++;
 
 			/*
@@ -843,8 +860,9 @@ lazy_scan_zheap(Relation onerel, VacuumParams *params, LVRelStats *vacrelstats,
 		 */
 
 		/*
-		 * Prune the TPD pages and if all the entries are removed, then record
-		 * it in FSM, so that it can be reused as a zheap page.
+		 * Prune the TPD pages and if all the entries are removed, then put it
+		 * on the free list of the metapage, so that it can be reused as a TPD
+		 * page.
 		 */
 		if (IsTPDPage(page))
 		{
@@ -872,7 +890,7 @@ lazy_scan_zheap(Relation onerel, VacuumParams *params, LVRelStats *vacrelstats,
 			vmstatus = visibilitymap_get_status(onerel,
 												blkno,
 												&vmbuffer);
-			if ((vmstatus & VISIBILITYMAP_ALL_VISIBLE) == 0)
+			if ((vmstatus & VISIBILITYMAP_VALID_BITS) != VISIBILITYMAP_VALID_BITS)
 			{
 				START_CRIT_SECTION();
 
@@ -895,7 +913,8 @@ lazy_scan_zheap(Relation onerel, VacuumParams *params, LVRelStats *vacrelstats,
 
 				visibilitymap_set(onerel, blkno, buf, InvalidXLogRecPtr,
 								  vmbuffer, InvalidTransactionId,
-								  VISIBILITYMAP_ALL_VISIBLE);
+								  VISIBILITYMAP_ALL_VISIBLE |
+								  VISIBILITYMAP_ALL_FROZEN);
 
 				END_CRIT_SECTION();
 			}
@@ -1050,8 +1069,7 @@ lazy_scan_zheap(Relation onerel, VacuumParams *params, LVRelStats *vacrelstats,
 			if (nindexes == 0)
 			{
 				/* Remove tuples from zheap */
-				tupindex = lazy_vacuum_zpage(onerel, blkno, buf, tupindex,
-											 vacrelstats, &vmbuffer);
+				lazy_vacuum_zpage(onerel, blkno, buf, vacrelstats, &vmbuffer);
 				has_dead_tuples = false;
 
 				/*
@@ -1059,8 +1077,7 @@ lazy_scan_zheap(Relation onerel, VacuumParams *params, LVRelStats *vacrelstats,
 				 * careful not to reset latestRemovedXid since we want that
 				 * value to be valid.
 				 */
-				vacrelstats->num_dead_tuples = 0;
-				tupindex = 0;
+				lazy_forget_dead_tuples(vacrelstats);
 				vacuumed_pages++;
 
 				/*
@@ -1082,24 +1099,24 @@ lazy_scan_zheap(Relation onerel, VacuumParams *params, LVRelStats *vacrelstats,
 				Assert(nindexes > 0);
 
 				/* Remove tuples from zheap and write the undo for it. */
-				tupindex = lazy_vacuum_zpage_with_undo(onerel, blkno, buf,
-													   tupindex, vacrelstats,
-													   &vmbuffer,
-													   &visibility_cutoff_xid);
+				lazy_vacuum_zpage_with_undo(onerel, blkno, buf, vacrelstats,
+											&vmbuffer,
+											&visibility_cutoff_xid);
 			}
 		}
 
 		/* Now that we are done with the page, get its available space */
 		freespace = PageGetZHeapFreeSpace(page);
 
-		/* mark page all-visible, if appropriate */
-		if (all_visible && !all_visible_according_to_vm)
-		{
-			uint8		flags = VISIBILITYMAP_ALL_VISIBLE;
-
-			visibilitymap_set(onerel, blkno, buf, InvalidXLogRecPtr,
-							  vmbuffer, visibility_cutoff_xid, flags);
-		}
+		/*
+		 * Mark page all-visible, and all-frozen if appropriate.  A page that
+		 * is all-visible according to the VM may still have to be marked
+		 * all-frozen.
+		 */
+		all_frozen = all_visible && zheap_page_is_all_frozen(page);
+		if (all_visible && (!all_visible_according_to_vm || all_frozen))
+			zheap_vm_set_all_visible(onerel, blkno, buf, &vmbuffer,
+									 visibility_cutoff_xid, all_frozen);
 		else if (has_dead_tuples && all_visible_according_to_vm)
 		{
 			visibilitymap_clear(onerel, blkno, vmbuffer,
@@ -1143,6 +1160,9 @@ lazy_scan_zheap(Relation onerel, VacuumParams *params, LVRelStats *vacrelstats,
 		vmbuffer = InvalidBuffer;
 	}
 
+	if (spool_blocks != NULL)
+		pfree(spool_blocks);
+
 	if (vacrelstats->num_dead_tuples > 0)
 	{
 		/* Report that we are now vacuuming indexes. */
@@ -1155,12 +1175,8 @@ lazy_scan_zheap(Relation onerel, VacuumParams *params, LVRelStats *vacrelstats,
 		 * This is because we have covered all the dead tuples in the first
 		 * pass itself and we don't need another pass on heap after index.
 		 */
-		for (i = 0; i < nindexes; i++)
-			lazy_vacuum_index(Irel[i],
-							  &indstats[i],
-							  vacrelstats,
-							  vac_strategy,
-							  elevel);
+		lazy_vacuum_all_indexes(onerel, Irel, indstats, nindexes,
+								vacrelstats, vac_strategy, elevel, nworkers);
 
 		pgstat_progress_update_param(PROGRESS_VACUUM_NUM_INDEX_VACUUMS,
 									 vacrelstats->num_index_scans + 1);
@@ -1197,9 +1213,8 @@ lazy_scan_zheap(Relation onerel, VacuumParams *params, LVRelStats *vacrelstats,
 								 PROGRESS_VACUUM_PHASE_INDEX_CLEANUP);
 
 	/* Do post-vacuum cleanup and statistics update for each index */
-	for (i = 0; i < nindexes; i++)
-		lazy_cleanup_index(Irel[i], indstats[i], vacrelstats, vac_strategy,
-						   elevel);
+	lazy_cleanup_all_indexes(onerel, Irel, indstats, nindexes, vacrelstats,
+							 vac_strategy, elevel, nworkers);
 
 	/*
 	 * This is pretty messy, but we split it up so that we can skip emitting
@@ -1285,9 +1300,13 @@ lazy_vacuum_zheap_rel(Relation onerel, VacuumParams *params,
 	Assert(TransactionIdIsNormal(OldestXmin));
 
 	/*
-	 * We request an aggressive scan if DISABLE_PAGE_SKIPPING was specified.
+	 * We request an aggressive scan if DISABLE_PAGE_SKIPPING was specified,
+	 * and for VACUUM FREEZE and anti-wraparound vacuums.  Zheap doesn't
+	 * maintain relfrozenxid, so unlike heap, the freeze table age of the
+	 * relation can't tell us when to do so.
 	 */
-	if (params->options & VACOPT_DISABLE_PAGE_SKIPPING)
+	if ((params->options & VACOPT_DISABLE_PAGE_SKIPPING) ||
+		params->freeze_table_age == 0 || params->is_wraparound)
 		aggressive = true;
 
 	vacrelstats = (LVRelStats *) palloc0(sizeof(LVRelStats));
@@ -1303,6 +1322,19 @@ lazy_vacuum_zheap_rel(Relation onerel, VacuumParams *params,
 	vacrelstats->useindex = (nindexes > 0 &&
 							 params->index_cleanup == VACOPT_TERNARY_ENABLED);
 
+	/*
+	 * Parallel workers can't access the leader's temporary tables, so vacuum
+	 * their indexes serially.
+	 */
+	nworkers = params->nworkers;
+	if (nworkers > 0 && RelationUsesLocalBuffers(onerel))
+	{
+		ereport(WARNING,
+				(errmsg("disabling parallel option of vacuum on \"%s\" --- cannot vacuum temporary tables in parallel",
+						RelationGetRelationName(onerel))));
+		nworkers = 0;
+	}
+
 	/* Do the vacuuming */
 	lazy_scan_zheap(onerel, params, vacrelstats, Irel, nindexes,
 					vac_strategy, aggressive);
@@ -1311,9 +1343,12 @@ lazy_vacuum_zheap_rel(Relation onerel, VacuumParams *params,
 	vac_close_indexes(nindexes, Irel, NoLock);
 
 	/*
-	 * Optionally truncate the relation.
+	 * Optionally truncate the relation.  Not after visiting only the spooled
+	 * blocks, since finding the empty ones at the end would need a scan of
+	 * the whole table.
 	 */
-	if (should_attempt_truncation(params, vacrelstats))
+	if ((params->options & VACOPT_UNDO_SPOOL) == 0 &&
+		should_attempt_truncation(params, vacrelstats))
 		lazy_truncate_heap(onerel, vacrelstats, vac_strategy, elevel);
 
 	/* Report that we are now doing final cleanup. */
@@ -1440,43 +1475,22 @@ lazy_vacuum_zheap_rel(Relation onerel, VacuumParams *params,
 static void
 lazy_space_zalloc(LVRelStats *vacrelstats, BlockNumber relblocks)
 {
-	long		maxtuples;
-	int			vac_work_mem = IsAutoVacuumWorkerProcess() &&
-	autovacuum_work_mem != -1 ?
-	autovacuum_work_mem : maintenance_work_mem;
-
-	if (vacrelstats->useindex)
-	{
-		maxtuples = (vac_work_mem * 1024L) / sizeof(ItemPointerData);
-		maxtuples = Min(maxtuples, INT_MAX);
-		maxtuples = Min(maxtuples, MaxAllocSize / sizeof(ItemPointerData));
-
-		/* curious coding here to ensure the multiplication can't overflow */
-		if ((BlockNumber) (maxtuples / LAZY_ALLOC_TUPLES) > relblocks)
-			maxtuples = relblocks * LAZY_ALLOC_TUPLES;
-
-		/* stay sane if small maintenance_work_mem */
-		maxtuples = Max(maxtuples, MaxZHeapTuplesPerPage);
-	}
-	else
-	{
-		maxtuples = MaxZHeapTuplesPerPage;
-	}
-
 	vacrelstats->num_dead_tuples = 0;
-	vacrelstats->max_dead_tuples = (int) maxtuples;
-	vacrelstats->dead_tuples = (ItemPointer)
-		palloc(maxtuples * sizeof(ItemPointerData));
+	vacrelstats->dead_tids = lazy_dead_tids_create(relblocks,
+												   MaxZHeapTuplesPerPage,
+												   vacrelstats->useindex);
 }
 
 /*
  * Check if every tuple in the given page is visible to all current and future
  * transactions. Also return the visibility_cutoff_xid which is the highest
- * xmin amongst the visible tuples.
+ * xmin amongst the visible tuples, and whether the page is all-frozen in
+ * *all_frozen.
  */
 static bool
 zheap_page_is_all_visible(Relation rel, Buffer buf,
-						  TransactionId *visibility_cutoff_xid)
+						  TransactionId *visibility_cutoff_xid,
+						  bool *all_frozen)
 {
 	Page		page = BufferGetPage(buf);
 	BlockNumber blockno = BufferGetBlockNumber(buf);
@@ -1485,6 +1499,7 @@ zheap_page_is_all_visible(Relation rel, Buffer buf,
 	bool		all_visible = true;
 
 	*visibility_cutoff_xid = InvalidTransactionId;
+	*all_frozen = false;
 
 	/*
 	 * This is a stripped down version of the line pointer scan in
@@ -1560,5 +1575,93 @@ zheap_page_is_all_visible(Relation rel, Buffer buf,
 		}
 	}							/* scan along page */
 
+	if (all_visible)
+		*all_frozen = zheap_page_is_all_frozen(page);
+
 	return all_visible;
 }
+
+/*
+ * Check if the tuples of an all-visible page no longer depend on any
+ * transaction.
+ *
+ * That's the case if every transaction slot on the page is frozen, or belongs
+ * to a transaction older than all undo, and no tuple is locked by multiple
+ * lockers, so that the visibility of the tuples can be decided without
+ * consulting the status of any xid or fetching any undo.  Pages whose slots
+ * overflowed into a TPD entry are not considered.
+ */
+static bool
+zheap_page_is_all_frozen(Page page)
+{
+	ZHeapPageOpaque opaque;
+	OffsetNumber offnum,
+				maxoff;
+	int			slot_no;
+
+	if (ZHeapPageHasTPDSlot((PageHeader) page))
+		return false;
+
+	opaque = (ZHeapPageOpaque) PageGetSpecialPointer(page);
+
+	for (slot_no = 0; slot_no < ZHeapPageGetNumTransSlots(page); slot_no++)
+	{
+		FullTransactionId slot_fxid = opaque->transinfo[slot_no].fxid;
+		UndoRecPtr	urec_ptr = opaque->transinfo[slot_no].urec_ptr;
+
+		if (FullTransactionIdIsValid(slot_fxid))
+		{
+			if (!FullTransactionIdOlderThanAllUndo(slot_fxid))
+				return false;
+		}
+		else if (UndoRecPtrIsValid(urec_ptr) && !UndoLogIsDiscarded(urec_ptr))
+			return false;
+	}
+
+	maxoff = PageGetMaxOffsetNumber(page);
+	for (offnum = FirstOffsetNumber;
+		 offnum <= maxoff;
+		 offnum = OffsetNumberNext(offnum))
+	{
+		ItemId		itemid = PageGetItemId(page, offnum);
+		ZHeapTupleHeader tuphdr;
+
+		if (!ItemIdIsNormal(itemid))
+			continue;
+
+		tuphdr = (ZHeapTupleHeader) PageGetItem(page, itemid);
+		if (ZHeapTupleHasMultiLockers(tuphdr->t_infomask))
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Mark an all-visible page as such in the visibility map, and as all-frozen
+ * too if all_frozen is true.
+ *
+ * As the all-frozen bit on its own marks the page potentially all-visible, a
+ * leftover one is cleared before a page that isn't all-frozen is marked
+ * all-visible.
+ */
+static void
+zheap_vm_set_all_visible(Relation rel, BlockNumber blkno, Buffer buf,
+						 Buffer *vmbuffer, TransactionId cutoff_xid,
+						 bool all_frozen)
+{
+	uint8		vm_status = visibilitymap_get_status(rel, blkno, vmbuffer);
+	uint8		flags = VISIBILITYMAP_ALL_VISIBLE;
+
+	if (all_frozen)
+		flags |= VISIBILITYMAP_ALL_FROZEN;
+
+	if ((vm_status & flags) == flags)
+		return;
+
+	if (!all_frozen && vm_status == VISIBILITYMAP_POTENTIAL_ALL_VISIBLE)
+		visibilitymap_clear(rel, blkno, *vmbuffer, VISIBILITYMAP_VALID_BITS);
+
+	visibilitymap_set(rel, blkno, buf, InvalidXLogRecPtr, *vmbuffer,
+					  cutoff_xid, flags);
+}
@@ -227,6 +227,7 @@ Boot_CreateStmt:
 												   tupdesc,
 												   RELKIND_RELATION,
 												   RELPERSISTENCE_PERMANENT,
+												   (Datum) 0,
 												   shared_relation,
 												   mapped_relation,
 												   true,
@@ -33,6 +33,7 @@
 #include "access/htup_details.h"
 #include "access/multixact.h"
 #include "access/relation.h"
+#include "access/reloptions.h"
 #include "access/sysattr.h"
 #include "access/table.h"
 #include "access/tableam.h"
@@ -82,6 +83,7 @@
 #include "utils/fmgroids.h"
 #include "utils/inval.h"
 #include "utils/lsyscache.h"
+#include "utils/memutils.h"
 #include "utils/partcache.h"
 #include "utils/rel.h"
 #include "utils/ruleutils.h"
@@ -302,6 +304,7 @@ heap_create(const char *relname,
 			TupleDesc tupDesc,
 			char relkind,
 			char relpersistence,
+			Datum reloptions,
 			bool shared_relation,
 			bool mapped_relation,
 			bool allow_system_table_mods,
@@ -406,6 +409,26 @@ heap_create(const char *relname,
 									 relpersistence,
 									 relkind);
 
+	/*
+	 * The table AM may want to look at the relation's options while setting
+	 * up its storage, so parse them into the dummy relcache entry.  The entry
+	 * is rebuilt from pg_class anyway once the relation has been cataloged.
+	 */
+	if (create_storage && reloptions != (Datum) 0 &&
+		(relkind == RELKIND_RELATION || relkind == RELKIND_TOASTVALUE ||
+		 relkind == RELKIND_MATVIEW))
+	{
+		bytea	   *options = heap_reloptions(relkind, reloptions, false);
+
+		if (options)
+		{
+			rel->rd_options = MemoryContextAlloc(CacheMemoryContext,
+												 VARSIZE(options));
+			memcpy(rel->rd_options, options, VARSIZE(options));
+			pfree(options);
+		}
+	}
+
 	/*
 	 * Have the storage manager create the relation's disk file, if needed.
 	 *
@@ -715,6 +738,7 @@ InsertPgAttributeTuple(Relation pg_attribute_rel,
 	values[Anum_pg_attribute_atttypmod - 1] = Int32GetDatum(new_attribute->atttypmod);
 	values[Anum_pg_attribute_attbyval - 1] = BoolGetDatum(new_attribute->attbyval);
 	values[Anum_pg_attribute_attstorage - 1] = CharGetDatum(new_attribute->attstorage);
+	values[Anum_pg_attribute_attcompression - 1] = CharGetDatum(new_attribute->attcompression);
 	values[Anum_pg_attribute_attalign - 1] = CharGetDatum(new_attribute->attalign);
 	values[Anum_pg_attribute_attnotnull - 1] = BoolGetDatum(new_attribute->attnotnull);
 	values[Anum_pg_attribute_atthasdef - 1] = BoolGetDatum(new_attribute->atthasdef);
@@ -1224,6 +1248,7 @@ heap_create_with_catalog(const char *relname,
 							   tupdesc,
 							   relkind,
 							   relpersistence,
+							   reloptions,
 							   shared_relation,
 							   mapped_relation,
 							   allow_system_table_mods,
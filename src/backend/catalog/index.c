@@ -884,6 +884,7 @@ index_create(Relation heapRelation,
 								indexTupDesc,
 								relkind,
 								relpersistence,
+								(Datum) 0,
 								shared_relation,
 								mapped_relation,
 								allow_system_table_mods,
@@ -2667,12 +2668,13 @@ index_build(Relation heapRelation,
 
 	/*
 	 * Determine worker process details for parallel CREATE INDEX.  Currently,
-	 * only btree has support for parallel builds.
+	 * only btree and GIN have support for parallel builds.
 	 *
 	 * Note that planner considers parallel safety for us.
 	 */
 	if (parallel && IsNormalProcessingMode() &&
-		indexRelation->rd_rel->relam == BTREE_AM_OID)
+		(indexRelation->rd_rel->relam == BTREE_AM_OID ||
+		 indexRelation->rd_rel->relam == GIN_AM_OID))
 		indexInfo->ii_ParallelWorkers =
 			plan_create_index_workers(RelationGetRelid(heapRelation),
 									  RelationGetRelid(indexRelation));
@@ -3762,7 +3764,9 @@ RestoreReindexState(void *reindexstate)
 	currentlyReindexedHeap = sistate->currentlyReindexedHeap;
 	currentlyReindexedIndex = sistate->currentlyReindexedIndex;
 
-	Assert(pendingReindexedIndexes == NIL);
+	/* A reused worker may still have the state of its previous leader. */
+	list_free(pendingReindexedIndexes);
+	pendingReindexedIndexes = NIL;
 	oldcontext = MemoryContextSwitchTo(TopMemoryContext);
 	for (c = 0; c < sistate->numPendingReindexedIndexes; ++c)
 		pendingReindexedIndexes =
@@ -580,6 +580,22 @@ CREATE VIEW pg_stat_xact_user_tables AS
     WHERE schemaname NOT IN ('pg_catalog', 'information_schema') AND
           schemaname !~ '^pg_toast';
 
+CREATE VIEW pg_stat_zheap_tables AS
+    SELECT
+            C.oid AS relid,
+            N.nspname AS schemaname,
+            C.relname AS relname,
+            pg_stat_get_tuples_updated(C.oid) AS n_tup_upd,
+            pg_stat_get_tuples_inplace_updated(C.oid) AS n_tup_inplace_upd,
+            pg_stat_get_zheap_tpd_allocs(C.oid) AS n_tpd_alloc,
+            pg_stat_get_zheap_slot_waits(C.oid) AS n_slot_wait,
+            pg_stat_get_zheap_prunes(C.oid) AS n_prune,
+            pg_stat_get_zheap_undo_bytes(C.oid) AS undo_bytes
+    FROM pg_class C JOIN
+         pg_am A ON A.oid = C.relam
+         LEFT JOIN pg_namespace N ON (N.oid = C.relnamespace)
+    WHERE C.relkind IN ('r', 't', 'm') AND A.amname = 'zheap';
+
 CREATE VIEW pg_statio_all_tables AS
     SELECT
             C.oid AS relid,
@@ -760,6 +776,66 @@ CREATE VIEW pg_stat_wal_receiver AS
     FROM pg_stat_get_wal_receiver() s
     WHERE s.pid IS NOT NULL;
 
+CREATE VIEW pg_stat_recovery_prefetch AS
+    SELECT
+        s.stats_reset,
+        s.prefetch,
+        s.skip_hit,
+        s.skip_new,
+        s.skip_fpw,
+        s.skip_init,
+        s.skip_rep,
+        s.distance
+    FROM pg_stat_get_recovery_prefetch() s;
+
+CREATE VIEW pg_stat_lwlocks AS
+    SELECT
+        s.tranche,
+        s.acquisitions,
+        s.contended,
+        s.spin_delays,
+        s.wait_time,
+        s.stats_reset
+    FROM pg_stat_get_lwlocks() s;
+
+CREATE VIEW pg_stat_io AS
+    SELECT
+        s.backend_type,
+        s.object,
+        s.context,
+        s.reads,
+        s.read_time,
+        s.writes,
+        s.write_time,
+        s.extends,
+        s.extend_time,
+        s.fsyncs,
+        s.fsync_time,
+        s.stats_reset
+    FROM pg_stat_get_io() s;
+
+CREATE VIEW pg_stat_catcache AS
+    SELECT
+        s.cache_id,
+        s.relid,
+        s.indexrelid,
+        s.entries,
+        s.negative_entries,
+        s.memory,
+        s.hits,
+        s.misses,
+        s.evictions
+    FROM pg_stat_get_catcache() s;
+
+CREATE VIEW pg_stat_relcache AS
+    SELECT
+        s.entries,
+        s.memory,
+        s.hits,
+        s.misses,
+        s.evictions
+    FROM pg_stat_get_relcache() s;
+
 CREATE VIEW pg_stat_subscription AS
     SELECT
             su.oid AS subid,
@@ -1013,7 +1089,7 @@ REVOKE ALL ON pg_replication_origin_status FROM public;
 
 -- All columns of pg_subscription except subconninfo are readable.
 REVOKE ALL ON pg_subscription FROM public;
-GRANT SELECT (subdbid, subname, subowner, subenabled, subslotname, subpublications)
+GRANT SELECT (subdbid, subname, subowner, subenabled, substream, subslotname, subpublications)
     ON pg_subscription TO public;
 
 
@@ -62,6 +62,7 @@
 #include "utils/pg_rusage.h"
 #include "utils/sampling.h"
 #include "utils/sortsupport.h"
+#include "utils/spccache.h"
 #include "utils/syscache.h"
 #include "utils/timestamp.h"
 
@@ -1016,6 +1017,12 @@ acquire_sample_rows(Relation onerel, int elevel,
 	ReservoirStateData rstate;
 	TupleTableSlot *slot;
 	TableScanDesc scan;
+	long		randseed;		/* Seed for block sampler(s) */
+#ifdef USE_PREFETCH
+	int			prefetch_maximum = target_prefetch_pages;
+	BlockSamplerData prefetch_bs;
+	int			io_concurrency;
+#endif
 
 	Assert(targrows > 0);
 
@@ -1025,10 +1032,36 @@ acquire_sample_rows(Relation onerel, int elevel,
 	OldestXmin = GetOldestXmin(onerel, PROCARRAY_FLAGS_VACUUM);
 
 	/* Prepare for sampling block numbers */
-	BlockSampler_Init(&bs, totalblocks, targrows, random());
+	randseed = random();
+	BlockSampler_Init(&bs, totalblocks, targrows, randseed);
 	/* Prepare for sampling rows */
 	reservoir_init_selection_state(&rstate, targrows);
 
+#ifdef USE_PREFETCH
+	/*
+	 * A second sampler with the same seed produces the same sequence of
+	 * blocks, kept prefetch_maximum blocks ahead of the one being read.  The
+	 * tablespace may override effective_io_concurrency.
+	 */
+	io_concurrency = get_tablespace_io_concurrency(onerel->rd_rel->reltablespace);
+	if (io_concurrency != effective_io_concurrency)
+	{
+		double		maximum;
+
+		if (ComputeIoConcurrency(io_concurrency, &maximum))
+			prefetch_maximum = rint(maximum);
+	}
+
+	BlockSampler_Init(&prefetch_bs, totalblocks, targrows, randseed);
+	if (prefetch_maximum > 0)
+	{
+		int			i;
+
+		for (i = 0; i < prefetch_maximum && BlockSampler_HasMore(&prefetch_bs); i++)
+			PrefetchBuffer(onerel, MAIN_FORKNUM, BlockSampler_Next(&prefetch_bs));
+	}
+#endif
+
 	scan = table_beginscan_analyze(onerel);
 	slot = table_slot_create(onerel, NULL);
 
@@ -1039,6 +1072,12 @@ acquire_sample_rows(Relation onerel, int elevel,
 
 		vacuum_delay_point();
 
+#ifdef USE_PREFETCH
+		/* Keep the prefetch window prefetch_maximum blocks ahead. */
+		if (prefetch_maximum > 0 && BlockSampler_HasMore(&prefetch_bs))
+			PrefetchBuffer(onerel, MAIN_FORKNUM, BlockSampler_Next(&prefetch_bs));
+#endif
+
 		if (!table_scan_analyze_next_block(scan, targblock, vac_strategy))
 			continue;
 
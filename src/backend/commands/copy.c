@@ -20,12 +20,14 @@
 
 #include "access/heapam.h"
 #include "access/htup_details.h"
+#include "access/parallel.h"
 #include "access/sysattr.h"
 #include "access/tableam.h"
 #include "access/xact.h"
 #include "access/xlog.h"
 #include "catalog/dependency.h"
 #include "catalog/pg_authid.h"
+#include "catalog/pg_proc.h"
 #include "catalog/pg_type.h"
 #include "commands/copy.h"
 #include "commands/defrem.h"
@@ -39,15 +41,20 @@
 #include "libpq/pqformat.h"
 #include "mb/pg_wchar.h"
 #include "miscadmin.h"
+#include "optimizer/clauses.h"
 #include "optimizer/optimizer.h"
 #include "nodes/makefuncs.h"
 #include "parser/parse_coerce.h"
 #include "parser/parse_collate.h"
 #include "parser/parse_expr.h"
 #include "parser/parse_relation.h"
+#include "pgstat.h"
 #include "port/pg_bswap.h"
+#include "postmaster/bgworker_internals.h"
 #include "rewrite/rewriteHandler.h"
+#include "storage/condition_variable.h"
 #include "storage/fd.h"
+#include "storage/spin.h"
 #include "tcop/tcopprot.h"
 #include "utils/builtins.h"
 #include "utils/lsyscache.h"
@@ -57,6 +64,7 @@
 #include "utils/rel.h"
 #include "utils/rls.h"
 #include "utils/snapmgr.h"
+#include "utils/typcache.h"
 
 
 #define ISOCTAL(c) (((c) >= '0') && ((c) <= '7'))
@@ -95,6 +103,76 @@ typedef enum CopyInsertMethod
 	CIM_MULTI_CONDITIONAL		/* use table_multi_insert only if valid */
 } CopyInsertMethod;
 
+/*
+ * Parallel COPY FROM.
+ *
+ * The leader reads the input and splits it into lines, as a serial COPY
+ * would, and packs the lines, already converted to the server encoding, into
+ * fixed-size chunks in shared memory.  Workers take filled chunks in order,
+ * then parse, convert and insert the lines with the ordinary CopyFrom()
+ * machinery.  Each line is stored with its line number so that errors can be
+ * reported just as in a serial COPY.  A line that doesn't fit in the rest of
+ * its chunk continues in the next chunk, which is flagged as a continuation
+ * and may only be taken by the worker that took the line's first part.
+ */
+#define PARALLEL_KEY_COPY_SHARED		UINT64CONST(0xA000000000000001)
+#define PARALLEL_KEY_COPY_STATE			UINT64CONST(0xA000000000000002)
+#define PARALLEL_KEY_QUERY_TEXT			UINT64CONST(0xA000000000000003)
+
+#define PARALLEL_COPY_CHUNK_SIZE		65536
+#define PARALLEL_COPY_CHUNKS_PER_WORKER	4
+
+typedef enum ParallelCopyChunkState
+{
+	PCOPY_CHUNK_FREE,			/* may be filled by the leader */
+	PCOPY_CHUNK_FILLED,			/* waiting to be taken by a worker */
+	PCOPY_CHUNK_BUSY			/* being copied out by a worker */
+} ParallelCopyChunkState;
+
+typedef struct ParallelCopyChunk
+{
+	ParallelCopyChunkState state;
+	bool		continuation;	/* starts with the rest of the last line of
+								 * the previous chunk? */
+	int			len;			/* number of bytes of data used */
+	char		data[PARALLEL_COPY_CHUNK_SIZE];
+} ParallelCopyChunk;
+
+/* Header of each line stored in a chunk; it is never split across chunks */
+typedef struct ParallelCopyLineHeader
+{
+	uint64		lineno;			/* line number for error messages */
+	uint32		len;			/* length of the line, excluding header */
+} ParallelCopyLineHeader;
+
+typedef struct ParallelCopyShared
+{
+	/* These fields are not modified after setup */
+	Oid			relid;			/* target table */
+	int			ti_options;		/* table insert options chosen by leader */
+	int			nchunks;		/* size of chunks[] */
+
+	slock_t		mutex;			/* protects the fields below and the state
+								 * of each chunk */
+	int			next_chunk;		/* next chunk for workers to take */
+	bool		eof;			/* has the leader queued all input? */
+	uint64		processed;		/* rows inserted by finished workers */
+
+	ConditionVariable filled_cv;	/* a chunk was filled, or EOF was reached */
+	ConditionVariable freed_cv; /* a chunk was freed */
+
+	ParallelCopyChunk chunks[FLEXIBLE_ARRAY_MEMBER];
+} ParallelCopyShared;
+
+/* Per-worker state, pointed to by CopyStateData in a parallel COPY worker */
+typedef struct ParallelCopyWorker
+{
+	ParallelCopyShared *shared;
+	char	   *buf;			/* private copy of the current chunk */
+	int			len;			/* bytes in buf */
+	int			pos;			/* next byte to process in buf */
+} ParallelCopyWorker;
+
 /*
  * This struct contains all the state variables used throughout a COPY
  * operation. For simplicity, we use the same struct for all variants of COPY,
@@ -154,6 +232,9 @@ typedef struct CopyStateData
 	List	   *convert_select; /* list of column names (can be NIL) */
 	bool	   *convert_select_flags;	/* per-column CSV/TEXT CS flags */
 	Node	   *whereClause;	/* WHERE condition (or NULL) */
+	int			nworkers;		/* number of parallel workers requested */
+	List	   *attnamelist;	/* as given to BeginCopyFrom, for workers */
+	List	   *options;		/* as given to BeginCopyFrom, for workers */
 
 	/* these are just for error messages, see CopyFromErrorCallback */
 	const char *cur_relname;	/* table name for error messages */
@@ -188,6 +269,8 @@ typedef struct CopyStateData
 
 	TransitionCaptureState *transition_capture;
 
+	ParallelCopyWorker *pcopy;	/* set only in a parallel COPY worker */
+
 	/*
 	 * These variables are used to reduce overhead in textual COPY FROM.
 	 *
@@ -379,6 +462,10 @@ static void CopyAttributeOutCSV(CopyState cstate, char *string,
 static List *CopyGetAttnums(TupleDesc tupDesc, Relation rel,
 							List *attnamelist);
 static char *limit_printout_length(const char *str);
+static bool CopyFromParallelOK(CopyState cstate, ResultRelInfo *resultRelInfo);
+static bool ParallelCopyFrom(CopyState cstate, int ti_options,
+							 uint64 *processed);
+static bool ParallelCopyReadLine(CopyState cstate);
 
 /* Low-level communications functions */
 static void SendCopyBegin(CopyState cstate);
@@ -1115,6 +1202,7 @@ ProcessCopyOptions(ParseState *pstate,
 				   List *options)
 {
 	bool		format_specified = false;
+	bool		parallel_specified = false;
 	ListCell   *option;
 
 	/* Support external use for option sanity checking */
@@ -1292,6 +1380,23 @@ ProcessCopyOptions(ParseState *pstate,
 								defel->defname),
 						 parser_errposition(pstate, defel->location)));
 		}
+		else if (strcmp(defel->defname, "parallel") == 0)
+		{
+			if (parallel_specified)
+				ereport(ERROR,
+						(errcode(ERRCODE_SYNTAX_ERROR),
+						 errmsg("conflicting or redundant options"),
+						 parser_errposition(pstate, defel->location)));
+			parallel_specified = true;
+			cstate->nworkers = defGetInt32(defel);
+			if (cstate->nworkers < 0 ||
+				cstate->nworkers > MAX_PARALLEL_WORKER_LIMIT)
+				ereport(ERROR,
+						(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						 errmsg("argument to option \"%s\" must be between 0 and %d",
+								defel->defname, MAX_PARALLEL_WORKER_LIMIT),
+						 parser_errposition(pstate, defel->location)));
+		}
 		else
 			ereport(ERROR,
 					(errcode(ERRCODE_SYNTAX_ERROR),
@@ -1314,6 +1419,11 @@ ProcessCopyOptions(ParseState *pstate,
 				(errcode(ERRCODE_SYNTAX_ERROR),
 				 errmsg("cannot specify NULL in BINARY mode")));
 
+	if (cstate->binary && cstate->nworkers > 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_SYNTAX_ERROR),
+				 errmsg("cannot specify PARALLEL in BINARY mode")));
+
 	/* Set defaults for omitted options */
 	if (!cstate->delim)
 		cstate->delim = cstate->csv_mode ? "," : "\t";
@@ -1430,6 +1540,12 @@ ProcessCopyOptions(ParseState *pstate,
 				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
 				 errmsg("COPY force null only available using COPY FROM")));
 
+	/* Check parallel */
+	if (cstate->nworkers > 0 && !is_from)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("COPY parallel only available using COPY FROM")));
+
 	/* Don't allow the delimiter to appear in the null string. */
 	if (strchr(cstate->null_print, cstate->delim[0]) != NULL)
 		ereport(ERROR,
@@ -2672,6 +2788,8 @@ CopyFrom(CopyState cstate)
 	bool		has_before_insert_row_trig;
 	bool		has_instead_insert_row_trig;
 	bool		leafpart_use_multi_insert = false;
+	bool		use_parallel = false;
+	bool		parallel_done = false;
 
 	Assert(cstate->rel);
 
@@ -2819,6 +2937,10 @@ CopyFrom(CopyState cstate)
 		ti_options |= TABLE_INSERT_FROZEN;
 	}
 
+	/* In a parallel COPY worker, use the options the leader decided on */
+	if (cstate->pcopy != NULL)
+		ti_options = cstate->pcopy->shared->ti_options | TABLE_INSERT_PARALLEL;
+
 	/*
 	 * We need a ResultRelInfo so we can use the regular executor's
 	 * index-entry-making machinery.  (There used to be a huge amount of code
@@ -2963,6 +3085,13 @@ CopyFrom(CopyState cstate)
 
 		CopyMultiInsertInfoInit(&multiInsertInfo, resultRelInfo, cstate,
 								estate, mycid, ti_options);
+
+		/*
+		 * Parallel workers each run this function in multi-insert mode, so
+		 * only consider using them if we got this far.
+		 */
+		if (insertMethod == CIM_MULTI && cstate->nworkers > 0)
+			use_parallel = CopyFromParallelOK(cstate, resultRelInfo);
 	}
 
 	/*
@@ -2989,8 +3118,11 @@ CopyFrom(CopyState cstate)
 	 * should do this for COPY, since it's not really an "INSERT" statement as
 	 * such. However, executing these triggers maintains consistency with the
 	 * EACH ROW triggers that we already fire on COPY.
+	 *
+	 * Statement-level triggers are fired by the leader of a parallel COPY.
 	 */
-	ExecBSInsertTriggers(estate, resultRelInfo);
+	if (cstate->pcopy == NULL)
+		ExecBSInsertTriggers(estate, resultRelInfo);
 
 	econtext = GetPerTupleExprContext(estate);
 
@@ -3000,7 +3132,14 @@ CopyFrom(CopyState cstate)
 	errcallback.previous = error_context_stack;
 	error_context_stack = &errcallback;
 
-	for (;;)
+	/*
+	 * Hand the input over to parallel workers, if possible.  If none could be
+	 * launched, carry on loading it ourselves.
+	 */
+	if (use_parallel)
+		parallel_done = ParallelCopyFrom(cstate, ti_options, &processed);
+
+	while (!parallel_done)
 	{
 		TupleTableSlot *myslot;
 		bool		skip_tuple;
@@ -3342,7 +3481,9 @@ CopyFrom(CopyState cstate)
 		pq_endmsgread();
 
 	/* Execute AFTER STATEMENT insertion triggers */
-	ExecASInsertTriggers(estate, target_resultRelInfo, cstate->transition_capture);
+	if (cstate->pcopy == NULL)
+		ExecASInsertTriggers(estate, target_resultRelInfo,
+							 cstate->transition_capture);
 
 	/* Handle queued AFTER triggers */
 	AfterTriggerEndQuery(estate);
@@ -3366,11 +3507,511 @@ CopyFrom(CopyState cstate)
 
 	FreeExecutorState(estate);
 
-	table_finish_bulk_insert(cstate->rel, ti_options);
+	/* The leader of a parallel COPY finishes the bulk insert for everyone */
+	if (cstate->pcopy == NULL)
+		table_finish_bulk_insert(cstate->rel, ti_options);
 
 	return processed;
 }
 
+/*
+ * Can the rows of this COPY FROM be inserted by parallel workers?
+ *
+ * The caller has already established that multi-inserts can be used, which
+ * rules out BEFORE and INSTEAD OF row triggers, foreign and partitioned
+ * tables, and volatile default expressions and WHERE clauses.  Workers also
+ * have to be able to do everything else a serial COPY would do for each row,
+ * so we insist on a heap table without any AFTER row triggers, and on
+ * parallel-safe input functions and expressions.  If anything is doubtful,
+ * we just do the COPY serially.
+ */
+static bool
+CopyFromParallelOK(CopyState cstate, ResultRelInfo *resultRelInfo)
+{
+	Relation	rel = cstate->rel;
+	TupleDesc	tupDesc = RelationGetDescr(rel);
+	TriggerDesc *trigdesc = rel->trigdesc;
+	ListCell   *cur;
+	int			i;
+
+	if (!IsUnderPostmaster || max_parallel_workers == 0)
+		return false;
+
+	/*
+	 * Only the heap AM knows how to insert from a parallel worker, and
+	 * workers can't see the leader's local buffers.
+	 */
+	if (rel->rd_rel->relkind != RELKIND_RELATION ||
+		rel->rd_tableam != GetHeapamTableAmRoutine() ||
+		RelationUsesLocalBuffers(rel))
+		return false;
+
+	/* Predicate locks taken by workers would not be visible to the leader */
+	if (IsolationIsSerializable())
+		return false;
+
+	/* This also covers foreign keys and deferred uniqueness checks */
+	if (trigdesc != NULL &&
+		(trigdesc->trig_insert_after_row || trigdesc->trig_insert_new_table))
+		return false;
+
+	if (tupDesc->constr != NULL)
+	{
+		if (tupDesc->constr->has_generated_stored)
+			return false;
+
+		for (i = 0; i < tupDesc->constr->num_check; i++)
+		{
+			Node	   *checkexpr = stringToNode(tupDesc->constr->check[i].ccbin);
+
+			if (!is_parallel_safe_expr(checkexpr))
+				return false;
+		}
+	}
+
+	/* Input functions and domain constraints run in the workers */
+	foreach(cur, cstate->attnumlist)
+	{
+		int			attnum = lfirst_int(cur);
+		Form_pg_attribute att = TupleDescAttr(tupDesc, attnum - 1);
+
+		if (func_parallel(cstate->in_functions[attnum - 1].fn_oid) != PROPARALLEL_SAFE)
+			return false;
+		if (DomainHasConstraints(att->atttypid))
+			return false;
+	}
+
+	for (i = 0; i < cstate->num_defaults; i++)
+	{
+		if (!is_parallel_safe_expr((Node *) cstate->defexprs[i]->expr))
+			return false;
+	}
+
+	if (!is_parallel_safe_expr(cstate->whereClause))
+		return false;
+
+	for (i = 0; i < resultRelInfo->ri_NumIndices; i++)
+	{
+		IndexInfo  *ii = resultRelInfo->ri_IndexRelationInfo[i];
+
+		if (ii->ii_ExclusionOps != NULL)
+			return false;
+		if (!is_parallel_safe_expr((Node *) ii->ii_Expressions) ||
+			!is_parallel_safe_expr((Node *) ii->ii_Predicate))
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Per-leader state for filling chunks
+ */
+typedef struct ParallelCopyLeader
+{
+	ParallelCopyShared *shared;
+	int			cur;			/* index of the chunk we fill next */
+	ParallelCopyChunk *chunk;	/* chunk being filled, or NULL */
+} ParallelCopyLeader;
+
+/*
+ * Wait for the next chunk in order to become free and start filling it.
+ */
+static void
+ParallelCopyStartChunk(ParallelCopyLeader *pl, bool continuation)
+{
+	ParallelCopyShared *shared = pl->shared;
+	ParallelCopyChunk *chunk = &shared->chunks[pl->cur];
+
+	for (;;)
+	{
+		bool		isfree;
+
+		SpinLockAcquire(&shared->mutex);
+		isfree = (chunk->state == PCOPY_CHUNK_FREE);
+		SpinLockRelease(&shared->mutex);
+		if (isfree)
+			break;
+		ConditionVariableSleep(&shared->freed_cv, WAIT_EVENT_PARALLEL_COPY_FREE);
+	}
+	ConditionVariableCancelSleep();
+
+	chunk->continuation = continuation;
+	chunk->len = 0;
+	pl->chunk = chunk;
+}
+
+/*
+ * Hand the chunk being filled over to the workers.
+ */
+static void
+ParallelCopyQueueChunk(ParallelCopyLeader *pl)
+{
+	ParallelCopyShared *shared = pl->shared;
+
+	SpinLockAcquire(&shared->mutex);
+	pl->chunk->state = PCOPY_CHUNK_FILLED;
+	SpinLockRelease(&shared->mutex);
+	ConditionVariableBroadcast(&shared->filled_cv);
+
+	pl->cur = (pl->cur + 1) % shared->nchunks;
+	pl->chunk = NULL;
+}
+
+/*
+ * Append a line to the chunk being filled, starting new chunks as needed.
+ */
+static void
+ParallelCopyPutLine(ParallelCopyLeader *pl, uint64 lineno,
+					const char *data, uint32 len)
+{
+	ParallelCopyLineHeader hdr;
+
+	if (pl->chunk != NULL &&
+		pl->chunk->len + sizeof(hdr) > PARALLEL_COPY_CHUNK_SIZE)
+		ParallelCopyQueueChunk(pl);
+	if (pl->chunk == NULL)
+		ParallelCopyStartChunk(pl, false);
+
+	hdr.lineno = lineno;
+	hdr.len = len;
+	memcpy(pl->chunk->data + pl->chunk->len, &hdr, sizeof(hdr));
+	pl->chunk->len += sizeof(hdr);
+
+	for (;;)
+	{
+		uint32		n = Min(len, PARALLEL_COPY_CHUNK_SIZE - pl->chunk->len);
+
+		memcpy(pl->chunk->data + pl->chunk->len, data, n);
+		pl->chunk->len += n;
+		data += n;
+		len -= n;
+		if (len == 0)
+			break;
+
+		/* The rest of the line goes to the next chunk */
+		ParallelCopyQueueChunk(pl);
+		ParallelCopyStartChunk(pl, true);
+	}
+}
+
+/*
+ * Load the input with the help of parallel workers.
+ *
+ * Called by CopyFrom() in the leader, after the target relation and the
+ * statement-level triggers have been taken care of.  Returns false if no
+ * workers could be launched, in which case nothing has been read and the
+ * caller has to load the data itself.  Otherwise, all input has been
+ * consumed and *processed is set to the number of rows the workers
+ * inserted.
+ */
+static bool
+ParallelCopyFrom(CopyState cstate, int ti_options, uint64 *processed)
+{
+	ParallelContext *pcxt;
+	ParallelCopyShared *shared;
+	ParallelCopyLeader pl;
+	char	   *state;
+	char	   *sharedstate;
+	Size		estshared;
+	int			nworkers;
+	int			nchunks;
+	int			statelen;
+	int			querylen = 0;
+	int			nkeys = 2;
+	int			i;
+	bool		done = false;
+
+	nworkers = Min(cstate->nworkers, max_parallel_workers);
+	Assert(nworkers > 0);
+
+	/*
+	 * Workers share our transaction and command IDs, but can't assign them,
+	 * so make sure both exist before entering parallel mode.
+	 */
+	(void) GetCurrentTransactionId();
+	(void) GetCurrentCommandId(true);
+
+	EnterParallelMode();
+	pcxt = CreateParallelContext("postgres", "ParallelCopyMain", nworkers);
+
+	nchunks = nworkers * PARALLEL_COPY_CHUNKS_PER_WORKER;
+	estshared = add_size(offsetof(ParallelCopyShared, chunks),
+						 mul_size(nchunks, sizeof(ParallelCopyChunk)));
+	shm_toc_estimate_chunk(&pcxt->estimator, estshared);
+
+	/* Workers set up their own CopyState from the same input */
+	state = nodeToString(list_make4(cstate->options, cstate->attnamelist,
+									cstate->whereClause, cstate->range_table));
+	statelen = strlen(state);
+	shm_toc_estimate_chunk(&pcxt->estimator, statelen + 1);
+
+	if (debug_query_string)
+	{
+		querylen = strlen(debug_query_string);
+		shm_toc_estimate_chunk(&pcxt->estimator, querylen + 1);
+		nkeys++;
+	}
+	shm_toc_estimate_keys(&pcxt->estimator, nkeys);
+
+	InitializeParallelDSM(pcxt);
+
+	shared = (ParallelCopyShared *) shm_toc_allocate(pcxt->toc, estshared);
+	shared->relid = RelationGetRelid(cstate->rel);
+	shared->ti_options = ti_options;
+	shared->nchunks = nchunks;
+	SpinLockInit(&shared->mutex);
+	shared->next_chunk = 0;
+	shared->eof = false;
+	shared->processed = 0;
+	ConditionVariableInit(&shared->filled_cv);
+	ConditionVariableInit(&shared->freed_cv);
+	for (i = 0; i < nchunks; i++)
+		shared->chunks[i].state = PCOPY_CHUNK_FREE;
+	shm_toc_insert(pcxt->toc, PARALLEL_KEY_COPY_SHARED, shared);
+
+	sharedstate = (char *) shm_toc_allocate(pcxt->toc, statelen + 1);
+	memcpy(sharedstate, state, statelen + 1);
+	shm_toc_insert(pcxt->toc, PARALLEL_KEY_COPY_STATE, sharedstate);
+
+	if (debug_query_string)
+	{
+		char	   *sharedquery;
+
+		sharedquery = (char *) shm_toc_allocate(pcxt->toc, querylen + 1);
+		memcpy(sharedquery, debug_query_string, querylen + 1);
+		shm_toc_insert(pcxt->toc, PARALLEL_KEY_QUERY_TEXT, sharedquery);
+	}
+
+	LaunchParallelWorkers(pcxt);
+
+	/* If no workers were successfully launched, back out */
+	if (pcxt->nworkers_launched == 0)
+	{
+		WaitForParallelWorkersToFinish(pcxt);
+		DestroyParallelContext(pcxt);
+		ExitParallelMode();
+		return false;
+	}
+
+	/* Make sure that the failure-to-start case will not hang forever. */
+	WaitForParallelWorkersToAttach(pcxt);
+
+	pl.shared = shared;
+	pl.cur = 0;
+	pl.chunk = NULL;
+
+	/* on input just throw the header line away */
+	if (cstate->header_line)
+	{
+		cstate->cur_lineno++;
+		done = CopyReadLine(cstate);
+	}
+
+	while (!done)
+	{
+		CHECK_FOR_INTERRUPTS();
+
+		cstate->cur_lineno++;
+		done = CopyReadLine(cstate);
+
+		/* See NextCopyFromRawFields */
+		if (done && cstate->line_buf.len == 0)
+			break;
+
+		ParallelCopyPutLine(&pl, cstate->cur_lineno,
+							cstate->line_buf.data, cstate->line_buf.len);
+	}
+	cstate->line_buf_valid = false;
+
+	if (pl.chunk != NULL)
+		ParallelCopyQueueChunk(&pl);
+
+	SpinLockAcquire(&shared->mutex);
+	shared->eof = true;
+	SpinLockRelease(&shared->mutex);
+	ConditionVariableBroadcast(&shared->filled_cv);
+
+	WaitForParallelWorkersToFinish(pcxt);
+	*processed = shared->processed;
+
+	DestroyParallelContext(pcxt);
+	ExitParallelMode();
+
+	return true;
+}
+
+/*
+ * Take the next chunk from the queue into the worker's private buffer.
+ *
+ * If 'continuation' is true, we hold the first part of a line and need the
+ * chunk with the rest of it; otherwise we need a chunk that starts with a new
+ * line.  Returns false if the leader has reached the end of the input.
+ */
+static bool
+ParallelCopyTakeChunk(ParallelCopyWorker *pw, bool continuation)
+{
+	ParallelCopyShared *shared = pw->shared;
+	ParallelCopyChunk *chunk;
+
+	for (;;)
+	{
+		bool		eof;
+
+		SpinLockAcquire(&shared->mutex);
+		chunk = &shared->chunks[shared->next_chunk];
+		if (chunk->state == PCOPY_CHUNK_FILLED &&
+			chunk->continuation == continuation)
+		{
+			chunk->state = PCOPY_CHUNK_BUSY;
+			shared->next_chunk = (shared->next_chunk + 1) % shared->nchunks;
+			SpinLockRelease(&shared->mutex);
+			break;
+		}
+		eof = shared->eof && chunk->state != PCOPY_CHUNK_FILLED;
+		SpinLockRelease(&shared->mutex);
+
+		if (eof)
+		{
+			ConditionVariableCancelSleep();
+			if (continuation)
+				elog(ERROR, "parallel COPY input ended in the middle of a line");
+			return false;
+		}
+		ConditionVariableSleep(&shared->filled_cv,
+							   WAIT_EVENT_PARALLEL_COPY_INPUT);
+	}
+	ConditionVariableCancelSleep();
+
+	/*
+	 * Other workers may be waiting behind the continuation chunk we just
+	 * took for a chunk that is already filled.
+	 */
+	if (continuation)
+		ConditionVariableBroadcast(&shared->filled_cv);
+
+	memcpy(pw->buf, chunk->data, chunk->len);
+	pw->len = chunk->len;
+	pw->pos = 0;
+
+	SpinLockAcquire(&shared->mutex);
+	chunk->state = PCOPY_CHUNK_FREE;
+	SpinLockRelease(&shared->mutex);
+	ConditionVariableSignal(&shared->freed_cv);
+
+	return true;
+}
+
+/*
+ * Read the next line in a parallel COPY worker and stash it in line_buf.
+ *
+ * This is the counterpart of CopyReadLine; the line has already been
+ * converted to the server encoding by the leader.  Returns false if there
+ * are no more lines.
+ */
+static bool
+ParallelCopyReadLine(CopyState cstate)
+{
+	ParallelCopyWorker *pw = cstate->pcopy;
+	ParallelCopyLineHeader hdr;
+	uint32		remaining;
+
+	if (pw->pos >= pw->len && !ParallelCopyTakeChunk(pw, false))
+		return false;
+
+	Assert(pw->len - pw->pos >= sizeof(hdr));
+	memcpy(&hdr, pw->buf + pw->pos, sizeof(hdr));
+	pw->pos += sizeof(hdr);
+
+	resetStringInfo(&cstate->line_buf);
+	cstate->cur_lineno = hdr.lineno;
+	remaining = hdr.len;
+	for (;;)
+	{
+		uint32		n = Min(remaining, pw->len - pw->pos);
+
+		appendBinaryStringInfo(&cstate->line_buf, pw->buf + pw->pos, n);
+		pw->pos += n;
+		remaining -= n;
+		if (remaining == 0)
+			break;
+		(void) ParallelCopyTakeChunk(pw, true);
+	}
+
+	cstate->line_buf_valid = true;
+	cstate->line_buf_converted = true;
+
+	return true;
+}
+
+/*
+ * Data source callback for parallel COPY workers, which never read the input
+ * themselves.
+ */
+static int
+ParallelCopyNoData(void *outbuf, int minread, int maxread)
+{
+	elog(ERROR, "parallel COPY worker cannot read input");
+	return 0;					/* keep compiler quiet */
+}
+
+/*
+ * Perform work within a launched parallel process.
+ */
+void
+ParallelCopyMain(dsm_segment *seg, shm_toc *toc)
+{
+	ParallelCopyShared *shared;
+	ParallelCopyWorker *pw;
+	CopyState	cstate;
+	Relation	rel;
+	List	   *state;
+	char	   *sharedquery;
+	uint64		processed;
+
+	/* Set debug_query_string for individual workers first */
+	sharedquery = shm_toc_lookup(toc, PARALLEL_KEY_QUERY_TEXT, true);
+	debug_query_string = sharedquery;
+
+	/* Report the query string from leader */
+	pgstat_report_activity(STATE_RUNNING, debug_query_string);
+
+	shared = shm_toc_lookup(toc, PARALLEL_KEY_COPY_SHARED, false);
+	state = (List *) stringToNode(shm_toc_lookup(toc, PARALLEL_KEY_COPY_STATE,
+												 false));
+
+	/*
+	 * Open the relation with the lock mode obtained by DoCopy; the leader
+	 * already holds it, so we won't conflict with it.
+	 */
+	rel = table_open(shared->relid, RowExclusiveLock);
+
+	cstate = BeginCopyFrom(NULL, rel, NULL, false, ParallelCopyNoData,
+						   (List *) lsecond(state), (List *) linitial(state));
+	cstate->whereClause = (Node *) lthird(state);
+	cstate->range_table = (List *) lfourth(state);
+
+	/* The leader has dealt with these */
+	cstate->freeze = false;
+	cstate->header_line = false;
+	cstate->nworkers = 0;
+
+	pw = (ParallelCopyWorker *) palloc(sizeof(ParallelCopyWorker));
+	pw->shared = shared;
+	pw->buf = (char *) palloc(PARALLEL_COPY_CHUNK_SIZE);
+	pw->len = pw->pos = 0;
+	cstate->pcopy = pw;
+
+	processed = CopyFrom(cstate);
+
+	EndCopyFrom(cstate);
+	table_close(rel, RowExclusiveLock);
+
+	SpinLockAcquire(&shared->mutex);
+	shared->processed += processed;
+	SpinLockRelease(&shared->mutex);
+}
+
 /*
  * Setup to read tuples from a file for COPY FROM.
  *
@@ -3426,6 +4067,10 @@ BeginCopyFrom(ParseState *pstate,
 	if (pstate)
 		cstate->range_table = pstate->p_rtable;
 
+	/* Remember these in case we launch parallel workers */
+	cstate->attnamelist = attnamelist;
+	cstate->options = options;
+
 	tupDesc = RelationGetDescr(cstate->rel);
 	num_phys_attrs = tupDesc->natts;
 	num_defaults = 0;
@@ -3639,26 +4284,35 @@ NextCopyFromRawFields(CopyState cstate, char ***fields, int *nfields)
 	/* only available for text or csv input */
 	Assert(!cstate->binary);
 
-	/* on input just throw the header line away */
-	if (cstate->cur_lineno == 0 && cstate->header_line)
+	if (cstate->pcopy != NULL)
 	{
-		cstate->cur_lineno++;
-		if (CopyReadLine(cstate))
-			return false;		/* done */
+		/* In a parallel COPY worker, the leader has split the input */
+		if (!ParallelCopyReadLine(cstate))
+			return false;
 	}
+	else
+	{
+		/* on input just throw the header line away */
+		if (cstate->cur_lineno == 0 && cstate->header_line)
+		{
+			cstate->cur_lineno++;
+			if (CopyReadLine(cstate))
+				return false;	/* done */
+		}
 
-	cstate->cur_lineno++;
+		cstate->cur_lineno++;
 
-	/* Actually read the line into memory here */
-	done = CopyReadLine(cstate);
+		/* Actually read the line into memory here */
+		done = CopyReadLine(cstate);
 
-	/*
-	 * EOF at start of line means we're done.  If we see EOF after some
-	 * characters, we act as though it was newline followed by EOF, ie,
-	 * process the line and then exit loop on next iteration.
-	 */
-	if (done && cstate->line_buf.len == 0)
-		return false;
+		/*
+		 * EOF at start of line means we're done.  If we see EOF after some
+		 * characters, we act as though it was newline followed by EOF, ie,
+		 * process the line and then exit loop on next iteration.
+		 */
+		if (done && cstate->line_buf.len == 0)
+			return false;
+	}
 
 	/* Parse the line into de-escaped field values */
 	if (cstate->csv_mode)
@@ -80,6 +80,8 @@ static void show_upper_qual(List *qual, const char *qlabel,
 							ExplainState *es);
 static void show_sort_keys(SortState *sortstate, List *ancestors,
 						   ExplainState *es);
+static void show_incremental_sort_keys(IncrementalSortState *incrsortstate,
+									   List *ancestors, ExplainState *es);
 static void show_merge_append_keys(MergeAppendState *mstate, List *ancestors,
 								   ExplainState *es);
 static void show_agg_keys(AggState *astate, List *ancestors,
@@ -101,7 +103,11 @@ static void show_sortorder_options(StringInfo buf, Node *sortexpr,
 static void show_tablesample(TableSampleClause *tsc, PlanState *planstate,
 							 List *ancestors, ExplainState *es);
 static void show_sort_info(SortState *sortstate, ExplainState *es);
+static void show_incremental_sort_info(IncrementalSortState *incrsortstate,
+									   ExplainState *es);
 static void show_hash_info(HashState *hashstate, ExplainState *es);
+static void show_memoize_info(MemoizeState *mstate, List *ancestors,
+							  ExplainState *es);
 static void show_tidbitmap_info(BitmapHeapScanState *planstate,
 								ExplainState *es);
 static void show_instrumentation_count(const char *qlabel, int which,
@@ -1212,9 +1218,15 @@ ExplainNode(PlanState *planstate, List *ancestors,
 		case T_Material:
 			pname = sname = "Materialize";
 			break;
+		case T_Memoize:
+			pname = sname = "Memoize";
+			break;
 		case T_Sort:
 			pname = sname = "Sort";
 			break;
+		case T_IncrementalSort:
+			pname = sname = "Incremental Sort";
+			break;
 		case T_Group:
 			pname = sname = "Group";
 			break;
@@ -1319,6 +1331,8 @@ ExplainNode(PlanState *planstate, List *ancestors,
 		}
 		if (plan->parallel_aware)
 			appendStringInfoString(es->str, "Parallel ");
+		if (plan->async_capable)
+			appendStringInfoString(es->str, "Async ");
 		appendStringInfoString(es->str, pname);
 		es->indent++;
 	}
@@ -1338,6 +1352,7 @@ ExplainNode(PlanState *planstate, List *ancestors,
 		if (custom_name)
 			ExplainPropertyText("Custom Plan Provider", custom_name, es);
 		ExplainPropertyBool("Parallel Aware", plan->parallel_aware, es);
+		ExplainPropertyBool("Async Capable", plan->async_capable, es);
 	}
 
 	switch (nodeTag(plan))
@@ -1584,6 +1599,8 @@ ExplainNode(PlanState *planstate, List *ancestors,
 		case T_IndexScan:
 			show_scan_qual(((IndexScan *) plan)->indexqualorig,
 						   "Index Cond", planstate, ancestors, es);
+			if (((IndexScan *) plan)->indexskipscan)
+				ExplainPropertyBool("Skip Scan", true, es);
 			if (((IndexScan *) plan)->indexqualorig)
 				show_instrumentation_count("Rows Removed by Index Recheck", 2,
 										   planstate, es);
@@ -1597,6 +1614,8 @@ ExplainNode(PlanState *planstate, List *ancestors,
 		case T_IndexOnlyScan:
 			show_scan_qual(((IndexOnlyScan *) plan)->indexqual,
 						   "Index Cond", planstate, ancestors, es);
+			if (((IndexOnlyScan *) plan)->indexskipscan)
+				ExplainPropertyBool("Skip Scan", true, es);
 			if (((IndexOnlyScan *) plan)->indexqual)
 				show_instrumentation_count("Rows Removed by Index Recheck", 2,
 										   planstate, es);
@@ -1613,6 +1632,8 @@ ExplainNode(PlanState *planstate, List *ancestors,
 		case T_BitmapIndexScan:
 			show_scan_qual(((BitmapIndexScan *) plan)->indexqualorig,
 						   "Index Cond", planstate, ancestors, es);
+			if (((BitmapIndexScan *) plan)->indexskipscan)
+				ExplainPropertyBool("Skip Scan", true, es);
 			break;
 		case T_BitmapHeapScan:
 			show_scan_qual(((BitmapHeapScan *) plan)->bitmapqualorig,
@@ -1642,6 +1663,11 @@ ExplainNode(PlanState *planstate, List *ancestors,
 			if (plan->qual)
 				show_instrumentation_count("Rows Removed by Filter", 1,
 										   planstate, es);
+			/* only shown if a hash join pushed down a filter that was used */
+			if (IsA(plan, SeqScan) && planstate->instrument &&
+				planstate->instrument->nfiltered2 > 0)
+				show_instrumentation_count("Rows Removed by Runtime Filter", 2,
+										   planstate, es);
 			break;
 		case T_Gather:
 			{
@@ -1841,6 +1867,12 @@ ExplainNode(PlanState *planstate, List *ancestors,
 			show_sort_keys(castNode(SortState, planstate), ancestors, es);
 			show_sort_info(castNode(SortState, planstate), es);
 			break;
+		case T_IncrementalSort:
+			show_incremental_sort_keys(castNode(IncrementalSortState, planstate),
+									   ancestors, es);
+			show_incremental_sort_info(castNode(IncrementalSortState, planstate),
+									   es);
+			break;
 		case T_MergeAppend:
 			show_merge_append_keys(castNode(MergeAppendState, planstate),
 								   ancestors, es);
@@ -1860,6 +1892,10 @@ ExplainNode(PlanState *planstate, List *ancestors,
 		case T_Hash:
 			show_hash_info(castNode(HashState, planstate), es);
 			break;
+		case T_Memoize:
+			show_memoize_info(castNode(MemoizeState, planstate), ancestors,
+							  es);
+			break;
 		default:
 			break;
 	}
@@ -2181,6 +2217,28 @@ show_sort_keys(SortState *sortstate, List *ancestors, ExplainState *es)
 						 ancestors, es);
 }
 
+/*
+ * Show the sort keys for an Incremental Sort node, and which of them the
+ * input is already sorted by.
+ */
+static void
+show_incremental_sort_keys(IncrementalSortState *incrsortstate,
+						   List *ancestors, ExplainState *es)
+{
+	IncrementalSort *plan = (IncrementalSort *) incrsortstate->ss.ps.plan;
+
+	show_sort_group_keys((PlanState *) incrsortstate, "Sort Key",
+						 plan->sort.numCols, plan->sort.sortColIdx,
+						 plan->sort.sortOperators, plan->sort.collations,
+						 plan->sort.nullsFirst,
+						 ancestors, es);
+	show_sort_group_keys((PlanState *) incrsortstate, "Presorted Key",
+						 plan->nPresortedCols, plan->sort.sortColIdx,
+						 plan->sort.sortOperators, plan->sort.collations,
+						 plan->sort.nullsFirst,
+						 ancestors, es);
+}
+
 /*
  * Likewise, for a MergeAppend node.
  */
@@ -2612,6 +2670,104 @@ show_sort_info(SortState *sortstate, ExplainState *es)
 	}
 }
 
+/*
+ * If it's EXPLAIN ANALYZE, show the number of batches an incremental sort
+ * node has sorted
+ */
+static void
+show_incremental_sort_info(IncrementalSortState *incrsortstate,
+						   ExplainState *es)
+{
+	if (!es->analyze)
+		return;
+
+	ExplainPropertyInteger("Sort Batches", NULL, incrsortstate->n_batches, es);
+}
+
+/*
+ * Show the cache key of a Memoize node, and if it's EXPLAIN ANALYZE, how
+ * well the cache worked.
+ */
+static void
+show_memoize_info(MemoizeState *mstate, List *ancestors, ExplainState *es)
+{
+	Plan	   *plan = ((PlanState *) mstate)->plan;
+	ListCell   *lc;
+	List	   *context;
+	StringInfoData keystr;
+	char	   *separator = "";
+	bool		useprefix;
+	int64		memPeakKb;
+
+	initStringInfo(&keystr);
+
+	/*
+	 * It's hard to imagine having a memoize node with fewer than 2 RTEs, but
+	 * let's just keep the same useprefix logic as elsewhere in this file.
+	 */
+	useprefix = list_length(es->rtable) > 1 || es->verbose;
+
+	/* Set up deparsing context */
+	context = set_deparse_context_planstate(es->deparse_cxt,
+											(Node *) mstate,
+											ancestors);
+
+	foreach(lc, ((Memoize *) plan)->param_exprs)
+	{
+		Node	   *expr = (Node *) lfirst(lc);
+
+		appendStringInfoString(&keystr, separator);
+
+		appendStringInfoString(&keystr, deparse_expression(expr, context,
+														   useprefix, false));
+		separator = ", ";
+	}
+
+	ExplainPropertyText("Cache Key", keystr.data, es);
+
+	pfree(keystr.data);
+
+	if (!es->analyze)
+		return;
+
+	if (mstate->stats.cache_misses > 0)
+	{
+		/*
+		 * mem_peak is only set when we freed memory, so we must use mem_used
+		 * when mem_peak is 0.
+		 */
+		if (mstate->stats.mem_peak > 0)
+			memPeakKb = (mstate->stats.mem_peak + 1023) / 1024;
+		else
+			memPeakKb = (mstate->mem_used + 1023) / 1024;
+
+		if (es->format != EXPLAIN_FORMAT_TEXT)
+		{
+			ExplainPropertyInteger("Cache Hits", NULL,
+								   mstate->stats.cache_hits, es);
+			ExplainPropertyInteger("Cache Misses", NULL,
+								   mstate->stats.cache_misses, es);
+			ExplainPropertyInteger("Cache Evictions", NULL,
+								   mstate->stats.cache_evictions, es);
+			ExplainPropertyInteger("Cache Overflows", NULL,
+								   mstate->stats.cache_overflows, es);
+			ExplainPropertyInteger("Peak Memory Usage", "kB", memPeakKb,
+								   es);
+		}
+		else
+		{
+			appendStringInfoSpaces(es->str, es->indent * 2);
+			appendStringInfo(es->str,
+							 "Hits: " UINT64_FORMAT "  Misses: " UINT64_FORMAT "  Evictions: " UINT64_FORMAT "  Overflows: " UINT64_FORMAT "  Memory Usage: " INT64_FORMAT "kB\n",
+							 mstate->stats.cache_hits,
+							 mstate->stats.cache_misses,
+							 mstate->stats.cache_evictions,
+							 mstate->stats.cache_overflows,
+							 memPeakKb);
+		}
+	}
+}
+
 /*
  * Show information on hash buckets/batches.
  */
@@ -2856,6 +3012,9 @@ show_buffer_usage(ExplainState *es, const BufferUsage *usage)
 								  usage->shared_blks_read > 0 ||
 								  usage->shared_blks_dirtied > 0 ||
 								  usage->shared_blks_written > 0);
+		bool		has_undo = (usage->undo_blks_hit > 0 ||
+								usage->undo_blks_read > 0 ||
+								usage->undo_blks_dirtied > 0);
 		bool		has_local = (usage->local_blks_hit > 0 ||
 								 usage->local_blks_read > 0 ||
 								 usage->local_blks_dirtied > 0 ||
@@ -2866,7 +3025,7 @@ show_buffer_usage(ExplainState *es, const BufferUsage *usage)
 								  !INSTR_TIME_IS_ZERO(usage->blk_write_time));
 
 		/* Show only positive counter values. */
-		if (has_shared || has_local || has_temp)
+		if (has_shared || has_undo || has_local || has_temp)
 		{
 			appendStringInfoSpaces(es->str, es->indent * 2);
 			appendStringInfoString(es->str, "Buffers:");
@@ -2886,6 +3045,21 @@ show_buffer_usage(ExplainState *es, const BufferUsage *usage)
 				if (usage->shared_blks_written > 0)
 					appendStringInfo(es->str, " written=%ld",
 									 usage->shared_blks_written);
+				if (has_undo || has_local || has_temp)
+					appendStringInfoChar(es->str, ',');
+			}
+			if (has_undo)
+			{
+				appendStringInfoString(es->str, " undo");
+				if (usage->undo_blks_hit > 0)
+					appendStringInfo(es->str, " hit=%ld",
+									 usage->undo_blks_hit);
+				if (usage->undo_blks_read > 0)
+					appendStringInfo(es->str, " read=%ld",
+									 usage->undo_blks_read);
+				if (usage->undo_blks_dirtied > 0)
+					appendStringInfo(es->str, " dirtied=%ld",
+									 usage->undo_blks_dirtied);
 				if (has_local || has_temp)
 					appendStringInfoChar(es->str, ',');
 			}
@@ -2944,6 +3118,12 @@ show_buffer_usage(ExplainState *es, const BufferUsage *usage)
 							   usage->shared_blks_dirtied, es);
 		ExplainPropertyInteger("Shared Written Blocks", NULL,
 							   usage->shared_blks_written, es);
+		ExplainPropertyInteger("Undo Hit Blocks", NULL,
+							   usage->undo_blks_hit, es);
+		ExplainPropertyInteger("Undo Read Blocks", NULL,
+							   usage->undo_blks_read, es);
+		ExplainPropertyInteger("Undo Dirtied Blocks", NULL,
+							   usage->undo_blks_dirtied, es);
 		ExplainPropertyInteger("Local Hit Blocks", NULL,
 							   usage->local_blks_hit, es);
 		ExplainPropertyInteger("Local Read Blocks", NULL,
@@ -39,9 +39,11 @@
 #include "parser/parse_type.h"
 #include "storage/lmgr.h"
 #include "storage/proc.h"
+#include "storage/shmem.h"
 #include "storage/smgr.h"
 #include "utils/acl.h"
 #include "utils/builtins.h"
+#include "utils/hashutils.h"
 #include "utils/lsyscache.h"
 #include "utils/resowner.h"
 #include "utils/syscache.h"
@@ -82,6 +84,7 @@ typedef struct SeqTableData
 	/* if last != cached, we have not used up all the cached values */
 	int64		increment;		/* copy of sequence's increment field */
 	/* note that increment is zero until we first do nextval_internal() */
+	bool		shared_cache;	/* did nextval last use the shared cache? */
 } SeqTableData;
 
 typedef SeqTableData *SeqTable;
@@ -94,6 +97,36 @@ static HTAB *seqhashtab = NULL; /* hash table for SeqTable items */
  */
 static SeqTableData *last_used_seq = NULL;
 
+/*
+ * With shared_sequence_cache set, the values of sequences with CACHE 1 are
+ * handed out from ranges of up to SEQ_LOG_VALS values kept in shared memory.
+ * The backend that finds a sequence's range used up takes a new one from the
+ * sequence, with a single WAL record; the other backends take their values
+ * from the range under a shared lock with an atomic increment, without
+ * touching the sequence's buffer.  The values are still handed out in order,
+ * unlike with per-backend caching.
+ *
+ * The slots are direct-mapped by database and sequence OID, and a sequence
+ * just takes over the slot of another one.  The values left in a range that
+ * is replaced or invalidated are lost, as they would be in a crash.
+ */
+typedef struct SeqCacheSlot
+{
+	LWLock		lock;
+	Oid			dbid;			/* database of the sequence */
+	Oid			relid;			/* pg_class OID, or InvalidOid if unused */
+	Oid			filenode;		/* relfilenode the range was taken from */
+	int64		first;			/* first value of the range */
+	int64		increment;		/* step between values of the range */
+	uint32		nvalues;		/* number of values in the range */
+	pg_atomic_uint32 nused;		/* number of them handed out, or more */
+} SeqCacheSlot;
+
+/* GUC variable */
+int			shared_sequence_cache = 0;
+
+static SeqCacheSlot *SeqCacheSlots = NULL;
+
 static void fill_seq_with_data(Relation rel, HeapTuple tuple);
 static Relation lock_and_open_sequence(SeqTable seq);
 static void create_seq_hashtable(void);
@@ -107,6 +140,11 @@ static void init_params(ParseState *pstate, List *options, bool for_identity,
 						bool *need_seq_rewrite,
 						List **owned_by);
 static void do_setval(Oid relid, int64 next, bool iscalled);
+static int64 nextval_shared(Relation seqrel, int64 incby, int64 maxv,
+							int64 minv, bool cycle);
+static SeqCacheSlot *seq_cache_slot(Oid relid);
+static bool seq_cache_take(SeqCacheSlot *slot, Relation seqrel, int64 *result);
+static void seq_cache_invalidate(Oid relid);
 static void process_owned_by(Relation seqrel, List *owned_by, bool for_identity);
 
 
@@ -333,6 +371,8 @@ ResetSequence(Oid seq_relid)
 	/* Note that we do not change the currval() state */
 	elm->cached = elm->last;
 
+	seq_cache_invalidate(seq_relid);
+
 	relation_close(seq_rel, NoLock);
 }
 
@@ -478,6 +518,12 @@ AlterSequence(ParseState *pstate, AlterSeqStmt *stmt)
 	/* Note that we do not change the currval() state */
 	elm->cached = elm->last;
 
+	/*
+	 * The same goes for the shared cache.  No range can be taken again until
+	 * we commit, as nextval needs a lock that conflicts with ours.
+	 */
+	seq_cache_invalidate(relid);
+
 	/* If needed, rewrite the sequence relation itself */
 	if (need_seq_rewrite)
 	{
@@ -538,6 +584,8 @@ DeleteSequenceTuple(Oid relid)
 
 	ReleaseSysCache(tuple);
 	table_close(rel, RowExclusiveLock);
+
+	seq_cache_invalidate(relid);
 }
 
 /*
@@ -631,6 +679,29 @@ nextval_internal(Oid relid, bool check_permissions)
 		return elm->last;
 	}
 
+	/*
+	 * If the sequence's values came from the shared cache last time, try to
+	 * take one from its range without any catalog lookup.  Anything that
+	 * changes the sequence invalidates the range.
+	 */
+	if (elm->shared_cache)
+	{
+		SeqCacheSlot *slot = seq_cache_slot(relid);
+		bool		found;
+
+		LWLockAcquire(&slot->lock, LW_SHARED);
+		found = seq_cache_take(slot, seqrel, &result);
+		LWLockRelease(&slot->lock);
+
+		if (found)
+		{
+			elm->last = elm->cached = result;
+			relation_close(seqrel, NoLock);
+			last_used_seq = elm;
+			return result;
+		}
+	}
+
 	pgstuple = SearchSysCache1(SEQRELID, ObjectIdGetDatum(relid));
 	if (!HeapTupleIsValid(pgstuple))
 		elog(ERROR, "cache lookup failed for sequence %u", relid);
@@ -642,11 +713,27 @@ nextval_internal(Oid relid, bool check_permissions)
 	cycle = pgsform->seqcycle;
 	ReleaseSysCache(pgstuple);
 
+	elm->increment = incby;
+
+	/* Sequences without a cache of their own can use the shared one. */
+	elm->shared_cache = (SeqCacheSlots != NULL && cache == 1 &&
+						 seqrel->rd_rel->relpersistence != RELPERSISTENCE_TEMP);
+	if (elm->shared_cache)
+	{
+		result = nextval_shared(seqrel, incby, maxv, minv, cycle);
+
+		elm->last = elm->cached = result;
+		elm->last_valid = true;
+		last_used_seq = elm;
+
+		relation_close(seqrel, NoLock);
+
+		return result;
+	}
+
 	/* lock page' buffer and read tuple */
 	seq = read_seq_tuple(seqrel, &buf, &seqdatatuple);
 	page = BufferGetPage(buf);
-
-	elm->increment = incby;
 	last = next = result = seq->last_value;
 	fetch = cache;
 	log = seq->log_cnt;
@@ -826,6 +913,139 @@ nextval_internal(Oid relid, bool check_permissions)
 	return result;
 }
 
+/*
+ * Can another value follow "value" in a sequence without exceeding its
+ * MAXVALUE (for ascending sequences) or MINVALUE (for descending ones)?
+ */
+static inline bool
+seq_can_advance(int64 value, int64 incby, int64 maxv, int64 minv)
+{
+	if (incby > 0)
+		return !((maxv >= 0 && value > maxv - incby) ||
+				 (maxv < 0 && value + incby > maxv));
+	else
+		return !((minv < 0 && value < minv - incby) ||
+				 (minv >= 0 && value + incby < minv));
+}
+
+/*
+ * nextval_shared - nextval for a sequence whose values come from the shared
+ * sequence cache
+ *
+ * If the sequence's range has no values left, a new one is taken from the
+ * sequence and WAL-logged; see SeqCacheSlot.
+ */
+static int64
+nextval_shared(Relation seqrel, int64 incby, int64 maxv, int64 minv,
+			   bool cycle)
+{
+	SeqCacheSlot *slot = seq_cache_slot(RelationGetRelid(seqrel));
+	Buffer		buf;
+	HeapTupleData seqdatatuple;
+	Form_pg_sequence_data seq;
+	int64		first,
+				last;
+	uint32		nvalues;
+
+	LWLockAcquire(&slot->lock, LW_EXCLUSIVE);
+
+	/* Somebody may have taken a new range while we waited for the lock. */
+	if (seq_cache_take(slot, seqrel, &first))
+	{
+		LWLockRelease(&slot->lock);
+		return first;
+	}
+
+	/* lock page' buffer and read tuple */
+	seq = read_seq_tuple(seqrel, &buf, &seqdatatuple);
+
+	/* return last_value if not is_called */
+	first = seq->last_value;
+	if (seq->is_called)
+	{
+		if (seq_can_advance(first, incby, maxv, minv))
+			first += incby;
+		else if (cycle)
+			first = (incby > 0) ? minv : maxv;
+		else
+		{
+			char		buf[100];
+
+			snprintf(buf, sizeof(buf), INT64_FORMAT,
+					 (incby > 0) ? maxv : minv);
+			if (incby > 0)
+				ereport(ERROR,
+						(errcode(ERRCODE_SEQUENCE_GENERATOR_LIMIT_EXCEEDED),
+						 errmsg("nextval: reached maximum value of sequence \"%s\" (%s)",
+								RelationGetRelationName(seqrel), buf)));
+			else
+				ereport(ERROR,
+						(errcode(ERRCODE_SEQUENCE_GENERATOR_LIMIT_EXCEEDED),
+						 errmsg("nextval: reached minimum value of sequence \"%s\" (%s)",
+								RelationGetRelationName(seqrel), buf)));
+		}
+	}
+
+	/* The range stops short of the bound, a cycle starts a new one. */
+	last = first;
+	nvalues = 1;
+	while (nvalues < SEQ_LOG_VALS &&
+		   seq_can_advance(last, incby, maxv, minv))
+	{
+		last += incby;
+		nvalues++;
+	}
+
+	/* check the comment above nextval_internal()'s equivalent call. */
+	if (RelationNeedsWAL(seqrel))
+		GetTopTransactionId();
+
+	/* ready to change the on-disk (or really, in-buffer) tuple */
+	START_CRIT_SECTION();
+
+	seq->last_value = last;		/* last fetched number */
+	seq->is_called = true;
+	seq->log_cnt = 0;
+
+	MarkBufferDirty(buf);
+
+	/* XLOG stuff */
+	if (RelationNeedsWAL(seqrel))
+	{
+		xl_seq_rec	xlrec;
+		XLogRecPtr	recptr;
+		Page		page = BufferGetPage(buf);
+
+		XLogBeginInsert();
+		XLogRegisterBuffer(0, buf, REGBUF_WILL_INIT);
+
+		xlrec.node = seqrel->rd_node;
+		XLogRegisterData((char *) &xlrec, sizeof(xl_seq_rec));
+		XLogRegisterData((char *) seqdatatuple.t_data, seqdatatuple.t_len);
+
+		recptr = XLogInsert(RM_SEQ_ID, XLOG_SEQ_LOG);
+
+		PageSetLSN(page, recptr);
+	}
+
+	END_CRIT_SECTION();
+
+	UnlockReleaseBuffer(buf);
+
+	/* Publish the range, of which we take the first value. */
+	slot->dbid = MyDatabaseId;
+	slot->relid = RelationGetRelid(seqrel);
+	slot->filenode = seqrel->rd_node.relNode;
+	slot->first = first;
+	slot->increment = incby;
+	slot->nvalues = nvalues;
+	pg_atomic_write_u32(&slot->nused, 1);
+
+	LWLockRelease(&slot->lock);
+
+	return first;
+}
+
 Datum
 currval_oid(PG_FUNCTION_ARGS)
 {
@@ -915,6 +1135,7 @@ do_setval(Oid relid, int64 next, bool iscalled)
 	Form_pg_sequence_data seq;
 	HeapTuple	pgstuple;
 	Form_pg_sequence pgsform;
+	SeqCacheSlot *slot;
 	int64		maxv,
 				minv;
 
@@ -946,6 +1167,14 @@ do_setval(Oid relid, int64 next, bool iscalled)
 	 */
 	PreventCommandIfParallelMode("setval()");
 
+	/*
+	 * Keep other backends from taking a new range from the sequence in the
+	 * shared cache until we have invalidated the current one.
+	 */
+	slot = seq_cache_slot(relid);
+	if (slot)
+		LWLockAcquire(&slot->lock, LW_EXCLUSIVE);
+
 	/* lock page' buffer and read tuple */
 	seq = read_seq_tuple(seqrel, &buf, &seqdatatuple);
 
@@ -1011,6 +1240,13 @@ do_setval(Oid relid, int64 next, bool iscalled)
 
 	UnlockReleaseBuffer(buf);
 
+	if (slot)
+	{
+		if (slot->dbid == MyDatabaseId && slot->relid == relid)
+			slot->relid = InvalidOid;
+		LWLockRelease(&slot->lock);
+	}
+
 	relation_close(seqrel, NoLock);
 }
 
@@ -1127,6 +1363,7 @@ init_sequence(Oid relid, SeqTable *p_elm, Relation *p_rel)
 		elm->lxid = InvalidLocalTransactionId;
 		elm->last_valid = false;
 		elm->last = elm->cached = 0;
+		elm->shared_cache = false;
 	}
 
 	/*
@@ -1944,6 +2181,102 @@ ResetSequenceCaches(void)
 	last_used_seq = NULL;
 }
 
+/*
+ * Report shared-memory space needed by SequenceShmemInit.
+ */
+Size
+SequenceShmemSize(void)
+{
+	return mul_size(shared_sequence_cache, sizeof(SeqCacheSlot));
+}
+
+/*
+ * Allocate and initialize the shared sequence cache.
+ */
+void
+SequenceShmemInit(void)
+{
+	bool		found;
+	int			i;
+
+	if (shared_sequence_cache == 0)
+		return;
+
+	SeqCacheSlots = (SeqCacheSlot *)
+		ShmemInitStruct("Shared Sequence Cache", SequenceShmemSize(), &found);
+
+	if (!IsUnderPostmaster)
+	{
+		Assert(!found);
+
+		for (i = 0; i < shared_sequence_cache; i++)
+		{
+			LWLockInitialize(&SeqCacheSlots[i].lock, LWTRANCHE_SEQUENCE_CACHE);
+			SeqCacheSlots[i].relid = InvalidOid;
+			pg_atomic_init_u32(&SeqCacheSlots[i].nused, 0);
+		}
+	}
+	else
+		Assert(found);
+}
+
+/*
+ * Find the slot of a sequence of the current database in the shared cache,
+ * or NULL if the cache is disabled.
+ */
+static SeqCacheSlot *
+seq_cache_slot(Oid relid)
+{
+	uint32		hash;
+
+	if (SeqCacheSlots == NULL)
+		return NULL;
+
+	hash = hash_combine(murmurhash32(MyDatabaseId), murmurhash32(relid));
+
+	return &SeqCacheSlots[hash % shared_sequence_cache];
+}
+
+/*
+ * Take the next value of the range in a slot, if it is the range of the
+ * given sequence and has any values left.  The caller must hold the slot's
+ * lock, in either mode.
+ */
+static bool
+seq_cache_take(SeqCacheSlot *slot, Relation seqrel, int64 *result)
+{
+	uint32		n;
+
+	if (slot->dbid != MyDatabaseId ||
+		slot->relid != RelationGetRelid(seqrel) ||
+		slot->filenode != seqrel->rd_node.relNode)
+		return false;
+
+	n = pg_atomic_fetch_add_u32(&slot->nused, 1);
+	if (n >= slot->nvalues)
+		return false;
+
+	*result = slot->first + (int64) n * slot->increment;
+	return true;
+}
+
+/*
+ * Forget the range of a sequence in the shared cache, if it has one.
+ */
+static void
+seq_cache_invalidate(Oid relid)
+{
+	SeqCacheSlot *slot = seq_cache_slot(relid);
+
+	if (slot == NULL)
+		return;
+
+	LWLockAcquire(&slot->lock, LW_EXCLUSIVE);
+	if (slot->dbid == MyDatabaseId && slot->relid == relid)
+		slot->relid = InvalidOid;
+	LWLockRelease(&slot->lock);
+}
+
 /*
  * Mask a Sequence page before performing consistency checks on it.
  */
@@ -33,6 +33,7 @@
 #include "catalog/pg_type.h"
 #include "commands/dbcommands.h"
 #include "commands/defrem.h"
+#include "commands/tablespace.h"
 #include "commands/trigger.h"
 #include "executor/executor.h"
 #include "miscadmin.h"
@@ -47,6 +48,7 @@
 #include "partitioning/partdesc.h"
 #include "pgstat.h"
 #include "rewrite/rewriteManip.h"
+#include "storage/buffile.h"
 #include "storage/bufmgr.h"
 #include "storage/lmgr.h"
 #include "tcop/utility.h"
@@ -58,6 +60,7 @@
 #include "utils/lsyscache.h"
 #include "utils/memutils.h"
 #include "utils/rel.h"
+#include "utils/resowner.h"
 #include "utils/snapmgr.h"
 #include "utils/syscache.h"
 #include "utils/tuplestore.h"
@@ -3691,29 +3694,51 @@ typedef struct AfterTriggerEventDataZeroCtids
  * array).  The space between CHUNK_DATA_START and freeptr is occupied by
  * AfterTriggerEventData records; the space between endfree and endptr is
  * occupied by AfterTriggerSharedData records.
+ *
+ * The data of a chunk is allocated separately from its header, so that once
+ * the event lists outgrow work_mem the data of chunks that are not the tail
+ * of their list can be written out to a temporary file and freed, leaving
+ * the header in the list.  Since an event links to its shared record by a
+ * relative offset, the data can be read back anywhere in memory.  A spilled
+ * chunk has data == NULL, and must be read back in with
+ * afterTriggerLoadChunk before its events are looked at; the iteration
+ * macros below take care of that.
  */
 typedef struct AfterTriggerEventChunk
 {
 	struct AfterTriggerEventChunk *next;	/* list link */
+	char	   *data;			/* start of chunk data, or NULL if spilled */
 	char	   *freeptr;		/* start of free space in chunk */
 	char	   *endfree;		/* end of free space in chunk */
 	char	   *endptr;			/* end of chunk */
-	/* event data follows here */
+	Size		size;			/* allocated size of chunk data */
+	int			pinned;			/* # of scans firing events of this chunk */
+	/* copy of the chunk in the spill file, if spill_space > 0: */
+	int			spill_fileno;	/* position of the copy in the file */
+	off_t		spill_offset;
+	Size		spill_space;	/* space reserved for the copy */
+	Size		spill_events;	/* when spilled, bytes of event records */
+	Size		spill_shared;	/* when spilled, bytes of shared records */
 } AfterTriggerEventChunk;
 
-#define CHUNK_DATA_START(cptr) ((char *) (cptr) + MAXALIGN(sizeof(AfterTriggerEventChunk)))
+#define CHUNK_DATA_START(cptr) ((cptr)->data)
 
-/* A list of events */
+/*
+ * A list of events.  tailfree is kept as an offset rather than a pointer,
+ * since the tail chunk saved in a copy of the list might be spilled and read
+ * back at a different address before the copy is restored.
+ */
 typedef struct AfterTriggerEventList
 {
 	AfterTriggerEventChunk *head;
 	AfterTriggerEventChunk *tail;
-	char	   *tailfree;		/* freeptr of tail chunk */
+	Size		tailfree;		/* offset of freeptr of tail chunk */
 } AfterTriggerEventList;
 
 /* Macros to help in iterating over a list of events */
 #define for_each_chunk(cptr, evtlist) \
-	for (cptr = (evtlist).head; cptr != NULL; cptr = cptr->next)
+	for (cptr = afterTriggerLoadChunk((evtlist).head); cptr != NULL; \
+		 cptr = afterTriggerNextChunk(cptr))
 #define for_each_event(eptr, cptr) \
 	for (eptr = (AfterTriggerEvent) CHUNK_DATA_START(cptr); \
 		 (char *) eptr < (cptr)->freeptr; \
@@ -3722,9 +3747,12 @@ typedef struct AfterTriggerEventList
 #define for_each_event_chunk(eptr, cptr, evtlist) \
 	for_each_chunk(cptr, evtlist) for_each_event(eptr, cptr)
 
-/* Macros for iterating from a start point that might not be list start */
+/*
+ * Macros for iterating from a start point that might not be list start.
+ * The chunk at the start point must have been loaded already.
+ */
 #define for_each_chunk_from(cptr) \
-	for (; cptr != NULL; cptr = cptr->next)
+	for (; cptr != NULL; cptr = afterTriggerNextChunk(cptr))
 #define for_each_event_from(eptr, cptr) \
 	for (; \
 		 (char *) eptr < (cptr)->freeptr; \
@@ -3751,6 +3779,11 @@ typedef struct AfterTriggerEventList
  * end of the list, so it is relatively easy to discard them.  The event
  * list chunks themselves are stored in event_cxt.
  *
+ * event_mem is the total size of the chunk data of all event lists that is
+ * currently held in memory.  Once it exceeds work_mem, chunks that are not
+ * the tail of their list are written to spill_file as they are passed over;
+ * spill_end_fileno and spill_end_offset give the end of the file's data.
+ *
  * query_depth is the current depth of nested AfterTriggerBeginQuery calls
  * (-1 when the stack is empty).
  *
@@ -3816,6 +3849,10 @@ typedef struct AfterTriggersData
 	SetConstraintState state;	/* the active S C state */
 	AfterTriggerEventList events;	/* deferred-event list */
 	MemoryContext event_cxt;	/* memory context for events, if any */
+	Size		event_mem;		/* bytes of chunk data held in memory */
+	BufFile    *spill_file;		/* temp file for spilled chunks, if any */
+	int			spill_end_fileno;	/* end of data in spill_file */
+	off_t		spill_end_offset;
 
 	/* per-query-level data: */
 	AfterTriggersQueryData *query_stack;	/* array of structs shown below */
@@ -3868,6 +3905,10 @@ static void AfterTriggerExecute(EState *estate,
 								MemoryContext per_tuple_context,
 								TupleTableSlot *trig_tuple_slot1,
 								TupleTableSlot *trig_tuple_slot2);
+static AfterTriggerEventChunk *afterTriggerLoadChunk(AfterTriggerEventChunk *chunk);
+static AfterTriggerEventChunk *afterTriggerNextChunk(AfterTriggerEventChunk *chunk);
+static void afterTriggerMaybeSpillChunk(AfterTriggerEventChunk *chunk);
+static void afterTriggerFreeChunk(AfterTriggerEventChunk *chunk);
 static AfterTriggersTableData *GetAfterTriggersTableData(Oid relid,
 														 CmdType cmdType);
 static void AfterTriggerFreeQuery(AfterTriggersQueryData *qs);
@@ -3957,6 +3998,179 @@ afterTriggerCheckState(AfterTriggerShared evtshared)
 }
 
 
+/* ----------
+ * afterTriggerGetSpillFile()
+ *
+ *	Return the temporary file that event chunks are spilled to, creating it
+ *	if necessary.  It lives until the end of the top-level transaction.
+ * ----------
+ */
+static BufFile *
+afterTriggerGetSpillFile(void)
+{
+	if (afterTriggers.spill_file == NULL)
+	{
+		MemoryContext oldcxt;
+		ResourceOwner saveResourceOwner;
+
+		oldcxt = MemoryContextSwitchTo(TopTransactionContext);
+		saveResourceOwner = CurrentResourceOwner;
+		CurrentResourceOwner = TopTransactionResourceOwner;
+
+		PrepareTempTablespaces();
+		afterTriggers.spill_file = BufFileCreateTemp(false);
+		afterTriggers.spill_end_fileno = 0;
+		afterTriggers.spill_end_offset = 0;
+
+		CurrentResourceOwner = saveResourceOwner;
+		MemoryContextSwitchTo(oldcxt);
+	}
+	return afterTriggers.spill_file;
+}
+
+/* ----------
+ * afterTriggerSpillChunk()
+ *
+ *	Write the data of an event chunk to the spill file and free it.  The
+ *	space the chunk had in the file before is reused if it is big enough,
+ *	which it is unless the chunk has been a list's tail in the meantime.
+ * ----------
+ */
+static void
+afterTriggerSpillChunk(AfterTriggerEventChunk *chunk)
+{
+	BufFile    *file = afterTriggerGetSpillFile();
+	Size		nevents = chunk->freeptr - chunk->data;
+	Size		nshared = chunk->endptr - chunk->endfree;
+	bool		append = false;
+
+	Assert(chunk->data != NULL && chunk->pinned == 0);
+
+	if (nevents + nshared > chunk->spill_space)
+	{
+		chunk->spill_fileno = afterTriggers.spill_end_fileno;
+		chunk->spill_offset = afterTriggers.spill_end_offset;
+		chunk->spill_space = nevents + nshared;
+		append = true;
+	}
+
+	if (BufFileSeek(file, chunk->spill_fileno, chunk->spill_offset,
+					SEEK_SET) != 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not seek in trigger event temporary file: %m")));
+	if (BufFileWrite(file, chunk->data, nevents) != nevents ||
+		BufFileWrite(file, chunk->endfree, nshared) != nshared)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not write to trigger event temporary file: %m")));
+	if (append)
+		BufFileTell(file, &afterTriggers.spill_end_fileno,
+					&afterTriggers.spill_end_offset);
+
+	chunk->spill_events = nevents;
+	chunk->spill_shared = nshared;
+
+	pfree(chunk->data);
+	chunk->data = chunk->freeptr = chunk->endfree = chunk->endptr = NULL;
+	afterTriggers.event_mem -= chunk->size;
+}
+
+/* ----------
+ * afterTriggerLoadChunk()
+ *
+ *	Make sure the data of an event chunk is in memory, reading it back from
+ *	the spill file if it was spilled.  The chunk is returned for the
+ *	convenience of the iteration macros; NULL is passed through.
+ * ----------
+ */
+static AfterTriggerEventChunk *
+afterTriggerLoadChunk(AfterTriggerEventChunk *chunk)
+{
+	if (chunk != NULL && chunk->data == NULL)
+	{
+		BufFile    *file = afterTriggers.spill_file;
+		char	   *data;
+
+		Assert(file != NULL);
+
+		data = MemoryContextAlloc(afterTriggers.event_cxt, chunk->size);
+		if (BufFileSeek(file, chunk->spill_fileno, chunk->spill_offset,
+						SEEK_SET) != 0)
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not seek in trigger event temporary file: %m")));
+		if (BufFileRead(file, data, chunk->spill_events) != chunk->spill_events ||
+			BufFileRead(file, data + chunk->size - chunk->spill_shared,
+						chunk->spill_shared) != chunk->spill_shared)
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not read from trigger event temporary file: %m")));
+
+		chunk->data = data;
+		chunk->freeptr = data + chunk->spill_events;
+		chunk->endptr = data + chunk->size;
+		chunk->endfree = chunk->endptr - chunk->spill_shared;
+		afterTriggers.event_mem += chunk->size;
+	}
+	return chunk;
+}
+
+/* ----------
+ * afterTriggerNextChunk()
+ *
+ *	Step from an event chunk to the next one in its list, spilling the
+ *	chunk left behind if we are over work_mem and loading the next one.
+ *	The tail chunk of a list is never spilled, as events are still being
+ *	added to it.
+ * ----------
+ */
+static AfterTriggerEventChunk *
+afterTriggerNextChunk(AfterTriggerEventChunk *chunk)
+{
+	AfterTriggerEventChunk *next = chunk->next;
+
+	if (next != NULL)
+		afterTriggerMaybeSpillChunk(chunk);
+	return afterTriggerLoadChunk(next);
+}
+
+/* ----------
+ * afterTriggerMaybeSpillChunk()
+ *
+ *	Spill a chunk that is not the tail of its list, if the event lists are
+ *	using more than work_mem.  A chunk whose events are being fired is left
+ *	alone, since the firing loop holds pointers into it.  (If an error
+ *	escapes that loop the chunk stays pinned, which merely keeps it in
+ *	memory.)
+ * ----------
+ */
+static void
+afterTriggerMaybeSpillChunk(AfterTriggerEventChunk *chunk)
+{
+	if (chunk->data != NULL && chunk->pinned == 0 &&
+		afterTriggers.event_mem > work_mem * 1024L)
+		afterTriggerSpillChunk(chunk);
+}
+
+/* ----------
+ * afterTriggerFreeChunk()
+ *
+ *	Free an event chunk.  Its space in the spill file, if any, is not
+ *	reused.
+ * ----------
+ */
+static void
+afterTriggerFreeChunk(AfterTriggerEventChunk *chunk)
+{
+	if (chunk->data != NULL)
+	{
+		pfree(chunk->data);
+		afterTriggers.event_mem -= chunk->size;
+	}
+	pfree(chunk);
+}
+
 /* ----------
  * afterTriggerAddEvent()
  *
@@ -4018,7 +4232,7 @@ afterTriggerAddEvent(AfterTriggerEventList *events,
 		else
 		{
 			/* preceding chunk size... */
-			chunksize = chunk->endptr - (char *) chunk;
+			chunksize = chunk->size;
 			/* check number of shared records in preceding chunk */
 			if ((chunk->endptr - chunk->endfree) <=
 				(100 * sizeof(AfterTriggerSharedData)))
@@ -4027,16 +4241,24 @@ afterTriggerAddEvent(AfterTriggerEventList *events,
 				chunksize /= 2; /* too many shared records */
 			chunksize = Min(chunksize, MAX_CHUNK_SIZE);
 		}
-		chunk = MemoryContextAlloc(afterTriggers.event_cxt, chunksize);
-		chunk->next = NULL;
+		chunk = MemoryContextAllocZero(afterTriggers.event_cxt,
+									   sizeof(AfterTriggerEventChunk));
+		chunk->data = MemoryContextAlloc(afterTriggers.event_cxt, chunksize);
+		chunk->size = chunksize;
 		chunk->freeptr = CHUNK_DATA_START(chunk);
-		chunk->endptr = chunk->endfree = (char *) chunk + chunksize;
+		chunk->endptr = chunk->endfree = chunk->data + chunksize;
 		Assert(chunk->endfree - chunk->freeptr >= needed);
+		afterTriggers.event_mem += chunksize;
 
 		if (events->head == NULL)
 			events->head = chunk;
 		else
+		{
 			events->tail->next = chunk;
+
+			/* the former tail is full, so it can be spilled now */
+			afterTriggerMaybeSpillChunk(events->tail);
+		}
 		events->tail = chunk;
 		/* events->tailfree is now out of sync, but we'll fix it below */
 	}
@@ -4071,7 +4293,7 @@ afterTriggerAddEvent(AfterTriggerEventList *events,
 	newevent->ate_flags |= (char *) newshared - (char *) newevent;
 
 	chunk->freeptr += eventsize;
-	events->tailfree = chunk->freeptr;
+	events->tailfree = chunk->freeptr - CHUNK_DATA_START(chunk);
 }
 
 /* ----------
@@ -4088,10 +4310,10 @@ afterTriggerFreeEventList(AfterTriggerEventList *events)
 	while ((chunk = events->head) != NULL)
 	{
 		events->head = chunk->next;
-		pfree(chunk);
+		afterTriggerFreeChunk(chunk);
 	}
 	events->tail = NULL;
-	events->tailfree = NULL;
+	events->tailfree = 0;
 }
 
 /* ----------
@@ -4120,11 +4342,12 @@ afterTriggerRestoreEventList(AfterTriggerEventList *events,
 		for (chunk = events->tail->next; chunk != NULL; chunk = next_chunk)
 		{
 			next_chunk = chunk->next;
-			pfree(chunk);
+			afterTriggerFreeChunk(chunk);
 		}
 		/* and clean up the tail chunk to be the right length */
 		events->tail->next = NULL;
-		events->tail->freeptr = events->tailfree;
+		afterTriggerLoadChunk(events->tail);
+		events->tail->freeptr = CHUNK_DATA_START(events->tail) + events->tailfree;
 
 		/*
 		 * We don't make any effort to remove now-unused shared data records.
@@ -4163,13 +4386,13 @@ afterTriggerDeleteHeadEventChunk(AfterTriggersQueryData *qs)
 		{
 			table->after_trig_events.head = NULL;
 			table->after_trig_events.tail = NULL;
-			table->after_trig_events.tailfree = NULL;
+			table->after_trig_events.tailfree = 0;
 		}
 	}
 
 	/* Now we can flush the head chunk */
 	qs->events.head = target->next;
-	pfree(target);
+	afterTriggerFreeChunk(target);
 }
 
 
@@ -4527,6 +4750,9 @@ afterTriggerInvokeEvents(AfterTriggerEventList *events,
 		AfterTriggerEvent event;
 		bool		all_fired_in_chunk = true;
 
+		/* keep nested additions to the list from spilling this chunk */
+		chunk->pinned++;
+
 		for_each_event(event, chunk)
 		{
 			AfterTriggerShared evtshared = GetTriggerSharedData(event);
@@ -4586,6 +4812,8 @@ afterTriggerInvokeEvents(AfterTriggerEventList *events,
 			}
 		}
 
+		chunk->pinned--;
+
 		/* Clear the chunk if delete_ok and nothing left of interest */
 		if (delete_ok && all_fired_in_chunk)
 		{
@@ -4599,7 +4827,7 @@ afterTriggerInvokeEvents(AfterTriggerEventList *events,
 			 * list, since we'd fail to fix their copies of tailfree.
 			 */
 			if (chunk == events->tail)
-				events->tailfree = chunk->freeptr;
+				events->tailfree = 0;
 		}
 	}
 	if (slot1 != NULL)
@@ -4800,6 +5028,7 @@ AfterTriggerBeginXact(void)
 	Assert(afterTriggers.query_stack == NULL);
 	Assert(afterTriggers.maxquerydepth == 0);
 	Assert(afterTriggers.event_cxt == NULL);
+	Assert(afterTriggers.spill_file == NULL);
 	Assert(afterTriggers.events.head == NULL);
 	Assert(afterTriggers.trans_stack == NULL);
 	Assert(afterTriggers.maxtransdepth == 0);
@@ -5050,9 +5279,17 @@ AfterTriggerEndXact(bool isCommit)
 	{
 		MemoryContextDelete(afterTriggers.event_cxt);
 		afterTriggers.event_cxt = NULL;
+		afterTriggers.event_mem = 0;
 		afterTriggers.events.head = NULL;
 		afterTriggers.events.tail = NULL;
-		afterTriggers.events.tailfree = NULL;
+		afterTriggers.events.tailfree = 0;
+	}
+	if (afterTriggers.spill_file)
+	{
+		BufFile    *file = afterTriggers.spill_file;
+
+		afterTriggers.spill_file = NULL;
+		BufFileClose(file);
 	}
 
 	/*
@@ -5268,7 +5505,7 @@ AfterTriggerEnlargeQueryState(void)
 
 		qs->events.head = NULL;
 		qs->events.tail = NULL;
-		qs->events.tailfree = NULL;
+		qs->events.tailfree = 0;
 		qs->fdw_tuplestore = NULL;
 		qs->tables = NIL;
 
@@ -6169,12 +6406,13 @@ cancel_prior_stmt_triggers(Oid relid, CmdType cmdType, int tgevent)
 
 		if (table->after_trig_events.tail)
 		{
-			chunk = table->after_trig_events.tail;
-			event = (AfterTriggerEvent) table->after_trig_events.tailfree;
+			chunk = afterTriggerLoadChunk(table->after_trig_events.tail);
+			event = (AfterTriggerEvent) (CHUNK_DATA_START(chunk) +
+										 table->after_trig_events.tailfree);
 		}
 		else
 		{
-			chunk = qs->events.head;
+			chunk = afterTriggerLoadChunk(qs->events.head);
 			event = NULL;
 		}
 
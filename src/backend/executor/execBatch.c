@@ -0,0 +1,317 @@
+/*-------------------------------------------------------------------------
+ *
+ * execBatch.c
+ *	  Batch-at-a-time evaluation of simple scan quals.
+ *
+ * Quals are normally evaluated by ExecQual() one tuple at a time, which
+ * dispatches on every step of the expression for every tuple.  For the
+ * simplest and most common kind of clause, a comparison of a column with a
+ * constant or another column of a fixed-width type, that overhead is most
+ * of the cost.  A scan can instead fetch a batch of tuples ahead, deform the
+ * columns the quals need for all of them, and evaluate each clause on the
+ * whole batch in a tight loop, narrowing down a selection vector of the
+ * tuples that passed all clauses so far.
+ *
+ * Only the leading clauses of the qual that are simple enough are evaluated
+ * that way, as are only functions that are strict and leakproof: as the
+ * clauses are evaluated on tuples the scan wouldn't otherwise have fetched
+ * yet, for example under a LIMIT, they mustn't raise errors or have side
+ * effects.  The remaining clauses are left to ExecQual().
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ *
+ * IDENTIFICATION
+ *	  src/backend/executor/execBatch.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "catalog/objectaccess.h"
+#include "catalog/pg_type.h"
+#include "executor/execBatch.h"
+#include "executor/executor.h"
+#include "miscadmin.h"
+#include "nodes/nodeFuncs.h"
+#include "utils/acl.h"
+#include "utils/lsyscache.h"
+
+static bool batch_qual_arg_ok(Node *arg, Index scanrelid);
+
+
+/*
+ * ExecInitTupleBatch
+ *
+ * Create an empty batch of up to maxslots tuples of the given type.
+ */
+TupleBatch *
+ExecInitTupleBatch(TupleDesc tupdesc, const TupleTableSlotOps *tts_ops,
+				   int maxslots)
+{
+	TupleBatch *batch = palloc0(sizeof(TupleBatch));
+
+	Assert(maxslots > 0 && maxslots <= PG_UINT16_MAX + 1);
+
+	batch->tupdesc = tupdesc;
+	batch->tts_ops = tts_ops;
+	batch->maxslots = maxslots;
+	batch->slots = palloc0(sizeof(TupleTableSlot *) * maxslots);
+	batch->sel = palloc(sizeof(uint16) * maxslots);
+
+	return batch;
+}
+
+/*
+ * ExecTupleBatchSlot
+ *
+ * Return the batch's slotno'th slot, creating it if needed.
+ */
+TupleTableSlot *
+ExecTupleBatchSlot(TupleBatch *batch, int slotno)
+{
+	Assert(slotno >= 0 && slotno < batch->maxslots);
+
+	if (batch->slots[slotno] == NULL)
+		batch->slots[slotno] = MakeSingleTupleTableSlot(batch->tupdesc,
+														batch->tts_ops);
+
+	return batch->slots[slotno];
+}
+
+/*
+ * ExecClearTupleBatch
+ *
+ * Empty the batch, releasing the resources its tuples hold, such as buffer
+ * pins, but keeping the slots for reuse.
+ */
+void
+ExecClearTupleBatch(TupleBatch *batch)
+{
+	int			i;
+
+	for (i = 0; i < batch->maxslots && batch->slots[i] != NULL; i++)
+		ExecClearTuple(batch->slots[i]);
+
+	batch->nslots = 0;
+	batch->nselected = 0;
+	batch->next = 0;
+}
+
+/*
+ * ExecReleaseTupleBatch
+ *
+ * Empty the batch and drop its slots, as when the scan is over, not to keep
+ * their memory around.  The slots are recreated if the batch is used again.
+ */
+void
+ExecReleaseTupleBatch(TupleBatch *batch)
+{
+	int			i;
+
+	for (i = 0; i < batch->maxslots && batch->slots[i] != NULL; i++)
+	{
+		ExecDropSingleTupleTableSlot(batch->slots[i]);
+		batch->slots[i] = NULL;
+	}
+
+	batch->nslots = 0;
+	batch->nselected = 0;
+	batch->next = 0;
+}
+
+/*
+ * Can an argument of a batch qual clause be evaluated without ExecQual?
+ * It must be a user column of the scan relation or a non-null constant, of
+ * a by-value type.
+ */
+static bool
+batch_qual_arg_ok(Node *arg, Index scanrelid)
+{
+	if (IsA(arg, Var))
+	{
+		Var		   *var = (Var *) arg;
+
+		if (var->varno != scanrelid || var->varlevelsup != 0 ||
+			var->varattno <= 0)
+			return false;
+	}
+	else if (IsA(arg, Const))
+	{
+		if (((Const *) arg)->constisnull)
+			return false;
+	}
+	else
+		return false;
+
+	return get_typbyval(exprType(arg));
+}
+
+/*
+ * ExecInitBatchQual
+ *
+ * Prepare the leading clauses of a scan's implicitly-ANDed qual list that
+ * are simple enough for evaluation on a TupleBatch at a time.  The remaining
+ * clauses are returned in *rest, for ExecInitQual.  Returns NULL if not even
+ * the first clause can be evaluated that way.
+ */
+BatchQual *
+ExecInitBatchQual(List *qual, Index scanrelid, List **rest)
+{
+	BatchQual  *bqual;
+	ListCell   *lc;
+	int			nsteps = 0;
+	int			stepno;
+
+	*rest = qual;
+
+	foreach(lc, qual)
+	{
+		OpExpr	   *opexpr = (OpExpr *) lfirst(lc);
+
+		if (!IsA(opexpr, OpExpr) || list_length(opexpr->args) != 2 ||
+			opexpr->opresulttype != BOOLOID || opexpr->opretset)
+			break;
+
+		set_opfuncid(opexpr);
+		if (!func_strict(opexpr->opfuncid) ||
+			!get_func_leakproof(opexpr->opfuncid))
+			break;
+
+		if (!batch_qual_arg_ok(linitial(opexpr->args), scanrelid) ||
+			!batch_qual_arg_ok(lsecond(opexpr->args), scanrelid))
+			break;
+
+		/* a comparison of constants should have been folded already */
+		if (IsA(linitial(opexpr->args), Const) &&
+			IsA(lsecond(opexpr->args), Const))
+			break;
+
+		nsteps++;
+	}
+
+	if (nsteps == 0)
+		return NULL;
+
+	bqual = palloc0(sizeof(BatchQual));
+	bqual->nsteps = nsteps;
+	bqual->steps = palloc0(sizeof(BatchQualStep) * nsteps);
+
+	for (stepno = 0; stepno < nsteps; stepno++)
+	{
+		OpExpr	   *opexpr = (OpExpr *) list_nth(qual, stepno);
+		BatchQualStep *step = &bqual->steps[stepno];
+		FmgrInfo   *flinfo;
+		AclResult	aclresult;
+		int			argno;
+
+		/* Check permission to call function, as ExecInitFunc does */
+		aclresult = pg_proc_aclcheck(opexpr->opfuncid, GetUserId(),
+									 ACL_EXECUTE);
+		if (aclresult != ACLCHECK_OK)
+			aclcheck_error(aclresult, OBJECT_FUNCTION,
+						   get_func_name(opexpr->opfuncid));
+		InvokeFunctionExecuteHook(opexpr->opfuncid);
+
+		flinfo = palloc0(sizeof(FmgrInfo));
+		step->fcinfo = palloc0(SizeForFunctionCallInfo(2));
+		fmgr_info(opexpr->opfuncid, flinfo);
+		fmgr_info_set_expr((Node *) opexpr, flinfo);
+		InitFunctionCallInfoData(*step->fcinfo, flinfo, 2,
+								 opexpr->inputcollid, NULL, NULL);
+		step->fn_addr = flinfo->fn_addr;
+
+		for (argno = 0; argno < 2; argno++)
+		{
+			Node	   *arg = list_nth(opexpr->args, argno);
+
+			step->fcinfo->args[argno].isnull = false;
+			if (IsA(arg, Var))
+			{
+				AttrNumber	attno = ((Var *) arg)->varattno;
+
+				step->argattno[argno] = attno - 1;
+				bqual->maxattno = Max(bqual->maxattno, attno);
+			}
+			else
+			{
+				step->argattno[argno] = -1;
+				step->fcinfo->args[argno].value = ((Const *) arg)->constvalue;
+			}
+		}
+	}
+
+	*rest = list_copy_tail(qual, nsteps);
+
+	return bqual;
+}
+
+/*
+ * ExecBatchQual
+ *
+ * Evaluate a batch qual on all the tuples of a batch, and set up its
+ * selection vector with those that pass, to be returned from the start.
+ *
+ * The functions are called in econtext's per-tuple memory context, which the
+ * caller should reset after each batch.
+ */
+void
+ExecBatchQual(BatchQual *bqual, TupleBatch *batch, ExprContext *econtext)
+{
+	MemoryContext oldcontext;
+	int			nselected = batch->nslots;
+	int			stepno;
+	int			i;
+
+	oldcontext = MemoryContextSwitchTo(econtext->ecxt_per_tuple_memory);
+
+	/* deform the columns needed for all tuples, and start with all selected */
+	for (i = 0; i < batch->nslots; i++)
+	{
+		slot_getsomeattrs(batch->slots[i], bqual->maxattno);
+		batch->sel[i] = i;
+	}
+
+	for (stepno = 0; stepno < bqual->nsteps && nselected > 0; stepno++)
+	{
+		BatchQualStep *step = &bqual->steps[stepno];
+		FunctionCallInfo fcinfo = step->fcinfo;
+		AttrNumber	attno0 = step->argattno[0];
+		AttrNumber	attno1 = step->argattno[1];
+		int			nout = 0;
+
+		for (i = 0; i < nselected; i++)
+		{
+			TupleTableSlot *slot = batch->slots[batch->sel[i]];
+			Datum		result;
+
+			/* the function is strict, so a null fails the clause */
+			if (attno0 >= 0)
+			{
+				if (slot->tts_isnull[attno0])
+					continue;
+				fcinfo->args[0].value = slot->tts_values[attno0];
+			}
+			if (attno1 >= 0)
+			{
+				if (slot->tts_isnull[attno1])
+					continue;
+				fcinfo->args[1].value = slot->tts_values[attno1];
+			}
+
+			fcinfo->isnull = false;
+			result = step->fn_addr(fcinfo);
+
+			if (!fcinfo->isnull && DatumGetBool(result))
+				batch->sel[nout++] = batch->sel[i];
+		}
+
+		nselected = nout;
+	}
+
+	MemoryContextSwitchTo(oldcontext);
+
+	batch->nselected = nselected;
+	batch->next = 0;
+}
@@ -61,6 +61,8 @@ static void ExecInitExprRec(Expr *node, ExprState *state,
 static void ExecInitFunc(ExprEvalStep *scratch, Expr *node, List *args,
 						 Oid funcid, Oid inputcollid,
 						 ExprState *state);
+static bool ExecInitVarCmp(ExprEvalStep *scratch, OpExpr *op,
+						   ExprState *state);
 static void ExecInitExprSlots(ExprState *state, Node *node);
 static void ExecPushExprSlots(ExprState *state, LastAttnumInfo *info);
 static bool get_last_attnums_walker(Node *node, LastAttnumInfo *info);
@@ -246,9 +248,54 @@ ExecInitQual(List *qual, PlanState *parent)
 	{
 		Expr	   *node = (Expr *) lfirst(lc);
 
+		ExprEvalStep *last;
+
 		/* first evaluate expression */
 		ExecInitExprRec(node, state, &state->resvalue, &state->resnull);
 
+		/*
+		 * If the expression's final step has a variant that also detects a
+		 * false (or null) result, use that instead of a separate EEOP_QUAL.
+		 * That's only safe if the step computes the qual's own result, not
+		 * that of a subexpression that other steps might jump past, as in a
+		 * CASE.
+		 */
+		last = &state->steps[state->steps_len - 1];
+		if (IsA(node, OpExpr) || IsA(node, NullTest))
+		{
+			ExprEvalOp	qualop = EEOP_LAST;
+
+			Assert(last->resvalue == &state->resvalue);
+
+			switch (last->opcode)
+			{
+				case EEOP_VAR_CMP_CONST:
+					qualop = EEOP_QUAL_VAR_CMP_CONST;
+					break;
+				case EEOP_VAR_CMP_VAR:
+					qualop = EEOP_QUAL_VAR_CMP_VAR;
+					break;
+				case EEOP_NULLTEST_ISNULL:
+					qualop = EEOP_QUAL_NULLTEST_ISNULL;
+					last->d.qualexpr.jumpdone = -1;
+					break;
+				case EEOP_NULLTEST_ISNOTNULL:
+					qualop = EEOP_QUAL_NULLTEST_ISNOTNULL;
+					last->d.qualexpr.jumpdone = -1;
+					break;
+				default:
+					break;
+			}
+
+			if (qualop != EEOP_LAST)
+			{
+				last->opcode = qualop;
+				adjust_jumps = lappend_int(adjust_jumps,
+										   state->steps_len - 1);
+				continue;
+			}
+		}
+
 		/* then emit EEOP_QUAL to detect if it's false (or null) */
 		scratch.d.qualexpr.jumpdone = -1;
 		ExprEvalPushStep(state, &scratch);
@@ -261,9 +308,20 @@ ExecInitQual(List *qual, PlanState *parent)
 	{
 		ExprEvalStep *as = &state->steps[lfirst_int(lc)];
 
-		Assert(as->opcode == EEOP_QUAL);
-		Assert(as->d.qualexpr.jumpdone == -1);
-		as->d.qualexpr.jumpdone = state->steps_len;
+		if (as->opcode == EEOP_QUAL_VAR_CMP_CONST ||
+			as->opcode == EEOP_QUAL_VAR_CMP_VAR)
+		{
+			Assert(as->d.varcmp.jumpdone == -1);
+			as->d.varcmp.jumpdone = state->steps_len;
+		}
+		else
+		{
+			Assert(as->opcode == EEOP_QUAL ||
+				   as->opcode == EEOP_QUAL_NULLTEST_ISNULL ||
+				   as->opcode == EEOP_QUAL_NULLTEST_ISNOTNULL);
+			Assert(as->d.qualexpr.jumpdone == -1);
+			as->d.qualexpr.jumpdone = state->steps_len;
+		}
 	}
 
 	/*
@@ -891,6 +949,13 @@ ExecInitExprRec(Expr *node, ExprState *state,
 			{
 				OpExpr	   *op = (OpExpr *) node;
 
+				/* comparisons of a Var use a specialized step if possible */
+				if (ExecInitVarCmp(&scratch, op, state))
+				{
+					ExprEvalPushStep(state, &scratch);
+					break;
+				}
+
 				ExecInitFunc(&scratch, node,
 							 op->args, op->opfuncid, op->inputcollid,
 							 state);
@@ -2246,6 +2311,165 @@ ExecInitFunc(ExprEvalStep *scratch, Expr *node, List *args, Oid funcid,
 	}
 }
 
+/*
+ * Comparison functions that EEOP_[QUAL_]VAR_CMP_* steps evaluate inline.
+ * They're identified by their C function, so that types sharing one (like
+ * timestamp and timestamptz) are both covered.
+ */
+static const struct
+{
+	PGFunction	fn_addr;
+	ExprVarCmpType cmptype;
+	ExprVarCmpOp cmpop;
+}			varcmp_functions[] =
+{
+	{int4eq, VARCMP_INT4, VARCMP_EQ},
+	{int4ne, VARCMP_INT4, VARCMP_NE},
+	{int4lt, VARCMP_INT4, VARCMP_LT},
+	{int4le, VARCMP_INT4, VARCMP_LE},
+	{int4gt, VARCMP_INT4, VARCMP_GT},
+	{int4ge, VARCMP_INT4, VARCMP_GE},
+	{date_eq, VARCMP_INT4, VARCMP_EQ},
+	{date_ne, VARCMP_INT4, VARCMP_NE},
+	{date_lt, VARCMP_INT4, VARCMP_LT},
+	{date_le, VARCMP_INT4, VARCMP_LE},
+	{date_gt, VARCMP_INT4, VARCMP_GT},
+	{date_ge, VARCMP_INT4, VARCMP_GE},
+	{int8eq, VARCMP_INT8, VARCMP_EQ},
+	{int8ne, VARCMP_INT8, VARCMP_NE},
+	{int8lt, VARCMP_INT8, VARCMP_LT},
+	{int8le, VARCMP_INT8, VARCMP_LE},
+	{int8gt, VARCMP_INT8, VARCMP_GT},
+	{int8ge, VARCMP_INT8, VARCMP_GE},
+	{timestamp_eq, VARCMP_INT8, VARCMP_EQ},
+	{timestamp_ne, VARCMP_INT8, VARCMP_NE},
+	{timestamp_lt, VARCMP_INT8, VARCMP_LT},
+	{timestamp_le, VARCMP_INT8, VARCMP_LE},
+	{timestamp_gt, VARCMP_INT8, VARCMP_GT},
+	{timestamp_ge, VARCMP_INT8, VARCMP_GE},
+	{float8eq, VARCMP_FLOAT8, VARCMP_EQ},
+	{float8ne, VARCMP_FLOAT8, VARCMP_NE},
+	{float8lt, VARCMP_FLOAT8, VARCMP_LT},
+	{float8le, VARCMP_FLOAT8, VARCMP_LE},
+	{float8gt, VARCMP_FLOAT8, VARCMP_GT},
+	{float8ge, VARCMP_FLOAT8, VARCMP_GE},
+};
+
+/*
+ * Prepare an EEOP_VAR_CMP_CONST or EEOP_VAR_CMP_VAR step for an operator
+ * comparing a user column to a non-null constant or to another user column,
+ * if its function is one of varcmp_functions.  Returns false, having done
+ * nothing, if the operator has to be evaluated by calling its function.
+ */
+static bool
+ExecInitVarCmp(ExprEvalStep *scratch, OpExpr *op, ExprState *state)
+{
+	FmgrInfo	flinfo;
+	Expr	   *left;
+	Expr	   *right;
+	Var		   *lvar;
+	ExprVarCmpOp cmpop;
+	AclResult	aclresult;
+	int			i;
+
+	if (list_length(op->args) != 2)
+		return false;
+	left = (Expr *) linitial(op->args);
+	right = (Expr *) lsecond(op->args);
+
+	/* the Var can be on either side; commute if it's on the right */
+	if (IsA(left, Const) && IsA(right, Var))
+	{
+		Expr	   *tmp = left;
+
+		left = right;
+		right = tmp;
+	}
+
+	if (!IsA(left, Var) || ((Var *) left)->varattno <= 0)
+		return false;
+	if (IsA(right, Const))
+	{
+		if (((Const *) right)->constisnull)
+			return false;
+	}
+	else if (!IsA(right, Var) || ((Var *) right)->varattno <= 0)
+		return false;
+
+	fmgr_info(op->opfuncid, &flinfo);
+
+	/* calls must still be counted if function usage is tracked */
+	if (pgstat_track_functions > flinfo.fn_stats)
+		return false;
+
+	for (i = 0; i < lengthof(varcmp_functions); i++)
+	{
+		if (varcmp_functions[i].fn_addr == flinfo.fn_addr)
+			break;
+	}
+	if (i == lengthof(varcmp_functions))
+		return false;
+
+	cmpop = varcmp_functions[i].cmpop;
+	if (left != linitial(op->args))
+	{
+		switch (cmpop)
+		{
+			case VARCMP_LT:
+				cmpop = VARCMP_GT;
+				break;
+			case VARCMP_LE:
+				cmpop = VARCMP_GE;
+				break;
+			case VARCMP_GT:
+				cmpop = VARCMP_LT;
+				break;
+			case VARCMP_GE:
+				cmpop = VARCMP_LE;
+				break;
+			default:
+				break;
+		}
+	}
+
+	/* Check permission to call function, just as ExecInitFunc() would */
+	aclresult = pg_proc_aclcheck(op->opfuncid, GetUserId(), ACL_EXECUTE);
+	if (aclresult != ACLCHECK_OK)
+		aclcheck_error(aclresult, OBJECT_FUNCTION, get_func_name(op->opfuncid));
+	InvokeFunctionExecuteHook(op->opfuncid);
+
+	lvar = (Var *) left;
+	scratch->d.varcmp.lattnum = lvar->varattno - 1;
+	scratch->d.varcmp.lvartype = lvar->vartype;
+	scratch->d.varcmp.lslot = lvar->varno == INNER_VAR ? VARCMP_INNER :
+		lvar->varno == OUTER_VAR ? VARCMP_OUTER : VARCMP_SCAN;
+	scratch->d.varcmp.cmptype = varcmp_functions[i].cmptype;
+	scratch->d.varcmp.cmpop = cmpop;
+	scratch->d.varcmp.jumpdone = -1;
+
+	if (IsA(right, Const))
+	{
+		scratch->d.varcmp.rattnum = -1;
+		scratch->d.varcmp.rvartype = InvalidOid;
+		scratch->d.varcmp.rslot = VARCMP_SCAN;
+		scratch->d.varcmp.constval = ((Const *) right)->constvalue;
+		scratch->opcode = EEOP_VAR_CMP_CONST;
+	}
+	else
+	{
+		Var		   *rvar = (Var *) right;
+
+		scratch->d.varcmp.rattnum = rvar->varattno - 1;
+		scratch->d.varcmp.rvartype = rvar->vartype;
+		scratch->d.varcmp.rslot = rvar->varno == INNER_VAR ? VARCMP_INNER :
+			rvar->varno == OUTER_VAR ? VARCMP_OUTER : VARCMP_SCAN;
+		scratch->d.varcmp.constval = (Datum) 0;
+		scratch->opcode = EEOP_VAR_CMP_VAR;
+	}
+
+	return true;
+}
+
 /*
  * Add expression steps deforming the ExprState's inner/outer/scan slots
  * as much as required by the expression.
@@ -3214,6 +3438,7 @@ ExecBuildAggTransCall(ExprState *state, AggState *aggstate,
 {
 	int			adjust_init_jumpnull = -1;
 	int			adjust_strict_jumpnull = -1;
+	int			adjust_pergroup_jumpnull = -1;
 	ExprContext *aggcontext;
 
 	if (ishash)
@@ -3221,6 +3446,19 @@ ExecBuildAggTransCall(ExprState *state, AggState *aggstate,
 	else
 		aggcontext = aggstate->aggcontexts[setno];
 
+	/*
+	 * A hashed grouping set has no per-group states for the input tuples
+	 * that went to its spill files, so skip the transition for those.
+	 */
+	if (ishash)
+	{
+		scratch->opcode = EEOP_AGG_PLAIN_PERGROUP_NULLCHECK;
+		scratch->d.agg_plain_pergroup_nullcheck.setoff = setoff;
+		scratch->d.agg_plain_pergroup_nullcheck.jumpnull = -1;	/* adjust later */
+		ExprEvalPushStep(state, scratch);
+		adjust_pergroup_jumpnull = state->steps_len - 1;
+	}
+
 	/*
 	 * If the initial value for the transition state doesn't exist in the
 	 * pg_aggregate table then we will let the first non-NULL value returned
@@ -3298,6 +3536,13 @@ ExecBuildAggTransCall(ExprState *state, AggState *aggstate,
 		Assert(as->d.agg_strict_trans_check.jumpnull == -1);
 		as->d.agg_strict_trans_check.jumpnull = state->steps_len;
 	}
+	if (adjust_pergroup_jumpnull != -1)
+	{
+		ExprEvalStep *as = &state->steps[adjust_pergroup_jumpnull];
+
+		Assert(as->d.agg_plain_pergroup_nullcheck.jumpnull == -1);
+		as->d.agg_plain_pergroup_nullcheck.jumpnull = state->steps_len;
+	}
 }
 
 /*
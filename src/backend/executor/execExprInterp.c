@@ -71,6 +71,7 @@
 #include "utils/date.h"
 #include "utils/datum.h"
 #include "utils/expandedrecord.h"
+#include "utils/float.h"
 #include "utils/lsyscache.h"
 #include "utils/timestamp.h"
 #include "utils/typcache.h"
@@ -137,6 +138,11 @@ static ExprEvalOpLookup reverse_dispatch_table[EEOP_LAST];
 		EEO_DISPATCH(); \
 	} while (0)
 
+/* Slot holding a Var compared by EEOP_[QUAL_]VAR_CMP_*, see ExprVarCmpSlot */
+#define VARCMP_SLOT(which) \
+	((which) == VARCMP_INNER ? innerslot : \
+	 (which) == VARCMP_OUTER ? outerslot : scanslot)
+
 
 static Datum ExecInterpExpr(ExprState *state, ExprContext *econtext, bool *isnull);
 static void ExecInitInterpreter(void);
@@ -149,6 +155,10 @@ static TupleDesc get_cached_rowtype(Oid type_id, int32 typmod,
 static void ShutdownTupleDescRef(Datum arg);
 static void ExecEvalRowNullInt(ExprState *state, ExprEvalStep *op,
 							   ExprContext *econtext, bool checkisnull);
+static pg_attribute_always_inline bool ExecEvalVarCmpInternal(ExprEvalStep *op,
+															  TupleTableSlot *lslot,
+															  TupleTableSlot *rslot,
+															  bool *isnull);
 
 /* fast-path evaluation functions */
 static Datum ExecJustInnerVar(ExprState *state, ExprContext *econtext, bool *isnull);
@@ -329,6 +339,10 @@ ExecInterpExpr(ExprState *state, ExprContext *econtext, bool *isnull)
 		&&CASE_EEOP_FUNCEXPR_STRICT,
 		&&CASE_EEOP_FUNCEXPR_FUSAGE,
 		&&CASE_EEOP_FUNCEXPR_STRICT_FUSAGE,
+		&&CASE_EEOP_VAR_CMP_CONST,
+		&&CASE_EEOP_VAR_CMP_VAR,
+		&&CASE_EEOP_QUAL_VAR_CMP_CONST,
+		&&CASE_EEOP_QUAL_VAR_CMP_VAR,
 		&&CASE_EEOP_BOOL_AND_STEP_FIRST,
 		&&CASE_EEOP_BOOL_AND_STEP,
 		&&CASE_EEOP_BOOL_AND_STEP_LAST,
@@ -343,6 +357,8 @@ ExecInterpExpr(ExprState *state, ExprContext *econtext, bool *isnull)
 		&&CASE_EEOP_JUMP_IF_NOT_TRUE,
 		&&CASE_EEOP_NULLTEST_ISNULL,
 		&&CASE_EEOP_NULLTEST_ISNOTNULL,
+		&&CASE_EEOP_QUAL_NULLTEST_ISNULL,
+		&&CASE_EEOP_QUAL_NULLTEST_ISNOTNULL,
 		&&CASE_EEOP_NULLTEST_ROWISNULL,
 		&&CASE_EEOP_NULLTEST_ROWISNOTNULL,
 		&&CASE_EEOP_BOOLTEST_IS_TRUE,
@@ -389,6 +405,7 @@ ExecInterpExpr(ExprState *state, ExprContext *econtext, bool *isnull)
 		&&CASE_EEOP_AGG_DESERIALIZE,
 		&&CASE_EEOP_AGG_STRICT_INPUT_CHECK_ARGS,
 		&&CASE_EEOP_AGG_STRICT_INPUT_CHECK_NULLS,
+		&&CASE_EEOP_AGG_PLAIN_PERGROUP_NULLCHECK,
 		&&CASE_EEOP_AGG_INIT_TRANS,
 		&&CASE_EEOP_AGG_STRICT_TRANS_CHECK,
 		&&CASE_EEOP_AGG_PLAIN_TRANS_BYVAL,
@@ -670,6 +687,72 @@ ExecInterpExpr(ExprState *state, ExprContext *econtext, bool *isnull)
 			EEO_NEXT();
 		}
 
+		EEO_CASE(EEOP_VAR_CMP_CONST)
+		{
+			bool		isnull;
+
+			*op->resvalue =
+				BoolGetDatum(ExecEvalVarCmpInternal(op,
+													VARCMP_SLOT(op->d.varcmp.lslot),
+													NULL, &isnull));
+			*op->resnull = isnull;
+
+			EEO_NEXT();
+		}
+
+		EEO_CASE(EEOP_VAR_CMP_VAR)
+		{
+			bool		isnull;
+
+			*op->resvalue =
+				BoolGetDatum(ExecEvalVarCmpInternal(op,
+													VARCMP_SLOT(op->d.varcmp.lslot),
+													VARCMP_SLOT(op->d.varcmp.rslot),
+													&isnull));
+			*op->resnull = isnull;
+
+			EEO_NEXT();
+		}
+
+		EEO_CASE(EEOP_QUAL_VAR_CMP_CONST)
+		{
+			bool		isnull;
+
+			/* as EEOP_VAR_CMP_CONST followed by EEOP_QUAL */
+			if (!ExecEvalVarCmpInternal(op, VARCMP_SLOT(op->d.varcmp.lslot),
+										NULL, &isnull) || isnull)
+			{
+				*op->resnull = false;
+				*op->resvalue = BoolGetDatum(false);
+				EEO_JUMP(op->d.varcmp.jumpdone);
+			}
+
+			*op->resnull = false;
+			*op->resvalue = BoolGetDatum(true);
+
+			EEO_NEXT();
+		}
+
+		EEO_CASE(EEOP_QUAL_VAR_CMP_VAR)
+		{
+			bool		isnull;
+
+			/* as EEOP_VAR_CMP_VAR followed by EEOP_QUAL */
+			if (!ExecEvalVarCmpInternal(op, VARCMP_SLOT(op->d.varcmp.lslot),
+										VARCMP_SLOT(op->d.varcmp.rslot),
+										&isnull) || isnull)
+			{
+				*op->resnull = false;
+				*op->resvalue = BoolGetDatum(false);
+				EEO_JUMP(op->d.varcmp.jumpdone);
+			}
+
+			*op->resnull = false;
+			*op->resvalue = BoolGetDatum(true);
+
+			EEO_NEXT();
+		}
+
 		/*
 		 * If any of its clauses is FALSE, an AND's result is FALSE regardless
 		 * of the states of the rest of the clauses, so we can stop evaluating
@@ -888,6 +971,36 @@ ExecInterpExpr(ExprState *state, ExprContext *econtext, bool *isnull)
 			EEO_NEXT();
 		}
 
+		EEO_CASE(EEOP_QUAL_NULLTEST_ISNULL)
+		{
+			/* as EEOP_NULLTEST_ISNULL followed by EEOP_QUAL */
+			if (!*op->resnull)
+			{
+				*op->resvalue = BoolGetDatum(false);
+				EEO_JUMP(op->d.qualexpr.jumpdone);
+			}
+
+			*op->resvalue = BoolGetDatum(true);
+			*op->resnull = false;
+
+			EEO_NEXT();
+		}
+
+		EEO_CASE(EEOP_QUAL_NULLTEST_ISNOTNULL)
+		{
+			/* as EEOP_NULLTEST_ISNOTNULL followed by EEOP_QUAL */
+			if (*op->resnull)
+			{
+				*op->resnull = false;
+				*op->resvalue = BoolGetDatum(false);
+				EEO_JUMP(op->d.qualexpr.jumpdone);
+			}
+
+			*op->resvalue = BoolGetDatum(true);
+
+			EEO_NEXT();
+		}
+
 		EEO_CASE(EEOP_NULLTEST_ROWISNULL)
 		{
 			/* out of line implementation: too large */
@@ -1556,6 +1669,25 @@ ExecInterpExpr(ExprState *state, ExprContext *econtext, bool *isnull)
 			EEO_NEXT();
 		}
 
+		/*
+		 * Check for a NULL pointer to the per-group states, which means that
+		 * the current input tuple has been spilled from that hash table, and
+		 * skip the transition for it.
+		 */
+		EEO_CASE(EEOP_AGG_PLAIN_PERGROUP_NULLCHECK)
+		{
+			AggState   *aggstate = castNode(AggState, state->parent);
+			AggStatePerGroup pergroup_allaggs;
+
+			pergroup_allaggs = aggstate->all_pergroups
+				[op->d.agg_plain_pergroup_nullcheck.setoff];
+
+			if (pergroup_allaggs == NULL)
+				EEO_JUMP(op->d.agg_plain_pergroup_nullcheck.jumpnull);
+
+			EEO_NEXT();
+		}
+
 		/*
 		 * Initialize an aggregate's first value if necessary.
 		 */
@@ -1814,6 +1946,21 @@ CheckExprStillValid(ExprState *state, ExprContext *econtext)
 					CheckVarSlotCompatibility(scanslot, attnum + 1, op->d.var.vartype);
 					break;
 				}
+
+			case EEOP_VAR_CMP_VAR:
+			case EEOP_QUAL_VAR_CMP_VAR:
+				CheckVarSlotCompatibility(VARCMP_SLOT(op->d.varcmp.rslot),
+										  op->d.varcmp.rattnum + 1,
+										  op->d.varcmp.rvartype);
+				/* FALLTHROUGH */
+
+			case EEOP_VAR_CMP_CONST:
+			case EEOP_QUAL_VAR_CMP_CONST:
+				CheckVarSlotCompatibility(VARCMP_SLOT(op->d.varcmp.lslot),
+										  op->d.varcmp.lattnum + 1,
+										  op->d.varcmp.lvartype);
+				break;
+
 			default:
 				break;
 		}
@@ -2257,6 +2404,119 @@ ExecEvalFuncExprStrictFusage(ExprState *state, ExprEvalStep *op,
 	pgstat_end_function_usage(&fcusage, true);
 }
 
+/*
+ * Compare the Var of an EEOP_[QUAL_]VAR_CMP_* step to its Const, if rslot is
+ * NULL, or to its other Var.  The comparison functions recognized by
+ * ExecInitVarCmp() are all strict, so the result is null if either input
+ * is.
+ */
+static pg_attribute_always_inline bool
+ExecEvalVarCmpInternal(ExprEvalStep *op, TupleTableSlot *lslot,
+					   TupleTableSlot *rslot, bool *isnull)
+{
+	int			lattnum = op->d.varcmp.lattnum;
+	Datum		l;
+	Datum		r;
+	int			c;
+
+	Assert(lattnum >= 0 && lattnum < lslot->tts_nvalid);
+	if (lslot->tts_isnull[lattnum])
+	{
+		*isnull = true;
+		return false;
+	}
+	l = lslot->tts_values[lattnum];
+
+	if (rslot == NULL)
+		r = op->d.varcmp.constval;
+	else
+	{
+		int			rattnum = op->d.varcmp.rattnum;
+
+		Assert(rattnum >= 0 && rattnum < rslot->tts_nvalid);
+		if (rslot->tts_isnull[rattnum])
+		{
+			*isnull = true;
+			return false;
+		}
+		r = rslot->tts_values[rattnum];
+	}
+
+	*isnull = false;
+
+	/* reduce to a three-way comparison, following each type's rules */
+	switch ((ExprVarCmpType) op->d.varcmp.cmptype)
+	{
+		case VARCMP_INT4:
+			c = (DatumGetInt32(l) > DatumGetInt32(r)) -
+				(DatumGetInt32(l) < DatumGetInt32(r));
+			break;
+		case VARCMP_INT8:
+			c = (DatumGetInt64(l) > DatumGetInt64(r)) -
+				(DatumGetInt64(l) < DatumGetInt64(r));
+			break;
+		case VARCMP_FLOAT8:
+			/* NaNs are equal to each other and greater than anything else */
+			c = float8_gt(DatumGetFloat8(l), DatumGetFloat8(r)) -
+				float8_lt(DatumGetFloat8(l), DatumGetFloat8(r));
+			break;
+		default:
+			pg_unreachable();
+	}
+
+	switch ((ExprVarCmpOp) op->d.varcmp.cmpop)
+	{
+		case VARCMP_EQ:
+			return c == 0;
+		case VARCMP_NE:
+			return c != 0;
+		case VARCMP_LT:
+			return c < 0;
+		case VARCMP_LE:
+			return c <= 0;
+		case VARCMP_GT:
+			return c > 0;
+		case VARCMP_GE:
+			return c >= 0;
+	}
+
+	pg_unreachable();
+}
+
+/*
+ * Out-of-line versions of EEOP_VAR_CMP_CONST and EEOP_VAR_CMP_VAR, for JIT
+ * compiled expressions.  The QUAL variants use these too, and test the
+ * result afterwards.
+ */
+void
+ExecEvalVarCmpConst(ExprState *state, ExprEvalStep *op, ExprContext *econtext)
+{
+	TupleTableSlot *innerslot = econtext->ecxt_innertuple;
+	TupleTableSlot *outerslot = econtext->ecxt_outertuple;
+	TupleTableSlot *scanslot = econtext->ecxt_scantuple;
+	bool		isnull;
+
+	*op->resvalue =
+		BoolGetDatum(ExecEvalVarCmpInternal(op, VARCMP_SLOT(op->d.varcmp.lslot),
+											NULL, &isnull));
+	*op->resnull = isnull;
+}
+
+void
+ExecEvalVarCmpVar(ExprState *state, ExprEvalStep *op, ExprContext *econtext)
+{
+	TupleTableSlot *innerslot = econtext->ecxt_innertuple;
+	TupleTableSlot *outerslot = econtext->ecxt_outertuple;
+	TupleTableSlot *scanslot = econtext->ecxt_scantuple;
+	bool		isnull;
+
+	*op->resvalue =
+		BoolGetDatum(ExecEvalVarCmpInternal(op, VARCMP_SLOT(op->d.varcmp.lslot),
+											VARCMP_SLOT(op->d.varcmp.rslot),
+											&isnull));
+	*op->resnull = isnull;
+}
+
 /*
  * Evaluate a PARAM_EXEC parameter.
  *
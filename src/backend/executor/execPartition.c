@@ -134,6 +134,15 @@ struct PartitionTupleRouting
  *		the index corresponds to the PartitionDispatch for it in its
  *		partition_dispatch_info array.  -1 indicates we've not yet allocated
  *		anything in PartitionTupleRouting for the partition.
+ *
+ * last_bound_offset, last_part_index, last_found_count
+ *		The list or range bound, and the partition it leads to, that the
+ *		last tuple routed through this table matched, and how many tuples in
+ *		a row have gone to that partition.  Once that exceeds
+ *		PARTITION_CACHED_FIND_THRESHOLD, get_partition_for_tuple checks the
+ *		bound before searching all of them, since rows that arrive ordered
+ *		or clustered by the partition key tend to go to the same partition
+ *		as the row before.  last_bound_offset is -1 if not valid.
  *-----------------------
  */
 typedef struct PartitionDispatchData
@@ -144,9 +153,14 @@ typedef struct PartitionDispatchData
 	PartitionDesc partdesc;
 	TupleTableSlot *tupslot;
 	AttrNumber *tupmap;
+	int			last_bound_offset;
+	int			last_part_index;
+	int			last_found_count;
 	int			indexes[FLEXIBLE_ARRAY_MEMBER];
 }			PartitionDispatchData;
 
+#define PARTITION_CACHED_FIND_THRESHOLD 16
+
 /* struct to hold result relations coming from UPDATE subplans */
 typedef struct SubplanResultRelHashElem
 {
@@ -1028,6 +1042,9 @@ ExecInitPartitionDispatchInfo(EState *estate,
 	pd->key = RelationGetPartitionKey(rel);
 	pd->keystate = NIL;
 	pd->partdesc = partdesc;
+	pd->last_bound_offset = -1;
+	pd->last_part_index = -1;
+	pd->last_found_count = 0;
 	if (parent_pd != NULL)
 	{
 		TupleDesc	tupdesc = RelationGetDescr(rel);
@@ -1224,6 +1241,28 @@ FormPartitionKeyDatum(PartitionDispatch pd,
 		elog(ERROR, "wrong number of partition key expressions");
 }
 
+/*
+ * remember_partition_bound
+ *		Note that a tuple matched the list or range bound at bound_offset,
+ *		leading to partition part_index; see PartitionDispatchData.
+ */
+static inline void
+remember_partition_bound(PartitionDispatch pd, int bound_offset,
+						 int part_index)
+{
+	if (bound_offset == pd->last_bound_offset)
+	{
+		if (pd->last_found_count < PARTITION_CACHED_FIND_THRESHOLD)
+			pd->last_found_count++;
+	}
+	else
+	{
+		pd->last_bound_offset = bound_offset;
+		pd->last_part_index = part_index;
+		pd->last_found_count = 1;
+	}
+}
+
 /*
  * get_partition_for_tuple
  *		Finds partition of relation which accepts the partition key specified
@@ -1264,17 +1303,31 @@ get_partition_for_tuple(PartitionDispatch pd, Datum *values, bool *isnull)
 			{
 				if (partition_bound_accepts_nulls(boundinfo))
 					part_index = boundinfo->null_index;
+				pd->last_found_count = 0;
 			}
 			else
 			{
 				bool		equal = false;
 
+				/* Try the value the preceding tuples have kept matching */
+				if (pd->last_found_count >= PARTITION_CACHED_FIND_THRESHOLD &&
+					DatumGetInt32(FunctionCall2Coll(&key->partsupfunc[0],
+													key->partcollation[0],
+													boundinfo->datums[pd->last_bound_offset][0],
+													values[0])) == 0)
+					return pd->last_part_index;
+
 				bound_offset = partition_list_bsearch(key->partsupfunc,
 													  key->partcollation,
 													  boundinfo,
 													  values[0], &equal);
 				if (bound_offset >= 0 && equal)
+				{
 					part_index = boundinfo->indexes[bound_offset];
+					remember_partition_bound(pd, bound_offset, part_index);
+				}
+				else
+					pd->last_found_count = 0;
 			}
 			break;
 
@@ -1299,6 +1352,31 @@ get_partition_for_tuple(PartitionDispatch pd, Datum *values, bool *isnull)
 
 				if (!range_partkey_has_null)
 				{
+					/*
+					 * Try the range the preceding tuples have kept falling
+					 * into: its lower bound must be less than or equal to the
+					 * tuple value, and its upper bound greater.
+					 */
+					if (pd->last_found_count >= PARTITION_CACHED_FIND_THRESHOLD)
+					{
+						int			offset = pd->last_bound_offset;
+
+						Assert(offset + 1 < boundinfo->ndatums);
+						if (partition_rbound_datum_cmp(key->partsupfunc,
+													   key->partcollation,
+													   boundinfo->datums[offset],
+													   boundinfo->kind[offset],
+													   values,
+													   key->partnatts) <= 0 &&
+							partition_rbound_datum_cmp(key->partsupfunc,
+													   key->partcollation,
+													   boundinfo->datums[offset + 1],
+													   boundinfo->kind[offset + 1],
+													   values,
+													   key->partnatts) > 0)
+							return pd->last_part_index;
+					}
+
 					bound_offset = partition_range_datum_bsearch(key->partsupfunc,
 																 key->partcollation,
 																 boundinfo,
@@ -1313,7 +1391,13 @@ get_partition_for_tuple(PartitionDispatch pd, Datum *values, bool *isnull)
 					 * actually exists one.
 					 */
 					part_index = boundinfo->indexes[bound_offset + 1];
+					if (part_index >= 0)
+						remember_partition_bound(pd, bound_offset, part_index);
+					else
+						pd->last_found_count = 0;
 				}
+				else
+					pd->last_found_count = 0;
 			}
 			break;
 
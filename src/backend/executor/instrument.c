@@ -196,6 +196,14 @@ BufferUsageAdd(BufferUsage *dst, const BufferUsage *add)
 	dst->local_blks_read += add->local_blks_read;
 	dst->local_blks_dirtied += add->local_blks_dirtied;
 	dst->local_blks_written += add->local_blks_written;
+	dst->undo_blks_hit += add->undo_blks_hit;
+	dst->undo_blks_read += add->undo_blks_read;
+	dst->undo_blks_dirtied += add->undo_blks_dirtied;
+	dst->undo_records += add->undo_records;
+	dst->undo_bytes += add->undo_bytes;
+	dst->wal_records += add->wal_records;
+	dst->wal_fpi += add->wal_fpi;
+	dst->wal_bytes += add->wal_bytes;
 	dst->temp_blks_read += add->temp_blks_read;
 	dst->temp_blks_written += add->temp_blks_written;
 	INSTR_TIME_ADD(dst->blk_read_time, add->blk_read_time);
@@ -216,6 +224,14 @@ BufferUsageAccumDiff(BufferUsage *dst,
 	dst->local_blks_read += add->local_blks_read - sub->local_blks_read;
 	dst->local_blks_dirtied += add->local_blks_dirtied - sub->local_blks_dirtied;
 	dst->local_blks_written += add->local_blks_written - sub->local_blks_written;
+	dst->undo_blks_hit += add->undo_blks_hit - sub->undo_blks_hit;
+	dst->undo_blks_read += add->undo_blks_read - sub->undo_blks_read;
+	dst->undo_blks_dirtied += add->undo_blks_dirtied - sub->undo_blks_dirtied;
+	dst->undo_records += add->undo_records - sub->undo_records;
+	dst->undo_bytes += add->undo_bytes - sub->undo_bytes;
+	dst->wal_records += add->wal_records - sub->wal_records;
+	dst->wal_fpi += add->wal_fpi - sub->wal_fpi;
+	dst->wal_bytes += add->wal_bytes - sub->wal_bytes;
 	dst->temp_blks_read += add->temp_blks_read - sub->temp_blks_read;
 	dst->temp_blks_written += add->temp_blks_written - sub->temp_blks_written;
 	INSTR_TIME_ACCUM_DIFF(dst->blk_read_time,
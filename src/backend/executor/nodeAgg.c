@@ -194,6 +194,32 @@
  *	  transition values.  hashcontext is the single context created to support
  *	  all hash tables.
  *
+ *	  Spilling to disk:
+ *
+ *	  The hash tables can't always be kept within work_mem, as the planner's
+ *	  estimate of the number of groups may be far off.  Once the memory used
+ *	  by the hash tables exceeds work_mem, we enter "spill mode": input tuples
+ *	  whose group is already in memory are still aggregated as usual, but
+ *	  tuples of new groups are written to temporary files instead, one file
+ *	  for each of a few partitions of each hash table, chosen by bits of the
+ *	  tuple's hash value.  After the groups in memory have been returned, the
+ *	  hash tables are emptied, and each partition is read back in turn as a
+ *	  "batch" and aggregated the same way.  A batch whose groups don't fit in
+ *	  memory either is partitioned again, using the next bits of the hash,
+ *	  and so on.  As the groups in memory are never spilled themselves, and
+ *	  at least one group is created in every pass, this always terminates.
+ *
+ *	  Parallel HashAggregate:
+ *
+ *	  A parallel-aware AGG_HASHED node divides the groups between the
+ *	  participants of a parallel query, rather than having each of them
+ *	  aggregate its share of the input partially for the leader to combine.
+ *	  All participants first write their input tuples to shared tuplestores,
+ *	  a few for each participant, chosen by the leading bits of the hash
+ *	  value.  Once all the input has been written, they claim one partition
+ *	  after the other and aggregate it entirely, the same way as a spilled
+ *	  batch, so that each group is formed and returned by just one of them.
+ *
  *    Transition / Combine function invocation:
  *
  *    For performance reasons transition functions, including combine
@@ -229,14 +255,89 @@
 #include "optimizer/optimizer.h"
 #include "parser/parse_agg.h"
 #include "parser/parse_coerce.h"
+#include "pgstat.h"
+#include "port/atomics.h"
+#include "storage/barrier.h"
+#include "storage/buffile.h"
 #include "utils/acl.h"
 #include "utils/builtins.h"
+#include "utils/dynahash.h"
 #include "utils/lsyscache.h"
 #include "utils/memutils.h"
+#include "utils/sharedtuplestore.h"
 #include "utils/syscache.h"
 #include "utils/tuplesort.h"
 #include "utils/datum.h"
 
+/*
+ * Limits of the number of partitions the input of a hash table is spilled
+ * to in one pass.  Each partition file has its own buffer, so there can't
+ * be too many of them, but a partition that turns out not to fit in memory
+ * is simply partitioned again.
+ */
+#define HASHAGG_MIN_PARTITIONS	4
+#define HASHAGG_MAX_PARTITIONS	32
+
+/*
+ * A Parallel HashAggregate divides its input into a few partitions for each
+ * participant, so that the work can be shared out evenly even if they don't
+ * all take the same time.  Every participant has a write buffer for each
+ * partition, so there's a limit to that, too.
+ */
+#define HASHAGG_PARALLEL_PARTITIONS_PER_PARTICIPANT	4
+#define HASHAGG_MAX_PARALLEL_PARTITIONS	64
+
+/*
+ * HashAggSpill - the partitions the input tuples of a hashed grouping set
+ * are written to in spill mode, when their group isn't in memory.  The
+ * partition is chosen by the bits of the hash value following the used_bits
+ * bits already used to partition the tuples in earlier passes.
+ */
+typedef struct HashAggSpill
+{
+	int			npartitions;	/* number of partitions */
+	int			partition_bits; /* log2 of npartitions */
+	int			used_bits;		/* hash bits used by earlier passes */
+	BufFile   **partitions;		/* partition files, NULL until first used */
+	int64	   *ntuples;		/* number of tuples in each partition */
+} HashAggSpill;
+
+/*
+ * HashAggBatch - a spilled partition of the input of a hashed grouping set,
+ * yet to be aggregated.
+ */
+typedef struct HashAggBatch
+{
+	int			setno;			/* grouping set the tuples belong to */
+	int			used_bits;		/* hash bits used to partition them */
+	BufFile    *input_file;		/* spilled tuples, rewound */
+	SharedTuplestoreAccessor *input_sts;	/* or shared partition */
+	int64		input_tuples;	/* number of tuples in input_file */
+} HashAggBatch;
+
+/*
+ * ParallelAggState - shared state of a Parallel HashAggregate, followed by
+ * a SharedTuplestore for each partition of the input.
+ */
+typedef struct ParallelAggState
+{
+	Barrier		barrier;		/* PAGG_PHASE_* */
+	pg_atomic_uint32 next_partition;	/* next partition to be claimed */
+	int			nparticipants;	/* number of participants, with the leader */
+	int			npartitions;	/* number of partitions */
+	int			partition_bits; /* log2 of npartitions */
+	Size		sts_size;		/* space for each SharedTuplestore */
+	SharedFileSet fileset;		/* space for the partition files */
+} ParallelAggState;
+
+#define PAGG_PHASE_PARTITIONING		0
+#define PAGG_PHASE_AGGREGATING		1
+
+#define ParallelAggPartition(pstate, i) \
+	((SharedTuplestore *) ((char *) (pstate) + \
+						   MAXALIGN(sizeof(ParallelAggState)) + \
+						   (i) * (pstate)->sts_size))
+
 
 static void select_current_set(AggState *aggstate, int setno, bool is_hash);
 static void initialize_phase(AggState *aggstate, int newphase);
@@ -272,10 +373,27 @@ static TupleTableSlot *project_aggregates(AggState *aggstate);
 static Bitmapset *find_unaggregated_cols(AggState *aggstate);
 static bool find_unaggregated_cols_walker(Node *node, Bitmapset **colnos);
 static void build_hash_table(AggState *aggstate);
-static TupleHashEntryData *lookup_hash_entry(AggState *aggstate);
+static TupleTableSlot *prepare_hash_slot(AggState *aggstate);
+static AggStatePerGroup lookup_hash_entry(AggState *aggstate);
 static void lookup_hash_entries(AggState *aggstate);
+static void hash_agg_check_limits(AggState *aggstate);
+static void hashagg_spill_init(AggState *aggstate, HashAggSpill *spill,
+							   int used_bits, double input_groups);
+static void hashagg_spill_tuple(AggState *aggstate, HashAggSpill *spill,
+								TupleTableSlot *inputslot, uint32 hash);
+static void hashagg_spill_finish(AggState *aggstate, HashAggSpill *spill,
+								 int setno);
+static void hashagg_finish_initial_spills(AggState *aggstate);
+static MinimalTuple hashagg_batch_read(HashAggBatch *batch);
+static void hashagg_batch_close(HashAggBatch *batch);
+static void hashagg_reset_spill_state(AggState *aggstate);
+static int	hashagg_parallel_partitions(AggState *aggstate, int nparticipants);
+static void hashagg_shared_init(AggState *aggstate, ParallelAggState *pstate);
+static void hashagg_partition_shared(AggState *aggstate);
+static bool hashagg_claim_shared_partition(AggState *aggstate);
 static TupleTableSlot *agg_retrieve_direct(AggState *aggstate);
 static void agg_fill_hash_table(AggState *aggstate);
+static bool agg_refill_hash_table(AggState *aggstate);
 static TupleTableSlot *agg_retrieve_hash_table(AggState *aggstate);
 static Datum GetAggInitVal(Datum textInitVal, Oid transtype);
 static void build_pertrans_for_aggref(AggStatePerTrans pertrans,
@@ -1258,7 +1376,8 @@ find_unaggregated_cols_walker(Node *node, Bitmapset **colnos)
  *
  * The contents of the hash tables always live in the hashcontext's per-tuple
  * memory context (there is only one of these for all tables together, since
- * they are all reset at the same time).
+ * they are all reset at the same time).  The tables themselves live in
+ * hash_metacxt, so that their memory is counted against the limit, too.
  */
 static void
 build_hash_table(AggState *aggstate)
@@ -1289,7 +1408,7 @@ build_hash_table(AggState *aggstate)
 														perhash->aggnode->grpCollations,
 														perhash->aggnode->numGroups,
 														additionalsize,
-														aggstate->ss.ps.state->es_query_cxt,
+														aggstate->hash_metacxt,
 														aggstate->hashcontext->ecxt_per_tuple_memory,
 														tmpmem,
 														DO_AGGSPLIT_SKIPFINAL(aggstate->aggsplit));
@@ -1455,24 +1574,18 @@ hash_agg_entry_size(int numAggs)
 }
 
 /*
- * Find or create a hashtable entry for the tuple group containing the current
- * tuple (already set in tmpcontext's outertuple slot), in the current grouping
- * set (which the caller must have selected - note that initialize_aggregate
- * depends on this).
- *
- * When called, CurrentMemoryContext should be the per-query context.
+ * Transfer just the grouping columns of the current tuple (already set in
+ * tmpcontext's outertuple slot) into the current grouping set's hashslot,
+ * and return that.
  */
-static TupleHashEntryData *
-lookup_hash_entry(AggState *aggstate)
+static TupleTableSlot *
+prepare_hash_slot(AggState *aggstate)
 {
 	TupleTableSlot *inputslot = aggstate->tmpcontext->ecxt_outertuple;
 	AggStatePerHash perhash = &aggstate->perhash[aggstate->current_set];
 	TupleTableSlot *hashslot = perhash->hashslot;
-	TupleHashEntryData *entry;
-	bool		isnew;
 	int			i;
 
-	/* transfer just the needed columns into hashslot */
 	slot_getsomeattrs(inputslot, perhash->largestGrpColIdx);
 	ExecClearTuple(hashslot);
 
@@ -1485,6 +1598,50 @@ lookup_hash_entry(AggState *aggstate)
 	}
 	ExecStoreVirtualTuple(hashslot);
 
+	return hashslot;
+}
+
+/*
+ * Find or create a hashtable entry for the tuple group containing the current
+ * tuple (already set in tmpcontext's outertuple slot), in the current grouping
+ * set (which the caller must have selected - note that initialize_aggregate
+ * depends on this), and return its per-group states.
+ *
+ * In spill mode, no new entries are created: if the group isn't in memory,
+ * the tuple is written to the grouping set's spill partitions instead, and
+ * NULL is returned.
+ *
+ * When called, CurrentMemoryContext should be the per-query context.
+ */
+static AggStatePerGroup
+lookup_hash_entry(AggState *aggstate)
+{
+	TupleTableSlot *inputslot = aggstate->tmpcontext->ecxt_outertuple;
+	AggStatePerHash perhash = &aggstate->perhash[aggstate->current_set];
+	TupleTableSlot *hashslot = prepare_hash_slot(aggstate);
+	TupleHashEntryData *entry;
+	bool		isnew;
+
+	if (aggstate->hash_spill_mode)
+	{
+		/* find the hashtable entry, or spill the tuple if there's none */
+		entry = LookupTupleHashEntry(perhash->hashtable, hashslot, NULL);
+		if (entry == NULL)
+		{
+			HashAggSpill *spill = &aggstate->hash_spills[aggstate->current_set];
+
+			if (spill->partitions == NULL)
+				hashagg_spill_init(aggstate, spill, 0,
+								   perhash->aggnode->numGroups);
+			hashagg_spill_tuple(aggstate, spill, inputslot,
+								TupleHashTableHashSlot(perhash->hashtable,
+													   hashslot));
+			return NULL;
+		}
+
+		return (AggStatePerGroup) entry->additional;
+	}
+
 	/* find or create the hashtable entry using the filtered tuple */
 	entry = LookupTupleHashEntry(perhash->hashtable, hashslot, &isnew);
 
@@ -1509,14 +1666,19 @@ lookup_hash_entry(AggState *aggstate)
 
 			initialize_aggregate(aggstate, pertrans, pergroupstate);
 		}
+
+		aggstate->hash_ngroups_current++;
+		hash_agg_check_limits(aggstate);
 	}
 
-	return entry;
+	return (AggStatePerGroup) entry->additional;
 }
 
 /*
  * Look up hash entries for the current tuple in all hashed grouping sets,
  * returning an array of pergroup pointers suitable for advance_aggregates.
+ * The pointer is NULL for the grouping sets the tuple has been spilled for,
+ * which makes advance_aggregates skip them.
  *
  * Be aware that lookup_hash_entry can reset the tmpcontext.
  */
@@ -1530,8 +1692,415 @@ lookup_hash_entries(AggState *aggstate)
 	for (setno = 0; setno < numHashes; setno++)
 	{
 		select_current_set(aggstate, setno, true);
-		pergroup[setno] = lookup_hash_entry(aggstate)->additional;
+		pergroup[setno] = lookup_hash_entry(aggstate);
+	}
+}
+
+/*
+ * Enter spill mode once the hash tables have outgrown the memory limit.
+ *
+ * This is checked whenever a new group is created, so there's at least one
+ * group in memory in every pass, and so every pass makes progress.
+ */
+static void
+hash_agg_check_limits(AggState *aggstate)
+{
+	Size		meta_mem;
+	Size		hash_mem;
+
+	meta_mem = MemoryContextMemAllocated(aggstate->hash_metacxt, true);
+	hash_mem = MemoryContextMemAllocated(aggstate->hashcontext->ecxt_per_tuple_memory,
+										 true);
+
+	if (meta_mem + hash_mem > aggstate->hash_mem_limit)
+		aggstate->hash_spill_mode = true;
+}
+
+/*
+ * Prepare to spill input tuples of a hashed grouping set, whose groups are
+ * expected to number input_groups.  Enough partitions are used for each to
+ * fit in memory, if that estimate is right, within the fixed limits.
+ */
+static void
+hashagg_spill_init(AggState *aggstate, HashAggSpill *spill, int used_bits,
+				   double input_groups)
+{
+	MemoryContext oldcontext;
+	double		mem_wanted;
+	int			npartitions;
+	int			partition_bits;
+
+	mem_wanted = input_groups * hash_agg_entry_size(aggstate->numtrans);
+	npartitions = (int) Min(1.0 + mem_wanted / aggstate->hash_mem_limit,
+							(double) HASHAGG_MAX_PARTITIONS);
+	npartitions = Max(npartitions, HASHAGG_MIN_PARTITIONS);
+
+	/* there are only so many bits of the hash to go around */
+	partition_bits = my_log2(npartitions);
+	if (used_bits + partition_bits > 32)
+		partition_bits = 32 - used_bits;
+
+	spill->npartitions = 1 << partition_bits;
+	spill->partition_bits = partition_bits;
+	spill->used_bits = used_bits;
+
+	oldcontext = MemoryContextSwitchTo(aggstate->ss.ps.state->es_query_cxt);
+	spill->partitions = palloc0(sizeof(BufFile *) * spill->npartitions);
+	spill->ntuples = palloc0(sizeof(int64) * spill->npartitions);
+	MemoryContextSwitchTo(oldcontext);
+}
+
+/*
+ * Write an input tuple to the spill partition its hash value selects.
+ */
+static void
+hashagg_spill_tuple(AggState *aggstate, HashAggSpill *spill,
+					TupleTableSlot *inputslot, uint32 hash)
+{
+	MinimalTuple tuple;
+	bool		shouldFree;
+	BufFile    *file;
+	int			partition = 0;
+
+	if (spill->partition_bits > 0)
+		partition = (hash << spill->used_bits) >> (32 - spill->partition_bits);
+
+	file = spill->partitions[partition];
+	if (file == NULL)
+	{
+		MemoryContext oldcontext;
+
+		oldcontext = MemoryContextSwitchTo(aggstate->ss.ps.state->es_query_cxt);
+		file = spill->partitions[partition] = BufFileCreateCompressedTemp(false);
+		MemoryContextSwitchTo(oldcontext);
+	}
+
+	tuple = ExecFetchSlotMinimalTuple(inputslot, &shouldFree);
+
+	if (BufFileWrite(file, (void *) tuple, tuple->t_len) != tuple->t_len)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not write to hash-aggregate temporary file: %m")));
+
+	spill->ntuples[partition]++;
+	aggstate->hash_ever_spilled = true;
+
+	if (shouldFree)
+		pfree(tuple);
+}
+
+/*
+ * Turn the partitions of a spill into batches, to be aggregated after the
+ * groups in memory have been returned.
+ */
+static void
+hashagg_spill_finish(AggState *aggstate, HashAggSpill *spill, int setno)
+{
+	MemoryContext oldcontext;
+	int			i;
+
+	if (spill->partitions == NULL)
+		return;
+
+	oldcontext = MemoryContextSwitchTo(aggstate->ss.ps.state->es_query_cxt);
+
+	for (i = 0; i < spill->npartitions; i++)
+	{
+		BufFile    *file = spill->partitions[i];
+		HashAggBatch *batch;
+
+		if (file == NULL)
+			continue;
+
+		if (BufFileSeek(file, 0, 0L, SEEK_SET))
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not rewind hash-aggregate temporary file: %m")));
+
+		batch = palloc(sizeof(HashAggBatch));
+		batch->setno = setno;
+		batch->used_bits = spill->used_bits + spill->partition_bits;
+		batch->input_file = file;
+		batch->input_sts = NULL;
+		batch->input_tuples = spill->ntuples[i];
+
+		aggstate->hash_batches = lappend(aggstate->hash_batches, batch);
+	}
+
+	MemoryContextSwitchTo(oldcontext);
+
+	pfree(spill->partitions);
+	pfree(spill->ntuples);
+	spill->partitions = NULL;
+	spill->ntuples = NULL;
+	spill->npartitions = 0;
+}
+
+/*
+ * Finish the spills of all the hashed grouping sets, once the input has been
+ * read entirely.
+ */
+static void
+hashagg_finish_initial_spills(AggState *aggstate)
+{
+	int			setno;
+
+	for (setno = 0; setno < aggstate->num_hashes; setno++)
+		hashagg_spill_finish(aggstate, &aggstate->hash_spills[setno], setno);
+
+	aggstate->hash_spill_mode = false;
+}
+
+/*
+ * Read the next tuple of a batch, or return NULL at the end of it.  The tuple
+ * is palloc'd, unless it comes from a shared partition, whose accessor owns
+ * it.
+ */
+static MinimalTuple
+hashagg_batch_read(HashAggBatch *batch)
+{
+	MinimalTuple tuple;
+	uint32		t_len;
+	size_t		nread;
+
+	if (batch->input_sts != NULL)
+		return sts_parallel_scan_next(batch->input_sts, NULL);
+
+	nread = BufFileRead(batch->input_file, (void *) &t_len, sizeof(t_len));
+	if (nread == 0)
+		return NULL;
+	if (nread != sizeof(t_len))
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not read from hash-aggregate temporary file: %m")));
+
+	tuple = (MinimalTuple) palloc(t_len);
+	tuple->t_len = t_len;
+
+	nread = BufFileRead(batch->input_file,
+						(void *) ((char *) tuple + sizeof(uint32)),
+						t_len - sizeof(uint32));
+	if (nread != t_len - sizeof(uint32))
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not read from hash-aggregate temporary file: %m")));
+
+	return tuple;
+}
+
+/*
+ * Release a batch, once aggregated or no longer needed.
+ */
+static void
+hashagg_batch_close(HashAggBatch *batch)
+{
+	if (batch->input_sts != NULL)
+		sts_end_parallel_scan(batch->input_sts);
+	else
+		BufFileClose(batch->input_file);
+	pfree(batch);
+}
+
+/*
+ * Close all spill files and forget the pending batches, as when rescanning
+ * the node or ending it before all its output was read.
+ */
+static void
+hashagg_reset_spill_state(AggState *aggstate)
+{
+	ListCell   *lc;
+	int			setno;
+
+	for (setno = 0; setno < aggstate->num_hashes; setno++)
+	{
+		HashAggSpill *spill = &aggstate->hash_spills[setno];
+		int			i;
+
+		if (spill->partitions == NULL)
+			continue;
+
+		for (i = 0; i < spill->npartitions; i++)
+		{
+			if (spill->partitions[i] != NULL)
+				BufFileClose(spill->partitions[i]);
+		}
+		pfree(spill->partitions);
+		pfree(spill->ntuples);
+		spill->partitions = NULL;
+		spill->ntuples = NULL;
+		spill->npartitions = 0;
+	}
+
+	foreach(lc, aggstate->hash_batches)
+		hashagg_batch_close((HashAggBatch *) lfirst(lc));
+	list_free(aggstate->hash_batches);
+	aggstate->hash_batches = NIL;
+
+	aggstate->hash_spill_mode = false;
+	aggstate->hash_ever_spilled = false;
+	aggstate->hash_ngroups_current = 0;
+}
+
+/*
+ * Choose the number of shared partitions for a Parallel HashAggregate: a few
+ * for each participant, or more if the groups of each wouldn't fit in
+ * memory, within the limit.  The plan's numGroups is the number of groups
+ * of all participants together.
+ */
+static int
+hashagg_parallel_partitions(AggState *aggstate, int nparticipants)
+{
+	Agg		   *node = (Agg *) aggstate->ss.ps.plan;
+	double		mem_wanted;
+	int			npartitions;
+
+	mem_wanted = (double) node->numGroups *
+		hash_agg_entry_size(aggstate->numtrans);
+	npartitions = (int) Min(1.0 + mem_wanted / aggstate->hash_mem_limit,
+							(double) HASHAGG_MAX_PARALLEL_PARTITIONS);
+	npartitions = Max(npartitions,
+					  nparticipants * HASHAGG_PARALLEL_PARTITIONS_PER_PARTICIPANT);
+	npartitions = Min(npartitions, HASHAGG_MAX_PARALLEL_PARTITIONS);
+
+	return 1 << my_log2(npartitions);
+}
+
+/*
+ * (Re)initialize the shared state of a Parallel HashAggregate, whose
+ * partition files must not exist yet, and attach to it as the leader.
+ */
+static void
+hashagg_shared_init(AggState *aggstate, ParallelAggState *pstate)
+{
+	MemoryContext oldcontext;
+	int			i;
+
+	BarrierInit(&pstate->barrier, 0);
+	pg_atomic_init_u32(&pstate->next_partition, 0);
+
+	oldcontext = MemoryContextSwitchTo(aggstate->ss.ps.state->es_query_cxt);
+
+	if (aggstate->hash_shared_partitions == NULL)
+		aggstate->hash_shared_partitions =
+			palloc0(sizeof(SharedTuplestoreAccessor *) * pstate->npartitions);
+
+	for (i = 0; i < pstate->npartitions; i++)
+	{
+		SharedTuplestore *sts = ParallelAggPartition(pstate, i);
+		char		name[MAXPGPATH];
+
+		if (aggstate->hash_shared_partitions[i] != NULL)
+			pfree(aggstate->hash_shared_partitions[i]);
+
+		/* sts_initialize doesn't forget the pages written before */
+		memset(sts, 0, pstate->sts_size);
+		snprintf(name, sizeof(name), "p%d", i);
+		aggstate->hash_shared_partitions[i] =
+			sts_initialize(sts, pstate->nparticipants, 0, 0,
+						   SHARED_TUPLESTORE_SINGLE_PASS,
+						   &pstate->fileset, name);
+	}
+
+	MemoryContextSwitchTo(oldcontext);
+
+	aggstate->hash_shared = pstate;
+}
+
+/*
+ * Parallel HashAggregate: write our share of the input tuples to the shared
+ * partitions, chosen by the leading bits of their hash value, and wait for
+ * the other participants to do the same.  A participant that arrives only
+ * once the partitioning is over, when there's no input left for it, skips
+ * straight to aggregating.
+ */
+static void
+hashagg_partition_shared(AggState *aggstate)
+{
+	ParallelAggState *pstate = aggstate->hash_shared;
+	TupleTableSlot *outerslot;
+	int			i;
+
+	if (BarrierAttach(&pstate->barrier) == PAGG_PHASE_PARTITIONING)
+	{
+		select_current_set(aggstate, 0, true);
+
+		for (;;)
+		{
+			MinimalTuple tuple;
+			bool		shouldFree;
+			uint32		hash;
+			int			partition = 0;
+
+			outerslot = fetch_input_tuple(aggstate);
+			if (TupIsNull(outerslot))
+				break;
+
+			aggstate->tmpcontext->ecxt_outertuple = outerslot;
+			hash = TupleHashTableHashSlot(aggstate->perhash[0].hashtable,
+										  prepare_hash_slot(aggstate));
+			if (pstate->partition_bits > 0)
+				partition = hash >> (32 - pstate->partition_bits);
+
+			tuple = ExecFetchSlotMinimalTuple(outerslot, &shouldFree);
+			sts_puttuple(aggstate->hash_shared_partitions[partition], NULL,
+						 tuple);
+			if (shouldFree)
+				pfree(tuple);
+
+			ResetExprContext(aggstate->tmpcontext);
+		}
+
+		for (i = 0; i < pstate->npartitions; i++)
+			sts_end_write(aggstate->hash_shared_partitions[i]);
+
+		BarrierArriveAndWait(&pstate->barrier, WAIT_EVENT_HASHAGG_PARTITIONING);
+	}
+
+	Assert(BarrierPhase(&pstate->barrier) == PAGG_PHASE_AGGREGATING);
+}
+
+/*
+ * Parallel HashAggregate: claim the next shared partition that no other
+ * participant has taken yet, and queue it as a batch to aggregate.  Returns
+ * false, when not parallel or once all partitions have been claimed.
+ */
+static bool
+hashagg_claim_shared_partition(AggState *aggstate)
+{
+	ParallelAggState *pstate = aggstate->hash_shared;
+	MemoryContext oldcontext;
+	HashAggBatch *batch;
+	uint32		partition;
+
+	if (pstate == NULL)
+		return false;
+
+	partition = pg_atomic_fetch_add_u32(&pstate->next_partition, 1);
+	if (partition >= pstate->npartitions)
+	{
+		/* nothing left for us to do */
+		BarrierDetach(&pstate->barrier);
+		return false;
 	}
+
+	oldcontext = MemoryContextSwitchTo(aggstate->ss.ps.state->es_query_cxt);
+
+	batch = palloc(sizeof(HashAggBatch));
+	batch->setno = 0;
+	batch->used_bits = pstate->partition_bits;
+	batch->input_file = NULL;
+	batch->input_sts = aggstate->hash_shared_partitions[partition];
+	/* not known, but this is only used to size its spill */
+	batch->input_tuples = aggstate->perhash[0].aggnode->numGroups /
+		pstate->npartitions;
+
+	aggstate->hash_batches = lappend(aggstate->hash_batches, batch);
+
+	MemoryContextSwitchTo(oldcontext);
+
+	sts_begin_parallel_scan(batch->input_sts);
+
+	return true;
 }
 
 /*
@@ -1683,6 +2252,7 @@ agg_retrieve_direct(AggState *aggstate)
 				 * Mixed mode; we've output all the grouped stuff and have
 				 * full hashtables, so switch to outputting those.
 				 */
+				hashagg_finish_initial_spills(aggstate);
 				initialize_phase(aggstate, 0);
 				aggstate->table_filled = true;
 				ResetTupleHashIterator(aggstate->perhash[0].hashtable,
@@ -1929,6 +2499,21 @@ agg_fill_hash_table(AggState *aggstate)
 	TupleTableSlot *outerslot;
 	ExprContext *tmpcontext = aggstate->tmpcontext;
 
+	/*
+	 * In a Parallel HashAggregate, the input is only partitioned for now; the
+	 * hash table is left empty, to be filled from the partitions we claim.
+	 */
+	if (aggstate->hash_shared != NULL)
+	{
+		hashagg_partition_shared(aggstate);
+
+		aggstate->table_filled = true;
+		select_current_set(aggstate, 0, true);
+		ResetTupleHashIterator(aggstate->perhash[0].hashtable,
+							   &aggstate->perhash[0].hashiter);
+		return;
+	}
+
 	/*
 	 * Process each outer-plan tuple, and then fetch the next one, until we
 	 * exhaust the outer plan.
@@ -1955,6 +2540,8 @@ agg_fill_hash_table(AggState *aggstate)
 		ResetExprContext(aggstate->tmpcontext);
 	}
 
+	hashagg_finish_initial_spills(aggstate);
+
 	aggstate->table_filled = true;
 	/* Initialize to walk the first hash table */
 	select_current_set(aggstate, 0, true);
@@ -1962,6 +2549,80 @@ agg_fill_hash_table(AggState *aggstate)
 						   &aggstate->perhash[0].hashiter);
 }
 
+/*
+ * ExecAgg for hashed case: aggregate the next spilled batch into the hash
+ * tables, which must have been returned entirely.  Returns false if there
+ * are no batches left.  A Parallel HashAggregate claims the next shared
+ * partition as a batch once its own are done.
+ *
+ * The tuples of the batch whose groups don't fit in memory are spilled once
+ * more, partitioned by the next bits of their hash value.
+ */
+static bool
+agg_refill_hash_table(AggState *aggstate)
+{
+	HashAggBatch *batch;
+	HashAggSpill *spill;
+	AggStatePerHash perhash;
+	TupleTableSlot *slot = aggstate->hash_spill_slot;
+	MinimalTuple tuple;
+	int			setno;
+
+	if (aggstate->hash_batches == NIL &&
+		!hashagg_claim_shared_partition(aggstate))
+		return false;
+
+	batch = (HashAggBatch *) linitial(aggstate->hash_batches);
+	aggstate->hash_batches = list_delete_first(aggstate->hash_batches);
+
+	/*
+	 * Free the groups of the previous pass.  We use rescan rather than reset,
+	 * as transfns may have registered callbacks that need to be run now.  The
+	 * other grouping sets' pergroup pointers stay NULL, so that only the
+	 * batch's grouping set is advanced.
+	 */
+	ReScanExprContext(aggstate->hashcontext);
+	for (setno = 0; setno < aggstate->num_hashes; setno++)
+	{
+		ResetTupleHashTable(aggstate->perhash[setno].hashtable);
+		aggstate->hash_pergroup[setno] = NULL;
+	}
+	aggstate->hash_ngroups_current = 0;
+	aggstate->hash_spill_mode = false;
+
+	setno = batch->setno;
+	perhash = &aggstate->perhash[setno];
+	spill = &aggstate->hash_spills[setno];
+	hashagg_spill_init(aggstate, spill, batch->used_bits,
+					   (double) batch->input_tuples);
+
+	select_current_set(aggstate, setno, true);
+
+	while ((tuple = hashagg_batch_read(batch)) != NULL)
+	{
+		CHECK_FOR_INTERRUPTS();
+
+		ExecStoreMinimalTuple(tuple, slot, batch->input_sts == NULL);
+		aggstate->tmpcontext->ecxt_outertuple = slot;
+
+		aggstate->hash_pergroup[setno] = lookup_hash_entry(aggstate);
+		advance_aggregates(aggstate);
+
+		ResetExprContext(aggstate->tmpcontext);
+	}
+	ExecClearTuple(slot);
+
+	hashagg_batch_close(batch);
+
+	hashagg_spill_finish(aggstate, spill, setno);
+	aggstate->hash_spill_mode = false;
+
+	/* Initialize to walk the refilled hash table */
+	ResetTupleHashIterator(perhash->hashtable, &perhash->hashiter);
+
+	return true;
+}
+
 /*
  * ExecAgg for hashed case: retrieving groups from hash table
  */
@@ -2024,6 +2685,13 @@ agg_retrieve_hash_table(AggState *aggstate)
 
 				continue;
 			}
+			else if (agg_refill_hash_table(aggstate))
+			{
+				/* Restart the loop with the grouping set of the new batch */
+				perhash = &aggstate->perhash[aggstate->current_set];
+
+				continue;
+			}
 			else
 			{
 				/* No more hashtables, so done */
@@ -2466,6 +3134,15 @@ ExecInitAgg(Agg *node, EState *estate, int eflags)
 		/* this is an array of pointers, not structures */
 		aggstate->hash_pergroup = pergroups;
 
+		/* state for spilling to disk, once work_mem is exhausted */
+		aggstate->hash_metacxt = AllocSetContextCreate(estate->es_query_cxt,
+													   "HashAgg meta context",
+													   ALLOCSET_DEFAULT_SIZES);
+		aggstate->hash_spills = palloc0(sizeof(HashAggSpill) * numHashes);
+		aggstate->hash_spill_slot = ExecInitExtraTupleSlot(estate, scanDesc,
+														   &TTSOpsMinimalTuple);
+		aggstate->hash_mem_limit = work_mem * 1024L;
+
 		find_hash_columns(aggstate);
 		build_hash_table(aggstate);
 		aggstate->table_filled = false;
@@ -2853,11 +3530,12 @@ ExecInitAgg(Agg *node, EState *estate, int eflags)
 		else if (aggstate->aggstrategy == AGG_MIXED && phaseidx == 0)
 		{
 			/*
-			 * No need to compute a transition function for an AGG_MIXED phase
-			 * 0 - the contents of the hashtables will have been computed
-			 * during phase 1.
+			 * The contents of the hashtables of an AGG_MIXED phase 0 are
+			 * computed during phase 1, but the tuples spilled meanwhile are
+			 * aggregated into them later, in phase 0.
 			 */
-			continue;
+			dohash = true;
+			dosort = false;
 		}
 		else if (phase->aggstrategy == AGG_PLAIN ||
 				 phase->aggstrategy == AGG_SORTED)
@@ -3385,6 +4063,10 @@ ExecEndAgg(AggState *node)
 	if (node->hashcontext)
 		ReScanExprContext(node->hashcontext);
 
+	/* Close the spill files of a hashed aggregation that wasn't finished */
+	if (node->hash_spills)
+		hashagg_reset_spill_state(node);
+
 	/*
 	 * We don't actually free any ExprContexts here (see comment in
 	 * ExecFreeExprContext), just unlinking the output one from the plan node
@@ -3426,9 +4108,13 @@ ExecReScanAgg(AggState *node)
 		 * If we do have the hash table, and the subplan does not have any
 		 * parameter changes, and none of our own parameter changes affect
 		 * input expressions of the aggregated functions, then we can just
-		 * rescan the existing hash table; no need to build it again.
+		 * rescan the existing hash table; no need to build it again.  That
+		 * doesn't work if anything was spilled, or in a Parallel
+		 * HashAggregate, as the table then only has the groups of the last
+		 * batch.
 		 */
-		if (outerPlan->chgParam == NULL &&
+		if (!node->hash_ever_spilled && node->hash_shared == NULL &&
+			outerPlan->chgParam == NULL &&
 			!bms_overlap(node->ss.ps.chgParam, aggnode->aggParams))
 		{
 			ResetTupleHashIterator(node->perhash[0].hashtable,
@@ -3485,6 +4171,7 @@ ExecReScanAgg(AggState *node)
 	 */
 	if (node->aggstrategy == AGG_HASHED || node->aggstrategy == AGG_MIXED)
 	{
+		hashagg_reset_spill_state(node);
 		ReScanExprContext(node->hashcontext);
 		/* Rebuild an empty hash table */
 		build_hash_table(node);
@@ -3515,6 +4202,125 @@ ExecReScanAgg(AggState *node)
 }
 
 
+/* ----------------------------------------------------------------
+ *						Parallel HashAggregate Support
+ * ----------------------------------------------------------------
+ */
+
+/* ----------------------------------------------------------------
+ *		ExecAggEstimate
+ *
+ *		Estimate space required for the shared partitions of a
+ *		Parallel HashAggregate.
+ * ----------------------------------------------------------------
+ */
+void
+ExecAggEstimate(AggState *node, ParallelContext *pcxt)
+{
+	int			nparticipants = pcxt->nworkers + 1;
+	int			npartitions;
+
+	Assert(node->aggstrategy == AGG_HASHED && node->num_hashes == 1);
+
+	npartitions = hashagg_parallel_partitions(node, nparticipants);
+	shm_toc_estimate_chunk(&pcxt->estimator,
+						   MAXALIGN(sizeof(ParallelAggState)) +
+						   npartitions * MAXALIGN(sts_estimate(nparticipants)));
+	shm_toc_estimate_keys(&pcxt->estimator, 1);
+}
+
+/* ----------------------------------------------------------------
+ *		ExecAggInitializeDSM
+ *
+ *		Set up the shared partitions of a Parallel HashAggregate.
+ * ----------------------------------------------------------------
+ */
+void
+ExecAggInitializeDSM(AggState *node, ParallelContext *pcxt)
+{
+	int			plan_node_id = node->ss.ps.plan->plan_node_id;
+	int			nparticipants = pcxt->nworkers + 1;
+	int			npartitions;
+	ParallelAggState *pstate;
+
+	/*
+	 * Without a real DSM segment there's no space for shared files, but no
+	 * workers either, so then we just aggregate all the input ourselves.
+	 */
+	if (pcxt->seg == NULL)
+		return;
+
+	npartitions = hashagg_parallel_partitions(node, nparticipants);
+	pstate = shm_toc_allocate(pcxt->toc,
+							  MAXALIGN(sizeof(ParallelAggState)) +
+							  npartitions * MAXALIGN(sts_estimate(nparticipants)));
+	shm_toc_insert(pcxt->toc, plan_node_id, pstate);
+
+	pstate->nparticipants = nparticipants;
+	pstate->npartitions = npartitions;
+	pstate->partition_bits = my_log2(npartitions);
+	pstate->sts_size = MAXALIGN(sts_estimate(nparticipants));
+	SharedFileSetInit(&pstate->fileset, pcxt->seg);
+
+	hashagg_shared_init(node, pstate);
+}
+
+/* ----------------------------------------------------------------
+ *		ExecAggReInitializeDSM
+ *
+ *		Reset the shared partitions before beginning a fresh scan.
+ * ----------------------------------------------------------------
+ */
+void
+ExecAggReInitializeDSM(AggState *node, ParallelContext *pcxt)
+{
+	int			plan_node_id = node->ss.ps.plan->plan_node_id;
+	ParallelAggState *pstate;
+
+	pstate = shm_toc_lookup(pcxt->toc, plan_node_id, true);
+	if (pstate == NULL)
+		return;
+
+	/* Stop reading any partition we were still aggregating */
+	hashagg_reset_spill_state(node);
+
+	/* Clear the partition files, and start over */
+	SharedFileSetDeleteAll(&pstate->fileset);
+	hashagg_shared_init(node, pstate);
+}
+
+/* ----------------------------------------------------------------
+ *		ExecAggInitializeWorker
+ *
+ *		Attach to the shared partitions of a Parallel HashAggregate.
+ * ----------------------------------------------------------------
+ */
+void
+ExecAggInitializeWorker(AggState *node, ParallelWorkerContext *pwcxt)
+{
+	int			plan_node_id = node->ss.ps.plan->plan_node_id;
+	MemoryContext oldcontext;
+	ParallelAggState *pstate;
+	int			i;
+
+	pstate = shm_toc_lookup(pwcxt->toc, plan_node_id, false);
+	SharedFileSetAttach(&pstate->fileset, pwcxt->seg);
+
+	oldcontext = MemoryContextSwitchTo(node->ss.ps.state->es_query_cxt);
+
+	node->hash_shared_partitions =
+		palloc(sizeof(SharedTuplestoreAccessor *) * pstate->npartitions);
+	for (i = 0; i < pstate->npartitions; i++)
+		node->hash_shared_partitions[i] =
+			sts_attach(ParallelAggPartition(pstate, i),
+					   ParallelWorkerNumber + 1, &pstate->fileset);
+
+	MemoryContextSwitchTo(oldcontext);
+
+	node->hash_shared = pstate;
+}
+
+
 /***********************************************************************
  * API exposed to aggregate functions
  ***********************************************************************/
@@ -21,7 +21,7 @@
 #include "executor/nodeGatherMerge.h"
 #include "executor/nodeSubplan.h"
 #include "executor/tqueue.h"
-#include "lib/binaryheap.h"
+#include "lib/losertree.h"
 #include "miscadmin.h"
 #include "optimizer/optimizer.h"
 #include "utils/memutils.h"
@@ -52,7 +52,7 @@ typedef struct GMReaderTupleBuffer
 } GMReaderTupleBuffer;
 
 static TupleTableSlot *ExecGatherMerge(PlanState *pstate);
-static int32 heap_compare_slots(Datum a, Datum b, void *arg);
+static int32 gm_compare_slots(Datum a, Datum b, void *arg);
 static TupleTableSlot *gather_merge_getnext(GatherMergeState *gm_state);
 static HeapTuple gm_readnext_tuple(GatherMergeState *gm_state, int nreader,
 								   bool nowait, bool *done);
@@ -388,7 +388,7 @@ ExecReScanGatherMerge(GatherMergeState *node)
  * not leaking memory across rescans.
  *
  * In the gm_slots[] array, index 0 is for the leader, and indexes 1 to n
- * are for workers.  The values placed into gm_heap correspond to indexes
+ * are for workers.  The values placed into gm_tree correspond to indexes
  * in gm_slots[].  The gm_tuple_buffers[] array, however, is indexed from
  * 0 to n-1; it has no entry for the leader.
  */
@@ -428,9 +428,9 @@ gather_merge_setup(GatherMergeState *gm_state)
 	}
 
 	/* Allocate the resources for the merge */
-	gm_state->gm_heap = binaryheap_allocate(nreaders + 1,
-											heap_compare_slots,
-											gm_state);
+	gm_state->gm_tree = losertree_allocate(nreaders + 1,
+										   gm_compare_slots,
+										   gm_state);
 }
 
 /*
@@ -438,7 +438,7 @@ gather_merge_setup(GatherMergeState *gm_state)
  *
  * Reset data structures to ensure they're empty.  Then pull at least one
  * tuple from leader + each worker (or set its "done" indicator), and set up
- * the heap.
+ * the merge tree.
  */
 static void
 gather_merge_init(GatherMergeState *gm_state)
@@ -465,15 +465,15 @@ gather_merge_init(GatherMergeState *gm_state)
 		ExecClearTuple(gm_state->gm_slots[i + 1]);
 	}
 
-	/* Reset binary heap to empty */
-	binaryheap_reset(gm_state->gm_heap);
+	/* Reset merge tree to empty */
+	losertree_reset(gm_state->gm_tree);
 
 	/*
 	 * First, try to read a tuple from each worker (including leader) in
 	 * nowait mode.  After this, if not all workers were able to produce a
 	 * tuple (or a "done" indication), then re-read from remaining workers,
 	 * this time using wait mode.  Add all live readers (those producing at
-	 * least one tuple) to the heap.
+	 * least one tuple) to the merge tree.
 	 */
 reread:
 	for (i = 0; i <= nreaders; i++)
@@ -488,8 +488,8 @@ reread:
 			{
 				/* Don't have a tuple yet, try to get one */
 				if (gather_merge_readnext(gm_state, i, nowait))
-					binaryheap_add_unordered(gm_state->gm_heap,
-											 Int32GetDatum(i));
+					losertree_add_unordered(gm_state->gm_tree,
+											Int32GetDatum(i));
 			}
 			else
 			{
@@ -513,8 +513,8 @@ reread:
 		}
 	}
 
-	/* Now heapify the heap. */
-	binaryheap_build(gm_state->gm_heap);
+	/* Now play the tournament between them. */
+	losertree_build(gm_state->gm_tree);
 
 	gm_state->gm_initialized = true;
 }
@@ -542,7 +542,7 @@ gather_merge_clear_tuples(GatherMergeState *gm_state)
 /*
  * Read the next tuple for gather merge.
  *
- * Fetch the sorted tuple out of the heap.
+ * Fetch the sorted tuple out of the merge tree.
  */
 static TupleTableSlot *
 gather_merge_getnext(GatherMergeState *gm_state)
@@ -553,7 +553,7 @@ gather_merge_getnext(GatherMergeState *gm_state)
 	{
 		/*
 		 * First time through: pull the first tuple from each participant, and
-		 * set up the heap.
+		 * set up the merge tree.
 		 */
 		gather_merge_init(gm_state);
 	}
@@ -561,31 +561,31 @@ gather_merge_getnext(GatherMergeState *gm_state)
 	{
 		/*
 		 * Otherwise, pull the next tuple from whichever participant we
-		 * returned from last time, and reinsert that participant's index into
-		 * the heap, because it might now compare differently against the
-		 * other elements of the heap.
+		 * returned from last time, and replay that participant's comparisons
+		 * in the merge tree, because it might now compare differently against
+		 * the other participants.
 		 */
-		i = DatumGetInt32(binaryheap_first(gm_state->gm_heap));
+		i = DatumGetInt32(losertree_first(gm_state->gm_tree));
 
 		if (gather_merge_readnext(gm_state, i, false))
-			binaryheap_replace_first(gm_state->gm_heap, Int32GetDatum(i));
+			losertree_replace_first(gm_state->gm_tree, Int32GetDatum(i));
 		else
 		{
-			/* reader exhausted, remove it from heap */
-			(void) binaryheap_remove_first(gm_state->gm_heap);
+			/* reader exhausted, remove it from merge tree */
+			losertree_remove_first(gm_state->gm_tree);
 		}
 	}
 
-	if (binaryheap_empty(gm_state->gm_heap))
+	if (losertree_empty(gm_state->gm_tree))
 	{
-		/* All the queues are exhausted, and so is the heap */
+		/* All the queues are exhausted, and so is the merge tree */
 		gather_merge_clear_tuples(gm_state);
 		return NULL;
 	}
 	else
 	{
 		/* Return next tuple from whichever participant has the leading one */
-		i = DatumGetInt32(binaryheap_first(gm_state->gm_heap));
+		i = DatumGetInt32(losertree_first(gm_state->gm_tree));
 		return gm_state->gm_slots[i];
 	}
 }
@@ -736,7 +736,7 @@ gm_readnext_tuple(GatherMergeState *gm_state, int nreader, bool nowait,
 }
 
 /*
- * We have one slot for each item in the heap array.  We use SlotNumber
+ * We have one slot for each leaf of the merge tree.  We use SlotNumber
  * to store slot indexes.  This doesn't actually provide any formal
  * type-safety, but it makes the code more self-documenting.
  */
@@ -746,7 +746,7 @@ typedef int32 SlotNumber;
  * Compare the tuples in the two given slots.
  */
 static int32
-heap_compare_slots(Datum a, Datum b, void *arg)
+gm_compare_slots(Datum a, Datum b, void *arg)
 {
 	GatherMergeState *node = (GatherMergeState *) arg;
 	SlotNumber	slot1 = DatumGetInt32(a);
@@ -776,10 +776,7 @@ heap_compare_slots(Datum a, Datum b, void *arg)
 									  datum2, isNull2,
 									  sortKey);
 		if (compare != 0)
-		{
-			INVERT_COMPARE_RESULT(compare);
 			return compare;
-		}
 	}
 	return 0;
 }
@@ -37,7 +37,9 @@
 #include "miscadmin.h"
 #include "pgstat.h"
 #include "port/atomics.h"
+#include "port/pg_bitutils.h"
 #include "utils/dynahash.h"
+#include "utils/hashutils.h"
 #include "utils/memutils.h"
 #include "utils/lsyscache.h"
 #include "utils/syscache.h"
@@ -79,6 +81,28 @@ static bool ExecParallelHashTuplePrealloc(HashJoinTable hashtable,
 										  size_t size);
 static void ExecParallelHashMergeCounters(HashJoinTable hashtable);
 static void ExecParallelHashCloseBatchAccessors(HashJoinTable hashtable);
+static uint32 ExecHashBloomChooseSize(double ntuples);
+static inline void ExecHashBloomAdd(HashBloomFilter *bloom, uint32 hashvalue);
+static inline bool ExecHashBloomCheck(HashBloomFilter *bloom, uint32 hashvalue);
+static void ExecHashBloomFinish(HashJoinTable hashtable);
+static void ExecParallelHashMergeBloom(HashJoinTable hashtable);
+static void ExecParallelHashFetchBloom(HashJoinTable hashtable);
+
+/*
+ * Parameters of the Bloom filter on the inner hash values.  We aim for about
+ * 2% false positives, and don't bother if the filter would be too large to
+ * stay in cache, or turns out too saturated once built.  Once pushed down,
+ * the filter is checked for HASH_BLOOM_SAMPLE_TUPLES outer tuples, and then
+ * switched off if it didn't discard at least HASH_BLOOM_MIN_REJECT_FRAC of
+ * them.
+ */
+#define HASH_BLOOM_BITS_PER_TUPLE	10
+#define HASH_BLOOM_NHASHES			3
+#define HASH_BLOOM_MIN_BITS			1024
+#define HASH_BLOOM_MAX_BITS			(1 << 24)
+#define HASH_BLOOM_MAX_FILL_FRAC	0.5
+#define HASH_BLOOM_SAMPLE_TUPLES	4096
+#define HASH_BLOOM_MIN_REJECT_FRAC	0.1
 
 
 /* ----------------------------------------------------------------
@@ -113,6 +137,10 @@ MultiExecHash(HashState *node)
 	else
 		MultiExecPrivateHash(node);
 
+	/* decide whether the Bloom filter is selective enough to keep */
+	if (node->hashtable->bloom != NULL)
+		ExecHashBloomFinish(node->hashtable);
+
 	/* must provide our own instrumentation support */
 	if (node->ps.instrument)
 		InstrStopNode(node->ps.instrument, node->hashtable->partialTuples);
@@ -172,6 +200,9 @@ MultiExecPrivateHash(HashState *node)
 		{
 			int			bucketNumber;
 
+			if (hashtable->bloom != NULL)
+				ExecHashBloomAdd(hashtable->bloom, hashvalue);
+
 			bucketNumber = ExecHashGetSkewBucket(hashtable, hashvalue);
 			if (bucketNumber != INVALID_SKEW_BUCKET_NO)
 			{
@@ -285,10 +316,18 @@ MultiExecParallelHash(HashState *node)
 				if (ExecHashGetHashValue(hashtable, econtext, hashkeys,
 										 false, hashtable->keepNulls,
 										 &hashvalue))
+				{
+					if (hashtable->bloom != NULL)
+						ExecHashBloomAdd(hashtable->bloom, hashvalue);
 					ExecParallelHashTableInsert(hashtable, slot, hashvalue);
+				}
 				hashtable->partialTuples++;
 			}
 
+			/* Add the hash values we saw to the shared Bloom filter. */
+			if (hashtable->bloom != NULL)
+				ExecParallelHashMergeBloom(hashtable);
+
 			/*
 			 * Make sure that any tuples we wrote to disk are visible to
 			 * others before anyone tries to load them.
@@ -333,6 +372,10 @@ MultiExecParallelHash(HashState *node)
 	hashtable->totalTuples = pstate->total_tuples;
 	ExecParallelHashEnsureBatchAccessors(hashtable);
 
+	/* Everyone has merged their hash values, so get the complete filter. */
+	if (hashtable->bloom != NULL)
+		ExecParallelHashFetchBloom(hashtable);
+
 	/*
 	 * The next synchronization point is in ExecHashJoin's HJ_BUILD_HASHTABLE
 	 * case, which will bring the build phase to PHJ_BUILD_DONE (if it isn't
@@ -422,10 +465,14 @@ ExecEndHash(HashState *node)
  *		ExecHashTableCreate
  *
  *		create an empty hashtable data structure for hashjoin.
+ *
+ *		If useBloom is true, also build a Bloom filter on the hash values
+ *		of the inner tuples, for the caller to push down to the outer side.
  * ----------------------------------------------------------------
  */
 HashJoinTable
-ExecHashTableCreate(HashState *state, List *hashOperators, List *hashCollations, bool keepNulls)
+ExecHashTableCreate(HashState *state, List *hashOperators, List *hashCollations,
+					bool keepNulls, bool useBloom)
 {
 	Hash	   *node;
 	HashJoinTable hashtable;
@@ -510,6 +557,7 @@ ExecHashTableCreate(HashState *state, List *hashOperators, List *hashCollations,
 	hashtable->parallel_state = state->parallel_state;
 	hashtable->area = state->ps.state->es_query_dsa;
 	hashtable->batches = NULL;
+	hashtable->bloom = NULL;
 
 #ifdef HJDEBUG
 	printf("Hashjoin %p: initial nbatch = %d, nbuckets = %d\n",
@@ -575,6 +623,20 @@ ExecHashTableCreate(HashState *state, List *hashOperators, List *hashCollations,
 		PrepareTempTablespaces();
 	}
 
+	if (useBloom)
+	{
+		uint32		nbits = ExecHashBloomChooseSize(rows);
+
+		if (nbits > 0)
+		{
+			hashtable->bloom = (HashBloomFilter *)
+				palloc(sizeof(HashBloomFilter));
+			hashtable->bloom->nbits = nbits;
+			hashtable->bloom->words = (uint32 *)
+				palloc0(nbits / 32 * sizeof(uint32));
+		}
+	}
+
 	MemoryContextSwitchTo(oldcxt);
 
 	if (hashtable->parallel_state)
@@ -616,6 +678,20 @@ ExecHashTableCreate(HashState *state, List *hashOperators, List *hashCollations,
 			 */
 			pstate->nbuckets = nbuckets;
 			ExecParallelHashTableAlloc(hashtable, 0);
+
+			/* Allocate the shared Bloom filter, if we're building one. */
+			pstate->bloom = InvalidDsaPointer;
+			if (hashtable->bloom != NULL)
+			{
+				uint32		nwords = hashtable->bloom->nbits / 32;
+				pg_atomic_uint32 *words;
+
+				pstate->bloom = dsa_allocate(hashtable->area,
+											 nwords * sizeof(pg_atomic_uint32));
+				words = dsa_get_address(hashtable->area, pstate->bloom);
+				for (i = 0; i < nwords; ++i)
+					pg_atomic_init_u32(&words[i], 0);
+			}
 		}
 
 		/*
@@ -1863,6 +1939,166 @@ ExecHashGetHashValue(HashJoinTable hashtable,
 	return true;
 }
 
+/*
+ * ExecHashRuntimeFilterPass
+ *		Check a scan tuple against a runtime filter pushed down from a
+ *		hash join
+ *
+ * The scan tuple must be in econtext->ecxt_scantuple.  Returns false if the
+ * tuple can't have a join partner, either because its hash value is not in
+ * the Bloom filter or because a join key is NULL.  (The filter is only
+ * pushed down for joins that don't need to emit unmatched outer tuples.)
+ */
+bool
+ExecHashRuntimeFilterPass(HashRuntimeFilter *filter, ExprContext *econtext)
+{
+	uint32		hashvalue;
+	bool		pass;
+
+	if (!filter->active)
+		return true;
+
+	pass = ExecHashGetHashValue(filter->hashtable, econtext, filter->hashkeys,
+								true, false, &hashvalue) &&
+		ExecHashBloomCheck(filter->hashtable->bloom, hashvalue);
+
+	filter->nchecked++;
+	if (!pass)
+		filter->nrejected++;
+
+	/* Give up on the filter if it isn't discarding enough tuples. */
+	if (filter->nchecked == HASH_BLOOM_SAMPLE_TUPLES &&
+		filter->nrejected < filter->nchecked * HASH_BLOOM_MIN_REJECT_FRAC)
+		filter->active = false;
+
+	return pass;
+}
+
+/*
+ * ExecHashBloomChooseSize
+ *		Choose the size (in bits) of the Bloom filter for the given number
+ *		of inner tuples, or 0 if it's not worth building one
+ */
+static uint32
+ExecHashBloomChooseSize(double ntuples)
+{
+	double		nbits = ntuples * HASH_BLOOM_BITS_PER_TUPLE;
+
+	if (nbits > HASH_BLOOM_MAX_BITS)
+		return 0;
+	nbits = Max(nbits, HASH_BLOOM_MIN_BITS);
+
+	/* round up to a power of 2, so that we can mask instead of dividing */
+	return (uint32) 1 << my_log2((long) nbits);
+}
+
+/*
+ * Set the Bloom filter bits for the given hash value.  The bit positions are
+ * derived from the hash value and a remix of it, by double hashing.
+ */
+static inline void
+ExecHashBloomAdd(HashBloomFilter *bloom, uint32 hashvalue)
+{
+	uint32		mask = bloom->nbits - 1;
+	uint32		h2 = murmurhash32(hashvalue) | 1;
+	int			i;
+
+	for (i = 0; i < HASH_BLOOM_NHASHES; i++)
+	{
+		uint32		bit = (hashvalue + i * h2) & mask;
+
+		bloom->words[bit / 32] |= (uint32) 1 << (bit % 32);
+	}
+}
+
+static inline bool
+ExecHashBloomCheck(HashBloomFilter *bloom, uint32 hashvalue)
+{
+	uint32		mask = bloom->nbits - 1;
+	uint32		h2 = murmurhash32(hashvalue) | 1;
+	int			i;
+
+	for (i = 0; i < HASH_BLOOM_NHASHES; i++)
+	{
+		uint32		bit = (hashvalue + i * h2) & mask;
+
+		if ((bloom->words[bit / 32] & ((uint32) 1 << (bit % 32))) == 0)
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * ExecHashBloomFinish
+ *		Discard the Bloom filter if too many of its bits are set for it to
+ *		be selective, as happens when the inner relation turned out much
+ *		larger than estimated
+ */
+static void
+ExecHashBloomFinish(HashJoinTable hashtable)
+{
+	HashBloomFilter *bloom = hashtable->bloom;
+	uint64		nset;
+
+	nset = pg_popcount((const char *) bloom->words, bloom->nbits / 8);
+	if (nset > bloom->nbits * HASH_BLOOM_MAX_FILL_FRAC)
+	{
+		pfree(bloom->words);
+		pfree(bloom);
+		hashtable->bloom = NULL;
+	}
+}
+
+/*
+ * ExecParallelHashMergeBloom
+ *		OR our private Bloom filter bits into the shared filter
+ */
+static void
+ExecParallelHashMergeBloom(HashJoinTable hashtable)
+{
+	ParallelHashJoinState *pstate = hashtable->parallel_state;
+	HashBloomFilter *bloom = hashtable->bloom;
+	pg_atomic_uint32 *shared;
+	uint32		i;
+
+	Assert(DsaPointerIsValid(pstate->bloom));
+	shared = dsa_get_address(hashtable->area, pstate->bloom);
+
+	for (i = 0; i < bloom->nbits / 32; ++i)
+	{
+		if (bloom->words[i] != 0)
+			pg_atomic_fetch_or_u32(&shared[i], bloom->words[i]);
+	}
+}
+
+/*
+ * ExecParallelHashFetchBloom
+ *		Replace our private Bloom filter with a copy of the complete shared
+ *		filter, after all participants have finished hashing
+ */
+static void
+ExecParallelHashFetchBloom(HashJoinTable hashtable)
+{
+	ParallelHashJoinState *pstate = hashtable->parallel_state;
+	HashBloomFilter *bloom = hashtable->bloom;
+	pg_atomic_uint32 *shared;
+	uint32		i;
+
+	/* the shared filter is gone, if we arrived very late */
+	if (!DsaPointerIsValid(pstate->bloom))
+	{
+		pfree(bloom->words);
+		pfree(bloom);
+		hashtable->bloom = NULL;
+		return;
+	}
+
+	shared = dsa_get_address(hashtable->area, pstate->bloom);
+	for (i = 0; i < bloom->nbits / 32; ++i)
+		bloom->words[i] = pg_atomic_read_u32(&shared[i]);
+}
+
 /*
  * ExecHashGetBucketAndBatch
  *		Determine the bucket number and batch number for a hash value
@@ -3160,6 +3396,11 @@ ExecHashTableDetach(HashJoinTable hashtable)
 				dsa_free(hashtable->area, pstate->batches);
 				pstate->batches = InvalidDsaPointer;
 			}
+			if (DsaPointerIsValid(pstate->bloom))
+			{
+				dsa_free(hashtable->area, pstate->bloom);
+				pstate->bloom = InvalidDsaPointer;
+			}
 		}
 
 		hashtable->parallel_state = NULL;
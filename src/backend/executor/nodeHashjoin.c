@@ -113,11 +113,18 @@
 #include "executor/nodeHash.h"
 #include "executor/nodeHashjoin.h"
 #include "miscadmin.h"
+#include "nodes/nodeFuncs.h"
+#include "optimizer/optimizer.h"
+#include "parser/parsetree.h"
 #include "pgstat.h"
 #include "utils/memutils.h"
 #include "utils/sharedtuplestore.h"
 
 
+/* GUC parameter */
+bool		enable_hashjoin_bloom = true;
+
+
 /*
  * States of the ExecHashJoin state machine
  */
@@ -133,9 +140,23 @@
 /* Returns true if doing null-fill on inner relation */
 #define HJ_FILL_INNER(hjstate)	((hjstate)->hj_NullOuterTupleSlot != NULL)
 
+/*
+ * Number of outer tuples to read ahead of the probe, and the hash table size
+ * from which on it's worth it, as the table is unlikely to stay in the CPU
+ * caches.  See ExecHashJoinOuterReadAhead.
+ */
+#define HJ_OUTER_READ_AHEAD		8
+#define HJ_OUTER_READ_AHEAD_MIN_SPACE	(1024 * 1024)
+
 static TupleTableSlot *ExecHashJoinOuterGetTuple(PlanState *outerNode,
 												 HashJoinState *hjstate,
 												 uint32 *hashvalue);
+static TupleTableSlot *ExecHashJoinOuterReadAhead(PlanState *outerNode,
+												  HashJoinState *hjstate,
+												  uint32 *hashvalue);
+static HashRuntimeFilter *ExecHashJoinInitRuntimeFilter(HashJoinState *hjstate,
+														HashJoin *node);
+static Node *runtime_filter_key_mutator(Node *node, List *tlist);
 static TupleTableSlot *ExecParallelHashJoinOuterGetTuple(PlanState *outerNode,
 														 HashJoinState *hjstate,
 														 uint32 *hashvalue);
@@ -279,7 +300,8 @@ ExecHashJoinImpl(PlanState *pstate, bool parallel)
 				hashtable = ExecHashTableCreate(hashNode,
 												node->hj_HashOperators,
 												node->hj_Collations,
-												HJ_FILL_INNER(node));
+												HJ_FILL_INNER(node),
+												node->hj_RuntimeFilter != NULL);
 				node->hj_HashTable = hashtable;
 
 				/*
@@ -290,6 +312,24 @@ ExecHashJoinImpl(PlanState *pstate, bool parallel)
 				hashNode->hashtable = hashtable;
 				(void) MultiExecProcNode((PlanState *) hashNode);
 
+				/*
+				 * If a Bloom filter on the inner hash values was built (and
+				 * found selective enough), push it down to the outer scan,
+				 * so that outer tuples without a partner are discarded
+				 * there.  This includes all the tuples a multi-batch join
+				 * would otherwise write out to batch files.
+				 */
+				if (node->hj_RuntimeFilter != NULL && hashtable->bloom != NULL)
+				{
+					HashRuntimeFilter *filter = node->hj_RuntimeFilter;
+
+					filter->hashtable = hashtable;
+					filter->active = true;
+					filter->nchecked = 0;
+					filter->nrejected = 0;
+					((ScanState *) outerNode)->ss_RuntimeFilter = filter;
+				}
+
 				/*
 				 * If the inner relation is completely empty, and we're not
 				 * doing a left outer join, we can quit without scanning the
@@ -353,7 +393,7 @@ ExecHashJoinImpl(PlanState *pstate, bool parallel)
 														  &hashvalue);
 				else
 					outerTupleSlot =
-						ExecHashJoinOuterGetTuple(outerNode, node, &hashvalue);
+						ExecHashJoinOuterReadAhead(outerNode, node, &hashvalue);
 
 				if (TupIsNull(outerTupleSlot))
 				{
@@ -663,6 +703,28 @@ ExecInitHashJoin(HashJoin *node, EState *estate, int eflags)
 	hjstate->hj_OuterTupleSlot = ExecInitExtraTupleSlot(estate, outerDesc,
 														ops);
 
+	/*
+	 * Parallel-aware joins probe a shared hash table with a different layout,
+	 * so they don't read outer tuples ahead.
+	 */
+	hjstate->hj_OuterAheadSlots = NULL;
+	hjstate->hj_OuterAheadHashes = NULL;
+	if (!node->join.plan.parallel_aware)
+	{
+		int			i;
+
+		hjstate->hj_OuterAheadSlots =
+			palloc(sizeof(TupleTableSlot *) * HJ_OUTER_READ_AHEAD);
+		for (i = 0; i < HJ_OUTER_READ_AHEAD; i++)
+			hjstate->hj_OuterAheadSlots[i] =
+				ExecInitExtraTupleSlot(estate, outerDesc, &TTSOpsMinimalTuple);
+		hjstate->hj_OuterAheadHashes =
+			palloc(sizeof(uint32) * HJ_OUTER_READ_AHEAD);
+	}
+	hjstate->hj_OuterAheadCount = 0;
+	hjstate->hj_OuterAheadNext = 0;
+	hjstate->hj_OuterAheadDone = false;
+
 	/*
 	 * detect whether we need only consider the first matching inner tuple
 	 */
@@ -761,6 +823,8 @@ ExecInitHashJoin(HashJoin *node, EState *estate, int eflags)
 	/* child Hash node needs to evaluate inner hash keys, too */
 	((HashState *) innerPlanState(hjstate))->hashkeys = rhclauses;
 
+	hjstate->hj_RuntimeFilter = ExecHashJoinInitRuntimeFilter(hjstate, node);
+
 	hjstate->hj_JoinState = HJ_BUILD_HASHTABLE;
 	hjstate->hj_MatchedOuter = false;
 	hjstate->hj_OuterNotEmpty = false;
@@ -768,6 +832,82 @@ ExecInitHashJoin(HashJoin *node, EState *estate, int eflags)
 	return hjstate;
 }
 
+/*
+ * ExecHashJoinInitRuntimeFilter
+ *		Prepare a Bloom filter to push down to the outer scan, if possible
+ *
+ * We can only discard outer tuples early if the join doesn't need to emit
+ * the unmatched ones, and we only know how to check the filter in a plain
+ * sequential scan directly below us.  The outer hash keys reference the scan's
+ * output tuple (OUTER_VAR); to check the filter before projecting, they are
+ * rewritten in terms of the scan tuple by substituting the scan's targetlist
+ * entries, which must not be volatile since they'd be evaluated twice.
+ */
+static HashRuntimeFilter *
+ExecHashJoinInitRuntimeFilter(HashJoinState *hjstate, HashJoin *node)
+{
+	PlanState  *outerState = outerPlanState(hjstate);
+	HashRuntimeFilter *filter;
+	List	   *hashkeys = NIL;
+	ListCell   *l;
+
+	if (!enable_hashjoin_bloom)
+		return NULL;
+
+	if (node->join.jointype != JOIN_INNER &&
+		node->join.jointype != JOIN_SEMI &&
+		node->join.jointype != JOIN_RIGHT)
+		return NULL;
+
+	if (!IsA(outerState, SeqScanState))
+		return NULL;
+
+	foreach(l, node->hashclauses)
+	{
+		OpExpr	   *hclause = lfirst_node(OpExpr, l);
+		Node	   *key;
+
+		key = runtime_filter_key_mutator((Node *) linitial(hclause->args),
+										 outerState->plan->targetlist);
+		if (contain_volatile_functions(key))
+			return NULL;
+
+		hashkeys = lappend(hashkeys, ExecInitExpr((Expr *) key, outerState));
+	}
+
+	filter = (HashRuntimeFilter *) palloc0(sizeof(HashRuntimeFilter));
+	filter->hashkeys = hashkeys;
+
+	return filter;
+}
+
+/*
+ * Replace references to the outer plan's output in an outer hash key by the
+ * corresponding expressions of the outer plan's targetlist.
+ */
+static Node *
+runtime_filter_key_mutator(Node *node, List *tlist)
+{
+	if (node == NULL)
+		return NULL;
+	if (IsA(node, Var))
+	{
+		Var		   *var = (Var *) node;
+		TargetEntry *tle;
+
+		if (var->varno != OUTER_VAR)
+			elog(ERROR, "unexpected varno %d in hash join outer key",
+				 var->varno);
+		tle = get_tle_by_resno(tlist, var->varattno);
+		if (tle == NULL)
+			elog(ERROR, "hash join outer key references nonexistent column %d",
+				 var->varattno);
+		return (Node *) copyObject(tle->expr);
+	}
+	return expression_tree_mutator(node, runtime_filter_key_mutator,
+								   (void *) tlist);
+}
+
 /* ----------------------------------------------------------------
  *		ExecEndHashJoin
  *
@@ -778,8 +918,11 @@ void
 ExecEndHashJoin(HashJoinState *node)
 {
 	/*
-	 * Free hash table
+	 * Free hash table, after making sure the outer scan doesn't look at its
+	 * Bloom filter anymore
 	 */
+	if (node->hj_RuntimeFilter)
+		((ScanState *) outerPlanState(node))->ss_RuntimeFilter = NULL;
 	if (node->hj_HashTable)
 	{
 		ExecHashTableDestroy(node->hj_HashTable);
@@ -888,6 +1031,80 @@ ExecHashJoinOuterGetTuple(PlanState *outerNode,
 	return NULL;
 }
 
+/*
+ * ExecHashJoinOuterReadAhead
+ *
+ *		Get the next outer tuple like ExecHashJoinOuterGetTuple, but when the
+ *		hash table is large, read a few outer tuples at a time and prefetch
+ *		the hash buckets they will probe.
+ *
+ * Probing a hash table that doesn't fit in the CPU caches takes a cache miss
+ * to read the bucket and another to read the first tuple in it, and we would
+ * otherwise wait for each in turn.  With a group of outer tuples at hand we
+ * can start loading all their buckets, then the first tuple of each bucket,
+ * so that the misses overlap.  The tuples have to be copied, as the outer
+ * plan is free to reuse its slot on the next call.
+ */
+static TupleTableSlot *
+ExecHashJoinOuterReadAhead(PlanState *outerNode,
+						   HashJoinState *hjstate,
+						   uint32 *hashvalue)
+{
+	HashJoinTable hashtable = hjstate->hj_HashTable;
+	HashJoinTuple *buckets = hashtable->buckets.unshared;
+	uint32		bucketmask = hashtable->nbuckets - 1;
+	int			i;
+
+	if (hjstate->hj_OuterAheadNext == hjstate->hj_OuterAheadCount)
+	{
+		hjstate->hj_OuterAheadCount = 0;
+		hjstate->hj_OuterAheadNext = 0;
+
+		if (hjstate->hj_OuterAheadDone)
+		{
+			hjstate->hj_OuterAheadDone = false;
+			return NULL;
+		}
+
+		/* Not worth copying the tuples when the hash table is small. */
+		if (hjstate->hj_OuterAheadSlots == NULL ||
+			hashtable->spaceUsed + hashtable->nbuckets * sizeof(HashJoinTuple) <
+			HJ_OUTER_READ_AHEAD_MIN_SPACE)
+			return ExecHashJoinOuterGetTuple(outerNode, hjstate, hashvalue);
+
+		while (hjstate->hj_OuterAheadCount < HJ_OUTER_READ_AHEAD)
+		{
+			TupleTableSlot *slot;
+			uint32		hash;
+
+			slot = ExecHashJoinOuterGetTuple(outerNode, hjstate, &hash);
+			if (TupIsNull(slot))
+			{
+				hjstate->hj_OuterAheadDone = true;
+				break;
+			}
+
+			i = hjstate->hj_OuterAheadCount++;
+			ExecCopySlot(hjstate->hj_OuterAheadSlots[i], slot);
+			hjstate->hj_OuterAheadHashes[i] = hash;
+			pg_prefetch_mem(&buckets[hash & bucketmask]);
+		}
+
+		for (i = 0; i < hjstate->hj_OuterAheadCount; i++)
+			pg_prefetch_mem(buckets[hjstate->hj_OuterAheadHashes[i] & bucketmask]);
+
+		if (hjstate->hj_OuterAheadCount == 0)
+		{
+			hjstate->hj_OuterAheadDone = false;
+			return NULL;
+		}
+	}
+
+	i = hjstate->hj_OuterAheadNext++;
+	*hashvalue = hjstate->hj_OuterAheadHashes[i];
+	return hjstate->hj_OuterAheadSlots[i];
+}
+
 /*
  * ExecHashJoinOuterGetTuple variant for the parallel case.
  */
@@ -1237,7 +1454,7 @@ ExecHashJoinSaveTuple(MinimalTuple tuple, uint32 hashvalue,
 	if (file == NULL)
 	{
 		/* First write to this batch file, so open it. */
-		file = BufFileCreateTemp(false);
+		file = BufFileCreateCompressedTemp(false);
 		*fileptr = file;
 	}
 
@@ -1348,7 +1565,9 @@ ExecReScanHashJoin(HashJoinState *node)
 		}
 		else
 		{
-			/* must destroy and rebuild hash table */
+			/* must destroy and rebuild hash table, and its Bloom filter */
+			if (node->hj_RuntimeFilter)
+				((ScanState *) outerPlanState(node))->ss_RuntimeFilter = NULL;
 			ExecHashTableDestroy(node->hj_HashTable);
 			node->hj_HashTable = NULL;
 			node->hj_JoinState = HJ_BUILD_HASHTABLE;
@@ -1370,6 +1589,9 @@ ExecReScanHashJoin(HashJoinState *node)
 
 	node->hj_MatchedOuter = false;
 	node->hj_FirstOuterTupleSlot = NULL;
+	node->hj_OuterAheadCount = 0;
+	node->hj_OuterAheadNext = 0;
+	node->hj_OuterAheadDone = false;
 
 	/*
 	 * if chgParam of subnode is not null then plan will be re-scanned by
@@ -1483,6 +1705,7 @@ ExecHashJoinInitializeDSM(HashJoinState *state, ParallelContext *pcxt)
 	pstate->growth = PHJ_GROWTH_OK;
 	pstate->chunk_work_queue = InvalidDsaPointer;
 	pg_atomic_init_u32(&pstate->distributor, 0);
+	pstate->bloom = InvalidDsaPointer;
 	pstate->nparticipants = pcxt->nworkers + 1;
 	pstate->total_tuples = 0;
 	LWLockInitialize(&pstate->lock,
@@ -0,0 +1,403 @@
+/*-------------------------------------------------------------------------
+ *
+ * nodeIncrementalSort.c
+ *	  Routines to handle incremental sorting of relations.
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ *
+ * IDENTIFICATION
+ *	  src/backend/executor/nodeIncrementalSort.c
+ *
+ * DESCRIPTION
+ *
+ *	Incremental sort is an optimized variant of multikey sort for cases
+ *	when the input is already sorted by a prefix of the sort keys.  For
+ *	example when a sort by (key1, key2 ... keyN) is requested, and the
+ *	input is already sorted by (key1, key2 ... keyM), M < N, we can
+ *	divide the input into groups where keys (key1, ... keyM) are equal,
+ *	and only sort on the remaining columns.
+ *
+ *	Consider the following example.  We have input tuples consisting of
+ *	two integers (X, Y) already presorted by X, while it's required to
+ *	sort them by both X and Y.  Let input tuples be following.
+ *
+ *	(1, 5)
+ *	(1, 2)
+ *	(2, 9)
+ *	(2, 1)
+ *	(2, 5)
+ *	(3, 3)
+ *	(3, 7)
+ *
+ *	An incremental sort algorithm would split the input into the following
+ *	groups, which have equal X, and then sort them by Y individually:
+ *
+ *		(1, 5) (1, 2)
+ *		(2, 9) (2, 1) (2, 5)
+ *		(3, 3) (3, 7)
+ *
+ *	After sorting these groups and putting them altogether, we would get
+ *	the following result which is sorted by X and Y, as requested:
+ *
+ *	(1, 2)
+ *	(1, 5)
+ *	(2, 1)
+ *	(2, 5)
+ *	(2, 9)
+ *	(3, 3)
+ *	(3, 7)
+ *
+ *	Setting up a tuplesort for each group would be expensive when the groups
+ *	are small, so we rather sort batches of at least INCREMENTAL_SORT_MIN_BATCH
+ *	tuples, each consisting of whole groups.  As the batches follow each
+ *	other in the order of the presorted keys, sorting each batch by all the
+ *	keys gives the same result.
+ *
+ *	Incremental sort may be more efficient than plain sort, particularly
+ *	on large datasets, as it reduces the amount of data to sort at once,
+ *	making it more likely it fits into work_mem (eliminating the need to
+ *	spill to disk).  But the main advantage of incremental sort is that
+ *	it can start producing rows early, before sorting the whole dataset,
+ *	which is a significant benefit especially for queries with LIMIT.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "executor/execdebug.h"
+#include "executor/nodeIncrementalSort.h"
+#include "miscadmin.h"
+#include "utils/lsyscache.h"
+#include "utils/tuplesort.h"
+
+/*
+ * Minimum number of tuples sorted at once, the setup of a new tuplesort being
+ * expensive compared to sorting a few tuples.
+ */
+#define INCREMENTAL_SORT_MIN_BATCH	32
+
+
+/* ----------------------------------------------------------------
+ *		prepare_presorted_eq
+ *
+ *		Build the expression comparing the presorted columns of two tuples
+ *		for equality, using the equality operators that match the ordering
+ *		operators of the sort.
+ * ----------------------------------------------------------------
+ */
+static ExprState *
+prepare_presorted_eq(IncrementalSortState *node)
+{
+	IncrementalSort *plannode = (IncrementalSort *) node->ss.ps.plan;
+	int			nPresortedCols = plannode->nPresortedCols;
+	Oid		   *eqOperators;
+	int			i;
+
+	eqOperators = (Oid *) palloc(nPresortedCols * sizeof(Oid));
+
+	for (i = 0; i < nPresortedCols; i++)
+	{
+		Oid			sortop = plannode->sort.sortOperators[i];
+
+		eqOperators[i] = get_equality_op_for_ordering_op(sortop, NULL);
+		if (!OidIsValid(eqOperators[i]))
+			elog(ERROR, "missing equality operator for ordering operator %u",
+				 sortop);
+	}
+
+	return execTuplesMatchPrepare(ExecGetResultType(outerPlanState(node)),
+								  nPresortedCols,
+								  plannode->sort.sortColIdx,
+								  eqOperators,
+								  plannode->sort.collations,
+								  &node->ss.ps);
+}
+
+/* ----------------------------------------------------------------
+ *		fill_sort_batch
+ *
+ *		Read the next batch of tuples from the outer plan into a new
+ *		tuplesort, and sort it.  A batch is complete once it has at least
+ *		INCREMENTAL_SORT_MIN_BATCH tuples and the presorted columns change;
+ *		the tuple that shows that is kept for the next batch in
+ *		transfer_tuple.
+ * ----------------------------------------------------------------
+ */
+static void
+fill_sort_batch(IncrementalSortState *node)
+{
+	IncrementalSort *plannode = (IncrementalSort *) node->ss.ps.plan;
+	PlanState  *outerNode = outerPlanState(node);
+	ExprContext *econtext = node->ss.ps.ps_ExprContext;
+	Tuplesortstate *tuplesortstate;
+	int64		ntuples = 0;
+
+	/*
+	 * Use a new tuplesort for each batch, so that the memory for sorting
+	 * depends on the size of the batches only.
+	 */
+	if (node->tuplesortstate != NULL)
+		tuplesort_end((Tuplesortstate *) node->tuplesortstate);
+	node->tuplesortstate = NULL;
+
+	tuplesortstate = tuplesort_begin_heap(ExecGetResultType(outerNode),
+										  plannode->sort.numCols,
+										  plannode->sort.sortColIdx,
+										  plannode->sort.sortOperators,
+										  plannode->sort.collations,
+										  plannode->sort.nullsFirst,
+										  work_mem,
+										  NULL, false);
+	if (node->bounded)
+		tuplesort_set_bound(tuplesortstate, node->bound - node->bound_Done);
+	node->tuplesortstate = (void *) tuplesortstate;
+	node->n_batches++;
+
+	/* The batch starts with the tuple that ended the previous one, if any */
+	if (!TupIsNull(node->transfer_tuple))
+	{
+		tuplesort_puttupleslot(tuplesortstate, node->transfer_tuple);
+		ExecClearTuple(node->transfer_tuple);
+		ntuples++;
+	}
+
+	for (;;)
+	{
+		TupleTableSlot *slot = ExecProcNode(outerNode);
+
+		if (TupIsNull(slot))
+		{
+			node->outerNodeDone = true;
+			break;
+		}
+
+		if (ntuples >= INCREMENTAL_SORT_MIN_BATCH)
+		{
+			/* Does this tuple still belong to the group of the pivot? */
+			econtext->ecxt_innertuple = node->group_pivot;
+			econtext->ecxt_outertuple = slot;
+			if (!ExecQualAndReset(node->presorted_eq, econtext))
+			{
+				ExecCopySlot(node->transfer_tuple, slot);
+				break;
+			}
+		}
+		else if (ntuples == INCREMENTAL_SORT_MIN_BATCH - 1)
+		{
+			/*
+			 * The batch is large enough once the group of this tuple is
+			 * complete.
+			 */
+			ExecCopySlot(node->group_pivot, slot);
+		}
+
+		tuplesort_puttupleslot(tuplesortstate, slot);
+		ntuples++;
+	}
+
+	SO1_printf("fill_sort_batch: sorting batch of " INT64_FORMAT " tuples\n",
+			   ntuples);
+
+	tuplesort_performsort(tuplesortstate);
+	node->batch_sorted = true;
+}
+
+/* ----------------------------------------------------------------
+ *		ExecIncrementalSort
+ *
+ *		Returns the tuples of the outer subtree sorted, sorting one batch
+ *		of groups with equal presorted columns at a time.
+ *
+ *		Conditions:
+ *		  -- the input is sorted by the first nPresortedCols sort columns.
+ *
+ *		Initial States:
+ *		  -- the outer child is prepared to return the first tuple.
+ * ----------------------------------------------------------------
+ */
+static TupleTableSlot *
+ExecIncrementalSort(PlanState *pstate)
+{
+	IncrementalSortState *node = castNode(IncrementalSortState, pstate);
+	TupleTableSlot *slot = node->ss.ps.ps_ResultTupleSlot;
+
+	CHECK_FOR_INTERRUPTS();
+
+	/* Incremental sort doesn't support backward scans */
+	Assert(ScanDirectionIsForward(node->ss.ps.state->es_direction));
+
+	for (;;)
+	{
+		/*
+		 * Return the next tuple of the current batch.  Note that we only rely
+		 * on slot tuple remaining valid until the next fetch from the
+		 * tuplesort.
+		 */
+		if (node->batch_sorted)
+		{
+			if (tuplesort_gettupleslot((Tuplesortstate *) node->tuplesortstate,
+									   true, false, slot, NULL))
+			{
+				node->bound_Done++;
+				return slot;
+			}
+			node->batch_sorted = false;
+		}
+
+		/* Are we done? */
+		if (node->outerNodeDone && TupIsNull(node->transfer_tuple))
+			return ExecClearTuple(slot);
+		if (node->bounded && node->bound_Done >= node->bound)
+			return ExecClearTuple(slot);
+
+		fill_sort_batch(node);
+	}
+}
+
+/* ----------------------------------------------------------------
+ *		ExecInitIncrementalSort
+ *
+ *		Creates the run-time state information for the incremental sort
+ *		node produced by the planner and initializes its outer subtree.
+ * ----------------------------------------------------------------
+ */
+IncrementalSortState *
+ExecInitIncrementalSort(IncrementalSort *node, EState *estate, int eflags)
+{
+	IncrementalSortState *incrsortstate;
+	TupleDesc	outerDesc;
+
+	SO1_printf("ExecInitIncrementalSort: %s\n",
+			   "initializing incremental sort node");
+
+	/*
+	 * The sorted output isn't kept, so incremental sort supports neither
+	 * backward scans nor mark/restore; the planner knows that.
+	 */
+	Assert((eflags & (EXEC_FLAG_BACKWARD | EXEC_FLAG_MARK)) == 0);
+
+	/*
+	 * create state structure
+	 */
+	incrsortstate = makeNode(IncrementalSortState);
+	incrsortstate->ss.ps.plan = (Plan *) node;
+	incrsortstate->ss.ps.state = estate;
+	incrsortstate->ss.ps.ExecProcNode = ExecIncrementalSort;
+
+	incrsortstate->bounded = false;
+	incrsortstate->bound_Done = 0;
+	incrsortstate->outerNodeDone = false;
+	incrsortstate->batch_sorted = false;
+	incrsortstate->n_batches = 0;
+	incrsortstate->tuplesortstate = NULL;
+
+	/*
+	 * Miscellaneous initialization
+	 *
+	 * We need an ExprContext to compare the presorted columns.
+	 */
+	ExecAssignExprContext(estate, &incrsortstate->ss.ps);
+
+	/*
+	 * initialize child nodes
+	 *
+	 * A rescan reads the outer plan again, so it has to support REWIND if
+	 * we do.
+	 */
+	outerPlanState(incrsortstate) = ExecInitNode(outerPlan(node), estate, eflags);
+	outerDesc = ExecGetResultType(outerPlanState(incrsortstate));
+
+	/*
+	 * Initialize scan slot and type.
+	 */
+	ExecCreateScanSlotFromOuterPlan(estate, &incrsortstate->ss, &TTSOpsVirtual);
+
+	/*
+	 * Initialize return slot and type. No need to initialize projection info
+	 * because this node doesn't do projections.
+	 */
+	ExecInitResultTupleSlotTL(&incrsortstate->ss.ps, &TTSOpsMinimalTuple);
+	incrsortstate->ss.ps.ps_ProjInfo = NULL;
+
+	/* slots for detecting the end of the groups */
+	incrsortstate->group_pivot = MakeSingleTupleTableSlot(outerDesc,
+														  &TTSOpsMinimalTuple);
+	incrsortstate->transfer_tuple = MakeSingleTupleTableSlot(outerDesc,
+															 &TTSOpsMinimalTuple);
+
+	incrsortstate->presorted_eq = prepare_presorted_eq(incrsortstate);
+
+	SO1_printf("ExecInitIncrementalSort: %s\n",
+			   "incremental sort node initialized");
+
+	return incrsortstate;
+}
+
+/* ----------------------------------------------------------------
+ *		ExecEndIncrementalSort(node)
+ * ----------------------------------------------------------------
+ */
+void
+ExecEndIncrementalSort(IncrementalSortState *node)
+{
+	SO1_printf("ExecEndIncrementalSort: %s\n",
+			   "shutting down incremental sort node");
+
+	/*
+	 * clean out the tuple table
+	 */
+	ExecClearTuple(node->ss.ss_ScanTupleSlot);
+	/* must drop pointer to sort result tuple */
+	ExecClearTuple(node->ss.ps.ps_ResultTupleSlot);
+	ExecDropSingleTupleTableSlot(node->group_pivot);
+	ExecDropSingleTupleTableSlot(node->transfer_tuple);
+
+	/*
+	 * Release tuplesort resources
+	 */
+	if (node->tuplesortstate != NULL)
+		tuplesort_end((Tuplesortstate *) node->tuplesortstate);
+	node->tuplesortstate = NULL;
+
+	ExecFreeExprContext(&node->ss.ps);
+
+	/*
+	 * shut down the subplan
+	 */
+	ExecEndNode(outerPlanState(node));
+
+	SO1_printf("ExecEndIncrementalSort: %s\n",
+			   "incremental sort node shutdown");
+}
+
+void
+ExecReScanIncrementalSort(IncrementalSortState *node)
+{
+	PlanState  *outerPlan = outerPlanState(node);
+
+	/*
+	 * The sorted batches aren't kept, so we always have to re-read the
+	 * subplan and sort again.
+	 */
+	ExecClearTuple(node->ss.ps.ps_ResultTupleSlot);
+	ExecClearTuple(node->group_pivot);
+	ExecClearTuple(node->transfer_tuple);
+
+	if (node->tuplesortstate != NULL)
+		tuplesort_end((Tuplesortstate *) node->tuplesortstate);
+	node->tuplesortstate = NULL;
+
+	node->outerNodeDone = false;
+	node->batch_sorted = false;
+	node->bound_Done = 0;
+
+	/*
+	 * if chgParam of subnode is not null then plan will be re-scanned by
+	 * first ExecProcNode.
+	 */
+	if (outerPlan->chgParam == NULL)
+		ExecReScan(outerPlan);
+}
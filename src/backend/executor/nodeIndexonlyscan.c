@@ -101,6 +101,8 @@ IndexOnlyNext(IndexOnlyScanState *node)
 
 		/* Set it up for index-only scan */
 		node->ioss_ScanDesc->xs_want_itup = true;
+		node->ioss_ScanDesc->xs_skipscan =
+			((IndexOnlyScan *) node->ss.ps.plan)->indexskipscan;
 		node->ioss_VMBuffer = InvalidBuffer;
 
 		/*
@@ -157,8 +159,13 @@ IndexOnlyNext(IndexOnlyScanState *node)
 		 *
 		 * It's worth going through this complexity to avoid needing to lock
 		 * the VM buffer, which could cause significant contention.
+		 *
+		 * An entry the index AM asks us to check against the heap tuple (see
+		 * index_fetch_heap) might not match the tuple even if all its
+		 * versions are visible, so we must visit the heap for it regardless.
 		 */
-		if (!VM_ALL_VISIBLE(scandesc->heapRelation,
+		if (scandesc->xs_keycheck ||
+			!VM_ALL_VISIBLE(scandesc->heapRelation,
 							ItemPointerGetBlockNumber(tid),
 							&node->ioss_VMBuffer))
 		{
@@ -638,7 +645,8 @@ ExecIndexOnlyScanEstimate(IndexOnlyScanState *node,
 {
 	EState	   *estate = node->ss.ps.state;
 
-	node->ioss_PscanLen = index_parallelscan_estimate(node->ioss_RelationDesc,
+	node->ioss_PscanLen = index_parallelscan_estimate(node->ss.ss_currentRelation,
+													  node->ioss_RelationDesc,
 													  estate->es_snapshot);
 	shm_toc_estimate_chunk(&pcxt->estimator, node->ioss_PscanLen);
 	shm_toc_estimate_keys(&pcxt->estimator, 1);
@@ -116,6 +116,7 @@ IndexNext(IndexScanState *node)
 								   node->iss_NumOrderByKeys);
 
 		node->iss_ScanDesc = scandesc;
+		scandesc->xs_skipscan = ((IndexScan *) node->ss.ps.plan)->indexskipscan;
 
 		/*
 		 * If no run-time keys to calculate or they are ready, go ahead and
@@ -211,6 +212,7 @@ IndexNextWithReorder(IndexScanState *node)
 								   node->iss_NumOrderByKeys);
 
 		node->iss_ScanDesc = scandesc;
+		scandesc->xs_skipscan = ((IndexScan *) node->ss.ps.plan)->indexskipscan;
 
 		/*
 		 * If no run-time keys to calculate or they are ready, go ahead and
@@ -1653,7 +1655,8 @@ ExecIndexScanEstimate(IndexScanState *node,
 {
 	EState	   *estate = node->ss.ps.state;
 
-	node->iss_PscanLen = index_parallelscan_estimate(node->iss_RelationDesc,
+	node->iss_PscanLen = index_parallelscan_estimate(node->ss.ss_currentRelation,
+													 node->iss_RelationDesc,
 													 estate->es_snapshot);
 	shm_toc_estimate_chunk(&pcxt->estimator, node->iss_PscanLen);
 	shm_toc_estimate_keys(&pcxt->estimator, 1);
@@ -33,6 +33,13 @@
  *		It must be called again to continue the operation.  Without RETURNING,
  *		we just loop within the node until all the work is done, then
  *		return NULL.  This avoids useless call/return overhead.
+ *
+ *		An INSERT that has neither RETURNING nor anything else that has to
+ *		see each row in the table before the next one is processed buffers
+ *		its rows and inserts them with the table AM's multi_insert, which
+ *		lets the AM share the work of a page among the rows going to it.
+ *		Rows routed to the partitions of a partitioned table are buffered
+ *		separately for each partition.
  */
 
 #include "postgres.h"
@@ -76,6 +83,49 @@ static void ExecSetupChildParentMapForSubplan(ModifyTableState *mtstate);
 static TupleConversionMap *tupconv_map_for_subplan(ModifyTableState *node,
 												   int whichplan);
 
+/*
+ * Rows buffered for a multi-row insertion into one table: the target table
+ * itself, or one of the partitions that rows are routed to.  A table whose
+ * rows can't be buffered gets a batch with size 0, to remember that.
+ */
+typedef struct ModifyTableBatch
+{
+	ResultRelInfo *resultRelInfo;	/* table the rows go to */
+	int			size;			/* max number of rows per batch */
+	TupleTableSlot **slots;		/* buffered rows */
+	int			nused;			/* number of rows in slots */
+	Size		bytes;			/* approximate size of the buffered rows */
+} ModifyTableBatch;
+
+static bool ExecCanBatchInsert(ModifyTableState *mtstate);
+static int	ExecInsertBatchSize(ResultRelInfo *resultRelInfo);
+static ModifyTableBatch *ExecGetInsertBatch(ModifyTableState *mtstate,
+											ResultRelInfo *resultRelInfo,
+											EState *estate);
+static void ExecBatchInsert(ModifyTableState *mtstate,
+							ModifyTableBatch *batch,
+							TupleTableSlot *slot,
+							EState *estate);
+static void ExecBatchInsertFlush(ModifyTableState *mtstate,
+								 ModifyTableBatch *batch,
+								 EState *estate);
+static void ExecBatchInsertFlushAll(ModifyTableState *mtstate,
+									EState *estate);
+static void ExecBatchInsertCleanup(ModifyTableBatch *batch);
+
+/*
+ * No more than this many rows, or rows of this many bytes in total, are
+ * buffered for a multi-row insertion; the same limits as COPY's.
+ */
+#define MAX_BATCHED_INSERT_TUPLES	1000
+#define MAX_BATCHED_INSERT_BYTES	65535
+
+/*
+ * Rows routed to this many partitions at most are buffered at a time; the
+ * same limit as COPY's.
+ */
+#define MAX_PARTITION_BATCHES	32
+
 /*
  * Verify that the tuples to be produced by INSERT or UPDATE match the
  * target relation's rowtype
@@ -353,6 +403,7 @@ ExecInsert(ModifyTableState *mtstate,
 	TransitionCaptureState *ar_insert_trig_tcs;
 	ModifyTable *node = (ModifyTable *) mtstate->ps.plan;
 	OnConflictAction onconflict = node->onConflictAction;
+	ModifyTableBatch *batch = NULL;
 
 	ExecMaterializeSlot(slot);
 
@@ -362,6 +413,14 @@ ExecInsert(ModifyTableState *mtstate,
 	resultRelInfo = estate->es_result_relation_info;
 	resultRelationDesc = resultRelInfo->ri_RelationDesc;
 
+	/*
+	 * Find the batch to buffer the row in, if rows are being buffered.  This
+	 * has to be done before any triggers fire, since for a table that can't
+	 * be batched it inserts the rows buffered for other tables first.
+	 */
+	if (mtstate->mt_batch_insert)
+		batch = ExecGetInsertBatch(mtstate, resultRelInfo, estate);
+
 	/*
 	 * BEFORE ROW INSERT Triggers.
 	 *
@@ -394,6 +453,16 @@ ExecInsert(ModifyTableState *mtstate,
 			resultRelationDesc->rd_att->constr->has_generated_stored)
 			ExecComputeStoredGenerated(estate, slot);
 
+		/*
+		 * If the FDW takes rows in batches, just buffer this one; see
+		 * ExecInsertBatchSize.
+		 */
+		if (batch != NULL)
+		{
+			ExecBatchInsert(mtstate, batch, slot, estate);
+			return NULL;
+		}
+
 		/*
 		 * insert into foreign table: let the FDW do it
 		 */
@@ -587,6 +656,16 @@ ExecInsert(ModifyTableState *mtstate,
 
 			/* Since there was no insertion conflict, we're done */
 		}
+		else if (batch != NULL)
+		{
+			/*
+			 * Buffer the tuple, to be inserted together with the following
+			 * ones.  Nothing else has to be done for it; see
+			 * ExecInsertBatchSize.
+			 */
+			ExecBatchInsert(mtstate, batch, slot, estate);
+			return NULL;
+		}
 		else
 		{
 			/* insert the tuple normally */
@@ -658,6 +737,316 @@ ExecInsert(ModifyTableState *mtstate,
 	return result;
 }
 
+/* ----------------------------------------------------------------
+ *		ExecCanBatchInsert
+ *
+ *		Decide whether the rows of an INSERT can be buffered and inserted
+ *		several at a time.  That leaves each row out of the table and its
+ *		indexes until its batch is flushed, so it's only done when nothing
+ *		has to see the row, or run for it, right after it's inserted: no
+ *		RETURNING, no transition tables, no ON CONFLICT, and no volatile
+ *		functions in the query, as checked by the planner.  Whether the
+ *		rows for a particular table can be buffered is up to
+ *		ExecInsertBatchSize, as the rows of a partitioned table are routed
+ *		to partitions that may each allow it or not.
+ * ----------------------------------------------------------------
+ */
+static bool
+ExecCanBatchInsert(ModifyTableState *mtstate)
+{
+	ModifyTable *node = (ModifyTable *) mtstate->ps.plan;
+
+	if (mtstate->operation != CMD_INSERT || !node->batchInsert)
+		return false;
+
+	if (mtstate->mt_nplans != 1 ||
+		node->onConflictAction != ONCONFLICT_NONE ||
+		node->returningLists != NIL ||
+		mtstate->mt_transition_capture != NULL)
+		return false;
+
+	return true;
+}
+
+/* ----------------------------------------------------------------
+ *		ExecInsertBatchSize
+ *
+ *		Return the number of rows that an INSERT allowed to batch by
+ *		ExecCanBatchInsert may buffer for the given table, or 0 if its rows
+ *		must be inserted one by one.  Row triggers (which includes foreign
+ *		keys and deferred uniqueness checks) and WITH CHECK OPTIONs rule
+ *		batching out.
+ *
+ *		Foreign tables are batched only if their FDW provides
+ *		ExecForeignBatchInsert, and says through GetForeignModifyBatchSize
+ *		that it wants more than one row at a time.  BEFORE ROW triggers are
+ *		fine there, since they have fired by the time the row is buffered.
+ *		Foreign partitions are not batched, as COPY doesn't either.
+ * ----------------------------------------------------------------
+ */
+static int
+ExecInsertBatchSize(ResultRelInfo *resultRelInfo)
+{
+	Relation	rel = resultRelInfo->ri_RelationDesc;
+	TriggerDesc *trigDesc = resultRelInfo->ri_TrigDesc;
+
+	if (resultRelInfo->ri_WithCheckOptions != NIL)
+		return 0;
+
+	if (resultRelInfo->ri_FdwRoutine != NULL)
+	{
+		FdwRoutine *fdwroutine = resultRelInfo->ri_FdwRoutine;
+		int			batch_size;
+
+		if (resultRelInfo->ri_PartitionInfo != NULL ||
+			fdwroutine->ExecForeignBatchInsert == NULL ||
+			fdwroutine->GetForeignModifyBatchSize == NULL)
+			return 0;
+
+		if (trigDesc != NULL &&
+			(trigDesc->trig_insert_after_row ||
+			 trigDesc->trig_insert_new_table))
+			return 0;
+
+		batch_size = fdwroutine->GetForeignModifyBatchSize(resultRelInfo);
+		if (batch_size <= 1)
+			return 0;
+
+		return Min(batch_size, MAX_BATCHED_INSERT_TUPLES);
+	}
+
+	if (rel->rd_rel->relkind != RELKIND_RELATION)
+		return 0;
+
+	if (trigDesc != NULL &&
+		(trigDesc->trig_insert_before_row ||
+		 trigDesc->trig_insert_after_row ||
+		 trigDesc->trig_insert_instead_row ||
+		 trigDesc->trig_insert_new_table))
+		return 0;
+
+	return MAX_BATCHED_INSERT_TUPLES;
+}
+
+/* ----------------------------------------------------------------
+ *		ExecGetInsertBatch
+ *
+ *		Return the batch that the rows of an INSERT going to the given table
+ *		are buffered in, or NULL if they can't be buffered.
+ *
+ *		Rows routed to the partitions of a partitioned table get a batch for
+ *		each partition, so that rows arriving in no particular order still
+ *		make up batches of a useful size.  The MAX_PARTITION_BATCHES
+ *		batches used most recently are kept; the least recently used one is
+ *		flushed and freed to make room for another.  Before a row goes into
+ *		a partition that can't be batched, all the buffered rows are
+ *		inserted, so that whatever runs for that row sees them.
+ * ----------------------------------------------------------------
+ */
+static ModifyTableBatch *
+ExecGetInsertBatch(ModifyTableState *mtstate, ResultRelInfo *resultRelInfo,
+				   EState *estate)
+{
+	ModifyTableBatch *batch = mtstate->mt_batch;
+	ListCell   *lc;
+
+	/* Most of the time, it's the same table as for the last row */
+	if (batch != NULL && batch->resultRelInfo == resultRelInfo)
+		return batch->size > 0 ? batch : NULL;
+
+	batch = NULL;
+	foreach(lc, mtstate->mt_batches)
+	{
+		if (((ModifyTableBatch *) lfirst(lc))->resultRelInfo == resultRelInfo)
+		{
+			batch = (ModifyTableBatch *) lfirst(lc);
+			break;
+		}
+	}
+
+	if (batch != NULL)
+		mtstate->mt_batches = list_delete_ptr(mtstate->mt_batches, batch);
+	else
+	{
+		batch = (ModifyTableBatch *)
+			MemoryContextAllocZero(estate->es_query_cxt,
+								   sizeof(ModifyTableBatch));
+		batch->resultRelInfo = resultRelInfo;
+		batch->size = ExecInsertBatchSize(resultRelInfo);
+		if (batch->size > 0)
+			batch->slots = (TupleTableSlot **)
+				MemoryContextAllocZero(estate->es_query_cxt,
+									   sizeof(TupleTableSlot *) * batch->size);
+	}
+	mtstate->mt_batches = lcons(batch, mtstate->mt_batches);
+	mtstate->mt_batch = batch;
+
+	if (list_length(mtstate->mt_batches) > MAX_PARTITION_BATCHES)
+	{
+		ModifyTableBatch *oldest = (ModifyTableBatch *) llast(mtstate->mt_batches);
+
+		ExecBatchInsertFlush(mtstate, oldest, estate);
+		ExecBatchInsertCleanup(oldest);
+		mtstate->mt_batches = list_delete_ptr(mtstate->mt_batches, oldest);
+	}
+
+	if (batch->size == 0)
+	{
+		ExecBatchInsertFlushAll(mtstate, estate);
+		return NULL;
+	}
+	return batch;
+}
+
+/* ----------------------------------------------------------------
+ *		ExecBatchInsert
+ *
+ *		Add a row that passed all the checks of ExecInsert to the batch,
+ *		flushing it first if it's full.
+ * ----------------------------------------------------------------
+ */
+static void
+ExecBatchInsert(ModifyTableState *mtstate, ModifyTableBatch *batch,
+				TupleTableSlot *slot, EState *estate)
+{
+	TupleTableSlot *batchslot;
+
+	if (batch->nused >= batch->size ||
+		batch->bytes >= MAX_BATCHED_INSERT_BYTES)
+		ExecBatchInsertFlush(mtstate, batch, estate);
+
+	batchslot = batch->slots[batch->nused];
+	if (batchslot == NULL)
+	{
+		batchslot = table_slot_create(batch->resultRelInfo->ri_RelationDesc,
+									  NULL);
+		batch->slots[batch->nused] = batchslot;
+	}
+
+	slot_getallattrs(slot);
+	batch->bytes += heap_compute_data_size(slot->tts_tupleDescriptor,
+										   slot->tts_values,
+										   slot->tts_isnull);
+
+	ExecCopySlot(batchslot, slot);
+	batchslot->tts_tableOid = slot->tts_tableOid;
+	batch->nused++;
+}
+
+/* ----------------------------------------------------------------
+ *		ExecBatchInsertFlush
+ *
+ *		Insert the rows buffered in a batch into its table and the
+ *		table's indexes.
+ * ----------------------------------------------------------------
+ */
+static void
+ExecBatchInsertFlush(ModifyTableState *mtstate, ModifyTableBatch *batch,
+					 EState *estate)
+{
+	ResultRelInfo *resultRelInfo = batch->resultRelInfo;
+	ResultRelInfo *saved_resultRelInfo = estate->es_result_relation_info;
+	TupleTableSlot **slots = batch->slots;
+	int			nused = batch->nused;
+	MemoryContext oldcontext;
+	int			i;
+
+	if (nused == 0)
+		return;
+
+	/* ExecInsertIndexTuples works on the current result relation */
+	estate->es_result_relation_info = resultRelInfo;
+
+	/* Foreign tables hand the whole batch to the FDW */
+	if (resultRelInfo->ri_FdwRoutine != NULL)
+	{
+		int			ninserted = nused;
+
+		resultRelInfo->ri_FdwRoutine->ExecForeignBatchInsert(estate,
+															 resultRelInfo,
+															 slots,
+															 &ninserted);
+		if (mtstate->canSetTag)
+			estate->es_processed += ninserted;
+
+		for (i = 0; i < nused; i++)
+			ExecClearTuple(slots[i]);
+
+		batch->nused = 0;
+		batch->bytes = 0;
+		estate->es_result_relation_info = saved_resultRelInfo;
+		return;
+	}
+
+	/*
+	 * table_multi_insert may leak memory, so switch to short-lived memory
+	 * context before calling it.
+	 */
+	oldcontext = MemoryContextSwitchTo(GetPerTupleMemoryContext(estate));
+	table_multi_insert(resultRelInfo->ri_RelationDesc, slots, nused,
+					   estate->es_output_cid, 0, NULL);
+	MemoryContextSwitchTo(oldcontext);
+
+	for (i = 0; i < nused; i++)
+	{
+		if (resultRelInfo->ri_NumIndices > 0)
+		{
+			List	   *recheckIndexes;
+
+			recheckIndexes = ExecInsertIndexTuples(slots[i], estate, false,
+												   NULL, NIL);
+			/* only deferred constraints, which rule out batching, recheck */
+			Assert(recheckIndexes == NIL);
+		}
+	}
+
+	if (mtstate->canSetTag)
+	{
+		estate->es_processed += nused;
+		setLastTid(&slots[nused - 1]->tts_tid);
+	}
+
+	for (i = 0; i < nused; i++)
+		ExecClearTuple(slots[i]);
+
+	batch->nused = 0;
+	batch->bytes = 0;
+	estate->es_result_relation_info = saved_resultRelInfo;
+}
+
+/* ----------------------------------------------------------------
+ *		ExecBatchInsertFlushAll
+ *
+ *		Insert the rows buffered in all batches.
+ * ----------------------------------------------------------------
+ */
+static void
+ExecBatchInsertFlushAll(ModifyTableState *mtstate, EState *estate)
+{
+	ListCell   *lc;
+
+	foreach(lc, mtstate->mt_batches)
+		ExecBatchInsertFlush(mtstate, (ModifyTableBatch *) lfirst(lc), estate);
+}
+
+/* ----------------------------------------------------------------
+ *		ExecBatchInsertCleanup
+ *
+ *		Release the slots of a batch that has been flushed, and the batch.
+ * ----------------------------------------------------------------
+ */
+static void
+ExecBatchInsertCleanup(ModifyTableBatch *batch)
+{
+	int			i;
+
+	for (i = 0; i < batch->size && batch->slots[i] != NULL; i++)
+		ExecDropSingleTupleTableSlot(batch->slots[i]);
+	if (batch->slots)
+		pfree(batch->slots);
+	pfree(batch);
+}
+
 /* ----------------------------------------------------------------
  *		ExecDelete
  *
@@ -2264,6 +2653,10 @@ ExecModifyTable(PlanState *pstate)
 		}
 	}
 
+	/* Insert the rows still buffered */
+	if (node->mt_batch_insert)
+		ExecBatchInsertFlushAll(node, estate);
+
 	/* Restore es_result_relation_info before exiting */
 	estate->es_result_relation_info = saved_resultRelInfo;
 
@@ -2718,6 +3111,9 @@ ExecInitModifyTable(ModifyTable *node, EState *estate, int eflags)
 		}
 	}
 
+	/* Buffer the rows of an INSERT for multi-row insertion, if we can. */
+	mtstate->mt_batch_insert = ExecCanBatchInsert(mtstate);
+
 	/*
 	 * Lastly, if this is not the primary (canSetTag) ModifyTable node, add it
 	 * to estate->es_auxmodifytables so that it will be run to completion by
@@ -2746,6 +3142,7 @@ void
 ExecEndModifyTable(ModifyTableState *node)
 {
 	int			i;
+	ListCell   *lc;
 
 	/*
 	 * Allow any FDWs to shut down
@@ -2761,6 +3158,13 @@ ExecEndModifyTable(ModifyTableState *node)
 														   resultRelInfo);
 	}
 
+	/* Release the batches of buffered rows, which have all been inserted */
+	foreach(lc, node->mt_batches)
+		ExecBatchInsertCleanup((ModifyTableBatch *) lfirst(lc));
+	list_free(node->mt_batches);
+	node->mt_batches = NIL;
+	node->mt_batch = NULL;
+
 	/*
 	 * Close all the partitioned tables, leaf partitions, and their indices
 	 * and release the slot used for tuple routing, if set.
@@ -29,17 +29,46 @@
 
 #include "access/relscan.h"
 #include "access/tableam.h"
+#include "executor/execBatch.h"
 #include "executor/execdebug.h"
+#include "executor/nodeHash.h"
 #include "executor/nodeSeqscan.h"
+#include "miscadmin.h"
 #include "utils/rel.h"
 
+static TableScanDesc SeqScanDesc(SeqScanState *node);
 static TupleTableSlot *SeqNext(SeqScanState *node);
+static bool SeqNextBatch(SeqScanState *node);
 
 /* ----------------------------------------------------------------
  *						Scan Support
  * ----------------------------------------------------------------
  */
 
+/* ----------------------------------------------------------------
+ *		SeqScanDesc
+ *
+ *		Return the scan descriptor, beginning the scan if needed
+ * ----------------------------------------------------------------
+ */
+static TableScanDesc
+SeqScanDesc(SeqScanState *node)
+{
+	if (node->ss.ss_currentScanDesc == NULL)
+	{
+		/*
+		 * We reach here if the scan is not parallel, or if we're serially
+		 * executing a scan that was planned to be parallel.
+		 */
+		node->ss.ss_currentScanDesc =
+			table_beginscan(node->ss.ss_currentRelation,
+							node->ss.ps.state->es_snapshot,
+							0, NULL);
+	}
+
+	return node->ss.ss_currentScanDesc;
+}
+
 /* ----------------------------------------------------------------
  *		SeqNext
  *
@@ -57,23 +86,11 @@ SeqNext(SeqScanState *node)
 	/*
 	 * get information from the estate and scan state
 	 */
-	scandesc = node->ss.ss_currentScanDesc;
+	scandesc = SeqScanDesc(node);
 	estate = node->ss.ps.state;
 	direction = estate->es_direction;
 	slot = node->ss.ss_ScanTupleSlot;
 
-	if (scandesc == NULL)
-	{
-		/*
-		 * We reach here if the scan is not parallel, or if we're serially
-		 * executing a scan that was planned to be parallel.
-		 */
-		scandesc = table_beginscan(node->ss.ss_currentRelation,
-								   estate->es_snapshot,
-								   0, NULL);
-		node->ss.ss_currentScanDesc = scandesc;
-	}
-
 	/*
 	 * get the next tuple from the table
 	 */
@@ -82,6 +99,53 @@ SeqNext(SeqScanState *node)
 	return NULL;
 }
 
+/* ----------------------------------------------------------------
+ *		SeqNextBatch
+ *
+ *		Fetch the next batch of tuples and evaluate the batch quals
+ *		on it, for ExecSeqScanBatch.  Returns false at the end of the
+ *		scan, after releasing the batch.
+ * ----------------------------------------------------------------
+ */
+static bool
+SeqNextBatch(SeqScanState *node)
+{
+	TupleBatch *batch = node->batch;
+	TableScanDesc scandesc;
+	int			nslots = 0;
+
+	/* don't let the table AM start over once it has reached the end */
+	if (node->batch_done)
+	{
+		node->ss.ss_ScanTupleSlot = node->scanslot;
+		ExecReleaseTupleBatch(batch);
+		return false;
+	}
+
+	scandesc = SeqScanDesc(node);
+
+	while (nslots < batch->maxslots)
+	{
+		CHECK_FOR_INTERRUPTS();
+
+		if (!table_scan_getnextslot(scandesc, ForwardScanDirection,
+									ExecTupleBatchSlot(batch, nslots)))
+		{
+			node->batch_done = true;
+			break;
+		}
+		nslots++;
+	}
+
+	batch->nslots = nslots;
+
+	ResetExprContext(node->ss.ps.ps_ExprContext);
+	ExecBatchQual(node->batchqual, batch, node->ss.ps.ps_ExprContext);
+	InstrCountFiltered1(node, batch->nslots - batch->nselected);
+
+	return true;
+}
+
 /*
  * SeqRecheck -- access method routine to recheck a tuple in EvalPlanQual
  */
@@ -114,6 +178,74 @@ ExecSeqScan(PlanState *pstate)
 					(ExecScanRecheckMtd) SeqRecheck);
 }
 
+/* ----------------------------------------------------------------
+ *		ExecSeqScanBatch(node)
+ *
+ *		Like ExecSeqScan, but fetches tuples a batch at a time and
+ *		evaluates the leading quals on the whole batch.  The remaining
+ *		quals and the projection are done tuple by tuple, as usual.
+ * ----------------------------------------------------------------
+ */
+static TupleTableSlot *
+ExecSeqScanBatch(PlanState *pstate)
+{
+	SeqScanState *node = castNode(SeqScanState, pstate);
+	TupleBatch *batch = node->batch;
+	ExprContext *econtext = node->ss.ps.ps_ExprContext;
+	ExprState  *qual = node->ss.ps.qual;
+	ProjectionInfo *projInfo = node->ss.ps.ps_ProjInfo;
+
+	ResetExprContext(econtext);
+
+	for (;;)
+	{
+		TupleTableSlot *slot;
+
+		if (batch->next >= batch->nselected)
+		{
+			if (!SeqNextBatch(node))
+			{
+				/* return an empty slot, as ExecScan does */
+				if (projInfo)
+					return ExecClearTuple(projInfo->pi_state.resultslot);
+				else
+					return ExecClearTuple(node->ss.ss_ScanTupleSlot);
+			}
+			continue;
+		}
+
+		slot = batch->slots[batch->sel[batch->next++]];
+
+		/*
+		 * Make it the scan's current tuple, which is where WHERE CURRENT OF
+		 * looks for it.
+		 */
+		node->ss.ss_ScanTupleSlot = slot;
+		econtext->ecxt_scantuple = slot;
+
+		/* see ExecScan */
+		if (node->ss.ss_RuntimeFilter &&
+			!ExecHashRuntimeFilterPass(node->ss.ss_RuntimeFilter, econtext))
+		{
+			InstrCountFiltered2(node, 1);
+			ResetExprContext(econtext);
+			continue;
+		}
+
+		if (qual == NULL || ExecQual(qual, econtext))
+		{
+			if (projInfo)
+				return ExecProject(projInfo);
+			else
+				return slot;
+		}
+		else
+			InstrCountFiltered1(node, 1);
+
+		ResetExprContext(econtext);
+	}
+}
+
 
 /* ----------------------------------------------------------------
  *		ExecInitSeqScan
@@ -165,6 +297,36 @@ ExecInitSeqScan(SeqScan *node, EState *estate, int eflags)
 	ExecInitResultTypeTL(&scanstate->ss.ps);
 	ExecAssignScanProjectionInfo(&scanstate->ss);
 
+	/*
+	 * The leading quals are evaluated a batch of tuples at a time, if they
+	 * are simple enough.  That needs the tuples to be fetched ahead, which
+	 * we don't do for a scan that may need to go backwards, or that returns
+	 * the test tuple of an EvalPlanQual recheck instead.
+	 */
+	if (!(eflags & EXEC_FLAG_BACKWARD) && estate->es_epqTupleSlot == NULL)
+	{
+		List	   *rest;
+
+		scanstate->batchqual = ExecInitBatchQual(node->plan.qual,
+												 node->scanrelid, &rest);
+		if (scanstate->batchqual != NULL)
+		{
+			Relation	rel = scanstate->ss.ss_currentRelation;
+
+			scanstate->batch =
+				ExecInitTupleBatch(RelationGetDescr(rel),
+								   table_slot_callbacks(rel),
+								   EXEC_BATCH_SIZE);
+			scanstate->scanslot = scanstate->ss.ss_ScanTupleSlot;
+			scanstate->ss.ps.ExecProcNode = ExecSeqScanBatch;
+
+			scanstate->ss.ps.qual =
+				ExecInitQual(rest, (PlanState *) scanstate);
+
+			return scanstate;
+		}
+	}
+
 	/*
 	 * initialize child expressions
 	 */
@@ -198,6 +360,11 @@ ExecEndSeqScan(SeqScanState *node)
 	/*
 	 * clean out the tuple table
 	 */
+	if (node->batch)
+	{
+		node->ss.ss_ScanTupleSlot = node->scanslot;
+		ExecReleaseTupleBatch(node->batch);
+	}
 	if (node->ss.ps.ps_ResultTupleSlot)
 		ExecClearTuple(node->ss.ps.ps_ResultTupleSlot);
 	ExecClearTuple(node->ss.ss_ScanTupleSlot);
@@ -231,6 +398,14 @@ ExecReScanSeqScan(SeqScanState *node)
 		table_rescan(scan,		/* scan desc */
 					 NULL);		/* new scan keys */
 
+	/* forget the tuples fetched ahead */
+	if (node->batch)
+	{
+		node->ss.ss_ScanTupleSlot = node->scanslot;
+		ExecClearTupleBatch(node->batch);
+		node->batch_done = false;
+	}
+
 	ExecScanReScan((ScanState *) node);
 }
 
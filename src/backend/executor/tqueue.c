@@ -8,6 +8,15 @@
  *
  * A TupleQueueReader reads tuples from a shm_mq and returns the tuples.
  *
+ * To keep the cost of shm_mq operations, and of waking the receiver, from
+ * dominating when tuples are small, the sender packs tuples into chunks and
+ * sends each chunk as one message.  Each tuple in a chunk is preceded by its
+ * length, and both are padded to a MAXALIGN boundary so that the tuple data
+ * can be read in place.  A chunk is sent once it is full, or as soon as a
+ * tuple is added while the receiver has less than a chunk of data still
+ * waiting to be read; so tuples are held back only while the receiver has
+ * work queued, and a receiver that is keeping up sees each tuple at once.
+ *
  * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
  * Portions Copyright (c) 1994, Regents of the University of California
  *
@@ -31,6 +40,8 @@ typedef struct TQueueDestReceiver
 {
 	DestReceiver pub;			/* public fields */
 	shm_mq_handle *queue;		/* shm_mq to send to */
+	char	   *chunk;			/* tuples not yet sent */
+	Size		chunk_used;		/* number of bytes used in chunk */
 } TQueueDestReceiver;
 
 /*
@@ -43,8 +54,60 @@ typedef struct TQueueDestReceiver
 struct TupleQueueReader
 {
 	shm_mq_handle *queue;		/* shm_mq to receive from */
+	char	   *chunk;			/* chunk being read, or NULL */
+	Size		chunk_size;		/* total size of chunk */
+	Size		chunk_offset;	/* offset of next tuple within chunk */
 };
 
+/*
+ * Size of the chunks tuples are sent in.  This is small compared to the
+ * queues Gather sets up, so that a worker can go on filling a chunk while
+ * the leader reads the previous ones.  Tuples too large for a chunk are sent
+ * in a chunk of their own.
+ */
+#define TQUEUE_CHUNK_SIZE		8192
+
+/* Space taken by the length word that precedes each tuple in a chunk */
+#define TQUEUE_ITEM_HDRSZ		MAXALIGN(sizeof(uint32))
+
+/*
+ * Check the result of sending to the shm_mq.
+ *
+ * Returns true if successful, false if shm_mq has been detached.
+ */
+static bool
+tqueueCheckResult(shm_mq_result result)
+{
+	if (result == SHM_MQ_DETACHED)
+		return false;
+	else if (result != SHM_MQ_SUCCESS)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("could not send tuple to shared-memory queue")));
+
+	return true;
+}
+
+/*
+ * Send the tuples accumulated in the chunk, if any.
+ *
+ * Returns true if successful, false if shm_mq has been detached.
+ */
+static bool
+tqueueFlush(TQueueDestReceiver *tqueue)
+{
+	shm_mq_result result;
+
+	if (tqueue->chunk_used == 0)
+		return true;
+
+	result = shm_mq_send(tqueue->queue, tqueue->chunk_used, tqueue->chunk,
+						 false);
+	tqueue->chunk_used = 0;
+
+	return tqueueCheckResult(result);
+}
+
 /*
  * Receive a tuple from a query, and send it to the designated shm_mq.
  *
@@ -55,25 +118,57 @@ tqueueReceiveSlot(TupleTableSlot *slot, DestReceiver *self)
 {
 	TQueueDestReceiver *tqueue = (TQueueDestReceiver *) self;
 	HeapTuple	tuple;
-	shm_mq_result result;
+	Size		itemsize;
+	uint32		len;
 	bool		should_free;
+	bool		ok = true;
 
-	/* Send the tuple itself. */
 	tuple = ExecFetchSlotHeapTuple(slot, true, &should_free);
-	result = shm_mq_send(tqueue->queue, tuple->t_len, tuple->t_data, false);
+	len = tuple->t_len;
+	itemsize = TQUEUE_ITEM_HDRSZ + MAXALIGN(len);
+
+	/* If the tuple won't fit in the chunk, send what we have first. */
+	if (tqueue->chunk_used + itemsize > TQUEUE_CHUNK_SIZE)
+		ok = tqueueFlush(tqueue);
+
+	if (!ok)
+	{
+		/* queue is detached; nothing more to do */
+	}
+	else if (itemsize > TQUEUE_CHUNK_SIZE)
+	{
+		/* Too large to buffer, so send the tuple as a chunk of its own. */
+		char		hdr[TQUEUE_ITEM_HDRSZ];
+		shm_mq_iovec iov[2];
+
+		memset(hdr, 0, sizeof(hdr));
+		memcpy(hdr, &len, sizeof(uint32));
+		iov[0].data = hdr;
+		iov[0].len = TQUEUE_ITEM_HDRSZ;
+		iov[1].data = (const char *) tuple->t_data;
+		iov[1].len = len;
+		ok = tqueueCheckResult(shm_mq_sendv(tqueue->queue, iov, 2, false));
+	}
+	else
+	{
+		char	   *item = tqueue->chunk + tqueue->chunk_used;
+
+		memcpy(item, &len, sizeof(uint32));
+		memcpy(item + TQUEUE_ITEM_HDRSZ, tuple->t_data, len);
+		tqueue->chunk_used += itemsize;
+
+		/*
+		 * Send the chunk right away if the receiver is close to running out
+		 * of data, so that it doesn't sit idle waiting for a chunk to fill.
+		 */
+		if (shm_mq_get_bytes_unread(tqueue->queue) < TQUEUE_CHUNK_SIZE)
+			ok = tqueueFlush(tqueue);
+	}
 
 	if (should_free)
 		heap_freetuple(tuple);
 
-	/* Check for failure. */
-	if (result == SHM_MQ_DETACHED)
-		return false;
-	else if (result != SHM_MQ_SUCCESS)
-		ereport(ERROR,
-				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
-				 errmsg("could not send tuple to shared-memory queue")));
-
-	return true;
+	return ok;
 }
 
 /*
@@ -94,7 +189,11 @@ tqueueShutdownReceiver(DestReceiver *self)
 	TQueueDestReceiver *tqueue = (TQueueDestReceiver *) self;
 
 	if (tqueue->queue != NULL)
+	{
+		/* Send any tuples still in the chunk; the queue may be detached. */
+		(void) tqueueFlush(tqueue);
 		shm_mq_detach(tqueue->queue);
+	}
 	tqueue->queue = NULL;
 }
 
@@ -109,6 +208,7 @@ tqueueDestroyReceiver(DestReceiver *self)
 	/* We probably already detached from queue, but let's be sure */
 	if (tqueue->queue != NULL)
 		shm_mq_detach(tqueue->queue);
+	pfree(tqueue->chunk);
 	pfree(self);
 }
 
@@ -128,6 +228,8 @@ CreateTupleQueueDestReceiver(shm_mq_handle *handle)
 	self->pub.rDestroy = tqueueDestroyReceiver;
 	self->pub.mydest = DestTupleQueue;
 	self->queue = handle;
+	self->chunk = palloc(TQUEUE_CHUNK_SIZE);
+	self->chunk_used = 0;
 
 	return (DestReceiver *) self;
 }
@@ -171,33 +273,55 @@ DestroyTupleQueueReader(TupleQueueReader *reader)
  * Even when shm_mq_receive() returns SHM_MQ_WOULD_BLOCK, this can still
  * accumulate bytes from a partially-read message, so it's useful to call
  * this with nowait = true even if nothing is returned.
+ *
+ * Tuples are returned from the current chunk until it is used up, and only
+ * then is the next chunk received; the chunk's data stays valid until then.
  */
 HeapTuple
 TupleQueueReaderNext(TupleQueueReader *reader, bool nowait, bool *done)
 {
 	HeapTupleData htup;
-	shm_mq_result result;
-	Size		nbytes;
-	void	   *data;
+	uint32		len;
+	char	   *item;
 
 	if (done != NULL)
 		*done = false;
 
-	/* Attempt to read a message. */
-	result = shm_mq_receive(reader->queue, &nbytes, &data, nowait);
-
-	/* If queue is detached, set *done and return NULL. */
-	if (result == SHM_MQ_DETACHED)
+	if (reader->chunk == NULL || reader->chunk_offset >= reader->chunk_size)
 	{
-		if (done != NULL)
-			*done = true;
-		return NULL;
+		shm_mq_result result;
+		Size		nbytes;
+		void	   *data;
+
+		reader->chunk = NULL;
+
+		/* Attempt to read a message. */
+		result = shm_mq_receive(reader->queue, &nbytes, &data, nowait);
+
+		/* If queue is detached, set *done and return NULL. */
+		if (result == SHM_MQ_DETACHED)
+		{
+			if (done != NULL)
+				*done = true;
+			return NULL;
+		}
+
+		/* In non-blocking mode, bail out if no message ready yet. */
+		if (result == SHM_MQ_WOULD_BLOCK)
+			return NULL;
+		Assert(result == SHM_MQ_SUCCESS);
+		Assert(nbytes > TQUEUE_ITEM_HDRSZ);
+
+		reader->chunk = data;
+		reader->chunk_size = nbytes;
+		reader->chunk_offset = 0;
 	}
 
-	/* In non-blocking mode, bail out if no message ready yet. */
-	if (result == SHM_MQ_WOULD_BLOCK)
-		return NULL;
-	Assert(result == SHM_MQ_SUCCESS);
+	/* Step over the next tuple in the chunk. */
+	item = reader->chunk + reader->chunk_offset;
+	memcpy(&len, item, sizeof(uint32));
+	Assert(reader->chunk_offset + TQUEUE_ITEM_HDRSZ + len <= reader->chunk_size);
+	reader->chunk_offset += TQUEUE_ITEM_HDRSZ + MAXALIGN(len);
 
 	/*
 	 * Set up a dummy HeapTupleData pointing to the data from the shm_mq
@@ -205,8 +329,8 @@ TupleQueueReaderNext(TupleQueueReader *reader, bool nowait, bool *done)
 	 */
 	ItemPointerSetInvalid(&htup.t_self);
 	htup.t_tableOid = InvalidOid;
-	htup.t_len = nbytes;
-	htup.t_data = data;
+	htup.t_len = len;
+	htup.t_data = (HeapTupleHeader) (item + TQUEUE_ITEM_HDRSZ);
 
 	return heap_copytuple(&htup);
 }
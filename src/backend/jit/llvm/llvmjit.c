@@ -68,6 +68,7 @@ LLVMTypeRef StructTupleDescData;
 LLVMTypeRef StructTupleTableSlot;
 LLVMTypeRef StructHeapTupleTableSlot;
 LLVMTypeRef StructMinimalTupleTableSlot;
+LLVMTypeRef StructZHeapTupleTableSlot;
 LLVMTypeRef StructMemoryContextData;
 LLVMTypeRef StructPGFinfoRecord;
 LLVMTypeRef StructFmgrInfo;
@@ -158,6 +159,29 @@ llvm_create_context(int jitFlags)
 	return context;
 }
 
+/*
+ * Create a context for code that is reused across queries.
+ *
+ * Unlike contexts created by llvm_create_context(), the context isn't
+ * associated with a resource owner and is never released: the code emitted
+ * in it stays valid until the backend exits.
+ */
+LLVMJitContext *
+llvm_create_persistent_context(int jitFlags)
+{
+	LLVMJitContext *context;
+
+	llvm_assert_in_fatal_section();
+
+	llvm_session_initialize();
+
+	context = MemoryContextAllocZero(TopMemoryContext,
+									 sizeof(LLVMJitContext));
+	context->base.flags = jitFlags;
+
+	return context;
+}
+
 /*
  * Release resources required by one llvm context.
  */
@@ -817,6 +841,7 @@ llvm_create_types(void)
 	StructTupleTableSlot = load_type(mod, "StructTupleTableSlot");
 	StructHeapTupleTableSlot = load_type(mod, "StructHeapTupleTableSlot");
 	StructMinimalTupleTableSlot = load_type(mod, "StructMinimalTupleTableSlot");
+	StructZHeapTupleTableSlot = load_type(mod, "StructZHeapTupleTableSlot");
 	StructHeapTupleData = load_type(mod, "StructHeapTupleData");
 	StructTupleDescData = load_type(mod, "StructTupleDescData");
 	StructAggState = load_type(mod, "StructAggState");
@@ -1,12 +1,19 @@
 /*-------------------------------------------------------------------------
  *
  * llvmjit_deform.c
- *	  Generate code for deforming a heap tuple.
+ *	  Generate code for deforming a heap or zheap tuple.
  *
  * This gains performance benefits over unJITed deforming from compile-time
  * knowledge of the tuple descriptor. Fixed column widths, NOT NULLness, etc
  * can be taken advantage of.
  *
+ * zheap tuples follow different alignment rules: pass-by-value columns are
+ * not aligned at all, and since t_hoff isn't MAXALIGN'd, the other columns
+ * are aligned by their address rather than by their offset in the data.
+ *
+ * Deforming functions only depend on the physical layout of the tuple, so
+ * they are kept in a per-backend cache and reused by later queries.
+ *
  * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
  * Portions Copyright (c) 1994, Regents of the University of California
  *
@@ -22,9 +29,51 @@
 
 #include "access/htup_details.h"
 #include "access/tupdesc_details.h"
+#include "access/zhtup.h"
 #include "executor/tuptable.h"
 #include "jit/llvmjit.h"
 #include "jit/llvmjit_emit.h"
+#include "utils/hashutils.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+
+
+/*
+ * The properties of an attribute that the code generated by
+ * slot_compile_deform() depends on.
+ */
+typedef struct DeformCacheAttr
+{
+	int16		attlen;
+	char		attalign;
+	bool		attbyval;
+	bool		attnotnull;
+	bool		atthasmissing;
+	bool		attisdropped;
+} DeformCacheAttr;
+
+typedef struct DeformCacheKey
+{
+	const TupleTableSlotOps *ops;
+	int			natts;			/* number of columns to deform */
+	int			flags;			/* PGJIT_* flags affecting the code */
+	int			ndescatts;		/* number of entries in attrs */
+	DeformCacheAttr *attrs;
+} DeformCacheKey;
+
+typedef struct DeformCacheEntry
+{
+	DeformCacheKey key;			/* hash key (must be first) */
+	void	   *fn;				/* the compiled function */
+} DeformCacheEntry;
+
+static HTAB *deform_cache = NULL;
+
+/*
+ * Context that cached functions are compiled in.  It is never released, so
+ * the code stays valid until the backend exits.
+ */
+static LLVMJitContext *deform_cache_context = NULL;
 
 
 /*
@@ -87,6 +136,8 @@ slot_compile_deform(LLVMJitContext *context, TupleDesc desc,
 	/* if true, known_alignment describes definite offset of column */
 	bool		attguaranteedalign = true;
 
+	bool		is_zheap = (ops == &TTSOpsZHeapTuple);
+
 	int			attnum;
 
 	/* virtual tuples never need deforming, so don't generate code */
@@ -95,7 +146,7 @@ slot_compile_deform(LLVMJitContext *context, TupleDesc desc,
 
 	/* decline to JIT for slot types we don't know to handle */
 	if (ops != &TTSOpsHeapTuple && ops != &TTSOpsBufferHeapTuple &&
-		ops != &TTSOpsMinimalTuple)
+		ops != &TTSOpsMinimalTuple && ops != &TTSOpsZHeapTuple)
 		return NULL;
 
 	mod = llvm_mutable_module(context);
@@ -208,56 +259,116 @@ slot_compile_deform(LLVMJitContext *context, TupleDesc desc,
 			l_load_struct_gep(b, v_minimalslot, FIELDNO_MINIMALTUPLETABLESLOT_TUPLE,
 							  "tupleheader");
 	}
+	else if (ops == &TTSOpsZHeapTuple)
+	{
+		LLVMValueRef v_zheapslot;
+
+		v_zheapslot =
+			LLVMBuildBitCast(b,
+							 v_slot,
+							 l_ptr(StructZHeapTupleTableSlot),
+							 "zheapslot");
+		v_slotoffp = LLVMBuildStructGEP(b, v_zheapslot, FIELDNO_ZHEAPTUPLETABLESLOT_OFF, "");
+		v_tupleheaderp =
+			l_load_struct_gep(b, v_zheapslot, FIELDNO_ZHEAPTUPLETABLESLOT_TUPLE,
+							  "tupleheader");
+	}
 	else
 	{
 		/* should've returned at the start of the function */
 		pg_unreachable();
 	}
 
-	v_tuplep =
-		l_load_struct_gep(b, v_tupleheaderp, FIELDNO_HEAPTUPLEDATA_DATA,
-						  "tuple");
-	v_bits =
-		LLVMBuildBitCast(b,
-						 LLVMBuildStructGEP(b, v_tuplep,
-											FIELDNO_HEAPTUPLEHEADERDATA_BITS,
+	if (is_zheap)
+	{
+		v_tuplep =
+			l_load_struct_gep(b, v_tupleheaderp, FIELDNO_ZHEAPTUPLEDATA_DATA,
+							  "tuple");
+		v_bits =
+			LLVMBuildBitCast(b,
+							 LLVMBuildStructGEP(b, v_tuplep,
+												FIELDNO_ZHEAPTUPLEHEADERDATA_BITS,
+												""),
+							 l_ptr(LLVMInt8Type()),
+							 "t_bits");
+		v_infomask1 =
+			l_load_struct_gep(b, v_tuplep,
+							  FIELDNO_ZHEAPTUPLEHEADERDATA_INFOMASK,
+							  "infomask1");
+		v_infomask2 =
+			l_load_struct_gep(b,
+							  v_tuplep, FIELDNO_ZHEAPTUPLEHEADERDATA_INFOMASK2,
+							  "infomask2");
+
+		/* t_infomask & ZHEAP_HASNULL */
+		v_hasnulls =
+			LLVMBuildICmp(b, LLVMIntNE,
+						  LLVMBuildAnd(b,
+									   l_int16_const(ZHEAP_HASNULL),
+									   v_infomask1, ""),
+						  l_int16_const(0),
+						  "hasnulls");
+
+		/* t_infomask2 & ZHEAP_NATTS_MASK */
+		v_maxatt = LLVMBuildAnd(b,
+								l_int16_const(ZHEAP_NATTS_MASK),
+								v_infomask2,
+								"maxatt");
+
+		v_hoff =
+			LLVMBuildZExt(b,
+						  l_load_struct_gep(b, v_tuplep,
+											FIELDNO_ZHEAPTUPLEHEADERDATA_HOFF,
 											""),
-						 l_ptr(LLVMInt8Type()),
-						 "t_bits");
-	v_infomask1 =
-		l_load_struct_gep(b, v_tuplep,
-						  FIELDNO_HEAPTUPLEHEADERDATA_INFOMASK,
-						  "infomask1");
-	v_infomask2 =
-		l_load_struct_gep(b,
-						  v_tuplep, FIELDNO_HEAPTUPLEHEADERDATA_INFOMASK2,
-						  "infomask2");
-
-	/* t_infomask & HEAP_HASNULL */
-	v_hasnulls =
-		LLVMBuildICmp(b, LLVMIntNE,
-					  LLVMBuildAnd(b,
-								   l_int16_const(HEAP_HASNULL),
-								   v_infomask1, ""),
-					  l_int16_const(0),
-					  "hasnulls");
-
-	/* t_infomask2 & HEAP_NATTS_MASK */
-	v_maxatt = LLVMBuildAnd(b,
-							l_int16_const(HEAP_NATTS_MASK),
-							v_infomask2,
-							"maxatt");
+						  LLVMInt32Type(), "t_hoff");
+	}
+	else
+	{
+		v_tuplep =
+			l_load_struct_gep(b, v_tupleheaderp, FIELDNO_HEAPTUPLEDATA_DATA,
+							  "tuple");
+		v_bits =
+			LLVMBuildBitCast(b,
+							 LLVMBuildStructGEP(b, v_tuplep,
+												FIELDNO_HEAPTUPLEHEADERDATA_BITS,
+												""),
+							 l_ptr(LLVMInt8Type()),
+							 "t_bits");
+		v_infomask1 =
+			l_load_struct_gep(b, v_tuplep,
+							  FIELDNO_HEAPTUPLEHEADERDATA_INFOMASK,
+							  "infomask1");
+		v_infomask2 =
+			l_load_struct_gep(b,
+							  v_tuplep, FIELDNO_HEAPTUPLEHEADERDATA_INFOMASK2,
+							  "infomask2");
+
+		/* t_infomask & HEAP_HASNULL */
+		v_hasnulls =
+			LLVMBuildICmp(b, LLVMIntNE,
+						  LLVMBuildAnd(b,
+									   l_int16_const(HEAP_HASNULL),
+									   v_infomask1, ""),
+						  l_int16_const(0),
+						  "hasnulls");
+
+		/* t_infomask2 & HEAP_NATTS_MASK */
+		v_maxatt = LLVMBuildAnd(b,
+								l_int16_const(HEAP_NATTS_MASK),
+								v_infomask2,
+								"maxatt");
 
-	/*
-	 * Need to zext, as getelementptr otherwise treats hoff as a signed 8bit
-	 * integer, which'd yield a negative offset for t_hoff > 127.
-	 */
-	v_hoff =
-		LLVMBuildZExt(b,
-					  l_load_struct_gep(b, v_tuplep,
-										FIELDNO_HEAPTUPLEHEADERDATA_HOFF,
-										""),
-					  LLVMInt32Type(), "t_hoff");
+		/*
+		 * Need to zext, as getelementptr otherwise treats hoff as a signed
+		 * 8bit integer, which'd yield a negative offset for t_hoff > 127.
+		 */
+		v_hoff =
+			LLVMBuildZExt(b,
+						  l_load_struct_gep(b, v_tuplep,
+											FIELDNO_HEAPTUPLEHEADERDATA_HOFF,
+											""),
+						  LLVMInt32Type(), "t_hoff");
+	}
 
 	v_tupdata_base =
 		LLVMBuildGEP(b,
@@ -490,6 +601,10 @@ slot_compile_deform(LLVMJitContext *context, TupleDesc desc,
 			alignto = 0;
 		}
 
+		/* zheap doesn't align pass-by-value columns */
+		if (is_zheap && att->attbyval)
+			alignto = 1;
+
 		/* ------
 		 * Even if alignment is required, we can skip doing it if provably
 		 * unnecessary:
@@ -497,10 +612,12 @@ slot_compile_deform(LLVMJitContext *context, TupleDesc desc,
 		 * - columns following a NOT NULL fixed width datum have known
 		 *   alignment, can skip alignment computation if that known alignment
 		 *   is compatible with current column.
+		 * Neither holds for zheap, whose tuple data isn't aligned.
 		 * ------
 		 */
 		if (alignto > 1 &&
-			(known_alignment < 0 || known_alignment != TYPEALIGN(alignto, known_alignment)))
+			(is_zheap || known_alignment < 0 ||
+			 known_alignment != TYPEALIGN(alignto, known_alignment)))
 		{
 			/*
 			 * When accessing a varlena field, we have to "peek" to see if we
@@ -540,6 +657,26 @@ slot_compile_deform(LLVMJitContext *context, TupleDesc desc,
 			LLVMPositionBuilderAtEnd(b, attalignblocks[attnum]);
 
 			/* translation of alignment code (cf TYPEALIGN()) */
+			if (is_zheap)
+			{
+				LLVMValueRef v_base;
+				LLVMValueRef v_addr;
+				LLVMValueRef v_addr_aligned;
+				LLVMValueRef v_off = LLVMBuildLoad(b, v_offp, "");
+
+				/* align the address, as att_align_pointer() does */
+				v_base = LLVMBuildPtrToInt(b, v_tupdata_base, TypeSizeT, "");
+				v_addr = LLVMBuildAdd(b, v_base, v_off, "");
+				v_addr = LLVMBuildAdd(b, v_addr, l_sizet_const(alignto - 1), "");
+				v_addr_aligned = LLVMBuildAnd(b, v_addr,
+											  l_sizet_const(~(alignto - 1)),
+											  "aligned_addr");
+				LLVMBuildStore(b,
+							   LLVMBuildSub(b, v_addr_aligned, v_base,
+											"aligned_offset"),
+							   v_offp);
+			}
+			else
 			{
 				LLVMValueRef v_off_aligned;
 				LLVMValueRef v_off = LLVMBuildLoad(b, v_offp, "");
@@ -561,9 +698,15 @@ slot_compile_deform(LLVMJitContext *context, TupleDesc desc,
 			/*
 			 * As alignment either was unnecessary or has been performed, we
 			 * now know the current alignment. This is only safe because this
-			 * value isn't used for varlena and nullable columns.
+			 * value isn't used for varlena and nullable columns.  For zheap,
+			 * the resulting offset depends on where the tuple is.
 			 */
-			if (known_alignment >= 0)
+			if (is_zheap)
+			{
+				known_alignment = -1;
+				attguaranteedalign = false;
+			}
+			else if (known_alignment >= 0)
 			{
 				Assert(known_alignment != 0);
 				known_alignment = TYPEALIGN(alignto, known_alignment);
@@ -657,6 +800,9 @@ slot_compile_deform(LLVMJitContext *context, TupleDesc desc,
 			v_tmp_loaddata =
 				LLVMBuildPointerCast(b, v_attdatap, vartypep, "");
 			v_tmp_loaddata = LLVMBuildLoad(b, v_tmp_loaddata, "attr_byval");
+			/* pass-by-value columns aren't aligned in zheap */
+			if (is_zheap)
+				LLVMSetAlignment(v_tmp_loaddata, 1);
 			v_tmp_loaddata = LLVMBuildZExt(b, v_tmp_loaddata, TypeSizeT, "");
 
 			LLVMBuildStore(b, v_tmp_loaddata, v_resultp);
@@ -754,3 +900,157 @@ slot_compile_deform(LLVMJitContext *context, TupleDesc desc,
 
 	return v_deform_fn;
 }
+
+static uint32
+deform_cache_hash(const void *key, Size keysize)
+{
+	const DeformCacheKey *k = (const DeformCacheKey *) key;
+	uint32		hash;
+
+	hash = DatumGetUInt32(hash_any((const unsigned char *) k->attrs,
+								   k->ndescatts * sizeof(DeformCacheAttr)));
+	hash = hash_combine(hash,
+						DatumGetUInt32(hash_uint32((uint32) (uintptr_t) k->ops)));
+	hash = hash_combine(hash, DatumGetUInt32(hash_uint32((uint32) k->natts)));
+	hash = hash_combine(hash, DatumGetUInt32(hash_uint32((uint32) k->flags)));
+
+	return hash;
+}
+
+static int
+deform_cache_match(const void *key1, const void *key2, Size keysize)
+{
+	const DeformCacheKey *k1 = (const DeformCacheKey *) key1;
+	const DeformCacheKey *k2 = (const DeformCacheKey *) key2;
+
+	if (k1->ops != k2->ops ||
+		k1->natts != k2->natts ||
+		k1->flags != k2->flags ||
+		k1->ndescatts != k2->ndescatts)
+		return 1;
+
+	return memcmp(k1->attrs, k2->attrs,
+				  k1->ndescatts * sizeof(DeformCacheAttr));
+}
+
+/*
+ * Return a reference, usable in context's module, to a function deforming a
+ * tuple of type desc up to natts columns that was compiled for an earlier
+ * query, compiling and caching it if there's none yet.
+ *
+ * Returns NULL if the function can't be cached, e.g. because the cache is
+ * full, in which case the caller should use slot_compile_deform() instead.
+ *
+ * The cached function is called through a pointer, so unlike a function
+ * built by slot_compile_deform() it can't be inlined into the expression;
+ * that's a small price for not having to optimize and emit it each time.
+ * The time spent compiling a function that's not cached yet is included in
+ * the caller's generation time.
+ */
+LLVMValueRef
+slot_cached_deform(LLVMJitContext *context, TupleDesc desc,
+				   const TupleTableSlotOps *ops, int natts)
+{
+	DeformCacheKey key;
+	DeformCacheEntry *entry;
+	LLVMTypeRef param_types[1];
+	LLVMTypeRef deform_sig;
+	int			attnum;
+
+	if (jit_deform_cache_size <= 0)
+		return NULL;
+
+	/* same restrictions as slot_compile_deform() */
+	if (ops != &TTSOpsHeapTuple && ops != &TTSOpsBufferHeapTuple &&
+		ops != &TTSOpsMinimalTuple && ops != &TTSOpsZHeapTuple)
+		return NULL;
+
+	if (deform_cache == NULL)
+	{
+		HASHCTL		ctl;
+
+		memset(&ctl, 0, sizeof(ctl));
+		ctl.keysize = sizeof(DeformCacheKey);
+		ctl.entrysize = sizeof(DeformCacheEntry);
+		ctl.hash = deform_cache_hash;
+		ctl.match = deform_cache_match;
+		ctl.hcxt = TopMemoryContext;
+		deform_cache = hash_create("JIT deform cache", 64, &ctl,
+								   HASH_ELEM | HASH_FUNCTION | HASH_COMPARE |
+								   HASH_CONTEXT);
+	}
+
+	key.ops = ops;
+	key.natts = natts;
+	key.flags = context->base.flags & (PGJIT_OPT3 | PGJIT_INLINE);
+	key.ndescatts = desc->natts;
+	/* zeroed, so that padding doesn't affect hashing and comparisons */
+	key.attrs = palloc0(sizeof(DeformCacheAttr) * Max(desc->natts, 1));
+	for (attnum = 0; attnum < desc->natts; attnum++)
+	{
+		Form_pg_attribute att = TupleDescAttr(desc, attnum);
+
+		key.attrs[attnum].attlen = att->attlen;
+		key.attrs[attnum].attalign = att->attalign;
+		key.attrs[attnum].attbyval = att->attbyval;
+		key.attrs[attnum].attnotnull = att->attnotnull;
+		key.attrs[attnum].atthasmissing = att->atthasmissing;
+		key.attrs[attnum].attisdropped = att->attisdropped;
+	}
+
+	entry = (DeformCacheEntry *) hash_search(deform_cache, &key,
+											 HASH_FIND, NULL);
+
+	if (entry == NULL)
+	{
+		LLVMValueRef v_deform_fn;
+		char	   *funcname;
+		void	   *fn;
+		bool		found;
+
+		if (hash_get_num_entries(deform_cache) >= jit_deform_cache_size)
+		{
+			pfree(key.attrs);
+			return NULL;
+		}
+
+		if (deform_cache_context == NULL)
+			deform_cache_context = llvm_create_persistent_context(key.flags);
+		deform_cache_context->base.flags = key.flags;
+
+		/* throw away what's left of a module an error interrupted */
+		if (deform_cache_context->module)
+		{
+			LLVMDisposeModule(deform_cache_context->module);
+			deform_cache_context->module = NULL;
+		}
+
+		v_deform_fn = slot_compile_deform(deform_cache_context, desc,
+										  ops, natts);
+		Assert(v_deform_fn != NULL);
+
+		/* has to be visible, to be looked up after emission */
+		LLVMSetLinkage(v_deform_fn, LLVMExternalLinkage);
+		funcname = pstrdup(LLVMGetValueName(v_deform_fn));
+		fn = llvm_get_function(deform_cache_context, funcname);
+		pfree(funcname);
+
+		entry = (DeformCacheEntry *) hash_search(deform_cache, &key,
+												 HASH_ENTER, &found);
+		Assert(!found);
+		entry->key.attrs =
+			MemoryContextAlloc(TopMemoryContext,
+							   sizeof(DeformCacheAttr) * Max(desc->natts, 1));
+		memcpy(entry->key.attrs, key.attrs,
+			   sizeof(DeformCacheAttr) * Max(desc->natts, 1));
+		entry->fn = fn;
+	}
+
+	pfree(key.attrs);
+
+	param_types[0] = l_ptr(StructTupleTableSlot);
+	deform_sig = LLVMFunctionType(LLVMVoidType(), param_types,
+								  lengthof(param_types), 0);
+
+	return l_ptr_const(entry->fn, l_ptr(deform_sig));
+}
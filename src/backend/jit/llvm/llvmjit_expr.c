@@ -322,9 +322,14 @@ llvm_compile_expr(ExprState *state)
 					if (tts_ops && desc && (context->base.flags & PGJIT_DEFORM))
 					{
 						l_jit_deform =
-							slot_compile_deform(context, desc,
-												tts_ops,
-												op->d.fetch.last_var);
+							slot_cached_deform(context, desc,
+											   tts_ops,
+											   op->d.fetch.last_var);
+						if (!l_jit_deform)
+							l_jit_deform =
+								slot_compile_deform(context, desc,
+													tts_ops,
+													op->d.fetch.last_var);
 					}
 
 					if (l_jit_deform)
@@ -658,6 +663,60 @@ llvm_compile_expr(ExprState *state)
 				LLVMBuildBr(b, opblocks[i + 1]);
 				break;
 
+			case EEOP_VAR_CMP_CONST:
+				build_EvalXFunc(b, mod, "ExecEvalVarCmpConst",
+								v_state, v_econtext, op);
+				LLVMBuildBr(b, opblocks[i + 1]);
+				break;
+
+			case EEOP_VAR_CMP_VAR:
+				build_EvalXFunc(b, mod, "ExecEvalVarCmpVar",
+								v_state, v_econtext, op);
+				LLVMBuildBr(b, opblocks[i + 1]);
+				break;
+
+			case EEOP_QUAL_VAR_CMP_CONST:
+			case EEOP_QUAL_VAR_CMP_VAR:
+				{
+					LLVMValueRef v_resnull;
+					LLVMValueRef v_resvalue;
+					LLVMValueRef v_nullorfalse;
+					LLVMBasicBlockRef b_qualfail;
+
+					b_qualfail = l_bb_before_v(opblocks[i + 1],
+											   "op.%d.qualfail", i);
+
+					/* compute the comparison out of line ... */
+					build_EvalXFunc(b, mod,
+									opcode == EEOP_QUAL_VAR_CMP_CONST ?
+									"ExecEvalVarCmpConst" : "ExecEvalVarCmpVar",
+									v_state, v_econtext, op);
+
+					/* ... and then test it as EEOP_QUAL does */
+					v_resvalue = LLVMBuildLoad(b, v_resvaluep, "");
+					v_resnull = LLVMBuildLoad(b, v_resnullp, "");
+
+					v_nullorfalse =
+						LLVMBuildOr(b,
+									LLVMBuildICmp(b, LLVMIntEQ, v_resnull,
+												  l_sbool_const(1), ""),
+									LLVMBuildICmp(b, LLVMIntEQ, v_resvalue,
+												  l_sizet_const(0), ""),
+									"");
+
+					LLVMBuildCondBr(b,
+									v_nullorfalse,
+									b_qualfail,
+									opblocks[i + 1]);
+
+					/* build block handling NULL or false */
+					LLVMPositionBuilderAtEnd(b, b_qualfail);
+					LLVMBuildStore(b, l_sbool_const(0), v_resnullp);
+					LLVMBuildStore(b, l_sizet_const(0), v_resvaluep);
+					LLVMBuildBr(b, opblocks[op->d.varcmp.jumpdone]);
+					break;
+				}
+
 			case EEOP_BOOL_AND_STEP_FIRST:
 				{
 					LLVMValueRef v_boolanynullp;
@@ -1026,6 +1085,39 @@ llvm_compile_expr(ExprState *state)
 					break;
 				}
 
+			case EEOP_QUAL_NULLTEST_ISNULL:
+			case EEOP_QUAL_NULLTEST_ISNOTNULL:
+				{
+					LLVMValueRef v_resnull = LLVMBuildLoad(b, v_resnullp, "");
+					LLVMValueRef v_pass;
+					LLVMBasicBlockRef b_qualpass;
+					LLVMBasicBlockRef b_qualfail;
+
+					b_qualpass = l_bb_before_v(opblocks[i + 1],
+											   "op.%d.qualpass", i);
+					b_qualfail = l_bb_before_v(opblocks[i + 1],
+											   "op.%d.qualfail", i);
+
+					v_pass = LLVMBuildICmp(b,
+										   opcode == EEOP_QUAL_NULLTEST_ISNULL ?
+										   LLVMIntEQ : LLVMIntNE,
+										   v_resnull, l_sbool_const(1), "");
+					LLVMBuildCondBr(b, v_pass, b_qualpass, b_qualfail);
+
+					/* the test passed, leave TRUE in place */
+					LLVMPositionBuilderAtEnd(b, b_qualpass);
+					LLVMBuildStore(b, l_sizet_const(1), v_resvaluep);
+					LLVMBuildStore(b, l_sbool_const(0), v_resnullp);
+					LLVMBuildBr(b, opblocks[i + 1]);
+
+					/* the test failed, return FALSE */
+					LLVMPositionBuilderAtEnd(b, b_qualfail);
+					LLVMBuildStore(b, l_sizet_const(0), v_resvaluep);
+					LLVMBuildStore(b, l_sbool_const(0), v_resnullp);
+					LLVMBuildBr(b, opblocks[op->d.qualexpr.jumpdone]);
+					break;
+				}
+
 			case EEOP_NULLTEST_ROWISNULL:
 				build_EvalXFunc(b, mod, "ExecEvalRowNull",
 								v_state, v_econtext, op);
@@ -2083,6 +2175,41 @@ llvm_compile_expr(ExprState *state)
 					break;
 				}
 
+			case EEOP_AGG_PLAIN_PERGROUP_NULLCHECK:
+				{
+					int			jumpnull;
+					LLVMValueRef v_aggstatep;
+					LLVMValueRef v_allpergroupsp;
+					LLVMValueRef v_pergroup_allaggs;
+					LLVMValueRef v_setoff;
+
+					jumpnull = op->d.agg_plain_pergroup_nullcheck.jumpnull;
+
+					/*
+					 * pergroup_allaggs = aggstate->all_pergroups
+					 * [op->d.agg_plain_pergroup_nullcheck.setoff];
+					 */
+					v_aggstatep = l_ptr_const(state->parent,
+											  l_ptr(StructAggState));
+					v_allpergroupsp =
+						l_load_struct_gep(b, v_aggstatep,
+										  FIELDNO_AGGSTATE_ALL_PERGROUPS,
+										  "aggstate.all_pergroups");
+					v_setoff =
+						l_int32_const(op->d.agg_plain_pergroup_nullcheck.setoff);
+					v_pergroup_allaggs =
+						l_load_gep1(b, v_allpergroupsp, v_setoff, "");
+
+					LLVMBuildCondBr(b,
+									LLVMBuildICmp(b, LLVMIntEQ,
+												  LLVMBuildPtrToInt(b, v_pergroup_allaggs,
+																	TypeSizeT, ""),
+												  l_sizet_const(0), ""),
+									opblocks[jumpnull],
+									opblocks[i + 1]);
+					break;
+				}
+
 			case EEOP_AGG_INIT_TRANS:
 				{
 					AggState   *aggstate;
@@ -29,6 +29,7 @@
 #include "access/htup.h"
 #include "access/htup_details.h"
 #include "access/tupdesc.h"
+#include "access/zhtup.h"
 #include "catalog/pg_attribute.h"
 #include "executor/execExpr.h"
 #include "executor/nodeAgg.h"
@@ -62,6 +63,7 @@ MemoryContextData StructMemoryContextData;
 TupleTableSlot StructTupleTableSlot;
 HeapTupleTableSlot StructHeapTupleTableSlot;
 MinimalTupleTableSlot StructMinimalTupleTableSlot;
+ZHeapTupleTableSlot StructZHeapTupleTableSlot;
 TupleDescData StructTupleDescData;
 
 
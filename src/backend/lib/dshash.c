@@ -17,8 +17,9 @@
  * is only expected to happen a small number of times until a stable size is
  * found, since growth is geometric.
  *
- * Future versions may support iterators and incremental resizing; for now
- * the implementation is minimalist.
+ * A sequential scan visits one partition at a time, holding only that
+ * partition's lock.  Future versions may support incremental resizing; for
+ * now the implementation is minimalist.
  *
  * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
  * Portions Copyright (c) 1994, Regents of the University of California
@@ -574,6 +575,126 @@ dshash_release_lock(dshash_table *hash_table, void *entry)
 	LWLockRelease(PARTITION_LOCK(hash_table, partition_index));
 }
 
+/*
+ * Begin a sequential scan of all entries.  Partitions are locked one at a
+ * time, in shared or exclusive mode depending on 'exclusive', as the scan
+ * reaches them, so entries inserted or deleted concurrently in partitions
+ * not yet visited may or may not be returned.  While the scan is in
+ * progress, the caller must not call any other dshash function on the same
+ * table, except dshash_delete_current.  The scan must be finished with
+ * dshash_seq_term, also when it has returned all entries.
+ */
+void
+dshash_seq_init(dshash_seq_status *status, dshash_table *hash_table,
+				bool exclusive)
+{
+	Assert(hash_table->control->magic == DSHASH_MAGIC);
+	Assert(!hash_table->find_locked);
+
+	status->hash_table = hash_table;
+	status->curpartition = -1;
+	status->curbucket = 0;
+	status->endbucket = 0;
+	status->curitem = InvalidDsaPointer;
+	status->nextitem = InvalidDsaPointer;
+	status->exclusive = exclusive;
+}
+
+/*
+ * Lock the scan's current partition and find its range of buckets.
+ */
+static void
+seq_lock_partition(dshash_seq_status *status)
+{
+	dshash_table *hash_table = status->hash_table;
+
+	LWLockAcquire(PARTITION_LOCK(hash_table, status->curpartition),
+				  status->exclusive ? LW_EXCLUSIVE : LW_SHARED);
+	ensure_valid_bucket_pointers(hash_table);
+
+	status->curbucket =
+		BUCKET_INDEX_FOR_PARTITION(status->curpartition,
+								   hash_table->size_log2);
+	status->endbucket =
+		BUCKET_INDEX_FOR_PARTITION(status->curpartition + 1,
+								   hash_table->size_log2);
+}
+
+/*
+ * Return the next entry of a sequential scan, or NULL if there are no more.
+ * The entry's partition stays locked until the scan moves past it.
+ */
+void *
+dshash_seq_next(dshash_seq_status *status)
+{
+	dshash_table *hash_table = status->hash_table;
+	dsa_pointer item_pointer;
+	dshash_table_item *item;
+
+	if (status->curpartition >= DSHASH_NUM_PARTITIONS)
+		return NULL;
+
+	if (status->curpartition < 0)
+	{
+		status->curpartition = 0;
+		seq_lock_partition(status);
+		item_pointer = hash_table->buckets[status->curbucket];
+	}
+	else
+		item_pointer = status->nextitem;
+
+	while (!DsaPointerIsValid(item_pointer))
+	{
+		if (++status->curbucket >= status->endbucket)
+		{
+			LWLockRelease(PARTITION_LOCK(hash_table, status->curpartition));
+			if (++status->curpartition >= DSHASH_NUM_PARTITIONS)
+			{
+				status->curitem = InvalidDsaPointer;
+				return NULL;
+			}
+			seq_lock_partition(status);
+		}
+		item_pointer = hash_table->buckets[status->curbucket];
+	}
+
+	item = dsa_get_address(hash_table->area, item_pointer);
+	status->curitem = item_pointer;
+	status->nextitem = item->next;
+
+	return ENTRY_FROM_ITEM(item);
+}
+
+/*
+ * Finish a sequential scan, releasing the lock still held, if any.
+ */
+void
+dshash_seq_term(dshash_seq_status *status)
+{
+	if (status->curpartition >= 0 &&
+		status->curpartition < DSHASH_NUM_PARTITIONS)
+		LWLockRelease(PARTITION_LOCK(status->hash_table,
+									 status->curpartition));
+	status->curpartition = DSHASH_NUM_PARTITIONS;
+}
+
+/*
+ * Delete the entry last returned by an exclusive sequential scan.
+ */
+void
+dshash_delete_current(dshash_seq_status *status)
+{
+	dshash_table *hash_table = status->hash_table;
+	dshash_table_item *item;
+
+	Assert(status->exclusive);
+	Assert(DsaPointerIsValid(status->curitem));
+
+	item = dsa_get_address(hash_table->area, status->curitem);
+	delete_item(hash_table, item);
+	status->curitem = InvalidDsaPointer;
+}
+
 /*
  * A compare function that forwards to memcmp.
  */
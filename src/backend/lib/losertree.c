@@ -0,0 +1,254 @@
+/*-------------------------------------------------------------------------
+ *
+ * losertree.c
+ *	  A tournament tree of losers, for k-way merging
+ *
+ * A loser tree holds one leaf for each input of a merge.  Each internal node
+ * remembers the leaf that lost the comparison played at that node, and the
+ * overall winner is kept apart.  After the winner's leaf has been replaced by
+ * the next value of the same input, only the comparisons on the path from
+ * that leaf to the root have to be replayed, comparing against the losers
+ * stored there.  That's about log2(k) comparisons per value returned, where
+ * sifting down a binary heap takes about twice as many.
+ *
+ * Leaves are never moved.  An input that has run dry is marked exhausted and
+ * loses every comparison, so the tree keeps its shape until it is rebuilt.
+ *
+ * Portions Copyright (c) 2012-2019, PostgreSQL Global Development Group
+ *
+ * IDENTIFICATION
+ *	  src/backend/lib/losertree.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "lib/losertree.h"
+
+static inline bool leaf_beats(losertree *tree, int a, int b);
+static void replay(losertree *tree, int leaf);
+
+/*
+ * losertree_allocate
+ *
+ * Returns a pointer to a newly-allocated tree that has the capacity to merge
+ * the given number of inputs, in the order defined by the given comparator
+ * function, which will be invoked with the additional argument specified by
+ * 'arg'.
+ */
+losertree *
+losertree_allocate(int capacity, losertree_comparator compare, void *arg)
+{
+	Size		sz;
+	losertree  *tree;
+
+	Assert(capacity > 0);
+
+	sz = MAXALIGN(offsetof(losertree, lt_leaves) + sizeof(Datum) * capacity);
+	sz += sizeof(int) * capacity + sizeof(bool) * capacity;
+	tree = (losertree *) palloc(sz);
+	tree->lt_space = capacity;
+	tree->lt_compare = compare;
+	tree->lt_arg = arg;
+	tree->lt_nodes = (int *)
+		((char *) tree +
+		 MAXALIGN(offsetof(losertree, lt_leaves) + sizeof(Datum) * capacity));
+	tree->lt_exhausted = (bool *) (tree->lt_nodes + capacity);
+
+	tree->lt_size = 0;
+	tree->lt_nleaves = 0;
+	tree->lt_has_tree_property = true;
+
+	return tree;
+}
+
+/*
+ * losertree_reset
+ *
+ * Resets the tree to an empty state, losing its data content but not the
+ * parameters passed at allocation.
+ */
+void
+losertree_reset(losertree *tree)
+{
+	tree->lt_size = 0;
+	tree->lt_nleaves = 0;
+	tree->lt_has_tree_property = true;
+}
+
+/*
+ * losertree_free
+ *
+ * Releases memory used by the given losertree.
+ */
+void
+losertree_free(losertree *tree)
+{
+	pfree(tree);
+}
+
+/*
+ * The tree has the shape of a binary heap of 2 * nleaves - 1 nodes: internal
+ * node i has children 2 * i and 2 * i + 1, and leaf j is node nleaves + j.
+ * So internal nodes are 1 .. nleaves - 1, leaving lt_nodes[0] for the winner.
+ */
+
+/*
+ * Does leaf a come before leaf b?  Exhausted leaves come after everything.
+ */
+static inline bool
+leaf_beats(losertree *tree, int a, int b)
+{
+	if (tree->lt_exhausted[b])
+		return !tree->lt_exhausted[a];
+	if (tree->lt_exhausted[a])
+		return false;
+	return tree->lt_compare(tree->lt_leaves[a], tree->lt_leaves[b],
+							tree->lt_arg) < 0;
+}
+
+/*
+ * Replay the comparisons from the given leaf to the root, after its value
+ * has changed.
+ */
+static void
+replay(losertree *tree, int leaf)
+{
+	int			winner = leaf;
+	int			node;
+
+	for (node = (leaf + tree->lt_nleaves) / 2; node > 0; node /= 2)
+	{
+		int			loser = tree->lt_nodes[node];
+
+		if (leaf_beats(tree, loser, winner))
+		{
+			tree->lt_nodes[node] = winner;
+			winner = loser;
+		}
+	}
+
+	tree->lt_nodes[0] = winner;
+}
+
+/*
+ * losertree_add_unordered
+ *
+ * Adds the given datum as a new leaf, without playing any comparisons.
+ * losertree_build() must be called before the tree is used for merging.
+ */
+void
+losertree_add_unordered(losertree *tree, Datum d)
+{
+	if (tree->lt_nleaves >= tree->lt_space)
+		elog(ERROR, "out of loser tree slots");
+	tree->lt_has_tree_property = false;
+	tree->lt_leaves[tree->lt_nleaves] = d;
+	tree->lt_exhausted[tree->lt_nleaves] = false;
+	tree->lt_nleaves++;
+	tree->lt_size++;
+}
+
+/*
+ * losertree_build
+ *
+ * Plays all the comparisons between the leaves added since the last reset,
+ * bottom up.  O(n).
+ */
+void
+losertree_build(losertree *tree)
+{
+	int			nleaves = tree->lt_nleaves;
+	int		   *winners;
+	int			node;
+
+	if (nleaves == 0)
+	{
+		tree->lt_has_tree_property = true;
+		return;
+	}
+
+	/* winners[i] is the leaf that won at internal node i */
+	winners = (int *) palloc(sizeof(int) * nleaves);
+
+	for (node = nleaves - 1; node > 0; node--)
+	{
+		int			left = 2 * node;
+		int			right = 2 * node + 1;
+
+		left = (left >= nleaves) ? left - nleaves : winners[left];
+		right = (right >= nleaves) ? right - nleaves : winners[right];
+
+		if (leaf_beats(tree, right, left))
+		{
+			winners[node] = right;
+			tree->lt_nodes[node] = left;
+		}
+		else
+		{
+			winners[node] = left;
+			tree->lt_nodes[node] = right;
+		}
+	}
+
+	tree->lt_nodes[0] = (nleaves == 1) ? 0 : winners[1];
+	pfree(winners);
+
+	tree->lt_has_tree_property = true;
+}
+
+/*
+ * losertree_first
+ *
+ * Returns the datum of the winning leaf, which is the first one in the
+ * comparator's order.  The tree must not be empty.  O(1).
+ */
+Datum
+losertree_first(losertree *tree)
+{
+	Assert(!losertree_empty(tree) && tree->lt_has_tree_property);
+	return tree->lt_leaves[tree->lt_nodes[0]];
+}
+
+/*
+ * losertree_remove_first
+ *
+ * Marks the winning leaf exhausted, when its input has no more values, and
+ * finds the new winner.  The tree must not be empty.  O(log n).
+ */
+void
+losertree_remove_first(losertree *tree)
+{
+	int			leaf;
+
+	Assert(!losertree_empty(tree) && tree->lt_has_tree_property);
+
+	leaf = tree->lt_nodes[0];
+	tree->lt_exhausted[leaf] = true;
+	tree->lt_size--;
+
+	if (tree->lt_size > 0)
+		replay(tree, leaf);
+}
+
+/*
+ * losertree_replace_first
+ *
+ * Replaces the winning leaf's datum with the given one, normally the next
+ * value of the same input, and finds the new winner.  The tree must not be
+ * empty.  O(log n).
+ */
+void
+losertree_replace_first(losertree *tree, Datum d)
+{
+	int			leaf;
+
+	Assert(!losertree_empty(tree) && tree->lt_has_tree_property);
+
+	leaf = tree->lt_nodes[0];
+	tree->lt_leaves[leaf] = d;
+
+	if (tree->lt_nleaves > 1)
+		replay(tree, leaf);
+}
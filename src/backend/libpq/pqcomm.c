@@ -44,6 +44,7 @@
  *		StreamClose			- Close a client/backend connection
  *		TouchSocketFiles	- Protect socket files against /tmp cleaners
  *		pq_init			- initialize libpq at backend startup
+ *		pq_enable_compression - compress traffic from now on
  *		pq_comm_reset	- reset libpq during error recovery
  *		pq_close		- shutdown libpq at backend exit
  *
@@ -89,6 +90,7 @@
 #endif
 
 #include "common/ip.h"
+#include "common/zpq_stream.h"
 #include "libpq/libpq.h"
 #include "miscadmin.h"
 #include "port/pg_bswap.h"
@@ -150,6 +152,12 @@ static bool PqCommBusy;			/* busy sending data to the client */
 static bool PqCommReadingMsg;	/* in the middle of reading a message */
 static bool DoingCopyOut;		/* in old-protocol COPY OUT processing */
 
+/*
+ * Compression stream, if compression was negotiated at startup.  It sits
+ * between the buffers above and secure_read/secure_write.
+ */
+static ZpqStream *PqStream = NULL;
+
 
 /* Internal functions */
 static void socket_comm_reset(void);
@@ -164,6 +172,9 @@ static void socket_startcopyout(void);
 static void socket_endcopyout(bool errorAbort);
 static int	internal_putbytes(const char *s, size_t len);
 static int	internal_flush(void);
+static ssize_t pq_read_client(void *ptr, size_t len);
+static ssize_t pq_zpq_read(void *arg, void *ptr, size_t len);
+static ssize_t pq_zpq_write(void *arg, const void *ptr, size_t len);
 
 #ifdef HAVE_UNIX_SOCKETS
 static int	Lock_AF_UNIX(char *unixSocketDir, char *unixSocketPath);
@@ -227,6 +238,99 @@ pq_init(void)
 	AddWaitEventToSet(FeBeWaitSet, WL_POSTMASTER_DEATH, -1, NULL, NULL);
 }
 
+/* --------------------------------
+ *		pq_switch_socket - make the backend talk to the frontend over sock
+ *
+ * Used when a pooled session is handed over to a connection proxy.  The
+ * caller is responsible for closing the old socket, and there must be no
+ * unsent output.
+ * --------------------------------
+ */
+void
+pq_switch_socket(pgsocket sock)
+{
+	Assert(PqSendStart == PqSendPointer);
+
+#ifndef WIN32
+	if (!pg_set_noblock(sock))
+		ereport(COMMERROR,
+				(errmsg("could not set socket to nonblocking mode: %m")));
+#endif
+	MyProcPort->sock = sock;
+
+	FreeWaitEventSet(FeBeWaitSet);
+	FeBeWaitSet = CreateWaitEventSet(TopMemoryContext, 3);
+	AddWaitEventToSet(FeBeWaitSet, WL_SOCKET_WRITEABLE, MyProcPort->sock,
+					  NULL, NULL);
+	AddWaitEventToSet(FeBeWaitSet, WL_LATCH_SET, -1, MyLatch, NULL);
+	AddWaitEventToSet(FeBeWaitSet, WL_POSTMASTER_DEATH, -1, NULL, NULL);
+}
+
+/* --------------------------------
+ *		pq_enable_compression - compress traffic with the client from now on
+ *
+ * Called during connection startup, right after the message accepting the
+ * client's compression request has been flushed.  Returns false if the
+ * compression stream can't be set up.
+ * --------------------------------
+ */
+bool
+pq_enable_compression(const char *algorithm)
+{
+	Assert(PqStream == NULL);
+	Assert(PqSendStart == PqSendPointer);
+
+	/* anything the client sent after the request is compressed already */
+	PqStream = zpq_create(algorithm, pq_zpq_write, pq_zpq_read, MyProcPort,
+						  PqRecvBuffer + PqRecvPointer,
+						  PqRecvLength - PqRecvPointer);
+	if (PqStream == NULL)
+		return false;
+	PqRecvPointer = PqRecvLength = 0;
+
+	return true;
+}
+
+/* Transport callbacks for the compression stream */
+static ssize_t
+pq_zpq_read(void *arg, void *ptr, size_t len)
+{
+	return secure_read((Port *) arg, ptr, len);
+}
+
+static ssize_t
+pq_zpq_write(void *arg, const void *ptr, size_t len)
+{
+	return secure_write((Port *) arg, unconstify(void *, ptr), len);
+}
+
+/* --------------------------------
+ *		pq_read_client - read from the client, decompressing if needed
+ *
+ * Like secure_read, except that it returns ZPQ_DECOMPRESS_ERROR, having
+ * already logged the problem, if the client sent garbage.
+ * --------------------------------
+ */
+static ssize_t
+pq_read_client(void *ptr, size_t len)
+{
+	ssize_t		r;
+
+	if (PqStream == NULL)
+		return secure_read(MyProcPort, ptr, len);
+
+	r = zpq_read(PqStream, ptr, len);
+	if (r == ZPQ_DECOMPRESS_ERROR)
+	{
+		/* As below, this must go *only* to the postmaster log */
+		ereport(COMMERROR,
+				(errcode(ERRCODE_PROTOCOL_VIOLATION),
+				 errmsg("could not decompress data from client: %s",
+						zpq_error(PqStream))));
+	}
+	return r;
+}
+
 /* --------------------------------
  *		socket_comm_reset - reset libpq during error recovery
  *
@@ -961,9 +1065,11 @@ pq_recvbuf(void)
 	{
 		int			r;
 
-		r = secure_read(MyProcPort, PqRecvBuffer + PqRecvLength,
-						PQ_RECV_BUFFER_SIZE - PqRecvLength);
+		r = pq_read_client(PqRecvBuffer + PqRecvLength,
+						   PQ_RECV_BUFFER_SIZE - PqRecvLength);
 
+		if (r == ZPQ_DECOMPRESS_ERROR)
+			return EOF;
 		if (r < 0)
 		{
 			if (errno == EINTR)
@@ -1029,6 +1135,16 @@ pq_peekbyte(void)
 	return (unsigned char) PqRecvBuffer[PqRecvPointer];
 }
 
+/* --------------------------------
+ *		pq_buffer_has_data - is there received data not yet consumed?
+ * --------------------------------
+ */
+bool
+pq_buffer_has_data(void)
+{
+	return (PqRecvPointer < PqRecvLength);
+}
+
 /* --------------------------------
  *		pq_getbyte_if_available - get a single byte from connection,
  *			if available
@@ -1053,8 +1169,10 @@ pq_getbyte_if_available(unsigned char *c)
 	/* Put the socket into non-blocking mode */
 	socket_set_nonblocking(true);
 
-	r = secure_read(MyProcPort, c, 1);
-	if (r < 0)
+	r = pq_read_client(c, 1);
+	if (r == ZPQ_DECOMPRESS_ERROR)
+		r = EOF;
+	else if (r < 0)
 	{
 		/*
 		 * Ok if no data available without blocking or interrupted (though
@@ -1427,11 +1545,33 @@ internal_flush(void)
 	char	   *bufptr = PqSendBuffer + PqSendStart;
 	char	   *bufend = PqSendBuffer + PqSendPointer;
 
-	while (bufptr < bufend)
+	/*
+	 * With compression, data can be accepted by the compression stream and
+	 * yet not sent, so keep going until the stream is drained too.
+	 */
+	while (bufptr < bufend || (PqStream && zpq_buffered_tx(PqStream)))
 	{
 		int			r;
 
-		r = secure_write(MyProcPort, bufptr, bufend - bufptr);
+		if (PqStream)
+		{
+			r = zpq_write(PqStream, bufptr, bufend - bufptr);
+			if (r == ZPQ_COMPRESS_ERROR)
+			{
+				ereport(COMMERROR,
+						(errmsg("could not compress data to send to client: %s",
+								zpq_error(PqStream))));
+				PqSendStart = PqSendPointer = 0;
+				ClientConnectionLost = 1;
+				InterruptPending = 1;
+				return EOF;
+			}
+			/* with no new data, zero just means the stream is drained */
+			if (r == 0 && bufptr == bufend && !zpq_buffered_tx(PqStream))
+				break;
+		}
+		else
+			r = secure_write(MyProcPort, bufptr, bufend - bufptr);
 
 		if (r <= 0)
 		{
@@ -1498,7 +1638,8 @@ socket_flush_if_writable(void)
 	int			res;
 
 	/* Quick exit if nothing to do */
-	if (PqSendPointer == PqSendStart)
+	if (PqSendPointer == PqSendStart &&
+		!(PqStream && zpq_buffered_tx(PqStream)))
 		return 0;
 
 	/* No-op if reentrant call */
@@ -1521,7 +1662,8 @@ socket_flush_if_writable(void)
 static bool
 socket_is_send_pending(void)
 {
-	return (PqSendStart < PqSendPointer);
+	return (PqSendStart < PqSendPointer) ||
+		(PqStream && zpq_buffered_tx(PqStream));
 }
 
 /* --------------------------------
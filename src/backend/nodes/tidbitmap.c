@@ -28,6 +28,14 @@
  * into a bitmap, and it can also happen internally when we AND a lossy
  * and a non-lossy page.
  *
+ * Exact pages are stored compactly.  The offsets on a zheap page can go far
+ * higher than on a heap page, but a per-page bitmap large enough for them
+ * would make every page entry several times bigger, and so make bitmaps go
+ * lossy sooner for the same work_mem.  Instead, each entry has room for a
+ * bitmap covering the offsets possible on a heap page; a page with a higher
+ * offset is stored as a list of offset ranges or of single offsets, if
+ * either fits in the same space, and is otherwise made lossy.
+ *
  *
  * Copyright (c) 2003-2019, PostgreSQL Global Development Group
  *
@@ -78,10 +86,28 @@
 #define WORDNUM(x)	((x) / BITS_PER_BITMAPWORD)
 #define BITNUM(x)	((x) % BITS_PER_BITMAPWORD)
 
-/* number of active words for an exact page: */
+/* number of words in a bitmap of all the offsets possible on a page: */
 #define WORDS_PER_PAGE	((MAX_TUPLES_PER_PAGE - 1) / BITS_PER_BITMAPWORD + 1)
 /* number of active words for a lossy chunk: */
 #define WORDS_PER_CHUNK  ((PAGES_PER_CHUNK - 1) / BITS_PER_BITMAPWORD + 1)
+/* number of words in a page table entry: */
+#define WORDS_PER_ENTRY \
+	Max((MaxHeapTuplesPerPage - 1) / BITS_PER_BITMAPWORD + 1, WORDS_PER_CHUNK)
+
+/* highest offset that an entry in TBM_PAGE_BITMAP format can hold */
+#define ENTRY_BITMAP_OFFSETS	(WORDS_PER_ENTRY * BITS_PER_BITMAPWORD)
+/* capacity of an entry in TBM_PAGE_ARRAY and TBM_PAGE_RUNS format */
+#define ENTRY_ARRAY_OFFSETS \
+	(WORDS_PER_ENTRY * sizeof(bitmapword) / sizeof(OffsetNumber))
+#define ENTRY_RUNS		(ENTRY_ARRAY_OFFSETS / 2)
+
+/*
+ * Formats of an exact page's words[].  Unused array slots and runs are zero,
+ * which is not a valid offset.
+ */
+#define TBM_PAGE_BITMAP		0	/* bit k represents tuple offset k+1 */
+#define TBM_PAGE_RUNS		1	/* ascending (first, last) offset pairs */
+#define TBM_PAGE_ARRAY		2	/* ascending offsets */
 
 /*
  * The hashtable entries are represented by this data structure.  For
@@ -96,6 +122,9 @@
  * recheck is used only on exact pages --- it indicates that although
  * only the stated tuples need be checked, the full index qual condition
  * must be checked for each (ie, these are candidate matches).
+ *
+ * format is also used only on exact pages; a lossy chunk's words are always
+ * a bitmap.
  */
 typedef struct PagetableEntry
 {
@@ -103,7 +132,8 @@ typedef struct PagetableEntry
 	char		status;			/* hash entry status */
 	bool		ischunk;		/* T = lossy storage, F = exact */
 	bool		recheck;		/* should the tuples be rechecked? */
-	bitmapword	words[Max(WORDS_PER_PAGE, WORDS_PER_CHUNK)];
+	char		format;			/* TBM_PAGE_xxx, see above */
+	bitmapword	words[WORDS_PER_ENTRY];
 } PagetableEntry;
 
 /*
@@ -226,6 +256,10 @@ struct TBMSharedIterator
 };
 
 /* Local function prototypes */
+static void tbm_page_decode(const PagetableEntry *page, bitmapword *bits);
+static bool tbm_page_encode(PagetableEntry *page, const bitmapword *bits);
+static void tbm_page_add_offset(TIDBitmap *tbm, PagetableEntry *page,
+								OffsetNumber off);
 static void tbm_union_page(TIDBitmap *a, const PagetableEntry *bpage);
 static bool tbm_intersect_page(TIDBitmap *a, PagetableEntry *apage,
 							   const TIDBitmap *b);
@@ -267,6 +301,10 @@ tbm_create(long maxbytes, dsa_area *dsa)
 {
 	TIDBitmap  *tbm;
 
+	/* A page entry must fit in the bitmap that tbm_page_decode fills */
+	StaticAssertStmt(WORDS_PER_ENTRY <= WORDS_PER_PAGE,
+					 "page table entry is larger than a page bitmap");
+
 	/* Create the TIDBitmap struct and zero all its fields */
 	tbm = makeNode(TIDBitmap);
 
@@ -410,19 +448,29 @@ tbm_add_tuples(TIDBitmap *tbm, const ItemPointer tids, int ntids,
 		if (page == NULL)
 			continue;			/* whole page is already marked */
 
+		page->recheck |= recheck;
 		if (page->ischunk)
 		{
 			/* The page is a lossy chunk header, set bit for itself */
-			wordnum = bitnum = 0;
+			page->words[0] |= ((bitmapword) 1 << 0);
 		}
-		else
+		else if (page->format == TBM_PAGE_BITMAP &&
+				 off <= ENTRY_BITMAP_OFFSETS)
 		{
 			/* Page is exact, so set bit for individual tuple */
 			wordnum = WORDNUM(off - 1);
 			bitnum = BITNUM(off - 1);
+			page->words[wordnum] |= ((bitmapword) 1 << bitnum);
+		}
+		else
+		{
+			/*
+			 * The page needs a compact format.  This may make the page lossy
+			 * and move other entries, so force a new lookup.
+			 */
+			tbm_page_add_offset(tbm, page, off);
+			currblk = InvalidBlockNumber;
 		}
-		page->words[wordnum] |= ((bitmapword) 1 << bitnum);
-		page->recheck |= recheck;
 
 		if (tbm->nentries > tbm->maxentries)
 		{
@@ -449,6 +497,143 @@ tbm_add_page(TIDBitmap *tbm, BlockNumber pageno)
 		tbm_lossify(tbm);
 }
 
+/*
+ * tbm_page_decode - expand an exact page's offsets into a full bitmap
+ *
+ * bits must have room for WORDS_PER_PAGE words.
+ */
+static void
+tbm_page_decode(const PagetableEntry *page, bitmapword *bits)
+{
+	const OffsetNumber *offsets = (const OffsetNumber *) page->words;
+	int			i;
+
+	Assert(!page->ischunk);
+	memset(bits, 0, WORDS_PER_PAGE * sizeof(bitmapword));
+
+	switch (page->format)
+	{
+		case TBM_PAGE_BITMAP:
+			memcpy(bits, page->words, sizeof(page->words));
+			break;
+		case TBM_PAGE_RUNS:
+			for (i = 0; i < ENTRY_RUNS && offsets[2 * i] != 0; i++)
+			{
+				int			off;
+
+				for (off = offsets[2 * i]; off <= offsets[2 * i + 1]; off++)
+					bits[WORDNUM(off - 1)] |= (bitmapword) 1 << BITNUM(off - 1);
+			}
+			break;
+		case TBM_PAGE_ARRAY:
+			for (i = 0; i < ENTRY_ARRAY_OFFSETS && offsets[i] != 0; i++)
+				bits[WORDNUM(offsets[i] - 1)] |=
+					(bitmapword) 1 << BITNUM(offsets[i] - 1);
+			break;
+		default:
+			elog(ERROR, "unrecognized TID bitmap page format: %d",
+				 page->format);
+	}
+}
+
+/*
+ * tbm_page_encode - store a full bitmap of offsets into an exact page
+ *
+ * The most compact format that can hold the offsets is chosen.  Returns
+ * false, leaving the page unchanged, if none can.
+ */
+static bool
+tbm_page_encode(PagetableEntry *page, const bitmapword *bits)
+{
+	bitmapword	runwords[WORDS_PER_ENTRY];
+	bitmapword	arraywords[WORDS_PER_ENTRY];
+	OffsetNumber *runs = (OffsetNumber *) runwords;
+	OffsetNumber *array = (OffsetNumber *) arraywords;
+	int			nruns = 0;
+	int			noffsets = 0;
+	int			last = -1;
+	int			wordnum;
+
+	Assert(!page->ischunk);
+
+	/* If no offset is too high, a plain bitmap will do */
+	for (wordnum = WORDS_PER_ENTRY; wordnum < WORDS_PER_PAGE; wordnum++)
+	{
+		if (bits[wordnum] != 0)
+			break;
+	}
+	if (wordnum >= WORDS_PER_PAGE)
+	{
+		memcpy(page->words, bits, sizeof(page->words));
+		page->format = TBM_PAGE_BITMAP;
+		return true;
+	}
+
+	/* Otherwise build the run and array forms until they overflow */
+	memset(runwords, 0, sizeof(runwords));
+	memset(arraywords, 0, sizeof(arraywords));
+	for (wordnum = 0; wordnum < WORDS_PER_PAGE; wordnum++)
+	{
+		bitmapword	w = bits[wordnum];
+		int			off = wordnum * BITS_PER_BITMAPWORD + 1;
+
+		for (; w != 0; w >>= 1, off++)
+		{
+			if ((w & 1) == 0)
+				continue;
+
+			if (off == last + 1)
+			{
+				if (nruns <= ENTRY_RUNS)
+					runs[2 * (nruns - 1) + 1] = (OffsetNumber) off;
+			}
+			else
+			{
+				if (nruns < ENTRY_RUNS)
+					runs[2 * nruns] = runs[2 * nruns + 1] = (OffsetNumber) off;
+				nruns++;
+			}
+			last = off;
+
+			if (noffsets < ENTRY_ARRAY_OFFSETS)
+				array[noffsets] = (OffsetNumber) off;
+			noffsets++;
+		}
+		if (nruns > ENTRY_RUNS && noffsets > ENTRY_ARRAY_OFFSETS)
+			return false;
+	}
+
+	if (nruns <= ENTRY_RUNS)
+	{
+		memcpy(page->words, runwords, sizeof(page->words));
+		page->format = TBM_PAGE_RUNS;
+	}
+	else
+	{
+		memcpy(page->words, arraywords, sizeof(page->words));
+		page->format = TBM_PAGE_ARRAY;
+	}
+	return true;
+}
+
+/*
+ * tbm_page_add_offset - add one offset to an exact page, the slow way
+ *
+ * Used when the offset doesn't fit the page's bitmap.  If no format can hold
+ * the page's offsets anymore, the page is made lossy, which may move other
+ * entries around.
+ */
+static void
+tbm_page_add_offset(TIDBitmap *tbm, PagetableEntry *page, OffsetNumber off)
+{
+	bitmapword	bits[WORDS_PER_PAGE];
+
+	tbm_page_decode(page, bits);
+	bits[WORDNUM(off - 1)] |= (bitmapword) 1 << BITNUM(off - 1);
+	if (!tbm_page_encode(page, bits))
+		tbm_mark_page_lossy(tbm, page->blockno);
+}
+
 /*
  * tbm_union - set union
  *
@@ -518,12 +703,27 @@ tbm_union_page(TIDBitmap *a, const PagetableEntry *bpage)
 			/* The page is a lossy chunk header, set bit for itself */
 			apage->words[0] |= ((bitmapword) 1 << 0);
 		}
+		else if (apage->format == TBM_PAGE_BITMAP &&
+				 bpage->format == TBM_PAGE_BITMAP)
+		{
+			/* Both pages are exact bitmaps, merge at the bit level */
+			for (wordnum = 0; wordnum < WORDS_PER_ENTRY; wordnum++)
+				apage->words[wordnum] |= bpage->words[wordnum];
+			apage->recheck |= bpage->recheck;
+		}
 		else
 		{
-			/* Both pages are exact, merge at the bit level */
+			bitmapword	abits[WORDS_PER_PAGE];
+			bitmapword	bbits[WORDS_PER_PAGE];
+
+			/* Merge the expanded bitmaps, making the page lossy if need be */
+			tbm_page_decode(apage, abits);
+			tbm_page_decode(bpage, bbits);
 			for (wordnum = 0; wordnum < WORDS_PER_PAGE; wordnum++)
-				apage->words[wordnum] |= bpage->words[wordnum];
+				abits[wordnum] |= bbits[wordnum];
 			apage->recheck |= bpage->recheck;
+			if (!tbm_page_encode(apage, abits))
+				tbm_mark_page_lossy(a, bpage->blockno);
 		}
 	}
 
@@ -646,11 +846,13 @@ tbm_intersect_page(TIDBitmap *a, PagetableEntry *apage, const TIDBitmap *b)
 		bool		candelete = true;
 
 		bpage = tbm_find_pageentry(b, apage->blockno);
-		if (bpage != NULL)
+		if (bpage != NULL &&
+			apage->format == TBM_PAGE_BITMAP &&
+			bpage->format == TBM_PAGE_BITMAP)
 		{
-			/* Both pages are exact, merge at the bit level */
+			/* Both pages are exact bitmaps, merge at the bit level */
 			Assert(!bpage->ischunk);
-			for (wordnum = 0; wordnum < WORDS_PER_PAGE; wordnum++)
+			for (wordnum = 0; wordnum < WORDS_PER_ENTRY; wordnum++)
 			{
 				apage->words[wordnum] &= bpage->words[wordnum];
 				if (apage->words[wordnum] != 0)
@@ -658,6 +860,30 @@ tbm_intersect_page(TIDBitmap *a, PagetableEntry *apage, const TIDBitmap *b)
 			}
 			apage->recheck |= bpage->recheck;
 		}
+		else if (bpage != NULL)
+		{
+			bitmapword	abits[WORDS_PER_PAGE];
+			bitmapword	bbits[WORDS_PER_PAGE];
+
+			Assert(!bpage->ischunk);
+			tbm_page_decode(apage, abits);
+			tbm_page_decode(bpage, bbits);
+			for (wordnum = 0; wordnum < WORDS_PER_PAGE; wordnum++)
+			{
+				abits[wordnum] &= bbits[wordnum];
+				if (abits[wordnum] != 0)
+					candelete = false;
+			}
+			apage->recheck |= bpage->recheck;
+
+			/*
+			 * Splitting runs can leave more of them than fit.  We mustn't
+			 * make the page lossy while scanning a's hashtable, but keeping
+			 * a's tuples and rechecking them is just as correct.
+			 */
+			if (!candelete && !tbm_page_encode(apage, abits))
+				apage->recheck = true;
+		}
 		/* If there is no matching b page, we can just delete the a page */
 		return candelete;
 	}
@@ -910,10 +1136,30 @@ tbm_prepare_shared_iterate(TIDBitmap *tbm)
 static inline int
 tbm_extract_page_tuple(PagetableEntry *page, TBMIterateResult *output)
 {
+	const OffsetNumber *offsets = (const OffsetNumber *) page->words;
 	int			wordnum;
 	int			ntuples = 0;
+	int			i;
 
-	for (wordnum = 0; wordnum < WORDS_PER_PAGE; wordnum++)
+	if (page->format == TBM_PAGE_RUNS)
+	{
+		for (i = 0; i < ENTRY_RUNS && offsets[2 * i] != 0; i++)
+		{
+			int			off;
+
+			for (off = offsets[2 * i]; off <= offsets[2 * i + 1]; off++)
+				output->offsets[ntuples++] = (OffsetNumber) off;
+		}
+		return ntuples;
+	}
+	if (page->format == TBM_PAGE_ARRAY)
+	{
+		for (i = 0; i < ENTRY_ARRAY_OFFSETS && offsets[i] != 0; i++)
+			output->offsets[ntuples++] = offsets[i];
+		return ntuples;
+	}
+
+	for (wordnum = 0; wordnum < WORDS_PER_ENTRY; wordnum++)
 	{
 		bitmapword	w = page->words[wordnum];
 
@@ -61,6 +61,7 @@ typedef struct pushdown_safety_info
 /* These parameters are set by GUC */
 bool		enable_geqo = false;	/* just in case GUC doesn't set it */
 int			geqo_threshold;
+int			join_search_method = JOIN_SEARCH_ITERATIVE;
 int			min_parallel_table_scan_size;
 int			min_parallel_index_scan_size;
 
@@ -125,6 +126,8 @@ static void set_result_pathlist(PlannerInfo *root, RelOptInfo *rel,
 static void set_worktable_pathlist(PlannerInfo *root, RelOptInfo *rel,
 								   RangeTblEntry *rte);
 static RelOptInfo *make_rel_from_joinlist(PlannerInfo *root, List *joinlist);
+static RelOptInfo *iterative_join_search(PlannerInfo *root, int levels_needed,
+										 List *initial_rels);
 static bool subquery_is_pushdown_safe(Query *subquery, Query *topquery,
 									  pushdown_safety_info *safetyInfo);
 static bool recurse_pushdown_safe(Node *setOp, Query *topquery,
@@ -2807,7 +2810,11 @@ make_rel_from_joinlist(PlannerInfo *root, List *joinlist)
 		if (join_search_hook)
 			return (*join_search_hook) (root, levels_needed, initial_rels);
 		else if (enable_geqo && levels_needed >= geqo_threshold)
+		{
+			if (join_search_method == JOIN_SEARCH_ITERATIVE)
+				return iterative_join_search(root, levels_needed, initial_rels);
 			return geqo(root, levels_needed, initial_rels);
+		}
 		else
 			return standard_join_search(root, levels_needed, initial_rels);
 	}
@@ -2927,6 +2934,141 @@ standard_join_search(PlannerInfo *root, int levels_needed, List *initial_rels)
 	return rel;
 }
 
+/*
+ * iterative_join_search
+ *	  Find a join order for a query with too many jointree items for
+ *	  standard_join_search, by "iterative dynamic programming".
+ *
+ * Each round runs the same dynamic programming over the current set of
+ * items as standard_join_search does, but only until a level has more than
+ * IDP_MAX_LEVEL_JOINRELS join relations, or all the items are joined.  The
+ * cheapest join relation of the last level built is then kept, and becomes
+ * a single item that replaces the items it joins for the next round; the
+ * other join relations built in the round are forgotten.  For a chain of
+ * joins the first round usually completes the search, so the plan is the
+ * one the exhaustive search would find; star and clique joins, whose levels
+ * grow fastest, are instead built a few items at a time.  Unlike GEQO the
+ * result does not depend on a random seed, and the work done is polynomial
+ * in the number of items.
+ *
+ * Fixing the join of some items may in principle leave outer join order
+ * restrictions that no later round can satisfy.  If a round fails to build
+ * any join at all, we start over with GEQO.
+ *
+ * The parameters and result are as for standard_join_search.
+ */
+#define IDP_MAX_LEVEL_JOINRELS	1000
+
+static RelOptInfo *
+iterative_join_search(PlannerInfo *root, int levels_needed, List *initial_rels)
+{
+	int			savelength = list_length(root->join_rel_list);
+	struct HTAB *savehash = root->join_rel_hash;
+	List	   *items = list_copy(initial_rels);
+
+	Assert(root->join_rel_level == NULL);
+
+	/* join_rel_list will be truncated, so its hash table can't be kept */
+	root->join_rel_hash = NULL;
+
+	for (;;)
+	{
+		int			nitems = list_length(items);
+		int			roundlength = list_length(root->join_rel_list);
+		RelOptInfo *best = NULL;
+		List	   *newitems;
+		ListCell   *lc;
+		int			lev;
+		int			bestlev = 0;
+
+		/* has_legal_joinclause() looks at the items being joined */
+		root->initial_rels = items;
+		root->join_rel_level = (List **) palloc0((nitems + 1) * sizeof(List *));
+		root->join_rel_level[1] = items;
+
+		for (lev = 2; lev <= nitems; lev++)
+		{
+			join_search_one_level(root, lev);
+
+			/* as in standard_join_search */
+			foreach(lc, root->join_rel_level[lev])
+			{
+				RelOptInfo *rel = (RelOptInfo *) lfirst(lc);
+
+				generate_partitionwise_join_paths(root, rel);
+				if (lev < nitems)
+					generate_gather_paths(root, rel, false);
+				set_cheapest(rel);
+
+#ifdef OPTIMIZER_DEBUG
+				debug_print_rel(root, rel);
+#endif
+			}
+
+			/*
+			 * Special joins can leave some levels empty, so keep going until
+			 * a level that has join relations is too big to go on.
+			 */
+			if (root->join_rel_level[lev] != NIL)
+			{
+				bestlev = lev;
+				if (list_length(root->join_rel_level[lev]) > IDP_MAX_LEVEL_JOINRELS)
+					break;
+			}
+		}
+
+		if (bestlev == 0)
+		{
+			/* stuck; start over with GEQO, as though we hadn't been here */
+			root->join_rel_level = NULL;
+			root->join_rel_list = list_truncate(root->join_rel_list,
+												savelength);
+			root->join_rel_hash = savehash;
+			root->initial_rels = initial_rels;
+			return geqo(root, levels_needed, initial_rels);
+		}
+
+		/* Keep the cheapest join relation of the last level built */
+		foreach(lc, root->join_rel_level[bestlev])
+		{
+			RelOptInfo *rel = (RelOptInfo *) lfirst(lc);
+
+			if (best == NULL ||
+				rel->cheapest_total_path->total_cost <
+				best->cheapest_total_path->total_cost)
+				best = rel;
+		}
+
+		root->join_rel_level = NULL;
+
+		if (bestlev == nitems)
+		{
+			/* That was all of them */
+			root->initial_rels = initial_rels;
+			return best;
+		}
+
+		/*
+		 * Forget the other join relations of this round; their paths may be
+		 * built again from the new item in the next round.
+		 */
+		root->join_rel_list = list_truncate(root->join_rel_list, roundlength);
+		root->join_rel_list = lappend(root->join_rel_list, best);
+		root->join_rel_hash = NULL;
+
+		newitems = list_make1(best);
+		foreach(lc, items)
+		{
+			RelOptInfo *rel = (RelOptInfo *) lfirst(lc);
+
+			if (!bms_is_subset(rel->relids, best->relids))
+				newitems = lappend(newitems, rel);
+		}
+		list_free(items);
+		items = newitems;
+	}
+}
+
 /*****************************************************************************
  *			PUSHING QUALS DOWN INTO SUBQUERIES
  *****************************************************************************/
@@ -3860,6 +4002,10 @@ print_path(PlannerInfo *root, Path *path, int indent)
 			ptype = "Material";
 			subpath = ((MaterialPath *) path)->subpath;
 			break;
+		case T_MemoizePath:
+			ptype = "Memoize";
+			subpath = ((MemoizePath *) path)->subpath;
+			break;
 		case T_UniquePath:
 			ptype = "Unique";
 			subpath = ((UniquePath *) path)->subpath;
@@ -3884,6 +4030,10 @@ print_path(PlannerInfo *root, Path *path, int indent)
 			ptype = "Sort";
 			subpath = ((SortPath *) path)->subpath;
 			break;
+		case T_IncrementalSortPath:
+			ptype = "IncrementalSort";
+			subpath = ((SortPath *) path)->subpath;
+			break;
 		case T_GroupPath:
 			ptype = "Group";
 			subpath = ((GroupPath *) path)->subpath;
@@ -62,9 +62,10 @@ static RelOptInfo *find_single_rel_for_clauses(PlannerInfo *root,
  *
  * The basic approach is to apply extended statistics first, on as many
  * clauses as possible, in order to capture cross-column dependencies etc.
- * The remaining clauses are then estimated using regular statistics tracked
- * for individual columns.  This is done by simply passing the clauses to
- * clauselist_selectivity_simple.
+ * For join clauses, that means the ndistinct statistics of the joined
+ * relations.  The remaining clauses are then estimated using regular
+ * statistics tracked for individual columns.  This is done by simply passing
+ * the clauses to clauselist_selectivity_simple.
  */
 Selectivity
 clauselist_selectivity(PlannerInfo *root,
@@ -95,6 +96,15 @@ clauselist_selectivity(PlannerInfo *root,
 											 jointype, sjinfo, rel,
 											 &estimatedclauses);
 	}
+	else if (rel == NULL && varRelid == 0)
+	{
+		/*
+		 * The clauses may join relations on several columns at once, which
+		 * ndistinct statistics may tell are correlated.
+		 */
+		s1 *= statext_join_clauselist_selectivity(root, clauses, jointype,
+												  sjinfo, &estimatedclauses);
+	}
 
 	/*
 	 * Apply normal selectivity estimates for the remaining clauses, passing
@@ -265,6 +265,13 @@ query_planner(PlannerInfo *root,
 	 */
 	add_other_rels_to_query(root);
 
+	/*
+	 * When inheritance_planner is only after the set of surviving children,
+	 * we're done.
+	 */
+	if (root->inhTargetExpandOnly)
+		return NULL;
+
 	/*
 	 * Ready to do the primary planning.
 	 */
@@ -627,6 +627,7 @@ subquery_planner(PlannerGlobal *glob, Query *parse,
 	root->minmax_aggs = NIL;
 	root->qual_security_level = 0;
 	root->inhTargetKind = INHKIND_NONE;
+	root->inhTargetExpandOnly = false;
 	root->hasRecursion = hasRecursion;
 	if (hasRecursion)
 		root->wt_param_id = assign_special_exec_param(root);
@@ -635,6 +636,16 @@ subquery_planner(PlannerGlobal *glob, Query *parse,
 	root->non_recursive_path = NULL;
 	root->partColsUpdated = false;
 
+	/*
+	 * The executor may buffer the rows of an INSERT and add them to the table
+	 * several at a time, unless a volatile function in the query could
+	 * notice that the earlier rows aren't in the table yet.  This has to be
+	 * checked before sublinks are turned into subplans, which the walker
+	 * can't descend into.  nextval() is allowed, as COPY does.
+	 */
+	root->batchInsert = (parse->commandType == CMD_INSERT &&
+						 !contain_volatile_functions_not_nextval((Node *) parse));
+
 	/*
 	 * If there is a WITH list, process each WITH query and either convert it
 	 * to RTE_SUBQUERY RTE(s) or build an initplan SubPlan structure for it.
@@ -1284,10 +1295,14 @@ inheritance_planner(PlannerInfo *root)
 	 * find out which child relations need to be processed, using the same
 	 * expansion and pruning logic as for a SELECT.  We'll then pull out the
 	 * RangeTblEntry-s generated for the child rels, and make use of the
-	 * AppendRelInfo entries for them to guide the real planning.  (This is
-	 * rather inefficient; we could perhaps stop short of making a full Path
-	 * tree.  But this whole function is inefficient and slated for
-	 * destruction, so let's not contort query_planner for that.)
+	 * AppendRelInfo entries for them to guide the real planning.
+	 *
+	 * Nothing but the expansion is of interest here, so query_planner stops
+	 * short of building paths once it has added the otherrels.  With
+	 * thousands of partitions surviving pruning, making a complete Path tree
+	 * for all of them only to throw it away used to cost as much as the
+	 * real planning cycles below.  Constraint exclusion of the children is
+	 * left to those cycles, as before.
 	 */
 	{
 		PlannerInfo *subroot;
@@ -1328,7 +1343,8 @@ inheritance_planner(PlannerInfo *root)
 		/* and we haven't created PlaceHolderInfos, either */
 		Assert(subroot->placeholder_list == NIL);
 
-		/* Generate Path(s) for accessing this result relation */
+		/* Expand the inheritance tree, pruning partitions where possible */
+		subroot->inhTargetExpandOnly = true;
 		grouping_planner(subroot, true, 0.0 /* retrieve all tuples */ );
 
 		/* Extract the info we need. */
@@ -2047,6 +2063,16 @@ grouping_planner(PlannerInfo *root, bool inheritance_update,
 		 */
 		current_rel = query_planner(root, standard_qp_callback, &qp_extra);
 
+		/*
+		 * inheritance_planner only wanted the appendrels expanded; there are
+		 * no paths to build upper rels from.
+		 */
+		if (root->inhTargetExpandOnly)
+		{
+			Assert(current_rel == NULL);
+			return;
+		}
+
 		/*
 		 * Convert the query's result tlist into PathTarget format.
 		 *
@@ -4917,8 +4943,9 @@ create_distinct_paths(PlannerInfo *root,
  * Build a new upperrel containing Paths for ORDER BY evaluation.
  *
  * All paths in the result must satisfy the ORDER BY ordering.
- * The only new path we need consider is an explicit sort on the
- * cheapest-total existing path.
+ * The only new paths we need consider are an explicit sort on the
+ * cheapest-total existing path, and incremental sorts on the existing paths
+ * that are already sorted by a prefix of the ORDER BY.
  *
  * input_rel: contains the source-data Paths
  * target: the output tlist the result Paths must emit
@@ -4957,11 +4984,14 @@ create_ordered_paths(PlannerInfo *root,
 
 	foreach(lc, input_rel->pathlist)
 	{
-		Path	   *path = (Path *) lfirst(lc);
+		Path	   *input_path = (Path *) lfirst(lc);
+		Path	   *path = input_path;
 		bool		is_sorted;
+		int			presorted_keys;
 
-		is_sorted = pathkeys_contained_in(root->sort_pathkeys,
-										  path->pathkeys);
+		is_sorted = pathkeys_count_contained_in(root->sort_pathkeys,
+												path->pathkeys,
+												&presorted_keys);
 		if (path == cheapest_input_path || is_sorted)
 		{
 			if (!is_sorted)
@@ -4981,6 +5011,28 @@ create_ordered_paths(PlannerInfo *root,
 
 			add_path(ordered_rel, path);
 		}
+
+		/*
+		 * If the path is sorted by a prefix of the required pathkeys, an
+		 * incremental sort on top of it may be cheaper than a full sort,
+		 * especially if there's a LIMIT.
+		 */
+		if (is_sorted || presorted_keys == 0 || !enable_incrementalsort)
+			continue;
+
+		path = (Path *) create_incremental_sort_path(root,
+													 ordered_rel,
+													 input_path,
+													 root->sort_pathkeys,
+													 presorted_keys,
+													 limit_tuples);
+
+		/* Add projection step if needed */
+		if (path->pathtarget != target)
+			path = apply_projection_to_path(root, ordered_rel,
+											path, target);
+
+		add_path(ordered_rel, path);
 	}
 
 	/*
@@ -6540,6 +6592,32 @@ add_paths_to_grouping_rel(PlannerInfo *root, RelOptInfo *input_rel,
 										 agg_costs,
 										 dNumGroups));
 			}
+
+			/*
+			 * We can also have the participants of a parallel plan divide the
+			 * groups between them.  That costs passing all input tuples on
+			 * to the participant in charge of their group, but unlike partial
+			 * aggregation, doesn't need aggregates to be combinable and
+			 * doesn't make every participant hash nearly every group when
+			 * most groups are small.  The resulting partial path is gathered
+			 * below.
+			 */
+			if (enable_parallel_hashagg && grouped_rel->consider_parallel &&
+				input_rel->partial_pathlist != NIL)
+			{
+				Path	   *cheapest_partial_path;
+
+				cheapest_partial_path = linitial(input_rel->partial_pathlist);
+				add_partial_path(grouped_rel, (Path *)
+								 create_parallel_hashagg_path(root,
+															  grouped_rel,
+															  cheapest_partial_path,
+															  grouped_rel->reltarget,
+															  parse->groupClause,
+															  havingQual,
+															  agg_costs,
+															  dNumGroups));
+			}
 		}
 
 		/*
@@ -6571,10 +6649,11 @@ add_paths_to_grouping_rel(PlannerInfo *root, RelOptInfo *input_rel,
 	}
 
 	/*
-	 * When partitionwise aggregate is used, we might have fully aggregated
-	 * paths in the partial pathlist, because add_paths_to_append_rel() will
-	 * consider a path for grouped_rel consisting of a Parallel Append of
-	 * non-partial paths from each child.
+	 * We might have fully aggregated paths in the partial pathlist: Parallel
+	 * HashAggregate paths from above, and when partitionwise aggregate is
+	 * used, because add_paths_to_append_rel() will consider a path for
+	 * grouped_rel consisting of a Parallel Append of non-partial paths from
+	 * each child.
 	 */
 	if (grouped_rel->partial_pathlist != NIL)
 		gather_grouping_paths(root, grouped_rel);
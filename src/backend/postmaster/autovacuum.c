@@ -65,6 +65,7 @@
 #include <sys/time.h>
 #include <unistd.h>
 
+#include "access/gin.h"
 #include "access/heapam.h"
 #include "access/htup_details.h"
 #include "access/multixact.h"
@@ -72,6 +73,8 @@
 #include "access/tableam.h"
 #include "access/transam.h"
 #include "access/xact.h"
+#include "access/zfreepages.h"
+#include "access/zheap.h"
 #include "catalog/dependency.h"
 #include "catalog/namespace.h"
 #include "catalog/pg_database.h"
@@ -184,6 +187,19 @@ typedef struct av_relation
 								 * reloptions, or NULL if none */
 } av_relation;
 
+/* a table collected for processing, with its urgency score */
+typedef struct av_table_score
+{
+	Oid			ats_relid;
+	double		ats_score;		/* higher is processed earlier */
+} av_table_score;
+
+/*
+ * Score given to tables at risk of wraparound, on top of their XID age
+ * fraction, so that they are always processed before any other table.
+ */
+#define AV_WRAPAROUND_SCORE		1000.0
+
 /* struct to keep track of tables to vacuum and/or analyze, after rechecking */
 typedef struct autovac_table
 {
@@ -325,19 +341,21 @@ static void FreeWorkerInfo(int code, Datum arg);
 static autovac_table *table_recheck_autovac(Oid relid, HTAB *table_toast_map,
 											TupleDesc pg_class_desc,
 											int effective_multixact_freeze_max_age);
+static double table_autovac_score(Oid relid, HTAB *table_toast_map,
+								  TupleDesc pg_class_desc,
+								  int effective_multixact_freeze_max_age);
 static void relation_needs_vacanalyze(Oid relid, AutoVacOpts *relopts,
 									  Form_pg_class classForm,
 									  PgStat_StatTabEntry *tabentry,
 									  int effective_multixact_freeze_max_age,
-									  bool *dovacuum, bool *doanalyze, bool *wraparound);
+									  bool *dovacuum, bool *doanalyze, bool *wraparound,
+									  double *score);
+static int	av_table_score_comparator(const void *a, const void *b);
 
 static void autovacuum_do_vac_analyze(autovac_table *tab,
 									  BufferAccessStrategy bstrategy);
 static AutoVacOpts *extract_autovac_opts(HeapTuple tup,
 										 TupleDesc pg_class_desc);
-static PgStat_StatTabEntry *get_pgstat_tabentry_relid(Oid relid, bool isshared,
-													  PgStat_StatDBEntry *shared,
-													  PgStat_StatDBEntry *dbentry);
 static void perform_work_item(AutoVacuumWorkItem *workitem);
 static void autovac_report_activity(autovac_table *tab);
 static void autovac_report_workitem(AutoVacuumWorkItem *workitem,
@@ -1933,13 +1951,15 @@ do_autovacuum(void)
 	HeapTuple	tuple;
 	TableScanDesc relScan;
 	Form_pg_database dbForm;
-	List	   *table_oids = NIL;
+	List	   *table_list = NIL;
 	List	   *orphan_oids = NIL;
+	av_table_score *tables;
+	int			ntables;
+	int			tableno;
+	TimestampTz last_scored;
 	HASHCTL		ctl;
 	HTAB	   *table_toast_map;
 	ListCell   *volatile cell;
-	PgStat_StatDBEntry *shared;
-	PgStat_StatDBEntry *dbentry;
 	BufferAccessStrategy bstrategy;
 	ScanKeyData key;
 	TupleDesc	pg_class_desc;
@@ -1958,12 +1978,6 @@ do_autovacuum(void)
 										  ALLOCSET_DEFAULT_SIZES);
 	MemoryContextSwitchTo(AutovacMemCxt);
 
-	/*
-	 * may be NULL if we couldn't find an entry (only happens if we are
-	 * forcing a vacuum for anti-wrap purposes).
-	 */
-	dbentry = pgstat_fetch_stat_dbentry(MyDatabaseId);
-
 	/* Start a transaction so our commands have one to play into. */
 	StartTransactionCommand();
 
@@ -2011,9 +2025,6 @@ do_autovacuum(void)
 	/* StartTransactionCommand changed elsewhere */
 	MemoryContextSwitchTo(AutovacMemCxt);
 
-	/* The database hash where pgstat keeps shared relations */
-	shared = pgstat_fetch_stat_dbentry(InvalidOid);
-
 	classRel = table_open(RelationRelationId, AccessShareLock);
 
 	/* create a copy so we can use it after closing pg_class */
@@ -2058,6 +2069,7 @@ do_autovacuum(void)
 		bool		dovacuum;
 		bool		doanalyze;
 		bool		wraparound;
+		double		score;
 
 		if (classForm->relkind != RELKIND_RELATION &&
 			classForm->relkind != RELKIND_MATVIEW)
@@ -2091,17 +2103,23 @@ do_autovacuum(void)
 
 		/* Fetch reloptions and the pgstat entry for this table */
 		relopts = extract_autovac_opts(tuple, pg_class_desc);
-		tabentry = get_pgstat_tabentry_relid(relid, classForm->relisshared,
-											 shared, dbentry);
+		tabentry = pgstat_fetch_stat_tabentry_ext(classForm->relisshared,
+												  relid);
 
 		/* Check if it needs vacuum or analyze */
 		relation_needs_vacanalyze(relid, relopts, classForm, tabentry,
 								  effective_multixact_freeze_max_age,
-								  &dovacuum, &doanalyze, &wraparound);
+								  &dovacuum, &doanalyze, &wraparound, &score);
 
-		/* Relations that need work are added to table_oids */
+		/* Relations that need work are added to table_list */
 		if (dovacuum || doanalyze)
-			table_oids = lappend_oid(table_oids, relid);
+		{
+			av_table_score *ts = palloc(sizeof(av_table_score));
+
+			ts->ats_relid = relid;
+			ts->ats_score = score;
+			table_list = lappend(table_list, ts);
+		}
 
 		/*
 		 * Remember TOAST associations for the second pass.  Note: we must do
@@ -2150,6 +2168,7 @@ do_autovacuum(void)
 		bool		dovacuum;
 		bool		doanalyze;
 		bool		wraparound;
+		double		score;
 
 		/*
 		 * We cannot safely process other backends' temp tables, so skip 'em.
@@ -2175,16 +2194,22 @@ do_autovacuum(void)
 		}
 
 		/* Fetch the pgstat entry for this table */
-		tabentry = get_pgstat_tabentry_relid(relid, classForm->relisshared,
-											 shared, dbentry);
+		tabentry = pgstat_fetch_stat_tabentry_ext(classForm->relisshared,
+												  relid);
 
 		relation_needs_vacanalyze(relid, relopts, classForm, tabentry,
 								  effective_multixact_freeze_max_age,
-								  &dovacuum, &doanalyze, &wraparound);
+								  &dovacuum, &doanalyze, &wraparound, &score);
 
 		/* ignore analyze for toast tables */
 		if (dovacuum)
-			table_oids = lappend_oid(table_oids, relid);
+		{
+			av_table_score *ts = palloc(sizeof(av_table_score));
+
+			ts->ats_relid = relid;
+			ts->ats_score = score;
+			table_list = lappend(table_list, ts);
+		}
 	}
 
 	table_endscan(relScan);
@@ -2292,12 +2317,25 @@ do_autovacuum(void)
 										  "Autovacuum Portal",
 										  ALLOCSET_DEFAULT_SIZES);
 
+	/*
+	 * Sort the collected tables so that the most urgent ones are processed
+	 * first, rather than in pg_class order.
+	 */
+	ntables = list_length(table_list);
+	tables = palloc(Max(ntables, 1) * sizeof(av_table_score));
+	tableno = 0;
+	foreach(cell, table_list)
+		tables[tableno++] = *(av_table_score *) lfirst(cell);
+	list_free_deep(table_list);
+	qsort(tables, ntables, sizeof(av_table_score), av_table_score_comparator);
+	last_scored = GetCurrentTimestamp();
+
 	/*
 	 * Perform operations on collected tables.
 	 */
-	foreach(cell, table_oids)
+	for (tableno = 0; tableno < ntables; tableno++)
 	{
-		Oid			relid = lfirst_oid(cell);
+		Oid			relid;
 		HeapTuple	classTup;
 		autovac_table *tab;
 		bool		isshared;
@@ -2324,6 +2362,31 @@ do_autovacuum(void)
 			 */
 		}
 
+		/*
+		 * The scores change as we and other workers process tables and as
+		 * new activity comes in.  If we've been at it for longer than a nap
+		 * time, rescore the tables still to do and pick the next one from
+		 * the new order; since every worker of this database does the same,
+		 * the most urgent tables keep going to whichever worker is free.
+		 */
+		if (TimestampDifferenceExceeds(last_scored, GetCurrentTimestamp(),
+									   autovacuum_naptime * 1000))
+		{
+			int			j;
+
+			autovac_refresh_stats();
+			for (j = tableno; j < ntables; j++)
+				tables[j].ats_score =
+					table_autovac_score(tables[j].ats_relid, table_toast_map,
+										pg_class_desc,
+										effective_multixact_freeze_max_age);
+			qsort(tables + tableno, ntables - tableno, sizeof(av_table_score),
+				  av_table_score_comparator);
+			last_scored = GetCurrentTimestamp();
+		}
+
+		relid = tables[tableno].ats_relid;
+
 		/*
 		 * Find out whether the table is shared or not.  (It's slightly
 		 * annoying to fetch the syscache entry just for this, but in typical
@@ -2573,6 +2636,9 @@ deleted:
 	}
 	LWLockRelease(AutovacuumLock);
 
+	/* Enter the pages pruned by the work items into the FSM. */
+	ZHeapFlushFreedPages();
+
 	/*
 	 * We leak table_toast_map here (among other things), but since we're
 	 * going away soon, it's not a problem.
@@ -2657,6 +2723,13 @@ perform_work_item(AutoVacuumWorkItem *workitem)
 									ObjectIdGetDatum(workitem->avw_relation),
 									Int64GetDatum((int64) workitem->avw_blockNumber));
 				break;
+			case AVW_ZHeapPrunePage:
+				zheap_page_prune_work(workitem->avw_relation,
+									  workitem->avw_blockNumber);
+				break;
+			case AVW_GINCleanPendingList:
+				ginCleanPendingListWork(workitem->avw_relation);
+				break;
 			default:
 				elog(WARNING, "unrecognized work item found: type %d",
 					 workitem->avw_type);
@@ -2735,30 +2808,6 @@ extract_autovac_opts(HeapTuple tup, TupleDesc pg_class_desc)
 	return av;
 }
 
-/*
- * get_pgstat_tabentry_relid
- *
- * Fetch the pgstat entry of a table, either local to a database or shared.
- */
-static PgStat_StatTabEntry *
-get_pgstat_tabentry_relid(Oid relid, bool isshared, PgStat_StatDBEntry *shared,
-						  PgStat_StatDBEntry *dbentry)
-{
-	PgStat_StatTabEntry *tabentry = NULL;
-
-	if (isshared)
-	{
-		if (PointerIsValid(shared))
-			tabentry = hash_search(shared->tables, &relid,
-								   HASH_FIND, NULL);
-	}
-	else if (PointerIsValid(dbentry))
-		tabentry = hash_search(dbentry->tables, &relid,
-							   HASH_FIND, NULL);
-
-	return tabentry;
-}
-
 /*
  * table_recheck_autovac
  *
@@ -2778,17 +2827,12 @@ table_recheck_autovac(Oid relid, HTAB *table_toast_map,
 	bool		doanalyze;
 	autovac_table *tab = NULL;
 	PgStat_StatTabEntry *tabentry;
-	PgStat_StatDBEntry *shared;
-	PgStat_StatDBEntry *dbentry;
 	bool		wraparound;
 	AutoVacOpts *avopts;
 
 	/* use fresh stats */
 	autovac_refresh_stats();
 
-	shared = pgstat_fetch_stat_dbentry(InvalidOid);
-	dbentry = pgstat_fetch_stat_dbentry(MyDatabaseId);
-
 	/* fetch the relation's relcache entry */
 	classTup = SearchSysCacheCopy1(RELOID, ObjectIdGetDatum(relid));
 	if (!HeapTupleIsValid(classTup))
@@ -2812,12 +2856,12 @@ table_recheck_autovac(Oid relid, HTAB *table_toast_map,
 	}
 
 	/* fetch the pgstat table entry */
-	tabentry = get_pgstat_tabentry_relid(relid, classForm->relisshared,
-										 shared, dbentry);
+	tabentry = pgstat_fetch_stat_tabentry_ext(classForm->relisshared,
+											  relid);
 
 	relation_needs_vacanalyze(relid, avopts, classForm, tabentry,
 							  effective_multixact_freeze_max_age,
-							  &dovacuum, &doanalyze, &wraparound);
+							  &dovacuum, &doanalyze, &wraparound, NULL);
 
 	/* ignore ANALYZE for toast tables */
 	if (classForm->relkind == RELKIND_TOASTVALUE)
@@ -2888,6 +2932,7 @@ table_recheck_autovac(Oid relid, HTAB *table_toast_map,
 			(!wraparound ? VACOPT_SKIP_LOCKED : 0);
 		tab->at_params.index_cleanup = VACOPT_TERNARY_DEFAULT;
 		tab->at_params.truncate = VACOPT_TERNARY_DEFAULT;
+		tab->at_params.nworkers = 0;
 		tab->at_params.freeze_min_age = freeze_min_age;
 		tab->at_params.freeze_table_age = freeze_table_age;
 		tab->at_params.multixact_freeze_min_age = multixact_freeze_min_age;
@@ -2914,6 +2959,82 @@ table_recheck_autovac(Oid relid, HTAB *table_toast_map,
 	return tab;
 }
 
+/*
+ * table_autovac_score
+ *
+ * Recompute the urgency score of a table collected by do_autovacuum, from
+ * fresh catalog and pgstat data.  Tables that went away or no longer need
+ * any work get a negative score, which sorts them last; they are skipped by
+ * table_recheck_autovac when their turn comes.
+ */
+static double
+table_autovac_score(Oid relid, HTAB *table_toast_map,
+					TupleDesc pg_class_desc,
+					int effective_multixact_freeze_max_age)
+{
+	HeapTuple	classTup;
+	Form_pg_class classForm;
+	AutoVacOpts *relopts;
+	AutoVacOpts *avopts;
+	PgStat_StatTabEntry *tabentry;
+	bool		dovacuum;
+	bool		doanalyze;
+	bool		wraparound;
+	double		score;
+
+	classTup = SearchSysCacheCopy1(RELOID, ObjectIdGetDatum(relid));
+	if (!HeapTupleIsValid(classTup))
+		return -1.0;
+	classForm = (Form_pg_class) GETSTRUCT(classTup);
+
+	/* same reloptions lookup as table_recheck_autovac */
+	relopts = extract_autovac_opts(classTup, pg_class_desc);
+	avopts = relopts;
+	if (classForm->relkind == RELKIND_TOASTVALUE &&
+		avopts == NULL && table_toast_map != NULL)
+	{
+		av_relation *hentry;
+		bool		found;
+
+		hentry = hash_search(table_toast_map, &relid, HASH_FIND, &found);
+		if (found && hentry->ar_hasrelopts)
+			avopts = &hentry->ar_reloptions;
+	}
+
+	tabentry = pgstat_fetch_stat_tabentry_ext(classForm->relisshared, relid);
+
+	relation_needs_vacanalyze(relid, avopts, classForm, tabentry,
+							  effective_multixact_freeze_max_age,
+							  &dovacuum, &doanalyze, &wraparound, &score);
+
+	if (relopts)
+		pfree(relopts);
+	heap_freetuple(classTup);
+
+	return (dovacuum || doanalyze) ? score : -1.0;
+}
+
+/*
+ * qsort comparator for av_table_score, highest score first
+ */
+static int
+av_table_score_comparator(const void *a, const void *b)
+{
+	const av_table_score *ta = (const av_table_score *) a;
+	const av_table_score *tb = (const av_table_score *) b;
+
+	if (ta->ats_score > tb->ats_score)
+		return -1;
+	if (ta->ats_score < tb->ats_score)
+		return 1;
+	/* keep pg_class order among equals, more or less */
+	if (ta->ats_relid < tb->ats_relid)
+		return -1;
+	if (ta->ats_relid > tb->ats_relid)
+		return 1;
+	return 0;
+}
+
 /*
  * relation_needs_vacanalyze
  *
@@ -2921,6 +3042,15 @@ table_recheck_autovac(Oid relid, HTAB *table_toast_map,
  * "dovacuum" and "doanalyze", respectively.  Also return whether the vacuum is
  * being forced because of Xid or multixact wraparound.
  *
+ * If "score" isn't NULL, it is set to the table's urgency, used to order the
+ * tables a worker processes.  Tables at risk of wraparound get
+ * AV_WRAPAROUND_SCORE plus the fraction of freeze_max_age their relfrozenxid
+ * (or relminmxid) is old, so they go first, oldest first.  For the others,
+ * the score adds up that fraction, the ratios of dead tuples and of changes
+ * since analyze to their thresholds, and for zheap tables the TPD entries
+ * allocated per page and the undo written per table byte since the latest
+ * vacuum.
+ *
  * relopts is a pointer to the AutoVacOpts options (either for itself in the
  * case of a plain table, or for either itself or its parent table in the case
  * of a TOAST table), NULL if none; tabentry is the pgstats entry, which can be
@@ -2960,9 +3090,11 @@ relation_needs_vacanalyze(Oid relid,
  /* output params below */
 						  bool *dovacuum,
 						  bool *doanalyze,
-						  bool *wraparound)
+						  bool *wraparound,
+						  double *score)
 {
 	bool		force_vacuum;
+	double		age_frac = 0.0;
 	bool		av_enabled;
 	float4		reltuples;		/* pg_class.reltuples */
 
@@ -3039,6 +3171,19 @@ relation_needs_vacanalyze(Oid relid,
 	}
 	*wraparound = force_vacuum;
 
+	/* How close the table is to needing an anti-wraparound vacuum */
+	if (TransactionIdIsNormal(classForm->relfrozenxid) && freeze_max_age > 0)
+		age_frac = Max(age_frac,
+					   (double) (int32) (recentXid - classForm->relfrozenxid) /
+					   freeze_max_age);
+	if (MultiXactIdIsValid(classForm->relminmxid) &&
+		multixact_freeze_max_age > 0)
+		age_frac = Max(age_frac,
+					   (double) (int32) (recentMulti - classForm->relminmxid) /
+					   multixact_freeze_max_age);
+	if (score)
+		*score = force_vacuum ? AV_WRAPAROUND_SCORE + age_frac : age_frac;
+
 	/* User disabled it in pg_class.reloptions?  (But ignore if at risk) */
 	if (!av_enabled && !force_vacuum)
 	{
@@ -3075,6 +3220,18 @@ relation_needs_vacanalyze(Oid relid,
 		/* Determine if this table needs vacuum or analyze. */
 		*dovacuum = force_vacuum || (vactuples > vacthresh);
 		*doanalyze = (anltuples > anlthresh);
+
+		if (score && !force_vacuum)
+		{
+			double		pages = Max(classForm->relpages, 1);
+
+			*score += vactuples / Max(vacthresh, 1.0);
+			*score += anltuples / Max(anlthresh, 1.0);
+			*score += (tabentry->zheap_tpd_allocs -
+					   tabentry->zheap_tpd_allocs_at_vacuum) / pages;
+			*score += (tabentry->zheap_undo_bytes -
+					   tabentry->zheap_undo_bytes_at_vacuum) / (pages * BLCKSZ);
+		}
 	}
 	else
 	{
@@ -3174,6 +3331,14 @@ autovac_report_workitem(AutoVacuumWorkItem *workitem,
 			snprintf(activity, MAX_AUTOVAC_ACTIV_LEN,
 					 "autovacuum: BRIN summarize");
 			break;
+		case AVW_ZHeapPrunePage:
+			snprintf(activity, MAX_AUTOVAC_ACTIV_LEN,
+					 "autovacuum: zheap prune");
+			break;
+		case AVW_GINCleanPendingList:
+			snprintf(activity, MAX_AUTOVAC_ACTIV_LEN,
+					 "autovacuum: GIN pending list cleanup");
+			break;
 	}
 
 	/*
@@ -3210,37 +3375,55 @@ AutoVacuumingActive(void)
 
 /*
  * Request one work item to the next autovacuum run processing our database.
- * Return false if the request can't be recorded.
+ * Return false if the request can't be recorded.  An identical request that
+ * is still pending is not recorded again, but counts as success.
  */
 bool
 AutoVacuumRequestWork(AutoVacuumWorkItemType type, Oid relationId,
 					  BlockNumber blkno)
 {
+	AutoVacuumWorkItem *freeitem = NULL;
 	int			i;
 	bool		result = false;
 
 	LWLockAcquire(AutovacuumLock, LW_EXCLUSIVE);
 
 	/*
-	 * Locate an unused work item and fill it with the given data.
+	 * Locate an unused work item, checking for a duplicate on the way.
 	 */
 	for (i = 0; i < NUM_WORKITEMS; i++)
 	{
 		AutoVacuumWorkItem *workitem = &AutoVacuumShmem->av_workItems[i];
 
-		if (workitem->avw_used)
+		if (!workitem->avw_used)
+		{
+			if (freeitem == NULL)
+				freeitem = workitem;
 			continue;
+		}
 
-		workitem->avw_used = true;
-		workitem->avw_active = false;
-		workitem->avw_type = type;
-		workitem->avw_database = MyDatabaseId;
-		workitem->avw_relation = relationId;
-		workitem->avw_blockNumber = blkno;
-		result = true;
+		if (!workitem->avw_active &&
+			workitem->avw_type == type &&
+			workitem->avw_database == MyDatabaseId &&
+			workitem->avw_relation == relationId &&
+			workitem->avw_blockNumber == blkno)
+		{
+			freeitem = NULL;
+			result = true;
+			break;
+		}
+	}
 
-		/* done */
-		break;
+	/* Fill the unused work item with the given data. */
+	if (freeitem != NULL)
+	{
+		freeitem->avw_used = true;
+		freeitem->avw_active = false;
+		freeitem->avw_type = type;
+		freeitem->avw_database = MyDatabaseId;
+		freeitem->avw_relation = relationId;
+		freeitem->avw_blockNumber = blkno;
+		result = true;
 	}
 
 	LWLockRelease(AutovacuumLock);
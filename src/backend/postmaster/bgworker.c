@@ -23,8 +23,11 @@
 #include "port/atomics.h"
 #include "postmaster/bgworker_internals.h"
 #include "postmaster/postmaster.h"
+#include "postmaster/proxy.h"
+#include "postmaster/walsummarizer.h"
 #include "replication/logicallauncher.h"
 #include "replication/logicalworker.h"
+#include "storage/aio.h"
 #include "storage/dsm.h"
 #include "storage/ipc.h"
 #include "storage/latch.h"
@@ -132,6 +135,12 @@ static const struct
 	{
 		"ApplyWorkerMain", ApplyWorkerMain
 	},
+	{
+		"ParallelApplyWorkerMain", ParallelApplyWorkerMain
+	},
+	{
+		"ParallelSyncWorkerMain", ParallelSyncWorkerMain
+	},
 	{
 		"UndoLauncherMain", UndoLauncherMain
 	},
@@ -140,6 +149,15 @@ static const struct
 	},
 	{
 		"DiscardWorkerMain", DiscardWorkerMain
+	},
+	{
+		"AioWorkerMain", AioWorkerMain
+	},
+	{
+		"ProxyMain", ProxyMain
+	},
+	{
+		"WalSummarizerMain", WalSummarizerMain
 	}
 };
 
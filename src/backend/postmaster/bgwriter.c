@@ -270,6 +270,7 @@ BackgroundWriterMain(void)
 		 * Send off activity statistics to the stats collector
 		 */
 		pgstat_send_bgwriter();
+		pgstat_send_io(false);
 
 		if (FirstCallSinceLastCheckpoint())
 		{
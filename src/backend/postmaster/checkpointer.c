@@ -36,6 +36,7 @@
  */
 #include "postgres.h"
 
+#include <math.h>
 #include <signal.h>
 #include <sys/time.h>
 #include <time.h>
@@ -57,6 +58,7 @@
 #include "storage/shmem.h"
 #include "storage/smgr.h"
 #include "storage/spin.h"
+#include "storage/sync.h"
 #include "utils/guc.h"
 #include "utils/memutils.h"
 #include "utils/resowner.h"
@@ -146,6 +148,31 @@ static CheckpointerShmemStruct *CheckpointerShmem;
 int			CheckPointTimeout = 300;
 int			CheckPointWarning = 30;
 double		CheckPointCompletionTarget = 0.5;
+int			CheckPointPacing = CHECKPOINT_PACING_SCHEDULE;
+
+/*
+ * With adaptive pacing, while the checkpointer's writes take more than
+ * CKPT_LATENCY_FACTOR times as long as usual, it keeps napping for
+ * CKPT_LATENCY_NAP_USEC between writes until it has fallen behind schedule
+ * by CKPT_LATENCY_SLACK of the checkpoint interval, leaving the device to
+ * the backends.  The write latency is smoothed over CKPT_LATENCY_SMOOTHING
+ * writes, and the usual latency follows rises in it over
+ * CKPT_LATENCY_BASE_SMOOTHING writes.
+ */
+#define CKPT_LATENCY_FACTOR			2.0
+#define CKPT_LATENCY_NAP_USEC		10000L
+#define CKPT_LATENCY_SLACK			0.05
+#define CKPT_LATENCY_SMOOTHING		16
+#define CKPT_LATENCY_BASE_SMOOTHING	1024
+#define CKPT_LATENCY_MIN_SAMPLES	64
+
+/*
+ * Full-page images make a checkpoint's WAL front-loaded, so adaptive pacing
+ * measures progress against WAL by the fraction of CheckPointSegments used
+ * raised to this power, rather than rushing the writes while backends are
+ * busiest with WAL right after the checkpoint starts.
+ */
+#define CKPT_FPI_COMPENSATION		1.5
 
 /*
  * Flags set by interrupt handlers for later service in the main loop.
@@ -163,6 +190,11 @@ static pg_time_t ckpt_start_time;
 static XLogRecPtr ckpt_start_recptr;
 static double ckpt_cached_elapsed;
 
+/* write latency observed by adaptive pacing, kept across checkpoints */
+static double ckpt_write_latency;
+static double ckpt_write_latency_base;
+static int	ckpt_write_latency_samples = 0;
+
 static pg_time_t last_checkpoint_time;
 static pg_time_t last_xlog_switch_time;
 
@@ -170,6 +202,7 @@ static pg_time_t last_xlog_switch_time;
 
 static void CheckArchiveTimeout(void);
 static bool IsCheckpointOnSchedule(double progress);
+static bool IsCheckpointWriteLatencyHigh(double progress);
 static bool ImmediateCheckpointRequested(void);
 static bool CompactCheckpointerRequestQueue(void);
 static void UpdateSharedMemoryConfig(void);
@@ -533,6 +566,7 @@ CheckpointerMain(void)
 		 * stats message types.)
 		 */
 		pgstat_send_bgwriter();
+		pgstat_send_io(false);
 
 		/*
 		 * Sleep until we are signaled or it's time for another checkpoint or
@@ -551,6 +585,13 @@ CheckpointerMain(void)
 			cur_timeout = Min(cur_timeout, XLogArchiveTimeout - elapsed_secs);
 		}
 
+		/*
+		 * If shared_buffers was lowered, evict what the buffers taken out of
+		 * use still hold.  Come back soon for those that were pinned.
+		 */
+		if (!DrainBufferPool())
+			cur_timeout = 1;
+
 		(void) WaitLatch(MyLatch,
 						 WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
 						 cur_timeout * 1000L /* convert to ms */ ,
@@ -645,6 +686,73 @@ ImmediateCheckpointRequested(void)
 	return false;
 }
 
+/*
+ * CheckpointNapTime -- how long CheckpointWriteDelay should nap now, in
+ *		microseconds, or zero to go on writing
+ */
+static long
+CheckpointNapTime(int flags, double progress)
+{
+	if (!AmCheckpointerProcess() ||
+		(flags & CHECKPOINT_IMMEDIATE) ||
+		shutdown_requested ||
+		ImmediateCheckpointRequested())
+		return 0;
+
+	if (IsCheckpointOnSchedule(progress))
+		return 100000L;
+
+	if (CheckPointPacing == CHECKPOINT_PACING_ADAPTIVE &&
+		IsCheckpointWriteLatencyHigh(progress))
+		return CKPT_LATENCY_NAP_USEC;
+
+	return 0;
+}
+
+/*
+ * CheckpointWriteDelayWouldSleep -- would CheckpointWriteDelay nap now?
+ *
+ * BufferSync() uses this to finish the writes it has in flight before the
+ * checkpointer goes to sleep, rather than leaving them to wait out the nap.
+ */
+bool
+CheckpointWriteDelayWouldSleep(int flags, double progress)
+{
+	return CheckpointNapTime(flags, progress) > 0;
+}
+
+/*
+ * CheckpointNoteWriteLatency -- note the time one buffer write took
+ *
+ * BufferSync() calls this for adaptive pacing, with the average time per
+ * buffer of the writes it just did.
+ */
+void
+CheckpointNoteWriteLatency(double msec)
+{
+	if (ckpt_write_latency_samples == 0)
+	{
+		ckpt_write_latency = msec;
+		ckpt_write_latency_base = msec;
+	}
+	else
+	{
+		ckpt_write_latency += (msec - ckpt_write_latency) /
+			CKPT_LATENCY_SMOOTHING;
+
+		/* the usual latency follows drops at once, but rises only slowly */
+		if (ckpt_write_latency < ckpt_write_latency_base)
+			ckpt_write_latency_base = ckpt_write_latency;
+		else
+			ckpt_write_latency_base +=
+				(ckpt_write_latency - ckpt_write_latency_base) /
+				CKPT_LATENCY_BASE_SMOOTHING;
+	}
+
+	if (ckpt_write_latency_samples < CKPT_LATENCY_MIN_SAMPLES)
+		ckpt_write_latency_samples++;
+}
+
 /*
  * CheckpointWriteDelay -- control rate of checkpoint
  *
@@ -662,6 +770,7 @@ void
 CheckpointWriteDelay(int flags, double progress)
 {
 	static int	absorb_counter = WRITES_PER_ABSORB;
+	long		nap;
 
 	/* Do nothing if checkpoint is being executed by non-checkpointer process */
 	if (!AmCheckpointerProcess())
@@ -671,10 +780,8 @@ CheckpointWriteDelay(int flags, double progress)
 	 * Perform the usual duties and take a nap, unless we're behind schedule,
 	 * in which case we just try to catch up as quickly as possible.
 	 */
-	if (!(flags & CHECKPOINT_IMMEDIATE) &&
-		!shutdown_requested &&
-		!ImmediateCheckpointRequested() &&
-		IsCheckpointOnSchedule(progress))
+	nap = CheckpointNapTime(flags, progress);
+	if (nap > 0)
 	{
 		if (got_SIGHUP)
 		{
@@ -687,20 +794,24 @@ CheckpointWriteDelay(int flags, double progress)
 		AbsorbSyncRequests();
 		absorb_counter = WRITES_PER_ABSORB;
 
+		ProcessEarlySyncs();
+
 		CheckArchiveTimeout();
 
 		/*
 		 * Report interim activity statistics to the stats collector.
 		 */
 		pgstat_send_bgwriter();
+		pgstat_send_io(false);
 
 		/*
 		 * This sleep used to be connected to bgwriter_delay, typically 200ms.
 		 * That resulted in more frequent wakeups if not much work to do.
 		 * Checkpointer and bgwriter are no longer related so take the Big
-		 * Sleep.
+		 * Sleep.  Adaptive pacing may also take shorter naps when behind
+		 * schedule, see CheckpointNapTime().
 		 */
-		pg_usleep(100000L);
+		pg_usleep(nap);
 	}
 	else if (--absorb_counter <= 0)
 	{
@@ -711,6 +822,8 @@ CheckpointWriteDelay(int flags, double progress)
 		 */
 		AbsorbSyncRequests();
 		absorb_counter = WRITES_PER_ABSORB;
+
+		ProcessEarlySyncs();
 	}
 }
 
@@ -770,6 +883,9 @@ IsCheckpointOnSchedule(double progress)
 		recptr = GetInsertRecPtr();
 	elapsed_xlogs = (((double) (recptr - ckpt_start_recptr)) /
 					 wal_segment_size) / CheckPointSegments;
+	if (CheckPointPacing == CHECKPOINT_PACING_ADAPTIVE && fullPageWrites &&
+		elapsed_xlogs < 1.0)
+		elapsed_xlogs = pow(elapsed_xlogs, CKPT_FPI_COMPENSATION);
 
 	if (progress < elapsed_xlogs)
 	{
@@ -794,6 +910,25 @@ IsCheckpointOnSchedule(double progress)
 	return true;
 }
 
+/*
+ * IsCheckpointWriteLatencyHigh -- should a checkpoint that is behind
+ *		schedule still back off, because its writes are slow?
+ *
+ * Must be called right after IsCheckpointOnSchedule() returned false, so that
+ * ckpt_cached_elapsed tells how far the checkpoint is along its schedule.
+ */
+static bool
+IsCheckpointWriteLatencyHigh(double progress)
+{
+	if (ckpt_write_latency_samples < CKPT_LATENCY_MIN_SAMPLES ||
+		ckpt_write_latency < ckpt_write_latency_base * CKPT_LATENCY_FACTOR)
+		return false;
+
+	/* never fall further behind than the slack allows */
+	return ckpt_cached_elapsed - progress * CheckPointCompletionTarget <
+		CKPT_LATENCY_SLACK;
+}
+
 
 /* --------------------------------
  *		signal handler routines
@@ -1348,6 +1483,9 @@ UpdateSharedMemoryConfig(void)
 	 */
 	UpdateFullPageWrites();
 
+	/* Grow or shrink the buffer pool if shared_buffers has been changed */
+	ResizeBufferPool();
+
 	elog(DEBUG2, "checkpointer updated shared memory configuration values");
 }
 
@@ -40,28 +40,35 @@
 #include "access/transam.h"
 #include "access/twophase_rmgr.h"
 #include "access/xact.h"
+#include "access/xlogprefetch.h"
 #include "catalog/pg_database.h"
 #include "catalog/pg_proc.h"
 #include "common/ip.h"
+#include "lib/dshash.h"
 #include "libpq/libpq.h"
 #include "libpq/pqsignal.h"
 #include "mb/pg_wchar.h"
 #include "miscadmin.h"
 #include "pg_trace.h"
 #include "postmaster/autovacuum.h"
+#include "postmaster/bgworker.h"
 #include "postmaster/fork_process.h"
 #include "postmaster/postmaster.h"
 #include "replication/walsender.h"
 #include "storage/backendid.h"
+#include "storage/bufmgr.h"
 #include "storage/dsm.h"
 #include "storage/fd.h"
 #include "storage/ipc.h"
 #include "storage/latch.h"
 #include "storage/lmgr.h"
+#include "storage/lwlock.h"
 #include "storage/pg_shmem.h"
 #include "storage/procsignal.h"
+#include "storage/shmem.h"
 #include "storage/sinvaladt.h"
 #include "utils/ascii.h"
+#include "utils/dsa.h"
 #include "utils/guc.h"
 #include "utils/memutils.h"
 #include "utils/ps_status.h"
@@ -105,6 +112,12 @@
 #define PGSTAT_TAB_HASH_SIZE	512
 #define PGSTAT_FUNCTION_HASH_SIZE	512
 
+/*
+ * Size of the part of the main shared memory segment that holds the
+ * object statistics area.  The area grows into DSM segments beyond this.
+ */
+#define PGSTAT_SHMEM_AREA_SIZE	(1024 * 1024)
+
 
 /* ----------
  * Total number of backends including auxiliary
@@ -142,6 +155,13 @@ char	   *pgstat_stat_tmpname = NULL;
  */
 PgStat_MsgBgWriter BgWriterStats;
 
+/*
+ * I/O context the buffer manager is currently doing I/O in.  Set by
+ * ReadBuffer_common around the smgr calls it makes on behalf of a buffer
+ * access strategy, and IOCONTEXT_NORMAL otherwise.
+ */
+IOContext	pgStatIOContext = IOCONTEXT_NORMAL;
+
 /* ----------
  * Local data
  * ----------
@@ -154,9 +174,65 @@ static time_t last_pgstat_start_time;
 
 static bool pgStatRunningInCollector = false;
 
+/*
+ * Per-table and per-function cumulative statistics live in shared memory,
+ * in two dshash tables in a DSA area that is created in place in the main
+ * shared memory segment.  Backends flush their pending counts straight into
+ * these tables, and readers look up only the entries they need, so none of
+ * this goes through the collector or its stats files.  Entries are keyed by
+ * database OID (InvalidOid for shared catalogs) and object OID.
+ */
+typedef struct PgStat_SharedKey
+{
+	Oid			databaseid;
+	Oid			objectid;
+} PgStat_SharedKey;
+
+typedef struct PgStat_SharedTabEntry
+{
+	PgStat_SharedKey key;		/* hash key (must be first) */
+	PgStat_StatTabEntry stats;
+} PgStat_SharedTabEntry;
+
+typedef struct PgStat_SharedFuncEntry
+{
+	PgStat_SharedKey key;		/* hash key (must be first) */
+	PgStat_StatFuncEntry stats;
+} PgStat_SharedFuncEntry;
+
+typedef struct PgStat_SharedControl
+{
+	dshash_table_handle tables;
+	dshash_table_handle functions;
+} PgStat_SharedControl;
+
+static const dshash_parameters pgstat_tab_hash_params = {
+	sizeof(PgStat_SharedKey),
+	sizeof(PgStat_SharedTabEntry),
+	dshash_memcmp,
+	dshash_memhash,
+	LWTRANCHE_PGSTAT_HASH
+};
+
+static const dshash_parameters pgstat_func_hash_params = {
+	sizeof(PgStat_SharedKey),
+	sizeof(PgStat_SharedFuncEntry),
+	dshash_memcmp,
+	dshash_memhash,
+	LWTRANCHE_PGSTAT_HASH
+};
+
+static PgStat_SharedControl *pgStatShared = NULL;
+static void *pgStatSharedAreaSpace = NULL;
+
+/* This backend's attachment to the above, set up on first use */
+static dsa_area *pgStatSharedArea = NULL;
+static dshash_table *pgStatSharedTables = NULL;
+static dshash_table *pgStatSharedFunctions = NULL;
+
 /*
  * Structures in which backends store per-table info that's waiting to be
- * sent to the collector.
+ * flushed to shared memory.
  *
  * NOTE: once allocated, TabStatusArray structures are never moved or deleted
  * for the life of the backend.  Also, we zero out the t_id fields of the
@@ -191,17 +267,24 @@ typedef struct TabStatHashEntry
 static HTAB *pgStatTabHash = NULL;
 
 /*
- * Backends store per-function info that's waiting to be sent to the collector
- * in this hash table (indexed by function OID).
+ * Backends store per-function info that's waiting to be flushed to shared
+ * memory in this hash table (indexed by function OID).
  */
 static HTAB *pgStatFunctions = NULL;
 
 /*
  * Indicates if backend has some function stats that it hasn't yet
- * sent to the collector.
+ * flushed to shared memory.
  */
 static bool have_function_stats = false;
 
+/*
+ * I/O counts of this process that haven't been sent to the collector yet,
+ * indexed by IOObject.
+ */
+static PgStat_IOCounts pgStatPendingIO[IOOBJECT_NUM_TYPES];
+static bool have_io_stats = false;
+
 /*
  * Tuple insertion/deletion counts for an open transaction can't be propagated
  * into PgStat_TableStatus counters until we know if it is going to commit
@@ -246,6 +329,14 @@ typedef struct TwoPhasePgStatRecord
 static MemoryContext pgStatLocalContext = NULL;
 static HTAB *pgStatDBHash = NULL;
 
+/*
+ * Copies of the shared table and function entries looked at in the current
+ * transaction, so that repeated lookups return the same values.  These live
+ * in pgStatLocalContext too and are keyed by PgStat_SharedKey.
+ */
+static HTAB *pgStatLocalTables = NULL;
+static HTAB *pgStatLocalFunctions = NULL;
+
 /* Status for backends including auxiliary */
 static LocalPgBackendStatus *localBackendStatusTable = NULL;
 
@@ -259,11 +350,11 @@ static int	localNumBackends = 0;
  */
 static PgStat_ArchiverStats archiverStats;
 static PgStat_GlobalStats globalStats;
+static PgStat_IOStats ioStats;
 
 /*
- * List of OIDs of databases we need to write out.  If an entry is InvalidOid,
- * it means to write only the shared-catalog stats ("DB 0"); otherwise, we
- * will write both that DB's data and the shared stats.
+ * List of OIDs of databases whose backends are waiting for a stats file
+ * write.  InvalidOid stands for the shared-catalog entry ("DB 0").
  */
 static List *pending_write_requests = NIL;
 
@@ -293,20 +384,22 @@ static void pgstat_beshutdown_hook(int code, Datum arg);
 static void pgstat_sighup_handler(SIGNAL_ARGS);
 
 static PgStat_StatDBEntry *pgstat_get_db_entry(Oid databaseid, bool create);
-static PgStat_StatTabEntry *pgstat_get_tab_entry(PgStat_StatDBEntry *dbentry,
-												 Oid tableoid, bool create);
+static void pgstat_attach_shared(void);
+static PgStat_SharedTabEntry *pgstat_get_shared_tabentry(Oid databaseid,
+														  Oid tableoid);
+static void pgstat_purge_shared_entries(Oid databaseid);
 static void pgstat_write_statsfiles(bool permanent, bool allDbs);
-static void pgstat_write_db_statsfile(PgStat_StatDBEntry *dbentry, bool permanent);
-static HTAB *pgstat_read_statsfiles(Oid onlydb, bool permanent, bool deep);
-static void pgstat_read_db_statsfile(Oid databaseid, HTAB *tabhash, HTAB *funchash, bool permanent);
+static HTAB *pgstat_read_statsfiles(bool permanent);
 static void backend_read_statsfile(void);
 static void pgstat_read_current_status(void);
 
 static bool pgstat_write_statsfile_needed(void);
 static bool pgstat_db_requested(Oid databaseid);
 
-static void pgstat_send_tabstat(PgStat_MsgTabstat *tsmsg);
-static void pgstat_send_funcstats(void);
+static void pgstat_flush_tabstat(PgStat_TableStatus *entry,
+								 PgStat_MsgDbstat *dbmsg);
+static void pgstat_send_dbstat(PgStat_MsgDbstat *dbmsg);
+static void pgstat_flush_funcstats(void);
 static HTAB *pgstat_collect_oids(Oid catalogid, AttrNumber anum_oid);
 
 static PgStat_TableStatus *get_tabstat_entry(Oid rel_id, bool isshared);
@@ -323,19 +416,15 @@ static void pgstat_setheader(PgStat_MsgHdr *hdr, StatMsgType mtype);
 static void pgstat_send(void *msg, int len);
 
 static void pgstat_recv_inquiry(PgStat_MsgInquiry *msg, int len);
-static void pgstat_recv_tabstat(PgStat_MsgTabstat *msg, int len);
-static void pgstat_recv_tabpurge(PgStat_MsgTabpurge *msg, int len);
+static void pgstat_recv_dbstat(PgStat_MsgDbstat *msg, int len);
 static void pgstat_recv_dropdb(PgStat_MsgDropdb *msg, int len);
 static void pgstat_recv_resetcounter(PgStat_MsgResetcounter *msg, int len);
 static void pgstat_recv_resetsharedcounter(PgStat_MsgResetsharedcounter *msg, int len);
 static void pgstat_recv_resetsinglecounter(PgStat_MsgResetsinglecounter *msg, int len);
 static void pgstat_recv_autovac(PgStat_MsgAutovacStart *msg, int len);
-static void pgstat_recv_vacuum(PgStat_MsgVacuum *msg, int len);
-static void pgstat_recv_analyze(PgStat_MsgAnalyze *msg, int len);
 static void pgstat_recv_archiver(PgStat_MsgArchiver *msg, int len);
 static void pgstat_recv_bgwriter(PgStat_MsgBgWriter *msg, int len);
-static void pgstat_recv_funcstat(PgStat_MsgFuncstat *msg, int len);
-static void pgstat_recv_funcpurge(PgStat_MsgFuncpurge *msg, int len);
+static void pgstat_recv_io(PgStat_MsgIO *msg, int len);
 static void pgstat_recv_recoveryconflict(PgStat_MsgRecoveryConflict *msg, int len);
 static void pgstat_recv_deadlock(PgStat_MsgDeadlock *msg, int len);
 static void pgstat_recv_checksum_failure(PgStat_MsgChecksumFailure *msg, int len);
@@ -652,10 +741,13 @@ pgstat_reset_remove_files(const char *directory)
 
 		/*
 		 * Skip directory entries that don't match the file names we write.
-		 * See get_dbstat_filename for the database-specific pattern.
+		 * The "db_<oid>." files are no longer written, but may be left over
+		 * from an older server.
 		 */
 		if (strncmp(entry->d_name, "global.", 7) == 0)
 			nchars = 7;
+		else if (strncmp(entry->d_name, "objects.", 8) == 0)
+			nchars = 8;
 		else
 		{
 			nchars = 0;
@@ -692,6 +784,150 @@ pgstat_reset_all(void)
 	pgstat_reset_remove_files(PGSTAT_STAT_PERMANENT_DIRECTORY);
 }
 
+/*
+ * PgStatShmemSize() -
+ *
+ *	Report the shared memory needed for table and function statistics.
+ */
+Size
+PgStatShmemSize(void)
+{
+	Size		size;
+
+	size = MAXALIGN(sizeof(PgStat_SharedControl));
+	size = add_size(size, PGSTAT_SHMEM_AREA_SIZE);
+
+	return size;
+}
+
+/*
+ * PgStatShmemInit() -
+ *
+ *	Set up the DSA area and hash tables holding table and function stats.
+ *	The postmaster (or a standalone backend) creates them; everybody else
+ *	attaches lazily with pgstat_attach_shared().
+ */
+void
+PgStatShmemInit(void)
+{
+	bool		found;
+
+	pgStatShared = (PgStat_SharedControl *)
+		ShmemInitStruct("Shared Object Statistics",
+						sizeof(PgStat_SharedControl), &found);
+	pgStatSharedAreaSpace = ShmemInitStruct("Shared Object Statistics Area",
+											PGSTAT_SHMEM_AREA_SIZE, &found);
+
+	if (!IsUnderPostmaster)
+	{
+		dsa_area   *area;
+		dshash_table *tables;
+		dshash_table *functions;
+
+		Assert(!found);
+
+		area = dsa_create_in_place(pgStatSharedAreaSpace,
+								   PGSTAT_SHMEM_AREA_SIZE,
+								   LWTRANCHE_PGSTAT_DSA, NULL);
+		tables = dshash_create(area, &pgstat_tab_hash_params, NULL);
+		functions = dshash_create(area, &pgstat_func_hash_params, NULL);
+
+		pgStatShared->tables = dshash_get_hash_table_handle(tables);
+		pgStatShared->functions = dshash_get_hash_table_handle(functions);
+
+		dshash_detach(tables);
+		dshash_detach(functions);
+		dsa_detach(area);
+	}
+}
+
+/*
+ * pgstat_attach_shared() -
+ *
+ *	Attach this process to the shared table and function stats, if it isn't
+ *	already.  The attachment lasts for the life of the process.
+ */
+static void
+pgstat_attach_shared(void)
+{
+	MemoryContext oldcontext;
+
+	if (pgStatSharedArea != NULL)
+		return;
+
+	oldcontext = MemoryContextSwitchTo(TopMemoryContext);
+
+	pgStatSharedArea = dsa_attach_in_place(pgStatSharedAreaSpace, NULL);
+	dsa_pin_mapping(pgStatSharedArea);
+	pgStatSharedTables = dshash_attach(pgStatSharedArea,
+									   &pgstat_tab_hash_params,
+									   pgStatShared->tables, NULL);
+	pgStatSharedFunctions = dshash_attach(pgStatSharedArea,
+										  &pgstat_func_hash_params,
+										  pgStatShared->functions, NULL);
+
+	MemoryContextSwitchTo(oldcontext);
+}
+
+/*
+ * pgstat_get_shared_tabentry() -
+ *
+ *	Find or create the shared stats entry of a table.  The entry is returned
+ *	exclusively locked; release it with dshash_release_lock().
+ */
+static PgStat_SharedTabEntry *
+pgstat_get_shared_tabentry(Oid databaseid, Oid tableoid)
+{
+	PgStat_SharedKey key;
+	PgStat_SharedTabEntry *entry;
+	bool		found;
+
+	pgstat_attach_shared();
+
+	key.databaseid = databaseid;
+	key.objectid = tableoid;
+	entry = dshash_find_or_insert(pgStatSharedTables, &key, &found);
+
+	if (!found)
+	{
+		MemSet(&entry->stats, 0, sizeof(PgStat_StatTabEntry));
+		entry->stats.tableid = tableoid;
+	}
+
+	return entry;
+}
+
+/*
+ * pgstat_purge_shared_entries() -
+ *
+ *	Remove all shared table and function entries of a database.
+ */
+static void
+pgstat_purge_shared_entries(Oid databaseid)
+{
+	dshash_seq_status status;
+	PgStat_SharedTabEntry *tabentry;
+	PgStat_SharedFuncEntry *funcentry;
+
+	pgstat_attach_shared();
+
+	dshash_seq_init(&status, pgStatSharedTables, true);
+	while ((tabentry = dshash_seq_next(&status)) != NULL)
+	{
+		if (tabentry->key.databaseid == databaseid)
+			dshash_delete_current(&status);
+	}
+	dshash_seq_term(&status);
+
+	dshash_seq_init(&status, pgStatSharedFunctions, true);
+	while ((funcentry = dshash_seq_next(&status)) != NULL)
+	{
+		if (funcentry->key.databaseid == databaseid)
+			dshash_delete_current(&status);
+	}
+	dshash_seq_term(&status);
+}
+
 #ifdef EXEC_BACKEND
 
 /*
@@ -806,10 +1042,11 @@ allow_immediate_pgstat_restart(void)
  * pgstat_report_stat() -
  *
  *	Must be called by processes that performs DML: tcop/postgres.c, logical
- *	receiver processes, SPI worker, etc. to send the so far collected
- *	per-table and function usage statistics to the collector.  Note that this
- *	is called only when not within a transaction, so it is fair to use
- *	transaction stop time as an approximation of current time.
+ *	receiver processes, SPI worker, etc. to flush the so far collected
+ *	per-table and function usage statistics to shared memory, and to send
+ *	the database-wide sums to the collector.  Note that this is called only
+ *	when not within a transaction, so it is fair to use transaction stop
+ *	time as an approximation of current time.
  * ----------
  */
 void
@@ -820,20 +1057,21 @@ pgstat_report_stat(bool force)
 	static TimestampTz last_report = 0;
 
 	TimestampTz now;
-	PgStat_MsgTabstat regular_msg;
-	PgStat_MsgTabstat shared_msg;
+	PgStat_MsgDbstat regular_msg;
+	PgStat_MsgDbstat shared_msg;
+	bool		have_shared = false;
 	TabStatusArray *tsa;
 	int			i;
 
 	/* Don't expend a clock check if nothing to do */
 	if ((pgStatTabList == NULL || pgStatTabList->tsa_used == 0) &&
 		pgStatXactCommit == 0 && pgStatXactRollback == 0 &&
-		!have_function_stats)
+		!have_function_stats && !have_io_stats)
 		return;
 
 	/*
-	 * Don't send a message unless it's been at least PGSTAT_STAT_INTERVAL
-	 * msec since we last sent one, or the caller wants to force stats out.
+	 * Don't flush unless it's been at least PGSTAT_STAT_INTERVAL msec since
+	 * we last did, or the caller wants to force stats out.
 	 */
 	now = GetCurrentTransactionStopTimestamp();
 	if (!force &&
@@ -842,7 +1080,7 @@ pgstat_report_stat(bool force)
 	last_report = now;
 
 	/*
-	 * Destroy pgStatTabHash before we start invalidating PgStat_TableEntry
+	 * Destroy pgStatTabHash before we start invalidating PgStat_TableStatus
 	 * entries it points to.  (Should we fail partway through the loop below,
 	 * it's okay to have removed the hashtable already --- the only
 	 * consequence is we'd get multiple entries for the same table in the
@@ -854,22 +1092,20 @@ pgstat_report_stat(bool force)
 
 	/*
 	 * Scan through the TabStatusArray struct(s) to find tables that actually
-	 * have counts, and build messages to send.  We have to separate shared
-	 * relations from regular ones because the databaseid field in the message
-	 * header has to depend on that.
+	 * have counts, and add them to the shared entries.  The database-wide
+	 * sums are kept apart for shared relations, as the collector accounts
+	 * for those under InvalidOid.
 	 */
+	MemSet(&regular_msg, 0, sizeof(regular_msg));
+	MemSet(&shared_msg, 0, sizeof(shared_msg));
 	regular_msg.m_databaseid = MyDatabaseId;
 	shared_msg.m_databaseid = InvalidOid;
-	regular_msg.m_nentries = 0;
-	shared_msg.m_nentries = 0;
 
 	for (tsa = pgStatTabList; tsa != NULL; tsa = tsa->tsa_next)
 	{
 		for (i = 0; i < tsa->tsa_used; i++)
 		{
 			PgStat_TableStatus *entry = &tsa->tsa_entries[i];
-			PgStat_MsgTabstat *this_msg;
-			PgStat_TableEntry *this_ent;
 
 			/* Shouldn't have any pending transaction-dependent counts */
 			Assert(entry->trans == NULL);
@@ -882,19 +1118,13 @@ pgstat_report_stat(bool force)
 					   sizeof(PgStat_TableCounts)) == 0)
 				continue;
 
-			/*
-			 * OK, insert data into the appropriate message, and send if full.
-			 */
-			this_msg = entry->t_shared ? &shared_msg : &regular_msg;
-			this_ent = &this_msg->m_entry[this_msg->m_nentries];
-			this_ent->t_id = entry->t_id;
-			memcpy(&this_ent->t_counts, &entry->t_counts,
-				   sizeof(PgStat_TableCounts));
-			if (++this_msg->m_nentries >= PGSTAT_NUM_TABENTRIES)
+			if (entry->t_shared)
 			{
-				pgstat_send_tabstat(this_msg);
-				this_msg->m_nentries = 0;
+				pgstat_flush_tabstat(entry, &shared_msg);
+				have_shared = true;
 			}
+			else
+				pgstat_flush_tabstat(entry, &regular_msg);
 		}
 		/* zero out TableStatus structs after use */
 		MemSet(tsa->tsa_entries, 0,
@@ -903,115 +1133,155 @@ pgstat_report_stat(bool force)
 	}
 
 	/*
-	 * Send partial messages.  Make sure that any pending xact commit/abort
-	 * gets counted, even if there are no table stats to send.
+	 * Send the database-wide sums.  Make sure that any pending xact
+	 * commit/abort gets counted, even if no table was touched.
 	 */
-	if (regular_msg.m_nentries > 0 ||
-		pgStatXactCommit > 0 || pgStatXactRollback > 0)
-		pgstat_send_tabstat(&regular_msg);
-	if (shared_msg.m_nentries > 0)
-		pgstat_send_tabstat(&shared_msg);
+	pgstat_send_dbstat(&regular_msg);
+	if (have_shared)
+		pgstat_send_dbstat(&shared_msg);
 
-	/* Now, send function statistics */
-	pgstat_send_funcstats();
+	/* Now, flush function statistics */
+	pgstat_flush_funcstats();
+
+	/* And the I/O statistics, which we just rate-limited above */
+	pgstat_send_io(true);
 }
 
 /*
- * Subroutine for pgstat_report_stat: finish and send a tabstat message
+ * Subroutine for pgstat_report_stat: add a table's pending counts to its
+ * shared entry, and to the database-wide sums in *dbmsg
  */
 static void
-pgstat_send_tabstat(PgStat_MsgTabstat *tsmsg)
+pgstat_flush_tabstat(PgStat_TableStatus *entry, PgStat_MsgDbstat *dbmsg)
 {
-	int			n;
-	int			len;
+	PgStat_TableCounts *counts = &entry->t_counts;
+	PgStat_SharedTabEntry *shent;
+	PgStat_StatTabEntry *tabentry;
 
-	/* It's unlikely we'd get here with no socket, but maybe not impossible */
-	if (pgStatSock == PGINVALID_SOCKET)
-		return;
+	shent = pgstat_get_shared_tabentry(entry->t_shared ? InvalidOid : MyDatabaseId,
+									   entry->t_id);
+	tabentry = &shent->stats;
+
+	tabentry->numscans += counts->t_numscans;
+	tabentry->tuples_returned += counts->t_tuples_returned;
+	tabentry->tuples_fetched += counts->t_tuples_fetched;
+	tabentry->tuples_inserted += counts->t_tuples_inserted;
+	tabentry->tuples_updated += counts->t_tuples_updated;
+	tabentry->tuples_deleted += counts->t_tuples_deleted;
+	tabentry->tuples_hot_updated += counts->t_tuples_hot_updated;
+	tabentry->tuples_inplace_updated += counts->t_tuples_inplace_updated;
+	/* If table was truncated, first reset the live/dead counters */
+	if (counts->t_truncated)
+	{
+		tabentry->n_live_tuples = 0;
+		tabentry->n_dead_tuples = 0;
+	}
+	tabentry->n_live_tuples += counts->t_delta_live_tuples;
+	tabentry->n_dead_tuples += counts->t_delta_dead_tuples;
+	tabentry->changes_since_analyze += counts->t_changed_tuples;
+	tabentry->blocks_fetched += counts->t_blocks_fetched;
+	tabentry->blocks_hit += counts->t_blocks_hit;
+	tabentry->zheap_tpd_allocs += counts->t_zheap_tpd_allocs;
+	tabentry->zheap_slot_waits += counts->t_zheap_slot_waits;
+	tabentry->zheap_prunes += counts->t_zheap_prunes;
+	tabentry->zheap_undo_bytes += counts->t_zheap_undo_bytes;
+
+	/* Clamp n_live_tuples in case of negative delta_live_tuples */
+	tabentry->n_live_tuples = Max(tabentry->n_live_tuples, 0);
+	/* Likewise for n_dead_tuples */
+	tabentry->n_dead_tuples = Max(tabentry->n_dead_tuples, 0);
+
+	dshash_release_lock(pgStatSharedTables, shent);
+
+	/*
+	 * Add per-table stats to the per-database sums, too.
+	 */
+	dbmsg->m_tuples_returned += counts->t_tuples_returned;
+	dbmsg->m_tuples_fetched += counts->t_tuples_fetched;
+	dbmsg->m_tuples_inserted += counts->t_tuples_inserted;
+	dbmsg->m_tuples_updated += counts->t_tuples_updated;
+	dbmsg->m_tuples_deleted += counts->t_tuples_deleted;
+	dbmsg->m_blocks_fetched += counts->t_blocks_fetched;
+	dbmsg->m_blocks_hit += counts->t_blocks_hit;
+}
 
+/*
+ * Subroutine for pgstat_report_stat: finish and send a dbstat message
+ */
+static void
+pgstat_send_dbstat(PgStat_MsgDbstat *dbmsg)
+{
 	/*
 	 * Report and reset accumulated xact commit/rollback and I/O timings
-	 * whenever we send a normal tabstat message
+	 * whenever we send a normal dbstat message
 	 */
-	if (OidIsValid(tsmsg->m_databaseid))
+	if (OidIsValid(dbmsg->m_databaseid))
 	{
-		tsmsg->m_xact_commit = pgStatXactCommit;
-		tsmsg->m_xact_rollback = pgStatXactRollback;
-		tsmsg->m_block_read_time = pgStatBlockReadTime;
-		tsmsg->m_block_write_time = pgStatBlockWriteTime;
+		dbmsg->m_xact_commit = pgStatXactCommit;
+		dbmsg->m_xact_rollback = pgStatXactRollback;
+		dbmsg->m_block_read_time = pgStatBlockReadTime;
+		dbmsg->m_block_write_time = pgStatBlockWriteTime;
 		pgStatXactCommit = 0;
 		pgStatXactRollback = 0;
 		pgStatBlockReadTime = 0;
 		pgStatBlockWriteTime = 0;
 	}
-	else
-	{
-		tsmsg->m_xact_commit = 0;
-		tsmsg->m_xact_rollback = 0;
-		tsmsg->m_block_read_time = 0;
-		tsmsg->m_block_write_time = 0;
-	}
 
-	n = tsmsg->m_nentries;
-	len = offsetof(PgStat_MsgTabstat, m_entry[0]) +
-		n * sizeof(PgStat_TableEntry);
-
-	pgstat_setheader(&tsmsg->m_hdr, PGSTAT_MTYPE_TABSTAT);
-	pgstat_send(tsmsg, len);
+	pgstat_setheader(&dbmsg->m_hdr, PGSTAT_MTYPE_DBSTAT);
+	pgstat_send(dbmsg, sizeof(PgStat_MsgDbstat));
 }
 
 /*
- * Subroutine for pgstat_report_stat: populate and send a function stat message
+ * Subroutine for pgstat_report_stat: flush function stats to shared memory
  */
 static void
-pgstat_send_funcstats(void)
+pgstat_flush_funcstats(void)
 {
 	/* we assume this inits to all zeroes: */
 	static const PgStat_FunctionCounts all_zeroes;
 
-	PgStat_MsgFuncstat msg;
 	PgStat_BackendFunctionEntry *entry;
 	HASH_SEQ_STATUS fstat;
 
 	if (pgStatFunctions == NULL)
 		return;
 
-	pgstat_setheader(&msg.m_hdr, PGSTAT_MTYPE_FUNCSTAT);
-	msg.m_databaseid = MyDatabaseId;
-	msg.m_nentries = 0;
+	pgstat_attach_shared();
 
 	hash_seq_init(&fstat, pgStatFunctions);
 	while ((entry = (PgStat_BackendFunctionEntry *) hash_seq_search(&fstat)) != NULL)
 	{
-		PgStat_FunctionEntry *m_ent;
+		PgStat_SharedKey key;
+		PgStat_SharedFuncEntry *shent;
+		bool		found;
 
 		/* Skip it if no counts accumulated since last time */
 		if (memcmp(&entry->f_counts, &all_zeroes,
 				   sizeof(PgStat_FunctionCounts)) == 0)
 			continue;
 
-		/* need to convert format of time accumulators */
-		m_ent = &msg.m_entry[msg.m_nentries];
-		m_ent->f_id = entry->f_id;
-		m_ent->f_numcalls = entry->f_counts.f_numcalls;
-		m_ent->f_total_time = INSTR_TIME_GET_MICROSEC(entry->f_counts.f_total_time);
-		m_ent->f_self_time = INSTR_TIME_GET_MICROSEC(entry->f_counts.f_self_time);
-
-		if (++msg.m_nentries >= PGSTAT_NUM_FUNCENTRIES)
+		key.databaseid = MyDatabaseId;
+		key.objectid = entry->f_id;
+		shent = dshash_find_or_insert(pgStatSharedFunctions, &key, &found);
+		if (!found)
 		{
-			pgstat_send(&msg, offsetof(PgStat_MsgFuncstat, m_entry[0]) +
-						msg.m_nentries * sizeof(PgStat_FunctionEntry));
-			msg.m_nentries = 0;
+			MemSet(&shent->stats, 0, sizeof(PgStat_StatFuncEntry));
+			shent->stats.functionid = entry->f_id;
 		}
 
+		/* need to convert format of time accumulators */
+		shent->stats.f_numcalls += entry->f_counts.f_numcalls;
+		shent->stats.f_total_time +=
+			INSTR_TIME_GET_MICROSEC(entry->f_counts.f_total_time);
+		shent->stats.f_self_time +=
+			INSTR_TIME_GET_MICROSEC(entry->f_counts.f_self_time);
+
+		dshash_release_lock(pgStatSharedFunctions, shent);
+
 		/* reset the entry's counts */
 		MemSet(&entry->f_counts, 0, sizeof(PgStat_FunctionCounts));
 	}
 
-	if (msg.m_nentries > 0)
-		pgstat_send(&msg, offsetof(PgStat_MsgFuncstat, m_entry[0]) +
-					msg.m_nentries * sizeof(PgStat_FunctionEntry));
-
 	have_function_stats = false;
 }
 
@@ -1019,179 +1289,118 @@ pgstat_send_funcstats(void)
 /* ----------
  * pgstat_vacuum_stat() -
  *
- *	Will tell the collector about objects he can get rid of.
+ *	Get rid of the statistics of objects that no longer exist: the shared
+ *	entries of our own dropped tables and functions, and of any dropped
+ *	database.  Also tells the collector about dead databases.
  * ----------
  */
 void
 pgstat_vacuum_stat(void)
 {
+	HTAB	   *dbids;
 	HTAB	   *htab;
-	PgStat_MsgTabpurge msg;
-	PgStat_MsgFuncpurge f_msg;
 	HASH_SEQ_STATUS hstat;
 	PgStat_StatDBEntry *dbentry;
-	PgStat_StatTabEntry *tabentry;
-	PgStat_StatFuncEntry *funcentry;
-	int			len;
-
-	if (pgStatSock == PGINVALID_SOCKET)
-		return;
-
-	/*
-	 * If not done for this transaction, read the statistics collector stats
-	 * file into some hash tables.
-	 */
-	backend_read_statsfile();
+	dshash_seq_status sstat;
+	PgStat_SharedTabEntry *tabentry;
+	PgStat_SharedFuncEntry *funcentry;
+	bool		have_funcs = false;
 
 	/*
 	 * Read pg_database and make a list of OIDs of all existing databases
 	 */
-	htab = pgstat_collect_oids(DatabaseRelationId, Anum_pg_database_oid);
-
-	/*
-	 * Search the database hash table for dead databases and tell the
-	 * collector to drop them.
-	 */
-	hash_seq_init(&hstat, pgStatDBHash);
-	while ((dbentry = (PgStat_StatDBEntry *) hash_seq_search(&hstat)) != NULL)
-	{
-		Oid			dbid = dbentry->databaseid;
-
-		CHECK_FOR_INTERRUPTS();
-
-		/* the DB entry for shared tables (with InvalidOid) is never dropped */
-		if (OidIsValid(dbid) &&
-			hash_search(htab, (void *) &dbid, HASH_FIND, NULL) == NULL)
-			pgstat_drop_database(dbid);
-	}
-
-	/* Clean up */
-	hash_destroy(htab);
-
-	/*
-	 * Lookup our own database entry; if not found, nothing more to do.
-	 */
-	dbentry = (PgStat_StatDBEntry *) hash_search(pgStatDBHash,
-												 (void *) &MyDatabaseId,
-												 HASH_FIND, NULL);
-	if (dbentry == NULL || dbentry->tables == NULL)
-		return;
-
-	/*
-	 * Similarly to above, make a list of all known relations in this DB.
-	 */
-	htab = pgstat_collect_oids(RelationRelationId, Anum_pg_class_oid);
-
-	/*
-	 * Initialize our messages table counter to zero
-	 */
-	msg.m_nentries = 0;
+	dbids = pgstat_collect_oids(DatabaseRelationId, Anum_pg_database_oid);
 
 	/*
-	 * Check for all tables listed in stats hashtable if they still exist.
+	 * Search the collector's database hash table for dead databases and tell
+	 * the collector to drop them.
 	 */
-	hash_seq_init(&hstat, dbentry->tables);
-	while ((tabentry = (PgStat_StatTabEntry *) hash_seq_search(&hstat)) != NULL)
+	if (pgStatSock != PGINVALID_SOCKET)
 	{
-		Oid			tabid = tabentry->tableid;
-
-		CHECK_FOR_INTERRUPTS();
-
-		if (hash_search(htab, (void *) &tabid, HASH_FIND, NULL) != NULL)
-			continue;
-
 		/*
-		 * Not there, so add this table's Oid to the message
+		 * If not done for this transaction, read the statistics collector
+		 * stats file into some hash tables.
 		 */
-		msg.m_tableid[msg.m_nentries++] = tabid;
+		backend_read_statsfile();
 
-		/*
-		 * If the message is full, send it out and reinitialize to empty
-		 */
-		if (msg.m_nentries >= PGSTAT_NUM_TABPURGE)
+		hash_seq_init(&hstat, pgStatDBHash);
+		while ((dbentry = (PgStat_StatDBEntry *) hash_seq_search(&hstat)) != NULL)
 		{
-			len = offsetof(PgStat_MsgTabpurge, m_tableid[0])
-				+ msg.m_nentries * sizeof(Oid);
+			Oid			dbid = dbentry->databaseid;
 
-			pgstat_setheader(&msg.m_hdr, PGSTAT_MTYPE_TABPURGE);
-			msg.m_databaseid = MyDatabaseId;
-			pgstat_send(&msg, len);
+			CHECK_FOR_INTERRUPTS();
 
-			msg.m_nentries = 0;
+			/* the DB entry for shared tables (with InvalidOid) is never dropped */
+			if (OidIsValid(dbid) &&
+				hash_search(dbids, (void *) &dbid, HASH_FIND, NULL) == NULL)
+				pgstat_drop_database(dbid);
 		}
 	}
 
 	/*
-	 * Send the rest
+	 * Make a list of all known relations in this DB, and remove the shared
+	 * entries of tables that are gone, along with any left behind by dead
+	 * databases.  We can't read the catalogs while holding a partition lock,
+	 * hence the lists are built up front.
 	 */
-	if (msg.m_nentries > 0)
+	htab = pgstat_collect_oids(RelationRelationId, Anum_pg_class_oid);
+
+	pgstat_attach_shared();
+
+	dshash_seq_init(&sstat, pgStatSharedTables, true);
+	while ((tabentry = dshash_seq_next(&sstat)) != NULL)
 	{
-		len = offsetof(PgStat_MsgTabpurge, m_tableid[0])
-			+ msg.m_nentries * sizeof(Oid);
+		Oid			dbid = tabentry->key.databaseid;
+		Oid			tabid = tabentry->key.objectid;
 
-		pgstat_setheader(&msg.m_hdr, PGSTAT_MTYPE_TABPURGE);
-		msg.m_databaseid = MyDatabaseId;
-		pgstat_send(&msg, len);
+		if (dbid == MyDatabaseId)
+		{
+			if (hash_search(htab, (void *) &tabid, HASH_FIND, NULL) == NULL)
+				dshash_delete_current(&sstat);
+		}
+		else if (OidIsValid(dbid) &&
+				 hash_search(dbids, (void *) &dbid, HASH_FIND, NULL) == NULL)
+			dshash_delete_current(&sstat);
 	}
+	dshash_seq_term(&sstat);
 
 	/* Clean up */
 	hash_destroy(htab);
 
 	/*
 	 * Now repeat the above steps for functions.  However, we needn't bother
-	 * in the common case where no function stats are being collected.
+	 * reading pg_proc in the common case where no function stats are being
+	 * collected.
 	 */
-	if (dbentry->functions != NULL &&
-		hash_get_num_entries(dbentry->functions) > 0)
+	dshash_seq_init(&sstat, pgStatSharedFunctions, false);
+	if (dshash_seq_next(&sstat) != NULL)
+		have_funcs = true;
+	dshash_seq_term(&sstat);
+
+	if (have_funcs)
 	{
 		htab = pgstat_collect_oids(ProcedureRelationId, Anum_pg_proc_oid);
 
-		pgstat_setheader(&f_msg.m_hdr, PGSTAT_MTYPE_FUNCPURGE);
-		f_msg.m_databaseid = MyDatabaseId;
-		f_msg.m_nentries = 0;
-
-		hash_seq_init(&hstat, dbentry->functions);
-		while ((funcentry = (PgStat_StatFuncEntry *) hash_seq_search(&hstat)) != NULL)
+		dshash_seq_init(&sstat, pgStatSharedFunctions, true);
+		while ((funcentry = dshash_seq_next(&sstat)) != NULL)
 		{
-			Oid			funcid = funcentry->functionid;
-
-			CHECK_FOR_INTERRUPTS();
-
-			if (hash_search(htab, (void *) &funcid, HASH_FIND, NULL) != NULL)
-				continue;
-
-			/*
-			 * Not there, so add this function's Oid to the message
-			 */
-			f_msg.m_functionid[f_msg.m_nentries++] = funcid;
+			Oid			dbid = funcentry->key.databaseid;
+			Oid			funcid = funcentry->key.objectid;
 
-			/*
-			 * If the message is full, send it out and reinitialize to empty
-			 */
-			if (f_msg.m_nentries >= PGSTAT_NUM_FUNCPURGE)
+			if (dbid == MyDatabaseId)
 			{
-				len = offsetof(PgStat_MsgFuncpurge, m_functionid[0])
-					+ f_msg.m_nentries * sizeof(Oid);
-
-				pgstat_send(&f_msg, len);
-
-				f_msg.m_nentries = 0;
+				if (hash_search(htab, (void *) &funcid, HASH_FIND, NULL) == NULL)
+					dshash_delete_current(&sstat);
 			}
+			else if (hash_search(dbids, (void *) &dbid, HASH_FIND, NULL) == NULL)
+				dshash_delete_current(&sstat);
 		}
-
-		/*
-		 * Send the rest
-		 */
-		if (f_msg.m_nentries > 0)
-		{
-			len = offsetof(PgStat_MsgFuncpurge, m_functionid[0])
-				+ f_msg.m_nentries * sizeof(Oid);
-
-			pgstat_send(&f_msg, len);
-		}
+		dshash_seq_term(&sstat);
 
 		hash_destroy(htab);
 	}
+
+	hash_destroy(dbids);
 }
 
 
@@ -1249,9 +1458,10 @@ pgstat_collect_oids(Oid catalogid, AttrNumber anum_oid)
 /* ----------
  * pgstat_drop_database() -
  *
- *	Tell the collector that we just dropped a database.
- *	(If the message gets lost, we will still clean the dead DB eventually
- *	via future invocations of pgstat_vacuum_stat().)
+ *	Remove the table and function stats of a database we just dropped, and
+ *	tell the collector about it.  (If the message gets lost, we will still
+ *	clean the dead DB eventually via future invocations of
+ *	pgstat_vacuum_stat().)
  * ----------
  */
 void
@@ -1259,6 +1469,8 @@ pgstat_drop_database(Oid databaseid)
 {
 	PgStat_MsgDropdb msg;
 
+	pgstat_purge_shared_entries(databaseid);
+
 	if (pgStatSock == PGINVALID_SOCKET)
 		return;
 
@@ -1271,9 +1483,7 @@ pgstat_drop_database(Oid databaseid)
 /* ----------
  * pgstat_drop_relation() -
  *
- *	Tell the collector that we just dropped a relation.
- *	(If the message gets lost, we will still clean the dead entry eventually
- *	via future invocations of pgstat_vacuum_stat().)
+ *	Remove the stats of a relation we just dropped.
  *
  *	Currently not used for lack of any good place to call it; we rely
  *	entirely on pgstat_vacuum_stat() to clean out stats for dead rels.
@@ -1283,20 +1493,13 @@ pgstat_drop_database(Oid databaseid)
 void
 pgstat_drop_relation(Oid relid)
 {
-	PgStat_MsgTabpurge msg;
-	int			len;
-
-	if (pgStatSock == PGINVALID_SOCKET)
-		return;
+	PgStat_SharedKey key;
 
-	msg.m_tableid[0] = relid;
-	msg.m_nentries = 1;
+	pgstat_attach_shared();
 
-	len = offsetof(PgStat_MsgTabpurge, m_tableid[0]) + sizeof(Oid);
-
-	pgstat_setheader(&msg.m_hdr, PGSTAT_MTYPE_TABPURGE);
-	msg.m_databaseid = MyDatabaseId;
-	pgstat_send(&msg, len);
+	key.databaseid = MyDatabaseId;
+	key.objectid = relid;
+	(void) dshash_delete_key(pgStatSharedTables, &key);
 }
 #endif							/* NOT_USED */
 
@@ -1304,7 +1507,8 @@ pgstat_drop_relation(Oid relid)
 /* ----------
  * pgstat_reset_counters() -
  *
- *	Tell the statistics collector to reset counters for our database.
+ *	Reset the table and function counters of our database, and tell the
+ *	statistics collector to reset the database-wide ones.
  *
  *	Permission checking for this function is managed through the normal
  *	GRANT system.
@@ -1315,6 +1519,8 @@ pgstat_reset_counters(void)
 {
 	PgStat_MsgResetcounter msg;
 
+	pgstat_purge_shared_entries(MyDatabaseId);
+
 	if (pgStatSock == PGINVALID_SOCKET)
 		return;
 
@@ -1337,6 +1543,20 @@ pgstat_reset_shared_counters(const char *target)
 {
 	PgStat_MsgResetsharedcounter msg;
 
+	/* The recovery prefetch counters live in shared memory, not here. */
+	if (strcmp(target, "recovery_prefetch") == 0)
+	{
+		XLogPrefetchRequestResetStats();
+		return;
+	}
+
+	/* So do the LWLock counters. */
+	if (strcmp(target, "lwlock") == 0)
+	{
+		LWLockResetStats();
+		return;
+	}
+
 	if (pgStatSock == PGINVALID_SOCKET)
 		return;
 
@@ -1344,11 +1564,13 @@ pgstat_reset_shared_counters(const char *target)
 		msg.m_resettarget = RESET_ARCHIVER;
 	else if (strcmp(target, "bgwriter") == 0)
 		msg.m_resettarget = RESET_BGWRITER;
+	else if (strcmp(target, "io") == 0)
+		msg.m_resettarget = RESET_IO;
 	else
 		ereport(ERROR,
 				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
 				 errmsg("unrecognized reset target: \"%s\"", target),
-				 errhint("Target must be \"archiver\" or \"bgwriter\".")));
+				 errhint("Target must be \"archiver\", \"bgwriter\", \"io\", \"lwlock\" or \"recovery_prefetch\".")));
 
 	pgstat_setheader(&msg.m_hdr, PGSTAT_MTYPE_RESETSHAREDCOUNTER);
 	pgstat_send(&msg, sizeof(msg));
@@ -1357,7 +1579,8 @@ pgstat_reset_shared_counters(const char *target)
 /* ----------
  * pgstat_reset_single_counter() -
  *
- *	Tell the statistics collector to reset a single counter.
+ *	Reset the counters of a single table or function.  The statistics
+ *	collector is told too, so that it updates the database's reset time.
  *
  *	Permission checking for this function is managed through the normal
  *	GRANT system.
@@ -1367,6 +1590,16 @@ void
 pgstat_reset_single_counter(Oid objoid, PgStat_Single_Reset_Type type)
 {
 	PgStat_MsgResetsinglecounter msg;
+	PgStat_SharedKey key;
+
+	pgstat_attach_shared();
+
+	key.databaseid = MyDatabaseId;
+	key.objectid = objoid;
+	if (type == RESET_TABLE)
+		(void) dshash_delete_key(pgStatSharedTables, &key);
+	else if (type == RESET_FUNCTION)
+		(void) dshash_delete_key(pgStatSharedFunctions, &key);
 
 	if (pgStatSock == PGINVALID_SOCKET)
 		return;
@@ -1406,32 +1639,49 @@ pgstat_report_autovac(Oid dboid)
 /* ---------
  * pgstat_report_vacuum() -
  *
- *	Tell the collector about the table we just vacuumed.
+ *	Record the results of the table we just vacuumed.
  * ---------
  */
 void
 pgstat_report_vacuum(Oid tableoid, bool shared,
 					 PgStat_Counter livetuples, PgStat_Counter deadtuples)
 {
-	PgStat_MsgVacuum msg;
+	PgStat_SharedTabEntry *shent;
+	PgStat_StatTabEntry *tabentry;
+	TimestampTz ts;
 
-	if (pgStatSock == PGINVALID_SOCKET || !pgstat_track_counts)
+	if (!pgstat_track_counts)
 		return;
 
-	pgstat_setheader(&msg.m_hdr, PGSTAT_MTYPE_VACUUM);
-	msg.m_databaseid = shared ? InvalidOid : MyDatabaseId;
-	msg.m_tableoid = tableoid;
-	msg.m_autovacuum = IsAutoVacuumWorkerProcess();
-	msg.m_vacuumtime = GetCurrentTimestamp();
-	msg.m_live_tuples = livetuples;
-	msg.m_dead_tuples = deadtuples;
-	pgstat_send(&msg, sizeof(msg));
+	ts = GetCurrentTimestamp();
+
+	shent = pgstat_get_shared_tabentry(shared ? InvalidOid : MyDatabaseId,
+									   tableoid);
+	tabentry = &shent->stats;
+
+	tabentry->n_live_tuples = livetuples;
+	tabentry->n_dead_tuples = deadtuples;
+	tabentry->zheap_tpd_allocs_at_vacuum = tabentry->zheap_tpd_allocs;
+	tabentry->zheap_undo_bytes_at_vacuum = tabentry->zheap_undo_bytes;
+
+	if (IsAutoVacuumWorkerProcess())
+	{
+		tabentry->autovac_vacuum_timestamp = ts;
+		tabentry->autovac_vacuum_count++;
+	}
+	else
+	{
+		tabentry->vacuum_timestamp = ts;
+		tabentry->vacuum_count++;
+	}
+
+	dshash_release_lock(pgStatSharedTables, shent);
 }
 
 /* --------
  * pgstat_report_analyze() -
  *
- *	Tell the collector about the table we just analyzed.
+ *	Record the results of the table we just analyzed.
  *
  * Caller must provide new live- and dead-tuples estimates, as well as a
  * flag indicating whether to reset the changes_since_analyze counter.
@@ -1442,9 +1692,11 @@ pgstat_report_analyze(Relation rel,
 					  PgStat_Counter livetuples, PgStat_Counter deadtuples,
 					  bool resetcounter)
 {
-	PgStat_MsgAnalyze msg;
+	PgStat_SharedTabEntry *shent;
+	PgStat_StatTabEntry *tabentry;
+	TimestampTz ts;
 
-	if (pgStatSock == PGINVALID_SOCKET || !pgstat_track_counts)
+	if (!pgstat_track_counts)
 		return;
 
 	/*
@@ -1452,10 +1704,9 @@ pgstat_report_analyze(Relation rel,
 	 * already inserted and/or deleted rows in the target table. ANALYZE will
 	 * have counted such rows as live or dead respectively. Because we will
 	 * report our counts of such rows at transaction end, we should subtract
-	 * off these counts from what we send to the collector now, else they'll
-	 * be double-counted after commit.  (This approach also ensures that the
-	 * collector ends up with the right numbers if we abort instead of
-	 * committing.)
+	 * off these counts from what we store now, else they'll be double-counted
+	 * after commit.  (This approach also ensures that the shared entry ends
+	 * up with the right numbers if we abort instead of committing.)
 	 */
 	if (rel->pgstat_info != NULL)
 	{
@@ -1474,15 +1725,36 @@ pgstat_report_analyze(Relation rel,
 		deadtuples = Max(deadtuples, 0);
 	}
 
-	pgstat_setheader(&msg.m_hdr, PGSTAT_MTYPE_ANALYZE);
-	msg.m_databaseid = rel->rd_rel->relisshared ? InvalidOid : MyDatabaseId;
-	msg.m_tableoid = RelationGetRelid(rel);
-	msg.m_autovacuum = IsAutoVacuumWorkerProcess();
-	msg.m_resetcounter = resetcounter;
-	msg.m_analyzetime = GetCurrentTimestamp();
-	msg.m_live_tuples = livetuples;
-	msg.m_dead_tuples = deadtuples;
-	pgstat_send(&msg, sizeof(msg));
+	ts = GetCurrentTimestamp();
+
+	shent = pgstat_get_shared_tabentry(rel->rd_rel->relisshared ?
+									   InvalidOid : MyDatabaseId,
+									   RelationGetRelid(rel));
+	tabentry = &shent->stats;
+
+	tabentry->n_live_tuples = livetuples;
+	tabentry->n_dead_tuples = deadtuples;
+
+	/*
+	 * If commanded, reset changes_since_analyze to zero.  This forgets any
+	 * changes that were committed while the ANALYZE was in progress, but we
+	 * have no good way to estimate how many of those there were.
+	 */
+	if (resetcounter)
+		tabentry->changes_since_analyze = 0;
+
+	if (IsAutoVacuumWorkerProcess())
+	{
+		tabentry->autovac_analyze_timestamp = ts;
+		tabentry->autovac_analyze_count++;
+	}
+	else
+	{
+		tabentry->analyze_timestamp = ts;
+		tabentry->analyze_count++;
+	}
+
+	dshash_release_lock(pgStatSharedTables, shent);
 }
 
 /* --------
@@ -2489,56 +2761,82 @@ pgstat_fetch_stat_dbentry(Oid dbid)
  *
  *	Support function for the SQL-callable pgstat* functions. Returns
  *	the collected statistics for one table or NULL. NULL doesn't mean
- *	that the table doesn't exist, it is just not yet known by the
- *	collector, so the caller is better off to report ZERO instead.
+ *	that the table doesn't exist, it just has no counts yet, so the
+ *	caller is better off to report ZERO instead.
  * ----------
  */
 PgStat_StatTabEntry *
 pgstat_fetch_stat_tabentry(Oid relid)
 {
-	Oid			dbid;
-	PgStat_StatDBEntry *dbentry;
 	PgStat_StatTabEntry *tabentry;
 
-	/*
-	 * If not done for this transaction, read the statistics collector stats
-	 * file into some hash tables.
-	 */
-	backend_read_statsfile();
-
-	/*
-	 * Lookup our database, then look in its table hash table.
-	 */
-	dbid = MyDatabaseId;
-	dbentry = (PgStat_StatDBEntry *) hash_search(pgStatDBHash,
-												 (void *) &dbid,
-												 HASH_FIND, NULL);
-	if (dbentry != NULL && dbentry->tables != NULL)
-	{
-		tabentry = (PgStat_StatTabEntry *) hash_search(dbentry->tables,
-													   (void *) &relid,
-													   HASH_FIND, NULL);
-		if (tabentry)
-			return tabentry;
-	}
+	tabentry = pgstat_fetch_stat_tabentry_ext(false, relid);
+	if (tabentry != NULL)
+		return tabentry;
 
 	/*
 	 * If we didn't find it, maybe it's a shared table.
 	 */
-	dbid = InvalidOid;
-	dbentry = (PgStat_StatDBEntry *) hash_search(pgStatDBHash,
-												 (void *) &dbid,
-												 HASH_FIND, NULL);
-	if (dbentry != NULL && dbentry->tables != NULL)
-	{
-		tabentry = (PgStat_StatTabEntry *) hash_search(dbentry->tables,
-													   (void *) &relid,
-													   HASH_FIND, NULL);
-		if (tabentry)
-			return tabentry;
+	return pgstat_fetch_stat_tabentry_ext(true, relid);
+}
+
+
+/* ----------
+ * pgstat_fetch_stat_tabentry_ext() -
+ *
+ *	Like pgstat_fetch_stat_tabentry, but for callers that know whether the
+ *	table is a shared catalog.  The first lookup of a table in a transaction
+ *	copies its shared entry into local memory, and later lookups return that
+ *	copy until pgstat_clear_snapshot().
+ * ----------
+ */
+PgStat_StatTabEntry *
+pgstat_fetch_stat_tabentry_ext(bool shared, Oid relid)
+{
+	PgStat_SharedKey key;
+	PgStat_SharedTabEntry *shent;
+	PgStat_SharedTabEntry *localent;
+	PgStat_StatTabEntry stats;
+
+	key.databaseid = shared ? InvalidOid : MyDatabaseId;
+	key.objectid = relid;
+
+	pgstat_setup_memcxt();
+
+	if (pgStatLocalTables == NULL)
+	{
+		HASHCTL		hash_ctl;
+
+		memset(&hash_ctl, 0, sizeof(hash_ctl));
+		hash_ctl.keysize = sizeof(PgStat_SharedKey);
+		hash_ctl.entrysize = sizeof(PgStat_SharedTabEntry);
+		hash_ctl.hcxt = pgStatLocalContext;
+		pgStatLocalTables = hash_create("Table stat entries",
+										PGSTAT_TAB_HASH_SIZE,
+										&hash_ctl,
+										HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
 	}
 
-	return NULL;
+	localent = (PgStat_SharedTabEntry *) hash_search(pgStatLocalTables,
+													 (void *) &key,
+													 HASH_FIND, NULL);
+	if (localent != NULL)
+		return &localent->stats;
+
+	pgstat_attach_shared();
+
+	shent = dshash_find(pgStatSharedTables, &key, false);
+	if (shent == NULL)
+		return NULL;
+	memcpy(&stats, &shent->stats, sizeof(PgStat_StatTabEntry));
+	dshash_release_lock(pgStatSharedTables, shent);
+
+	localent = (PgStat_SharedTabEntry *) hash_search(pgStatLocalTables,
+													 (void *) &key,
+													 HASH_ENTER, NULL);
+	memcpy(&localent->stats, &stats, sizeof(PgStat_StatTabEntry));
+
+	return &localent->stats;
 }
 
 
@@ -2546,28 +2844,57 @@ pgstat_fetch_stat_tabentry(Oid relid)
  * pgstat_fetch_stat_funcentry() -
  *
  *	Support function for the SQL-callable pgstat* functions. Returns
- *	the collected statistics for one function or NULL.
+ *	the collected statistics for one function or NULL.  As for tables, the
+ *	value seen first in a transaction is kept until pgstat_clear_snapshot().
  * ----------
  */
 PgStat_StatFuncEntry *
 pgstat_fetch_stat_funcentry(Oid func_id)
 {
-	PgStat_StatDBEntry *dbentry;
-	PgStat_StatFuncEntry *funcentry = NULL;
+	PgStat_SharedKey key;
+	PgStat_SharedFuncEntry *shent;
+	PgStat_SharedFuncEntry *localent;
+	PgStat_StatFuncEntry stats;
 
-	/* load the stats file if needed */
-	backend_read_statsfile();
+	key.databaseid = MyDatabaseId;
+	key.objectid = func_id;
+
+	pgstat_setup_memcxt();
 
-	/* Lookup our database, then find the requested function.  */
-	dbentry = pgstat_fetch_stat_dbentry(MyDatabaseId);
-	if (dbentry != NULL && dbentry->functions != NULL)
+	if (pgStatLocalFunctions == NULL)
 	{
-		funcentry = (PgStat_StatFuncEntry *) hash_search(dbentry->functions,
-														 (void *) &func_id,
-														 HASH_FIND, NULL);
+		HASHCTL		hash_ctl;
+
+		memset(&hash_ctl, 0, sizeof(hash_ctl));
+		hash_ctl.keysize = sizeof(PgStat_SharedKey);
+		hash_ctl.entrysize = sizeof(PgStat_SharedFuncEntry);
+		hash_ctl.hcxt = pgStatLocalContext;
+		pgStatLocalFunctions = hash_create("Function stat entries",
+										   PGSTAT_FUNCTION_HASH_SIZE,
+										   &hash_ctl,
+										   HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
 	}
 
-	return funcentry;
+	localent = (PgStat_SharedFuncEntry *) hash_search(pgStatLocalFunctions,
+													  (void *) &key,
+													  HASH_FIND, NULL);
+	if (localent != NULL)
+		return &localent->stats;
+
+	pgstat_attach_shared();
+
+	shent = dshash_find(pgStatSharedFunctions, &key, false);
+	if (shent == NULL)
+		return NULL;
+	memcpy(&stats, &shent->stats, sizeof(PgStat_StatFuncEntry));
+	dshash_release_lock(pgStatSharedFunctions, shent);
+
+	localent = (PgStat_SharedFuncEntry *) hash_search(pgStatLocalFunctions,
+													  (void *) &key,
+													  HASH_ENTER, NULL);
+	memcpy(&localent->stats, &stats, sizeof(PgStat_StatFuncEntry));
+
+	return &localent->stats;
 }
 
 
@@ -2663,6 +2990,22 @@ pgstat_fetch_global(void)
 	return &globalStats;
 }
 
+/*
+ * ---------
+ * pgstat_fetch_stat_io() -
+ *
+ *	Support function for the SQL-callable pgstat* functions. Returns
+ *	a pointer to the I/O statistics struct.
+ * ---------
+ */
+PgStat_IOStats *
+pgstat_fetch_stat_io(void)
+{
+	backend_read_statsfile();
+
+	return &ioStats;
+}
+
 
 /* ------------------------------------------------------------
  * Functions for management of the shared-memory PgBackendStatus array
@@ -3131,6 +3474,9 @@ pgstat_beshutdown_hook(int code, Datum arg)
 	if (OidIsValid(MyDatabaseId))
 		pgstat_report_stat(true);
 
+	/* I/O counts don't belong to a database, so report them in any case */
+	pgstat_send_io(true);
+
 	/*
 	 * Clear my status entry, following the protocol of bumping st_changecount
 	 * before and after.  We use a volatile pointer here to ensure the
@@ -3681,6 +4027,9 @@ pgstat_get_wait_activity(WaitEventActivity w)
 
 	switch (w)
 	{
+		case WAIT_EVENT_AIO_WORKER_MAIN:
+			event_name = "AioWorkerMain";
+			break;
 		case WAIT_EVENT_ARCHIVER_MAIN:
 			event_name = "ArchiverMain";
 			break;
@@ -3702,6 +4051,12 @@ pgstat_get_wait_activity(WaitEventActivity w)
 		case WAIT_EVENT_LOGICAL_LAUNCHER_MAIN:
 			event_name = "LogicalLauncherMain";
 			break;
+		case WAIT_EVENT_LOGICAL_PARALLEL_APPLY_MAIN:
+			event_name = "LogicalParallelApplyMain";
+			break;
+		case WAIT_EVENT_PARALLEL_WORKER_POOL_MAIN:
+			event_name = "ParallelWorkerPoolMain";
+			break;
 		case WAIT_EVENT_PGSTAT_MAIN:
 			event_name = "PgStatMain";
 			break;
@@ -3731,6 +4086,9 @@ pgstat_get_wait_activity(WaitEventActivity w)
 			break;
 		case WAIT_EVENT_UNDO_WORKER_MAIN:
 			event_name = "UndoWorkerMain";
+			break;
+		case WAIT_EVENT_WAL_SUMMARIZER_MAIN:
+			event_name = "WalSummarizerMain";
 			/* no default case, so that compiler will warn */
 	}
 
@@ -3796,6 +4154,9 @@ pgstat_get_wait_ipc(WaitEventIPC w)
 
 	switch (w)
 	{
+		case WAIT_EVENT_APPEND_READY:
+			event_name = "AppendReady";
+			break;
 		case WAIT_EVENT_BGWORKER_SHUTDOWN:
 			event_name = "BgWorkerShutdown";
 			break;
@@ -3862,6 +4223,12 @@ pgstat_get_wait_ipc(WaitEventIPC w)
 		case WAIT_EVENT_HASH_GROW_BUCKETS_REINSERTING:
 			event_name = "Hash/GrowBuckets/Reinserting";
 			break;
+		case WAIT_EVENT_HASHAGG_PARTITIONING:
+			event_name = "HashAgg/Partitioning";
+			break;
+		case WAIT_EVENT_LOGICAL_PARALLEL_APPLY_STATE_CHANGE:
+			event_name = "LogicalParallelApplyStateChange";
+			break;
 		case WAIT_EVENT_LOGICAL_SYNC_DATA:
 			event_name = "LogicalSyncData";
 			break;
@@ -3883,12 +4250,24 @@ pgstat_get_wait_ipc(WaitEventIPC w)
 		case WAIT_EVENT_PARALLEL_BITMAP_SCAN:
 			event_name = "ParallelBitmapScan";
 			break;
+		case WAIT_EVENT_PARALLEL_CLUSTER_SCAN:
+			event_name = "ParallelClusterScan";
+			break;
+		case WAIT_EVENT_PARALLEL_COPY_FREE:
+			event_name = "ParallelCopyFree";
+			break;
+		case WAIT_EVENT_PARALLEL_COPY_INPUT:
+			event_name = "ParallelCopyInput";
+			break;
 		case WAIT_EVENT_PARALLEL_CREATE_INDEX_SCAN:
 			event_name = "ParallelCreateIndexScan";
 			break;
 		case WAIT_EVENT_PARALLEL_FINISH:
 			event_name = "ParallelFinish";
 			break;
+		case WAIT_EVENT_PARALLEL_ZHEAP_REWRITE:
+			event_name = "ParallelZHeapRewrite";
+			break;
 		case WAIT_EVENT_PROCARRAY_GROUP_UPDATE:
 			event_name = "ProcArrayGroupUpdate";
 			break;
@@ -3907,6 +4286,9 @@ pgstat_get_wait_ipc(WaitEventIPC w)
 		case WAIT_EVENT_SYNC_REP:
 			event_name = "SyncRep";
 			break;
+		case WAIT_EVENT_WAL_SUMMARY_READY:
+			event_name = "WalSummaryReady";
+			break;
 			/* no default case, so that compiler will warn */
 	}
 
@@ -4146,6 +4528,12 @@ pgstat_get_wait_io(WaitEventIO w)
 		case WAIT_EVENT_UNDO_FILE_SYNC:
 			event_name = "UndoFileSync";
 			break;
+		case WAIT_EVENT_UNDO_SPOOL_READ:
+			event_name = "UndoSpoolRead";
+			break;
+		case WAIT_EVENT_UNDO_SPOOL_WRITE:
+			event_name = "UndoSpoolWrite";
+			break;
 
 		case WAIT_EVENT_WALSENDER_TIMELINE_HISTORY_READ:
 			event_name = "WALSenderTimelineHistoryRead";
@@ -4389,6 +4777,64 @@ pgstat_get_backend_desc(BackendType backendType)
 	return backendDesc;
 }
 
+const char *
+pgstat_get_io_backend_desc(IOBackendType type)
+{
+	/* the process types known to pg_stat_activity are numbered alike */
+	StaticAssertStmt((int) IOBACKEND_WAL_WRITER == (int) B_WAL_WRITER,
+					 "IOBackendType does not match BackendType");
+
+	switch (type)
+	{
+		case IOBACKEND_UNDO_LAUNCHER:
+			return "undo worker launcher";
+		case IOBACKEND_UNDO_WORKER:
+			return "undo apply worker";
+		case IOBACKEND_DISCARD_WORKER:
+			return "discard worker";
+		default:
+			return pgstat_get_backend_desc((BackendType) type);
+	}
+}
+
+const char *
+pgstat_get_io_object_desc(IOObject io_object)
+{
+	switch (io_object)
+	{
+		case IOOBJECT_RELATION:
+			return "relation";
+		case IOOBJECT_TEMP_RELATION:
+			return "temp relation";
+		case IOOBJECT_UNDO:
+			return "undo";
+		case IOOBJECT_TEMP_FILE:
+			return "temp file";
+		case IOOBJECT_WAL:
+			return "wal";
+	}
+
+	return "unknown";
+}
+
+const char *
+pgstat_get_io_context_desc(IOContext io_context)
+{
+	switch (io_context)
+	{
+		case IOCONTEXT_NORMAL:
+			return "normal";
+		case IOCONTEXT_VACUUM:
+			return "vacuum";
+		case IOCONTEXT_BULKREAD:
+			return "bulkread";
+		case IOCONTEXT_BULKWRITE:
+			return "bulkwrite";
+	}
+
+	return "unknown";
+}
+
 /* ------------------------------------------------------------
  * Local support functions follow
  * ------------------------------------------------------------
@@ -4491,6 +4937,153 @@ pgstat_send_bgwriter(void)
 	MemSet(&BgWriterStats, 0, sizeof(BgWriterStats));
 }
 
+/* ----------
+ * pgstat_io_start() -
+ *
+ *		Return the start time of an I/O operation to pass to
+ *		pgstat_count_io(), or zero if I/O timing is not tracked.
+ * ----------
+ */
+instr_time
+pgstat_io_start(void)
+{
+	instr_time	start;
+
+	if (track_io_timing)
+		INSTR_TIME_SET_CURRENT(start);
+	else
+		INSTR_TIME_SET_ZERO(start);
+
+	return start;
+}
+
+/* ----------
+ * pgstat_count_io() -
+ *
+ *		Count "cnt" blocks of I/O done by this process in one operation
+ *		started at "start".  The second half of an operation that is started
+ *		and waited for separately passes a count of zero.
+ * ----------
+ */
+void
+pgstat_count_io(IOObject io_object, IOContext io_context, IOOp io_op,
+				int cnt, instr_time start)
+{
+	PgStat_IOCounts *pending = &pgStatPendingIO[io_object];
+
+	/* Only relation data is read through buffer access strategies */
+	if (io_object != IOOBJECT_RELATION)
+		io_context = IOCONTEXT_NORMAL;
+
+	pending->counts[io_context][io_op] += cnt;
+
+	if (!INSTR_TIME_IS_ZERO(start))
+	{
+		instr_time	elapsed;
+
+		INSTR_TIME_SET_CURRENT(elapsed);
+		INSTR_TIME_SUBTRACT(elapsed, start);
+		pending->times[io_context][io_op] += INSTR_TIME_GET_MICROSEC(elapsed);
+	}
+
+	have_io_stats = true;
+}
+
+/*
+ * Work out which kind of process we are for the I/O statistics.  This
+ * follows pgstat_bestart(), but tells the undo workers apart from other
+ * background workers.
+ */
+static IOBackendType
+pgstat_io_backend_type(void)
+{
+	switch (MyAuxProcType)
+	{
+		case StartupProcess:
+			return IOBACKEND_STARTUP;
+		case BgWriterProcess:
+			return IOBACKEND_BG_WRITER;
+		case CheckpointerProcess:
+			return IOBACKEND_CHECKPOINTER;
+		case WalWriterProcess:
+			return IOBACKEND_WAL_WRITER;
+		case WalReceiverProcess:
+			return IOBACKEND_WAL_RECEIVER;
+		default:
+			break;
+	}
+
+	if (IsAutoVacuumLauncherProcess())
+		return IOBACKEND_AUTOVAC_LAUNCHER;
+	if (IsAutoVacuumWorkerProcess())
+		return IOBACKEND_AUTOVAC_WORKER;
+	if (am_walsender)
+		return IOBACKEND_WAL_SENDER;
+	if (IsBackgroundWorker)
+	{
+		const char *function_name = MyBgworkerEntry->bgw_function_name;
+
+		if (strcmp(function_name, "UndoLauncherMain") == 0)
+			return IOBACKEND_UNDO_LAUNCHER;
+		if (strcmp(function_name, "UndoWorkerMain") == 0)
+			return IOBACKEND_UNDO_WORKER;
+		if (strcmp(function_name, "DiscardWorkerMain") == 0)
+			return IOBACKEND_DISCARD_WORKER;
+		return IOBACKEND_BG_WORKER;
+	}
+	return IOBACKEND_BACKEND;
+}
+
+/* ----------
+ * pgstat_send_io() -
+ *
+ *		Send the I/O statistics of this process to the collector, at most
+ *		once every PGSTAT_STAT_INTERVAL unless "force" is set.
+ * ----------
+ */
+void
+pgstat_send_io(bool force)
+{
+	/* We assume this initializes to zeroes */
+	static const PgStat_IOCounts all_zeroes;
+	static TimestampTz last_report = 0;
+	PgStat_MsgIO msg;
+	int			i;
+
+	if (!have_io_stats || pgStatSock == PGINVALID_SOCKET)
+		return;
+
+	if (!force)
+	{
+		TimestampTz now = GetCurrentTimestamp();
+
+		if (!TimestampDifferenceExceeds(last_report, now,
+										PGSTAT_STAT_INTERVAL))
+			return;
+		last_report = now;
+	}
+
+	/*
+	 * The counts of all objects together don't fit in one message, so send
+	 * one per object that had any I/O.
+	 */
+	msg.m_backend_type = pgstat_io_backend_type();
+	for (i = 0; i < IOOBJECT_NUM_TYPES; i++)
+	{
+		if (memcmp(&pgStatPendingIO[i], &all_zeroes,
+				   sizeof(PgStat_IOCounts)) == 0)
+			continue;
+
+		pgstat_setheader(&msg.m_hdr, PGSTAT_MTYPE_IO);
+		msg.m_object = (IOObject) i;
+		memcpy(&msg.m_counts, &pgStatPendingIO[i], sizeof(PgStat_IOCounts));
+		pgstat_send(&msg, sizeof(msg));
+	}
+
+	MemSet(pgStatPendingIO, 0, sizeof(pgStatPendingIO));
+	have_io_stats = false;
+}
+
 
 /* ----------
  * PgstatCollectorMain() -
@@ -4534,7 +5127,7 @@ PgstatCollectorMain(int argc, char *argv[])
 	 * Read in existing stats files or initialize the stats to zero.
 	 */
 	pgStatRunningInCollector = true;
-	pgStatDBHash = pgstat_read_statsfiles(InvalidOid, true, true);
+	pgStatDBHash = pgstat_read_statsfiles(true);
 
 	/*
 	 * Loop to process messages until we get SIGQUIT or detect ungraceful
@@ -4635,12 +5228,8 @@ PgstatCollectorMain(int argc, char *argv[])
 					pgstat_recv_inquiry(&msg.msg_inquiry, len);
 					break;
 
-				case PGSTAT_MTYPE_TABSTAT:
-					pgstat_recv_tabstat(&msg.msg_tabstat, len);
-					break;
-
-				case PGSTAT_MTYPE_TABPURGE:
-					pgstat_recv_tabpurge(&msg.msg_tabpurge, len);
+				case PGSTAT_MTYPE_DBSTAT:
+					pgstat_recv_dbstat(&msg.msg_dbstat, len);
 					break;
 
 				case PGSTAT_MTYPE_DROPDB:
@@ -4667,14 +5256,6 @@ PgstatCollectorMain(int argc, char *argv[])
 					pgstat_recv_autovac(&msg.msg_autovacuum_start, len);
 					break;
 
-				case PGSTAT_MTYPE_VACUUM:
-					pgstat_recv_vacuum(&msg.msg_vacuum, len);
-					break;
-
-				case PGSTAT_MTYPE_ANALYZE:
-					pgstat_recv_analyze(&msg.msg_analyze, len);
-					break;
-
 				case PGSTAT_MTYPE_ARCHIVER:
 					pgstat_recv_archiver(&msg.msg_archiver, len);
 					break;
@@ -4683,12 +5264,8 @@ PgstatCollectorMain(int argc, char *argv[])
 					pgstat_recv_bgwriter(&msg.msg_bgwriter, len);
 					break;
 
-				case PGSTAT_MTYPE_FUNCSTAT:
-					pgstat_recv_funcstat(&msg.msg_funcstat, len);
-					break;
-
-				case PGSTAT_MTYPE_FUNCPURGE:
-					pgstat_recv_funcpurge(&msg.msg_funcpurge, len);
+				case PGSTAT_MTYPE_IO:
+					pgstat_recv_io(&msg.msg_io, len);
 					break;
 
 				case PGSTAT_MTYPE_RECOVERYCONFLICT:
@@ -4784,14 +5361,10 @@ pgstat_sighup_handler(SIGNAL_ARGS)
 
 /*
  * Subroutine to clear stats in a database entry
- *
- * Tables and functions hashes are initialized to empty.
  */
 static void
 reset_dbentry_counters(PgStat_StatDBEntry *dbentry)
 {
-	HASHCTL		hash_ctl;
-
 	dbentry->n_xact_commit = 0;
 	dbentry->n_xact_rollback = 0;
 	dbentry->n_blocks_fetched = 0;
@@ -4817,21 +5390,6 @@ reset_dbentry_counters(PgStat_StatDBEntry *dbentry)
 
 	dbentry->stat_reset_timestamp = GetCurrentTimestamp();
 	dbentry->stats_timestamp = 0;
-
-	memset(&hash_ctl, 0, sizeof(hash_ctl));
-	hash_ctl.keysize = sizeof(Oid);
-	hash_ctl.entrysize = sizeof(PgStat_StatTabEntry);
-	dbentry->tables = hash_create("Per-database table",
-								  PGSTAT_TAB_HASH_SIZE,
-								  &hash_ctl,
-								  HASH_ELEM | HASH_BLOBS);
-
-	hash_ctl.keysize = sizeof(Oid);
-	hash_ctl.entrysize = sizeof(PgStat_StatFuncEntry);
-	dbentry->functions = hash_create("Per-database function",
-									 PGSTAT_FUNCTION_HASH_SIZE,
-									 &hash_ctl,
-									 HASH_ELEM | HASH_BLOBS);
 }
 
 /*
@@ -4854,61 +5412,9 @@ pgstat_get_db_entry(Oid databaseid, bool create)
 	if (!create && !found)
 		return NULL;
 
-	/*
-	 * If not found, initialize the new one.  This creates empty hash tables
-	 * for tables and functions, too.
-	 */
-	if (!found)
-		reset_dbentry_counters(result);
-
-	return result;
-}
-
-
-/*
- * Lookup the hash table entry for the specified table. If no hash
- * table entry exists, initialize it, if the create parameter is true.
- * Else, return NULL.
- */
-static PgStat_StatTabEntry *
-pgstat_get_tab_entry(PgStat_StatDBEntry *dbentry, Oid tableoid, bool create)
-{
-	PgStat_StatTabEntry *result;
-	bool		found;
-	HASHACTION	action = (create ? HASH_ENTER : HASH_FIND);
-
-	/* Lookup or create the hash table entry for this table */
-	result = (PgStat_StatTabEntry *) hash_search(dbentry->tables,
-												 &tableoid,
-												 action, &found);
-
-	if (!create && !found)
-		return NULL;
-
 	/* If not found, initialize the new one. */
 	if (!found)
-	{
-		result->numscans = 0;
-		result->tuples_returned = 0;
-		result->tuples_fetched = 0;
-		result->tuples_inserted = 0;
-		result->tuples_updated = 0;
-		result->tuples_deleted = 0;
-		result->tuples_hot_updated = 0;
-		result->n_live_tuples = 0;
-		result->n_dead_tuples = 0;
-		result->changes_since_analyze = 0;
-		result->blocks_fetched = 0;
-		result->blocks_hit = 0;
-		result->vacuum_timestamp = 0;
-		result->vacuum_count = 0;
-		result->autovac_vacuum_timestamp = 0;
-		result->autovac_vacuum_count = 0;
-		result->analyze_timestamp = 0;
-		result->analyze_count = 0;
-		result->autovac_analyze_timestamp = 0;
-		result->autovac_analyze_count = 0;
-	}
+		reset_dbentry_counters(result);
 
 	return result;
 }
@@ -4916,16 +5422,17 @@ pgstat_get_tab_entry(PgStat_StatDBEntry *dbentry, Oid tableoid, bool create)
 
 /* ----------
  * pgstat_write_statsfiles() -
- *		Write the global statistics file, as well as requested DB files.
+ *		Write the global statistics file.
  *
  *	'permanent' specifies writing to the permanent files not temporary ones.
  *	When true (happens only when the collector is shutting down), also remove
  *	the temporary files so that backends starting up under a new postmaster
  *	can't read old data before the new collector is ready.
  *
- *	When 'allDbs' is false, only the requested databases (listed in
- *	pending_write_requests) will be written; otherwise, all databases
- *	will be written.
+ *	The databases listed in pending_write_requests, or all of them if
+ *	'allDbs' is true, get their timestamp advanced, which is what the
+ *	requesting backends wait for.  (Table and function stats are kept in
+ *	shared memory and are not written here; see pgstat_write_object_stats.)
  * ----------
  */
 static void
@@ -4978,30 +5485,27 @@ pgstat_write_statsfiles(bool permanent, bool allDbs)
 	rc = fwrite(&archiverStats, sizeof(archiverStats), 1, fpout);
 	(void) rc;					/* we'll check for error with ferror */
 
+	/*
+	 * Write I/O stats struct
+	 */
+	rc = fwrite(&ioStats, sizeof(ioStats), 1, fpout);
+	(void) rc;					/* we'll check for error with ferror */
+
 	/*
 	 * Walk through the database table.
 	 */
 	hash_seq_init(&hstat, pgStatDBHash);
 	while ((dbentry = (PgStat_StatDBEntry *) hash_seq_search(&hstat)) != NULL)
 	{
-		/*
-		 * Write out the table and function stats for this DB into the
-		 * appropriate per-DB stat file, if required.
-		 */
+		/* Make requested DBs' timestamp consistent with the global stats */
 		if (allDbs || pgstat_db_requested(dbentry->databaseid))
-		{
-			/* Make DB's timestamp consistent with the global stats */
 			dbentry->stats_timestamp = globalStats.stats_timestamp;
 
-			pgstat_write_db_statsfile(dbentry, permanent);
-		}
-
 		/*
-		 * Write out the DB entry. We don't write the tables or functions
-		 * pointers, since they're of no use to any other process.
+		 * Write out the DB entry.
 		 */
 		fputc('D', fpout);
-		rc = fwrite(dbentry, offsetof(PgStat_StatDBEntry, tables), 1, fpout);
+		rc = fwrite(dbentry, sizeof(PgStat_StatDBEntry), 1, fpout);
 		(void) rc;				/* we'll check for error with ferror */
 	}
 
@@ -5049,192 +5553,52 @@ pgstat_write_statsfiles(bool permanent, bool allDbs)
 	pending_write_requests = NIL;
 }
 
-/*
- * return the filename for a DB stat file; filename is the output buffer,
- * of length len.
- */
-static void
-get_dbstat_filename(bool permanent, bool tempname, Oid databaseid,
-					char *filename, int len)
-{
-	int			printed;
-
-	/* NB -- pgstat_reset_remove_files knows about the pattern this uses */
-	printed = snprintf(filename, len, "%s/db_%u.%s",
-					   permanent ? PGSTAT_STAT_PERMANENT_DIRECTORY :
-					   pgstat_stat_directory,
-					   databaseid,
-					   tempname ? "tmp" : "stat");
-	if (printed >= len)
-		elog(ERROR, "overlength pgstat path");
-}
-
 /* ----------
- * pgstat_write_db_statsfile() -
- *		Write the stat file for a single database.
+ * pgstat_read_statsfiles() -
+ *
+ *	Reads in the existing statistics collector file and returns the
+ *	databases hash table that is the top level of the data.
  *
- *	If writing to the permanent file (happens when the collector is
- *	shutting down only), remove the temporary file so that backends
- *	starting up under a new postmaster can't read the old data before
- *	the new collector is ready.
+ *	'permanent' specifies reading from the permanent file not temporary one.
+ *	When true (happens only when the collector is starting up), remove the
+ *	file after reading; the in-memory status is now authoritative, and the
+ *	file would be out of date in case somebody else reads it.
  * ----------
  */
-static void
-pgstat_write_db_statsfile(PgStat_StatDBEntry *dbentry, bool permanent)
+static HTAB *
+pgstat_read_statsfiles(bool permanent)
 {
-	HASH_SEQ_STATUS tstat;
-	HASH_SEQ_STATUS fstat;
-	PgStat_StatTabEntry *tabentry;
-	PgStat_StatFuncEntry *funcentry;
-	FILE	   *fpout;
+	PgStat_StatDBEntry *dbentry;
+	PgStat_StatDBEntry dbbuf;
+	HASHCTL		hash_ctl;
+	HTAB	   *dbhash;
+	FILE	   *fpin;
 	int32		format_id;
-	Oid			dbid = dbentry->databaseid;
-	int			rc;
-	char		tmpfile[MAXPGPATH];
-	char		statfile[MAXPGPATH];
-
-	get_dbstat_filename(permanent, true, dbid, tmpfile, MAXPGPATH);
-	get_dbstat_filename(permanent, false, dbid, statfile, MAXPGPATH);
-
-	elog(DEBUG2, "writing stats file \"%s\"", statfile);
+	bool		found;
+	const char *statfile = permanent ? PGSTAT_STAT_PERMANENT_FILENAME : pgstat_stat_filename;
 
 	/*
-	 * Open the statistics temp file to write out the current values.
+	 * The tables will live in pgStatLocalContext.
 	 */
-	fpout = AllocateFile(tmpfile, PG_BINARY_W);
-	if (fpout == NULL)
-	{
-		ereport(LOG,
-				(errcode_for_file_access(),
-				 errmsg("could not open temporary statistics file \"%s\": %m",
-						tmpfile)));
-		return;
-	}
+	pgstat_setup_memcxt();
 
 	/*
-	 * Write the file header --- currently just a format ID.
+	 * Create the DB hashtable
 	 */
-	format_id = PGSTAT_FILE_FORMAT_ID;
-	rc = fwrite(&format_id, sizeof(format_id), 1, fpout);
-	(void) rc;					/* we'll check for error with ferror */
+	memset(&hash_ctl, 0, sizeof(hash_ctl));
+	hash_ctl.keysize = sizeof(Oid);
+	hash_ctl.entrysize = sizeof(PgStat_StatDBEntry);
+	hash_ctl.hcxt = pgStatLocalContext;
+	dbhash = hash_create("Databases hash", PGSTAT_DB_HASH_SIZE, &hash_ctl,
+						 HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
 
 	/*
-	 * Walk through the database's access stats per table.
+	 * Clear out global and archiver statistics so they start from zero in
+	 * case we can't load an existing statsfile.
 	 */
-	hash_seq_init(&tstat, dbentry->tables);
-	while ((tabentry = (PgStat_StatTabEntry *) hash_seq_search(&tstat)) != NULL)
-	{
-		fputc('T', fpout);
-		rc = fwrite(tabentry, sizeof(PgStat_StatTabEntry), 1, fpout);
-		(void) rc;				/* we'll check for error with ferror */
-	}
-
-	/*
-	 * Walk through the database's function stats table.
-	 */
-	hash_seq_init(&fstat, dbentry->functions);
-	while ((funcentry = (PgStat_StatFuncEntry *) hash_seq_search(&fstat)) != NULL)
-	{
-		fputc('F', fpout);
-		rc = fwrite(funcentry, sizeof(PgStat_StatFuncEntry), 1, fpout);
-		(void) rc;				/* we'll check for error with ferror */
-	}
-
-	/*
-	 * No more output to be done. Close the temp file and replace the old
-	 * pgstat.stat with it.  The ferror() check replaces testing for error
-	 * after each individual fputc or fwrite above.
-	 */
-	fputc('E', fpout);
-
-	if (ferror(fpout))
-	{
-		ereport(LOG,
-				(errcode_for_file_access(),
-				 errmsg("could not write temporary statistics file \"%s\": %m",
-						tmpfile)));
-		FreeFile(fpout);
-		unlink(tmpfile);
-	}
-	else if (FreeFile(fpout) < 0)
-	{
-		ereport(LOG,
-				(errcode_for_file_access(),
-				 errmsg("could not close temporary statistics file \"%s\": %m",
-						tmpfile)));
-		unlink(tmpfile);
-	}
-	else if (rename(tmpfile, statfile) < 0)
-	{
-		ereport(LOG,
-				(errcode_for_file_access(),
-				 errmsg("could not rename temporary statistics file \"%s\" to \"%s\": %m",
-						tmpfile, statfile)));
-		unlink(tmpfile);
-	}
-
-	if (permanent)
-	{
-		get_dbstat_filename(false, false, dbid, statfile, MAXPGPATH);
-
-		elog(DEBUG2, "removing temporary stats file \"%s\"", statfile);
-		unlink(statfile);
-	}
-}
-
-/* ----------
- * pgstat_read_statsfiles() -
- *
- *	Reads in some existing statistics collector files and returns the
- *	databases hash table that is the top level of the data.
- *
- *	If 'onlydb' is not InvalidOid, it means we only want data for that DB
- *	plus the shared catalogs ("DB 0").  We'll still populate the DB hash
- *	table for all databases, but we don't bother even creating table/function
- *	hash tables for other databases.
- *
- *	'permanent' specifies reading from the permanent files not temporary ones.
- *	When true (happens only when the collector is starting up), remove the
- *	files after reading; the in-memory status is now authoritative, and the
- *	files would be out of date in case somebody else reads them.
- *
- *	If a 'deep' read is requested, table/function stats are read, otherwise
- *	the table/function hash tables remain empty.
- * ----------
- */
-static HTAB *
-pgstat_read_statsfiles(Oid onlydb, bool permanent, bool deep)
-{
-	PgStat_StatDBEntry *dbentry;
-	PgStat_StatDBEntry dbbuf;
-	HASHCTL		hash_ctl;
-	HTAB	   *dbhash;
-	FILE	   *fpin;
-	int32		format_id;
-	bool		found;
-	const char *statfile = permanent ? PGSTAT_STAT_PERMANENT_FILENAME : pgstat_stat_filename;
-
-	/*
-	 * The tables will live in pgStatLocalContext.
-	 */
-	pgstat_setup_memcxt();
-
-	/*
-	 * Create the DB hashtable
-	 */
-	memset(&hash_ctl, 0, sizeof(hash_ctl));
-	hash_ctl.keysize = sizeof(Oid);
-	hash_ctl.entrysize = sizeof(PgStat_StatDBEntry);
-	hash_ctl.hcxt = pgStatLocalContext;
-	dbhash = hash_create("Databases hash", PGSTAT_DB_HASH_SIZE, &hash_ctl,
-						 HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
-
-	/*
-	 * Clear out global and archiver statistics so they start from zero in
-	 * case we can't load an existing statsfile.
-	 */
-	memset(&globalStats, 0, sizeof(globalStats));
-	memset(&archiverStats, 0, sizeof(archiverStats));
+	memset(&globalStats, 0, sizeof(globalStats));
+	memset(&archiverStats, 0, sizeof(archiverStats));
+	memset(&ioStats, 0, sizeof(ioStats));
 
 	/*
 	 * Set the current timestamp (will be kept only in case we can't load an
@@ -5242,6 +5606,7 @@ pgstat_read_statsfiles(Oid onlydb, bool permanent, bool deep)
 	 */
 	globalStats.stat_reset_timestamp = GetCurrentTimestamp();
 	archiverStats.stat_reset_timestamp = globalStats.stat_reset_timestamp;
+	ioStats.stat_reset_timestamp = globalStats.stat_reset_timestamp;
 
 	/*
 	 * Try to open the stats file. If it doesn't exist, the backends simply
@@ -5305,6 +5670,17 @@ pgstat_read_statsfiles(Oid onlydb, bool permanent, bool deep)
 		goto done;
 	}
 
+	/*
+	 * Read I/O stats struct
+	 */
+	if (fread(&ioStats, 1, sizeof(ioStats), fpin) != sizeof(ioStats))
+	{
+		ereport(pgStatRunningInCollector ? LOG : WARNING,
+				(errmsg("corrupted statistics file \"%s\"", statfile)));
+		memset(&ioStats, 0, sizeof(ioStats));
+		goto done;
+	}
+
 	/*
 	 * We found an existing collector stats file. Read it and put all the
 	 * hashtable entries into place.
@@ -5318,8 +5694,8 @@ pgstat_read_statsfiles(Oid onlydb, bool permanent, bool deep)
 				 * follows.
 				 */
 			case 'D':
-				if (fread(&dbbuf, 1, offsetof(PgStat_StatDBEntry, tables),
-						  fpin) != offsetof(PgStat_StatDBEntry, tables))
+				if (fread(&dbbuf, 1, sizeof(PgStat_StatDBEntry),
+						  fpin) != sizeof(PgStat_StatDBEntry))
 				{
 					ereport(pgStatRunningInCollector ? LOG : WARNING,
 							(errmsg("corrupted statistics file \"%s\"",
@@ -5343,8 +5719,6 @@ pgstat_read_statsfiles(Oid onlydb, bool permanent, bool deep)
 				}
 
 				memcpy(dbentry, &dbbuf, sizeof(PgStat_StatDBEntry));
-				dbentry->tables = NULL;
-				dbentry->functions = NULL;
 
 				/*
 				 * In the collector, disregard the timestamp we read from the
@@ -5354,45 +5728,6 @@ pgstat_read_statsfiles(Oid onlydb, bool permanent, bool deep)
 				 */
 				if (pgStatRunningInCollector)
 					dbentry->stats_timestamp = 0;
-
-				/*
-				 * Don't create tables/functions hashtables for uninteresting
-				 * databases.
-				 */
-				if (onlydb != InvalidOid)
-				{
-					if (dbbuf.databaseid != onlydb &&
-						dbbuf.databaseid != InvalidOid)
-						break;
-				}
-
-				memset(&hash_ctl, 0, sizeof(hash_ctl));
-				hash_ctl.keysize = sizeof(Oid);
-				hash_ctl.entrysize = sizeof(PgStat_StatTabEntry);
-				hash_ctl.hcxt = pgStatLocalContext;
-				dbentry->tables = hash_create("Per-database table",
-											  PGSTAT_TAB_HASH_SIZE,
-											  &hash_ctl,
-											  HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
-
-				hash_ctl.keysize = sizeof(Oid);
-				hash_ctl.entrysize = sizeof(PgStat_StatFuncEntry);
-				hash_ctl.hcxt = pgStatLocalContext;
-				dbentry->functions = hash_create("Per-database function",
-												 PGSTAT_FUNCTION_HASH_SIZE,
-												 &hash_ctl,
-												 HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
-
-				/*
-				 * If requested, read the data from the database-specific
-				 * file.  Otherwise we just leave the hashtables empty.
-				 */
-				if (deep)
-					pgstat_read_db_statsfile(dbentry->databaseid,
-											 dbentry->tables,
-											 dbentry->functions,
-											 permanent);
-
 				break;
 
 			case 'E':
@@ -5421,47 +5756,126 @@ done:
 
 
 /* ----------
- * pgstat_read_db_statsfile() -
+ * pgstat_write_object_stats() -
  *
- *	Reads in the existing statistics collector file for the given database,
- *	filling the passed-in tables and functions hash tables.
- *
- *	As in pgstat_read_statsfiles, if the permanent file is requested, it is
- *	removed after reading.
+ *	Write the shared table and function stats to PGSTAT_OBJECTS_FILENAME,
+ *	so that they survive a clean shutdown.  Called at the end of the
+ *	shutdown checkpoint, when nothing else is updating them any more.
+ * ----------
+ */
+void
+pgstat_write_object_stats(void)
+{
+	dshash_seq_status status;
+	PgStat_SharedTabEntry *tabentry;
+	PgStat_SharedFuncEntry *funcentry;
+	FILE	   *fpout;
+	int32		format_id;
+	int			rc;
+
+	elog(DEBUG2, "writing stats file \"%s\"", PGSTAT_OBJECTS_FILENAME);
+
+	fpout = AllocateFile(PGSTAT_OBJECTS_TMPFILE, PG_BINARY_W);
+	if (fpout == NULL)
+	{
+		ereport(LOG,
+				(errcode_for_file_access(),
+				 errmsg("could not open temporary statistics file \"%s\": %m",
+						PGSTAT_OBJECTS_TMPFILE)));
+		return;
+	}
+
+	/*
+	 * Write the file header --- currently just a format ID.
+	 */
+	format_id = PGSTAT_FILE_FORMAT_ID;
+	rc = fwrite(&format_id, sizeof(format_id), 1, fpout);
+	(void) rc;					/* we'll check for error with ferror */
+
+	pgstat_attach_shared();
+
+	/*
+	 * Walk through the table stats.
+	 */
+	dshash_seq_init(&status, pgStatSharedTables, false);
+	while ((tabentry = dshash_seq_next(&status)) != NULL)
+	{
+		fputc('T', fpout);
+		rc = fwrite(tabentry, sizeof(PgStat_SharedTabEntry), 1, fpout);
+		(void) rc;				/* we'll check for error with ferror */
+	}
+	dshash_seq_term(&status);
+
+	/*
+	 * Walk through the function stats.
+	 */
+	dshash_seq_init(&status, pgStatSharedFunctions, false);
+	while ((funcentry = dshash_seq_next(&status)) != NULL)
+	{
+		fputc('F', fpout);
+		rc = fwrite(funcentry, sizeof(PgStat_SharedFuncEntry), 1, fpout);
+		(void) rc;				/* we'll check for error with ferror */
+	}
+	dshash_seq_term(&status);
+
+	/*
+	 * No more output to be done. Close the temp file and replace the old
+	 * file with it.  The ferror() check replaces testing for error after
+	 * each individual fputc or fwrite above.
+	 */
+	fputc('E', fpout);
+
+	if (ferror(fpout))
+	{
+		ereport(LOG,
+				(errcode_for_file_access(),
+				 errmsg("could not write temporary statistics file \"%s\": %m",
+						PGSTAT_OBJECTS_TMPFILE)));
+		FreeFile(fpout);
+		unlink(PGSTAT_OBJECTS_TMPFILE);
+	}
+	else if (FreeFile(fpout) < 0)
+	{
+		ereport(LOG,
+				(errcode_for_file_access(),
+				 errmsg("could not close temporary statistics file \"%s\": %m",
+						PGSTAT_OBJECTS_TMPFILE)));
+		unlink(PGSTAT_OBJECTS_TMPFILE);
+	}
+	else if (durable_rename(PGSTAT_OBJECTS_TMPFILE, PGSTAT_OBJECTS_FILENAME,
+							LOG) != 0)
+		unlink(PGSTAT_OBJECTS_TMPFILE);
+}
+
+/* ----------
+ * pgstat_read_object_stats() -
  *
- *	Note: this code has the ability to skip storing per-table or per-function
- *	data, if NULL is passed for the corresponding hashtable.  That's not used
- *	at the moment though.
+ *	Load the table and function stats saved by pgstat_write_object_stats()
+ *	into shared memory, and remove the file; the shared entries are now
+ *	authoritative.  Called by the startup process when no WAL recovery is
+ *	needed, before anybody else can touch the stats.
  * ----------
  */
-static void
-pgstat_read_db_statsfile(Oid databaseid, HTAB *tabhash, HTAB *funchash,
-						 bool permanent)
+void
+pgstat_read_object_stats(void)
 {
-	PgStat_StatTabEntry *tabentry;
-	PgStat_StatTabEntry tabbuf;
-	PgStat_StatFuncEntry funcbuf;
-	PgStat_StatFuncEntry *funcentry;
+	PgStat_SharedTabEntry tabbuf;
+	PgStat_SharedFuncEntry funcbuf;
+	PgStat_SharedTabEntry *tabentry;
+	PgStat_SharedFuncEntry *funcentry;
 	FILE	   *fpin;
 	int32		format_id;
 	bool		found;
-	char		statfile[MAXPGPATH];
-
-	get_dbstat_filename(permanent, false, databaseid, statfile, MAXPGPATH);
+	const char *statfile = PGSTAT_OBJECTS_FILENAME;
 
 	/*
-	 * Try to open the stats file. If it doesn't exist, the backends simply
-	 * return zero for anything and the collector simply starts from scratch
-	 * with empty counters.
-	 *
-	 * ENOENT is a possibility if the stats collector is not running or has
-	 * not yet written the stats file the first time.  Any other failure
-	 * condition is suspicious.
+	 * Try to open the stats file.  If it doesn't exist, we simply start from
+	 * scratch with empty counters.
 	 */
 	if ((fpin = AllocateFile(statfile, PG_BINARY_R)) == NULL)
 	{
 		if (errno != ENOENT)
-			ereport(pgStatRunningInCollector ? LOG : WARNING,
+			ereport(LOG,
 					(errcode_for_file_access(),
 					 errmsg("could not open statistics file \"%s\": %m",
 							statfile)));
@@ -5474,85 +5888,53 @@ pgstat_read_db_statsfile(Oid databaseid, HTAB *tabhash, HTAB *funchash,
 	if (fread(&format_id, 1, sizeof(format_id), fpin) != sizeof(format_id) ||
 		format_id != PGSTAT_FILE_FORMAT_ID)
 	{
-		ereport(pgStatRunningInCollector ? LOG : WARNING,
+		ereport(LOG,
 				(errmsg("corrupted statistics file \"%s\"", statfile)));
 		goto done;
 	}
 
-	/*
-	 * We found an existing collector stats file. Read it and put all the
-	 * hashtable entries into place.
-	 */
+	pgstat_attach_shared();
+
 	for (;;)
 	{
 		switch (fgetc(fpin))
 		{
 				/*
-				 * 'T'	A PgStat_StatTabEntry follows.
+				 * 'T'	A PgStat_SharedTabEntry follows.
 				 */
 			case 'T':
-				if (fread(&tabbuf, 1, sizeof(PgStat_StatTabEntry),
-						  fpin) != sizeof(PgStat_StatTabEntry))
-				{
-					ereport(pgStatRunningInCollector ? LOG : WARNING,
-							(errmsg("corrupted statistics file \"%s\"",
-									statfile)));
-					goto done;
-				}
-
-				/*
-				 * Skip if table data not wanted.
-				 */
-				if (tabhash == NULL)
-					break;
-
-				tabentry = (PgStat_StatTabEntry *) hash_search(tabhash,
-															   (void *) &tabbuf.tableid,
-															   HASH_ENTER, &found);
-
-				if (found)
+				if (fread(&tabbuf, 1, sizeof(PgStat_SharedTabEntry),
+						  fpin) != sizeof(PgStat_SharedTabEntry))
 				{
-					ereport(pgStatRunningInCollector ? LOG : WARNING,
+					ereport(LOG,
 							(errmsg("corrupted statistics file \"%s\"",
 									statfile)));
 					goto done;
 				}
 
+				tabentry = dshash_find_or_insert(pgStatSharedTables,
+												 &tabbuf.key, &found);
 				memcpy(tabentry, &tabbuf, sizeof(tabbuf));
+				dshash_release_lock(pgStatSharedTables, tabentry);
 				break;
 
 				/*
-				 * 'F'	A PgStat_StatFuncEntry follows.
+				 * 'F'	A PgStat_SharedFuncEntry follows.
 				 */
 			case 'F':
-				if (fread(&funcbuf, 1, sizeof(PgStat_StatFuncEntry),
-						  fpin) != sizeof(PgStat_StatFuncEntry))
+				if (fread(&funcbuf, 1, sizeof(PgStat_SharedFuncEntry),
+						  fpin) != sizeof(PgStat_SharedFuncEntry))
 				{
-					ereport(pgStatRunningInCollector ? LOG : WARNING,
-							(errmsg("corrupted statistics file \"%s\"",
-									statfile)));
-					goto done;
-				}
-
-				/*
-				 * Skip if function data not wanted.
-				 */
-				if (funchash == NULL)
-					break;
-
-				funcentry = (PgStat_StatFuncEntry *) hash_search(funchash,
-																 (void *) &funcbuf.functionid,
-																 HASH_ENTER, &found);
-
-				if (found)
-				{
-					ereport(pgStatRunningInCollector ? LOG : WARNING,
+					ereport(LOG,
 							(errmsg("corrupted statistics file \"%s\"",
 									statfile)));
 					goto done;
 				}
 
+				funcentry = dshash_find_or_insert(pgStatSharedFunctions,
+												  &funcbuf.key, &found);
 				memcpy(funcentry, &funcbuf, sizeof(funcbuf));
+				dshash_release_lock(pgStatSharedFunctions, funcentry);
 				break;
 
 				/*
@@ -5562,7 +5944,7 @@ pgstat_read_db_statsfile(Oid databaseid, HTAB *tabhash, HTAB *funchash,
 				goto done;
 
 			default:
-				ereport(pgStatRunningInCollector ? LOG : WARNING,
+				ereport(LOG,
 						(errmsg("corrupted statistics file \"%s\"",
 								statfile)));
 				goto done;
@@ -5572,11 +5954,8 @@ pgstat_read_db_statsfile(Oid databaseid, HTAB *tabhash, HTAB *funchash,
 done:
 	FreeFile(fpin);
 
-	if (permanent)
-	{
-		elog(DEBUG2, "removing permanent stats file \"%s\"", statfile);
-		unlink(statfile);
-	}
+	elog(DEBUG2, "removing permanent stats file \"%s\"", statfile);
+	unlink(statfile);
 }
 
 /* ----------
@@ -5603,6 +5982,7 @@ pgstat_read_db_statsfile_timestamp(Oid databaseid, bool permanent,
 	PgStat_StatDBEntry dbentry;
 	PgStat_GlobalStats myGlobalStats;
 	PgStat_ArchiverStats myArchiverStats;
+	PgStat_IOStats myIOStats;
 	FILE	   *fpin;
 	int32		format_id;
 	const char *statfile = permanent ? PGSTAT_STAT_PERMANENT_FILENAME : pgstat_stat_filename;
@@ -5657,6 +6037,18 @@ pgstat_read_db_statsfile_timestamp(Oid databaseid, bool permanent,
 		return false;
 	}
 
+	/*
+	 * Read I/O stats struct
+	 */
+	if (fread(&myIOStats, 1, sizeof(myIOStats),
+			  fpin) != sizeof(myIOStats))
+	{
+		ereport(pgStatRunningInCollector ? LOG : WARNING,
+				(errmsg("corrupted statistics file \"%s\"", statfile)));
+		FreeFile(fpin);
+		return false;
+	}
+
 	/* By default, we're going to return the timestamp of the global file. */
 	*ts = myGlobalStats.stats_timestamp;
 
@@ -5673,8 +6065,8 @@ pgstat_read_db_statsfile_timestamp(Oid databaseid, bool permanent,
 				 * follows.
 				 */
 			case 'D':
-				if (fread(&dbentry, 1, offsetof(PgStat_StatDBEntry, tables),
-						  fpin) != offsetof(PgStat_StatDBEntry, tables))
+				if (fread(&dbentry, 1, sizeof(PgStat_StatDBEntry),
+						  fpin) != sizeof(PgStat_StatDBEntry))
 				{
 					ereport(pgStatRunningInCollector ? LOG : WARNING,
 							(errmsg("corrupted statistics file \"%s\"",
@@ -5831,15 +6223,7 @@ backend_read_statsfile(void)
 				(errmsg("using stale statistics instead of current ones "
 						"because stats collector is not responding")));
 
-	/*
-	 * Autovacuum launcher wants stats about all databases, but a shallow read
-	 * is sufficient.  Regular backends want a deep read for just the tables
-	 * they can see (MyDatabaseId + shared catalogs).
-	 */
-	if (IsAutoVacuumLauncherProcess())
-		pgStatDBHash = pgstat_read_statsfiles(InvalidOid, false, false);
-	else
-		pgStatDBHash = pgstat_read_statsfiles(MyDatabaseId, false, true);
+	pgStatDBHash = pgstat_read_statsfiles(false);
 }
 
 
@@ -5879,6 +6263,8 @@ pgstat_clear_snapshot(void)
 	/* Reset variables */
 	pgStatLocalContext = NULL;
 	pgStatDBHash = NULL;
+	pgStatLocalTables = NULL;
+	pgStatLocalFunctions = NULL;
 	localBackendStatusTable = NULL;
 	localNumBackends = 0;
 }
@@ -5912,7 +6298,7 @@ pgstat_recv_inquiry(PgStat_MsgInquiry *msg, int len)
 	/*
 	 * Check to see if we last wrote this database at a time >= the requested
 	 * cutoff time.  If so, this is a stale request that was generated before
-	 * we updated the DB file, and we don't need to do so again.
+	 * we wrote the stats file, and we don't need to do so again.
 	 *
 	 * If the requestor's local clock time is older than stats_timestamp, we
 	 * should suspect a clock glitch, ie system time going backwards; though
@@ -5978,144 +6364,30 @@ pgstat_recv_inquiry(PgStat_MsgInquiry *msg, int len)
 
 
 /* ----------
- * pgstat_recv_tabstat() -
+ * pgstat_recv_dbstat() -
  *
  *	Count what the backend has done.
  * ----------
  */
 static void
-pgstat_recv_tabstat(PgStat_MsgTabstat *msg, int len)
+pgstat_recv_dbstat(PgStat_MsgDbstat *msg, int len)
 {
 	PgStat_StatDBEntry *dbentry;
-	PgStat_StatTabEntry *tabentry;
-	int			i;
-	bool		found;
 
 	dbentry = pgstat_get_db_entry(msg->m_databaseid, true);
 
-	/*
-	 * Update database-wide stats.
-	 */
 	dbentry->n_xact_commit += (PgStat_Counter) (msg->m_xact_commit);
 	dbentry->n_xact_rollback += (PgStat_Counter) (msg->m_xact_rollback);
 	dbentry->n_block_read_time += msg->m_block_read_time;
 	dbentry->n_block_write_time += msg->m_block_write_time;
 
-	/*
-	 * Process all table entries in the message.
-	 */
-	for (i = 0; i < msg->m_nentries; i++)
-	{
-		PgStat_TableEntry *tabmsg = &(msg->m_entry[i]);
-
-		tabentry = (PgStat_StatTabEntry *) hash_search(dbentry->tables,
-													   (void *) &(tabmsg->t_id),
-													   HASH_ENTER, &found);
-
-		if (!found)
-		{
-			/*
-			 * If it's a new table entry, initialize counters to the values we
-			 * just got.
-			 */
-			tabentry->numscans = tabmsg->t_counts.t_numscans;
-			tabentry->tuples_returned = tabmsg->t_counts.t_tuples_returned;
-			tabentry->tuples_fetched = tabmsg->t_counts.t_tuples_fetched;
-			tabentry->tuples_inserted = tabmsg->t_counts.t_tuples_inserted;
-			tabentry->tuples_updated = tabmsg->t_counts.t_tuples_updated;
-			tabentry->tuples_deleted = tabmsg->t_counts.t_tuples_deleted;
-			tabentry->tuples_hot_updated = tabmsg->t_counts.t_tuples_hot_updated;
-			tabentry->tuples_inplace_updated = tabmsg->t_counts.t_tuples_inplace_updated;
-			tabentry->n_live_tuples = tabmsg->t_counts.t_delta_live_tuples;
-			tabentry->n_dead_tuples = tabmsg->t_counts.t_delta_dead_tuples;
-			tabentry->changes_since_analyze = tabmsg->t_counts.t_changed_tuples;
-			tabentry->blocks_fetched = tabmsg->t_counts.t_blocks_fetched;
-			tabentry->blocks_hit = tabmsg->t_counts.t_blocks_hit;
-
-			tabentry->vacuum_timestamp = 0;
-			tabentry->vacuum_count = 0;
-			tabentry->autovac_vacuum_timestamp = 0;
-			tabentry->autovac_vacuum_count = 0;
-			tabentry->analyze_timestamp = 0;
-			tabentry->analyze_count = 0;
-			tabentry->autovac_analyze_timestamp = 0;
-			tabentry->autovac_analyze_count = 0;
-		}
-		else
-		{
-			/*
-			 * Otherwise add the values to the existing entry.
-			 */
-			tabentry->numscans += tabmsg->t_counts.t_numscans;
-			tabentry->tuples_returned += tabmsg->t_counts.t_tuples_returned;
-			tabentry->tuples_fetched += tabmsg->t_counts.t_tuples_fetched;
-			tabentry->tuples_inserted += tabmsg->t_counts.t_tuples_inserted;
-			tabentry->tuples_updated += tabmsg->t_counts.t_tuples_updated;
-			tabentry->tuples_deleted += tabmsg->t_counts.t_tuples_deleted;
-			tabentry->tuples_hot_updated += tabmsg->t_counts.t_tuples_hot_updated;
-			tabentry->tuples_inplace_updated += tabmsg->t_counts.t_tuples_inplace_updated;
-			/* If table was truncated, first reset the live/dead counters */
-			if (tabmsg->t_counts.t_truncated)
-			{
-				tabentry->n_live_tuples = 0;
-				tabentry->n_dead_tuples = 0;
-			}
-			tabentry->n_live_tuples += tabmsg->t_counts.t_delta_live_tuples;
-			tabentry->n_dead_tuples += tabmsg->t_counts.t_delta_dead_tuples;
-			tabentry->changes_since_analyze += tabmsg->t_counts.t_changed_tuples;
-			tabentry->blocks_fetched += tabmsg->t_counts.t_blocks_fetched;
-			tabentry->blocks_hit += tabmsg->t_counts.t_blocks_hit;
-		}
-
-		/* Clamp n_live_tuples in case of negative delta_live_tuples */
-		tabentry->n_live_tuples = Max(tabentry->n_live_tuples, 0);
-		/* Likewise for n_dead_tuples */
-		tabentry->n_dead_tuples = Max(tabentry->n_dead_tuples, 0);
-
-		/*
-		 * Add per-table stats to the per-database entry, too.
-		 */
-		dbentry->n_tuples_returned += tabmsg->t_counts.t_tuples_returned;
-		dbentry->n_tuples_fetched += tabmsg->t_counts.t_tuples_fetched;
-		dbentry->n_tuples_inserted += tabmsg->t_counts.t_tuples_inserted;
-		dbentry->n_tuples_updated += tabmsg->t_counts.t_tuples_updated;
-		dbentry->n_tuples_deleted += tabmsg->t_counts.t_tuples_deleted;
-		dbentry->n_blocks_fetched += tabmsg->t_counts.t_blocks_fetched;
-		dbentry->n_blocks_hit += tabmsg->t_counts.t_blocks_hit;
-	}
-}
-
-
-/* ----------
- * pgstat_recv_tabpurge() -
- *
- *	Arrange for dead table removal.
- * ----------
- */
-static void
-pgstat_recv_tabpurge(PgStat_MsgTabpurge *msg, int len)
-{
-	PgStat_StatDBEntry *dbentry;
-	int			i;
-
-	dbentry = pgstat_get_db_entry(msg->m_databaseid, false);
-
-	/*
-	 * No need to purge if we don't even know the database.
-	 */
-	if (!dbentry || !dbentry->tables)
-		return;
-
-	/*
-	 * Process all table entries in the message.
-	 */
-	for (i = 0; i < msg->m_nentries; i++)
-	{
-		/* Remove from hashtable if present; we don't care if it's not. */
-		(void) hash_search(dbentry->tables,
-						   (void *) &(msg->m_tableid[i]),
-						   HASH_REMOVE, NULL);
-	}
+	dbentry->n_tuples_returned += msg->m_tuples_returned;
+	dbentry->n_tuples_fetched += msg->m_tuples_fetched;
+	dbentry->n_tuples_inserted += msg->m_tuples_inserted;
+	dbentry->n_tuples_updated += msg->m_tuples_updated;
+	dbentry->n_tuples_deleted += msg->m_tuples_deleted;
+	dbentry->n_blocks_fetched += msg->m_blocks_fetched;
+	dbentry->n_blocks_hit += msg->m_blocks_hit;
 }
 
 
@@ -6137,22 +6409,10 @@ pgstat_recv_dropdb(PgStat_MsgDropdb *msg, int len)
 	dbentry = pgstat_get_db_entry(dbid, false);
 
 	/*
-	 * If found, remove it (along with the db statfile).
+	 * If found, remove it.
 	 */
 	if (dbentry)
 	{
-		char		statfile[MAXPGPATH];
-
-		get_dbstat_filename(false, false, dbid, statfile, MAXPGPATH);
-
-		elog(DEBUG2, "removing stats file \"%s\"", statfile);
-		unlink(statfile);
-
-		if (dbentry->tables != NULL)
-			hash_destroy(dbentry->tables);
-		if (dbentry->functions != NULL)
-			hash_destroy(dbentry->functions);
-
 		if (hash_search(pgStatDBHash,
 						(void *) &dbid,
 						HASH_REMOVE, NULL) == NULL)
@@ -6182,20 +6442,8 @@ pgstat_recv_resetcounter(PgStat_MsgResetcounter *msg, int len)
 		return;
 
 	/*
-	 * We simply throw away all the database's table entries by recreating a
-	 * new hash table for them.
-	 */
-	if (dbentry->tables != NULL)
-		hash_destroy(dbentry->tables);
-	if (dbentry->functions != NULL)
-		hash_destroy(dbentry->functions);
-
-	dbentry->tables = NULL;
-	dbentry->functions = NULL;
-
-	/*
-	 * Reset database-level stats, too.  This creates empty hash tables for
-	 * tables and functions.
+	 * Reset database-level stats.  The backend has already removed the
+	 * database's table and function entries from shared memory.
 	 */
 	reset_dbentry_counters(dbentry);
 }
@@ -6221,6 +6469,12 @@ pgstat_recv_resetsharedcounter(PgStat_MsgResetsharedcounter *msg, int len)
 		memset(&archiverStats, 0, sizeof(archiverStats));
 		archiverStats.stat_reset_timestamp = GetCurrentTimestamp();
 	}
+	else if (msg->m_resettarget == RESET_IO)
+	{
+		/* Reset the I/O statistics for the cluster. */
+		memset(&ioStats, 0, sizeof(ioStats));
+		ioStats.stat_reset_timestamp = GetCurrentTimestamp();
+	}
 
 	/*
 	 * Presumably the sender of this message validated the target, don't
@@ -6231,7 +6485,8 @@ pgstat_recv_resetsharedcounter(PgStat_MsgResetsharedcounter *msg, int len)
 /* ----------
  * pgstat_recv_resetsinglecounter() -
  *
- *	Reset a statistics for a single object
+ *	Note the reset of the statistics for a single object.  The object's
+ *	entry itself lives in shared memory and was removed by the backend.
  * ----------
  */
 static void
@@ -6246,14 +6501,6 @@ pgstat_recv_resetsinglecounter(PgStat_MsgResetsinglecounter *msg, int len)
 
 	/* Set the reset timestamp for the whole database */
 	dbentry->stat_reset_timestamp = GetCurrentTimestamp();
-
-	/* Remove object if it exists, ignore it if not */
-	if (msg->m_resettype == RESET_TABLE)
-		(void) hash_search(dbentry->tables, (void *) &(msg->m_objectid),
-						   HASH_REMOVE, NULL);
-	else if (msg->m_resettype == RESET_FUNCTION)
-		(void) hash_search(dbentry->functions, (void *) &(msg->m_objectid),
-						   HASH_REMOVE, NULL);
 }
 
 /* ----------
@@ -6275,83 +6522,6 @@ pgstat_recv_autovac(PgStat_MsgAutovacStart *msg, int len)
 	dbentry->last_autovac_time = msg->m_start_time;
 }
 
-/* ----------
- * pgstat_recv_vacuum() -
- *
- *	Process a VACUUM message.
- * ----------
- */
-static void
-pgstat_recv_vacuum(PgStat_MsgVacuum *msg, int len)
-{
-	PgStat_StatDBEntry *dbentry;
-	PgStat_StatTabEntry *tabentry;
-
-	/*
-	 * Store the data in the table's hashtable entry.
-	 */
-	dbentry = pgstat_get_db_entry(msg->m_databaseid, true);
-
-	tabentry = pgstat_get_tab_entry(dbentry, msg->m_tableoid, true);
-
-	tabentry->n_live_tuples = msg->m_live_tuples;
-	tabentry->n_dead_tuples = msg->m_dead_tuples;
-
-	if (msg->m_autovacuum)
-	{
-		tabentry->autovac_vacuum_timestamp = msg->m_vacuumtime;
-		tabentry->autovac_vacuum_count++;
-	}
-	else
-	{
-		tabentry->vacuum_timestamp = msg->m_vacuumtime;
-		tabentry->vacuum_count++;
-	}
-}
-
-/* ----------
- * pgstat_recv_analyze() -
- *
- *	Process an ANALYZE message.
- * ----------
- */
-static void
-pgstat_recv_analyze(PgStat_MsgAnalyze *msg, int len)
-{
-	PgStat_StatDBEntry *dbentry;
-	PgStat_StatTabEntry *tabentry;
-
-	/*
-	 * Store the data in the table's hashtable entry.
-	 */
-	dbentry = pgstat_get_db_entry(msg->m_databaseid, true);
-
-	tabentry = pgstat_get_tab_entry(dbentry, msg->m_tableoid, true);
-
-	tabentry->n_live_tuples = msg->m_live_tuples;
-	tabentry->n_dead_tuples = msg->m_dead_tuples;
-
-	/*
-	 * If commanded, reset changes_since_analyze to zero.  This forgets any
-	 * changes that were committed while the ANALYZE was in progress, but we
-	 * have no good way to estimate how many of those there were.
-	 */
-	if (msg->m_resetcounter)
-		tabentry->changes_since_analyze = 0;
-
-	if (msg->m_autovacuum)
-	{
-		tabentry->autovac_analyze_timestamp = msg->m_analyzetime;
-		tabentry->autovac_analyze_count++;
-	}
-	else
-	{
-		tabentry->analyze_timestamp = msg->m_analyzetime;
-		tabentry->analyze_count++;
-	}
-}
-
-
 /* ----------
  * pgstat_recv_archiver() -
  *
@@ -6400,6 +6570,29 @@ pgstat_recv_bgwriter(PgStat_MsgBgWriter *msg, int len)
 	globalStats.buf_alloc += msg->m_buf_alloc;
 }
 
+/* ----------
+ * pgstat_recv_io() -
+ *
+ *	Process an IO message.
+ * ----------
+ */
+static void
+pgstat_recv_io(PgStat_MsgIO *msg, int len)
+{
+	PgStat_IOCounts *counts = &ioStats.counts[msg->m_backend_type][msg->m_object];
+	int			i;
+	int			j;
+
+	for (i = 0; i < IOCONTEXT_NUM_TYPES; i++)
+	{
+		for (j = 0; j < IOOP_NUM_TYPES; j++)
+		{
+			counts->counts[i][j] += msg->m_counts.counts[i][j];
+			counts->times[i][j] += msg->m_counts.times[i][j];
+		}
+	}
+}
+
 /* ----------
  * pgstat_recv_recoveryconflict() -
  *
@@ -6490,86 +6683,6 @@ pgstat_recv_tempfile(PgStat_MsgTempFile *msg, int len)
 	dbentry->n_temp_files += 1;
 }
 
-/* ----------
- * pgstat_recv_funcstat() -
- *
- *	Count what the backend has done.
- * ----------
- */
-static void
-pgstat_recv_funcstat(PgStat_MsgFuncstat *msg, int len)
-{
-	PgStat_FunctionEntry *funcmsg = &(msg->m_entry[0]);
-	PgStat_StatDBEntry *dbentry;
-	PgStat_StatFuncEntry *funcentry;
-	int			i;
-	bool		found;
-
-	dbentry = pgstat_get_db_entry(msg->m_databaseid, true);
-
-	/*
-	 * Process all function entries in the message.
-	 */
-	for (i = 0; i < msg->m_nentries; i++, funcmsg++)
-	{
-		funcentry = (PgStat_StatFuncEntry *) hash_search(dbentry->functions,
-														 (void *) &(funcmsg->f_id),
-														 HASH_ENTER, &found);
-
-		if (!found)
-		{
-			/*
-			 * If it's a new function entry, initialize counters to the values
-			 * we just got.
-			 */
-			funcentry->f_numcalls = funcmsg->f_numcalls;
-			funcentry->f_total_time = funcmsg->f_total_time;
-			funcentry->f_self_time = funcmsg->f_self_time;
-		}
-		else
-		{
-			/*
-			 * Otherwise add the values to the existing entry.
-			 */
-			funcentry->f_numcalls += funcmsg->f_numcalls;
-			funcentry->f_total_time += funcmsg->f_total_time;
-			funcentry->f_self_time += funcmsg->f_self_time;
-		}
-	}
-}
-
-/* ----------
- * pgstat_recv_funcpurge() -
- *
- *	Arrange for dead function removal.
- * ----------
- */
-static void
-pgstat_recv_funcpurge(PgStat_MsgFuncpurge *msg, int len)
-{
-	PgStat_StatDBEntry *dbentry;
-	int			i;
-
-	dbentry = pgstat_get_db_entry(msg->m_databaseid, false);
-
-	/*
-	 * No need to purge if we don't even know the database.
-	 */
-	if (!dbentry || !dbentry->functions)
-		return;
-
-	/*
-	 * Process all function entries in the message.
-	 */
-	for (i = 0; i < msg->m_nentries; i++)
-	{
-		/* Remove from hashtable if present; we don't care if it's not. */
-		(void) hash_search(dbentry->functions,
-						   (void *) &(msg->m_functionid[i]),
-						   HASH_REMOVE, NULL);
-	}
-}
-
 /* ----------
  * pgstat_write_statsfile_needed() -
  *
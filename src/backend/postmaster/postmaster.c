@@ -102,6 +102,7 @@
 #include "common/file_perm.h"
 #include "common/ip.h"
 #include "common/string.h"
+#include "common/zpq_stream.h"
 #include "lib/ilist.h"
 #include "libpq/auth.h"
 #include "libpq/libpq.h"
@@ -116,7 +117,9 @@
 #include "postmaster/fork_process.h"
 #include "postmaster/pgarch.h"
 #include "postmaster/postmaster.h"
+#include "postmaster/proxy.h"
 #include "postmaster/syslogger.h"
+#include "postmaster/walsummarizer.h"
 #include "replication/logicallauncher.h"
 #include "replication/walsender.h"
 #include "storage/fd.h"
@@ -219,6 +222,9 @@ int			ReservedBackends;
 #define MAXLISTEN	64
 static pgsocket ListenSocket[MAXLISTEN];
 
+/* The sockets listening on proxy_port, whose sessions are pooled */
+static bool ListenSocketPooled[MAXLISTEN];
+
 /*
  * Set by the -o option
  */
@@ -384,6 +390,7 @@ static DNSServiceRef bonjour_sdref = NULL;
  * postmaster.c - function prototypes
  */
 static void CloseServerPorts(int status, Datum arg);
+static void ListenForPooledConnections(const char *host, const char *socketdir);
 static void unlink_external_pid_file(int status, Datum arg);
 static void getInstallationPaths(const char *argv0);
 static void checkControlFile(void);
@@ -410,6 +417,7 @@ static int	ServerLoop(void);
 static int	BackendStartup(Port *port);
 static int	ProcessStartupPacket(Port *port, bool SSLdone);
 static void SendNegotiateProtocolVersion(List *unrecognized_protocol_options);
+static void SendCompressionAck(Port *port, const char *algorithms);
 static void processCancelRequest(Port *port, void *pkt);
 static int	initMasks(fd_set *rmask);
 static void report_fork_failure_to_client(Port *port, int errnum);
@@ -515,6 +523,8 @@ typedef struct
 	bool		IsBinaryUpgrade;
 	int			max_safe_fds;
 	int			MaxBackends;
+	int			FastPathLockGroupsPerBackend;
+	int			NBuffers;
 #ifdef WIN32
 	HANDLE		PostmasterHandle;
 	HANDLE		initial_signal_pipe;
@@ -993,6 +1003,15 @@ PostmasterMain(int argc, char *argv[])
 	/* Register the Undo Discard worker. */
 	DiscardWorkerRegister();
 
+	/* Register the I/O workers, if io_method = worker. */
+	AioWorkerRegister();
+
+	/* Register the connection proxies, if connection_proxies > 0. */
+	ProxyRegister();
+
+	/* Register the WAL summarizer, if summarize_wal is enabled. */
+	WalSummarizerRegister();
+
 	/*
 	 * process any libraries that should be preloaded at postmaster start
 	 */
@@ -1004,6 +1023,12 @@ PostmasterMain(int argc, char *argv[])
 	 */
 	InitializeMaxBackends();
 
+	/* And the number of fast-path lock slots, which depends on GUCs too */
+	InitializeFastPathLocks();
+
+	/* Likewise the number of shared buffers to reserve */
+	InitializeBufferPoolSize();
+
 	/* Report server startup in log */
 	ereport(LOG,
 			(errmsg("starting %s", PG_VERSION_STR)));
@@ -1015,7 +1040,10 @@ PostmasterMain(int argc, char *argv[])
 	 * charged with closing the sockets again at postmaster shutdown.
 	 */
 	for (i = 0; i < MAXLISTEN; i++)
+	{
 		ListenSocket[i] = PGINVALID_SOCKET;
+		ListenSocketPooled[i] = false;
+	}
 
 	on_proc_exit(CloseServerPorts, 0);
 
@@ -1057,6 +1085,8 @@ PostmasterMain(int argc, char *argv[])
 			if (status == STATUS_OK)
 			{
 				success++;
+				ListenForPooledConnections(strcmp(curhost, "*") == 0 ?
+										   NULL : curhost, NULL);
 				/* record the first successful host addr in lockfile */
 				if (!listen_addr_saved)
 				{
@@ -1149,6 +1179,7 @@ PostmasterMain(int argc, char *argv[])
 			if (status == STATUS_OK)
 			{
 				success++;
+				ListenForPooledConnections(NULL, socketdir);
 				/* record the first successful Unix socket in lockfile */
 				if (success == 1)
 					AddToDataDirLockFile(LOCK_FILE_LINE_SOCKET_DIR, socketdir);
@@ -1396,6 +1427,46 @@ PostmasterMain(int argc, char *argv[])
 }
 
 
+/*
+ * Also listen on proxy_port for the host or Unix socket directory just set
+ * up, if connection pooling is enabled.  The new sockets are marked in
+ * ListenSocketPooled.  Failure is only a warning, as clients can still
+ * connect to the normal port.
+ */
+static void
+ListenForPooledConnections(const char *host, const char *socketdir)
+{
+	int			nbefore;
+	int			i;
+
+	if (connection_proxies == 0)
+		return;
+
+	for (nbefore = 0; nbefore < MAXLISTEN; nbefore++)
+	{
+		if (ListenSocket[nbefore] == PGINVALID_SOCKET)
+			break;
+	}
+
+	if (StreamServerPort(socketdir ? AF_UNIX : AF_UNSPEC, (char *) host,
+						 (unsigned short) proxy_port,
+						 (char *) socketdir,
+						 ListenSocket, MAXLISTEN) != STATUS_OK)
+	{
+		ereport(WARNING,
+				(errmsg("could not create listen socket for pooled connections on port %d",
+						proxy_port)));
+		return;
+	}
+
+	for (i = nbefore; i < MAXLISTEN; i++)
+	{
+		if (ListenSocket[i] == PGINVALID_SOCKET)
+			break;
+		ListenSocketPooled[i] = true;
+	}
+}
+
 /*
  * on_proc_exit callback to close server's listen sockets
  */
@@ -1712,6 +1783,7 @@ ServerLoop(void)
 					port = ConnCreate(ListenSocket[i]);
 					if (port)
 					{
+						port->pooled = ListenSocketPooled[i];
 						BackendStartup(port);
 
 						/*
@@ -2084,6 +2156,7 @@ retry1:
 	{
 		int32		offset = sizeof(ProtocolVersion);
 		List	   *unrecognized_protocol_options = NIL;
+		char	   *compression_algorithms = NULL;
 
 		/*
 		 * Scan packet body for name/option pairs.  We can assume any string
@@ -2133,11 +2206,16 @@ retry1:
 									valptr),
 							 errhint("Valid values are: \"false\", 0, \"true\", 1, \"database\".")));
 			}
+			else if (strcmp(nameptr, "_pq_.compression") == 0)
+			{
+				/* the algorithms the client can use, in its preferred order */
+				compression_algorithms = pstrdup(valptr);
+			}
 			else if (strncmp(nameptr, "_pq_.", 5) == 0)
 			{
 				/*
 				 * Any option beginning with _pq_. is reserved for use as a
-				 * protocol-level option, but at present no such options are
+				 * protocol-level option, but at present no others are
 				 * defined.
 				 */
 				unrecognized_protocol_options =
@@ -2187,6 +2265,10 @@ retry1:
 		if (PG_PROTOCOL_MINOR(proto) > PG_PROTOCOL_MINOR(PG_PROTOCOL_LATEST) ||
 			unrecognized_protocol_options != NIL)
 			SendNegotiateProtocolVersion(unrecognized_protocol_options);
+
+		/* Answer a compression request, and start compressing if agreed */
+		if (compression_algorithms)
+			SendCompressionAck(port, compression_algorithms);
 	}
 	else
 	{
@@ -2329,6 +2411,35 @@ SendNegotiateProtocolVersion(List *unrecognized_protocol_options)
 	/* no need to flush, some other message will follow */
 }
 
+/*
+ * Send a CompressionAck message to the client.
+ *
+ * This names the first of the client's algorithms that we support, or is
+ * empty if there's none, in which case the connection continues
+ * uncompressed.  Everything after this message is compressed, in both
+ * directions, so it has to be flushed before compression is switched on.
+ */
+static void
+SendCompressionAck(Port *port, const char *algorithms)
+{
+	StringInfoData buf;
+	const char *algorithm = zpq_choose_algorithm(algorithms);
+
+	pq_beginmessage(&buf, 'z'); /* CompressionAck */
+	pq_sendstring(&buf, algorithm ? algorithm : "");
+	pq_endmessage(&buf);
+	pq_flush();
+
+	if (algorithm == NULL)
+		return;
+
+	if (!pq_enable_compression(algorithm))
+		ereport(FATAL,
+				(errcode(ERRCODE_OUT_OF_MEMORY),
+				 errmsg("could not set up %s compression", algorithm)));
+	port->compression = pstrdup(algorithm);
+}
+
 /*
  * The client has sent a cancel request packet, not a normal
  * start-a-new-connection packet.  Perform the necessary processing.
@@ -6107,6 +6218,8 @@ save_backend_variables(BackendParameters *param, Port *port,
 	param->max_safe_fds = max_safe_fds;
 
 	param->MaxBackends = MaxBackends;
+	param->FastPathLockGroupsPerBackend = FastPathLockGroupsPerBackend;
+	param->NBuffers = NBuffers;
 
 #ifdef WIN32
 	param->PostmasterHandle = PostmasterHandle;
@@ -6342,6 +6455,8 @@ restore_backend_variables(BackendParameters *param, Port *port)
 	max_safe_fds = param->max_safe_fds;
 
 	MaxBackends = param->MaxBackends;
+	FastPathLockGroupsPerBackend = param->FastPathLockGroupsPerBackend;
+	NBuffers = param->NBuffers;
 
 #ifdef WIN32
 	PostmasterHandle = param->PostmasterHandle;
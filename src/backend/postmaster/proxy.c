@@ -0,0 +1,1342 @@
+/*-------------------------------------------------------------------------
+ *
+ * proxy.c
+ *	  Built-in connection pooler
+ *
+ * Clients that connect to proxy_port rather than port get a pooled session.
+ * The postmaster forks a backend for them as for any other connection, which
+ * authenticates the client and completes session startup.  After sending its
+ * first ReadyForQuery, the backend hands the client's socket, together with
+ * one end of a new socket pair, to one of connection_proxies proxy processes,
+ * and from then on talks to the proxy through the socket pair instead of to
+ * the client.
+ *
+ * Each proxy keeps a pool of session backends for each combination of
+ * database, role and startup options.  Clients are multiplexed onto the
+ * backends of their pool at transaction granularity: a backend is assigned
+ * to a client when the client sends a message, and it goes back to the pool
+ * when it reports ReadyForQuery outside a transaction block with no further
+ * queries or unsynced extended-protocol messages outstanding.  If no backend
+ * is free, the client waits.  A backend handed over while its pool already
+ * has session_pool_size backends is dismissed, so the number of backends
+ * does not grow with the number of clients.
+ *
+ * Before a backend serves a client other than the one it served last, the
+ * proxy sends it DISCARD ALL, and then re-creates the named prepared
+ * statements the client has made with protocol-level Parse messages.  The
+ * replies to these are not passed on to the client.  Because pools are keyed
+ * by startup options, DISCARD ALL brings the session back to the settings
+ * the client asked for when it connected.
+ *
+ * The socket passing relies on Unix-domain sockets and on children
+ * inheriting the postmaster's channel sockets through fork(), so the pooler
+ * isn't available on Windows or in EXEC_BACKEND builds.
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ *
+ *
+ * IDENTIFICATION
+ *	  src/backend/postmaster/proxy.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include <signal.h>
+#include <unistd.h>
+#ifdef HAVE_POLL_H
+#include <poll.h>
+#endif
+#ifdef HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif
+
+#include "lib/ilist.h"
+#include "libpq/libpq.h"
+#include "libpq/pqsignal.h"
+#include "miscadmin.h"
+#include "port/pg_bswap.h"
+#include "postmaster/bgworker.h"
+#include "postmaster/postmaster.h"
+#include "postmaster/proxy.h"
+#include "replication/walsender.h"
+#include "storage/ipc.h"
+#include "utils/memutils.h"
+
+#if defined(HAVE_UNIX_SOCKETS) && defined(HAVE_POLL) && !defined(EXEC_BACKEND)
+#define USE_CONNECTION_PROXY
+#endif
+
+/* GUC options */
+int			connection_proxies = 0;
+int			proxy_port = 6543;
+int			session_pool_size = 10;
+
+#ifdef USE_CONNECTION_PROXY
+
+/*
+ * Largest session handover message.  Sessions with more startup options than
+ * fit are not pooled.
+ */
+#define PROXY_MAX_HANDOVER		8192
+
+/* Initial size of the buffers of client and backend connections */
+#define PROXY_BUFSIZE			8192
+
+/*
+ * A session handover message, sent by a backend to a proxy along with the
+ * client socket and the backend's end of the socket pair.  key identifies
+ * the session pool: the database and role names, the command-line options
+ * and the other startup options, each terminated by '\0'.
+ */
+typedef struct ProxyHandover
+{
+	int32		pid;			/* PID of the backend */
+	int32		keylen;			/* length of key */
+	char		key[FLEXIBLE_ARRAY_MEMBER];
+} ProxyHandover;
+
+/*
+ * Datagram socket pairs through which backends hand sessions to proxies.
+ * They are created by the postmaster and inherited by all its children:
+ * proxy i receives from ProxyChannels[i][0] and backends send to
+ * ProxyChannels[i][1].
+ */
+static pgsocket ProxyChannels[MAX_CONNECTION_PROXIES][2];
+
+/* Bytes received from a socket and not yet passed on */
+typedef struct ProxyBuf
+{
+	char	   *data;
+	int			size;			/* allocated size of data */
+	int			start;			/* first byte not yet passed on */
+	int			end;			/* end of the bytes received */
+} ProxyBuf;
+
+typedef struct ProxyClient ProxyClient;
+typedef struct ProxyBackend ProxyBackend;
+
+/* Clients and backends that share a database, role and startup options */
+typedef struct SessionPool
+{
+	dlist_node	node;			/* list link in Pools */
+	char	   *key;			/* see ProxyHandover */
+	int			keylen;
+	int			nclients;		/* # of clients of the pool */
+	int			nbackends;		/* # of backends of the pool */
+	dlist_head	idle_backends;	/* backends not serving any client */
+	dlist_head	waiting_clients;	/* clients waiting for a backend */
+} SessionPool;
+
+/* A named prepared statement made by a client, for replay on new backends */
+typedef struct ProxyStmt
+{
+	char	   *name;
+	char	   *msg;			/* the whole Parse message */
+	int			len;
+} ProxyStmt;
+
+struct ProxyClient
+{
+	dlist_node	node;			/* list link in AllClients */
+	dlist_node	wait_node;		/* list link in pool->waiting_clients */
+	uint64		id;
+	pgsocket	sock;
+	bool		closed;			/* waiting to be freed */
+	SessionPool *pool;
+	ProxyBackend *backend;		/* backend serving the client, or NULL */
+	bool		waiting;		/* in pool->waiting_clients? */
+	ProxyBuf	in;				/* received from the client */
+	int			msg_left;		/* bytes left of the message being passed */
+	bool		need_input;		/* can't pass on in until more arrives */
+	bool		out_blocked;	/* socket full, wait until writable */
+	ProxyStmt  *stmts;
+	int			nstmts;
+	int			maxstmts;
+};
+
+struct ProxyBackend
+{
+	dlist_node	node;			/* list link in AllBackends */
+	dlist_node	idle_node;		/* list link in pool->idle_backends */
+	int			pid;
+	pgsocket	sock;
+	bool		closed;			/* waiting to be freed */
+	SessionPool *pool;
+	ProxyClient *client;		/* client being served, or NULL */
+	uint64		last_client;	/* id of the client served last */
+	ProxyBuf	in;				/* received from the backend */
+	ProxyBuf	out;			/* generated by the proxy, not yet sent */
+	int			msg_left;		/* bytes left of the message being passed */
+	bool		discard_msg;	/* drop rather than pass the message? */
+	bool		at_ready;		/* the message is a ReadyForQuery */
+	bool		need_input;		/* can't pass on in until more arrives */
+	bool		out_blocked;	/* socket full, wait until writable */
+	int			pending;		/* # of ReadyForQuery the backend owes */
+	int			discard;		/* # of those owed for the proxy's commands */
+	bool		unsynced;		/* extended-protocol messages not yet synced */
+	char		txn_status;		/* status from the last ReadyForQuery */
+};
+
+static int	MyProxyId;
+static MemoryContext ProxyContext;
+static dlist_head Pools = DLIST_STATIC_INIT(Pools);
+static dlist_head AllClients = DLIST_STATIC_INIT(AllClients);
+static dlist_head AllBackends = DLIST_STATIC_INIT(AllBackends);
+static uint64 NextClientId = 1;
+static volatile sig_atomic_t proxy_shutdown_requested = false;
+
+static void client_close(ProxyClient *client);
+static void backend_close(ProxyBackend *be);
+static bool client_forward(ProxyClient *client);
+static bool backend_forward(ProxyBackend *be);
+
+#endif							/* USE_CONNECTION_PROXY */
+
+
+/*
+ * ProxyRegister -- set up the handover channels and register the proxies
+ *
+ * Called by the postmaster at startup, before the background worker slots
+ * are sized.
+ */
+void
+ProxyRegister(void)
+{
+#ifdef USE_CONNECTION_PROXY
+	BackgroundWorker bgw;
+	int			i;
+
+	for (i = 0; i < connection_proxies; i++)
+	{
+		if (socketpair(AF_UNIX, SOCK_DGRAM, 0, ProxyChannels[i]) < 0)
+			ereport(FATAL,
+					(errcode_for_socket_access(),
+					 errmsg("could not create socket pair for connection proxy: %m")));
+		if (!pg_set_noblock(ProxyChannels[i][0]) ||
+			!pg_set_noblock(ProxyChannels[i][1]))
+			ereport(FATAL,
+					(errcode_for_socket_access(),
+					 errmsg("could not set socket to nonblocking mode: %m")));
+
+		memset(&bgw, 0, sizeof(bgw));
+		bgw.bgw_flags = BGWORKER_SHMEM_ACCESS;
+		bgw.bgw_start_time = BgWorkerStart_PostmasterStart;
+		snprintf(bgw.bgw_name, BGW_MAXLEN, "connection proxy %d", i);
+		snprintf(bgw.bgw_type, BGW_MAXLEN, "connection proxy");
+		sprintf(bgw.bgw_library_name, "postgres");
+		sprintf(bgw.bgw_function_name, "ProxyMain");
+		bgw.bgw_restart_time = 1;
+		bgw.bgw_notify_pid = 0;
+		bgw.bgw_main_arg = Int32GetDatum(i);
+
+		RegisterBackgroundWorker(&bgw);
+	}
+#else
+	if (connection_proxies > 0)
+		ereport(FATAL,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("connection pooling is not supported by this build"),
+				 errhint("Set connection_proxies to zero.")));
+#endif
+}
+
+/*
+ * ProxyCanPoolSession -- will this session be handed over to a proxy?
+ *
+ * Only connections accepted on proxy_port are pooled, and only if they use
+ * protocol version 3 and no transport encryption, whose state couldn't be
+ * handed over.  Replication connections are never pooled.
+ */
+bool
+ProxyCanPoolSession(Port *port)
+{
+#ifdef USE_CONNECTION_PROXY
+	if (!port->pooled || connection_proxies == 0 || am_walsender)
+		return false;
+	if (PG_PROTOCOL_MAJOR(port->proto) < 3 || port->ssl_in_use ||
+		port->compression)
+		return false;
+#ifdef ENABLE_GSS
+	if (be_gssapi_get_enc(port))
+		return false;
+#endif
+	return true;
+#else
+	return false;
+#endif
+}
+
+/*
+ * ProxyHandOverSession -- pass this session's client to a proxy
+ *
+ * Called in a backend for which ProxyCanPoolSession() said yes, after the
+ * first ReadyForQuery has been flushed.  On success the backend's frontend
+ * socket is replaced by a socket connected to the proxy, and it carries on
+ * serving whatever clients the proxy assigns to it.  Returns false if the
+ * session could not be handed over; the backend then keeps serving its
+ * client directly.
+ */
+bool
+ProxyHandOverSession(void)
+{
+#ifdef USE_CONNECTION_PROXY
+	union
+	{
+		ProxyHandover hdr;
+		char		data[PROXY_MAX_HANDOVER];
+	}			handover;
+	union
+	{
+		struct cmsghdr hdr;
+		char		buf[CMSG_SPACE(2 * sizeof(int))];
+	}			cmsgbuf;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	int			fds[2];
+	pgsocket	chan[2];
+	pgsocket	client_sock = MyProcPort->sock;
+	char	   *p;
+	char	   *endp;
+	ListCell   *lc;
+	int			len;
+
+	/* The proxy couldn't know about input we have already read */
+	if (pq_buffer_has_data())
+		return false;
+
+	/* Build the pool key */
+	p = handover.hdr.key;
+	endp = handover.data + sizeof(handover.data);
+#define APPEND_KEY(s) \
+	do { \
+		const char *_s = (s) ? (s) : ""; \
+		int			_len = strlen(_s) + 1; \
+		if (endp - p < _len) \
+			return false; \
+		memcpy(p, _s, _len); \
+		p += _len; \
+	} while (0)
+	APPEND_KEY(MyProcPort->database_name);
+	APPEND_KEY(MyProcPort->user_name);
+	APPEND_KEY(MyProcPort->cmdline_options);
+	foreach(lc, MyProcPort->guc_options)
+		APPEND_KEY((char *) lfirst(lc));
+#undef APPEND_KEY
+	handover.hdr.pid = MyProcPid;
+	handover.hdr.keylen = p - handover.hdr.key;
+	len = p - handover.data;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, chan) < 0)
+	{
+		ereport(LOG,
+				(errcode_for_socket_access(),
+				 errmsg("could not create socket pair for pooled session: %m")));
+		return false;
+	}
+
+	memset(&msg, 0, sizeof(msg));
+	memset(&cmsgbuf, 0, sizeof(cmsgbuf));
+	iov.iov_base = handover.data;
+	iov.iov_len = len;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cmsgbuf.buf;
+	msg.msg_controllen = sizeof(cmsgbuf.buf);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	fds[0] = client_sock;
+	fds[1] = chan[1];
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+	/*
+	 * The channel is nonblocking, so if the proxy is too far behind, we just
+	 * keep the session to ourselves.
+	 */
+	if (sendmsg(ProxyChannels[MyProcPid % connection_proxies][1],
+				&msg, 0) != len)
+	{
+		ereport(DEBUG1,
+				(errcode_for_socket_access(),
+				 errmsg("could not hand over session to connection proxy: %m")));
+		closesocket(chan[0]);
+		closesocket(chan[1]);
+		return false;
+	}
+
+	/* The proxy owns the client now */
+	closesocket(chan[1]);
+	pq_switch_socket(chan[0]);
+	closesocket(client_sock);
+
+	ereport(DEBUG1,
+			(errmsg("session handed over to connection proxy %d",
+					MyProcPid % connection_proxies)));
+	return true;
+#else
+	return false;
+#endif
+}
+
+#ifdef USE_CONNECTION_PROXY
+
+/* Make room for at least need more bytes at the end of buf */
+static void
+buf_reserve(ProxyBuf *buf, int need)
+{
+	if (buf->start > 0 && buf->size - buf->end < need)
+	{
+		memmove(buf->data, buf->data + buf->start, buf->end - buf->start);
+		buf->end -= buf->start;
+		buf->start = 0;
+	}
+	if (buf->size - buf->end < need)
+	{
+		int			newsize = Max(buf->size * 2, buf->end + need);
+
+		buf->data = repalloc(buf->data, newsize);
+		buf->size = newsize;
+	}
+}
+
+static void
+buf_init(ProxyBuf *buf)
+{
+	buf->data = palloc(PROXY_BUFSIZE);
+	buf->size = PROXY_BUFSIZE;
+	buf->start = buf->end = 0;
+}
+
+/*
+ * Read what is available from sock into buf.  Returns false on EOF or error.
+ */
+static bool
+buf_read(ProxyBuf *buf, pgsocket sock)
+{
+	ssize_t		n;
+
+	if (buf->start == buf->end)
+		buf->start = buf->end = 0;
+	buf_reserve(buf, 1);
+
+	n = recv(sock, buf->data + buf->end, buf->size - buf->end, 0);
+	if (n < 0)
+		return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+	if (n == 0)
+		return false;
+	buf->end += n;
+	return true;
+}
+
+/* Append a protocol message to buf */
+static void
+buf_append_msg(ProxyBuf *buf, char type, const char *body, int bodylen)
+{
+	uint32		n32 = pg_hton32((uint32) bodylen + 4);
+
+	buf_reserve(buf, 5 + bodylen);
+	buf->data[buf->end] = type;
+	memcpy(buf->data + buf->end + 1, &n32, 4);
+	if (bodylen > 0)
+		memcpy(buf->data + buf->end + 5, body, bodylen);
+	buf->end += 5 + bodylen;
+}
+
+/* Read the header of the protocol message at the start of buf */
+static bool
+buf_msg_header(ProxyBuf *buf, char *type, uint32 *len)
+{
+	uint32		n32;
+
+	if (buf->end - buf->start < 5)
+		return false;
+	*type = buf->data[buf->start];
+	memcpy(&n32, buf->data + buf->start + 1, 4);
+	*len = pg_ntoh32(n32);
+	return true;
+}
+
+/*
+ * Send a FATAL error to a client that hasn't got a backend, and disconnect
+ * it.
+ */
+static void
+client_fail(ProxyClient *client, const char *message)
+{
+	ProxyBuf	buf;
+	StringInfoData body;
+
+	initStringInfo(&body);
+	appendStringInfoChar(&body, PG_DIAG_SEVERITY);
+	appendBinaryStringInfo(&body, "FATAL", 6);
+	appendStringInfoChar(&body, PG_DIAG_SEVERITY_NONLOCALIZED);
+	appendBinaryStringInfo(&body, "FATAL", 6);
+	appendStringInfoChar(&body, PG_DIAG_SQLSTATE);
+	appendBinaryStringInfo(&body, "08006", 6);
+	appendStringInfoChar(&body, PG_DIAG_MESSAGE_PRIMARY);
+	appendBinaryStringInfo(&body, message, strlen(message) + 1);
+	appendStringInfoChar(&body, '\0');
+
+	buf_init(&buf);
+	buf_append_msg(&buf, 'E', body.data, body.len);
+	/* best effort; the client is disconnected either way */
+	(void) send(client->sock, buf.data, buf.end, 0);
+
+	pfree(buf.data);
+	pfree(body.data);
+	client_close(client);
+}
+
+/* Remember a named prepared statement the client is making */
+static void
+client_remember_stmt(ProxyClient *client, const char *msg, int len)
+{
+	const char *name = msg + 5;
+	int			i;
+
+	if (*name == '\0' || memchr(name, '\0', len - 5) == NULL)
+		return;					/* unnamed, or malformed */
+
+	for (i = 0; i < client->nstmts; i++)
+	{
+		if (strcmp(client->stmts[i].name, name) == 0)
+			break;
+	}
+	if (i == client->nstmts)
+	{
+		if (client->nstmts == client->maxstmts)
+		{
+			client->maxstmts = Max(client->maxstmts * 2, 8);
+			if (client->stmts)
+				client->stmts = repalloc(client->stmts,
+										 client->maxstmts * sizeof(ProxyStmt));
+			else
+				client->stmts = palloc(client->maxstmts * sizeof(ProxyStmt));
+		}
+		client->stmts[i].name = pstrdup(name);
+		client->nstmts++;
+	}
+	else
+		pfree(client->stmts[i].msg);
+
+	client->stmts[i].msg = palloc(len);
+	memcpy(client->stmts[i].msg, msg, len);
+	client->stmts[i].len = len;
+}
+
+/* Forget a prepared statement the client is closing */
+static void
+client_forget_stmt(ProxyClient *client, const char *msg, int len)
+{
+	const char *name = msg + 6;
+	int			i;
+
+	if (len < 7 || msg[5] != 'S' || memchr(name, '\0', len - 6) == NULL)
+		return;					/* a portal, or malformed */
+
+	for (i = 0; i < client->nstmts; i++)
+	{
+		if (strcmp(client->stmts[i].name, name) == 0)
+		{
+			pfree(client->stmts[i].name);
+			pfree(client->stmts[i].msg);
+			client->stmts[i] = client->stmts[--client->nstmts];
+			break;
+		}
+	}
+}
+
+/*
+ * Start serving client with backend be.  If be last served some other
+ * client, queue up the commands that reset the session first.
+ */
+static void
+backend_assign(ProxyBackend *be, ProxyClient *client)
+{
+	be->client = client;
+	client->backend = be;
+
+	if (be->last_client != client->id)
+	{
+		static const char discard_all[] = "DISCARD ALL";
+		int			i;
+
+		buf_append_msg(&be->out, 'Q', discard_all, sizeof(discard_all));
+		be->pending++;
+		be->discard++;
+
+		if (client->nstmts > 0)
+		{
+			for (i = 0; i < client->nstmts; i++)
+			{
+				buf_reserve(&be->out, client->stmts[i].len);
+				memcpy(be->out.data + be->out.end, client->stmts[i].msg,
+					   client->stmts[i].len);
+				be->out.end += client->stmts[i].len;
+			}
+			buf_append_msg(&be->out, 'S', NULL, 0);
+			be->pending++;
+			be->discard++;
+		}
+	}
+	be->last_client = client->id;
+}
+
+/*
+ * Find a backend for a client that wants to send something.  Prefer the
+ * backend that served it last, which needs no reset.  If all backends are
+ * busy, the client is queued.  Returns false if the client has to go.
+ */
+static bool
+client_attach(ProxyClient *client)
+{
+	SessionPool *pool = client->pool;
+	ProxyBackend *be = NULL;
+	dlist_iter	iter;
+
+	if (client->waiting)
+		return true;
+
+	dlist_foreach(iter, &pool->idle_backends)
+	{
+		ProxyBackend *cand = dlist_container(ProxyBackend, idle_node, iter.cur);
+
+		if (cand->last_client == client->id)
+		{
+			be = cand;
+			break;
+		}
+	}
+	if (be == NULL && !dlist_is_empty(&pool->idle_backends))
+		be = dlist_head_element(ProxyBackend, idle_node, &pool->idle_backends);
+
+	if (be == NULL)
+	{
+		if (pool->nbackends == 0)
+		{
+			client_fail(client, "no session backend available for pooled connection");
+			return false;
+		}
+		client->waiting = true;
+		dlist_push_tail(&pool->waiting_clients, &client->wait_node);
+		return true;
+	}
+
+	dlist_delete(&be->idle_node);
+	backend_assign(be, client);
+	return true;
+}
+
+/*
+ * The backend has finished serving its client.  Hand it to the next waiting
+ * client of its pool, if any, or else make it idle.
+ */
+static void
+backend_release(ProxyBackend *be)
+{
+	SessionPool *pool = be->pool;
+	ProxyClient *client;
+
+	be->client->backend = NULL;
+	be->client = NULL;
+
+	if (dlist_is_empty(&pool->waiting_clients))
+	{
+		dlist_push_head(&pool->idle_backends, &be->idle_node);
+		return;
+	}
+
+	client = dlist_container(ProxyClient, wait_node,
+							 dlist_pop_head_node(&pool->waiting_clients));
+	client->waiting = false;
+	backend_assign(be, client);
+	if (!client_forward(client))
+		client_close(client);
+}
+
+/*
+ * Send what the proxy has queued up for the backend.  Returns false if the
+ * backend is gone.
+ */
+static bool
+backend_flush(ProxyBackend *be)
+{
+	ProxyBuf   *out = &be->out;
+
+	while (out->start < out->end)
+	{
+		ssize_t		n = send(be->sock, out->data + out->start,
+							 out->end - out->start, 0);
+
+		if (n < 0)
+		{
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+			{
+				be->out_blocked = true;
+				return true;
+			}
+			return false;
+		}
+		out->start += n;
+	}
+	out->start = out->end = 0;
+	return true;
+}
+
+/*
+ * Pass messages the client has sent on to its backend, attaching one first
+ * if need be.  Returns false if the client has to be disconnected.
+ */
+static bool
+client_forward(ProxyClient *client)
+{
+	ProxyBuf   *buf = &client->in;
+
+	client->need_input = false;
+
+	while (buf->start < buf->end)
+	{
+		ProxyBackend *be;
+		ssize_t		n;
+
+		if (client->msg_left == 0)
+		{
+			char		type;
+			uint32		len;
+
+			if (!buf_msg_header(buf, &type, &len))
+			{
+				client->need_input = true;
+				break;
+			}
+			if (len < 4 ||
+				((type == 'P' || type == 'C') && len >= MaxAllocSize / 2))
+				return false;
+			if (type == 'X')
+				return false;	/* Terminate */
+
+			/* Parse and Close messages are looked at as a whole */
+			if ((type == 'P' || type == 'C') &&
+				buf->end - buf->start < (int) len + 1)
+			{
+				buf_reserve(buf, len + 1 - (buf->end - buf->start));
+				client->need_input = true;
+				break;
+			}
+
+			if (client->backend == NULL)
+			{
+				if (!client_attach(client))
+					return true;	/* already disconnected */
+				if (client->backend == NULL)
+					break;		/* waiting for a backend */
+			}
+			be = client->backend;
+
+			if (type == 'P')
+				client_remember_stmt(client, buf->data + buf->start, len + 1);
+			else if (type == 'C')
+				client_forget_stmt(client, buf->data + buf->start, len + 1);
+
+			/* Query, Sync and FunctionCall are answered by ReadyForQuery */
+			if (type == 'Q' || type == 'S' || type == 'F')
+			{
+				be->pending++;
+				be->unsynced = false;
+			}
+			else if (type != 'd' && type != 'c' && type != 'f')
+				be->unsynced = true;
+
+			client->msg_left = len + 1;
+		}
+		be = client->backend;
+
+		/* The proxy's own commands go first */
+		if (be->out.start < be->out.end)
+		{
+			if (!backend_flush(be))
+			{
+				backend_close(be);
+				return false;
+			}
+			if (be->out_blocked)
+				break;
+		}
+
+		n = send(be->sock, buf->data + buf->start,
+				 Min(buf->end - buf->start, client->msg_left), 0);
+		if (n < 0)
+		{
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+			{
+				be->out_blocked = true;
+				break;
+			}
+			backend_close(be);
+			return false;
+		}
+		buf->start += n;
+		client->msg_left -= n;
+	}
+
+	if (buf->start == buf->end)
+		buf->start = buf->end = 0;
+	return true;
+}
+
+/*
+ * Pass messages the backend has sent on to its client, or drop them if they
+ * answer the proxy's own commands or no client is being served.  Returns
+ * false if the backend has to be closed.
+ */
+static bool
+backend_forward(ProxyBackend *be)
+{
+	ProxyBuf   *buf = &be->in;
+
+	be->need_input = false;
+
+	while (buf->start < buf->end)
+	{
+		int			avail = buf->end - buf->start;
+		ssize_t		n;
+
+		if (be->msg_left == 0)
+		{
+			char		type;
+			uint32		len;
+
+			if (!buf_msg_header(buf, &type, &len))
+			{
+				be->need_input = true;
+				break;
+			}
+			if (len < 4)
+				return false;
+
+			if (type == 'Z')
+			{
+				if (len != 5)
+					return false;
+				if (avail < 6)
+				{
+					be->need_input = true;
+					break;
+				}
+				be->txn_status = buf->data[buf->start + 5];
+				if (be->pending > 0)
+					be->pending--;
+				if (be->discard > 0)
+				{
+					/* the answer to the proxy's own commands is complete */
+					be->discard--;
+					buf->start += 6;
+					continue;
+				}
+				be->at_ready = true;
+			}
+
+			be->msg_left = len + 1;
+			be->discard_msg = (be->discard > 0 || be->client == NULL);
+		}
+
+		n = Min(avail, be->msg_left);
+		if (!be->discard_msg)
+		{
+			ProxyClient *client = be->client;
+
+			n = send(client->sock, buf->data + buf->start, n, 0);
+			if (n < 0)
+			{
+				if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+				{
+					client->out_blocked = true;
+					break;
+				}
+				/* the client is gone in the middle of something */
+				client_close(client);
+				return false;
+			}
+		}
+		buf->start += n;
+		be->msg_left -= n;
+
+		if (be->msg_left == 0 && be->at_ready)
+		{
+			be->at_ready = false;
+			if (be->client && be->pending == 0 && !be->unsynced &&
+				be->txn_status == 'I')
+			{
+				backend_release(be);
+				if (be->closed)
+					return true;
+			}
+		}
+	}
+
+	if (buf->start == buf->end)
+		buf->start = buf->end = 0;
+	return true;
+}
+
+/* Find or create the pool for a key */
+static SessionPool *
+proxy_get_pool(const char *key, int keylen)
+{
+	SessionPool *pool;
+	dlist_iter	iter;
+
+	dlist_foreach(iter, &Pools)
+	{
+		pool = dlist_container(SessionPool, node, iter.cur);
+		if (pool->keylen == keylen && memcmp(pool->key, key, keylen) == 0)
+			return pool;
+	}
+
+	pool = palloc0(sizeof(SessionPool));
+	pool->key = palloc(keylen);
+	memcpy(pool->key, key, keylen);
+	pool->keylen = keylen;
+	dlist_init(&pool->idle_backends);
+	dlist_init(&pool->waiting_clients);
+	dlist_push_head(&Pools, &pool->node);
+	return pool;
+}
+
+/* Free a pool that has neither clients nor backends left */
+static void
+proxy_maybe_free_pool(SessionPool *pool)
+{
+	if (pool->nclients > 0 || pool->nbackends > 0)
+		return;
+	dlist_delete(&pool->node);
+	pfree(pool->key);
+	pfree(pool);
+}
+
+/*
+ * A backend handed over its session: take on the client, and keep the
+ * backend unless its pool is full.  The backend's session was set up for
+ * this very client, so it doesn't need a reset before serving it.
+ */
+static void
+proxy_add_session(ProxyHandover *hdr, pgsocket client_sock,
+				  pgsocket backend_sock)
+{
+	SessionPool *pool = proxy_get_pool(hdr->key, hdr->keylen);
+	ProxyClient *client;
+	ProxyBackend *be;
+
+	if (!pg_set_noblock(client_sock) || !pg_set_noblock(backend_sock))
+	{
+		ereport(LOG,
+				(errcode_for_socket_access(),
+				 errmsg("could not set socket to nonblocking mode: %m")));
+		closesocket(client_sock);
+		closesocket(backend_sock);
+		proxy_maybe_free_pool(pool);
+		return;
+	}
+
+	client = palloc0(sizeof(ProxyClient));
+	client->id = NextClientId++;
+	client->sock = client_sock;
+	client->pool = pool;
+	buf_init(&client->in);
+	dlist_push_tail(&AllClients, &client->node);
+	pool->nclients++;
+
+	if (pool->nbackends >= session_pool_size)
+	{
+		/* Dismiss the backend; it exits when it sees end of file */
+		closesocket(backend_sock);
+		return;
+	}
+
+	be = palloc0(sizeof(ProxyBackend));
+	be->pid = hdr->pid;
+	be->sock = backend_sock;
+	be->pool = pool;
+	be->last_client = client->id;
+	be->txn_status = 'I';
+	buf_init(&be->in);
+	buf_init(&be->out);
+	dlist_push_tail(&AllBackends, &be->node);
+	dlist_push_head(&pool->idle_backends, &be->idle_node);
+	pool->nbackends++;
+
+	/* Someone may have been waiting for a backend */
+	if (!dlist_is_empty(&pool->waiting_clients))
+	{
+		dlist_delete(&be->idle_node);
+		be->client = client;	/* so that backend_release has a client */
+		client->backend = be;
+		backend_release(be);
+	}
+}
+
+/* Receive the sessions backends have handed over */
+static void
+proxy_accept_sessions(void)
+{
+	for (;;)
+	{
+		union
+		{
+			ProxyHandover hdr;
+			char		data[PROXY_MAX_HANDOVER];
+		}			handover;
+		union
+		{
+			struct cmsghdr hdr;
+			char		buf[CMSG_SPACE(2 * sizeof(int))];
+		}			cmsgbuf;
+		struct msghdr msg;
+		struct iovec iov;
+		struct cmsghdr *cmsg;
+		int			fds[2];
+		ssize_t		n;
+
+		memset(&msg, 0, sizeof(msg));
+		iov.iov_base = handover.data;
+		iov.iov_len = sizeof(handover.data);
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = cmsgbuf.buf;
+		msg.msg_controllen = sizeof(cmsgbuf.buf);
+
+		n = recvmsg(ProxyChannels[MyProxyId][0], &msg, 0);
+		if (n < 0)
+		{
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+				ereport(LOG,
+						(errcode_for_socket_access(),
+						 errmsg("could not receive session from backend: %m")));
+			return;
+		}
+
+		cmsg = CMSG_FIRSTHDR(&msg);
+		if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET ||
+			cmsg->cmsg_type != SCM_RIGHTS ||
+			cmsg->cmsg_len != CMSG_LEN(sizeof(fds)))
+		{
+			ereport(LOG,
+					(errmsg("received invalid session handover message")));
+			continue;
+		}
+		memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+		if ((msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) != 0 ||
+			n < offsetof(ProxyHandover, key) ||
+			handover.hdr.keylen != n - offsetof(ProxyHandover, key))
+		{
+			ereport(LOG,
+					(errmsg("received invalid session handover message")));
+			closesocket(fds[0]);
+			closesocket(fds[1]);
+			continue;
+		}
+
+		proxy_add_session(&handover.hdr, fds[0], fds[1]);
+	}
+}
+
+/*
+ * Disconnect a client.  A backend still serving it is in an unknown state
+ * and is closed too.  The structs are freed by proxy_free_closed().
+ */
+static void
+client_close(ProxyClient *client)
+{
+	if (client->closed)
+		return;
+	client->closed = true;
+	closesocket(client->sock);
+
+	if (client->waiting)
+		dlist_delete(&client->wait_node);
+	if (client->backend)
+	{
+		client->backend->client = NULL;
+		backend_close(client->backend);
+		client->backend = NULL;
+	}
+	client->pool->nclients--;
+}
+
+/*
+ * Close a backend's socket, which makes it exit.  A client it was serving
+ * is disconnected too.
+ */
+static void
+backend_close(ProxyBackend *be)
+{
+	SessionPool *pool = be->pool;
+
+	if (be->closed)
+		return;
+	be->closed = true;
+	closesocket(be->sock);
+
+	if (be->client)
+	{
+		be->client->backend = NULL;
+		client_close(be->client);
+		be->client = NULL;
+	}
+	else
+		dlist_delete(&be->idle_node);
+	pool->nbackends--;
+
+	/* Nobody is left to serve the clients waiting in this pool */
+	if (pool->nbackends == 0)
+	{
+		while (!dlist_is_empty(&pool->waiting_clients))
+		{
+			ProxyClient *client;
+
+			client = dlist_head_element(ProxyClient, wait_node,
+										&pool->waiting_clients);
+			client_fail(client, "session backend of pooled connection terminated");
+		}
+	}
+}
+
+/* Free the clients and backends closed since the last call */
+static void
+proxy_free_closed(void)
+{
+	dlist_mutable_iter iter;
+
+	dlist_foreach_modify(iter, &AllClients)
+	{
+		ProxyClient *client = dlist_container(ProxyClient, node, iter.cur);
+		SessionPool *pool = client->pool;
+		int			i;
+
+		if (!client->closed)
+			continue;
+		dlist_delete(&client->node);
+		for (i = 0; i < client->nstmts; i++)
+		{
+			pfree(client->stmts[i].name);
+			pfree(client->stmts[i].msg);
+		}
+		if (client->stmts)
+			pfree(client->stmts);
+		pfree(client->in.data);
+		pfree(client);
+		proxy_maybe_free_pool(pool);
+	}
+
+	dlist_foreach_modify(iter, &AllBackends)
+	{
+		ProxyBackend *be = dlist_container(ProxyBackend, node, iter.cur);
+		SessionPool *pool = be->pool;
+
+		if (!be->closed)
+			continue;
+		dlist_delete(&be->node);
+		pfree(be->in.data);
+		pfree(be->out.data);
+		pfree(be);
+		proxy_maybe_free_pool(pool);
+	}
+}
+
+static void
+proxy_sigterm(SIGNAL_ARGS)
+{
+	proxy_shutdown_requested = true;
+}
+
+/*
+ * ProxyMain -- main loop of a connection proxy
+ */
+void
+ProxyMain(Datum main_arg)
+{
+	struct pollfd *pfds = NULL;
+	void	  **owners = NULL;
+	int			maxfds = 0;
+
+	MyProxyId = DatumGetInt32(main_arg);
+
+	pqsignal(SIGTERM, proxy_sigterm);
+	pqsignal(SIGPIPE, SIG_IGN);
+	BackgroundWorkerUnblockSignals();
+
+	if (MyProxyId >= connection_proxies)
+		proc_exit(0);
+
+	ProxyContext = AllocSetContextCreate(TopMemoryContext,
+										 "Connection proxy",
+										 ALLOCSET_DEFAULT_SIZES);
+	MemoryContextSwitchTo(ProxyContext);
+
+	while (!proxy_shutdown_requested)
+	{
+		dlist_iter	iter;
+		int			nfds = 0;
+		int			nclientfds;
+		int			rc;
+		int			i;
+		int			needed;
+
+		needed = 2;
+		dlist_foreach(iter, &AllClients)
+			needed++;
+		dlist_foreach(iter, &AllBackends)
+			needed++;
+		if (needed > maxfds)
+		{
+			maxfds = Max(needed, maxfds * 2);
+			if (pfds)
+			{
+				pfds = repalloc(pfds, maxfds * sizeof(struct pollfd));
+				owners = repalloc(owners, maxfds * sizeof(void *));
+			}
+			else
+			{
+				pfds = palloc(maxfds * sizeof(struct pollfd));
+				owners = palloc(maxfds * sizeof(void *));
+			}
+		}
+
+		pfds[nfds].fd = ProxyChannels[MyProxyId][0];
+		pfds[nfds].events = POLLIN;
+		owners[nfds++] = NULL;
+		pfds[nfds].fd = postmaster_alive_fds[POSTMASTER_FD_WATCH];
+		pfds[nfds].events = POLLIN;
+		owners[nfds++] = NULL;
+
+		/*
+		 * Read from a connection only when what was read before has been
+		 * passed on, or an incomplete message needs more; write to it only
+		 * when it was found full.
+		 */
+		dlist_foreach(iter, &AllClients)
+		{
+			ProxyClient *client = dlist_container(ProxyClient, node, iter.cur);
+			short		events = 0;
+
+			if (!client->waiting &&
+				!(client->backend && client->backend->out_blocked) &&
+				(client->in.start == client->in.end || client->need_input))
+				events |= POLLIN;
+			if (client->out_blocked)
+				events |= POLLOUT;
+			pfds[nfds].fd = client->sock;
+			pfds[nfds].events = events;
+			owners[nfds++] = client;
+		}
+		nclientfds = nfds;
+		dlist_foreach(iter, &AllBackends)
+		{
+			ProxyBackend *be = dlist_container(ProxyBackend, node, iter.cur);
+			short		events = 0;
+
+			if (!(be->client && be->client->out_blocked) &&
+				(be->in.start == be->in.end || be->need_input))
+				events |= POLLIN;
+			if (be->out_blocked)
+				events |= POLLOUT;
+			pfds[nfds].fd = be->sock;
+			pfds[nfds].events = events;
+			owners[nfds++] = be;
+		}
+
+		rc = poll(pfds, nfds, 1000);
+		if (rc < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			ereport(FATAL,
+					(errcode_for_socket_access(),
+					 errmsg("poll() failed in connection proxy: %m")));
+		}
+		if (rc == 0)
+			continue;
+
+		if (pfds[1].revents != 0)
+			proc_exit(1);		/* postmaster died */
+		if (pfds[0].revents != 0)
+			proxy_accept_sessions();
+
+		for (i = 2; i < nfds; i++)
+		{
+			short		revents = pfds[i].revents;
+
+			if (revents == 0)
+				continue;
+
+			if (i < nclientfds)
+			{
+				ProxyClient *client = (ProxyClient *) owners[i];
+
+				if (client->closed)
+					continue;
+				if ((revents & POLLOUT) && client->out_blocked)
+				{
+					client->out_blocked = false;
+					if (client->backend && !backend_forward(client->backend))
+					{
+						if (client->backend)
+							backend_close(client->backend);
+						continue;
+					}
+				}
+				if (revents & (POLLIN | POLLHUP | POLLERR))
+				{
+					if (!buf_read(&client->in, client->sock) ||
+						!client_forward(client))
+						client_close(client);
+				}
+			}
+			else
+			{
+				ProxyBackend *be = (ProxyBackend *) owners[i];
+
+				if (be->closed)
+					continue;
+				if ((revents & POLLOUT) && be->out_blocked)
+				{
+					be->out_blocked = false;
+					if (!backend_flush(be))
+					{
+						backend_close(be);
+						continue;
+					}
+					if (!be->out_blocked && be->client &&
+						!client_forward(be->client))
+					{
+						client_close(be->client);
+						continue;
+					}
+				}
+				if (revents & (POLLIN | POLLHUP | POLLERR))
+				{
+					if (!buf_read(&be->in, be->sock) || !backend_forward(be))
+						backend_close(be);
+				}
+			}
+		}
+
+		proxy_free_closed();
+	}
+
+	proc_exit(0);
+}
+
+#else							/* !USE_CONNECTION_PROXY */
+
+void
+ProxyMain(Datum main_arg)
+{
+	proc_exit(0);
+}
+
+#endif							/* USE_CONNECTION_PROXY */
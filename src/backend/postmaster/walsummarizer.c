@@ -0,0 +1,1228 @@
+/*-------------------------------------------------------------------------
+ *
+ * walsummarizer.c
+ *
+ * The WAL summarizer is a background worker that reads the server's WAL and
+ * writes, for each range of it, a summary of the relation blocks that the
+ * WAL modified.  Blocks are taken from the block references of each record,
+ * so they include undo log blocks, which are registered like relation
+ * blocks.  Relation creation and truncation, database creation and any
+ * stretch of WAL generated with wal_level = minimal are recorded as well,
+ * since they change files without a block reference for every block.
+ *
+ * The summaries live in pg_wal/summaries, one file per range of WAL, named
+ * after the timeline and the start and end LSN of the range.  An incremental
+ * base backup loads the summaries covering the WAL between a reference
+ * backup's start LSN and its own, and sends only the blocks they mention.
+ *
+ * The summarizer is started when the server reaches a consistent state, and
+ * only if summarize_wal is enabled.  If it exits, it resumes after the end
+ * of the newest summary on disk; WAL that has not been summarized yet is
+ * kept around by the checkpointer until it has been.
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ *
+ *
+ * IDENTIFICATION
+ *	  src/backend/postmaster/walsummarizer.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "access/timeline.h"
+#include "access/xlog.h"
+#include "access/xlog_internal.h"
+#include "access/xlogreader.h"
+#include "access/xlogutils.h"
+#include "catalog/pg_control.h"
+#include "catalog/storage_xlog.h"
+#include "commands/dbcommands_xlog.h"
+#include "lib/stringinfo.h"
+#include "libpq/pqsignal.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "port/pg_crc32c.h"
+#include "postmaster/bgworker.h"
+#include "postmaster/walsummarizer.h"
+#include "storage/fd.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/proc.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
+#include "tcop/tcopprot.h"
+#include "utils/guc.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+#include "utils/timestamp.h"
+
+
+/*
+ * GUC parameters
+ */
+bool		summarize_wal = false;
+int			wal_summary_keep_time = 10 * 24 * 60;	/* minutes */
+
+/*
+ * A summary is written out when the summarizer crosses a WAL segment
+ * boundary, when a backup asks for it, or when this many block references
+ * have piled up in memory, whichever comes first.
+ */
+#define MAX_BLOCKS_PER_SUMMARY		(1024 * 1024)
+
+/* How long to sleep when caught up, and how often to remove old summaries */
+#define SUMMARIZER_NAPTIME			1000L	/* ms */
+#define SUMMARY_CLEANUP_INTERVAL	(10 * 60 * 1000)	/* ms */
+
+/* How long a backup waits for the summarizer to make progress */
+#define SUMMARIZER_PROGRESS_TIMEOUT	(60 * 1000)		/* ms */
+
+/*
+ * A summary file is a WalSummaryFileHeader, followed by nentries entries,
+ * each a WalSummaryEntry followed by its nblocks block numbers in ascending
+ * order, followed by a CRC-32C of everything before it.
+ */
+#define WAL_SUMMARY_MAGIC			0x57534D31	/* "WSM1" */
+
+typedef struct WalSummaryFileHeader
+{
+	uint32		magic;
+	TimeLineID	tli;
+	XLogRecPtr	start_lsn;
+	XLogRecPtr	end_lsn;
+	uint32		nentries;
+} WalSummaryFileHeader;
+
+typedef struct WalSummaryEntry
+{
+	RelFileNode rnode;
+	ForkNumber	forknum;
+	BlockNumber limit_block;
+	uint32		nblocks;
+} WalSummaryEntry;
+
+/* A summary file found in WAL_SUMMARY_DIR */
+typedef struct WalSummaryFile
+{
+	TimeLineID	tli;
+	XLogRecPtr	start_lsn;
+	XLogRecPtr	end_lsn;
+} WalSummaryFile;
+
+/* Length of a summary file name, ".summary" included */
+#define WAL_SUMMARY_FNAME_LEN		(40 + 8)
+
+/*
+ * In-memory block reference table.  The blocks of an entry are kept in
+ * arrival order, with duplicates, until the entry is compacted by sorting;
+ * that happens whenever the array fills up and once more before the entry
+ * is written out or looked up.
+ */
+typedef struct BlockRefTableKey
+{
+	RelFileNode rnode;
+	ForkNumber	forknum;
+} BlockRefTableKey;
+
+typedef struct BlockRefTableEntry
+{
+	BlockRefTableKey key;		/* hash key; must be first */
+	BlockNumber limit_block;
+	uint32		nblocks;
+	uint32		maxblocks;
+	bool		sorted;
+	BlockNumber *blocks;
+} BlockRefTableEntry;
+
+struct BlockRefTable
+{
+	HTAB	   *hash;
+	MemoryContext context;
+	uint64		nblocks;		/* total block references held */
+};
+
+/*
+ * Shared state.  summarized_lsn is the end of the newest summary on disk,
+ * and is valid once the summarizer has started for the first time.
+ * request_lsn is the LSN a backup waits to see summarized, if any.
+ */
+typedef struct WalSummarizerCtlData
+{
+	slock_t		mutex;
+	bool		initialized;
+	TimeLineID	summarized_tli;
+	XLogRecPtr	summarized_lsn;
+	XLogRecPtr	request_lsn;
+	int			summarizer_pgprocno;	/* -1 if not running */
+} WalSummarizerCtlData;
+
+static WalSummarizerCtlData *WalSummarizerCtl = NULL;
+
+/* Flags set by interrupt handlers for later service in the main loop. */
+static volatile sig_atomic_t got_SIGHUP = false;
+
+static void walsummarizer_sighup(SIGNAL_ARGS);
+static void walsummarizer_exit(int code, Datum arg);
+static void summarize_record(BlockRefTable *brtab, XLogReaderState *record);
+static void write_wal_summary(BlockRefTable *brtab, TimeLineID tli,
+							  XLogRecPtr start_lsn, XLogRecPtr end_lsn);
+static void read_wal_summary(BlockRefTable *brtab, WalSummaryFile *ws);
+static List *list_wal_summaries(List *history);
+static bool summary_in_history(WalSummaryFile *ws, List *history);
+static void remove_old_wal_summaries(void);
+static void brt_init_hash(BlockRefTable *brtab);
+static BlockRefTableEntry *brt_get_entry(BlockRefTable *brtab,
+										 const RelFileNode *rnode,
+										 ForkNumber forknum, bool create);
+static void brt_compact_entry(BlockRefTableEntry *entry);
+static int	blocknumber_cmp(const void *a, const void *b);
+static int	wal_summary_cmp(const void *a, const void *b);
+
+/* ----------------------------------------------------------------
+ *				Block reference tables
+ * ----------------------------------------------------------------
+ */
+
+/*
+ * Create an empty block reference table.  Its contents live in a memory
+ * context of their own, a child of the current one.
+ */
+BlockRefTable *
+CreateBlockRefTable(void)
+{
+	BlockRefTable *brtab;
+
+	brtab = palloc(sizeof(BlockRefTable));
+	brtab->context = AllocSetContextCreate(CurrentMemoryContext,
+										   "block reference table",
+										   ALLOCSET_DEFAULT_SIZES);
+	brt_init_hash(brtab);
+
+	return brtab;
+}
+
+/*
+ * Record that a block of a relation fork was modified.
+ */
+void
+BlockRefTableMarkBlock(BlockRefTable *brtab, const RelFileNode *rnode,
+					   ForkNumber forknum, BlockNumber blkno)
+{
+	BlockRefTableEntry *entry = brt_get_entry(brtab, rnode, forknum, true);
+
+	/* Cheap check for the common case of a block modified repeatedly */
+	if (entry->nblocks > 0 && entry->blocks[entry->nblocks - 1] == blkno)
+		return;
+
+	if (entry->nblocks >= entry->maxblocks)
+	{
+		/* Drop duplicates first, and only grow if that didn't help much */
+		brtab->nblocks -= entry->nblocks;
+		brt_compact_entry(entry);
+		brtab->nblocks += entry->nblocks;
+
+		if (entry->nblocks >= entry->maxblocks / 2)
+		{
+			entry->maxblocks *= 2;
+			entry->blocks = repalloc(entry->blocks,
+									 sizeof(BlockNumber) * entry->maxblocks);
+		}
+	}
+
+	entry->blocks[entry->nblocks++] = blkno;
+	entry->sorted = false;
+	brtab->nblocks++;
+}
+
+/*
+ * Record that a relation fork was created, or truncated, at 'limit' blocks.
+ */
+void
+BlockRefTableSetLimit(BlockRefTable *brtab, const RelFileNode *rnode,
+					  ForkNumber forknum, BlockNumber limit)
+{
+	BlockRefTableEntry *entry = brt_get_entry(brtab, rnode, forknum, true);
+
+	if (limit < entry->limit_block)
+		entry->limit_block = limit;
+}
+
+/*
+ * Get the limit block of a relation fork.
+ *
+ * Database creation and unlogged stretches of WAL are recorded as entries
+ * with a limit of zero, keyed by the database with an invalid relation, or
+ * by an all-invalid RelFileNode for the whole cluster; they apply to every
+ * fork they cover.
+ */
+BlockNumber
+BlockRefTableGetLimit(BlockRefTable *brtab, const RelFileNode *rnode,
+					  ForkNumber forknum)
+{
+	BlockRefTableEntry *entry;
+	RelFileNode marker;
+
+	memset(&marker, 0, sizeof(marker));
+	if (brt_get_entry(brtab, &marker, MAIN_FORKNUM, false) != NULL)
+		return 0;
+
+	marker.spcNode = rnode->spcNode;
+	marker.dbNode = rnode->dbNode;
+	if (brt_get_entry(brtab, &marker, MAIN_FORKNUM, false) != NULL)
+		return 0;
+
+	entry = brt_get_entry(brtab, rnode, forknum, false);
+	return entry != NULL ? entry->limit_block : InvalidBlockNumber;
+}
+
+/*
+ * Fetch the modified blocks of a relation fork that fall within
+ * [start_blkno, stop_blkno), in ascending order, into 'blocks'.  At most
+ * 'nblocks' are returned; the return value is the number found.
+ */
+int
+BlockRefTableGetBlocks(BlockRefTable *brtab, const RelFileNode *rnode,
+					   ForkNumber forknum, BlockNumber start_blkno,
+					   BlockNumber stop_blkno, BlockNumber *blocks,
+					   int nblocks)
+{
+	BlockRefTableEntry *entry;
+	uint32		lo,
+				hi;
+	int			n = 0;
+
+	entry = brt_get_entry(brtab, rnode, forknum, false);
+	if (entry == NULL || entry->nblocks == 0)
+		return 0;
+
+	if (!entry->sorted)
+	{
+		brtab->nblocks -= entry->nblocks;
+		brt_compact_entry(entry);
+		brtab->nblocks += entry->nblocks;
+	}
+
+	/* Binary search for the first block at or after start_blkno */
+	lo = 0;
+	hi = entry->nblocks;
+	while (lo < hi)
+	{
+		uint32		mid = lo + (hi - lo) / 2;
+
+		if (entry->blocks[mid] < start_blkno)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	while (lo < entry->nblocks && entry->blocks[lo] < stop_blkno &&
+		   n < nblocks)
+		blocks[n++] = entry->blocks[lo++];
+
+	return n;
+}
+
+static void
+brt_init_hash(BlockRefTable *brtab)
+{
+	HASHCTL		ctl;
+
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(BlockRefTableKey);
+	ctl.entrysize = sizeof(BlockRefTableEntry);
+	ctl.hcxt = brtab->context;
+	brtab->hash = hash_create("block reference table", 1024, &ctl,
+							  HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+	brtab->nblocks = 0;
+}
+
+static BlockRefTableEntry *
+brt_get_entry(BlockRefTable *brtab, const RelFileNode *rnode,
+			  ForkNumber forknum, bool create)
+{
+	BlockRefTableKey key;
+	BlockRefTableEntry *entry;
+	bool		found;
+
+	memset(&key, 0, sizeof(key));
+	key.rnode = *rnode;
+	key.forknum = forknum;
+
+	entry = hash_search(brtab->hash, &key, create ? HASH_ENTER : HASH_FIND,
+						&found);
+	if (create && !found)
+	{
+		entry->limit_block = InvalidBlockNumber;
+		entry->nblocks = 0;
+		entry->maxblocks = 16;
+		entry->sorted = true;
+		entry->blocks = MemoryContextAlloc(brtab->context,
+										   sizeof(BlockNumber) * entry->maxblocks);
+	}
+
+	return entry;
+}
+
+/*
+ * Sort the blocks of an entry and remove duplicates.
+ */
+static void
+brt_compact_entry(BlockRefTableEntry *entry)
+{
+	uint32		i,
+				n;
+
+	if (entry->sorted || entry->nblocks == 0)
+	{
+		entry->sorted = true;
+		return;
+	}
+
+	qsort(entry->blocks, entry->nblocks, sizeof(BlockNumber), blocknumber_cmp);
+
+	n = 1;
+	for (i = 1; i < entry->nblocks; i++)
+	{
+		if (entry->blocks[i] != entry->blocks[n - 1])
+			entry->blocks[n++] = entry->blocks[i];
+	}
+	entry->nblocks = n;
+	entry->sorted = true;
+}
+
+static int
+blocknumber_cmp(const void *a, const void *b)
+{
+	BlockNumber ba = *(const BlockNumber *) a;
+	BlockNumber bb = *(const BlockNumber *) b;
+
+	if (ba < bb)
+		return -1;
+	if (ba > bb)
+		return 1;
+	return 0;
+}
+
+/* ----------------------------------------------------------------
+ *				Shared memory and registration
+ * ----------------------------------------------------------------
+ */
+
+Size
+WalSummarizerShmemSize(void)
+{
+	return sizeof(WalSummarizerCtlData);
+}
+
+void
+WalSummarizerShmemInit(void)
+{
+	bool		found;
+
+	WalSummarizerCtl = (WalSummarizerCtlData *)
+		ShmemInitStruct("Wal Summarizer Ctl", WalSummarizerShmemSize(),
+						&found);
+
+	if (!found)
+	{
+		SpinLockInit(&WalSummarizerCtl->mutex);
+		WalSummarizerCtl->initialized = false;
+		WalSummarizerCtl->summarized_tli = 0;
+		WalSummarizerCtl->summarized_lsn = InvalidXLogRecPtr;
+		WalSummarizerCtl->request_lsn = InvalidXLogRecPtr;
+		WalSummarizerCtl->summarizer_pgprocno = -1;
+	}
+}
+
+/*
+ * WalSummarizerRegister -- register the WAL summarizer, if summarize_wal
+ */
+void
+WalSummarizerRegister(void)
+{
+	BackgroundWorker bgw;
+
+	if (!summarize_wal)
+		return;
+
+	memset(&bgw, 0, sizeof(bgw));
+	bgw.bgw_flags = BGWORKER_SHMEM_ACCESS;
+	bgw.bgw_start_time = BgWorkerStart_ConsistentState;
+	snprintf(bgw.bgw_name, BGW_MAXLEN, "wal summarizer");
+	snprintf(bgw.bgw_type, BGW_MAXLEN, "wal summarizer");
+	sprintf(bgw.bgw_library_name, "postgres");
+	sprintf(bgw.bgw_function_name, "WalSummarizerMain");
+	bgw.bgw_restart_time = 5;
+	bgw.bgw_notify_pid = 0;
+	bgw.bgw_main_arg = (Datum) 0;
+
+	RegisterBackgroundWorker(&bgw);
+}
+
+/*
+ * Get the oldest LSN that has not been summarized yet, for the benefit of
+ * the checkpointer, which must not remove WAL the summarizer still needs.
+ * Returns InvalidXLogRecPtr if summarization is disabled, and 0/1 if the
+ * summarizer has not started yet, so that all WAL is kept until it does.
+ */
+XLogRecPtr
+GetOldestUnsummarizedLSN(void)
+{
+	XLogRecPtr	result;
+
+	if (!summarize_wal || WalSummarizerCtl == NULL)
+		return InvalidXLogRecPtr;
+
+	SpinLockAcquire(&WalSummarizerCtl->mutex);
+	if (WalSummarizerCtl->initialized)
+		result = WalSummarizerCtl->summarized_lsn;
+	else
+		result = 1;
+	SpinLockRelease(&WalSummarizerCtl->mutex);
+
+	return result;
+}
+
+/*
+ * Wait until all WAL before 'lsn' has been summarized and written to disk.
+ *
+ * The summarizer normally writes a summary only at the end of a WAL segment,
+ * so advertise what we need and wake it up.  Error out if it makes no
+ * progress for a while, rather than hanging forever.
+ */
+void
+WaitForWalSummarization(XLogRecPtr lsn)
+{
+	XLogRecPtr	last_seen = InvalidXLogRecPtr;
+	TimestampTz last_progress = GetCurrentTimestamp();
+
+	if (!summarize_wal)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("incremental backups require WAL summarization"),
+				 errhint("Set \"summarize_wal\" to on and restart the server.")));
+
+	for (;;)
+	{
+		bool		initialized;
+		XLogRecPtr	summarized_lsn;
+		int			pgprocno;
+
+		SpinLockAcquire(&WalSummarizerCtl->mutex);
+		if (WalSummarizerCtl->request_lsn < lsn)
+			WalSummarizerCtl->request_lsn = lsn;
+		initialized = WalSummarizerCtl->initialized;
+		summarized_lsn = WalSummarizerCtl->summarized_lsn;
+		pgprocno = WalSummarizerCtl->summarizer_pgprocno;
+		SpinLockRelease(&WalSummarizerCtl->mutex);
+
+		if (initialized && summarized_lsn >= lsn)
+			break;
+
+		if (summarized_lsn != last_seen)
+		{
+			last_seen = summarized_lsn;
+			last_progress = GetCurrentTimestamp();
+		}
+		else if (TimestampDifferenceExceeds(last_progress,
+											GetCurrentTimestamp(),
+											SUMMARIZER_PROGRESS_TIMEOUT))
+			ereport(ERROR,
+					(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+					 errmsg("WAL summarization is not progressing"),
+					 errdetail("Summarization is needed through %X/%X, but is stuck at %X/%X.",
+							   (uint32) (lsn >> 32), (uint32) lsn,
+							   (uint32) (summarized_lsn >> 32),
+							   (uint32) summarized_lsn)));
+
+		if (pgprocno >= 0)
+			SetLatch(&ProcGlobal->allProcs[pgprocno].procLatch);
+
+		(void) WaitLatch(MyLatch,
+						 WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
+						 100L, WAIT_EVENT_WAL_SUMMARY_READY);
+		ResetLatch(MyLatch);
+		CHECK_FOR_INTERRUPTS();
+	}
+}
+
+/* ----------------------------------------------------------------
+ *				The summarizer process
+ * ----------------------------------------------------------------
+ */
+
+/* SIGHUP: set flag to reload configuration at next convenient time */
+static void
+walsummarizer_sighup(SIGNAL_ARGS)
+{
+	int			save_errno = errno;
+
+	got_SIGHUP = true;
+	SetLatch(MyLatch);
+
+	errno = save_errno;
+}
+
+static void
+walsummarizer_exit(int code, Datum arg)
+{
+	SpinLockAcquire(&WalSummarizerCtl->mutex);
+	WalSummarizerCtl->summarizer_pgprocno = -1;
+	SpinLockRelease(&WalSummarizerCtl->mutex);
+}
+
+/*
+ * WalSummarizerMain -- main loop of the WAL summarizer
+ */
+void
+WalSummarizerMain(Datum main_arg)
+{
+	XLogReaderState *reader;
+	BlockRefTable *brtab;
+	List	   *history;
+	ListCell   *lc;
+	TimeLineID	current_tli;
+	TimeLineID	summary_tli = 0;
+	XLogRecPtr	summary_start = InvalidXLogRecPtr;
+	XLogRecPtr	summary_end;
+	XLogSegNo	segno;
+	bool		first = true;
+	TimestampTz last_cleanup = 0;
+
+	pqsignal(SIGHUP, walsummarizer_sighup);
+	pqsignal(SIGTERM, die);
+	BackgroundWorkerUnblockSignals();
+
+	if (MakePGDirectory(WAL_SUMMARY_DIR) < 0 && errno != EEXIST)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not create directory \"%s\": %m",
+						WAL_SUMMARY_DIR)));
+
+	/* This sets ThisTimeLineID on a primary, as read_local_xlog_page needs */
+	if (RecoveryInProgress())
+		(void) GetXLogReplayRecPtr(&current_tli);
+	else
+		current_tli = ThisTimeLineID;
+
+	/* Resume after the newest summary that belongs to our history */
+	history = readTimeLineHistory(current_tli);
+	foreach(lc, list_wal_summaries(history))
+	{
+		WalSummaryFile *ws = (WalSummaryFile *) lfirst(lc);
+
+		if (ws->end_lsn > summary_start)
+		{
+			summary_start = ws->end_lsn;
+			summary_tli = ws->tli;
+		}
+	}
+
+	/*
+	 * If the WAL after it is gone, which happens if summarization was
+	 * disabled for a while, start over from the last checkpoint.  Backups
+	 * whose WAL range spans the gap will be refused.
+	 */
+	if (!XLogRecPtrIsInvalid(summary_start))
+	{
+		XLByteToSeg(summary_start, segno, wal_segment_size);
+		if (segno <= XLogGetLastRemovedSegno())
+			summary_start = InvalidXLogRecPtr;
+	}
+	if (XLogRecPtrIsInvalid(summary_start))
+	{
+		summary_start = GetRedoRecPtr();
+		summary_tli = 0;
+	}
+	summary_end = summary_start;
+
+	ereport(DEBUG1,
+			(errmsg("WAL summarizer starting at %X/%X",
+					(uint32) (summary_start >> 32), (uint32) summary_start)));
+
+	SpinLockAcquire(&WalSummarizerCtl->mutex);
+	WalSummarizerCtl->initialized = true;
+	WalSummarizerCtl->summarized_tli = summary_tli;
+	WalSummarizerCtl->summarized_lsn = summary_start;
+	WalSummarizerCtl->summarizer_pgprocno = MyProc->pgprocno;
+	SpinLockRelease(&WalSummarizerCtl->mutex);
+	on_shmem_exit(walsummarizer_exit, (Datum) 0);
+
+	brtab = CreateBlockRefTable();
+
+	reader = XLogReaderAllocate(wal_segment_size, &read_local_xlog_page, NULL);
+	if (reader == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OUT_OF_MEMORY),
+				 errmsg("out of memory"),
+				 errdetail("Failed while allocating a WAL reading processor.")));
+
+	for (;;)
+	{
+		XLogRecPtr	read_lsn;
+		XLogRecPtr	available_lsn;
+		XLogRecPtr	request_lsn;
+		XLogRecord *record;
+		char	   *errormsg;
+		XLogSegNo	start_segno;
+
+		CHECK_FOR_INTERRUPTS();
+
+		if (got_SIGHUP)
+		{
+			got_SIGHUP = false;
+			ProcessConfigFile(PGC_SIGHUP);
+		}
+
+		SpinLockAcquire(&WalSummarizerCtl->mutex);
+		request_lsn = WalSummarizerCtl->request_lsn;
+		SpinLockRelease(&WalSummarizerCtl->mutex);
+
+		/*
+		 * If we've caught up with the WAL that can be read, write out what we
+		 * have if a backup is waiting for it, and otherwise take a nap.
+		 */
+		read_lsn = first ? summary_start : reader->EndRecPtr;
+		if (RecoveryInProgress())
+			available_lsn = GetXLogReplayRecPtr(NULL);
+		else
+			available_lsn = GetFlushRecPtr();
+
+		if (read_lsn >= available_lsn)
+		{
+			if (summary_end > summary_start &&
+				!XLogRecPtrIsInvalid(request_lsn) &&
+				request_lsn > summary_start)
+			{
+				write_wal_summary(brtab, summary_tli, summary_start,
+								  summary_end);
+				summary_start = summary_end;
+				continue;
+			}
+
+			if (wal_summary_keep_time > 0 &&
+				TimestampDifferenceExceeds(last_cleanup,
+										   GetCurrentTimestamp(),
+										   SUMMARY_CLEANUP_INTERVAL))
+			{
+				remove_old_wal_summaries();
+				last_cleanup = GetCurrentTimestamp();
+			}
+
+			(void) WaitLatch(MyLatch,
+							 WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
+							 SUMMARIZER_NAPTIME,
+							 WAIT_EVENT_WAL_SUMMARIZER_MAIN);
+			ResetLatch(MyLatch);
+			continue;
+		}
+
+		record = XLogReadRecord(reader, first ? summary_start : InvalidXLogRecPtr,
+								&errormsg);
+		if (record == NULL)
+		{
+			if (errormsg)
+				ereport(ERROR,
+						(errmsg("could not read WAL at %X/%X: %s",
+								(uint32) (read_lsn >> 32), (uint32) read_lsn,
+								errormsg)));
+			else
+				ereport(ERROR,
+						(errmsg("could not read WAL at %X/%X",
+								(uint32) (read_lsn >> 32), (uint32) read_lsn)));
+		}
+		first = false;
+
+		/*
+		 * A summary never spans a timeline switch: the old timeline's part
+		 * ends where the last record on it ended, which is where the new
+		 * timeline begins.
+		 */
+		if (summary_tli == 0)
+			summary_tli = reader->currTLI;
+		else if (reader->currTLI != summary_tli)
+		{
+			if (summary_end > summary_start)
+				write_wal_summary(brtab, summary_tli, summary_start,
+								  summary_end);
+			summary_start = summary_end;
+			summary_tli = reader->currTLI;
+		}
+
+		summarize_record(brtab, reader);
+		summary_end = reader->EndRecPtr;
+
+		/* Time to write out a summary? */
+		XLByteToSeg(summary_start, start_segno, wal_segment_size);
+		XLByteToSeg(summary_end, segno, wal_segment_size);
+		if (segno != start_segno ||
+			brtab->nblocks >= MAX_BLOCKS_PER_SUMMARY ||
+			(!XLogRecPtrIsInvalid(request_lsn) && summary_end >= request_lsn &&
+			 request_lsn > summary_start))
+		{
+			write_wal_summary(brtab, summary_tli, summary_start, summary_end);
+			summary_start = summary_end;
+		}
+	}
+}
+
+/*
+ * Add the blocks, and the creations and truncations, of one WAL record to
+ * the block reference table.
+ */
+static void
+summarize_record(BlockRefTable *brtab, XLogReaderState *record)
+{
+	uint8		rmid = XLogRecGetRmid(record);
+	uint8		info = XLogRecGetInfo(record) & ~XLR_INFO_MASK;
+	int			block_id;
+
+	for (block_id = 0; block_id <= record->max_block_id; block_id++)
+	{
+		RelFileNode rnode;
+		ForkNumber	forknum;
+		BlockNumber blkno;
+
+		if (!XLogRecGetBlockTag(record, block_id, &rnode, &forknum, &blkno))
+			continue;
+		BlockRefTableMarkBlock(brtab, &rnode, forknum, blkno);
+	}
+
+	if (rmid == RM_SMGR_ID && info == XLOG_SMGR_CREATE)
+	{
+		xl_smgr_create *xlrec = (xl_smgr_create *) XLogRecGetData(record);
+
+		BlockRefTableSetLimit(brtab, &xlrec->rnode, xlrec->forkNum, 0);
+	}
+	else if (rmid == RM_SMGR_ID && info == XLOG_SMGR_TRUNCATE)
+	{
+		xl_smgr_truncate *xlrec = (xl_smgr_truncate *) XLogRecGetData(record);
+
+		if ((xlrec->flags & SMGR_TRUNCATE_HEAP) != 0)
+			BlockRefTableSetLimit(brtab, &xlrec->rnode, MAIN_FORKNUM,
+								  xlrec->blkno);
+
+		/*
+		 * The map page that covers the truncation point is cleared without
+		 * a block reference, so treat the whole map as new.  Pages taken
+		 * from the reference backup would only be less precise, not wrong,
+		 * if they were zeroes.
+		 */
+		if ((xlrec->flags & SMGR_TRUNCATE_VM) != 0)
+			BlockRefTableSetLimit(brtab, &xlrec->rnode,
+								  VISIBILITYMAP_FORKNUM, 0);
+		if ((xlrec->flags & SMGR_TRUNCATE_FSM) != 0)
+			BlockRefTableSetLimit(brtab, &xlrec->rnode, FSM_FORKNUM, 0);
+	}
+	else if (rmid == RM_DBASE_ID && info == XLOG_DBASE_CREATE)
+	{
+		xl_dbase_create_rec *xlrec =
+		(xl_dbase_create_rec *) XLogRecGetData(record);
+		RelFileNode marker;
+
+		/* The files were copied without WAL, so all of them are new */
+		marker.spcNode = xlrec->tablespace_id;
+		marker.dbNode = xlrec->db_id;
+		marker.relNode = InvalidOid;
+		BlockRefTableSetLimit(brtab, &marker, MAIN_FORKNUM, 0);
+	}
+	else if (rmid == RM_XLOG_ID && info == XLOG_PARAMETER_CHANGE)
+	{
+		xl_parameter_change xlrec;
+
+		memcpy(&xlrec, XLogRecGetData(record), sizeof(xl_parameter_change));
+		if (xlrec.wal_level < WAL_LEVEL_REPLICA)
+		{
+			RelFileNode marker;
+
+			/* Anything may have changed without WAL from here on */
+			memset(&marker, 0, sizeof(marker));
+			BlockRefTableSetLimit(brtab, &marker, MAIN_FORKNUM, 0);
+		}
+	}
+}
+
+/*
+ * Write the block reference table out as the summary of the given range of
+ * WAL, advertise it, and empty the table for the next range.
+ */
+static void
+write_wal_summary(BlockRefTable *brtab, TimeLineID tli,
+				  XLogRecPtr start_lsn, XLogRecPtr end_lsn)
+{
+	char		path[MAXPGPATH];
+	char		temppath[MAXPGPATH];
+	StringInfoData buf;
+	WalSummaryFileHeader hdr;
+	HASH_SEQ_STATUS status;
+	BlockRefTableEntry *entry;
+	pg_crc32c	crc;
+	int			fd;
+
+	snprintf(path, MAXPGPATH, WAL_SUMMARY_DIR "/%08X%08X%08X%08X%08X.summary",
+			 tli,
+			 (uint32) (start_lsn >> 32), (uint32) start_lsn,
+			 (uint32) (end_lsn >> 32), (uint32) end_lsn);
+	snprintf(temppath, MAXPGPATH, "%s.tmp", path);
+
+	initStringInfo(&buf);
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = WAL_SUMMARY_MAGIC;
+	hdr.tli = tli;
+	hdr.start_lsn = start_lsn;
+	hdr.end_lsn = end_lsn;
+	hdr.nentries = hash_get_num_entries(brtab->hash);
+	appendBinaryStringInfo(&buf, (char *) &hdr, sizeof(hdr));
+
+	hash_seq_init(&status, brtab->hash);
+	while ((entry = hash_seq_search(&status)) != NULL)
+	{
+		WalSummaryEntry wse;
+
+		brt_compact_entry(entry);
+
+		memset(&wse, 0, sizeof(wse));
+		wse.rnode = entry->key.rnode;
+		wse.forknum = entry->key.forknum;
+		wse.limit_block = entry->limit_block;
+		wse.nblocks = entry->nblocks;
+		appendBinaryStringInfo(&buf, (char *) &wse, sizeof(wse));
+		appendBinaryStringInfo(&buf, (char *) entry->blocks,
+							   sizeof(BlockNumber) * entry->nblocks);
+	}
+
+	INIT_CRC32C(crc);
+	COMP_CRC32C(crc, buf.data, buf.len);
+	FIN_CRC32C(crc);
+	appendBinaryStringInfo(&buf, (char *) &crc, sizeof(crc));
+
+	fd = OpenTransientFile(temppath, O_WRONLY | O_CREAT | O_TRUNC | PG_BINARY);
+	if (fd < 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not create file \"%s\": %m", temppath)));
+
+	errno = 0;
+	if (write(fd, buf.data, buf.len) != buf.len)
+	{
+		/* if write didn't set errno, assume problem is no disk space */
+		if (errno == 0)
+			errno = ENOSPC;
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not write file \"%s\": %m", temppath)));
+	}
+
+	if (pg_fsync(fd) != 0)
+		ereport(data_sync_elevel(ERROR),
+				(errcode_for_file_access(),
+				 errmsg("could not fsync file \"%s\": %m", temppath)));
+
+	if (CloseTransientFile(fd))
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not close file \"%s\": %m", temppath)));
+
+	(void) durable_rename(temppath, path, ERROR);
+
+	ereport(DEBUG1,
+			(errmsg("summarized WAL on timeline %u from %X/%X to %X/%X",
+					tli,
+					(uint32) (start_lsn >> 32), (uint32) start_lsn,
+					(uint32) (end_lsn >> 32), (uint32) end_lsn)));
+
+	SpinLockAcquire(&WalSummarizerCtl->mutex);
+	WalSummarizerCtl->summarized_tli = tli;
+	WalSummarizerCtl->summarized_lsn = end_lsn;
+	if (WalSummarizerCtl->request_lsn <= end_lsn)
+		WalSummarizerCtl->request_lsn = InvalidXLogRecPtr;
+	SpinLockRelease(&WalSummarizerCtl->mutex);
+
+	pfree(buf.data);
+
+	/* Start over with an empty table */
+	MemoryContextReset(brtab->context);
+	brt_init_hash(brtab);
+}
+
+/*
+ * Remove summary files older than wal_summary_keep_time.
+ */
+static void
+remove_old_wal_summaries(void)
+{
+	DIR		   *dir;
+	struct dirent *de;
+	time_t		cutoff;
+
+	cutoff = time(NULL) - (time_t) wal_summary_keep_time * SECS_PER_MINUTE;
+
+	dir = AllocateDir(WAL_SUMMARY_DIR);
+	while ((de = ReadDir(dir, WAL_SUMMARY_DIR)) != NULL)
+	{
+		char		path[MAXPGPATH * 2];
+		struct stat statbuf;
+
+		if (strlen(de->d_name) != WAL_SUMMARY_FNAME_LEN ||
+			strcmp(de->d_name + 40, ".summary") != 0)
+			continue;
+
+		snprintf(path, sizeof(path), WAL_SUMMARY_DIR "/%s", de->d_name);
+		if (stat(path, &statbuf) != 0 || statbuf.st_mtime >= cutoff)
+			continue;
+
+		ereport(DEBUG2,
+				(errmsg("removing WAL summary file \"%s\"", path)));
+		if (unlink(path) != 0 && errno != ENOENT)
+			ereport(LOG,
+					(errcode_for_file_access(),
+					 errmsg("could not remove file \"%s\": %m", path)));
+	}
+	FreeDir(dir);
+}
+
+/* ----------------------------------------------------------------
+ *				Reading summaries
+ * ----------------------------------------------------------------
+ */
+
+/*
+ * Build a block reference table from the summaries covering WAL from
+ * start_lsn to end_lsn on the history of timeline 'tli'.  The summaries must
+ * cover the range without gaps; it's an error otherwise.
+ */
+BlockRefTable *
+LoadWalSummaries(TimeLineID tli, XLogRecPtr start_lsn, XLogRecPtr end_lsn)
+{
+	BlockRefTable *brtab = CreateBlockRefTable();
+	List	   *summaries;
+	WalSummaryFile **sorted;
+	XLogRecPtr	covered = start_lsn;
+	int			nsummaries;
+	int			i;
+	ListCell   *lc;
+
+	summaries = list_wal_summaries(readTimeLineHistory(tli));
+	nsummaries = list_length(summaries);
+	sorted = palloc(sizeof(WalSummaryFile *) * Max(nsummaries, 1));
+	i = 0;
+	foreach(lc, summaries)
+		sorted[i++] = (WalSummaryFile *) lfirst(lc);
+	qsort(sorted, nsummaries, sizeof(WalSummaryFile *), wal_summary_cmp);
+
+	/*
+	 * Walk forward from start_lsn, each time taking the summary that covers
+	 * the next unsummarized LSN and reaches furthest.
+	 */
+	i = 0;
+	while (covered < end_lsn)
+	{
+		WalSummaryFile *best = NULL;
+
+		for (; i < nsummaries && sorted[i]->start_lsn <= covered; i++)
+		{
+			if (sorted[i]->end_lsn > covered &&
+				(best == NULL || sorted[i]->end_lsn > best->end_lsn))
+				best = sorted[i];
+		}
+
+		if (best == NULL)
+			ereport(ERROR,
+					(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+					 errmsg("WAL summaries are required from %X/%X to %X/%X, but no summary covers %X/%X",
+							(uint32) (start_lsn >> 32), (uint32) start_lsn,
+							(uint32) (end_lsn >> 32), (uint32) end_lsn,
+							(uint32) (covered >> 32), (uint32) covered),
+					 errhint("The reference backup may be older than wal_summary_keep_time, or WAL summarization was disabled after it was taken.")));
+
+		read_wal_summary(brtab, best);
+		covered = best->end_lsn;
+	}
+
+	pfree(sorted);
+	list_free_deep(summaries);
+
+	return brtab;
+}
+
+/*
+ * Merge one summary file into a block reference table.
+ */
+static void
+read_wal_summary(BlockRefTable *brtab, WalSummaryFile *ws)
+{
+	char		path[MAXPGPATH];
+	struct stat statbuf;
+	char	   *data;
+	char	   *p;
+	char	   *end;
+	WalSummaryFileHeader hdr;
+	pg_crc32c	crc;
+	pg_crc32c	file_crc;
+	uint32		i;
+	int			fd;
+	int			r;
+
+	snprintf(path, MAXPGPATH, WAL_SUMMARY_DIR "/%08X%08X%08X%08X%08X.summary",
+			 ws->tli,
+			 (uint32) (ws->start_lsn >> 32), (uint32) ws->start_lsn,
+			 (uint32) (ws->end_lsn >> 32), (uint32) ws->end_lsn);
+
+	fd = OpenTransientFile(path, O_RDONLY | PG_BINARY);
+	if (fd < 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not open file \"%s\": %m", path)));
+	if (fstat(fd, &statbuf) != 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not stat file \"%s\": %m", path)));
+	if (statbuf.st_size < sizeof(WalSummaryFileHeader) + sizeof(pg_crc32c))
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_CORRUPTED),
+				 errmsg("WAL summary file \"%s\" is too short", path)));
+
+	data = palloc(statbuf.st_size);
+	r = read(fd, data, statbuf.st_size);
+	if (r != statbuf.st_size)
+	{
+		if (r < 0)
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not read file \"%s\": %m", path)));
+		else
+			ereport(ERROR,
+					(errcode(ERRCODE_DATA_CORRUPTED),
+					 errmsg("could not read file \"%s\": read %d of %zu",
+							path, r, (Size) statbuf.st_size)));
+	}
+	if (CloseTransientFile(fd))
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not close file \"%s\": %m", path)));
+
+	end = data + statbuf.st_size - sizeof(pg_crc32c);
+	INIT_CRC32C(crc);
+	COMP_CRC32C(crc, data, end - data);
+	FIN_CRC32C(crc);
+	memcpy(&file_crc, end, sizeof(pg_crc32c));
+	memcpy(&hdr, data, sizeof(hdr));
+	if (!EQ_CRC32C(crc, file_crc) || hdr.magic != WAL_SUMMARY_MAGIC)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_CORRUPTED),
+				 errmsg("WAL summary file \"%s\" is corrupt", path)));
+
+	p = data + sizeof(hdr);
+	for (i = 0; i < hdr.nentries; i++)
+	{
+		WalSummaryEntry wse;
+		uint32		j;
+
+		if (end - p < sizeof(wse))
+			ereport(ERROR,
+					(errcode(ERRCODE_DATA_CORRUPTED),
+					 errmsg("WAL summary file \"%s\" is corrupt", path)));
+		memcpy(&wse, p, sizeof(wse));
+		p += sizeof(wse);
+
+		if ((end - p) / sizeof(BlockNumber) < wse.nblocks)
+			ereport(ERROR,
+					(errcode(ERRCODE_DATA_CORRUPTED),
+					 errmsg("WAL summary file \"%s\" is corrupt", path)));
+
+		if (wse.limit_block != InvalidBlockNumber)
+			BlockRefTableSetLimit(brtab, &wse.rnode, wse.forknum,
+								  wse.limit_block);
+		for (j = 0; j < wse.nblocks; j++)
+		{
+			BlockNumber blkno;
+
+			memcpy(&blkno, p, sizeof(BlockNumber));
+			p += sizeof(BlockNumber);
+			BlockRefTableMarkBlock(brtab, &wse.rnode, wse.forknum, blkno);
+		}
+	}
+
+	pfree(data);
+}
+
+/*
+ * List the summary files on disk that belong to the given timeline history.
+ */
+static List *
+list_wal_summaries(List *history)
+{
+	List	   *result = NIL;
+	DIR		   *dir;
+	struct dirent *de;
+
+	dir = AllocateDir(WAL_SUMMARY_DIR);
+	while ((de = ReadDirExtended(dir, WAL_SUMMARY_DIR, DEBUG1)) != NULL)
+	{
+		WalSummaryFile *ws;
+		uint32		start_hi,
+					start_lo,
+					end_hi,
+					end_lo;
+		TimeLineID	tli;
+
+		if (strlen(de->d_name) != WAL_SUMMARY_FNAME_LEN ||
+			strspn(de->d_name, "0123456789ABCDEF") != 40 ||
+			strcmp(de->d_name + 40, ".summary") != 0)
+			continue;
+		if (sscanf(de->d_name, "%08X%08X%08X%08X%08X", &tli,
+				   &start_hi, &start_lo, &end_hi, &end_lo) != 5)
+			continue;
+
+		ws = palloc(sizeof(WalSummaryFile));
+		ws->tli = tli;
+		ws->start_lsn = ((uint64) start_hi) << 32 | start_lo;
+		ws->end_lsn = ((uint64) end_hi) << 32 | end_lo;
+
+		if (summary_in_history(ws, history))
+			result = lappend(result, ws);
+		else
+			pfree(ws);
+	}
+	FreeDir(dir);
+
+	return result;
+}
+
+/*
+ * Does the WAL a summary covers belong to the given timeline history?
+ */
+static bool
+summary_in_history(WalSummaryFile *ws, List *history)
+{
+	ListCell   *lc;
+
+	foreach(lc, history)
+	{
+		TimeLineHistoryEntry *tle = (TimeLineHistoryEntry *) lfirst(lc);
+
+		if (tle->tli == ws->tli)
+			return ws->start_lsn >= tle->begin &&
+				(XLogRecPtrIsInvalid(tle->end) || ws->end_lsn <= tle->end);
+	}
+
+	return false;
+}
+
+static int
+wal_summary_cmp(const void *a, const void *b)
+{
+	const WalSummaryFile *wa = *(WalSummaryFile *const *) a;
+	const WalSummaryFile *wb = *(WalSummaryFile *const *) b;
+
+	if (wa->start_lsn < wb->start_lsn)
+		return -1;
+	if (wa->start_lsn > wb->start_lsn)
+		return 1;
+	return 0;
+}
@@ -385,6 +385,8 @@ pg_regcomp(regex_t *re,
 	v->cm = &g->cmap;
 	g->lacons = NULL;
 	g->nlacons = 0;
+	g->searchdfa = NULL;
+	g->maindfa = NULL;
 	ZAPCNFA(g->search);
 	v->nfa = newnfa(v, v->cm, (struct nfa *) NULL);
 	CNOERR();
@@ -1994,6 +1996,7 @@ rfree(regex_t *re)
 	if (g != NULL)
 	{
 		g->magic = 0;
+		pg_reg_freedfas(g);
 		freecm(&g->cmap);
 		if (g->tree != NULL)
 			freesubre((struct vars *) NULL, g->tree);
@@ -532,6 +532,75 @@ freedfa(struct dfa *d)
 		FREE(d->mallocarea);
 }
 
+/*
+ * getsaveddfa - get the DFA kept from an earlier execution, or a fresh one
+ *
+ * The state-set cache of a DFA depends only on its NFA and the colormap, not
+ * on the string being matched (miss() never links transitions that depend on
+ * lookaround constraints), so a regex that is executed many times can keep
+ * its search and main DFAs in its guts rather than rebuilding the cache on
+ * every call.  Only the pointers into the previous string must be forgotten.
+ * The DFA is detached from *slot while in use; putsaveddfa() puts it back.
+ */
+static struct dfa *
+getsaveddfa(struct vars *v,
+			struct dfa **slot,
+			struct cnfa *cnfa,
+			struct colormap *cm,
+			struct smalldfa *sml)	/* preallocated space, may be NULL */
+{
+	struct dfa *d = *slot;
+	int			i;
+
+	/* REG_SMALL is for testing the cache replacement; don't keep those */
+	if (v->eflags & REG_SMALL)
+		return newdfa(v, cnfa, cm, sml);
+
+	if (d == NULL)
+		return newdfa(v, cnfa, cm, DOMALLOC);
+
+	*slot = NULL;
+	for (i = 0; i < d->nssused; i++)
+		d->ssets[i].lastseen = NULL;
+	d->lastpost = NULL;
+	d->lastnopr = NULL;
+	return d;
+}
+
+/*
+ * putsaveddfa - keep a DFA obtained from getsaveddfa() for later executions
+ *
+ * A DFA that was in use when an error occurred is not trusted, and freed.
+ */
+static void
+putsaveddfa(struct vars *v,
+			struct dfa **slot,
+			struct dfa *d)
+{
+	if (d == NULL)
+		return;
+	if ((v->eflags & REG_SMALL) || ISERR() || *slot != NULL)
+	{
+		freedfa(d);
+		return;
+	}
+	*slot = d;
+}
+
+/*
+ * pg_reg_freedfas - free the DFAs kept with a regex, when it is freed
+ */
+void
+pg_reg_freedfas(struct guts *g)
+{
+	if (g->searchdfa != NULL)
+		freedfa(g->searchdfa);
+	g->searchdfa = NULL;
+	if (g->maindfa != NULL)
+		freedfa(g->maindfa);
+	g->maindfa = NULL;
+}
+
 /*
  * hash - construct a hash code for a bitvector
  *
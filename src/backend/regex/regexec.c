@@ -157,6 +157,8 @@ static int	matchuntil(struct vars *, struct dfa *, chr *, struct sset **, chr **
 static chr *lastcold(struct vars *, struct dfa *);
 static struct dfa *newdfa(struct vars *, struct cnfa *, struct colormap *, struct smalldfa *);
 static void freedfa(struct dfa *);
+static struct dfa *getsaveddfa(struct vars *, struct dfa **, struct cnfa *, struct colormap *, struct smalldfa *);
+static void putsaveddfa(struct vars *, struct dfa **, struct dfa *);
 static unsigned hash(unsigned *, int);
 static struct sset *initialize(struct vars *, struct dfa *, chr *);
 static struct sset *miss(struct vars *, struct dfa *, struct sset *, color, chr *, chr *);
@@ -387,14 +389,14 @@ find(struct vars *v,
 	int			shorter = (v->g->tree->flags & SHORTER) ? 1 : 0;
 
 	/* first, a shot with the search RE */
-	s = newdfa(v, &v->g->search, cm, &v->dfa1);
+	s = getsaveddfa(v, &v->g->searchdfa, &v->g->search, cm, &v->dfa1);
 	assert(!(ISERR() && s != NULL));
 	NOERR();
 	MDEBUG(("\nsearch at %ld\n", LOFF(v->start)));
 	cold = NULL;
 	close = shortest(v, s, v->search_start, v->search_start, v->stop,
 					 &cold, (int *) NULL);
-	freedfa(s);
+	putsaveddfa(v, &v->g->searchdfa, s);
 	NOERR();
 	if (v->g->cflags & REG_EXPECT)
 	{
@@ -415,7 +417,7 @@ find(struct vars *v,
 	open = cold;
 	cold = NULL;
 	MDEBUG(("between %ld and %ld\n", LOFF(open), LOFF(close)));
-	d = newdfa(v, cnfa, cm, &v->dfa1);
+	d = getsaveddfa(v, &v->g->maindfa, cnfa, cm, &v->dfa1);
 	assert(!(ISERR() && d != NULL));
 	NOERR();
 	for (begin = open; begin <= close; begin++)
@@ -428,7 +430,7 @@ find(struct vars *v,
 			end = longest(v, d, begin, v->stop, &hitend);
 		if (ISERR())
 		{
-			freedfa(d);
+			putsaveddfa(v, &v->g->maindfa, d);
 			return v->err;
 		}
 		if (hitend && cold == NULL)
@@ -437,7 +439,7 @@ find(struct vars *v,
 			break;				/* NOTE BREAK OUT */
 	}
 	assert(end != NULL);		/* search RE succeeded so loop should */
-	freedfa(d);
+	putsaveddfa(v, &v->g->maindfa, d);
 
 	/* and pin down details */
 	assert(v->nmatch > 0);
@@ -472,20 +474,20 @@ cfind(struct vars *v,
 	chr		   *cold;
 	int			ret;
 
-	s = newdfa(v, &v->g->search, cm, &v->dfa1);
+	s = getsaveddfa(v, &v->g->searchdfa, &v->g->search, cm, &v->dfa1);
 	NOERR();
-	d = newdfa(v, cnfa, cm, &v->dfa2);
+	d = getsaveddfa(v, &v->g->maindfa, cnfa, cm, &v->dfa2);
 	if (ISERR())
 	{
 		assert(d == NULL);
-		freedfa(s);
+		putsaveddfa(v, &v->g->searchdfa, s);
 		return v->err;
 	}
 
 	ret = cfindloop(v, cnfa, cm, d, s, &cold);
 
-	freedfa(d);
-	freedfa(s);
+	putsaveddfa(v, &v->g->maindfa, d);
+	putsaveddfa(v, &v->g->searchdfa, s);
 	NOERR();
 	if (v->g->cflags & REG_EXPECT)
 	{
@@ -16,7 +16,9 @@
 #include <unistd.h>
 #include <time.h>
 
+#include "access/undolog.h"
 #include "access/xlog_internal.h"	/* for pg_start/stop_backup */
+#include "catalog/pg_tablespace_d.h"
 #include "catalog/pg_type.h"
 #include "common/file_perm.h"
 #include "lib/stringinfo.h"
@@ -28,7 +30,9 @@
 #include "pgstat.h"
 #include "port.h"
 #include "postmaster/syslogger.h"
+#include "postmaster/walsummarizer.h"
 #include "replication/basebackup.h"
+#include "replication/basebackup_incremental.h"
 #include "replication/walsender.h"
 #include "replication/walsender_private.h"
 #include "storage/bufpage.h"
@@ -52,6 +56,7 @@ typedef struct
 	bool		includewal;
 	uint32		maxrate;
 	bool		sendtblspcmapfile;
+	XLogRecPtr	incremental_lsn;
 } basebackup_options;
 
 
@@ -59,6 +64,11 @@ static int64 sendDir(const char *path, int basepathlen, bool sizeonly,
 					 List *tablespaces, bool sendtblspclinks);
 static bool sendFile(const char *readfilename, const char *tarfilename,
 					 struct stat *statbuf, bool missing_ok, Oid dboid);
+static bool sendIncrementalFile(const char *readfilename,
+								const char *tarfilename,
+								struct stat *statbuf, FILE *fp);
+static bool parse_relation_path(const char *path, RelFileNode *rnode,
+								ForkNumber *forknum, BlockNumber *segstart);
 static void sendFileWithContent(const char *filename, const char *content);
 static int64 _tarWriteHeader(const char *filename, const char *linktarget,
 							 struct stat *statbuf, bool sizeonly);
@@ -111,6 +121,13 @@ static int64 total_checksum_failures;
 /* Do not verify checksums. */
 static bool noverify_checksums = false;
 
+/*
+ * Blocks changed since the reference backup, if this is an incremental
+ * backup, and the tablespace being sent, to identify its relation files.
+ */
+static BlockRefTable *incremental_brtab = NULL;
+static Oid	sending_tablespace_oid = InvalidOid;
+
 /*
  * The contents of these directories are removed or recreated during server
  * start so they are not included in backups.  The directories themselves are
@@ -241,6 +258,7 @@ perform_base_backup(basebackup_options *opt)
 	tblspc_map_file = makeStringInfo();
 
 	total_checksum_failures = 0;
+	incremental_brtab = NULL;
 
 	startptr = do_pg_start_backup(opt->label, opt->fastcheckpoint, &starttli,
 								  labelfile, &tablespaces,
@@ -261,6 +279,31 @@ perform_base_backup(basebackup_options *opt)
 
 		SendXlogRecPtrResult(startptr, starttli);
 
+		/*
+		 * For an incremental backup, find out what changed since the
+		 * reference backup started, once the summarizer has caught up with
+		 * our own start, and mark the label so that the result can't be
+		 * started by mistake.
+		 */
+		if (!XLogRecPtrIsInvalid(opt->incremental_lsn))
+		{
+			if (opt->incremental_lsn > startptr)
+				ereport(ERROR,
+						(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+						 errmsg("reference backup start location %X/%X is after this backup's start location %X/%X",
+								(uint32) (opt->incremental_lsn >> 32),
+								(uint32) opt->incremental_lsn,
+								(uint32) (startptr >> 32), (uint32) startptr)));
+
+			WaitForWalSummarization(startptr);
+			incremental_brtab = LoadWalSummaries(starttli,
+												 opt->incremental_lsn,
+												 startptr);
+			appendStringInfo(labelfile, INCREMENTAL_LABEL_LINE ": %X/%X\n",
+							 (uint32) (opt->incremental_lsn >> 32),
+							 (uint32) opt->incremental_lsn);
+		}
+
 		/*
 		 * Calculate the relative path of temporary statistics directory in
 		 * order to skip the files which are located in that directory later.
@@ -317,6 +360,8 @@ perform_base_backup(basebackup_options *opt)
 			pq_sendint16(&buf, 0);	/* natts */
 			pq_endmessage(&buf);
 
+			sending_tablespace_oid = ti->path ? atooid(ti->oid) : InvalidOid;
+
 			if (ti->path == NULL)
 			{
 				struct stat statbuf;
@@ -650,6 +695,7 @@ parse_basebackup_options(List *options, basebackup_options *opt)
 	bool		o_maxrate = false;
 	bool		o_tablespace_map = false;
 	bool		o_noverify_checksums = false;
+	bool		o_incremental = false;
 
 	MemSet(opt, 0, sizeof(*opt));
 	foreach(lopt, options)
@@ -738,6 +784,27 @@ parse_basebackup_options(List *options, basebackup_options *opt)
 			noverify_checksums = true;
 			o_noverify_checksums = true;
 		}
+		else if (strcmp(defel->defname, "incremental") == 0)
+		{
+			char	   *lsn = strVal(defel->arg);
+			uint32		hi,
+						lo;
+
+			if (o_incremental)
+				ereport(ERROR,
+						(errcode(ERRCODE_SYNTAX_ERROR),
+						 errmsg("duplicate option \"%s\"", defel->defname)));
+
+			if (sscanf(lsn, "%X/%X", &hi, &lo) != 2 ||
+				(hi == 0 && lo == 0))
+				ereport(ERROR,
+						(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						 errmsg("invalid value for parameter \"%s\": \"%s\"",
+								"INCREMENTAL", lsn)));
+
+			opt->incremental_lsn = ((uint64) hi) << 32 | lo;
+			o_incremental = true;
+		}
 		else
 			elog(ERROR, "option \"%s\" not recognized",
 				 defel->defname);
@@ -1394,6 +1461,14 @@ sendFile(const char *readfilename, const char *tarfilename, struct stat *statbuf
 				 errmsg("could not open file \"%s\": %m", readfilename)));
 	}
 
+	/* In an incremental backup, send only the changed blocks if we can */
+	if (incremental_brtab != NULL &&
+		sendIncrementalFile(readfilename, tarfilename, statbuf, fp))
+	{
+		FreeFile(fp);
+		return true;
+	}
+
 	_tarWriteHeader(tarfilename, NULL, statbuf, false);
 
 	if (!noverify_checksums && DataChecksumsEnabled())
@@ -1592,6 +1667,226 @@ sendFile(const char *readfilename, const char *tarfilename, struct stat *statbuf
 	return true;
 }
 
+/*
+ * Send a relation segment file as an incremental file, holding only the
+ * blocks changed since the reference backup; see basebackup_incremental.h.
+ *
+ * Returns false, having sent nothing, if the file isn't a relation segment,
+ * if the summaries say that all of it is new, or if so much of it changed
+ * that the whole file might as well be sent.  The caller then sends it in
+ * full.  The free space map is always sent in full, since it isn't
+ * WAL-logged.
+ *
+ * Checksums aren't verified here.  The blocks sent are ones that WAL
+ * touched recently, and torn copies are fixed by replay.
+ */
+static bool
+sendIncrementalFile(const char *readfilename, const char *tarfilename,
+					struct stat *statbuf, FILE *fp)
+{
+	RelFileNode rnode;
+	ForkNumber	forknum;
+	BlockNumber segstart;
+	BlockNumber file_blocks;
+	BlockNumber limit;
+	BlockNumber *blocks;
+	int			nblocks;
+	IncrementalFileHeader hdr;
+	struct stat incstatbuf;
+	char		incfilename[MAXPGPATH];
+	const char *sep;
+	char		buf[BLCKSZ];
+	Size		len;
+	size_t		pad;
+	int			i;
+
+	if (!parse_relation_path(readfilename, &rnode, &forknum, &segstart) ||
+		forknum == FSM_FORKNUM ||
+		statbuf->st_size % BLCKSZ != 0 ||
+		statbuf->st_size == 0)
+		return false;
+	file_blocks = statbuf->st_size / BLCKSZ;
+
+	/* If the fork was created or truncated before this segment, it's new */
+	limit = BlockRefTableGetLimit(incremental_brtab, &rnode, forknum);
+	if (limit != InvalidBlockNumber && limit <= segstart)
+		return false;
+	if (limit == InvalidBlockNumber || limit - segstart > file_blocks)
+		limit = file_blocks;
+	else
+		limit -= segstart;
+
+	blocks = palloc(sizeof(BlockNumber) * file_blocks);
+	nblocks = BlockRefTableGetBlocks(incremental_brtab, &rnode, forknum,
+									 segstart, segstart + file_blocks,
+									 blocks, file_blocks);
+
+	/* Not worth it if 90% or more of the file would be sent anyway */
+	if ((uint64) nblocks * 10 >= (uint64) file_blocks * 9)
+	{
+		pfree(blocks);
+		return false;
+	}
+
+	for (i = 0; i < nblocks; i++)
+		blocks[i] -= segstart;
+
+	sep = last_dir_separator(tarfilename);
+	if (sep == NULL)
+		snprintf(incfilename, sizeof(incfilename), "%s%s",
+				 INCREMENTAL_PREFIX, tarfilename);
+	else
+		snprintf(incfilename, sizeof(incfilename), "%.*s%s%s",
+				 (int) (sep + 1 - tarfilename), tarfilename,
+				 INCREMENTAL_PREFIX, sep + 1);
+
+	hdr.magic = INCREMENTAL_MAGIC;
+	hdr.nblocks = nblocks;
+	hdr.file_blocks = file_blocks;
+	hdr.limit_block = limit;
+
+	len = sizeof(hdr) + sizeof(BlockNumber) * nblocks + (Size) BLCKSZ * nblocks;
+	incstatbuf = *statbuf;
+	incstatbuf.st_size = len;
+	_tarWriteHeader(incfilename, NULL, &incstatbuf, false);
+
+	if (pq_putmessage('d', (char *) &hdr, sizeof(hdr)) ||
+		(nblocks > 0 &&
+		 pq_putmessage('d', (char *) blocks, sizeof(BlockNumber) * nblocks)))
+		ereport(ERROR,
+				(errmsg("base backup could not send data, aborting backup")));
+	throttle(sizeof(hdr) + sizeof(BlockNumber) * nblocks);
+
+	for (i = 0; i < nblocks; i++)
+	{
+		size_t		cnt;
+
+		if (fseeko(fp, (off_t) blocks[i] * BLCKSZ, SEEK_SET) != 0)
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not fseek in file \"%s\": %m",
+							readfilename)));
+
+		/*
+		 * If the file was truncated while we were sending it, send zeroes
+		 * like sendFile does.  WAL replay will fix it up.
+		 */
+		cnt = fread(buf, 1, BLCKSZ, fp);
+		if (cnt < BLCKSZ)
+		{
+			if (ferror(fp))
+				ereport(ERROR,
+						(errcode_for_file_access(),
+						 errmsg("could not read file \"%s\": %m",
+								readfilename)));
+			MemSet(buf + cnt, 0, BLCKSZ - cnt);
+		}
+
+		if (pq_putmessage('d', buf, BLCKSZ))
+			ereport(ERROR,
+					(errmsg("base backup could not send data, aborting backup")));
+		throttle(BLCKSZ);
+	}
+
+	/* Pad to 512 byte boundary, per tar format requirements. */
+	pad = ((len + 511) & ~511) - len;
+	if (pad > 0)
+	{
+		MemSet(buf, 0, pad);
+		pq_putmessage('d', buf, pad);
+	}
+
+	pfree(blocks);
+
+	return true;
+}
+
+/*
+ * Identify the relation fork, and the number of its first block, that a file
+ * in a database directory, the global directory or an undo directory holds.
+ * Undo logs are keyed like relations, with UndoLogDatabaseOid and the log
+ * number, and their segment files are named after their starting offset.
+ *
+ * Returns false if the file isn't a relation or undo segment.
+ */
+static bool
+parse_relation_path(const char *path, RelFileNode *rnode,
+					ForkNumber *forknum, BlockNumber *segstart)
+{
+	char		dirpath[MAXPGPATH];
+	const char *filename;
+	const char *dirname;
+	int			parentlen;
+	int			oidchars;
+
+	filename = last_dir_separator(path);
+	if (filename == NULL || filename - path >= MAXPGPATH)
+		return false;
+	memcpy(dirpath, path, filename - path);
+	dirpath[filename - path] = '\0';
+	filename++;
+
+	dirname = last_dir_separator(dirpath);
+	if (dirname == NULL)
+		return false;
+	parentlen = dirname - dirpath;
+	dirname++;
+
+	if (strcmp(dirpath, "./global") == 0)
+	{
+		rnode->spcNode = GLOBALTABLESPACE_OID;
+		rnode->dbNode = InvalidOid;
+	}
+	else
+	{
+		/* The parent must be $PGDATA/base or a tablespace version path */
+		if (parentlen == strlen("./base") &&
+			strncmp(dirpath, "./base", parentlen) == 0)
+			rnode->spcNode = DEFAULTTABLESPACE_OID;
+		else if (OidIsValid(sending_tablespace_oid) &&
+				 parentlen >= (sizeof(TABLESPACE_VERSION_DIRECTORY) - 1) &&
+				 strncmp(dirname - 1 - (sizeof(TABLESPACE_VERSION_DIRECTORY) - 1),
+						 TABLESPACE_VERSION_DIRECTORY,
+						 sizeof(TABLESPACE_VERSION_DIRECTORY) - 1) == 0)
+			rnode->spcNode = sending_tablespace_oid;
+		else
+			return false;
+
+		if (strcmp(dirname, "undo") == 0)
+		{
+			uint32		logno;
+			uint64		offset;
+
+			if (strlen(filename) != 17 || filename[6] != '.' ||
+				strspn(filename, "0123456789ABCDEF") != 6 ||
+				strspn(filename + 7, "0123456789ABCDEF") != 10 ||
+				sscanf(filename, "%06X.%010" INT64_MODIFIER "X",
+					   &logno, &offset) != 2)
+				return false;
+
+			rnode->dbNode = UndoLogDatabaseOid;
+			rnode->relNode = logno;
+			*forknum = MAIN_FORKNUM;
+			*segstart = offset / BLCKSZ;
+			return true;
+		}
+
+		if (dirname[0] == '\0' ||
+			strspn(dirname, "0123456789") != strlen(dirname))
+			return false;
+		rnode->dbNode = atooid(dirname);
+	}
+
+	if (!parse_filename_for_nontemp_relation(filename, &oidchars, forknum))
+		return false;
+	rnode->relNode = atooid(filename);
+	*segstart = 0;
+	if (strchr(filename, '.') != NULL)
+		*segstart = atoi(strchr(filename, '.') + 1) * RELSEG_SIZE;
+
+	return true;
+}
+
 
 static int64
 _tarWriteHeader(const char *filename, const char *linktarget,
@@ -0,0 +1,1254 @@
+/*-------------------------------------------------------------------------
+ * applyparallelworker.c
+ *	   Parallel apply of logical replication changes
+ *
+ * Copyright (c) 2016-2019, PostgreSQL Global Development Group
+ *
+ * IDENTIFICATION
+ *	  src/backend/replication/logical/applyparallelworker.c
+ *
+ * NOTES
+ *	  When max_parallel_apply_workers_per_subscription is set, the main apply
+ *	  worker of a subscription (the leader) starts that many parallel apply
+ *	  workers and hands each remote transaction to one of them as soon as its
+ *	  BEGIN arrives.  The remaining messages of the transaction are forwarded
+ *	  to the same worker through a shm_mq as they are received, so a large
+ *	  transaction is applied while the publisher is still streaming it,
+ *	  rather than after its commit has been received.
+ *
+ *	  Every transaction dispatched gets a sequence number, and the workers
+ *	  commit strictly in sequence order, which is the publisher's commit
+ *	  order.  The workers share the leader's replication origin; since they
+ *	  commit in order, the origin's progress is the end of the last
+ *	  transaction that was committed, as with serial apply.  The leader
+ *	  collects the workers' commit positions and reports them to the
+ *	  publisher.
+ *
+ *	  Transactions that modify rows with the same replica identity key are
+ *	  not independent.  The leader remembers, for a hash of every key it has
+ *	  seen recently, the last transaction that touched it.  When a change in
+ *	  a later transaction hits a key whose transaction hasn't committed yet,
+ *	  the leader tells the worker to wait for that commit before applying the
+ *	  change.  Changes whose key can't be determined, and TRUNCATE, make the
+ *	  transaction wait for all earlier ones, and all later ones wait for it.
+ *
+ *	  Conflicts the key tracking can't see (unique indexes other than the
+ *	  replica identity, foreign keys, triggers) may make a transaction block
+ *	  on a row locked by a later one, which in turn waits for the earlier
+ *	  one to commit.  To let the deadlock detector see the wait, each worker
+ *	  holds a lock on its transaction's sequence number while applying it,
+ *	  and waits for an earlier commit by acquiring the earlier transaction's
+ *	  lock.  A worker that gets a deadlock error spools the transaction to
+ *	  a temporary file as it arrives, rolls back, asks all later
+ *	  transactions to back off the same way, and replays the transaction once
+ *	  everything before it has committed.
+ *
+ *	  While any table of the subscription is not in READY state, the leader
+ *	  waits for the workers to finish and applies transactions itself, so
+ *	  that table synchronization sees the same ordering as without parallel
+ *	  apply.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "access/xact.h"
+#include "libpq/pqformat.h"
+#include "libpq/pqsignal.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "port/atomics.h"
+#include "postmaster/bgworker.h"
+#include "replication/logicallauncher.h"
+#include "replication/logicalproto.h"
+#include "replication/logicalrelation.h"
+#include "replication/logicalworker.h"
+#include "replication/origin.h"
+#include "replication/worker_internal.h"
+#include "storage/buffile.h"
+#include "storage/dsm.h"
+#include "storage/ipc.h"
+#include "storage/lmgr.h"
+#include "storage/proc.h"
+#include "storage/shm_mq.h"
+#include "storage/shm_toc.h"
+#include "storage/spin.h"
+#include "tcop/tcopprot.h"
+#include "utils/guc.h"
+#include "utils/hashutils.h"
+#include "utils/hsearch.h"
+#include "utils/inval.h"
+#include "utils/memutils.h"
+
+#define PARALLEL_APPLY_MAGIC		0x50a1a991
+#define PARALLEL_APPLY_KEY_SHARED	0
+#define PARALLEL_APPLY_KEY_QUEUE	1	/* plus the worker number */
+
+/* Size of the queue from the leader to each worker. */
+#define PARALLEL_APPLY_QUEUE_SIZE	(1024 * 1024)
+
+/*
+ * Messages the leader sends besides the replication protocol messages.  They
+ * are chosen not to clash with the protocol's message types.
+ */
+#define PARALLEL_APPLY_MSG_START	's' /* start of a transaction, with its
+										 * sequence number */
+#define PARALLEL_APPLY_MSG_WAIT		'w' /* wait for a transaction to commit */
+
+/* Prune the key table at a BEGIN once it has grown past this many entries. */
+#define PARALLEL_APPLY_KEYS_PRUNE	65536
+
+typedef struct ParallelApplyWorkerSlot
+{
+	slock_t		mutex;
+	PGPROC	   *proc;			/* NULL until the worker has started */
+	uint64		seq;			/* transaction last handed out, or 0 when
+								 * that one is done */
+	uint64		done_seq;		/* last transaction committed */
+	XLogRecPtr	remote_end;		/* remote end of done_seq */
+	XLogRecPtr	local_end;		/* local commit end of done_seq, or invalid
+								 * if nothing was applied */
+	bool		yield;			/* should back off for an earlier
+								 * transaction */
+} ParallelApplyWorkerSlot;
+
+typedef struct ParallelApplyShared
+{
+	Oid			dbid;
+	Oid			userid;
+	Oid			subid;
+	RepOriginId originid;
+	int			leader_pid;
+	PGPROC	   *leader;
+	pg_atomic_uint64 last_committed_seq;
+	int			nworkers;
+	ParallelApplyWorkerSlot slots[FLEXIBLE_ARRAY_MEMBER];
+} ParallelApplyShared;
+
+/* Entry of the leader's table of recently modified keys. */
+typedef struct ParallelApplyKey
+{
+	uint64		hash;			/* hash of relation and key values */
+	uint64		seq;			/* last transaction that modified it */
+} ParallelApplyKey;
+
+static ParallelApplyShared *pa_shared = NULL;
+
+/* Leader state. */
+static dsm_segment *pa_seg = NULL;
+static int	pa_nworkers = 0;
+static shm_mq_handle **pa_mqh = NULL;
+static BackgroundWorkerHandle **pa_handles = NULL;
+static uint64 *pa_assigned = NULL;	/* last transaction of each worker */
+static bool *pa_busy = NULL;
+static int *pa_inflight = NULL; /* busy workers, in sequence order */
+static int	pa_ninflight = 0;
+static int	pa_next_worker = 0;
+static uint64 pa_last_seq = 0;	/* last sequence number handed out */
+static uint64 pa_barrier_seq = 0;	/* last transaction all later ones wait
+									 * for */
+static int	pa_current = -1;	/* worker of the transaction being received */
+static bool pa_serial = false;	/* leader applies the current transaction */
+static uint64 pa_waited_seq = 0;	/* latest wait sent for pa_current */
+static HTAB *pa_keys = NULL;
+
+/* Parallel apply worker state. */
+static ParallelApplyWorkerSlot *MyParallelApplySlot = NULL;
+static shm_mq_handle *pa_worker_mqh = NULL;
+static uint64 pa_my_seq = 0;	/* transaction being applied, or 0 */
+static BufFile *pa_spool = NULL;
+static int	pa_spool_nmsgs = 0;
+
+static volatile sig_atomic_t got_SIGHUP = false;
+
+static void pa_shutdown_workers(int code, Datum arg);
+static void pa_check_workers(void);
+static void pa_wait_for_workers(bool all);
+static void pa_send(int worker, const char *data, Size len);
+static void pa_send_control(int worker, char type, uint64 seq);
+static void pa_wait_before(uint64 seq);
+static void pa_track_change(StringInfo s);
+static void pa_track_tuple(LogicalRepRelId relid, LogicalRepTupleData *tuple);
+static void pa_prune_keys(void);
+
+static void pa_worker_loop(void);
+static void pa_worker_handle_message(StringInfo s);
+static void pa_apply_message(StringInfo s);
+static void pa_check_yield(void);
+static void pa_request_yield(void);
+static void pa_wait_for_commit(uint64 seq);
+static void pa_wakeup_all(void);
+static void pa_spool_reset(void);
+static void pa_spool_write(StringInfo s);
+static void pa_spool_replay(void);
+
+/*
+ * Start the parallel apply workers of the current subscription.
+ *
+ * Called by the main apply worker before it starts streaming, after it has
+ * set up its replication origin.  If no worker can be started, apply stays
+ * serial.
+ */
+void
+pa_launch_workers(void)
+{
+	int			nworkers = max_parallel_apply_workers_per_subscription;
+	MemoryContext oldctx;
+	shm_toc_estimator e;
+	shm_toc    *toc;
+	Size		shared_size;
+	Size		segsize;
+	int			i;
+
+	Assert(!am_tablesync_worker() && pa_seg == NULL);
+
+	oldctx = MemoryContextSwitchTo(ApplyContext);
+
+	shared_size = add_size(offsetof(ParallelApplyShared, slots),
+						   mul_size(nworkers, sizeof(ParallelApplyWorkerSlot)));
+	shm_toc_initialize_estimator(&e);
+	shm_toc_estimate_chunk(&e, shared_size);
+	shm_toc_estimate_chunk(&e, mul_size(nworkers, PARALLEL_APPLY_QUEUE_SIZE));
+	shm_toc_estimate_keys(&e, 1 + nworkers);
+	segsize = shm_toc_estimate(&e);
+
+	pa_seg = dsm_create(segsize, 0);
+	dsm_pin_mapping(pa_seg);
+	toc = shm_toc_create(PARALLEL_APPLY_MAGIC, dsm_segment_address(pa_seg),
+						 segsize);
+
+	pa_shared = shm_toc_allocate(toc, shared_size);
+	pa_shared->dbid = MyLogicalRepWorker->dbid;
+	pa_shared->userid = MyLogicalRepWorker->userid;
+	pa_shared->subid = MyLogicalRepWorker->subid;
+	pa_shared->originid = replorigin_session_origin;
+	pa_shared->leader_pid = MyProcPid;
+	pa_shared->leader = MyProc;
+	pg_atomic_init_u64(&pa_shared->last_committed_seq, 0);
+	pa_shared->nworkers = nworkers;
+	for (i = 0; i < nworkers; i++)
+	{
+		ParallelApplyWorkerSlot *slot = &pa_shared->slots[i];
+
+		SpinLockInit(&slot->mutex);
+		slot->proc = NULL;
+		slot->seq = 0;
+		slot->done_seq = 0;
+		slot->remote_end = InvalidXLogRecPtr;
+		slot->local_end = InvalidXLogRecPtr;
+		slot->yield = false;
+	}
+	shm_toc_insert(toc, PARALLEL_APPLY_KEY_SHARED, pa_shared);
+
+	pa_mqh = palloc0(nworkers * sizeof(shm_mq_handle *));
+	pa_handles = palloc0(nworkers * sizeof(BackgroundWorkerHandle *));
+	pa_assigned = palloc0(nworkers * sizeof(uint64));
+	pa_busy = palloc0(nworkers * sizeof(bool));
+	pa_inflight = palloc0(nworkers * sizeof(int));
+
+	for (i = 0; i < nworkers; i++)
+	{
+		BackgroundWorker bgw;
+		shm_mq	   *mq;
+
+		mq = shm_mq_create(shm_toc_allocate(toc, PARALLEL_APPLY_QUEUE_SIZE),
+						   PARALLEL_APPLY_QUEUE_SIZE);
+		shm_toc_insert(toc, PARALLEL_APPLY_KEY_QUEUE + i, mq);
+		shm_mq_set_sender(mq, MyProc);
+
+		memset(&bgw, 0, sizeof(bgw));
+		bgw.bgw_flags = BGWORKER_SHMEM_ACCESS |
+			BGWORKER_BACKEND_DATABASE_CONNECTION;
+		bgw.bgw_start_time = BgWorkerStart_RecoveryFinished;
+		snprintf(bgw.bgw_library_name, BGW_MAXLEN, "postgres");
+		snprintf(bgw.bgw_function_name, BGW_MAXLEN, "ParallelApplyWorkerMain");
+		snprintf(bgw.bgw_name, BGW_MAXLEN,
+				 "logical replication parallel apply worker for subscription %u",
+				 pa_shared->subid);
+		snprintf(bgw.bgw_type, BGW_MAXLEN,
+				 "logical replication parallel apply worker");
+		bgw.bgw_restart_time = BGW_NEVER_RESTART;
+		bgw.bgw_notify_pid = MyProcPid;
+		bgw.bgw_main_arg = UInt32GetDatum(dsm_segment_handle(pa_seg));
+		memcpy(bgw.bgw_extra, &i, sizeof(int));
+
+		if (!RegisterDynamicBackgroundWorker(&bgw, &pa_handles[i]))
+		{
+			ereport(WARNING,
+					(errcode(ERRCODE_CONFIGURATION_LIMIT_EXCEEDED),
+					 errmsg("out of background worker slots"),
+					 errdetail("Started %d of %d parallel apply workers for subscription \"%s\".",
+							   i, nworkers, MySubscription->name),
+					 errhint("You might need to increase max_worker_processes.")));
+			break;
+		}
+
+		pa_mqh[i] = shm_mq_attach(mq, pa_seg, pa_handles[i]);
+		pa_nworkers++;
+	}
+
+	if (pa_nworkers > 0)
+	{
+		HASHCTL		ctl;
+
+		before_shmem_exit(pa_shutdown_workers, (Datum) 0);
+
+		memset(&ctl, 0, sizeof(ctl));
+		ctl.keysize = sizeof(uint64);
+		ctl.entrysize = sizeof(ParallelApplyKey);
+		ctl.hcxt = ApplyContext;
+		pa_keys = hash_create("logical replication parallel apply keys",
+							  1024, &ctl,
+							  HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+	}
+	else
+	{
+		dsm_detach(pa_seg);
+		pa_seg = NULL;
+		pa_shared = NULL;
+	}
+
+	MemoryContextSwitchTo(oldctx);
+}
+
+/*
+ * Does the leader hand transactions to parallel apply workers?
+ */
+bool
+pa_enabled(void)
+{
+	return pa_nworkers > 0;
+}
+
+/*
+ * Are there transactions handed to parallel apply workers that haven't been
+ * committed yet (or whose commit the leader hasn't collected yet)?
+ */
+bool
+pa_has_pending(void)
+{
+	return pa_ninflight > 0;
+}
+
+/*
+ * Terminate the parallel apply workers when the leader exits.
+ *
+ * The workers would notice the leader is gone once its queues are detached,
+ * but don't let them go on applying a transaction that will be streamed
+ * again anyway.
+ */
+static void
+pa_shutdown_workers(int code, Datum arg)
+{
+	int			i;
+
+	for (i = 0; i < pa_nworkers; i++)
+		TerminateBackgroundWorker(pa_handles[i]);
+}
+
+/*
+ * Error out if a parallel apply worker has exited.
+ *
+ * The transactions it was given can't be committed anymore, and all later
+ * ones wait for them, so the only way forward is to restart the whole
+ * subscription from the last committed transaction.
+ */
+static void
+pa_check_workers(void)
+{
+	int			i;
+
+	for (i = 0; i < pa_nworkers; i++)
+	{
+		pid_t		pid;
+		BgwHandleStatus status;
+
+		status = GetBackgroundWorkerPid(pa_handles[i], &pid);
+		if (status == BGWH_STOPPED || status == BGWH_POSTMASTER_DIED)
+			ereport(ERROR,
+					(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+					 errmsg("logical replication parallel apply worker for subscription \"%s\" exited unexpectedly",
+							MySubscription->name)));
+	}
+}
+
+/*
+ * Collect the transactions the parallel apply workers have committed, in
+ * sequence order, and queue their positions for feedback to the publisher.
+ */
+void
+pa_process_completions(void)
+{
+	while (pa_ninflight > 0)
+	{
+		int			worker = pa_inflight[0];
+		ParallelApplyWorkerSlot *slot = &pa_shared->slots[worker];
+		uint64		done_seq;
+		XLogRecPtr	remote_end;
+		XLogRecPtr	local_end;
+
+		SpinLockAcquire(&slot->mutex);
+		done_seq = slot->done_seq;
+		remote_end = slot->remote_end;
+		local_end = slot->local_end;
+		SpinLockRelease(&slot->mutex);
+
+		if (done_seq < pa_assigned[worker])
+			break;
+
+		if (!XLogRecPtrIsInvalid(local_end))
+			store_flush_position(remote_end, local_end);
+
+		pa_busy[worker] = false;
+		pa_ninflight--;
+		memmove(pa_inflight, pa_inflight + 1, pa_ninflight * sizeof(int));
+	}
+}
+
+/*
+ * Wait until some parallel apply worker is idle, or all are if 'all'.
+ */
+static void
+pa_wait_for_workers(bool all)
+{
+	for (;;)
+	{
+		int			rc;
+
+		pa_process_completions();
+
+		if (all ? pa_ninflight == 0 : pa_ninflight < pa_nworkers)
+			break;
+
+		pa_check_workers();
+
+		rc = WaitLatch(MyLatch,
+					   WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
+					   1000L,
+					   WAIT_EVENT_LOGICAL_PARALLEL_APPLY_STATE_CHANGE);
+
+		if (rc & WL_LATCH_SET)
+			ResetLatch(MyLatch);
+
+		CHECK_FOR_INTERRUPTS();
+	}
+}
+
+/*
+ * Send a message to a parallel apply worker, waiting for queue space.
+ */
+static void
+pa_send(int worker, const char *data, Size len)
+{
+	shm_mq_result res;
+
+	res = shm_mq_send(pa_mqh[worker], len, data, false);
+	if (res != SHM_MQ_SUCCESS)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("could not send data to logical replication parallel apply worker for subscription \"%s\"",
+						MySubscription->name)));
+}
+
+static void
+pa_send_control(int worker, char type, uint64 seq)
+{
+	StringInfoData buf;
+
+	initStringInfo(&buf);
+	pq_sendbyte(&buf, type);
+	pq_sendint64(&buf, seq);
+	pa_send(worker, buf.data, buf.len);
+	pfree(buf.data);
+}
+
+/*
+ * Make the transaction being received wait for the commit of 'seq' before
+ * its next change is applied.
+ */
+static void
+pa_wait_before(uint64 seq)
+{
+	if (seq == 0 || seq <= pa_waited_seq ||
+		seq <= pg_atomic_read_u64(&pa_shared->last_committed_seq))
+		return;
+
+	pa_send_control(pa_current, PARALLEL_APPLY_MSG_WAIT, seq);
+	pa_waited_seq = seq;
+}
+
+/*
+ * Hand a replication protocol message to the parallel apply workers, or
+ * apply it here.
+ */
+void
+pa_dispatch(StringInfo s)
+{
+	char		action = s->data[s->cursor];
+	const char *data = s->data + s->cursor;
+	Size		len = s->len - s->cursor;
+
+	/* All workers need to know about all relations and types. */
+	if (action == 'R' || action == 'Y')
+	{
+		int			i;
+
+		for (i = 0; i < pa_nworkers; i++)
+			pa_send(i, data, len);
+		apply_dispatch(s);
+		return;
+	}
+
+	/*
+	 * Streamed transactions are spooled and applied here, once everything
+	 * committed before them has been applied.
+	 */
+	if (action == 'c')
+		pa_wait_for_workers(true);
+	if (action == 'S' || action == 'E' || action == 'A' || action == 'c' ||
+		in_streamed_transaction)
+	{
+		apply_dispatch(s);
+		return;
+	}
+
+	if (action == 'B')
+	{
+		ParallelApplyWorkerSlot *slot;
+		int			worker;
+
+		pa_process_completions();
+
+		/*
+		 * Apply the transaction here while any table is being synchronized,
+		 * after everything before it.
+		 */
+		if (!AllTablesyncsReady())
+		{
+			pa_wait_for_workers(true);
+			pa_serial = true;
+			apply_dispatch(s);
+			return;
+		}
+
+		if (hash_get_num_entries(pa_keys) > PARALLEL_APPLY_KEYS_PRUNE)
+			pa_prune_keys();
+
+		pa_wait_for_workers(false);
+		for (;;)
+		{
+			worker = pa_next_worker;
+			pa_next_worker = (pa_next_worker + 1) % pa_nworkers;
+			if (!pa_busy[worker])
+				break;
+		}
+
+		pa_current = worker;
+		pa_waited_seq = 0;
+		pa_assigned[worker] = ++pa_last_seq;
+		pa_busy[worker] = true;
+		pa_inflight[pa_ninflight++] = worker;
+
+		slot = &pa_shared->slots[worker];
+		SpinLockAcquire(&slot->mutex);
+		slot->seq = pa_last_seq;
+		SpinLockRelease(&slot->mutex);
+
+		pa_send_control(worker, PARALLEL_APPLY_MSG_START, pa_last_seq);
+		pa_send(worker, data, len);
+		pa_wait_before(pa_barrier_seq);
+
+		in_remote_transaction = true;
+		return;
+	}
+
+	if (pa_serial)
+	{
+		apply_dispatch(s);
+		if (action == 'C')
+			pa_serial = false;
+		return;
+	}
+
+	/* Let apply_dispatch() complain about messages outside a transaction. */
+	if (pa_current < 0)
+	{
+		apply_dispatch(s);
+		return;
+	}
+
+	switch (action)
+	{
+		case 'I':
+		case 'U':
+		case 'D':
+			pa_track_change(s);
+			break;
+		case 'T':
+			pa_wait_before(pa_last_seq - 1);
+			pa_barrier_seq = pa_last_seq;
+			break;
+		default:
+			break;
+	}
+
+	pa_send(pa_current, data, len);
+
+	if (action == 'C')
+	{
+		pa_current = -1;
+		in_remote_transaction = false;
+	}
+}
+
+/*
+ * Record the keys an INSERT, UPDATE or DELETE modifies, and make the
+ * transaction wait for whichever uncommitted transaction modified them
+ * before.
+ */
+static void
+pa_track_change(StringInfo s)
+{
+	StringInfoData msg = *s;
+	LogicalRepRelId relid;
+	LogicalRepTupleData oldtup;
+	LogicalRepTupleData newtup;
+	bool		has_oldtup;
+
+	switch (pq_getmsgbyte(&msg))
+	{
+		case 'I':
+			relid = logicalrep_read_insert(&msg, &newtup);
+			pa_track_tuple(relid, &newtup);
+			break;
+		case 'U':
+			relid = logicalrep_read_update(&msg, &has_oldtup, &oldtup,
+										   &newtup);
+			if (has_oldtup)
+				pa_track_tuple(relid, &oldtup);
+			pa_track_tuple(relid, &newtup);
+			break;
+		case 'D':
+			relid = logicalrep_read_delete(&msg, &oldtup);
+			pa_track_tuple(relid, &oldtup);
+			break;
+	}
+}
+
+static void
+pa_track_tuple(LogicalRepRelId relid, LogicalRepTupleData *tuple)
+{
+	LogicalRepRelation *remoterel = logicalrep_relmap_get_remoterel(relid);
+	ParallelApplyKey *entry;
+	uint64		hash;
+	bool		found;
+	int			i;
+
+	/*
+	 * Inserts into a table without replica identity can't conflict on it,
+	 * and it can't have updates or deletes.
+	 */
+	if (remoterel != NULL && bms_is_empty(remoterel->attkeys))
+		return;
+
+	hash = DatumGetUInt64(hash_uint32_extended(relid, 0));
+
+	i = -1;
+	while (remoterel != NULL &&
+		   (i = bms_next_member(remoterel->attkeys, i)) >= 0)
+	{
+		uint64		colhash;
+
+		/* We don't get the value of an unchanged toasted column. */
+		if (i >= remoterel->natts || !tuple->changed[i])
+			break;
+
+		if (tuple->values[i] == NULL)
+			colhash = 0;
+		else
+			colhash = DatumGetUInt64(hash_any_extended((unsigned char *) tuple->values[i],
+													   strlen(tuple->values[i]),
+													   0));
+		hash = hash_combine64(hash, colhash);
+	}
+
+	/*
+	 * If the key can't be determined, order the transaction after all
+	 * earlier ones, and all later ones after it.
+	 */
+	if (remoterel == NULL || i >= 0)
+	{
+		pa_wait_before(pa_last_seq - 1);
+		pa_barrier_seq = pa_last_seq;
+		return;
+	}
+
+	entry = hash_search(pa_keys, &hash, HASH_ENTER, &found);
+	if (found && entry->seq != pa_last_seq)
+		pa_wait_before(entry->seq);
+	entry->seq = pa_last_seq;
+}
+
+/*
+ * Forget the keys modified by transactions that have committed.
+ */
+static void
+pa_prune_keys(void)
+{
+	uint64		committed = pg_atomic_read_u64(&pa_shared->last_committed_seq);
+	HASH_SEQ_STATUS status;
+	ParallelApplyKey *entry;
+
+	hash_seq_init(&status, pa_keys);
+	while ((entry = hash_seq_search(&status)) != NULL)
+	{
+		if (entry->seq <= committed)
+			hash_search(pa_keys, &entry->hash, HASH_REMOVE, NULL);
+	}
+}
+
+/*
+ * Is the current process a parallel apply worker?
+ */
+bool
+am_parallel_apply_worker(void)
+{
+	return MyParallelApplySlot != NULL;
+}
+
+/* SIGHUP: set flag to reload configuration at next convenient time */
+static void
+pa_worker_sighup(SIGNAL_ARGS)
+{
+	int			save_errno = errno;
+
+	got_SIGHUP = true;
+
+	/* Waken anything waiting on the process latch */
+	SetLatch(MyLatch);
+
+	errno = save_errno;
+}
+
+/* Logical replication parallel apply worker entry point */
+void
+ParallelApplyWorkerMain(Datum main_arg)
+{
+	dsm_segment *seg;
+	shm_toc    *toc;
+	shm_mq	   *mq;
+	int			worker_number;
+	MemoryContext oldctx;
+
+	memcpy(&worker_number, MyBgworkerEntry->bgw_extra, sizeof(int));
+
+	/* Setup signal handling */
+	pqsignal(SIGHUP, pa_worker_sighup);
+	pqsignal(SIGTERM, die);
+	BackgroundWorkerUnblockSignals();
+
+	seg = dsm_attach(DatumGetUInt32(main_arg));
+	if (seg == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("could not map dynamic shared memory segment")));
+	toc = shm_toc_attach(PARALLEL_APPLY_MAGIC, dsm_segment_address(seg));
+	if (toc == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("invalid magic number in dynamic shared memory segment")));
+
+	pa_shared = shm_toc_lookup(toc, PARALLEL_APPLY_KEY_SHARED, false);
+	mq = shm_toc_lookup(toc, PARALLEL_APPLY_KEY_QUEUE + worker_number, false);
+	shm_mq_set_receiver(mq, MyProc);
+	pa_worker_mqh = shm_mq_attach(mq, seg, NULL);
+
+	MyParallelApplySlot = &pa_shared->slots[worker_number];
+	SpinLockAcquire(&MyParallelApplySlot->mutex);
+	MyParallelApplySlot->proc = MyProc;
+	SpinLockRelease(&MyParallelApplySlot->mutex);
+
+	/*
+	 * The apply code looks at the worker's launcher slot; we don't have one,
+	 * so set up a private copy with what it needs.
+	 */
+	MyLogicalRepWorker = MemoryContextAllocZero(TopMemoryContext,
+												sizeof(LogicalRepWorker));
+	MyLogicalRepWorker->launch_time = GetCurrentTimestamp();
+	MyLogicalRepWorker->in_use = true;
+	MyLogicalRepWorker->proc = MyProc;
+	MyLogicalRepWorker->dbid = pa_shared->dbid;
+	MyLogicalRepWorker->userid = pa_shared->userid;
+	MyLogicalRepWorker->subid = pa_shared->subid;
+	MyLogicalRepWorker->relid = InvalidOid;
+
+	/* Run as replica session replication role. */
+	SetConfigOption("session_replication_role", "replica",
+					PGC_SUSET, PGC_S_OVERRIDE);
+
+	/* Connect to our database. */
+	BackgroundWorkerInitializeConnectionByOid(pa_shared->dbid,
+											  pa_shared->userid,
+											  0);
+
+	ApplyContext = AllocSetContextCreate(TopMemoryContext,
+										 "ApplyContext",
+										 ALLOCSET_DEFAULT_SIZES);
+	ApplyMessageContext = AllocSetContextCreate(ApplyContext,
+												"ApplyMessageContext",
+												ALLOCSET_DEFAULT_SIZES);
+
+	/*
+	 * Load the subscription.  Its changes make the leader restart, and us
+	 * with it, so we don't need to watch for them.
+	 */
+	StartTransactionCommand();
+	oldctx = MemoryContextSwitchTo(ApplyContext);
+	MySubscription = GetSubscription(pa_shared->subid, true);
+	MemoryContextSwitchTo(oldctx);
+	if (!MySubscription)
+		proc_exit(0);
+	MySubscriptionValid = true;
+
+	/* Setup synchronous commit according to the user's wishes */
+	SetConfigOption("synchronous_commit", MySubscription->synccommit,
+					PGC_BACKEND, PGC_S_OVERRIDE);
+
+	ereport(DEBUG1,
+			(errmsg("logical replication parallel apply worker for subscription \"%s\" has started",
+					MySubscription->name)));
+
+	CommitTransactionCommand();
+
+	/* Commit with the leader's replication origin. */
+	replorigin_session_attach(pa_shared->originid, pa_shared->leader_pid);
+	replorigin_session_origin = pa_shared->originid;
+
+	pgstat_report_activity(STATE_IDLE, NULL);
+
+	pa_worker_loop();
+
+	proc_exit(0);
+}
+
+/*
+ * Parallel apply worker main loop.
+ */
+static void
+pa_worker_loop(void)
+{
+	for (;;)
+	{
+		shm_mq_result res;
+		Size		len;
+		void	   *data;
+
+		CHECK_FOR_INTERRUPTS();
+
+		res = shm_mq_receive(pa_worker_mqh, &len, &data, true);
+
+		if (res == SHM_MQ_SUCCESS)
+		{
+			StringInfoData s;
+
+			MemoryContextSwitchTo(ApplyMessageContext);
+
+			s.data = data;
+			s.len = len;
+			s.cursor = 0;
+			s.maxlen = -1;
+
+			pa_worker_handle_message(&s);
+
+			MemoryContextReset(ApplyMessageContext);
+			MemoryContextSwitchTo(TopMemoryContext);
+			continue;
+		}
+
+		/* The leader has exited; it will error out if it wasn't expected. */
+		if (res == SHM_MQ_DETACHED)
+			break;
+
+		(void) WaitLatch(MyLatch,
+						 WL_LATCH_SET | WL_EXIT_ON_PM_DEATH, -1L,
+						 WAIT_EVENT_LOGICAL_PARALLEL_APPLY_MAIN);
+		ResetLatch(MyLatch);
+
+		if (got_SIGHUP)
+		{
+			got_SIGHUP = false;
+			ProcessConfigFile(PGC_SIGHUP);
+		}
+	}
+}
+
+/*
+ * Apply a message from the leader, retrying the transaction it belongs to if
+ * it deadlocks against a later one.
+ */
+static void
+pa_worker_handle_message(StringInfo s)
+{
+	volatile bool replay = false;
+
+	if (s->data[0] == PARALLEL_APPLY_MSG_START)
+	{
+		s->cursor = 1;
+		pa_my_seq = pq_getmsgint64(s);
+
+		SpinLockAcquire(&MyParallelApplySlot->mutex);
+		MyParallelApplySlot->yield = false;
+		SpinLockRelease(&MyParallelApplySlot->mutex);
+
+		pa_spool_reset();
+		return;
+	}
+
+	/* Relation and type messages between transactions can't deadlock. */
+	if (pa_my_seq == 0)
+	{
+		apply_dispatch(s);
+		return;
+	}
+
+	pa_spool_write(s);
+
+	for (;;)
+	{
+		MemoryContext ctx = CurrentMemoryContext;
+		volatile bool retry = false;
+		ErrorData  *edata;
+
+		PG_TRY();
+		{
+			if (replay)
+			{
+				pa_wait_for_commit(pa_my_seq - 1);
+				pa_spool_replay();
+			}
+			else
+				pa_apply_message(s);
+		}
+		PG_CATCH();
+		{
+			MemoryContextSwitchTo(ApplyContext);
+			edata = CopyErrorData();
+
+			if (edata->sqlerrcode != ERRCODE_T_R_DEADLOCK_DETECTED &&
+				edata->sqlerrcode != ERRCODE_T_R_SERIALIZATION_FAILURE)
+			{
+				MemoryContextSwitchTo(ctx);
+				PG_RE_THROW();
+			}
+
+			/*
+			 * Roll back, and replay the whole transaction once all earlier
+			 * ones have committed.  Abort processing is the same as in
+			 * autovacuum's error recovery.
+			 */
+			HOLD_INTERRUPTS();
+			AbortOutOfAnyTransaction();
+			FlushErrorState();
+			MemoryContextReset(ApplyMessageContext);
+			RESUME_INTERRUPTS();
+
+			ereport(LOG,
+					(errmsg("logical replication parallel apply worker for subscription \"%s\" will retry remote transaction",
+							MySubscription->name),
+					 errdetail_internal("%s", edata->message)));
+			FreeErrorData(edata);
+
+			pa_request_yield();
+
+			SpinLockAcquire(&MyParallelApplySlot->mutex);
+			MyParallelApplySlot->yield = false;
+			SpinLockRelease(&MyParallelApplySlot->mutex);
+
+			MemoryContextSwitchTo(ApplyMessageContext);
+			retry = true;
+		}
+		PG_END_TRY();
+
+		if (!retry)
+			break;
+		replay = true;
+	}
+}
+
+/*
+ * Apply one message of the current transaction.
+ */
+static void
+pa_apply_message(StringInfo s)
+{
+	pa_check_yield();
+
+	if (s->data[0] == PARALLEL_APPLY_MSG_WAIT)
+	{
+		s->cursor = 1;
+		pa_wait_for_commit(pq_getmsgint64(s));
+	}
+	else
+		apply_dispatch(s);
+}
+
+/*
+ * Error out if an earlier transaction has asked us to get out of its way.
+ */
+static void
+pa_check_yield(void)
+{
+	bool		yield;
+
+	SpinLockAcquire(&MyParallelApplySlot->mutex);
+	yield = MyParallelApplySlot->yield;
+	SpinLockRelease(&MyParallelApplySlot->mutex);
+
+	if (yield)
+		ereport(ERROR,
+				(errcode(ERRCODE_T_R_SERIALIZATION_FAILURE),
+				 errmsg("canceling apply of remote transaction to let an earlier one proceed")));
+}
+
+/*
+ * Ask the workers applying transactions later than ours to roll back and
+ * retry, so that they don't hold rows our transaction needs.
+ */
+static void
+pa_request_yield(void)
+{
+	int			i;
+
+	for (i = 0; i < pa_shared->nworkers; i++)
+	{
+		ParallelApplyWorkerSlot *slot = &pa_shared->slots[i];
+		PGPROC	   *proc = NULL;
+
+		if (slot == MyParallelApplySlot)
+			continue;
+
+		SpinLockAcquire(&slot->mutex);
+		if (slot->seq > pa_my_seq)
+		{
+			slot->yield = true;
+			proc = slot->proc;
+		}
+		SpinLockRelease(&slot->mutex);
+
+		if (proc)
+			SetLatch(&proc->procLatch);
+	}
+}
+
+/*
+ * Take the lock other workers wait on for the current transaction to
+ * commit.  Called when the local transaction is started.
+ */
+void
+pa_lock_transaction(void)
+{
+	LOCKTAG		tag;
+
+	Assert(pa_my_seq != 0);
+
+	SET_LOCKTAG_APPLY_TRANSACTION(tag, MyDatabaseId, pa_shared->subid,
+								  pa_my_seq);
+	(void) LockAcquire(&tag, AccessExclusiveLock, false, false);
+
+	/* Let the workers waiting for us block on the lock. */
+	pa_wakeup_all();
+}
+
+/*
+ * Wait until the transaction 'seq' has been committed.
+ *
+ * We wait on the lock of the oldest transaction not committed yet rather
+ * than just on our latch, so that the deadlock detector can see the wait if
+ * that transaction is blocked by one of ours.
+ */
+static void
+pa_wait_for_commit(uint64 seq)
+{
+	for (;;)
+	{
+		uint64		committed = pg_atomic_read_u64(&pa_shared->last_committed_seq);
+		LOCKTAG		tag;
+		int			rc;
+
+		if (committed >= seq)
+			break;
+
+		pa_check_yield();
+
+		SET_LOCKTAG_APPLY_TRANSACTION(tag, MyDatabaseId, pa_shared->subid,
+									  committed + 1);
+		(void) LockAcquire(&tag, AccessShareLock, true, false);
+		LockRelease(&tag, AccessShareLock, true);
+
+		if (pg_atomic_read_u64(&pa_shared->last_committed_seq) >= seq)
+			break;
+
+		rc = WaitLatch(MyLatch,
+					   WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
+					   1000L,
+					   WAIT_EVENT_LOGICAL_PARALLEL_APPLY_STATE_CHANGE);
+
+		if (rc & WL_LATCH_SET)
+			ResetLatch(MyLatch);
+
+		CHECK_FOR_INTERRUPTS();
+	}
+}
+
+/*
+ * Commit the current transaction, after all earlier ones.
+ */
+void
+pa_commit_transaction(XLogRecPtr end_lsn, TimestampTz committime)
+{
+	XLogRecPtr	local_end = InvalidXLogRecPtr;
+
+	pa_wait_for_commit(pa_my_seq - 1);
+
+	if (IsTransactionState())
+	{
+		/*
+		 * Update origin state so we can restart streaming from correct
+		 * position in case of crash.
+		 */
+		replorigin_session_origin_lsn = end_lsn;
+		replorigin_session_origin_timestamp = committime;
+
+		CommitTransactionCommand();
+		pgstat_report_stat(false);
+
+		local_end = XactLastCommitEnd;
+	}
+	else
+	{
+		/* Process any invalidation messages that might have accumulated. */
+		AcceptInvalidationMessages();
+	}
+
+	SpinLockAcquire(&MyParallelApplySlot->mutex);
+	MyParallelApplySlot->done_seq = pa_my_seq;
+	MyParallelApplySlot->remote_end = end_lsn;
+	MyParallelApplySlot->local_end = local_end;
+	MyParallelApplySlot->seq = 0;
+	MyParallelApplySlot->yield = false;
+	SpinLockRelease(&MyParallelApplySlot->mutex);
+
+	pg_atomic_write_u64(&pa_shared->last_committed_seq, pa_my_seq);
+	pa_my_seq = 0;
+
+	pa_wakeup_all();
+}
+
+/*
+ * Wake up the leader and all other parallel apply workers.
+ */
+static void
+pa_wakeup_all(void)
+{
+	int			i;
+
+	SetLatch(&pa_shared->leader->procLatch);
+
+	for (i = 0; i < pa_shared->nworkers; i++)
+	{
+		ParallelApplyWorkerSlot *slot = &pa_shared->slots[i];
+		PGPROC	   *proc;
+
+		if (slot == MyParallelApplySlot)
+			continue;
+
+		SpinLockAcquire(&slot->mutex);
+		proc = slot->proc;
+		SpinLockRelease(&slot->mutex);
+
+		if (proc)
+			SetLatch(&proc->procLatch);
+	}
+}
+
+/*
+ * Start spooling a new transaction.
+ */
+static void
+pa_spool_reset(void)
+{
+	if (pa_spool == NULL)
+	{
+		MemoryContext oldctx = MemoryContextSwitchTo(ApplyContext);
+
+		pa_spool = BufFileCreateTemp(true);
+		MemoryContextSwitchTo(oldctx);
+	}
+	else if (BufFileSeek(pa_spool, 0, 0, SEEK_SET) != 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not rewind parallel apply spool file: %m")));
+
+	pa_spool_nmsgs = 0;
+}
+
+/*
+ * Remember a message of the current transaction in case it has to be
+ * replayed.
+ */
+static void
+pa_spool_write(StringInfo s)
+{
+	int			len = s->len;
+
+	if (BufFileWrite(pa_spool, &len, sizeof(len)) != sizeof(len) ||
+		BufFileWrite(pa_spool, s->data, len) != len)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not write to parallel apply spool file: %m")));
+
+	pa_spool_nmsgs++;
+}
+
+/*
+ * Apply all messages of the current transaction received so far again.
+ */
+static void
+pa_spool_replay(void)
+{
+	MemoryContext ctx = CurrentMemoryContext;
+	int			i;
+
+	if (BufFileSeek(pa_spool, 0, 0, SEEK_SET) != 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not rewind parallel apply spool file: %m")));
+
+	for (i = 0; i < pa_spool_nmsgs; i++)
+	{
+		StringInfoData s;
+		int			len;
+
+		if (BufFileRead(pa_spool, &len, sizeof(len)) != sizeof(len))
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not read from parallel apply spool file: %m")));
+
+		s.data = MemoryContextAlloc(ApplyContext, len);
+		s.len = len;
+		s.cursor = 0;
+		s.maxlen = -1;
+
+		if (BufFileRead(pa_spool, s.data, len) != len)
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not read from parallel apply spool file: %m")));
+
+		pa_apply_message(&s);
+
+		pfree(s.data);
+		MemoryContextReset(ApplyMessageContext);
+		MemoryContextSwitchTo(ctx);
+	}
+}
@@ -34,6 +34,7 @@
 #include "access/xlogutils.h"
 #include "access/xlogreader.h"
 #include "access/xlogrecord.h"
+#include "access/zheapam_xlog.h"
 
 #include "catalog/pg_control.h"
 
@@ -60,6 +61,8 @@ static void DecodeHeap2Op(LogicalDecodingContext *ctx, XLogRecordBuffer *buf);
 static void DecodeXactOp(LogicalDecodingContext *ctx, XLogRecordBuffer *buf);
 static void DecodeStandbyOp(LogicalDecodingContext *ctx, XLogRecordBuffer *buf);
 static void DecodeLogicalMsgOp(LogicalDecodingContext *ctx, XLogRecordBuffer *buf);
+static void DecodeZHeapOp(LogicalDecodingContext *ctx, XLogRecordBuffer *buf);
+static void DecodeZHeap2Op(LogicalDecodingContext *ctx, XLogRecordBuffer *buf);
 
 /* individual record(group)'s handlers */
 static void DecodeInsert(LogicalDecodingContext *ctx, XLogRecordBuffer *buf);
@@ -68,6 +71,10 @@ static void DecodeDelete(LogicalDecodingContext *ctx, XLogRecordBuffer *buf);
 static void DecodeTruncate(LogicalDecodingContext *ctx, XLogRecordBuffer *buf);
 static void DecodeMultiInsert(LogicalDecodingContext *ctx, XLogRecordBuffer *buf);
 static void DecodeSpecConfirm(LogicalDecodingContext *ctx, XLogRecordBuffer *buf);
+static void DecodeZHeapInsert(LogicalDecodingContext *ctx, XLogRecordBuffer *buf);
+static void DecodeZHeapUpdate(LogicalDecodingContext *ctx, XLogRecordBuffer *buf);
+static void DecodeZHeapDelete(LogicalDecodingContext *ctx, XLogRecordBuffer *buf);
+static void DecodeZHeapMultiInsert(LogicalDecodingContext *ctx, XLogRecordBuffer *buf);
 
 static void DecodeCommit(LogicalDecodingContext *ctx, XLogRecordBuffer *buf,
 						 xl_xact_parsed_commit *parsed, TransactionId xid);
@@ -76,6 +83,7 @@ static void DecodeAbort(LogicalDecodingContext *ctx, XLogRecordBuffer *buf,
 
 /* common function to decode tuples */
 static void DecodeXLogTuple(char *data, Size len, ReorderBufferTupleBuf *tup);
+static void DecodeXLogZTuple(char *data, Size len, ReorderBufferTupleBuf *tup);
 
 /*
  * Take every XLogReadRecord()ed record and perform the actions required to
@@ -133,6 +141,14 @@ LogicalDecodingProcessRecord(LogicalDecodingContext *ctx, XLogReaderState *recor
 			DecodeLogicalMsgOp(ctx, &buf);
 			break;
 
+		case RM_ZHEAP_ID:
+			DecodeZHeapOp(ctx, &buf);
+			break;
+
+		case RM_ZHEAP2_ID:
+			DecodeZHeap2Op(ctx, &buf);
+			break;
+
 			/*
 			 * Rmgrs irrelevant for logical decoding; they describe stuff not
 			 * represented in logical decoding. Add new rmgrs in rmgrlist.h's
@@ -155,27 +171,13 @@ LogicalDecodingProcessRecord(LogicalDecodingContext *ctx, XLogReaderState *recor
 		case RM_REPLORIGIN_ID:
 		case RM_GENERIC_ID:
 		case RM_UNDOLOG_ID:
+		case RM_ZUNDO_ID:
+		case RM_TPD_ID:
 		case RM_UNDOACTION_ID:
 			/* just deal with xid, and done */
 			ReorderBufferProcessXid(ctx->reorder, XLogRecGetXid(record),
 									buf.origptr);
 			break;
-		case RM_ZHEAP_ID:
-			/* Logical decoding is not yet implemented for zheap. */
-			Assert(0);
-			break;
-		case RM_ZHEAP2_ID:
-			/* Logical decoding is not yet implemented for zheap. */
-			Assert(0);
-			break;
-		case RM_ZUNDO_ID:
-			/* Logical decoding is not yet implemented for zheap. */
-			Assert(0);
-			break;
-		case RM_TPD_ID:
-			/* Logical decoding is not yet implemented for TPD. */
-			Assert(0);
-			break;
 		case RM_NEXT_ID:
 			elog(ERROR, "unexpected RM_NEXT_ID rmgr_id: %u", (RmgrIds) XLogRecGetRmid(buf.record));
 	}
@@ -511,6 +513,126 @@ DecodeHeapOp(LogicalDecodingContext *ctx, XLogRecordBuffer *buf)
 	}
 }
 
+/*
+ * Handle rmgr ZHEAP_ID records for DecodeRecordIntoReorderBuffer().
+ *
+ * zheap doesn't emit any records that are only of interest to logical
+ * decoding: it isn't used for catalogs, so there's nothing to tell snapbuild.c
+ * about, and the information needed to decode the changes is already part of
+ * the records that carry the undo reconstruction information.
+ */
+static void
+DecodeZHeapOp(LogicalDecodingContext *ctx, XLogRecordBuffer *buf)
+{
+	uint8		info = XLogRecGetInfo(buf->record) & XLOG_ZHEAP_OPMASK;
+	TransactionId xid = XLogRecGetXid(buf->record);
+	SnapBuild  *builder = ctx->snapshot_builder;
+
+	ReorderBufferProcessXid(ctx->reorder, xid, buf->origptr);
+
+	/*
+	 * If we don't have snapshot or we are just fast-forwarding, there is no
+	 * point in decoding data changes.
+	 */
+	if (SnapBuildCurrentState(builder) < SNAPBUILD_FULL_SNAPSHOT ||
+		ctx->fast_forward)
+		return;
+
+	switch (info)
+	{
+		case XLOG_ZHEAP_INSERT:
+			if (SnapBuildProcessChange(builder, xid, buf->origptr))
+				DecodeZHeapInsert(ctx, buf);
+			break;
+
+			/*
+			 * In-place and non-in-place updates have the same layout as far
+			 * as the new tuple is concerned.
+			 */
+		case XLOG_ZHEAP_UPDATE:
+			if (SnapBuildProcessChange(builder, xid, buf->origptr))
+				DecodeZHeapUpdate(ctx, buf);
+			break;
+
+		case XLOG_ZHEAP_DELETE:
+			if (SnapBuildProcessChange(builder, xid, buf->origptr))
+				DecodeZHeapDelete(ctx, buf);
+			break;
+
+		case XLOG_ZHEAP_MULTI_INSERT:
+			if (SnapBuildProcessChange(builder, xid, buf->origptr))
+				DecodeZHeapMultiInsert(ctx, buf);
+			break;
+
+		case XLOG_ZHEAP_LOCK:
+			/* we don't care about row level locks for now */
+			break;
+
+			/*
+			 * Everything else here is just low level physical stuff we're not
+			 * interested in.
+			 */
+		case XLOG_ZHEAP_FREEZE_XACT_SLOT:
+		case XLOG_ZHEAP_INVALID_XACT_SLOT:
+		case XLOG_ZHEAP_CLEAN:
+			break;
+
+		default:
+			elog(ERROR, "unexpected RM_ZHEAP_ID record type: %u", info);
+			break;
+	}
+}
+
+/*
+ * Handle rmgr ZHEAP2_ID records for DecodeRecordIntoReorderBuffer().
+ */
+static void
+DecodeZHeap2Op(LogicalDecodingContext *ctx, XLogRecordBuffer *buf)
+{
+	uint8		info = XLogRecGetInfo(buf->record) & XLOG_ZHEAP_OPMASK;
+	TransactionId xid = XLogRecGetXid(buf->record);
+	SnapBuild  *builder = ctx->snapshot_builder;
+
+	ReorderBufferProcessXid(ctx->reorder, xid, buf->origptr);
+
+	/*
+	 * If we don't have snapshot or we are just fast-forwarding, there is no
+	 * point in decoding changes.
+	 */
+	if (SnapBuildCurrentState(builder) < SNAPBUILD_FULL_SNAPSHOT ||
+		ctx->fast_forward)
+		return;
+
+	switch (info)
+	{
+		case XLOG_ZHEAP_CONFIRM:
+			{
+				xl_zheap_confirm *xlrec;
+
+				/*
+				 * A failed speculative insertion is irrelevant for logical
+				 * decoding, just like a super deletion in heap.
+				 */
+				xlrec = (xl_zheap_confirm *) XLogRecGetData(buf->record);
+				if ((xlrec->flags & XLZ_SPEC_INSERT_SUCCESS) &&
+					SnapBuildProcessChange(builder, xid, buf->origptr))
+					DecodeSpecConfirm(ctx, buf);
+				break;
+			}
+
+			/*
+			 * Everything else here is just low level physical stuff we're not
+			 * interested in.
+			 */
+		case XLOG_ZHEAP_UNUSED:
+		case XLOG_ZHEAP_VISIBLE:
+			break;
+
+		default:
+			elog(ERROR, "unexpected RM_ZHEAP2_ID record type: %u", info);
+	}
+}
+
 static inline bool
 FilterByOrigin(LogicalDecodingContext *ctx, RepOriginId origin_id)
 {
@@ -1028,6 +1150,290 @@ DecodeSpecConfirm(LogicalDecodingContext *ctx, XLogRecordBuffer *buf)
 	ReorderBufferQueueChange(ctx->reorder, XLogRecGetXid(r), buf->origptr, change);
 }
 
+/*
+ * Parse XLOG_ZHEAP_INSERT (not MULTI_INSERT!) records into tuplebufs.
+ *
+ * The tuple is queued in zheap format; ReorderBufferCommit converts it to a
+ * heap tuple once the relation's descriptor is available.
+ */
+static void
+DecodeZHeapInsert(LogicalDecodingContext *ctx, XLogRecordBuffer *buf)
+{
+	Size		datalen;
+	char	   *tupledata;
+	Size		tuplelen;
+	XLogReaderState *r = buf->record;
+	xl_zheap_insert *xlrec;
+	ReorderBufferChange *change;
+	RelFileNode target_node;
+
+	xlrec = (xl_zheap_insert *) XLogRecGetData(r);
+
+	/* Ignore insert records without new tuples. */
+	if (!(xlrec->flags & XLZ_INSERT_CONTAINS_NEW_TUPLE))
+		return;
+
+	/* only interested in our database */
+	XLogRecGetBlockTag(r, 0, &target_node, NULL, NULL);
+	if (target_node.dbNode != ctx->slot->data.database)
+		return;
+
+	/* output plugin doesn't look for this origin, no need to queue */
+	if (FilterByOrigin(ctx, XLogRecGetOrigin(r)))
+		return;
+
+	change = ReorderBufferGetChange(ctx->reorder);
+	if (!(xlrec->flags & XLZ_INSERT_IS_SPECULATIVE))
+		change->action = REORDER_BUFFER_CHANGE_INSERT;
+	else
+		change->action = REORDER_BUFFER_CHANGE_INTERNAL_SPEC_INSERT;
+	change->origin_id = XLogRecGetOrigin(r);
+
+	memcpy(&change->data.tp.relnode, &target_node, sizeof(RelFileNode));
+
+	tupledata = XLogRecGetBlockData(r, 0, &datalen);
+	tuplelen = datalen - SizeOfZHeapHeader;
+
+	change->data.tp.newtuple =
+		ReorderBufferGetTupleBuf(ctx->reorder, tuplelen);
+
+	DecodeXLogZTuple(tupledata, datalen, change->data.tp.newtuple);
+
+	change->data.tp.clear_toast_afterwards = true;
+
+	ReorderBufferQueueChange(ctx->reorder, XLogRecGetXid(r), buf->origptr, change);
+}
+
+/*
+ * Parse XLOG_ZHEAP_UPDATE from wal into proper tuplebufs.
+ *
+ * For logically logged relations, the record contains the complete new tuple
+ * as well as the complete old tuple, which is what replay uses to regenerate
+ * the undo record.
+ */
+static void
+DecodeZHeapUpdate(LogicalDecodingContext *ctx, XLogRecordBuffer *buf)
+{
+	XLogReaderState *r = buf->record;
+	xl_zheap_update *xlrec;
+	ReorderBufferChange *change;
+	char	   *data;
+	RelFileNode target_node;
+
+	xlrec = (xl_zheap_update *) (XLogRecGetData(r) + SizeOfUndoHeader);
+
+	/* only interested in our database */
+	XLogRecGetBlockTag(r, 0, &target_node, NULL, NULL);
+	if (target_node.dbNode != ctx->slot->data.database)
+		return;
+
+	/* output plugin doesn't look for this origin, no need to queue */
+	if (FilterByOrigin(ctx, XLogRecGetOrigin(r)))
+		return;
+
+	change = ReorderBufferGetChange(ctx->reorder);
+	change->action = REORDER_BUFFER_CHANGE_UPDATE;
+	change->origin_id = XLogRecGetOrigin(r);
+	memcpy(&change->data.tp.relnode, &target_node, sizeof(RelFileNode));
+
+	if (xlrec->flags & XLZ_UPDATE_CONTAINS_NEW_TUPLE)
+	{
+		Size		datalen;
+		Size		tuplelen;
+
+		/* prefix and suffix compression is disabled for such records */
+		Assert(!(xlrec->flags & (XLZ_UPDATE_PREFIX_FROM_OLD |
+								 XLZ_UPDATE_SUFFIX_FROM_OLD)));
+
+		data = XLogRecGetBlockData(r, 0, &datalen);
+
+		tuplelen = datalen - SizeOfZHeapHeader;
+
+		change->data.tp.newtuple =
+			ReorderBufferGetTupleBuf(ctx->reorder, tuplelen);
+
+		DecodeXLogZTuple(data, datalen, change->data.tp.newtuple);
+	}
+
+	/* A diff-encoded undo tuple isn't of any use to us. */
+	if ((xlrec->flags & XLZ_HAS_UPDATE_UNDOTUPLE) &&
+		!(xlrec->flags & XLZ_UPDATE_UNDO_TUPLE_DELTA))
+	{
+		Size		offset = SizeOfUndoHeader + SizeOfZHeapUpdate;
+		Size		datalen;
+		Size		tuplelen;
+
+		if (xlrec->flags & XLZ_UPDATE_OLD_CONTAINS_TPD_SLOT)
+			offset += sizeof(int);
+		if (xlrec->flags & XLZ_NON_INPLACE_UPDATE)
+		{
+			offset += SizeOfUndoHeader;
+			if (xlrec->flags & XLZ_UPDATE_NEW_CONTAINS_TPD_SLOT)
+				offset += sizeof(int);
+		}
+
+		/* caution, remaining data in record is not aligned */
+		data = XLogRecGetData(r) + offset;
+		datalen = XLogRecGetDataLen(r) - offset;
+		tuplelen = datalen - SizeOfZHeapHeader;
+
+		change->data.tp.oldtuple =
+			ReorderBufferGetTupleBuf(ctx->reorder, tuplelen);
+
+		DecodeXLogZTuple(data, datalen, change->data.tp.oldtuple);
+	}
+
+	change->data.tp.clear_toast_afterwards = true;
+
+	ReorderBufferQueueChange(ctx->reorder, XLogRecGetXid(r), buf->origptr, change);
+}
+
+/*
+ * Parse XLOG_ZHEAP_DELETE from wal into proper tuplebufs.
+ *
+ * For logically logged relations, the record contains the complete old
+ * tuple.
+ */
+static void
+DecodeZHeapDelete(LogicalDecodingContext *ctx, XLogRecordBuffer *buf)
+{
+	XLogReaderState *r = buf->record;
+	xl_zheap_delete *xlrec;
+	ReorderBufferChange *change;
+	RelFileNode target_node;
+
+	xlrec = (xl_zheap_delete *) (XLogRecGetData(r) + SizeOfUndoHeader);
+
+	/* only interested in our database */
+	XLogRecGetBlockTag(r, 0, &target_node, NULL, NULL);
+	if (target_node.dbNode != ctx->slot->data.database)
+		return;
+
+	/* output plugin doesn't look for this origin, no need to queue */
+	if (FilterByOrigin(ctx, XLogRecGetOrigin(r)))
+		return;
+
+	change = ReorderBufferGetChange(ctx->reorder);
+	change->action = REORDER_BUFFER_CHANGE_DELETE;
+	change->origin_id = XLogRecGetOrigin(r);
+
+	memcpy(&change->data.tp.relnode, &target_node, sizeof(RelFileNode));
+
+	if (xlrec->flags & XLZ_HAS_DELETE_UNDOTUPLE)
+	{
+		Size		offset = SizeOfUndoHeader + SizeOfZHeapDelete;
+		Size		datalen;
+		Size		tuplelen;
+
+		if (xlrec->flags & XLZ_DELETE_CONTAINS_TPD_SLOT)
+			offset += sizeof(int);
+
+		Assert(XLogRecGetDataLen(r) > (offset + SizeOfZHeapHeader));
+
+		datalen = XLogRecGetDataLen(r) - offset;
+		tuplelen = datalen - SizeOfZHeapHeader;
+
+		change->data.tp.oldtuple =
+			ReorderBufferGetTupleBuf(ctx->reorder, tuplelen);
+
+		DecodeXLogZTuple(XLogRecGetData(r) + offset,
+						 datalen, change->data.tp.oldtuple);
+	}
+
+	change->data.tp.clear_toast_afterwards = true;
+
+	ReorderBufferQueueChange(ctx->reorder, XLogRecGetXid(r), buf->origptr, change);
+}
+
+/*
+ * Decode XLOG_ZHEAP_MULTI_INSERT record into multiple tuplebufs.
+ */
+static void
+DecodeZHeapMultiInsert(LogicalDecodingContext *ctx, XLogRecordBuffer *buf)
+{
+	XLogReaderState *r = buf->record;
+	xl_zheap_multi_insert *xlrec;
+	int			i;
+	char	   *data;
+	char	   *tupledata;
+	Size		tuplelen;
+	RelFileNode rnode;
+
+	xlrec = (xl_zheap_multi_insert *) (XLogRecGetData(r) + SizeOfUndoHeader);
+
+	if (!(xlrec->flags & XLZ_INSERT_CONTAINS_NEW_TUPLE))
+		return;
+
+	/* only interested in our database */
+	XLogRecGetBlockTag(r, 0, &rnode, NULL, NULL);
+	if (rnode.dbNode != ctx->slot->data.database)
+		return;
+
+	/* output plugin doesn't look for this origin, no need to queue */
+	if (FilterByOrigin(ctx, XLogRecGetOrigin(r)))
+		return;
+
+	tupledata = XLogRecGetBlockData(r, 0, &tuplelen);
+
+	data = tupledata;
+	for (i = 0; i < xlrec->ntuples; i++)
+	{
+		ReorderBufferChange *change;
+		xl_multi_insert_ztuple *xlhdr;
+		int			datalen;
+		ReorderBufferTupleBuf *tuple;
+		ZHeapTupleHeader header;
+
+		change = ReorderBufferGetChange(ctx->reorder);
+		change->action = REORDER_BUFFER_CHANGE_INSERT;
+		change->origin_id = XLogRecGetOrigin(r);
+
+		memcpy(&change->data.tp.relnode, &rnode, sizeof(RelFileNode));
+
+		xlhdr = (xl_multi_insert_ztuple *) SHORTALIGN(data);
+		data = ((char *) xlhdr) + SizeOfMultiInsertZTuple;
+		datalen = xlhdr->datalen;
+
+		change->data.tp.newtuple =
+			ReorderBufferGetTupleBuf(ctx->reorder, datalen);
+
+		tuple = change->data.tp.newtuple;
+		header = (ZHeapTupleHeader) tuple->tuple.t_data;
+
+		/* not a disk based tuple */
+		ItemPointerSetInvalid(&tuple->tuple.t_self);
+
+		/* We can only figure this out after reassembling the transactions. */
+		tuple->tuple.t_tableOid = InvalidOid;
+
+		tuple->tuple.t_len = datalen + SizeofZHeapTupleHeader;
+
+		memset(header, 0, SizeofZHeapTupleHeader);
+
+		memcpy((char *) header + SizeofZHeapTupleHeader, data, datalen);
+		data += datalen;
+
+		header->t_infomask = xlhdr->t_infomask;
+		header->t_infomask2 = xlhdr->t_infomask2;
+		header->t_hoff = xlhdr->t_hoff;
+
+		/*
+		 * Reset toast reassembly state only after the last row in the last
+		 * xl_zheap_multi_insert record emitted by one zheap_multi_insert()
+		 * call.
+		 */
+		if (xlrec->flags & XLZ_INSERT_LAST_IN_MULTI &&
+			(i + 1) == xlrec->ntuples)
+			change->data.tp.clear_toast_afterwards = true;
+		else
+			change->data.tp.clear_toast_afterwards = false;
+
+		ReorderBufferQueueChange(ctx->reorder, XLogRecGetXid(r),
+								 buf->origptr, change);
+	}
+	Assert(data == tupledata + tuplelen);
+}
+
 
 /*
  * Read a HeapTuple as WAL logged by heap_insert, heap_update and heap_delete
@@ -1069,3 +1475,43 @@ DecodeXLogTuple(char *data, Size len, ReorderBufferTupleBuf *tuple)
 	header->t_infomask2 = xlhdr.t_infomask2;
 	header->t_hoff = xlhdr.t_hoff;
 }
+
+/*
+ * Read a ZHeapTuple as WAL logged by zheap_insert, zheap_update and
+ * zheap_delete (but not by zheap_multi_insert) into a tuplebuf.
+ *
+ * The tuple keeps its zheap header, so tuple->tuple.t_data really points to
+ * a ZHeapTupleHeader.  The size 'len' and the pointer 'data' in the record
+ * need to be computed outside as they are record specific.
+ */
+static void
+DecodeXLogZTuple(char *data, Size len, ReorderBufferTupleBuf *tuple)
+{
+	xl_zheap_header xlhdr;
+	int			datalen = len - SizeOfZHeapHeader;
+	ZHeapTupleHeader header;
+
+	Assert(datalen >= 0);
+
+	tuple->tuple.t_len = datalen + SizeofZHeapTupleHeader;
+	header = (ZHeapTupleHeader) tuple->tuple.t_data;
+
+	/* not a disk based tuple */
+	ItemPointerSetInvalid(&tuple->tuple.t_self);
+
+	/* we can only figure this out after reassembling the transactions */
+	tuple->tuple.t_tableOid = InvalidOid;
+
+	/* data is not stored aligned, copy to aligned storage */
+	memcpy((char *) &xlhdr, data, SizeOfZHeapHeader);
+
+	memset(header, 0, SizeofZHeapTupleHeader);
+
+	memcpy(((char *) header) + SizeofZHeapTupleHeader,
+		   data + SizeOfZHeapHeader,
+		   datalen);
+
+	header->t_infomask = xlhdr.t_infomask;
+	header->t_infomask2 = xlhdr.t_infomask2;
+	header->t_hoff = xlhdr.t_hoff;
+}
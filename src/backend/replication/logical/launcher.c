@@ -60,6 +60,8 @@
 
 int			max_logical_replication_workers = 4;
 int			max_sync_workers_per_subscription = 2;
+int			max_parallel_apply_workers_per_subscription = 0;
+int			max_parallel_sync_workers_per_table = 0;
 
 LogicalRepWorker *MyLogicalRepWorker = NULL;
 
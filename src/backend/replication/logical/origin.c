@@ -1134,6 +1134,55 @@ replorigin_session_setup(RepOriginId node)
 	ConditionVariableBroadcast(&session_replication_state->origin_cv);
 }
 
+/*
+ * Share a replication origin that another process has already acquired with
+ * replorigin_session_setup().
+ *
+ * This is used by the parallel apply workers of a subscription, which commit
+ * on behalf of their leader.  The origin stays owned by the leader, so it is
+ * released when the leader exits, not when we do; replorigin_session_reset()
+ * must not be called in a session set up this way.
+ */
+void
+replorigin_session_attach(RepOriginId node, int acquired_by)
+{
+	int			i;
+
+	Assert(max_replication_slots > 0);
+
+	if (session_replication_state != NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("cannot setup replication origin when one is already setup")));
+
+	LWLockAcquire(ReplicationOriginLock, LW_SHARED);
+
+	for (i = 0; i < max_replication_slots; i++)
+	{
+		ReplicationState *curstate = &replication_states[i];
+
+		if (curstate->roident != node)
+			continue;
+
+		if (curstate->acquired_by != acquired_by)
+			ereport(ERROR,
+					(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+					 errmsg("replication identifier %d is not active for PID %d",
+							curstate->roident, acquired_by)));
+
+		session_replication_state = curstate;
+		break;
+	}
+
+	LWLockRelease(ReplicationOriginLock);
+
+	if (session_replication_state == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_OBJECT),
+				 errmsg("replication origin with OID %u is not set up",
+						node)));
+}
+
 /*
  * Reset replay state previously setup in this session.
  *
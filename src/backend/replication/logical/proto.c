@@ -137,12 +137,20 @@ logicalrep_read_origin(StringInfo in, XLogRecPtr *origin_lsn)
 
 /*
  * Write INSERT to the output stream.
+ *
+ * Inside a streamed transaction, xid is the (sub)transaction the change
+ * belongs to; it's InvalidTransactionId otherwise and not sent at all.  The
+ * same goes for the other change messages.
  */
 void
-logicalrep_write_insert(StringInfo out, Relation rel, HeapTuple newtuple)
+logicalrep_write_insert(StringInfo out, TransactionId xid, Relation rel,
+						HeapTuple newtuple)
 {
 	pq_sendbyte(out, 'I');		/* action INSERT */
 
+	if (TransactionIdIsValid(xid))
+		pq_sendint32(out, xid);
+
 	Assert(rel->rd_rel->relreplident == REPLICA_IDENTITY_DEFAULT ||
 		   rel->rd_rel->relreplident == REPLICA_IDENTITY_FULL ||
 		   rel->rd_rel->relreplident == REPLICA_IDENTITY_INDEX);
@@ -182,11 +190,14 @@ logicalrep_read_insert(StringInfo in, LogicalRepTupleData *newtup)
  * Write UPDATE to the output stream.
  */
 void
-logicalrep_write_update(StringInfo out, Relation rel, HeapTuple oldtuple,
-						HeapTuple newtuple)
+logicalrep_write_update(StringInfo out, TransactionId xid, Relation rel,
+						HeapTuple oldtuple, HeapTuple newtuple)
 {
 	pq_sendbyte(out, 'U');		/* action UPDATE */
 
+	if (TransactionIdIsValid(xid))
+		pq_sendint32(out, xid);
+
 	Assert(rel->rd_rel->relreplident == REPLICA_IDENTITY_DEFAULT ||
 		   rel->rd_rel->relreplident == REPLICA_IDENTITY_FULL ||
 		   rel->rd_rel->relreplident == REPLICA_IDENTITY_INDEX);
@@ -252,7 +263,8 @@ logicalrep_read_update(StringInfo in, bool *has_oldtuple,
  * Write DELETE to the output stream.
  */
 void
-logicalrep_write_delete(StringInfo out, Relation rel, HeapTuple oldtuple)
+logicalrep_write_delete(StringInfo out, TransactionId xid, Relation rel,
+						HeapTuple oldtuple)
 {
 	Assert(rel->rd_rel->relreplident == REPLICA_IDENTITY_DEFAULT ||
 		   rel->rd_rel->relreplident == REPLICA_IDENTITY_FULL ||
@@ -260,6 +272,9 @@ logicalrep_write_delete(StringInfo out, Relation rel, HeapTuple oldtuple)
 
 	pq_sendbyte(out, 'D');		/* action DELETE */
 
+	if (TransactionIdIsValid(xid))
+		pq_sendint32(out, xid);
+
 	/* use Oid as relation identifier */
 	pq_sendint32(out, RelationGetRelid(rel));
 
@@ -300,6 +315,7 @@ logicalrep_read_delete(StringInfo in, LogicalRepTupleData *oldtup)
  */
 void
 logicalrep_write_truncate(StringInfo out,
+						  TransactionId xid,
 						  int nrelids,
 						  Oid relids[],
 						  bool cascade, bool restart_seqs)
@@ -309,6 +325,9 @@ logicalrep_write_truncate(StringInfo out,
 
 	pq_sendbyte(out, 'T');		/* action TRUNCATE */
 
+	if (TransactionIdIsValid(xid))
+		pq_sendint32(out, xid);
+
 	pq_sendint32(out, nrelids);
 
 	/* encode and send truncate flags */
@@ -437,6 +456,115 @@ logicalrep_read_typ(StringInfo in, LogicalRepTyp *ltyp)
 	ltyp->typname = pstrdup(pq_getmsgstring(in));
 }
 
+/*
+ * Write STREAM START to the output stream.
+ *
+ * The changes up to the next STREAM STOP belong to the in-progress toplevel
+ * transaction xid.
+ */
+void
+logicalrep_write_stream_start(StringInfo out, TransactionId xid)
+{
+	pq_sendbyte(out, 'S');		/* STREAM START */
+
+	Assert(TransactionIdIsValid(xid));
+	pq_sendint32(out, xid);
+}
+
+/*
+ * Read STREAM START from the stream, returns the toplevel transaction id.
+ */
+TransactionId
+logicalrep_read_stream_start(StringInfo in)
+{
+	TransactionId xid;
+
+	xid = pq_getmsgint(in, 4);
+	if (!TransactionIdIsValid(xid))
+		elog(ERROR, "invalid transaction ID in stream start message");
+
+	return xid;
+}
+
+/*
+ * Write STREAM STOP to the output stream.
+ */
+void
+logicalrep_write_stream_stop(StringInfo out)
+{
+	pq_sendbyte(out, 'E');		/* STREAM STOP */
+}
+
+/*
+ * Write STREAM ABORT to the output stream.  If subxid is different from xid,
+ * only the changes of that subtransaction are to be discarded.
+ */
+void
+logicalrep_write_stream_abort(StringInfo out, TransactionId xid,
+							  TransactionId subxid)
+{
+	pq_sendbyte(out, 'A');		/* STREAM ABORT */
+
+	Assert(TransactionIdIsValid(xid) && TransactionIdIsValid(subxid));
+	pq_sendint32(out, xid);
+	pq_sendint32(out, subxid);
+}
+
+/*
+ * Read STREAM ABORT from the stream.
+ */
+void
+logicalrep_read_stream_abort(StringInfo in, TransactionId *xid,
+							 TransactionId *subxid)
+{
+	*xid = pq_getmsgint(in, 4);
+	*subxid = pq_getmsgint(in, 4);
+}
+
+/*
+ * Write STREAM COMMIT to the output stream.
+ */
+void
+logicalrep_write_stream_commit(StringInfo out, ReorderBufferTXN *txn,
+							   XLogRecPtr commit_lsn)
+{
+	uint8		flags = 0;
+
+	pq_sendbyte(out, 'c');		/* STREAM COMMIT */
+
+	pq_sendint32(out, txn->xid);
+
+	/* send the flags field (unused for now) */
+	pq_sendbyte(out, flags);
+
+	/* send fields */
+	pq_sendint64(out, commit_lsn);
+	pq_sendint64(out, txn->end_lsn);
+	pq_sendint64(out, txn->commit_time);
+}
+
+/*
+ * Read STREAM COMMIT from the stream.
+ */
+void
+logicalrep_read_stream_commit(StringInfo in,
+							  LogicalRepStreamCommitData *commit_data)
+{
+	uint8		flags;
+
+	commit_data->xid = pq_getmsgint(in, 4);
+
+	/* read flags (unused for now) */
+	flags = pq_getmsgbyte(in);
+	if (flags != 0)
+		elog(ERROR, "unrecognized flags %u in stream commit message", flags);
+
+	/* read fields */
+	commit_data->commit_lsn = pq_getmsgint64(in);
+	commit_data->end_lsn = pq_getmsgint64(in);
+	commit_data->committime = pq_getmsgint64(in);
+}
+
 /*
  * Write a tuple to the outputstream, in the most efficient format possible.
  */
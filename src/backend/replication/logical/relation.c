@@ -190,6 +190,27 @@ logicalrep_relmap_update(LogicalRepRelation *remoterel)
 	MemoryContextSwitchTo(oldctx);
 }
 
+/*
+ * Return the publisher's description of a remote relation, as last sent in a
+ * RELATION message, or NULL if we haven't seen one yet.
+ *
+ * Unlike logicalrep_rel_open() this doesn't touch the local relation, so it
+ * can be used outside of a transaction.
+ */
+LogicalRepRelation *
+logicalrep_relmap_get_remoterel(LogicalRepRelId remoteid)
+{
+	LogicalRepRelMapEntry *entry;
+
+	if (LogicalRepRelMap == NULL)
+		return NULL;
+
+	entry = hash_search(LogicalRepRelMap, (void *) &remoteid,
+						HASH_FIND, NULL);
+
+	return entry ? &entry->remoterel : NULL;
+}
+
 /*
  * Find attribute index in TupleDesc struct by attribute name.
  *
@@ -62,6 +62,7 @@
 #include "access/tuptoaster.h"
 #include "access/xact.h"
 #include "access/xlog_internal.h"
+#include "access/zhtup.h"
 #include "catalog/catalog.h"
 #include "lib/binaryheap.h"
 #include "miscadmin.h"
@@ -156,6 +157,13 @@ typedef struct ReorderBufferDiskChange
  */
 static const Size max_changes_in_memory = 4096;
 
+/*
+ * Maximum amount of memory, in kB, used by the changes of all transactions
+ * being decoded.  Once exceeded, the largest transaction is either streamed
+ * to the output plugin, if it supports that, or spilled to disk.
+ */
+int			logical_decoding_work_mem;
+
 /* ---------------------------------------
  * primary reorderbuffer support routines
  * ---------------------------------------
@@ -170,6 +178,12 @@ static void ReorderBufferTransferSnapToParent(ReorderBufferTXN *txn,
 
 static void AssertTXNLsnOrder(ReorderBuffer *rb);
 
+static void ReorderBufferProcessTXN(ReorderBuffer *rb, ReorderBufferTXN *txn,
+									XLogRecPtr commit_lsn,
+									volatile Snapshot snapshot_now,
+									volatile CommandId command_id,
+									bool streaming);
+
 /* ---------------------------------------
  * support functions for lsn-order iterating over the ->changes of a
  * transaction and its subtransactions
@@ -189,7 +203,7 @@ static void ReorderBufferExecuteInvalidations(ReorderBuffer *rb, ReorderBufferTX
  * Disk serialization support functions
  * ---------------------------------------
  */
-static void ReorderBufferCheckSerializeTXN(ReorderBuffer *rb, ReorderBufferTXN *txn);
+static void ReorderBufferCheckMemoryLimit(ReorderBuffer *rb);
 static void ReorderBufferSerializeTXN(ReorderBuffer *rb, ReorderBufferTXN *txn);
 static void ReorderBufferSerializeChange(ReorderBuffer *rb, ReorderBufferTXN *txn,
 										 int fd, ReorderBufferChange *change);
@@ -199,6 +213,7 @@ static void ReorderBufferRestoreChange(ReorderBuffer *rb, ReorderBufferTXN *txn,
 									   char *change);
 static void ReorderBufferRestoreCleanup(ReorderBuffer *rb, ReorderBufferTXN *txn);
 static void ReorderBufferCleanupSerializedTXNs(const char *slotname);
+static void ReorderBufferTruncateTXN(ReorderBuffer *rb, ReorderBufferTXN *txn);
 static void ReorderBufferSerializedPath(char *path, ReplicationSlot *slot,
 										TransactionId xid, XLogSegNo segno);
 
@@ -206,6 +221,18 @@ static void ReorderBufferFreeSnap(ReorderBuffer *rb, Snapshot snap);
 static Snapshot ReorderBufferCopySnap(ReorderBuffer *rb, Snapshot orig_snap,
 									  ReorderBufferTXN *txn, CommandId cid);
 
+/* ---------------------------------------
+ * memory accounting and streaming of in-progress transactions
+ * ---------------------------------------
+ */
+static Size ReorderBufferChangeSize(ReorderBufferChange *change);
+static void ReorderBufferChangeMemoryUpdate(ReorderBuffer *rb,
+											ReorderBufferChange *change,
+											bool addition);
+static ReorderBufferTXN *ReorderBufferLargestTXN(ReorderBuffer *rb);
+static bool ReorderBufferCanStreamTXN(ReorderBuffer *rb, ReorderBufferTXN *txn);
+static void ReorderBufferStreamTXN(ReorderBuffer *rb, ReorderBufferTXN *txn);
+
 /* ---------------------------------------
  * toast reassembly support
  * ---------------------------------------
@@ -217,6 +244,16 @@ static void ReorderBufferToastReplace(ReorderBuffer *rb, ReorderBufferTXN *txn,
 static void ReorderBufferToastAppendChunk(ReorderBuffer *rb, ReorderBufferTXN *txn,
 										  Relation relation, ReorderBufferChange *change);
 
+/* ---------------------------------------
+ * zheap support
+ * ---------------------------------------
+ */
+static void ReorderBufferZHeapToHeap(ReorderBuffer *rb, Relation relation,
+									 ReorderBufferChange *change);
+static ReorderBufferTupleBuf *ReorderBufferZTupleToHeap(ReorderBuffer *rb,
+														TupleDesc desc,
+														ReorderBufferTupleBuf *ztuple);
+
 
 /*
  * Allocate a new ReorderBuffer and clean out any old serialized state from
@@ -269,6 +306,7 @@ ReorderBufferAllocate(void)
 
 	buffer->outbuf = NULL;
 	buffer->outbufsize = 0;
+	buffer->size = 0;
 
 	buffer->current_restart_decoding_lsn = InvalidXLogRecPtr;
 
@@ -369,11 +407,16 @@ ReorderBufferGetChange(ReorderBuffer *rb)
 }
 
 /*
- * Free an ReorderBufferChange.
+ * Free an ReorderBufferChange. If upd_mem is true, the memory used by the
+ * change is subtracted from the accounted memory of its transaction.
  */
 void
-ReorderBufferReturnChange(ReorderBuffer *rb, ReorderBufferChange *change)
+ReorderBufferReturnChange(ReorderBuffer *rb, ReorderBufferChange *change,
+						  bool upd_mem)
 {
+	if (upd_mem)
+		ReorderBufferChangeMemoryUpdate(rb, change, false);
+
 	/* free contained data */
 	switch (change->action)
 	{
@@ -585,12 +628,15 @@ ReorderBufferQueueChange(ReorderBuffer *rb, TransactionId xid, XLogRecPtr lsn,
 	txn = ReorderBufferTXNByXid(rb, xid, true, NULL, lsn, true);
 
 	change->lsn = lsn;
+	change->txn = txn;
 	Assert(InvalidXLogRecPtr != lsn);
 	dlist_push_tail(&txn->changes, &change->node);
 	txn->nentries++;
 	txn->nentries_mem++;
 
-	ReorderBufferCheckSerializeTXN(rb, txn);
+	ReorderBufferChangeMemoryUpdate(rb, change, true);
+
+	ReorderBufferCheckMemoryLimit(rb);
 }
 
 /*
@@ -1088,7 +1134,7 @@ ReorderBufferIterTXNNext(ReorderBuffer *rb, ReorderBufferIterTXNState *state)
 	{
 		change = dlist_container(ReorderBufferChange, node,
 								 dlist_pop_head_node(&state->old_change));
-		ReorderBufferReturnChange(rb, change);
+		ReorderBufferReturnChange(rb, change, true);
 		Assert(dlist_is_empty(&state->old_change));
 	}
 
@@ -1174,7 +1220,7 @@ ReorderBufferIterTXNFinish(ReorderBuffer *rb,
 
 		change = dlist_container(ReorderBufferChange, node,
 								 dlist_pop_head_node(&state->old_change));
-		ReorderBufferReturnChange(rb, change);
+		ReorderBufferReturnChange(rb, change, true);
 		Assert(dlist_is_empty(&state->old_change));
 	}
 
@@ -1217,7 +1263,7 @@ ReorderBufferCleanupTXN(ReorderBuffer *rb, ReorderBufferTXN *txn)
 
 		change = dlist_container(ReorderBufferChange, node, iter.cur);
 
-		ReorderBufferReturnChange(rb, change);
+		ReorderBufferReturnChange(rb, change, true);
 	}
 
 	/*
@@ -1230,7 +1276,7 @@ ReorderBufferCleanupTXN(ReorderBuffer *rb, ReorderBufferTXN *txn)
 
 		change = dlist_container(ReorderBufferChange, node, iter.cur);
 		Assert(change->action == REORDER_BUFFER_CHANGE_INTERNAL_TUPLECID);
-		ReorderBufferReturnChange(rb, change);
+		ReorderBufferReturnChange(rb, change, false);
 	}
 
 	/*
@@ -1242,6 +1288,21 @@ ReorderBufferCleanupTXN(ReorderBuffer *rb, ReorderBufferTXN *txn)
 		dlist_delete(&txn->base_snapshot_node);
 	}
 
+	/*
+	 * Cleanup the state left behind by streaming the transaction, if any.
+	 */
+	if (txn->stream_snapshot != NULL)
+	{
+		ReorderBufferFreeSnap(rb, txn->stream_snapshot);
+		txn->stream_snapshot = NULL;
+	}
+	if (txn->stream_specinsert != NULL)
+	{
+		ReorderBufferReturnChange(rb, txn->stream_specinsert, true);
+		txn->stream_specinsert = NULL;
+	}
+	ReorderBufferToastReset(rb, txn);
+
 	/*
 	 * Remove TXN from its containing list.
 	 *
@@ -1267,6 +1328,45 @@ ReorderBufferCleanupTXN(ReorderBuffer *rb, ReorderBufferTXN *txn)
 	ReorderBufferReturnTXN(rb, txn);
 }
 
+/*
+ * Discard the changes of a transaction and its subtransactions after they
+ * have been streamed, keeping the transactions themselves around.
+ */
+static void
+ReorderBufferTruncateTXN(ReorderBuffer *rb, ReorderBufferTXN *txn)
+{
+	dlist_mutable_iter iter;
+
+	dlist_foreach_modify(iter, &txn->subtxns)
+	{
+		ReorderBufferTXN *subtxn;
+
+		subtxn = dlist_container(ReorderBufferTXN, node, iter.cur);
+		Assert(subtxn->is_known_as_subxact);
+		ReorderBufferTruncateTXN(rb, subtxn);
+	}
+
+	dlist_foreach_modify(iter, &txn->changes)
+	{
+		ReorderBufferChange *change;
+
+		change = dlist_container(ReorderBufferChange, node, iter.cur);
+		dlist_delete(&change->node);
+		ReorderBufferReturnChange(rb, change, true);
+	}
+
+	/* the spilled changes have been streamed as well */
+	if (txn->serialized)
+	{
+		ReorderBufferRestoreCleanup(rb, txn);
+		txn->serialized = false;
+	}
+
+	txn->nentries = 0;
+	txn->nentries_mem = 0;
+	txn->streamed = true;
+}
+
 /*
  * Build a hash with a (relfilenode, ctid) -> (cmin, cmax) mapping for use by
  * HeapTupleSatisfiesHistoricMVCC.
@@ -1429,6 +1529,9 @@ ReorderBufferFreeSnap(ReorderBuffer *rb, Snapshot snap)
  * invalidations. Thus, once a toplevel commit is read, we iterate over the top
  * and subtransactions (using a k-way merge) and replay the changes in lsn
  * order.
+ *
+ * A transaction that has been streamed already (see ReorderBufferStreamTXN)
+ * only has its remaining changes replayed, followed by a stream commit.
  */
 void
 ReorderBufferCommit(ReorderBuffer *rb, TransactionId xid,
@@ -1437,10 +1540,8 @@ ReorderBufferCommit(ReorderBuffer *rb, TransactionId xid,
 					RepOriginId origin_id, XLogRecPtr origin_lsn)
 {
 	ReorderBufferTXN *txn;
-	volatile Snapshot snapshot_now;
-	volatile CommandId command_id = FirstCommandId;
-	bool		using_subtxn;
-	ReorderBufferIterTXNState *volatile iterstate = NULL;
+	Snapshot	snapshot_now;
+	CommandId	command_id = FirstCommandId;
 
 	txn = ReorderBufferTXNByXid(rb, xid, false, NULL, InvalidXLogRecPtr,
 								false);
@@ -1468,7 +1569,45 @@ ReorderBufferCommit(ReorderBuffer *rb, TransactionId xid,
 		return;
 	}
 
-	snapshot_now = txn->base_snapshot;
+	if (txn->streamed)
+	{
+		/*
+		 * Continue with the snapshot and command id the last streaming run
+		 * ended with, but make the transaction's own changes visible again in
+		 * case it modified the catalog since then.
+		 */
+		command_id = txn->stream_command_id;
+		snapshot_now = ReorderBufferCopySnap(rb, txn->stream_snapshot,
+											 txn, command_id);
+		ReorderBufferFreeSnap(rb, txn->stream_snapshot);
+		txn->stream_snapshot = NULL;
+	}
+	else
+		snapshot_now = txn->base_snapshot;
+
+	ReorderBufferProcessTXN(rb, txn, commit_lsn, snapshot_now, command_id,
+							false);
+}
+
+/*
+ * Replay the changes of a transaction and its subtransactions, starting with
+ * the given snapshot and command id.
+ *
+ * If streaming is true, the transaction is still in progress and is being
+ * streamed because the reorder buffer exceeded logical_decoding_work_mem. In
+ * that case the changes replayed are freed afterwards, and the state needed to
+ * continue with the next run is remembered in the transaction. Otherwise the
+ * transaction has committed at commit_lsn, and is removed once replayed.
+ */
+static void
+ReorderBufferProcessTXN(ReorderBuffer *rb, ReorderBufferTXN *txn,
+						XLogRecPtr commit_lsn,
+						volatile Snapshot snapshot_now,
+						volatile CommandId command_id,
+						bool streaming)
+{
+	bool		using_subtxn;
+	ReorderBufferIterTXNState *volatile iterstate = NULL;
 
 	/* build data to be able to lookup the CommandIds of catalog tuples */
 	ReorderBufferBuildTupleCidHash(rb, txn);
@@ -1491,14 +1630,21 @@ ReorderBufferCommit(ReorderBuffer *rb, TransactionId xid,
 	PG_TRY();
 	{
 		ReorderBufferChange *change;
-		ReorderBufferChange *specinsert = NULL;
+		ReorderBufferChange *specinsert;
+		bool		stream_started = false;
+		XLogRecPtr	prev_lsn = InvalidXLogRecPtr;
+
+		/* pick up a pending speculative insertion from the last run */
+		specinsert = txn->stream_specinsert;
+		txn->stream_specinsert = NULL;
 
 		if (using_subtxn)
 			BeginInternalSubTransaction("replay");
 		else
 			StartTransactionCommand();
 
-		rb->begin(rb, txn);
+		if (!txn->streamed)
+			rb->begin(rb, txn);
 
 		iterstate = ReorderBufferIterTXNInit(rb, txn);
 		while ((change = ReorderBufferIterTXNNext(rb, iterstate)) != NULL)
@@ -1506,6 +1652,14 @@ ReorderBufferCommit(ReorderBuffer *rb, TransactionId xid,
 			Relation	relation = NULL;
 			Oid			reloid;
 
+			/* a stream is only opened if there is something to send */
+			if (txn->streamed && !stream_started)
+			{
+				rb->stream_start(rb, txn, change->lsn);
+				stream_started = true;
+			}
+			prev_lsn = change->lsn;
+
 			switch (change->action)
 			{
 				case REORDER_BUFFER_CHANGE_INTERNAL_SPEC_CONFIRM:
@@ -1578,11 +1732,21 @@ ReorderBufferCommit(ReorderBuffer *rb, TransactionId xid,
 					if (relation->rd_rel->relkind == RELKIND_SEQUENCE)
 						goto change_done;
 
+					/*
+					 * zheap changes are queued in zheap format, convert them
+					 * before anyone looks at the tuples.
+					 */
+					if (RelationStorageIsZHeap(relation))
+						ReorderBufferZHeapToHeap(rb, relation, change);
+
 					/* user-triggered change */
 					if (!IsToastRelation(relation))
 					{
 						ReorderBufferToastReplace(rb, txn, relation, change);
-						rb->apply_change(rb, txn, relation, change);
+						if (txn->streamed)
+							rb->stream_change(rb, txn, relation, change);
+						else
+							rb->apply_change(rb, txn, relation, change);
 
 						/*
 						 * Only clear reassembled toast chunks if we're sure
@@ -1618,7 +1782,7 @@ ReorderBufferCommit(ReorderBuffer *rb, TransactionId xid,
 					 */
 					if (specinsert != NULL)
 					{
-						ReorderBufferReturnChange(rb, specinsert);
+						ReorderBufferReturnChange(rb, specinsert, true);
 						specinsert = NULL;
 					}
 
@@ -1647,7 +1811,7 @@ ReorderBufferCommit(ReorderBuffer *rb, TransactionId xid,
 					/* clear out a pending (and thus failed) speculation */
 					if (specinsert != NULL)
 					{
-						ReorderBufferReturnChange(rb, specinsert);
+						ReorderBufferReturnChange(rb, specinsert, true);
 						specinsert = NULL;
 					}
 
@@ -1680,7 +1844,12 @@ ReorderBufferCommit(ReorderBuffer *rb, TransactionId xid,
 							relations[nrelations++] = relation;
 						}
 
-						rb->apply_truncate(rb, txn, nrelations, relations, change);
+						if (txn->streamed)
+							rb->stream_truncate(rb, txn, nrelations, relations,
+												change);
+						else
+							rb->apply_truncate(rb, txn, nrelations, relations,
+											   change);
 
 						for (i = 0; i < nrelations; i++)
 							RelationClose(relations[i]);
@@ -1689,10 +1858,16 @@ ReorderBufferCommit(ReorderBuffer *rb, TransactionId xid,
 					}
 
 				case REORDER_BUFFER_CHANGE_MESSAGE:
-					rb->message(rb, txn, change->lsn, true,
-								change->data.msg.prefix,
-								change->data.msg.message_size,
-								change->data.msg.message);
+					if (txn->streamed)
+						rb->stream_message(rb, txn, change->lsn, true,
+										   change->data.msg.prefix,
+										   change->data.msg.message_size,
+										   change->data.msg.message);
+					else
+						rb->message(rb, txn, change->lsn, true,
+									change->data.msg.prefix,
+									change->data.msg.message_size,
+									change->data.msg.message);
 					break;
 
 				case REORDER_BUFFER_CHANGE_INTERNAL_SNAPSHOT:
@@ -1764,22 +1939,32 @@ ReorderBufferCommit(ReorderBuffer *rb, TransactionId xid,
 		}
 
 		/*
-		 * There's a speculative insertion remaining, just clean in up, it
-		 * can't have been successful, otherwise we'd gotten a confirmation
-		 * record.
+		 * There's a speculative insertion remaining.  If the transaction is
+		 * still in progress, its confirmation may yet arrive, so keep it for
+		 * the next run.  Otherwise just clean it up, it can't have been
+		 * successful, otherwise we'd gotten a confirmation record.
 		 */
-		if (specinsert)
-		{
-			ReorderBufferReturnChange(rb, specinsert);
-			specinsert = NULL;
-		}
+		if (specinsert && streaming)
+			txn->stream_specinsert = specinsert;
+		else if (specinsert)
+			ReorderBufferReturnChange(rb, specinsert, true);
+		specinsert = NULL;
 
 		/* clean up the iterator */
 		ReorderBufferIterTXNFinish(rb, iterstate);
 		iterstate = NULL;
 
-		/* call commit callback */
-		rb->commit(rb, txn, commit_lsn);
+		if (stream_started)
+			rb->stream_stop(rb, txn, prev_lsn);
+
+		/* call commit callback, unless the transaction is still running */
+		if (!streaming)
+		{
+			if (txn->streamed)
+				rb->stream_commit(rb, txn, commit_lsn);
+			else
+				rb->commit(rb, txn, commit_lsn);
+		}
 
 		/* this is just a sanity check against bad output plugin behaviour */
 		if (GetCurrentTransactionIdIfAny() != InvalidTransactionId)
@@ -1803,11 +1988,29 @@ ReorderBufferCommit(ReorderBuffer *rb, TransactionId xid,
 		if (using_subtxn)
 			RollbackAndReleaseCurrentSubTransaction();
 
-		if (snapshot_now->copied)
-			ReorderBufferFreeSnap(rb, snapshot_now);
+		if (streaming)
+		{
+			/*
+			 * Remember where to continue from.  The snapshot may belong to
+			 * one of the changes we're about to free, so copy it if needed.
+			 */
+			if (!snapshot_now->copied)
+				snapshot_now = ReorderBufferCopySnap(rb, snapshot_now,
+													 txn, command_id);
+			txn->stream_snapshot = snapshot_now;
+			txn->stream_command_id = command_id;
+
+			/* free the changes we've just streamed */
+			ReorderBufferTruncateTXN(rb, txn);
+		}
+		else
+		{
+			if (snapshot_now->copied)
+				ReorderBufferFreeSnap(rb, snapshot_now);
 
-		/* remove potential on-disk data, and deallocate */
-		ReorderBufferCleanupTXN(rb, txn);
+			/* remove potential on-disk data, and deallocate */
+			ReorderBufferCleanupTXN(rb, txn);
+		}
 	}
 	PG_CATCH();
 	{
@@ -1867,6 +2070,10 @@ ReorderBufferAbort(ReorderBuffer *rb, TransactionId xid, XLogRecPtr lsn)
 	/* cosmetic... */
 	txn->final_lsn = lsn;
 
+	/* have the output plugin throw away what it has been sent already */
+	if (txn->streamed)
+		rb->stream_abort(rb, txn, lsn);
+
 	/* remove potential on-disk data, and deallocate */
 	ReorderBufferCleanupTXN(rb, txn);
 }
@@ -1915,6 +2122,9 @@ ReorderBufferAbortOld(ReorderBuffer *rb, TransactionId oldestRunningXid)
 
 			elog(DEBUG2, "aborting old transaction %u", txn->xid);
 
+			if (txn->streamed)
+				rb->stream_abort(rb, txn, txn->final_lsn);
+
 			/* remove potential on-disk data, and deallocate this tx */
 			ReorderBufferCleanupTXN(rb, txn);
 		}
@@ -1962,6 +2172,13 @@ ReorderBufferForget(ReorderBuffer *rb, TransactionId xid, XLogRecPtr lsn)
 	else
 		Assert(txn->ninvalidations == 0);
 
+	/*
+	 * The output plugin has to throw away what it has been sent already, as
+	 * we're not going to send the commit.
+	 */
+	if (txn->streamed)
+		rb->stream_abort(rb, txn, lsn);
+
 	/* remove potential on-disk data, and deallocate */
 	ReorderBufferCleanupTXN(rb, txn);
 }
@@ -2230,20 +2447,236 @@ ReorderBufferSerializeReserve(ReorderBuffer *rb, Size sz)
 }
 
 /*
- * Check whether the transaction tx should spill its data to disk.
+ * Size of a change in memory, as accounted for by
+ * ReorderBufferChangeMemoryUpdate().
+ */
+static Size
+ReorderBufferChangeSize(ReorderBufferChange *change)
+{
+	Size		sz = sizeof(ReorderBufferChange);
+
+	switch (change->action)
+	{
+		case REORDER_BUFFER_CHANGE_INSERT:
+		case REORDER_BUFFER_CHANGE_UPDATE:
+		case REORDER_BUFFER_CHANGE_DELETE:
+		case REORDER_BUFFER_CHANGE_INTERNAL_SPEC_INSERT:
+			if (change->data.tp.oldtuple)
+				sz += sizeof(ReorderBufferTupleBuf) +
+					change->data.tp.oldtuple->alloc_tuple_size;
+			if (change->data.tp.newtuple)
+				sz += sizeof(ReorderBufferTupleBuf) +
+					change->data.tp.newtuple->alloc_tuple_size;
+			break;
+		case REORDER_BUFFER_CHANGE_MESSAGE:
+			sz += strlen(change->data.msg.prefix) + 1 +
+				change->data.msg.message_size;
+			break;
+		case REORDER_BUFFER_CHANGE_INTERNAL_SNAPSHOT:
+			{
+				Snapshot	snap = change->data.snapshot;
+
+				sz += sizeof(SnapshotData) +
+					sizeof(TransactionId) * (snap->xcnt + snap->subxcnt);
+				break;
+			}
+		case REORDER_BUFFER_CHANGE_TRUNCATE:
+			sz += sizeof(Oid) * change->data.truncate.nrelids;
+			break;
+		case REORDER_BUFFER_CHANGE_INTERNAL_SPEC_CONFIRM:
+		case REORDER_BUFFER_CHANGE_INTERNAL_COMMAND_ID:
+		case REORDER_BUFFER_CHANGE_INTERNAL_TUPLECID:
+			break;
+	}
+
+	return sz;
+}
+
+/*
+ * Add or subtract the memory used by a change to the accounted memory of its
+ * transaction and the whole reorder buffer.
+ *
+ * A change is accounted for from the moment it's queued (or restored from
+ * disk) until it's freed, regardless of whether it's still linked into the
+ * transaction's list of changes.
  */
 static void
-ReorderBufferCheckSerializeTXN(ReorderBuffer *rb, ReorderBufferTXN *txn)
+ReorderBufferChangeMemoryUpdate(ReorderBuffer *rb,
+								ReorderBufferChange *change,
+								bool addition)
 {
-	/*
-	 * TODO: improve accounting so we cheaply can take subtransactions into
-	 * account here.
-	 */
-	if (txn->nentries_mem >= max_changes_in_memory)
+	ReorderBufferTXN *txn = change->txn;
+	Size		sz;
+
+	Assert(txn != NULL);
+
+	sz = ReorderBufferChangeSize(change);
+
+	if (addition)
+	{
+		txn->size += sz;
+		rb->size += sz;
+	}
+	else
+	{
+		Assert(txn->size >= sz && rb->size >= sz);
+		txn->size -= sz;
+		rb->size -= sz;
+	}
+}
+
+/*
+ * Find the toplevel transaction using the most memory, including the memory
+ * used by its subtransactions.
+ *
+ * This walks all the toplevel transactions, but that's only done once the
+ * memory limit has been exceeded, and the number of concurrently running
+ * transactions is usually moderate.
+ */
+static ReorderBufferTXN *
+ReorderBufferLargestTXN(ReorderBuffer *rb)
+{
+	dlist_iter	iter;
+	ReorderBufferTXN *largest = NULL;
+	Size		largest_size = 0;
+
+	dlist_foreach(iter, &rb->toplevel_by_lsn)
+	{
+		ReorderBufferTXN *txn;
+		dlist_iter	subtxn_i;
+		Size		size;
+
+		txn = dlist_container(ReorderBufferTXN, node, iter.cur);
+
+		size = txn->size;
+		dlist_foreach(subtxn_i, &txn->subtxns)
+		{
+			ReorderBufferTXN *subtxn;
+
+			subtxn = dlist_container(ReorderBufferTXN, node, subtxn_i.cur);
+			size += subtxn->size;
+		}
+
+		if (size > largest_size)
+		{
+			largest = txn;
+			largest_size = size;
+		}
+	}
+
+	return largest;
+}
+
+/*
+ * Check whether the changes held in memory exceed logical_decoding_work_mem,
+ * and if so, evict the largest transactions until they don't anymore.
+ *
+ * A transaction is streamed to the output plugin if possible, and spilled to
+ * disk otherwise.
+ */
+static void
+ReorderBufferCheckMemoryLimit(ReorderBuffer *rb)
+{
+	while (rb->size >= logical_decoding_work_mem * 1024L)
+	{
+		ReorderBufferTXN *txn;
+		Size		before = rb->size;
+
+		txn = ReorderBufferLargestTXN(rb);
+		if (txn == NULL)
+			break;
+
+		if (ReorderBufferCanStreamTXN(rb, txn))
+			ReorderBufferStreamTXN(rb, txn);
+		else
+			ReorderBufferSerializeTXN(rb, txn);
+
+		/*
+		 * Toast chunks and pending speculative insertions can't be evicted;
+		 * don't loop forever if they're all that is left.
+		 */
+		if (rb->size >= before)
+			break;
+	}
+}
+
+/*
+ * Can the changes of the toplevel transaction txn be streamed to the output
+ * plugin before its commit is decoded?
+ *
+ * Apart from the plugin supporting it, this requires the snapshot builder to
+ * have reached a consistent state, and we must not be before the point where
+ * the client asked decoding to start.  Transactions that modified the catalog
+ * are not streamed: decoding their later changes requires seeing their own
+ * catalog changes, which could be aborted concurrently.  If a transaction
+ * starts modifying the catalog after it has been streamed, the rest of it is
+ * held back until it commits.
+ */
+static bool
+ReorderBufferCanStreamTXN(ReorderBuffer *rb, ReorderBufferTXN *txn)
+{
+	LogicalDecodingContext *ctx = rb->private_data;
+	dlist_iter	iter;
+
+	if (!ctx->streaming)
+		return false;
+
+	if (txn->base_snapshot == NULL)
+		return false;
+
+	if (SnapBuildCurrentState(ctx->snapshot_builder) != SNAPBUILD_CONSISTENT ||
+		SnapBuildXactNeedsSkip(ctx->snapshot_builder, ctx->reader->EndRecPtr))
+		return false;
+
+	if (txn->has_catalog_changes)
+		return false;
+
+	dlist_foreach(iter, &txn->subtxns)
+	{
+		ReorderBufferTXN *subtxn;
+
+		subtxn = dlist_container(ReorderBufferTXN, node, iter.cur);
+		if (subtxn->has_catalog_changes)
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Send the changes of an in-progress toplevel transaction, and its known
+ * subtransactions, to the output plugin and free them.
+ *
+ * The first run starts with the transaction's base snapshot; later runs
+ * continue with the snapshot and command id the previous one ended with.
+ */
+static void
+ReorderBufferStreamTXN(ReorderBuffer *rb, ReorderBufferTXN *txn)
+{
+	Snapshot	snapshot_now;
+	CommandId	command_id;
+
+	Assert(!txn->is_known_as_subxact);
+	Assert(txn->base_snapshot != NULL);
+
+	if (!txn->streamed)
+	{
+		command_id = FirstCommandId;
+		snapshot_now = ReorderBufferCopySnap(rb, txn->base_snapshot,
+											 txn, command_id);
+		txn->streamed = true;
+	}
+	else
 	{
-		ReorderBufferSerializeTXN(rb, txn);
-		Assert(txn->nentries_mem == 0);
+		command_id = txn->stream_command_id;
+		snapshot_now = txn->stream_snapshot;
+		txn->stream_snapshot = NULL;
 	}
+
+	elog(DEBUG2, "streaming changes of in-progress XID %u", txn->xid);
+
+	ReorderBufferProcessTXN(rb, txn, InvalidXLogRecPtr, snapshot_now,
+							command_id, true);
 }
 
 /*
@@ -2309,8 +2742,16 @@ ReorderBufferSerializeTXN(ReorderBuffer *rb, ReorderBufferTXN *txn)
 		}
 
 		ReorderBufferSerializeChange(rb, txn, fd, change);
+
+		/*
+		 * Remember the last spilled change, so the spilled data can be found
+		 * again even before the transaction's end is known.
+		 */
+		if (change->lsn > txn->final_lsn)
+			txn->final_lsn = change->lsn;
+
 		dlist_delete(&change->node);
-		ReorderBufferReturnChange(rb, change);
+		ReorderBufferReturnChange(rb, change, true);
 
 		spilled++;
 	}
@@ -2533,7 +2974,7 @@ ReorderBufferRestoreChanges(ReorderBuffer *rb, ReorderBufferTXN *txn,
 		dlist_container(ReorderBufferChange, node, cleanup_iter.cur);
 
 		dlist_delete(&cleanup->node);
-		ReorderBufferReturnChange(rb, cleanup);
+		ReorderBufferReturnChange(rb, cleanup, true);
 	}
 	txn->nentries_mem = 0;
 	Assert(dlist_is_empty(&txn->changes));
@@ -2674,8 +3115,10 @@ ReorderBufferRestoreChange(ReorderBuffer *rb, ReorderBufferTXN *txn,
 			{
 				uint32		tuplelen = ((HeapTuple) data)->t_len;
 
+				/* zheap tuples can be shorter than a heap tuple header */
 				change->data.tp.oldtuple =
-					ReorderBufferGetTupleBuf(rb, tuplelen - SizeofHeapTupleHeader);
+					ReorderBufferGetTupleBuf(rb, tuplelen -
+											 Min(tuplelen, SizeofHeapTupleHeader));
 
 				/* restore ->tuple */
 				memcpy(&change->data.tp.oldtuple->tuple, data,
@@ -2700,7 +3143,8 @@ ReorderBufferRestoreChange(ReorderBuffer *rb, ReorderBufferTXN *txn,
 					   sizeof(uint32));
 
 				change->data.tp.newtuple =
-					ReorderBufferGetTupleBuf(rb, tuplelen - SizeofHeapTupleHeader);
+					ReorderBufferGetTupleBuf(rb, tuplelen -
+											 Min(tuplelen, SizeofHeapTupleHeader));
 
 				/* restore ->tuple */
 				memcpy(&change->data.tp.newtuple->tuple, data,
@@ -2782,8 +3226,11 @@ ReorderBufferRestoreChange(ReorderBuffer *rb, ReorderBufferTXN *txn,
 			break;
 	}
 
+	change->txn = txn;
 	dlist_push_tail(&txn->changes, &change->node);
 	txn->nentries_mem++;
+
+	ReorderBufferChangeMemoryUpdate(rb, change, true);
 }
 
 /*
@@ -3122,7 +3569,7 @@ ReorderBufferToastReplace(ReorderBuffer *rb, ReorderBufferTXN *txn,
 				   VARSIZE(chunk) - VARHDRSZ);
 			data_done += VARSIZE(chunk) - VARHDRSZ;
 		}
-		Assert(data_done == toast_pointer.va_extsize);
+		Assert(data_done == VARATT_EXTERNAL_GET_EXTSIZE(toast_pointer));
 
 		/* make sure its marked as compressed or not */
 		if (VARATT_EXTERNAL_IS_COMPRESSED(toast_pointer))
@@ -3197,7 +3644,7 @@ ReorderBufferToastReset(ReorderBuffer *rb, ReorderBufferTXN *txn)
 			dlist_container(ReorderBufferChange, node, it.cur);
 
 			dlist_delete(&change->node);
-			ReorderBufferReturnChange(rb, change);
+			ReorderBufferReturnChange(rb, change, true);
 		}
 	}
 
@@ -3205,6 +3652,74 @@ ReorderBufferToastReset(ReorderBuffer *rb, ReorderBufferTXN *txn)
 	txn->toast_hash = NULL;
 }
 
+/* ---------------------------------------
+ * zheap support
+ *
+ * Changes to zheap relations are decoded with the tuples in zheap format,
+ * since the relation's tuple descriptor, which is needed to interpret them,
+ * is only available once the transaction is replayed.  Convert them to heap
+ * tuples, which is what the toast reassembly code and the output plugins
+ * expect, right after opening the relation.
+ * ---------------------------------------
+ */
+static void
+ReorderBufferZHeapToHeap(ReorderBuffer *rb, Relation relation,
+						 ReorderBufferChange *change)
+{
+	TupleDesc	desc = RelationGetDescr(relation);
+
+	/* the converted tuples generally differ in size */
+	ReorderBufferChangeMemoryUpdate(rb, change, false);
+
+	if (change->data.tp.newtuple != NULL)
+		change->data.tp.newtuple =
+			ReorderBufferZTupleToHeap(rb, desc, change->data.tp.newtuple);
+	if (change->data.tp.oldtuple != NULL)
+		change->data.tp.oldtuple =
+			ReorderBufferZTupleToHeap(rb, desc, change->data.tp.oldtuple);
+
+	ReorderBufferChangeMemoryUpdate(rb, change, true);
+}
+
+/*
+ * Form a heap tuple with the contents of the zheap tuple in ztuple, which is
+ * returned to the reorder buffer.
+ */
+static ReorderBufferTupleBuf *
+ReorderBufferZTupleToHeap(ReorderBuffer *rb, TupleDesc desc,
+						  ReorderBufferTupleBuf *ztuple)
+{
+	ReorderBufferTupleBuf *tuple;
+	ZHeapTupleData zhtup;
+	HeapTuple	htup;
+	Datum	   *values;
+	bool	   *isnull;
+
+	zhtup.t_len = ztuple->tuple.t_len;
+	zhtup.t_self = ztuple->tuple.t_self;
+	zhtup.t_tableOid = ztuple->tuple.t_tableOid;
+	zhtup.t_data = (ZHeapTupleHeader) ztuple->tuple.t_data;
+
+	values = palloc(desc->natts * sizeof(Datum));
+	isnull = palloc(desc->natts * sizeof(bool));
+
+	zheap_deform_tuple(&zhtup, desc, values, isnull, desc->natts);
+	htup = heap_form_tuple(desc, values, isnull);
+
+	tuple = ReorderBufferGetTupleBuf(rb, htup->t_len - SizeofHeapTupleHeader);
+	tuple->tuple.t_len = htup->t_len;
+	tuple->tuple.t_self = ztuple->tuple.t_self;
+	tuple->tuple.t_tableOid = ztuple->tuple.t_tableOid;
+	memcpy(tuple->tuple.t_data, htup->t_data, htup->t_len);
+
+	heap_freetuple(htup);
+	pfree(values);
+	pfree(isnull);
+	ReorderBufferReturnTupleBuf(rb, ztuple);
+
+	return tuple;
+}
+
 
 /* ---------------------------------------
  * Visibility support for logical decoding
@@ -47,6 +47,19 @@
  *	  So the state progression is always: INIT -> DATASYNC -> SYNCWAIT -> CATCHUP ->
  *	  SYNCDONE -> READY.
  *
+ *	  A large table can be copied by several processes at once, when
+ *	  max_parallel_sync_workers_per_table is set and the table has a replica
+ *	  identity index.  The sync worker then exports the snapshot of its slot
+ *	  instead of using it, splits the table into ranges of a key column at
+ *	  the bounds of the publisher's histogram for that column, and starts
+ *	  parallel sync workers that import the snapshot and copy some of the
+ *	  ranges while it copies others.  The parallel sync workers commit their
+ *	  ranges on their own, so the table is in state DATASYNC_PARALLEL rather
+ *	  than DATASYNC meanwhile, and a sync worker that finds the table in that
+ *	  state throws away whatever has been copied before it starts over.  To
+ *	  make that safe, only tables which are empty when the copy starts are
+ *	  copied in parallel.
+ *
  *	  The catalog pg_subscription_rel is used to keep information about
  *	  subscribed tables and their state.  Some transient state during data
  *	  synchronization is kept in shared memory.  The states SYNCWAIT and
@@ -91,29 +104,77 @@
 #include "access/table.h"
 #include "access/xact.h"
 
+#include "catalog/heap.h"
 #include "catalog/pg_subscription_rel.h"
 #include "catalog/pg_type.h"
 
 #include "commands/copy.h"
 
+#include "libpq/pqsignal.h"
+
+#include "optimizer/paths.h"
+
 #include "parser/parse_relation.h"
 
+#include "postmaster/bgworker.h"
+
 #include "replication/logicallauncher.h"
 #include "replication/logicalrelation.h"
+#include "replication/logicalworker.h"
 #include "replication/walreceiver.h"
 #include "replication/worker_internal.h"
 
 #include "utils/snapmgr.h"
+#include "storage/bufmgr.h"
+#include "storage/dsm.h"
 #include "storage/ipc.h"
+#include "storage/proc.h"
+#include "storage/shm_toc.h"
+#include "storage/spin.h"
+
+#include "tcop/tcopprot.h"
 
 #include "utils/builtins.h"
+#include "utils/guc.h"
 #include "utils/lsyscache.h"
 #include "utils/memutils.h"
 
+#define PARALLEL_SYNC_MAGIC			0x50a1a992
+#define PARALLEL_SYNC_KEY_SHARED	0
+
+/* State of one range of a table copied in parallel. */
+typedef enum ParallelSyncPartState
+{
+	PARALLEL_SYNC_PART_FREE,	/* nobody copies it yet */
+	PARALLEL_SYNC_PART_CLAIMED, /* being copied */
+	PARALLEL_SYNC_PART_DONE		/* copied and committed */
+} ParallelSyncPartState;
+
+typedef struct ParallelSyncShared
+{
+	Oid			dbid;
+	Oid			userid;
+	Oid			subid;
+	Oid			relid;
+	PGPROC	   *leader;
+	char		slotname[NAMEDATALEN];
+	char		snapshot[NAMEDATALEN];	/* exported by the leader's slot */
+	int			nparts;
+	slock_t		mutex;
+	ParallelSyncPartState parts[FLEXIBLE_ARRAY_MEMBER];
+} ParallelSyncShared;
+
 static bool table_states_valid = false;
+static List *table_states = NIL;	/* tables not yet in READY state */
 
 StringInfo	copybuf = NULL;
 
+static ParallelSyncShared *ps_shared = NULL;
+
+/* Parallel sync workers started by the sync worker, indexed by part. */
+static BackgroundWorkerHandle **ps_handles = NULL;
+static int	ps_nhandles = 0;
+
 /*
  * Exit routine for synchronization worker.
  */
@@ -331,7 +392,6 @@ process_syncing_tables_for_apply(XLogRecPtr current_lsn)
 		Oid			relid;
 		TimestampTz last_start_time;
 	};
-	static List *table_states = NIL;
 	static HTAB *last_start_times = NULL;
 	ListCell   *lc;
 	bool		started_tx = false;
@@ -541,6 +601,21 @@ process_syncing_tables(XLogRecPtr current_lsn)
 		process_syncing_tables_for_apply(current_lsn);
 }
 
+/*
+ * Are all the subscription's tables known to be in READY state?
+ *
+ * The answer is only as fresh as the last process_syncing_tables() call
+ * in the apply worker; if the states have been invalidated since, report
+ * false until they are rebuilt.
+ */
+bool
+AllTablesyncsReady(void)
+{
+	Assert(!am_tablesync_worker());
+
+	return table_states_valid && table_states == NIL;
+}
+
 /*
  * Create list of columns for COPY based on logical relation mapping.
  */
@@ -742,13 +817,160 @@ fetch_remote_table_info(char *nspname, char *relname,
 	pfree(cmd.data);
 }
 
+/*
+ * Get the values of the key column of a remote table at which to split it
+ * into nparts ranges of about the same number of rows, in ascending order.
+ *
+ * The values are taken from the histogram of the column in the publisher's
+ * statistics, so fewer values are returned if there are not enough bounds,
+ * and none if the column has no histogram.  Run under the same snapshot, the
+ * result is the same for every process that asks.
+ */
+static List *
+fetch_split_points(LogicalRepRelation *lrel, int nparts)
+{
+	WalRcvExecResult *res;
+	StringInfoData cmd;
+	TupleTableSlot *slot;
+	Oid			boundRow[1] = {TEXTOID};
+	List	   *bounds = NIL;
+	List	   *splits = NIL;
+	char	   *last = NULL;
+	int			nbounds;
+	int			i;
+
+	initStringInfo(&cmd);
+	appendStringInfo(&cmd,
+					 "SELECT b.v"
+					 "  FROM pg_catalog.pg_stats s,"
+					 "       pg_catalog.unnest(s.histogram_bounds::pg_catalog.text::pg_catalog.text[])"
+					 "       WITH ORDINALITY AS b(v, n)"
+					 " WHERE s.schemaname = %s"
+					 "   AND s.tablename = %s"
+					 "   AND s.attname = %s"
+					 "   AND NOT s.inherited"
+					 " ORDER BY b.n",
+					 quote_literal_cstr(lrel->nspname),
+					 quote_literal_cstr(lrel->relname),
+					 quote_literal_cstr(lrel->attnames[bms_next_member(lrel->attkeys, -1)]));
+	res = walrcv_exec(wrconn, cmd.data, 1, boundRow);
+	pfree(cmd.data);
+
+	if (res->status != WALRCV_OK_TUPLES)
+		ereport(ERROR,
+				(errmsg("could not fetch column statistics for table \"%s.%s\" from publisher: %s",
+						lrel->nspname, lrel->relname, res->err)));
+
+	slot = MakeSingleTupleTableSlot(res->tupledesc, &TTSOpsMinimalTuple);
+	while (tuplestore_gettupleslot(res->tuplestore, true, false, slot))
+	{
+		bool		isnull;
+		Datum		value = slot_getattr(slot, 1, &isnull);
+
+		if (!isnull)
+			bounds = lappend(bounds, TextDatumGetCString(value));
+		ExecClearTuple(slot);
+	}
+	ExecDropSingleTupleTableSlot(slot);
+	walrcv_clear_result(res);
+
+	/*
+	 * The histogram bounds divide the rows into buckets of equal size, so
+	 * take every (nbounds - 1) / nparts'th bound, except the lowest one.
+	 */
+	nbounds = list_length(bounds);
+	for (i = 1; i < nparts && nbounds > 1; i++)
+	{
+		int			idx = (int) ((int64) i * (nbounds - 1) / nparts);
+		char	   *bound;
+
+		if (idx == 0)
+			continue;
+		bound = list_nth(bounds, idx);
+		if (last != NULL && strcmp(last, bound) == 0)
+			continue;
+		splits = lappend(splits, bound);
+		last = bound;
+	}
+
+	return splits;
+}
+
+/*
+ * Decide into how many parts to split the initial copy of a table.
+ *
+ * Returns 1 if the table is to be copied by the sync worker alone.
+ */
+static int
+parallel_sync_parts(Relation rel)
+{
+	LogicalRepRelation lrel;
+	WalRcvExecResult *res;
+	StringInfoData cmd;
+	TupleTableSlot *slot;
+	Oid			sizeRow[1] = {INT8OID};
+	bool		isnull;
+	int64		relsize;
+	int64		partsize;
+	int			nparts;
+
+	if (max_parallel_sync_workers_per_table == 0)
+		return 1;
+
+	/*
+	 * What the parallel sync workers have copied is thrown away if the sync
+	 * has to start over, so the table must not have had anything else.
+	 */
+	if (RelationGetNumberOfBlocks(rel) > 0)
+		return 1;
+
+	fetch_remote_table_info(get_namespace_name(RelationGetNamespace(rel)),
+							RelationGetRelationName(rel), &lrel);
+
+	/* The ranges are of a key column, which is never NULL. */
+	if (bms_is_empty(lrel.attkeys))
+		return 1;
+
+	initStringInfo(&cmd);
+	appendStringInfo(&cmd, "SELECT pg_catalog.pg_relation_size(%u)",
+					 lrel.remoteid);
+	res = walrcv_exec(wrconn, cmd.data, 1, sizeRow);
+	pfree(cmd.data);
+
+	if (res->status != WALRCV_OK_TUPLES)
+		ereport(ERROR,
+				(errmsg("could not fetch table info for table \"%s.%s\" from publisher: %s",
+						lrel.nspname, lrel.relname, res->err)));
+
+	slot = MakeSingleTupleTableSlot(res->tupledesc, &TTSOpsMinimalTuple);
+	if (!tuplestore_gettupleslot(res->tuplestore, true, false, slot))
+		ereport(ERROR,
+				(errmsg("table \"%s.%s\" not found on publisher",
+						lrel.nspname, lrel.relname)));
+	relsize = DatumGetInt64(slot_getattr(slot, 1, &isnull));
+	ExecDropSingleTupleTableSlot(slot);
+	walrcv_clear_result(res);
+
+	/* Give each process at least min_parallel_table_scan_size to copy. */
+	partsize = Max((int64) min_parallel_table_scan_size * BLCKSZ, 1);
+	nparts = (int) Min(relsize / partsize,
+					   max_parallel_sync_workers_per_table + 1);
+	if (nparts < 2)
+		return 1;
+
+	return list_length(fetch_split_points(&lrel, nparts)) + 1;
+}
+
 /*
  * Copy existing data of a table from publisher.
  *
+ * If nparts is more than 1, only copy the part'th of the key ranges the
+ * table is split into for a parallel copy.
+ *
  * Caller is responsible for locking the local relation.
  */
 static void
-copy_table(Relation rel)
+copy_table(Relation rel, int part, int nparts)
 {
 	LogicalRepRelMapEntry *relmapentry;
 	LogicalRepRelation lrel;
@@ -771,8 +993,47 @@ copy_table(Relation rel)
 
 	/* Start copy on the publisher. */
 	initStringInfo(&cmd);
-	appendStringInfo(&cmd, "COPY %s TO STDOUT",
-					 quote_qualified_identifier(lrel.nspname, lrel.relname));
+	if (nparts > 1)
+	{
+		List	   *splits = fetch_split_points(&lrel, nparts);
+		int			nsplits = list_length(splits);
+		char	   *keyname;
+		int			i;
+
+		/* There may be fewer ranges than parts, see fetch_split_points. */
+		if (part > nsplits)
+		{
+			pfree(cmd.data);
+			logicalrep_rel_close(relmapentry, NoLock);
+			return;
+		}
+
+		keyname = lrel.attnames[bms_next_member(lrel.attkeys, -1)];
+
+		appendStringInfoString(&cmd, "COPY (SELECT ");
+		for (i = 0; i < lrel.natts; i++)
+		{
+			if (i > 0)
+				appendStringInfoString(&cmd, ", ");
+			appendStringInfoString(&cmd, quote_identifier(lrel.attnames[i]));
+		}
+		appendStringInfo(&cmd, " FROM ONLY %s WHERE ",
+						 quote_qualified_identifier(lrel.nspname, lrel.relname));
+		if (part > 0)
+			appendStringInfo(&cmd, "%s >= %s", quote_identifier(keyname),
+							 quote_literal_cstr(list_nth(splits, part - 1)));
+		if (part > 0 && part < nsplits)
+			appendStringInfoString(&cmd, " AND ");
+		if (part < nsplits)
+			appendStringInfo(&cmd, "%s < %s", quote_identifier(keyname),
+							 quote_literal_cstr(list_nth(splits, part)));
+		if (nsplits == 0)
+			appendStringInfoString(&cmd, "true");
+		appendStringInfoString(&cmd, ") TO STDOUT");
+	}
+	else
+		appendStringInfo(&cmd, "COPY %s TO STDOUT",
+						 quote_qualified_identifier(lrel.nspname, lrel.relname));
 	res = walrcv_exec(wrconn, cmd.data, 0, NULL);
 	pfree(cmd.data);
 	if (res->status != WALRCV_OK_COPY_OUT)
@@ -796,6 +1057,382 @@ copy_table(Relation rel)
 	logicalrep_rel_close(relmapentry, NoLock);
 }
 
+/*
+ * Claim a part of a parallel copy.  Returns false if it's taken already.
+ */
+static bool
+parallel_sync_claim(int part)
+{
+	bool		claimed = false;
+
+	SpinLockAcquire(&ps_shared->mutex);
+	if (ps_shared->parts[part] == PARALLEL_SYNC_PART_FREE)
+	{
+		ps_shared->parts[part] = PARALLEL_SYNC_PART_CLAIMED;
+		claimed = true;
+	}
+	SpinLockRelease(&ps_shared->mutex);
+
+	return claimed;
+}
+
+/*
+ * Mark a part of a parallel copy as copied and tell the leader.
+ */
+static void
+parallel_sync_done(int part)
+{
+	SpinLockAcquire(&ps_shared->mutex);
+	ps_shared->parts[part] = PARALLEL_SYNC_PART_DONE;
+	SpinLockRelease(&ps_shared->mutex);
+
+	SetLatch(&ps_shared->leader->procLatch);
+}
+
+/*
+ * Start a transaction on the publisher that sees the snapshot exported by
+ * the sync worker's slot.
+ */
+static void
+parallel_sync_import_snapshot(void)
+{
+	WalRcvExecResult *res;
+	char	   *cmd;
+
+	res = walrcv_exec(wrconn,
+					  "BEGIN READ ONLY ISOLATION LEVEL "
+					  "REPEATABLE READ", 0, NULL);
+	if (res->status != WALRCV_OK_COMMAND)
+		ereport(ERROR,
+				(errmsg("table copy could not start transaction on publisher"),
+				 errdetail("The error was: %s", res->err)));
+	walrcv_clear_result(res);
+
+	cmd = psprintf("SET TRANSACTION SNAPSHOT %s",
+				   quote_literal_cstr(ps_shared->snapshot));
+	res = walrcv_exec(wrconn, cmd, 0, NULL);
+	pfree(cmd);
+	if (res->status != WALRCV_OK_COMMAND)
+		ereport(ERROR,
+				(errmsg("table copy could not import snapshot \"%s\" on publisher",
+						ps_shared->snapshot),
+				 errdetail("The error was: %s", res->err)));
+	walrcv_clear_result(res);
+}
+
+/*
+ * Terminate the parallel sync workers when the sync worker exits.
+ */
+static void
+parallel_sync_shutdown(int code, Datum arg)
+{
+	int			i;
+
+	for (i = 0; i < ps_nhandles; i++)
+	{
+		if (ps_handles[i] != NULL)
+			TerminateBackgroundWorker(ps_handles[i]);
+	}
+}
+
+/*
+ * Copy existing data of a table from publisher in nparts key ranges, which
+ * parallel sync workers copy concurrently with us.
+ *
+ * Our own ranges are copied in the current transaction, like copy_table();
+ * the parallel sync workers commit theirs before we return.  The slot is
+ * created with an exported snapshot on wrconn, which must then stay idle
+ * until all the workers have imported it, so we copy over another
+ * connection.
+ */
+static void
+copy_table_parallel(Relation rel, char *slotname, int nparts,
+					XLogRecPtr *origin_startpos)
+{
+	WalReceiverConn *slotconn = wrconn;
+	WalRcvExecResult *res;
+	char	   *snapshot;
+	char	   *err;
+	dsm_segment *seg;
+	shm_toc_estimator e;
+	shm_toc    *toc;
+	Size		shared_size;
+	Size		segsize;
+	int			nstarted = 0;
+	int			part;
+
+	snapshot = walrcv_create_slot(wrconn, slotname, true,
+								  CRS_EXPORT_SNAPSHOT, origin_startpos);
+
+	shared_size = add_size(offsetof(ParallelSyncShared, parts),
+						   mul_size(nparts, sizeof(ParallelSyncPartState)));
+	shm_toc_initialize_estimator(&e);
+	shm_toc_estimate_chunk(&e, shared_size);
+	shm_toc_estimate_keys(&e, 1);
+	segsize = shm_toc_estimate(&e);
+
+	seg = dsm_create(segsize, 0);
+	toc = shm_toc_create(PARALLEL_SYNC_MAGIC, dsm_segment_address(seg),
+						 segsize);
+
+	ps_shared = shm_toc_allocate(toc, shared_size);
+	ps_shared->dbid = MyLogicalRepWorker->dbid;
+	ps_shared->userid = MyLogicalRepWorker->userid;
+	ps_shared->subid = MyLogicalRepWorker->subid;
+	ps_shared->relid = MyLogicalRepWorker->relid;
+	ps_shared->leader = MyProc;
+	strlcpy(ps_shared->slotname, slotname, NAMEDATALEN);
+	strlcpy(ps_shared->snapshot, snapshot, NAMEDATALEN);
+	ps_shared->nparts = nparts;
+	SpinLockInit(&ps_shared->mutex);
+	for (part = 0; part < nparts; part++)
+		ps_shared->parts[part] = PARALLEL_SYNC_PART_FREE;
+	shm_toc_insert(toc, PARALLEL_SYNC_KEY_SHARED, ps_shared);
+
+	/* We copy the first range ourselves. */
+	(void) parallel_sync_claim(0);
+
+	/* This happens once in a sync worker's life. */
+	ps_handles = MemoryContextAllocZero(TopMemoryContext,
+										nparts * sizeof(BackgroundWorkerHandle *));
+	ps_nhandles = nparts;
+	before_shmem_exit(parallel_sync_shutdown, (Datum) 0);
+
+	for (part = 1; part < nparts; part++)
+	{
+		BackgroundWorker bgw;
+
+		memset(&bgw, 0, sizeof(bgw));
+		bgw.bgw_flags = BGWORKER_SHMEM_ACCESS |
+			BGWORKER_BACKEND_DATABASE_CONNECTION;
+		bgw.bgw_start_time = BgWorkerStart_RecoveryFinished;
+		snprintf(bgw.bgw_library_name, BGW_MAXLEN, "postgres");
+		snprintf(bgw.bgw_function_name, BGW_MAXLEN, "ParallelSyncWorkerMain");
+		snprintf(bgw.bgw_name, BGW_MAXLEN,
+				 "logical replication parallel sync worker for subscription %u sync %u",
+				 ps_shared->subid, ps_shared->relid);
+		snprintf(bgw.bgw_type, BGW_MAXLEN,
+				 "logical replication parallel sync worker");
+		bgw.bgw_restart_time = BGW_NEVER_RESTART;
+		bgw.bgw_notify_pid = MyProcPid;
+		bgw.bgw_main_arg = UInt32GetDatum(dsm_segment_handle(seg));
+		memcpy(bgw.bgw_extra, &part, sizeof(int));
+
+		if (!RegisterDynamicBackgroundWorker(&bgw, &ps_handles[part]))
+		{
+			ereport(WARNING,
+					(errcode(ERRCODE_CONFIGURATION_LIMIT_EXCEEDED),
+					 errmsg("out of background worker slots"),
+					 errdetail("Started %d of %d parallel sync workers for table \"%s\".",
+							   nstarted, nparts - 1,
+							   RelationGetRelationName(rel)),
+					 errhint("You might need to increase max_worker_processes.")));
+			break;
+		}
+		nstarted++;
+	}
+
+	wrconn = walrcv_connect(MySubscription->conninfo, true, slotname, &err);
+	if (wrconn == NULL)
+		ereport(ERROR,
+				(errmsg("could not connect to the publisher: %s", err)));
+	parallel_sync_import_snapshot();
+
+	/*
+	 * Copy the first range, and then any the parallel sync workers haven't
+	 * taken by then, because they failed to start or are slow to.
+	 */
+	PushActiveSnapshot(GetTransactionSnapshot());
+	for (part = 0; part < nparts; part++)
+	{
+		if (part > 0 && !parallel_sync_claim(part))
+			continue;
+		copy_table(rel, part, nparts);
+		parallel_sync_done(part);
+	}
+	PopActiveSnapshot();
+
+	res = walrcv_exec(wrconn, "COMMIT", 0, NULL);
+	if (res->status != WALRCV_OK_COMMAND)
+		ereport(ERROR,
+				(errmsg("table copy could not finish transaction on publisher"),
+				 errdetail("The error was: %s", res->err)));
+	walrcv_clear_result(res);
+	walrcv_disconnect(wrconn);
+	wrconn = slotconn;
+
+	/* Wait for the parallel sync workers to commit their ranges. */
+	for (;;)
+	{
+		bool		done = true;
+
+		CHECK_FOR_INTERRUPTS();
+
+		for (part = 1; part < nparts; part++)
+		{
+			BgwHandleStatus status = BGWH_STOPPED;
+			ParallelSyncPartState state;
+			pid_t		pid;
+
+			if (ps_handles[part] != NULL)
+				status = GetBackgroundWorkerPid(ps_handles[part], &pid);
+
+			/* Look at the part after the worker, which sets it before exit. */
+			SpinLockAcquire(&ps_shared->mutex);
+			state = ps_shared->parts[part];
+			SpinLockRelease(&ps_shared->mutex);
+
+			if (state == PARALLEL_SYNC_PART_DONE)
+				continue;
+			done = false;
+
+			if (status == BGWH_STOPPED || status == BGWH_POSTMASTER_DIED)
+				ereport(ERROR,
+						(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+						 errmsg("logical replication parallel sync worker for table \"%s\" exited unexpectedly",
+								RelationGetRelationName(rel))));
+		}
+
+		if (done)
+			break;
+
+		(void) WaitLatch(MyLatch,
+						 WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
+						 1000L, WAIT_EVENT_LOGICAL_SYNC_DATA);
+		ResetLatch(MyLatch);
+	}
+
+	/* Workers that found their range taken may still be looking at it. */
+	for (part = 1; part < nparts; part++)
+	{
+		if (ps_handles[part] != NULL)
+			(void) WaitForBackgroundWorkerShutdown(ps_handles[part]);
+	}
+	ps_nhandles = 0;
+	dsm_detach(seg);
+	ps_shared = NULL;
+}
+
+/*
+ * Main entry point of a parallel sync worker, which copies one key range
+ * of a table for a sync worker.
+ */
+void
+ParallelSyncWorkerMain(Datum main_arg)
+{
+	dsm_segment *seg;
+	shm_toc    *toc;
+	int			part;
+	char	   *err;
+	Relation	rel;
+	WalRcvExecResult *res;
+	MemoryContext oldctx;
+
+	memcpy(&part, MyBgworkerEntry->bgw_extra, sizeof(int));
+
+	/* Setup signal handling */
+	pqsignal(SIGTERM, die);
+	BackgroundWorkerUnblockSignals();
+
+	seg = dsm_attach(DatumGetUInt32(main_arg));
+	if (seg == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("could not map dynamic shared memory segment")));
+	toc = shm_toc_attach(PARALLEL_SYNC_MAGIC, dsm_segment_address(seg));
+	if (toc == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("invalid magic number in dynamic shared memory segment")));
+	ps_shared = shm_toc_lookup(toc, PARALLEL_SYNC_KEY_SHARED, false);
+
+	/* The sync worker may have copied our range itself already. */
+	if (!parallel_sync_claim(part))
+		proc_exit(0);
+
+	/*
+	 * The copy code looks at the worker's launcher slot; we don't have one,
+	 * so set up a private copy with what it needs.
+	 */
+	MyLogicalRepWorker = MemoryContextAllocZero(TopMemoryContext,
+												sizeof(LogicalRepWorker));
+	MyLogicalRepWorker->launch_time = GetCurrentTimestamp();
+	MyLogicalRepWorker->in_use = true;
+	MyLogicalRepWorker->proc = MyProc;
+	MyLogicalRepWorker->dbid = ps_shared->dbid;
+	MyLogicalRepWorker->userid = ps_shared->userid;
+	MyLogicalRepWorker->subid = ps_shared->subid;
+	MyLogicalRepWorker->relid = ps_shared->relid;
+
+	/* Run as replica session replication role. */
+	SetConfigOption("session_replication_role", "replica",
+					PGC_SUSET, PGC_S_OVERRIDE);
+
+	/* Connect to our database. */
+	BackgroundWorkerInitializeConnectionByOid(ps_shared->dbid,
+											  ps_shared->userid,
+											  0);
+
+	ApplyContext = AllocSetContextCreate(TopMemoryContext,
+										 "ApplyContext",
+										 ALLOCSET_DEFAULT_SIZES);
+
+	/* Load the subscription; if it's gone, the sync worker is going too. */
+	StartTransactionCommand();
+	oldctx = MemoryContextSwitchTo(ApplyContext);
+	MySubscription = GetSubscription(ps_shared->subid, true);
+	MemoryContextSwitchTo(oldctx);
+	if (!MySubscription)
+		proc_exit(0);
+	MySubscriptionValid = true;
+
+	/* Setup synchronous commit according to the user's wishes */
+	SetConfigOption("synchronous_commit", MySubscription->synccommit,
+					PGC_BACKEND, PGC_S_OVERRIDE);
+
+	ereport(DEBUG1,
+			(errmsg("logical replication parallel sync worker for subscription \"%s\", table \"%s\" has started",
+					MySubscription->name,
+					get_rel_name(ps_shared->relid))));
+
+	CommitTransactionCommand();
+
+	/* Load the libpq-specific functions */
+	load_file("libpqwalreceiver", false);
+
+	wrconn = walrcv_connect(MySubscription->conninfo, true,
+							ps_shared->slotname, &err);
+	if (wrconn == NULL)
+		ereport(ERROR,
+				(errmsg("could not connect to the publisher: %s", err)));
+
+	StartTransactionCommand();
+	rel = table_open(ps_shared->relid, RowExclusiveLock);
+
+	parallel_sync_import_snapshot();
+
+	PushActiveSnapshot(GetTransactionSnapshot());
+	copy_table(rel, part, ps_shared->nparts);
+	PopActiveSnapshot();
+
+	res = walrcv_exec(wrconn, "COMMIT", 0, NULL);
+	if (res->status != WALRCV_OK_COMMAND)
+		ereport(ERROR,
+				(errmsg("table copy could not finish transaction on publisher"),
+				 errdetail("The error was: %s", res->err)));
+	walrcv_clear_result(res);
+
+	table_close(rel, NoLock);
+	CommitTransactionCommand();
+	pgstat_report_stat(false);
+
+	parallel_sync_done(part);
+
+	walrcv_disconnect(wrconn);
+
+	proc_exit(0);
+}
+
 /*
  * Start syncing the table in the sync worker.
  *
@@ -849,12 +1486,36 @@ LogicalRepSyncTableStart(XLogRecPtr *origin_startpos)
 	{
 		case SUBREL_STATE_INIT:
 		case SUBREL_STATE_DATASYNC:
+		case SUBREL_STATE_DATASYNC_PARALLEL:
 			{
 				Relation	rel;
 				WalRcvExecResult *res;
+				int			nparts;
+
+				/*
+				 * Throw away what the parallel sync workers of an earlier
+				 * attempt have committed.  The table was empty when that
+				 * attempt started, so nothing else goes with it.
+				 */
+				if (MyLogicalRepWorker->relstate == SUBREL_STATE_DATASYNC_PARALLEL)
+				{
+					StartTransactionCommand();
+					rel = table_open(MyLogicalRepWorker->relid,
+									 AccessExclusiveLock);
+					heap_truncate_one_rel(rel);
+					table_close(rel, NoLock);
+					CommitTransactionCommand();
+				}
+
+				StartTransactionCommand();
+				rel = table_open(MyLogicalRepWorker->relid, AccessShareLock);
+				nparts = parallel_sync_parts(rel);
+				table_close(rel, AccessShareLock);
+				CommitTransactionCommand();
 
 				SpinLockAcquire(&MyLogicalRepWorker->relmutex);
-				MyLogicalRepWorker->relstate = SUBREL_STATE_DATASYNC;
+				MyLogicalRepWorker->relstate = (nparts > 1) ?
+					SUBREL_STATE_DATASYNC_PARALLEL : SUBREL_STATE_DATASYNC;
 				MyLogicalRepWorker->relstate_lsn = InvalidXLogRecPtr;
 				SpinLockRelease(&MyLogicalRepWorker->relmutex);
 
@@ -881,41 +1542,46 @@ LogicalRepSyncTableStart(XLogRecPtr *origin_startpos)
 				 */
 				rel = table_open(MyLogicalRepWorker->relid, RowExclusiveLock);
 
-				/*
-				 * Create a temporary slot for the sync process. We do this
-				 * inside the transaction so that we can use the snapshot made
-				 * by the slot to get existing data.
-				 */
-				res = walrcv_exec(wrconn,
-								  "BEGIN READ ONLY ISOLATION LEVEL "
-								  "REPEATABLE READ", 0, NULL);
-				if (res->status != WALRCV_OK_COMMAND)
-					ereport(ERROR,
-							(errmsg("table copy could not start transaction on publisher"),
-							 errdetail("The error was: %s", res->err)));
-				walrcv_clear_result(res);
+				if (nparts > 1)
+					copy_table_parallel(rel, slotname, nparts, origin_startpos);
+				else
+				{
+					/*
+					 * Create a temporary slot for the sync process. We do
+					 * this inside the transaction so that we can use the
+					 * snapshot made by the slot to get existing data.
+					 */
+					res = walrcv_exec(wrconn,
+									  "BEGIN READ ONLY ISOLATION LEVEL "
+									  "REPEATABLE READ", 0, NULL);
+					if (res->status != WALRCV_OK_COMMAND)
+						ereport(ERROR,
+								(errmsg("table copy could not start transaction on publisher"),
+								 errdetail("The error was: %s", res->err)));
+					walrcv_clear_result(res);
 
-				/*
-				 * Create new temporary logical decoding slot.
-				 *
-				 * We'll use slot for data copy so make sure the snapshot is
-				 * used for the transaction; that way the COPY will get data
-				 * that is consistent with the lsn used by the slot to start
-				 * decoding.
-				 */
-				walrcv_create_slot(wrconn, slotname, true,
-								   CRS_USE_SNAPSHOT, origin_startpos);
-
-				PushActiveSnapshot(GetTransactionSnapshot());
-				copy_table(rel);
-				PopActiveSnapshot();
-
-				res = walrcv_exec(wrconn, "COMMIT", 0, NULL);
-				if (res->status != WALRCV_OK_COMMAND)
-					ereport(ERROR,
-							(errmsg("table copy could not finish transaction on publisher"),
-							 errdetail("The error was: %s", res->err)));
-				walrcv_clear_result(res);
+					/*
+					 * Create new temporary logical decoding slot.
+					 *
+					 * We'll use slot for data copy so make sure the snapshot
+					 * is used for the transaction; that way the COPY will get
+					 * data that is consistent with the lsn used by the slot
+					 * to start decoding.
+					 */
+					walrcv_create_slot(wrconn, slotname, true,
+									   CRS_USE_SNAPSHOT, origin_startpos);
+
+					PushActiveSnapshot(GetTransactionSnapshot());
+					copy_table(rel, 0, 1);
+					PopActiveSnapshot();
+
+					res = walrcv_exec(wrconn, "COMMIT", 0, NULL);
+					if (res->status != WALRCV_OK_COMMAND)
+						ereport(ERROR,
+								(errmsg("table copy could not finish transaction on publisher"),
+								 errdetail("The error was: %s", res->err)));
+					walrcv_clear_result(res);
+				}
 
 				table_close(rel, NoLock);
 
@@ -18,6 +18,13 @@
  *	  This module includes server facing code and shares libpqwalreceiver
  *	  module with walreceiver for providing the libpq specific functionality.
  *
+ *	  When the subscription has streaming enabled, the publisher may send the
+ *	  changes of a large transaction before it commits, in chunks enclosed in
+ *	  STREAM START and STREAM STOP messages.  We spool those changes to a
+ *	  temporary file per toplevel transaction, remembering where each
+ *	  subtransaction's changes begin so that a subtransaction abort can cut
+ *	  them off again, and replay the file when STREAM COMMIT arrives.
+ *
  *-------------------------------------------------------------------------
  */
 
@@ -49,6 +56,7 @@
 #include "postmaster/walwriter.h"
 #include "replication/decode.h"
 #include "replication/logical.h"
+#include "replication/logicallauncher.h"
 #include "replication/logicalproto.h"
 #include "replication/logicalrelation.h"
 #include "replication/logicalworker.h"
@@ -58,6 +66,7 @@
 #include "replication/walreceiver.h"
 #include "replication/worker_internal.h"
 #include "rewrite/rewriteHandler.h"
+#include "storage/buffile.h"
 #include "storage/bufmgr.h"
 #include "storage/ipc.h"
 #include "storage/lmgr.h"
@@ -69,6 +78,7 @@
 #include "utils/datum.h"
 #include "utils/fmgroids.h"
 #include "utils/guc.h"
+#include "utils/hsearch.h"
 #include "utils/inval.h"
 #include "utils/lsyscache.h"
 #include "utils/memutils.h"
@@ -94,7 +104,30 @@ typedef struct SlotErrCallbackArg
 	int			remote_attnum;
 } SlotErrCallbackArg;
 
-static MemoryContext ApplyMessageContext = NULL;
+/* Position of the first spooled change of a subtransaction */
+typedef struct StreamSubXact
+{
+	TransactionId xid;
+	int			fileno;
+	off_t		offset;
+} StreamSubXact;
+
+/* Spooled changes of a streamed transaction, until it commits or aborts */
+typedef struct StreamXidEntry
+{
+	TransactionId xid;			/* toplevel transaction, hash key */
+	BufFile    *file;			/* spooled changes */
+	int			end_fileno;		/* logical end of the spool; anything past */
+	off_t		end_offset;		/* it belongs to aborted subtransactions */
+	StreamSubXact *subxacts;	/* in order of their first change */
+	int			nsubxacts;
+	int			maxsubxacts;
+} StreamXidEntry;
+
+static HTAB *stream_xids = NULL;
+static StreamXidEntry *stream_xid = NULL;	/* transaction being streamed */
+
+MemoryContext ApplyMessageContext = NULL;
 MemoryContext ApplyContext = NULL;
 
 WalReceiverConn *wrconn = NULL;
@@ -103,12 +136,11 @@ Subscription *MySubscription = NULL;
 bool		MySubscriptionValid = false;
 
 bool		in_remote_transaction = false;
+bool		in_streamed_transaction = false;
 static XLogRecPtr remote_final_lsn = InvalidXLogRecPtr;
 
 static void send_feedback(XLogRecPtr recvpos, bool force, bool requestReply);
 
-static void store_flush_position(XLogRecPtr remote_lsn);
-
 static void maybe_reread_subscription(void);
 
 /* Flags set by signal handlers */
@@ -159,6 +191,10 @@ ensure_transaction(void)
 	SetCurrentStatementStartTimestamp();
 	StartTransactionCommand();
 
+	/* Let the transactions applied after ours wait for its commit. */
+	if (am_parallel_apply_worker())
+		pa_lock_transaction();
+
 	maybe_reread_subscription();
 
 	MemoryContextSwitchTo(ApplyMessageContext);
@@ -449,19 +485,12 @@ apply_handle_begin(StringInfo s)
 }
 
 /*
- * Handle COMMIT message.
- *
- * TODO, support tracking of multiple origins
+ * Commit the local transaction applying a remote one, which ended at end_lsn
+ * on the publisher.
  */
 static void
-apply_handle_commit(StringInfo s)
+apply_commit_internal(XLogRecPtr end_lsn, TimestampTz committime)
 {
-	LogicalRepCommitData commit_data;
-
-	logicalrep_read_commit(s, &commit_data);
-
-	Assert(commit_data.commit_lsn == remote_final_lsn);
-
 	/* The synchronization worker runs in single transaction. */
 	if (IsTransactionState() && !am_tablesync_worker())
 	{
@@ -469,13 +498,13 @@ apply_handle_commit(StringInfo s)
 		 * Update origin state so we can restart streaming from correct
 		 * position in case of crash.
 		 */
-		replorigin_session_origin_lsn = commit_data.end_lsn;
-		replorigin_session_origin_timestamp = commit_data.committime;
+		replorigin_session_origin_lsn = end_lsn;
+		replorigin_session_origin_timestamp = committime;
 
 		CommitTransactionCommand();
 		pgstat_report_stat(false);
 
-		store_flush_position(commit_data.end_lsn);
+		store_flush_position(end_lsn, XactLastCommitEnd);
 	}
 	else
 	{
@@ -487,11 +516,40 @@ apply_handle_commit(StringInfo s)
 	in_remote_transaction = false;
 
 	/* Process any tables that are being synchronized in parallel. */
-	process_syncing_tables(commit_data.end_lsn);
+	process_syncing_tables(end_lsn);
 
 	pgstat_report_activity(STATE_IDLE, NULL);
 }
 
+/*
+ * Handle COMMIT message.
+ *
+ * TODO, support tracking of multiple origins
+ */
+static void
+apply_handle_commit(StringInfo s)
+{
+	LogicalRepCommitData commit_data;
+
+	logicalrep_read_commit(s, &commit_data);
+
+	Assert(commit_data.commit_lsn == remote_final_lsn);
+
+	/*
+	 * A parallel apply worker commits in the publisher's order, and leaves
+	 * tracking of flush positions and table synchronization to the leader.
+	 */
+	if (am_parallel_apply_worker())
+	{
+		pa_commit_transaction(commit_data.end_lsn, commit_data.committime);
+		in_remote_transaction = false;
+		pgstat_report_activity(STATE_IDLE, NULL);
+		return;
+	}
+
+	apply_commit_internal(commit_data.end_lsn, commit_data.committime);
+}
+
 /*
  * Handle ORIGIN message.
  *
@@ -940,15 +998,297 @@ apply_handle_truncate(StringInfo s)
 	CommandCounterIncrement();
 }
 
+/*
+ * Handle STREAM START message.
+ *
+ * The transaction's spool file is created when we first hear about it, and
+ * every later chunk continues where the previous one stopped.
+ */
+static void
+apply_handle_stream_start(StringInfo s)
+{
+	TransactionId xid;
+	bool		found;
+
+	if (in_streamed_transaction)
+		ereport(ERROR,
+				(errcode(ERRCODE_PROTOCOL_VIOLATION),
+				 errmsg("STREAM START message sent out of order")));
+
+	xid = logicalrep_read_stream_start(s);
+
+	if (stream_xids == NULL)
+	{
+		HASHCTL		ctl;
+
+		MemSet(&ctl, 0, sizeof(ctl));
+		ctl.keysize = sizeof(TransactionId);
+		ctl.entrysize = sizeof(StreamXidEntry);
+		ctl.hcxt = ApplyContext;
+		stream_xids = hash_create("logical replication streamed transactions",
+								  16, &ctl,
+								  HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+	}
+
+	stream_xid = hash_search(stream_xids, &xid, HASH_ENTER, &found);
+	if (!found)
+	{
+		MemoryContext oldctx = MemoryContextSwitchTo(ApplyContext);
+
+		stream_xid->file = BufFileCreateTemp(true);
+		stream_xid->end_fileno = 0;
+		stream_xid->end_offset = 0;
+		stream_xid->maxsubxacts = 16;
+		stream_xid->nsubxacts = 0;
+		stream_xid->subxacts = palloc(stream_xid->maxsubxacts *
+									  sizeof(StreamSubXact));
+		MemoryContextSwitchTo(oldctx);
+	}
+	else if (BufFileSeek(stream_xid->file, stream_xid->end_fileno,
+						 stream_xid->end_offset, SEEK_SET) != 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not seek in streamed transaction spool file: %m")));
+
+	in_streamed_transaction = true;
+}
+
+/*
+ * Handle STREAM STOP message.
+ */
+static void
+apply_handle_stream_stop(StringInfo s)
+{
+	if (!in_streamed_transaction)
+		ereport(ERROR,
+				(errcode(ERRCODE_PROTOCOL_VIOLATION),
+				 errmsg("STREAM STOP message sent out of order")));
+
+	BufFileTell(stream_xid->file, &stream_xid->end_fileno,
+				&stream_xid->end_offset);
+
+	stream_xid = NULL;
+	in_streamed_transaction = false;
+}
 
 /*
- * Logical replication protocol message dispatcher.
+ * Spool a change of the transaction being streamed, instead of applying it.
+ *
+ * Returns false for messages that must be handled right away; relation and
+ * type messages only update our caches, so they don't need to wait for the
+ * commit.
+ */
+static bool
+apply_spool_change(char action, StringInfo s)
+{
+	TransactionId subxid;
+	int			len;
+
+	Assert(in_streamed_transaction);
+
+	if (action != 'I' && action != 'U' && action != 'D' && action != 'T')
+		return false;
+
+	/* Remember where the changes of a new subtransaction begin. */
+	subxid = pq_getmsgint(s, 4);
+	if (subxid != stream_xid->xid &&
+		(stream_xid->nsubxacts == 0 ||
+		 stream_xid->subxacts[stream_xid->nsubxacts - 1].xid != subxid))
+	{
+		int			i;
+
+		for (i = 0; i < stream_xid->nsubxacts; i++)
+		{
+			if (stream_xid->subxacts[i].xid == subxid)
+				break;
+		}
+
+		if (i == stream_xid->nsubxacts)
+		{
+			StreamSubXact *subxact;
+
+			if (stream_xid->nsubxacts == stream_xid->maxsubxacts)
+			{
+				stream_xid->maxsubxacts *= 2;
+				stream_xid->subxacts =
+					repalloc(stream_xid->subxacts,
+							 stream_xid->maxsubxacts * sizeof(StreamSubXact));
+			}
+
+			subxact = &stream_xid->subxacts[stream_xid->nsubxacts++];
+			subxact->xid = subxid;
+			BufFileTell(stream_xid->file, &subxact->fileno, &subxact->offset);
+		}
+	}
+
+	/* The spooled message is the action and what follows the xid. */
+	len = s->len - s->cursor + 1;
+	if (BufFileWrite(stream_xid->file, &len, sizeof(len)) != sizeof(len) ||
+		BufFileWrite(stream_xid->file, &action, 1) != 1 ||
+		BufFileWrite(stream_xid->file, s->data + s->cursor,
+					 len - 1) != len - 1)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not write to streamed transaction spool file: %m")));
+
+	return true;
+}
+
+/*
+ * Forget about a streamed transaction and remove its spool file.
+ */
+static void
+stream_cleanup(StreamXidEntry *entry)
+{
+	TransactionId xid = entry->xid;
+
+	BufFileClose(entry->file);
+	pfree(entry->subxacts);
+	hash_search(stream_xids, &xid, HASH_REMOVE, NULL);
+}
+
+/*
+ * Handle STREAM ABORT message.
+ *
+ * For a subtransaction, everything spooled since its first change is thrown
+ * away; whatever came after belongs to its own subtransactions, which are
+ * aborted along with it.
+ */
+static void
+apply_handle_stream_abort(StringInfo s)
+{
+	TransactionId xid;
+	TransactionId subxid;
+	StreamXidEntry *entry;
+	int			i;
+
+	if (in_streamed_transaction)
+		ereport(ERROR,
+				(errcode(ERRCODE_PROTOCOL_VIOLATION),
+				 errmsg("STREAM ABORT message sent out of order")));
+
+	logicalrep_read_stream_abort(s, &xid, &subxid);
+
+	/* Nothing to do if none of its changes made it here. */
+	entry = stream_xids ? hash_search(stream_xids, &xid, HASH_FIND, NULL) :
+		NULL;
+	if (entry == NULL)
+		return;
+
+	if (subxid == xid)
+	{
+		stream_cleanup(entry);
+		return;
+	}
+
+	for (i = 0; i < entry->nsubxacts; i++)
+	{
+		if (entry->subxacts[i].xid == subxid)
+		{
+			entry->end_fileno = entry->subxacts[i].fileno;
+			entry->end_offset = entry->subxacts[i].offset;
+			entry->nsubxacts = i;
+			break;
+		}
+	}
+}
+
+/*
+ * Handle STREAM COMMIT message, by applying the spooled changes in a single
+ * local transaction.
  */
 static void
+apply_handle_stream_commit(StringInfo s)
+{
+	LogicalRepStreamCommitData commit_data;
+	StreamXidEntry *entry;
+	StringInfoData buf;
+	MemoryContext oldctx;
+	int			nchanges = 0;
+
+	if (in_streamed_transaction)
+		ereport(ERROR,
+				(errcode(ERRCODE_PROTOCOL_VIOLATION),
+				 errmsg("STREAM COMMIT message sent out of order")));
+
+	logicalrep_read_stream_commit(s, &commit_data);
+
+	entry = stream_xids ?
+		hash_search(stream_xids, &commit_data.xid, HASH_FIND, NULL) : NULL;
+	if (entry == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_PROTOCOL_VIOLATION),
+				 errmsg("STREAM COMMIT for unknown transaction %u",
+						commit_data.xid)));
+
+	remote_final_lsn = commit_data.commit_lsn;
+	in_remote_transaction = true;
+	pgstat_report_activity(STATE_RUNNING, NULL);
+
+	if (BufFileSeek(entry->file, 0, 0, SEEK_SET) != 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not seek in streamed transaction spool file: %m")));
+
+	/*
+	 * The buffer has to survive the reset of ApplyMessageContext after each
+	 * change.
+	 */
+	oldctx = MemoryContextSwitchTo(ApplyContext);
+	initStringInfo(&buf);
+	MemoryContextSwitchTo(oldctx);
+	for (;;)
+	{
+		int			fileno;
+		off_t		offset;
+		int			len;
+
+		BufFileTell(entry->file, &fileno, &offset);
+		if (fileno == entry->end_fileno && offset == entry->end_offset)
+			break;
+
+		if (BufFileRead(entry->file, &len, sizeof(len)) != sizeof(len))
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not read from streamed transaction spool file: %m")));
+
+		resetStringInfo(&buf);
+		enlargeStringInfo(&buf, len);
+		if (BufFileRead(entry->file, buf.data, len) != len)
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not read from streamed transaction spool file: %m")));
+		buf.len = len;
+		buf.data[len] = '\0';
+
+		MemoryContextSwitchTo(ApplyMessageContext);
+		apply_dispatch(&buf);
+		MemoryContextReset(ApplyMessageContext);
+
+		nchanges++;
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	elog(DEBUG1, "replayed %d changes of streamed transaction %u",
+		 nchanges, commit_data.xid);
+
+	pfree(buf.data);
+	stream_cleanup(entry);
+
+	apply_commit_internal(commit_data.end_lsn, commit_data.committime);
+}
+
+/*
+ * Logical replication protocol message dispatcher.
+ */
+void
 apply_dispatch(StringInfo s)
 {
 	char		action = pq_getmsgbyte(s);
 
+	if (in_streamed_transaction && apply_spool_change(action, s))
+		return;
+
 	switch (action)
 	{
 			/* BEGIN */
@@ -987,6 +1327,22 @@ apply_dispatch(StringInfo s)
 		case 'O':
 			apply_handle_origin(s);
 			break;
+			/* STREAM START */
+		case 'S':
+			apply_handle_stream_start(s);
+			break;
+			/* STREAM STOP */
+		case 'E':
+			apply_handle_stream_stop(s);
+			break;
+			/* STREAM ABORT */
+		case 'A':
+			apply_handle_stream_abort(s);
+			break;
+			/* STREAM COMMIT */
+		case 'c':
+			apply_handle_stream_commit(s);
+			break;
 		default:
 			ereport(ERROR,
 					(errcode(ERRCODE_PROTOCOL_VIOLATION),
@@ -1049,10 +1405,10 @@ get_flush_position(XLogRecPtr *write, XLogRecPtr *flush,
 }
 
 /*
- * Store current remote/local lsn pair in the tracking list.
+ * Store a remote/local lsn pair in the tracking list.
  */
-static void
-store_flush_position(XLogRecPtr remote_lsn)
+void
+store_flush_position(XLogRecPtr remote_lsn, XLogRecPtr local_lsn)
 {
 	FlushPosition *flushpos;
 
@@ -1061,7 +1417,7 @@ store_flush_position(XLogRecPtr remote_lsn)
 
 	/* Track commit lsn  */
 	flushpos = (FlushPosition *) palloc(sizeof(FlushPosition));
-	flushpos->local_end = XactLastCommitEnd;
+	flushpos->local_end = local_lsn;
 	flushpos->remote_end = remote_lsn;
 
 	dlist_push_tail(&lsn_mapping, &flushpos->node);
@@ -1097,6 +1453,11 @@ LogicalRepApplyLoop(XLogRecPtr last_received)
 												"ApplyMessageContext",
 												ALLOCSET_DEFAULT_SIZES);
 
+	/* Start the parallel apply workers, if any are wanted. */
+	if (!am_tablesync_worker() &&
+		max_parallel_apply_workers_per_subscription > 0)
+		pa_launch_workers();
+
 	/* mark as idle, before starting to loop */
 	pgstat_report_activity(STATE_IDLE, NULL);
 
@@ -1172,7 +1533,10 @@ LogicalRepApplyLoop(XLogRecPtr last_received)
 
 						UpdateWorkerStats(last_received, send_time, false);
 
-						apply_dispatch(&s);
+						if (pa_enabled())
+							pa_dispatch(&s);
+						else
+							apply_dispatch(&s);
 					}
 					else if (c == 'k')
 					{
@@ -1199,6 +1563,10 @@ LogicalRepApplyLoop(XLogRecPtr last_received)
 			}
 		}
 
+		/* Collect the transactions the parallel apply workers committed. */
+		if (pa_enabled())
+			pa_process_completions();
+
 		/* confirm all writes so far */
 		send_feedback(last_received, false, false);
 
@@ -1232,11 +1600,13 @@ LogicalRepApplyLoop(XLogRecPtr last_received)
 		/*
 		 * Wait for more data or latch.  If we have unflushed transactions,
 		 * wake up after WalWriterDelay to see if they've been flushed yet (in
-		 * which case we should send a feedback message).  Otherwise, there's
+		 * which case we should send a feedback message).  The same goes for
+		 * transactions still being applied by parallel apply workers, though
+		 * those will usually wake us up when they commit.  Otherwise, there's
 		 * no particular urgency about waking up unless we get data or a
 		 * signal.
 		 */
-		if (!dlist_is_empty(&lsn_mapping))
+		if (!dlist_is_empty(&lsn_mapping) || pa_has_pending())
 			wait_time = WalWriterDelay;
 		else
 			wait_time = NAPTIME_PER_CYCLE;
@@ -1345,9 +1715,11 @@ send_feedback(XLogRecPtr recvpos, bool force, bool requestReply)
 
 	/*
 	 * No outstanding transactions to flush, we can report the latest received
-	 * position. This is important for synchronous replication.
+	 * position. This is important for synchronous replication.  Transactions
+	 * handed to parallel apply workers and not committed yet are outstanding
+	 * too, even though they are not in the tracking list.
 	 */
-	if (!have_pending_txes)
+	if (!have_pending_txes && !pa_has_pending())
 		flushpos = writepos = recvpos;
 
 	if (writepos < last_writepos)
@@ -1723,9 +2095,19 @@ ApplyWorkerMain(Datum main_arg)
 	options.logical = true;
 	options.startpoint = origin_startpos;
 	options.slotname = myslotname;
-	options.proto.logical.proto_version = LOGICALREP_PROTO_VERSION_NUM;
 	options.proto.logical.publication_names = MySubscription->publications;
 
+	/*
+	 * Table synchronization workers only apply the changes needed to catch up
+	 * with the main apply worker, so don't bother streaming for them.  Ask for
+	 * the streaming protocol version only when we need it, so that publishers
+	 * not knowing about it keep working.
+	 */
+	options.proto.logical.streaming =
+		(MySubscription->stream && !am_tablesync_worker());
+	options.proto.logical.proto_version = options.proto.logical.streaming ?
+		LOGICALREP_PROTO_STREAM_VERSION_NUM : LOGICALREP_PROTO_MIN_VERSION_NUM;
+
 	/* Start normal logical streaming replication. */
 	walrcv_startstreaming(wrconn, &options);
 
@@ -75,6 +75,7 @@
 int			wal_receiver_status_interval;
 int			wal_receiver_timeout;
 bool		hot_standby_feedback;
+bool		wal_receiver_immediate_feedback;
 
 /* libpqwalreceiver connection */
 static WalReceiverConn *wrconn = NULL;
@@ -431,6 +432,16 @@ WalReceiverMain(void)
 							last_recv_timestamp = GetCurrentTimestamp();
 							ping_sent = false;
 							XLogWalRcvProcessMsg(buf[0], &buf[1], len - 1);
+
+							/*
+							 * In immediate feedback mode, don't wait for the
+							 * socket to be drained: a busy primary might
+							 * never let that happen, holding back the flush
+							 * and the reply that synchronous commits on the
+							 * primary are waiting for.
+							 */
+							if (wal_receiver_immediate_feedback)
+								XLogWalRcvFlush(false);
 						}
 						else if (len == 0)
 							break;
@@ -1033,10 +1044,13 @@ XLogWalRcvFlush(bool dying)
 			set_ps_display(activitymsg, false);
 		}
 
-		/* Also let the master know that we made some progress */
+		/*
+		 * Also let the master know that we made some progress.  In immediate
+		 * feedback mode, do so even if wal_receiver_status_interval is zero.
+		 */
 		if (!dying)
 		{
-			XLogWalRcvSendReply(false, false);
+			XLogWalRcvSendReply(wal_receiver_immediate_feedback, false);
 			XLogWalRcvSendHSFeedback(false);
 		}
 	}
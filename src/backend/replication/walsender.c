@@ -2181,6 +2181,9 @@ WalSndLoop(WalSndSendDataCallback send_data)
 		/* Check for input from the client */
 		ProcessRepliesIfAny();
 
+		/* Send off I/O statistics to the stats collector */
+		pgstat_send_io(false);
+
 		/*
 		 * If we have received CopyDone from the client, sent CopyDone
 		 * ourselves, and the output buffer is empty, it's time to exit
@@ -2380,6 +2383,7 @@ retry:
 		uint32		startoff;
 		int			segbytes;
 		int			readbytes;
+		instr_time	io_start;
 
 		startoff = XLogSegmentOffset(recptr, wal_segment_size);
 
@@ -2471,9 +2475,13 @@ retry:
 		else
 			segbytes = nbytes;
 
+		io_start = pgstat_io_start();
 		pgstat_report_wait_start(WAIT_EVENT_WAL_READ);
 		readbytes = read(sendFile, p, segbytes);
 		pgstat_report_wait_end();
+		if (readbytes > 0)
+			pgstat_count_io(IOOBJECT_WAL, IOCONTEXT_NORMAL, IOOP_READ, 1,
+							io_start);
 		if (readbytes < 0)
 		{
 			ereport(ERROR,
@@ -22,10 +22,12 @@
 #include "access/tuptoaster.h"
 #include "catalog/indexing.h"
 #include "catalog/pg_collation.h"
+#include "catalog/pg_statistic.h"
 #include "catalog/pg_statistic_ext.h"
 #include "nodes/nodeFuncs.h"
 #include "optimizer/clauses.h"
 #include "optimizer/optimizer.h"
+#include "optimizer/pathnode.h"
 #include "postmaster/autovacuum.h"
 #include "statistics/extended_stats_internal.h"
 #include "statistics/statistics.h"
@@ -1131,3 +1133,233 @@ statext_clauselist_selectivity(PlannerInfo *root, List *clauses, int varRelid,
 
 	return sel;
 }
+
+/*
+ * statext_is_compatible_join_clause
+ *		Determines if the clause is an equality of plain columns of two
+ *		different relations, which ndistinct statistics can be used for.
+ *
+ * On success, the columns are returned in *var1 and *var2, ordered by their
+ * range table index.
+ */
+static bool
+statext_is_compatible_join_clause(RestrictInfo *rinfo, Var **var1, Var **var2)
+{
+	OpExpr	   *expr;
+	Node	   *left;
+	Node	   *right;
+	Var		   *lvar;
+	Var		   *rvar;
+
+	/* only btree equality, so that "distinct" means what ANALYZE took */
+	if (rinfo->pseudoconstant || rinfo->mergeopfamilies == NIL)
+		return false;
+
+	if (bms_membership(rinfo->left_relids) != BMS_SINGLETON ||
+		bms_membership(rinfo->right_relids) != BMS_SINGLETON ||
+		bms_overlap(rinfo->left_relids, rinfo->right_relids))
+		return false;
+
+	/* a mergejoinable clause is always a binary OpExpr */
+	expr = (OpExpr *) rinfo->clause;
+	Assert(is_opclause(expr) && list_length(expr->args) == 2);
+
+	/* Look inside any binary-compatible relabeling (as in examine_variable) */
+	left = (Node *) linitial(expr->args);
+	if (IsA(left, RelabelType))
+		left = (Node *) ((RelabelType *) left)->arg;
+	right = (Node *) lsecond(expr->args);
+	if (IsA(right, RelabelType))
+		right = (Node *) ((RelabelType *) right)->arg;
+
+	if (!IsA(left, Var) || !IsA(right, Var))
+		return false;
+
+	lvar = (Var *) left;
+	rvar = (Var *) right;
+
+	/* we also better ensure the Vars are from the current level */
+	if (lvar->varlevelsup != 0 || rvar->varlevelsup != 0)
+		return false;
+
+	/* no support for system attributes or whole-row references */
+	if (!AttrNumberIsForUserDefinedAttr(lvar->varattno) ||
+		!AttrNumberIsForUserDefinedAttr(rvar->varattno))
+		return false;
+
+	if (lvar->varno < rvar->varno)
+	{
+		*var1 = lvar;
+		*var2 = rvar;
+	}
+	else
+	{
+		*var1 = rvar;
+		*var2 = lvar;
+	}
+
+	return true;
+}
+
+/*
+ * join_vars_nonnull_frac
+ *		Estimate the fraction of rows that have none of the given columns
+ *		NULL, taking the columns to be independent.
+ */
+static double
+join_vars_nonnull_frac(PlannerInfo *root, List *vars)
+{
+	double		frac = 1.0;
+	ListCell   *lc;
+
+	foreach(lc, vars)
+	{
+		VariableStatData vardata;
+
+		examine_variable(root, (Node *) lfirst(lc), 0, &vardata);
+		if (HeapTupleIsValid(vardata.statsTuple))
+		{
+			Form_pg_statistic stats;
+
+			stats = (Form_pg_statistic) GETSTRUCT(vardata.statsTuple);
+			frac *= 1.0 - stats->stanullfrac;
+		}
+		ReleaseVariableStats(vardata);
+	}
+
+	return frac;
+}
+
+/*
+ * statext_join_clauselist_selectivity
+ *		Estimate equality join clauses between two relations using the
+ *		ndistinct statistics of either of them.
+ *
+ * Estimating each of the clauses "t1.a = t2.a AND t1.b = t2.b" on its own
+ * and multiplying the results assumes that (a,b) has as many distinct values
+ * as a and b have between them, which strongly correlated columns are far
+ * from.  If either relation has ndistinct statistics on the join columns, we
+ * estimate the clauses together as a single equality on the combination of
+ * the columns instead, using the number of distinct combinations on each
+ * side as estimate_num_groups() gets it.
+ *
+ * Only the equality clauses between the first pair of relations found are
+ * estimated, and only if there are at least two of them.  Clauses that we
+ * estimate are marked in *estimatedclauses.
+ */
+Selectivity
+statext_join_clauselist_selectivity(PlannerInfo *root, List *clauses,
+									JoinType jointype, SpecialJoinInfo *sjinfo,
+									Bitmapset **estimatedclauses)
+{
+	Index		relid1 = 0;
+	Index		relid2 = 0;
+	List	   *vars1 = NIL;
+	List	   *vars2 = NIL;
+	Bitmapset  *attnums1 = NULL;
+	Bitmapset  *attnums2 = NULL;
+	Bitmapset  *matched = NULL;
+	RelOptInfo *rel1;
+	RelOptInfo *rel2;
+	double		nd1;
+	double		nd2;
+	Selectivity sel;
+	ListCell   *l;
+	int			listidx;
+
+	/* need at least two clauses to make any difference */
+	if (list_length(clauses) < 2)
+		return 1.0;
+
+	listidx = -1;
+	foreach(l, clauses)
+	{
+		Node	   *clause = (Node *) lfirst(l);
+		Var		   *var1;
+		Var		   *var2;
+
+		listidx++;
+
+		if (bms_is_member(listidx, *estimatedclauses))
+			continue;
+
+		if (!IsA(clause, RestrictInfo) ||
+			!statext_is_compatible_join_clause((RestrictInfo *) clause,
+											   &var1, &var2))
+			continue;
+
+		if (relid1 == 0)
+		{
+			relid1 = var1->varno;
+			relid2 = var2->varno;
+		}
+		else if (var1->varno != relid1 || var2->varno != relid2)
+			continue;
+
+		/* a column joined to two others is left to the usual estimate */
+		if (bms_is_member(var1->varattno, attnums1) ||
+			bms_is_member(var2->varattno, attnums2))
+			continue;
+
+		attnums1 = bms_add_member(attnums1, var1->varattno);
+		attnums2 = bms_add_member(attnums2, var2->varattno);
+		vars1 = lappend(vars1, var1);
+		vars2 = lappend(vars2, var2);
+		matched = bms_add_member(matched, listidx);
+	}
+
+	if (bms_num_members(matched) < 2)
+		return 1.0;
+
+	rel1 = find_base_rel(root, relid1);
+	rel2 = find_base_rel(root, relid2);
+
+	/* without ndistinct statistics we would only repeat the usual estimate */
+	if (!choose_best_statistics(rel1->statlist, attnums1,
+								STATS_EXT_NDISTINCT) &&
+		!choose_best_statistics(rel2->statlist, attnums2,
+								STATS_EXT_NDISTINCT))
+		return 1.0;
+
+	/* for a semijoin, rel1 must be the outer side */
+	if (sjinfo && bms_is_member(relid1, sjinfo->syn_righthand))
+	{
+		RelOptInfo *tmprel = rel1;
+		List	   *tmpvars = vars1;
+
+		rel1 = rel2;
+		rel2 = tmprel;
+		vars1 = vars2;
+		vars2 = tmpvars;
+	}
+
+	nd1 = estimate_num_groups(root, vars1, rel1->rows, NULL);
+	nd2 = estimate_num_groups(root, vars2, rel2->rows, NULL);
+
+	switch (jointype)
+	{
+		case JOIN_SEMI:
+		case JOIN_ANTI:
+
+			/*
+			 * The fraction of outer rows that have a match, assuming that the
+			 * side with fewer distinct combinations has all of its values on
+			 * the other side, as eqjoinsel_semi() does.
+			 */
+			sel = join_vars_nonnull_frac(root, vars1);
+			if (nd1 > nd2)
+				sel *= nd2 / nd1;
+			break;
+		default:
+			/* the same assumption as eqjoinsel_inner() without MCVs */
+			sel = join_vars_nonnull_frac(root, vars1) *
+				join_vars_nonnull_frac(root, vars2) / Max(nd1, nd2);
+			break;
+	}
+
+	CLAMP_PROBABILITY(sel);
+
+	*estimatedclauses = bms_add_members(*estimatedclauses, matched);
+
+	return sel;
+}
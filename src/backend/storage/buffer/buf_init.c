@@ -78,9 +78,12 @@ InitBufferPool(void)
 						NBuffers * sizeof(BufferDescPadded),
 						&foundDescs);
 
+	/* Align data pages for direct I/O */
 	BufferBlocks = (char *)
-		ShmemInitStruct("Buffer Blocks",
-						NBuffers * (Size) BLCKSZ, &foundBufs);
+		TYPEALIGN(PG_IO_ALIGN_SIZE,
+				  ShmemInitStruct("Buffer Blocks",
+								  NBuffers * (Size) BLCKSZ + PG_IO_ALIGN_SIZE,
+								  &foundBufs));
 
 	/* Align lwlocks to cacheline boundary */
 	BufferIOLWLockArray = (LWLockMinimallyPadded *)
@@ -112,6 +115,9 @@ InitBufferPool(void)
 	{
 		int			i;
 
+		/* Choose the NUMA placement before the memory is first touched */
+		StrategyBindBufferMemory();
+
 		/*
 		 * Initialize all the buffer headers.
 		 */
@@ -134,6 +140,7 @@ InitBufferPool(void)
 
 			LWLockInitialize(BufferDescriptorGetContentLock(buf),
 							 LWTRANCHE_BUFFER_CONTENT);
+			pg_atomic_init_u32(&buf->change_count, 0);
 
 			LWLockInitialize(BufferDescriptorGetIOLock(buf),
 							 LWTRANCHE_BUFFER_IO_IN_PROGRESS);
@@ -169,6 +176,8 @@ BufferShmemSize(void)
 
 	/* size of data pages */
 	size = add_size(size, mul_size(NBuffers, BLCKSZ));
+	/* to allow aligning data pages */
+	size = add_size(size, PG_IO_ALIGN_SIZE);
 
 	/* size of stuff controlled by freelist.c */
 	size = add_size(size, StrategyShmemSize());
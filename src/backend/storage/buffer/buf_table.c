@@ -106,6 +106,35 @@ BufTableLookup(BufferTag *tagPtr, uint32 hashcode)
 	return result->id;
 }
 
+/*
+ * BufTableLookupUnlocked
+ *		Like BufTableLookup, but without any lock
+ *
+ * The result is only a guess, which the caller must verify by pinning the
+ * buffer and checking its tag.  -1 means either that the tag is not in the
+ * table or that we couldn't tell; the caller must then use BufTableLookup.
+ */
+int
+BufTableLookupUnlocked(BufferTag *tagPtr, uint32 hashcode)
+{
+	BufferLookupEnt *result;
+	int			buf_id;
+
+	/* Chains are short; a longer walk means they are being changed. */
+	result = (BufferLookupEnt *)
+		hash_search_unlocked(SharedBufHash, (void *) tagPtr, hashcode, 32);
+
+	if (!result)
+		return -1;
+
+	/* a reused entry can hold anything, so don't trust the ID blindly */
+	buf_id = ((volatile BufferLookupEnt *) result)->id;
+	if (buf_id < 0 || buf_id >= NBuffers)
+		return -1;
+
+	return buf_id;
+}
+
 /*
  * BufTableInsert
  *		Insert a hashtable entry for given tag and buffer ID,
@@ -31,9 +31,13 @@
 #include "postgres.h"
 
 #include <sys/file.h>
+#ifndef WIN32
+#include <sys/mman.h>
+#endif
 #include <unistd.h>
 
 #include "access/tableam.h"
+#include "access/undolog.h"
 #include "access/xlog.h"
 #include "catalog/catalog.h"
 #include "catalog/storage.h"
@@ -42,13 +46,16 @@
 #include "miscadmin.h"
 #include "pg_trace.h"
 #include "pgstat.h"
+#include "port/pg_iovec.h"
 #include "postmaster/bgwriter.h"
 #include "storage/buf_internals.h"
 #include "storage/bufmgr.h"
 #include "storage/ipc.h"
+#include "storage/md.h"
 #include "storage/proc.h"
 #include "storage/smgr.h"
 #include "storage/standby.h"
+#include "utils/memutils.h"
 #include "utils/rel.h"
 #include "utils/resowner_private.h"
 #include "utils/timestamp.h"
@@ -129,9 +136,39 @@ int			backend_flush_after = 0;
  */
 int			target_prefetch_pages = 0;
 
-/* local state for StartBufferIO and related functions */
-static BufferDesc *InProgressBuf = NULL;
-static bool IsForInput;
+/*
+ * local state for StartBufferIO and related functions
+ *
+ * A process normally has at most one buffer I/O in progress, but writes
+ * batched by SyncOneBuffer can have up to PGAIO_MAX_IN_FLIGHT.
+ */
+static BufferDesc *InProgressBufs[PGAIO_MAX_IN_FLIGHT];
+static bool InProgressIsForInput[PGAIO_MAX_IN_FLIGHT];
+static int	NumInProgressBufs = 0;
+
+/*
+ * A buffer write started by FlushBufferStart and not yet finished.
+ */
+typedef struct PendingBufferWrite
+{
+	BufferDesc *buf;
+	SMgrRelation reln;
+	char	   *copy;			/* copy of the page being written, or NULL */
+	PgAioHandle *io;			/* in-flight write, or NULL if done */
+	instr_time	io_start;
+	ErrorContextCallback errcallback;
+} PendingBufferWrite;
+
+/*
+ * Writes started by SyncOneBuffer for BufferSync and BgBufferSync, when
+ * io_method allows several to be in flight, or gathered by SyncBufferRun
+ * for one vectored write.  The buffers stay pinned and their io_in_progress
+ * locks held until FinishBufferWrites; their content locks are released as
+ * soon as the page has been copied to PendingWriteCopies.
+ */
+static PendingBufferWrite PendingWrites[PGAIO_MAX_IN_FLIGHT];
+static int	NumPendingWrites = 0;
+static PGAlignedBlock *PendingWriteCopies = NULL;
 
 /* local state for LockBufferForCleanup */
 static BufferDesc *PinCountWaitBuf = NULL;
@@ -429,6 +466,17 @@ ForgetPrivateRefCountEntry(PrivateRefCountEntry *ref)
 	(GetPrivateRefCount(bufnum) > 0) \
 )
 
+/*
+ * BufferContentLockedExclusive
+ *		Advance the change count after locking a shared buffer exclusively,
+ *		so that optimistic readers notice that the contents may change.
+ */
+static inline void
+BufferContentLockedExclusive(BufferDesc *buf)
+{
+	pg_atomic_fetch_add_u32(&buf->change_count, 1);
+}
+
 
 static Buffer ReadBuffer_common(SMgrRelation reln, char relpersistence,
 								ForkNumber forkNum, BlockNumber blockNum,
@@ -439,7 +487,13 @@ static void PinBuffer_Locked(BufferDesc *buf);
 static void UnpinBuffer(BufferDesc *buf, bool fixOwner);
 static void BufferSync(int flags);
 static uint32 WaitBufHdrUnlocked(BufferDesc *buf);
-static int	SyncOneBuffer(int buf_id, bool skip_recently_used, WritebackContext *flush_context);
+static bool EvictDrainedBuffer(int buf_id, WritebackContext *wb_context);
+static int	SyncOneBuffer(int buf_id, bool skip_recently_used,
+						  WritebackContext *flush_context, bool batch);
+static int	SyncBufferRun(int first, int maxitems,
+						  WritebackContext *wb_context, int *nwritten);
+static void FinishBufferWrites(WritebackContext *wb_context);
+static void AllocPendingWriteCopies(void);
 static void WaitIO(BufferDesc *buf);
 static bool StartBufferIO(BufferDesc *buf, bool forInput);
 static void TerminateBufferIO(BufferDesc *buf, bool clear_dirty,
@@ -453,6 +507,10 @@ static BufferDesc *BufferAlloc(SMgrRelation smgr,
 							   BufferAccessStrategy strategy,
 							   bool *foundPtr);
 static void FlushBuffer(BufferDesc *buf, SMgrRelation reln);
+static bool FlushBufferStart(BufferDesc *buf, SMgrRelation reln,
+							 PendingBufferWrite *pending, char *copy,
+							 bool start_write);
+static void FlushBufferFinish(PendingBufferWrite *pending);
 static void AtProcExit_Buffers(int code, Datum arg);
 static void CheckForBufferLeaks(void);
 static int	rnode_comparator(const void *p1, const void *p2);
@@ -527,8 +585,11 @@ ComputeIoConcurrency(int io_concurrency, double *target)
  * buffer.  Instead it tries to ensure that a future ReadBuffer for the given
  * block will not be delayed by the I/O.  Prefetching is optional.
  * No-op if prefetching isn't compiled in.
+ *
+ * Returns true if a read was initiated, false if the block was found in
+ * shared buffers.
  */
-static void
+static bool
 PrefetchBufferGuts(RelFileNode rnode, SMgrRelation smgr, ForkNumber forkNum,
 				   BlockNumber blockNum)
 {
@@ -551,7 +612,10 @@ PrefetchBufferGuts(RelFileNode rnode, SMgrRelation smgr, ForkNumber forkNum,
 
 	/* If not in buffers, initiate prefetch */
 	if (buf_id < 0)
+	{
 		smgrprefetch(smgr, forkNum, blockNum);
+		return true;
+	}
 
 	/*
 	 * If the block *is* in buffers, we do nothing.  This is not really ideal:
@@ -564,6 +628,7 @@ PrefetchBufferGuts(RelFileNode rnode, SMgrRelation smgr, ForkNumber forkNum,
 	 * additional per-buffer state, and it's not clear that there's enough of
 	 * a problem to justify that.
 	 */
+	return false;
 }
 #endif							/* USE_PREFETCH */
 
@@ -592,16 +657,18 @@ PrefetchBuffer(Relation reln, ForkNumber forkNum, BlockNumber blockNum)
 		LocalPrefetchBuffer(reln->rd_smgr, forkNum, blockNum);
 	}
 	else
-		PrefetchBufferGuts(reln->rd_smgr->smgr_rnode.node, reln->rd_smgr,
-						   forkNum, blockNum);
+		(void) PrefetchBufferGuts(reln->rd_smgr->smgr_rnode.node,
+								  reln->rd_smgr, forkNum, blockNum);
 #endif							/* USE_PREFETCH */
 }
 
 /*
  * PrefetchBufferWithoutRelcache -- like PrefetchBuffer but doesn't need a
  *									relcache entry for the relation.
+ *
+ * Returns false if the block was found in shared buffers, true otherwise.
  */
-void
+bool
 PrefetchBufferWithoutRelcache(RelFileNode rnode, ForkNumber forkNum,
 							  BlockNumber blockNum, char relpersistence)
 {
@@ -614,12 +681,43 @@ PrefetchBufferWithoutRelcache(RelFileNode rnode, ForkNumber forkNum,
 	{
 		/* pass it off to localbuf.c */
 		LocalPrefetchBuffer(smgr, forkNum, blockNum);
+		return true;
 	}
 	else
-		PrefetchBufferGuts(rnode, smgr, forkNum, blockNum);
+		return PrefetchBufferGuts(rnode, smgr, forkNum, blockNum);
+#else
+	return true;
 #endif							/* USE_PREFETCH */
 }
 
+/*
+ * BufferBlockIsResident -- check whether a block of a non-temporary relation
+ *							is in shared buffers, without a relcache entry.
+ *
+ * The answer can be out of date as soon as it's returned.  It's of use to
+ * callers that read the block from its file instead, and know that nothing
+ * they care about changes in the block if it's read back in meanwhile.
+ */
+bool
+BufferBlockIsResident(RelFileNode rnode, ForkNumber forkNum,
+					  BlockNumber blockNum)
+{
+	BufferTag	tag;
+	uint32		hash;
+	LWLock	   *partitionLock;
+	int			buf_id;
+
+	INIT_BUFFERTAG(tag, rnode, forkNum, blockNum);
+	hash = BufTableHashCode(&tag);
+	partitionLock = BufMappingPartitionLock(hash);
+
+	LWLockAcquire(partitionLock, LW_SHARED);
+	buf_id = BufTableLookup(&tag, hash);
+	LWLockRelease(partitionLock);
+
+	return (buf_id >= 0);
+}
+
 
 /*
  * ReadBuffer -- a shorthand for ReadBufferExtended, for reading from main
@@ -742,12 +840,16 @@ ReadBuffer_common(SMgrRelation smgr, char relpersistence, ForkNumber forkNum,
 	bool		found;
 	bool		isExtend;
 	bool		isLocalBuf = SmgrIsTemp(smgr);
+	bool		isUndo = (smgr->smgr_rnode.node.dbNode == UndoLogDatabaseOid);
 
 	*hit = false;
 
 	/* Make sure we will have room to remember the buffer pin */
 	ResourceOwnerEnlargeBuffers(CurrentResourceOwner);
 
+	/* Count the I/O we do under the caller's buffer access strategy */
+	pgStatIOContext = StrategyIOContext(strategy);
+
 	isExtend = (blockNum == P_NEW);
 
 	TRACE_POSTGRESQL_BUFFER_READ_START(forkNum, blockNum,
@@ -765,12 +867,22 @@ ReadBuffer_common(SMgrRelation smgr, char relpersistence, ForkNumber forkNum,
 	{
 		bufHdr = LocalBufferAlloc(smgr, forkNum, blockNum, &found);
 		if (found)
-			pgBufferUsage.local_blks_hit++;
+		{
+			if (isUndo)
+				pgBufferUsage.undo_blks_hit++;
+			else
+				pgBufferUsage.local_blks_hit++;
+		}
 		else if (isExtend)
 			pgBufferUsage.local_blks_written++;
 		else if (mode == RBM_NORMAL || mode == RBM_NORMAL_NO_LOG ||
 				 mode == RBM_ZERO_ON_ERROR)
-			pgBufferUsage.local_blks_read++;
+		{
+			if (isUndo)
+				pgBufferUsage.undo_blks_read++;
+			else
+				pgBufferUsage.local_blks_read++;
+		}
 	}
 	else
 	{
@@ -781,12 +893,22 @@ ReadBuffer_common(SMgrRelation smgr, char relpersistence, ForkNumber forkNum,
 		bufHdr = BufferAlloc(smgr, relpersistence, forkNum, blockNum,
 							 strategy, &found);
 		if (found)
-			pgBufferUsage.shared_blks_hit++;
+		{
+			if (isUndo)
+				pgBufferUsage.undo_blks_hit++;
+			else
+				pgBufferUsage.shared_blks_hit++;
+		}
 		else if (isExtend)
 			pgBufferUsage.shared_blks_written++;
 		else if (mode == RBM_NORMAL || mode == RBM_NORMAL_NO_LOG ||
 				 mode == RBM_ZERO_ON_ERROR)
-			pgBufferUsage.shared_blks_read++;
+		{
+			if (isUndo)
+				pgBufferUsage.undo_blks_read++;
+			else
+				pgBufferUsage.shared_blks_read++;
+		}
 	}
 
 	/* At this point we do NOT hold any locks. */
@@ -818,12 +940,16 @@ ReadBuffer_common(SMgrRelation smgr, char relpersistence, ForkNumber forkNum,
 			if (!isLocalBuf)
 			{
 				if (mode == RBM_ZERO_AND_LOCK)
+				{
 					LWLockAcquire(BufferDescriptorGetContentLock(bufHdr),
 								  LW_EXCLUSIVE);
+					BufferContentLockedExclusive(bufHdr);
+				}
 				else if (mode == RBM_ZERO_AND_CLEANUP_LOCK)
 					LockBufferForCleanup(BufferDescriptorGetBuffer(bufHdr));
 			}
 
+			pgStatIOContext = IOCONTEXT_NORMAL;
 			return BufferDescriptorGetBuffer(bufHdr);
 		}
 
@@ -974,6 +1100,7 @@ ReadBuffer_common(SMgrRelation smgr, char relpersistence, ForkNumber forkNum,
 		!isLocalBuf)
 	{
 		LWLockAcquire(BufferDescriptorGetContentLock(bufHdr), LW_EXCLUSIVE);
+		BufferContentLockedExclusive(bufHdr);
 	}
 
 	if (isLocalBuf)
@@ -1002,6 +1129,7 @@ ReadBuffer_common(SMgrRelation smgr, char relpersistence, ForkNumber forkNum,
 									  isExtend,
 									  found);
 
+	pgStatIOContext = IOCONTEXT_NORMAL;
 	return BufferDescriptorGetBuffer(bufHdr);
 }
 
@@ -1049,23 +1177,52 @@ BufferAlloc(SMgrRelation smgr, char relpersistence, ForkNumber forkNum,
 	newHash = BufTableHashCode(&newTag);
 	newPartitionLock = BufMappingPartitionLock(newHash);
 
-	/* see if the block is in the buffer pool already */
-	LWLockAcquire(newPartitionLock, LW_SHARED);
-	buf_id = BufTableLookup(&newTag, newHash);
+	/*
+	 * See if the block is in the buffer pool already.  Try without the
+	 * mapping lock first: pin whatever buffer the lookup finds, and keep it
+	 * only if it turns out to hold our block.  Nobody can change the tag of
+	 * a buffer while we have it pinned, so a matching tag seen after pinning
+	 * stays valid, just as if we had pinned it under the mapping lock.
+	 */
+	buf = NULL;
+	buf_id = BufTableLookupUnlocked(&newTag, newHash);
 	if (buf_id >= 0)
 	{
-		/*
-		 * Found it.  Now, pin the buffer so no one can steal it from the
-		 * buffer pool, and check to see if the correct data has been loaded
-		 * into the buffer.
-		 */
 		buf = GetBufferDescriptor(buf_id);
 
 		valid = PinBuffer(buf, strategy);
 
+		if (!(pg_atomic_read_u32(&buf->state) & BM_TAG_VALID) ||
+			!BUFFERTAGS_EQUAL(buf->tag, newTag))
+		{
+			/* it was replaced meanwhile, or the lookup was fooled */
+			UnpinBuffer(buf, true);
+			buf = NULL;
+		}
+	}
+
+	if (buf == NULL)
+	{
+		LWLockAcquire(newPartitionLock, LW_SHARED);
+		buf_id = BufTableLookup(&newTag, newHash);
+		if (buf_id >= 0)
+		{
+			/*
+			 * Found it.  Now, pin the buffer so no one can steal it from the
+			 * buffer pool, and check to see if the correct data has been
+			 * loaded into the buffer.
+			 */
+			buf = GetBufferDescriptor(buf_id);
+
+			valid = PinBuffer(buf, strategy);
+		}
+
 		/* Can release the mapping lock as soon as we've pinned it */
 		LWLockRelease(newPartitionLock);
+	}
 
+	if (buf != NULL)
+	{
 		*foundPtr = true;
 
 		if (!valid)
@@ -1092,9 +1249,8 @@ BufferAlloc(SMgrRelation smgr, char relpersistence, ForkNumber forkNum,
 
 	/*
 	 * Didn't find it in the buffer pool.  We'll have to initialize a new
-	 * buffer.  Remember to unlock the mapping lock while doing the work.
+	 * buffer.
 	 */
-	LWLockRelease(newPartitionLock);
 
 	/* Loop here in case we have to try another victim buffer */
 	for (;;)
@@ -1109,7 +1265,8 @@ BufferAlloc(SMgrRelation smgr, char relpersistence, ForkNumber forkNum,
 		 * Select a victim buffer.  The buffer is returned with its header
 		 * spinlock still held!
 		 */
-		buf = StrategyGetBuffer(strategy, &buf_state);
+		buf = StrategyGetBuffer(strategy, &buf_state,
+								smgr->smgr_rnode.node.dbNode == UndoLogDatabaseOid);
 
 		Assert(BUF_STATE_GET_REFCOUNT(buf_state) == 0);
 
@@ -1586,7 +1743,10 @@ MarkBufferDirty(Buffer buffer)
 	if (!(old_buf_state & BM_DIRTY))
 	{
 		VacuumPageDirty++;
-		pgBufferUsage.shared_blks_dirtied++;
+		if (bufHdr->tag.rnode.dbNode == UndoLogDatabaseOid)
+			pgBufferUsage.undo_blks_dirtied++;
+		else
+			pgBufferUsage.shared_blks_dirtied++;
 		if (VacuumCostActive)
 			VacuumCostBalance += VacuumCostPageDirty;
 	}
@@ -1885,6 +2045,8 @@ BufferSync(int flags)
 	int			i;
 	int			mask = BM_DIRTY;
 	WritebackContext wb_context;
+	bool		batch = pgaio_batch_size() > 1;
+	bool		adaptive;
 
 	/* Make sure we can handle the pin inside SyncOneBuffer */
 	ResourceOwnerEnlargeBuffers(CurrentResourceOwner);
@@ -1934,6 +2096,7 @@ BufferSync(int flags)
 			item = &CkptBufferIds[num_to_scan++];
 			item->buf_id = buf_id;
 			item->tsId = bufHdr->tag.rnode.spcNode;
+			item->dbNode = bufHdr->tag.rnode.dbNode;
 			item->relNode = bufHdr->tag.rnode.relNode;
 			item->forkNum = bufHdr->tag.forkNum;
 			item->blockNum = bufHdr->tag.blockNum;
@@ -1947,6 +2110,13 @@ BufferSync(int flags)
 
 	WritebackContextInit(&wb_context, &checkpoint_flush_after);
 
+	/*
+	 * Adaptive pacing only makes sense for a spread checkpoint done by the
+	 * checkpointer, which is also the one to fsync files early.
+	 */
+	adaptive = CheckPointPacing == CHECKPOINT_PACING_ADAPTIVE &&
+		AmCheckpointerProcess() && !(flags & CHECKPOINT_IMMEDIATE);
+
 	TRACE_POSTGRESQL_BUFFER_SYNC_START(NBuffers, num_to_scan);
 
 	/*
@@ -2055,14 +2225,13 @@ BufferSync(int flags)
 		BufferDesc *bufHdr = NULL;
 		CkptTsStatus *ts_stat = (CkptTsStatus *)
 		DatumGetPointer(binaryheap_first(ts_heap));
+		int			nscanned = 1;
 
 		buf_id = CkptBufferIds[ts_stat->index].buf_id;
 		Assert(buf_id != -1);
 
 		bufHdr = GetBufferDescriptor(buf_id);
 
-		num_processed++;
-
 		/*
 		 * We don't need to acquire the lock here, because we're only looking
 		 * at a single bit. It's possible that someone else writes the buffer
@@ -2077,21 +2246,90 @@ BufferSync(int flags)
 		 */
 		if (pg_atomic_read_u32(&bufHdr->state) & BM_CHECKPOINT_NEEDED)
 		{
-			if (SyncOneBuffer(buf_id, false, &wb_context) & BUF_WRITTEN)
+			instr_time	write_start;
+			int			nwritten = 0;
+
+			if (adaptive)
+				INSTR_TIME_SET_CURRENT(write_start);
+
+			if (batch)
 			{
-				TRACE_POSTGRESQL_BUFFER_SYNC_WRITTEN(buf_id);
-				BgWriterStats.m_buf_written_checkpoints++;
-				num_written++;
+				if (SyncOneBuffer(buf_id, false, &wb_context, true) & BUF_WRITTEN)
+				{
+					TRACE_POSTGRESQL_BUFFER_SYNC_WRITTEN(buf_id);
+					BgWriterStats.m_buf_written_checkpoints++;
+					num_written++;
+					nwritten = 1;
+				}
+			}
+			else
+			{
+				/*
+				 * Without asynchronous I/O, write this buffer together with
+				 * any that follow it on disk, so the kernel sees one large
+				 * write instead of many small ones.
+				 */
+				nscanned = SyncBufferRun(ts_stat->index,
+										 ts_stat->num_to_scan - ts_stat->num_scanned,
+										 &wb_context, &nwritten);
+				BgWriterStats.m_buf_written_checkpoints += nwritten;
+				num_written += nwritten;
+			}
+
+			/* Let the checkpointer see how long the device takes to write */
+			if (adaptive && nwritten > 0)
+			{
+				instr_time	write_time;
+
+				INSTR_TIME_SET_CURRENT(write_time);
+				INSTR_TIME_SUBTRACT(write_time, write_start);
+				CheckpointNoteWriteLatency(INSTR_TIME_GET_MILLISEC(write_time) /
+										   nwritten);
 			}
 		}
 
+		num_processed += nscanned;
+
 		/*
 		 * Measure progress independent of actually having to flush the buffer
 		 * - otherwise writing become unbalanced.
 		 */
-		ts_stat->progress += ts_stat->progress_slice;
-		ts_stat->num_scanned++;
-		ts_stat->index++;
+		ts_stat->progress += ts_stat->progress_slice * nscanned;
+		ts_stat->num_scanned += nscanned;
+		ts_stat->index += nscanned;
+
+		/*
+		 * With adaptive pacing, once the writes in a tablespace move on to
+		 * another file, the checkpoint is done with the previous one.  Start
+		 * its writeback right away and have it fsync'd soon, rather than
+		 * leaving all of the fsyncs to the end of the checkpoint.  Undo files
+		 * are left to the sync phase.
+		 */
+		if (adaptive)
+		{
+			CkptSortItem *last = &CkptBufferIds[ts_stat->index - 1];
+			CkptSortItem *next = NULL;
+
+			if (ts_stat->num_scanned < ts_stat->num_to_scan)
+				next = &CkptBufferIds[ts_stat->index];
+
+			if (last->dbNode != UndoLogDatabaseOid &&
+				(next == NULL ||
+				 next->dbNode != last->dbNode ||
+				 next->relNode != last->relNode ||
+				 next->forkNum != last->forkNum ||
+				 next->blockNum / RELSEG_SIZE != last->blockNum / RELSEG_SIZE))
+			{
+				RelFileNode rnode;
+
+				rnode.spcNode = last->tsId;
+				rnode.dbNode = last->dbNode;
+				rnode.relNode = last->relNode;
+
+				IssuePendingWritebacks(&wb_context);
+				mdcheckpointfiledone(rnode, last->forkNum, last->blockNum);
+			}
+		}
 
 		/* Have all the buffers from the tablespace been processed? */
 		if (ts_stat->num_scanned == ts_stat->num_to_scan)
@@ -2105,11 +2343,18 @@ BufferSync(int flags)
 		}
 
 		/*
-		 * Sleep to throttle our I/O rate.
+		 * Sleep to throttle our I/O rate.  Writes still in flight are
+		 * finished first, so their buffers don't stay locked through the nap.
 		 */
+		if (NumPendingWrites > 0 &&
+			CheckpointWriteDelayWouldSleep(flags,
+										   (double) num_processed / num_to_scan))
+			FinishBufferWrites(&wb_context);
 		CheckpointWriteDelay(flags, (double) num_processed / num_to_scan);
 	}
 
+	FinishBufferWrites(&wb_context);
+
 	/* issue all pending flushes */
 	IssuePendingWritebacks(&wb_context);
 
@@ -2144,12 +2389,14 @@ BgBufferSync(WritebackContext *wb_context)
 	int			strategy_buf_id;
 	uint32		strategy_passes;
 	uint32		recent_alloc;
+	int			nbuffers;
 
 	/*
 	 * Information saved between calls so we can determine the strategy
 	 * point's advance rate and avoid scanning already-cleaned buffers.
 	 */
 	static bool saved_info_valid = false;
+	static int	prev_nbuffers;
 	static int	prev_strategy_buf_id;
 	static uint32 prev_strategy_passes;
 	static int	next_to_clean;
@@ -2176,6 +2423,7 @@ BgBufferSync(WritebackContext *wb_context)
 	int			num_to_scan;
 	int			num_written;
 	int			reusable_buffers;
+	bool		batch;
 
 	/* Variables for final smoothed_density update */
 	long		new_strategy_delta;
@@ -2185,11 +2433,17 @@ BgBufferSync(WritebackContext *wb_context)
 	 * Find out where the freelist clock sweep currently is, and how many
 	 * buffer allocations have happened since our last call.
 	 */
-	strategy_buf_id = StrategySyncStart(&strategy_passes, &recent_alloc);
+	strategy_buf_id = StrategySyncStart(&strategy_passes, &recent_alloc,
+										&nbuffers);
 
 	/* Report buffer alloc counts to pgstat */
 	BgWriterStats.m_buf_alloc += recent_alloc;
 
+	/* Start over at the strategy point if the buffer pool was resized */
+	if (nbuffers != prev_nbuffers)
+		saved_info_valid = false;
+	prev_nbuffers = nbuffers;
+
 	/*
 	 * If we're not running the LRU scan, just stop after doing the stats
 	 * stuff.  We mark the saved state invalid so that we can recover sanely
@@ -2214,7 +2468,7 @@ BgBufferSync(WritebackContext *wb_context)
 		int32		passes_delta = strategy_passes - prev_strategy_passes;
 
 		strategy_delta = strategy_buf_id - prev_strategy_buf_id;
-		strategy_delta += (long) passes_delta * NBuffers;
+		strategy_delta += (long) passes_delta * nbuffers;
 
 		Assert(strategy_delta >= 0);
 
@@ -2233,7 +2487,7 @@ BgBufferSync(WritebackContext *wb_context)
 				 next_to_clean >= strategy_buf_id)
 		{
 			/* on same pass, but ahead or at least not behind */
-			bufs_to_lap = NBuffers - (next_to_clean - strategy_buf_id);
+			bufs_to_lap = nbuffers - (next_to_clean - strategy_buf_id);
 #ifdef BGW_DEBUG
 			elog(DEBUG2, "bgwriter ahead: bgw %u-%u strategy %u-%u delta=%ld lap=%d",
 				 next_passes, next_to_clean,
@@ -2255,7 +2509,7 @@ BgBufferSync(WritebackContext *wb_context)
 #endif
 			next_to_clean = strategy_buf_id;
 			next_passes = strategy_passes;
-			bufs_to_lap = NBuffers;
+			bufs_to_lap = nbuffers;
 		}
 	}
 	else
@@ -2271,7 +2525,7 @@ BgBufferSync(WritebackContext *wb_context)
 		strategy_delta = 0;
 		next_to_clean = strategy_buf_id;
 		next_passes = strategy_passes;
-		bufs_to_lap = NBuffers;
+		bufs_to_lap = nbuffers;
 	}
 
 	/* Update saved info for next time */
@@ -2297,7 +2551,7 @@ BgBufferSync(WritebackContext *wb_context)
 	 * strategy point and where we've scanned ahead to, based on the smoothed
 	 * density estimate.
 	 */
-	bufs_ahead = NBuffers - bufs_to_lap;
+	bufs_ahead = nbuffers - bufs_to_lap;
 	reusable_buffers_est = (float) bufs_ahead / smoothed_density;
 
 	/*
@@ -2335,7 +2589,7 @@ BgBufferSync(WritebackContext *wb_context)
 	 * the BGW will be called during the scan_whole_pool time; slice the
 	 * buffer pool into that many sections.
 	 */
-	min_scan_buffers = (int) (NBuffers / (scan_whole_pool_milliseconds / BgWriterDelay));
+	min_scan_buffers = (int) (nbuffers / (scan_whole_pool_milliseconds / BgWriterDelay));
 
 	if (upcoming_alloc_est < (min_scan_buffers + reusable_buffers_est))
 	{
@@ -2356,6 +2610,7 @@ BgBufferSync(WritebackContext *wb_context)
 	/* Make sure we can handle the pin inside SyncOneBuffer */
 	ResourceOwnerEnlargeBuffers(CurrentResourceOwner);
 
+	batch = pgaio_batch_size() > 1;
 	num_to_scan = bufs_to_lap;
 	num_written = 0;
 	reusable_buffers = reusable_buffers_est;
@@ -2364,9 +2619,9 @@ BgBufferSync(WritebackContext *wb_context)
 	while (num_to_scan > 0 && reusable_buffers < upcoming_alloc_est)
 	{
 		int			sync_state = SyncOneBuffer(next_to_clean, true,
-											   wb_context);
+											   wb_context, batch);
 
-		if (++next_to_clean >= NBuffers)
+		if (++next_to_clean >= nbuffers)
 		{
 			next_to_clean = 0;
 			next_passes++;
@@ -2386,6 +2641,8 @@ BgBufferSync(WritebackContext *wb_context)
 			reusable_buffers++;
 	}
 
+	FinishBufferWrites(wb_context);
+
 	BgWriterStats.m_buf_written_clean += num_written;
 
 #ifdef BGW_DEBUG
@@ -2438,10 +2695,14 @@ BgBufferSync(WritebackContext *wb_context)
  * (BUF_WRITTEN could be set in error if FlushBuffers finds the buffer clean
  * after locking it, but we don't care all that much.)
  *
+ * If batch is true, the write is only started and the buffer added to
+ * PendingWrites; the caller must call FinishBufferWrites before it's done.
+ *
  * Note: caller must have done ResourceOwnerEnlargeBuffers.
  */
 static int
-SyncOneBuffer(int buf_id, bool skip_recently_used, WritebackContext *wb_context)
+SyncOneBuffer(int buf_id, bool skip_recently_used, WritebackContext *wb_context,
+			  bool batch)
 {
 	BufferDesc *bufHdr = GetBufferDescriptor(buf_id);
 	int			result = 0;
@@ -2450,6 +2711,9 @@ SyncOneBuffer(int buf_id, bool skip_recently_used, WritebackContext *wb_context)
 
 	ReservePrivateRefCountEntry();
 
+	if (batch)
+		AllocPendingWriteCopies();
+
 	/*
 	 * Check whether buffer needs writing.
 	 *
@@ -2487,9 +2751,33 @@ SyncOneBuffer(int buf_id, bool skip_recently_used, WritebackContext *wb_context)
 	PinBuffer_Locked(bufHdr);
 	LWLockAcquire(BufferDescriptorGetContentLock(bufHdr), LW_SHARED);
 
-	FlushBuffer(bufHdr, NULL);
+	if (batch)
+	{
+		bool		started;
+
+		started = FlushBufferStart(bufHdr, NULL,
+								   &PendingWrites[NumPendingWrites],
+								   PendingWriteCopies[NumPendingWrites].data,
+								   true);
+		LWLockRelease(BufferDescriptorGetContentLock(bufHdr));
 
-	LWLockRelease(BufferDescriptorGetContentLock(bufHdr));
+		if (started)
+		{
+			/* FinishBufferWrites will unpin it */
+			NumPendingWrites++;
+			if (NumPendingWrites >= pgaio_batch_size())
+				FinishBufferWrites(wb_context);
+			else
+				ResourceOwnerEnlargeBuffers(CurrentResourceOwner);
+			return result | BUF_WRITTEN;
+		}
+	}
+	else
+	{
+		FlushBuffer(bufHdr, NULL);
+
+		LWLockRelease(BufferDescriptorGetContentLock(bufHdr));
+	}
 
 	tag = bufHdr->tag;
 
@@ -2500,6 +2788,408 @@ SyncOneBuffer(int buf_id, bool skip_recently_used, WritebackContext *wb_context)
 	return result | BUF_WRITTEN;
 }
 
+/*
+ * If the main pool has been shrunk and DrainBufferPool() hasn't evicted all
+ * the buffers taken away yet, the end of the range of buffers that may still
+ * hold pages; otherwise zero.  Only used in the checkpointer.
+ */
+static int	DrainBufferEnd = 0;
+
+/*
+ * ResizeBufferPool -- apply the shared_buffers setting to the buffer pool
+ *
+ * The pool can't grow past the NBuffers buffers reserved at startup, and the
+ * undo buffer pool must stay no larger than half of it, as for a new server.
+ * Growing takes effect at once.  When shrinking, the buffers taken away are
+ * no longer handed out, but their pages are only written out and evicted by
+ * DrainBufferPool().
+ *
+ * Called by the checkpointer whenever it has (re)read the configuration.
+ */
+void
+ResizeBufferPool(void)
+{
+	int			target = SharedBuffers;
+	int			oldBuffers = StrategyMainPoolSize();
+	int			mainBuffers;
+
+	if (target > NBuffers)
+	{
+		ereport(LOG,
+				(errmsg("shared_buffers cannot be raised above %d buffers without restarting the server",
+						NBuffers),
+				 errhint("Set max_shared_buffers to reserve room for a larger buffer pool at server start.")));
+		target = NBuffers;
+	}
+	if (NUndoBuffers > target / 2)
+	{
+		ereport(LOG,
+				(errmsg("shared_buffers cannot be lowered below twice undo_buffers (%d)",
+						NUndoBuffers)));
+		target = NUndoBuffers * 2;
+	}
+
+	mainBuffers = target - NUndoBuffers;
+	if (mainBuffers == oldBuffers)
+		return;
+
+	StrategyResizePool(mainBuffers);
+
+	if (mainBuffers < oldBuffers)
+		DrainBufferEnd = Max(DrainBufferEnd, oldBuffers);
+	else if (mainBuffers >= DrainBufferEnd)
+		DrainBufferEnd = 0;
+
+	ereport(LOG,
+			(errmsg("shared buffer pool resized from %d to %d buffers",
+					oldBuffers + NUndoBuffers, target)));
+}
+
+/*
+ * DrainBufferPool -- evict the pages held by buffers taken out of use
+ *
+ * After ResizeBufferPool() shrank the pool, this writes out the buffers past
+ * its new end if they are dirty, and removes them from the buffer mapping
+ * table.  Pinned buffers are skipped, so that a pin held for a long time
+ * doesn't hold up the checkpointer.  Returns true once all of them are free,
+ * at which point the memory of their pages is given back to the kernel where
+ * that's supported.
+ */
+bool
+DrainBufferPool(void)
+{
+	int			mainBuffers = StrategyMainPoolSize();
+	bool		done = true;
+	int			buf_id;
+
+	if (DrainBufferEnd <= mainBuffers)
+	{
+		DrainBufferEnd = 0;
+		return true;
+	}
+
+	/* Make sure we can handle the pin inside SyncOneBuffer */
+	ResourceOwnerEnlargeBuffers(CurrentResourceOwner);
+
+	for (buf_id = mainBuffers; buf_id < DrainBufferEnd; buf_id++)
+	{
+		if (!EvictDrainedBuffer(buf_id, &BackendWritebackContext))
+			done = false;
+	}
+	IssuePendingWritebacks(&BackendWritebackContext);
+
+	if (!done)
+		return false;
+
+#if defined(MADV_REMOVE)
+	{
+		Size		pagesize = (Size) sysconf(_SC_PAGESIZE);
+		char	   *start = (char *) TYPEALIGN(pagesize,
+											   BufferBlocks + mainBuffers * (Size) BLCKSZ);
+		char	   *end = (char *) TYPEALIGN_DOWN(pagesize,
+												  BufferBlocks + DrainBufferEnd * (Size) BLCKSZ);
+
+		/* This fails with huge pages that aren't wholly free, which is OK */
+		if (start < end && madvise(start, end - start, MADV_REMOVE) != 0)
+			elog(DEBUG1, "could not release memory of evicted shared buffers: %m");
+	}
+#endif
+
+	elog(DEBUG1, "evicted buffers %d to %d from shared buffers",
+		 mainBuffers, DrainBufferEnd - 1);
+	DrainBufferEnd = 0;
+
+	return true;
+}
+
+/*
+ * EvictDrainedBuffer -- DrainBufferPool() helper for a single buffer
+ *
+ * Returns true if the buffer holds no page and isn't pinned, which is final
+ * for a buffer that is no longer in use (see BufferIsInUse in freelist.c).
+ *
+ * Note: caller must have done ResourceOwnerEnlargeBuffers.
+ */
+static bool
+EvictDrainedBuffer(int buf_id, WritebackContext *wb_context)
+{
+	BufferDesc *buf = GetBufferDescriptor(buf_id);
+	BufferTag	tag;
+	uint32		hash;
+	LWLock	   *partitionLock;
+	uint32		buf_state;
+
+	buf_state = LockBufHdr(buf);
+	if (BUF_STATE_GET_REFCOUNT(buf_state) != 0)
+	{
+		UnlockBufHdr(buf, buf_state);
+		return false;
+	}
+	if (!(buf_state & BM_TAG_VALID))
+	{
+		UnlockBufHdr(buf, buf_state);
+		return true;
+	}
+
+	if (buf_state & BM_DIRTY)
+	{
+		UnlockBufHdr(buf, buf_state);
+		(void) SyncOneBuffer(buf_id, false, wb_context, false);
+
+		/* someone might have got in meanwhile; try again next time if so */
+		buf_state = LockBufHdr(buf);
+		if (BUF_STATE_GET_REFCOUNT(buf_state) != 0 ||
+			(buf_state & BM_DIRTY))
+		{
+			UnlockBufHdr(buf, buf_state);
+			return false;
+		}
+		if (!(buf_state & BM_TAG_VALID))
+		{
+			UnlockBufHdr(buf, buf_state);
+			return true;
+		}
+	}
+
+	/* Now remove it from the mapping table, as InvalidateBuffer() does */
+	tag = buf->tag;
+	UnlockBufHdr(buf, buf_state);
+
+	hash = BufTableHashCode(&tag);
+	partitionLock = BufMappingPartitionLock(hash);
+
+	LWLockAcquire(partitionLock, LW_EXCLUSIVE);
+	buf_state = LockBufHdr(buf);
+	if (!BUFFERTAGS_EQUAL(buf->tag, tag) ||
+		BUF_STATE_GET_REFCOUNT(buf_state) != 0 ||
+		(buf_state & BM_DIRTY))
+	{
+		UnlockBufHdr(buf, buf_state);
+		LWLockRelease(partitionLock);
+		return false;
+	}
+
+	Assert(buf_state & BM_TAG_VALID);
+	CLEAR_BUFFERTAG(buf->tag);
+	buf_state &= ~(BUF_FLAG_MASK | BUF_USAGECOUNT_MASK);
+	UnlockBufHdr(buf, buf_state);
+
+	BufTableDelete(&tag, hash);
+	LWLockRelease(partitionLock);
+
+	return true;
+}
+
+/*
+ * SyncBufferRun -- write a run of consecutive checkpoint buffers
+ *
+ * BufferSync helper for when writes aren't batched.  CkptBufferIds[first]
+ * is written together with as many of the following maxitems - 1 entries
+ * (and at most PG_IOV_MAX in all) as hold the next blocks of the same
+ * relation fork and still need writing for the checkpoint, with a single
+ * smgrwritev() call.  Each page is copied while its buffer is share-locked,
+ * as SyncOneBuffer's batched writes do.
+ *
+ * Returns the number of CkptBufferIds entries dealt with, which is at least
+ * one, and sets *nwritten to the number of buffers written.
+ *
+ * Note: caller must have done ResourceOwnerEnlargeBuffers.
+ */
+static int
+SyncBufferRun(int first, int maxitems, WritebackContext *wb_context,
+			  int *nwritten)
+{
+	CkptSortItem *items = &CkptBufferIds[first];
+	char	   *buffers[PG_IOV_MAX];
+	BufferTag	runtag;
+	SMgrRelation reln;
+	instr_time	io_start,
+				io_time;
+	int			nitems;
+	int			nscanned;
+	int			i;
+
+	StaticAssertStmt(PG_IOV_MAX <= PGAIO_MAX_IN_FLIGHT,
+					 "PG_IOV_MAX exceeds PGAIO_MAX_IN_FLIGHT");
+	Assert(NumPendingWrites == 0);
+
+	/*
+	 * Find how far the run could go going by the sorted entries alone.  The
+	 * buffers may have been replaced since, so the buffer tags are checked
+	 * again below.
+	 */
+	maxitems = Min(maxitems, PG_IOV_MAX);
+	for (nitems = 1; nitems < maxitems; nitems++)
+	{
+		if (items[nitems].dbNode != items[0].dbNode ||
+			items[nitems].relNode != items[0].relNode ||
+			items[nitems].forkNum != items[0].forkNum ||
+			items[nitems].blockNum != items[0].blockNum + nitems)
+			break;
+	}
+
+	/* Nothing to combine; write it the usual way without copying the page */
+	if (nitems == 1)
+	{
+		*nwritten = 0;
+		if (SyncOneBuffer(items[0].buf_id, false, wb_context, false) & BUF_WRITTEN)
+		{
+			TRACE_POSTGRESQL_BUFFER_SYNC_WRITTEN(items[0].buf_id);
+			*nwritten = 1;
+		}
+		return 1;
+	}
+
+	AllocPendingWriteCopies();
+
+	*nwritten = 0;
+	nscanned = 0;
+	while (nscanned < nitems)
+	{
+		BufferDesc *bufHdr = GetBufferDescriptor(items[nscanned].buf_id);
+		uint32		buf_state;
+		bool		started;
+
+		ReservePrivateRefCountEntry();
+		ResourceOwnerEnlargeBuffers(CurrentResourceOwner);
+
+		buf_state = LockBufHdr(bufHdr);
+
+		/*
+		 * The first buffer is known to have needed writing a moment ago; the
+		 * others must still need it for the checkpoint, and still hold the
+		 * block their entry says.  Otherwise the run ends here and the next
+		 * BufferSync iteration takes it from there.
+		 */
+		if (nscanned > 0 &&
+			(!(buf_state & BM_CHECKPOINT_NEEDED) ||
+			 !RelFileNodeEquals(bufHdr->tag.rnode, runtag.rnode) ||
+			 bufHdr->tag.forkNum != runtag.forkNum ||
+			 bufHdr->tag.blockNum != runtag.blockNum + nscanned))
+		{
+			UnlockBufHdr(bufHdr, buf_state);
+			break;
+		}
+
+		if (!(buf_state & BM_VALID) || !(buf_state & BM_DIRTY))
+		{
+			/* It's clean, so nothing to do */
+			UnlockBufHdr(bufHdr, buf_state);
+			if (nscanned == 0)
+				nscanned++;
+			break;
+		}
+
+		if (nscanned == 0)
+			runtag = bufHdr->tag;
+
+		PinBuffer_Locked(bufHdr);
+		LWLockAcquire(BufferDescriptorGetContentLock(bufHdr), LW_SHARED);
+
+		started = FlushBufferStart(bufHdr, NULL,
+								   &PendingWrites[NumPendingWrites],
+								   PendingWriteCopies[NumPendingWrites].data,
+								   false);
+		LWLockRelease(BufferDescriptorGetContentLock(bufHdr));
+		nscanned++;
+
+		if (!started)
+		{
+			/* Someone else wrote it, which is as good; but ends the run */
+			BufferTag	tag = bufHdr->tag;
+
+			UnpinBuffer(bufHdr, true);
+			ScheduleBufferTagForWriteback(wb_context, &tag);
+			TRACE_POSTGRESQL_BUFFER_SYNC_WRITTEN(bufHdr->buf_id);
+			(*nwritten)++;
+			break;
+		}
+
+		buffers[NumPendingWrites] = PendingWrites[NumPendingWrites].copy;
+		NumPendingWrites++;
+	}
+
+	if (NumPendingWrites == 0)
+		return nscanned;
+
+	/*
+	 * Write the copies.  Errors are reported in the context of the first
+	 * buffer; AbortBufferIO cleans up all of them.
+	 */
+	reln = PendingWrites[0].reln;
+	PendingWrites[0].errcallback.previous = error_context_stack;
+	error_context_stack = &PendingWrites[0].errcallback;
+
+	if (track_io_timing)
+		INSTR_TIME_SET_CURRENT(io_start);
+
+	smgrwritev(reln, PendingWrites[0].buf->tag.forkNum,
+			   PendingWrites[0].buf->tag.blockNum, buffers,
+			   NumPendingWrites, false);
+
+	if (track_io_timing)
+	{
+		INSTR_TIME_SET_CURRENT(io_time);
+		INSTR_TIME_SUBTRACT(io_time, io_start);
+		pgstat_count_buffer_write_time(INSTR_TIME_GET_MICROSEC(io_time));
+		INSTR_TIME_ADD(pgBufferUsage.blk_write_time, io_time);
+	}
+
+	error_context_stack = PendingWrites[0].errcallback.previous;
+
+	for (i = 0; i < NumPendingWrites; i++)
+		TRACE_POSTGRESQL_BUFFER_SYNC_WRITTEN(PendingWrites[i].buf->buf_id);
+	*nwritten += NumPendingWrites;
+
+	FinishBufferWrites(wb_context);
+
+	return nscanned;
+}
+
+/*
+ * FinishBufferWrites -- finish the writes in PendingWrites
+ *
+ * Each buffer is marked clean, unpinned, and scheduled for writeback.
+ */
+static void
+FinishBufferWrites(WritebackContext *wb_context)
+{
+	int			i;
+
+	pgaio_submit();
+
+	for (i = 0; i < NumPendingWrites; i++)
+	{
+		BufferDesc *bufHdr = PendingWrites[i].buf;
+		BufferTag	tag;
+
+		FlushBufferFinish(&PendingWrites[i]);
+
+		tag = bufHdr->tag;
+
+		UnpinBuffer(bufHdr, true);
+
+		ScheduleBufferTagForWriteback(wb_context, &tag);
+	}
+	NumPendingWrites = 0;
+}
+
+/*
+ * AllocPendingWriteCopies -- make sure PendingWriteCopies is allocated
+ *
+ * The copies are aligned for direct I/O (a BLCKSZ multiple keeps them so).
+ */
+static void
+AllocPendingWriteCopies(void)
+{
+	if (PendingWriteCopies == NULL)
+		PendingWriteCopies = (PGAlignedBlock *)
+			TYPEALIGN(PG_IO_ALIGN_SIZE,
+					  MemoryContextAlloc(TopMemoryContext,
+										 PGAIO_MAX_IN_FLIGHT * sizeof(PGAlignedBlock) +
+										 PG_IO_ALIGN_SIZE));
+}
+
 /*
  *		AtEOXact_Buffers - clean up at end of transaction.
  *
@@ -2514,6 +3204,9 @@ AtEOXact_Buffers(bool isCommit)
 
 	AtEOXact_LocalBuffers(isCommit);
 
+	/* in case an error escaped ReadBuffer_common */
+	pgStatIOContext = IOCONTEXT_NORMAL;
+
 	Assert(PrivateRefCountOverflowed == 0);
 }
 
@@ -2759,11 +3452,33 @@ BufferGetTag(Buffer buffer, RelFileNode *rnode, ForkNumber *forknum,
  */
 static void
 FlushBuffer(BufferDesc *buf, SMgrRelation reln)
+{
+	PendingBufferWrite pending;
+
+	if (FlushBufferStart(buf, reln, &pending, NULL, false))
+		FlushBufferFinish(&pending);
+}
+
+/*
+ * FlushBufferStart -- first half of FlushBuffer
+ *
+ * Returns false if the buffer turned out not to need writing.  Otherwise the
+ * buffer's io_in_progress lock is held and *pending describes the write,
+ * which FlushBufferFinish must be called on.
+ *
+ * If copy is NULL, the page is written before returning, as it always used
+ * to be.  Otherwise it is copied into that BLCKSZ area and an asynchronous
+ * write of the copy is started, so the caller can release the content lock
+ * right away; changes made to the page meanwhile set BM_JUST_DIRTIED, so
+ * the buffer won't be marked clean by FlushBufferFinish.  If start_write is
+ * false, the copy is only made: the caller writes it out itself before
+ * calling FlushBufferFinish, and accounts for the I/O time.
+ */
+static bool
+FlushBufferStart(BufferDesc *buf, SMgrRelation reln,
+				 PendingBufferWrite *pending, char *copy, bool start_write)
 {
 	XLogRecPtr	recptr;
-	ErrorContextCallback errcallback;
-	instr_time	io_start,
-				io_time;
 	Block		bufBlock;
 	char	   *bufToWrite;
 	uint32		buf_state;
@@ -2774,13 +3489,13 @@ FlushBuffer(BufferDesc *buf, SMgrRelation reln)
 	 * not do anything.
 	 */
 	if (!StartBufferIO(buf, false))
-		return;
+		return false;
 
 	/* Setup error traceback support for ereport() */
-	errcallback.callback = shared_buffer_write_error_callback;
-	errcallback.arg = (void *) buf;
-	errcallback.previous = error_context_stack;
-	error_context_stack = &errcallback;
+	pending->errcallback.callback = shared_buffer_write_error_callback;
+	pending->errcallback.arg = (void *) buf;
+	pending->errcallback.previous = error_context_stack;
+	error_context_stack = &pending->errcallback;
 
 	/* Find smgr relation for buffer */
 	if (reln == NULL)
@@ -2831,29 +3546,87 @@ FlushBuffer(BufferDesc *buf, SMgrRelation reln)
 	 */
 	bufBlock = BufHdrGetBlock(buf);
 
-	/*
-	 * Update page checksum if desired.  Since we have only shared lock on the
-	 * buffer, other processes might be updating hint bits in it, so we must
-	 * copy the page to private storage if we do checksumming.
-	 */
-	bufToWrite = PageSetChecksumCopy((Page) bufBlock, buf->tag.blockNum);
+	pending->buf = buf;
+	pending->reln = reln;
+	pending->copy = copy;
 
 	if (track_io_timing)
-		INSTR_TIME_SET_CURRENT(io_start);
+		INSTR_TIME_SET_CURRENT(pending->io_start);
 
-	/*
-	 * bufToWrite is either the shared buffer or a copy, as appropriate.
-	 */
-	smgrwrite(reln,
-			  buf->tag.forkNum,
-			  buf->tag.blockNum,
-			  bufToWrite,
-			  false);
+	if (copy == NULL)
+	{
+		/*
+		 * Update page checksum if desired.  Since we have only shared lock on
+		 * the buffer, other processes might be updating hint bits in it, so
+		 * we must copy the page to private storage if we do checksumming.
+		 */
+		bufToWrite = PageSetChecksumCopy((Page) bufBlock, buf->tag.blockNum);
 
-	if (track_io_timing)
+		/*
+		 * bufToWrite is either the shared buffer or a copy, as appropriate.
+		 */
+		smgrwrite(reln,
+				  buf->tag.forkNum,
+				  buf->tag.blockNum,
+				  bufToWrite,
+				  false);
+		pending->io = NULL;
+	}
+	else
+	{
+		memcpy(copy, (char *) bufBlock, BLCKSZ);
+		PageSetChecksumInplace((Page) copy, buf->tag.blockNum);
+
+		if (start_write)
+			pending->io = smgrstartwrite(reln,
+										 buf->tag.forkNum,
+										 buf->tag.blockNum,
+										 copy,
+										 false);
+		else
+		{
+			pending->io = NULL;
+			INSTR_TIME_SET_ZERO(pending->io_start);
+		}
+	}
+
+	/* Pop the error context stack */
+	error_context_stack = pending->errcallback.previous;
+
+	return true;
+}
+
+/*
+ * FlushBufferFinish -- second half of FlushBuffer
+ *
+ * Waits for the write if it is still in progress, marks the buffer clean
+ * (unless BM_JUST_DIRTIED has become set) and ends the io_in_progress state.
+ */
+static void
+FlushBufferFinish(PendingBufferWrite *pending)
+{
+	BufferDesc *buf = pending->buf;
+	SMgrRelation reln = pending->reln;
+	instr_time	io_time;
+
+	pending->errcallback.previous = error_context_stack;
+	error_context_stack = &pending->errcallback;
+
+	if (pending->io != NULL)
+	{
+		smgrfinishwrite(reln,
+						buf->tag.forkNum,
+						buf->tag.blockNum,
+						pending->copy,
+						false,
+						pending->io);
+		pending->io = NULL;
+	}
+
+	if (track_io_timing && !INSTR_TIME_IS_ZERO(pending->io_start))
 	{
 		INSTR_TIME_SET_CURRENT(io_time);
-		INSTR_TIME_SUBTRACT(io_time, io_start);
+		INSTR_TIME_SUBTRACT(io_time, pending->io_start);
 		pgstat_count_buffer_write_time(INSTR_TIME_GET_MICROSEC(io_time));
 		INSTR_TIME_ADD(pgBufferUsage.blk_write_time, io_time);
 	}
@@ -2873,7 +3646,7 @@ FlushBuffer(BufferDesc *buf, SMgrRelation reln)
 									   reln->smgr_rnode.node.relNode);
 
 	/* Pop the error context stack */
-	error_context_stack = errcallback.previous;
+	error_context_stack = pending->errcallback.previous;
 }
 
 /*
@@ -3630,7 +4403,10 @@ MarkBufferDirtyHint(Buffer buffer, bool buffer_std)
 		if (dirtied)
 		{
 			VacuumPageDirty++;
-			pgBufferUsage.shared_blks_dirtied++;
+			if (bufHdr->tag.rnode.dbNode == UndoLogDatabaseOid)
+				pgBufferUsage.undo_blks_dirtied++;
+			else
+				pgBufferUsage.shared_blks_dirtied++;
 			if (VacuumCostActive)
 				VacuumCostBalance += VacuumCostPageDirty;
 		}
@@ -3690,7 +4466,10 @@ LockBuffer(Buffer buffer, int mode)
 	else if (mode == BUFFER_LOCK_SHARE)
 		LWLockAcquire(BufferDescriptorGetContentLock(buf), LW_SHARED);
 	else if (mode == BUFFER_LOCK_EXCLUSIVE)
+	{
 		LWLockAcquire(BufferDescriptorGetContentLock(buf), LW_EXCLUSIVE);
+		BufferContentLockedExclusive(buf);
+	}
 	else
 		elog(ERROR, "unrecognized buffer lock mode: %d", mode);
 }
@@ -3711,8 +4490,87 @@ ConditionalLockBuffer(Buffer buffer)
 
 	buf = GetBufferDescriptor(buffer - 1);
 
-	return LWLockConditionalAcquire(BufferDescriptorGetContentLock(buf),
-									LW_EXCLUSIVE);
+	if (!LWLockConditionalAcquire(BufferDescriptorGetContentLock(buf),
+								  LW_EXCLUSIVE))
+		return false;
+
+	BufferContentLockedExclusive(buf);
+	return true;
+}
+
+/*
+ * BufferBeginOptimisticRead -- start reading a buffer without its content lock
+ *
+ * The caller must hold a pin on the buffer.  If the content lock is held in
+ * exclusive mode right now, return false, and the caller has to lock the
+ * buffer instead.  Otherwise, *version is set, and the caller may copy what
+ * it needs out of the page, and then call BufferEndOptimisticRead to find
+ * out whether the copy is consistent.
+ *
+ * Only changes made under an exclusive content lock are detected, so this
+ * must not be used to read anything that is changed under a share lock,
+ * such as heap tuple hint bits.  Until the copy has been validated, it can
+ * contain anything at all, so the caller must check line pointers and the
+ * like against the page bounds before following them, and must not act on
+ * the data.
+ *
+ * A page LSN can't serve as the version, since it is only advanced after
+ * the page has been changed, and not at all for unlogged relations.
+ */
+bool
+BufferBeginOptimisticRead(Buffer buffer, uint32 *version)
+{
+	BufferDesc *buf;
+
+	Assert(BufferIsPinned(buffer));
+	if (BufferIsLocal(buffer))
+	{
+		/* nobody else can change a local buffer */
+		*version = 0;
+		return true;
+	}
+
+	buf = GetBufferDescriptor(buffer - 1);
+
+	*version = pg_atomic_read_u32(&buf->change_count);
+	pg_read_barrier();
+
+	/*
+	 * A writer that locked the buffer before we read the version would go
+	 * unnoticed, so there must be none now.  Anyone locking it from now on
+	 * advances the version.
+	 */
+	if (LWLockHeldExclusive(BufferDescriptorGetContentLock(buf)))
+		return false;
+	pg_read_barrier();
+
+	return true;
+}
+
+/*
+ * BufferEndOptimisticRead -- check an optimistic read of a buffer
+ *
+ * Returns true if the buffer wasn't locked exclusively at any point since
+ * the call to BufferBeginOptimisticRead that returned version, in which case
+ * what the caller read in the meantime is consistent.
+ */
+bool
+BufferEndOptimisticRead(Buffer buffer, uint32 version)
+{
+	BufferDesc *buf;
+
+	Assert(BufferIsPinned(buffer));
+	if (BufferIsLocal(buffer))
+		return true;
+
+	buf = GetBufferDescriptor(buffer - 1);
+
+	pg_read_barrier();
+	if (LWLockHeldExclusive(BufferDescriptorGetContentLock(buf)))
+		return false;
+	pg_read_barrier();
+
+	return pg_atomic_read_u32(&buf->change_count) == version;
 }
 
 /*
@@ -4008,7 +4866,7 @@ StartBufferIO(BufferDesc *buf, bool forInput)
 {
 	uint32		buf_state;
 
-	Assert(!InProgressBuf);
+	Assert(NumInProgressBufs < PGAIO_MAX_IN_FLIGHT);
 
 	for (;;)
 	{
@@ -4047,8 +4905,9 @@ StartBufferIO(BufferDesc *buf, bool forInput)
 	buf_state |= BM_IO_IN_PROGRESS;
 	UnlockBufHdr(buf, buf_state);
 
-	InProgressBuf = buf;
-	IsForInput = forInput;
+	InProgressBufs[NumInProgressBufs] = buf;
+	InProgressIsForInput[NumInProgressBufs] = forInput;
+	NumInProgressBufs++;
 
 	return true;
 }
@@ -4074,8 +4933,14 @@ static void
 TerminateBufferIO(BufferDesc *buf, bool clear_dirty, uint32 set_flag_bits)
 {
 	uint32		buf_state;
+	int			i;
 
-	Assert(buf == InProgressBuf);
+	for (i = NumInProgressBufs - 1; i >= 0; i--)
+	{
+		if (InProgressBufs[i] == buf)
+			break;
+	}
+	Assert(i >= 0);
 
 	buf_state = LockBufHdr(buf);
 
@@ -4088,7 +4953,10 @@ TerminateBufferIO(BufferDesc *buf, bool clear_dirty, uint32 set_flag_bits)
 	buf_state |= set_flag_bits;
 	UnlockBufHdr(buf, buf_state);
 
-	InProgressBuf = NULL;
+	/* Forget it, keeping the array dense */
+	NumInProgressBufs--;
+	InProgressBufs[i] = InProgressBufs[NumInProgressBufs];
+	InProgressIsForInput[i] = InProgressIsForInput[NumInProgressBufs];
 
 	LWLockRelease(BufferDescriptorGetIOLock(buf));
 }
@@ -4097,7 +4965,7 @@ TerminateBufferIO(BufferDesc *buf, bool clear_dirty, uint32 set_flag_bits)
  * AbortBufferIO: Clean up any active buffer I/O after an error.
  *
  *	All LWLocks we might have held have been released,
- *	but we haven't yet released buffer pins, so the buffer is still pinned.
+ *	but we haven't yet released buffer pins, so the buffers are still pinned.
  *
  *	If I/O was in progress, we always set BM_IO_ERROR, even though it's
  *	possible the error condition wasn't related to the I/O.
@@ -4105,10 +4973,18 @@ TerminateBufferIO(BufferDesc *buf, bool clear_dirty, uint32 set_flag_bits)
 void
 AbortBufferIO(void)
 {
-	BufferDesc *buf = InProgressBuf;
+	/*
+	 * Asynchronous writes may still be using the pages; let them complete
+	 * before the buffers are given up.  The pins in PendingWrites are
+	 * released by the resource owner.
+	 */
+	pgaio_wait_all();
+	NumPendingWrites = 0;
 
-	if (buf)
+	while (NumInProgressBufs > 0)
 	{
+		BufferDesc *buf = InProgressBufs[NumInProgressBufs - 1];
+		bool		forInput = InProgressIsForInput[NumInProgressBufs - 1];
 		uint32		buf_state;
 
 		/*
@@ -4121,7 +4997,7 @@ AbortBufferIO(void)
 
 		buf_state = LockBufHdr(buf);
 		Assert(buf_state & BM_IO_IN_PROGRESS);
-		if (IsForInput)
+		if (forInput)
 		{
 			Assert(!(buf_state & BM_DIRTY));
 
@@ -4314,6 +5190,11 @@ ckpt_buforder_comparator(const void *pa, const void *pb)
 		return -1;
 	else if (a->tsId > b->tsId)
 		return 1;
+	/* compare database */
+	if (a->dbNode < b->dbNode)
+		return -1;
+	else if (a->dbNode > b->dbNode)
+		return 1;
 	/* compare relation */
 	if (a->relNode < b->relNode)
 		return -1;
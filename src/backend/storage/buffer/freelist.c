@@ -15,6 +15,13 @@
  */
 #include "postgres.h"
 
+#ifdef USE_LIBNUMA
+#include <numa.h>
+#include <numaif.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
+
 #include "port/atomics.h"
 #include "storage/buf_internals.h"
 #include "storage/bufmgr.h"
@@ -22,22 +29,57 @@
 
 #define INT_ACCESS_ONCE(var)	((int)(*((volatile int *)&(var))))
 
+/* GUC variable */
+bool		numa_buffers = false;
 
 /*
- * The shared freelist control information.
+ * Upper limit on the number of NUMA partitions of the main buffer pool, and
+ * the smallest partition we bother to make.  Partition boundaries are rounded
+ * to a multiple of NUMA_PARTITION_ALIGN buffers so that the pages of each
+ * partition start on a 2MB (huge page) boundary.
+ */
+#define MAX_STRATEGY_PARTITIONS		64
+#define MIN_PARTITION_BUFFERS		1024
+#define NUMA_PARTITION_ALIGN		((2 * 1024 * 1024) / BLCKSZ)
+
+/*
+ * How many buffer allocations a backend makes before checking again which
+ * NUMA node it is running on.
+ */
+#define PARTITION_RECHECK_INTERVAL	256
+
+/*
+ * One clock sweep over a contiguous range of buffers, with its own freelist.
+ *
+ * Without NUMA partitioning there is a single partition covering the main
+ * buffer pool.  With NUMA partitioning the main pool is split into one
+ * partition per node, whose descriptors and pages live on that node's memory.
+ * The undo buffer pool always has a partition of its own.
+ *
+ * The main pool partitions are laid out over all the buffers reserved for the
+ * main pool, but only the first numBuffers of each are in use: shrinking
+ * shared_buffers takes buffers away from the end of the pool, and growing it
+ * gives them back (see StrategyResizePool).  Buffers that are not in use are
+ * never handed out by StrategyGetBuffer.
  */
 typedef struct
 {
-	/* Spinlock: protects the values below */
-	slock_t		buffer_strategy_lock;
+	/* Spinlock: protects freelist, completePasses and numBuffers */
+	slock_t		lock;
 
 	/*
-	 * Clock sweep hand: index of next buffer to consider grabbing. Note that
-	 * this isn't a concrete buffer - we only ever increase the value. So, to
-	 * get an actual buffer, it needs to be used modulo NBuffers.
+	 * Clock sweep hand: index of next buffer to consider grabbing, relative
+	 * to firstBuffer. Note that this isn't a concrete buffer - we only ever
+	 * increase the value. So, to get an actual buffer, it needs to be used
+	 * modulo numBuffers.
 	 */
 	pg_atomic_uint32 nextVictimBuffer;
 
+	int			firstBuffer;	/* first buffer of the range */
+	int			numBuffers;		/* number of buffers of the range in use */
+	int			maxBuffers;		/* number of buffers in the range */
+	int			node;			/* NUMA node, or -1 */
+
 	int			firstFreeBuffer;	/* Head of list of unused buffers */
 	int			lastFreeBuffer; /* Tail of list of unused buffers */
 
@@ -52,6 +94,46 @@ typedef struct
 	 */
 	uint32		completePasses; /* Complete cycles of the clock sweep */
 	pg_atomic_uint32 numBufferAllocs;	/* Buffers allocated since last reset */
+} BufferStrategyPartition;
+
+/* Each partition gets a cache line of its own */
+typedef union BufferStrategyPartitionPadded
+{
+	BufferStrategyPartition part;
+	char		pad[PG_CACHE_LINE_SIZE];
+} BufferStrategyPartitionPadded;
+
+/*
+ * The shared freelist control information.
+ */
+typedef struct
+{
+	/* Partitions of the main buffer pool; keep this first for alignment */
+	BufferStrategyPartitionPadded partitions[MAX_STRATEGY_PARTITIONS];
+
+	/*
+	 * If undo_buffers is set, the last NUndoBuffers buffers form a separate
+	 * pool that only holds undo log blocks, with its own clock sweep hand and
+	 * freelist.  The main clock sweep passes over those buffers without
+	 * touching them.  Undo is appended at the insert point and discarded at
+	 * the other end, and discarded blocks are put back on the freelist (see
+	 * ForgetBuffer), so the undo sweep mostly has to choose among the blocks
+	 * of undo which is still live.
+	 */
+	BufferStrategyPartitionPadded undo;
+
+	int			numPartitions;	/* number of partitions in use */
+	int			partitionSize;	/* buffers per partition, except the last */
+
+	/*
+	 * Number of buffers of the main pool in use, out of the
+	 * UndoBufferPoolStart() buffers reserved for it.  Only changed by
+	 * StrategyResizePool().
+	 */
+	int			mainBuffers;
+
+	/* Spinlock: protects bgwprocno */
+	slock_t		buffer_strategy_lock;
 
 	/*
 	 * Bgworker process to be notified upon activity or -1 if none. See
@@ -63,6 +145,20 @@ typedef struct
 /* Pointers to shared state */
 static BufferStrategyControl *StrategyControl = NULL;
 
+/*
+ * Partition layout chosen by StrategyBindBufferMemory(), to be copied into
+ * StrategyControl by StrategyInitialize().
+ */
+static int	layoutPartitions = 0;
+static int	layoutPartitionSize = 0;
+static int	layoutNodes[MAX_STRATEGY_PARTITIONS];
+
+/* The main pool partition this backend allocates from first */
+static int	MyStrategyPartition = 0;
+#ifdef USE_LIBNUMA
+static uint32 allocsSincePartitionCheck = PARTITION_RECHECK_INTERVAL;
+#endif
+
 /*
  * Private (non-shared) state for managing a ring of shared buffers to re-use.
  * This is currently the only kind of BufferAccessStrategy object, but someday
@@ -102,15 +198,98 @@ static BufferDesc *GetBufferFromRing(BufferAccessStrategy strategy,
 									 uint32 *buf_state);
 static void AddBufferToRing(BufferAccessStrategy strategy,
 							BufferDesc *buf);
+static BufferDesc *GetBufferFromFreelist(BufferStrategyPartition *part,
+										 uint32 *buf_state);
+static BufferDesc *GetBufferFromClockSweep(BufferStrategyPartition *part,
+										   uint32 *buf_state);
+
+/* First buffer of the dedicated undo buffer pool. */
+#define UndoBufferPoolStart()	(NBuffers - NUndoBuffers)
+
+#define BufferIsInUndoPool(buf_id)	((buf_id) >= UndoBufferPoolStart())
+
+#define StrategyPartition(i)	(&StrategyControl->partitions[(i)].part)
+#define UndoStrategyPartition()	(&StrategyControl->undo.part)
+
+/*
+ * StrategyPartitionOf -- the partition a buffer is managed by
+ */
+static inline BufferStrategyPartition *
+StrategyPartitionOf(int buf_id)
+{
+	if (NUndoBuffers > 0 && BufferIsInUndoPool(buf_id))
+		return UndoStrategyPartition();
+	if (StrategyControl->numPartitions == 1)
+		return StrategyPartition(0);
+	return StrategyPartition(buf_id / StrategyControl->partitionSize);
+}
+
+/*
+ * BufferIsInUse -- is a buffer part of the buffer pool at present?
+ *
+ * False for buffers past the end of the main pool after shared_buffers was
+ * lowered.  The caller must hold the buffer header spinlock, which makes the
+ * answer stick: StrategyResizePool() changes the partition's size before
+ * DrainBufferPool() looks at the buffers it took away, and that takes the
+ * header spinlock too.
+ */
+static inline bool
+BufferIsInUse(BufferDesc *buf)
+{
+	BufferStrategyPartition *part = StrategyPartitionOf(buf->buf_id);
+
+	return buf->buf_id < part->firstBuffer + INT_ACCESS_ONCE(part->numBuffers);
+}
+
+/*
+ * StrategyLocalPartition -- the partition this backend should allocate from
+ *
+ * That is the partition on the NUMA node of the CPU we are running on.  The
+ * scheduler may move us to another node at any time, so the answer is
+ * refreshed every PARTITION_RECHECK_INTERVAL allocations.
+ */
+static inline int
+StrategyLocalPartition(void)
+{
+#ifdef USE_LIBNUMA
+	int			nparts = StrategyControl->numPartitions;
+
+	if (nparts > 1 &&
+		++allocsSincePartitionCheck >= PARTITION_RECHECK_INTERVAL)
+	{
+		int			cpu = sched_getcpu();
+		int			node = cpu >= 0 ? numa_node_of_cpu(cpu) : -1;
+		int			i;
+
+		allocsSincePartitionCheck = 0;
+		if (node >= 0)
+		{
+			MyStrategyPartition = node % nparts;
+			for (i = 0; i < nparts; i++)
+			{
+				if (StrategyPartition(i)->node == node)
+				{
+					MyStrategyPartition = i;
+					break;
+				}
+			}
+		}
+	}
+#endif
+
+	return MyStrategyPartition;
+}
 
 /*
  * ClockSweepTick - Helper routine for StrategyGetBuffer()
  *
- * Move the clock hand one buffer ahead of its current position and return the
- * id of the buffer now under the hand.
+ * Move the partition's clock hand one buffer ahead of its current position
+ * and return the id of the buffer now under the hand.  nbuffers is the
+ * partition's numBuffers, as read once by the caller: the pool may be resized
+ * meanwhile.
  */
 static inline uint32
-ClockSweepTick(void)
+ClockSweepTick(BufferStrategyPartition *part, uint32 nbuffers)
 {
 	uint32		victim;
 
@@ -120,14 +299,14 @@ ClockSweepTick(void)
 	 * apparent order.
 	 */
 	victim =
-		pg_atomic_fetch_add_u32(&StrategyControl->nextVictimBuffer, 1);
+		pg_atomic_fetch_add_u32(&part->nextVictimBuffer, 1);
 
-	if (victim >= NBuffers)
+	if (victim >= nbuffers)
 	{
 		uint32		originalVictim = victim;
 
 		/* always wrap what we look up in BufferDescriptors */
-		victim = victim % NBuffers;
+		victim = victim % nbuffers;
 
 		/*
 		 * If we're the one that just caused a wraparound, force
@@ -153,19 +332,19 @@ ClockSweepTick(void)
 				 * could lead to an overflow of nextVictimBuffers, but that's
 				 * highly unlikely and wouldn't be particularly harmful.
 				 */
-				SpinLockAcquire(&StrategyControl->buffer_strategy_lock);
+				SpinLockAcquire(&part->lock);
 
-				wrapped = expected % NBuffers;
+				wrapped = expected % nbuffers;
 
-				success = pg_atomic_compare_exchange_u32(&StrategyControl->nextVictimBuffer,
+				success = pg_atomic_compare_exchange_u32(&part->nextVictimBuffer,
 														 &expected, wrapped);
 				if (success)
-					StrategyControl->completePasses++;
-				SpinLockRelease(&StrategyControl->buffer_strategy_lock);
+					part->completePasses++;
+				SpinLockRelease(&part->lock);
 			}
 		}
 	}
-	return victim;
+	return part->firstBuffer + victim;
 }
 
 /*
@@ -179,10 +358,14 @@ ClockSweepTick(void)
 bool
 have_free_buffer()
 {
-	if (StrategyControl->firstFreeBuffer >= 0)
-		return true;
-	else
-		return false;
+	int			i;
+
+	for (i = 0; i < StrategyControl->numPartitions; i++)
+	{
+		if (StrategyPartition(i)->firstFreeBuffer >= 0)
+			return true;
+	}
+	return false;
 }
 
 /*
@@ -194,20 +377,33 @@ have_free_buffer()
  *
  *	strategy is a BufferAccessStrategy object, or NULL for default strategy.
  *
+ *	undo says whether the buffer is for an undo log block, which is taken
+ *	from the dedicated undo buffer pool if there is one.
+ *
+ *	With NUMA partitioning, the partition of the node we are running on is
+ *	tried first, so that new pages (and their descriptors, which PinBuffer
+ *	touches) are on local memory.  Other partitions are only used when the
+ *	local one has nothing left to evict.
+ *
  *	To ensure that no one else can pin the buffer before we do, we must
  *	return the buffer with the buffer header spinlock still held.
  */
 BufferDesc *
-StrategyGetBuffer(BufferAccessStrategy strategy, uint32 *buf_state)
+StrategyGetBuffer(BufferAccessStrategy strategy, uint32 *buf_state, bool undo)
 {
 	BufferDesc *buf;
 	int			bgwprocno;
-	int			trycounter;
-	uint32		local_buf_state;	/* to avoid repeated (de-)referencing */
+	int			nparts;
+	int			local;
+	int			i;
+
+	/* Without a dedicated pool, undo blocks live in shared buffers. */
+	if (NUndoBuffers == 0)
+		undo = false;
 
 	/*
 	 * If given a strategy object, see whether it can select a buffer. We
-	 * assume strategy objects don't need buffer_strategy_lock.
+	 * assume strategy objects don't need the partition locks.
 	 */
 	if (strategy != NULL)
 	{
@@ -242,12 +438,79 @@ StrategyGetBuffer(BufferAccessStrategy strategy, uint32 *buf_state)
 		SetLatch(&ProcGlobal->allProcs[bgwprocno].procLatch);
 	}
 
+	nparts = StrategyControl->numPartitions;
+	local = StrategyLocalPartition();
+
 	/*
 	 * We count buffer allocation requests so that the bgwriter can estimate
 	 * the rate of buffer consumption.  Note that buffers recycled by a
-	 * strategy object are intentionally not counted here.
+	 * strategy object are intentionally not counted here.  The counter is
+	 * kept per partition so that it stays on a node-local cache line.
+	 */
+	pg_atomic_fetch_add_u32(&StrategyPartition(local)->numBufferAllocs, 1);
+
+	if (undo)
+	{
+		BufferStrategyPartition *part = UndoStrategyPartition();
+
+		buf = GetBufferFromFreelist(part, buf_state);
+		if (buf == NULL)
+			buf = GetBufferFromClockSweep(part, buf_state);
+		if (buf == NULL)
+			elog(ERROR, "no unpinned undo buffers available");
+		return buf;
+	}
+
+	/* Use a never-used buffer if there is one, preferably a local one */
+	for (i = 0; i < nparts; i++)
+	{
+		buf = GetBufferFromFreelist(StrategyPartition((local + i) % nparts),
+									buf_state);
+		if (buf != NULL)
+		{
+			if (strategy != NULL)
+				AddBufferToRing(strategy, buf);
+			return buf;
+		}
+	}
+
+	/*
+	 * Nothing on the freelists, so run the "clock sweep" algorithm, moving
+	 * on to the next partition only if every buffer in one is pinned.
 	 */
-	pg_atomic_fetch_add_u32(&StrategyControl->numBufferAllocs, 1);
+	for (i = 0; i < nparts; i++)
+	{
+		buf = GetBufferFromClockSweep(StrategyPartition((local + i) % nparts),
+									  buf_state);
+		if (buf != NULL)
+		{
+			if (strategy != NULL)
+				AddBufferToRing(strategy, buf);
+			return buf;
+		}
+	}
+
+	/*
+	 * We've scanned all the buffers without making any state changes, so all
+	 * the buffers are pinned (or were when we looked at them).  We could
+	 * hope that someone will free one eventually, but it's probably better
+	 * to fail than to risk getting stuck in an infinite loop.
+	 */
+	elog(ERROR, "no unpinned buffers available");
+	return NULL;				/* keep compiler quiet */
+}
+
+/*
+ * GetBufferFromFreelist -- pop an unused buffer off a partition's freelist
+ *
+ * Returns NULL if the freelist is empty, else the buffer with its header
+ * spinlock held.
+ */
+static BufferDesc *
+GetBufferFromFreelist(BufferStrategyPartition *part, uint32 *buf_state)
+{
+	BufferDesc *buf;
+	uint32		local_buf_state;	/* to avoid repeated (de-)referencing */
 
 	/*
 	 * First check, without acquiring the lock, whether there's buffers in the
@@ -262,96 +525,108 @@ StrategyGetBuffer(BufferAccessStrategy strategy, uint32 *buf_state)
 	 * repeat if not.
 	 *
 	 * Note that the freeNext fields are considered to be protected by the
-	 * buffer_strategy_lock not the individual buffer spinlocks, so it's OK to
+	 * partition's lock not the individual buffer spinlocks, so it's OK to
 	 * manipulate them without holding the spinlock.
 	 */
-	if (StrategyControl->firstFreeBuffer >= 0)
+	if (part->firstFreeBuffer < 0)
+		return NULL;
+
+	while (true)
 	{
-		while (true)
+		/* Acquire the spinlock to remove element from the freelist */
+		SpinLockAcquire(&part->lock);
+
+		if (part->firstFreeBuffer < 0)
 		{
-			/* Acquire the spinlock to remove element from the freelist */
-			SpinLockAcquire(&StrategyControl->buffer_strategy_lock);
+			SpinLockRelease(&part->lock);
+			return NULL;
+		}
 
-			if (StrategyControl->firstFreeBuffer < 0)
-			{
-				SpinLockRelease(&StrategyControl->buffer_strategy_lock);
-				break;
-			}
+		buf = GetBufferDescriptor(part->firstFreeBuffer);
+		Assert(buf->freeNext != FREENEXT_NOT_IN_LIST);
 
-			buf = GetBufferDescriptor(StrategyControl->firstFreeBuffer);
-			Assert(buf->freeNext != FREENEXT_NOT_IN_LIST);
-
-			/* Unconditionally remove buffer from freelist */
-			StrategyControl->firstFreeBuffer = buf->freeNext;
-			buf->freeNext = FREENEXT_NOT_IN_LIST;
-
-			/*
-			 * Release the lock so someone else can access the freelist while
-			 * we check out this buffer.
-			 */
-			SpinLockRelease(&StrategyControl->buffer_strategy_lock);
-
-			/*
-			 * If the buffer is pinned or has a nonzero usage_count, we cannot
-			 * use it; discard it and retry.  (This can only happen if VACUUM
-			 * put a valid buffer in the freelist and then someone else used
-			 * it before we got to it.  It's probably impossible altogether as
-			 * of 8.3, but we'd better check anyway.)
-			 */
-			local_buf_state = LockBufHdr(buf);
-			if (BUF_STATE_GET_REFCOUNT(local_buf_state) == 0
-				&& BUF_STATE_GET_USAGECOUNT(local_buf_state) == 0)
-			{
-				if (strategy != NULL)
-					AddBufferToRing(strategy, buf);
-				*buf_state = local_buf_state;
-				return buf;
-			}
-			UnlockBufHdr(buf, local_buf_state);
+		/* Unconditionally remove buffer from freelist */
+		part->firstFreeBuffer = buf->freeNext;
+		buf->freeNext = FREENEXT_NOT_IN_LIST;
 
+		/*
+		 * Release the lock so someone else can access the freelist while we
+		 * check out this buffer.
+		 */
+		SpinLockRelease(&part->lock);
+
+		/*
+		 * If the buffer is pinned or has a nonzero usage_count, we cannot use
+		 * it; discard it and retry.  (This can only happen if VACUUM put a
+		 * valid buffer in the freelist and then someone else used it before
+		 * we got to it.  It's probably impossible altogether as of 8.3, but
+		 * we'd better check anyway.)  Buffers taken out of use by shrinking
+		 * the pool are left on the freelist, to be discarded here.
+		 */
+		local_buf_state = LockBufHdr(buf);
+		if (BUF_STATE_GET_REFCOUNT(local_buf_state) == 0
+			&& BUF_STATE_GET_USAGECOUNT(local_buf_state) == 0
+			&& BufferIsInUse(buf))
+		{
+			*buf_state = local_buf_state;
+			return buf;
 		}
+		UnlockBufHdr(buf, local_buf_state);
 	}
+}
+
+/*
+ * GetBufferFromClockSweep -- run the clock sweep over one partition
+ *
+ * Returns NULL if every buffer of the partition is pinned, else the victim
+ * buffer with its header spinlock held.
+ */
+static BufferDesc *
+GetBufferFromClockSweep(BufferStrategyPartition *part, uint32 *buf_state)
+{
+	BufferDesc *buf;
+	uint32		nbuffers = INT_ACCESS_ONCE(part->numBuffers);
+	int			trycounter;
+	uint32		local_buf_state;
 
-	/* Nothing on the freelist, so run the "clock sweep" algorithm */
-	trycounter = NBuffers;
+	/* All of the partition may have been taken out of use */
+	if (nbuffers == 0)
+		return NULL;
+
+	trycounter = nbuffers;
 	for (;;)
 	{
-		buf = GetBufferDescriptor(ClockSweepTick());
+		uint32		victim = ClockSweepTick(part, nbuffers);
+
+		buf = GetBufferDescriptor(victim);
 
 		/*
 		 * If the buffer is pinned or has a nonzero usage_count, we cannot use
 		 * it; decrement the usage_count (unless pinned) and keep scanning.
+		 * If the pool shrank since we looked at its size, the buffer may no
+		 * longer be in use, which we treat like a pinned one.
 		 */
 		local_buf_state = LockBufHdr(buf);
 
-		if (BUF_STATE_GET_REFCOUNT(local_buf_state) == 0)
+		if (BUF_STATE_GET_REFCOUNT(local_buf_state) == 0 && BufferIsInUse(buf))
 		{
 			if (BUF_STATE_GET_USAGECOUNT(local_buf_state) != 0)
 			{
 				local_buf_state -= BUF_USAGECOUNT_ONE;
 
-				trycounter = NBuffers;
+				trycounter = nbuffers;
 			}
 			else
 			{
 				/* Found a usable buffer */
-				if (strategy != NULL)
-					AddBufferToRing(strategy, buf);
 				*buf_state = local_buf_state;
 				return buf;
 			}
 		}
 		else if (--trycounter == 0)
 		{
-			/*
-			 * We've scanned all the buffers without making any state changes,
-			 * so all the buffers are pinned (or were when we looked at them).
-			 * We could hope that someone will free one eventually, but it's
-			 * probably better to fail than to risk getting stuck in an
-			 * infinite loop.
-			 */
 			UnlockBufHdr(buf, local_buf_state);
-			elog(ERROR, "no unpinned buffers available");
+			return NULL;
 		}
 		UnlockBufHdr(buf, local_buf_state);
 	}
@@ -363,21 +638,25 @@ StrategyGetBuffer(BufferAccessStrategy strategy, uint32 *buf_state)
 void
 StrategyFreeBuffer(BufferDesc *buf)
 {
-	SpinLockAcquire(&StrategyControl->buffer_strategy_lock);
+	BufferStrategyPartition *part = StrategyPartitionOf(buf->buf_id);
+
+	SpinLockAcquire(&part->lock);
 
 	/*
 	 * It is possible that we are told to put something in the freelist that
-	 * is already in it; don't screw up the list if so.
+	 * is already in it; don't screw up the list if so.  Buffers that are not
+	 * in use don't go on the freelist at all.
 	 */
-	if (buf->freeNext == FREENEXT_NOT_IN_LIST)
+	if (buf->freeNext == FREENEXT_NOT_IN_LIST &&
+		buf->buf_id < part->firstBuffer + part->numBuffers)
 	{
-		buf->freeNext = StrategyControl->firstFreeBuffer;
+		buf->freeNext = part->firstFreeBuffer;
 		if (buf->freeNext < 0)
-			StrategyControl->lastFreeBuffer = buf->buf_id;
-		StrategyControl->firstFreeBuffer = buf->buf_id;
+			part->lastFreeBuffer = buf->buf_id;
+		part->firstFreeBuffer = buf->buf_id;
 	}
 
-	SpinLockRelease(&StrategyControl->buffer_strategy_lock);
+	SpinLockRelease(&part->lock);
 }
 
 /*
@@ -389,35 +668,56 @@ StrategyFreeBuffer(BufferDesc *buf)
  * In addition, we return the completed-pass count (which is effectively
  * the higher-order bits of nextVictimBuffer) and the count of recent buffer
  * allocs if non-NULL pointers are passed.  The alloc count is reset after
- * being read.
+ * being read.  *num_buffers is set to the number of buffers the clock hand
+ * goes around, which changes when the pool is resized.
+ *
+ * With several partitions there is no single clock hand.  We then report a
+ * virtual one, which has advanced as many buffers past the start of the
+ * main pool as all the partition hands together.
  */
 int
-StrategySyncStart(uint32 *complete_passes, uint32 *num_buf_alloc)
+StrategySyncStart(uint32 *complete_passes, uint32 *num_buf_alloc,
+				  int *num_buffers)
 {
-	uint32		nextVictimBuffer;
-	int			result;
+	uint64		position = 0;
+	uint64		wheel = 0;
+	uint32		allocs = 0;
+	int			i;
 
-	SpinLockAcquire(&StrategyControl->buffer_strategy_lock);
-	nextVictimBuffer = pg_atomic_read_u32(&StrategyControl->nextVictimBuffer);
-	result = nextVictimBuffer % NBuffers;
-
-	if (complete_passes)
+	for (i = 0; i < StrategyControl->numPartitions; i++)
 	{
-		*complete_passes = StrategyControl->completePasses;
+		BufferStrategyPartition *part = StrategyPartition(i);
+		uint32		nextVictimBuffer;
+		uint32		passes;
+
+		SpinLockAcquire(&part->lock);
+		if (num_buf_alloc)
+			allocs += pg_atomic_exchange_u32(&part->numBufferAllocs, 0);
+		if (part->numBuffers == 0)
+		{
+			SpinLockRelease(&part->lock);
+			continue;
+		}
+		nextVictimBuffer = pg_atomic_read_u32(&part->nextVictimBuffer);
 
 		/*
 		 * Additionally add the number of wraparounds that happened before
 		 * completePasses could be incremented. C.f. ClockSweepTick().
 		 */
-		*complete_passes += nextVictimBuffer / NBuffers;
+		passes = part->completePasses + nextVictimBuffer / part->numBuffers;
+		position += (uint64) passes * part->numBuffers +
+			nextVictimBuffer % part->numBuffers;
+		wheel += part->numBuffers;
+		SpinLockRelease(&part->lock);
 	}
 
+	if (complete_passes)
+		*complete_passes = (uint32) (position / wheel);
 	if (num_buf_alloc)
-	{
-		*num_buf_alloc = pg_atomic_exchange_u32(&StrategyControl->numBufferAllocs, 0);
-	}
-	SpinLockRelease(&StrategyControl->buffer_strategy_lock);
-	return result;
+		*num_buf_alloc = allocs;
+	*num_buffers = (int) wheel;
+
+	return (int) (position % wheel);
 }
 
 /*
@@ -441,6 +741,59 @@ StrategyNotifyBgWriter(int bgwprocno)
 	SpinLockRelease(&StrategyControl->buffer_strategy_lock);
 }
 
+/*
+ * StrategyMainPoolSize -- number of buffers of the main pool in use
+ */
+int
+StrategyMainPoolSize(void)
+{
+	return INT_ACCESS_ONCE(StrategyControl->mainBuffers);
+}
+
+/*
+ * StrategyResizePool -- change the number of buffers of the main pool in use
+ *
+ * The partitions covering the end of the reserved main pool are cut short or
+ * extended.  Buffers that come into use hold no page, unless they were taken
+ * out of use before and not evicted yet, and the clock sweep reaches them in
+ * its next pass.  Buffers taken out of use are no longer handed out, but may
+ * still be pinned or hold pages; it's up to the caller to evict them.  Those
+ * on the freelist are left there for GetBufferFromFreelist to discard, as
+ * unlinking them could take a long time with the spinlock held.
+ *
+ * Only the checkpointer calls this, see ResizeBufferPool().
+ */
+void
+StrategyResizePool(int mainBuffers)
+{
+	int			i;
+
+	Assert(mainBuffers > 0 && mainBuffers <= UndoBufferPoolStart());
+
+	for (i = 0; i < StrategyControl->numPartitions; i++)
+	{
+		BufferStrategyPartition *part = StrategyPartition(i);
+		int			nbuffers;
+
+		nbuffers = Max(Min(part->maxBuffers, mainBuffers - part->firstBuffer), 0);
+
+		SpinLockAcquire(&part->lock);
+		if (nbuffers < part->numBuffers)
+		{
+			uint32		nextVictimBuffer;
+
+			/* Keep the clock hand within the range, c.f. ClockSweepTick() */
+			nextVictimBuffer = pg_atomic_read_u32(&part->nextVictimBuffer);
+			pg_atomic_write_u32(&part->nextVictimBuffer,
+								nbuffers > 0 ? nextVictimBuffer % nbuffers : 0);
+		}
+		part->numBuffers = nbuffers;
+		SpinLockRelease(&part->lock);
+	}
+
+	StrategyControl->mainBuffers = mainBuffers;
+}
+
 
 /*
  * StrategyShmemSize
@@ -464,11 +817,166 @@ StrategyShmemSize(void)
 	return size;
 }
 
+#ifdef USE_LIBNUMA
+/*
+ * Set the NUMA memory policy of a range of shared memory.  Returns errno if
+ * that failed, else 0.
+ */
+static int
+BindMemory(void *ptr, Size len, int mode, struct bitmask *nodes)
+{
+	Size		pagesize = (Size) sysconf(_SC_PAGESIZE);
+	char	   *start = (char *) TYPEALIGN_DOWN(pagesize, ptr);
+	char	   *end = (char *) TYPEALIGN(pagesize, (char *) ptr + len);
+
+	if (mbind(start, end - start, mode, nodes->maskp, nodes->size + 1, 0) != 0)
+		return errno;
+	return 0;
+}
+#endif
+
+/*
+ * StrategyBindBufferMemory -- place the buffer pool on NUMA nodes
+ *
+ * Decides how the main buffer pool is partitioned, and asks the kernel to
+ * put the descriptors and pages of each partition on the memory of its
+ * node.  The undo buffer pool is shared by all nodes, so it is interleaved.
+ *
+ * This must be called by InitBufferPool() before the buffer descriptors are
+ * first touched, since that is when the kernel allocates their memory.  The
+ * placement is only a preference: a node that runs out of memory takes
+ * pages from the others, rather than failing.
+ */
+void
+StrategyBindBufferMemory(void)
+{
+	int			mainBuffers = NBuffers - NUndoBuffers;
+
+	layoutPartitions = 1;
+	layoutPartitionSize = mainBuffers;
+	layoutNodes[0] = -1;
+
+#ifdef USE_LIBNUMA
+	if (numa_buffers && numa_available() < 0)
+		ereport(LOG,
+				(errmsg("NUMA is not available on this system, so shared buffers will not be partitioned")));
+	else if (numa_buffers)
+	{
+		int			nnodes = 0;
+		int			node;
+		int			err = 0;
+		int			i;
+
+		for (node = 0; node <= numa_max_node(); node++)
+		{
+			if (nnodes < MAX_STRATEGY_PARTITIONS &&
+				numa_bitmask_isbitset(numa_all_nodes_ptr, node))
+				layoutNodes[nnodes++] = node;
+		}
+		nnodes = Min(nnodes, mainBuffers / MIN_PARTITION_BUFFERS);
+
+		if (nnodes > 1)
+		{
+			struct bitmask *mask = numa_allocate_nodemask();
+
+			layoutPartitionSize = (mainBuffers + nnodes - 1) / nnodes;
+			layoutPartitionSize =
+				((layoutPartitionSize + NUMA_PARTITION_ALIGN - 1) /
+				 NUMA_PARTITION_ALIGN) * NUMA_PARTITION_ALIGN;
+			layoutPartitions =
+				(mainBuffers + layoutPartitionSize - 1) / layoutPartitionSize;
+
+			for (i = 0; i < layoutPartitions && err == 0; i++)
+			{
+				int			first = i * layoutPartitionSize;
+				int			nbuffers = Min(layoutPartitionSize,
+										   mainBuffers - first);
+
+				numa_bitmask_clearall(mask);
+				numa_bitmask_setbit(mask, layoutNodes[i]);
+				err = BindMemory(GetBufferDescriptor(first),
+								 nbuffers * sizeof(BufferDescPadded),
+								 MPOL_PREFERRED, mask);
+				if (err == 0)
+					err = BindMemory(BufferBlocks + first * (Size) BLCKSZ,
+									 nbuffers * (Size) BLCKSZ,
+									 MPOL_PREFERRED, mask);
+			}
+			numa_bitmask_free(mask);
+
+			if (err == 0 && NUndoBuffers > 0)
+			{
+				err = BindMemory(GetBufferDescriptor(mainBuffers),
+								 NUndoBuffers * sizeof(BufferDescPadded),
+								 MPOL_INTERLEAVE, numa_all_nodes_ptr);
+				if (err == 0)
+					err = BindMemory(BufferBlocks + mainBuffers * (Size) BLCKSZ,
+									 NUndoBuffers * (Size) BLCKSZ,
+									 MPOL_INTERLEAVE, numa_all_nodes_ptr);
+			}
+
+			if (err != 0)
+			{
+				errno = err;
+				ereport(LOG,
+						(errmsg("could not place shared buffers on NUMA nodes: %m")));
+			}
+			else
+				ereport(DEBUG1,
+						(errmsg("split shared buffers into %d NUMA partitions of %d buffers",
+								layoutPartitions, layoutPartitionSize)));
+		}
+	}
+#endif
+
+	if (layoutPartitions == 1)
+		layoutNodes[0] = -1;
+}
+
+/*
+ * Set up one partition of maxbuffers buffers, the first nbuffers of which
+ * are in use; those are already linked together as unused.
+ */
+static void
+InitStrategyPartition(BufferStrategyPartition *part, int first, int maxbuffers,
+					  int nbuffers, int node)
+{
+	int			i;
+
+	SpinLockInit(&part->lock);
+	pg_atomic_init_u32(&part->nextVictimBuffer, 0);
+	part->firstBuffer = first;
+	part->numBuffers = nbuffers;
+	part->maxBuffers = maxbuffers;
+	part->node = node;
+
+	if (nbuffers > 0)
+	{
+		GetBufferDescriptor(first + nbuffers - 1)->freeNext = FREENEXT_END_OF_LIST;
+		part->firstFreeBuffer = first;
+		part->lastFreeBuffer = first + nbuffers - 1;
+	}
+	else
+	{
+		part->firstFreeBuffer = -1;
+		part->lastFreeBuffer = -1;
+	}
+
+	/* The buffers not in use yet are not on the freelist */
+	for (i = nbuffers; i < maxbuffers; i++)
+		GetBufferDescriptor(first + i)->freeNext = FREENEXT_NOT_IN_LIST;
+
+	/* Clear statistics */
+	part->completePasses = 0;
+	pg_atomic_init_u32(&part->numBufferAllocs, 0);
+}
+
 /*
  * StrategyInitialize -- initialize the buffer cache replacement
  *		strategy.
  *
- * Assumes: All of the buffers are already built into a linked list.
+ * Assumes: All of the buffers are already built into a linked list, and
+ *		StrategyBindBufferMemory() has chosen the partitions.
  *		Only called by postmaster and only during initialization.
  */
 void
@@ -476,6 +984,12 @@ StrategyInitialize(bool init)
 {
 	bool		found;
 
+	if (NUndoBuffers > SharedBuffers / 2)
+		ereport(FATAL,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("undo_buffers (%d) must not be more than half of shared_buffers (%d)",
+						NUndoBuffers, SharedBuffers)));
+
 	/*
 	 * Initialize the shared buffer lookup hashtable.
 	 *
@@ -498,26 +1012,46 @@ StrategyInitialize(bool init)
 
 	if (!found)
 	{
+		int			reservedBuffers = UndoBufferPoolStart();
+		int			mainBuffers;
+		int			i;
+
 		/*
 		 * Only done once, usually in postmaster
 		 */
 		Assert(init);
+		Assert(layoutPartitions > 0);
 
 		SpinLockInit(&StrategyControl->buffer_strategy_lock);
 
+		StrategyControl->numPartitions = layoutPartitions;
+		StrategyControl->partitionSize = layoutPartitionSize;
+
 		/*
-		 * Grab the whole linked list of free buffers for our strategy. We
-		 * assume it was previously set up by InitBufferPool().
+		 * Of the buffers reserved for the main pool, use as many as
+		 * shared_buffers asks for.
 		 */
-		StrategyControl->firstFreeBuffer = 0;
-		StrategyControl->lastFreeBuffer = NBuffers - 1;
+		mainBuffers = Min(SharedBuffers, NBuffers) - NUndoBuffers;
+		StrategyControl->mainBuffers = mainBuffers;
 
-		/* Initialize the clock sweep pointer */
-		pg_atomic_init_u32(&StrategyControl->nextVictimBuffer, 0);
+		/*
+		 * Grab the linked list of free buffers for our strategy, cutting it
+		 * at the end of the buffers in use of each partition.
+		 */
+		for (i = 0; i < layoutPartitions; i++)
+		{
+			int			first = i * layoutPartitionSize;
+			int			maxbuffers = Min(layoutPartitionSize,
+										 reservedBuffers - first);
+			int			nbuffers = Max(Min(maxbuffers, mainBuffers - first), 0);
 
-		/* Clear statistics */
-		StrategyControl->completePasses = 0;
-		pg_atomic_init_u32(&StrategyControl->numBufferAllocs, 0);
+			InitStrategyPartition(StrategyPartition(i), first, maxbuffers,
+								  nbuffers, layoutNodes[i]);
+		}
+
+		/* Split off the freelist of the undo buffer pool, if any. */
+		InitStrategyPartition(UndoStrategyPartition(), reservedBuffers,
+							  NUndoBuffers, NUndoBuffers, -1);
 
 		/* No pending notification */
 		StrategyControl->bgwprocno = -1;
@@ -573,7 +1107,8 @@ GetAccessStrategy(BufferAccessStrategyType btype)
 	}
 
 	/* Make sure ring isn't an undue fraction of shared buffers */
-	ring_size = Min(NBuffers / 8, ring_size);
+	ring_size = Min(INT_ACCESS_ONCE(StrategyControl->mainBuffers) / 8,
+					ring_size);
 
 	/* Allocate the object and initialize all elements to zeroes */
 	strategy = (BufferAccessStrategy)
@@ -638,12 +1173,14 @@ GetBufferFromRing(BufferAccessStrategy strategy, uint32 *buf_state)
 	 * since our own previous usage of the ring element would have left it
 	 * there, but it might've been decremented by clock sweep since then). A
 	 * higher usage_count indicates someone else has touched the buffer, so we
-	 * shouldn't re-use it.
+	 * shouldn't re-use it.  Nor can we if the pool has shrunk and the buffer
+	 * is no longer in use.
 	 */
 	buf = GetBufferDescriptor(bufnum - 1);
 	local_buf_state = LockBufHdr(buf);
 	if (BUF_STATE_GET_REFCOUNT(local_buf_state) == 0
-		&& BUF_STATE_GET_USAGECOUNT(local_buf_state) <= 1)
+		&& BUF_STATE_GET_USAGECOUNT(local_buf_state) <= 1
+		&& BufferIsInUse(buf))
 	{
 		strategy->current_was_in_ring = true;
 		*buf_state = local_buf_state;
@@ -702,3 +1239,28 @@ StrategyRejectBuffer(BufferAccessStrategy strategy, BufferDesc *buf)
 
 	return true;
 }
+
+/*
+ * StrategyIOContext -- the I/O statistics context of a strategy
+ *
+ * I/O done on behalf of a ring is counted separately in pg_stat_io, so that
+ * it can be told apart from that of ordinary buffer replacement.
+ */
+IOContext
+StrategyIOContext(BufferAccessStrategy strategy)
+{
+	if (strategy == NULL)
+		return IOCONTEXT_NORMAL;
+
+	switch (strategy->btype)
+	{
+		case BAS_BULKREAD:
+			return IOCONTEXT_BULKREAD;
+		case BAS_BULKWRITE:
+			return IOCONTEXT_BULKWRITE;
+		case BAS_VACUUM:
+			return IOCONTEXT_VACUUM;
+		default:
+			return IOCONTEXT_NORMAL;
+	}
+}
@@ -16,6 +16,7 @@
 #include "postgres.h"
 
 #include "access/parallel.h"
+#include "access/undolog.h"
 #include "catalog/catalog.h"
 #include "executor/instrument.h"
 #include "storage/buf_internals.h"
@@ -341,7 +342,12 @@ MarkLocalBufferDirty(Buffer buffer)
 	buf_state = pg_atomic_read_u32(&bufHdr->state);
 
 	if (!(buf_state & BM_DIRTY))
-		pgBufferUsage.local_blks_dirtied++;
+	{
+		if (bufHdr->tag.rnode.dbNode == UndoLogDatabaseOid)
+			pgBufferUsage.undo_blks_dirtied++;
+		else
+			pgBufferUsage.local_blks_dirtied++;
+	}
 
 	buf_state |= BM_DIRTY;
 
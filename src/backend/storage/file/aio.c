@@ -0,0 +1,930 @@
+/*-------------------------------------------------------------------------
+ *
+ * aio.c
+ *	  Asynchronous file I/O.
+ *
+ * A backend starts a read or write with pgaio_start_io() and later collects
+ * its result with pgaio_wait(), which returns what pg_pread() or pg_pwrite()
+ * would have.  In between, the backend is free to start more I/O, so that
+ * the device sees a queue of requests rather than one at a time.  How the
+ * I/O actually gets done is decided by io_method:
+ *
+ * sync: the I/O is done synchronously when it is started.  This is the
+ * default, and costs no more than calling pg_pread()/pg_pwrite() directly.
+ *
+ * worker: the I/O is queued in shared memory and done by one of io_workers
+ * I/O worker processes.  The workers can't use the submitter's file
+ * descriptors, so each request carries the file's path, and a worker opens
+ * the file for the duration of the request.  Data is read into or written
+ * from the submitter's buffer directly if that lies in shared memory (as
+ * shared buffers do), or through a bounce buffer in the request otherwise.
+ * If there is no room in the queue, or no worker is running (in a standalone
+ * backend, or at shutdown once the workers have exited), the submitter does
+ * the I/O itself.
+ *
+ * io_uring: each backend sets up an io_uring of io_queue_depth entries the
+ * first time it needs one, and I/O is submitted through that.  A few
+ * requests are gathered before entering the kernel.  Requests refer to the
+ * kernel file descriptor, so fd.c calls pgaio_closing_fd() before it closes
+ * one, and we finish any I/O still using it.
+ *
+ * The buffer of an I/O that is in flight must stay valid until the I/O is
+ * waited for.  On error, pgaio_wait_all() (called by AbortBufferIO) waits for
+ * everything still in flight, so buffers can be reused safely afterwards.
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * IDENTIFICATION
+ *	  src/backend/storage/file/aio.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef USE_LIBURING
+#include <liburing.h>
+#endif
+
+#include "lib/ilist.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "postmaster/bgworker.h"
+#include "storage/aio.h"
+#include "storage/fd.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/proc.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
+#include "utils/memutils.h"
+
+/* GUC variables */
+int			io_method = IOMETHOD_SYNC;
+int			io_workers = 3;
+int			io_queue_depth = 32;
+
+/* How long a submitter sleeps before checking again that workers exist */
+#define WORKER_WAIT_TIMEOUT_MS	100
+
+/* How many io_uring requests are gathered before entering the kernel */
+#define URING_SUBMIT_BATCH		8
+
+typedef enum PgAioState
+{
+	PGAIO_IN_FLIGHT,			/* started */
+	PGAIO_DONE					/* result is known */
+} PgAioState;
+
+struct PgAioHandle
+{
+	dlist_node	node;			/* in active_ios or free_ios */
+	PgAioState	state;
+	bool		is_write;
+	int			fd;				/* kernel fd, for io_uring */
+	char	   *buffer;
+	int			amount;
+	off_t		offset;
+	uint32		wait_event_info;
+	int			slot;			/* worker request slot, or -1 */
+	int			result;			/* bytes transferred, or -1 */
+	int			error;			/* errno, if result is -1 */
+#ifdef USE_LIBURING
+	struct iovec iov;
+#endif
+};
+
+/* Handles that have been started and not waited for, and spare ones */
+static dlist_head active_ios = DLIST_STATIC_INIT(active_ios);
+static dlist_head free_ios = DLIST_STATIC_INIT(free_ios);
+static bool aio_exit_registered = false;
+
+/*
+ * A request handed to the I/O workers.  state is protected by the mutex in
+ * AioWorkerControl; the other fields belong to whoever moved the slot into
+ * its current state.
+ */
+typedef enum AioSlotState
+{
+	AIO_SLOT_FREE,
+	AIO_SLOT_QUEUED,			/* waiting for a worker */
+	AIO_SLOT_RUNNING,			/* a worker (or the submitter) is on it */
+	AIO_SLOT_DONE				/* result is known */
+} AioSlotState;
+
+typedef struct AioWorkerSlot
+{
+	AioSlotState state;
+	int			owner;			/* pgprocno of the submitter */
+	bool		is_write;
+	int			flags;			/* for opening the file */
+	int			mode;
+	off_t		offset;
+	int			amount;
+	char	   *buffer;			/* in shared memory, or NULL for bounce */
+	int			result;
+	int			error;
+	char	   *bounce;			/* BLCKSZ, aligned for direct I/O */
+	char		path[MAXPGPATH];
+} AioWorkerSlot;
+
+/*
+ * Shared state of the I/O workers.  The queue is a ring of slot numbers.  A
+ * submitter that finds that no worker is running takes its request back by
+ * marking it running, and the worker that later finds it in the queue skips
+ * it, so the ring is twice as big as the number of slots.
+ */
+typedef struct AioWorkerControl
+{
+	slock_t		mutex;
+	int			nworkers;		/* running I/O workers */
+	int			worker_procno[MAX_IO_WORKERS];
+	bool		worker_idle[MAX_IO_WORKERS];
+	int			nslots;
+	int			nfree;
+	uint64		queue_head;		/* next entry to dequeue */
+	uint64		queue_tail;		/* next entry to fill */
+	int		   *freelist;		/* nslots entries */
+	int		   *queue;			/* 2 * nslots entries */
+	AioWorkerSlot *slots;
+} AioWorkerControl;
+
+static AioWorkerControl *AioCtl = NULL;
+
+/* Set by the SIGTERM handler of an I/O worker */
+static volatile sig_atomic_t aio_worker_shutdown = false;
+
+#ifdef USE_LIBURING
+static struct io_uring aio_ring;
+static bool aio_ring_ready = false;
+static bool aio_ring_failed = false;
+static int	aio_ring_unsubmitted = 0;
+static int	aio_ring_in_flight = 0;
+#endif
+
+static void pgaio_sync_io(PgAioHandle *io);
+static void pgaio_release(PgAioHandle *io);
+static void pgaio_at_exit(int code, Datum arg);
+static bool pgaio_worker_submit(PgAioHandle *io, const char *path,
+								int flags, int mode);
+static void pgaio_worker_wait(PgAioHandle *io, bool cancel);
+static void pgaio_worker_run(AioWorkerSlot *slot);
+#ifdef USE_LIBURING
+static bool pgaio_uring_submit(PgAioHandle *io);
+static void pgaio_uring_reap(bool wait, uint32 wait_event_info);
+#endif
+
+/*
+ * Number of request slots of the I/O workers.
+ */
+static int
+AioWorkerSlots(void)
+{
+	if (io_method != IOMETHOD_WORKER)
+		return 0;
+	return io_workers * io_queue_depth;
+}
+
+/*
+ * AioShmemSize -- report the shared memory needed by the I/O workers
+ */
+Size
+AioShmemSize(void)
+{
+	int			nslots = AioWorkerSlots();
+	Size		size;
+
+	if (nslots == 0)
+		return 0;
+
+	size = MAXALIGN(sizeof(AioWorkerControl));
+	size = add_size(size, MAXALIGN(mul_size(nslots, sizeof(int))));
+	size = add_size(size, MAXALIGN(mul_size(nslots * 2, sizeof(int))));
+	size = add_size(size, mul_size(nslots, sizeof(AioWorkerSlot)));
+	size = add_size(size, PG_IO_ALIGN_SIZE);
+	size = add_size(size, mul_size(nslots, BLCKSZ));
+
+	return size;
+}
+
+/*
+ * AioShmemInit -- allocate and initialize the I/O worker queue
+ */
+void
+AioShmemInit(void)
+{
+	int			nslots = AioWorkerSlots();
+	bool		found;
+	char	   *ptr;
+	int			i;
+
+	if (nslots == 0)
+		return;
+
+	AioCtl = (AioWorkerControl *)
+		ShmemInitStruct("AIO Worker Control", AioShmemSize(), &found);
+
+	/* The pointers are the same in every process, so set them each time */
+	ptr = (char *) AioCtl + MAXALIGN(sizeof(AioWorkerControl));
+	AioCtl->freelist = (int *) ptr;
+	ptr += MAXALIGN(nslots * sizeof(int));
+	AioCtl->queue = (int *) ptr;
+	ptr += MAXALIGN(nslots * 2 * sizeof(int));
+	AioCtl->slots = (AioWorkerSlot *) ptr;
+	ptr += nslots * sizeof(AioWorkerSlot);
+	ptr = (char *) TYPEALIGN(PG_IO_ALIGN_SIZE, ptr);
+	for (i = 0; i < nslots; i++)
+		AioCtl->slots[i].bounce = ptr + (Size) i * BLCKSZ;
+
+	if (found)
+		return;
+
+	SpinLockInit(&AioCtl->mutex);
+	AioCtl->nworkers = 0;
+	for (i = 0; i < MAX_IO_WORKERS; i++)
+	{
+		AioCtl->worker_procno[i] = -1;
+		AioCtl->worker_idle[i] = false;
+	}
+	AioCtl->nslots = nslots;
+	AioCtl->nfree = nslots;
+	AioCtl->queue_head = 0;
+	AioCtl->queue_tail = 0;
+	for (i = 0; i < nslots; i++)
+	{
+		AioCtl->freelist[i] = nslots - 1 - i;
+		AioCtl->slots[i].state = AIO_SLOT_FREE;
+	}
+}
+
+/*
+ * pgaio_batch_size -- how many I/Os it's worth keeping in flight
+ *
+ * With io_method = sync there is nothing to gain from starting I/O early,
+ * so callers can take 1 as a hint to do things the old way.
+ */
+int
+pgaio_batch_size(void)
+{
+	if (io_method == IOMETHOD_SYNC)
+		return 1;
+	return Min(io_queue_depth, PGAIO_MAX_IN_FLIGHT);
+}
+
+/*
+ * Get a handle for a new I/O.
+ */
+static PgAioHandle *
+pgaio_new_handle(void)
+{
+	PgAioHandle *io;
+
+	if (!aio_exit_registered)
+	{
+		before_shmem_exit(pgaio_at_exit, 0);
+		aio_exit_registered = true;
+	}
+
+	if (!dlist_is_empty(&free_ios))
+		io = dlist_container(PgAioHandle, node, dlist_pop_head_node(&free_ios));
+	else
+		io = MemoryContextAlloc(TopMemoryContext, sizeof(PgAioHandle));
+
+	dlist_push_tail(&active_ios, &io->node);
+	io->slot = -1;
+	io->result = -1;
+	io->error = 0;
+
+	return io;
+}
+
+/*
+ * pgaio_start_io -- start reading or writing part of a file
+ *
+ * fd is the kernel file descriptor, which must stay open until the I/O is
+ * waited for (see pgaio_closing_fd).  path, flags and mode are what the file
+ * was opened with, for I/O workers to open it again.  buffer must stay valid
+ * until the I/O is waited for.
+ */
+PgAioHandle *
+pgaio_start_io(bool is_write, int fd, const char *path, int flags, int mode,
+			   char *buffer, int amount, off_t offset,
+			   uint32 wait_event_info)
+{
+	PgAioHandle *io = pgaio_new_handle();
+
+	io->is_write = is_write;
+	io->fd = fd;
+	io->buffer = buffer;
+	io->amount = amount;
+	io->offset = offset;
+	io->wait_event_info = wait_event_info;
+
+	if (io_method == IOMETHOD_WORKER &&
+		pgaio_worker_submit(io, path, flags, mode))
+		return io;
+
+#ifdef USE_LIBURING
+	if (io_method == IOMETHOD_IO_URING && pgaio_uring_submit(io))
+		return io;
+#endif
+
+	pgaio_sync_io(io);
+	return io;
+}
+
+/*
+ * pgaio_completed_io -- make a handle for an I/O that is already over
+ *
+ * This is for I/O that failed before starting, or that the caller had to do
+ * synchronously, and lets callers report the outcome from the same place as
+ * that of other I/O.  result and error are what pgaio_wait will return.
+ */
+PgAioHandle *
+pgaio_completed_io(int result, int error)
+{
+	PgAioHandle *io = pgaio_new_handle();
+
+	io->state = PGAIO_DONE;
+	io->result = result;
+	io->error = error;
+	io->wait_event_info = 0;
+
+	return io;
+}
+
+/*
+ * pgaio_wait -- wait for an I/O to finish, and release its handle
+ *
+ * Returns the number of bytes transferred, or -1 with errno set.  As with
+ * FileWrite, a short write with no error reported sets errno to ENOSPC.
+ */
+int
+pgaio_wait(PgAioHandle *io)
+{
+	int			result;
+	int			error;
+
+	if (io->state != PGAIO_DONE)
+	{
+		if (io->slot >= 0)
+			pgaio_worker_wait(io, false);
+#ifdef USE_LIBURING
+		else
+		{
+			pgaio_submit();
+			while (io->state != PGAIO_DONE)
+				pgaio_uring_reap(true, io->wait_event_info);
+		}
+#endif
+	}
+	Assert(io->state == PGAIO_DONE);
+
+	result = io->result;
+	error = io->error;
+	pgaio_release(io);
+
+	errno = error;
+	return result;
+}
+
+/*
+ * pgaio_submit -- make sure all started I/O has been submitted
+ *
+ * Callers that have started a batch of I/O and have other work to do before
+ * they wait for it should call this, so the I/O gets going in the meantime.
+ */
+void
+pgaio_submit(void)
+{
+#ifdef USE_LIBURING
+	while (aio_ring_unsubmitted > 0)
+	{
+		int			ret = io_uring_submit(&aio_ring);
+
+		if (ret > 0)
+			aio_ring_unsubmitted -= Min(ret, aio_ring_unsubmitted);
+		else if (ret == 0)
+			aio_ring_unsubmitted = 0;
+		else if ((ret == -EAGAIN || ret == -EBUSY) &&
+				 aio_ring_in_flight > aio_ring_unsubmitted)
+			pgaio_uring_reap(true, 0);
+		else if (ret != -EINTR)
+			elog(PANIC, "could not submit I/O to io_uring: %s",
+				 strerror(-ret));
+	}
+#endif
+}
+
+/*
+ * pgaio_closing_fd -- finish all I/O using a file descriptor about to close
+ */
+void
+pgaio_closing_fd(int fd)
+{
+#ifdef USE_LIBURING
+	dlist_iter	iter;
+
+	if (aio_ring_in_flight == 0)
+		return;
+
+	pgaio_submit();
+	dlist_foreach(iter, &active_ios)
+	{
+		PgAioHandle *io = dlist_container(PgAioHandle, node, iter.cur);
+
+		while (io->fd == fd && io->slot < 0 && io->state != PGAIO_DONE)
+			pgaio_uring_reap(true, io->wait_event_info);
+	}
+#endif
+}
+
+/*
+ * pgaio_wait_all -- wait for all I/O in flight, and forget about it
+ *
+ * This is for error recovery and process exit, after which no one is going
+ * to wait for the I/O.  Requests still queued for the I/O workers are
+ * simply taken back.
+ */
+void
+pgaio_wait_all(void)
+{
+	dlist_mutable_iter iter;
+
+	dlist_foreach_modify(iter, &active_ios)
+	{
+		PgAioHandle *io = dlist_container(PgAioHandle, node, iter.cur);
+
+		if (io->state != PGAIO_DONE)
+		{
+			if (io->slot >= 0)
+				pgaio_worker_wait(io, true);
+#ifdef USE_LIBURING
+			else
+			{
+				pgaio_submit();
+				while (io->state != PGAIO_DONE)
+					pgaio_uring_reap(true, io->wait_event_info);
+			}
+#endif
+		}
+		pgaio_release(io);
+	}
+}
+
+/*
+ * Give back the handle of a finished I/O.
+ */
+static void
+pgaio_release(PgAioHandle *io)
+{
+	Assert(io->state == PGAIO_DONE);
+
+	dlist_delete(&io->node);
+	dlist_push_head(&free_ios, &io->node);
+}
+
+static void
+pgaio_at_exit(int code, Datum arg)
+{
+	pgaio_wait_all();
+
+#ifdef USE_LIBURING
+	if (aio_ring_ready)
+	{
+		io_uring_queue_exit(&aio_ring);
+		aio_ring_ready = false;
+	}
+#endif
+}
+
+/*
+ * Do an I/O right away, the same way FileRead and FileWrite do.
+ */
+static void
+pgaio_sync_io(PgAioHandle *io)
+{
+	int			returnCode;
+
+retry:
+	errno = 0;
+	pgstat_report_wait_start(io->wait_event_info);
+	if (io->is_write)
+		returnCode = pg_pwrite(io->fd, io->buffer, io->amount, io->offset);
+	else
+		returnCode = pg_pread(io->fd, io->buffer, io->amount, io->offset);
+	pgstat_report_wait_end();
+
+	/* if write didn't set errno, assume problem is no disk space */
+	if (io->is_write && returnCode != io->amount && errno == 0)
+		errno = ENOSPC;
+
+	/* OK to retry if interrupted */
+	if (returnCode < 0 && errno == EINTR)
+		goto retry;
+
+	io->result = returnCode;
+	io->error = errno;
+	io->state = PGAIO_DONE;
+}
+
+/* ----------------------------------------------------------------
+ *				I/O workers
+ * ----------------------------------------------------------------
+ */
+
+/*
+ * Queue an I/O for the workers.  Returns false if it can't be, in which case
+ * the caller should do it some other way.
+ */
+static bool
+pgaio_worker_submit(PgAioHandle *io, const char *path, int flags, int mode)
+{
+	AioWorkerSlot *slot;
+	bool		shared = ShmemAddrIsValid(io->buffer);
+	int			idx;
+	int			wake = -1;
+	int			i;
+
+	if (AioCtl == NULL || MyProc == NULL)
+		return false;
+	if (!shared && io->amount > BLCKSZ)
+		return false;
+	if (strlen(path) >= MAXPGPATH)
+		return false;
+
+	SpinLockAcquire(&AioCtl->mutex);
+	if (AioCtl->nworkers == 0 || AioCtl->nfree == 0 ||
+		AioCtl->queue_tail - AioCtl->queue_head >= 2 * AioCtl->nslots)
+	{
+		SpinLockRelease(&AioCtl->mutex);
+		return false;
+	}
+	idx = AioCtl->freelist[--AioCtl->nfree];
+	SpinLockRelease(&AioCtl->mutex);
+
+	slot = &AioCtl->slots[idx];
+	slot->owner = MyProc->pgprocno;
+	slot->is_write = io->is_write;
+	slot->flags = flags & ~(O_CREAT | O_EXCL | O_TRUNC);
+	slot->mode = mode;
+	slot->offset = io->offset;
+	slot->amount = io->amount;
+	slot->buffer = shared ? io->buffer : NULL;
+	strlcpy(slot->path, path, MAXPGPATH);
+	if (!shared && io->is_write)
+		memcpy(slot->bounce, io->buffer, io->amount);
+
+	SpinLockAcquire(&AioCtl->mutex);
+	slot->state = AIO_SLOT_QUEUED;
+	AioCtl->queue[AioCtl->queue_tail++ % (2 * AioCtl->nslots)] = idx;
+	for (i = 0; i < MAX_IO_WORKERS; i++)
+	{
+		if (AioCtl->worker_idle[i])
+		{
+			AioCtl->worker_idle[i] = false;
+			wake = AioCtl->worker_procno[i];
+			break;
+		}
+	}
+	SpinLockRelease(&AioCtl->mutex);
+
+	if (wake >= 0)
+		SetLatch(&ProcGlobal->allProcs[wake].procLatch);
+
+	io->slot = idx;
+	io->state = PGAIO_IN_FLIGHT;
+	return true;
+}
+
+/*
+ * Wait for an I/O queued for the workers to finish.
+ *
+ * If cancel is true, the result is not wanted, and a request no worker has
+ * started on is just taken back.  If no worker is running, we do the I/O
+ * ourselves.
+ */
+static void
+pgaio_worker_wait(PgAioHandle *io, bool cancel)
+{
+	AioWorkerSlot *slot = &AioCtl->slots[io->slot];
+	bool		waited = false;
+
+	for (;;)
+	{
+		AioSlotState state;
+		bool		run = false;
+
+		SpinLockAcquire(&AioCtl->mutex);
+		state = slot->state;
+		if (state == AIO_SLOT_QUEUED && (cancel || AioCtl->nworkers == 0))
+		{
+			slot->state = cancel ? AIO_SLOT_DONE : AIO_SLOT_RUNNING;
+			run = !cancel;
+		}
+		SpinLockRelease(&AioCtl->mutex);
+
+		if (run)
+		{
+			pgstat_report_wait_start(io->wait_event_info);
+			pgaio_worker_run(slot);
+			pgstat_report_wait_end();
+			break;
+		}
+		if (state == AIO_SLOT_DONE || (cancel && state == AIO_SLOT_QUEUED))
+			break;
+
+		(void) WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
+						 WORKER_WAIT_TIMEOUT_MS, io->wait_event_info);
+		ResetLatch(MyLatch);
+		waited = true;
+	}
+
+	/* The latch may have been set for some other reason, too */
+	if (waited)
+		SetLatch(MyLatch);
+
+	if (!cancel && !io->is_write && slot->buffer == NULL && slot->result > 0)
+		memcpy(io->buffer, slot->bounce, slot->result);
+	io->result = slot->result;
+	io->error = slot->error;
+	io->state = PGAIO_DONE;
+	io->slot = -1;
+
+	SpinLockAcquire(&AioCtl->mutex);
+	slot->state = AIO_SLOT_FREE;
+	AioCtl->freelist[AioCtl->nfree++] = slot - AioCtl->slots;
+	SpinLockRelease(&AioCtl->mutex);
+}
+
+/*
+ * Do the I/O of a worker request.
+ */
+static void
+pgaio_worker_run(AioWorkerSlot *slot)
+{
+	char	   *buffer = slot->buffer ? slot->buffer : slot->bounce;
+	int			returnCode;
+	int			fd;
+
+	fd = BasicOpenFilePerm(slot->path, slot->flags, slot->mode);
+	if (fd < 0)
+	{
+		slot->result = -1;
+		slot->error = errno;
+		return;
+	}
+
+retry:
+	errno = 0;
+	if (slot->is_write)
+		returnCode = pg_pwrite(fd, buffer, slot->amount, slot->offset);
+	else
+		returnCode = pg_pread(fd, buffer, slot->amount, slot->offset);
+
+	/* if write didn't set errno, assume problem is no disk space */
+	if (slot->is_write && returnCode != slot->amount && errno == 0)
+		errno = ENOSPC;
+
+	/* OK to retry if interrupted */
+	if (returnCode < 0 && errno == EINTR)
+		goto retry;
+
+	slot->result = returnCode;
+	slot->error = errno;
+
+	close(fd);
+}
+
+/*
+ * AioWorkerRegister -- register the I/O workers, if io_method calls for them
+ */
+void
+AioWorkerRegister(void)
+{
+	BackgroundWorker bgw;
+	int			i;
+
+	if (io_method != IOMETHOD_WORKER)
+		return;
+
+	for (i = 0; i < io_workers; i++)
+	{
+		memset(&bgw, 0, sizeof(bgw));
+		bgw.bgw_flags = BGWORKER_SHMEM_ACCESS;
+		bgw.bgw_start_time = BgWorkerStart_PostmasterStart;
+		snprintf(bgw.bgw_name, BGW_MAXLEN, "io worker %d", i);
+		snprintf(bgw.bgw_type, BGW_MAXLEN, "io worker");
+		sprintf(bgw.bgw_library_name, "postgres");
+		sprintf(bgw.bgw_function_name, "AioWorkerMain");
+		bgw.bgw_restart_time = 1;
+		bgw.bgw_notify_pid = 0;
+		bgw.bgw_main_arg = Int32GetDatum(i);
+
+		RegisterBackgroundWorker(&bgw);
+	}
+}
+
+static void
+aio_worker_sigterm(SIGNAL_ARGS)
+{
+	int			save_errno = errno;
+
+	aio_worker_shutdown = true;
+	SetLatch(MyLatch);
+
+	errno = save_errno;
+}
+
+static void
+aio_worker_exit(int code, Datum arg)
+{
+	int			id = DatumGetInt32(arg);
+
+	SpinLockAcquire(&AioCtl->mutex);
+	AioCtl->nworkers--;
+	AioCtl->worker_procno[id] = -1;
+	AioCtl->worker_idle[id] = false;
+	SpinLockRelease(&AioCtl->mutex);
+}
+
+/*
+ * AioWorkerMain -- main loop of an I/O worker
+ *
+ * At shutdown, the worker finishes what is queued before it exits.
+ */
+void
+AioWorkerMain(Datum main_arg)
+{
+	int			id = DatumGetInt32(main_arg);
+
+	pqsignal(SIGTERM, aio_worker_sigterm);
+	BackgroundWorkerUnblockSignals();
+
+	if (AioCtl == NULL || id >= MAX_IO_WORKERS)
+		proc_exit(0);
+
+	SpinLockAcquire(&AioCtl->mutex);
+	AioCtl->nworkers++;
+	AioCtl->worker_procno[id] = MyProc->pgprocno;
+	AioCtl->worker_idle[id] = false;
+	SpinLockRelease(&AioCtl->mutex);
+	on_shmem_exit(aio_worker_exit, Int32GetDatum(id));
+
+	for (;;)
+	{
+		AioWorkerSlot *slot = NULL;
+
+		/* Take a request, or else go idle */
+		SpinLockAcquire(&AioCtl->mutex);
+		while (AioCtl->queue_head < AioCtl->queue_tail)
+		{
+			int			idx;
+
+			idx = AioCtl->queue[AioCtl->queue_head++ % (2 * AioCtl->nslots)];
+			if (AioCtl->slots[idx].state == AIO_SLOT_QUEUED)
+			{
+				slot = &AioCtl->slots[idx];
+				slot->state = AIO_SLOT_RUNNING;
+				break;
+			}
+		}
+		if (slot == NULL)
+			AioCtl->worker_idle[id] = true;
+		SpinLockRelease(&AioCtl->mutex);
+
+		if (slot != NULL)
+		{
+			int			owner;
+
+			pgaio_worker_run(slot);
+
+			SpinLockAcquire(&AioCtl->mutex);
+			slot->state = AIO_SLOT_DONE;
+			owner = slot->owner;
+			SpinLockRelease(&AioCtl->mutex);
+
+			SetLatch(&ProcGlobal->allProcs[owner].procLatch);
+			continue;
+		}
+
+		if (aio_worker_shutdown)
+			break;
+
+		(void) WaitLatch(MyLatch, WL_LATCH_SET | WL_EXIT_ON_PM_DEATH, -1L,
+						 WAIT_EVENT_AIO_WORKER_MAIN);
+		ResetLatch(MyLatch);
+	}
+
+	proc_exit(0);
+}
+
+/* ----------------------------------------------------------------
+ *				io_uring
+ * ----------------------------------------------------------------
+ */
+#ifdef USE_LIBURING
+
+/*
+ * Prepare an I/O in our io_uring.  Returns false if we have none, in which
+ * case the caller should do the I/O synchronously.
+ */
+static bool
+pgaio_uring_submit(PgAioHandle *io)
+{
+	struct io_uring_sqe *sqe;
+
+	if (!aio_ring_ready)
+	{
+		int			ret;
+
+		if (aio_ring_failed)
+			return false;
+
+		ret = io_uring_queue_init(io_queue_depth, &aio_ring, 0);
+		if (ret < 0)
+		{
+			aio_ring_failed = true;
+			ereport(LOG,
+					(errmsg("could not set up io_uring, doing I/O synchronously: %s",
+							strerror(-ret))));
+			return false;
+		}
+		aio_ring_ready = true;
+	}
+
+	/* Don't keep more in flight than the completion queue can take */
+	while (aio_ring_in_flight >= io_queue_depth)
+	{
+		pgaio_submit();
+		pgaio_uring_reap(true, io->wait_event_info);
+	}
+
+	while ((sqe = io_uring_get_sqe(&aio_ring)) == NULL)
+		pgaio_submit();
+
+	io->iov.iov_base = io->buffer;
+	io->iov.iov_len = io->amount;
+	if (io->is_write)
+		io_uring_prep_writev(sqe, io->fd, &io->iov, 1, io->offset);
+	else
+		io_uring_prep_readv(sqe, io->fd, &io->iov, 1, io->offset);
+	io_uring_sqe_set_data(sqe, io);
+
+	io->state = PGAIO_IN_FLIGHT;
+	aio_ring_in_flight++;
+	if (++aio_ring_unsubmitted >= URING_SUBMIT_BATCH)
+		pgaio_submit();
+
+	return true;
+}
+
+/*
+ * Collect completed I/O from our io_uring, waiting for one if asked to.
+ */
+static void
+pgaio_uring_reap(bool wait, uint32 wait_event_info)
+{
+	struct io_uring_cqe *cqe;
+	int			ret;
+
+	if (wait)
+	{
+		pgstat_report_wait_start(wait_event_info);
+		ret = io_uring_wait_cqe(&aio_ring, &cqe);
+		pgstat_report_wait_end();
+	}
+	else
+		ret = io_uring_peek_cqe(&aio_ring, &cqe);
+
+	while (ret == 0)
+	{
+		PgAioHandle *io = (PgAioHandle *) io_uring_cqe_get_data(cqe);
+		int			res = cqe->res;
+
+		io_uring_cqe_seen(&aio_ring, cqe);
+		aio_ring_in_flight--;
+
+		if (res == -EINTR || res == -EAGAIN)
+			pgaio_sync_io(io);
+		else
+		{
+			io->result = res < 0 ? -1 : res;
+			io->error = res < 0 ? -res : 0;
+			/* as in pgaio_sync_io */
+			if (io->is_write && res >= 0 && res != io->amount)
+				io->error = ENOSPC;
+			io->state = PGAIO_DONE;
+		}
+
+		ret = io_uring_peek_cqe(&aio_ring, &cqe);
+	}
+
+	if (ret < 0 && ret != -EAGAIN && ret != -EINTR)
+		elog(PANIC, "could not get I/O completion from io_uring: %s",
+			 strerror(-ret));
+}
+
+#endif							/* USE_LIBURING */
@@ -36,12 +36,27 @@
  * other backends, as infrastructure for parallel execution.  Such files need
  * to be created as a member of a SharedFileSet that all participants are
  * attached to.
+ *
+ * BufFile can also compress temporary files block by block, if the
+ * temp_file_compression setting asks for it and the file is created with
+ * BufFileCreateCompressedTemp.  Each buffer-load is then stored as a header
+ * followed by its compressed (or, when that does not save space, its raw)
+ * contents, so that blocks occupy a variable amount of space on disk and a
+ * logical position no longer maps to a physical one.  Such files must be
+ * written sequentially and can only be rewound to the start; that suits hash
+ * join batches and hash aggregate spill files, which are written once and
+ * read back once, but not the random block access of logtape.c.
  *-------------------------------------------------------------------------
  */
 
 #include "postgres.h"
 
+#ifdef USE_LZ4
+#include <lz4.h>
+#endif
+
 #include "commands/tablespace.h"
+#include "common/pg_lzcompress.h"
 #include "executor/instrument.h"
 #include "miscadmin.h"
 #include "pgstat.h"
@@ -58,6 +73,30 @@
 #define MAX_PHYSICAL_FILESIZE	0x40000000
 #define BUFFILE_SEG_SIZE		(MAX_PHYSICAL_FILESIZE / BLCKSZ)
 
+/*
+ * Header of a block of a compressed BufFile.  The block's data follows,
+ * compressed if stored_len is less than raw_len.  Blocks never cross a
+ * segment boundary; the tail of a segment that is too short for the next
+ * block is left unused.
+ */
+typedef struct BufFileBlockHeader
+{
+	uint16		stored_len;		/* bytes of data following the header */
+	uint16		raw_len;		/* bytes of data once decompressed */
+} BufFileBlockHeader;
+
+#ifdef USE_LZ4
+#define LZ4_MAX_BLCKSZ		LZ4_COMPRESSBOUND(BLCKSZ)
+#else
+#define LZ4_MAX_BLCKSZ		0
+#endif
+
+#define COMPRESS_BUFSIZE	(sizeof(BufFileBlockHeader) + \
+							 Max(PGLZ_MAX_OUTPUT(BLCKSZ), LZ4_MAX_BLCKSZ))
+
+/* GUC variable */
+int			temp_file_compression = TEMP_FILE_COMPRESSION_NONE;
+
 /*
  * This data structure represents a buffered file that consists of one or
  * more physical files (each accessed through a virtual file descriptor
@@ -76,6 +115,13 @@ struct BufFile
 	SharedFileSet *fileset;		/* space for segment files if shared */
 	const char *name;			/* name of this BufFile if shared */
 
+	/*
+	 * Compression method for the file's blocks, and workspace of
+	 * COMPRESS_BUFSIZE bytes for their on-disk form (NULL if not compressed).
+	 */
+	int			compression;
+	char	   *cbuffer;
+
 	/*
 	 * resowner is the ResourceOwner to use for underlying temp files.  (We
 	 * don't need to remember the memory context we're using explicitly,
@@ -91,6 +137,8 @@ struct BufFile
 	off_t		curOffset;		/* offset part of current pos */
 	int			pos;			/* next read/write position in buffer */
 	int			nbytes;			/* total # of valid bytes in buffer */
+	int			physbytes;		/* # of bytes buffer occupies on disk, if
+								 * compressed */
 	PGAlignedBlock buffer;
 };
 
@@ -99,6 +147,8 @@ static BufFile *makeBufFile(File firstfile);
 static void extendBufFile(BufFile *file);
 static void BufFileLoadBuffer(BufFile *file);
 static void BufFileDumpBuffer(BufFile *file);
+static void BufFileLoadCompressedBuffer(BufFile *file);
+static void BufFileDumpCompressedBuffer(BufFile *file);
 static int	BufFileFlush(BufFile *file);
 static File MakeNewSharedSegment(BufFile *file, int segment);
 
@@ -118,6 +168,9 @@ makeBufFileCommon(int nfiles)
 	file->curOffset = 0L;
 	file->pos = 0;
 	file->nbytes = 0;
+	file->physbytes = 0;
+	file->compression = TEMP_FILE_COMPRESSION_NONE;
+	file->cbuffer = NULL;
 
 	return file;
 }
@@ -206,6 +259,28 @@ BufFileCreateTemp(bool interXact)
 	return file;
 }
 
+/*
+ * Create a BufFile like BufFileCreateTemp, but compressing its contents with
+ * the method selected by temp_file_compression, if any.
+ *
+ * The caller must write the file sequentially, and may only seek back to its
+ * start (with BufFileSeek(file, 0, 0L, SEEK_SET)) before reading it back
+ * sequentially; BufFileTell and BufFileSeekBlock are not supported.
+ */
+BufFile *
+BufFileCreateCompressedTemp(bool interXact)
+{
+	BufFile    *file = BufFileCreateTemp(interXact);
+
+	if (temp_file_compression != TEMP_FILE_COMPRESSION_NONE)
+	{
+		file->compression = temp_file_compression;
+		file->cbuffer = palloc(COMPRESS_BUFSIZE);
+	}
+
+	return file;
+}
+
 /*
  * Build the name for a given segment of a given BufFile.
  */
@@ -399,6 +474,8 @@ BufFileClose(BufFile *file)
 		FileClose(file->files[i]);
 	/* release the buffer space */
 	pfree(file->files);
+	if (file->cbuffer)
+		pfree(file->cbuffer);
 	pfree(file);
 }
 
@@ -413,6 +490,13 @@ static void
 BufFileLoadBuffer(BufFile *file)
 {
 	File		thisfile;
+	instr_time	io_start;
+
+	if (file->compression != TEMP_FILE_COMPRESSION_NONE)
+	{
+		BufFileLoadCompressedBuffer(file);
+		return;
+	}
 
 	/*
 	 * Advance to next component file if necessary and possible.
@@ -428,6 +512,7 @@ BufFileLoadBuffer(BufFile *file)
 	 * Read whatever we can get, up to a full bufferload.
 	 */
 	thisfile = file->files[file->curFile];
+	io_start = pgstat_io_start();
 	file->nbytes = FileRead(thisfile,
 							file->buffer.data,
 							sizeof(file->buffer),
@@ -438,7 +523,11 @@ BufFileLoadBuffer(BufFile *file)
 	/* we choose not to advance curOffset here */
 
 	if (file->nbytes > 0)
+	{
 		pgBufferUsage.temp_blks_read++;
+		pgstat_count_io(IOOBJECT_TEMP_FILE, IOCONTEXT_NORMAL, IOOP_READ, 1,
+						io_start);
+	}
 }
 
 /*
@@ -455,6 +544,12 @@ BufFileDumpBuffer(BufFile *file)
 	int			bytestowrite;
 	File		thisfile;
 
+	if (file->compression != TEMP_FILE_COMPRESSION_NONE)
+	{
+		BufFileDumpCompressedBuffer(file);
+		return;
+	}
+
 	/*
 	 * Unlike BufFileLoadBuffer, we must dump the whole buffer even if it
 	 * crosses a component-file boundary; so we need a loop.
@@ -462,6 +557,7 @@ BufFileDumpBuffer(BufFile *file)
 	while (wpos < file->nbytes)
 	{
 		off_t		availbytes;
+		instr_time	io_start;
 
 		/*
 		 * Advance to next component file if necessary and possible.
@@ -484,6 +580,7 @@ BufFileDumpBuffer(BufFile *file)
 			bytestowrite = (int) availbytes;
 
 		thisfile = file->files[file->curFile];
+		io_start = pgstat_io_start();
 		bytestowrite = FileWrite(thisfile,
 								 file->buffer.data + wpos,
 								 bytestowrite,
@@ -495,6 +592,8 @@ BufFileDumpBuffer(BufFile *file)
 		wpos += bytestowrite;
 
 		pgBufferUsage.temp_blks_written++;
+		pgstat_count_io(IOOBJECT_TEMP_FILE, IOCONTEXT_NORMAL, IOOP_WRITE, 1,
+						io_start);
 	}
 	file->dirty = false;
 
@@ -519,6 +618,180 @@ BufFileDumpBuffer(BufFile *file)
 	file->nbytes = 0;
 }
 
+/*
+ * BufFileLoadCompressedBuffer
+ *
+ * BufFileLoadBuffer for a compressed file: load and decompress the block
+ * starting at curOffset.  On exit, nbytes is the number of bytes loaded and
+ * physbytes the space the block occupies on disk; curOffset is not advanced.
+ */
+static void
+BufFileLoadCompressedBuffer(BufFile *file)
+{
+	BufFileBlockHeader *hdr = (BufFileBlockHeader *) file->cbuffer;
+	char	   *data = file->cbuffer + sizeof(BufFileBlockHeader);
+	File		thisfile;
+	int			nread;
+	int32		rawlen;
+	instr_time	io_start;
+
+	file->nbytes = 0;
+	file->physbytes = 0;
+	io_start = pgstat_io_start();
+
+	/*
+	 * Read the block header, advancing to the next component file if the
+	 * current one holds no further blocks.
+	 */
+	for (;;)
+	{
+		thisfile = file->files[file->curFile];
+		nread = 0;
+		if (file->curOffset + (off_t) sizeof(BufFileBlockHeader) <=
+			MAX_PHYSICAL_FILESIZE)
+			nread = FileRead(thisfile, (char *) hdr,
+							 sizeof(BufFileBlockHeader), file->curOffset,
+							 WAIT_EVENT_BUFFILE_READ);
+		if (nread > 0 || file->curFile + 1 >= file->numFiles)
+			break;
+		file->curFile++;
+		file->curOffset = 0L;
+	}
+	if (nread <= 0)
+		return;					/* end of file */
+	if (nread != sizeof(BufFileBlockHeader) ||
+		hdr->stored_len > hdr->raw_len || hdr->raw_len > BLCKSZ)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_CORRUPTED),
+				 errmsg("invalid block header in temporary file \"%s\"",
+						FilePathName(thisfile))));
+
+	nread = FileRead(thisfile, data, hdr->stored_len,
+					 file->curOffset + sizeof(BufFileBlockHeader),
+					 WAIT_EVENT_BUFFILE_READ);
+	if (nread != hdr->stored_len)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not read block from temporary file \"%s\": read only %d of %d bytes",
+						FilePathName(thisfile), Max(nread, 0),
+						(int) hdr->stored_len)));
+	pgstat_count_io(IOOBJECT_TEMP_FILE, IOCONTEXT_NORMAL, IOOP_READ, 1,
+					io_start);
+
+	if (hdr->stored_len == hdr->raw_len)
+	{
+		memcpy(file->buffer.data, data, hdr->raw_len);
+		rawlen = hdr->raw_len;
+	}
+	else
+	{
+		switch (file->compression)
+		{
+			case TEMP_FILE_COMPRESSION_PGLZ:
+				rawlen = pglz_decompress(data, hdr->stored_len,
+										 file->buffer.data, hdr->raw_len,
+										 true);
+				break;
+#ifdef USE_LZ4
+			case TEMP_FILE_COMPRESSION_LZ4:
+				rawlen = LZ4_decompress_safe(data, file->buffer.data,
+											 hdr->stored_len, hdr->raw_len);
+				break;
+#endif
+			default:
+				elog(ERROR, "unrecognized temporary file compression method: %d",
+					 file->compression);
+				rawlen = -1;	/* keep compiler quiet */
+				break;
+		}
+		if (rawlen != hdr->raw_len)
+			ereport(ERROR,
+					(errcode(ERRCODE_DATA_CORRUPTED),
+					 errmsg("could not decompress block of temporary file \"%s\"",
+							FilePathName(thisfile))));
+	}
+
+	file->nbytes = rawlen;
+	file->physbytes = sizeof(BufFileBlockHeader) + hdr->stored_len;
+
+	pgBufferUsage.temp_blks_read++;
+}
+
+/*
+ * BufFileDumpCompressedBuffer
+ *
+ * BufFileDumpBuffer for a compressed file: compress the buffer and write it
+ * out as a block starting at curOffset.  Since a compressed file is written
+ * sequentially, pos is always at the end of the buffer here.
+ */
+static void
+BufFileDumpCompressedBuffer(BufFile *file)
+{
+	BufFileBlockHeader *hdr = (BufFileBlockHeader *) file->cbuffer;
+	char	   *data = file->cbuffer + sizeof(BufFileBlockHeader);
+	int32		len;
+	int			physbytes;
+	instr_time	io_start;
+
+	Assert(file->pos == file->nbytes);
+
+	switch (file->compression)
+	{
+		case TEMP_FILE_COMPRESSION_PGLZ:
+			len = pglz_compress(file->buffer.data, file->nbytes, data,
+								PGLZ_strategy_default);
+			break;
+#ifdef USE_LZ4
+		case TEMP_FILE_COMPRESSION_LZ4:
+			/* limit the output so that only a useful result is accepted */
+			len = LZ4_compress_default(file->buffer.data, data,
+									   file->nbytes, file->nbytes - 1);
+			if (len <= 0)
+				len = -1;
+			break;
+#endif
+		default:
+			elog(ERROR, "unrecognized temporary file compression method: %d",
+				 file->compression);
+			len = -1;			/* keep compiler quiet */
+			break;
+	}
+
+	/* Store the block as is if compressing it would not save space */
+	if (len < 0 || len >= file->nbytes)
+	{
+		memcpy(data, file->buffer.data, file->nbytes);
+		len = file->nbytes;
+	}
+	hdr->stored_len = (uint16) len;
+	hdr->raw_len = (uint16) file->nbytes;
+	physbytes = sizeof(BufFileBlockHeader) + len;
+
+	/* Move on to the next component file if the block doesn't fit */
+	if (file->curOffset + physbytes > MAX_PHYSICAL_FILESIZE)
+	{
+		while (file->curFile + 1 >= file->numFiles)
+			extendBufFile(file);
+		file->curFile++;
+		file->curOffset = 0L;
+	}
+
+	io_start = pgstat_io_start();
+	if (FileWrite(file->files[file->curFile], file->cbuffer, physbytes,
+				  file->curOffset, WAIT_EVENT_BUFFILE_WRITE) != physbytes)
+		return;					/* failed to write */
+	file->curOffset += physbytes;
+
+	pgBufferUsage.temp_blks_written++;
+	pgstat_count_io(IOOBJECT_TEMP_FILE, IOCONTEXT_NORMAL, IOOP_WRITE, 1,
+					io_start);
+
+	file->dirty = false;
+	file->pos = 0;
+	file->nbytes = 0;
+	file->physbytes = 0;
+}
+
 /*
  * BufFileRead
  *
@@ -542,7 +815,10 @@ BufFileRead(BufFile *file, void *ptr, size_t size)
 		if (file->pos >= file->nbytes)
 		{
 			/* Try to load more data into buffer. */
-			file->curOffset += file->pos;
+			if (file->compression != TEMP_FILE_COMPRESSION_NONE)
+				file->curOffset += file->physbytes;
+			else
+				file->curOffset += file->pos;
 			file->pos = 0;
 			file->nbytes = 0;
 			BufFileLoadBuffer(file);
@@ -593,6 +869,8 @@ BufFileWrite(BufFile *file, void *ptr, size_t size)
 			else
 			{
 				/* Hmm, went directly from reading to writing? */
+				if (file->compression != TEMP_FILE_COMPRESSION_NONE)
+					elog(ERROR, "cannot write to compressed temporary file after reading it");
 				file->curOffset += file->pos;
 				file->pos = 0;
 				file->nbytes = 0;
@@ -652,6 +930,24 @@ BufFileSeek(BufFile *file, int fileno, off_t offset, int whence)
 	int			newFile;
 	off_t		newOffset;
 
+	/*
+	 * Positions within a compressed file are not known, except for its
+	 * start, so rewinding is all that is supported.
+	 */
+	if (file->compression != TEMP_FILE_COMPRESSION_NONE)
+	{
+		if (whence != SEEK_SET || fileno != 0 || offset != 0)
+			elog(ERROR, "compressed temporary files can only be rewound");
+		if (BufFileFlush(file) != 0)
+			return EOF;
+		file->curFile = 0;
+		file->curOffset = 0L;
+		file->pos = 0;
+		file->nbytes = 0;
+		file->physbytes = 0;
+		return 0;
+	}
+
 	switch (whence)
 	{
 		case SEEK_SET:
@@ -733,6 +1029,8 @@ BufFileSeek(BufFile *file, int fileno, off_t offset, int whence)
 void
 BufFileTell(BufFile *file, int *fileno, off_t *offset)
 {
+	Assert(file->compression == TEMP_FILE_COMPRESSION_NONE);
+
 	*fileno = file->curFile;
 	*offset = file->curOffset + file->pos;
 }
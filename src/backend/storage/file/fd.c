@@ -86,9 +86,11 @@
 #include "common/file_perm.h"
 #include "pgstat.h"
 #include "portability/mem.h"
+#include "storage/aio.h"
 #include "storage/fd.h"
 #include "storage/ipc.h"
 #include "utils/guc.h"
+#include "utils/memutils.h"
 #include "utils/resowner_private.h"
 
 
@@ -148,6 +150,9 @@ int			max_safe_fds = 32;	/* default if not changed */
 /* Whether it is safe to continue running after fsync() fails. */
 bool		data_sync_retry = false;
 
+/* Which files to open with O_DIRECT; set from the io_direct GUC */
+int			io_direct_flags = 0;
+
 /* Debugging.... */
 
 #ifdef FDDEBUG
@@ -301,6 +306,7 @@ static File AllocateVfd(void);
 static void FreeVfd(File file);
 
 static int	FileAccess(File file);
+static char *FileBounceBuffer(Vfd *vfdP, char *buffer, int amount);
 static File OpenTemporaryFileInTablespace(Oid tblspcOid, bool rejectError);
 static bool reserveAllocatedDesc(void);
 static int	FreeDesc(AllocateDesc *desc);
@@ -1043,6 +1049,9 @@ LruDelete(File file)
 
 	vfdP = &VfdCache[file];
 
+	/* Asynchronous I/O may still be using the kernel fd */
+	pgaio_closing_fd(vfdP->fd);
+
 	/*
 	 * Close the file.  We aren't expecting this to fail; if it does, better
 	 * to leak the FD than to mess up our internal state.
@@ -1723,6 +1732,9 @@ FileClose(File file)
 
 	if (!FileIsNotOpen(file))
 	{
+		/* Asynchronous I/O may still be using the kernel fd */
+		pgaio_closing_fd(vfdP->fd);
+
 		/* close the file */
 		if (close(vfdP->fd))
 		{
@@ -1817,6 +1829,10 @@ FilePrefetch(File file, off_t offset, int amount, uint32 wait_event_info)
 			   file, VfdCache[file].fileName,
 			   (int64) offset, amount));
 
+	/* With O_DIRECT, the pages would only be read into the kernel's cache */
+	if (VfdCache[file].fileFlags & PG_O_DIRECT)
+		return 0;
+
 	returnCode = FileAccess(file);
 	if (returnCode < 0)
 		return returnCode;
@@ -1862,6 +1878,7 @@ FileRead(File file, char *buffer, int amount, off_t offset,
 {
 	int			returnCode;
 	Vfd		   *vfdP;
+	char	   *iobuf;
 
 	Assert(FileIsValid(file));
 
@@ -1875,12 +1892,16 @@ FileRead(File file, char *buffer, int amount, off_t offset,
 		return returnCode;
 
 	vfdP = &VfdCache[file];
+	iobuf = FileBounceBuffer(vfdP, buffer, amount);
 
 retry:
 	pgstat_report_wait_start(wait_event_info);
-	returnCode = pg_pread(vfdP->fd, buffer, amount, offset);
+	returnCode = pg_pread(vfdP->fd, iobuf, amount, offset);
 	pgstat_report_wait_end();
 
+	if (returnCode > 0 && iobuf != buffer)
+		memcpy(buffer, iobuf, returnCode);
+
 	if (returnCode < 0)
 	{
 		/*
@@ -1918,6 +1939,7 @@ FileWrite(File file, char *buffer, int amount, off_t offset,
 {
 	int			returnCode;
 	Vfd		   *vfdP;
+	char	   *iobuf;
 
 	Assert(FileIsValid(file));
 
@@ -1957,10 +1979,14 @@ FileWrite(File file, char *buffer, int amount, off_t offset,
 		}
 	}
 
+	iobuf = FileBounceBuffer(vfdP, buffer, amount);
+	if (iobuf != buffer)
+		memcpy(iobuf, buffer, amount);
+
 retry:
 	errno = 0;
 	pgstat_report_wait_start(wait_event_info);
-	returnCode = pg_pwrite(VfdCache[file].fd, buffer, amount, offset);
+	returnCode = pg_pwrite(VfdCache[file].fd, iobuf, amount, offset);
 	pgstat_report_wait_end();
 
 	/* if write didn't set errno, assume problem is no disk space */
@@ -2014,6 +2040,298 @@ retry:
 	return returnCode;
 }
 
+/*
+ * FileWriteV -- write from several buffers at consecutive file positions
+ *
+ * Works like FileWrite, except that the data is gathered from iovcnt buffers
+ * (at most PG_IOV_MAX) with one system call where the platform allows.
+ * Temporary files subject to temp_file_limit can't be written this way.  If
+ * the file was opened with O_DIRECT and some buffer isn't suitably aligned,
+ * each buffer is written on its own through FileWrite.
+ */
+int
+FileWriteV(File file, const struct iovec *iov, int iovcnt, off_t offset,
+		   uint32 wait_event_info)
+{
+	int			returnCode;
+	Vfd		   *vfdP;
+	int			amount = 0;
+	bool		aligned = true;
+	int			i;
+
+	Assert(FileIsValid(file));
+	Assert(iovcnt > 0 && iovcnt <= PG_IOV_MAX);
+
+	DO_DB(elog(LOG, "FileWriteV: %d (%s) " INT64_FORMAT " %d",
+			   file, VfdCache[file].fileName,
+			   (int64) offset,
+			   iovcnt));
+
+	returnCode = FileAccess(file);
+	if (returnCode < 0)
+		return returnCode;
+
+	vfdP = &VfdCache[file];
+	Assert(!(vfdP->fdstate & FD_TEMP_FILE_LIMIT));
+
+	for (i = 0; i < iovcnt; i++)
+	{
+		amount += iov[i].iov_len;
+		if (FileBounceBuffer(vfdP, iov[i].iov_base, iov[i].iov_len) !=
+			iov[i].iov_base)
+			aligned = false;
+	}
+
+	if (!aligned)
+	{
+		int			written = 0;
+
+		for (i = 0; i < iovcnt; i++)
+		{
+			returnCode = FileWrite(file, iov[i].iov_base, iov[i].iov_len,
+								   offset + written, wait_event_info);
+			if (returnCode < 0)
+				return written > 0 ? written : returnCode;
+			written += returnCode;
+			if (returnCode != iov[i].iov_len)
+				break;
+		}
+		return written;
+	}
+
+retry:
+	errno = 0;
+	pgstat_report_wait_start(wait_event_info);
+	returnCode = pg_pwritev(VfdCache[file].fd, iov, iovcnt, offset);
+	pgstat_report_wait_end();
+
+	/* if write didn't set errno, assume problem is no disk space */
+	if (returnCode != amount && errno == 0)
+		errno = ENOSPC;
+
+	if (returnCode < 0)
+	{
+		/*
+		 * See comments in FileRead()
+		 */
+#ifdef WIN32
+		DWORD		error = GetLastError();
+
+		switch (error)
+		{
+			case ERROR_NO_SYSTEM_RESOURCES:
+				pg_usleep(1000L);
+				errno = EINTR;
+				break;
+			default:
+				_dosmaperr(error);
+				break;
+		}
+#endif
+		/* OK to retry if interrupted */
+		if (errno == EINTR)
+			goto retry;
+	}
+
+	return returnCode;
+}
+
+/*
+ * FileZero -- write zeroes over a range of a file
+ *
+ * Used to extend files; the zeroes go out PG_IOV_MAX blocks per system call.
+ * Returns 0 on success, or -1 with errno set.
+ */
+int
+FileZero(File file, off_t offset, off_t amount, uint32 wait_event_info)
+{
+	static PGAlignedBlock zbuffer;
+	struct iovec iov[PG_IOV_MAX];
+
+	Assert(FileIsValid(file));
+
+	DO_DB(elog(LOG, "FileZero: %d (%s) " INT64_FORMAT " " INT64_FORMAT,
+			   file, VfdCache[file].fileName,
+			   (int64) offset, (int64) amount));
+
+	while (amount > 0)
+	{
+		off_t		chunk = 0;
+		int			iovcnt = 0;
+		int			written;
+
+		while (iovcnt < PG_IOV_MAX && chunk < amount)
+		{
+			iov[iovcnt].iov_base = zbuffer.data;
+			iov[iovcnt].iov_len = Min(BLCKSZ, amount - chunk);
+			chunk += iov[iovcnt].iov_len;
+			iovcnt++;
+		}
+
+		written = FileWriteV(file, iov, iovcnt, offset, wait_event_info);
+		if (written < 0)
+			return -1;
+		if (written != chunk)
+		{
+			/* as in FileWrite, a short write means no disk space */
+			errno = ENOSPC;
+			return -1;
+		}
+
+		offset += chunk;
+		amount -= chunk;
+	}
+
+	return 0;
+}
+
+/*
+ * FileFallocate -- allocate disk space for a range of a file
+ *
+ * The range reads back as zeroes afterwards.  posix_fallocate() is used
+ * where available, which doesn't write the data out; if the platform or the
+ * filesystem doesn't support that, this falls back to FileZero().  Returns
+ * 0 on success, or -1 with errno set.
+ */
+int
+FileFallocate(File file, off_t offset, off_t amount, uint32 wait_event_info)
+{
+#ifdef HAVE_POSIX_FALLOCATE
+	int			returnCode;
+
+	Assert(FileIsValid(file));
+
+	DO_DB(elog(LOG, "FileFallocate: %d (%s) " INT64_FORMAT " " INT64_FORMAT,
+			   file, VfdCache[file].fileName,
+			   (int64) offset, (int64) amount));
+
+	returnCode = FileAccess(file);
+	if (returnCode < 0)
+		return -1;
+
+retry:
+	pgstat_report_wait_start(wait_event_info);
+	returnCode = posix_fallocate(VfdCache[file].fd, offset, amount);
+	pgstat_report_wait_end();
+
+	if (returnCode == 0)
+		return 0;
+	if (returnCode == EINTR)
+		goto retry;
+
+	/* posix_fallocate() returns the error rather than setting errno */
+	errno = returnCode;
+	if (returnCode != EINVAL && returnCode != EOPNOTSUPP)
+		return -1;
+#endif
+
+	return FileZero(file, offset, amount, wait_event_info);
+}
+
+/*
+ * FileStartRead / FileStartWrite -- start an asynchronous read or write
+ *
+ * These work like FileRead and FileWrite, except that the result is
+ * collected later with pgaio_wait(), and the buffer must not be touched in
+ * the meantime.  Temporary files subject to temp_file_limit can't be written
+ * this way.  If the file was opened with O_DIRECT and the buffer isn't
+ * suitably aligned, the I/O is done synchronously through FileRead or
+ * FileWrite, which know how to handle that.
+ */
+PgAioHandle *
+FileStartRead(File file, char *buffer, int amount, off_t offset,
+			  uint32 wait_event_info)
+{
+	int			returnCode;
+	Vfd		   *vfdP;
+
+	Assert(FileIsValid(file));
+
+	DO_DB(elog(LOG, "FileStartRead: %d (%s) " INT64_FORMAT " %d %p",
+			   file, VfdCache[file].fileName,
+			   (int64) offset,
+			   amount, buffer));
+
+	returnCode = FileAccess(file);
+	if (returnCode < 0)
+		return pgaio_completed_io(-1, errno);
+
+	vfdP = &VfdCache[file];
+
+	if (FileBounceBuffer(vfdP, buffer, amount) != buffer)
+	{
+		returnCode = FileRead(file, buffer, amount, offset, wait_event_info);
+		return pgaio_completed_io(returnCode, errno);
+	}
+
+	return pgaio_start_io(false, vfdP->fd, vfdP->fileName, vfdP->fileFlags,
+						  vfdP->fileMode, buffer, amount, offset,
+						  wait_event_info);
+}
+
+PgAioHandle *
+FileStartWrite(File file, char *buffer, int amount, off_t offset,
+			   uint32 wait_event_info)
+{
+	int			returnCode;
+	Vfd		   *vfdP;
+
+	Assert(FileIsValid(file));
+
+	DO_DB(elog(LOG, "FileStartWrite: %d (%s) " INT64_FORMAT " %d %p",
+			   file, VfdCache[file].fileName,
+			   (int64) offset,
+			   amount, buffer));
+
+	returnCode = FileAccess(file);
+	if (returnCode < 0)
+		return pgaio_completed_io(-1, errno);
+
+	vfdP = &VfdCache[file];
+	Assert(!(vfdP->fdstate & FD_TEMP_FILE_LIMIT));
+
+	if (FileBounceBuffer(vfdP, buffer, amount) != buffer)
+	{
+		returnCode = FileWrite(file, buffer, amount, offset, wait_event_info);
+		return pgaio_completed_io(returnCode, errno);
+	}
+
+	return pgaio_start_io(true, vfdP->fd, vfdP->fileName, vfdP->fileFlags,
+						  vfdP->fileMode, buffer, amount, offset,
+						  wait_event_info);
+}
+
+/*
+ * FileBounceBuffer -- get a buffer suitable for direct I/O
+ *
+ * Returns buffer itself, unless the file was opened with O_DIRECT and buffer
+ * isn't aligned to PG_IO_ALIGN_SIZE; then an aligned buffer of at least
+ * amount bytes is returned, which is good until the next call.  Shared
+ * buffers are always aligned, but pages built in private memory (by index
+ * builds and the like) are not.
+ */
+static char *
+FileBounceBuffer(Vfd *vfdP, char *buffer, int amount)
+{
+	static char *bounce = NULL;
+	static int	bounce_size = 0;
+
+	if (!(vfdP->fileFlags & PG_O_DIRECT) ||
+		(uintptr_t) buffer % PG_IO_ALIGN_SIZE == 0)
+		return buffer;
+
+	if (amount > bounce_size)
+	{
+		if (bounce != NULL)
+			pfree(bounce);
+		bounce_size = Max(amount, BLCKSZ);
+		bounce = MemoryContextAlloc(TopMemoryContext,
+									bounce_size + PG_IO_ALIGN_SIZE);
+	}
+
+	return (char *) TYPEALIGN(PG_IO_ALIGN_SIZE, bounce);
+}
+
 int
 FileSync(File file, uint32 wait_event_info)
 {
@@ -136,6 +136,40 @@ GetPageWithFreeSpace(Relation rel, Size spaceNeeded)
 	return fsm_search(rel, min_cat);
 }
 
+/*
+ * GetPageWithFreeSpaceNear - like GetPageWithFreeSpace, but prefer a page
+ *		close to nearPage.
+ *
+ * Only the bottom-level FSM page covering nearPage is searched for a close
+ * page; if it has none with enough free space, we search as usual.
+ */
+BlockNumber
+GetPageWithFreeSpaceNear(Relation rel, BlockNumber nearPage,
+						 Size spaceNeeded)
+{
+	uint8		min_cat = fsm_space_needed_to_cat(spaceNeeded);
+	FSMAddress	addr;
+	uint16		slot;
+	Buffer		buf;
+	int			search_slot = -1;
+
+	/* Get the location of the FSM byte representing the heap block */
+	addr = fsm_get_location(nearPage, &slot);
+
+	buf = fsm_readbuf(rel, addr, false);
+	if (BufferIsValid(buf))
+	{
+		LockBuffer(buf, BUFFER_LOCK_SHARE);
+		search_slot = fsm_search_avail_near(buf, slot, min_cat);
+		UnlockReleaseBuffer(buf);
+	}
+
+	if (search_slot != -1)
+		return fsm_get_heap_blk(addr, search_slot);
+	else
+		return fsm_search(rel, min_cat);
+}
+
 /*
  * RecordAndGetPageWithFreeSpace - update info about a page and try again.
  *
@@ -305,6 +305,80 @@ restart:
 	return slot;
 }
 
+/*
+ * Searches for a slot with category at least minvalue, close to the given
+ * slot.  Returns slot number, or -1 if none found.
+ *
+ * We climb the tree from the given slot, and at each level check the
+ * subtree on the other side of our parent before moving further up.  The
+ * first such subtree with enough space is descended, preferring the side
+ * that faces the start slot.  The result is thus always within the smallest
+ * subtree that contains both the start slot and a suitable slot, although
+ * not necessarily the closest suitable slot.  Unlike fsm_search_avail, this
+ * doesn't touch fp_next_slot, since spreading the load isn't the point.
+ *
+ * The caller must hold at least a shared lock on the page.  If the page
+ * turns out to be inconsistent, -1 is returned and it's left to a regular
+ * search to fix it.
+ */
+int
+fsm_search_avail_near(Buffer buf, int slot, uint8 minvalue)
+{
+	Page		page = BufferGetPage(buf);
+	FSMPage		fsmpage = (FSMPage) PageGetContents(page);
+	bool		prefer_left = true;
+	int			nodeno;
+
+	Assert(slot >= 0 && slot < LeafNodesPerPage);
+
+	/* Exit quickly if there's no leaf with enough free space. */
+	if (fsmpage->fp_nodes[0] < minvalue)
+		return -1;
+
+	nodeno = NonLeafNodesPerPage + slot;
+	if (fsmpage->fp_nodes[nodeno] >= minvalue)
+		return slot;
+
+	/* Climb until the sibling subtree has enough free space. */
+	while (nodeno > 0)
+	{
+		int			sibling = (nodeno % 2 == 1) ? nodeno + 1 : nodeno - 1;
+
+		if (sibling < NodesPerPage && fsmpage->fp_nodes[sibling] >= minvalue)
+		{
+			prefer_left = (sibling > nodeno);
+			nodeno = sibling;
+			break;
+		}
+		nodeno = parentof(nodeno);
+	}
+
+	/* The root promised space, but none of the subtrees has it. */
+	if (nodeno == 0)
+		return -1;
+
+	/* Descend to the bottom, staying as close to the start as possible. */
+	while (nodeno < NonLeafNodesPerPage)
+	{
+		int			nearchild,
+					farchild;
+
+		nearchild = prefer_left ? leftchild(nodeno) : rightchild(nodeno);
+		farchild = prefer_left ? rightchild(nodeno) : leftchild(nodeno);
+
+		if (nearchild < NodesPerPage &&
+			fsmpage->fp_nodes[nearchild] >= minvalue)
+			nodeno = nearchild;
+		else if (farchild < NodesPerPage &&
+				 fsmpage->fp_nodes[farchild] >= minvalue)
+			nodeno = farchild;
+		else
+			return -1;
+	}
+
+	return nodeno - NonLeafNodesPerPage;
+}
+
 /*
  * Sets the available space to zero for all slots numbered >= nslots.
  * Returns true if the page was modified.
@@ -16,26 +16,37 @@
 
 #include "access/clog.h"
 #include "access/commit_ts.h"
+#include "access/discardworker.h"
 #include "access/heapam.h"
 #include "access/multixact.h"
 #include "access/nbtree.h"
+#include "access/parallel.h"
 #include "access/subtrans.h"
 #include "access/twophase.h"
+#include "access/undocache.h"
 #include "access/undolog.h"
 #include "access/undorequest.h"
+#include "access/xlogprefetch.h"
 #include "access/undoworker.h"
+#include "access/zfreepages.h"
+#include "access/zkeysharelock.h"
+#include "access/zmultilocker.h"
+#include "access/zspectoken.h"
 #include "commands/async.h"
+#include "commands/sequence.h"
 #include "miscadmin.h"
 #include "pgstat.h"
 #include "postmaster/autovacuum.h"
 #include "postmaster/bgworker_internals.h"
 #include "postmaster/bgwriter.h"
 #include "postmaster/postmaster.h"
+#include "postmaster/walsummarizer.h"
 #include "replication/logicallauncher.h"
 #include "replication/slot.h"
 #include "replication/walreceiver.h"
 #include "replication/walsender.h"
 #include "replication/origin.h"
+#include "storage/aio.h"
 #include "storage/bufmgr.h"
 #include "storage/dsm.h"
 #include "storage/ipc.h"
@@ -46,7 +57,9 @@
 #include "storage/procarray.h"
 #include "storage/procsignal.h"
 #include "storage/sinvaladt.h"
+#include "storage/smgr.h"
 #include "storage/spin.h"
+#include "utils/sharedplancache.h"
 #include "utils/snapmgr.h"
 
 /* GUCs */
@@ -127,14 +140,22 @@ CreateSharedMemoryAndSemaphores(int port)
 		size = add_size(size, PredicateLockShmemSize());
 		size = add_size(size, ProcGlobalShmemSize());
 		size = add_size(size, XLOGShmemSize());
+		size = add_size(size, XLogPrefetchShmemSize());
 		size = add_size(size, CLOGShmemSize());
 		size = add_size(size, UndoLogShmemSize());
+		size = add_size(size, UndoRecordCacheShmemSize());
+		size = add_size(size, ZHeapKeyShareLockShmemSize());
+		size = add_size(size, ZMultiLockCacheShmemSize());
+		size = add_size(size, ZHeapSpecTokenShmemSize());
+		size = add_size(size, ZHeapFreedPagesShmemSize());
 		size = add_size(size, CommitTsShmemSize());
 		size = add_size(size, SUBTRANSShmemSize());
 		size = add_size(size, TwoPhaseShmemSize());
 		size = add_size(size, BackgroundWorkerShmemSize());
+		size = add_size(size, ParallelWorkerPoolShmemSize());
 		size = add_size(size, MultiXactShmemSize());
 		size = add_size(size, LWLockShmemSize());
+		size = add_size(size, LWLockStatsShmemSize());
 		size = add_size(size, ProcArrayShmemSize());
 		size = add_size(size, BackendStatusShmemSize());
 		size = add_size(size, SInvalShmemSize());
@@ -146,6 +167,7 @@ CreateSharedMemoryAndSemaphores(int port)
 		size = add_size(size, ReplicationOriginShmemSize());
 		size = add_size(size, WalSndShmemSize());
 		size = add_size(size, WalRcvShmemSize());
+		size = add_size(size, WalSummarizerShmemSize());
 		size = add_size(size, ApplyLauncherShmemSize());
 		size = add_size(size, SnapMgrShmemSize());
 		size = add_size(size, BTreeShmemSize());
@@ -153,6 +175,12 @@ CreateSharedMemoryAndSemaphores(int port)
 		size = add_size(size, AsyncShmemSize());
 		size = add_size(size, PendingUndoShmemSize());
 		size = add_size(size, UndoLauncherShmemSize());
+		size = add_size(size, DiscardWorkerShmemSize());
+		size = add_size(size, AioShmemSize());
+		size = add_size(size, SMgrSizeShmemSize());
+		size = add_size(size, SharedPlanCacheShmemSize());
+		size = add_size(size, PgStatShmemSize());
+		size = add_size(size, SequenceShmemSize());
 #ifdef EXEC_BACKEND
 		size = add_size(size, ShmemBackendArraySize());
 #endif
@@ -213,13 +241,20 @@ CreateSharedMemoryAndSemaphores(int port)
 	 * Set up shmem.c index hashtable
 	 */
 	InitShmemIndex();
+	LWLockStatsShmemInit();
 
 	/*
 	 * Set up xlog, clog, and buffers
 	 */
 	XLOGShmemInit();
+	XLogPrefetchShmemInit();
 	CLOGShmemInit();
 	UndoLogShmemInit();
+	UndoRecordCacheShmemInit();
+	ZHeapKeyShareLockShmemInit();
+	ZMultiLockCacheShmemInit();
+	ZHeapSpecTokenShmemInit();
+	ZHeapFreedPagesShmemInit();
 	CommitTsShmemInit();
 	SUBTRANSShmemInit();
 	MultiXactShmemInit();
@@ -245,6 +280,7 @@ CreateSharedMemoryAndSemaphores(int port)
 	CreateSharedBackendStatus();
 	TwoPhaseShmemInit();
 	BackgroundWorkerShmemInit();
+	ParallelWorkerPoolShmemInit();
 
 	/*
 	 * Set up shared-inval messaging
@@ -262,8 +298,15 @@ CreateSharedMemoryAndSemaphores(int port)
 	ReplicationOriginShmemInit();
 	WalSndShmemInit();
 	WalRcvShmemInit();
+	WalSummarizerShmemInit();
 	ApplyLauncherShmemInit();
 	UndoLauncherShmemInit();
+	DiscardWorkerShmemInit();
+	AioShmemInit();
+	SMgrSizeShmemInit();
+	SharedPlanCacheShmemInit();
+	PgStatShmemInit();
+	SequenceShmemInit();
 
 	/*
 	 * Set up other modules that need some shared memory space
@@ -850,6 +850,28 @@ shm_mq_get_queue(shm_mq_handle *mqh)
 	return mqh->mqh_queue;
 }
 
+/*
+ * Get the number of bytes written to the queue that the receiver has not yet
+ * consumed.
+ *
+ * The counters are read without a lock, so the result is only a hint; it is
+ * meant for a sender deciding whether the receiver is short of work.  Bytes
+ * the receiver has read but not yet reported are counted as unread, but the
+ * receiver always reports them before it waits for more data.
+ */
+Size
+shm_mq_get_bytes_unread(shm_mq_handle *mqh)
+{
+	shm_mq	   *mq = mqh->mqh_queue;
+	uint64		rb;
+	uint64		wb;
+
+	rb = pg_atomic_read_u64(&mq->mq_bytes_read);
+	wb = pg_atomic_read_u64(&mq->mq_bytes_written);
+
+	return wb > rb ? (Size) (wb - rb) : 0;
+}
+
 /*
  * Write bytes into a shared message queue.
  */
@@ -1287,6 +1287,14 @@ DescribeLockTag(StringInfo buf, const LOCKTAG *tag)
 							 tag->locktag_field2,
 							 tag->locktag_field1);
 			break;
+		case LOCKTAG_APPLY_TRANSACTION:
+			appendStringInfo(buf,
+							 _("remote transaction " UINT64_FORMAT " of subscription %u of database %u"),
+							 ((uint64) tag->locktag_field4 << 32) |
+							 tag->locktag_field3,
+							 tag->locktag_field2,
+							 tag->locktag_field1);
+			break;
 		case LOCKTAG_USERLOCK:
 			/* reserved for old contrib code, now on pgfoundry */
 			appendStringInfo(buf,
@@ -76,17 +76,22 @@
  */
 #include "postgres.h"
 
+#include "funcapi.h"
 #include "miscadmin.h"
 #include "pgstat.h"
 #include "pg_trace.h"
+#include "portability/instr_time.h"
 #include "postmaster/postmaster.h"
 #include "replication/slot.h"
 #include "storage/ipc.h"
 #include "storage/predicate.h"
 #include "storage/proc.h"
 #include "storage/proclist.h"
+#include "storage/shmem.h"
 #include "storage/spin.h"
+#include "utils/builtins.h"
 #include "utils/memutils.h"
+#include "utils/timestamp.h"
 
 #ifdef LWLOCK_STATS
 #include "utils/hsearch.h"
@@ -163,6 +168,82 @@ static void RegisterLWLockTranches(void);
 static inline void LWLockReportWaitStart(LWLock *lock);
 static inline void LWLockReportWaitEnd(void);
 
+/*
+ * Contention statistics, counted per tranche and always enabled.
+ *
+ * Every process has its own set of counters, indexed by pgprocno, which only
+ * that process ever writes; readers add up the counters of all processes.
+ * Counting an acquisition thus costs neither an atomic read-modify-write nor
+ * a cache line shared with other processes.  The counters of a PGPROC are
+ * never cleared, so what a process counted stays around after it exits, and
+ * the next process to use the same PGPROC just adds to it.  Resetting the
+ * statistics remembers the totals at the time of the reset, to be subtracted
+ * from later readings.
+ *
+ * Tranches registered at runtime by extensions all share the last slot.
+ * Wait time is only measured when we actually have to sleep, so it doesn't
+ * add clock reads to uncontended acquisitions.
+ */
+#define LWLOCK_STATS_SLOTS		(LWTRANCHE_FIRST_USER_DEFINED + 1)
+
+typedef struct LWLockTrancheCounters
+{
+	pg_atomic_uint64 acquire_count; /* # of acquisitions */
+	pg_atomic_uint64 contended_count;	/* # of acquisitions that slept */
+	pg_atomic_uint64 spin_delay_count;	/* # of spin delays on wait list */
+	pg_atomic_uint64 wait_time; /* time slept, in microseconds */
+} LWLockTrancheCounters;
+
+typedef struct LWLockTrancheTotals
+{
+	uint64		acquire_count;
+	uint64		contended_count;
+	uint64		spin_delay_count;
+	uint64		wait_time;
+} LWLockTrancheTotals;
+
+typedef struct LWLockStatsControl
+{
+	slock_t		mutex;			/* protects stats_reset and reset_totals */
+	TimestampTz stats_reset;
+	LWLockTrancheTotals reset_totals[LWLOCK_STATS_SLOTS];
+	/* LWLOCK_STATS_SLOTS counters for each PGPROC follow */
+	LWLockTrancheCounters counters[FLEXIBLE_ARRAY_MEMBER];
+} LWLockStatsControl;
+
+static LWLockStatsControl *LWLockStats = NULL;
+
+/* We have counters for regular and auxiliary processes, not prepared xacts */
+#define LWLockStatsProcs()		(MaxBackends + NUM_AUXILIARY_PROCS)
+
+static void LWLockSumCounters(LWLockTrancheTotals *totals);
+
+/*
+ * Get this process's counters for the tranche of a lock, or NULL if we have
+ * no PGPROC to count them for.
+ */
+static inline LWLockTrancheCounters *
+LWLockGetCounters(LWLock *lock)
+{
+	int			slot;
+
+	if (MyProc == NULL || LWLockStats == NULL)
+		return NULL;
+
+	slot = Min(lock->tranche, LWTRANCHE_FIRST_USER_DEFINED);
+	return &LWLockStats->counters[MyProc->pgprocno * LWLOCK_STATS_SLOTS + slot];
+}
+
+/*
+ * Add to one of our own counters.  Nobody else writes it, so a plain read
+ * and write are enough; the read side only needs to see untorn values.
+ */
+static inline void
+LWLockCountAdd(pg_atomic_uint64 *counter, uint64 n)
+{
+	pg_atomic_write_u64(counter, pg_atomic_read_u64(counter) + n);
+}
+
 #ifdef LWLOCK_STATS
 typedef struct lwlock_stats_key
 {
@@ -524,6 +605,22 @@ RegisterLWLockTranches(void)
 	LWLockRegisterTranche(LWTRANCHE_SXACT, "serializable_xact");
 	LWLockRegisterTranche(LWTRANCHE_UNDOLOG, "undo_log");
 	LWLockRegisterTranche(LWTRANCHE_UNDODISCARD, "undo_discard");
+	LWLockRegisterTranche(LWTRANCHE_DISCARD_UPDATE, "undo_discard_update");
+	LWLockRegisterTranche(LWTRANCHE_UNDO_RECORD_CACHE, "undo_record_cache");
+	LWLockRegisterTranche(LWTRANCHE_ROLLBACK_REQUESTS, "rollback_requests");
+	LWLockRegisterTranche(LWTRANCHE_ZHEAP_KEYSHARE_LOCKS,
+						  "zheap_key_share_locks");
+	LWLockRegisterTranche(LWTRANCHE_ZHEAP_MULTILOCKER_CACHE,
+						  "zheap_multilocker_cache");
+	LWLockRegisterTranche(LWTRANCHE_ZHEAP_SPEC_TOKENS, "zheap_spec_tokens");
+	LWLockRegisterTranche(LWTRANCHE_ZHEAP_FREED_PAGES, "zheap_freed_pages");
+	LWLockRegisterTranche(LWTRANCHE_ZHEAP_PARALLEL_REWRITE,
+						  "zheap_parallel_rewrite");
+	LWLockRegisterTranche(LWTRANCHE_SMGR_SIZE, "smgr_size");
+	LWLockRegisterTranche(LWTRANCHE_SHARED_PLAN_CACHE, "shared_plan_cache");
+	LWLockRegisterTranche(LWTRANCHE_PGSTAT_DSA, "pgstat_dsa");
+	LWLockRegisterTranche(LWTRANCHE_PGSTAT_HASH, "pgstat_hash");
+	LWLockRegisterTranche(LWTRANCHE_SEQUENCE_CACHE, "sequence_cache");
 
 	/* Register named tranches. */
 	for (i = 0; i < NamedLWLockTrancheRequests; i++)
@@ -531,6 +628,188 @@ RegisterLWLockTranches(void)
 							  NamedLWLockTrancheArray[i].trancheName);
 }
 
+/*
+ * Compute shmem space needed for LWLock statistics.
+ */
+Size
+LWLockStatsShmemSize(void)
+{
+	Size		size;
+
+	size = offsetof(LWLockStatsControl, counters);
+	size = add_size(size, mul_size(mul_size(LWLockStatsProcs(),
+											LWLOCK_STATS_SLOTS),
+								   sizeof(LWLockTrancheCounters)));
+
+	return size;
+}
+
+/*
+ * Allocate and initialize shmem space for LWLock statistics.
+ */
+void
+LWLockStatsShmemInit(void)
+{
+	bool		found;
+	int			ncounters;
+	int			i;
+
+	LWLockStats = (LWLockStatsControl *)
+		ShmemInitStruct("LWLock Statistics", LWLockStatsShmemSize(), &found);
+
+	if (!found)
+	{
+		SpinLockInit(&LWLockStats->mutex);
+		LWLockStats->stats_reset = GetCurrentTimestamp();
+		memset(LWLockStats->reset_totals, 0,
+			   sizeof(LWLockStats->reset_totals));
+
+		ncounters = LWLockStatsProcs() * LWLOCK_STATS_SLOTS;
+		for (i = 0; i < ncounters; i++)
+		{
+			LWLockTrancheCounters *counters = &LWLockStats->counters[i];
+
+			pg_atomic_init_u64(&counters->acquire_count, 0);
+			pg_atomic_init_u64(&counters->contended_count, 0);
+			pg_atomic_init_u64(&counters->spin_delay_count, 0);
+			pg_atomic_init_u64(&counters->wait_time, 0);
+		}
+	}
+}
+
+/*
+ * Add up the counters of all processes, for every tranche.
+ */
+static void
+LWLockSumCounters(LWLockTrancheTotals *totals)
+{
+	int			nprocs = LWLockStatsProcs();
+	int			procno;
+	int			slot;
+
+	memset(totals, 0, sizeof(LWLockTrancheTotals) * LWLOCK_STATS_SLOTS);
+
+	for (procno = 0; procno < nprocs; procno++)
+	{
+		LWLockTrancheCounters *counters;
+
+		counters = &LWLockStats->counters[procno * LWLOCK_STATS_SLOTS];
+		for (slot = 0; slot < LWLOCK_STATS_SLOTS; slot++)
+		{
+			totals[slot].acquire_count +=
+				pg_atomic_read_u64(&counters[slot].acquire_count);
+			totals[slot].contended_count +=
+				pg_atomic_read_u64(&counters[slot].contended_count);
+			totals[slot].spin_delay_count +=
+				pg_atomic_read_u64(&counters[slot].spin_delay_count);
+			totals[slot].wait_time +=
+				pg_atomic_read_u64(&counters[slot].wait_time);
+		}
+	}
+}
+
+/*
+ * Reset the LWLock statistics, by remembering the current totals.
+ */
+void
+LWLockResetStats(void)
+{
+	LWLockTrancheTotals totals[LWLOCK_STATS_SLOTS];
+
+	LWLockSumCounters(totals);
+
+	SpinLockAcquire(&LWLockStats->mutex);
+	memcpy(LWLockStats->reset_totals, totals, sizeof(totals));
+	LWLockStats->stats_reset = GetCurrentTimestamp();
+	SpinLockRelease(&LWLockStats->mutex);
+}
+
+/*
+ * SQL-callable function returning the LWLock statistics of every tranche.
+ */
+Datum
+pg_stat_get_lwlocks(PG_FUNCTION_ARGS)
+{
+#define PG_STAT_GET_LWLOCKS_COLS	6
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+	LWLockTrancheTotals totals[LWLOCK_STATS_SLOTS];
+	LWLockTrancheTotals reset_totals[LWLOCK_STATS_SLOTS];
+	TimestampTz stats_reset;
+	int			slot;
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not " \
+						"allowed in this context")));
+
+	/* Build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	SpinLockAcquire(&LWLockStats->mutex);
+	memcpy(reset_totals, LWLockStats->reset_totals, sizeof(reset_totals));
+	stats_reset = LWLockStats->stats_reset;
+	SpinLockRelease(&LWLockStats->mutex);
+
+	LWLockSumCounters(totals);
+
+	for (slot = 0; slot < LWLOCK_STATS_SLOTS; slot++)
+	{
+		Datum		values[PG_STAT_GET_LWLOCKS_COLS];
+		bool		nulls[PG_STAT_GET_LWLOCKS_COLS];
+		const char *name;
+
+		if (slot == LWTRANCHE_FIRST_USER_DEFINED)
+			name = "extension";
+		else if (slot < LWLockTranchesAllocated &&
+				 LWLockTrancheArray[slot] != NULL &&
+				 LWLockTrancheArray[slot][0] != '<')
+			name = LWLockTrancheArray[slot];
+		else
+			continue;			/* unassigned individual lock */
+
+		MemSet(nulls, 0, sizeof(nulls));
+
+		values[0] = CStringGetTextDatum(name);
+		values[1] = Int64GetDatum(totals[slot].acquire_count -
+								  reset_totals[slot].acquire_count);
+		values[2] = Int64GetDatum(totals[slot].contended_count -
+								  reset_totals[slot].contended_count);
+		values[3] = Int64GetDatum(totals[slot].spin_delay_count -
+								  reset_totals[slot].spin_delay_count);
+		/* convert to msec for output */
+		values[4] = Float8GetDatum((double) (totals[slot].wait_time -
+											 reset_totals[slot].wait_time) / 1000.0);
+		values[5] = TimestampTzGetDatum(stats_reset);
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	tuplestore_donestoring(tupstore);
+
+	return (Datum) 0;
+}
+
 /*
  * InitLWLockAccess - initialize backend-local state needed to hold LWLocks
  */
@@ -813,9 +1092,9 @@ static void
 LWLockWaitListLock(LWLock *lock)
 {
 	uint32		old_state;
+	uint32		delays = 0;
 #ifdef LWLOCK_STATS
 	lwlock_stats *lwstats;
-	uint32		delays = 0;
 
 	lwstats = get_lwlock_stats_entry(lock);
 #endif
@@ -838,9 +1117,7 @@ LWLockWaitListLock(LWLock *lock)
 				perform_spin_delay(&delayStatus);
 				old_state = pg_atomic_read_u32(&lock->state);
 			}
-#ifdef LWLOCK_STATS
 			delays += delayStatus.delays;
-#endif
 			finish_spin_delay(&delayStatus);
 		}
 
@@ -853,6 +1130,14 @@ LWLockWaitListLock(LWLock *lock)
 #ifdef LWLOCK_STATS
 	lwstats->spin_delay_count += delays;
 #endif
+
+	if (delays > 0)
+	{
+		LWLockTrancheCounters *counters = LWLockGetCounters(lock);
+
+		if (counters)
+			LWLockCountAdd(&counters->spin_delay_count, delays);
+	}
 }
 
 /*
@@ -1126,6 +1411,9 @@ LWLockAcquire(LWLock *lock, LWLockMode mode)
 	PGPROC	   *proc = MyProc;
 	bool		result = true;
 	int			extraWaits = 0;
+	LWLockTrancheCounters *counters = LWLockGetCounters(lock);
+	instr_time	wait_start;
+	instr_time	wait_time;
 #ifdef LWLOCK_STATS
 	lwlock_stats *lwstats;
 
@@ -1136,6 +1424,9 @@ LWLockAcquire(LWLock *lock, LWLockMode mode)
 
 	PRINT_LWDEBUG("LWLockAcquire", lock, mode);
 
+	if (counters)
+		LWLockCountAdd(&counters->acquire_count, 1);
+
 #ifdef LWLOCK_STATS
 	/* Count lock acquisition attempts */
 	if (mode == LW_EXCLUSIVE)
@@ -1240,6 +1531,8 @@ LWLockAcquire(LWLock *lock, LWLockMode mode)
 
 		LWLockReportWaitStart(lock);
 		TRACE_POSTGRESQL_LWLOCK_WAIT_START(T_NAME(lock), mode);
+		if (counters)
+			INSTR_TIME_SET_CURRENT(wait_start);
 
 		for (;;)
 		{
@@ -1249,6 +1542,14 @@ LWLockAcquire(LWLock *lock, LWLockMode mode)
 			extraWaits++;
 		}
 
+		if (counters)
+		{
+			INSTR_TIME_SET_CURRENT(wait_time);
+			INSTR_TIME_SUBTRACT(wait_time, wait_start);
+			LWLockCountAdd(&counters->wait_time,
+						   INSTR_TIME_GET_MICROSEC(wait_time));
+		}
+
 		/* Retrying, allow LWLockRelease to release waiters again. */
 		pg_atomic_fetch_or_u32(&lock->state, LW_FLAG_RELEASE_OK);
 
@@ -1272,6 +1573,9 @@ LWLockAcquire(LWLock *lock, LWLockMode mode)
 
 	TRACE_POSTGRESQL_LWLOCK_ACQUIRE(T_NAME(lock), mode);
 
+	if (!result && counters)
+		LWLockCountAdd(&counters->contended_count, 1);
+
 	/* Add lock to list of locks held by this backend */
 	held_lwlocks[num_held_lwlocks].lock = lock;
 	held_lwlocks[num_held_lwlocks++].mode = mode;
@@ -1325,6 +1629,11 @@ LWLockConditionalAcquire(LWLock *lock, LWLockMode mode)
 	}
 	else
 	{
+		LWLockTrancheCounters *counters = LWLockGetCounters(lock);
+
+		if (counters)
+			LWLockCountAdd(&counters->acquire_count, 1);
+
 		/* Add lock to list of locks held by this backend */
 		held_lwlocks[num_held_lwlocks].lock = lock;
 		held_lwlocks[num_held_lwlocks++].mode = mode;
@@ -1353,6 +1662,9 @@ LWLockAcquireOrWait(LWLock *lock, LWLockMode mode)
 	PGPROC	   *proc = MyProc;
 	bool		mustwait;
 	int			extraWaits = 0;
+	LWLockTrancheCounters *counters = LWLockGetCounters(lock);
+	instr_time	wait_start;
+	instr_time	wait_time;
 #ifdef LWLOCK_STATS
 	lwlock_stats *lwstats;
 
@@ -1401,6 +1713,8 @@ LWLockAcquireOrWait(LWLock *lock, LWLockMode mode)
 
 			LWLockReportWaitStart(lock);
 			TRACE_POSTGRESQL_LWLOCK_WAIT_START(T_NAME(lock), mode);
+			if (counters)
+				INSTR_TIME_SET_CURRENT(wait_start);
 
 			for (;;)
 			{
@@ -1410,6 +1724,15 @@ LWLockAcquireOrWait(LWLock *lock, LWLockMode mode)
 				extraWaits++;
 			}
 
+			if (counters)
+			{
+				INSTR_TIME_SET_CURRENT(wait_time);
+				INSTR_TIME_SUBTRACT(wait_time, wait_start);
+				LWLockCountAdd(&counters->wait_time,
+							   INSTR_TIME_GET_MICROSEC(wait_time));
+				LWLockCountAdd(&counters->contended_count, 1);
+			}
+
 #ifdef LOCK_DEBUG
 			{
 				/* not waiting anymore */
@@ -1453,6 +1776,8 @@ LWLockAcquireOrWait(LWLock *lock, LWLockMode mode)
 	else
 	{
 		LOG_LWDEBUG("LWLockAcquireOrWait", lock, "succeeded");
+		if (counters)
+			LWLockCountAdd(&counters->acquire_count, 1);
 		/* Add lock to list of locks held by this backend */
 		held_lwlocks[num_held_lwlocks].lock = lock;
 		held_lwlocks[num_held_lwlocks++].mode = mode;
@@ -1537,6 +1862,10 @@ LWLockWaitForVar(LWLock *lock, uint64 *valptr, uint64 oldval, uint64 *newval)
 	PGPROC	   *proc = MyProc;
 	int			extraWaits = 0;
 	bool		result = false;
+	bool		waited = false;
+	LWLockTrancheCounters *counters = LWLockGetCounters(lock);
+	instr_time	wait_start;
+	instr_time	wait_time;
 #ifdef LWLOCK_STATS
 	lwlock_stats *lwstats;
 
@@ -1617,6 +1946,8 @@ LWLockWaitForVar(LWLock *lock, uint64 *valptr, uint64 oldval, uint64 *newval)
 
 		LWLockReportWaitStart(lock);
 		TRACE_POSTGRESQL_LWLOCK_WAIT_START(T_NAME(lock), LW_EXCLUSIVE);
+		if (counters)
+			INSTR_TIME_SET_CURRENT(wait_start);
 
 		for (;;)
 		{
@@ -1626,6 +1957,15 @@ LWLockWaitForVar(LWLock *lock, uint64 *valptr, uint64 oldval, uint64 *newval)
 			extraWaits++;
 		}
 
+		if (counters)
+		{
+			INSTR_TIME_SET_CURRENT(wait_time);
+			INSTR_TIME_SUBTRACT(wait_time, wait_start);
+			LWLockCountAdd(&counters->wait_time,
+						   INSTR_TIME_GET_MICROSEC(wait_time));
+		}
+		waited = true;
+
 #ifdef LOCK_DEBUG
 		{
 			/* not waiting anymore */
@@ -1645,6 +1985,9 @@ LWLockWaitForVar(LWLock *lock, uint64 *valptr, uint64 oldval, uint64 *newval)
 
 	TRACE_POSTGRESQL_LWLOCK_ACQUIRE(T_NAME(lock), LW_EXCLUSIVE);
 
+	if (waited && counters)
+		LWLockCountAdd(&counters->contended_count, 1);
+
 	/*
 	 * Fix the process wait semaphore's count for any absorbed wakeups.
 	 */
@@ -1870,3 +2213,15 @@ LWLockHeldByMeInMode(LWLock *l, LWLockMode mode)
 	}
 	return false;
 }
+
+/*
+ * LWLockHeldExclusive - test whether any process holds a lock exclusively
+ *
+ * The answer may be out of date as soon as it's returned, so callers need a
+ * way of their own to notice the lock being acquired afterwards.
+ */
+bool
+LWLockHeldExclusive(LWLock *l)
+{
+	return (pg_atomic_read_u32(&l->state) & LW_VAL_EXCLUSIVE) != 0;
+}
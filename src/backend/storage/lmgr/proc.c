@@ -119,6 +119,11 @@ ProcGlobalShmemSize(void)
 	size = add_size(size, mul_size(NUM_AUXILIARY_PROCS, sizeof(PGXACT)));
 	size = add_size(size, mul_size(max_prepared_xacts, sizeof(PGXACT)));
 
+	/* fast-path lock arrays of all PGPROCs */
+	size = add_size(size, mul_size(MaxBackends + NUM_AUXILIARY_PROCS +
+								   max_prepared_xacts,
+								   FastPathLockShmemSizePerProc()));
+
 	return size;
 }
 
@@ -165,6 +170,7 @@ InitProcGlobal(void)
 {
 	PGPROC	   *procs;
 	PGXACT	   *pgxacts;
+	char	   *fpPtr;
 	int			i,
 				j;
 	bool		found;
@@ -217,10 +223,24 @@ InitProcGlobal(void)
 	MemSet(pgxacts, 0, TotalProcs * sizeof(PGXACT));
 	ProcGlobal->allPgXact = pgxacts;
 
+	/*
+	 * The fast-path lock arrays are sized at startup from
+	 * max_locks_per_transaction, so they can't be embedded in PGPROC.  Carve
+	 * them out of one chunk; the lock bits come first in each proc's share to
+	 * keep them 8-byte aligned.
+	 */
+	fpPtr = (char *) ShmemAlloc(TotalProcs * FastPathLockShmemSizePerProc());
+	MemSet(fpPtr, 0, TotalProcs * FastPathLockShmemSizePerProc());
+
 	for (i = 0; i < TotalProcs; i++)
 	{
 		/* Common initialization for all PGPROCs, regardless of type. */
 
+		procs[i].fpLockBits = (uint64 *) fpPtr;
+		fpPtr += MAXALIGN(FastPathLockGroupsPerBackend * sizeof(uint64));
+		procs[i].fpRelId = (Oid *) fpPtr;
+		fpPtr += MAXALIGN(FastPathLockSlotsPerBackend() * sizeof(Oid));
+
 		/*
 		 * Set up per-PGPROC semaphore, latch, and backendLock. Prepared xact
 		 * dummy PGPROCs don't need these though - they're never associated
@@ -298,6 +318,7 @@ InitProcGlobal(void)
 	SpinLockInit(ProcStructLock);
 
 	pg_atomic_init_u64(&ProcGlobal->oldestXidWithEpochHavingUndo, 0);
+	pg_atomic_init_u64(&ProcGlobal->undoRetentionHorizon, 0);
 }
 
 /*
@@ -1916,3 +1937,36 @@ BecomeLockGroupMember(PGPROC *leader, int pid)
 
 	return ok;
 }
+
+/*
+ * LeaveLockGroup - stop being a member of a lock group
+ *
+ * This is for a parallel worker that is kept for reuse after finishing its
+ * work for a leader; the caller must not hold any locks.  If we are the last
+ * member, the leader has already exited and its PGPROC can only be returned
+ * to the free list by ProcKill, so we stay in the group and return false; the
+ * caller should then exit.  Otherwise returns true.
+ */
+bool
+LeaveLockGroup(void)
+{
+	PGPROC	   *leader = MyProc->lockGroupLeader;
+	LWLock	   *leader_lwlock;
+	bool		ok = false;
+
+	/* Must be a member of some other process's group */
+	Assert(leader != NULL && leader != MyProc);
+
+	leader_lwlock = LockHashPartitionLockByProc(leader);
+	LWLockAcquire(leader_lwlock, LW_EXCLUSIVE);
+	if (dlist_has_next(&leader->lockGroupMembers, &MyProc->lockGroupLink) ||
+		dlist_has_prev(&leader->lockGroupMembers, &MyProc->lockGroupLink))
+	{
+		ok = true;
+		dlist_delete(&MyProc->lockGroupLink);
+		MyProc->lockGroupLeader = NULL;
+	}
+	LWLockRelease(leader_lwlock);
+
+	return ok;
+}
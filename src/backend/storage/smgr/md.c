@@ -134,10 +134,17 @@ static char *_mdfd_segpath(SMgrRelation reln, ForkNumber forknum,
 						   BlockNumber segno);
 static MdfdVec *_mdfd_openseg(SMgrRelation reln, ForkNumber forkno,
 							  BlockNumber segno, int oflags);
+static int	_mdfd_direct_flag(SMgrRelation reln);
 static MdfdVec *_mdfd_getseg(SMgrRelation reln, ForkNumber forkno,
 							 BlockNumber blkno, bool skipFsync, int behavior);
 static BlockNumber _mdnblocks(SMgrRelation reln, ForkNumber forknum,
 							  MdfdVec *seg);
+static void md_read_done(SMgrRelation reln, ForkNumber forknum,
+						 BlockNumber blocknum, char *buffer, MdfdVec *v,
+						 int nbytes);
+static void md_write_done(SMgrRelation reln, ForkNumber forknum,
+						  BlockNumber blocknum, bool skipFsync, MdfdVec *v,
+						  int nbytes);
 
 
 /*
@@ -187,14 +194,16 @@ mdcreate(SMgrRelation reln, ForkNumber forkNum, bool isRedo)
 
 	path = relpath(reln->smgr_rnode, forkNum);
 
-	fd = PathNameOpenFile(path, O_RDWR | O_CREAT | O_EXCL | PG_BINARY);
+	fd = PathNameOpenFile(path, O_RDWR | O_CREAT | O_EXCL | PG_BINARY |
+						  _mdfd_direct_flag(reln));
 
 	if (fd < 0)
 	{
 		int			save_errno = errno;
 
 		if (isRedo)
-			fd = PathNameOpenFile(path, O_RDWR | PG_BINARY);
+			fd = PathNameOpenFile(path, O_RDWR | PG_BINARY |
+								  _mdfd_direct_flag(reln));
 		if (fd < 0)
 		{
 			/* be sure to report the error reported by create, not open */
@@ -424,6 +433,85 @@ mdextend(SMgrRelation reln, ForkNumber forknum, BlockNumber blocknum,
 	Assert(_mdnblocks(reln, forknum, v) <= ((BlockNumber) RELSEG_SIZE));
 }
 
+/*
+ *	mdzeroextend() -- Add nblocks new, zero-filled blocks to the specified
+ *					  relation, starting at blocknum.
+ *
+ *		The new blocks read back as new pages.  Space for larger runs is
+ *		allocated with FileFallocate(), sparing the write of the zeroes;
+ *		for a few blocks that isn't worth a separate system call on some
+ *		filesystems, so they are simply written.
+ */
+void
+mdzeroextend(SMgrRelation reln, ForkNumber forknum, BlockNumber blocknum,
+			 int nblocks, bool skipFsync)
+{
+	MdfdVec    *v;
+	BlockNumber curblocknum = blocknum;
+	int			remblocks = nblocks;
+
+	Assert(nblocks > 0);
+
+	/* This assert is too expensive to have on normally ... */
+#ifdef CHECK_WRITE_VS_EXTEND
+	Assert(blocknum >= mdnblocks(reln, forknum));
+#endif
+
+	/*
+	 * If a relation manages to grow to 2^32-1 blocks, refuse to extend it any
+	 * more --- we mustn't create a block whose number actually is
+	 * InvalidBlockNumber.
+	 */
+	if ((uint64) blocknum + nblocks >= (uint64) InvalidBlockNumber)
+		ereport(ERROR,
+				(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+				 errmsg("cannot extend file \"%s\" beyond %u blocks",
+						relpath(reln->smgr_rnode, forknum),
+						InvalidBlockNumber)));
+
+	while (remblocks > 0)
+	{
+		BlockNumber segstartblock = curblocknum % ((BlockNumber) RELSEG_SIZE);
+		off_t		seekpos = (off_t) BLCKSZ * segstartblock;
+		int			numblocks;
+		int			ret;
+
+		/* Don't cross a segment boundary */
+		if (segstartblock + remblocks > RELSEG_SIZE)
+			numblocks = RELSEG_SIZE - segstartblock;
+		else
+			numblocks = remblocks;
+
+		v = _mdfd_getseg(reln, forknum, curblocknum, skipFsync, EXTENSION_CREATE);
+
+		Assert(segstartblock < RELSEG_SIZE);
+		Assert(segstartblock + numblocks <= RELSEG_SIZE);
+
+		if (numblocks > 8)
+			ret = FileFallocate(v->mdfd_vfd, seekpos,
+								(off_t) BLCKSZ * numblocks,
+								WAIT_EVENT_DATA_FILE_EXTEND);
+		else
+			ret = FileZero(v->mdfd_vfd, seekpos,
+						   (off_t) BLCKSZ * numblocks,
+						   WAIT_EVENT_DATA_FILE_EXTEND);
+		if (ret != 0)
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not extend file \"%s\": %m",
+							FilePathName(v->mdfd_vfd)),
+					 errhint("Check free disk space.")));
+
+		if (!skipFsync && !SmgrIsTemp(reln))
+			register_dirty_segment(reln, forknum, v);
+
+		Assert(_mdnblocks(reln, forknum, v) <= ((BlockNumber) RELSEG_SIZE));
+
+		remblocks -= numblocks;
+		curblocknum += numblocks;
+	}
+}
+
 /*
  *	mdopen() -- Open the specified relation.
  *
@@ -447,7 +535,7 @@ mdopen(SMgrRelation reln, ForkNumber forknum, int behavior)
 
 	path = relpath(reln->smgr_rnode, forknum);
 
-	fd = PathNameOpenFile(path, O_RDWR | PG_BINARY);
+	fd = PathNameOpenFile(path, O_RDWR | PG_BINARY | _mdfd_direct_flag(reln));
 
 	if (fd < 0)
 	{
@@ -603,6 +691,65 @@ mdread(SMgrRelation reln, ForkNumber forknum, BlockNumber blocknum,
 
 	nbytes = FileRead(v->mdfd_vfd, buffer, BLCKSZ, seekpos, WAIT_EVENT_DATA_FILE_READ);
 
+	md_read_done(reln, forknum, blocknum, buffer, v, nbytes);
+}
+
+/*
+ *	mdstartread() -- Start reading the specified block of a relation.
+ *
+ *		The buffer must stay untouched until mdfinishread() is called with
+ *		the returned handle.
+ */
+PgAioHandle *
+mdstartread(SMgrRelation reln, ForkNumber forknum, BlockNumber blocknum,
+			char *buffer)
+{
+	off_t		seekpos;
+	MdfdVec    *v;
+
+	TRACE_POSTGRESQL_SMGR_MD_READ_START(forknum, blocknum,
+										reln->smgr_rnode.node.spcNode,
+										reln->smgr_rnode.node.dbNode,
+										reln->smgr_rnode.node.relNode,
+										reln->smgr_rnode.backend);
+
+	v = _mdfd_getseg(reln, forknum, blocknum, false,
+					 EXTENSION_FAIL | EXTENSION_CREATE_RECOVERY);
+
+	seekpos = (off_t) BLCKSZ * (blocknum % ((BlockNumber) RELSEG_SIZE));
+
+	Assert(seekpos < (off_t) BLCKSZ * RELSEG_SIZE);
+
+	return FileStartRead(v->mdfd_vfd, buffer, BLCKSZ, seekpos,
+						 WAIT_EVENT_DATA_FILE_READ);
+}
+
+/*
+ *	mdfinishread() -- Wait for a read started by mdstartread().
+ */
+void
+mdfinishread(SMgrRelation reln, ForkNumber forknum, BlockNumber blocknum,
+			 char *buffer, PgAioHandle *io)
+{
+	int			nbytes;
+	MdfdVec    *v;
+
+	nbytes = pgaio_wait(io);
+
+	/* The segment was opened at start, so this only looks it up */
+	v = _mdfd_getseg(reln, forknum, blocknum, false,
+					 EXTENSION_FAIL | EXTENSION_CREATE_RECOVERY);
+
+	md_read_done(reln, forknum, blocknum, buffer, v, nbytes);
+}
+
+/*
+ * md_read_done -- report the outcome of reading a block
+ */
+static void
+md_read_done(SMgrRelation reln, ForkNumber forknum, BlockNumber blocknum,
+			 char *buffer, MdfdVec *v, int nbytes)
+{
 	TRACE_POSTGRESQL_SMGR_MD_READ_DONE(forknum, blocknum,
 									   reln->smgr_rnode.node.spcNode,
 									   reln->smgr_rnode.node.dbNode,
@@ -673,6 +820,146 @@ mdwrite(SMgrRelation reln, ForkNumber forknum, BlockNumber blocknum,
 
 	nbytes = FileWrite(v->mdfd_vfd, buffer, BLCKSZ, seekpos, WAIT_EVENT_DATA_FILE_WRITE);
 
+	md_write_done(reln, forknum, blocknum, skipFsync, v, nbytes);
+}
+
+/*
+ *	mdwritev() -- Write the supplied blocks, which are consecutive blocks of
+ *				  the relation starting at blocknum.
+ *
+ *		The same rules as for mdwrite() apply.  Runs are split at segment
+ *		boundaries, and each piece is written with one FileWriteV call.
+ */
+void
+mdwritev(SMgrRelation reln, ForkNumber forknum, BlockNumber blocknum,
+		 char **buffers, int nblocks, bool skipFsync)
+{
+	struct iovec iov[PG_IOV_MAX];
+
+	while (nblocks > 0)
+	{
+		off_t		seekpos;
+		int			nbytes;
+		int			nthis;
+		int			i;
+		MdfdVec    *v;
+
+		/* This assert is too expensive to have on normally ... */
+#ifdef CHECK_WRITE_VS_EXTEND
+		Assert(blocknum + nblocks - 1 < mdnblocks(reln, forknum));
+#endif
+
+		TRACE_POSTGRESQL_SMGR_MD_WRITE_START(forknum, blocknum,
+											 reln->smgr_rnode.node.spcNode,
+											 reln->smgr_rnode.node.dbNode,
+											 reln->smgr_rnode.node.relNode,
+											 reln->smgr_rnode.backend);
+
+		v = _mdfd_getseg(reln, forknum, blocknum, skipFsync,
+						 EXTENSION_FAIL | EXTENSION_CREATE_RECOVERY);
+
+		seekpos = (off_t) BLCKSZ * (blocknum % ((BlockNumber) RELSEG_SIZE));
+
+		Assert(seekpos < (off_t) BLCKSZ * RELSEG_SIZE);
+
+		nthis = Min(nblocks, PG_IOV_MAX);
+		nthis = Min(nthis, RELSEG_SIZE - blocknum % ((BlockNumber) RELSEG_SIZE));
+		for (i = 0; i < nthis; i++)
+		{
+			iov[i].iov_base = buffers[i];
+			iov[i].iov_len = BLCKSZ;
+		}
+
+		nbytes = FileWriteV(v->mdfd_vfd, iov, nthis, seekpos,
+							WAIT_EVENT_DATA_FILE_WRITE);
+
+		/* On failure, complain about the first block that didn't make it */
+		if (nbytes < 0)
+			md_write_done(reln, forknum, blocknum, skipFsync, v, nbytes);
+		else if (nbytes != nthis * BLCKSZ)
+			md_write_done(reln, forknum, blocknum + nbytes / BLCKSZ,
+						  skipFsync, v, nbytes % BLCKSZ);
+
+		TRACE_POSTGRESQL_SMGR_MD_WRITE_DONE(forknum, blocknum,
+											reln->smgr_rnode.node.spcNode,
+											reln->smgr_rnode.node.dbNode,
+											reln->smgr_rnode.node.relNode,
+											reln->smgr_rnode.backend,
+											nbytes,
+											nthis * BLCKSZ);
+
+		if (!skipFsync && !SmgrIsTemp(reln))
+			register_dirty_segment(reln, forknum, v);
+
+		blocknum += nthis;
+		buffers += nthis;
+		nblocks -= nthis;
+	}
+}
+
+/*
+ *	mdstartwrite() -- Start writing the supplied block.
+ *
+ *		The same rules as for mdwrite() apply.  The buffer must stay
+ *		untouched until mdfinishwrite() is called with the returned handle.
+ */
+PgAioHandle *
+mdstartwrite(SMgrRelation reln, ForkNumber forknum, BlockNumber blocknum,
+			 char *buffer, bool skipFsync)
+{
+	off_t		seekpos;
+	MdfdVec    *v;
+
+	/* This assert is too expensive to have on normally ... */
+#ifdef CHECK_WRITE_VS_EXTEND
+	Assert(blocknum < mdnblocks(reln, forknum));
+#endif
+
+	TRACE_POSTGRESQL_SMGR_MD_WRITE_START(forknum, blocknum,
+										 reln->smgr_rnode.node.spcNode,
+										 reln->smgr_rnode.node.dbNode,
+										 reln->smgr_rnode.node.relNode,
+										 reln->smgr_rnode.backend);
+
+	v = _mdfd_getseg(reln, forknum, blocknum, skipFsync,
+					 EXTENSION_FAIL | EXTENSION_CREATE_RECOVERY);
+
+	seekpos = (off_t) BLCKSZ * (blocknum % ((BlockNumber) RELSEG_SIZE));
+
+	Assert(seekpos < (off_t) BLCKSZ * RELSEG_SIZE);
+
+	return FileStartWrite(v->mdfd_vfd, buffer, BLCKSZ, seekpos,
+						  WAIT_EVENT_DATA_FILE_WRITE);
+}
+
+/*
+ *	mdfinishwrite() -- Wait for a write started by mdstartwrite().
+ *
+ *		Only now is the segment registered for fsync, so that the checkpointer
+ *		can't absorb the request and sync the file before the data is in.
+ */
+void
+mdfinishwrite(SMgrRelation reln, ForkNumber forknum, BlockNumber blocknum,
+			  char *buffer, bool skipFsync, PgAioHandle *io)
+{
+	int			nbytes;
+	MdfdVec    *v;
+
+	nbytes = pgaio_wait(io);
+
+	v = _mdfd_getseg(reln, forknum, blocknum, skipFsync,
+					 EXTENSION_FAIL | EXTENSION_CREATE_RECOVERY);
+
+	md_write_done(reln, forknum, blocknum, skipFsync, v, nbytes);
+}
+
+/*
+ * md_write_done -- report the outcome of writing a block
+ */
+static void
+md_write_done(SMgrRelation reln, ForkNumber forknum, BlockNumber blocknum,
+			  bool skipFsync, MdfdVec *v, int nbytes)
+{
 	TRACE_POSTGRESQL_SMGR_MD_WRITE_DONE(forknum, blocknum,
 										reln->smgr_rnode.node.spcNode,
 										reln->smgr_rnode.node.dbNode,
@@ -909,14 +1196,19 @@ register_dirty_segment(SMgrRelation reln, ForkNumber forknum, MdfdVec *seg)
 
 	if (!RegisterSyncRequest(&tag, SYNC_REQUEST, false /* retryOnError */ ))
 	{
+		instr_time	io_start;
+
 		ereport(DEBUG1,
 				(errmsg("could not forward fsync request because request queue is full")));
 
+		io_start = pgstat_io_start();
 		if (FileSync(seg->mdfd_vfd, WAIT_EVENT_DATA_FILE_SYNC) < 0)
 			ereport(data_sync_elevel(ERROR),
 					(errcode_for_file_access(),
 					 errmsg("could not fsync file \"%s\": %m",
 							FilePathName(seg->mdfd_vfd))));
+		pgstat_count_io(IOOBJECT_RELATION, IOCONTEXT_NORMAL, IOOP_FSYNC, 1,
+						io_start);
 	}
 }
 
@@ -951,6 +1243,24 @@ register_forget_request(RelFileNodeBackend rnode, ForkNumber forknum,
 	RegisterSyncRequest(&tag, SYNC_FORGET_REQUEST, true /* retryOnError */ );
 }
 
+/*
+ * mdcheckpointfiledone -- the checkpoint is done writing a segment
+ *
+ * Called with adaptive checkpoint pacing once the checkpoint has written all
+ * the buffers it is going to write in the segment holding blocknum, so that
+ * the segment can be fsync'd before the end of the checkpoint.
+ */
+void
+mdcheckpointfiledone(RelFileNode rnode, ForkNumber forknum,
+					 BlockNumber blocknum)
+{
+	FileTag		tag;
+
+	INIT_MD_FILETAG(tag, rnode, forknum, blocknum / ((BlockNumber) RELSEG_SIZE));
+
+	ScheduleEarlySync(&tag);
+}
+
 /*
  * ForgetDatabaseSyncRequests -- forget any fsyncs and unlinks for a DB
  */
@@ -1061,6 +1371,20 @@ _mdfd_segpath(SMgrRelation reln, ForkNumber forknum, BlockNumber segno)
 	return fullpath;
 }
 
+/*
+ * Return PG_O_DIRECT if the relation's files are to be opened with it.
+ *
+ * Temporary relations use local buffers, which aren't aligned for direct
+ * I/O, and are better off in the kernel's cache anyway.
+ */
+static int
+_mdfd_direct_flag(SMgrRelation reln)
+{
+	if ((io_direct_flags & IO_DIRECT_DATA) && !SmgrIsTemp(reln))
+		return PG_O_DIRECT;
+	return 0;
+}
+
 /*
  * Open the specified segment of the relation,
  * and make a MdfdVec object for it.  Returns NULL on failure.
@@ -1076,7 +1400,8 @@ _mdfd_openseg(SMgrRelation reln, ForkNumber forknum, BlockNumber segno,
 	fullpath = _mdfd_segpath(reln, forknum, segno);
 
 	/* open the file */
-	fd = PathNameOpenFile(fullpath, O_RDWR | PG_BINARY | oflags);
+	fd = PathNameOpenFile(fullpath,
+						  O_RDWR | PG_BINARY | _mdfd_direct_flag(reln) | oflags);
 
 	pfree(fullpath);
 
@@ -19,11 +19,16 @@
 
 #include "commands/tablespace.h"
 #include "lib/ilist.h"
+#include "miscadmin.h"
+#include "pgstat.h"
 #include "storage/bufmgr.h"
 #include "storage/ipc.h"
+#include "storage/lwlock.h"
 #include "storage/md.h"
+#include "storage/shmem.h"
 #include "storage/undofile.h"
 #include "storage/smgr.h"
+#include "utils/hashutils.h"
 #include "utils/hsearch.h"
 #include "utils/inval.h"
 
@@ -50,12 +55,29 @@ typedef struct f_smgr
 								bool isRedo);
 	void		(*smgr_extend) (SMgrRelation reln, ForkNumber forknum,
 								BlockNumber blocknum, char *buffer, bool skipFsync);
+	void		(*smgr_zeroextend) (SMgrRelation reln, ForkNumber forknum,
+									BlockNumber blocknum, int nblocks,
+									bool skipFsync);
 	void		(*smgr_prefetch) (SMgrRelation reln, ForkNumber forknum,
 								  BlockNumber blocknum);
 	void		(*smgr_read) (SMgrRelation reln, ForkNumber forknum,
 							  BlockNumber blocknum, char *buffer);
 	void		(*smgr_write) (SMgrRelation reln, ForkNumber forknum,
 							   BlockNumber blocknum, char *buffer, bool skipFsync);
+	void		(*smgr_writev) (SMgrRelation reln, ForkNumber forknum,
+								BlockNumber blocknum, char **buffers,
+								int nblocks, bool skipFsync);
+	PgAioHandle *(*smgr_startread) (SMgrRelation reln, ForkNumber forknum,
+									BlockNumber blocknum, char *buffer);
+	void		(*smgr_finishread) (SMgrRelation reln, ForkNumber forknum,
+									BlockNumber blocknum, char *buffer,
+									PgAioHandle *io);
+	PgAioHandle *(*smgr_startwrite) (SMgrRelation reln, ForkNumber forknum,
+									 BlockNumber blocknum, char *buffer,
+									 bool skipFsync);
+	void		(*smgr_finishwrite) (SMgrRelation reln, ForkNumber forknum,
+									 BlockNumber blocknum, char *buffer,
+									 bool skipFsync, PgAioHandle *io);
 	void		(*smgr_writeback) (SMgrRelation reln, ForkNumber forknum,
 								   BlockNumber blocknum, BlockNumber nblocks);
 	BlockNumber (*smgr_nblocks) (SMgrRelation reln, ForkNumber forknum);
@@ -74,9 +96,15 @@ static const f_smgr smgrsw[] = {
 		.smgr_exists = mdexists,
 		.smgr_unlink = mdunlink,
 		.smgr_extend = mdextend,
+		.smgr_zeroextend = mdzeroextend,
 		.smgr_prefetch = mdprefetch,
 		.smgr_read = mdread,
 		.smgr_write = mdwrite,
+		.smgr_writev = mdwritev,
+		.smgr_startread = mdstartread,
+		.smgr_finishread = mdfinishread,
+		.smgr_startwrite = mdstartwrite,
+		.smgr_finishwrite = mdfinishwrite,
 		.smgr_writeback = mdwriteback,
 		.smgr_nblocks = mdnblocks,
 		.smgr_truncate = mdtruncate,
@@ -92,9 +120,15 @@ static const f_smgr smgrsw[] = {
 		.smgr_exists = undofile_exists,
 		.smgr_unlink = undofile_unlink,
 		.smgr_extend = undofile_extend,
+		.smgr_zeroextend = undofile_zeroextend,
 		.smgr_prefetch = undofile_prefetch,
 		.smgr_read = undofile_read,
 		.smgr_write = undofile_write,
+		.smgr_writev = undofile_writev,
+		.smgr_startread = undofile_startread,
+		.smgr_finishread = undofile_finishread,
+		.smgr_startwrite = undofile_startwrite,
+		.smgr_finishwrite = undofile_finishwrite,
 		.smgr_writeback = undofile_writeback,
 		.smgr_nblocks = undofile_nblocks,
 		.smgr_truncate = undofile_truncate,
@@ -121,9 +155,235 @@ static HTAB *SMgrRelationHash = NULL;
 
 static dlist_head unowned_relns;
 
+/*
+ * Shared cache of relation sizes.
+ *
+ * smgrnblocks() would otherwise ask the storage manager every time, which
+ * for md.c means an lseek() on the last segment, and the planner and the
+ * extension paths call it a lot.  Sizes of the forks of permanent and
+ * unlogged md.c relations are kept in a table in shared memory where each
+ * fork maps to a bucket of a few entries.  An entry is filled in by the
+ * first smgrnblocks() call that misses, while holding the bucket's partition
+ * lock exclusively, so that an extension or truncation can't be lost in
+ * between asking the storage manager and filling it in; extension moves the
+ * size forward, and truncation and unlinking forget it, under that same
+ * lock.  Any other change of the files behind smgr's back must forget the
+ * affected entries: dropping or moving a database is the only one.
+ */
+#define SMGRSIZE_BUCKET_SIZE		4
+#define NUM_SMGRSIZE_PARTITIONS		16
+
+typedef struct SMgrSizeEntry
+{
+	RelFileNode rnode;
+	ForkNumber	forknum;
+	BlockNumber nblocks;		/* InvalidBlockNumber, if the entry is unused */
+} SMgrSizeEntry;
+
+typedef struct SMgrSizeCtl
+{
+	LWLockPadded locks[NUM_SMGRSIZE_PARTITIONS];
+	SMgrSizeEntry entries[FLEXIBLE_ARRAY_MEMBER];
+} SMgrSizeCtl;
+
+/* GUC: number of entries in the relation size cache, zero disables it. */
+int			smgr_size_cache = 4096;
+
+static SMgrSizeCtl *SMgrSizes = NULL;
+
+#define SMgrSizeNumBuckets() (smgr_size_cache / SMGRSIZE_BUCKET_SIZE)
+
+#define SMgrSizePartitionLock(bucket) \
+	(&SMgrSizes->locks[(bucket) % NUM_SMGRSIZE_PARTITIONS].lock)
+
+/* Only md.c's sizes of shared relations are cached */
+#define SMgrSizeIsCached(reln) \
+	(SMgrSizes != NULL && (reln)->smgr_which == 0 && !SmgrIsTemp(reln))
+
+/* Kind of object the I/O on reln is counted under in pg_stat_io */
+#define SmgrIOObject(reln) \
+	((reln)->smgr_which == 1 ? IOOBJECT_UNDO : \
+	 SmgrIsTemp(reln) ? IOOBJECT_TEMP_RELATION : IOOBJECT_RELATION)
+
 /* local function prototypes */
 static void smgrshutdown(int code, Datum arg);
+static SMgrSizeEntry *smgrsize_bucket(RelFileNode *rnode, ForkNumber forknum,
+									  LWLock **lock);
+static SMgrSizeEntry *smgrsize_lookup(SMgrSizeEntry *entries,
+									  RelFileNode *rnode, ForkNumber forknum);
+static void smgrsize_update(SMgrRelation reln, ForkNumber forknum,
+							BlockNumber nblocks);
+static void smgrsize_forget(RelFileNode *rnode, ForkNumber forknum);
+
+
+/*
+ * Report shared-memory space needed by SMgrSizeShmemInit.
+ */
+Size
+SMgrSizeShmemSize(void)
+{
+	if (SMgrSizeNumBuckets() == 0)
+		return 0;
+
+	return add_size(offsetof(SMgrSizeCtl, entries),
+					mul_size(SMgrSizeNumBuckets() * SMGRSIZE_BUCKET_SIZE,
+							 sizeof(SMgrSizeEntry)));
+}
+
+/*
+ * Allocate and initialize the relation size cache in shared memory.
+ */
+void
+SMgrSizeShmemInit(void)
+{
+	bool		found;
+	int			i;
+
+	if (SMgrSizeNumBuckets() == 0)
+		return;
+
+	SMgrSizes = (SMgrSizeCtl *)
+		ShmemInitStruct("SMgr Relation Sizes", SMgrSizeShmemSize(), &found);
+
+	if (!IsUnderPostmaster)
+	{
+		Assert(!found);
+
+		for (i = 0; i < NUM_SMGRSIZE_PARTITIONS; i++)
+			LWLockInitialize(&SMgrSizes->locks[i].lock, LWTRANCHE_SMGR_SIZE);
+		for (i = 0; i < SMgrSizeNumBuckets() * SMGRSIZE_BUCKET_SIZE; i++)
+			SMgrSizes->entries[i].nblocks = InvalidBlockNumber;
+	}
+	else
+		Assert(found);
+}
+
+/*
+ * Find the bucket of a relation fork in the size cache, and the lock that
+ * protects it.
+ */
+static SMgrSizeEntry *
+smgrsize_bucket(RelFileNode *rnode, ForkNumber forknum, LWLock **lock)
+{
+	uint32		h;
+	int			bucket;
+
+	h = hash_combine(murmurhash32(rnode->relNode),
+					 murmurhash32(rnode->dbNode ^ rnode->spcNode));
+	h = hash_combine(h, (uint32) forknum);
+	bucket = h % SMgrSizeNumBuckets();
+
+	*lock = SMgrSizePartitionLock(bucket);
+	return &SMgrSizes->entries[bucket * SMGRSIZE_BUCKET_SIZE];
+}
+
+/*
+ * Find the entry of a relation fork in its bucket, or return NULL.
+ */
+static SMgrSizeEntry *
+smgrsize_lookup(SMgrSizeEntry *entries, RelFileNode *rnode,
+				ForkNumber forknum)
+{
+	int			i;
+
+	for (i = 0; i < SMGRSIZE_BUCKET_SIZE; i++)
+	{
+		if (entries[i].nblocks != InvalidBlockNumber &&
+			entries[i].forknum == forknum &&
+			RelFileNodeEquals(entries[i].rnode, *rnode))
+			return &entries[i];
+	}
+
+	return NULL;
+}
+
+/*
+ * Move the cached size of a relation fork forward to nblocks, after it has
+ * been extended.  Nothing is done if it isn't cached.
+ */
+static void
+smgrsize_update(SMgrRelation reln, ForkNumber forknum, BlockNumber nblocks)
+{
+	SMgrSizeEntry *entry;
+	LWLock	   *lock;
+
+	if (!SMgrSizeIsCached(reln))
+		return;
+
+	entry = smgrsize_bucket(&reln->smgr_rnode.node, forknum, &lock);
+	LWLockAcquire(lock, LW_EXCLUSIVE);
+	entry = smgrsize_lookup(entry, &reln->smgr_rnode.node, forknum);
+	if (entry != NULL && entry->nblocks < nblocks)
+		entry->nblocks = nblocks;
+	LWLockRelease(lock);
+}
+
+/*
+ * Forget the cached size of a relation fork, or of all its forks if forknum
+ * is InvalidForkNumber.
+ */
+static void
+smgrsize_forget(RelFileNode *rnode, ForkNumber forknum)
+{
+	ForkNumber	fork;
+
+	if (SMgrSizes == NULL)
+		return;
+
+	for (fork = 0; fork <= MAX_FORKNUM; fork++)
+	{
+		SMgrSizeEntry *entry;
+		LWLock	   *lock;
+
+		if (forknum != InvalidForkNumber && fork != forknum)
+			continue;
+
+		entry = smgrsize_bucket(rnode, fork, &lock);
+		LWLockAcquire(lock, LW_EXCLUSIVE);
+		entry = smgrsize_lookup(entry, rnode, fork);
+		if (entry != NULL)
+			entry->nblocks = InvalidBlockNumber;
+		LWLockRelease(lock);
+	}
+}
+
+/*
+ *	smgrsizeforgetdb() -- Forget the cached sizes of all relations of a
+ *						  database.
+ *
+ *		This must be called when the files of a database are removed or
+ *		copied other than through smgr, that is by dropping or moving the
+ *		database.
+ */
+void
+smgrsizeforgetdb(Oid dbid)
+{
+	int			partition;
+
+	if (SMgrSizes == NULL)
+		return;
 
+	for (partition = 0; partition < NUM_SMGRSIZE_PARTITIONS; partition++)
+	{
+		int			bucket;
+
+		LWLockAcquire(&SMgrSizes->locks[partition].lock, LW_EXCLUSIVE);
+		for (bucket = partition; bucket < SMgrSizeNumBuckets();
+			 bucket += NUM_SMGRSIZE_PARTITIONS)
+		{
+			SMgrSizeEntry *entries;
+			int			i;
+
+			entries = &SMgrSizes->entries[bucket * SMGRSIZE_BUCKET_SIZE];
+			for (i = 0; i < SMGRSIZE_BUCKET_SIZE; i++)
+			{
+				if (entries[i].rnode.dbNode == dbid)
+					entries[i].nblocks = InvalidBlockNumber;
+			}
+		}
+		LWLockRelease(&SMgrSizes->locks[partition].lock);
+	}
+}
 
 /*
  *	smgrinit(), smgrshutdown() -- Initialize or shut down storage
@@ -449,6 +709,8 @@ smgrdounlink(SMgrRelation reln, bool isRedo)
 	 * xact.
 	 */
 	smgrsw[which].smgr_unlink(rnode, InvalidForkNumber, isRedo);
+
+	smgrsize_forget(&rnode.node, InvalidForkNumber);
 }
 
 /*
@@ -527,6 +789,8 @@ smgrdounlinkall(SMgrRelation *rels, int nrels, bool isRedo)
 
 		for (forknum = 0; forknum <= MAX_FORKNUM; forknum++)
 			smgrsw[which].smgr_unlink(rnodes[i], forknum, isRedo);
+
+		smgrsize_forget(&rnodes[i].node, InvalidForkNumber);
 	}
 
 	pfree(rnodes);
@@ -582,6 +846,8 @@ smgrdounlinkfork(SMgrRelation reln, ForkNumber forknum, bool isRedo)
 	 * xact.
 	 */
 	smgrsw[which].smgr_unlink(rnode, forknum, isRedo);
+
+	smgrsize_forget(&rnode.node, forknum);
 }
 
 /*
@@ -597,8 +863,35 @@ void
 smgrextend(SMgrRelation reln, ForkNumber forknum, BlockNumber blocknum,
 		   char *buffer, bool skipFsync)
 {
+	instr_time	io_start = pgstat_io_start();
+
 	smgrsw[reln->smgr_which].smgr_extend(reln, forknum, blocknum,
 										 buffer, skipFsync);
+	pgstat_count_io(SmgrIOObject(reln), pgStatIOContext, IOOP_EXTEND, 1,
+					io_start);
+
+	smgrsize_update(reln, forknum, blocknum + 1);
+}
+
+/*
+ *	smgrzeroextend() -- Add new zero-filled blocks to a file.
+ *
+ *		Like smgrextend(), but adds nblocks blocks starting at blocknum,
+ *		which read back as new (all-zeroes) pages, without the caller having
+ *		to supply their contents.  This doesn't go through shared buffers.
+ */
+void
+smgrzeroextend(SMgrRelation reln, ForkNumber forknum, BlockNumber blocknum,
+			   int nblocks, bool skipFsync)
+{
+	instr_time	io_start = pgstat_io_start();
+
+	smgrsw[reln->smgr_which].smgr_zeroextend(reln, forknum, blocknum,
+											 nblocks, skipFsync);
+	pgstat_count_io(SmgrIOObject(reln), pgStatIOContext, IOOP_EXTEND,
+					nblocks, io_start);
+
+	smgrsize_update(reln, forknum, blocknum + nblocks);
 }
 
 /*
@@ -622,7 +915,11 @@ void
 smgrread(SMgrRelation reln, ForkNumber forknum, BlockNumber blocknum,
 		 char *buffer)
 {
+	instr_time	io_start = pgstat_io_start();
+
 	smgrsw[reln->smgr_which].smgr_read(reln, forknum, blocknum, buffer);
+	pgstat_count_io(SmgrIOObject(reln), pgStatIOContext, IOOP_READ, 1,
+					io_start);
 }
 
 /*
@@ -644,8 +941,109 @@ void
 smgrwrite(SMgrRelation reln, ForkNumber forknum, BlockNumber blocknum,
 		  char *buffer, bool skipFsync)
 {
+	instr_time	io_start = pgstat_io_start();
+
 	smgrsw[reln->smgr_which].smgr_write(reln, forknum, blocknum,
 										buffer, skipFsync);
+	pgstat_count_io(SmgrIOObject(reln), pgStatIOContext, IOOP_WRITE, 1,
+					io_start);
+}
+
+/*
+ *	smgrwritev() -- Write out several consecutive blocks.
+ *
+ *		As smgrwrite(), for nblocks blocks starting at blocknum, whose
+ *		contents are in buffers[0 .. nblocks-1].  The storage manager writes
+ *		them with as few system calls as it can.
+ */
+void
+smgrwritev(SMgrRelation reln, ForkNumber forknum, BlockNumber blocknum,
+		   char **buffers, int nblocks, bool skipFsync)
+{
+	instr_time	io_start = pgstat_io_start();
+
+	smgrsw[reln->smgr_which].smgr_writev(reln, forknum, blocknum,
+										 buffers, nblocks, skipFsync);
+	pgstat_count_io(SmgrIOObject(reln), pgStatIOContext, IOOP_WRITE,
+					nblocks, io_start);
+}
+
+/*
+ *	smgrstartread() -- Start reading a block into the supplied buffer.
+ *
+ *		Depending on io_method the read may still be in progress at return;
+ *		the buffer must not be looked at or reused until smgrfinishread()
+ *		has been called with the returned handle, which is where any error
+ *		is reported.  Several reads can be in progress at once.
+ */
+PgAioHandle *
+smgrstartread(SMgrRelation reln, ForkNumber forknum, BlockNumber blocknum,
+			  char *buffer)
+{
+	instr_time	io_start = pgstat_io_start();
+	PgAioHandle *io;
+
+	io = smgrsw[reln->smgr_which].smgr_startread(reln, forknum, blocknum,
+												 buffer);
+	pgstat_count_io(SmgrIOObject(reln), pgStatIOContext, IOOP_READ, 1,
+					io_start);
+
+	return io;
+}
+
+/*
+ *	smgrfinishread() -- Wait for a read started by smgrstartread().
+ */
+void
+smgrfinishread(SMgrRelation reln, ForkNumber forknum, BlockNumber blocknum,
+			   char *buffer, PgAioHandle *io)
+{
+	instr_time	io_start = pgstat_io_start();
+
+	smgrsw[reln->smgr_which].smgr_finishread(reln, forknum, blocknum,
+											 buffer, io);
+	/* the read was counted when it was started, only add the wait */
+	pgstat_count_io(SmgrIOObject(reln), pgStatIOContext, IOOP_READ, 0,
+					io_start);
+}
+
+/*
+ *	smgrstartwrite() -- Start writing the supplied buffer out.
+ *
+ *		As smgrwrite(), except that the write may still be in progress at
+ *		return.  The buffer must be left alone until smgrfinishwrite() is
+ *		called with the returned handle; the relation is only registered
+ *		for fsync then.
+ */
+PgAioHandle *
+smgrstartwrite(SMgrRelation reln, ForkNumber forknum, BlockNumber blocknum,
+			   char *buffer, bool skipFsync)
+{
+	instr_time	io_start = pgstat_io_start();
+	PgAioHandle *io;
+
+	io = smgrsw[reln->smgr_which].smgr_startwrite(reln, forknum, blocknum,
+												  buffer, skipFsync);
+	pgstat_count_io(SmgrIOObject(reln), pgStatIOContext, IOOP_WRITE, 1,
+					io_start);
+
+	return io;
+}
+
+/*
+ *	smgrfinishwrite() -- Wait for a write started by smgrstartwrite().
+ */
+void
+smgrfinishwrite(SMgrRelation reln, ForkNumber forknum, BlockNumber blocknum,
+				char *buffer, bool skipFsync, PgAioHandle *io)
+{
+	instr_time	io_start = pgstat_io_start();
+
+	smgrsw[reln->smgr_which].smgr_finishwrite(reln, forknum, blocknum,
+											  buffer, skipFsync, io);
+	/* the write was counted when it was started, only add the wait */
+	pgstat_count_io(SmgrIOObject(reln), pgStatIOContext, IOOP_WRITE, 0,
+					io_start);
 }
 
 
@@ -664,11 +1062,67 @@ smgrwriteback(SMgrRelation reln, ForkNumber forknum, BlockNumber blocknum,
 /*
  *	smgrnblocks() -- Calculate the number of blocks in the
  *					 supplied relation.
+ *
+ *		The answer comes from the shared relation size cache if possible.
  */
 BlockNumber
 smgrnblocks(SMgrRelation reln, ForkNumber forknum)
 {
-	return smgrsw[reln->smgr_which].smgr_nblocks(reln, forknum);
+	SMgrSizeEntry *bucket;
+	SMgrSizeEntry *entry;
+	LWLock	   *lock;
+	BlockNumber result;
+	int			i;
+
+	if (!SMgrSizeIsCached(reln))
+		return smgrsw[reln->smgr_which].smgr_nblocks(reln, forknum);
+
+	bucket = smgrsize_bucket(&reln->smgr_rnode.node, forknum, &lock);
+
+	LWLockAcquire(lock, LW_SHARED);
+	entry = smgrsize_lookup(bucket, &reln->smgr_rnode.node, forknum);
+	if (entry != NULL)
+	{
+		result = entry->nblocks;
+		LWLockRelease(lock);
+		return result;
+	}
+	LWLockRelease(lock);
+
+	/*
+	 * Ask the storage manager, holding the lock so that no extension or
+	 * truncation can happen between that and filling in the entry.
+	 */
+	LWLockAcquire(lock, LW_EXCLUSIVE);
+	entry = smgrsize_lookup(bucket, &reln->smgr_rnode.node, forknum);
+	if (entry != NULL)
+	{
+		result = entry->nblocks;
+		LWLockRelease(lock);
+		return result;
+	}
+
+	result = smgrsw[reln->smgr_which].smgr_nblocks(reln, forknum);
+
+	/* Take an unused entry, or else evict one */
+	entry = &bucket[reln->smgr_rnode.node.relNode % SMGRSIZE_BUCKET_SIZE];
+	for (i = 0; i < SMGRSIZE_BUCKET_SIZE; i++)
+	{
+		if (bucket[i].nblocks == InvalidBlockNumber)
+		{
+			entry = &bucket[i];
+			break;
+		}
+	}
+	if (result != InvalidBlockNumber)
+	{
+		entry->rnode = reln->smgr_rnode.node;
+		entry->forknum = forknum;
+		entry->nblocks = result;
+	}
+	LWLockRelease(lock);
+
+	return result;
 }
 
 /*
@@ -702,6 +1156,8 @@ smgrtruncate(SMgrRelation reln, ForkNumber forknum, BlockNumber nblocks)
 	 * Do the truncation.
 	 */
 	smgrsw[reln->smgr_which].smgr_truncate(reln, forknum, nblocks);
+
+	smgrsize_forget(&reln->smgr_rnode.node, forknum);
 }
 
 /*
@@ -730,7 +1186,11 @@ smgrtruncate(SMgrRelation reln, ForkNumber forknum, BlockNumber nblocks)
 void
 smgrimmedsync(SMgrRelation reln, ForkNumber forknum)
 {
+	instr_time	io_start = pgstat_io_start();
+
 	smgrsw[reln->smgr_which].smgr_immedsync(reln, forknum);
+	pgstat_count_io(SmgrIOObject(reln), pgStatIOContext, IOOP_FSYNC, 1,
+					io_start);
 }
 
 /*
@@ -18,6 +18,7 @@
 #include "access/undolog.h"
 #include "access/xlog.h"
 #include "miscadmin.h"
+#include "portability/instr_time.h"
 #include "pgstat.h"
 #include "postmaster/bgwriter.h"
 #include "storage/fd.h"
@@ -81,6 +82,10 @@ static MemoryContext pendingOpsCxt;
 static File undofile_open_segment_file(Oid relNode, Oid spcNode, int segno,
 									   bool missing_ok);
 static File undofile_get_segment_file(SMgrRelation reln, int segno);
+static void undofile_read_done(File file, BlockNumber blocknum, int nbytes);
+static void undofile_write_done(SMgrRelation reln, File file,
+								BlockNumber blocknum, bool skipFsync,
+								int nbytes);
 
 void
 undofile_init(void)
@@ -148,6 +153,13 @@ undofile_extend(SMgrRelation reln, ForkNumber forknum,
 	elog(ERROR, "undofile_extend is not supported");
 }
 
+void
+undofile_zeroextend(SMgrRelation reln, ForkNumber forknum,
+					BlockNumber blocknum, int nblocks, bool skipFsync)
+{
+	elog(ERROR, "undofile_zeroextend is not supported");
+}
+
 void
 undofile_prefetch(SMgrRelation reln, ForkNumber forknum, BlockNumber blocknum)
 {
@@ -178,6 +190,38 @@ undofile_read(SMgrRelation reln, ForkNumber forknum, BlockNumber blocknum,
 	seekpos = (off_t) BLCKSZ * (blocknum % ((BlockNumber) UNDOSEG_SIZE));
 	Assert(seekpos < (off_t) BLCKSZ * UNDOSEG_SIZE);
 	nbytes = FileRead(file, buffer, BLCKSZ, seekpos, WAIT_EVENT_UNDO_FILE_READ);
+	undofile_read_done(file, blocknum, nbytes);
+}
+
+PgAioHandle *
+undofile_startread(SMgrRelation reln, ForkNumber forknum,
+				   BlockNumber blocknum, char *buffer)
+{
+	File		file;
+	off_t		seekpos;
+
+	Assert(forknum == MAIN_FORKNUM);
+	file = undofile_get_segment_file(reln, blocknum / UNDOSEG_SIZE);
+	seekpos = (off_t) BLCKSZ * (blocknum % ((BlockNumber) UNDOSEG_SIZE));
+	Assert(seekpos < (off_t) BLCKSZ * UNDOSEG_SIZE);
+	return FileStartRead(file, buffer, BLCKSZ, seekpos,
+						 WAIT_EVENT_UNDO_FILE_READ);
+}
+
+void
+undofile_finishread(SMgrRelation reln, ForkNumber forknum,
+					BlockNumber blocknum, char *buffer, PgAioHandle *io)
+{
+	int			nbytes;
+
+	nbytes = pgaio_wait(io);
+	undofile_read_done(undofile_get_segment_file(reln, blocknum / UNDOSEG_SIZE),
+					   blocknum, nbytes);
+}
+
+static void
+undofile_read_done(File file, BlockNumber blocknum, int nbytes)
+{
 	if (nbytes != BLCKSZ)
 	{
 		if (nbytes < 0)
@@ -198,16 +242,123 @@ undofile_write(SMgrRelation reln, ForkNumber forknum,
 			   BlockNumber blocknum, char *buffer,
 			   bool skipFsync)
 {
-	FileTag		tag;
 	File		file;
 	off_t		seekpos;
 	int			nbytes;
+	instr_time	start;
+	instr_time	duration;
 
 	Assert(forknum == MAIN_FORKNUM);
 	file = undofile_get_segment_file(reln, blocknum / UNDOSEG_SIZE);
 	seekpos = (off_t) BLCKSZ * (blocknum % ((BlockNumber) UNDOSEG_SIZE));
 	Assert(seekpos < (off_t) BLCKSZ * UNDOSEG_SIZE);
+	INSTR_TIME_SET_CURRENT(start);
 	nbytes = FileWrite(file, buffer, BLCKSZ, seekpos, WAIT_EVENT_UNDO_FILE_WRITE);
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, start);
+
+	/* Let undolog.c place undo logs away from slow tablespaces. */
+	UndoLogReportWrite(reln->smgr_rnode.node.spcNode,
+					   INSTR_TIME_GET_MICROSEC(duration));
+	undofile_write_done(reln, file, blocknum, skipFsync, nbytes);
+}
+
+/*
+ * Write consecutive undo blocks, one FileWriteV call per segment piece.  A
+ * whole run counts as one write for UndoLogReportWrite().
+ */
+void
+undofile_writev(SMgrRelation reln, ForkNumber forknum,
+				BlockNumber blocknum, char **buffers, int nblocks,
+				bool skipFsync)
+{
+	struct iovec iov[PG_IOV_MAX];
+	instr_time	start;
+	instr_time	duration;
+
+	Assert(forknum == MAIN_FORKNUM);
+	INSTR_TIME_SET_CURRENT(start);
+	while (nblocks > 0)
+	{
+		File		file;
+		off_t		seekpos;
+		int			nbytes;
+		int			nthis;
+		int			i;
+
+		file = undofile_get_segment_file(reln, blocknum / UNDOSEG_SIZE);
+		seekpos = (off_t) BLCKSZ * (blocknum % ((BlockNumber) UNDOSEG_SIZE));
+		Assert(seekpos < (off_t) BLCKSZ * UNDOSEG_SIZE);
+
+		nthis = Min(nblocks, PG_IOV_MAX);
+		nthis = Min(nthis, UNDOSEG_SIZE - blocknum % ((BlockNumber) UNDOSEG_SIZE));
+		for (i = 0; i < nthis; i++)
+		{
+			iov[i].iov_base = buffers[i];
+			iov[i].iov_len = BLCKSZ;
+		}
+
+		nbytes = FileWriteV(file, iov, nthis, seekpos,
+							WAIT_EVENT_UNDO_FILE_WRITE);
+
+		/* On failure, complain about the first block that didn't make it */
+		if (nbytes < 0)
+			undofile_write_done(reln, file, blocknum, skipFsync, nbytes);
+		else if (nbytes != nthis * BLCKSZ)
+			undofile_write_done(reln, file, blocknum + nbytes / BLCKSZ,
+								skipFsync, nbytes % BLCKSZ);
+		else
+			undofile_write_done(reln, file, blocknum, skipFsync, BLCKSZ);
+
+		blocknum += nthis;
+		buffers += nthis;
+		nblocks -= nthis;
+	}
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, start);
+
+	UndoLogReportWrite(reln->smgr_rnode.node.spcNode,
+					   INSTR_TIME_GET_MICROSEC(duration));
+}
+
+/*
+ * Asynchronous writes are not timed for UndoLogReportWrite(): the time
+ * between start and finish says more about the caller than the tablespace.
+ */
+PgAioHandle *
+undofile_startwrite(SMgrRelation reln, ForkNumber forknum,
+					BlockNumber blocknum, char *buffer, bool skipFsync)
+{
+	File		file;
+	off_t		seekpos;
+
+	Assert(forknum == MAIN_FORKNUM);
+	file = undofile_get_segment_file(reln, blocknum / UNDOSEG_SIZE);
+	seekpos = (off_t) BLCKSZ * (blocknum % ((BlockNumber) UNDOSEG_SIZE));
+	Assert(seekpos < (off_t) BLCKSZ * UNDOSEG_SIZE);
+	return FileStartWrite(file, buffer, BLCKSZ, seekpos,
+						  WAIT_EVENT_UNDO_FILE_WRITE);
+}
+
+void
+undofile_finishwrite(SMgrRelation reln, ForkNumber forknum,
+					 BlockNumber blocknum, char *buffer, bool skipFsync,
+					 PgAioHandle *io)
+{
+	int			nbytes;
+
+	nbytes = pgaio_wait(io);
+	undofile_write_done(reln,
+						undofile_get_segment_file(reln, blocknum / UNDOSEG_SIZE),
+						blocknum, skipFsync, nbytes);
+}
+
+static void
+undofile_write_done(SMgrRelation reln, File file, BlockNumber blocknum,
+					bool skipFsync, int nbytes)
+{
+	FileTag		tag;
+
 	if (nbytes != BLCKSZ)
 	{
 		if (nbytes < 0)
@@ -237,11 +388,15 @@ undofile_write(SMgrRelation reln, ForkNumber forknum,
 
 		if (!RegisterSyncRequest(&tag, SYNC_REQUEST, false /* retryOnError */ ))
 		{
+			instr_time	io_start = pgstat_io_start();
+
 			if (FileSync(file, WAIT_EVENT_DATA_FILE_SYNC) < 0)
 				ereport(data_sync_elevel(ERROR),
 						(errcode_for_file_access(),
 						 errmsg("could not fsync file \"%s\": %m",
 								FilePathName(file))));
+			pgstat_count_io(IOOBJECT_UNDO, IOCONTEXT_NORMAL, IOOP_FSYNC, 1,
+							io_start);
 		}
 	}
 }
@@ -300,7 +455,8 @@ undofile_open_segment_file(Oid relNode, Oid spcNode, int segno,
 	char		path[MAXPGPATH];
 
 	UndoLogSegmentPath(relNode, segno, spcNode, path);
-	file = PathNameOpenFile(path, O_RDWR | PG_BINARY);
+	file = PathNameOpenFile(path, O_RDWR | PG_BINARY |
+							((io_direct_flags & IO_DIRECT_DATA) ? PG_O_DIRECT : 0));
 
 	if (file <= 0 && (!missing_ok || errno != ENOENT))
 		elog(ERROR, "cannot open undo segment file '%s': %m", path);
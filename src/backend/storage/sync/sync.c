@@ -32,6 +32,7 @@
 #include "utils/hsearch.h"
 #include "utils/memutils.h"
 #include "utils/inval.h"
+#include "utils/timestamp.h"
 
 static MemoryContext pendingOpsCxt; /* context for the pending ops state  */
 
@@ -76,6 +77,25 @@ static MemoryContext pendingOpsCxt; /* context for the above  */
 static CycleCtr sync_cycle_ctr = 0;
 static CycleCtr checkpoint_cycle_ctr = 0;
 
+/*
+ * Files the checkpoint in progress has written all its buffers of, with
+ * adaptive checkpoint pacing.  They are fsync'd once their writeback has had
+ * EARLY_SYNC_DELAY_MS to get under way, which leaves the sync phase at the
+ * end of the checkpoint with less to do.  See ScheduleEarlySync().
+ */
+#define EARLY_SYNC_QUEUE_SIZE	32
+#define EARLY_SYNC_DELAY_MS		1000
+
+typedef struct
+{
+	FileTag		tag;			/* identifies handler and file */
+	TimestampTz scheduled;		/* when the checkpoint was done with it */
+} EarlySyncEntry;
+
+static EarlySyncEntry earlySyncQueue[EARLY_SYNC_QUEUE_SIZE];
+static int	earlySyncHead = 0;
+static int	earlySyncCount = 0;
+
 /* Intervals for calling AbsorbSyncRequests */
 #define FSYNCS_PER_ABSORB		10
 #define UNLINKS_PER_ABSORB		10
@@ -307,6 +327,9 @@ ProcessSyncRequests(void)
 		}
 	}
 
+	/* Files not synced early yet are synced below like all the others */
+	earlySyncCount = 0;
+
 	/* Advance counter so that new hashtable entries are distinguishable */
 	sync_cycle_ctr++;
 
@@ -380,6 +403,12 @@ ProcessSyncRequests(void)
 				total_elapsed += elapsed;
 				processed++;
 
+				if (!track_io_timing)
+					INSTR_TIME_SET_ZERO(sync_start);
+				pgstat_count_io(entry->tag.handler == SYNC_HANDLER_UNDO ?
+								IOOBJECT_UNDO : IOOBJECT_RELATION,
+								IOCONTEXT_NORMAL, IOOP_FSYNC, 1, sync_start);
+
 				if (log_checkpoints)
 					elog(DEBUG1, "checkpoint sync: number=%d file=%s time=%.3f msec",
 						 processed,
@@ -427,6 +456,112 @@ ProcessSyncRequests(void)
 	sync_in_progress = false;
 }
 
+/*
+ * SyncFileEarly() -- fsync one file ahead of the checkpoint's sync phase
+ */
+static void
+SyncFileEarly(const FileTag *ftag)
+{
+	PendingFsyncEntry *entry;
+	char		path[MAXPGPATH];
+	instr_time	io_start;
+
+	if (!enableFsync)
+		return;
+
+	/* Make sure the requests of all the writes done so far are entered */
+	AbsorbSyncRequests();
+
+	entry = (PendingFsyncEntry *) hash_search(pendingOps, (void *) ftag,
+											  HASH_FIND, NULL);
+	if (entry == NULL || entry->canceled)
+		return;
+
+	/*
+	 * Remove the entry before the fsync.  A write that's not covered by the
+	 * fsync can only have its request absorbed after this, so it makes a new
+	 * entry, which is synced at the end of the checkpoint as usual.
+	 */
+	if (hash_search(pendingOps, (void *) ftag, HASH_REMOVE, NULL) == NULL)
+		elog(ERROR, "pendingOps corrupted");
+
+	io_start = pgstat_io_start();
+	if (syncsw[ftag->handler].sync_syncfiletag(ftag, path) == 0)
+	{
+		pgstat_count_io(ftag->handler == SYNC_HANDLER_UNDO ?
+						IOOBJECT_UNDO : IOOBJECT_RELATION,
+						IOCONTEXT_NORMAL, IOOP_FSYNC, 1, io_start);
+		return;
+	}
+
+	if (!FILE_POSSIBLY_DELETED(errno))
+		ereport(data_sync_elevel(ERROR),
+				(errcode_for_file_access(),
+				 errmsg("could not fsync file \"%s\": %m", path)));
+
+	/*
+	 * Leave a file that may have been dropped, or one we may retry, to the
+	 * sync phase, which knows how to deal with those.
+	 */
+	RememberSyncRequest(ftag, SYNC_REQUEST);
+}
+
+/*
+ * ScheduleEarlySync() -- have a file fsync'd before the sync phase
+ *
+ * Called by the checkpointer once the checkpoint in progress has written all
+ * the buffers it is going to write in the file, after starting the file's
+ * writeback.  If the queue is full, the oldest file in it is synced now.
+ */
+void
+ScheduleEarlySync(const FileTag *ftag)
+{
+	EarlySyncEntry *entry;
+
+	if (!pendingOps)
+		return;
+
+	if (earlySyncCount == EARLY_SYNC_QUEUE_SIZE)
+	{
+		FileTag		oldest = earlySyncQueue[earlySyncHead].tag;
+
+		earlySyncHead = (earlySyncHead + 1) % EARLY_SYNC_QUEUE_SIZE;
+		earlySyncCount--;
+		SyncFileEarly(&oldest);
+	}
+
+	entry = &earlySyncQueue[(earlySyncHead + earlySyncCount) %
+							EARLY_SYNC_QUEUE_SIZE];
+	entry->tag = *ftag;
+	entry->scheduled = GetCurrentTimestamp();
+	earlySyncCount++;
+}
+
+/*
+ * ProcessEarlySyncs() -- fsync the scheduled files that are due
+ */
+void
+ProcessEarlySyncs(void)
+{
+	TimestampTz now;
+
+	if (earlySyncCount == 0)
+		return;
+
+	now = GetCurrentTimestamp();
+	while (earlySyncCount > 0 &&
+		   TimestampDifferenceExceeds(earlySyncQueue[earlySyncHead].scheduled,
+									  now, EARLY_SYNC_DELAY_MS))
+	{
+		/* advance first, in case the sync fails */
+		FileTag		tag = earlySyncQueue[earlySyncHead].tag;
+
+		earlySyncHead = (earlySyncHead + 1) % EARLY_SYNC_QUEUE_SIZE;
+		earlySyncCount--;
+		SyncFileEarly(&tag);
+	}
+}
+
 /*
  * RememberSyncRequest() -- callback from checkpointer side of sync request
  *
@@ -57,6 +57,7 @@
 #include "pg_getopt.h"
 #include "postmaster/autovacuum.h"
 #include "postmaster/postmaster.h"
+#include "postmaster/proxy.h"
 #include "replication/logicallauncher.h"
 #include "replication/logicalworker.h"
 #include "replication/slot.h"
@@ -150,6 +151,12 @@ static bool ignore_till_sync = false;
  */
 static bool stmt_timeout_active = false;
 
+/*
+ * Flag to keep track of whether we have tried to hand a pooled session over
+ * to a connection proxy.
+ */
+static bool session_handover_attempted = false;
+
 /*
  * If an unnamed prepared statement exists, it's stored here.
  * We keep it separate from the hashtable kept by commands/prepare.c
@@ -3846,6 +3853,8 @@ PostgresMain(int argc, char *argv[],
 
 		/* Initialize MaxBackends (if under postmaster, was done already) */
 		InitializeMaxBackends();
+		InitializeFastPathLocks();
+		InitializeBufferPoolSize();
 	}
 
 	/* Early initialization */
@@ -3915,15 +3924,18 @@ PostgresMain(int argc, char *argv[],
 	process_session_preload_libraries();
 
 	/*
-	 * Send this backend's cancellation info to the frontend.
+	 * Send this backend's cancellation info to the frontend.  A pooled
+	 * session will be served by other backends too, so it can't be canceled
+	 * this way.
 	 */
 	if (whereToSendOutput == DestRemote)
 	{
 		StringInfoData buf;
+		bool		pooled = ProxyCanPoolSession(MyProcPort);
 
 		pq_beginmessage(&buf, 'K');
-		pq_sendint32(&buf, (int32) MyProcPid);
-		pq_sendint32(&buf, (int32) MyCancelKey);
+		pq_sendint32(&buf, pooled ? 0 : (int32) MyProcPid);
+		pq_sendint32(&buf, pooled ? 0 : (int32) MyCancelKey);
 		pq_endmessage(&buf);
 		/* Need not flush since ReadyForQuery will do it. */
 	}
@@ -4175,6 +4187,18 @@ PostgresMain(int argc, char *argv[],
 
 			ReadyForQuery(whereToSendOutput);
 			send_ready_for_query = false;
+
+			/*
+			 * Once session startup is complete, a pooled session goes to a
+			 * connection proxy.
+			 */
+			if (!session_handover_attempted &&
+				whereToSendOutput == DestRemote &&
+				ProxyCanPoolSession(MyProcPort))
+			{
+				session_handover_attempted = true;
+				(void) ProxyHandOverSession();
+			}
 		}
 
 		/*
@@ -23,6 +23,7 @@
 #include "mb/pg_wchar.h"
 #include "miscadmin.h"
 #include "parser/parse_coerce.h"
+#include "port/simd.h"
 #include "utils/array.h"
 #include "utils/builtins.h"
 #include "utils/date.h"
@@ -970,8 +971,11 @@ json_lex_string(JsonLexContext *lex)
 			}
 
 		}
-		else if (lex->strval != NULL)
+		else
 		{
+			char	   *end = lex->input + lex->input_length;
+			char	   *p = s + 1;
+
 			if (hi_surrogate != -1)
 				ereport(ERROR,
 						(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
@@ -979,9 +983,32 @@ json_lex_string(JsonLexContext *lex)
 						 errdetail("Unicode low surrogate must follow a high surrogate."),
 						 report_json_context(lex)));
 
-			appendStringInfoChar(lex->strval, *s);
-		}
+			/*
+			 * Skip to the next byte that needs special handling, a vector at
+			 * a time as long as none of its bytes does, so that the run of
+			 * ordinary bytes can be copied in one go.
+			 */
+			while (p + sizeof(Vector8) <= end)
+			{
+				Vector8		chunk = vector8_load((const uint8 *) p);
+
+				if (vector8_has(chunk, '"') ||
+					vector8_has(chunk, '\\') ||
+					vector8_has_le(chunk, 31))
+					break;
+				p += sizeof(Vector8);
+			}
+			while (p < end && *p != '"' && *p != '\\' &&
+				   (unsigned char) *p >= 32)
+				p++;
 
+			if (lex->strval != NULL)
+				appendBinaryStringInfo(lex->strval, s, p - s);
+
+			/* leave s at the last ordinary byte; the loop advances past it */
+			len += p - s - 1;
+			s = p - 1;
+		}
 	}
 
 	if (hi_surrogate != -1)
@@ -68,6 +68,8 @@ static void jsonb_in_object_end(void *pstate);
 static void jsonb_in_array_start(void *pstate);
 static void jsonb_in_array_end(void *pstate);
 static void jsonb_in_object_field_start(void *pstate, char *fname, bool isnull);
+static void jsonb_in_nested_end(JsonbInState *state);
+static void jsonb_in_free_value(JsonbValue *v);
 static void jsonb_put_escaped_value(StringInfo out, JsonbValue *scalarVal);
 static void jsonb_in_scalar(void *pstate, char *token, JsonTokenType tokentype);
 static void jsonb_categorize_type(Oid typoid,
@@ -287,6 +289,8 @@ jsonb_in_object_end(void *pstate)
 	JsonbInState *_state = (JsonbInState *) pstate;
 
 	_state->res = pushJsonbValue(&_state->parseState, WJB_END_OBJECT, NULL);
+	if (_state->parseState != NULL)
+		jsonb_in_nested_end(_state);
 }
 
 static void
@@ -303,6 +307,75 @@ jsonb_in_array_end(void *pstate)
 	JsonbInState *_state = (JsonbInState *) pstate;
 
 	_state->res = pushJsonbValue(&_state->parseState, WJB_END_ARRAY, NULL);
+	if (_state->parseState != NULL)
+		jsonb_in_nested_end(_state);
+}
+
+/*
+ * A nested array or object has just been completed, and is now the last
+ * value of its parent.  Convert it to binary form and free the JsonbValues
+ * it was made of, so that parsing a large document never holds more of it
+ * as JsonbValues than the containers still open; the final conversion then
+ * just copies the nested containers.
+ */
+static void
+jsonb_in_nested_end(JsonbInState *state)
+{
+	JsonbValue *parent = &state->parseState->contVal;
+	JsonbValue *v;
+	JsonbValue	tree;
+
+	if (parent->type == jbvArray)
+		v = &parent->val.array.elems[parent->val.array.nElems - 1];
+	else
+	{
+		Assert(parent->type == jbvObject);
+		v = &parent->val.object.pairs[parent->val.object.nPairs - 1].value;
+	}
+
+	tree = *v;
+	JsonbValueToBinary(v);
+	jsonb_in_free_value(&tree);
+}
+
+/*
+ * Free a JsonbValue built by the jsonb input functions.  Its strings and
+ * numerics were made for it by the parser, and any containers it holds are
+ * in binary form already.
+ */
+static void
+jsonb_in_free_value(JsonbValue *v)
+{
+	int			i;
+
+	switch (v->type)
+	{
+		case jbvString:
+			pfree(v->val.string.val);
+			break;
+		case jbvNumeric:
+			pfree(v->val.numeric);
+			break;
+		case jbvBinary:
+			/* see JsonbValueToBinary */
+			pfree((char *) v->val.binary.data - VARHDRSZ);
+			break;
+		case jbvArray:
+			for (i = 0; i < v->val.array.nElems; i++)
+				jsonb_in_free_value(&v->val.array.elems[i]);
+			pfree(v->val.array.elems);
+			break;
+		case jbvObject:
+			for (i = 0; i < v->val.object.nPairs; i++)
+			{
+				jsonb_in_free_value(&v->val.object.pairs[i].key);
+				jsonb_in_free_value(&v->val.object.pairs[i].value);
+			}
+			pfree(v->val.object.pairs);
+			break;
+		default:
+			break;
+	}
 }
 
 static void
@@ -43,6 +43,7 @@ static void convertJsonbValue(StringInfo buffer, JEntry *header, JsonbValue *val
 static void convertJsonbArray(StringInfo buffer, JEntry *header, JsonbValue *val, int level);
 static void convertJsonbObject(StringInfo buffer, JEntry *header, JsonbValue *val, int level);
 static void convertJsonbScalar(StringInfo buffer, JEntry *header, JsonbValue *scalarVal);
+static void convertJsonbBinary(StringInfo buffer, JEntry *header, JsonbValue *val);
 
 static int	reserveFromBuffer(StringInfo buffer, int len);
 static void appendToBuffer(StringInfo buffer, const char *data, int len);
@@ -112,6 +113,43 @@ JsonbValueToJsonb(JsonbValue *val)
 	return out;
 }
 
+/*
+ * Replace an array or object JsonbValue by its binary representation, in
+ * place.  The new value points just past the varlena header of a palloc'd
+ * Jsonb; the JsonbValues that val referred to are left alone.
+ *
+ * A caller that builds a large document can use this to convert each nested
+ * container as soon as it is complete, so that only the containers still
+ * being filled are held as trees of JsonbValues.
+ */
+void
+JsonbValueToBinary(JsonbValue *val)
+{
+	Jsonb	   *jb;
+
+	Assert(val->type == jbvObject ||
+		   (val->type == jbvArray && !val->val.array.rawScalar));
+
+	jb = convertToJsonb(val);
+
+	/*
+	 * The conversion buffer starts out much larger than a small container
+	 * needs, so copy those to save memory.
+	 */
+	if (VARSIZE(jb) < 512)
+	{
+		Jsonb	   *copy = palloc(VARSIZE(jb));
+
+		memcpy(copy, jb, VARSIZE(jb));
+		pfree(jb);
+		jb = copy;
+	}
+
+	val->type = jbvBinary;
+	val->val.binary.data = &jb->root;
+	val->val.binary.len = VARSIZE(jb) - VARHDRSZ;
+}
+
 /*
  * Get the offset of the variable-length portion of a Jsonb node within
  * the variable-length-data part of its container.  The node is identified
@@ -1493,10 +1531,9 @@ convertJsonbValue(StringInfo buffer, JEntry *header, JsonbValue *val, int level)
 		return;
 
 	/*
-	 * A JsonbValue passed as val should never have a type of jbvBinary, and
-	 * neither should any of its sub-components. Those values will be produced
-	 * by convertJsonbArray and convertJsonbObject, the results of which will
-	 * not be passed back to this function as an argument.
+	 * A JsonbValue passed as val should only have a type of jbvBinary if it
+	 * is a nested container that has already been converted by
+	 * JsonbValueToBinary, and is copied as is.
 	 */
 
 	if (IsAJsonbScalar(val))
@@ -1505,10 +1542,36 @@ convertJsonbValue(StringInfo buffer, JEntry *header, JsonbValue *val, int level)
 		convertJsonbArray(buffer, header, val, level);
 	else if (val->type == jbvObject)
 		convertJsonbObject(buffer, header, val, level);
+	else if (val->type == jbvBinary && level > 0)
+		convertJsonbBinary(buffer, header, val);
 	else
 		elog(ERROR, "unknown type of jsonb container to convert");
 }
 
+/*
+ * Copy a nested container that is already in binary form.  The contents of
+ * a container don't depend on where it is stored, so this is just a matter
+ * of aligning it like convertJsonbArray and convertJsonbObject would.
+ */
+static void
+convertJsonbBinary(StringInfo buffer, JEntry *pheader, JsonbValue *val)
+{
+	int			base_offset;
+
+	Assert(!JsonContainerIsScalar(val->val.binary.data));
+
+	/* Remember where in the buffer this container starts. */
+	base_offset = buffer->len;
+
+	/* Align to 4-byte boundary (any padding counts as part of my data) */
+	padBufferToInt(buffer);
+
+	appendToBuffer(buffer, (char *) val->val.binary.data, val->val.binary.len);
+
+	/* Initialize the header of this node in the container's JEntry array */
+	*pheader = JENTRY_ISCONTAINER | (buffer->len - base_offset);
+}
+
 static void
 convertJsonbArray(StringInfo buffer, JEntry *pheader, JsonbValue *val, int level)
 {
@@ -34,6 +34,7 @@ const char *const LockTagTypeNames[] = {
 	"speculative token",
 	"object",
 	"undoaction",
+	"applytransaction",
 	"userlock",
 	"advisory"
 };
@@ -3503,6 +3503,10 @@ numeric_float4(PG_FUNCTION_ARGS)
  *
  * On platforms which support 128-bit integers some aggregates instead use a
  * 128-bit integer based transition datatype to speed up calculations.
+ * There, NumericAggState also accumulates inputs with few enough digits in a
+ * 128-bit integer holding the sum scaled by a power of ten (sumXInt), and
+ * falls back to the arbitrary-precision sumX only for the rest; the sum of
+ * the inputs is then sumX + sumXInt / 10^sumXIntScale.
  *
  * ----------------------------------------------------------------------
  */
@@ -3517,8 +3521,23 @@ typedef struct NumericAggState
 	int			maxScale;		/* maximum scale seen so far */
 	int64		maxScaleCount;	/* number of values seen with maximum scale */
 	int64		NaNcount;		/* count of NaN values (not included in N!) */
+#ifdef HAVE_INT128
+	int128		sumXInt;		/* part of sumX, as a scaled integer */
+	int			sumXIntScale;	/* decimal digits after the point in sumXInt */
+#endif
 } NumericAggState;
 
+#ifdef HAVE_INT128
+/*
+ * Inputs whose dscale exceeds NUMERIC_INT_SUM_MAX_SCALE, or which don't fit
+ * in an int64 once scaled, are added to sumX instead of sumXInt.  sumXInt is
+ * moved into sumX once its magnitude reaches NUMERIC_INT_SUM_LIMIT, which
+ * leaves room to add an int64 to it without overflow.
+ */
+#define NUMERIC_INT_SUM_MAX_SCALE	18
+#define NUMERIC_INT_SUM_LIMIT		(((int128) 1) << 120)
+#endif
+
 /*
  * Prepare state data for a numeric aggregate function that needs to compute
  * sum, count and optionally sum of squares of the input.
@@ -3560,6 +3579,185 @@ makeNumericAggStateCurrentContext(bool calcSumX2)
 	return state;
 }
 
+#ifdef HAVE_INT128
+/*
+ * Convert var to an integer holding its value scaled by 10^scale, which must
+ * be at least var's dscale.  Returns false if the result would overflow.
+ */
+static bool
+numericvar_to_scaled_int64(const NumericVar *var, int scale, int64 *result)
+{
+	int			fracdigits = (scale + DEC_DIGITS - 1) / DEC_DIGITS;
+	int64		val = 0;
+	int			p;
+	int			i;
+
+	if (var->ndigits == 0)
+	{
+		*result = 0;
+		return true;
+	}
+
+	/* Digits beyond the scale aren't expected, but would be lost */
+	if (var->ndigits > var->weight + fracdigits + 1)
+		return false;
+
+	for (p = var->weight; p >= -fracdigits; p--)
+	{
+		i = var->weight - p;
+		if (pg_mul_s64_overflow(val, NBASE, &val) ||
+			pg_add_s64_overflow(val,
+								i < var->ndigits ? var->digits[i] : 0,
+								&val))
+			return false;
+	}
+
+	/* The excess decimal digits of the last NBASE digit are zeroes */
+	for (i = fracdigits * DEC_DIGITS; i > scale; i--)
+		val /= 10;
+
+	*result = (var->sign == NUMERIC_NEG) ? -val : val;
+	return true;
+}
+
+/*
+ * Convert an integer holding a value scaled by 10^scale to a NumericVar of
+ * that dscale.
+ */
+static void
+scaled_int128_to_numericvar(int128 val, int scale, NumericVar *var)
+{
+	NumericVar	tmp;
+	NumericVar	pow10;
+
+	init_var(&tmp);
+	init_var(&pow10);
+
+	int128_to_numericvar(val, &tmp);
+	power_var_int(&const_ten, scale, &pow10, 0);
+	div_var(&tmp, &pow10, var, scale, false);
+
+	free_var(&tmp);
+	free_var(&pow10);
+}
+
+/*
+ * Move the integer part of the sum into sumX.  Must be called in the
+ * aggregate context.
+ */
+static void
+numeric_agg_int_flush(NumericAggState *state)
+{
+	NumericVar	tmp;
+
+	init_var(&tmp);
+	scaled_int128_to_numericvar(state->sumXInt, state->sumXIntScale, &tmp);
+	accum_sum_add(&state->sumX, &tmp);
+	free_var(&tmp);
+
+	state->sumXInt = 0;
+}
+
+/*
+ * Try to add X to the integer part of the sum, rescaling that first if X has
+ * more digits after the point.  Returns false if X must be added to sumX
+ * instead.  Must be called in the aggregate context.
+ */
+static bool
+numeric_agg_int_add(NumericAggState *state, const NumericVar *X)
+{
+	int64		val;
+
+	if (X->dscale > NUMERIC_INT_SUM_MAX_SCALE)
+		return false;
+
+	if (state->sumXInt >= NUMERIC_INT_SUM_LIMIT ||
+		state->sumXInt <= -NUMERIC_INT_SUM_LIMIT)
+		numeric_agg_int_flush(state);
+
+	while (state->sumXIntScale < X->dscale)
+	{
+		if (state->sumXInt >= NUMERIC_INT_SUM_LIMIT / 10 ||
+			state->sumXInt <= -NUMERIC_INT_SUM_LIMIT / 10)
+			numeric_agg_int_flush(state);
+		state->sumXInt *= 10;
+		state->sumXIntScale++;
+	}
+
+	if (!numericvar_to_scaled_int64(X, state->sumXIntScale, &val))
+		return false;
+
+	state->sumXInt += val;
+	return true;
+}
+#endif							/* HAVE_INT128 */
+
+/*
+ * Compute the sum of the inputs of a numeric aggregate into result, which
+ * must have been initialized.
+ */
+static void
+numeric_agg_sum_final(NumericAggState *state, NumericVar *result)
+{
+	accum_sum_final(&state->sumX, result);
+
+#ifdef HAVE_INT128
+	{
+		NumericVar	tmp;
+
+		init_var(&tmp);
+		scaled_int128_to_numericvar(state->sumXInt, state->sumXIntScale,
+									&tmp);
+		add_var(result, &tmp, result);
+		free_var(&tmp);
+	}
+#endif
+}
+
+/*
+ * Add the sum of state2's inputs to state1.  Must be called in state1's
+ * aggregate context.
+ */
+static void
+numeric_agg_sum_combine(NumericAggState *state1, NumericAggState *state2)
+{
+	accum_sum_combine(&state1->sumX, &state2->sumX);
+
+#ifdef HAVE_INT128
+	if (state1->sumXIntScale == state2->sumXIntScale &&
+		state1->sumXInt < NUMERIC_INT_SUM_LIMIT &&
+		state1->sumXInt > -NUMERIC_INT_SUM_LIMIT &&
+		state2->sumXInt < NUMERIC_INT_SUM_LIMIT &&
+		state2->sumXInt > -NUMERIC_INT_SUM_LIMIT)
+		state1->sumXInt += state2->sumXInt;
+	else
+	{
+		NumericVar	tmp;
+
+		init_var(&tmp);
+		scaled_int128_to_numericvar(state2->sumXInt, state2->sumXIntScale,
+									&tmp);
+		accum_sum_add(&state1->sumX, &tmp);
+		free_var(&tmp);
+	}
+#endif
+}
+
+/*
+ * Copy the sum of state2's inputs to state1, whose sum must be empty.  Must
+ * be called in state1's aggregate context.
+ */
+static void
+numeric_agg_sum_copy(NumericAggState *state1, NumericAggState *state2)
+{
+	accum_sum_copy(&state1->sumX, &state2->sumX);
+
+#ifdef HAVE_INT128
+	state1->sumXInt = state2->sumXInt;
+	state1->sumXIntScale = state2->sumXIntScale;
+#endif
+}
+
 /*
  * Accumulate a new input value for numeric aggregate functions.
  */
@@ -3605,7 +3803,10 @@ do_numeric_accum(NumericAggState *state, Numeric newval)
 	state->N++;
 
 	/* Accumulate sums */
-	accum_sum_add(&(state->sumX), &X);
+#ifdef HAVE_INT128
+	if (!numeric_agg_int_add(state, &X))
+#endif
+		accum_sum_add(&(state->sumX), &X);
 
 	if (state->calcSumX2)
 		accum_sum_add(&(state->sumX2), &X2);
@@ -3689,7 +3890,10 @@ do_numeric_discard(NumericAggState *state, Numeric newval)
 	{
 		/* Negate X, to subtract it from the sum */
 		X.sign = (X.sign == NUMERIC_POS ? NUMERIC_NEG : NUMERIC_POS);
-		accum_sum_add(&(state->sumX), &X);
+#ifdef HAVE_INT128
+		if (!numeric_agg_int_add(state, &X))
+#endif
+			accum_sum_add(&(state->sumX), &X);
 
 		if (state->calcSumX2)
 		{
@@ -3704,6 +3908,10 @@ do_numeric_discard(NumericAggState *state, Numeric newval)
 		Assert(state->N == 0);
 
 		accum_sum_reset(&state->sumX);
+#ifdef HAVE_INT128
+		state->sumXInt = 0;
+		state->sumXIntScale = 0;
+#endif
 		if (state->calcSumX2)
 			accum_sum_reset(&state->sumX2);
 	}
@@ -3764,7 +3972,7 @@ numeric_combine(PG_FUNCTION_ARGS)
 		state1->maxScale = state2->maxScale;
 		state1->maxScaleCount = state2->maxScaleCount;
 
-		accum_sum_copy(&state1->sumX, &state2->sumX);
+		numeric_agg_sum_copy(state1, state2);
 		accum_sum_copy(&state1->sumX2, &state2->sumX2);
 
 		MemoryContextSwitchTo(old_context);
@@ -3793,7 +4001,7 @@ numeric_combine(PG_FUNCTION_ARGS)
 		old_context = MemoryContextSwitchTo(agg_context);
 
 		/* Accumulate sums */
-		accum_sum_combine(&state1->sumX, &state2->sumX);
+		numeric_agg_sum_combine(state1, state2);
 		accum_sum_combine(&state1->sumX2, &state2->sumX2);
 
 		MemoryContextSwitchTo(old_context);
@@ -3852,7 +4060,7 @@ numeric_avg_combine(PG_FUNCTION_ARGS)
 		state1->maxScale = state2->maxScale;
 		state1->maxScaleCount = state2->maxScaleCount;
 
-		accum_sum_copy(&state1->sumX, &state2->sumX);
+		numeric_agg_sum_copy(state1, state2);
 
 		MemoryContextSwitchTo(old_context);
 
@@ -3880,7 +4088,7 @@ numeric_avg_combine(PG_FUNCTION_ARGS)
 		old_context = MemoryContextSwitchTo(agg_context);
 
 		/* Accumulate sums */
-		accum_sum_combine(&state1->sumX, &state2->sumX);
+		numeric_agg_sum_combine(state1, state2);
 
 		MemoryContextSwitchTo(old_context);
 	}
@@ -3915,7 +4123,7 @@ numeric_avg_serialize(PG_FUNCTION_ARGS)
 	 * this? Doing so would also remove the fmgr call overhead.
 	 */
 	init_var(&tmp_var);
-	accum_sum_final(&state->sumX, &tmp_var);
+	numeric_agg_sum_final(state, &tmp_var);
 
 	temp = DirectFunctionCall1(numeric_send,
 							   NumericGetDatum(make_result(&tmp_var)));
@@ -4029,7 +4237,7 @@ numeric_serialize(PG_FUNCTION_ARGS)
 	 */
 	init_var(&tmp_var);
 
-	accum_sum_final(&state->sumX, &tmp_var);
+	numeric_agg_sum_final(state, &tmp_var);
 	temp = DirectFunctionCall1(numeric_send,
 							   NumericGetDatum(make_result(&tmp_var)));
 	sumX = DatumGetByteaPP(temp);
@@ -4925,7 +5133,7 @@ numeric_avg(PG_FUNCTION_ARGS)
 	N_datum = DirectFunctionCall1(int8_numeric, Int64GetDatum(state->N));
 
 	init_var(&sumX_var);
-	accum_sum_final(&state->sumX, &sumX_var);
+	numeric_agg_sum_final(state, &sumX_var);
 	sumX_datum = NumericGetDatum(make_result(&sumX_var));
 	free_var(&sumX_var);
 
@@ -4949,7 +5157,7 @@ numeric_sum(PG_FUNCTION_ARGS)
 		PG_RETURN_NUMERIC(make_result(&const_nan));
 
 	init_var(&sumX_var);
-	accum_sum_final(&state->sumX, &sumX_var);
+	numeric_agg_sum_final(state, &sumX_var);
 	result = make_result(&sumX_var);
 	free_var(&sumX_var);
 
@@ -4997,7 +5205,7 @@ numeric_stddev_internal(NumericAggState *state,
 	init_var(&vsumX2);
 
 	int64_to_numericvar(state->N, &vN);
-	accum_sum_final(&(state->sumX), &vsumX);
+	numeric_agg_sum_final(state, &vsumX);
 	accum_sum_final(&(state->sumX2), &vsumX2);
 
 	/*
@@ -173,6 +173,70 @@ pg_stat_get_tuples_inplace_updated(PG_FUNCTION_ARGS)
 }
 
 
+Datum
+pg_stat_get_zheap_tpd_allocs(PG_FUNCTION_ARGS)
+{
+	Oid			relid = PG_GETARG_OID(0);
+	int64		result;
+	PgStat_StatTabEntry *tabentry;
+
+	if ((tabentry = pgstat_fetch_stat_tabentry(relid)) == NULL)
+		result = 0;
+	else
+		result = (int64) (tabentry->zheap_tpd_allocs);
+
+	PG_RETURN_INT64(result);
+}
+
+
+Datum
+pg_stat_get_zheap_slot_waits(PG_FUNCTION_ARGS)
+{
+	Oid			relid = PG_GETARG_OID(0);
+	int64		result;
+	PgStat_StatTabEntry *tabentry;
+
+	if ((tabentry = pgstat_fetch_stat_tabentry(relid)) == NULL)
+		result = 0;
+	else
+		result = (int64) (tabentry->zheap_slot_waits);
+
+	PG_RETURN_INT64(result);
+}
+
+
+Datum
+pg_stat_get_zheap_prunes(PG_FUNCTION_ARGS)
+{
+	Oid			relid = PG_GETARG_OID(0);
+	int64		result;
+	PgStat_StatTabEntry *tabentry;
+
+	if ((tabentry = pgstat_fetch_stat_tabentry(relid)) == NULL)
+		result = 0;
+	else
+		result = (int64) (tabentry->zheap_prunes);
+
+	PG_RETURN_INT64(result);
+}
+
+
+Datum
+pg_stat_get_zheap_undo_bytes(PG_FUNCTION_ARGS)
+{
+	Oid			relid = PG_GETARG_OID(0);
+	int64		result;
+	PgStat_StatTabEntry *tabentry;
+
+	if ((tabentry = pgstat_fetch_stat_tabentry(relid)) == NULL)
+		result = 0;
+	else
+		result = (int64) (tabentry->zheap_undo_bytes);
+
+	PG_RETURN_INT64(result);
+}
+
+
 Datum
 pg_stat_get_live_tuples(PG_FUNCTION_ARGS)
 {
@@ -2026,3 +2090,120 @@ pg_stat_get_archiver(PG_FUNCTION_ARGS)
 	PG_RETURN_DATUM(HeapTupleGetDatum(
 									  heap_form_tuple(tupdesc, values, nulls)));
 }
+
+/*
+ * Is io_op something that can be done on io_object at all?  Operations that
+ * can't are shown as NULL rather than zero.
+ */
+static bool
+pgstat_io_op_valid(IOObject io_object, IOOp io_op)
+{
+	switch (io_object)
+	{
+		case IOOBJECT_TEMP_RELATION:
+			return io_op != IOOP_FSYNC;
+		case IOOBJECT_TEMP_FILE:
+			return io_op == IOOP_READ || io_op == IOOP_WRITE;
+		case IOOBJECT_WAL:
+			return io_op != IOOP_EXTEND;
+		default:
+			return true;
+	}
+}
+
+Datum
+pg_stat_get_io(PG_FUNCTION_ARGS)
+{
+#define PG_STAT_GET_IO_COLS	12
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+	PgStat_IOStats *io_stats;
+	int			type;
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not " \
+						"allowed in this context")));
+
+	/* Build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+	MemoryContextSwitchTo(oldcontext);
+
+	io_stats = pgstat_fetch_stat_io();
+
+	for (type = 0; type < IOBACKEND_NUM_TYPES; type++)
+	{
+		int			object;
+
+		for (object = 0; object < IOOBJECT_NUM_TYPES; object++)
+		{
+			PgStat_IOCounts *counts = &io_stats->counts[type][object];
+			int			context;
+
+			for (context = 0; context < IOCONTEXT_NUM_TYPES; context++)
+			{
+				Datum		values[PG_STAT_GET_IO_COLS];
+				bool		nulls[PG_STAT_GET_IO_COLS];
+				int			op;
+
+				/* only relation data is accessed through strategies */
+				if (object != IOOBJECT_RELATION &&
+					context != IOCONTEXT_NORMAL)
+					continue;
+
+				MemSet(values, 0, sizeof(values));
+				MemSet(nulls, 0, sizeof(nulls));
+
+				values[0] = CStringGetTextDatum(pgstat_get_io_backend_desc((IOBackendType) type));
+				values[1] = CStringGetTextDatum(pgstat_get_io_object_desc((IOObject) object));
+				values[2] = CStringGetTextDatum(pgstat_get_io_context_desc((IOContext) context));
+
+				/* a count and a time, in msec, for each operation */
+				for (op = 0; op < IOOP_NUM_TYPES; op++)
+				{
+					int			col = 3 + op * 2;
+
+					if (!pgstat_io_op_valid((IOObject) object, (IOOp) op))
+					{
+						nulls[col] = true;
+						nulls[col + 1] = true;
+						continue;
+					}
+					values[col] = Int64GetDatum(counts->counts[context][op]);
+					values[col + 1] =
+						Float8GetDatum(((double) counts->times[context][op]) / 1000.0);
+				}
+
+				if (io_stats->stat_reset_timestamp == 0)
+					nulls[11] = true;
+				else
+					values[11] = TimestampTzGetDatum(io_stats->stat_reset_timestamp);
+
+				tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+			}
+		}
+	}
+
+	/* clean up and return the tuplestore */
+	tuplestore_donestoring(tupstore);
+
+	return (Datum) 0;
+}
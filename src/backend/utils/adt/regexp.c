@@ -31,10 +31,12 @@
 
 #include "catalog/pg_type.h"
 #include "funcapi.h"
+#include "lib/ilist.h"
 #include "miscadmin.h"
 #include "regex/regex.h"
 #include "utils/array.h"
 #include "utils/builtins.h"
+#include "utils/hashutils.h"
 #include "utils/memutils.h"
 #include "utils/varlena.h"
 
@@ -74,10 +76,10 @@ typedef struct regexp_matches_ctx
  * Over time, an item's average position corresponds to its frequency of use.
  *
  * When we first create an entry, it's inserted at the front of
- * the array, dropping the entry at the end of the array if necessary to
+ * the list, dropping the entry at the end of the list if necessary to
  * make room.  (This might seem to be weighting the new entry too heavily,
  * but if we insert new entries further back, we'll be unable to adjust to
- * a sudden shift in the query mix where we are presented with MAX_CACHED_RES
+ * a sudden shift in the query mix where we are presented with regex_cache_size
  * never-before-seen items used circularly.  We ought to be able to handle
  * that case, so we have to insert at the front.)
  *
@@ -88,17 +90,30 @@ typedef struct regexp_matches_ctx
  * A reusable pattern that isn't used at least as often as non-reusable
  * patterns are seen will "fail to keep up" and will drop off the end of the
  * cache.  With move-to-front, a reusable pattern is guaranteed to stay in
- * the cache as long as it's used at least once in every MAX_CACHED_RES uses.
+ * the cache as long as it's used at least once in every regex_cache_size
+ * uses.
+ *
+ * The list is a doubly-linked list of separately malloc'd entries, so that
+ * the size of the cache can be configured without making each hit cost a
+ * memmove of the entries ahead of it, and the entries are also chained into
+ * a fixed number of hash buckets so that a lookup doesn't have to compare
+ * the pattern against every cached entry.  A compiled regex also keeps the
+ * DFA state caches built while executing it (see getsaveddfa() in the regex
+ * library), so a cache hit saves that work as well as the compile step.
  */
 
-/* this is the maximum number of cached regular expressions */
-#ifndef MAX_CACHED_RES
-#define MAX_CACHED_RES	32
-#endif
+/* GUC parameter: the maximum number of cached regular expressions */
+int			regex_cache_size = 32;
+
+/* number of hash buckets; must be a power of 2 */
+#define RE_CACHE_NBUCKETS	256
 
 /* this structure describes one cached regular expression */
 typedef struct cached_re_str
 {
+	dlist_node	cre_lru;		/* link in the list of all entries */
+	struct cached_re_str *cre_next; /* next entry in the same hash bucket */
+	uint32		cre_hash;		/* hash of pattern, flags and collation */
 	char	   *cre_pat;		/* original RE (not null terminated!) */
 	int			cre_pat_len;	/* length of original RE, in bytes */
 	int			cre_flags;		/* compile flags: extended,icase etc */
@@ -107,7 +122,8 @@ typedef struct cached_re_str
 } cached_re_str;
 
 static int	num_res = 0;		/* # of cached re's */
-static cached_re_str re_array[MAX_CACHED_RES];	/* cached re's */
+static dlist_head re_lru = DLIST_STATIC_INIT(re_lru);	/* most recent first */
+static cached_re_str *re_buckets[RE_CACHE_NBUCKETS];	/* hash chains */
 
 
 /* Local functions */
@@ -119,6 +135,7 @@ static regexp_matches_ctx *setup_regexp_matches(text *orig_str, text *pattern,
 												bool fetching_unmatched);
 static ArrayType *build_regexp_match_result(regexp_matches_ctx *matchctx);
 static Datum build_regexp_split_result(regexp_matches_ctx *splitctx);
+static void RE_cache_evict(void);
 
 
 /*
@@ -140,34 +157,36 @@ RE_compile_and_cache(text *text_re, int cflags, Oid collation)
 	char	   *text_re_val = VARDATA_ANY(text_re);
 	pg_wchar   *pattern;
 	int			pattern_len;
-	int			i;
+	uint32		hashvalue;
+	cached_re_str **bucket;
+	cached_re_str *cre;
 	int			regcomp_result;
 	cached_re_str re_temp;
 	char		errMsg[100];
 
+	hashvalue = DatumGetUInt32(hash_any((const unsigned char *) text_re_val,
+										text_re_len));
+	hashvalue = hash_combine(hashvalue, (uint32) cflags);
+	hashvalue = hash_combine(hashvalue, (uint32) collation);
+	bucket = &re_buckets[hashvalue & (RE_CACHE_NBUCKETS - 1)];
+
 	/*
-	 * Look for a match among previously compiled REs.  Since the data
-	 * structure is self-organizing with most-used entries at the front, our
-	 * search strategy can just be to scan from the front.
+	 * Look for a match among previously compiled REs.
 	 */
-	for (i = 0; i < num_res; i++)
+	for (cre = *bucket; cre != NULL; cre = cre->cre_next)
 	{
-		if (re_array[i].cre_pat_len == text_re_len &&
-			re_array[i].cre_flags == cflags &&
-			re_array[i].cre_collation == collation &&
-			memcmp(re_array[i].cre_pat, text_re_val, text_re_len) == 0)
+		if (cre->cre_hash == hashvalue &&
+			cre->cre_pat_len == text_re_len &&
+			cre->cre_flags == cflags &&
+			cre->cre_collation == collation &&
+			memcmp(cre->cre_pat, text_re_val, text_re_len) == 0)
 		{
 			/*
 			 * Found a match; move it to front if not there already.
 			 */
-			if (i > 0)
-			{
-				re_temp = re_array[i];
-				memmove(&re_array[1], &re_array[0], i * sizeof(cached_re_str));
-				re_array[0] = re_temp;
-			}
+			dlist_move_head(&re_lru, &cre->cre_lru);
 
-			return &re_array[0].cre_re;
+			return &cre->cre_re;
 		}
 	}
 
@@ -209,43 +228,70 @@ RE_compile_and_cache(text *text_re, int cflags, Oid collation)
 	}
 
 	/*
-	 * We use malloc/free for the cre_pat field because the storage has to
-	 * persist across transactions, and because we want to get control back on
-	 * out-of-memory.  The Max() is because some malloc implementations return
-	 * NULL for malloc(0).
+	 * We use malloc/free for the entry and its cre_pat field because the
+	 * storage has to persist across transactions, and because we want to get
+	 * control back on out-of-memory.  The Max() is because some malloc
+	 * implementations return NULL for malloc(0).
 	 */
+	cre = malloc(sizeof(cached_re_str));
 	re_temp.cre_pat = malloc(Max(text_re_len, 1));
-	if (re_temp.cre_pat == NULL)
+	if (cre == NULL || re_temp.cre_pat == NULL)
 	{
+		if (cre != NULL)
+			free(cre);
+		if (re_temp.cre_pat != NULL)
+			free(re_temp.cre_pat);
 		pg_regfree(&re_temp.cre_re);
 		ereport(ERROR,
 				(errcode(ERRCODE_OUT_OF_MEMORY),
 				 errmsg("out of memory")));
 	}
 	memcpy(re_temp.cre_pat, text_re_val, text_re_len);
+	re_temp.cre_hash = hashvalue;
 	re_temp.cre_pat_len = text_re_len;
 	re_temp.cre_flags = cflags;
 	re_temp.cre_collation = collation;
 
 	/*
-	 * Okay, we have a valid new item in re_temp; insert it into the storage
-	 * array.  Discard last entry if needed.
+	 * Okay, we have a valid new item in re_temp; insert it into the cache.
+	 * Discard the least recently used entries if needed; there can be more
+	 * than one if regex_cache_size has been reduced.
 	 */
-	if (num_res >= MAX_CACHED_RES)
-	{
-		--num_res;
-		Assert(num_res < MAX_CACHED_RES);
-		pg_regfree(&re_array[num_res].cre_re);
-		free(re_array[num_res].cre_pat);
-	}
+	while (num_res >= regex_cache_size && num_res > 0)
+		RE_cache_evict();
 
-	if (num_res > 0)
-		memmove(&re_array[1], &re_array[0], num_res * sizeof(cached_re_str));
-
-	re_array[0] = re_temp;
+	*cre = re_temp;
+	cre->cre_next = *bucket;
+	*bucket = cre;
+	dlist_push_head(&re_lru, &cre->cre_lru);
 	num_res++;
 
-	return &re_array[0].cre_re;
+	return &cre->cre_re;
+}
+
+/*
+ * RE_cache_evict - discard the least recently used cached RE
+ */
+static void
+RE_cache_evict(void)
+{
+	cached_re_str *cre;
+	cached_re_str **prev;
+
+	Assert(num_res > 0);
+	cre = dlist_container(cached_re_str, cre_lru, dlist_tail_node(&re_lru));
+
+	for (prev = &re_buckets[cre->cre_hash & (RE_CACHE_NBUCKETS - 1)];
+		 *prev != cre;
+		 prev = &(*prev)->cre_next)
+		Assert(*prev != NULL);
+	*prev = cre->cre_next;
+	dlist_delete(&cre->cre_lru);
+	num_res--;
+
+	pg_regfree(&cre->cre_re);
+	free(cre->cre_pat);
+	free(cre);
 }
 
 /*
@@ -5704,6 +5704,147 @@ add_predicate_to_index_quals(IndexOptInfo *index, List *indexQuals)
 	return list_concat(predExtraQuals, indexQuals);
 }
 
+/*
+ * Estimate the cost of a btree skip scan, which does a primitive index scan
+ * for each distinct value of the first index column (see nbtutils.c).
+ *
+ * Returns false if a skip scan is not possible, or if statistics don't tell
+ * us the number of distinct values.  Otherwise, returns the total cost of
+ * accessing the index, and the number of index pages visited.
+ */
+static bool
+btcostskipscan(PlannerInfo *root, IndexPath *path, double loop_count,
+			   Cost *skipTotalCost, double *skipPages)
+{
+	IndexOptInfo *index = path->indexinfo;
+	List	   *indexQuals = get_quals_from_indexclauses(path->indexclauses);
+	List	   *indexBoundQuals;
+	TargetEntry *tle;
+	VariableStatData vardata;
+	double		numGroups;
+	double		numIndexTuples;
+	double		numIndexPages;
+	double		spc_random_page_cost;
+	Cost		descentCost;
+	Cost		totalCost;
+	bool		isdefault;
+	int			indexcol;
+	bool		eqQualHere;
+	ListCell   *lc;
+
+	/*
+	 * The scan has to have quals on the second index column but none on the
+	 * first one, and nbtree doesn't combine skipping with array keys.
+	 */
+	if (!enable_indexskipscan || index->nkeycolumns < 2 ||
+		path->indexclauses == NIL ||
+		linitial_node(IndexClause, path->indexclauses)->indexcol != 1)
+		return false;
+	foreach(lc, indexQuals)
+	{
+		RestrictInfo *rinfo = lfirst_node(RestrictInfo, lc);
+
+		if (IsA(rinfo->clause, ScalarArrayOpExpr))
+			return false;
+	}
+
+	/* Every primitive scan visits one of the first column's values */
+	tle = linitial_node(TargetEntry, index->indextlist);
+	examine_variable(root, (Node *) tle->expr, 0, &vardata);
+	numGroups = get_variable_numdistinct(&vardata, &isdefault);
+	ReleaseVariableStats(vardata);
+	if (isdefault)
+		return false;
+	numGroups = Min(numGroups, Max(index->tuples, 1.0));
+
+	/*
+	 * Within each of them, the boundary quals are found in the same way as in
+	 * btcostestimate, only starting at the second column.
+	 */
+	indexBoundQuals = NIL;
+	indexcol = 1;
+	eqQualHere = false;
+	foreach(lc, path->indexclauses)
+	{
+		IndexClause *iclause = lfirst_node(IndexClause, lc);
+		ListCell   *lc2;
+
+		if (indexcol != iclause->indexcol)
+		{
+			if (!eqQualHere)
+				break;
+			eqQualHere = false;
+			indexcol++;
+			if (indexcol != iclause->indexcol)
+				break;
+		}
+
+		foreach(lc2, iclause->indexquals)
+		{
+			RestrictInfo *rinfo = lfirst_node(RestrictInfo, lc2);
+			Expr	   *clause = rinfo->clause;
+
+			if (IsA(clause, OpExpr) &&
+				get_op_opfamily_strategy(((OpExpr *) clause)->opno,
+										 index->opfamily[indexcol]) == BTEqualStrategyNumber)
+				eqQualHere = true;
+			else if (IsA(clause, NullTest) &&
+					 ((NullTest *) clause)->nulltesttype == IS_NULL)
+				eqQualHere = true;
+
+			indexBoundQuals = lappend(indexBoundQuals, rinfo);
+		}
+	}
+
+	numIndexTuples = clauselist_selectivity(root,
+											add_predicate_to_index_quals(index, indexBoundQuals),
+											index->rel->relid,
+											JOIN_INNER,
+											NULL) * index->rel->tuples;
+	numIndexTuples = Max(rint(numIndexTuples), numGroups);
+	numIndexTuples = Min(numIndexTuples, Max(index->tuples, 1.0));
+
+	/* Each primitive scan reads at least one leaf page */
+	if (index->pages > 1 && index->tuples > 1)
+		numIndexPages = numGroups +
+			ceil(numIndexTuples * index->pages / index->tuples);
+	else
+		numIndexPages = 1.0;
+	numIndexPages = Min(numIndexPages, Max(index->pages, 1.0));
+
+	/* Disk access costs, as in genericcostestimate */
+	get_tablespace_page_costs(index->reltablespace,
+							  &spc_random_page_cost,
+							  NULL);
+	if (loop_count > 1)
+		totalCost = index_pages_fetched(numIndexPages * loop_count,
+										index->pages,
+										(double) index->pages,
+										root) *
+			spc_random_page_cost / loop_count;
+	else
+		totalCost = numIndexPages * spc_random_page_cost;
+
+	/* CPU costs, likewise */
+	totalCost += index_other_operands_eval_cost(root, indexQuals);
+	totalCost += numIndexTuples *
+		(cpu_index_tuple_cost + cpu_operator_cost * list_length(indexQuals));
+
+	/*
+	 * Charge for two descents of the tree per value: one to find the value
+	 * and one to start its primitive scan.  The first isn't needed when the
+	 * previous primitive scan runs into the value, but we can't tell how
+	 * often that happens.
+	 */
+	descentCost = (index->tree_height + 1) * 50.0 * cpu_operator_cost;
+	if (index->tuples > 1)
+		descentCost += ceil(log(index->tuples) / log(2.0)) * cpu_operator_cost;
+	totalCost += 2 * numGroups * descentCost;
+
+	*skipTotalCost = totalCost;
+	*skipPages = numIndexPages;
+	return true;
+}
 
 void
 btcostestimate(PlannerInfo *root, IndexPath *path, double loop_count,
@@ -5724,6 +5865,8 @@ btcostestimate(PlannerInfo *root, IndexPath *path, double loop_count,
 	bool		found_saop;
 	bool		found_is_null_op;
 	double		num_sa_scans;
+	Cost		skipTotalCost;
+	double		skipPages;
 	ListCell   *lc;
 
 	/*
@@ -5904,6 +6047,19 @@ btcostestimate(PlannerInfo *root, IndexPath *path, double loop_count,
 	costs.indexStartupCost += descentCost;
 	costs.indexTotalCost += costs.num_sa_scans * descentCost;
 
+	/*
+	 * Without quals on the first index column, the scan has to read the whole
+	 * index.  If that column has few distinct values, skipping over them and
+	 * doing a bounded primitive scan for each can be much cheaper.
+	 */
+	if (btcostskipscan(root, path, loop_count, &skipTotalCost, &skipPages) &&
+		skipTotalCost < costs.indexTotalCost)
+	{
+		path->indexskipscan = true;
+		costs.indexTotalCost = skipTotalCost;
+		costs.numIndexPages = skipPages;
+	}
+
 	/*
 	 * If we can get an estimate of the first column's ordering correlation C
 	 * from pg_statistic, estimate the index correlation as C for a
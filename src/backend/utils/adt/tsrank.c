@@ -16,6 +16,7 @@
 #include <limits.h>
 #include <math.h>
 
+#include "access/tuptoaster.h"
 #include "tsearch/ts_utils.h"
 #include "utils/array.h"
 #include "utils/builtins.h"
@@ -35,6 +36,15 @@ static const float weights[] = {0.1f, 0.2f, 0.4f, 1.0f};
 #define RANK_NORM_RDIVRPLUS1	0x20
 #define DEF_NORM_METHOD			RANK_NO_NORM
 
+/* normalization methods that need every entry of the document */
+#define RANK_NORM_NEEDS_DOC		(RANK_NORM_LOGLENGTH | RANK_NORM_LENGTH)
+
+/*
+ * Out-of-line tsvectors at least this large are fetched a part at a time, see
+ * fetch_tsvector_for_query()
+ */
+#define RANK_SLICE_MIN_SIZE		(16 * TOAST_MAX_CHUNK_SIZE)
+
 static float calc_rank_or(const float *w, TSVector t, TSQuery q);
 static float calc_rank_and(const float *w, TSVector t, TSQuery q);
 
@@ -128,6 +138,205 @@ find_wordentry(TSVector t, TSQuery q, QueryOperand *item, int32 *nitem)
 	return (*nitem > 0) ? StopHigh : NULL;
 }
 
+/*
+ * Compare the lexeme of entry 'e' of the out-of-line tsvector 'attr', whose
+ * lexemes start at offset 'stroff', with 'item' from 'q', as
+ * WordECompareQueryItem does.
+ */
+static int
+compare_entry_slice(struct varlena *attr, int32 stroff, WordEntry *e,
+					TSQuery q, QueryOperand *item, bool prefix)
+{
+	struct varlena *lexeme;
+	int			res;
+
+	lexeme = pg_detoast_datum_slice(attr, stroff + e->pos, e->len);
+	res = tsCompareString(GETOPERAND(q) + item->distance, item->length,
+						  VARDATA(lexeme), e->len, prefix);
+	pfree(lexeme);
+
+	return res;
+}
+
+/*
+ * Fetch the tsvector 'd' for ranking it against 'q' with normalization
+ * 'method', and return the number of entries of the whole document in
+ * *docsize.
+ *
+ * Ranking only looks at the entries of the lexemes in the query.  When a big
+ * tsvector is stored out of line without compression, it is much cheaper to
+ * fetch its entry array and then just the lexemes and positions the query
+ * needs than to fetch the whole value, so in that case the result is a
+ * tsvector holding only the matching entries.  Otherwise, and when the
+ * normalization needs the length of the whole document, it is the detoasted
+ * tsvector as usual.  Either way the caller is to free it if it isn't the
+ * argument itself, as with PG_FREE_IF_COPY.
+ */
+static TSVector
+fetch_tsvector_for_query(Datum d, TSQuery q, int method, int32 *docsize)
+{
+	struct varlena *attr = (struct varlena *) DatumGetPointer(d);
+	struct varatt_external toast_pointer;
+	QueryItem  *item = GETQUERY(q);
+	struct varlena *slice;
+	struct varlena *entryslice;
+	WordEntry  *entries;
+	int32		nentries;
+	int32		stroff;
+	bool	   *wanted;
+	int32		nwanted = 0;
+	int32		lenstr = 0;
+	int32		dataoff = 0;
+	TSVector	res;
+	WordEntry  *resentry;
+	int32		i;
+
+	if (!VARATT_IS_EXTERNAL_ONDISK(attr) || (method & RANK_NORM_NEEDS_DOC))
+	{
+		res = DatumGetTSVector(d);
+		*docsize = res->size;
+		return res;
+	}
+
+	VARATT_EXTERNAL_GET_POINTER(toast_pointer, attr);
+	if (VARATT_EXTERNAL_IS_COMPRESSED(toast_pointer) ||
+		VARATT_EXTERNAL_GET_EXTSIZE(toast_pointer) < RANK_SLICE_MIN_SIZE)
+	{
+		res = DatumGetTSVector(d);
+		*docsize = res->size;
+		return res;
+	}
+
+	/* offsets below are relative to the size field, which follows vl_len_ */
+	slice = pg_detoast_datum_slice(attr, 0, sizeof(int32));
+	memcpy(&nentries, VARDATA(slice), sizeof(int32));
+	pfree(slice);
+	*docsize = nentries;
+
+	entryslice = pg_detoast_datum_slice(attr, sizeof(int32),
+										nentries * sizeof(WordEntry));
+	entries = (WordEntry *) VARDATA(entryslice);
+	stroff = sizeof(int32) + nentries * sizeof(WordEntry);
+
+	/* find the entries of the query's lexemes, as find_wordentry does */
+	wanted = (bool *) palloc0(Max(nentries, 1) * sizeof(bool));
+	for (i = 0; i < q->size; i++)
+	{
+		QueryOperand *operand;
+		int32		lo = 0,
+					hi = nentries,
+					mid;
+		int			difference;
+		bool		found = false;
+
+		if (item[i].type != QI_VAL)
+			continue;
+		operand = &item[i].qoperand;
+
+		while (lo < hi)
+		{
+			mid = lo + (hi - lo) / 2;
+			difference = compare_entry_slice(attr, stroff, &entries[mid],
+											 q, operand, false);
+			if (difference == 0)
+			{
+				hi = mid;
+				found = true;
+				break;
+			}
+			else if (difference > 0)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+
+		if (operand->prefix)
+		{
+			for (mid = hi; mid < nentries; mid++)
+			{
+				if (compare_entry_slice(attr, stroff, &entries[mid],
+										q, operand, true) != 0)
+					break;
+				wanted[mid] = true;
+			}
+		}
+		else if (found)
+			wanted[hi] = true;
+	}
+
+	/* work out the size of the lexemes and positions of those entries */
+	for (i = 0; i < nentries; i++)
+	{
+		if (!wanted[i])
+			continue;
+		nwanted++;
+		lenstr += entries[i].len;
+		if (entries[i].haspos)
+		{
+			WordEntry  *e = &entries[i];
+			uint16		npos;
+
+			slice = pg_detoast_datum_slice(attr,
+										   stroff + SHORTALIGN(e->pos + e->len),
+										   sizeof(uint16));
+			memcpy(&npos, VARDATA(slice), sizeof(uint16));
+			pfree(slice);
+			lenstr = SHORTALIGN(lenstr) + sizeof(uint16) +
+				npos * sizeof(WordEntryPos);
+		}
+	}
+
+	/* and assemble a tsvector of them, laid out as tsvectorin does */
+	res = (TSVector) palloc0(CALCDATASIZE(nwanted, lenstr));
+	SET_VARSIZE(res, CALCDATASIZE(nwanted, lenstr));
+	res->size = nwanted;
+	resentry = ARRPTR(res);
+	for (i = 0; i < nentries; i++)
+	{
+		WordEntry  *e = &entries[i];
+		int32		len;
+
+		if (!wanted[i])
+			continue;
+
+		len = e->len;
+		if (e->haspos)
+			len = SHORTALIGN(e->pos + e->len) - e->pos + sizeof(uint16);
+		slice = pg_detoast_datum_slice(attr, stroff + e->pos, len);
+		memcpy(STRPTR(res) + dataoff, VARDATA(slice), e->len);
+
+		*resentry = *e;
+		resentry->pos = dataoff;
+		dataoff += e->len;
+
+		if (e->haspos)
+		{
+			uint16		npos;
+
+			memcpy(&npos, VARDATA(slice) + len - sizeof(uint16),
+				   sizeof(uint16));
+			pfree(slice);
+
+			dataoff = SHORTALIGN(dataoff);
+			slice = pg_detoast_datum_slice(attr,
+										   stroff + e->pos + len,
+										   npos * sizeof(WordEntryPos));
+			memcpy(STRPTR(res) + dataoff, &npos, sizeof(uint16));
+			memcpy(STRPTR(res) + dataoff + sizeof(uint16), VARDATA(slice),
+				   npos * sizeof(WordEntryPos));
+			dataoff += sizeof(uint16) + npos * sizeof(WordEntryPos);
+		}
+		pfree(slice);
+		resentry++;
+	}
+	Assert(dataoff == lenstr);
+
+	pfree(wanted);
+	pfree(entryslice);
+
+	return res;
+}
+
 
 /*
  * sort QueryOperands by (length, word)
@@ -354,14 +563,18 @@ calc_rank_or(const float *w, TSVector t, TSQuery q)
 	return res;
 }
 
+/*
+ * docsize is the number of entries of the whole document, which t may be
+ * only a part of; see fetch_tsvector_for_query().
+ */
 static float
-calc_rank(const float *w, TSVector t, TSQuery q, int32 method)
+calc_rank(const float *w, TSVector t, int32 docsize, TSQuery q, int32 method)
 {
 	QueryItem  *item = GETQUERY(q);
 	float		res = 0.0;
 	int			len;
 
-	if (!t->size || !q->size)
+	if (!docsize || !q->size)
 		return 0.0;
 
 	/* XXX: What about NOT? */
@@ -373,7 +586,7 @@ calc_rank(const float *w, TSVector t, TSQuery q, int32 method)
 	if (res < 0)
 		res = 1e-20f;
 
-	if ((method & RANK_NORM_LOGLENGTH) && t->size > 0)
+	if ((method & RANK_NORM_LOGLENGTH) && docsize > 0)
 		res /= log((double) (cnt_length(t) + 1)) / log(2.0);
 
 	if (method & RANK_NORM_LENGTH)
@@ -385,11 +598,11 @@ calc_rank(const float *w, TSVector t, TSQuery q, int32 method)
 
 	/* RANK_NORM_EXTDIST not applicable */
 
-	if ((method & RANK_NORM_UNIQ) && t->size > 0)
-		res /= (float) (t->size);
+	if ((method & RANK_NORM_UNIQ) && docsize > 0)
+		res /= (float) docsize;
 
-	if ((method & RANK_NORM_LOGUNIQ) && t->size > 0)
-		res /= log((double) (t->size + 1)) / log(2.0);
+	if ((method & RANK_NORM_LOGUNIQ) && docsize > 0)
+		res /= log((double) (docsize + 1)) / log(2.0);
 
 	if (method & RANK_NORM_RDIVRPLUS1)
 		res /= (res + 1);
@@ -439,12 +652,14 @@ Datum
 ts_rank_wttf(PG_FUNCTION_ARGS)
 {
 	ArrayType  *win = (ArrayType *) PG_DETOAST_DATUM(PG_GETARG_DATUM(0));
-	TSVector	txt = PG_GETARG_TSVECTOR(1);
 	TSQuery		query = PG_GETARG_TSQUERY(2);
 	int			method = PG_GETARG_INT32(3);
+	int32		docsize;
+	TSVector	txt = fetch_tsvector_for_query(PG_GETARG_DATUM(1), query,
+											   method, &docsize);
 	float		res;
 
-	res = calc_rank(getWeights(win), txt, query, method);
+	res = calc_rank(getWeights(win), txt, docsize, query, method);
 
 	PG_FREE_IF_COPY(win, 0);
 	PG_FREE_IF_COPY(txt, 1);
@@ -456,11 +671,13 @@ Datum
 ts_rank_wtt(PG_FUNCTION_ARGS)
 {
 	ArrayType  *win = (ArrayType *) PG_DETOAST_DATUM(PG_GETARG_DATUM(0));
-	TSVector	txt = PG_GETARG_TSVECTOR(1);
 	TSQuery		query = PG_GETARG_TSQUERY(2);
+	int32		docsize;
+	TSVector	txt = fetch_tsvector_for_query(PG_GETARG_DATUM(1), query,
+											   DEF_NORM_METHOD, &docsize);
 	float		res;
 
-	res = calc_rank(getWeights(win), txt, query, DEF_NORM_METHOD);
+	res = calc_rank(getWeights(win), txt, docsize, query, DEF_NORM_METHOD);
 
 	PG_FREE_IF_COPY(win, 0);
 	PG_FREE_IF_COPY(txt, 1);
@@ -471,12 +688,14 @@ ts_rank_wtt(PG_FUNCTION_ARGS)
 Datum
 ts_rank_ttf(PG_FUNCTION_ARGS)
 {
-	TSVector	txt = PG_GETARG_TSVECTOR(0);
 	TSQuery		query = PG_GETARG_TSQUERY(1);
 	int			method = PG_GETARG_INT32(2);
+	int32		docsize;
+	TSVector	txt = fetch_tsvector_for_query(PG_GETARG_DATUM(0), query,
+											   method, &docsize);
 	float		res;
 
-	res = calc_rank(getWeights(NULL), txt, query, method);
+	res = calc_rank(getWeights(NULL), txt, docsize, query, method);
 
 	PG_FREE_IF_COPY(txt, 0);
 	PG_FREE_IF_COPY(query, 1);
@@ -486,11 +705,13 @@ ts_rank_ttf(PG_FUNCTION_ARGS)
 Datum
 ts_rank_tt(PG_FUNCTION_ARGS)
 {
-	TSVector	txt = PG_GETARG_TSVECTOR(0);
 	TSQuery		query = PG_GETARG_TSQUERY(1);
+	int32		docsize;
+	TSVector	txt = fetch_tsvector_for_query(PG_GETARG_DATUM(0), query,
+											   DEF_NORM_METHOD, &docsize);
 	float		res;
 
-	res = calc_rank(getWeights(NULL), txt, query, DEF_NORM_METHOD);
+	res = calc_rank(getWeights(NULL), txt, docsize, query, DEF_NORM_METHOD);
 
 	PG_FREE_IF_COPY(txt, 0);
 	PG_FREE_IF_COPY(query, 1);
@@ -844,7 +1065,8 @@ get_docrep(TSVector txt, QueryRepresentation *qr, int *doclen)
 }
 
 static float4
-calc_rank_cd(const float4 *arrdata, TSVector txt, TSQuery query, int method)
+calc_rank_cd(const float4 *arrdata, TSVector txt, int32 docsize, TSQuery query,
+			 int method)
 {
 	DocRepresentation *doc;
 	int			len,
@@ -917,7 +1139,7 @@ calc_rank_cd(const float4 *arrdata, TSVector txt, TSQuery query, int method)
 		NExtent++;
 	}
 
-	if ((method & RANK_NORM_LOGLENGTH) && txt->size > 0)
+	if ((method & RANK_NORM_LOGLENGTH) && docsize > 0)
 		Wdoc /= log((double) (cnt_length(txt) + 1));
 
 	if (method & RANK_NORM_LENGTH)
@@ -930,11 +1152,11 @@ calc_rank_cd(const float4 *arrdata, TSVector txt, TSQuery query, int method)
 	if ((method & RANK_NORM_EXTDIST) && NExtent > 0 && SumDist > 0)
 		Wdoc /= ((double) NExtent) / SumDist;
 
-	if ((method & RANK_NORM_UNIQ) && txt->size > 0)
-		Wdoc /= (double) (txt->size);
+	if ((method & RANK_NORM_UNIQ) && docsize > 0)
+		Wdoc /= (double) docsize;
 
-	if ((method & RANK_NORM_LOGUNIQ) && txt->size > 0)
-		Wdoc /= log((double) (txt->size + 1)) / log(2.0);
+	if ((method & RANK_NORM_LOGUNIQ) && docsize > 0)
+		Wdoc /= log((double) (docsize + 1)) / log(2.0);
 
 	if (method & RANK_NORM_RDIVRPLUS1)
 		Wdoc /= (Wdoc + 1);
@@ -950,12 +1172,14 @@ Datum
 ts_rankcd_wttf(PG_FUNCTION_ARGS)
 {
 	ArrayType  *win = (ArrayType *) PG_DETOAST_DATUM(PG_GETARG_DATUM(0));
-	TSVector	txt = PG_GETARG_TSVECTOR(1);
 	TSQuery		query = PG_GETARG_TSQUERY(2);
 	int			method = PG_GETARG_INT32(3);
+	int32		docsize;
+	TSVector	txt = fetch_tsvector_for_query(PG_GETARG_DATUM(1), query,
+											   method, &docsize);
 	float		res;
 
-	res = calc_rank_cd(getWeights(win), txt, query, method);
+	res = calc_rank_cd(getWeights(win), txt, docsize, query, method);
 
 	PG_FREE_IF_COPY(win, 0);
 	PG_FREE_IF_COPY(txt, 1);
@@ -967,11 +1191,13 @@ Datum
 ts_rankcd_wtt(PG_FUNCTION_ARGS)
 {
 	ArrayType  *win = (ArrayType *) PG_DETOAST_DATUM(PG_GETARG_DATUM(0));
-	TSVector	txt = PG_GETARG_TSVECTOR(1);
 	TSQuery		query = PG_GETARG_TSQUERY(2);
+	int32		docsize;
+	TSVector	txt = fetch_tsvector_for_query(PG_GETARG_DATUM(1), query,
+											   DEF_NORM_METHOD, &docsize);
 	float		res;
 
-	res = calc_rank_cd(getWeights(win), txt, query, DEF_NORM_METHOD);
+	res = calc_rank_cd(getWeights(win), txt, docsize, query, DEF_NORM_METHOD);
 
 	PG_FREE_IF_COPY(win, 0);
 	PG_FREE_IF_COPY(txt, 1);
@@ -982,12 +1208,14 @@ ts_rankcd_wtt(PG_FUNCTION_ARGS)
 Datum
 ts_rankcd_ttf(PG_FUNCTION_ARGS)
 {
-	TSVector	txt = PG_GETARG_TSVECTOR(0);
 	TSQuery		query = PG_GETARG_TSQUERY(1);
 	int			method = PG_GETARG_INT32(2);
+	int32		docsize;
+	TSVector	txt = fetch_tsvector_for_query(PG_GETARG_DATUM(0), query,
+											   method, &docsize);
 	float		res;
 
-	res = calc_rank_cd(getWeights(NULL), txt, query, method);
+	res = calc_rank_cd(getWeights(NULL), txt, docsize, query, method);
 
 	PG_FREE_IF_COPY(txt, 0);
 	PG_FREE_IF_COPY(query, 1);
@@ -997,11 +1225,13 @@ ts_rankcd_ttf(PG_FUNCTION_ARGS)
 Datum
 ts_rankcd_tt(PG_FUNCTION_ARGS)
 {
-	TSVector	txt = PG_GETARG_TSVECTOR(0);
 	TSQuery		query = PG_GETARG_TSQUERY(1);
+	int32		docsize;
+	TSVector	txt = fetch_tsvector_for_query(PG_GETARG_DATUM(0), query,
+											   DEF_NORM_METHOD, &docsize);
 	float		res;
 
-	res = calc_rank_cd(getWeights(NULL), txt, query, DEF_NORM_METHOD);
+	res = calc_rank_cd(getWeights(NULL), txt, docsize, query, DEF_NORM_METHOD);
 
 	PG_FREE_IF_COPY(txt, 0);
 	PG_FREE_IF_COPY(query, 1);
@@ -24,6 +24,7 @@
 #include "catalog/pg_collation.h"
 #include "catalog/pg_operator.h"
 #include "catalog/pg_type.h"
+#include "funcapi.h"
 #include "miscadmin.h"
 #ifdef CATCACHE_STATS
 #include "storage/ipc.h"		/* for on_proc_exit */
@@ -38,6 +39,7 @@
 #include "utils/rel.h"
 #include "utils/resowner_private.h"
 #include "utils/syscache.h"
+#include "utils/tuplestore.h"
 
 
  /* #define CACHEDEBUG */	/* turns DEBUG elogs on */
@@ -63,6 +65,9 @@
 /* Cache management header --- pointer is NULL until created */
 static CatCacheHeader *CacheHdr = NULL;
 
+/* GUC parameter: memory target of all catcaches together, in kB */
+int			catalog_cache_memory_target = 0;
+
 static inline HeapTuple SearchCatCacheInternal(CatCache *cache,
 											   int nkeys,
 											   Datum v1, Datum v2,
@@ -88,6 +93,7 @@ static void CatCachePrintStats(int code, Datum arg);
 #endif
 static void CatCacheRemoveCTup(CatCache *cache, CatCTup *ct);
 static void CatCacheRemoveCList(CatCache *cache, CatCList *cl);
+static void CatCacheEvict(CatCTup *newct);
 static void CatalogCacheInitializeCache(CatCache *cache);
 static CatCTup *CatalogCacheCreateEntry(CatCache *cache, HeapTuple ntp,
 										Datum *arguments,
@@ -471,16 +477,23 @@ CatCacheRemoveCTup(CatCache *cache, CatCTup *ct)
 		return;					/* nothing left to do */
 	}
 
-	/* delink from linked list */
+	/* delink from linked lists */
 	dlist_delete(&ct->cache_elem);
+	dlist_delete(&ct->lru_elem);
+
+	cache->cc_memory -= GetMemoryChunkSpace(ct);
+	CacheHdr->ch_memory -= GetMemoryChunkSpace(ct);
 
 	/*
 	 * Free keys when we're dealing with a negative entry, normal entries just
 	 * point into tuple, allocated together with the CatCTup.
 	 */
 	if (ct->negative)
+	{
 		CatCacheFreeKeys(cache->cc_tupdesc, cache->cc_nkeys,
 						 cache->cc_keyno, ct->keys);
+		--cache->cc_nnegative;
+	}
 
 	pfree(ct);
 
@@ -802,6 +815,8 @@ InitCatCache(int id,
 		CacheHdr = (CatCacheHeader *) palloc(sizeof(CatCacheHeader));
 		slist_init(&CacheHdr->ch_caches);
 		CacheHdr->ch_ntup = 0;
+		dlist_init(&CacheHdr->ch_lru);
+		CacheHdr->ch_memory = 0;
 #ifdef CATCACHE_STATS
 		/* set up to dump stats at backend exit */
 		on_proc_exit(CatCachePrintStats, 0);
@@ -1263,6 +1278,8 @@ SearchCatCacheInternal(CatCache *cache,
 		 * near the front of the hashbucket's list.)
 		 */
 		dlist_move_head(bucket, &ct->cache_elem);
+		dlist_move_head(&CacheHdr->ch_lru, &ct->lru_elem);
+		cache->cc_nhits++;
 
 		/*
 		 * If it's a positive entry, bump its refcount and return it. If it's
@@ -1329,6 +1346,8 @@ SearchCatCacheMiss(CatCache *cache,
 	arguments[2] = v3;
 	arguments[3] = v4;
 
+	cache->cc_nmisses++;
+
 	/*
 	 * Ok, need to make a lookup in the relation, copy the scankey and fill
 	 * out any per-call fields.
@@ -1890,9 +1909,22 @@ CatalogCacheCreateEntry(CatCache *cache, HeapTuple ntp, Datum *arguments,
 	ct->hash_value = hashValue;
 
 	dlist_push_head(&cache->cc_bucket[hashIndex], &ct->cache_elem);
+	dlist_push_head(&CacheHdr->ch_lru, &ct->lru_elem);
 
 	cache->cc_ntup++;
 	CacheHdr->ch_ntup++;
+	cache->cc_memory += GetMemoryChunkSpace(ct);
+	CacheHdr->ch_memory += GetMemoryChunkSpace(ct);
+	if (negative)
+		cache->cc_nnegative++;
+
+	/*
+	 * If the caches have outgrown catalog_cache_memory_target, make room by
+	 * evicting the least recently used entries.
+	 */
+	if (catalog_cache_memory_target > 0 &&
+		CacheHdr->ch_memory > (Size) catalog_cache_memory_target * 1024)
+		CatCacheEvict(ct);
 
 	/*
 	 * If the hash table has become too full, enlarge the buckets array. Quite
@@ -1904,6 +1936,55 @@ CatalogCacheCreateEntry(CatCache *cache, HeapTuple ntp, Datum *arguments,
 	return ct;
 }
 
+/*
+ * CatCacheEvict
+ *		Remove unreferenced entries, least recently used first, until the
+ *		caches fit in catalog_cache_memory_target again.
+ *
+ * Negative entries and positive ones are treated alike.  Entries that are
+ * referenced, directly or through a CatCList, are skipped; an unreferenced
+ * CatCList is removed along with its member.  newct, the entry that was just
+ * created, is never removed.
+ */
+static void
+CatCacheEvict(CatCTup *newct)
+{
+	Size		target = (Size) catalog_cache_memory_target * 1024;
+	dlist_node *cur;
+	dlist_node *prev;
+
+	for (cur = CacheHdr->ch_lru.head.prev;
+		 cur != &CacheHdr->ch_lru.head && CacheHdr->ch_memory > target;
+		 cur = prev)
+	{
+		CatCTup    *ct = dlist_container(CatCTup, lru_elem, cur);
+		CatCache   *cache = ct->my_cache;
+		bool		had_list = (ct->c_list != NULL);
+
+		prev = cur->prev;
+
+		if (ct == newct || ct->refcount > 0 || ct->dead)
+			continue;
+
+		if (had_list)
+		{
+			if (ct->c_list->refcount > 0)
+				continue;
+			CatCacheRemoveCList(cache, ct->c_list);
+		}
+
+		cache->cc_nevicted++;
+		CatCacheRemoveCTup(cache, ct);
+
+		/*
+		 * Removing a list may have removed other members of it too, so start
+		 * over from the tail in that case.
+		 */
+		if (had_list)
+			prev = CacheHdr->ch_lru.head.prev;
+	}
+}
+
 /*
  * Helper routine that frees keys stored in the keys array.
  */
@@ -2090,3 +2171,71 @@ PrintCatCacheListLeakWarning(CatCList *list)
 		 list->my_cache->cc_relname, list->my_cache->id,
 		 list, list->refcount);
 }
+
+
+/*
+ * SQL-callable function for the pg_stat_catcache view: one row for each
+ * catcache of this backend.
+ */
+Datum
+pg_stat_get_catcache(PG_FUNCTION_ARGS)
+{
+#define PG_STAT_GET_CATCACHE_COLS	9
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+	slist_iter	iter;
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not " \
+						"allowed in this context")));
+
+	/* Build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	slist_foreach(iter, &CacheHdr->ch_caches)
+	{
+		CatCache   *cache = slist_container(CatCache, cc_next, iter.cur);
+		Datum		values[PG_STAT_GET_CATCACHE_COLS];
+		bool		nulls[PG_STAT_GET_CATCACHE_COLS];
+
+		MemSet(nulls, 0, sizeof(nulls));
+
+		values[0] = Int32GetDatum(cache->id);
+		values[1] = ObjectIdGetDatum(cache->cc_reloid);
+		values[2] = ObjectIdGetDatum(cache->cc_indexoid);
+		values[3] = Int64GetDatum(cache->cc_ntup);
+		values[4] = Int64GetDatum(cache->cc_nnegative);
+		values[5] = Int64GetDatum(cache->cc_memory);
+		values[6] = Int64GetDatum(cache->cc_nhits);
+		values[7] = Int64GetDatum(cache->cc_nmisses);
+		values[8] = Int64GetDatum(cache->cc_nevicted);
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	/* clean up and return the tuplestore */
+	tuplestore_donestoring(tupstore);
+
+	return (Datum) 0;
+}
@@ -71,6 +71,7 @@
 #include "utils/memutils.h"
 #include "utils/resowner_private.h"
 #include "utils/rls.h"
+#include "utils/sharedplancache.h"
 #include "utils/snapmgr.h"
 #include "utils/syscache.h"
 
@@ -100,6 +101,8 @@ static void ReleaseGenericPlan(CachedPlanSource *plansource);
 static List *RevalidateCachedQuery(CachedPlanSource *plansource,
 								   QueryEnvironment *queryEnv);
 static bool CheckCachedPlan(CachedPlanSource *plansource);
+static bool PlanSourceIsShareable(CachedPlanSource *plansource,
+								  QueryEnvironment *queryEnv);
 static CachedPlan *BuildCachedPlan(CachedPlanSource *plansource, List *qlist,
 								   ParamListInfo boundParams, QueryEnvironment *queryEnv);
 static bool choose_custom_plan(CachedPlanSource *plansource,
@@ -857,6 +860,28 @@ CheckCachedPlan(CachedPlanSource *plansource)
 	return false;
 }
 
+/*
+ * PlanSourceIsShareable: can generic plans for this plansource be shared with
+ * other backends through sharedplancache.c?
+ *
+ * Only saved plansources whose meaning is fixed by their query text and
+ * parameter types qualify; in particular not those with a parser hook, whose
+ * parameters can stand for anything (think PL/pgSQL variables).  Plans that
+ * depend on RLS or ephemeral named relations are not shared either.
+ */
+static bool
+PlanSourceIsShareable(CachedPlanSource *plansource, QueryEnvironment *queryEnv)
+{
+	return shared_plan_cache_size > 0 &&
+		plansource->is_saved &&
+		!plansource->is_oneshot &&
+		plansource->raw_parse_tree != NULL &&
+		plansource->parserSetup == NULL &&
+		!plansource->dependsOnRLS &&
+		queryEnv == NULL &&
+		!IsTransactionStmtPlan(plansource);
+}
+
 /*
  * BuildCachedPlan: construct a new CachedPlan from a CachedPlanSource.
  *
@@ -878,9 +903,11 @@ BuildCachedPlan(CachedPlanSource *plansource, List *qlist,
 				ParamListInfo boundParams, QueryEnvironment *queryEnv)
 {
 	CachedPlan *plan;
-	List	   *plist;
+	List	   *plist = NIL;
 	bool		snapshot_set;
 	bool		is_transient;
+	bool		shareable;
+	uint64		inval_generation = 0;
 	MemoryContext plan_context;
 	MemoryContext oldcxt = CurrentMemoryContext;
 	ListCell   *lc;
@@ -902,39 +929,77 @@ BuildCachedPlan(CachedPlanSource *plansource, List *qlist,
 		qlist = RevalidateCachedQuery(plansource, queryEnv);
 
 	/*
-	 * If we don't already have a copy of the querytree list that can be
-	 * scribbled on by the planner, make one.  For a one-shot plan, we assume
-	 * it's okay to scribble on the original query_list.
+	 * Another backend may have made the same generic plan already.  It held
+	 * the locks the plan needs, but we don't; take them, and if that brings
+	 * in any invalidation, don't trust the plan.
 	 */
-	if (qlist == NIL)
+	shareable = boundParams == NULL &&
+		PlanSourceIsShareable(plansource, queryEnv);
+	if (shareable)
 	{
-		if (!plansource->is_oneshot)
-			qlist = copyObject(plansource->query_list);
-		else
-			qlist = plansource->query_list;
+		inval_generation = SharedPlanCacheInvalGeneration();
+		plist = SharedPlanCacheLookup(plansource);
+		if (plist != NIL)
+		{
+			AcquireExecutorLocks(plist, true);
+			if (SharedPlanCacheInvalGeneration() != inval_generation ||
+				!plansource->is_valid)
+			{
+				AcquireExecutorLocks(plist, false);
+				plist = NIL;
+				if (!plansource->is_valid)
+					qlist = RevalidateCachedQuery(plansource, queryEnv);
+				inval_generation = SharedPlanCacheInvalGeneration();
+			}
+		}
 	}
 
-	/*
-	 * If a snapshot is already set (the normal case), we can just use that
-	 * for planning.  But if it isn't, and we need one, install one.
-	 */
-	snapshot_set = false;
-	if (!ActiveSnapshotSet() &&
-		plansource->raw_parse_tree &&
-		analyze_requires_snapshot(plansource->raw_parse_tree))
+	if (plist == NIL)
 	{
-		PushActiveSnapshot(GetTransactionSnapshot());
-		snapshot_set = true;
-	}
+		/*
+		 * If we don't already have a copy of the querytree list that can be
+		 * scribbled on by the planner, make one.  For a one-shot plan, we
+		 * assume it's okay to scribble on the original query_list.
+		 */
+		if (qlist == NIL)
+		{
+			if (!plansource->is_oneshot)
+				qlist = copyObject(plansource->query_list);
+			else
+				qlist = plansource->query_list;
+		}
 
-	/*
-	 * Generate the plan.
-	 */
-	plist = pg_plan_queries(qlist, plansource->cursor_options, boundParams);
+		/*
+		 * If a snapshot is already set (the normal case), we can just use
+		 * that for planning.  But if it isn't, and we need one, install one.
+		 */
+		snapshot_set = false;
+		if (!ActiveSnapshotSet() &&
+			plansource->raw_parse_tree &&
+			analyze_requires_snapshot(plansource->raw_parse_tree))
+		{
+			PushActiveSnapshot(GetTransactionSnapshot());
+			snapshot_set = true;
+		}
 
-	/* Release snapshot if we got one */
-	if (snapshot_set)
-		PopActiveSnapshot();
+		/*
+		 * Generate the plan.
+		 */
+		plist = pg_plan_queries(qlist, plansource->cursor_options, boundParams);
+
+		/* Release snapshot if we got one */
+		if (snapshot_set)
+			PopActiveSnapshot();
+
+		/*
+		 * Offer the plan to other backends, unless an invalidation arrived
+		 * while we were planning; it might not have been taken into account.
+		 */
+		if (shareable &&
+			SharedPlanCacheInvalGeneration() == inval_generation &&
+			plansource->is_valid)
+			SharedPlanCacheStore(plansource, plist);
+	}
 
 	/*
 	 * Normally we make a dedicated memory context for the CachedPlan and its
@@ -1765,6 +1830,8 @@ PlanCacheRelCallback(Datum arg, Oid relid)
 {
 	dlist_iter	iter;
 
+	SharedPlanCacheInvalidateRel(relid);
+
 	dlist_foreach(iter, &saved_plan_list)
 	{
 		CachedPlanSource *plansource = dlist_container(CachedPlanSource,
@@ -1849,6 +1916,8 @@ PlanCacheObjectCallback(Datum arg, int cacheid, uint32 hashvalue)
 {
 	dlist_iter	iter;
 
+	SharedPlanCacheInvalidateObject(cacheid, hashvalue);
+
 	dlist_foreach(iter, &saved_plan_list)
 	{
 		CachedPlanSource *plansource = dlist_container(CachedPlanSource,
@@ -1956,6 +2025,7 @@ PlanCacheObjectCallback(Datum arg, int cacheid, uint32 hashvalue)
 static void
 PlanCacheSysCallback(Datum arg, int cacheid, uint32 hashvalue)
 {
+	SharedPlanCacheReset();
 	ResetPlanCache();
 }
 
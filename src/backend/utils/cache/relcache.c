@@ -67,6 +67,7 @@
 #include "catalog/storage.h"
 #include "commands/policy.h"
 #include "commands/trigger.h"
+#include "funcapi.h"
 #include "miscadmin.h"
 #include "nodes/makefuncs.h"
 #include "nodes/nodeFuncs.h"
@@ -130,10 +131,25 @@ typedef struct relidcacheent
 {
 	Oid			reloid;
 	Relation	reldesc;
+	uint64		lastused;		/* relcacheClock at last lookup */
+	Size		size;			/* memory used by reldesc when inserted */
 } RelIdCacheEnt;
 
 static HTAB *RelationIdCache;
 
+/*
+ * Bookkeeping for keeping the relcache within catalog_cache_memory_target.
+ * relcacheClock is advanced by every lookup, so that the entries with the
+ * smallest lastused are the least recently used ones.  relcacheMemory is the
+ * sum of the entries' sizes; an entry's size is only measured when it is
+ * inserted, so information loaded lazily later on is not accounted for.
+ */
+static uint64 relcacheClock = 0;
+static Size relcacheMemory = 0;
+static uint64 relcacheHits = 0;
+static uint64 relcacheMisses = 0;
+static uint64 relcacheEvictions = 0;
+
 /*
  * This flag is false until we have prepared the critical relcache entries
  * that are needed to do indexscans on the tables read by relcache building.
@@ -195,6 +211,11 @@ do { \
 	hentry = (RelIdCacheEnt *) hash_search(RelationIdCache, \
 										   (void *) &((RELATION)->rd_id), \
 										   HASH_ENTER, &found); \
+	if (found) \
+		relcacheMemory -= hentry->size; \
+	hentry->lastused = relcacheClock; \
+	hentry->size = RelationCacheEntrySize(RELATION); \
+	relcacheMemory += hentry->size; \
 	if (found) \
 	{ \
 		/* see comments in RelationBuildDesc and RelationBuildLocalRelation */ \
@@ -232,6 +253,8 @@ do { \
 	if (hentry == NULL) \
 		elog(WARNING, "failed to delete relcache entry for OID %u", \
 			 (RELATION)->rd_id); \
+	else \
+		relcacheMemory -= hentry->size; \
 } while(0)
 
 
@@ -256,6 +279,8 @@ static HTAB *OpClassCache = NULL;
 
 /* non-export function prototypes */
 
+static Size RelationCacheEntrySize(Relation relation);
+static void RelationCacheEvict(void);
 static void RelationDestroyRelation(Relation relation, bool remember_tupdesc);
 static void RelationClearRelation(Relation relation, bool rebuild);
 
@@ -1990,18 +2015,27 @@ formrdesc(const char *relationName, Oid relationReltype,
 Relation
 RelationIdGetRelation(Oid relationId)
 {
+	RelIdCacheEnt *hentry;
 	Relation	rd;
 
 	/* Make sure we're in an xact, even if this ends up being a cache hit */
 	Assert(IsTransactionState());
 
+	relcacheClock++;
+
 	/*
 	 * first try to find reldesc in the cache
 	 */
-	RelationIdCacheLookup(relationId, rd);
+	hentry = (RelIdCacheEnt *) hash_search(RelationIdCache,
+										   (void *) &relationId,
+										   HASH_FIND, NULL);
 
-	if (RelationIsValid(rd))
+	if (hentry)
 	{
+		rd = hentry->reldesc;
+		hentry->lastused = relcacheClock;
+		relcacheHits++;
+
 		RelationIncrementReferenceCount(rd);
 		/* revalidate cache entry if necessary */
 		if (!rd->rd_isvalid)
@@ -2034,12 +2068,141 @@ RelationIdGetRelation(Oid relationId)
 	 * no reldesc in the cache, so have RelationBuildDesc() build one and add
 	 * it.
 	 */
+	relcacheMisses++;
 	rd = RelationBuildDesc(relationId, true);
 	if (RelationIsValid(rd))
 		RelationIncrementReferenceCount(rd);
 	return rd;
 }
 
+/*
+ * RelationCacheEntrySize
+ *		Estimate the memory used by a relcache entry
+ *
+ * This counts the RelationData itself, its pg_class row and tuple descriptor
+ * and the entry's private memory contexts.  Smaller pieces allocated directly
+ * in CacheMemoryContext, like the index list, are left out.
+ */
+static Size
+RelationCacheEntrySize(Relation relation)
+{
+	Size		size = GetMemoryChunkSpace(relation);
+
+	if (relation->rd_rel)
+		size += GetMemoryChunkSpace(relation->rd_rel);
+	if (relation->rd_att)
+		size += GetMemoryChunkSpace(relation->rd_att);
+	if (relation->rd_rulescxt)
+		size += MemoryContextMemAllocated(relation->rd_rulescxt, true);
+	if (relation->rd_partkeycxt)
+		size += MemoryContextMemAllocated(relation->rd_partkeycxt, true);
+	if (relation->rd_pdcxt)
+		size += MemoryContextMemAllocated(relation->rd_pdcxt, true);
+	if (relation->rd_partcheckcxt)
+		size += MemoryContextMemAllocated(relation->rd_partcheckcxt, true);
+	if (relation->rd_indexcxt)
+		size += MemoryContextMemAllocated(relation->rd_indexcxt, true);
+
+	return size;
+}
+
+/* qsort comparator for RelationCacheEvict: least recently used first */
+static int
+relidcacheent_lastused_cmp(const void *a, const void *b)
+{
+	const RelIdCacheEnt *ea = *(RelIdCacheEnt *const *) a;
+	const RelIdCacheEnt *eb = *(RelIdCacheEnt *const *) b;
+
+	if (ea->lastused < eb->lastused)
+		return -1;
+	if (ea->lastused > eb->lastused)
+		return 1;
+	return 0;
+}
+
+/*
+ * RelationCacheEvict
+ *		Shrink the relcache if it exceeds catalog_cache_memory_target
+ *
+ * Unreferenced entries are removed, least recently used first, until the
+ * relcache is back to 90% of the target, so that the scan over the whole
+ * hash table isn't repeated at the end of each following transaction.
+ * Nailed entries and entries created or given a new relfilenode in the
+ * current transaction are kept.
+ *
+ * This is only called at the end of a transaction, when no one can be in
+ * the middle of a hash_seq_search over RelationIdCache and no one relies on
+ * an unreferenced entry staying put.
+ */
+static void
+RelationCacheEvict(void)
+{
+	Size		target = (Size) catalog_cache_memory_target * 1024;
+	HASH_SEQ_STATUS status;
+	RelIdCacheEnt *idhentry;
+	RelIdCacheEnt **victims;
+	long		nvictims = 0;
+	long		i;
+
+	if (catalog_cache_memory_target <= 0 || relcacheMemory <= target ||
+		!criticalRelcachesBuilt || !criticalSharedRelcachesBuilt)
+		return;
+
+	target -= target / 10;
+
+	victims = (RelIdCacheEnt **)
+		palloc(hash_get_num_entries(RelationIdCache) * sizeof(RelIdCacheEnt *));
+
+	hash_seq_init(&status, RelationIdCache);
+	while ((idhentry = (RelIdCacheEnt *) hash_seq_search(&status)) != NULL)
+	{
+		Relation	relation = idhentry->reldesc;
+
+		if (!RelationHasReferenceCountZero(relation) ||
+			relation->rd_isnailed ||
+			relation->rd_createSubid != InvalidSubTransactionId ||
+			relation->rd_newRelfilenodeSubid != InvalidSubTransactionId)
+			continue;
+		victims[nvictims++] = idhentry;
+	}
+
+	qsort(victims, nvictims, sizeof(RelIdCacheEnt *),
+		  relidcacheent_lastused_cmp);
+
+	for (i = 0; i < nvictims && relcacheMemory > target; i++)
+	{
+		RelationClearRelation(victims[i]->reldesc, false);
+		relcacheEvictions++;
+	}
+
+	pfree(victims);
+}
+
+/*
+ * SQL-callable function for the pg_stat_relcache view.
+ */
+Datum
+pg_stat_get_relcache(PG_FUNCTION_ARGS)
+{
+#define PG_STAT_GET_RELCACHE_COLS 5
+	TupleDesc	tupdesc;
+	Datum		values[PG_STAT_GET_RELCACHE_COLS];
+	bool		nulls[PG_STAT_GET_RELCACHE_COLS];
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	MemSet(nulls, 0, sizeof(nulls));
+
+	values[0] = Int64GetDatum(hash_get_num_entries(RelationIdCache));
+	values[1] = Int64GetDatum(relcacheMemory);
+	values[2] = Int64GetDatum(relcacheHits);
+	values[3] = Int64GetDatum(relcacheMisses);
+	values[4] = Int64GetDatum(relcacheEvictions);
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls)));
+}
+
 /* ----------------------------------------------------------------
  *				cache invalidation support routines
  * ----------------------------------------------------------------
@@ -2352,10 +2515,13 @@ RelationDestroyRelation(Relation relation, bool remember_tupdesc)
 	bms_free(relation->rd_keyattr);
 	bms_free(relation->rd_pkattr);
 	bms_free(relation->rd_idattr);
+	bms_free(relation->rd_nodelmarkattr);
 	if (relation->rd_pubactions)
 		pfree(relation->rd_pubactions);
 	if (relation->rd_options)
 		pfree(relation->rd_options);
+	if (relation->rd_amcache)
+		pfree(relation->rd_amcache);
 	if (relation->rd_indextuple)
 		pfree(relation->rd_indextuple);
 	if (relation->rd_indexcxt)
@@ -2982,6 +3148,9 @@ AtEOXact_RelationCache(bool isCommit)
 	eoxact_list_overflowed = false;
 	NextEOXactTupleDescNum = 0;
 	EOXactTupleDescArrayLen = 0;
+
+	/* Finally, make room if the relcache has outgrown its target */
+	RelationCacheEvict();
 }
 
 /*
@@ -4729,8 +4898,10 @@ RelationGetIndexPredicate(Relation relation)
  * predicates.)
  *
  * Depending on attrKind, a bitmap covering the attnums for all index columns,
- * for all potential foreign key columns, or for all columns in the configured
- * replica identity index is returned.
+ * for all potential foreign key columns, for all columns in the configured
+ * replica identity index, or for all columns used by indexes whose entries
+ * can't be delete-marked is returned.  A column that is only used by indexes
+ * supporting delete-marking can be changed by an in-place update.
  *
  * Attribute numbers are offset by FirstLowInvalidHeapAttributeNumber so that
  * we can include system attributes (e.g., OID) in the bitmap representation.
@@ -4751,6 +4922,7 @@ RelationGetIndexAttrBitmap(Relation relation, IndexAttrBitmapKind attrKind)
 	Bitmapset  *uindexattrs;	/* columns in unique indexes */
 	Bitmapset  *pkindexattrs;	/* columns in the primary index */
 	Bitmapset  *idindexattrs;	/* columns in the replica identity */
+	Bitmapset  *nodelmarkattrs; /* columns in non-delete-markable indexes */
 	List	   *indexoidlist;
 	List	   *newindexoidlist;
 	Oid			relpkindex;
@@ -4771,6 +4943,8 @@ RelationGetIndexAttrBitmap(Relation relation, IndexAttrBitmapKind attrKind)
 				return bms_copy(relation->rd_pkattr);
 			case INDEX_ATTR_BITMAP_IDENTITY_KEY:
 				return bms_copy(relation->rd_idattr);
+			case INDEX_ATTR_BITMAP_NOT_DELETE_MARKABLE:
+				return bms_copy(relation->rd_nodelmarkattr);
 			default:
 				elog(ERROR, "unknown attrKind %u", attrKind);
 		}
@@ -4814,6 +4988,7 @@ restart:
 	uindexattrs = NULL;
 	pkindexattrs = NULL;
 	idindexattrs = NULL;
+	nodelmarkattrs = NULL;
 	foreach(l, indexoidlist)
 	{
 		Oid			indexOid = lfirst_oid(l);
@@ -4826,6 +5001,8 @@ restart:
 		bool		isKey;		/* candidate key */
 		bool		isPK;		/* primary key */
 		bool		isIDKey;	/* replica identity index */
+		bool		canDeleteMark;	/* entries can be delete-marked */
+		Bitmapset  *attrs = NULL;
 
 		indexDesc = index_open(indexOid, AccessShareLock);
 
@@ -4863,6 +5040,20 @@ restart:
 		/* Is this index the configured (or default) replica identity? */
 		isIDKey = (indexOid == relreplindex);
 
+		/*
+		 * Can in-place updates of this index's columns delete-mark its
+		 * entries?  Scans compare such entries with the table columns
+		 * directly, and a uniqueness check would have to do the same, so
+		 * only plain non-unique indexes without included columns qualify.
+		 */
+		canDeleteMark = indexDesc->rd_indam->amcandeletemark &&
+			indexDesc->rd_indam->amdeletemark != NULL &&
+			!indexDesc->rd_index->indisunique &&
+			!indexDesc->rd_index->indisexclusion &&
+			indexDesc->rd_index->indnkeyatts == indexDesc->rd_index->indnatts &&
+			indexExpressions == NULL &&
+			indexPredicate == NULL;
+
 		/* Collect simple attribute references */
 		for (i = 0; i < indexDesc->rd_index->indnatts; i++)
 		{
@@ -4878,8 +5069,8 @@ restart:
 			 */
 			if (attrnum != 0)
 			{
-				indexattrs = bms_add_member(indexattrs,
-											attrnum - FirstLowInvalidHeapAttributeNumber);
+				attrs = bms_add_member(attrs,
+									   attrnum - FirstLowInvalidHeapAttributeNumber);
 
 				if (isKey && i < indexDesc->rd_index->indnkeyatts)
 					uindexattrs = bms_add_member(uindexattrs,
@@ -4896,10 +5087,15 @@ restart:
 		}
 
 		/* Collect all attributes used in expressions, too */
-		pull_varattnos(indexExpressions, 1, &indexattrs);
+		pull_varattnos(indexExpressions, 1, &attrs);
 
 		/* Collect all attributes in the index predicate, too */
-		pull_varattnos(indexPredicate, 1, &indexattrs);
+		pull_varattnos(indexPredicate, 1, &attrs);
+
+		indexattrs = bms_add_members(indexattrs, attrs);
+		if (!canDeleteMark)
+			nodelmarkattrs = bms_add_members(nodelmarkattrs, attrs);
+		bms_free(attrs);
 
 		index_close(indexDesc, AccessShareLock);
 	}
@@ -4927,6 +5123,7 @@ restart:
 		bms_free(uindexattrs);
 		bms_free(pkindexattrs);
 		bms_free(idindexattrs);
+		bms_free(nodelmarkattrs);
 		bms_free(indexattrs);
 
 		goto restart;
@@ -4941,6 +5138,8 @@ restart:
 	relation->rd_pkattr = NULL;
 	bms_free(relation->rd_idattr);
 	relation->rd_idattr = NULL;
+	bms_free(relation->rd_nodelmarkattr);
+	relation->rd_nodelmarkattr = NULL;
 
 	/*
 	 * Now save copies of the bitmaps in the relcache entry.  We intentionally
@@ -4953,6 +5152,7 @@ restart:
 	relation->rd_keyattr = bms_copy(uindexattrs);
 	relation->rd_pkattr = bms_copy(pkindexattrs);
 	relation->rd_idattr = bms_copy(idindexattrs);
+	relation->rd_nodelmarkattr = bms_copy(nodelmarkattrs);
 	relation->rd_indexattr = bms_copy(indexattrs);
 	MemoryContextSwitchTo(oldcxt);
 
@@ -4967,6 +5167,8 @@ restart:
 			return pkindexattrs;
 		case INDEX_ATTR_BITMAP_IDENTITY_KEY:
 			return idindexattrs;
+		case INDEX_ATTR_BITMAP_NOT_DELETE_MARKABLE:
+			return nodelmarkattrs;
 		default:
 			elog(ERROR, "unknown attrKind %u", attrKind);
 			return NULL;
@@ -5606,6 +5808,7 @@ load_relcache_init_file(bool shared)
 		rel->rd_keyattr = NULL;
 		rel->rd_pkattr = NULL;
 		rel->rd_idattr = NULL;
+		rel->rd_nodelmarkattr = NULL;
 		rel->rd_pubactions = NULL;
 		rel->rd_statvalid = false;
 		rel->rd_statlist = NIL;
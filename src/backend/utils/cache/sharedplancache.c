@@ -0,0 +1,814 @@
+/*-------------------------------------------------------------------------
+ *
+ * sharedplancache.c
+ *	  Generic plans shared between backends.
+ *
+ * plancache.c keeps each backend's generic plans in backend-local memory, so
+ * every session planning the same prepared statement repeats the work.  When
+ * shared_plan_cache_size is set, a backend that has made a generic plan for a
+ * saved CachedPlanSource also publishes it here, in serialized form, and
+ * other backends needing a generic plan for the same statement deserialize
+ * that instead of running the planner.  The plan is still copied into each
+ * backend's own memory to be executed.
+ *
+ * Entries are keyed by the query text, database, role, search_path, the
+ * cursor options and the parameter types.  Since the text alone doesn't say
+ * what a query refers to (a temporary table may shadow a permanent one, for
+ * instance), an entry also records the dependencies that parse analysis
+ * found for the query, and is only used by a plansource whose analyzed query
+ * has exactly the same ones.
+ *
+ * Invalidation piggybacks on plancache.c's sinval callbacks: each backend
+ * that receives a relcache or syscache invalidation removes the entries that
+ * depend on the object.  The backend that publishes a plan processes every
+ * invalidation itself, either before publishing, in which case it notices
+ * that its plan may be stale and doesn't publish it, or after, in which case
+ * it removes the entry again.  Likewise, a backend that picks up a plan
+ * locks the plan's relations and discards the plan if that brought in any
+ * invalidation.  Invalidations are not filtered by database; removing an
+ * unrelated entry now and then does no harm.
+ *
+ * The cache lives in a DSA area created in place in the main shared memory
+ * segment, and never grows beyond it.  When it is full, the least recently
+ * used entries are evicted.
+ *
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * IDENTIFICATION
+ *	  src/backend/utils/cache/sharedplancache.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "access/hash.h"
+#include "catalog/namespace.h"
+#include "miscadmin.h"
+#include "nodes/plannodes.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/dsa.h"
+#include "utils/hashutils.h"
+#include "utils/memutils.h"
+#include "utils/rls.h"
+#include "utils/sharedplancache.h"
+
+/* GUC parameter, in megabytes */
+int			shared_plan_cache_size = 0;
+
+/* Average entry size assumed when sizing the hash table */
+#define SHARED_PLAN_AVG_ENTRY_SIZE	8192
+
+/* Largest share of the cache a single entry may take */
+#define SHARED_PLAN_MAX_ENTRY_FRACTION	8
+
+/* A dependency of a plan on a syscache entry, see PlanInvalItem */
+typedef struct SharedPlanInvalItem
+{
+	int			cacheId;
+	uint32		hashValue;
+} SharedPlanInvalItem;
+
+/*
+ * A cached plan.  The fixed part is followed by, in this order:
+ *
+ *	Oid			param_types[num_params];
+ *	Oid			source_rels[num_source_rels];
+ *	SharedPlanInvalItem source_items[num_source_items];
+ *	Oid			plan_rels[num_plan_rels];
+ *	SharedPlanInvalItem plan_items[num_plan_items];
+ *	char		query_string[query_len + 1];
+ *	char		plan_string[plan_len + 1];
+ *
+ * The source_* arrays are the plansource's dependencies, used to make sure
+ * the query means the same thing to the backend looking it up.  The plan_*
+ * arrays are the dependencies of the finished plan, which can be more, used
+ * for invalidation.
+ */
+typedef struct SharedPlanEntry
+{
+	dsa_pointer next;			/* next entry in the same bucket */
+	pg_atomic_uint64 last_used; /* clock value of the last lookup */
+
+	/* key */
+	uint32		hash;
+	Oid			dbid;
+	Oid			userid;
+	uint32		search_path_hash;
+	int			cursor_options;
+	bool		row_security;
+	int			num_params;
+	int			query_len;
+
+	/* payload */
+	int			num_source_rels;
+	int			num_source_items;
+	int			num_plan_rels;
+	int			num_plan_items;
+	int			plan_len;
+} SharedPlanEntry;
+
+#define SharedPlanEntryData(entry) \
+	((char *) (entry) + MAXALIGN(sizeof(SharedPlanEntry)))
+
+typedef struct SharedPlanCacheControl
+{
+	LWLock		lock;			/* protects everything below */
+	uint32		nbuckets;
+	int			nentries;
+	dsa_pointer buckets;		/* array of nbuckets chains of entries */
+	pg_atomic_uint64 clock;		/* ticks on every lookup hit and store */
+} SharedPlanCacheControl;
+
+/* The key of the plansource we're looking for */
+typedef struct SharedPlanKey
+{
+	uint32		hash;
+	Oid			dbid;
+	Oid			userid;
+	uint32		search_path_hash;
+	int			cursor_options;
+	bool		row_security;
+} SharedPlanKey;
+
+static SharedPlanCacheControl *SharedPlanCache = NULL;
+static void *SharedPlanCacheAreaSpace;
+static dsa_area *SharedPlanCacheArea = NULL;
+
+/*
+ * Number of invalidation callbacks this backend has run.  Anything that read
+ * the catalogs before a given value can be stale once it has moved on.
+ */
+static uint64 inval_generation = 0;
+
+/* Where each of the arrays of an entry starts */
+typedef struct SharedPlanEntryLayout
+{
+	Oid		   *param_types;
+	Oid		   *source_rels;
+	SharedPlanInvalItem *source_items;
+	Oid		   *plan_rels;
+	SharedPlanInvalItem *plan_items;
+	char	   *query_string;
+	char	   *plan_string;
+} SharedPlanEntryLayout;
+
+
+static Size
+SharedPlanCacheAreaSize(void)
+{
+	return Max((Size) shared_plan_cache_size * 1024 * 1024,
+			   dsa_minimum_size());
+}
+
+static uint32
+SharedPlanCacheNumBuckets(void)
+{
+	uint32		nbuckets = 64;
+
+	while (nbuckets < SharedPlanCacheAreaSize() / SHARED_PLAN_AVG_ENTRY_SIZE &&
+		   nbuckets < (1 << 24))
+		nbuckets <<= 1;
+
+	return nbuckets;
+}
+
+/*
+ * Report shared-memory space needed by SharedPlanCacheShmemInit.
+ */
+Size
+SharedPlanCacheShmemSize(void)
+{
+	if (shared_plan_cache_size == 0)
+		return 0;
+
+	return add_size(MAXALIGN(sizeof(SharedPlanCacheControl)),
+					SharedPlanCacheAreaSize());
+}
+
+/*
+ * Create the shared plan cache, if it's enabled.
+ */
+void
+SharedPlanCacheShmemInit(void)
+{
+	bool		foundControl;
+	bool		foundArea;
+
+	if (shared_plan_cache_size == 0)
+		return;
+
+	SharedPlanCache = (SharedPlanCacheControl *)
+		ShmemInitStruct("Shared Plan Cache",
+						sizeof(SharedPlanCacheControl), &foundControl);
+	SharedPlanCacheAreaSpace = ShmemInitStruct("Shared Plan Cache Area",
+											   SharedPlanCacheAreaSize(),
+											   &foundArea);
+
+	if (!IsUnderPostmaster)
+	{
+		dsa_area   *area;
+
+		Assert(!foundControl && !foundArea);
+
+		area = dsa_create_in_place(SharedPlanCacheAreaSpace,
+								   SharedPlanCacheAreaSize(),
+								   LWTRANCHE_SHARED_PLAN_CACHE, NULL);
+		/* Never create DSM segments beyond the space reserved above */
+		dsa_set_size_limit(area, SharedPlanCacheAreaSize());
+
+		LWLockInitialize(&SharedPlanCache->lock, LWTRANCHE_SHARED_PLAN_CACHE);
+		SharedPlanCache->nbuckets = SharedPlanCacheNumBuckets();
+		SharedPlanCache->nentries = 0;
+		SharedPlanCache->buckets =
+			dsa_allocate0(area,
+						  SharedPlanCache->nbuckets * sizeof(dsa_pointer));
+		pg_atomic_init_u64(&SharedPlanCache->clock, 0);
+
+		/*
+		 * Every process attaches to the area the first time it needs it, see
+		 * AttachSharedPlanCacheArea.
+		 */
+		dsa_detach(area);
+	}
+	else
+		Assert(foundControl && foundArea);
+}
+
+/*
+ * Attach to the shared plan cache area, if we haven't yet.  This must be done
+ * before acquiring the cache's lock, as attaching can fail.
+ */
+static void
+AttachSharedPlanCacheArea(void)
+{
+	MemoryContext oldcontext;
+
+	if (SharedPlanCacheArea != NULL)
+		return;
+
+	oldcontext = MemoryContextSwitchTo(TopMemoryContext);
+	SharedPlanCacheArea = dsa_attach_in_place(SharedPlanCacheAreaSpace, NULL);
+	dsa_pin_mapping(SharedPlanCacheArea);
+	MemoryContextSwitchTo(oldcontext);
+}
+
+static inline dsa_pointer *
+SharedPlanCacheBuckets(void)
+{
+	return (dsa_pointer *) dsa_get_address(SharedPlanCacheArea,
+										   SharedPlanCache->buckets);
+}
+
+static void
+SharedPlanEntryGetLayout(SharedPlanEntry *entry, SharedPlanEntryLayout *layout)
+{
+	char	   *ptr = SharedPlanEntryData(entry);
+
+	layout->param_types = (Oid *) ptr;
+	ptr += entry->num_params * sizeof(Oid);
+	layout->source_rels = (Oid *) ptr;
+	ptr += entry->num_source_rels * sizeof(Oid);
+	layout->source_items = (SharedPlanInvalItem *) ptr;
+	ptr += entry->num_source_items * sizeof(SharedPlanInvalItem);
+	layout->plan_rels = (Oid *) ptr;
+	ptr += entry->num_plan_rels * sizeof(Oid);
+	layout->plan_items = (SharedPlanInvalItem *) ptr;
+	ptr += entry->num_plan_items * sizeof(SharedPlanInvalItem);
+	layout->query_string = ptr;
+	ptr += entry->query_len + 1;
+	layout->plan_string = ptr;
+}
+
+/*
+ * Compute the key of a plansource in the current environment.
+ */
+static void
+SharedPlanCacheMakeKey(CachedPlanSource *plansource, SharedPlanKey *key)
+{
+	int			query_len = strlen(plansource->query_string);
+	uint32		h;
+
+	key->dbid = MyDatabaseId;
+	key->userid = GetUserId();
+	key->search_path_hash = hash_any((unsigned char *) namespace_search_path,
+									 strlen(namespace_search_path));
+	key->cursor_options = plansource->cursor_options;
+	key->row_security = row_security;
+
+	h = hash_any((unsigned char *) plansource->query_string, query_len);
+	h = hash_combine(h, murmurhash32(key->dbid));
+	h = hash_combine(h, murmurhash32(key->userid));
+	h = hash_combine(h, key->search_path_hash);
+	h = hash_combine(h, (uint32) key->cursor_options);
+	if (plansource->num_params > 0)
+		h = hash_combine(h, hash_any((unsigned char *) plansource->param_types,
+									 plansource->num_params * sizeof(Oid)));
+	key->hash = h;
+}
+
+static bool
+oid_array_matches_list(Oid *oids, int noids, List *list)
+{
+	ListCell   *lc;
+	int			i = 0;
+
+	if (list_length(list) != noids)
+		return false;
+	foreach(lc, list)
+	{
+		if (oids[i++] != lfirst_oid(lc))
+			return false;
+	}
+	return true;
+}
+
+static bool
+items_array_matches_list(SharedPlanInvalItem *items, int nitems, List *list)
+{
+	ListCell   *lc;
+	int			i = 0;
+
+	if (list_length(list) != nitems)
+		return false;
+	foreach(lc, list)
+	{
+		PlanInvalItem *item = (PlanInvalItem *) lfirst(lc);
+
+		if (items[i].cacheId != item->cacheId ||
+			items[i].hashValue != item->hashValue)
+			return false;
+		i++;
+	}
+	return true;
+}
+
+/*
+ * Find the entry for a plansource.  If check_deps is true, also require the
+ * query-level dependencies to match.  Caller must hold the lock.
+ */
+static SharedPlanEntry *
+SharedPlanCacheFind(CachedPlanSource *plansource, SharedPlanKey *key,
+					bool check_deps)
+{
+	int			query_len = strlen(plansource->query_string);
+	dsa_pointer entryp;
+
+	entryp = SharedPlanCacheBuckets()[key->hash % SharedPlanCache->nbuckets];
+	while (DsaPointerIsValid(entryp))
+	{
+		SharedPlanEntry *entry = dsa_get_address(SharedPlanCacheArea, entryp);
+		SharedPlanEntryLayout layout;
+
+		entryp = entry->next;
+
+		if (entry->hash != key->hash ||
+			entry->dbid != key->dbid ||
+			entry->userid != key->userid ||
+			entry->search_path_hash != key->search_path_hash ||
+			entry->cursor_options != key->cursor_options ||
+			entry->row_security != key->row_security ||
+			entry->num_params != plansource->num_params ||
+			entry->query_len != query_len)
+			continue;
+
+		SharedPlanEntryGetLayout(entry, &layout);
+		if (memcmp(layout.query_string, plansource->query_string,
+				   query_len) != 0)
+			continue;
+		if (plansource->num_params > 0 &&
+			memcmp(layout.param_types, plansource->param_types,
+				   plansource->num_params * sizeof(Oid)) != 0)
+			continue;
+
+		if (check_deps &&
+			(!oid_array_matches_list(layout.source_rels,
+									 entry->num_source_rels,
+									 plansource->relationOids) ||
+			 !items_array_matches_list(layout.source_items,
+									   entry->num_source_items,
+									   plansource->invalItems)))
+			continue;
+
+		return entry;
+	}
+
+	return NULL;
+}
+
+/*
+ * Unlink and free an entry.  Caller must hold the lock exclusively.
+ */
+static void
+SharedPlanCacheRemove(dsa_pointer entryp)
+{
+	SharedPlanEntry *entry = dsa_get_address(SharedPlanCacheArea, entryp);
+	dsa_pointer *link;
+
+	link = &SharedPlanCacheBuckets()[entry->hash % SharedPlanCache->nbuckets];
+	while (*link != entryp)
+	{
+		SharedPlanEntry *prev = dsa_get_address(SharedPlanCacheArea, *link);
+
+		Assert(DsaPointerIsValid(*link));
+		link = &prev->next;
+	}
+	*link = entry->next;
+
+	dsa_free(SharedPlanCacheArea, entryp);
+	SharedPlanCache->nentries--;
+}
+
+/*
+ * Evict the least recently used entry.  Caller must hold the lock
+ * exclusively.  Returns false if the cache is empty.
+ */
+static bool
+SharedPlanCacheEvictOne(void)
+{
+	dsa_pointer *buckets = SharedPlanCacheBuckets();
+	dsa_pointer victim = InvalidDsaPointer;
+	uint64		victim_used = PG_UINT64_MAX;
+	uint32		i;
+
+	if (SharedPlanCache->nentries == 0)
+		return false;
+
+	for (i = 0; i < SharedPlanCache->nbuckets; i++)
+	{
+		dsa_pointer entryp = buckets[i];
+
+		while (DsaPointerIsValid(entryp))
+		{
+			SharedPlanEntry *entry = dsa_get_address(SharedPlanCacheArea,
+													 entryp);
+			uint64		used = pg_atomic_read_u64(&entry->last_used);
+
+			if (used < victim_used)
+			{
+				victim = entryp;
+				victim_used = used;
+			}
+			entryp = entry->next;
+		}
+	}
+
+	Assert(DsaPointerIsValid(victim));
+	SharedPlanCacheRemove(victim);
+	return true;
+}
+
+/*
+ * Return the number of invalidation callbacks this backend has run so far.
+ *
+ * A caller that compares the values from before and after reading catalog
+ * state finds out whether the state may have changed in between.
+ */
+uint64
+SharedPlanCacheInvalGeneration(void)
+{
+	return inval_generation;
+}
+
+/*
+ * Look up a generic plan for a plansource.
+ *
+ * Returns the plan's list of PlannedStmts in the caller's memory context, or
+ * NIL if there's none.  The plan's relations are not locked yet; the caller
+ * has to do that and check SharedPlanCacheInvalGeneration() for any
+ * invalidation that came in meanwhile.
+ */
+List *
+SharedPlanCacheLookup(CachedPlanSource *plansource)
+{
+	SharedPlanKey key;
+	SharedPlanEntry *entry;
+	char	   *plan_string = NULL;
+
+	if (SharedPlanCache == NULL)
+		return NIL;
+
+	SharedPlanCacheMakeKey(plansource, &key);
+
+	AttachSharedPlanCacheArea();
+	LWLockAcquire(&SharedPlanCache->lock, LW_SHARED);
+
+	entry = SharedPlanCacheFind(plansource, &key, true);
+	if (entry != NULL)
+	{
+		SharedPlanEntryLayout layout;
+
+		SharedPlanEntryGetLayout(entry, &layout);
+		plan_string = palloc(entry->plan_len + 1);
+		memcpy(plan_string, layout.plan_string, entry->plan_len + 1);
+		pg_atomic_write_u64(&entry->last_used,
+							pg_atomic_fetch_add_u64(&SharedPlanCache->clock, 1));
+	}
+
+	LWLockRelease(&SharedPlanCache->lock);
+
+	if (plan_string == NULL)
+		return NIL;
+
+	/* Deserialize only after releasing the lock; this can take a while */
+	return (List *) stringToNode(plan_string);
+}
+
+/*
+ * Publish a just-made generic plan for a plansource.
+ *
+ * The caller must have checked that no invalidation arrived since it started
+ * analyzing and planning the query.  Plans that depend on TransactionXmin are
+ * not published, nor are plans that would take more than a small fraction of
+ * the cache.
+ */
+void
+SharedPlanCacheStore(CachedPlanSource *plansource, List *stmt_list)
+{
+	SharedPlanKey key;
+	SharedPlanEntry *entry;
+	SharedPlanEntryLayout layout;
+	dsa_pointer entryp;
+	dsa_pointer *bucket;
+	List	   *plan_rels = NIL;
+	List	   *plan_items = NIL;
+	char	   *plan_string;
+	int			query_len;
+	int			plan_len;
+	Size		size;
+	ListCell   *lc;
+	int			i;
+
+	if (SharedPlanCache == NULL)
+		return;
+
+	foreach(lc, stmt_list)
+	{
+		PlannedStmt *plannedstmt = lfirst_node(PlannedStmt, lc);
+
+		if (plannedstmt->commandType == CMD_UTILITY ||
+			plannedstmt->transientPlan)
+			return;
+
+		plan_rels = list_concat_unique_oid(plan_rels,
+										   plannedstmt->relationOids);
+		plan_items = list_concat(plan_items,
+								 list_copy(plannedstmt->invalItems));
+	}
+
+	plan_string = nodeToString(stmt_list);
+	plan_len = strlen(plan_string);
+	query_len = strlen(plansource->query_string);
+
+	size = MAXALIGN(sizeof(SharedPlanEntry)) +
+		plansource->num_params * sizeof(Oid) +
+		list_length(plansource->relationOids) * sizeof(Oid) +
+		list_length(plansource->invalItems) * sizeof(SharedPlanInvalItem) +
+		list_length(plan_rels) * sizeof(Oid) +
+		list_length(plan_items) * sizeof(SharedPlanInvalItem) +
+		query_len + 1 + plan_len + 1;
+	if (size > SharedPlanCacheAreaSize() / SHARED_PLAN_MAX_ENTRY_FRACTION)
+		return;
+
+	SharedPlanCacheMakeKey(plansource, &key);
+
+	AttachSharedPlanCacheArea();
+	LWLockAcquire(&SharedPlanCache->lock, LW_EXCLUSIVE);
+
+	/* Someone else may have been quicker */
+	if (SharedPlanCacheFind(plansource, &key, false) != NULL)
+	{
+		LWLockRelease(&SharedPlanCache->lock);
+		return;
+	}
+
+	for (;;)
+	{
+		entryp = dsa_allocate_extended(SharedPlanCacheArea, size,
+									   DSA_ALLOC_NO_OOM);
+		if (DsaPointerIsValid(entryp) || !SharedPlanCacheEvictOne())
+			break;
+	}
+	if (!DsaPointerIsValid(entryp))
+	{
+		LWLockRelease(&SharedPlanCache->lock);
+		return;
+	}
+
+	entry = dsa_get_address(SharedPlanCacheArea, entryp);
+	pg_atomic_init_u64(&entry->last_used,
+					   pg_atomic_fetch_add_u64(&SharedPlanCache->clock, 1));
+	entry->hash = key.hash;
+	entry->dbid = key.dbid;
+	entry->userid = key.userid;
+	entry->search_path_hash = key.search_path_hash;
+	entry->cursor_options = key.cursor_options;
+	entry->row_security = key.row_security;
+	entry->num_params = plansource->num_params;
+	entry->query_len = query_len;
+	entry->num_source_rels = list_length(plansource->relationOids);
+	entry->num_source_items = list_length(plansource->invalItems);
+	entry->num_plan_rels = list_length(plan_rels);
+	entry->num_plan_items = list_length(plan_items);
+	entry->plan_len = plan_len;
+
+	SharedPlanEntryGetLayout(entry, &layout);
+	if (plansource->num_params > 0)
+		memcpy(layout.param_types, plansource->param_types,
+			   plansource->num_params * sizeof(Oid));
+	i = 0;
+	foreach(lc, plansource->relationOids)
+		layout.source_rels[i++] = lfirst_oid(lc);
+	i = 0;
+	foreach(lc, plansource->invalItems)
+	{
+		PlanInvalItem *item = (PlanInvalItem *) lfirst(lc);
+
+		layout.source_items[i].cacheId = item->cacheId;
+		layout.source_items[i].hashValue = item->hashValue;
+		i++;
+	}
+	i = 0;
+	foreach(lc, plan_rels)
+		layout.plan_rels[i++] = lfirst_oid(lc);
+	i = 0;
+	foreach(lc, plan_items)
+	{
+		PlanInvalItem *item = (PlanInvalItem *) lfirst(lc);
+
+		layout.plan_items[i].cacheId = item->cacheId;
+		layout.plan_items[i].hashValue = item->hashValue;
+		i++;
+	}
+	memcpy(layout.query_string, plansource->query_string, query_len + 1);
+	memcpy(layout.plan_string, plan_string, plan_len + 1);
+
+	bucket = &SharedPlanCacheBuckets()[key.hash % SharedPlanCache->nbuckets];
+	entry->next = *bucket;
+	*bucket = entryp;
+	SharedPlanCache->nentries++;
+
+	LWLockRelease(&SharedPlanCache->lock);
+
+	pfree(plan_string);
+}
+
+/* What an invalidation is about */
+typedef struct SharedPlanInval
+{
+	bool		all;			/* every entry */
+	Oid			relid;			/* a relation, or any if InvalidOid */
+	int			cacheid;		/* else a syscache entry */
+	uint32		hashvalue;		/* ... or any of the cache's if 0 */
+} SharedPlanInval;
+
+static bool
+SharedPlanEntryMatchesInval(SharedPlanEntry *entry, SharedPlanInval *inval)
+{
+	SharedPlanEntryLayout layout;
+	int			i;
+
+	if (inval->all)
+		return true;
+
+	SharedPlanEntryGetLayout(entry, &layout);
+
+	if (inval->cacheid < 0)
+	{
+		if (inval->relid == InvalidOid)
+			return entry->num_source_rels > 0 || entry->num_plan_rels > 0;
+		for (i = 0; i < entry->num_source_rels; i++)
+			if (layout.source_rels[i] == inval->relid)
+				return true;
+		for (i = 0; i < entry->num_plan_rels; i++)
+			if (layout.plan_rels[i] == inval->relid)
+				return true;
+		return false;
+	}
+
+	for (i = 0; i < entry->num_source_items; i++)
+		if (layout.source_items[i].cacheId == inval->cacheid &&
+			(inval->hashvalue == 0 ||
+			 layout.source_items[i].hashValue == inval->hashvalue))
+			return true;
+	for (i = 0; i < entry->num_plan_items; i++)
+		if (layout.plan_items[i].cacheId == inval->cacheid &&
+			(inval->hashvalue == 0 ||
+			 layout.plan_items[i].hashValue == inval->hashvalue))
+			return true;
+	return false;
+}
+
+/*
+ * Remove all entries matching an invalidation.
+ *
+ * Most invalidations concern objects no shared plan depends on, so look for a
+ * match with the lock held in shared mode first.
+ */
+static void
+SharedPlanCacheInvalidate(SharedPlanInval *inval)
+{
+	dsa_pointer *buckets;
+	bool		found = false;
+	uint32		i;
+
+	inval_generation++;
+
+	if (SharedPlanCache == NULL)
+		return;
+
+	AttachSharedPlanCacheArea();
+	buckets = SharedPlanCacheBuckets();
+
+	LWLockAcquire(&SharedPlanCache->lock, LW_SHARED);
+	for (i = 0; i < SharedPlanCache->nbuckets && !found; i++)
+	{
+		dsa_pointer entryp = buckets[i];
+
+		while (DsaPointerIsValid(entryp))
+		{
+			SharedPlanEntry *entry = dsa_get_address(SharedPlanCacheArea,
+													 entryp);
+
+			if (SharedPlanEntryMatchesInval(entry, inval))
+			{
+				found = true;
+				break;
+			}
+			entryp = entry->next;
+		}
+	}
+	LWLockRelease(&SharedPlanCache->lock);
+
+	if (!found)
+		return;
+
+	LWLockAcquire(&SharedPlanCache->lock, LW_EXCLUSIVE);
+	for (i = 0; i < SharedPlanCache->nbuckets; i++)
+	{
+		dsa_pointer entryp = buckets[i];
+
+		while (DsaPointerIsValid(entryp))
+		{
+			SharedPlanEntry *entry = dsa_get_address(SharedPlanCacheArea,
+													 entryp);
+			dsa_pointer next = entry->next;
+
+			if (SharedPlanEntryMatchesInval(entry, inval))
+				SharedPlanCacheRemove(entryp);
+			entryp = next;
+		}
+	}
+	LWLockRelease(&SharedPlanCache->lock);
+}
+
+/*
+ * Remove the plans depending on a relation, or on any relation if relid is
+ * InvalidOid.  Called from plancache.c's relcache callback.
+ */
+void
+SharedPlanCacheInvalidateRel(Oid relid)
+{
+	SharedPlanInval inval;
+
+	inval.all = false;
+	inval.relid = relid;
+	inval.cacheid = -1;
+	inval.hashvalue = 0;
+	SharedPlanCacheInvalidate(&inval);
+}
+
+/*
+ * Remove the plans depending on a syscache entry, or on any entry of the
+ * cache if hashvalue is 0.  Called from plancache.c's PROCOID and TYPEOID
+ * callback.
+ */
+void
+SharedPlanCacheInvalidateObject(int cacheid, uint32 hashvalue)
+{
+	SharedPlanInval inval;
+
+	inval.all = false;
+	inval.relid = InvalidOid;
+	inval.cacheid = cacheid;
+	inval.hashvalue = hashvalue;
+	SharedPlanCacheInvalidate(&inval);
+}
+
+/*
+ * Remove all plans, for changes to catalogs whose dependencies aren't
+ * tracked.
+ */
+void
+SharedPlanCacheReset(void)
+{
+	SharedPlanInval inval;
+
+	inval.all = true;
+	inval.relid = InvalidOid;
+	inval.cacheid = -1;
+	inval.hashvalue = 0;
+	SharedPlanCacheInvalidate(&inval);
+}
@@ -2025,12 +2025,9 @@ SharedRecordTypmodRegistryAttach(SharedRecordTypmodRegistry *registry)
 	/*
 	 * We can't already have typmods in our local cache, because they'd clash
 	 * with those imported by SharedRecordTypmodRegistryInit.  This should be
-	 * a freshly started parallel worker.  If we ever support worker
-	 * recycling, a worker would need to zap its local cache in between
-	 * servicing different queries, in order to be able to call this and
-	 * synchronize typmods with a new leader; but that's problematic because
-	 * we can't be very sure that record-typmod-related state hasn't escaped
-	 * to anywhere else in the process.
+	 * a freshly started parallel worker, or one that is being reused and
+	 * zapped its local cache when it detached from its previous leader's
+	 * registry; see shared_record_typmod_registry_detach.
 	 */
 	Assert(NextRecordTypmod == 0);
 
@@ -2644,4 +2641,25 @@ shared_record_typmod_registry_detach(dsm_segment *segment, Datum datum)
 		CurrentSession->shared_typmod_table = NULL;
 	}
 	CurrentSession->shared_typmod_registry = NULL;
+
+	/*
+	 * In a parallel worker, every entry of the local record cache came from
+	 * the registry and points into its shared memory, so forget them all.
+	 * This matters for a worker that is kept for reuse, since the typmods of
+	 * its next leader will be different.
+	 */
+	if (IsParallelWorker())
+	{
+		if (RecordCacheHash != NULL)
+		{
+			hash_destroy(RecordCacheHash);
+			RecordCacheHash = NULL;
+		}
+		if (RecordCacheArray != NULL)
+		{
+			memset(RecordCacheArray, 0, RecordCacheArrayLen * sizeof(TupleDesc));
+			memset(RecordIdentifierArray, 0, RecordCacheArrayLen * sizeof(uint64));
+		}
+		NextRecordTypmod = 0;
+	}
 }
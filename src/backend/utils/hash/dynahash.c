@@ -1092,6 +1092,51 @@ hash_search_with_hash_value(HTAB *hashp,
 	return NULL;				/* keep compiler quiet */
 }
 
+/*
+ * hash_search_unlocked -- look up a key without holding the partition lock
+ *
+ * This is only for partitioned shared tables, which never split buckets, so
+ * the bucket a key hashes to is fixed.  Other backends may insert and delete
+ * entries while we follow the collision chain.  Elements live in shared memory
+ * that is never released, and an element that is freed or reused stays linked
+ * either to the freelist or to another chain, so we never dereference garbage.
+ * The chain can however change under us, so at most max_steps elements are
+ * visited.
+ *
+ * The result is only a hint.  NULL is returned when the key isn't found in
+ * max_steps steps, even if it is present, and a returned entry may have been
+ * deleted or reused by the time the caller looks at it.  The caller must be
+ * able to verify the entry by other means, and fall back to a locked
+ * hash_search_with_hash_value() when it can't.
+ */
+void *
+hash_search_unlocked(HTAB *hashp, const void *keyPtr, uint32 hashvalue,
+					 int max_steps)
+{
+	HASHHDR    *hctl = hashp->hctl;
+	Size		keysize = hashp->keysize;
+	HashCompareFunc match = hashp->match;
+	uint32		bucket;
+	HASHSEGMENT segp;
+	HASHBUCKET	currBucket;
+
+	Assert(IS_PARTITIONED(hctl));
+
+	bucket = calc_bucket(hctl, hashvalue);
+	segp = hashp->dir[bucket >> hashp->sshift];
+	currBucket = *((volatile HASHBUCKET *) &segp[MOD(bucket, hashp->ssize)]);
+
+	while (currBucket != NULL && max_steps-- > 0)
+	{
+		if (currBucket->hashvalue == hashvalue &&
+			match(ELEMENTKEY(currBucket), keyPtr, keysize) == 0)
+			return (void *) ELEMENTKEY(currBucket);
+		currBucket = *((volatile HASHBUCKET *) &currBucket->link);
+	}
+
+	return NULL;
+}
+
 /*
  * hash_update_hash_key -- change the hash key of an existing table entry
  *
@@ -133,9 +133,14 @@ bool		applying_subxact_undo = false;
  * Primary determinants of sizes of shared-memory structures.
  *
  * MaxBackends is computed by PostmasterMain after modules have had a chance to
- * register background workers.
+ * register background workers.  NBuffers, the number of buffers shared memory
+ * is sized for, is computed from SharedBuffers and MaxSharedBuffers, since
+ * shared_buffers can change later on.
  */
-int			NBuffers = 1000;
+int			NBuffers = 0;
+int			SharedBuffers = 1000;
+int			MaxSharedBuffers = -1;
+int			NUndoBuffers = 0;
 int			MaxConnections = 90;
 int			max_worker_processes = 8;
 int			max_parallel_workers = 8;
@@ -552,6 +552,46 @@ InitializeMaxBackends(void)
 		elog(ERROR, "too many backends configured");
 }
 
+/*
+ * Initialize the number of fast-path lock groups from config options.
+ *
+ * Each backend gets enough groups of FP_LOCK_SLOTS_PER_GROUP slots to hold
+ * max_locks_per_transaction relation locks, rounded up to a power of two and
+ * capped at FP_LOCK_GROUPS_PER_BACKEND_MAX, so that a transaction touching
+ * many partitions doesn't fall back to the shared lock table as early as with
+ * a fixed 16 slots.
+ *
+ * The same rules as for InitializeMaxBackends() apply: this must be called
+ * before shared memory size is determined, and in EXEC_BACKEND environment
+ * the value is passed down via BackendParameters.
+ */
+void
+InitializeFastPathLocks(void)
+{
+	Assert(FastPathLockGroupsPerBackend == 0);
+
+	FastPathLockGroupsPerBackend = 1;
+	while (FastPathLockGroupsPerBackend < FP_LOCK_GROUPS_PER_BACKEND_MAX &&
+		   FastPathLockGroupsPerBackend * FP_LOCK_SLOTS_PER_GROUP < max_locks_per_xact)
+		FastPathLockGroupsPerBackend *= 2;
+}
+
+/*
+ * Initialize NBuffers, the number of buffers shared memory is sized for, from
+ * config options.
+ *
+ * shared_buffers can be changed at runtime, but the buffer pool can't grow
+ * past what was reserved for it at startup, which is max_shared_buffers if
+ * that is larger.  The same rules as for InitializeMaxBackends() apply.
+ */
+void
+InitializeBufferPoolSize(void)
+{
+	Assert(NBuffers == 0);
+
+	NBuffers = Max(SharedBuffers, MaxSharedBuffers);
+}
+
 /*
  * Early initialization of a backend (either standalone or under postmaster).
  * This happens even before InitPostgres.
@@ -26,24 +26,47 @@
 #include <syslog.h>
 #endif
 
+#include "access/clog.h"
 #include "access/commit_ts.h"
 #include "access/gin.h"
+#include "access/multixact.h"
+#include "access/parallel.h"
 #include "access/rmgr.h"
+#include "access/slru.h"
+#include "access/subtrans.h"
 #include "access/tableam.h"
 #include "access/transam.h"
+#include "access/tuptoaster.h"
 #include "access/twophase.h"
+#include "access/undocache.h"
+#include "access/undodiscard.h"
+#include "access/undoinsert.h"
+#include "access/undolocal.h"
+#include "access/undolog.h"
+#include "access/undommap.h"
+#include "access/undorequest.h"
+#include "access/undospool.h"
 #include "access/undoworker.h"
+#include "access/discardworker.h"
 #include "access/xact.h"
 #include "access/xlog_internal.h"
+#include "access/xlogprefetch.h"
+#include "access/zfreepages.h"
+#include "access/zheap.h"
+#include "access/zkeysharelock.h"
+#include "access/zmultilocker.h"
+#include "access/zspectoken.h"
 #include "catalog/namespace.h"
 #include "catalog/pg_authid.h"
 #include "commands/async.h"
 #include "commands/prepare.h"
+#include "commands/sequence.h"
 #include "commands/user.h"
 #include "commands/vacuum.h"
 #include "commands/variable.h"
 #include "commands/trigger.h"
 #include "common/string.h"
+#include "executor/nodeHashjoin.h"
 #include "funcapi.h"
 #include "jit/jit.h"
 #include "libpq/auth.h"
@@ -64,13 +87,19 @@
 #include "postmaster/bgworker_internals.h"
 #include "postmaster/bgwriter.h"
 #include "postmaster/postmaster.h"
+#include "postmaster/proxy.h"
 #include "postmaster/syslogger.h"
+#include "postmaster/walsummarizer.h"
 #include "postmaster/walwriter.h"
+#include "regex/regex.h"
 #include "replication/logicallauncher.h"
+#include "replication/reorderbuffer.h"
 #include "replication/slot.h"
 #include "replication/syncrep.h"
 #include "replication/walreceiver.h"
 #include "replication/walsender.h"
+#include "storage/aio.h"
+#include "storage/buffile.h"
 #include "storage/bufmgr.h"
 #include "storage/dsm_impl.h"
 #include "storage/standby.h"
@@ -79,10 +108,12 @@
 #include "storage/pg_shmem.h"
 #include "storage/proc.h"
 #include "storage/predicate.h"
+#include "storage/smgr.h"
 #include "tcop/tcopprot.h"
 #include "tsearch/ts_cache.h"
 #include "utils/builtins.h"
 #include "utils/bytea.h"
+#include "utils/catcache.h"
 #include "utils/guc_tables.h"
 #include "utils/float.h"
 #include "utils/memutils.h"
@@ -92,6 +123,7 @@
 #include "utils/portal.h"
 #include "utils/ps_status.h"
 #include "utils/rls.h"
+#include "utils/sharedplancache.h"
 #include "utils/snapmgr.h"
 #include "utils/tzparser.h"
 #include "utils/varlena.h"
@@ -120,6 +152,7 @@
 extern bool Log_disconnections;
 extern int	CommitDelay;
 extern int	CommitSiblings;
+extern bool AdaptiveCommitDelay;
 extern char *default_tablespace;
 extern char *temp_tablespaces;
 extern char *undo_tablespaces;
@@ -174,6 +207,9 @@ static void assign_session_replication_role(int newval, void *extra);
 static bool check_temp_buffers(int *newval, void **extra, GucSource source);
 static bool check_bonjour(bool *newval, void **extra, GucSource source);
 static bool check_ssl(bool *newval, void **extra, GucSource source);
+static bool check_numa_buffers(bool *newval, void **extra, GucSource source);
+static bool check_io_direct(char **newval, void **extra, GucSource source);
+static void assign_io_direct(const char *newval, void *extra);
 static bool check_stage_log_stats(bool *newval, void **extra, GucSource source);
 static bool check_log_stats(bool *newval, void **extra, GucSource source);
 static bool check_canonical_path(char **newval, void **extra, GucSource source);
@@ -194,6 +230,10 @@ static bool check_max_worker_processes(int *newval, void **extra, GucSource sour
 static bool check_autovacuum_max_workers(int *newval, void **extra, GucSource source);
 static bool check_max_wal_senders(int *newval, void **extra, GucSource source);
 static bool check_autovacuum_work_mem(int *newval, void **extra, GucSource source);
+static bool check_transaction_buffers(int *newval, void **extra, GucSource source);
+static bool check_subtransaction_buffers(int *newval, void **extra, GucSource source);
+static bool check_multixact_offset_buffers(int *newval, void **extra, GucSource source);
+static bool check_multixact_member_buffers(int *newval, void **extra, GucSource source);
 static bool check_effective_io_concurrency(int *newval, void **extra, GucSource source);
 static void assign_effective_io_concurrency(int newval, void *extra);
 static void assign_pgstat_temp_directory(const char *newval, void *extra);
@@ -415,6 +455,56 @@ static const struct config_enum_entry huge_pages_options[] = {
 	{NULL, 0, false}
 };
 
+/*
+ * wal_compression used to be a boolean, so accept all the likely variants
+ * of "on" and "off"; "on" selects pglz, the only method there was then.
+ */
+static const struct config_enum_entry wal_compression_options[] = {
+	{"pglz", WAL_COMPRESSION_PGLZ, false},
+#ifdef USE_LZ4
+	{"lz4", WAL_COMPRESSION_LZ4, false},
+#endif
+#ifdef USE_ZSTD
+	{"zstd", WAL_COMPRESSION_ZSTD, false},
+#endif
+	{"on", WAL_COMPRESSION_PGLZ, false},
+	{"off", WAL_COMPRESSION_NONE, false},
+	{"true", WAL_COMPRESSION_PGLZ, true},
+	{"false", WAL_COMPRESSION_NONE, true},
+	{"yes", WAL_COMPRESSION_PGLZ, true},
+	{"no", WAL_COMPRESSION_NONE, true},
+	{"1", WAL_COMPRESSION_PGLZ, true},
+	{"0", WAL_COMPRESSION_NONE, true},
+	{NULL, 0, false}
+};
+
+static const struct config_enum_entry default_toast_compression_options[] = {
+	{"pglz", TOAST_PGLZ_COMPRESSION, false},
+#ifdef USE_LZ4
+	{"lz4", TOAST_LZ4_COMPRESSION, false},
+#endif
+	{NULL, 0, false}
+};
+
+static const struct config_enum_entry temp_file_compression_options[] = {
+	{"none", TEMP_FILE_COMPRESSION_NONE, false},
+	{"pglz", TEMP_FILE_COMPRESSION_PGLZ, false},
+#ifdef USE_LZ4
+	{"lz4", TEMP_FILE_COMPRESSION_LZ4, false},
+#endif
+	{"off", TEMP_FILE_COMPRESSION_NONE, true},
+	{NULL, 0, false}
+};
+
+static const struct config_enum_entry io_method_options[] = {
+	{"sync", IOMETHOD_SYNC, false},
+	{"worker", IOMETHOD_WORKER, false},
+#ifdef USE_LIBURING
+	{"io_uring", IOMETHOD_IO_URING, false},
+#endif
+	{NULL, 0, false}
+};
+
 static const struct config_enum_entry force_parallel_mode_options[] = {
 	{"off", FORCE_PARALLEL_OFF, false},
 	{"on", FORCE_PARALLEL_ON, false},
@@ -428,6 +518,24 @@ static const struct config_enum_entry force_parallel_mode_options[] = {
 	{NULL, 0, false}
 };
 
+static const struct config_enum_entry join_search_method_options[] = {
+	{"iterative", JOIN_SEARCH_ITERATIVE, false},
+	{"genetic", JOIN_SEARCH_GENETIC, false},
+	{NULL, 0, false}
+};
+
+static const struct config_enum_entry checkpoint_pacing_options[] = {
+	{"schedule", CHECKPOINT_PACING_SCHEDULE, false},
+	{"adaptive", CHECKPOINT_PACING_ADAPTIVE, false},
+	{NULL, 0, false}
+};
+
+static const struct config_enum_entry rollback_policy_options[] = {
+	{"size", ROLLBACK_POLICY_SIZE, false},
+	{"adaptive", ROLLBACK_POLICY_ADAPTIVE, false},
+	{NULL, 0, false}
+};
+
 static const struct config_enum_entry plan_cache_mode_options[] = {
 	{"auto", PLAN_CACHE_MODE_AUTO, false},
 	{"force_generic_plan", PLAN_CACHE_MODE_FORCE_GENERIC_PLAN, false},
@@ -556,6 +664,7 @@ int			huge_pages;
  * and is kept in sync by assign_hooks.
  */
 static char *syslog_ident_str;
+static char *io_direct_string;
 static double phony_random_seed;
 static char *client_encoding_string;
 static char *datestyle_string;
@@ -914,6 +1023,26 @@ static struct config_bool ConfigureNamesBool[] =
 		true,
 		NULL, NULL, NULL
 	},
+	{
+		{"enable_indexskipscan", PGC_USERSET, QUERY_TUNING_METHOD,
+			gettext_noop("Enables the planner's use of index skip scans."),
+			NULL,
+			GUC_EXPLAIN
+		},
+		&enable_indexskipscan,
+		true,
+		NULL, NULL, NULL
+	},
+	{
+		{"enable_async_append", PGC_USERSET, QUERY_TUNING_METHOD,
+			gettext_noop("Enables the planner's use of async append plans."),
+			NULL,
+			GUC_EXPLAIN
+		},
+		&enable_async_append,
+		true,
+		NULL, NULL, NULL
+	},
 	{
 		{"enable_bitmapscan", PGC_USERSET, QUERY_TUNING_METHOD,
 			gettext_noop("Enables the planner's use of bitmap-scan plans."),
@@ -944,6 +1073,16 @@ static struct config_bool ConfigureNamesBool[] =
 		true,
 		NULL, NULL, NULL
 	},
+	{
+		{"enable_incrementalsort", PGC_USERSET, QUERY_TUNING_METHOD,
+			gettext_noop("Enables the planner's use of incremental sort steps."),
+			NULL,
+			GUC_EXPLAIN
+		},
+		&enable_incrementalsort,
+		true,
+		NULL, NULL, NULL
+	},
 	{
 		{"enable_hashagg", PGC_USERSET, QUERY_TUNING_METHOD,
 			gettext_noop("Enables the planner's use of hashed aggregation plans."),
@@ -964,6 +1103,16 @@ static struct config_bool ConfigureNamesBool[] =
 		true,
 		NULL, NULL, NULL
 	},
+	{
+		{"enable_memoize", PGC_USERSET, QUERY_TUNING_METHOD,
+			gettext_noop("Enables the planner's use of memoization."),
+			NULL,
+			GUC_EXPLAIN
+		},
+		&enable_memoize,
+		true,
+		NULL, NULL, NULL
+	},
 	{
 		{"enable_nestloop", PGC_USERSET, QUERY_TUNING_METHOD,
 			gettext_noop("Enables the planner's use of nested-loop join plans."),
@@ -994,6 +1143,16 @@ static struct config_bool ConfigureNamesBool[] =
 		true,
 		NULL, NULL, NULL
 	},
+	{
+		{"enable_hashjoin_bloom", PGC_USERSET, QUERY_TUNING_METHOD,
+			gettext_noop("Enables pushing down Bloom filters from hash joins to the scans on their outer side."),
+			NULL,
+			GUC_EXPLAIN
+		},
+		&enable_hashjoin_bloom,
+		true,
+		NULL, NULL, NULL
+	},
 	{
 		{"enable_gathermerge", PGC_USERSET, QUERY_TUNING_METHOD,
 			gettext_noop("Enables the planner's use of gather merge plans."),
@@ -1044,6 +1203,16 @@ static struct config_bool ConfigureNamesBool[] =
 		true,
 		NULL, NULL, NULL
 	},
+	{
+		{"enable_parallel_hashagg", PGC_USERSET, QUERY_TUNING_METHOD,
+			gettext_noop("Enables the planner's use of parallel hashed aggregation plans."),
+			NULL,
+			GUC_EXPLAIN
+		},
+		&enable_parallel_hashagg,
+		true,
+		NULL, NULL, NULL
+	},
 	{
 		{"enable_partition_pruning", PGC_USERSET, QUERY_TUNING_METHOD,
 			gettext_noop("Enable plan-time and run-time partition pruning."),
@@ -1188,16 +1357,6 @@ static struct config_bool ConfigureNamesBool[] =
 		NULL, NULL, NULL
 	},
 
-	{
-		{"wal_compression", PGC_SUSET, WAL_SETTINGS,
-			gettext_noop("Compresses full-page writes written in WAL file."),
-			NULL
-		},
-		&wal_compression,
-		false,
-		NULL, NULL, NULL
-	},
-
 	{
 		{"wal_init_zero", PGC_SUSET, WAL_SETTINGS,
 			gettext_noop("Writes zeroes to new WAL files before first use."),
@@ -1218,6 +1377,27 @@ static struct config_bool ConfigureNamesBool[] =
 		NULL, NULL, NULL
 	},
 
+	{
+		{"adaptive_commit_delay", PGC_SUSET, WAL_SETTINGS,
+			gettext_noop("Computes the delay before flushing WAL from the recent commit rate."),
+			gettext_noop("When enabled, commit_siblings is ignored and a nonzero "
+						 "commit_delay only limits the delay.")
+		},
+		&AdaptiveCommitDelay,
+		false,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"summarize_wal", PGC_POSTMASTER, WAL_ARCHIVING,
+			gettext_noop("Starts the WAL summarizer process to enable incremental backup."),
+			NULL
+		},
+		&summarize_wal,
+		false,
+		NULL, NULL, NULL
+	},
+
 	{
 		{"log_checkpoints", PGC_SIGHUP, LOGGING_WHAT,
 			gettext_noop("Logs each checkpoint."),
@@ -1773,6 +1953,16 @@ static struct config_bool ConfigureNamesBool[] =
 		NULL, NULL, NULL
 	},
 
+	{
+		{"wal_receiver_immediate_feedback", PGC_SIGHUP, REPLICATION_STANDBY,
+			gettext_noop("Sends a reply to the primary as soon as received WAL has been flushed."),
+			NULL
+		},
+		&wal_receiver_immediate_feedback,
+		false,
+		NULL, NULL, NULL
+	},
+
 	{
 		{"allow_system_table_mods", PGC_POSTMASTER, DEVELOPER_OPTIONS,
 			gettext_noop("Allows modifications of the structure of system tables."),
@@ -1967,6 +2157,61 @@ static struct config_bool ConfigureNamesBool[] =
 		NULL, NULL, NULL
 	},
 
+	{
+		{"undo_spool_dead_tids", PGC_SIGHUP, RESOURCES_DISK,
+			gettext_noop("Spools the TIDs of deleted zheap tuples when their undo is discarded."),
+			gettext_noop("VACUUM (UNDO_SPOOL) then visits only the spooled blocks. The undo "
+						 "discard worker has to read all the undo of each transaction.")
+		},
+		&undo_spool_dead_tids,
+		false,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"undo_read_mmap", PGC_USERSET, RESOURCES_MEM,
+			gettext_noop("Reads undo records that aren't in shared buffers through memory mappings."),
+			gettext_noop("This saves pinning and locking a buffer for each undo record "
+						 "read while following undo chains.")
+		},
+		&undo_read_mmap,
+		false,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"numa_buffers", PGC_POSTMASTER, RESOURCES_MEM,
+			gettext_noop("Partitions shared buffers by NUMA node."),
+			gettext_noop("Each node gets the descriptors and pages of one partition "
+						 "on its own memory, and backends replace buffers in the "
+						 "partition of the node they run on.")
+		},
+		&numa_buffers,
+		false,
+		check_numa_buffers, NULL, NULL
+	},
+
+	{
+		{"zheap_background_prune", PGC_USERSET, AUTOVACUUM,
+			gettext_noop("Lets autovacuum prune the zheap pages that scans find prunable."),
+			NULL
+		},
+		&zheap_background_prune,
+		false,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"undo_full_page_writes", PGC_SIGHUP, WAL_SETTINGS,
+			gettext_noop("Writes full pages of undo logs to WAL when first modified after a checkpoint."),
+			gettext_noop("Undo pages are only appended to, so redo can rebuild them from a "
+						 "torn write. Ignored when data checksums are enabled.")
+		},
+		&undo_full_page_writes,
+		true,
+		NULL, NULL, NULL
+	},
+
 	/* End-of-list marker */
 	{
 		{NULL, 0, 0, NULL, NULL}, NULL, false, NULL, NULL, NULL
@@ -1987,6 +2232,16 @@ static struct config_int ConfigureNamesInt[] =
 		0, 0, INT_MAX / 2,
 		NULL, NULL, NULL
 	},
+	{
+		{"wal_summary_keep_time", PGC_SIGHUP, WAL_ARCHIVING,
+			gettext_noop("Time for which WAL summary files should be kept."),
+			gettext_noop("0 means keep them forever."),
+			GUC_UNIT_MIN
+		},
+		&wal_summary_keep_time,
+		10 * 24 * 60, 0, INT_MAX / SECS_PER_MINUTE,
+		NULL, NULL, NULL
+	},
 	{
 		{"post_auth_delay", PGC_BACKEND, DEVELOPER_OPTIONS,
 			gettext_noop("Waits N seconds on connection startup after authentication."),
@@ -2033,6 +2288,16 @@ static struct config_int ConfigureNamesInt[] =
 		8, 1, INT_MAX,
 		NULL, NULL, NULL
 	},
+	{
+		{"jit_deform_cache_size", PGC_USERSET, QUERY_TUNING_OTHER,
+			gettext_noop("Sets the maximum number of JIT compiled tuple deforming "
+						 "functions kept for use by later queries."),
+			gettext_noop("Zero disables the cache.")
+		},
+		&jit_deform_cache_size,
+		128, 0, INT_MAX,
+		NULL, NULL, NULL
+	},
 	{
 		{"geqo_threshold", PGC_USERSET, QUERY_TUNING_GEQO,
 			gettext_noop("Sets the threshold of FROM items beyond which GEQO is used."),
@@ -2119,6 +2384,17 @@ static struct config_int ConfigureNamesInt[] =
 		NULL, NULL, NULL
 	},
 
+	{
+		{"recovery_prefetch_distance", PGC_SIGHUP, REPLICATION_STANDBY,
+			gettext_noop("Sets how far ahead of replay to prefetch the blocks that WAL records modify."),
+			gettext_noop("Zero disables prefetching."),
+			GUC_UNIT_KB
+		},
+		&recovery_prefetch_distance,
+		256, 0, MAX_KILOBYTES,
+		NULL, NULL, NULL
+	},
+
 	{
 		{"wal_receiver_status_interval", PGC_SIGHUP, REPLICATION_STANDBY,
 			gettext_noop("Sets the maximum interval between WAL receiver status reports to the sending server."),
@@ -2167,16 +2443,40 @@ static struct config_int ConfigureNamesInt[] =
 	 * checking for overflow, so we mustn't allow more than INT_MAX / 2.
 	 */
 	{
-		{"shared_buffers", PGC_POSTMASTER, RESOURCES_MEM,
+		{"shared_buffers", PGC_SIGHUP, RESOURCES_MEM,
 			gettext_noop("Sets the number of shared memory buffers used by the server."),
-			NULL,
+			gettext_noop("It can be changed without a restart up to max_shared_buffers."),
 			GUC_UNIT_BLOCKS
 		},
-		&NBuffers,
+		&SharedBuffers,
 		1024, 16, INT_MAX / 2,
 		NULL, NULL, NULL
 	},
 
+	{
+		{"max_shared_buffers", PGC_POSTMASTER, RESOURCES_MEM,
+			gettext_noop("Sets the number of shared memory buffers reserved at server start."),
+			gettext_noop("shared_buffers can be raised up to this value without a "
+						 "restart. -1 reserves only shared_buffers."),
+			GUC_UNIT_BLOCKS
+		},
+		&MaxSharedBuffers,
+		-1, -1, INT_MAX / 2,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"undo_buffers", PGC_POSTMASTER, RESOURCES_MEM,
+			gettext_noop("Sets the number of shared memory buffers reserved for undo logs."),
+			gettext_noop("These buffers are part of shared_buffers.  Zero lets undo "
+						 "logs use all of shared_buffers."),
+			GUC_UNIT_BLOCKS
+		},
+		&NUndoBuffers,
+		0, 0, INT_MAX / 4,
+		NULL, NULL, NULL
+	},
+
 	{
 		{"temp_buffers", PGC_USERSET, RESOURCES_MEM,
 			gettext_noop("Sets the maximum number of temporary buffers used by each session."),
@@ -2198,6 +2498,36 @@ static struct config_int ConfigureNamesInt[] =
 		NULL, NULL, NULL
 	},
 
+	{
+		{"connection_proxies", PGC_POSTMASTER, CONN_AUTH_SETTINGS,
+			gettext_noop("Sets the number of connection proxy processes."),
+			gettext_noop("Zero disables connection pooling.")
+		},
+		&connection_proxies,
+		0, 0, MAX_CONNECTION_PROXIES,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"proxy_port", PGC_POSTMASTER, CONN_AUTH_SETTINGS,
+			gettext_noop("Sets the TCP port the server listens on for pooled connections."),
+			NULL
+		},
+		&proxy_port,
+		6543, 1, 65535,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"session_pool_size", PGC_POSTMASTER, CONN_AUTH_SETTINGS,
+			gettext_noop("Sets the number of backends each connection proxy keeps per database, role and startup options."),
+			NULL
+		},
+		&session_pool_size,
+		10, 1, MAX_BACKENDS,
+		NULL, NULL, NULL
+	},
+
 	{
 		{"unix_socket_permissions", PGC_POSTMASTER, CONN_AUTH_SETTINGS,
 			gettext_noop("Sets the access permissions of the Unix-domain socket."),
@@ -2266,6 +2596,19 @@ static struct config_int ConfigureNamesInt[] =
 		NULL, NULL, NULL
 	},
 
+	{
+		{"logical_decoding_work_mem", PGC_USERSET, RESOURCES_MEM,
+			gettext_noop("Sets the maximum memory to be used for logical decoding."),
+			gettext_noop("This much memory can be used by each internal "
+						 "reorder buffer before spilling to disk or "
+						 "streaming the transaction."),
+			GUC_UNIT_KB
+		},
+		&logical_decoding_work_mem,
+		65536, 64, MAX_KILOBYTES,
+		NULL, NULL, NULL
+	},
+
 	/*
 	 * We use the hopefully-safely-small value of 100kB as the compiled-in
 	 * default for max_stack_depth.  InitializeGUCOptions will increase it if
@@ -2625,6 +2968,17 @@ static struct config_int ConfigureNamesInt[] =
 		check_wal_buffers, NULL, NULL
 	},
 
+	{
+		{"wal_insert_locks", PGC_POSTMASTER, WAL_SETTINGS,
+			gettext_noop("Sets the number of WAL insertion locks."),
+			gettext_noop("More locks allow more backends to copy WAL records "
+						 "into the WAL buffers concurrently.")
+		},
+		&num_xloginsert_locks,
+		8, 1, 1024,
+		NULL, NULL, NULL
+	},
+
 	{
 		{"wal_writer_delay", PGC_SIGHUP, WAL_SETTINGS,
 			gettext_noop("Time between WAL flushes performed in the WAL writer."),
@@ -2837,6 +3191,30 @@ static struct config_int ConfigureNamesInt[] =
 		NULL, NULL, NULL
 	},
 
+	{
+		{"max_parallel_apply_workers_per_subscription",
+			PGC_SIGHUP,
+			REPLICATION_SUBSCRIBERS,
+			gettext_noop("Maximum number of parallel apply workers per subscription."),
+			gettext_noop("Takes effect when the subscription's apply worker is started."),
+		},
+		&max_parallel_apply_workers_per_subscription,
+		0, 0, MAX_PARALLEL_WORKER_LIMIT,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"max_parallel_sync_workers_per_table",
+			PGC_SIGHUP,
+			REPLICATION_SUBSCRIBERS,
+			gettext_noop("Maximum number of parallel workers helping to copy the initial data of a table."),
+			NULL,
+		},
+		&max_parallel_sync_workers_per_table,
+		0, 0, MAX_PARALLEL_WORKER_LIMIT,
+		NULL, NULL, NULL
+	},
+
 	{
 		{"log_rotation_age", PGC_SIGHUP, LOGGING_WHERE,
 			gettext_noop("Automatic log file rotation will occur after N minutes."),
@@ -2947,6 +3325,272 @@ static struct config_int ConfigureNamesInt[] =
 		NULL, NULL, NULL
 	},
 
+	{
+		{"rollback_foreground_latency", PGC_USERSET, RESOURCES_MEM,
+			gettext_noop("Rollbacks estimated to take longer than this are done lazily."),
+			gettext_noop("Only used when rollback_policy is adaptive."),
+			GUC_UNIT_MS
+		},
+		&rollback_foreground_latency,
+		1000, 0, INT_MAX,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"undo_record_cache_size", PGC_POSTMASTER, RESOURCES_MEM,
+			gettext_noop("Sets the number of unpacked undo records cached in shared memory."),
+			gettext_noop("Zero disables the undo record cache.")
+		},
+		&undo_record_cache_size,
+		1024, 0, INT_MAX / 2,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"zheap_key_share_lock_table_size", PGC_POSTMASTER, RESOURCES_MEM,
+			gettext_noop("Sets the number of zheap key share tuple locks kept in shared memory."),
+			gettext_noop("Zero disables the key share lock table.")
+		},
+		&zheap_key_share_lock_table_size,
+		0, 0, INT_MAX / 2,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"zheap_multilocker_cache_size", PGC_POSTMASTER, RESOURCES_MEM,
+			gettext_noop("Sets the number of zheap multi-locker member lists cached in shared memory."),
+			gettext_noop("Zero disables the multi-locker cache.")
+		},
+		&zheap_multilocker_cache_size,
+		256, 0, INT_MAX / 2,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"zheap_spec_token_table_size", PGC_POSTMASTER, RESOURCES_MEM,
+			gettext_noop("Sets the number of zheap speculative insertion tokens kept in shared memory."),
+			gettext_noop("Zero disables the speculative token table.")
+		},
+		&zheap_spec_token_table_size,
+		1024, 0, INT_MAX / 2,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"zheap_freed_page_hints", PGC_POSTMASTER, RESOURCES_MEM,
+			gettext_noop("Sets the number of recently freed zheap pages remembered in shared memory."),
+			gettext_noop("Zero disables the freed page hints.")
+		},
+		&zheap_freed_page_hints,
+		1024, 0, INT_MAX / 2,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"smgr_size_cache", PGC_POSTMASTER, RESOURCES_MEM,
+			gettext_noop("Sets the number of relation fork sizes cached in shared memory."),
+			gettext_noop("Zero disables the relation size cache.")
+		},
+		&smgr_size_cache,
+		4096, 0, INT_MAX / 2,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"shared_sequence_cache", PGC_POSTMASTER, RESOURCES_MEM,
+			gettext_noop("Sets the number of sequences whose values are cached in shared memory."),
+			gettext_noop("Zero disables the shared sequence cache.")
+		},
+		&shared_sequence_cache,
+		0, 0, INT_MAX / 2,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"shared_plan_cache_size", PGC_POSTMASTER, RESOURCES_MEM,
+			gettext_noop("Sets the amount of shared memory used to share generic plans of prepared statements between sessions."),
+			gettext_noop("Zero disables the shared plan cache."),
+			GUC_UNIT_MB
+		},
+		&shared_plan_cache_size,
+		0, 0, MAX_KILOBYTES / 1024,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"transaction_buffers", PGC_POSTMASTER, RESOURCES_MEM,
+			gettext_noop("Sets the number of shared memory buffers used for the transaction status cache."),
+			gettext_noop("Zero sizes the cache based on shared_buffers."),
+			GUC_UNIT_BLOCKS
+		},
+		&transaction_buffers,
+		0, 0, SLRU_MAX_ALLOWED_BUFFERS,
+		check_transaction_buffers, NULL, NULL
+	},
+
+	{
+		{"subtransaction_buffers", PGC_POSTMASTER, RESOURCES_MEM,
+			gettext_noop("Sets the number of shared memory buffers used for the subtransaction cache."),
+			gettext_noop("Zero sizes the cache based on shared_buffers."),
+			GUC_UNIT_BLOCKS
+		},
+		&subtransaction_buffers,
+		0, 0, SLRU_MAX_ALLOWED_BUFFERS,
+		check_subtransaction_buffers, NULL, NULL
+	},
+
+	{
+		{"multixact_offset_buffers", PGC_POSTMASTER, RESOURCES_MEM,
+			gettext_noop("Sets the number of shared memory buffers used for the MultiXact offset cache."),
+			NULL,
+			GUC_UNIT_BLOCKS
+		},
+		&multixact_offset_buffers,
+		16, SLRU_BANK_SIZE, SLRU_MAX_ALLOWED_BUFFERS,
+		check_multixact_offset_buffers, NULL, NULL
+	},
+
+	{
+		{"multixact_member_buffers", PGC_POSTMASTER, RESOURCES_MEM,
+			gettext_noop("Sets the number of shared memory buffers used for the MultiXact member cache."),
+			NULL,
+			GUC_UNIT_BLOCKS
+		},
+		&multixact_member_buffers,
+		32, SLRU_BANK_SIZE, SLRU_MAX_ALLOWED_BUFFERS,
+		check_multixact_member_buffers, NULL, NULL
+	},
+
+	{
+		{"undo_local_buffer_size", PGC_USERSET, RESOURCES_MEM,
+			gettext_noop("Sets the number of recently inserted undo records each backend keeps in memory for rollbacks."),
+			gettext_noop("Zero disables the local undo buffer.")
+		},
+		&undo_local_buffer_size,
+		32, 0, 65536,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"undo_local_cid_map_size", PGC_USERSET, RESOURCES_MEM,
+			gettext_noop("Sets the number of undo records of its current transaction each backend keeps the command id of."),
+			gettext_noop("Zero disables the command id map.")
+		},
+		&undo_local_cid_map_size,
+		16384, 0, INT_MAX / 2,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"undo_parallel_apply_size", PGC_SIGHUP, RESOURCES_MEM,
+			gettext_noop("Rollbacks greater than this size are applied by several undo workers."),
+			gettext_noop("Zero disables parallel apply of undo actions."),
+			GUC_UNIT_MB
+		},
+		&undo_parallel_apply_size,
+		1024, 0, MAX_KILOBYTES,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"undo_worker_min_per_database", PGC_SUSET, RESOURCES_ASYNCHRONOUS,
+			gettext_noop("Sets the number of idle undo workers kept connected to each database."),
+			gettext_noop("Once started, this many undo workers of a database keep waiting "
+						 "for its rollback requests instead of exiting when idle.")
+		},
+		&undo_worker_min_per_database,
+		0, 0, MAX_BACKENDS,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"undo_discard_workers", PGC_POSTMASTER, RESOURCES_ASYNCHRONOUS,
+			gettext_noop("Sets the number of undo discard worker processes."),
+			gettext_noop("Each worker discards the undo of its own share of the undo logs.")
+		},
+		&undo_discard_workers,
+		1, 1, MAX_DISCARD_WORKERS,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"io_workers", PGC_POSTMASTER, RESOURCES_ASYNCHRONOUS,
+			gettext_noop("Sets the number of I/O worker processes."),
+			gettext_noop("Only used when io_method is \"worker\".")
+		},
+		&io_workers,
+		3, 1, MAX_IO_WORKERS,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"io_queue_depth", PGC_POSTMASTER, RESOURCES_ASYNCHRONOUS,
+			gettext_noop("Sets the maximum number of asynchronous I/Os in flight per process."),
+			gettext_noop("With io_method \"worker\", this is also the number of I/O "
+						 "requests each I/O worker can have queued.")
+		},
+		&io_queue_depth,
+		32, 1, 1024,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"undo_retention_size", PGC_SIGHUP, RESOURCES_DISK,
+			gettext_noop("Sets the maximum amount of undo kept in each undo log for old snapshots."),
+			gettext_noop("Older undo is discarded anyway, and queries that need it fail with "
+						 "\"snapshot too old\".  Zero means no limit."),
+			GUC_UNIT_MB
+		},
+		&undo_retention_size,
+		0, 0, MAX_KILOBYTES,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"undo_retention_time", PGC_SIGHUP, RESOURCES_DISK,
+			gettext_noop("Sets the maximum age of the undo kept for old snapshots."),
+			gettext_noop("Older undo is discarded anyway, and queries that need it fail with "
+						 "\"snapshot too old\".  Zero means no limit."),
+			GUC_UNIT_S
+		},
+		&undo_retention_time,
+		0, 0, INT_MAX / 1000,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"undo_segment_pool_size", PGC_SIGHUP, RESOURCES_DISK,
+			gettext_noop("Sets the maximum number of discarded undo segment files kept for reuse."),
+			gettext_noop("Zero makes discarded undo segment files be removed right away.")
+		},
+		&undo_segment_pool_size,
+		16, 0, INT_MAX,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"undo_preallocate_segments", PGC_SIGHUP, RESOURCES_DISK,
+			gettext_noop("Sets the number of free undo segment files created ahead of time."),
+			gettext_noop("The undo discard worker creates them while it has nothing else to do. "
+						 "Zero disables preallocation.")
+		},
+		&undo_preallocate_segments,
+		0, 0, INT_MAX,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"undo_precreate_logs", PGC_SIGHUP, RESOURCES_DISK,
+			gettext_noop("Sets the number of free undo logs created ahead of time."),
+			gettext_noop("The undo discard worker keeps this many undo logs of the default "
+						 "tablespace free for each of permanent and unlogged undo, so that "
+						 "new sessions don't have to create one.  Zero disables this.")
+		},
+		&undo_precreate_logs,
+		0, 0, 1024,
+		NULL, NULL, NULL
+	},
+
 	{
 		{"wal_segment_size", PGC_INTERNAL, PRESET_OPTIONS,
 			gettext_noop("Shows the size of write ahead log segments."),
@@ -3052,6 +3696,16 @@ static struct config_int ConfigureNamesInt[] =
 		NULL, NULL, NULL
 	},
 
+	{
+		{"parallel_worker_pool_size", PGC_SIGHUP, RESOURCES_ASYNCHRONOUS,
+			gettext_noop("Sets the maximum number of parallel workers kept for reuse after finishing their work."),
+			NULL
+		},
+		&parallel_worker_pool_size,
+		0, 0, MAX_BACKENDS,
+		NULL, NULL, NULL
+	},
+
 	{
 		{"autovacuum_work_mem", PGC_SIGHUP, RESOURCES_MEM,
 			gettext_noop("Sets the maximum memory to be used by each autovacuum worker process."),
@@ -3063,6 +3717,27 @@ static struct config_int ConfigureNamesInt[] =
 		check_autovacuum_work_mem, NULL, NULL
 	},
 
+	{
+		{"catalog_cache_memory_target", PGC_USERSET, RESOURCES_MEM,
+			gettext_noop("Sets the memory each session's catalog caches and relation cache may use before unused entries are evicted."),
+			gettext_noop("Zero lets the caches grow without limit."),
+			GUC_UNIT_KB
+		},
+		&catalog_cache_memory_target,
+		0, 0, MAX_KILOBYTES,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"regex_cache_size", PGC_USERSET, RESOURCES_MEM,
+			gettext_noop("Sets the number of compiled regular expressions each session keeps for reuse."),
+			NULL
+		},
+		&regex_cache_size,
+		32, 1, 1000000,
+		NULL, NULL, NULL
+	},
+
 	{
 		{"old_snapshot_threshold", PGC_POSTMASTER, RESOURCES_ASYNCHRONOUS,
 			gettext_noop("Time before a snapshot is too old to read pages changed after the snapshot was taken."),
@@ -3905,6 +4580,17 @@ static struct config_string ConfigureNamesString[] =
 		"stderr",
 		check_log_destination, assign_log_destination, NULL
 	},
+	{
+		{"io_direct", PGC_POSTMASTER, RESOURCES_DISK,
+			gettext_noop("Selects the files read and written with direct I/O."),
+			gettext_noop("Valid values are combinations of \"data\" and \"wal\", "
+						 "or an empty string for none."),
+			GUC_LIST_INPUT
+		},
+		&io_direct_string,
+		"",
+		check_io_direct, assign_io_direct, NULL
+	},
 	{
 		{"log_directory", PGC_SIGHUP, LOGGING_WHERE,
 			gettext_noop("Sets the destination directory for log files."),
@@ -4299,6 +4985,28 @@ static struct config_enum ConfigureNamesEnum[] =
 		NULL, NULL, NULL
 	},
 
+	{
+		{"join_search_method", PGC_USERSET, QUERY_TUNING_GEQO,
+			gettext_noop("Sets the method used to plan joins of geqo_threshold or more FROM items."),
+			NULL,
+			GUC_EXPLAIN
+		},
+		&join_search_method,
+		JOIN_SEARCH_ITERATIVE, join_search_method_options,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"default_toast_compression", PGC_USERSET, CLIENT_CONN_STATEMENT,
+			gettext_noop("Sets the default compression method for compressible values."),
+			gettext_noop("It applies to columns that have no compression method of their own.")
+		},
+		&default_toast_compression,
+		TOAST_PGLZ_COMPRESSION,
+		default_toast_compression_options,
+		NULL, NULL, NULL
+	},
+
 	{
 		{"default_transaction_isolation", PGC_USERSET, CLIENT_CONN_STATEMENT,
 			gettext_noop("Sets the transaction isolation level of each new transaction."),
@@ -4464,6 +5172,36 @@ static struct config_enum ConfigureNamesEnum[] =
 		NULL, NULL, NULL
 	},
 
+	{
+		{"wal_compression", PGC_SUSET, WAL_SETTINGS,
+			gettext_noop("Compresses full-page writes written in WAL file with specified method."),
+			NULL
+		},
+		&wal_compression,
+		WAL_COMPRESSION_NONE, wal_compression_options,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"temp_file_compression", PGC_USERSET, RESOURCES_DISK,
+			gettext_noop("Compresses temporary files written by hash joins and hash aggregation with specified method."),
+			NULL
+		},
+		&temp_file_compression,
+		TEMP_FILE_COMPRESSION_NONE, temp_file_compression_options,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"io_method", PGC_POSTMASTER, RESOURCES_ASYNCHRONOUS,
+			gettext_noop("Selects the method used for asynchronous file I/O."),
+			NULL
+		},
+		&io_method,
+		IOMETHOD_SYNC, io_method_options,
+		NULL, NULL, NULL
+	},
+
 	{
 		{"dynamic_shared_memory_type", PGC_POSTMASTER, RESOURCES_MEM,
 			gettext_noop("Selects the dynamic shared memory implementation used."),
@@ -4561,6 +5299,26 @@ static struct config_enum ConfigureNamesEnum[] =
 		NULL, NULL, NULL
 	},
 
+	{
+		{"checkpoint_pacing", PGC_SIGHUP, WAL_CHECKPOINTS,
+			gettext_noop("Sets how the writes of a checkpoint are spread out."),
+			NULL
+		},
+		&CheckPointPacing,
+		CHECKPOINT_PACING_SCHEDULE, checkpoint_pacing_options,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"rollback_policy", PGC_USERSET, RESOURCES_MEM,
+			gettext_noop("Sets how the rollbacks done lazily by undo workers are chosen."),
+			NULL
+		},
+		&rollback_policy,
+		ROLLBACK_POLICY_SIZE, rollback_policy_options,
+		NULL, NULL, NULL
+	},
+
 	{
 		{"ssl_min_protocol_version", PGC_SIGHUP, CONN_AUTH_SSL,
 			gettext_noop("Sets the minimum SSL/TLS protocol version to use."),
@@ -10279,10 +11037,57 @@ RestoreGUCState(void *gucstate)
 	Size		len;
 	int			i;
 
-	/* See comment at can_skip_gucvar(). */
+	/*
+	 * See comment at can_skip_gucvar().  A parallel worker that is reused
+	 * still has the values restored for its previous leader, so free those
+	 * before resetting to the defaults, to avoid leaking memory.
+	 */
 	for (i = 0; i < num_guc_variables; i++)
-		if (!can_skip_gucvar(guc_variables[i]))
-			InitializeOneGUCOption(guc_variables[i]);
+	{
+		struct config_generic *gconf = guc_variables[i];
+
+		if (can_skip_gucvar(gconf))
+			continue;
+
+		Assert(gconf->stack == NULL);
+		switch (gconf->vartype)
+		{
+			case PGC_BOOL:
+				set_extra_field(gconf,
+								&((struct config_bool *) gconf)->reset_extra,
+								NULL);
+				break;
+			case PGC_INT:
+				set_extra_field(gconf,
+								&((struct config_int *) gconf)->reset_extra,
+								NULL);
+				break;
+			case PGC_REAL:
+				set_extra_field(gconf,
+								&((struct config_real *) gconf)->reset_extra,
+								NULL);
+				break;
+			case PGC_STRING:
+				{
+					struct config_string *conf = (struct config_string *) gconf;
+
+					set_string_field(conf, conf->variable, NULL);
+					set_string_field(conf, &conf->reset_val, NULL);
+					set_extra_field(gconf, &conf->reset_extra, NULL);
+					break;
+				}
+			case PGC_ENUM:
+				set_extra_field(gconf,
+								&((struct config_enum *) gconf)->reset_extra,
+								NULL);
+				break;
+		}
+		set_extra_field(gconf, &gconf->extra, NULL);
+		if (gconf->sourcefile)
+			free(gconf->sourcefile);
+
+		InitializeOneGUCOption(gconf);
+	}
 
 	/* First item is the length of the subsequent data */
 	memcpy(&len, gucstate, sizeof(len));
@@ -11127,6 +11932,80 @@ check_ssl(bool *newval, void **extra, GucSource source)
 	return true;
 }
 
+static bool
+check_io_direct(char **newval, void **extra, GucSource source)
+{
+	char	   *rawstring;
+	List	   *elemlist;
+	ListCell   *l;
+	int			flags = 0;
+	int		   *myextra;
+
+	/* Need a modifiable copy of string */
+	rawstring = pstrdup(*newval);
+
+	/* Parse string into list of identifiers */
+	if (!SplitIdentifierString(rawstring, ',', &elemlist))
+	{
+		/* syntax error in list */
+		GUC_check_errdetail("List syntax is invalid.");
+		pfree(rawstring);
+		list_free(elemlist);
+		return false;
+	}
+
+	foreach(l, elemlist)
+	{
+		char	   *tok = (char *) lfirst(l);
+
+		if (pg_strcasecmp(tok, "data") == 0)
+			flags |= IO_DIRECT_DATA;
+		else if (pg_strcasecmp(tok, "wal") == 0)
+			flags |= IO_DIRECT_WAL;
+		else
+		{
+			GUC_check_errdetail("Unrecognized key word: \"%s\".", tok);
+			pfree(rawstring);
+			list_free(elemlist);
+			return false;
+		}
+	}
+
+	pfree(rawstring);
+	list_free(elemlist);
+
+	if (flags != 0 && PG_O_DIRECT == 0)
+	{
+		GUC_check_errdetail("Direct I/O is not supported on this platform.");
+		return false;
+	}
+
+	myextra = (int *) guc_malloc(ERROR, sizeof(int));
+	*myextra = flags;
+	*extra = (void *) myextra;
+
+	return true;
+}
+
+static void
+assign_io_direct(const char *newval, void *extra)
+{
+	io_direct_flags = *((int *) extra);
+}
+
+static bool
+check_numa_buffers(bool *newval, void **extra, GucSource source)
+{
+#ifndef USE_LIBNUMA
+	if (*newval)
+	{
+		GUC_check_errmsg("NUMA is not supported by this build");
+		return false;
+	}
+#endif
+	return true;
+}
+
 static bool
 check_stage_log_stats(bool *newval, void **extra, GucSource source)
 {
@@ -11359,6 +12238,30 @@ check_autovacuum_work_mem(int *newval, void **extra, GucSource source)
 	return true;
 }
 
+static bool
+check_transaction_buffers(int *newval, void **extra, GucSource source)
+{
+	return check_slru_buffers("transaction_buffers", newval);
+}
+
+static bool
+check_subtransaction_buffers(int *newval, void **extra, GucSource source)
+{
+	return check_slru_buffers("subtransaction_buffers", newval);
+}
+
+static bool
+check_multixact_offset_buffers(int *newval, void **extra, GucSource source)
+{
+	return check_slru_buffers("multixact_offset_buffers", newval);
+}
+
+static bool
+check_multixact_member_buffers(int *newval, void **extra, GucSource source)
+{
+	return check_slru_buffers("multixact_member_buffers", newval);
+}
+
 static bool
 check_max_worker_processes(int *newval, void **extra, GucSource source)
 {
@@ -31,10 +31,11 @@
  * input is reached, we dump out remaining tuples in memory into a final run,
  * then merge the runs using Algorithm D.
  *
- * When merging runs, we use a heap containing just the frontmost tuple from
- * each source run; we repeatedly output the smallest tuple and replace it
- * with the next tuple from its source tape (if any).  When the heap empties,
- * the merge is complete.  The basic merge algorithm thus needs very little
+ * When merging runs, we use a tournament tree of losers (a "loser tree")
+ * containing just the frontmost tuple from each source run; we repeatedly
+ * output the smallest tuple and replace it with the next tuple from its
+ * source tape (if any), which only takes one comparison per level of the
+ * tree.  When the tree empties, the merge is complete.  The basic merge algorithm thus needs very little
  * memory --- only M tuples for an M-way merge, and M is constrained to a
  * small number.  However, we can still make good use of our full workMem
  * allocation by pre-reading additional blocks from each source tape.  Without
@@ -103,6 +104,7 @@
 #include "catalog/pg_am.h"
 #include "commands/tablespace.h"
 #include "executor/executor.h"
+#include "lib/losertree.h"
 #include "miscadmin.h"
 #include "pg_trace.h"
 #include "utils/datum.h"
@@ -163,8 +165,8 @@ bool		optimize_bounded_sort = true;
  * described above.  Accordingly, "tuple" is always used in preference to
  * datum1 as the authoritative value for pass-by-reference cases.
  *
- * tupindex holds the input tape number that each tuple in the heap was read
- * from during merge passes.
+ * tupindex holds the input tape number that each tuple in the merge tree was
+ * read from during merge passes.
  */
 typedef struct
 {
@@ -223,6 +225,16 @@ typedef enum
 #define TAPE_BUFFER_OVERHEAD		BLCKSZ
 #define MERGE_BUFFER_SIZE			(BLCKSZ * 32)
 
+/*
+ * Ranges of fewer than RADIXSORT_THRESHOLD tuples are sorted by comparisons
+ * rather than by radix sort.  RADIX_KEY maps a datum to the unsigned integer
+ * that is radix sorted on, and RADIX_BYTE extracts one of its bytes.
+ */
+#define RADIXSORT_THRESHOLD		64
+#define RADIX_KEY(datum, nbytes, xormask) \
+	(((nbytes) == 4 ? (Datum) (uint32) (datum) : (datum)) ^ (xormask))
+#define RADIX_BYTE(key, byte)	((int) (((key) >> ((byte) * 8)) & 0xFF))
+
 typedef int (*SortTupleComparator) (const SortTuple *a, const SortTuple *b,
 									Tuplesortstate *state);
 
@@ -288,9 +300,11 @@ struct Tuplesortstate
 	/*
 	 * This array holds the tuples now in sort memory.  If we are in state
 	 * INITIAL, the tuples are in no particular order; if we are in state
-	 * SORTEDINMEM, the tuples are in final sorted order; in states BUILDRUNS
-	 * and FINALMERGE, the tuples are organized in "heap" order per Algorithm
-	 * H.  In state SORTEDONTAPE, the array is not used.
+	 * SORTEDINMEM, the tuples are in final sorted order; in state BOUNDED,
+	 * the tuples are organized in "heap" order per Algorithm H.  In states
+	 * BUILDRUNS and FINALMERGE, each element holds the frontmost tuple of one
+	 * input run, and mergetree orders them.  In state SORTEDONTAPE, the array
+	 * is not used.
 	 */
 	SortTuple  *memtuples;		/* array of SortTuple structs */
 	int			memtupcount;	/* number of tuples currently present */
@@ -308,7 +322,7 @@ struct Tuplesortstate
 	 * For the slab, we use one large allocation, divided into SLAB_SLOT_SIZE
 	 * slots.  The allocation is sized to have one slot per tape, plus one
 	 * additional slot.  We need that many slots to hold all the tuples kept
-	 * in the heap during merge, plus the one we have last returned from the
+	 * in the merge tree, plus the one we have last returned from the
 	 * sort, with tuplesort_gettuple.
 	 *
 	 * Initially, all the slots are kept in a linked list of free slots.  When
@@ -359,6 +373,13 @@ struct Tuplesortstate
 	 */
 	bool	   *mergeactive;	/* active input run source? */
 
+	/*
+	 * Loser tree of memtuples[] indexes, used during merge passes.  It holds
+	 * one leaf for each input run being merged; memtupcount is the number of
+	 * those not yet exhausted.
+	 */
+	losertree  *mergetree;
+
 	/*
 	 * Variables for Algorithm D.  Note that destTape is a "logical" tape
 	 * number, ie, an index into the tp_xxx[] arrays.  Be careful to keep
@@ -601,10 +622,19 @@ static void mergeruns(Tuplesortstate *state);
 static void mergeonerun(Tuplesortstate *state);
 static void beginmerge(Tuplesortstate *state);
 static bool mergereadnext(Tuplesortstate *state, int srcTape, SortTuple *stup);
+static int	merge_compare_tuples(Datum a, Datum b, void *arg);
 static void dumptuples(Tuplesortstate *state, bool alltuples);
 static void make_bounded_heap(Tuplesortstate *state);
 static void sort_bounded_heap(Tuplesortstate *state);
 static void tuplesort_sort_memtuples(Tuplesortstate *state);
+static bool tuplesort_radix_sortable(Tuplesortstate *state, int *nbytes,
+									 Datum *xormask);
+static void tuplesort_radix_sort(Tuplesortstate *state, int nbytes,
+								 Datum xormask);
+static void radix_sort_tuple(Tuplesortstate *state, SortTuple *begin, int n,
+							 int byte, int nbytes, Datum xormask);
+static void radix_sort_finish(Tuplesortstate *state, SortTuple *begin, int n,
+							  bool equal);
 static void tuplesort_heap_insert(Tuplesortstate *state, SortTuple *tuple);
 static void tuplesort_heap_replace_top(Tuplesortstate *state, SortTuple *tuple);
 static void tuplesort_heap_delete_top(Tuplesortstate *state);
@@ -1049,6 +1079,76 @@ tuplesort_begin_index_btree(Relation heapRel,
 	return state;
 }
 
+/*
+ * Sort GiST index tuples, using the opclasses' sortsupport functions.  The
+ * order is meant to keep tuples that are close to each other in the key
+ * space close in the sort order too (e.g. a Z-order curve), so that packing
+ * the sorted tuples into pages yields a reasonable index.
+ */
+Tuplesortstate *
+tuplesort_begin_index_gist(Relation heapRel,
+						   Relation indexRel,
+						   int workMem,
+						   SortCoordinate coordinate,
+						   bool randomAccess)
+{
+	Tuplesortstate *state = tuplesort_begin_common(workMem, coordinate,
+												   randomAccess);
+	MemoryContext oldcontext;
+	int			i;
+
+	oldcontext = MemoryContextSwitchTo(state->sortcontext);
+
+#ifdef TRACE_SORT
+	if (trace_sort)
+		elog(LOG,
+			 "begin index sort: workMem = %d, randomAccess = %c",
+			 workMem, randomAccess ? 't' : 'f');
+#endif
+
+	state->nKeys = IndexRelationGetNumberOfKeyAttributes(indexRel);
+
+	TRACE_POSTGRESQL_SORT_START(INDEX_SORT,
+								false,
+								state->nKeys,
+								workMem,
+								randomAccess,
+								PARALLEL_SORT(state));
+
+	state->comparetup = comparetup_index_btree;
+	state->copytup = copytup_index;
+	state->writetup = writetup_index;
+	state->readtup = readtup_index;
+
+	state->heapRel = heapRel;
+	state->indexRel = indexRel;
+
+	/* Prepare SortSupport data for each column */
+	state->sortKeys = (SortSupport) palloc0(state->nKeys *
+											sizeof(SortSupportData));
+
+	for (i = 0; i < state->nKeys; i++)
+	{
+		SortSupport sortKey = state->sortKeys + i;
+
+		sortKey->ssup_cxt = CurrentMemoryContext;
+		sortKey->ssup_collation = indexRel->rd_indcollation[i];
+		sortKey->ssup_nulls_first = false;
+		sortKey->ssup_attno = i + 1;
+		/* Convey if abbreviation optimization is applicable in principle */
+		sortKey->abbreviate = (i == 0);
+
+		AssertState(sortKey->ssup_attno != 0);
+
+		/* Look for a sort support function */
+		PrepareSortSupportFromGistIndexRel(indexRel, sortKey);
+	}
+
+	MemoryContextSwitchTo(oldcontext);
+
+	return state;
+}
+
 Tuplesortstate *
 tuplesort_begin_index_hash(Relation heapRel,
 						   Relation indexRel,
@@ -2091,10 +2191,11 @@ tuplesort_gettuple_common(Tuplesortstate *state, bool forward,
 			 */
 			if (state->memtupcount > 0)
 			{
-				int			srcTape = state->memtuples[0].tupindex;
+				int			i = DatumGetInt32(losertree_first(state->mergetree));
+				int			srcTape = state->memtuples[i].tupindex;
 				SortTuple	newtup;
 
-				*stup = state->memtuples[0];
+				*stup = state->memtuples[i];
 
 				/*
 				 * Remember the tuple we return, so that we can recycle its
@@ -2104,15 +2205,16 @@ tuplesort_gettuple_common(Tuplesortstate *state, bool forward,
 
 				/*
 				 * Pull next tuple from tape, and replace the returned tuple
-				 * at top of the heap with it.
+				 * in the merge tree with it.
 				 */
 				if (!mergereadnext(state, srcTape, &newtup))
 				{
 					/*
 					 * If no more data, we've reached end of run on this tape.
-					 * Remove the top node from the heap.
+					 * Remove its leaf from the merge tree.
 					 */
-					tuplesort_heap_delete_top(state);
+					losertree_remove_first(state->mergetree);
+					state->memtupcount--;
 
 					/*
 					 * Rewind to free the read buffer.  It'd go away at the
@@ -2123,7 +2225,8 @@ tuplesort_gettuple_common(Tuplesortstate *state, bool forward,
 					return true;
 				}
 				newtup.tupindex = srcTape;
-				tuplesort_heap_replace_top(state, &newtup);
+				state->memtuples[i] = newtup;
+				losertree_replace_first(state->mergetree, Int32GetDatum(i));
 				return true;
 			}
 			return false;
@@ -2637,12 +2740,15 @@ mergeruns(Tuplesortstate *state)
 		init_slab_allocator(state, 0);
 
 	/*
-	 * Allocate a new 'memtuples' array, for the heap.  It will hold one tuple
-	 * from each input tape.
+	 * Allocate a new 'memtuples' array, and the loser tree to merge it.  It
+	 * will hold one tuple from each input tape.
 	 */
 	state->memtupsize = numInputTapes;
 	state->memtuples = (SortTuple *) palloc(numInputTapes * sizeof(SortTuple));
 	USEMEM(state, GetMemoryChunkSpace(state->memtuples));
+	state->mergetree = losertree_allocate(numInputTapes, merge_compare_tuples,
+										  state);
+	USEMEM(state, GetMemoryChunkSpace(state->mergetree));
 
 	/*
 	 * Use all the remaining memory we have available for read buffers among
@@ -2792,43 +2898,49 @@ mergeonerun(Tuplesortstate *state)
 
 	/*
 	 * Start the merge by loading one tuple from each active source tape into
-	 * the heap.  We can also decrease the input run/dummy run counts.
+	 * the merge tree.  We can also decrease the input run/dummy run counts.
 	 */
 	beginmerge(state);
 
 	/*
-	 * Execute merge by repeatedly extracting lowest tuple in heap, writing it
-	 * out, and replacing it with next tuple from same tape (if there is
-	 * another one).
+	 * Execute merge by repeatedly extracting lowest tuple in the merge tree,
+	 * writing it out, and replacing it with next tuple from same tape (if
+	 * there is another one).
 	 */
 	while (state->memtupcount > 0)
 	{
+		int			i = DatumGetInt32(losertree_first(state->mergetree));
 		SortTuple	stup;
 
+		CHECK_FOR_INTERRUPTS();
+
 		/* write the tuple to destTape */
-		srcTape = state->memtuples[0].tupindex;
-		WRITETUP(state, destTape, &state->memtuples[0]);
+		srcTape = state->memtuples[i].tupindex;
+		WRITETUP(state, destTape, &state->memtuples[i]);
 
 		/* recycle the slot of the tuple we just wrote out, for the next read */
-		if (state->memtuples[0].tuple)
-			RELEASE_SLAB_SLOT(state, state->memtuples[0].tuple);
+		if (state->memtuples[i].tuple)
+			RELEASE_SLAB_SLOT(state, state->memtuples[i].tuple);
 
 		/*
 		 * pull next tuple from the tape, and replace the written-out tuple in
-		 * the heap with it.
+		 * the merge tree with it.
 		 */
 		if (mergereadnext(state, srcTape, &stup))
 		{
 			stup.tupindex = srcTape;
-			tuplesort_heap_replace_top(state, &stup);
-
+			state->memtuples[i] = stup;
+			losertree_replace_first(state->mergetree, Int32GetDatum(i));
 		}
 		else
-			tuplesort_heap_delete_top(state);
+		{
+			losertree_remove_first(state->mergetree);
+			state->memtupcount--;
+		}
 	}
 
 	/*
-	 * When the heap empties, we're done.  Write an end-of-run marker on the
+	 * When the merge tree empties, we're done.  Write an end-of-run marker on the
 	 * output tape, and increment its count of real runs.
 	 */
 	markrunend(state, destTape);
@@ -2846,7 +2958,7 @@ mergeonerun(Tuplesortstate *state)
  *
  * We decrease the counts of real and dummy runs for each tape, and mark
  * which tapes contain active input runs in mergeactive[].  Then, fill the
- * merge heap with the first tuple from each active tape.
+ * merge tree with the first tuple from each active tape.
  */
 static void
 beginmerge(Tuplesortstate *state)
@@ -2855,7 +2967,7 @@ beginmerge(Tuplesortstate *state)
 	int			tapenum;
 	int			srcTape;
 
-	/* Heap should be empty here */
+	/* Merge tree should be empty here */
 	Assert(state->memtupcount == 0);
 
 	/* Adjust run counts and mark the active tapes */
@@ -2878,7 +2990,8 @@ beginmerge(Tuplesortstate *state)
 	Assert(activeTapes > 0);
 	state->activeTapes = activeTapes;
 
-	/* Load the merge heap with the first tuple from each input tape */
+	/* Load the merge tree with the first tuple from each input tape */
+	losertree_reset(state->mergetree);
 	for (srcTape = 0; srcTape < state->maxTapes; srcTape++)
 	{
 		SortTuple	tup;
@@ -2886,9 +2999,13 @@ beginmerge(Tuplesortstate *state)
 		if (mergereadnext(state, srcTape, &tup))
 		{
 			tup.tupindex = srcTape;
-			tuplesort_heap_insert(state, &tup);
+			state->memtuples[state->memtupcount] = tup;
+			losertree_add_unordered(state->mergetree,
+									Int32GetDatum(state->memtupcount));
+			state->memtupcount++;
 		}
 	}
+	losertree_build(state->mergetree);
 }
 
 /*
@@ -2915,6 +3032,18 @@ mergereadnext(Tuplesortstate *state, int srcTape, SortTuple *stup)
 	return true;
 }
 
+/*
+ * Comparator for the merge tree, whose leaves are indexes into memtuples[].
+ */
+static int
+merge_compare_tuples(Datum a, Datum b, void *arg)
+{
+	Tuplesortstate *state = (Tuplesortstate *) arg;
+
+	return COMPARETUP(state, &state->memtuples[DatumGetInt32(a)],
+					  &state->memtuples[DatumGetInt32(b)]);
+}
+
 /*
  * dumptuples - remove tuples from memtuples and write initial run to tape
  *
@@ -3301,19 +3430,27 @@ sort_bounded_heap(Tuplesortstate *state)
 }
 
 /*
- * Sort all memtuples using specialized qsort() routines.
+ * Sort all memtuples using specialized qsort() routines, or radix sort.
  *
- * Quicksort is used for small in-memory sorts, and external sort runs.
+ * Quicksort (or radix sort) is used for small in-memory sorts, and external
+ * sort runs.
  */
 static void
 tuplesort_sort_memtuples(Tuplesortstate *state)
 {
+	int			nbytes;
+	Datum		xormask;
+
 	Assert(!LEADER(state));
 
 	if (state->memtupcount > 1)
 	{
+		/* Can we distribute the tuples on their leading key's bytes? */
+		if (state->memtupcount >= RADIXSORT_THRESHOLD &&
+			tuplesort_radix_sortable(state, &nbytes, &xormask))
+			tuplesort_radix_sort(state, nbytes, xormask);
 		/* Can we use the single-key sort function? */
-		if (state->onlyKey != NULL)
+		else if (state->onlyKey != NULL)
 			qsort_ssup(state->memtuples, state->memtupcount,
 					   state->onlyKey);
 		else
@@ -3324,6 +3461,262 @@ tuplesort_sort_memtuples(Tuplesortstate *state)
 	}
 }
 
+/*
+ * Radix sort support.
+ *
+ * When the leading sort key's comparator is one of the ssup_datum_*_cmp()
+ * functions, datum1 (the key's value, or its abbreviated key) orders the same
+ * way as an unsigned integer derived from it.  memtuples can then be sorted
+ * by distributing them on that integer's bytes, most significant first,
+ * which is faster than comparing them when there are many.  Runs of tuples
+ * whose datum1 are equal still have to be put in order of their other keys
+ * (or of the authoritative comparator, when datum1 is abbreviated), which is
+ * left to qsort_tuple().  So is any range of fewer than RADIXSORT_THRESHOLD
+ * tuples, for which comparing is cheaper than another distribution pass.
+ */
+
+int
+ssup_datum_unsigned_cmp(Datum x, Datum y, SortSupport ssup)
+{
+	if (x < y)
+		return -1;
+	else if (x > y)
+		return 1;
+	else
+		return 0;
+}
+
+#if SIZEOF_DATUM >= 8
+int
+ssup_datum_signed_cmp(Datum x, Datum y, SortSupport ssup)
+{
+	int64		xx = DatumGetInt64(x);
+	int64		yy = DatumGetInt64(y);
+
+	if (xx < yy)
+		return -1;
+	else if (xx > yy)
+		return 1;
+	else
+		return 0;
+}
+#endif
+
+int
+ssup_datum_int32_cmp(Datum x, Datum y, SortSupport ssup)
+{
+	int32		xx = DatumGetInt32(x);
+	int32		yy = DatumGetInt32(y);
+
+	if (xx < yy)
+		return -1;
+	else if (xx > yy)
+		return 1;
+	else
+		return 0;
+}
+
+/*
+ * Can memtuples be radix sorted?  If so, set *nbytes to the width of the
+ * integers datum1 is mapped to, and *xormask to what needs to be XOR'ed into
+ * them so that they order as unsigned integers in the sort's direction.
+ *
+ * Only sorts whose comparetup routine starts by comparing datum1 using the
+ * first sort key are eligible.
+ */
+static bool
+tuplesort_radix_sortable(Tuplesortstate *state, int *nbytes, Datum *xormask)
+{
+	SortSupport sortKey = state->sortKeys;
+
+	if (sortKey == NULL)
+		return false;
+
+	if (state->comparetup != comparetup_heap &&
+		state->comparetup != comparetup_index_btree &&
+		state->comparetup != comparetup_datum)
+		return false;
+
+	if (sortKey->comparator == ssup_datum_unsigned_cmp)
+	{
+		*nbytes = SIZEOF_DATUM;
+		*xormask = 0;
+	}
+#if SIZEOF_DATUM >= 8
+	else if (sortKey->comparator == ssup_datum_signed_cmp)
+	{
+		/* flipping the sign bit makes two's complement order as unsigned */
+		*nbytes = 8;
+		*xormask = (Datum) 1 << 63;
+	}
+#endif
+	else if (sortKey->comparator == ssup_datum_int32_cmp)
+	{
+		*nbytes = 4;
+		*xormask = (Datum) 0x80000000;
+	}
+	else
+		return false;
+
+	if (sortKey->ssup_reverse)
+	{
+		if (*nbytes == 4)
+			*xormask ^= (Datum) 0xFFFFFFFF;
+		else
+			*xormask ^= ~(Datum) 0;
+	}
+
+	return true;
+}
+
+/*
+ * Radix sort memtuples.  NULLs in the leading key are set apart first, since
+ * datum1 is meaningless for them.
+ */
+static void
+tuplesort_radix_sort(Tuplesortstate *state, int nbytes, Datum xormask)
+{
+	SortTuple  *memtuples = state->memtuples;
+	int			memtupcount = state->memtupcount;
+	SortTuple  *nulls;
+	SortTuple  *notnulls;
+	int			nnulls = 0;
+	int			i;
+
+	if (state->sortKeys->ssup_nulls_first)
+	{
+		for (i = 0; i < memtupcount; i++)
+		{
+			if (memtuples[i].isnull1)
+			{
+				SortTuple	tmp = memtuples[i];
+
+				memtuples[i] = memtuples[nnulls];
+				memtuples[nnulls++] = tmp;
+			}
+		}
+		nulls = memtuples;
+		notnulls = memtuples + nnulls;
+	}
+	else
+	{
+		for (i = memtupcount - 1; i >= 0; i--)
+		{
+			if (memtuples[i].isnull1)
+			{
+				SortTuple	tmp = memtuples[i];
+
+				nnulls++;
+				memtuples[i] = memtuples[memtupcount - nnulls];
+				memtuples[memtupcount - nnulls] = tmp;
+			}
+		}
+		nulls = memtuples + memtupcount - nnulls;
+		notnulls = memtuples;
+	}
+
+	if (nnulls > 1)
+		radix_sort_finish(state, nulls, nnulls, true);
+
+	radix_sort_tuple(state, notnulls, memtupcount - nnulls, nbytes - 1,
+					 nbytes, xormask);
+}
+
+/*
+ * Sort the n tuples at begin, which all have the same bytes above byte in
+ * their radix keys.  This is an in-place MSD radix sort ("American flag
+ * sort"), recursing for the next byte into each bucket.
+ */
+static void
+radix_sort_tuple(Tuplesortstate *state, SortTuple *begin, int n, int byte,
+				 int nbytes, Datum xormask)
+{
+	int			counts[256];
+	int			offsets[256];
+	int			ends[256];
+	int			pos;
+	int			b;
+	int			i;
+
+	if (n < RADIXSORT_THRESHOLD)
+	{
+		radix_sort_finish(state, begin, n, false);
+		return;
+	}
+
+	CHECK_FOR_INTERRUPTS();
+
+	memset(counts, 0, sizeof(counts));
+	for (i = 0; i < n; i++)
+		counts[RADIX_BYTE(RADIX_KEY(begin[i].datum1, nbytes, xormask), byte)]++;
+
+	pos = 0;
+	for (b = 0; b < 256; b++)
+	{
+		offsets[b] = pos;
+		pos += counts[b];
+		ends[b] = pos;
+	}
+
+	/*
+	 * Swap each tuple that's not yet in its bucket to the next free position
+	 * of the bucket it belongs in.
+	 */
+	for (b = 0; b < 256; b++)
+	{
+		while (offsets[b] < ends[b])
+		{
+			SortTuple  *cur = &begin[offsets[b]];
+			int			target;
+
+			target = RADIX_BYTE(RADIX_KEY(cur->datum1, nbytes, xormask), byte);
+			if (target == b)
+				offsets[b]++;
+			else
+			{
+				SortTuple	tmp = *cur;
+
+				*cur = begin[offsets[target]];
+				begin[offsets[target]++] = tmp;
+			}
+		}
+	}
+
+	pos = 0;
+	for (b = 0; b < 256; b++)
+	{
+		if (counts[b] > 1)
+		{
+			if (byte == 0)
+				radix_sort_finish(state, begin + pos, counts[b], true);
+			else
+				radix_sort_tuple(state, begin + pos, counts[b], byte - 1,
+								 nbytes, xormask);
+		}
+		pos += counts[b];
+	}
+}
+
+/*
+ * Sort a range of tuples the radix sort left to comparisons.  If equal, the
+ * tuples are known to have equal leading keys, so they only need sorting if
+ * there are other keys to consider.
+ */
+static void
+radix_sort_finish(Tuplesortstate *state, SortTuple *begin, int n, bool equal)
+{
+	if (n < 2)
+		return;
+
+	if (state->onlyKey != NULL)
+	{
+		if (!equal)
+			qsort_ssup(begin, n, state->onlyKey);
+	}
+	else
+		qsort_tuple(begin, n, state->comparetup, state);
+}
+
 /*
  * Insert a new tuple into an empty or existing heap, maintaining the
  * heap invariant.  Caller is responsible for ensuring there's room.
@@ -4109,6 +4502,15 @@ comparetup_index_hash(const SortTuple *a, const SortTuple *b,
 	else if (bucket1 < bucket2)
 		return -1;
 
+	/*
+	 * Within a bucket, sort on the hash value, which is the order tuples are
+	 * kept in on a hash page; that lets a bulk build append them to pages.
+	 */
+	if (DatumGetUInt32(a->datum1) > DatumGetUInt32(b->datum1))
+		return 1;
+	else if (DatumGetUInt32(a->datum1) < DatumGetUInt32(b->datum1))
+		return -1;
+
 	/*
 	 * If hash values are equal, we sort on ItemPointer.  This does not affect
 	 * validity of the finished index, but it may be useful to have index
@@ -0,0 +1,914 @@
+/*-------------------------------------------------------------------------
+ *
+ * pg_combinebackup.c
+ *	  Reconstruct a full backup from a full backup and a chain of
+ *	  incremental backups taken after it
+ *
+ * The backups are given oldest first.  The newest one determines which
+ * files the result holds: files it has in full are copied from it, and the
+ * relation files it sent incrementally are rebuilt block by block from it
+ * and the older backups, as explained in basebackup_incremental.h.
+ *
+ * Copyright (c) 2010-2019, PostgreSQL Global Development Group
+ *
+ * IDENTIFICATION
+ *	  src/bin/pg_combinebackup/pg_combinebackup.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres_fe.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "common/controldata_utils.h"
+#include "common/file_perm.h"
+#include "common/file_utils.h"
+#include "common/logging.h"
+#include "getopt_long.h"
+#include "replication/basebackup_incremental.h"
+#include "storage/block.h"
+
+
+/* One of the backups being combined */
+typedef struct BackupInfo
+{
+	char	   *path;
+	XLogRecPtr	start_lsn;
+	XLogRecPtr	incremental_from;	/* InvalidXLogRecPtr for a full backup */
+	uint64		system_identifier;
+} BackupInfo;
+
+/* A copy of a relation file in one of the backups */
+typedef struct SourceFile
+{
+	char		path[MAXPGPATH];
+	int			fd;
+	bool		incremental;
+	IncrementalFileHeader hdr;	/* if incremental */
+	BlockNumber *blocks;		/* if incremental */
+	off_t		data_offset;	/* if incremental, where the blocks start */
+	BlockNumber file_blocks;	/* if full */
+} SourceFile;
+
+typedef struct TablespaceMapping
+{
+	char		old_dir[MAXPGPATH];
+	char		new_dir[MAXPGPATH];
+	struct TablespaceMapping *next;
+} TablespaceMapping;
+
+static const char *progname;
+static char *output_dir = NULL;
+static bool do_sync = true;
+static TablespaceMapping *tablespace_mappings = NULL;
+
+static BackupInfo *backups;
+static int	nbackups;
+
+/* Number of files rebuilt from incremental files, for the final report */
+static int64 files_reconstructed = 0;
+
+static void usage(void);
+static void read_backup_label(BackupInfo *backup);
+static void combine_directory(char **srcdirs, const char *outdir,
+							  bool toplevel, bool is_tblspc_dir);
+static void combine_tablespace(char **srcdirs, const char *outdir,
+							   const char *name);
+static void reconstruct_file(char **srcdirs, const char *outdir,
+							 const char *name);
+static void open_source_file(SourceFile *sf, const char *path,
+							 bool incremental);
+static void read_source_block(SourceFile *sf, off_t offset, char *buf);
+static void copy_file(const char *src, const char *dst);
+static void write_backup_label(const char *src, const char *dst);
+static void add_tablespace_mapping(const char *arg);
+static const char *get_tablespace_mapping(const char *dir);
+static char *read_symlink(const char *path);
+static int	blocknumber_cmp(const void *a, const void *b);
+
+
+static void
+usage(void)
+{
+	printf(_("%s reconstructs a full backup from incremental backups.\n\n"), progname);
+	printf(_("Usage:\n"));
+	printf(_("  %s [OPTION]... DIRECTORY...\n"), progname);
+	printf(_("\nOptions:\n"));
+	printf(_("  -N, --no-sync          do not wait for changes to be written safely to disk\n"));
+	printf(_("  -o, --output=DIRECTORY output directory\n"));
+	printf(_("  -T, --tablespace-mapping=OLDDIR=NEWDIR\n"
+			 "                         relocate tablespace in OLDDIR to NEWDIR\n"));
+	printf(_("  -V, --version          output version information, then exit\n"));
+	printf(_("  -?, --help             show this help, then exit\n"));
+	printf(_("\nList the backups oldest first, starting with a full backup and ending\n"
+			 "with the incremental backup to reconstruct.\n\n"));
+	printf(_("Report bugs to <pgsql-bugs@lists.postgresql.org>.\n"));
+}
+
+int
+main(int argc, char *argv[])
+{
+	static struct option long_options[] = {
+		{"no-sync", no_argument, NULL, 'N'},
+		{"output", required_argument, NULL, 'o'},
+		{"tablespace-mapping", required_argument, NULL, 'T'},
+		{NULL, 0, NULL, 0}
+	};
+
+	char	  **srcdirs;
+	int			c;
+	int			option_index;
+	int			i;
+
+	pg_logging_init(argv[0]);
+	set_pglocale_pgservice(argv[0], PG_TEXTDOMAIN("pg_combinebackup"));
+	progname = get_progname(argv[0]);
+
+	if (argc > 1)
+	{
+		if (strcmp(argv[1], "--help") == 0 || strcmp(argv[1], "-?") == 0)
+		{
+			usage();
+			exit(0);
+		}
+		if (strcmp(argv[1], "--version") == 0 || strcmp(argv[1], "-V") == 0)
+		{
+			puts("pg_combinebackup (PostgreSQL) " PG_VERSION);
+			exit(0);
+		}
+	}
+
+	while ((c = getopt_long(argc, argv, "No:T:", long_options,
+							&option_index)) != -1)
+	{
+		switch (c)
+		{
+			case 'N':
+				do_sync = false;
+				break;
+			case 'o':
+				output_dir = pg_strdup(optarg);
+				break;
+			case 'T':
+				add_tablespace_mapping(optarg);
+				break;
+			default:
+				fprintf(stderr, _("Try \"%s --help\" for more information.\n"), progname);
+				exit(1);
+		}
+	}
+
+	if (output_dir == NULL)
+	{
+		pg_log_error("no output directory specified");
+		fprintf(stderr, _("Try \"%s --help\" for more information.\n"), progname);
+		exit(1);
+	}
+
+	nbackups = argc - optind;
+	if (nbackups < 1)
+	{
+		pg_log_error("no input directories specified");
+		fprintf(stderr, _("Try \"%s --help\" for more information.\n"), progname);
+		exit(1);
+	}
+
+	/* Check that the backups form a chain, oldest first */
+	backups = pg_malloc0(sizeof(BackupInfo) * nbackups);
+	for (i = 0; i < nbackups; i++)
+	{
+		ControlFileData *control;
+		bool		crc_ok;
+
+		backups[i].path = pg_strdup(argv[optind + i]);
+		canonicalize_path(backups[i].path);
+		read_backup_label(&backups[i]);
+
+		control = get_controlfile(backups[i].path, &crc_ok);
+		if (!crc_ok)
+		{
+			pg_log_error("pg_control CRC value is incorrect in backup \"%s\"",
+						 backups[i].path);
+			exit(1);
+		}
+		backups[i].system_identifier = control->system_identifier;
+		pg_free(control);
+
+		if (i == 0)
+		{
+			if (!XLogRecPtrIsInvalid(backups[i].incremental_from))
+			{
+				pg_log_error("backup \"%s\" is an incremental backup, but the first backup must be a full backup",
+							 backups[i].path);
+				exit(1);
+			}
+			continue;
+		}
+
+		if (backups[i].system_identifier != backups[0].system_identifier)
+		{
+			pg_log_error("backup \"%s\" is from a different system than backup \"%s\"",
+						 backups[i].path, backups[0].path);
+			exit(1);
+		}
+		if (XLogRecPtrIsInvalid(backups[i].incremental_from))
+		{
+			pg_log_error("backup \"%s\" is a full backup, but only the first backup may be a full backup",
+						 backups[i].path);
+			exit(1);
+		}
+		if (backups[i].incremental_from != backups[i - 1].start_lsn)
+		{
+			pg_log_error("backup \"%s\" is incremental from %X/%X, but the preceding backup \"%s\" starts at %X/%X",
+						 backups[i].path,
+						 (uint32) (backups[i].incremental_from >> 32),
+						 (uint32) backups[i].incremental_from,
+						 backups[i - 1].path,
+						 (uint32) (backups[i - 1].start_lsn >> 32),
+						 (uint32) backups[i - 1].start_lsn);
+			exit(1);
+		}
+	}
+
+	/* Create the output directory with the permissions of the newest backup */
+	if (!GetDataDirectoryCreatePerm(backups[nbackups - 1].path))
+	{
+		pg_log_error("could not read permissions of directory \"%s\": %m",
+					 backups[nbackups - 1].path);
+		exit(1);
+	}
+	umask(pg_mode_mask);
+
+	canonicalize_path(output_dir);
+	switch (pg_check_dir(output_dir))
+	{
+		case 0:
+			if (pg_mkdir_p(output_dir, pg_dir_create_mode) == -1)
+			{
+				pg_log_error("could not create directory \"%s\": %m",
+							 output_dir);
+				exit(1);
+			}
+			break;
+		case 1:
+			/* Exists, empty */
+			break;
+		case 2:
+		case 3:
+		case 4:
+			pg_log_error("directory \"%s\" exists but is not empty",
+						 output_dir);
+			exit(1);
+		case -1:
+			pg_log_error("could not access directory \"%s\": %m", output_dir);
+			exit(1);
+	}
+
+	srcdirs = pg_malloc(sizeof(char *) * nbackups);
+	for (i = 0; i < nbackups; i++)
+		srcdirs[i] = backups[i].path;
+	combine_directory(srcdirs, output_dir, true, false);
+
+	if (do_sync)
+		fsync_pgdata(output_dir, PG_VERSION_NUM);
+
+	pg_log_info("reconstructed " INT64_FORMAT " files from incremental backups",
+				files_reconstructed);
+
+	return 0;
+}
+
+/*
+ * Read the start location, and the reference backup's start location if
+ * it's incremental, from a backup's backup_label.
+ */
+static void
+read_backup_label(BackupInfo *backup)
+{
+	char		path[MAXPGPATH];
+	char		line[MAXPGPATH];
+	bool		found_start = false;
+	FILE	   *fp;
+	uint32		hi,
+				lo;
+
+	snprintf(path, sizeof(path), "%s/backup_label", backup->path);
+	fp = fopen(path, "r");
+	if (fp == NULL)
+	{
+		pg_log_error("could not open file \"%s\": %m", path);
+		exit(1);
+	}
+
+	backup->incremental_from = InvalidXLogRecPtr;
+	while (fgets(line, sizeof(line), fp) != NULL)
+	{
+		if (sscanf(line, "START WAL LOCATION: %X/%X", &hi, &lo) == 2)
+		{
+			backup->start_lsn = ((uint64) hi) << 32 | lo;
+			found_start = true;
+		}
+		else if (sscanf(line, INCREMENTAL_LABEL_LINE ": %X/%X", &hi, &lo) == 2)
+			backup->incremental_from = ((uint64) hi) << 32 | lo;
+	}
+	fclose(fp);
+
+	if (!found_start)
+	{
+		pg_log_error("could not find start WAL location in file \"%s\"", path);
+		exit(1);
+	}
+}
+
+/*
+ * Combine one directory.  srcdirs holds the directory's path in each
+ * backup, oldest first, or NULL where a backup doesn't have it; the newest
+ * backup always has it.
+ */
+static void
+combine_directory(char **srcdirs, const char *outdir, bool toplevel,
+				  bool is_tblspc_dir)
+{
+	const char *newest = srcdirs[nbackups - 1];
+	char	  **subdirs;
+	DIR		   *dir;
+	struct dirent *de;
+
+	subdirs = pg_malloc(sizeof(char *) * nbackups);
+
+	dir = opendir(newest);
+	if (dir == NULL)
+	{
+		pg_log_error("could not open directory \"%s\": %m", newest);
+		exit(1);
+	}
+
+	while (errno = 0, (de = readdir(dir)) != NULL)
+	{
+		char		srcpath[MAXPGPATH];
+		char		dstpath[MAXPGPATH];
+		struct stat st;
+		int			i;
+
+		if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+			continue;
+
+		snprintf(srcpath, sizeof(srcpath), "%s/%s", newest, de->d_name);
+		if (lstat(srcpath, &st) != 0)
+		{
+			pg_log_error("could not stat file \"%s\": %m", srcpath);
+			exit(1);
+		}
+
+		for (i = 0; i < nbackups; i++)
+		{
+			if (srcdirs[i] == NULL)
+				subdirs[i] = NULL;
+			else
+				subdirs[i] = psprintf("%s/%s", srcdirs[i], de->d_name);
+		}
+
+#ifndef WIN32
+		if (is_tblspc_dir && S_ISLNK(st.st_mode))
+#else
+		if (is_tblspc_dir && pgwin32_is_junction(srcpath))
+#endif
+		{
+			combine_tablespace(subdirs, outdir, de->d_name);
+			goto next;
+		}
+
+		/* Follow other symbolic links, such as a pg_wal made by --waldir */
+		if (stat(srcpath, &st) != 0)
+		{
+			pg_log_error("could not stat file \"%s\": %m", srcpath);
+			exit(1);
+		}
+
+		if (S_ISDIR(st.st_mode))
+		{
+			/* Older backups that lack the directory can't contribute */
+			for (i = 0; i < nbackups - 1; i++)
+			{
+				struct stat sst;
+
+				if (subdirs[i] != NULL &&
+					(stat(subdirs[i], &sst) != 0 || !S_ISDIR(sst.st_mode)))
+				{
+					pfree(subdirs[i]);
+					subdirs[i] = NULL;
+				}
+			}
+
+			snprintf(dstpath, sizeof(dstpath), "%s/%s", outdir, de->d_name);
+			if (mkdir(dstpath, pg_dir_create_mode) != 0)
+			{
+				pg_log_error("could not create directory \"%s\": %m", dstpath);
+				exit(1);
+			}
+			combine_directory(subdirs, dstpath, false,
+							  toplevel && strcmp(de->d_name, "pg_tblspc") == 0);
+		}
+		else if (S_ISREG(st.st_mode))
+		{
+			if (strncmp(de->d_name, INCREMENTAL_PREFIX,
+						INCREMENTAL_PREFIX_LENGTH) == 0)
+			{
+				char	  **parents = pg_malloc(sizeof(char *) * nbackups);
+
+				for (i = 0; i < nbackups; i++)
+					parents[i] = srcdirs[i];
+				reconstruct_file(parents, outdir,
+								 de->d_name + INCREMENTAL_PREFIX_LENGTH);
+				pfree(parents);
+			}
+			else
+			{
+				snprintf(dstpath, sizeof(dstpath), "%s/%s", outdir, de->d_name);
+				if (toplevel && strcmp(de->d_name, "backup_label") == 0)
+					write_backup_label(srcpath, dstpath);
+				else
+					copy_file(srcpath, dstpath);
+			}
+		}
+		else
+			pg_log_warning("skipping special file \"%s\"", srcpath);
+
+next:
+		for (i = 0; i < nbackups; i++)
+		{
+			if (subdirs[i] != NULL)
+				pfree(subdirs[i]);
+		}
+	}
+
+	if (errno)
+	{
+		pg_log_error("could not read directory \"%s\": %m", newest);
+		exit(1);
+	}
+
+	if (closedir(dir))
+	{
+		pg_log_error("could not close directory \"%s\": %m", newest);
+		exit(1);
+	}
+
+	pfree(subdirs);
+}
+
+/*
+ * Combine a user-defined tablespace.  links holds the path of its symbolic
+ * link in pg_tblspc in each backup.  The newest backup's target must have
+ * been given a new location with --tablespace-mapping.
+ */
+static void
+combine_tablespace(char **links, const char *outdir, const char *name)
+{
+	char	  **srcdirs = pg_malloc(sizeof(char *) * nbackups);
+	char		linkpath[MAXPGPATH];
+	const char *new_dir;
+	int			i;
+
+	for (i = 0; i < nbackups; i++)
+	{
+		struct stat st;
+
+		srcdirs[i] = NULL;
+		if (links[i] != NULL && lstat(links[i], &st) == 0)
+			srcdirs[i] = read_symlink(links[i]);
+	}
+
+	new_dir = get_tablespace_mapping(srcdirs[nbackups - 1]);
+	if (new_dir == NULL)
+	{
+		pg_log_error("tablespace at \"%s\" must be relocated with --tablespace-mapping",
+					 srcdirs[nbackups - 1]);
+		exit(1);
+	}
+
+	switch (pg_check_dir(new_dir))
+	{
+		case 0:
+			if (pg_mkdir_p(unconstify(char *, new_dir), pg_dir_create_mode) == -1)
+			{
+				pg_log_error("could not create directory \"%s\": %m", new_dir);
+				exit(1);
+			}
+			break;
+		case 1:
+			break;
+		case -1:
+			pg_log_error("could not access directory \"%s\": %m", new_dir);
+			exit(1);
+		default:
+			pg_log_error("directory \"%s\" exists but is not empty", new_dir);
+			exit(1);
+	}
+
+	snprintf(linkpath, sizeof(linkpath), "%s/%s", outdir, name);
+	if (symlink(new_dir, linkpath) != 0)
+	{
+		pg_log_error("could not create symbolic link \"%s\": %m", linkpath);
+		exit(1);
+	}
+
+	combine_directory(srcdirs, new_dir, false, false);
+
+	for (i = 0; i < nbackups; i++)
+	{
+		if (srcdirs[i] != NULL)
+			pfree(srcdirs[i]);
+	}
+	pfree(srcdirs);
+}
+
+/*
+ * Rebuild the relation file 'name' of the directory whose path in each
+ * backup is in srcdirs.  The newest backup has it as an incremental file.
+ */
+static void
+reconstruct_file(char **srcdirs, const char *outdir, const char *name)
+{
+	SourceFile *sources;
+	int			nsources = 0;
+	char		dstpath[MAXPGPATH];
+	char		buf[BLCKSZ];
+	BlockNumber file_blocks;
+	BlockNumber blkno;
+	int			dstfd;
+	int			i;
+
+	/*
+	 * Collect the copies of the file, newest first, down to the first full
+	 * copy or the first backup that doesn't have the file at all, since
+	 * nothing older can matter then.
+	 */
+	sources = pg_malloc0(sizeof(SourceFile) * nbackups);
+	for (i = nbackups - 1; i >= 0; i--)
+	{
+		char		path[MAXPGPATH];
+		struct stat st;
+
+		if (srcdirs[i] == NULL)
+			break;
+
+		snprintf(path, sizeof(path), "%s/%s%s", srcdirs[i],
+				 INCREMENTAL_PREFIX, name);
+		if (stat(path, &st) == 0)
+		{
+			open_source_file(&sources[nsources++], path, true);
+			continue;
+		}
+
+		snprintf(path, sizeof(path), "%s/%s", srcdirs[i], name);
+		if (stat(path, &st) == 0)
+			open_source_file(&sources[nsources++], path, false);
+		break;
+	}
+	Assert(nsources > 0 && sources[0].incremental);
+
+	snprintf(dstpath, sizeof(dstpath), "%s/%s", outdir, name);
+	dstfd = open(dstpath, O_WRONLY | O_CREAT | O_EXCL | PG_BINARY,
+				 pg_file_create_mode);
+	if (dstfd < 0)
+	{
+		pg_log_error("could not create file \"%s\": %m", dstpath);
+		exit(1);
+	}
+
+	file_blocks = sources[0].hdr.file_blocks;
+	for (blkno = 0; blkno < file_blocks; blkno++)
+	{
+		bool		found = false;
+
+		for (i = 0; i < nsources && !found; i++)
+		{
+			SourceFile *sf = &sources[i];
+
+			if (sf->incremental)
+			{
+				BlockNumber *p;
+
+				p = bsearch(&blkno, sf->blocks, sf->hdr.nblocks,
+							sizeof(BlockNumber), blocknumber_cmp);
+				if (p != NULL)
+				{
+					read_source_block(sf, sf->data_offset +
+									  (off_t) (p - sf->blocks) * BLCKSZ, buf);
+					found = true;
+				}
+				else if (blkno >= sf->hdr.limit_block)
+					break;		/* older copies are stale */
+			}
+			else
+			{
+				if (blkno < sf->file_blocks)
+				{
+					read_source_block(sf, (off_t) blkno * BLCKSZ, buf);
+					found = true;
+				}
+				break;
+			}
+		}
+
+		if (!found)
+			memset(buf, 0, BLCKSZ);
+
+		errno = 0;
+		if (write(dstfd, buf, BLCKSZ) != BLCKSZ)
+		{
+			/* if write didn't set errno, assume problem is no disk space */
+			if (errno == 0)
+				errno = ENOSPC;
+			pg_log_error("could not write file \"%s\": %m", dstpath);
+			exit(1);
+		}
+	}
+
+	if (close(dstfd) != 0)
+	{
+		pg_log_error("could not close file \"%s\": %m", dstpath);
+		exit(1);
+	}
+
+	for (i = 0; i < nsources; i++)
+	{
+		close(sources[i].fd);
+		if (sources[i].blocks != NULL)
+			pfree(sources[i].blocks);
+	}
+	pfree(sources);
+
+	files_reconstructed++;
+}
+
+/*
+ * Open a copy of a relation file, reading the header and block list if it's
+ * an incremental file.
+ */
+static void
+open_source_file(SourceFile *sf, const char *path, bool incremental)
+{
+	struct stat st;
+
+	strlcpy(sf->path, path, sizeof(sf->path));
+	sf->incremental = incremental;
+	sf->blocks = NULL;
+
+	sf->fd = open(path, O_RDONLY | PG_BINARY, 0);
+	if (sf->fd < 0)
+	{
+		pg_log_error("could not open file \"%s\": %m", path);
+		exit(1);
+	}
+	if (fstat(sf->fd, &st) != 0)
+	{
+		pg_log_error("could not stat file \"%s\": %m", path);
+		exit(1);
+	}
+
+	if (!incremental)
+	{
+		sf->file_blocks = st.st_size / BLCKSZ;
+		return;
+	}
+
+	if (read(sf->fd, &sf->hdr, sizeof(sf->hdr)) != sizeof(sf->hdr) ||
+		sf->hdr.magic != INCREMENTAL_MAGIC ||
+		sf->hdr.limit_block > sf->hdr.file_blocks ||
+		st.st_size != sizeof(sf->hdr) +
+		(off_t) sf->hdr.nblocks * (sizeof(BlockNumber) + BLCKSZ))
+	{
+		pg_log_error("file \"%s\" is not a valid incremental file", path);
+		exit(1);
+	}
+
+	sf->blocks = pg_malloc(sizeof(BlockNumber) * Max(sf->hdr.nblocks, 1));
+	if (sf->hdr.nblocks > 0 &&
+		read(sf->fd, sf->blocks, sizeof(BlockNumber) * sf->hdr.nblocks) !=
+		sizeof(BlockNumber) * sf->hdr.nblocks)
+	{
+		pg_log_error("could not read file \"%s\": %m", path);
+		exit(1);
+	}
+	sf->data_offset = sizeof(sf->hdr) + sizeof(BlockNumber) * sf->hdr.nblocks;
+}
+
+static void
+read_source_block(SourceFile *sf, off_t offset, char *buf)
+{
+	int			rc;
+
+	if (lseek(sf->fd, offset, SEEK_SET) < 0)
+	{
+		pg_log_error("could not seek in file \"%s\": %m", sf->path);
+		exit(1);
+	}
+
+	rc = read(sf->fd, buf, BLCKSZ);
+	if (rc < 0)
+	{
+		pg_log_error("could not read file \"%s\": %m", sf->path);
+		exit(1);
+	}
+	if (rc != BLCKSZ)
+	{
+		pg_log_error("could not read file \"%s\": read %d of %d",
+					 sf->path, rc, BLCKSZ);
+		exit(1);
+	}
+}
+
+static void
+copy_file(const char *src, const char *dst)
+{
+	char		buf[65536];
+	int			srcfd;
+	int			dstfd;
+	int			rc;
+
+	srcfd = open(src, O_RDONLY | PG_BINARY, 0);
+	if (srcfd < 0)
+	{
+		pg_log_error("could not open file \"%s\": %m", src);
+		exit(1);
+	}
+
+	dstfd = open(dst, O_WRONLY | O_CREAT | O_EXCL | PG_BINARY,
+				 pg_file_create_mode);
+	if (dstfd < 0)
+	{
+		pg_log_error("could not create file \"%s\": %m", dst);
+		exit(1);
+	}
+
+	while ((rc = read(srcfd, buf, sizeof(buf))) > 0)
+	{
+		errno = 0;
+		if (write(dstfd, buf, rc) != rc)
+		{
+			/* if write didn't set errno, assume problem is no disk space */
+			if (errno == 0)
+				errno = ENOSPC;
+			pg_log_error("could not write file \"%s\": %m", dst);
+			exit(1);
+		}
+	}
+	if (rc < 0)
+	{
+		pg_log_error("could not read file \"%s\": %m", src);
+		exit(1);
+	}
+
+	close(srcfd);
+	if (close(dstfd) != 0)
+	{
+		pg_log_error("could not close file \"%s\": %m", dst);
+		exit(1);
+	}
+}
+
+/*
+ * Copy the newest backup's backup_label, without the line that marks it as
+ * incremental, so that the server will start from the result.
+ */
+static void
+write_backup_label(const char *src, const char *dst)
+{
+	char		line[MAXPGPATH];
+	FILE	   *in;
+	FILE	   *out;
+
+	in = fopen(src, "r");
+	if (in == NULL)
+	{
+		pg_log_error("could not open file \"%s\": %m", src);
+		exit(1);
+	}
+	out = fopen(dst, "w");
+	if (out == NULL)
+	{
+		pg_log_error("could not create file \"%s\": %m", dst);
+		exit(1);
+	}
+
+	while (fgets(line, sizeof(line), in) != NULL)
+	{
+		if (strncmp(line, INCREMENTAL_LABEL_LINE ":",
+					strlen(INCREMENTAL_LABEL_LINE ":")) == 0)
+			continue;
+		if (fputs(line, out) == EOF)
+		{
+			pg_log_error("could not write file \"%s\": %m", dst);
+			exit(1);
+		}
+	}
+
+	fclose(in);
+	if (fclose(out) != 0)
+	{
+		pg_log_error("could not write file \"%s\": %m", dst);
+		exit(1);
+	}
+}
+
+/*
+ * Parse an OLDDIR=NEWDIR tablespace mapping.
+ */
+static void
+add_tablespace_mapping(const char *arg)
+{
+	TablespaceMapping *cell = pg_malloc0(sizeof(TablespaceMapping));
+	const char *eq = strchr(arg, '=');
+
+	if (eq == NULL || eq == arg || eq[1] == '\0' ||
+		strchr(eq + 1, '=') != NULL)
+	{
+		pg_log_error("invalid tablespace mapping format \"%s\", must be \"OLDDIR=NEWDIR\"",
+					 arg);
+		exit(1);
+	}
+
+	if (eq - arg >= MAXPGPATH || strlen(eq + 1) >= MAXPGPATH)
+	{
+		pg_log_error("directory name too long");
+		exit(1);
+	}
+	memcpy(cell->old_dir, arg, eq - arg);
+	cell->old_dir[eq - arg] = '\0';
+	strlcpy(cell->new_dir, eq + 1, MAXPGPATH);
+
+	if (!is_absolute_path(cell->old_dir) || !is_absolute_path(cell->new_dir))
+	{
+		pg_log_error("directories in tablespace mapping must be absolute paths");
+		exit(1);
+	}
+	canonicalize_path(cell->old_dir);
+	canonicalize_path(cell->new_dir);
+
+	cell->next = tablespace_mappings;
+	tablespace_mappings = cell;
+}
+
+static const char *
+get_tablespace_mapping(const char *dir)
+{
+	TablespaceMapping *cell;
+	char		canon_dir[MAXPGPATH];
+
+	strlcpy(canon_dir, dir, MAXPGPATH);
+	canonicalize_path(canon_dir);
+
+	for (cell = tablespace_mappings; cell; cell = cell->next)
+	{
+		if (strcmp(canon_dir, cell->old_dir) == 0)
+			return cell->new_dir;
+	}
+
+	return NULL;
+}
+
+static char *
+read_symlink(const char *path)
+{
+#if defined(HAVE_READLINK) || defined(WIN32)
+	char		target[MAXPGPATH];
+	int			rllen;
+
+	rllen = readlink(path, target, sizeof(target));
+	if (rllen < 0)
+	{
+		pg_log_error("could not read symbolic link \"%s\": %m", path);
+		exit(1);
+	}
+	if (rllen >= sizeof(target))
+	{
+		pg_log_error("symbolic link \"%s\" target is too long", path);
+		exit(1);
+	}
+	target[rllen] = '\0';
+
+	return pg_strdup(target);
+#else
+	pg_log_error("symbolic links are not supported on this platform");
+	exit(1);
+#endif
+}
+
+static int
+blocknumber_cmp(const void *a, const void *b)
+{
+	BlockNumber ba = *(const BlockNumber *) a;
+	BlockNumber bb = *(const BlockNumber *) b;
+
+	if (ba < bb)
+		return -1;
+	if (ba > bb)
+		return 1;
+	return 0;
+}
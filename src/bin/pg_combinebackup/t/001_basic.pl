@@ -0,0 +1,68 @@
+use strict;
+use warnings;
+use File::Find;
+use PostgresNode;
+use TestLib;
+use Test::More tests => 16;
+
+program_help_ok('pg_combinebackup');
+program_version_ok('pg_combinebackup');
+program_options_handling_ok('pg_combinebackup');
+
+my $node = get_new_node('main');
+$node->init(allows_streaming => 1);
+$node->append_conf('postgresql.conf', 'summarize_wal = on');
+$node->start;
+
+$node->safe_psql('postgres',
+	    "CREATE TABLE changed AS SELECT g AS a FROM generate_series(1, 10000) g;"
+	  . "CREATE TABLE unchanged AS SELECT g AS a FROM generate_series(1, 10000) g;"
+	  . "CREATE TABLE truncated AS SELECT g AS a FROM generate_series(1, 10000) g;"
+	  . "CHECKPOINT;");
+
+my $full = $node->backup_dir . '/full';
+$node->command_ok(
+	[ 'pg_basebackup', '-D', $full, '-c', 'fast', '--no-sync' ],
+	'full backup');
+
+$node->safe_psql('postgres',
+	    "UPDATE changed SET a = -a WHERE a % 1000 = 0;"
+	  . "TRUNCATE truncated;"
+	  . "INSERT INTO truncated SELECT g FROM generate_series(1, 100) g;"
+	  . "CREATE TABLE created AS SELECT g AS a FROM generate_series(1, 100) g;");
+
+my $incr = $node->backup_dir . '/incr';
+$node->command_ok(
+	[
+		'pg_basebackup', '-D', $incr, '-c', 'fast', '--no-sync',
+		'--incremental', $full
+	],
+	'incremental backup');
+
+my $found_incremental = 0;
+find(sub { $found_incremental = 1 if /^INCREMENTAL\./ }, $incr);
+ok($found_incremental, 'incremental backup contains incremental files');
+
+my $combined = $node->backup_dir . '/combined';
+command_ok([ 'pg_combinebackup', '-o', $combined, $full, $incr ],
+	'combine backups');
+
+my $query =
+	"SELECT (SELECT sum(a) FROM changed), (SELECT sum(a) FROM unchanged),"
+  . " (SELECT sum(a) FROM truncated), (SELECT sum(a) FROM created)";
+my $expected = $node->safe_psql('postgres', $query);
+$node->stop;
+
+my $restored = get_new_node('restored');
+$restored->init_from_backup($node, 'combined');
+$restored->start;
+is($restored->safe_psql('postgres', $query),
+	$expected, 'combined backup has the data of the incremental backup');
+is($restored->safe_psql('postgres', 'SELECT count(*) FROM changed'),
+	'10000', 'unchanged blocks come from the full backup');
+$restored->stop;
+
+command_fails_like(
+	[ 'pg_combinebackup', '-o', $node->backup_dir . '/bad', $incr, $full ],
+	qr/the first backup must be a full backup/,
+	'backups in the wrong order are rejected');
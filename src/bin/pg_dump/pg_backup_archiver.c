@@ -1856,8 +1856,11 @@ buildTocEntryArrays(ArchiveHandle *AH)
 		 * tableDataId provides the TABLE DATA item's dump ID for each TABLE
 		 * TOC entry that has a DATA item.  We compute this by reversing the
 		 * TABLE DATA item's dependency, knowing that a TABLE DATA item has
-		 * just one dependency and it is the TABLE item.
+		 * just one dependency and it is the TABLE item.  If pg_dump split the
+		 * table's data into several TABLE DATA items, tableDataId gives the
+		 * first and the rest are chained through nextDataChunk.
 		 */
+		te->nextDataChunk = 0;
 		if (strcmp(te->desc, "TABLE DATA") == 0 && te->nDeps > 0)
 		{
 			DumpId		tableId = te->dependencies[0];
@@ -1870,7 +1873,16 @@ buildTocEntryArrays(ArchiveHandle *AH)
 			if (tableId <= 0 || tableId > maxDumpId)
 				fatal("bad table dumpId for TABLE DATA item");
 
-			AH->tableDataId[tableId] = te->dumpId;
+			if (AH->tableDataId[tableId] != 0)
+			{
+				TocEntry   *chunkte = AH->tocsByDumpId[AH->tableDataId[tableId]];
+
+				while (chunkte->nextDataChunk != 0)
+					chunkte = AH->tocsByDumpId[chunkte->nextDataChunk];
+				chunkte->nextDataChunk = te->dumpId;
+			}
+			else
+				AH->tableDataId[tableId] = te->dumpId;
 		}
 	}
 }
@@ -4654,11 +4666,32 @@ repoint_table_dependencies(ArchiveHandle *AH)
 			{
 				DumpId		tabledataid = AH->tableDataId[olddep];
 				TocEntry   *tabledatate = AH->tocsByDumpId[tabledataid];
+				pgoff_t		tabledatalen = tabledatate->dataLength;
 
 				te->dependencies[i] = tabledataid;
-				te->dataLength = Max(te->dataLength, tabledatate->dataLength);
 				pg_log_debug("transferring dependency %d -> %d to %d",
 							 te->dumpId, olddep, tabledataid);
+
+				/*
+				 * If the table's data is in chunks, the item must wait for
+				 * all of them.
+				 */
+				while (tabledatate->nextDataChunk != 0)
+				{
+					tabledataid = tabledatate->nextDataChunk;
+					tabledatate = AH->tocsByDumpId[tabledataid];
+					tabledatalen += tabledatate->dataLength;
+
+					te->dependencies = (DumpId *)
+						pg_realloc(te->dependencies,
+								   (te->nDeps + 1) * sizeof(DumpId));
+					te->dependencies[te->nDeps++] = tabledataid;
+					te->depCount++;
+					pg_log_debug("adding dependency %d -> %d",
+								 te->dumpId, tabledataid);
+				}
+
+				te->dataLength = Max(te->dataLength, tabledatalen);
 			}
 		}
 	}
@@ -4772,6 +4805,9 @@ reduce_dependencies(ArchiveHandle *AH, TocEntry *te,
 /*
  * Set the created flag on the DATA member corresponding to the given
  * TABLE member
+ *
+ * We don't if the table's data is in chunks: restoring a chunk mustn't
+ * TRUNCATE away the chunks that were loaded before it.
  */
 static void
 mark_create_done(ArchiveHandle *AH, TocEntry *te)
@@ -4780,7 +4816,8 @@ mark_create_done(ArchiveHandle *AH, TocEntry *te)
 	{
 		TocEntry   *ted = AH->tocsByDumpId[AH->tableDataId[te->dumpId]];
 
-		ted->created = true;
+		if (ted->nextDataChunk == 0)
+			ted->created = true;
 	}
 }
 
@@ -4798,7 +4835,13 @@ inhibit_data_for_failed_table(ArchiveHandle *AH, TocEntry *te)
 	{
 		TocEntry   *ted = AH->tocsByDumpId[AH->tableDataId[te->dumpId]];
 
-		ted->reqs = 0;
+		for (;;)
+		{
+			ted->reqs = 0;
+			if (ted->nextDataChunk == 0)
+				break;
+			ted = AH->tocsByDumpId[ted->nextDataChunk];
+		}
 	}
 }
 
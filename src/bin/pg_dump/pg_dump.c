@@ -244,6 +244,7 @@ static void addBoundaryDependencies(DumpableObject **dobjs, int numObjs,
 static void getDomainConstraints(Archive *fout, TypeInfo *tyinfo);
 static void getTableData(DumpOptions *dopt, TableInfo *tblinfo, int numTables, char relkind);
 static void makeTableDataInfo(DumpOptions *dopt, TableInfo *tbinfo);
+static void chunkTableData(Archive *fout, TableInfo *tblinfo, int numTables);
 static void buildMatViewRefreshDependencies(Archive *fout);
 static void getTableDataFKConstraints(void);
 static char *format_function_arguments(FuncInfo *finfo, char *funcargs,
@@ -319,6 +320,7 @@ main(int argc, char **argv)
 	const char *dumpsnapshot = NULL;
 	char	   *use_role = NULL;
 	long		rowsPerInsert;
+	long		chunkSize;
 	int			numWorkers = 1;
 	trivalue	prompt_password = TRI_DEFAULT;
 	int			compressLevel = -1;
@@ -391,6 +393,7 @@ main(int argc, char **argv)
 		{"no-sync", no_argument, NULL, 7},
 		{"on-conflict-do-nothing", no_argument, &dopt.do_nothing, 1},
 		{"rows-per-insert", required_argument, NULL, 10},
+		{"table-chunk-size", required_argument, NULL, 11},
 
 		{NULL, 0, NULL, 0}
 	};
@@ -607,6 +610,21 @@ main(int argc, char **argv)
 				dopt.dump_inserts = (int) rowsPerInsert;
 				break;
 
+			case 11:			/* table chunk size */
+				errno = 0;
+				chunkSize = strtol(optarg, &endptr, 10);
+
+				if (endptr == optarg || *endptr != '\0' ||
+					chunkSize <= 0 || chunkSize > INT_MAX ||
+					errno == ERANGE)
+				{
+					pg_log_error("table-chunk-size must be in range %d..%d",
+								 1, INT_MAX);
+					exit_nicely(1);
+				}
+				dopt.table_chunk_size = (int) chunkSize;
+				break;
+
 			default:
 				fprintf(stderr, _("Try \"%s --help\" for more information.\n"), progname);
 				exit_nicely(1);
@@ -841,6 +859,7 @@ main(int argc, char **argv)
 	if (!dopt.schemaOnly)
 	{
 		getTableData(&dopt, tblinfo, numTables, 0);
+		chunkTableData(fout, tblinfo, numTables);
 		buildMatViewRefreshDependencies(fout);
 		if (dopt.dataOnly)
 			getTableDataFKConstraints();
@@ -1035,6 +1054,8 @@ help(const char *progname)
 	printf(_("  --snapshot=SNAPSHOT          use given snapshot for the dump\n"));
 	printf(_("  --strict-names               require table and/or schema include patterns to\n"
 			 "                               match at least one entity each\n"));
+	printf(_("  --table-chunk-size=MB        dump data of larger tables in chunks of about MB\n"
+			 "                               megabytes, to be dumped and restored in parallel\n"));
 	printf(_("  --use-set-session-authorization\n"
 			 "                               use SET SESSION AUTHORIZATION commands instead of\n"
 			 "                               ALTER OWNER commands to set ownership\n"));
@@ -2260,6 +2281,8 @@ dumpTableData(Archive *fout, TableDataInfo *tdinfo)
 		 * exceeding INT_MAX pages.
 		 */
 		te->dataLength = (BlockNumber) tbinfo->relpages;
+		if (tdinfo->nchunks > 1)
+			te->dataLength /= tdinfo->nchunks;
 	}
 
 	destroyPQExpBuffer(copyBuf);
@@ -2380,11 +2403,172 @@ makeTableDataInfo(DumpOptions *dopt, TableInfo *tbinfo)
 	tdinfo->dobj.namespace = tbinfo->dobj.namespace;
 	tdinfo->tdtable = tbinfo;
 	tdinfo->filtercond = NULL;	/* might get set later */
+	tdinfo->nchunks = 1;
+	tdinfo->nextchunk = NULL;
 	addObjectDependency(&tdinfo->dobj, tbinfo->dobj.dumpId);
 
 	tbinfo->dataObj = tdinfo;
 }
 
+/*
+ * chunkTableData -
+ *	  split the data of large tables into several TABLE DATA items
+ *
+ * With --table-chunk-size, the data of each plain table larger than the
+ * chunk size is divided into ranges of its primary key, each dumped as a
+ * TABLE DATA item of its own, so that a parallel dump or restore can work on
+ * the chunks of one large table concurrently.  The ranges are of equal width
+ * between the smallest and largest key, which assumes the keys are spread
+ * evenly.  Only a single-column integer primary key is used.  Tables whose
+ * data already has a filter condition, and tables with inheritance children
+ * (a filtered COPY would also read the children's rows), are not split.
+ *
+ * This must be called after getTableData, before dependencies on table data
+ * objects are added.
+ */
+static void
+chunkTableData(Archive *fout, TableInfo *tblinfo, int numTables)
+{
+	DumpOptions *dopt = fout->dopt;
+	PQExpBuffer query;
+	PGresult   *res;
+	int64		chunk_pages;
+	int			i;
+
+	if (dopt->table_chunk_size == 0)
+		return;
+
+	res = ExecuteSqlQueryForSingleRow(fout,
+									  "SELECT pg_catalog.current_setting('block_size')");
+	chunk_pages = (int64) dopt->table_chunk_size * 1024 * 1024 /
+		atoi(PQgetvalue(res, 0, 0));
+	PQclear(res);
+	if (chunk_pages < 1)
+		chunk_pages = 1;
+
+	query = createPQExpBuffer();
+
+	for (i = 0; i < numTables; i++)
+	{
+		TableInfo  *tbinfo = &tblinfo[i];
+		TableDataInfo *tdinfo = tbinfo->dataObj;
+		const char *keycol = NULL;
+		int64		nchunks;
+		int			ntups;
+		int			j;
+
+		if (tdinfo == NULL || tdinfo->filtercond != NULL ||
+			tbinfo->relkind != RELKIND_RELATION ||
+			(BlockNumber) tbinfo->relpages <= chunk_pages)
+			continue;
+
+		/* Look for a single-column primary key of an integer type */
+		for (j = 0; j < tbinfo->numIndexes; j++)
+		{
+			IndxInfo   *indxinfo = &tbinfo->indexes[j];
+			ConstraintInfo *constrinfo;
+			int			attnum;
+			const char *typname;
+
+			if (indxinfo->indexconstraint == 0 || indxinfo->indnkeyattrs != 1)
+				continue;
+			constrinfo = (ConstraintInfo *)
+				findObjectByDumpId(indxinfo->indexconstraint);
+			if (constrinfo == NULL || constrinfo->contype != 'p')
+				continue;
+
+			attnum = indxinfo->indkeys[0];
+			if (attnum <= 0 || attnum > tbinfo->numatts)
+				continue;
+			typname = tbinfo->atttypnames[attnum - 1];
+			if (strcmp(typname, "smallint") == 0 ||
+				strcmp(typname, "integer") == 0 ||
+				strcmp(typname, "bigint") == 0)
+				keycol = tbinfo->attnames[attnum - 1];
+			break;
+		}
+		if (keycol == NULL)
+			continue;
+
+		/*
+		 * Fetch the boundaries between the chunks.  This runs in the dump's
+		 * snapshot, so the chunks cover exactly the rows that are dumped.
+		 */
+		nchunks = ((BlockNumber) tbinfo->relpages + chunk_pages - 1) /
+			chunk_pages;
+		resetPQExpBuffer(query);
+		appendPQExpBuffer(query,
+						  "SELECT DISTINCT b FROM "
+						  "(SELECT (s.lo + pg_catalog.floor((s.hi - s.lo) * i / " INT64_FORMAT "))::pg_catalog.int8 AS b, s.lo "
+						  "FROM (SELECT pg_catalog.min(%s)::pg_catalog.numeric AS lo, ",
+						  nchunks, fmtId(keycol));
+		appendPQExpBuffer(query,
+						  "pg_catalog.max(%s)::pg_catalog.numeric AS hi ",
+						  fmtId(keycol));
+		appendPQExpBuffer(query,
+						  "FROM ONLY %s) s, "
+						  "pg_catalog.generate_series(1, " INT64_FORMAT ") i) bounds "
+						  "WHERE b > lo AND NOT EXISTS "
+						  "(SELECT 1 FROM pg_catalog.pg_inherits "
+						  "WHERE inhparent = '%u'::pg_catalog.oid) "
+						  "ORDER BY b",
+						  fmtQualifiedDumpable(tbinfo), nchunks - 1,
+						  tbinfo->dobj.catId.oid);
+		res = ExecuteSqlQuery(fout, query->data, PGRES_TUPLES_OK);
+		ntups = PQntuples(res);
+
+		if (ntups > 0)
+		{
+			TableDataInfo *prev = tdinfo;
+
+			pg_log_info("splitting data of table \"%s.%s\" into %d chunks",
+						tbinfo->dobj.namespace->dobj.name,
+						tbinfo->dobj.name, ntups + 1);
+
+			/* The original object becomes the first chunk */
+			resetPQExpBuffer(query);
+			appendPQExpBuffer(query, "WHERE %s < ", fmtId(keycol));
+			appendPQExpBufferStr(query, PQgetvalue(res, 0, 0));
+			tdinfo->filtercond = pg_strdup(query->data);
+			tdinfo->nchunks = ntups + 1;
+
+			for (j = 0; j < ntups; j++)
+			{
+				TableDataInfo *chunk;
+
+				chunk = (TableDataInfo *) pg_malloc(sizeof(TableDataInfo));
+				chunk->dobj.objType = DO_TABLE_DATA;
+				chunk->dobj.catId = tdinfo->dobj.catId;
+				AssignDumpId(&chunk->dobj);
+				chunk->dobj.name = tdinfo->dobj.name;
+				chunk->dobj.namespace = tdinfo->dobj.namespace;
+				chunk->dobj.dump = tdinfo->dobj.dump;
+				chunk->tdtable = tbinfo;
+				chunk->nchunks = tdinfo->nchunks;
+				addObjectDependency(&chunk->dobj, tbinfo->dobj.dumpId);
+
+				resetPQExpBuffer(query);
+				appendPQExpBuffer(query, "WHERE %s >= ", fmtId(keycol));
+				appendPQExpBufferStr(query, PQgetvalue(res, j, 0));
+				if (j + 1 < ntups)
+				{
+					appendPQExpBuffer(query, " AND %s < ", fmtId(keycol));
+					appendPQExpBufferStr(query, PQgetvalue(res, j + 1, 0));
+				}
+				chunk->filtercond = pg_strdup(query->data);
+				chunk->nextchunk = NULL;
+
+				prev->nextchunk = chunk;
+				prev = chunk;
+			}
+		}
+
+		PQclear(res);
+	}
+
+	destroyPQExpBuffer(query);
+}
+
 /*
  * The refresh for a materialized view must be dependent on the refresh for
  * any materialized view that this one is dependent on.
@@ -2522,6 +2706,8 @@ getTableDataFKConstraints(void)
 		{
 			ConstraintInfo *cinfo = (ConstraintInfo *) dobjs[i];
 			TableInfo  *ftable;
+			TableDataInfo *tdinfo;
+			TableDataInfo *ftdinfo;
 
 			/* Not interesting unless both tables are to be dumped */
 			if (cinfo->contable == NULL ||
@@ -2534,10 +2720,23 @@ getTableDataFKConstraints(void)
 
 			/*
 			 * Okay, make referencing table's TABLE_DATA object depend on the
-			 * referenced table's TABLE_DATA object.
+			 * referenced table's TABLE_DATA object.  Either may be split into
+			 * chunks, in which case each referencing chunk depends on all the
+			 * referenced ones; but a self-reference needs only one loop to
+			 * draw the usual complaint.
 			 */
-			addObjectDependency(&cinfo->contable->dataObj->dobj,
-								ftable->dataObj->dobj.dumpId);
+			for (tdinfo = cinfo->contable->dataObj; tdinfo;
+				 tdinfo = tdinfo->nextchunk)
+			{
+				for (ftdinfo = ftable->dataObj; ftdinfo;
+					 ftdinfo = ftdinfo->nextchunk)
+				{
+					if (ftable == cinfo->contable && ftdinfo != tdinfo)
+						continue;
+					addObjectDependency(&tdinfo->dobj,
+										ftdinfo->dobj.dumpId);
+				}
+			}
 		}
 	}
 	free(dobjs);
@@ -4100,6 +4299,7 @@ getSubscriptions(Archive *fout)
 	int			i_subconninfo;
 	int			i_subslotname;
 	int			i_subsynccommit;
+	int			i_substream;
 	int			i_subpublications;
 	int			i,
 				ntups;
@@ -4132,11 +4332,18 @@ getSubscriptions(Archive *fout)
 					  "SELECT s.tableoid, s.oid, s.subname,"
 					  "(%s s.subowner) AS rolname, "
 					  " s.subconninfo, s.subslotname, s.subsynccommit, "
-					  " s.subpublications "
-					  "FROM pg_subscription s "
-					  "WHERE s.subdbid = (SELECT oid FROM pg_database"
-					  "                   WHERE datname = current_database())",
+					  " s.subpublications, ",
 					  username_subquery);
+
+	if (fout->remoteVersion >= 120000)
+		appendPQExpBufferStr(query, " s.substream ");
+	else
+		appendPQExpBufferStr(query, " false AS substream ");
+
+	appendPQExpBufferStr(query,
+						 "FROM pg_subscription s "
+						 "WHERE s.subdbid = (SELECT oid FROM pg_database"
+						 "                   WHERE datname = current_database())");
 	res = ExecuteSqlQuery(fout, query->data, PGRES_TUPLES_OK);
 
 	ntups = PQntuples(res);
@@ -4148,6 +4355,7 @@ getSubscriptions(Archive *fout)
 	i_subconninfo = PQfnumber(res, "subconninfo");
 	i_subslotname = PQfnumber(res, "subslotname");
 	i_subsynccommit = PQfnumber(res, "subsynccommit");
+	i_substream = PQfnumber(res, "substream");
 	i_subpublications = PQfnumber(res, "subpublications");
 
 	subinfo = pg_malloc(ntups * sizeof(SubscriptionInfo));
@@ -4168,6 +4376,8 @@ getSubscriptions(Archive *fout)
 			subinfo[i].subslotname = pg_strdup(PQgetvalue(res, i, i_subslotname));
 		subinfo[i].subsynccommit =
 			pg_strdup(PQgetvalue(res, i, i_subsynccommit));
+		subinfo[i].substream =
+			pg_strdup(PQgetvalue(res, i, i_substream));
 		subinfo[i].subpublications =
 			pg_strdup(PQgetvalue(res, i, i_subpublications));
 
@@ -4241,6 +4451,9 @@ dumpSubscription(Archive *fout, SubscriptionInfo *subinfo)
 	if (strcmp(subinfo->subsynccommit, "off") != 0)
 		appendPQExpBuffer(query, ", synchronous_commit = %s", fmtId(subinfo->subsynccommit));
 
+	if (strcmp(subinfo->substream, "f") != 0)
+		appendPQExpBufferStr(query, ", streaming = on");
+
 	appendPQExpBufferStr(query, ");\n");
 
 	ArchiveEntry(fout, subinfo->dobj.catId, subinfo->dobj.dumpId,
@@ -8215,6 +8428,7 @@ getTableAttrs(Archive *fout, TableInfo *tblinfo, int numTables)
 	int			i_attstattarget;
 	int			i_attstorage;
 	int			i_typstorage;
+	int			i_attcompression;
 	int			i_attnotnull;
 	int			i_atthasdef;
 	int			i_attidentity;
@@ -8273,10 +8487,12 @@ getTableAttrs(Archive *fout, TableInfo *tblinfo, int numTables)
 
 		if (fout->remoteVersion >= 120000)
 			appendPQExpBuffer(q,
-							  "a.attgenerated,\n");
+							  "a.attgenerated,\n"
+							  "a.attcompression,\n");
 		else
 			appendPQExpBuffer(q,
-							  "'' AS attgenerated,\n");
+							  "'' AS attgenerated,\n"
+							  "'' AS attcompression,\n");
 
 		if (fout->remoteVersion >= 110000)
 			appendPQExpBuffer(q,
@@ -8347,6 +8563,7 @@ getTableAttrs(Archive *fout, TableInfo *tblinfo, int numTables)
 		i_attstattarget = PQfnumber(res, "attstattarget");
 		i_attstorage = PQfnumber(res, "attstorage");
 		i_typstorage = PQfnumber(res, "typstorage");
+		i_attcompression = PQfnumber(res, "attcompression");
 		i_attnotnull = PQfnumber(res, "attnotnull");
 		i_atthasdef = PQfnumber(res, "atthasdef");
 		i_attidentity = PQfnumber(res, "attidentity");
@@ -8367,6 +8584,7 @@ getTableAttrs(Archive *fout, TableInfo *tblinfo, int numTables)
 		tbinfo->attstattarget = (int *) pg_malloc(ntups * sizeof(int));
 		tbinfo->attstorage = (char *) pg_malloc(ntups * sizeof(char));
 		tbinfo->typstorage = (char *) pg_malloc(ntups * sizeof(char));
+		tbinfo->attcompression = (char *) pg_malloc(ntups * sizeof(char));
 		tbinfo->attidentity = (char *) pg_malloc(ntups * sizeof(char));
 		tbinfo->attgenerated = (char *) pg_malloc(ntups * sizeof(char));
 		tbinfo->attisdropped = (bool *) pg_malloc(ntups * sizeof(bool));
@@ -8393,6 +8611,7 @@ getTableAttrs(Archive *fout, TableInfo *tblinfo, int numTables)
 			tbinfo->attstattarget[j] = atoi(PQgetvalue(res, j, i_attstattarget));
 			tbinfo->attstorage[j] = *(PQgetvalue(res, j, i_attstorage));
 			tbinfo->typstorage[j] = *(PQgetvalue(res, j, i_typstorage));
+			tbinfo->attcompression[j] = *(PQgetvalue(res, j, i_attcompression));
 			tbinfo->attidentity[j] = *(PQgetvalue(res, j, i_attidentity));
 			tbinfo->attgenerated[j] = *(PQgetvalue(res, j, i_attgenerated));
 			tbinfo->needs_override = tbinfo->needs_override || (tbinfo->attidentity[j] == ATTRIBUTE_IDENTITY_ALWAYS);
@@ -16097,6 +16316,37 @@ dumpTableSchema(Archive *fout, TableInfo *tbinfo)
 				}
 			}
 
+			/*
+			 * Dump per-column compression, if a method has been set for the
+			 * column.
+			 */
+			if (tbinfo->attcompression[j] != '\0')
+			{
+				const char *cmname;
+
+				switch (tbinfo->attcompression[j])
+				{
+					case 'p':
+						cmname = "pglz";
+						break;
+					case 'l':
+						cmname = "lz4";
+						break;
+					default:
+						cmname = NULL;
+				}
+
+				if (cmname != NULL)
+				{
+					appendPQExpBuffer(q, "ALTER TABLE ONLY %s ",
+									  qualrelname);
+					appendPQExpBuffer(q, "ALTER COLUMN %s ",
+									  fmtId(tbinfo->attnames[j]));
+					appendPQExpBuffer(q, "SET COMPRESSION %s;\n",
+									  cmname);
+				}
+			}
+
 			/*
 			 * Dump per-column attributes.
 			 */
@@ -308,6 +308,7 @@ typedef struct _tableInfo
 	int		   *attstattarget;	/* attribute statistics targets */
 	char	   *attstorage;		/* attribute storage scheme */
 	char	   *typstorage;		/* type storage scheme */
+	char	   *attcompression; /* per-attribute compression method */
 	bool	   *attisdropped;	/* true if attr is dropped; don't dump it */
 	char	   *attidentity;
 	char	   *attgenerated;
@@ -353,6 +354,8 @@ typedef struct _tableDataInfo
 	DumpableObject dobj;
 	TableInfo  *tdtable;		/* link to table to dump */
 	char	   *filtercond;		/* WHERE condition to limit rows dumped */
+	int			nchunks;		/* number of chunks the data is split into */
+	struct _tableDataInfo *nextchunk;	/* next chunk, or NULL */
 } TableDataInfo;
 
 typedef struct _indxInfo
@@ -624,6 +627,7 @@ typedef struct _SubscriptionInfo
 	char	   *subconninfo;
 	char	   *subslotname;
 	char	   *subsynccommit;
+	char	   *substream;
 	char	   *subpublications;
 } SubscriptionInfo;
 
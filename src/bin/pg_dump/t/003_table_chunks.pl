@@ -0,0 +1,49 @@
+use strict;
+use warnings;
+
+use PostgresNode;
+use TestLib;
+use Test::More tests => 6;
+
+my $tempdir = TestLib::tempdir;
+
+my $node = get_new_node('main');
+$node->init;
+$node->start;
+
+$node->safe_psql('postgres',
+	    "CREATE TABLE big (id int PRIMARY KEY, filler text);"
+	  . "INSERT INTO big SELECT g, repeat('x', 50) FROM generate_series(1, 100000) g;"
+	  . "CREATE TABLE nokey (id int, filler text);"
+	  . "INSERT INTO nokey SELECT g, repeat('x', 50) FROM generate_series(1, 100000) g;"
+	  . "VACUUM ANALYZE;");
+
+# Tables larger than the chunk size with a usable key are split
+$node->command_ok(
+	[
+		'pg_dump', '--no-sync', '-Fd', '-j2', '--table-chunk-size=1',
+		'-f', "$tempdir/chunked", 'postgres'
+	],
+	'parallel dump with table chunks');
+
+my ($stdout, $stderr) = run_command([ 'pg_restore', '-l', "$tempdir/chunked" ]);
+my $nchunks = () = $stdout =~ /TABLE DATA public big /g;
+cmp_ok($nchunks, '>', 1, 'table with primary key is dumped in chunks');
+my $nnokey = () = $stdout =~ /TABLE DATA public nokey /g;
+is($nnokey, 1, 'table without primary key is dumped whole');
+
+# The chunks restore in parallel, before the table's indexes are built
+$node->safe_psql('postgres', 'CREATE DATABASE restored');
+$node->command_ok(
+	[ 'pg_restore', '-j4', '-d', 'restored', "$tempdir/chunked" ],
+	'parallel restore of table chunks');
+
+my $query = 'SELECT count(*), sum(id) FROM big';
+is($node->safe_psql('restored', $query),
+	$node->safe_psql('postgres', $query),
+	'all chunks are restored');
+is( $node->safe_psql(
+		'restored',
+		"SELECT count(*) FROM pg_index WHERE indrelid = 'big'::regclass"),
+	'1',
+	'primary key is restored');
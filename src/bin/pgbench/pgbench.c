@@ -214,6 +214,7 @@ int			agg_interval;		/* log aggregates instead of individual
 bool		per_script_stats = false;	/* whether to collect stats per script */
 int			progress = 0;		/* thread progress report every this seconds */
 bool		progress_timestamp = false; /* progress report with Unix time */
+bool		undo_stats = false; /* progress report with undo statistics */
 int			nclients = 1;		/* number of clients */
 int			nthreads = 1;		/* number of threads */
 bool		is_connect;			/* establish connection for each transaction */
@@ -278,6 +279,7 @@ typedef struct StatsData
 								 * and --latency-limit */
 	SimpleStats latency;
 	SimpleStats lag;
+	SimpleStats rollback;		/* ROLLBACK latencies, under --undo-stats */
 } StatsData;
 
 /*
@@ -437,6 +439,10 @@ typedef struct
 	instr_time	conn_time;
 	StatsData	stats;
 	int64		latency_late;	/* executed but late transactions */
+
+	/* thread 0 only: server connection and last value, for --undo-stats */
+	PGconn	   *stats_con;
+	int64		undo_bytes;
 } TState;
 
 #define INVALID_THREAD		((pthread_t) 0)
@@ -507,6 +513,7 @@ typedef struct Command
 	char	   *varprefix;
 	PgBenchExpr *expr;
 	SimpleStats stats;
+	bool		is_rollback;	/* SQL command is a ROLLBACK or ABORT */
 } Command;
 
 typedef struct ParsedScript
@@ -566,6 +573,38 @@ static const BuiltinScript builtin_script[] =
 		"<builtin: select only>",
 		"\\set aid random(1, " CppAsString2(naccounts) " * :scale)\n"
 		"SELECT abalance FROM pgbench_accounts WHERE aid = :aid;\n"
+	},
+	{
+		"zheap-hot-page",
+		"<builtin: zheap hot page>",
+		"\\set aid1 random(1, 50)\n"
+		"\\set aid2 random(1, 50)\n"
+		"\\set delta random(-5000, 5000)\n"
+		"BEGIN;\n"
+		"UPDATE pgbench_accounts SET abalance = abalance + :delta WHERE aid = :aid1;\n"
+		"UPDATE pgbench_accounts SET abalance = abalance - :delta WHERE aid = :aid2;\n"
+		"END;\n"
+	},
+	{
+		"zheap-long-snapshot",
+		"<builtin: zheap long snapshot>",
+		"\\set aid random(1, 1000)\n"
+		"\\set delta random(-5000, 5000)\n"
+		"UPDATE pgbench_accounts SET abalance = abalance + :delta WHERE aid = :aid;\n"
+		"BEGIN ISOLATION LEVEL REPEATABLE READ;\n"
+		"SELECT sum(abalance) FROM pgbench_accounts WHERE aid BETWEEN 1 AND 1000;\n"
+		"\\sleep 10 ms\n"
+		"SELECT sum(abalance) FROM pgbench_accounts WHERE aid BETWEEN 1 AND 1000;\n"
+		"END;\n"
+	},
+	{
+		"zheap-rollback",
+		"<builtin: zheap rollback>",
+		"\\set aid random(1, " CppAsString2(naccounts) " * :scale - 9999)\n"
+		"\\set delta random(-5000, 5000)\n"
+		"BEGIN;\n"
+		"UPDATE pgbench_accounts SET abalance = abalance + :delta WHERE aid BETWEEN :aid AND :aid + 9999;\n"
+		"ROLLBACK;\n"
 	}
 };
 
@@ -651,6 +690,7 @@ usage(void)
 		   "  --progress-timestamp     use Unix epoch timestamps for progress\n"
 		   "  --random-seed=SEED       set random seed (\"time\", \"rand\", integer)\n"
 		   "  --sampling-rate=NUM      fraction of transactions to log (e.g., 0.01 for 1%%)\n"
+		   "  --undo-stats             report undo written and rollback latency in progress\n"
 		   "\nCommon options:\n"
 		   "  -d, --debug              print debugging output\n"
 		   "  -h, --host=HOSTNAME      database server host or socket directory\n"
@@ -1090,6 +1130,7 @@ initStats(StatsData *sd, time_t start_time)
 	sd->skipped = 0;
 	initSimpleStats(&sd->latency);
 	initSimpleStats(&sd->lag);
+	initSimpleStats(&sd->rollback);
 }
 
 /*
@@ -3036,7 +3077,7 @@ advanceConnectionState(TState *thread, CState *st, StatsData *agg)
 				}
 
 				/* record begin time of next command, and initiate it */
-				if (report_per_command)
+				if (report_per_command || undo_stats)
 				{
 					INSTR_TIME_SET_CURRENT_LAZY(now);
 					st->stmt_begin = now;
@@ -3217,9 +3258,9 @@ advanceConnectionState(TState *thread, CState *st, StatsData *agg)
 				/*
 				 * command completed: accumulate per-command execution times
 				 * in thread-local data structure, if per-command latencies
-				 * are requested.
+				 * are requested.  Likewise for rollbacks under --undo-stats.
 				 */
-				if (report_per_command)
+				if (report_per_command || undo_stats)
 				{
 					Command    *command;
 
@@ -3227,9 +3268,14 @@ advanceConnectionState(TState *thread, CState *st, StatsData *agg)
 
 					command = sql_script[st->use_file].commands[st->command];
 					/* XXX could use a mutex here, but we choose not to */
-					addToSimpleStats(&command->stats,
-									 INSTR_TIME_GET_DOUBLE(now) -
-									 INSTR_TIME_GET_DOUBLE(st->stmt_begin));
+					if (report_per_command)
+						addToSimpleStats(&command->stats,
+										 INSTR_TIME_GET_DOUBLE(now) -
+										 INSTR_TIME_GET_DOUBLE(st->stmt_begin));
+					if (undo_stats && command->is_rollback)
+						addToSimpleStats(&thread->stats.rollback,
+										 INSTR_TIME_GET_MICROSEC(now) -
+										 INSTR_TIME_GET_MICROSEC(st->stmt_begin));
 				}
 
 				/* Go ahead with next command, to be executed or skipped */
@@ -4127,6 +4173,8 @@ create_sql_command(PQExpBuffer buf, const char *source)
 	my_command->varprefix = NULL;	/* allocated later, if needed */
 	my_command->expr = NULL;
 	initSimpleStats(&my_command->stats);
+	my_command->is_rollback = (pg_strncasecmp(p, "rollback", 8) == 0 ||
+							   pg_strncasecmp(p, "abort", 5) == 0);
 
 	return my_command;
 }
@@ -4755,6 +4803,30 @@ addScript(ParsedScript script)
 	num_scripts++;
 }
 
+/*
+ * Fetch the total amount of undo written for the zheap tables of the
+ * database, or -1 on failure.
+ */
+static int64
+getUndoBytes(PGconn *con)
+{
+	PGresult   *res;
+	int64		undo_bytes = -1;
+
+	res = PQexec(con,
+				 "SELECT coalesce(sum(undo_bytes), 0) FROM pg_stat_zheap_tables");
+	if (PQresultStatus(res) != PGRES_TUPLES_OK || PQntuples(res) != 1 ||
+		!strtoint64(PQgetvalue(res, 0, 0), true, &undo_bytes))
+	{
+		fprintf(stderr, "could not fetch undo statistics: %s",
+				PQerrorMessage(con));
+		undo_bytes = -1;
+	}
+	PQclear(res);
+
+	return undo_bytes;
+}
+
 /*
  * Print progress report.
  *
@@ -4792,6 +4864,7 @@ printProgressReport(TState *threads, int64 test_start, int64 now,
 	{
 		mergeSimpleStats(&cur.latency, &threads[i].stats.latency);
 		mergeSimpleStats(&cur.lag, &threads[i].stats.lag);
+		mergeSimpleStats(&cur.rollback, &threads[i].stats.rollback);
 		cur.cnt += threads[i].stats.cnt;
 		cur.skipped += threads[i].stats.skipped;
 	}
@@ -4842,6 +4915,22 @@ printProgressReport(TState *threads, int64 test_start, int64 now,
 			fprintf(stderr, ", " INT64_FORMAT " skipped",
 					cur.skipped - last->skipped);
 	}
+
+	if (undo_stats)
+	{
+		int64		nrollback = cur.rollback.count - last->rollback.count;
+		int64		undo_bytes = getUndoBytes(threads->stats_con);
+
+		/* the collector only reports undo with a delay, see pgstat.c */
+		if (undo_bytes >= 0 && threads->undo_bytes >= 0)
+			fprintf(stderr, ", undo %.1f kB/s",
+					1000000.0 * (undo_bytes - threads->undo_bytes) / run / 1024);
+		threads->undo_bytes = undo_bytes;
+
+		fprintf(stderr, ", rollback lat %.3f ms",
+				nrollback > 0 ?
+				0.001 * (cur.rollback.sum - last->rollback.sum) / nrollback : 0.0);
+	}
 	fprintf(stderr, "\n");
 
 	*last = cur;
@@ -4914,6 +5003,9 @@ printResults(StatsData *total, instr_time total_time,
 
 	if (throttle_delay || progress || latency_limit)
 		printSimpleStats("latency", &total->latency);
+
+	if (undo_stats)
+		printSimpleStats("rollback latency", &total->rollback);
 	else
 	{
 		/* no measurement, show average latency computed from run time */
@@ -5088,6 +5180,7 @@ main(int argc, char **argv)
 		{"log-prefix", required_argument, NULL, 7},
 		{"foreign-keys", no_argument, NULL, 8},
 		{"random-seed", required_argument, NULL, 9},
+		{"undo-stats", no_argument, NULL, 10},
 		{NULL, 0, NULL, 0}
 	};
 
@@ -5440,6 +5533,10 @@ main(int argc, char **argv)
 					exit(1);
 				}
 				break;
+			case 10:			/* undo-stats */
+				benchmarking_option_set = true;
+				undo_stats = true;
+				break;
 			default:
 				fprintf(stderr, _("Try \"%s --help\" for more information.\n"), progname);
 				exit(1);
@@ -5603,6 +5700,12 @@ main(int argc, char **argv)
 		exit(1);
 	}
 
+	if (undo_stats && progress == 0)
+	{
+		fprintf(stderr, "--undo-stats is allowed only under --progress\n");
+		exit(1);
+	}
+
 	/*
 	 * save main process id in the global variable because process id will be
 	 * changed after fork.
@@ -5783,6 +5886,8 @@ main(int argc, char **argv)
 		thread->logfile = NULL; /* filled in later */
 		thread->latency_late = 0;
 		initStats(&thread->stats, 0);
+		thread->stats_con = NULL;	/* filled in later */
+		thread->undo_bytes = -1;
 
 		nclients_dealt += thread->nstate;
 	}
@@ -5860,6 +5965,7 @@ main(int argc, char **argv)
 		/* aggregate thread level stats */
 		mergeSimpleStats(&stats.latency, &thread->stats.latency);
 		mergeSimpleStats(&stats.lag, &thread->stats.lag);
+		mergeSimpleStats(&stats.rollback, &thread->stats.rollback);
 		stats.cnt += thread->stats.cnt;
 		stats.skipped += thread->stats.skipped;
 		latency_late += thread->latency_late;
@@ -5955,6 +6061,14 @@ threadRun(void *arg)
 	INSTR_TIME_SET_CURRENT(thread->conn_time);
 	INSTR_TIME_SUBTRACT(thread->conn_time, thread->start_time);
 
+	/* progress report is made by thread 0, which also fetches undo stats */
+	if (undo_stats && thread->tid == 0)
+	{
+		if ((thread->stats_con = doConnect()) == NULL)
+			goto done;
+		thread->undo_bytes = getUndoBytes(thread->stats_con);
+	}
+
 	/* explicitly initialize the state machines */
 	for (i = 0; i < nstate; i++)
 	{
@@ -6164,6 +6278,11 @@ done:
 	disconnect_all(state, nstate);
 	INSTR_TIME_SET_CURRENT(end);
 	INSTR_TIME_ACCUM_DIFF(thread->conn_time, end, start);
+	if (thread->stats_con)
+	{
+		PQfinish(thread->stats_con);
+		thread->stats_con = NULL;
+	}
 	if (thread->logfile)
 	{
 		if (agg_interval > 0)
@@ -178,6 +178,20 @@ pgbench(
 	],
 	'pgbench select only');
 
+# zheap stress builtins
+pgbench(
+	'-t 5 -c 2 -b zheap-hot-page -b zheap-long-snapshot -b zheap-rollback',
+	0,
+	[
+		qr{type: multiple scripts},
+		qr{builtin: zheap hot page},
+		qr{builtin: zheap long snapshot},
+		qr{builtin: zheap rollback},
+		qr{processed: 10/10}
+	],
+	[qr{^$}],
+	'pgbench zheap builtins');
+
 # check if threads are supported
 my $nthreads = 2;
 
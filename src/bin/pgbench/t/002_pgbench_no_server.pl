@@ -139,6 +139,10 @@ my @options = (
 		'--progress-timestamp => --progress', '--progress-timestamp',
 		[qr{allowed only under}]
 	],
+	[
+		'--undo-stats => --progress', '--undo-stats',
+		[qr{allowed only under}]
+	],
 	[
 		'-I without init option',
 		'-I dtg',
@@ -214,7 +218,9 @@ pgbench(
 	[qr{^$}],
 	[
 		qr{Available builtin scripts:}, qr{tpcb-like},
-		qr{simple-update},              qr{select-only}
+		qr{simple-update},              qr{select-only},
+		qr{zheap-hot-page},             qr{zheap-long-snapshot},
+		qr{zheap-rollback}
 	],
 	'pgbench builtin list');
 
@@ -0,0 +1,707 @@
+/*-------------------------------------------------------------------------
+ *
+ * zpq_stream.c
+ *	  Streaming compression of frontend/backend protocol traffic
+ *
+ * Once compression has been negotiated at connection startup, both libpq
+ * and the backend pass everything they send or receive through a ZpqStream.
+ * The stream sits between the protocol buffering and the transport (plain
+ * socket, SSL or GSSAPI), which it reaches through the callbacks given to
+ * zpq_create().  Each write is compressed and flushed, so the peer can
+ * decompress every message as soon as it arrives.
+ *
+ * The algorithms are zlib, LZ4 and Zstandard, each available if the build
+ * has the library.  The buffering is the same for all of them; they differ
+ * only in the ZpqAlgorithm routines that compress and decompress one
+ * buffer at a time.
+ *
+ * Copyright (c) 2019, PostgreSQL Global Development Group
+ *
+ *
+ * IDENTIFICATION
+ *	  src/common/zpq_stream.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef FRONTEND
+#include "postgres.h"
+#else
+#include "postgres_fe.h"
+#endif
+
+#include "common/zpq_stream.h"
+
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
+#ifdef USE_LZ4
+#include <lz4frame.h>
+#endif
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
+
+/* Size of the compressed-data buffers in each direction */
+#define ZPQ_BUFFER_SIZE		8192
+
+/*
+ * Protocol traffic is latency-sensitive and highly repetitive, so the
+ * fastest compression levels get nearly all of the benefit.
+ */
+#define ZPQ_ZLIB_LEVEL		Z_BEST_SPEED
+#define ZPQ_ZSTD_LEVEL		1
+
+/*
+ * Most input LZ4 is given at once.  LZ4F_compressUpdate() wants room for the
+ * worst case of its input, so this leaves space in the output buffer for
+ * the block and frame headers.
+ */
+#define ZPQ_LZ4_MAX_INPUT	(ZPQ_BUFFER_SIZE / 2)
+
+/*
+ * An algorithm's compress and decompress routines work on one buffer: they
+ * take up to *in_size bytes from in and produce up to out_size bytes at
+ * out, and report in *in_size and *out_len how much they consumed and
+ * produced.  Compressed output must be flushed, so that the peer can
+ * decompress all of the input consumed.  *more is set if there may be
+ * more output even without more input, because out filled up.  On failure
+ * they set zs->errmsg and return false.
+ */
+typedef struct ZpqAlgorithm
+{
+	const char *name;
+	bool		(*init) (ZpqStream *zs);
+	bool		(*compress) (ZpqStream *zs, const char *in, size_t *in_size,
+							 char *out, size_t out_size, size_t *out_len,
+							 bool *more);
+	bool		(*decompress) (ZpqStream *zs, const char *in, size_t *in_size,
+							   char *out, size_t out_size, size_t *out_len,
+							   bool *more);
+	void		(*end) (ZpqStream *zs);
+} ZpqAlgorithm;
+
+struct ZpqStream
+{
+	const ZpqAlgorithm *algorithm;
+	void	   *tx_state;		/* the algorithm's compressor */
+	void	   *rx_state;		/* the algorithm's decompressor */
+	bool		tx_begun;		/* has the compressor written a header? */
+
+	zpq_tx_func tx_func;
+	zpq_rx_func rx_func;
+	void	   *arg;
+
+	const char *errmsg;			/* description of the last failure */
+
+	/* Compressed output not yet accepted by tx_func */
+	size_t		tx_pos;			/* first unsent byte in tx_buf */
+	size_t		tx_len;			/* end of valid data in tx_buf */
+	bool		tx_more;		/* compressor may have more output for us */
+	char		tx_buf[ZPQ_BUFFER_SIZE];
+
+	/* Compressed input not yet decompressed */
+	size_t		rx_pos;			/* first unprocessed byte in rx_buf */
+	size_t		rx_len;			/* end of valid data in rx_buf */
+	bool		rx_more;		/* decompressor may have more output for us */
+	size_t		rx_size;		/* allocated size of rx_buf */
+	char	   *rx_buf;
+};
+
+#ifdef HAVE_LIBZ
+
+static bool
+zlib_init(ZpqStream *zs)
+{
+	z_stream   *tx;
+	z_stream   *rx;
+
+	tx = (z_stream *) malloc(sizeof(z_stream));
+	rx = (z_stream *) malloc(sizeof(z_stream));
+	if (tx == NULL || rx == NULL)
+	{
+		free(tx);
+		free(rx);
+		return false;
+	}
+	memset(tx, 0, sizeof(z_stream));
+	memset(rx, 0, sizeof(z_stream));
+
+	if (deflateInit(tx, ZPQ_ZLIB_LEVEL) != Z_OK)
+	{
+		free(tx);
+		free(rx);
+		return false;
+	}
+	if (inflateInit(rx) != Z_OK)
+	{
+		deflateEnd(tx);
+		free(tx);
+		free(rx);
+		return false;
+	}
+
+	zs->tx_state = tx;
+	zs->rx_state = rx;
+	return true;
+}
+
+static bool
+zlib_compress(ZpqStream *zs, const char *in, size_t *in_size,
+			  char *out, size_t out_size, size_t *out_len, bool *more)
+{
+	z_stream   *tx = (z_stream *) zs->tx_state;
+
+	tx->next_in = (Bytef *) in;
+	tx->avail_in = *in_size;
+	tx->next_out = (Bytef *) out;
+	tx->avail_out = out_size;
+
+	if (deflate(tx, Z_SYNC_FLUSH) == Z_STREAM_ERROR)
+	{
+		zs->errmsg = tx->msg ? tx->msg : "could not compress data";
+		return false;
+	}
+
+	*in_size -= tx->avail_in;
+	*out_len = out_size - tx->avail_out;
+	*more = (tx->avail_out == 0);
+	return true;
+}
+
+static bool
+zlib_decompress(ZpqStream *zs, const char *in, size_t *in_size,
+				char *out, size_t out_size, size_t *out_len, bool *more)
+{
+	z_stream   *rx = (z_stream *) zs->rx_state;
+	int			zrc;
+
+	rx->next_in = (Bytef *) in;
+	rx->avail_in = *in_size;
+	rx->next_out = (Bytef *) out;
+	rx->avail_out = out_size;
+
+	zrc = inflate(rx, Z_SYNC_FLUSH);
+	if (zrc != Z_OK && zrc != Z_BUF_ERROR)
+	{
+		zs->errmsg = rx->msg ? rx->msg : "unexpected end of compressed stream";
+		return false;
+	}
+
+	*in_size -= rx->avail_in;
+	*out_len = out_size - rx->avail_out;
+	*more = (rx->avail_out == 0);
+	return true;
+}
+
+static void
+zlib_end(ZpqStream *zs)
+{
+	deflateEnd((z_stream *) zs->tx_state);
+	inflateEnd((z_stream *) zs->rx_state);
+	free(zs->tx_state);
+	free(zs->rx_state);
+}
+
+#endif							/* HAVE_LIBZ */
+
+#ifdef USE_LZ4
+
+/*
+ * LZ4 uses its frame format, which can be decompressed incrementally.  With
+ * autoFlush, every LZ4F_compressUpdate() call emits all of its input.
+ */
+static void
+lz4_preferences(LZ4F_preferences_t *prefs)
+{
+	memset(prefs, 0, sizeof(LZ4F_preferences_t));
+	prefs->autoFlush = 1;
+}
+
+static bool
+lz4_init(ZpqStream *zs)
+{
+	LZ4F_cctx  *cctx;
+	LZ4F_dctx  *dctx;
+
+	if (LZ4F_isError(LZ4F_createCompressionContext(&cctx, LZ4F_VERSION)))
+		return false;
+	if (LZ4F_isError(LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION)))
+	{
+		LZ4F_freeCompressionContext(cctx);
+		return false;
+	}
+
+	zs->tx_state = cctx;
+	zs->rx_state = dctx;
+	return true;
+}
+
+static bool
+lz4_compress(ZpqStream *zs, const char *in, size_t *in_size,
+			 char *out, size_t out_size, size_t *out_len, bool *more)
+{
+	LZ4F_cctx  *cctx = (LZ4F_cctx *) zs->tx_state;
+	LZ4F_preferences_t prefs;
+	size_t		header = 0;
+	size_t		chunk = Min(*in_size, ZPQ_LZ4_MAX_INPUT);
+	size_t		rc;
+
+	lz4_preferences(&prefs);
+
+	/* The frame header goes out with the first data */
+	if (!zs->tx_begun)
+	{
+		header = LZ4F_compressBegin(cctx, out, out_size, &prefs);
+		if (LZ4F_isError(header))
+		{
+			zs->errmsg = LZ4F_getErrorName(header);
+			return false;
+		}
+		zs->tx_begun = true;
+	}
+
+	Assert(header + LZ4F_compressBound(chunk, &prefs) <= out_size);
+
+	rc = LZ4F_compressUpdate(cctx, out + header, out_size - header,
+							 in, chunk, NULL);
+	if (LZ4F_isError(rc))
+	{
+		zs->errmsg = LZ4F_getErrorName(rc);
+		return false;
+	}
+
+	*in_size = chunk;
+	*out_len = header + rc;
+	*more = false;
+	return true;
+}
+
+static bool
+lz4_decompress(ZpqStream *zs, const char *in, size_t *in_size,
+			   char *out, size_t out_size, size_t *out_len, bool *more)
+{
+	size_t		dst_size = out_size;
+	size_t		rc;
+
+	rc = LZ4F_decompress((LZ4F_dctx *) zs->rx_state, out, &dst_size,
+						 in, in_size, NULL);
+	if (LZ4F_isError(rc))
+	{
+		zs->errmsg = LZ4F_getErrorName(rc);
+		return false;
+	}
+
+	*out_len = dst_size;
+	*more = (dst_size == out_size);
+	return true;
+}
+
+static void
+lz4_end(ZpqStream *zs)
+{
+	LZ4F_freeCompressionContext((LZ4F_cctx *) zs->tx_state);
+	LZ4F_freeDecompressionContext((LZ4F_dctx *) zs->rx_state);
+}
+
+#endif							/* USE_LZ4 */
+
+#ifdef USE_ZSTD
+
+static bool
+zstd_init(ZpqStream *zs)
+{
+	ZSTD_CStream *cstream;
+	ZSTD_DStream *dstream;
+
+	cstream = ZSTD_createCStream();
+	if (cstream == NULL)
+		return false;
+	if (ZSTD_isError(ZSTD_initCStream(cstream, ZPQ_ZSTD_LEVEL)))
+	{
+		ZSTD_freeCStream(cstream);
+		return false;
+	}
+
+	dstream = ZSTD_createDStream();
+	if (dstream == NULL)
+	{
+		ZSTD_freeCStream(cstream);
+		return false;
+	}
+	if (ZSTD_isError(ZSTD_initDStream(dstream)))
+	{
+		ZSTD_freeCStream(cstream);
+		ZSTD_freeDStream(dstream);
+		return false;
+	}
+
+	zs->tx_state = cstream;
+	zs->rx_state = dstream;
+	return true;
+}
+
+static bool
+zstd_compress(ZpqStream *zs, const char *in, size_t *in_size,
+			  char *out, size_t out_size, size_t *out_len, bool *more)
+{
+	ZSTD_CStream *cstream = (ZSTD_CStream *) zs->tx_state;
+	ZSTD_inBuffer input;
+	ZSTD_outBuffer output;
+	size_t		rc;
+
+	input.src = in;
+	input.size = *in_size;
+	input.pos = 0;
+	output.dst = out;
+	output.size = out_size;
+	output.pos = 0;
+
+	rc = ZSTD_compressStream(cstream, &output, &input);
+	if (ZSTD_isError(rc))
+	{
+		zs->errmsg = ZSTD_getErrorName(rc);
+		return false;
+	}
+
+	/* Once all the input is in, flush it; rc is what's left to flush */
+	if (input.pos == input.size)
+	{
+		rc = ZSTD_flushStream(cstream, &output);
+		if (ZSTD_isError(rc))
+		{
+			zs->errmsg = ZSTD_getErrorName(rc);
+			return false;
+		}
+		*more = (rc != 0);
+	}
+	else
+		*more = true;
+
+	*in_size = input.pos;
+	*out_len = output.pos;
+	return true;
+}
+
+static bool
+zstd_decompress(ZpqStream *zs, const char *in, size_t *in_size,
+				char *out, size_t out_size, size_t *out_len, bool *more)
+{
+	ZSTD_inBuffer input;
+	ZSTD_outBuffer output;
+	size_t		rc;
+
+	input.src = in;
+	input.size = *in_size;
+	input.pos = 0;
+	output.dst = out;
+	output.size = out_size;
+	output.pos = 0;
+
+	rc = ZSTD_decompressStream((ZSTD_DStream *) zs->rx_state, &output, &input);
+	if (ZSTD_isError(rc))
+	{
+		zs->errmsg = ZSTD_getErrorName(rc);
+		return false;
+	}
+
+	*in_size = input.pos;
+	*out_len = output.pos;
+	*more = (output.pos == output.size);
+	return true;
+}
+
+static void
+zstd_end(ZpqStream *zs)
+{
+	ZSTD_freeCStream((ZSTD_CStream *) zs->tx_state);
+	ZSTD_freeDStream((ZSTD_DStream *) zs->rx_state);
+}
+
+#endif							/* USE_ZSTD */
+
+/*
+ * The algorithms this build supports, in the order "compression=on" offers
+ * them.  Zstandard compresses best for about the cost of LZ4.
+ */
+static const ZpqAlgorithm zpq_algorithms[] =
+{
+#ifdef USE_ZSTD
+	{"zstd", zstd_init, zstd_compress, zstd_decompress, zstd_end},
+#endif
+#ifdef USE_LZ4
+	{"lz4", lz4_init, lz4_compress, lz4_decompress, lz4_end},
+#endif
+#ifdef HAVE_LIBZ
+	{"zlib", zlib_init, zlib_compress, zlib_decompress, zlib_end},
+#endif
+	{NULL}
+};
+
+static const ZpqAlgorithm *
+zpq_find_algorithm(const char *name, size_t len)
+{
+	const ZpqAlgorithm *algorithm;
+
+	for (algorithm = zpq_algorithms; algorithm->name; algorithm++)
+	{
+		if (strlen(algorithm->name) == len &&
+			strncmp(algorithm->name, name, len) == 0)
+			return algorithm;
+	}
+	return NULL;
+}
+
+/*
+ * Is the named algorithm available in this build?
+ */
+bool
+zpq_algorithm_supported(const char *algorithm)
+{
+	return zpq_find_algorithm(algorithm, strlen(algorithm)) != NULL;
+}
+
+/*
+ * Write the algorithms this build supports, comma-separated and most
+ * preferred first, to buf.  The result is empty if there are none.
+ */
+void
+zpq_supported_algorithms(char *buf, size_t size)
+{
+	const ZpqAlgorithm *algorithm;
+
+	Assert(size > 0);
+	buf[0] = '\0';
+	for (algorithm = zpq_algorithms; algorithm->name; algorithm++)
+	{
+		if (algorithm != zpq_algorithms)
+			strlcat(buf, ",", size);
+		strlcat(buf, algorithm->name, size);
+	}
+}
+
+/*
+ * Pick the first algorithm we support from a comma-separated list, as sent
+ * by the client.  Returns NULL if there's none.
+ */
+const char *
+zpq_choose_algorithm(const char *algorithms)
+{
+	const char *p = algorithms;
+
+	while (*p)
+	{
+		size_t		len = strcspn(p, ",");
+		const ZpqAlgorithm *algorithm = zpq_find_algorithm(p, len);
+
+		if (algorithm)
+			return algorithm->name;
+		p += len;
+		if (*p == ',')
+			p++;
+	}
+	return NULL;
+}
+
+/*
+ * Create a compression stream.
+ *
+ * rx_data is any input that was read from the transport before compression
+ * was switched on, but which belongs to the compressed stream.
+ *
+ * Returns NULL if the algorithm is unknown or we run out of memory.
+ */
+ZpqStream *
+zpq_create(const char *algorithm, zpq_tx_func tx_func, zpq_rx_func rx_func,
+		   void *arg, const char *rx_data, size_t rx_data_size)
+{
+	const ZpqAlgorithm *alg;
+	ZpqStream  *zs;
+
+	alg = zpq_find_algorithm(algorithm, strlen(algorithm));
+	if (alg == NULL)
+		return NULL;
+
+	zs = (ZpqStream *) malloc(sizeof(ZpqStream));
+	if (zs == NULL)
+		return NULL;
+	memset(zs, 0, sizeof(ZpqStream));
+
+	zs->rx_size = Max(ZPQ_BUFFER_SIZE, rx_data_size);
+	zs->rx_buf = malloc(zs->rx_size);
+	if (zs->rx_buf == NULL)
+	{
+		free(zs);
+		return NULL;
+	}
+
+	if (!alg->init(zs))
+	{
+		free(zs->rx_buf);
+		free(zs);
+		return NULL;
+	}
+
+	zs->algorithm = alg;
+	zs->tx_func = tx_func;
+	zs->rx_func = rx_func;
+	zs->arg = arg;
+
+	if (rx_data_size > 0)
+		memcpy(zs->rx_buf, rx_data, rx_data_size);
+	zs->rx_len = rx_data_size;
+
+	return zs;
+}
+
+/*
+ * Read up to size bytes of decompressed data.
+ *
+ * Returns the number of bytes read, or whatever rx_func returned (0 for
+ * EOF, -1 with errno set) if it had to be called and produced no data, or
+ * ZPQ_DECOMPRESS_ERROR if the input is corrupt.
+ */
+ssize_t
+zpq_read(ZpqStream *zs, void *buf, size_t size)
+{
+	if (size == 0)
+		return 0;
+
+	for (;;)
+	{
+		ssize_t		rc;
+
+		if (zs->rx_pos < zs->rx_len || zs->rx_more)
+		{
+			size_t		consumed = zs->rx_len - zs->rx_pos;
+			size_t		produced;
+
+			if (!zs->algorithm->decompress(zs, zs->rx_buf + zs->rx_pos,
+										   &consumed, buf, size, &produced,
+										   &zs->rx_more))
+				return ZPQ_DECOMPRESS_ERROR;
+
+			zs->rx_pos += consumed;
+			if (produced > 0)
+				return produced;
+
+			/* LZ4 may take its input in several steps */
+			if (consumed > 0)
+				continue;
+
+			if (zs->rx_pos < zs->rx_len)
+			{
+				zs->errmsg = "could not make progress decompressing data";
+				return ZPQ_DECOMPRESS_ERROR;
+			}
+		}
+
+		/* Everything received so far has been used up; get some more */
+		zs->rx_pos = zs->rx_len = 0;
+		rc = zs->rx_func(zs->arg, zs->rx_buf, zs->rx_size);
+		if (rc <= 0)
+			return rc;
+		zs->rx_len = rc;
+	}
+}
+
+/*
+ * Compress and send size bytes.
+ *
+ * Returns the number of input bytes consumed.  That includes data which has
+ * been compressed but not yet accepted by tx_func; the caller must go on
+ * calling zpq_write, with more data or with size 0, for as long as
+ * zpq_buffered_tx() says there is some.  If tx_func fails before any input
+ * was consumed, its result (-1 with errno set, typically EWOULDBLOCK) is
+ * returned, or ZPQ_COMPRESS_ERROR if compression fails.
+ */
+ssize_t
+zpq_write(ZpqStream *zs, const void *buf, size_t size)
+{
+	const char *in = (const char *) buf;
+	size_t		in_left = size;
+
+	for (;;)
+	{
+		size_t		consumed;
+		size_t		produced;
+
+		if (zs->tx_pos < zs->tx_len)
+		{
+			ssize_t		rc;
+
+			rc = zs->tx_func(zs->arg, zs->tx_buf + zs->tx_pos,
+							 zs->tx_len - zs->tx_pos);
+			if (rc <= 0)
+			{
+				consumed = size - in_left;
+
+				return consumed > 0 ? (ssize_t) consumed : rc;
+			}
+			zs->tx_pos += rc;
+			continue;
+		}
+
+		/* All compressed output is gone; are we done? */
+		if (in_left == 0 && !zs->tx_more)
+			break;
+
+		consumed = in_left;
+		if (!zs->algorithm->compress(zs, in, &consumed, zs->tx_buf,
+									 ZPQ_BUFFER_SIZE, &produced,
+									 &zs->tx_more))
+			return ZPQ_COMPRESS_ERROR;
+
+		if (in_left > 0 && consumed == 0 && produced == 0 && !zs->tx_more)
+		{
+			zs->errmsg = "could not make progress compressing data";
+			return ZPQ_COMPRESS_ERROR;
+		}
+
+		in += consumed;
+		in_left -= consumed;
+		zs->tx_pos = 0;
+		zs->tx_len = produced;
+	}
+
+	return size;
+}
+
+/*
+ * Is there decompressed data, or compressed input, that zpq_read can
+ * deliver without calling rx_func?  Callers that wait for the socket to
+ * become readable must check this first.
+ */
+bool
+zpq_buffered_rx(ZpqStream *zs)
+{
+	return zs->rx_pos < zs->rx_len || zs->rx_more;
+}
+
+/*
+ * Is there compressed output that hasn't been handed to tx_func yet?
+ */
+bool
+zpq_buffered_tx(ZpqStream *zs)
+{
+	return zs->tx_pos < zs->tx_len || zs->tx_more;
+}
+
+/*
+ * Describe the last compression or decompression failure.
+ */
+const char *
+zpq_error(ZpqStream *zs)
+{
+	return zs->errmsg ? zs->errmsg : "unknown error";
+}
+
+void
+zpq_free(ZpqStream *zs)
+{
+	if (zs == NULL)
+		return;
+	zs->algorithm->end(zs);
+	free(zs->rx_buf);
+	free(zs);
+}
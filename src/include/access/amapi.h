@@ -76,6 +76,15 @@ typedef bool (*aminsert_function) (Relation indexRelation,
 								   IndexUniqueCheck checkUnique,
 								   struct IndexInfo *indexInfo);
 
+/* delete-mark the entry for an in-place updated tuple, insert its new one */
+typedef void (*amdeletemark_function) (Relation indexRelation,
+									   Datum *oldvalues,
+									   bool *oldisnull,
+									   Datum *newvalues,
+									   bool *newisnull,
+									   ItemPointer heap_tid,
+									   Relation heapRelation);
+
 /* bulk delete */
 typedef IndexBulkDeleteResult *(*ambulkdelete_function) (IndexVacuumInfo *info,
 														 IndexBulkDeleteResult *stats,
@@ -197,6 +206,8 @@ typedef struct IndexAmRoutine
 	bool		amcanparallel;
 	/* does AM support columns included with clause INCLUDE? */
 	bool		amcaninclude;
+	/* does AM support delete-marking entries for in-place updates? */
+	bool		amcandeletemark;
 	/* type of data stored in index, or InvalidOid if variable */
 	Oid			amkeytype;
 
@@ -210,6 +221,7 @@ typedef struct IndexAmRoutine
 	ambuild_function ambuild;
 	ambuildempty_function ambuildempty;
 	aminsert_function aminsert;
+	amdeletemark_function amdeletemark; /* can be NULL */
 	ambulkdelete_function ambulkdelete;
 	amvacuumcleanup_function amvacuumcleanup;
 	amcanreturn_function amcanreturn;	/* can be NULL */
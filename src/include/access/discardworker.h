@@ -13,6 +13,16 @@
 #ifndef _DISCARDWORKER_H
 #define _DISCARDWORKER_H
 
+/* Upper limit for undo_discard_workers. */
+#define MAX_DISCARD_WORKERS		32
+
+/* GUC */
+extern PGDLLIMPORT int undo_discard_workers;
+
+extern Size DiscardWorkerShmemSize(void);
+extern void DiscardWorkerShmemInit(void);
+extern void DiscardWorkerWakeupIfNeeded(TransactionId xid, TransactionId xmin,
+										bool wrote_undo);
 extern void DiscardWorkerRegister(void);
 extern void DiscardWorkerMain(Datum main_arg) pg_attribute_noreturn();
 extern bool IsDiscardProcess(void);
@@ -137,6 +137,11 @@ extern bool index_insert(Relation indexRelation,
 						 Relation heapRelation,
 						 IndexUniqueCheck checkUnique,
 						 struct IndexInfo *indexInfo);
+extern void index_deletemark(Relation indexRelation,
+							 Datum *oldvalues, bool *oldisnull,
+							 Datum *newvalues, bool *newisnull,
+							 ItemPointer heap_t_ctid,
+							 Relation heapRelation);
 
 extern IndexScanDesc index_beginscan(Relation heapRelation,
 									 Relation indexRelation,
@@ -151,7 +156,8 @@ extern void index_rescan(IndexScanDesc scan,
 extern void index_endscan(IndexScanDesc scan);
 extern void index_markpos(IndexScanDesc scan);
 extern void index_restrpos(IndexScanDesc scan);
-extern Size index_parallelscan_estimate(Relation indexrel, Snapshot snapshot);
+extern Size index_parallelscan_estimate(Relation heaprel, Relation indexrel,
+										 Snapshot snapshot);
 extern void index_parallelscan_initialize(Relation heaprel, Relation indexrel,
 										  Snapshot snapshot, ParallelIndexScanDesc target);
 extern void index_parallelrescan(IndexScanDesc scan);
@@ -165,6 +171,11 @@ extern bool index_fetch_heap(IndexScanDesc scan, struct TupleTableSlot *slot);
 extern bool index_getnext_slot(IndexScanDesc scan, ScanDirection direction,
 							   struct TupleTableSlot *slot);
 extern int64 index_getbitmap(IndexScanDesc scan, TIDBitmap *bitmap);
+struct IndexTupleData;
+extern bool index_tuple_matches_slot(Relation indexRelation,
+									 struct IndexTupleData *itup,
+									 TupleDesc itupdesc,
+									 struct TupleTableSlot *slot);
 
 extern IndexBulkDeleteResult *index_bulk_delete(IndexVacuumInfo *info,
 												IndexBulkDeleteResult *stats,
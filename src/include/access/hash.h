@@ -427,7 +427,8 @@ extern HSpool *_h_spoolinit(Relation heap, Relation index, uint32 num_buckets);
 extern void _h_spooldestroy(HSpool *hspool);
 extern void _h_spool(HSpool *hspool, ItemPointer self,
 					 Datum *values, bool *isnull);
-extern void _h_indexbuild(HSpool *hspool, Relation heapRel);
+extern void _h_indexbuild(HSpool *hspool, Relation heapRel,
+						  double ntuples);
 
 /* hashutil.c */
 extern bool _hash_checkqual(IndexScanDesc scan, IndexTuple itup);
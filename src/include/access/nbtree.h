@@ -76,6 +76,7 @@ typedef BTPageOpaqueData *BTPageOpaque;
 #define BTP_SPLIT_END	(1 << 5)	/* rightmost page of split group */
 #define BTP_HAS_GARBAGE (1 << 6)	/* page has LP_DEAD tuples */
 #define BTP_INCOMPLETE_SPLIT (1 << 7)	/* right sibling's downlink is missing */
+#define BTP_DELETE_MARKED (1 << 8)	/* tuples may not match their heap tuple */
 
 /*
  * The max allowed value of a cycle ID is a bit less than 64K.  This is
@@ -194,6 +195,31 @@ typedef struct BTMetaPageData
 #define P_IGNORE(opaque)		(((opaque)->btpo_flags & (BTP_DELETED|BTP_HALF_DEAD)) != 0)
 #define P_HAS_GARBAGE(opaque)	(((opaque)->btpo_flags & BTP_HAS_GARBAGE) != 0)
 #define P_INCOMPLETE_SPLIT(opaque)	(((opaque)->btpo_flags & BTP_INCOMPLETE_SPLIT) != 0)
+#define P_HAS_DELETE_MARKED(opaque)	(((opaque)->btpo_flags & BTP_DELETE_MARKED) != 0)
+
+/*
+ * Delete-marking.  When a zheap tuple is updated in place and the update
+ * changes the indexed columns, the tuple keeps its TID, so the old index
+ * tuple can't simply go away: older snapshots may still see the old values.
+ * Instead, we delete-mark the old index tuple and insert one for the new
+ * values (or unmark an existing one, if the tuple returns to earlier values).
+ *
+ * The mark lives in the line pointer: nbtree has no other use for redirect
+ * line pointers, so a leaf item with LP_REDIRECT is delete-marked.  Like the
+ * LP_DEAD hint, the mark is not preserved when the page is split.  What scans
+ * rely on instead is BTP_DELETE_MARKED, which is set on every leaf page that
+ * has had a tuple marked, unmarked or inserted this way, and is inherited by
+ * both halves of a split.  Tuples on such a page must be compared with the
+ * heap tuple version they lead to before being returned (see xs_keycheck).
+ * VACUUM deletes the tuples that turn out to be stale, and clears the flag
+ * once none are left (see btvacuumstale).
+ */
+#define BTItemIdIsDeleteMarked(itemId) \
+	((itemId)->lp_flags == LP_REDIRECT)
+#define BTItemIdSetDeleteMarked(itemId) \
+	((itemId)->lp_flags = LP_REDIRECT)
+#define BTItemIdClearDeleteMarked(itemId) \
+	((itemId)->lp_flags = LP_NORMAL)
 
 /*
  *	Lehman and Yao's algorithm requires a ``high key'' on every non-rightmost
@@ -229,13 +255,13 @@ typedef struct BTMetaPageData
  * tuples (non-pivot tuples).  _bt_check_natts() enforces the rules
  * described here.
  *
- * Non-pivot tuple format:
+ * Non-pivot tuple format (plain/non-posting variant):
  *
  *  t_tid | t_info | key values | INCLUDE columns, if any
  *
  * t_tid points to the heap TID, which is a tiebreaker key column as of
- * BTREE_VERSION 4.  Currently, the INDEX_ALT_TID_MASK status bit is never
- * set for non-pivot tuples.
+ * BTREE_VERSION 4.  The INDEX_ALT_TID_MASK status bit is never set for
+ * plain non-pivot tuples.
  *
  * All other types of index tuples ("pivot" tuples) only have key columns,
  * since pivot tuples only exist to represent how the key space is
@@ -278,17 +304,31 @@ typedef struct BTMetaPageData
  *
  * The 12 least significant offset bits from t_tid are used to represent
  * the number of columns in INDEX_ALT_TID_MASK tuples, leaving 4 status
- * bits (BT_RESERVED_OFFSET_MASK bits), 3 of which that are reserved for
+ * bits (BT_RESERVED_OFFSET_MASK bits), 2 of which that are reserved for
  * future use.  BT_N_KEYS_OFFSET_MASK should be large enough to store any
  * number of columns/attributes <= INDEX_MAX_KEYS.
  *
+ * Non-pivot posting tuple format:
+ *
+ *  t_tid | t_info | key values | posting list (TID array)
+ *
+ * Posting tuples are formed by deduplication (see nbtdedup.c), which
+ * merges non-pivot tuples with equal keys into a single tuple holding a
+ * sorted array of heap TIDs.  They only appear on the leaf level of
+ * heapkeyspace indexes, and never have INCLUDE columns.  A posting tuple
+ * has INDEX_ALT_TID_MASK set, and BT_IS_POSTING is set in its t_tid
+ * offset, whose BT_N_KEYS_OFFSET_MASK bits then hold the number of heap
+ * TIDs rather than a number of attributes.  The t_tid block number holds
+ * the offset of the posting list from the start of the tuple.  Posting
+ * tuples are never pivot tuples: _bt_truncate removes the posting list
+ * when a new high key is formed from one.
+ *
  * Note well: The macros that deal with the number of attributes in tuples
- * assume that a tuple with INDEX_ALT_TID_MASK set must be a pivot tuple,
- * and that a tuple without INDEX_ALT_TID_MASK set must be a non-pivot
- * tuple (or must have the same number of attributes as the index has
- * generally in the case of !heapkeyspace indexes).  They will need to be
- * updated if non-pivot tuples ever get taught to use INDEX_ALT_TID_MASK
- * for something else.
+ * assume that a tuple with INDEX_ALT_TID_MASK set must be a pivot tuple
+ * unless BT_IS_POSTING is also set, and that a tuple without
+ * INDEX_ALT_TID_MASK set must be a non-pivot tuple (or must have the same
+ * number of attributes as the index has generally in the case of
+ * !heapkeyspace indexes).
  */
 #define INDEX_ALT_TID_MASK			INDEX_AM_RESERVED_BIT
 
@@ -296,6 +336,54 @@ typedef struct BTMetaPageData
 #define BT_RESERVED_OFFSET_MASK		0xF000
 #define BT_N_KEYS_OFFSET_MASK		0x0FFF
 #define BT_HEAP_TID_ATTR			0x1000
+#define BT_IS_POSTING				0x2000
+
+/*
+ * The largest number of heap TIDs a leaf page can hold, counting all the
+ * TIDs in posting lists.  That's what the items array of a scan position
+ * must have room for.
+ */
+#define MaxTIDsPerBTreePage \
+	(int) ((BLCKSZ - SizeOfPageHeaderData - sizeof(BTPageOpaqueData)) / \
+		   sizeof(ItemPointerData))
+
+#define BTreeTupleIsPivot(itup) \
+	( \
+		((itup)->t_info & INDEX_ALT_TID_MASK) != 0 && \
+		(ItemPointerGetOffsetNumberNoCheck(&(itup)->t_tid) & BT_IS_POSTING) == 0 \
+	)
+#define BTreeTupleIsPosting(itup) \
+	( \
+		((itup)->t_info & INDEX_ALT_TID_MASK) != 0 && \
+		(ItemPointerGetOffsetNumberNoCheck(&(itup)->t_tid) & BT_IS_POSTING) != 0 \
+	)
+
+/*
+ * Get/set the posting list of a posting tuple.  The posting list starts
+ * at a MAXALIGN'd offset, right after the key values.
+ */
+#define BTreeTupleSetPosting(itup, nhtids, off) \
+	do { \
+		Assert((nhtids) > 1 && ((nhtids) & BT_N_KEYS_OFFSET_MASK) == (nhtids)); \
+		Assert((off) == MAXALIGN(off)); \
+		(itup)->t_info |= INDEX_ALT_TID_MASK; \
+		ItemPointerSetOffsetNumber(&(itup)->t_tid, (nhtids) | BT_IS_POSTING); \
+		ItemPointerSetBlockNumber(&(itup)->t_tid, (off)); \
+	} while(0)
+#define BTreeTupleGetNPosting(itup) \
+	( \
+		AssertMacro(BTreeTupleIsPosting(itup)), \
+		ItemPointerGetOffsetNumberNoCheck(&(itup)->t_tid) & BT_N_KEYS_OFFSET_MASK \
+	)
+#define BTreeTupleGetPostingOffset(itup) \
+	( \
+		AssertMacro(BTreeTupleIsPosting(itup)), \
+		ItemPointerGetBlockNumberNoCheck(&(itup)->t_tid) \
+	)
+#define BTreeTupleGetPosting(itup) \
+	((ItemPointer) ((char *) (itup) + BTreeTupleGetPostingOffset(itup)))
+#define BTreeTupleGetPostingN(itup, n) \
+	(BTreeTupleGetPosting(itup) + (n))
 
 /* Get/set downlink block number */
 #define BTreeInnerTupleGetDownLink(itup) \
@@ -326,7 +414,7 @@ typedef struct BTMetaPageData
  */
 #define BTreeTupleGetNAtts(itup, rel)	\
 	( \
-		(itup)->t_info & INDEX_ALT_TID_MASK ? \
+		BTreeTupleIsPivot(itup) ? \
 		( \
 			ItemPointerGetOffsetNumberNoCheck(&(itup)->t_tid) & BT_N_KEYS_OFFSET_MASK \
 		) \
@@ -340,18 +428,32 @@ typedef struct BTMetaPageData
 	} while(0)
 
 /*
- * Get tiebreaker heap TID attribute, if any.  Macro works with both pivot
- * and non-pivot tuples, despite differences in how heap TID is represented.
+ * Get tiebreaker heap TID attribute, if any.  Macro works with pivot,
+ * posting and plain non-pivot tuples, despite differences in how heap TID
+ * is represented.  For a posting tuple, that's its lowest heap TID.
  */
 #define BTreeTupleGetHeapTID(itup) \
 	( \
-	  (itup)->t_info & INDEX_ALT_TID_MASK && \
-	  (ItemPointerGetOffsetNumberNoCheck(&(itup)->t_tid) & BT_HEAP_TID_ATTR) != 0 ? \
+	  BTreeTupleIsPivot(itup) ? \
 	  ( \
+		(ItemPointerGetOffsetNumberNoCheck(&(itup)->t_tid) & BT_HEAP_TID_ATTR) != 0 ? \
 		(ItemPointer) (((char *) (itup) + IndexTupleSize(itup)) - \
 					   sizeof(ItemPointerData)) \
+		: NULL \
 	  ) \
-	  : (itup)->t_info & INDEX_ALT_TID_MASK ? NULL : (ItemPointer) &((itup)->t_tid) \
+	  : BTreeTupleIsPosting(itup) ? BTreeTupleGetPosting(itup) \
+	  : (ItemPointer) &((itup)->t_tid) \
+	)
+/*
+ * Get the highest heap TID of a non-pivot tuple.  That's the last TID of
+ * the posting list of a posting tuple.
+ */
+#define BTreeTupleGetMaxHeapTID(itup) \
+	( \
+	  AssertMacro(!BTreeTupleIsPivot(itup)), \
+	  BTreeTupleIsPosting(itup) ? \
+	  BTreeTupleGetPostingN(itup, BTreeTupleGetNPosting(itup) - 1) \
+	  : (ItemPointer) &((itup)->t_tid) \
 	)
 /*
  * Set the heap TID attribute for a tuple that uses the INDEX_ALT_TID_MASK
@@ -508,10 +610,87 @@ typedef struct BTInsertStateData
 	bool		bounds_valid;
 	OffsetNumber low;
 	OffsetNumber stricthigh;
+
+	/*
+	 * if _bt_binsrch_insert found the location inside existing posting list,
+	 * save the position inside the list.  -1 sentinel value indicates overlap
+	 * with an existing posting list tuple that has its LP_DEAD bit set.
+	 */
+	int			postingoff;
 } BTInsertStateData;
 
 typedef BTInsertStateData *BTInsertState;
 
+/*
+ * A group of consecutive items on a leaf page that deduplication merges into
+ * a single posting list tuple.  Deduplication WAL records describe their
+ * changes this way.
+ */
+typedef struct BTDedupInterval
+{
+	OffsetNumber baseoff;
+	uint16		nitems;
+} BTDedupInterval;
+
+/*
+ * BTDedupStateData is a working area used during deduplication, both of an
+ * existing leaf page and of the leaf level during an index build.
+ *
+ * A pending posting list is comprised of a contiguous group of equal items,
+ * starting from page offset number 'baseoff' (if there is a page).  This is
+ * the "base" tuple for new posting list.  'nitems' is the current total
+ * number of existing items that will be merged to make a new posting list
+ * tuple, including the base tuple item.  (Existing items may themselves be
+ * posting list tuples, or regular non-pivot tuples.)  'htids' collects the
+ * heap TIDs of all of them, in order.
+ */
+typedef struct BTDedupStateData
+{
+	/* Deduplication status info for entire pass over page */
+	Size		maxpostingsize; /* Limit on size of final tuple */
+
+	/* Metadata about base tuple of current pending posting list */
+	IndexTuple	base;			/* Use to form new posting list */
+	OffsetNumber baseoff;		/* page offset of base */
+	Size		basetupsize;	/* base size without original posting list */
+
+	/* Other metadata about pending posting list */
+	ItemPointer htids;			/* Heap TIDs in pending posting list */
+	int			nhtids;			/* Number of heap TIDs in htids array */
+	int			nitems;			/* Number of existing tuples/line pointers */
+
+	/*
+	 * Array of posting list tuples to form on the page, one for each pending
+	 * posting list with more than one item.  Existing tuples that will not
+	 * become part of a posting list tuple do not appear in the array (they
+	 * are implicitly unchanged by deduplication pass).
+	 */
+	int			nintervals;		/* current number of intervals in array */
+	BTDedupInterval intervals[MaxIndexTuplesPerPage];
+} BTDedupStateData;
+
+typedef BTDedupStateData *BTDedupState;
+
+/*
+ * BTVacuumPostingData is state that represents how to VACUUM a posting list
+ * tuple when some (though not all) of its TIDs are to be deleted.
+ *
+ * Convention is that itup field is the original posting list tuple on input,
+ * and palloc()'d final tuple used to overwrite existing tuple on output.
+ */
+typedef struct BTVacuumPostingData
+{
+	/* Tuple that will be/was updated */
+	IndexTuple	itup;
+	OffsetNumber updatedoffset;
+
+	/* State needed to describe final itup in WAL */
+	uint16		ndeletedtids;
+	uint16		deletetids[FLEXIBLE_ARRAY_MEMBER];
+} BTVacuumPostingData;
+
+typedef BTVacuumPostingData *BTVacuumPosting;
+
 /*
  * BTScanOpaqueData is the btree-private state needed for an indexscan.
  * This consists of preprocessed scan keys (see _bt_preprocess_keys() for
@@ -562,6 +741,9 @@ typedef struct BTScanPosData
 	bool		moreLeft;
 	bool		moreRight;
 
+	/* Page had BTP_DELETE_MARKED set when we read it? */
+	bool		deletemarked;
+
 	/*
 	 * If we are doing an index-only scan, nextTupleOffset is the first free
 	 * location in the associated tuple storage workspace.
@@ -579,7 +761,7 @@ typedef struct BTScanPosData
 	int			lastItem;		/* last valid index in items[] */
 	int			itemIndex;		/* current index in items[] */
 
-	BTScanPosItem items[MaxIndexTuplesPerPage]; /* MUST BE LAST */
+	BTScanPosItem items[MaxTIDsPerBTreePage];	/* MUST BE LAST */
 } BTScanPosData;
 
 typedef BTScanPosData *BTScanPos;
@@ -626,6 +808,14 @@ typedef struct BTArrayKeyInfo
 	Datum	   *elem_values;	/* array of num_elems Datums */
 } BTArrayKeyInfo;
 
+/* A value of the first index column, as visited by a skip scan */
+typedef struct BTSkipValue
+{
+	bool		valid;			/* is there a value at all? */
+	bool		isnull;			/* is it NULL? */
+	Datum		value;			/* the value, if not NULL */
+} BTSkipValue;
+
 typedef struct BTScanOpaqueData
 {
 	/* these fields are set by _bt_preprocess_keys(): */
@@ -642,6 +832,21 @@ typedef struct BTScanOpaqueData
 	BTArrayKeyInfo *arrayKeys;	/* info about each equality-type array key */
 	MemoryContext arrayContext; /* scan-lifespan context for array data */
 
+	/*
+	 * Workspace for skip scans.  skipKeyData holds an equality key on the
+	 * first index column for skipCur, followed by a copy of scan->keyData.
+	 * skipNext is the value after skipCur in scan direction skipNextDir, if
+	 * we happened to see it while reading a page.
+	 */
+	bool		skipScan;		/* skipping over first column values? */
+	ScanKey		skipKeyData;	/* modified copy of scan->keyData */
+	BTSkipValue skipCur;		/* value of the current primitive scan */
+	BTSkipValue skipNext;		/* the next value, if known */
+	ScanDirection skipNextDir;
+	BTSkipValue skipMark;		/* value at the marked position */
+	FmgrInfo	skipEqProc;		/* equality operator of the first column */
+	MemoryContext skipContext;	/* scan-lifespan context for skip data */
+
 	/* info about killed items if any (killedItems is NULL if never used) */
 	int		   *killedItems;	/* currPos.items indexes of killed items */
 	int			numKilled;		/* number of currently stored items */
@@ -699,6 +904,9 @@ extern bool btinsert(Relation rel, Datum *values, bool *isnull,
 					 ItemPointer ht_ctid, Relation heapRel,
 					 IndexUniqueCheck checkUnique,
 					 struct IndexInfo *indexInfo);
+extern void btdeletemark(Relation rel, Datum *oldvalues, bool *oldisnull,
+						 Datum *newvalues, bool *newisnull,
+						 ItemPointer ht_ctid, Relation heapRel);
 extern IndexScanDesc btbeginscan(Relation rel, int nkeys, int norderbys);
 extern Size btestimateparallelscan(void);
 extern void btinitparallelscan(void *target);
@@ -731,9 +939,28 @@ extern void _bt_parallel_advance_array_keys(IndexScanDesc scan);
  */
 extern bool _bt_doinsert(Relation rel, IndexTuple itup,
 						 IndexUniqueCheck checkUnique, Relation heapRel);
+extern void _bt_deletemark(Relation rel, IndexTuple olditup,
+						   IndexTuple newitup, Relation heapRel);
 extern Buffer _bt_getstackbuf(Relation rel, BTStack stack);
 extern void _bt_finish_split(Relation rel, Buffer bbuf, BTStack stack);
 
+/*
+ * prototypes for functions in nbtdedup.c
+ */
+extern bool _bt_dedup_allowed(Relation rel);
+extern void _bt_dedup_one_page(Relation rel, Buffer buf);
+extern void _bt_dedup_start_pending(BTDedupState state, IndexTuple base,
+									OffsetNumber baseoff);
+extern bool _bt_dedup_save_htid(BTDedupState state, IndexTuple itup);
+extern void _bt_dedup_apply(Page page, BTDedupInterval *intervals,
+							int nintervals);
+extern IndexTuple _bt_form_posting(IndexTuple base, ItemPointer htids,
+								   int nhtids);
+extern void _bt_update_posting(BTVacuumPosting vacposting);
+extern IndexTuple _bt_swap_posting(IndexTuple newitem, IndexTuple oposting,
+								   int postingoff);
+extern bool _bt_posting_contains(IndexTuple posting, ItemPointer htid);
+
 /*
  * prototypes for functions in nbtsplitloc.c
  */
@@ -747,6 +974,7 @@ extern OffsetNumber _bt_findsplitloc(Relation rel, Page page,
 extern void _bt_initmetapage(Page page, BlockNumber rootbknum, uint32 level);
 extern void _bt_update_meta_cleanup_info(Relation rel,
 										 TransactionId oldestBtpoXact, float8 numHeapTuples);
+extern void _bt_request_cleanup(Relation rel);
 extern void _bt_upgrademetapage(Page page);
 extern Buffer _bt_getroot(Relation rel, int access);
 extern Buffer _bt_gettrueroot(Relation rel);
@@ -761,8 +989,11 @@ extern void _bt_pageinit(Page page, Size size);
 extern bool _bt_page_recyclable(Page page);
 extern void _bt_delitems_delete(Relation rel, Buffer buf,
 								OffsetNumber *itemnos, int nitems, Relation heapRel);
+extern bool _bt_deletemark_item(Relation rel, Buffer buf,
+								OffsetNumber offnum, bool marked);
 extern void _bt_delitems_vacuum(Relation rel, Buffer buf,
-								OffsetNumber *itemnos, int nitems,
+								OffsetNumber *deletable, int ndeletable,
+								BTVacuumPosting *updatable, int nupdatable,
 								BlockNumber lastBlockVacuumed);
 extern int	_bt_pagedel(Relation rel, Buffer buf);
 
@@ -775,8 +1006,11 @@ extern Buffer _bt_moveright(Relation rel, BTScanInsert key, Buffer buf,
 							bool forupdate, BTStack stack, int access, Snapshot snapshot);
 extern OffsetNumber _bt_binsrch_insert(Relation rel, BTInsertState insertstate);
 extern int32 _bt_compare(Relation rel, BTScanInsert key, Page page, OffsetNumber offnum);
+extern Buffer _bt_finditem(Relation rel, BTScanInsert key, ItemPointer htid,
+						   OffsetNumber *offnum);
 extern bool _bt_first(IndexScanDesc scan, ScanDirection dir);
 extern bool _bt_next(IndexScanDesc scan, ScanDirection dir);
+extern bool _bt_find_skip_value(IndexScanDesc scan, ScanDirection dir);
 extern Buffer _bt_get_endpoint(Relation rel, uint32 level, bool rightmost,
 							   Snapshot snapshot);
 
@@ -790,6 +1024,13 @@ extern void _bt_start_array_keys(IndexScanDesc scan, ScanDirection dir);
 extern bool _bt_advance_array_keys(IndexScanDesc scan, ScanDirection dir);
 extern void _bt_mark_array_keys(IndexScanDesc scan);
 extern void _bt_restore_array_keys(IndexScanDesc scan);
+extern void _bt_preprocess_skip_key(IndexScanDesc scan);
+extern void _bt_save_skip_value(IndexScanDesc scan, BTSkipValue *skipval,
+								Datum value, bool isnull);
+extern bool _bt_start_skip_key(IndexScanDesc scan, ScanDirection dir);
+extern bool _bt_advance_skip_key(IndexScanDesc scan, ScanDirection dir);
+extern void _bt_mark_skip_key(IndexScanDesc scan);
+extern void _bt_restore_skip_key(IndexScanDesc scan);
 extern void _bt_preprocess_keys(IndexScanDesc scan);
 extern bool _bt_checkkeys(IndexScanDesc scan, IndexTuple tuple,
 						  int tupnatts, ScanDirection dir, bool *continuescan);
@@ -811,6 +1052,7 @@ extern int	_bt_keep_natts_fast(Relation rel, IndexTuple lastleft,
 								IndexTuple firstright);
 extern bool _bt_check_natts(Relation rel, bool heapkeyspace, Page page,
 							OffsetNumber offnum);
+extern bool _bt_allequalimage(Relation rel);
 extern void _bt_check_third_page(Relation rel, Relation heap,
 								 bool needheaptidspace, Page page, IndexTuple newtup);
 
@@ -28,7 +28,8 @@
 #define XLOG_BTREE_INSERT_META	0x20	/* same, plus update metapage */
 #define XLOG_BTREE_SPLIT_L		0x30	/* add index tuple with split */
 #define XLOG_BTREE_SPLIT_R		0x40	/* as above, new item on right */
-/* 0x50 and 0x60 are unused */
+#define XLOG_BTREE_INSERT_POST	0x50	/* add index tuple with posting split */
+#define XLOG_BTREE_DEDUP		0x60	/* deduplicate tuples for a page */
 #define XLOG_BTREE_DELETE		0x70	/* delete leaf index tuples for a page */
 #define XLOG_BTREE_UNLINK_PAGE	0x80	/* delete a half-dead page */
 #define XLOG_BTREE_UNLINK_PAGE_META 0x90	/* same, and update metapage */
@@ -40,6 +41,8 @@
 										 * FSM */
 #define XLOG_BTREE_META_CLEANUP	0xE0	/* update cleanup-related data in the
 										 * metapage */
+#define XLOG_BTREE_DELETE_MARK	0xF0	/* delete-mark or unmark a leaf index
+										 * tuple */
 
 /*
  * All that we need to regenerate the meta-data page
@@ -58,12 +61,21 @@ typedef struct xl_btree_metadata
 /*
  * This is what we need to know about simple (without split) insert.
  *
- * This data record is used for INSERT_LEAF, INSERT_UPPER, INSERT_META.
- * Note that INSERT_META implies it's not a leaf page.
+ * This data record is used for INSERT_LEAF, INSERT_UPPER, INSERT_META, and
+ * INSERT_POST.  Note that INSERT_META and INSERT_UPPER implies it's not a
+ * leaf page, while INSERT_POST and INSERT_LEAF imply that it must be a leaf
+ * page.
  *
- * Backup Blk 0: original page (data contains the inserted tuple)
+ * Backup Blk 0: original page
  * Backup Blk 1: child's left sibling, if INSERT_UPPER or INSERT_META
  * Backup Blk 2: xl_btree_metadata, if INSERT_META
+ *
+ * Note: The new tuple is actually the "original" new item in the posting
+ * list split insert case (i.e. the INSERT_POST case).  A split offset for
+ * the posting list is logged before the original new item.  Recovery needs
+ * both, since it must do an in-place update of the existing posting list
+ * that was split as an extra step.  Also, recovery generates a "final"
+ * newitem.  See _bt_swap_posting() for details on posting list splits.
  */
 typedef struct xl_btree_insert
 {
@@ -90,11 +102,19 @@ typedef struct xl_btree_insert
  * attributes in the right page (the original is unavailable from the right
  * page).
  *
+ * If the split of a leaf page also splits a posting list tuple that ends up
+ * on the left page, postingoff is set to its split offset, and the original
+ * new item is logged instead of the final one: recovery repeats the posting
+ * list split, just like for an INSERT_POST record.  The posting list tuple
+ * is always the item right before the new item (if both went to the right
+ * page, the posting list split is implied by the right page's tuples, and
+ * postingoff is 0).
+ *
  * Backup Blk 0: original page / new left page
  *
- * The left page's data portion contains the new item, if it's the _L variant.
- * An IndexTuple representing the high key of the left page must follow with
- * either variant.
+ * The left page's data portion contains the new item, if it's the _L variant,
+ * or the original new item if postingoff is set.  An IndexTuple representing
+ * the high key of the left page must follow with either variant.
  *
  * Backup Blk 1: new right page
  *
@@ -113,9 +133,30 @@ typedef struct xl_btree_split
 	uint32		level;			/* tree level of page being split */
 	OffsetNumber firstright;	/* first item moved to right page */
 	OffsetNumber newitemoff;	/* new item's offset (if placed on left page) */
+	uint16		postingoff;		/* offset inside orig posting tuple */
+	bool		deletemarked;	/* original page had BTP_DELETE_MARKED set */
 } xl_btree_split;
 
-#define SizeOfBtreeSplit	(offsetof(xl_btree_split, newitemoff) + sizeof(OffsetNumber))
+#define SizeOfBtreeSplit	(offsetof(xl_btree_split, deletemarked) + sizeof(bool))
+
+/*
+ * When page is deduplicated, consecutive groups of tuples with equal keys are
+ * merged together into posting list tuples.
+ *
+ * The WAL record represents a deduplication pass for a leaf page.  An array
+ * of BTDedupInterval structs follows, describing the groups of items that
+ * were merged.  Recovery merges them again.
+ *
+ * Backup Blk 0: leaf page
+ */
+typedef struct xl_btree_dedup
+{
+	uint16		nintervals;
+
+	/* DEDUPLICATION INTERVALS FOLLOW */
+} xl_btree_dedup;
+
+#define SizeOfBtreeDedup	(offsetof(xl_btree_dedup, nintervals) + sizeof(uint16))
 
 /*
  * This is what we need to know about delete of individual leaf index tuples.
@@ -134,6 +175,23 @@ typedef struct xl_btree_delete
 
 #define SizeOfBtreeDelete	(offsetof(xl_btree_delete, nitems) + sizeof(int))
 
+/*
+ * This is what we need to know about delete-marking a leaf index tuple, or
+ * removing its delete-mark, as done for in-place updates of the table.  The
+ * page gets BTP_DELETE_MARKED in either case.  If offnum is
+ * InvalidOffsetNumber, only the page flag is set; that's done before a new
+ * tuple for an in-place update is inserted.
+ *
+ * Backup Blk 0: leaf page
+ */
+typedef struct xl_btree_delete_mark
+{
+	OffsetNumber offnum;		/* tuple to mark or unmark, if any */
+	bool		marked;			/* new state of the tuple's delete-mark */
+} xl_btree_delete_mark;
+
+#define SizeOfBtreeDeleteMark	(offsetof(xl_btree_delete_mark, marked) + sizeof(bool))
+
 /*
  * This is what we need to know about page reuse within btree.
  */
@@ -168,15 +226,38 @@ typedef struct xl_btree_reuse_page
  *
  * Note that the *last* WAL record in any vacuum of an index is allowed to
  * have a zero length array of offsets. Earlier records must have at least one.
+ *
+ * VACUUM may also remove some, but not all, of the heap TIDs of a posting
+ * list tuple.  Such a tuple is updated in place with a smaller one.  The
+ * block data contains the array of deleted offset numbers, then the array of
+ * updated offset numbers, then one xl_btree_update (followed by its array of
+ * posting list offsets) for each updated tuple.
  */
 typedef struct xl_btree_vacuum
 {
 	BlockNumber lastBlockVacuumed;
+	uint16		ndeleted;
+	uint16		nupdated;
 
-	/* TARGET OFFSET NUMBERS FOLLOW */
+	/* DELETED TARGET OFFSET NUMBERS FOLLOW */
+	/* UPDATED TARGET OFFSET NUMBERS FOLLOW */
+	/* UPDATED TUPLES METADATA (xl_btree_update) ARRAY FOLLOWS */
 } xl_btree_vacuum;
 
-#define SizeOfBtreeVacuum	(offsetof(xl_btree_vacuum, lastBlockVacuumed) + sizeof(BlockNumber))
+#define SizeOfBtreeVacuum	(offsetof(xl_btree_vacuum, nupdated) + sizeof(uint16))
+
+/*
+ * The heap TIDs removed from a posting list tuple by VACUUM, given as
+ * offsets into its original posting list.
+ */
+typedef struct xl_btree_update
+{
+	uint16		ndeletedtids;
+
+	/* POSTING LIST uint16 OFFSETS TO A DELETED TID FOLLOW */
+} xl_btree_update;
+
+#define SizeOfBtreeUpdate	(offsetof(xl_btree_update, ndeletedtids) + sizeof(uint16))
 
 /*
  * This is what we need to know about marking an empty branch for deletion.
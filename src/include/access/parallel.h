@@ -27,6 +27,8 @@ typedef struct ParallelWorkerInfo
 	BackgroundWorkerHandle *bgwhandle;
 	shm_mq_handle *error_mqh;
 	int32		pid;
+	int			pool_slot;		/* slot of pooled worker, or -1 */
+	uint64		pool_generation;	/* assignment made to that slot */
 } ParallelWorkerInfo;
 
 typedef struct ParallelContext
@@ -57,6 +59,9 @@ extern volatile bool ParallelMessagePending;
 extern PGDLLIMPORT int ParallelWorkerNumber;
 extern PGDLLIMPORT bool InitializingParallelWorker;
 
+/* GUC variable */
+extern int	parallel_worker_pool_size;
+
 #define		IsParallelWorker()		(ParallelWorkerNumber >= 0)
 
 extern ParallelContext *CreateParallelContext(const char *library_name,
@@ -77,4 +82,8 @@ extern void ParallelWorkerReportLastRecEnd(XLogRecPtr last_xlog_end);
 
 extern void ParallelWorkerMain(Datum main_arg);
 
+extern Size ParallelWorkerPoolShmemSize(void);
+extern void ParallelWorkerPoolShmemInit(void);
+extern void TerminatePooledParallelWorkers(Oid databaseId);
+
 #endif							/* PARALLEL_H */
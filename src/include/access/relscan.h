@@ -81,6 +81,19 @@ typedef struct ParallelBlockTableScanDescData
 }			ParallelBlockTableScanDescData;
 typedef struct ParallelBlockTableScanDescData *ParallelBlockTableScanDesc;
 
+/*
+ * Per backend state for parallel table scans, for block oriented storage.
+ * Blocks are claimed from the shared counter in chunks, which are then
+ * handed out one at a time from here.
+ */
+typedef struct ParallelBlockTableScanWorkerData
+{
+	uint64		phsw_nallocated;	/* current # of blocks into the scan */
+	uint32		phsw_chunk_remaining;	/* # blocks left in this chunk */
+	uint32		phsw_chunk_size;	/* # blocks to claim at a time */
+}			ParallelBlockTableScanWorkerData;
+typedef struct ParallelBlockTableScanWorkerData *ParallelBlockTableScanWorker;
+
 /*
  * Base class for fetches from a table via an index. This is the base-class
  * for such scans, which needs to be embedded in the respective struct for
@@ -89,8 +102,27 @@ typedef struct ParallelBlockTableScanDescData *ParallelBlockTableScanDesc;
 typedef struct IndexFetchTableData
 {
 	Relation	rel;
+	void	   *pshared;		/* table AM's part of the shared state of a
+								 * parallel index scan, or NULL */
 } IndexFetchTableData;
 
+/*
+ * Shared state of the zheap index fetches of a parallel index scan.  When an
+ * index fetch moves to a new page, it checks whether the page can be marked
+ * all-visible, and whether it should be pruned.  The participants of a
+ * parallel scan tend to visit the same pages, so the block numbers of the
+ * pages that were checked are remembered here, in a lossy way, and the other
+ * participants don't check them again.
+ */
+#define ZHEAP_FETCH_SHARED_BLOCKS	1024
+
+typedef struct ZHeapIndexFetchShared
+{
+	pg_atomic_uint32 visited[ZHEAP_FETCH_SHARED_BLOCKS];	/* indexed by block
+															 * number modulo
+															 * the size */
+} ZHeapIndexFetchShared;
+
 
 typedef struct IndexFetchZHeapData
 {
@@ -98,6 +130,23 @@ typedef struct IndexFetchZHeapData
 
 	Buffer		xs_cbuf;		/* current heap buffer in scan, if any */
 	/* NB: if xs_cbuf is not InvalidBuffer, we hold a pin on that buffer */
+	Buffer		xs_vmbuf;		/* visibility map buffer, if any */
+
+	/*
+	 * Once two consecutive TIDs are fetched from the same page, the tuples
+	 * of the page visible to the snapshot are copied out at once, and the
+	 * following TIDs of the page are served from the copies without locking
+	 * it again.  xs_batchtups[offnum] is NULL if no version of the tuple is
+	 * visible, and xs_batchdead[offnum] tells that the item is unused or
+	 * dead.
+	 */
+	bool		xs_batched;		/* copies of xs_cbuf's tuples are valid */
+	struct SnapshotData *xs_batchsnap;	/* snapshot the copies are for */
+	CommandId	xs_batchcid;	/* the snapshot's curcid at the time */
+	OffsetNumber xs_batchmaxoff;	/* last item of the page copied */
+	struct ZHeapTupleData **xs_batchtups;
+	bool	   *xs_batchdead;
+	MemoryContext xs_batchcxt;	/* memory holding the copies */
 }			IndexFetchZHeapData;
 
 /*
@@ -116,6 +165,7 @@ typedef struct IndexScanDescData
 	struct ScanKeyData *keyData;	/* array of index qualifier descriptors */
 	struct ScanKeyData *orderByData;	/* array of ordering op descriptors */
 	bool		xs_want_itup;	/* caller requests index tuples */
+	bool		xs_skipscan;	/* planner costed the scan as a skip scan */
 	bool		xs_temp_snap;	/* unregister snapshot at scan end? */
 
 	/* signaling to index AM about killing index tuples */
@@ -144,6 +194,8 @@ typedef struct IndexScanDescData
 	IndexFetchTableData *xs_heapfetch;
 
 	bool		xs_recheck;		/* T means scan keys must be rechecked */
+	bool		xs_keycheck;	/* T means xs_itup must be checked against the
+								 * fetched table tuple; see index_fetch_heap */
 
 	/*
 	 * When fetching with an ordering operator, the values of the ORDER BY
@@ -165,6 +217,8 @@ typedef struct ParallelIndexScanDescData
 {
 	Oid			ps_relid;
 	Oid			ps_indexid;
+	Size		ps_tableam_offset;	/* Offset in bytes of table am specific
+									 * structure, or 0 if none */
 	Size		ps_offset;		/* Offset in bytes of am specific structure */
 	char		ps_snapshot_data[FLEXIBLE_ARRAY_MEMBER];
 }			ParallelIndexScanDescData;
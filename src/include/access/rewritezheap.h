@@ -14,10 +14,14 @@
 #define REWRITE_ZHEAP_H
 
 #include "access/zhtup.h"
+#include "storage/dsm.h"
+#include "storage/shm_toc.h"
 #include "utils/relcache.h"
+#include "utils/tuplesort.h"
 
-/* struct definition is private to rewritezheap.c */
+/* struct definitions are private to rewritezheap.c */
 typedef struct RewriteZheapStateData *RewriteZheapState;
+typedef struct ZHeapParallelClusterData *ZHeapParallelCluster;
 
 extern RewriteZheapState begin_zheap_rewrite(Relation OldHeap, Relation NewHeap,
 											 TransactionId OldestXmin, TransactionId FreezeXid,
@@ -29,4 +33,16 @@ extern void reform_and_rewrite_ztuple(TupleDesc oldTupDesc,
 extern void rewrite_zheap_tuple(RewriteZheapState state,
 								ZHeapTuple newTuple);
 
+extern ZHeapParallelCluster begin_zheap_parallel_cluster(Relation OldHeap,
+														 Relation OldIndex,
+														 int request);
+extern Tuplesortstate *zheap_parallel_cluster_sort(ZHeapParallelCluster pcluster,
+												   double *num_tuples);
+extern void end_zheap_parallel_cluster(ZHeapParallelCluster pcluster,
+									   Tuplesortstate *tuplesort);
+extern void zheap_parallel_cluster_main(dsm_segment *seg, shm_toc *toc);
+
+extern double zheap_rewrite_table(Relation OldHeap, Relation NewHeap);
+extern void zheap_parallel_rewrite_main(dsm_segment *seg, shm_toc *toc);
+
 #endif							/* REWRITE_ZHEAP_H */
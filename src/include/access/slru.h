@@ -35,6 +35,16 @@
 /* Maximum length of an SLRU name */
 #define SLRU_MAX_NAME_LENGTH	32
 
+/*
+ * Number of buffer slots in each bank.  A page can only be held by the slots
+ * of one bank, so lookups and victim selection scan just that bank.  SLRUs
+ * whose size is not a multiple of this have all their slots in one bank.
+ */
+#define SLRU_BANK_SIZE			16
+
+/* Largest value accepted by the *_buffers GUCs */
+#define SLRU_MAX_ALLOWED_BUFFERS	((1024 * 1024 * 1024) / BLCKSZ)
+
 /*
  * Page status codes.  Note that these do not include the "dirty" bit.
  * page_dirty can be true only in the VALID or WRITE_IN_PROGRESS states;
@@ -54,11 +64,22 @@ typedef enum
  */
 typedef struct SlruSharedData
 {
+	/*
+	 * Lock protecting all banks, or NULL if each bank has its own lock in
+	 * bank_locks[].
+	 */
 	LWLock	   *ControlLock;
 
 	/* Number of buffers managed by this SLRU structure */
 	int			num_slots;
 
+	/*
+	 * The slots are divided into num_banks banks of bank_size consecutive
+	 * slots.  Page pageno may only be held by bank (pageno % num_banks).
+	 */
+	int			num_banks;
+	int			bank_size;
+
 	/*
 	 * Arrays holding info for each buffer slot.  Page number is undefined
 	 * when status is EMPTY, as is page_lru_count.
@@ -82,19 +103,21 @@ typedef struct SlruSharedData
 
 	/*----------
 	 * We mark a page "most recently used" by setting
-	 *		page_lru_count[slotno] = ++cur_lru_count;
-	 * The oldest page is therefore the one with the highest value of
-	 *		cur_lru_count - page_lru_count[slotno]
+	 *		page_lru_count[slotno] = ++bank_cur_lru_count[bankno];
+	 * The oldest page in a bank is therefore the one with the highest value
+	 * of
+	 *		bank_cur_lru_count[bankno] - page_lru_count[slotno]
 	 * The counts will eventually wrap around, but this calculation still
 	 * works as long as no page's age exceeds INT_MAX counts.
 	 *----------
 	 */
-	int			cur_lru_count;
+	int		   *bank_cur_lru_count;
 
 	/*
 	 * latest_page_number is the page number of the current end of the log;
 	 * this is not critical data, since we use it only to avoid swapping out
-	 * the latest page.
+	 * the latest page.  When the banks have their own locks it is updated
+	 * under the latest page's bank lock and may be read without any lock.
 	 */
 	int			latest_page_number;
 
@@ -102,6 +125,9 @@ typedef struct SlruSharedData
 	int			lwlock_tranche_id;
 	char		lwlock_tranche_name[SLRU_MAX_NAME_LENGTH];
 	LWLockPadded *buffer_locks;
+	int			bank_tranche_id;
+	char		bank_tranche_name[SLRU_MAX_NAME_LENGTH];
+	LWLockPadded *bank_locks;
 } SlruSharedData;
 
 typedef SlruSharedData *SlruShared;
@@ -136,10 +162,26 @@ typedef struct SlruCtlData
 
 typedef SlruCtlData *SlruCtl;
 
+/*
+ * Get the lock that must be held to access the given page of the SLRU.
+ */
+static inline LWLock *
+SimpleLruGetBankLock(SlruCtl ctl, int pageno)
+{
+	SlruShared	shared = ctl->shared;
+
+	if (shared->ControlLock != NULL)
+		return shared->ControlLock;
+	return &shared->bank_locks[(uint32) pageno % shared->num_banks].lock;
+}
+
 
 extern Size SimpleLruShmemSize(int nslots, int nlsns);
 extern void SimpleLruInit(SlruCtl ctl, const char *name, int nslots, int nlsns,
-						  LWLock *ctllock, const char *subdir, int tranche_id);
+						  LWLock *ctllock, const char *subdir, int tranche_id,
+						  int bank_tranche_id);
+extern int	SimpleLruAutotuneBuffers(int divisor, int max);
+extern bool check_slru_buffers(const char *name, int *newval);
 extern int	SimpleLruZeroPage(SlruCtl ctl, int pageno);
 extern int	SimpleLruReadPage(SlruCtl ctl, int pageno, bool write_ok,
 							  TransactionId xid);
@@ -138,6 +138,7 @@ typedef struct TM_FailureData
 #define TABLE_INSERT_SKIP_FSM		0x0002
 #define TABLE_INSERT_FROZEN			0x0004
 #define TABLE_INSERT_NO_LOGICAL		0x0008
+#define TABLE_INSERT_PARALLEL		0x0020
 
 /* flag bits for table_tuple_lock */
 /* Follow tuples whose update is in progress if lock modes don't conflict  */
@@ -284,6 +285,15 @@ typedef struct TableAmRoutine
 	 */
 	void		(*index_fetch_end) (struct IndexFetchTableData *data);
 
+	/*
+	 * Optional callbacks to estimate the size of, and to initialize, state
+	 * that the index fetches of the participants of a parallel index scan
+	 * share.  The state is made available to index_fetch_tuple in the
+	 * pshared field of IndexFetchTableData; it is NULL for other scans.
+	 */
+	Size		(*index_fetch_parallel_estimate) (Relation rel);
+	void		(*index_fetch_parallel_initialize) (Relation rel, void *pshared);
+
 	/*
 	 * Fetch tuple at `tid` into `slot`, after doing a visibility test
 	 * according to `snapshot`. If a tuple was found and passed the visibility
@@ -962,6 +972,28 @@ table_index_fetch_end(struct IndexFetchTableData *scan)
 	scan->rel->rd_tableam->index_fetch_end(scan);
 }
 
+/*
+ * Estimate the size of the table AM's state shared by the index fetches of a
+ * parallel index scan.  Returns 0 if the AM doesn't need any.
+ */
+static inline Size
+table_index_fetch_parallel_estimate(Relation rel)
+{
+	if (rel->rd_tableam->index_fetch_parallel_estimate == NULL)
+		return 0;
+	return rel->rd_tableam->index_fetch_parallel_estimate(rel);
+}
+
+/*
+ * Initialize the table AM's state shared by the index fetches of a parallel
+ * index scan; `pshared` was sized by table_index_fetch_parallel_estimate().
+ */
+static inline void
+table_index_fetch_parallel_initialize(Relation rel, void *pshared)
+{
+	rel->rd_tableam->index_fetch_parallel_initialize(rel, pshared);
+}
+
 /*
  * Fetches, as part of an index scan, tuple at `tid` into `slot`, after doing
  * a visibility test according to `snapshot`. If a tuple was found and passed
@@ -1115,6 +1147,11 @@ table_compute_xid_horizon_for_tuples(Relation rel,
  * where RelationIsLogicallyLogged(relation) is not yet accurate for the new
  * relation.
  *
+ * TABLE_INSERT_PARALLEL declares that the caller is a parallel worker that
+ * cooperates with the rest of its lock group in filling the relation, as
+ * parallel COPY FROM does.  AMs that cannot insert from parallel workers
+ * should keep rejecting such inserts.
+ *
  * Note that most of these options will be applied when inserting into the
  * heap's TOAST table, too, if the tuple requires any out-of-line data.
  *
@@ -1729,8 +1766,10 @@ extern Size table_block_parallelscan_initialize(Relation rel,
 extern void table_block_parallelscan_reinitialize(Relation rel,
 												  ParallelTableScanDesc pscan);
 extern BlockNumber table_block_parallelscan_nextpage(Relation rel,
+													 ParallelBlockTableScanWorker pbscanwork,
 													 ParallelBlockTableScanDesc pbscan);
 extern void table_block_parallelscan_startblock_init(Relation rel,
+													 ParallelBlockTableScanWorker pbscanwork,
 													 ParallelBlockTableScanDesc pbscan);
 
 
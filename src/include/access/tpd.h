@@ -40,6 +40,16 @@ typedef TPDPageOpaqueData *TPDPageOpaque;
 #define IsTPDPage(page) \
 	(PageGetSpecialSize(page) == MAXALIGN(sizeof(TPDPageOpaqueData)))
 
+/*
+ * TPDPageIsFree
+ * 		returns true iff TPD page is on the free list of the metapage.
+ *
+ * Pages in the TPD chain link back to another TPD page or to nothing, so a
+ * free page is marked by linking back to the metapage instead.
+ */
+#define TPDPageIsFree(page) \
+	(((TPDPageOpaque) PageGetSpecialPointer(page))->tpd_prevblkno == ZHEAP_METAPAGE)
+
 /* TPD entry information */
 #define INITIAL_TRANS_SLOTS_IN_TPD_ENTRY	8
 /*
@@ -121,6 +131,8 @@ extern void TPDPageSetOffsetMapSlot(Buffer heapbuf, int trans_slot_id,
 									OffsetNumber offset);
 extern void TPDPageGetOffsetMap(Buffer heapbuf, char *tpd_entry_data,
 								int map_size);
+extern char *TPDPageGetOffsetMapData(Buffer heapbuf, int *num_entries,
+									   int *entry_size);
 extern int	TPDPageGetOffsetMapSize(Buffer heapbuf);
 extern void TPDPageSetOffsetMap(Buffer heapbuf, char *tpd_offset_map);
 extern bool TPDPageLock(Relation relation, Buffer heapbuf);
@@ -70,9 +70,10 @@ typedef struct xl_tpd_free_page
 {
 	BlockNumber prevblkno;
 	BlockNumber nextblkno;
+	BlockNumber nextfreeblkno;	/* next page on the free list */
 } xl_tpd_free_page;
 
-#define SizeOfTPDFreePage	(offsetof(xl_tpd_free_page, nextblkno) + sizeof(BlockNumber))
+#define SizeOfTPDFreePage	(offsetof(xl_tpd_free_page, nextfreeblkno) + sizeof(BlockNumber))
 
 extern void tpd_redo(XLogReaderState *record);
 extern void tpd_desc(StringInfo buf, XLogReaderState *record);
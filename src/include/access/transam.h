@@ -202,6 +202,14 @@ typedef struct VariableCacheData
 	TransactionId latestCompletedXid;	/* newest XID that has committed or
 										 * aborted */
 
+	/*
+	 * Bumped whenever the set of running xids visible to GetSnapshotData()
+	 * shrinks, i.e. when a transaction with an xid completes in some form.
+	 * GetSnapshotData() uses it to decide whether a previously computed
+	 * snapshot can be reused as is.  Starts at 1, so zero never matches.
+	 */
+	uint64		xactCompletionCount;
+
 	/*
 	 * These fields are protected by CLogTruncationLock
 	 */
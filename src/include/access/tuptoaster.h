@@ -24,6 +24,30 @@
  */
 #define TOAST_INDEX_HACK
 
+/*
+ * Compression methods of TOAST data.  A column's attcompression is one of
+ * the characters below, or InvalidCompressionMethod to compress with
+ * whatever default_toast_compression is set to when the value is stored.
+ * Compressed data itself records the ToastCompressionId of the method that
+ * compressed it, so that a column's method can be changed without
+ * rewriting the values already stored.
+ */
+#define TOAST_PGLZ_COMPRESSION		'p'
+#define TOAST_LZ4_COMPRESSION		'l'
+#define InvalidCompressionMethod	'\0'
+
+#define CompressionMethodIsValid(cm)  ((cm) != InvalidCompressionMethod)
+
+typedef enum ToastCompressionId
+{
+	TOAST_PGLZ_COMPRESSION_ID = 0,
+	TOAST_LZ4_COMPRESSION_ID = 1,
+	TOAST_INVALID_COMPRESSION_ID = 2
+} ToastCompressionId;
+
+/* GUC variable */
+extern int	default_toast_compression;
+
 
 /*
  * Find the maximum size of a tuple if there are to be N tuples per page.
@@ -110,7 +134,24 @@
  * saves space, so we expect either equality or less-than.
  */
 #define VARATT_EXTERNAL_IS_COMPRESSED(toast_pointer) \
-	((toast_pointer).va_extsize < (toast_pointer).va_rawsize - VARHDRSZ)
+	(VARATT_EXTERNAL_GET_EXTSIZE(toast_pointer) < \
+	 (toast_pointer).va_rawsize - VARHDRSZ)
+
+/*
+ * va_extinfo holds the external size of the data in its low 30 bits and,
+ * if the data is compressed, the ToastCompressionId in the two high bits.
+ */
+#define VARATT_EXTERNAL_GET_EXTSIZE(toast_pointer) \
+	((toast_pointer).va_extinfo & VARLENA_EXTSIZE_MASK)
+#define VARATT_EXTERNAL_GET_COMPRESS_METHOD(toast_pointer) \
+	((toast_pointer).va_extinfo >> VARLENA_EXTSIZE_BITS)
+#define VARATT_EXTERNAL_SET_SIZE_AND_COMPRESS_METHOD(toast_pointer, len, cm) \
+do { \
+	Assert((cm) == TOAST_PGLZ_COMPRESSION_ID || \
+		   (cm) == TOAST_LZ4_COMPRESSION_ID); \
+	(toast_pointer).va_extinfo = \
+		(len) | ((uint32) (cm) << VARLENA_EXTSIZE_BITS); \
+} while (0)
 
 /*
  * Macro to fetch the possibly-unaligned contents of an EXTERNAL datum
@@ -211,7 +252,25 @@ extern HeapTuple toast_build_flattened_tuple(TupleDesc tupleDesc,
  *	Create a compressed version of a varlena datum, if possible
  * ----------
  */
-extern Datum toast_compress_datum(Datum value);
+extern Datum toast_compress_datum(Datum value, char cmethod);
+
+/* ----------
+ * toast_get_compression_id -
+ *
+ *	Return the compression method of a varlena datum, or
+ *	TOAST_INVALID_COMPRESSION_ID if it is not compressed
+ * ----------
+ */
+extern ToastCompressionId toast_get_compression_id(struct varlena *attr);
+
+/* ----------
+ * CompressionNameToMethod, GetCompressionMethodName -
+ *
+ *	Convert between compression method names and attcompression values
+ * ----------
+ */
+extern char CompressionNameToMethod(const char *compression);
+extern const char *GetCompressionMethodName(char method);
 
 /* ----------
  * toast_raw_datum_size -
@@ -0,0 +1,36 @@
+/*-------------------------------------------------------------------------
+ *
+ * undocache.h
+ *	  shared cache of unpacked undo records
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * src/include/access/undocache.h
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef UNDOCACHE_H
+#define UNDOCACHE_H
+
+#include "access/undolog.h"
+#include "access/undorecord.h"
+
+/*
+ * Undo records whose payload and tuple data together exceed this size are
+ * never cached.
+ */
+#define UNDO_CACHE_MAX_DATA		1024
+
+/* Number of partitions of the undo record cache. */
+#define NUM_UNDO_CACHE_PARTITIONS	16
+
+/* GUC */
+extern PGDLLIMPORT int undo_record_cache_size;
+
+extern Size UndoRecordCacheShmemSize(void);
+extern void UndoRecordCacheShmemInit(void);
+extern bool UndoRecordCacheLookup(UndoRecPtr urp, UnpackedUndoRecord *uur);
+extern void UndoRecordCacheInsert(UndoRecPtr urp, UnpackedUndoRecord *uur);
+
+#endif							/* UNDOCACHE_H */
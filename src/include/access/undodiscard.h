@@ -18,7 +18,13 @@
 #include "catalog/pg_class.h"
 #include "storage/lwlock.h"
 
-extern void UndoDiscard(TransactionId xmin, bool *hibernate);
+/* GUCs */
+extern PGDLLIMPORT int undo_retention_size;
+extern PGDLLIMPORT int undo_retention_time;
+
+extern TransactionId UndoDiscard(TransactionId xmin, int nparts, int part,
+								 FullTransactionId *oldestXidHavingUndo,
+								 bool *hibernate);
 extern void UndoLogDiscardAll(void);
 extern void TempUndoDiscard(UndoLogNumber);
 
@@ -28,11 +28,19 @@ typedef bool (*SatisfyUndoRecordCallback) (UnpackedUndoRecord *urec,
 										   OffsetNumber offset,
 										   TransactionId xid);
 
+/* GUC */
+extern PGDLLIMPORT bool undo_full_page_writes;
+
 extern UndoRecPtr PrepareUndoInsert(UnpackedUndoRecord *, FullTransactionId xid,
 									UndoPersistence, XLogReaderState *xlog_record,
 									xl_undolog_meta *);
 
-extern void InsertPreparedUndo(void);
+extern void PrepareUndoInsertMulti(UnpackedUndoRecord *urecs, int nrecords,
+								   UndoRecPtr *urecptrs, FullTransactionId fxid,
+								   UndoPersistence upersistence,
+								   XLogReaderState *xlog_record,
+								   xl_undolog_meta *undometa);
+extern Size InsertPreparedUndo(void);
 extern void RegisterUndoLogBuffers(uint8 first_block_id);
 extern void UndoLogBuffersSetLSN(XLogRecPtr recptr);
 extern void UnlockReleaseUndoBuffers(void);
@@ -42,6 +50,7 @@ extern UnpackedUndoRecord *UndoFetchRecord(UndoRecPtr urp,
 										   TransactionId xid, UndoRecPtr *urec_ptr_out,
 										   SatisfyUndoRecordCallback callback);
 extern void UndoRecordRelease(UnpackedUndoRecord *urec);
+extern void UndoPrefetchRecord(UndoRecPtr urp);
 extern void UndoRecordSetPrevUndoLen(uint16 len);
 extern void UndoSetPrepareSize(UnpackedUndoRecord *undorecords, int nrecords,
 							   FullTransactionId fxid, UndoPersistence upersistence,
@@ -49,6 +58,9 @@ extern void UndoSetPrepareSize(UnpackedUndoRecord *undorecords, int nrecords,
 
 extern UndoRecPtr UndoGetPrevUndoRecptr(UndoRecPtr urp, UndoRecPtr prevurp,
 										Buffer *buffer);
+extern UndoRecPtr UndoRecordGetNextXact(UndoRecPtr urp,
+										UnpackedUndoRecord *uur,
+										UndoRecPtr last_xact_start);
 
 extern void UndoRecordOnUndoLogChange(UndoPersistence persistence);
 
@@ -0,0 +1,55 @@
+/*-------------------------------------------------------------------------
+ *
+ * undolocal.h
+ *	  backend-local copies of the undo records of the current transaction
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * src/include/access/undolocal.h
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef UNDOLOCAL_H
+#define UNDOLOCAL_H
+
+#include "access/undolog.h"
+#include "access/undorecord.h"
+#include "access/undorequest.h"
+
+/*
+ * Undo records whose payload and tuple data together exceed this size are
+ * not kept in the local buffer; a rollback that needs them reads the undo.
+ */
+#define UNDO_LOCAL_MAX_DATA		1024
+
+/*
+ * The header fields of an undo record that the current transaction has
+ * inserted, as kept in the backend's map of such records, so that checking
+ * the command ids of the tuples it has modified doesn't read the undo.
+ */
+typedef struct UndoLocalRecord
+{
+	UndoRecPtr	urp;			/* hash key */
+	bool		valid;			/* false, until the record is inserted */
+	uint8		type;
+	BlockNumber block;
+	OffsetNumber offset;
+	UndoRecPtr	blkprev;
+	TransactionId xid;
+	CommandId	cid;
+} UndoLocalRecord;
+
+/* GUCs */
+extern PGDLLIMPORT int undo_local_buffer_size;
+extern PGDLLIMPORT int undo_local_cid_map_size;
+
+extern void UndoLocalBufferPrepare(void);
+extern void UndoLocalBufferRemember(UndoRecPtr urp, UnpackedUndoRecord *uur);
+extern UndoRecInfo *UndoLocalBufferFetch(UndoRecPtr from_urecptr,
+										 UndoRecPtr to_urecptr, int *nrecords);
+extern void UndoLocalCidMapPrepare(UndoRecPtr urp, FullTransactionId fxid);
+extern void UndoLocalCidMapRemember(UndoRecPtr urp, UnpackedUndoRecord *uur);
+extern UndoLocalRecord *UndoLocalCidMapLookup(UndoRecPtr urp);
+
+#endif							/* UNDOLOCAL_H */
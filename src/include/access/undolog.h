@@ -19,6 +19,7 @@
 #include "access/xlogreader.h"
 #include "catalog/pg_class.h"
 #include "common/relpath.h"
+#include "datatype/timestamp.h"
 #include "storage/bufpage.h"
 
 #ifndef FRONTEND
@@ -130,6 +131,18 @@ typedef int UndoLogNumber;
 /* The number of usable bytes we can store per block. */
 #define UndoLogUsableBytesPerPage (BLCKSZ - UndoLogBlockHeaderSize)
 
+/*
+ * Undo pages have no use for pd_prune_xid, so it holds the length of the
+ * undo record that ends either at the end of the previous page or in the
+ * first usable byte of this one, if known, or zero.  The length stored at the
+ * end of that record isn't entirely on this page, and this way the record
+ * before one starting here can be found without reading the previous page.
+ */
+#define UndoPageGetBoundaryRecordLen(page) \
+	((UndoRecordSize) ((PageHeader) (page))->pd_prune_xid)
+#define UndoPageSetBoundaryRecordLen(page, len) \
+	(((PageHeader) (page))->pd_prune_xid = (TransactionId) (len))
+
 /* The pseudo-database OID used for undo logs. */
 #define UndoLogDatabaseOid 9
 
@@ -216,6 +229,23 @@ typedef struct xl_undolog_meta
 
 #ifndef FRONTEND
 
+/*
+ * Number of recent transaction starts remembered for each undo log.
+ */
+#define UNDO_LOG_XACT_STARTS	64
+
+/*
+ * The start of a transaction's undo in an undo log, as remembered in the
+ * undo log's in-memory index of transaction starts.
+ */
+typedef struct UndoLogXactStart
+{
+	UndoLogOffset start;		/* offset of the transaction header */
+	TransactionId xid;
+	uint32		epoch;
+	TimestampTz start_time;		/* transaction start, 0 if unknown */
+} UndoLogXactStart;
+
 /*
  * The in-memory control object for an undo log.  As well as the current
  * meta-data for the undo log, we also lazily maintain a snapshot of the
@@ -234,6 +264,18 @@ typedef struct xl_undolog_meta
  * influences the visibility decision but the updaters need to be blocked for
  * the entire discard process to ensure proper ordering of WAL records.
  *
+ * xact_starts is a ring of the most recent transaction headers inserted into
+ * the log, in insertion order, so that the discard worker can step over
+ * committed transactions without reading their headers from the undo log.
+ * It's not WAL-logged and starts out empty after a restart; the oldest
+ * entries are overwritten when it's full.
+ *
+ * xact_hdr_end is where the last allocation that included a transaction
+ * header ended.  If the insert pointer is still there when the next
+ * transaction starts, that header already points to it.  Like xact_starts
+ * it's not WAL-logged; it is zero after a restart, so the next transaction
+ * just goes back to update the header as it would otherwise.
+ *
  * Conceptually the set of UndoLogControl objects is arranged into a very
  * large array for access by log number, but because we typically need only a
  * smallish number of adjacent undo logs to be active at a time we arrange
@@ -246,8 +288,19 @@ typedef struct UndoLogControl
 	XLogRecPtr	lsn;
 	bool		need_attach_wal_record; /* need_attach_wal_record */
 	pid_t		pid;			/* InvalidPid for unattached */
+	UndoLogXactStart xact_starts[UNDO_LOG_XACT_STARTS];
+	int			xact_starts_first;	/* index of the oldest entry */
+	int			xact_starts_count;	/* number of valid entries */
+	UndoLogOffset xact_hdr_end; /* end of last allocation with a header */
+	/* Statistics since server start, for pg_stat_undo_logs. */
+	TimestampTz rate_time;		/* when rate_insert was sampled */
+	UndoLogOffset rate_insert;	/* insert pointer at rate_time */
+	double		write_rate;		/* bytes/s until rate_time */
+	uint64		segments_created;	/* segment files created from scratch */
+	uint64		segments_recycled;	/* segment files reused */
 	LWLock		mutex;			/* protects the above */
 	TransactionId xid;
+	TransactionId prepared_xid; /* prepared transaction the log is left to */
 	/* State used by undo workers. */
 	TransactionId oldest_xid;	/* cache of oldest transaction's xid */
 	uint32		oldest_xidepoch;
@@ -271,6 +324,9 @@ extern void UndoLogAdvance(UndoRecPtr insertion_point,
 						   UndoPersistence persistence);
 extern void UndoLogDiscard(UndoRecPtr discard_point, TransactionId xid);
 extern bool UndoLogIsDiscarded(UndoRecPtr point);
+extern void UndoLogPreallocateSegments(void);
+extern void UndoLogPrecreateLogs(void);
+extern void UndoLogReportWrite(Oid tablespace, uint64 elapsed_us);
 
 /* Initialization interfaces. */
 extern void StartupUndoLogs(XLogRecPtr checkPointRedo);
@@ -284,7 +340,14 @@ extern void ResetUndoLogs(UndoPersistence persistence);
 /* Interface use by tablespace.c. */
 extern bool DropUndoLogsInTablespace(Oid tablespace);
 
+/* Interfaces used for prepared transactions. */
+extern void PostPrepare_UndoLogs(TransactionId xid);
+extern void UndoLogReleasePrepared(TransactionId xid, UndoRecPtr urp);
+
 /* GUC interfaces. */
+extern PGDLLIMPORT int undo_segment_pool_size;
+extern PGDLLIMPORT int undo_preallocate_segments;
+extern PGDLLIMPORT int undo_precreate_logs;
 extern void assign_undo_tablespaces(const char *newval, void *extra);
 
 /* Checkpoint interfaces. */
@@ -296,10 +359,13 @@ extern void CheckPointUndoLogs(XLogRecPtr checkPointRedo,
 extern UndoLogControl *UndoLogGet(UndoLogNumber logno);
 extern UndoLogControl *UndoLogNext(UndoLogControl *log);
 extern bool AmAttachedToUndoLog(UndoLogControl *log);
+extern int	UndoLogGetXactStarts(UndoLogControl *log, UndoLogOffset from,
+								 UndoLogXactStart *starts);
 
 #endif
 
-extern void UndoLogSetLastXactStartPoint(UndoRecPtr point);
+extern void UndoLogSetLastXactStartPoint(UndoRecPtr point,
+										 FullTransactionId fxid);
 extern UndoRecPtr UndoLogGetLastXactStartPoint(UndoLogNumber logno);
 extern UndoRecPtr UndoLogGetCurrentLocation(UndoPersistence persistence);
 extern UndoRecPtr UndoLogGetFirstValidRecord(UndoLogNumber logno);
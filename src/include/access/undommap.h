@@ -0,0 +1,26 @@
+/*-------------------------------------------------------------------------
+ *
+ * undommap.h
+ *	  read undo records through memory mappings of the undo segment files
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * src/include/access/undommap.h
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef UNDOMMAP_H
+#define UNDOMMAP_H
+
+#include "access/undorecord.h"
+#include "storage/relfilenode.h"
+
+/* GUC */
+extern PGDLLIMPORT bool undo_read_mmap;
+
+extern bool UndoMmapGetOneRecord(UnpackedUndoRecord *urec, UndoRecPtr urp,
+								 RelFileNode rnode,
+								 UndoPersistence persistence);
+
+#endif							/* UNDOMMAP_H */
@@ -39,13 +39,21 @@ typedef enum undorectype
  * urec_info.  All structures are packed into the alignment without padding
  * bytes, and the undo record itself need not be aligned either, so care
  * must be taken when reading the header.
+ *
+ * Only the first SizeOfUndoRecordHeaderPrefix bytes of the header are always
+ * stored as they are.  Unless urec_packed_len is 0, they are followed by that
+ * many bytes holding urec_reloid, urec_xid, the distance from urec_prevxid to
+ * urec_xid and urec_cid, in this order and each in the variable-length
+ * encoding of UndoRecordPackHeader, instead of by the rest of the structure;
+ * urec_prevlen is not stored then.  Most records are from recent transactions
+ * with small command ids, so that usually saves about half of the header.
  */
 typedef struct UndoRecordHeader
 {
-	RmgrId		urec_rmid;		/* RMGR [XXX:TODO: this creates an alignment
-								 * hole?] */
+	RmgrId		urec_rmid;		/* RMGR */
 	uint8		urec_type;		/* record type code */
 	uint8		urec_info;		/* flag bits */
+	uint8		urec_packed_len;	/* # of bytes of the packed fields */
 	uint16		urec_prevlen;	/* length of previous record in bytes */
 	Oid			urec_reloid;	/* relation OID */
 
@@ -68,6 +76,12 @@ typedef struct UndoRecordHeader
 #define SizeOfUndoRecordHeader	\
 	(offsetof(UndoRecordHeader, urec_cid) + sizeof(CommandId))
 
+#define SizeOfUndoRecordHeaderPrefix \
+	offsetof(UndoRecordHeader, urec_prevlen)
+
+/* Room needed for the packed fields of the header. */
+#define UNDO_PACKED_HEADER_MAX_LEN	20
+
 /*
  * If UREC_INFO_RELATION_DETAILS is set, an UndoRecordRelationDetails structure
  * follows.
@@ -89,6 +103,19 @@ typedef struct UndoRecordHeader
 #define UREC_INFO_TRANSACTION				0x08
 #define UREC_INFO_PAYLOAD_CONTAINS_SLOT		0x10
 #define UREC_INFO_PAYLOAD_CONTAINS_SUBXACT	0x20
+#define UREC_INFO_TUPLE_IS_DELTA			0x40
+#define UREC_INFO_TUPLE_COMPRESSED			0x80
+
+/*
+ * Tuples of at least UNDO_TUPLE_COMPRESS_MIN bytes are stored compressed if
+ * that saves space, as indicated by UREC_INFO_TUPLE_COMPRESSED.  The first
+ * UNDO_TUPLE_RAW_PREFIX bytes of the tuple are stored as they are, followed by
+ * the uint16 length of the whole tuple and the pglz-compressed remainder, so
+ * the tuple header can still be read without decompressing the tuple.
+ */
+#define UNDO_TUPLE_COMPRESS_MIN				256
+#define UNDO_TUPLE_RAW_PREFIX				8
+
 /*
  * Additional information about a relation to which this record pertains,
  * namely the fork number.  If the fork number is MAIN_FORKNUM, this structure
@@ -138,7 +165,13 @@ typedef struct UndoRecordTransaction
 	 * that directly using prevlen during rollback.
 	 */
 	UndoRecPtr	urec_prevurp;
-	UndoRecPtr	urec_next;		/* urec pointer of the next transaction */
+
+	/*
+	 * urec pointer of the next transaction.  This is written up front as
+	 * where the next transaction would start, so it must be read with
+	 * UndoRecordGetNextXact.
+	 */
+	UndoRecPtr	urec_next;
 } UndoRecordTransaction;
 
 #define SizeOfUrecNext (sizeof(UndoRecPtr))
@@ -174,6 +207,12 @@ typedef struct UndoRecordPayload
  * When an undo record is decoded into an UnpackedUndoRecord, all fields
  * will be initialized, but those for which no information is available
  * will be set to invalid or default values, as appropriate.
+ *
+ * If UREC_INFO_TUPLE_COMPRESSED is set in a record being inserted, uur_tuple
+ * still holds the tuple as given by the caller and uur_packed_tuple holds the
+ * compressed form that will be written, as computed by UndoRecordSetInfo.  In
+ * a decoded record, uur_tuple holds the compressed form until the caller
+ * needs the tuple and calls UndoRecordDecompressTuple.
  */
 typedef struct UnpackedUndoRecord
 {
@@ -200,6 +239,8 @@ typedef struct UnpackedUndoRecord
 	uint32		uur_progress;
 	StringInfoData uur_payload; /* payload bytes */
 	StringInfoData uur_tuple;	/* tuple bytes */
+	char	   *uur_packed_tuple;	/* compressed tuple bytes to be inserted */
+	uint16		uur_packed_len; /* # of compressed tuple bytes */
 } UnpackedUndoRecord;
 
 
@@ -209,6 +250,7 @@ extern Size UnpackedUndoRecordSize(UnpackedUndoRecord *uur);
 extern bool InsertUndoRecord(UnpackedUndoRecord *uur, Page page,
 							 int starting_byte, int *already_written,
 							 int remaining_bytes, uint16 undo_len, bool header_only);
+extern void UndoRecordDecompressTuple(UnpackedUndoRecord *uur);
 extern bool UnpackUndoRecord(UnpackedUndoRecord *uur, Page page,
 							 int starting_byte, int *already_decoded, bool header_only,
 							 bool copy_data);
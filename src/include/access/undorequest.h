@@ -27,6 +27,17 @@ typedef enum
 
 #define InvalidUndoWorkerQueue -1
 
+/* Policies for choosing the rollbacks that are pushed to undo workers. */
+typedef enum RollbackPolicy
+{
+	ROLLBACK_POLICY_SIZE,		/* rollbacks above rollback_overflow_size */
+	ROLLBACK_POLICY_ADAPTIVE	/* rollbacks estimated to take too long */
+} RollbackPolicy;
+
+/* GUC options */
+extern PGDLLIMPORT int rollback_policy;
+extern PGDLLIMPORT int rollback_foreground_latency;
+
 /* Remembers the last seen RecentGlobalXmin */
 TransactionId latestRecentGlobalXmin;
 
@@ -37,6 +48,7 @@ typedef struct RollbackHashEntry
 	UndoRecPtr	start_urec_ptr;
 	UndoRecPtr	end_urec_ptr;
 	Oid			dbid;
+	uint64		request_size;	/* size of the undo to be applied */
 	bool		in_progress;	/* indicates that undo actions are being
 								 * processed */
 } RollbackHashEntry;
@@ -77,6 +89,21 @@ typedef struct UndoErrorQueue
 	TimestampTz err_occurred_at;
 } UndoErrorQueue;
 
+/*
+ * Parallel apply of undo actions splits the blocks of a transaction into at
+ * most UNDO_APPLY_MAX_PARTITIONS partitions of runs of
+ * UNDO_APPLY_PARTITION_BLOCKS consecutive blocks.
+ */
+#define UNDO_APPLY_MAX_PARTITIONS	32
+#define UNDO_APPLY_PARTITION_BLOCKS	16
+
+/*
+ * The undo actions of up to UNDO_APPLY_MAX_PAGES consecutive blocks of a
+ * relation are passed to the resource manager at once, so that it can apply
+ * and WAL-log them together.  Must not exceed XLR_MAX_BLOCK_ID + 1.
+ */
+#define UNDO_APPLY_MAX_PAGES		16
+
 /* undo record information */
 typedef struct UndoRecInfo
 {
@@ -114,6 +141,7 @@ typedef struct UndoRequestInfo
 	urinfo->start_urec_ptr = rh->start_urec_ptr, \
 	urinfo->end_urec_ptr = rh->end_urec_ptr, \
 	urinfo->dbid = rh->dbid, \
+	urinfo->request_size = rh->request_size, \
 	urinfo->undo_worker_queue = cur_queue \
 )
 
@@ -131,15 +159,23 @@ extern bool UndoGetWork(bool allow_peek, bool is_undo_launcher,
 extern bool RegisterRollbackReq(UndoRecPtr end_urec_ptr, UndoRecPtr start_urec_ptr,
 								Oid dbid, FullTransactionId full_xid);
 extern void RollbackHTRemoveEntry(FullTransactionId full_xid, UndoRecPtr start_urec_ptr);
-extern bool RollbackHTIsFull(void);
 extern void RollbackHTCleanup(Oid dbid);
+extern void RollbackHTMarkHot(FullTransactionId full_xid);
+extern void ReportUndoApplyRate(uint64 request_size, TimestampTz start_time);
 
 /* functions exposed from undoaction.c */
+extern void UndoPrefetchRecord(UndoRecPtr urecptr);
 extern UndoRecInfo *UndoRecordBulkFetch(UndoRecPtr *from_urecptr,
 										UndoRecPtr to_urecptr, int undo_apply_size,
 										int *nrecords, bool one_page);
 extern void execute_undo_actions(FullTransactionId full_xid, UndoRecPtr from_urecptr,
 								 UndoRecPtr to_urecptr, bool nopartial);
+extern bool execute_undo_actions_parallel(FullTransactionId full_xid,
+										  UndoRecPtr from_urecptr,
+										  UndoRecPtr to_urecptr, int nparts,
+										  uint32 parts);
+extern void execute_undo_actions_finish(FullTransactionId full_xid,
+										UndoRecPtr to_urecptr);
 extern bool execute_undo_actions_page(UndoRecInfo *urp_array, int first_idx,
 									  int last_idx, Oid reloid, FullTransactionId full_xid,
 									  BlockNumber blkno, bool blk_chain_complete);
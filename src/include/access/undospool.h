@@ -0,0 +1,36 @@
+/*-------------------------------------------------------------------------
+ *
+ * undospool.h
+ *	  spool of dead tuple TIDs harvested from discarded undo
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * src/include/access/undospool.h
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef UNDOSPOOL_H
+#define UNDOSPOOL_H
+
+#include "access/undolog.h"
+#include "storage/block.h"
+
+/* Directory, relative to the data directory, holding the spool files. */
+#define UNDO_SPOOL_DIR			"pg_undo_spool"
+
+/*
+ * A spool file that has grown beyond this size is not appended to anymore;
+ * the dead tuples it misses are left to a regular vacuum.
+ */
+#define UNDO_SPOOL_MAX_FILE_SIZE	(64 * 1024 * 1024)
+
+/* GUC */
+extern PGDLLIMPORT bool undo_spool_dead_tids;
+
+extern void UndoSpoolHarvest(Oid dbid, UndoRecPtr start, UndoRecPtr end);
+extern BlockNumber *UndoSpoolReadBlocks(Oid dbid, Oid relid,
+										BlockNumber minblock,
+										BlockNumber maxblock, int *nblocks);
+
+#endif							/* UNDOSPOOL_H */
@@ -17,6 +17,15 @@
 /* undo worker sleep time between rounds */
 extern int	UndoWorkerDelay;
 
+/* number of undo worker slots */
+extern int	max_undo_workers;
+
+/* rollbacks bigger than this many MB are applied by several undo workers */
+extern PGDLLIMPORT int undo_parallel_apply_size;
+
+/* idle undo workers each database keeps */
+extern PGDLLIMPORT int undo_worker_min_per_database;
+
 extern Size UndoLauncherShmemSize(void);
 extern void UndoLauncherShmemInit(void);
 extern void UndoLauncherRegister(void);
@@ -16,6 +16,12 @@
 
 #include "commands/vacuum.h"
 #include "storage/buf.h"
+#include "storage/dsm.h"
+#include "storage/off.h"
+#include "storage/shm_toc.h"
+
+/* Compact store of dead tuple TIDs, opaque outside vacuumblk.c */
+typedef struct LVDeadTids LVDeadTids;
 
 extern void lazy_vacuum_index(Relation indrel, IndexBulkDeleteResult **stats,
 							  LVRelStats *vacrelstats,
@@ -23,10 +29,32 @@ extern void lazy_vacuum_index(Relation indrel, IndexBulkDeleteResult **stats,
 extern void lazy_cleanup_index(Relation indrel, IndexBulkDeleteResult *stats,
 							   LVRelStats *vacrelstats,
 							   BufferAccessStrategy vac_strategy, int elevel);
+extern void lazy_vacuum_all_indexes(Relation onerel, Relation *Irel,
+									IndexBulkDeleteResult **stats,
+									int nindexes, LVRelStats *vacrelstats,
+									BufferAccessStrategy vac_strategy,
+									int elevel, int nworkers);
+extern void lazy_cleanup_all_indexes(Relation onerel, Relation *Irel,
+									 IndexBulkDeleteResult **stats,
+									 int nindexes, LVRelStats *vacrelstats,
+									 BufferAccessStrategy vac_strategy,
+									 int elevel, int nworkers);
+extern void lazy_parallel_vacuum_main(dsm_segment *seg, shm_toc *toc);
 extern bool should_attempt_truncation(VacuumParams *params, LVRelStats *vacrelstats);
 extern void lazy_truncate_heap(Relation onerel, LVRelStats *vacrelstats,
 							   BufferAccessStrategy vac_strategy, int elevel);
 extern void lazy_record_dead_tuple(LVRelStats *vacrelstats,
 								   ItemPointer itemptr);
+extern void lazy_forget_dead_tuples(LVRelStats *vacrelstats);
+
+extern LVDeadTids *lazy_dead_tids_create(BlockNumber relblocks, int maxtuples,
+										 bool useindex);
+extern bool lazy_dead_tids_is_full(LVDeadTids *dt);
+extern int64 lazy_dead_tids_max_tuples(LVDeadTids *dt);
+extern uint32 lazy_dead_tids_num_blocks(LVDeadTids *dt);
+extern BlockNumber lazy_dead_tids_block_number(LVDeadTids *dt,
+											   uint32 blockidx);
+extern int	lazy_dead_tids_get_offsets(LVDeadTids *dt, BlockNumber blkno,
+									   OffsetNumber *offsets);
 
 #endif							/* VACUUMBLK_H */
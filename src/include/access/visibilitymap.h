@@ -25,7 +25,11 @@
 /* Flags for bit map */
 #define VISIBILITYMAP_ALL_VISIBLE	0x01
 #define VISIBILITYMAP_ALL_FROZEN	0x02
-/* Used for zheap two-phase vacuum */
+/*
+ * Used for zheap two-phase vacuum.  Zheap sets VISIBILITYMAP_ALL_FROZEN only
+ * along with VISIBILITYMAP_ALL_VISIBLE, and the bit on its own means that the
+ * page is potentially all-visible.
+ */
 #define VISIBILITYMAP_POTENTIAL_ALL_VISIBLE 0x02
 #define VISIBILITYMAP_VALID_BITS	0x03	/* OR of all valid visibilitymap
 											 * flags bits */
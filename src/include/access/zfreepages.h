@@ -0,0 +1,39 @@
+/*-------------------------------------------------------------------------
+ *
+ * zfreepages.h
+ *	  hints of recently freed zheap pages, and batched FSM updates
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * src/include/access/zfreepages.h
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef ZFREEPAGES_H
+#define ZFREEPAGES_H
+
+#include "storage/block.h"
+#include "utils/relcache.h"
+
+/* Number of partitions of the freed page table. */
+#define NUM_ZFREEDPAGES_PARTITIONS	16
+
+/* Number of entries a relation can have in the freed page table. */
+#define ZFREEDPAGES_BUCKET_SIZE		8
+
+/* Number of pages whose FSM update is held back until they are flushed. */
+#define ZFREEDPAGES_BATCH_SIZE		32
+
+/* GUC */
+extern PGDLLIMPORT int zheap_freed_page_hints;
+
+extern Size ZHeapFreedPagesShmemSize(void);
+extern void ZHeapFreedPagesShmemInit(void);
+extern void ZHeapRecordFreedPage(Relation relation, BlockNumber blkno,
+								 Size freespace);
+extern void ZHeapFlushFreedPages(void);
+extern BlockNumber ZHeapGetFreedPage(Relation relation, Size spaceNeeded);
+extern void ZHeapForgetFreedPages(Relation relation, BlockNumber nblocks);
+
+#endif							/* ZFREEPAGES_H */
@@ -19,6 +19,7 @@
 #include "access/hio.h"
 #include "access/tableam.h"
 #include "access/undoinsert.h"
+#include "access/undolocal.h"
 #include "access/undorequest.h"
 #include "access/zhtup.h"
 #include "storage/smgr.h"
@@ -65,21 +66,59 @@ typedef struct ZHeapPageOpaqueData
 
 typedef ZHeapPageOpaqueData *ZHeapPageOpaque;
 
-#define SizeOfZHeapPageOpaqueData (ZHEAP_PAGE_TRANS_SLOTS \
-										 * sizeof(TransInfo))
+/*
+ * The number of transaction slots on a zheap page is chosen per relation by
+ * the trans_slots reloption and recorded in the metapage when the relation's
+ * storage is created; ZHEAP_PAGE_TRANS_SLOTS is only the default.  Every
+ * page carries its own slot count implicitly in the size of its special
+ * space, so code working on a page must use ZHeapPageGetNumTransSlots rather
+ * than assuming the default.  A single slot is not allowed, as such a page
+ * would have the same special size as a TPD page, and the slot number stored
+ * in a tuple header can't exceed 31.
+ */
+#define ZHEAP_MIN_PAGE_TRANS_SLOTS	2
+#define ZHEAP_MAX_PAGE_TRANS_SLOTS	31
+
+/*
+ * Upper bound of the insert_spread_blocks reloption, the number of blocks a
+ * backend extends a zheap relation by to keep for its own insertions.
+ */
+#define ZHEAP_MAX_INSERT_SPREAD_BLOCKS	512
+
+/*
+ * Upper bound of the growth_reserve reloption, the percentage of a page kept
+ * free for updates on pages whose tuples have outgrown it before.
+ */
+#define ZHEAP_MAX_GROWTH_RESERVE	50
+
+#define SizeOfZHeapPageOpaqueDataForSlots(nslots) \
+	((nslots) * sizeof(TransInfo))
+
+/*
+ * Smallest possible size of the special space of a zheap page; this is what
+ * the upper bounds on the tuple size and the number of tuples are based on.
+ */
+#define SizeOfZHeapPageOpaqueData \
+	SizeOfZHeapPageOpaqueDataForSlots(ZHEAP_MIN_PAGE_TRANS_SLOTS)
+
+#define ZHeapPageGetNumTransSlots(page) \
+	((int) (PageGetSpecialSize(page) / sizeof(TransInfo)))
+
 typedef struct ZHeapMetaPageData
 {
 	uint32		zhm_magic;		/* magic number for zheap tables */
 	uint32		zhm_version;	/* version ID */
 	uint32		zhm_first_used_tpd_page;
 	uint32		zhm_last_used_tpd_page;
+	uint32		zhm_free_tpd_page;	/* head of the list of free TPD pages */
+	uint32		zhm_trans_slots;	/* transaction slots on each data page */
 } ZHeapMetaPageData;
 
 typedef ZHeapMetaPageData *ZHeapMetaPage;
 
 #define ZHEAP_METAPAGE 0		/* metapage is always block 0 */
 #define ZHEAP_MAGIC            0xA056
-#define ZHEAP_VERSION  1
+#define ZHEAP_VERSION  3
 
 #define ZHeapPageGetMeta(page) \
 		((ZHeapMetaPage) PageGetContents(page))
@@ -114,6 +153,7 @@ typedef struct ZHeapPrepareUndoInfo
 	FullTransactionId fxid;
 	CommandId	cid;
 	UndoPersistence undo_persistence;
+	int			trans_slots;	/* number of transaction slots on the page */
 } ZHeapPrepareUndoInfo;
 
 /* This is used to prepare update undo records. */
@@ -132,6 +172,15 @@ typedef struct ZHeapPrepareUpdateUndoInfo
 	bool		inplace_update;
 	bool		same_buf;
 	bool		hasSubXactLock;
+
+	/*
+	 * For an in-place update, the new tuple version the undo tuple may be
+	 * diff-encoded against, or NULL.  During replay, the undo tuple taken
+	 * from WAL may instead already be encoded, in which case undo_tuple_delta
+	 * is set.
+	 */
+	ZHeapTuple	inplace_newtup;
+	bool		undo_tuple_delta;
 } ZHeapPrepareUpdateUndoInfo;
 
 /* This is used to prepare lock undo records. */
@@ -228,11 +277,14 @@ extern int	PageGetTransactionSlotId(Relation rel, Buffer buf,
 extern TransInfo *GetTransactionsSlotsForPage(Relation rel, Buffer buf,
 											  int *total_trans_slots,
 											  BlockNumber *tpd_blkno);
+extern void PrefetchTransactionSlotsUndo(TransInfo *trans_slots,
+										 int total_trans_slots);
 
 struct TupleTableSlot;
 extern void zheap_multi_insert(Relation relation, struct TupleTableSlot **slots,
 							   int ntuples, CommandId cid, int options,
 							   BulkInsertState bistate);
+extern void zheap_finish_bulk_insert(Relation relation, int options);
 extern void zheap_get_latest_tid(TableScanDesc sscan,
 								 ItemPointer tid);
 extern XLogRecPtr log_zheap_visible(RelFileNode rnode, Buffer heap_buffer,
@@ -274,8 +326,14 @@ extern UndoRecPtr zheap_prepare_undo_multi_insert(ZHeapPrepareUndoInfo *zh_undo_
 
 
 /* Pruning related API's (prunezheap.c) */
+extern PGDLLIMPORT bool zheap_background_prune;
+
 extern bool zheap_page_prune_opt(Relation relation, Buffer buffer,
 								 OffsetNumber offnum, Size space_required);
+extern void zheap_page_set_all_visible_opt(Relation relation, Buffer buffer,
+										   Buffer *vmbuffer);
+extern void zheap_page_prune_request(Relation relation, Buffer buffer);
+extern void zheap_page_prune_work(Oid relid, BlockNumber blkno);
 extern int	zheap_page_prune_guts(Relation relation, Buffer buffer,
 								  TransactionId OldestXmin, OffsetNumber target_offnum,
 								  Size space_required, bool report_stats, bool force_prune,
@@ -311,19 +369,39 @@ extern void RelationPutZHeapTuple(Relation relation, Buffer buffer,
 								  ZHeapTuple tuple);
 extern ZHeapFreeOffsetRanges *ZHeapGetUsableOffsetRanges(Buffer buffer,
 														 ZHeapTuple *tuples, int ntuples, Size saveFreeSpace);
-extern void ZheapInitPage(Page page, Size pageSize);
+extern void ZheapInitPage(Page page, Size pageSize, int nslots);
 extern void zheap_init_meta_page(Buffer metabuf, BlockNumber first_blkno,
-								 BlockNumber last_blkno);
+								 BlockNumber last_blkno, BlockNumber free_blkno,
+								 int trans_slots);
 extern void ZheapInitMetaPage(RelFileNode rnode, ForkNumber forkNum,
-							  char persistence, bool already_exists);
+							  char persistence, bool already_exists,
+							  int trans_slots);
+extern int	RelationGetZHeapTransSlots(Relation relation);
 extern ZHeapTuple zheap_gettuple(Relation relation, Buffer buffer,
 								 OffsetNumber offnum);
 
+/*
+ * Size of the fixed part of an undo tuple diff-encoded by
+ * EncodeInplaceUpdateUndoTuple: the tuple header and the prefix and suffix
+ * lengths.
+ */
+#define SizeofInplaceUpdateUndoTuple \
+	(SizeofZHeapTupleHeader + 2 * sizeof(uint16))
+
 /* Zheap and undo record interaction related API's (zundo.c) */
 extern bool ZHeapSatisfyUndoRecord(UnpackedUndoRecord *uurec, BlockNumber blkno,
 								   OffsetNumber offset, TransactionId xid);
+extern UndoLocalRecord *ZHeapLocalUndoRecord(UndoRecPtr *urec_ptr,
+											 BlockNumber blkno,
+											 OffsetNumber offset,
+											 TransactionId xid);
 extern int	UpdateTupleHeaderFromUndoRecord(UnpackedUndoRecord *urec,
 											ZHeapTupleHeader hdr, Page page);
+extern bool EncodeInplaceUpdateUndoTuple(StringInfo buf, ZHeapTuple oldtup,
+										 ZHeapTuple newtup);
+extern uint32 DecodeInplaceUpdateUndoTuple(UnpackedUndoRecord *urec,
+										   ZHeapTupleHeader newtup,
+										   uint32 newlen, char *dest);
 extern bool ValidateTuplesXact(Relation relation, ZHeapTuple tuple,
 							   Snapshot snapshot, Buffer buf,
 							   TransactionId priorXmax, bool nobuflock);
@@ -64,9 +64,11 @@ typedef struct xl_zheap_metadata
 {
 	uint32		first_used_tpd_page;
 	uint32		last_used_tpd_page;
+	uint32		free_tpd_page;
+	uint32		trans_slots;
 } xl_zheap_metadata;
 
-#define SizeOfMetaData	(offsetof(xl_zheap_metadata, last_used_tpd_page) + sizeof(uint32))
+#define SizeOfMetaData	(offsetof(xl_zheap_metadata, trans_slots) + sizeof(uint32))
 
 /* common undo record related info */
 typedef struct xl_undo_header
@@ -141,7 +143,7 @@ typedef struct xl_zheap_delete
 #define SizeOfZHeapDelete	(offsetof(xl_zheap_delete, flags) + sizeof(uint8))
 
 /*
- * xl_zheap_update flag values, 8 bits are available.
+ * xl_zheap_update flag values, 16 bits are available.
  */
 /* PD_ALL_VISIBLE was cleared */
 #define XLZ_UPDATE_OLD_ALL_VISIBLE_CLEARED		(1<<0)
@@ -154,6 +156,10 @@ typedef struct xl_zheap_delete
 #define	XLZ_UPDATE_OLD_CONTAINS_TPD_SLOT		(1<<6)
 #define	XLZ_UPDATE_NEW_CONTAINS_TPD_SLOT		(1<<7)
 #define XLZ_UPDATE_CONTAINS_SUBXACT				(1<<8)
+/* the undo tuple is diff-encoded against the new tuple */
+#define XLZ_UPDATE_UNDO_TUPLE_DELTA				(1<<9)
+/* the new tuple is included even if the page image is */
+#define XLZ_UPDATE_CONTAINS_NEW_TUPLE			(1<<10)
 
 /*
  * This is what we need to know about update|inplace_update
@@ -318,9 +324,15 @@ typedef struct xl_zheap_visible
  */
 #define XLOG_ZUNDO_PAGE				0x00
 #define XLOG_ZUNDO_RESET_SLOT		0x10
+#define XLOG_ZUNDO_MULTI_PAGE		0x20
 
 /*
  * xl_undoaction_page flag values, 8 bits are available.
+ *
+ * An XLOG_ZUNDO_MULTI_PAGE record holds a full-page image of each of its
+ * pages and a flags byte per page, in block reference order.  It is never
+ * used for pages with TPD slots, so only XLU_PAGE_CLEAR_VISIBILITY_MAP and
+ * XLU_INIT_PAGE can be set there.
  */
 #define XLU_PAGE_CONTAINS_TPD_SLOT			(1<<0)
 #define XLU_PAGE_CLEAR_VISIBILITY_MAP		(1<<1)
@@ -19,6 +19,15 @@
 #include "access/skey.h"
 #include "access/zheap.h"
 
+/*
+ * Size of the per-scan arena used to hold the tuples of an all-visible page
+ * in page-at-a-time mode.  The tuples on a page can't occupy more than a
+ * block, but each copy is MAXALIGN'd in the arena, so leave room for the
+ * padding as well.
+ */
+#define ZHEAP_SCAN_ARENA_SIZE \
+	(BLCKSZ + MaxZHeapTuplesPerPage * MAXIMUM_ALIGNOF)
+
 typedef struct ZHeapScanDescData
 {
 	/* scan parameters */
@@ -39,12 +48,26 @@ typedef struct ZHeapScanDescData
 	/* rs_numblocks is usually InvalidBlockNumber, meaning "scan whole rel" */
 	BufferAccessStrategy rs_strategy;	/* access strategy for reads */
 
+	/* blocks claimed for this backend in a parallel scan */
+	ParallelBlockTableScanWorkerData rs_parallelworkerdata;
+
 	ZHeapTuple	rs_cztup;		/* current tuple in scan, if any */
 
 	int			rs_cindex;		/* current tuple's index in visztuples */
 	int			rs_ntuples;		/* number of visible tuples on page */
 
 	ZHeapTuple	rs_visztuples[MaxZHeapTuplesPerPage];
+
+	/*
+	 * For all-visible pages in page-at-a-time mode, the visible tuples are
+	 * copied into rs_arena instead of being palloc'd one at a time, and
+	 * rs_visztuples points to the headers in rs_arenatuples.  rs_arenapage
+	 * tells whether that is the case for the current page.  The arena is
+	 * allocated on first use and reused for every page.
+	 */
+	bool		rs_arenapage;
+	char	   *rs_arena;
+	ZHeapTupleData rs_arenatuples[MaxZHeapTuplesPerPage];
 } ZHeapScanDescData;
 
 typedef struct ZHeapScanDescData *ZHeapScanDesc;
@@ -67,6 +90,10 @@ extern bool zheap_scan_bitmap_next_tuple(TableScanDesc sscan, struct TBMIterateR
 
 extern ZHeapTuple zheap_search_buffer(ItemPointer tid, Relation relation,
 									  Buffer buffer, Snapshot snapshot, bool *all_dead);
+extern ZHeapTuple zheap_search_buffer_optimistic(ItemPointer tid,
+												 Relation relation,
+												 Buffer buffer,
+												 Snapshot snapshot);
 extern bool zheap_fetch(Relation relation, Snapshot snapshot,
 						ItemPointer tid, ZHeapTuple *tuple, Buffer *userbuf,
 						bool keep_buf);
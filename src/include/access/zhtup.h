@@ -20,12 +20,13 @@
 #include "access/undolog.h"
 #include "access/undorecord.h"
 #include "executor/tuptable.h"
+#include "nodes/bitmapset.h"
 #include "nodes/lockoptions.h"
 #include "storage/bufpage.h"
 #include "storage/buf.h"
 #include "storage/itemptr.h"
 
-/* valid values for transaction slot is between 0 and ZHEAP_PAGE_TRANS_SLOTS */
+/* valid values for transaction slot is between 0 and the page's slot count */
 #define InvalidXactSlotId	(-1)
 /* we use frozen slot to indicate that the tuple is all visible now */
 #define	ZHTUP_SLOT_FROZEN	0x000
@@ -65,15 +66,19 @@ typedef enum LockOper
 
 typedef struct ZHeapTupleHeaderData
 {
+#define FIELDNO_ZHEAPTUPLEHEADERDATA_INFOMASK2 0
 	uint16		t_infomask2;	/* number of attributes + translot info +
 								 * various flags */
 
+#define FIELDNO_ZHEAPTUPLEHEADERDATA_INFOMASK 1
 	uint16		t_infomask;		/* various flag bits, see below */
 
+#define FIELDNO_ZHEAPTUPLEHEADERDATA_HOFF 2
 	uint8		t_hoff;			/* sizeof header incl. bitmap, padding */
 
 	/* ^ - 5 bytes - ^ */
 
+#define FIELDNO_ZHEAPTUPLEHEADERDATA_BITS 3
 	bits8		t_bits[FLEXIBLE_ARRAY_MEMBER];	/* bitmap of NULLs */
 
 	/* MORE DATA FOLLOWS AT END OF STRUCT */
@@ -88,6 +93,7 @@ typedef struct ZHeapTupleData
 	uint32		t_len;			/* length of *t_data */
 	ItemPointerData t_self;		/* SelfItemPointer */
 	Oid			t_tableOid;		/* table the tuple came from */
+#define FIELDNO_ZHEAPTUPLEDATA_DATA 3
 	ZHeapTupleHeader t_data;	/* -> tuple header and data */
 } ZHeapTupleData;
 
@@ -211,19 +217,29 @@ typedef ZHeapTupleData *ZHeapTuple;
 
 static inline
 void
-ZHeapTupleHeaderSetXactSlot(ZHeapTupleHeader tup, int slotno)
+ZHeapTupleHeaderSetXactSlot(ZHeapTupleHeader tup, int slotno, int nslots)
 {
 	/*
 	 * The slots that belongs to TPD entry always point to last slot on the
-	 * page.
+	 * page, nslots being the number of slots on the page.
 	 */
-	if (slotno > ZHEAP_PAGE_TRANS_SLOTS)
-		slotno = ZHEAP_PAGE_TRANS_SLOTS;
+	if (slotno > nslots)
+		slotno = nslots;
 
 	(tup)->t_infomask2 = ((tup)->t_infomask2 & ~ZHEAP_XACT_SLOT) |
 		(slotno << ZHEAP_XACT_SLOT_SHIFT);
 }
 
+/*
+ * Frozen slot is never clamped, so marking a tuple frozen doesn't need to
+ * know the number of slots on the page.
+ */
+#define ZHeapTupleHeaderSetXactSlotFrozen(tup) \
+( \
+	(tup)->t_infomask2 = ((tup)->t_infomask2 & ~ZHEAP_XACT_SLOT) | \
+		(ZHTUP_SLOT_FROZEN << ZHEAP_XACT_SLOT_SHIFT) \
+)
+
 #define ZHeapTupleHeaderSetMovedPartitions(tup) \
 ( \
 	(tup)->t_infomask |= ZHEAP_MOVED \
@@ -274,8 +290,10 @@ extern Bitmapset *zheap_tuple_attr_equals(TupleDesc tupdesc, Bitmapset *att_list
 typedef struct ZHeapTupleTableSlot
 {
 	TupleTableSlot base;
+#define FIELDNO_ZHEAPTUPLETABLESLOT_TUPLE 1
 	ZHeapTuple	tuple;			/* physical tuple */
 	ZHeapTupleData tupdata;
+#define FIELDNO_ZHEAPTUPLETABLESLOT_OFF 3
 	uint32		off;			/* saved state for slot_deform_tuple */
 } ZHeapTupleTableSlot;
 
@@ -302,7 +320,8 @@ extern void GetTransactionSlotInfo(Buffer buf, OffsetNumber offset,
 extern void ZHeapTupleGetSubXid(Buffer buf, OffsetNumber offnum,
 								UndoRecPtr urec_ptr, SubTransactionId *subxid);
 extern void ZHeapTupleGetSpecToken(ZHeapTuple zhtup, Buffer buf,
-								   UndoRecPtr urec_ptr, uint32 *specToken);
+								   UndoRecPtr urec_ptr, TransactionId xid,
+								   uint32 *specToken);
 
 /* Page related API's. */
 
@@ -325,7 +344,12 @@ extern void ZHeapTupleGetSpecToken(ZHeapTuple zhtup, Buffer buf,
 	((int) ((MaxZHeapPageFixedSpace) / \
 			(MaxZHeapTupFixedSize)))
 
-#define MaxZHeapTupleSize  (BLCKSZ - MAXALIGN(SizeOfPageHeaderData + SizeOfZHeapPageOpaqueData + sizeof(ItemIdData)))
+#define MaxZHeapTupleSizeForSlots(nslots) \
+	(BLCKSZ - MAXALIGN(SizeOfPageHeaderData + \
+					   SizeOfZHeapPageOpaqueDataForSlots(nslots) + \
+					   sizeof(ItemIdData)))
+#define MaxZHeapTupleSize \
+	MaxZHeapTupleSizeForSlots(ZHEAP_MIN_PAGE_TRANS_SLOTS)
 #define MinZHeapTupleSize  MAXALIGN(SizeofZHeapTupleHeader)
 
 #endif							/* ZHTUP_H */
@@ -0,0 +1,42 @@
+/*-------------------------------------------------------------------------
+ *
+ * zkeysharelock.h
+ *	  shared-memory table of zheap key share tuple locks
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * src/include/access/zkeysharelock.h
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef ZKEYSHARELOCK_H
+#define ZKEYSHARELOCK_H
+
+#include "storage/itemptr.h"
+#include "utils/rel.h"
+
+/* Number of entries in each bucket of the key share lock table. */
+#define ZHEAP_KEYSHARE_BUCKET_SIZE		8
+
+/* Number of partitions of the key share lock table. */
+#define NUM_ZHEAP_KEYSHARE_PARTITIONS	16
+
+/* GUC */
+extern PGDLLIMPORT int zheap_key_share_lock_table_size;
+
+extern Size ZHeapKeyShareLockShmemSize(void);
+extern void ZHeapKeyShareLockShmemInit(void);
+extern bool ZHeapKeyShareLockAcquire(Relation rel, ItemPointer tid);
+extern TransactionId ZHeapKeyShareLockGetHolder(Relation rel, ItemPointer tid);
+
+extern void AtEOXact_ZHeapKeyShareLocks(void);
+extern void AtPrepare_ZHeapKeyShareLocks(void);
+extern void PostPrepare_ZHeapKeyShareLocks(TransactionId xid);
+
+extern void zheap_keyshare_twophase_recover(TransactionId xid, uint16 info,
+											void *recdata, uint32 len);
+extern void zheap_keyshare_twophase_postcommit(TransactionId xid, uint16 info,
+											   void *recdata, uint32 len);
+
+#endif							/* ZKEYSHARELOCK_H */
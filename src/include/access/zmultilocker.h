@@ -20,10 +20,25 @@
 #include "storage/lmgr.h"
 #include "utils/rel.h"
 
+/*
+ * Multi locks on pages with more transaction slots than this, or with more
+ * members than this, are never cached.
+ */
+#define ZMULTILOCK_CACHE_MAX_SLOTS		16
+#define ZMULTILOCK_CACHE_MAX_MEMBERS	16
+
+/* Number of partitions of the multi locker cache. */
+#define NUM_ZMULTILOCK_CACHE_PARTITIONS	16
+
+/* GUC */
+extern PGDLLIMPORT int zheap_multilocker_cache_size;
+
 /* Get the LOCKMODE for a given LockTupleMode */
 #define HWLOCKMODE_from_locktupmode(lockmode) \
 				(GetHWLockModeFromMode(lockmode))
 
+extern Size ZMultiLockCacheShmemSize(void);
+extern void ZMultiLockCacheShmemInit(void);
 extern bool ZCurrentXactHasTupleLockMode(ZHeapTuple zhtup,
 										 UndoRecPtr urec_ptr, LockTupleMode required_mode);
 extern List *ZGetMultiLockMembers(Relation rel, ZHeapTuple zhtup, Buffer buf,
@@ -0,0 +1,34 @@
+/*-------------------------------------------------------------------------
+ *
+ * zspectoken.h
+ *	  shared-memory table of zheap speculative insertion tokens
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * src/include/access/zspectoken.h
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef ZSPECTOKEN_H
+#define ZSPECTOKEN_H
+
+#include "storage/buf.h"
+#include "storage/off.h"
+
+/* Number of partitions of the speculative token table. */
+#define NUM_ZSPECTOKEN_PARTITIONS	16
+
+/* GUC */
+extern PGDLLIMPORT int zheap_spec_token_table_size;
+
+extern Size ZHeapSpecTokenShmemSize(void);
+extern void ZHeapSpecTokenShmemInit(void);
+extern void ZHeapSpecTokenRemember(Buffer buf, OffsetNumber offnum,
+								   TransactionId xid, uint32 token);
+extern void ZHeapSpecTokenForget(Buffer buf, OffsetNumber offnum,
+								 TransactionId xid);
+extern uint32 ZHeapSpecTokenLookup(Buffer buf, OffsetNumber offnum,
+								   TransactionId xid);
+
+#endif							/* ZSPECTOKEN_H */
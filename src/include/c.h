@@ -208,6 +208,19 @@
 #define unlikely(x) ((x) != 0)
 #endif
 
+/*
+ * pg_prefetch_mem
+ *		Ask the CPU to start loading the memory at addr into its caches.
+ *
+ * This is only a hint; it never faults, so addr may be NULL or otherwise
+ * invalid.
+ */
+#if __GNUC__ >= 3
+#define pg_prefetch_mem(addr)	__builtin_prefetch(addr)
+#else
+#define pg_prefetch_mem(addr)	((void) (addr))
+#endif
+
 /*
  * CppAsString
  *		Convert the argument to a string, using the C preprocessor.
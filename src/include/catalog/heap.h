@@ -54,6 +54,7 @@ extern Relation heap_create(const char *relname,
 							TupleDesc tupDesc,
 							char relkind,
 							char relpersistence,
+							Datum reloptions,
 							bool shared_relation,
 							bool mapped_relation,
 							bool allow_system_table_mods,
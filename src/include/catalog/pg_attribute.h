@@ -122,6 +122,13 @@ CATALOG(pg_attribute,1249,AttributeRelationId) BKI_BOOTSTRAP BKI_ROWTYPE_OID(75,
 	 */
 	char		attstorage;
 
+	/*
+	 * attcompression sets the compression method of compressible values of
+	 * this column: 'p' for pglz, 'l' for lz4, or '\0' to use the
+	 * default_toast_compression in effect when a value is stored.
+	 */
+	char		attcompression BKI_DEFAULT('\0');
+
 	/*
 	 * attalign is a copy of the typalign field from pg_type for this
 	 * attribute.  See atttypid comments above.
@@ -0,0 +1,43 @@
+/*
+ * zpq_stream.h
+ *	  Streaming compression of frontend/backend protocol traffic
+ *
+ * Portions Copyright (c) 2019, PostgreSQL Global Development Group
+ *
+ * src/include/common/zpq_stream.h
+ */
+#ifndef ZPQ_STREAM_H
+#define ZPQ_STREAM_H
+
+/* Results of zpq_read() and zpq_write() when the algorithm itself fails */
+#define ZPQ_DECOMPRESS_ERROR	(-2)
+#define ZPQ_COMPRESS_ERROR		(-2)
+
+/*
+ * Callbacks used to move compressed data to and from the transport.  They
+ * have the semantics of send() and recv(), and must leave errno alone on
+ * failure so that callers can tell EWOULDBLOCK from a real error.
+ */
+typedef ssize_t (*zpq_tx_func) (void *arg, const void *data, size_t size);
+typedef ssize_t (*zpq_rx_func) (void *arg, void *data, size_t size);
+
+typedef struct ZpqStream ZpqStream;
+
+/* Big enough for the list of algorithms zpq_supported_algorithms() writes */
+#define ZPQ_ALGORITHMS_BUFSIZE	32
+
+extern bool zpq_algorithm_supported(const char *algorithm);
+extern void zpq_supported_algorithms(char *buf, size_t size);
+extern const char *zpq_choose_algorithm(const char *algorithms);
+extern ZpqStream *zpq_create(const char *algorithm,
+							 zpq_tx_func tx_func, zpq_rx_func rx_func,
+							 void *arg,
+							 const char *rx_data, size_t rx_data_size);
+extern ssize_t zpq_read(ZpqStream *zs, void *buf, size_t size);
+extern ssize_t zpq_write(ZpqStream *zs, const void *buf, size_t size);
+extern bool zpq_buffered_rx(ZpqStream *zs);
+extern bool zpq_buffered_tx(ZpqStream *zs);
+extern const char *zpq_error(ZpqStream *zs);
+extern void zpq_free(ZpqStream *zs);
+
+#endif							/* ZPQ_STREAM_H */
@@ -0,0 +1,78 @@
+/*-------------------------------------------------------------------------
+ *
+ * execBatch.h
+ *	  Batch-at-a-time evaluation of simple scan quals.
+ *
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * src/include/executor/execBatch.h
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef EXECBATCH_H
+#define EXECBATCH_H
+
+#include "executor/tuptable.h"
+#include "fmgr.h"
+#include "nodes/execnodes.h"
+
+/* number of tuples a scan fetches ahead to evaluate its quals on */
+#define EXEC_BATCH_SIZE		1024
+
+/*
+ * TupleBatch - a batch of tuples fetched from a scan.
+ *
+ * The slots are created as they are first needed.  The selection vector sel
+ * gives the positions of the tuples that passed the quals so far, in their
+ * original order; next is the position in it of the next tuple to return.
+ */
+typedef struct TupleBatch
+{
+	TupleDesc	tupdesc;		/* descriptor of the slots */
+	const TupleTableSlotOps *tts_ops;	/* their slot type */
+	int			maxslots;		/* capacity of the batch */
+	int			nslots;			/* number of tuples in the batch */
+	int			nselected;		/* number of entries in sel */
+	int			next;			/* next entry of sel to return */
+	TupleTableSlot **slots;		/* the tuples, NULL if not created yet */
+	uint16	   *sel;			/* selection vector */
+} TupleBatch;
+
+/*
+ * BatchQualStep - a clause of a batch qual: a call to a strict, leakproof
+ * function of two by-value arguments, each a column of the scan tuple or a
+ * non-null constant (already stored in fcinfo).
+ */
+typedef struct BatchQualStep
+{
+	AttrNumber	argattno[2];	/* column index of each argument, or -1 if
+								 * it's the constant */
+	PGFunction	fn_addr;		/* function to call */
+	FunctionCallInfo fcinfo;	/* its arguments */
+} BatchQualStep;
+
+/*
+ * BatchQual - the leading clauses of a scan's qual that can be evaluated on
+ * a TupleBatch at a time.
+ */
+typedef struct BatchQual
+{
+	int			nsteps;			/* number of clauses */
+	BatchQualStep *steps;		/* the clauses, in the qual's order */
+	AttrNumber	maxattno;		/* highest column number they reference */
+} BatchQual;
+
+extern TupleBatch *ExecInitTupleBatch(TupleDesc tupdesc,
+									  const TupleTableSlotOps *tts_ops,
+									  int maxslots);
+extern TupleTableSlot *ExecTupleBatchSlot(TupleBatch *batch, int slotno);
+extern void ExecClearTupleBatch(TupleBatch *batch);
+extern void ExecReleaseTupleBatch(TupleBatch *batch);
+extern BatchQual *ExecInitBatchQual(List *qual, Index scanrelid,
+									List **rest);
+extern void ExecBatchQual(BatchQual *bqual, TupleBatch *batch,
+						  ExprContext *econtext);
+
+#endif							/* EXECBATCH_H */
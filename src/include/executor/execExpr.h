@@ -91,6 +91,17 @@ typedef enum ExprEvalOp
 	EEOP_FUNCEXPR_FUSAGE,
 	EEOP_FUNCEXPR_STRICT_FUSAGE,
 
+	/*
+	 * Compare a Var to a Const or to another Var using one of the built-in
+	 * comparison functions of a few common types, without going through the
+	 * function call interface.  The QUAL variants also do the work of a
+	 * following EEOP_QUAL step.
+	 */
+	EEOP_VAR_CMP_CONST,
+	EEOP_VAR_CMP_VAR,
+	EEOP_QUAL_VAR_CMP_CONST,
+	EEOP_QUAL_VAR_CMP_VAR,
+
 	/*
 	 * Evaluate boolean AND expression, one step per subexpression. FIRST/LAST
 	 * subexpressions are special-cased for performance.  Since AND always has
@@ -124,6 +135,10 @@ typedef enum ExprEvalOp
 	EEOP_NULLTEST_ISNULL,
 	EEOP_NULLTEST_ISNOTNULL,
 
+	/* ditto, also doing the work of a following EEOP_QUAL step */
+	EEOP_QUAL_NULLTEST_ISNULL,
+	EEOP_QUAL_NULLTEST_ISNOTNULL,
+
 	/* perform NULL tests for row values */
 	EEOP_NULLTEST_ROWISNULL,
 	EEOP_NULLTEST_ROWISNOTNULL,
@@ -225,6 +240,7 @@ typedef enum ExprEvalOp
 	EEOP_AGG_DESERIALIZE,
 	EEOP_AGG_STRICT_INPUT_CHECK_ARGS,
 	EEOP_AGG_STRICT_INPUT_CHECK_NULLS,
+	EEOP_AGG_PLAIN_PERGROUP_NULLCHECK,
 	EEOP_AGG_INIT_TRANS,
 	EEOP_AGG_STRICT_TRANS_CHECK,
 	EEOP_AGG_PLAIN_TRANS_BYVAL,
@@ -236,6 +252,35 @@ typedef enum ExprEvalOp
 	EEOP_LAST
 } ExprEvalOp;
 
+/*
+ * Which slot a Var compared by EEOP_[QUAL_]VAR_CMP_* comes from, and the
+ * comparison to apply.  Types that are compared the same way share a
+ * comparison type, e.g. date uses VARCMP_INT4.
+ */
+typedef enum ExprVarCmpSlot
+{
+	VARCMP_INNER,
+	VARCMP_OUTER,
+	VARCMP_SCAN
+} ExprVarCmpSlot;
+
+typedef enum ExprVarCmpType
+{
+	VARCMP_INT4,
+	VARCMP_INT8,
+	VARCMP_FLOAT8
+} ExprVarCmpType;
+
+typedef enum ExprVarCmpOp
+{
+	VARCMP_EQ,
+	VARCMP_NE,
+	VARCMP_LT,
+	VARCMP_LE,
+	VARCMP_GT,
+	VARCMP_GE
+} ExprVarCmpOp;
+
 
 typedef struct ExprEvalStep
 {
@@ -324,6 +369,22 @@ typedef struct ExprEvalStep
 			int			nargs;	/* number of arguments */
 		}			func;
 
+		/* for EEOP_[QUAL_]VAR_CMP_CONST/VAR */
+		struct
+		{
+			int			lattnum;	/* attr number - 1 of left Var */
+			int			rattnum;	/* attr number - 1 of right Var, if any */
+			Oid			lvartype;	/* type OID of left Var */
+			Oid			rvartype;	/* type OID of right Var, if any */
+			Datum		constval;	/* value of right Const, if any */
+			uint8		lslot;		/* ExprVarCmpSlot of left Var */
+			uint8		rslot;		/* ExprVarCmpSlot of right Var, if any */
+			uint8		cmptype;	/* ExprVarCmpType */
+			uint8		cmpop;		/* ExprVarCmpOp */
+			int			jumpdone;	/* QUAL variants: jump here on false or
+									 * null */
+		}			varcmp;
+
 		/* for EEOP_BOOL_*_STEP */
 		struct
 		{
@@ -331,7 +392,7 @@ typedef struct ExprEvalStep
 			int			jumpdone;	/* jump here if result determined */
 		}			boolexpr;
 
-		/* for EEOP_QUAL */
+		/* for EEOP_QUAL, EEOP_QUAL_NULLTEST_* */
 		struct
 		{
 			int			jumpdone;	/* jump here on false or null */
@@ -622,6 +683,13 @@ typedef struct ExprEvalStep
 			int			jumpnull;
 		}			agg_strict_input_check;
 
+		/* for EEOP_AGG_PLAIN_PERGROUP_NULLCHECK */
+		struct
+		{
+			int			setoff;
+			int			jumpnull;
+		}			agg_plain_pergroup_nullcheck;
+
 		/* for EEOP_AGG_INIT_TRANS */
 		struct
 		{
@@ -713,6 +781,10 @@ extern void ExecEvalFuncExprFusage(ExprState *state, ExprEvalStep *op,
 								   ExprContext *econtext);
 extern void ExecEvalFuncExprStrictFusage(ExprState *state, ExprEvalStep *op,
 										 ExprContext *econtext);
+extern void ExecEvalVarCmpConst(ExprState *state, ExprEvalStep *op,
+								ExprContext *econtext);
+extern void ExecEvalVarCmpVar(ExprState *state, ExprEvalStep *op,
+							  ExprContext *econtext);
 extern void ExecEvalParamExec(ExprState *state, ExprEvalStep *op,
 							  ExprContext *econtext);
 extern void ExecEvalParamExtern(ExprState *state, ExprEvalStep *op,
@@ -250,6 +250,8 @@ typedef struct ParallelHashJoinState
 	Barrier		grow_buckets_barrier;
 	pg_atomic_uint32 distributor;	/* counter for load balancing */
 
+	dsa_pointer bloom;			/* shared Bloom filter words, if any */
+
 	SharedFileSet fileset;		/* space for shared temporary files */
 } ParallelHashJoinState;
 
@@ -281,6 +283,45 @@ typedef struct ParallelHashJoinState
 #define PHJ_GROW_BUCKETS_REINSERTING	2
 #define PHJ_GROW_BUCKETS_PHASE(n)		((n) % 3)	/* circular phases */
 
+/*
+ * Bloom filter over the hash values of all the inner tuples, built while
+ * hashing the inner relation regardless of the batch each tuple goes to.
+ * An outer tuple whose hash value is not in the filter cannot have a match,
+ * so the filter can be checked by the outer scan to discard such tuples
+ * before they reach the join (see HashRuntimeFilter).
+ *
+ * With Parallel Hash, each participant sets the bits for the tuples it
+ * hashed in its private copy, ORs that into the shared copy in DSA memory
+ * (ParallelHashJoinState.bloom) and reads the result back once everyone is
+ * done hashing.
+ */
+typedef struct HashBloomFilter
+{
+	uint32		nbits;			/* size of the bitmap, a power of 2 */
+	uint32	   *words;			/* nbits / 32 words of bitmap */
+} HashBloomFilter;
+
+/*
+ * Runtime filter pushed down from a hash join to the scan on its outer side.
+ * The outer hash keys are rewritten in terms of the scan tuple, so that the
+ * scan can compute the hash value and check it against the Bloom filter
+ * before evaluating its quals or projection; only the join key columns need
+ * to be deformed for the tuples that are discarded.
+ *
+ * The filter disables itself if, after a sample of tuples, it turns out not
+ * to discard enough of them to pay for the extra hashing.
+ *
+ * (The typedef is in nodes/execnodes.h.)
+ */
+struct HashRuntimeFilter
+{
+	HashJoinTable hashtable;	/* provides hash functions and the filter */
+	List	   *hashkeys;		/* outer hash keys, evaluated on scan tuple */
+	bool		active;			/* still worth checking? */
+	uint64		nchecked;		/* number of tuples checked */
+	uint64		nrejected;		/* number of tuples discarded */
+};
+
 typedef struct HashJoinTableData
 {
 	int			nbuckets;		/* # buckets in the in-memory hash table */
@@ -357,6 +398,8 @@ typedef struct HashJoinTableData
 	ParallelHashJoinState *parallel_state;
 	ParallelHashJoinBatchAccessor *batches;
 	dsa_pointer current_chunk_shared;
+
+	HashBloomFilter *bloom;		/* filter on inner hash values, or NULL */
 }			HashJoinTableData;
 
 #endif							/* HASHJOIN_H */
@@ -26,6 +26,14 @@ typedef struct BufferUsage
 	long		local_blks_read;	/* # of local disk blocks read */
 	long		local_blks_dirtied; /* # of shared blocks dirtied */
 	long		local_blks_written; /* # of local disk blocks written */
+	long		undo_blks_hit;	/* # of undo buffer hits */
+	long		undo_blks_read; /* # of undo disk blocks read */
+	long		undo_blks_dirtied;	/* # of undo blocks dirtied */
+	long		undo_records;	/* # of undo records inserted */
+	uint64		undo_bytes;		/* size of undo records inserted */
+	long		wal_records;	/* # of WAL records produced */
+	long		wal_fpi;		/* # of WAL full page images produced */
+	uint64		wal_bytes;		/* size of WAL records produced */
 	long		temp_blks_read; /* # of temp blocks read */
 	long		temp_blks_written;	/* # of temp blocks written */
 	instr_time	blk_read_time;	/* time spent reading */
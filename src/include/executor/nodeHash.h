@@ -25,7 +25,7 @@ extern void ExecEndHash(HashState *node);
 extern void ExecReScanHash(HashState *node);
 
 extern HashJoinTable ExecHashTableCreate(HashState *state, List *hashOperators, List *hashCollations,
-										 bool keepNulls);
+										 bool keepNulls, bool useBloom);
 extern void ExecParallelHashTableAlloc(HashJoinTable hashtable,
 									   int batchno);
 extern void ExecHashTableDestroy(HashJoinTable hashtable);
@@ -49,6 +49,8 @@ extern bool ExecHashGetHashValue(HashJoinTable hashtable,
 								 bool outer_tuple,
 								 bool keep_nulls,
 								 uint32 *hashvalue);
+extern bool ExecHashRuntimeFilterPass(HashRuntimeFilter *filter,
+									  ExprContext *econtext);
 extern void ExecHashGetBucketAndBatch(HashJoinTable hashtable,
 									  uint32 hashvalue,
 									  int *bucketno,
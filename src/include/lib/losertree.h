@@ -0,0 +1,61 @@
+/*
+ * losertree.h
+ *
+ * A tournament tree of losers, for k-way merging
+ *
+ * Portions Copyright (c) 2012-2019, PostgreSQL Global Development Group
+ *
+ * src/include/lib/losertree.h
+ */
+
+#ifndef LOSERTREE_H
+#define LOSERTREE_H
+
+/*
+ * The comparator must return <0 iff a is to be returned before b, 0 iff
+ * a == b, and >0 iff a is to be returned after b.
+ */
+typedef int (*losertree_comparator) (Datum a, Datum b, void *arg);
+
+/*
+ * losertree
+ *
+ *		lt_size			how many leaves are not yet exhausted
+ *		lt_nleaves		how many leaves the tree was built with
+ *		lt_space		how many leaves can be stored in "leaves"
+ *		lt_has_tree_property	no unordered operations since last build
+ *		lt_compare		comparison function to define the order
+ *		lt_arg			user data for comparison function
+ *		lt_nodes		internal nodes: lt_nodes[0] is the winning leaf,
+ *						the others the leaf that lost at that node
+ *		lt_exhausted	whether each leaf has been removed
+ *		lt_leaves		variable-length array of "space" leaves
+ */
+typedef struct losertree
+{
+	int			lt_size;
+	int			lt_nleaves;
+	int			lt_space;
+	bool		lt_has_tree_property;	/* debugging cross-check */
+	losertree_comparator lt_compare;
+	void	   *lt_arg;
+	int		   *lt_nodes;
+	bool	   *lt_exhausted;
+	Datum		lt_leaves[FLEXIBLE_ARRAY_MEMBER];
+} losertree;
+
+extern losertree *losertree_allocate(int capacity,
+									 losertree_comparator compare,
+									 void *arg);
+extern void losertree_reset(losertree *tree);
+extern void losertree_free(losertree *tree);
+extern void losertree_add_unordered(losertree *tree, Datum d);
+extern void losertree_build(losertree *tree);
+extern Datum losertree_first(losertree *tree);
+extern void losertree_remove_first(losertree *tree);
+extern void losertree_replace_first(losertree *tree, Datum d);
+
+#define losertree_empty(t)			((t)->lt_size == 0)
+#define losertree_cur_size(t)		((t)->lt_size)
+
+#endif							/* LOSERTREE_H */
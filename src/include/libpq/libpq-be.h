@@ -131,6 +131,7 @@ typedef struct Port
 	int			remote_hostname_errcode;	/* see above */
 	char	   *remote_port;	/* text rep of remote port */
 	CAC_state	canAcceptConnections;	/* postmaster connection status */
+	bool		pooled;			/* accepted on proxy_port? */
 
 	/*
 	 * Information that needs to be saved from the startup packet and passed
@@ -184,6 +185,11 @@ typedef struct Port
 	void	   *gss;
 #endif
 
+	/*
+	 * Compression algorithm in use on the connection, or NULL if none.
+	 */
+	char	   *compression;
+
 	/*
 	 * SSL structures.
 	 */
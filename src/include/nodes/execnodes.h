@@ -16,6 +16,7 @@
 
 #include "access/tupconvert.h"
 #include "executor/instrument.h"
+#include "lib/ilist.h"
 #include "lib/pairingheap.h"
 #include "nodes/params.h"
 #include "nodes/plannodes.h"
@@ -1026,6 +1027,8 @@ typedef struct PlanState
 	bool		outeropsset;
 	bool		inneropsset;
 	bool		resultopsset;
+
+	bool		async_capable;	/* true if node runs asynchronously */
 } PlanState;
 
 /* ----------------
@@ -1055,6 +1058,22 @@ typedef struct PlanState
 			((PlanState *)(node))->instrument->nfiltered2 += (delta); \
 	} while(0)
 
+/*
+ * AsyncRequest is a request for a tuple from an asynchronously executed
+ * node (the requestee), made by a node that knows how to consume it (the
+ * requestor).  See execAsync.c.
+ */
+typedef struct AsyncRequest
+{
+	struct PlanState *requestor;	/* Node that wants a tuple */
+	struct PlanState *requestee;	/* Node from which a tuple is wanted */
+	int			request_index;	/* Scratch space for requestor */
+	bool		callback_pending;	/* Callback is needed */
+	bool		request_complete;	/* Request complete, result valid */
+	TupleTableSlot *result;		/* Result (NULL or an empty slot if no more
+								 * tuples) */
+} AsyncRequest;
+
 /*
  * EPQState is state for executing an EvalPlanQual recheck on a candidate
  * tuple in ModifyTable or LockRows.  The estate and planstate fields are
@@ -1140,6 +1159,11 @@ typedef struct ModifyTableState
 
 	/* Per plan map for tuple conversion from child to root */
 	TupleConversionMap **mt_per_subplan_tupconv_maps;
+
+	/* Rows buffered for a multi-row insertion, see ExecGetInsertBatch */
+	bool		mt_batch_insert;	/* are INSERT rows being buffered? */
+	struct ModifyTableBatch *mt_batch;	/* batch of the last row's table */
+	List	   *mt_batches;		/* all batches, most recently used first */
 } ModifyTableState;
 
 /* ----------------
@@ -1152,6 +1176,9 @@ typedef struct ModifyTableState
  *							eliminated from the scan, or NULL if not possible.
  *		valid_subplans		for runtime pruning, valid appendplans indexes to
  *							scan.
+ *		asyncplans			appendplans indexes of the subplans that are run
+ *							asynchronously, and the requests made to them.
+ *							See nodeAppend.c.
  * ----------------
  */
 
@@ -1174,6 +1201,20 @@ struct AppendState
 	struct PartitionPruneState *as_prune_state;
 	Bitmapset  *as_valid_subplans;
 	bool		(*choose_next_subplan) (AppendState *);
+
+	/* Asynchronous execution state */
+	bool		as_begun;		/* false means need to initialize */
+	Bitmapset  *as_asyncplans;	/* asynchronous plans indexes */
+	int			as_nasyncplans; /* # of asynchronous plans */
+	AsyncRequest **as_asyncrequests;	/* array of AsyncRequests */
+	TupleTableSlot **as_asyncresults;	/* unreturned results of async plans */
+	int			as_nasyncresults;	/* # of valid entries in as_asyncresults */
+	bool		as_syncdone;	/* true if all synchronous plans done */
+	int			as_nasyncremain;	/* # of remaining asynchronous plans */
+	Bitmapset  *as_needrequest; /* asynchronous plans needing a new request */
+	struct WaitEventSet *as_eventset;	/* WaitEventSet used to configure
+										 * file descriptor wait events */
+	Bitmapset  *as_valid_asyncplans;	/* valid asynchronous plans indexes */
 };
 
 /* ----------------
@@ -1273,6 +1314,8 @@ typedef struct BitmapOrState
  *		currentRelation    relation being scanned (NULL if none)
  *		currentScanDesc    current scan descriptor for scan (NULL if none)
  *		ScanTupleSlot	   pointer to slot in tuple table holding scan tuple
+ *		RuntimeFilter	   filter pushed down by a hash join above (NULL if
+ *						   none), checked before the scan quals
  * ----------------
  */
 typedef struct ScanState
@@ -1281,6 +1324,7 @@ typedef struct ScanState
 	Relation	ss_currentRelation;
 	struct TableScanDescData *ss_currentScanDesc;
 	TupleTableSlot *ss_ScanTupleSlot;
+	struct HashRuntimeFilter *ss_RuntimeFilter;
 } ScanState;
 
 /* ----------------
@@ -1291,6 +1335,11 @@ typedef struct SeqScanState
 {
 	ScanState	ss;				/* its first field is NodeTag */
 	Size		pscan_len;		/* size of parallel heap scan descriptor */
+	/* these fields are used when evaluating quals a batch at a time: */
+	struct BatchQual *batchqual;	/* leading quals evaluated on batches */
+	struct TupleBatch *batch;	/* tuples fetched ahead */
+	bool		batch_done;		/* has the scan returned its last tuple? */
+	TupleTableSlot *scanslot;	/* the original ss_ScanTupleSlot */
 } SeqScanState;
 
 /* ----------------
@@ -1869,12 +1918,21 @@ typedef struct MergeJoinState
  *		hj_JoinState			current state of ExecHashJoin state machine
  *		hj_MatchedOuter			true if found a join match for current outer
  *		hj_OuterNotEmpty		true if outer relation known not empty
+ *		hj_RuntimeFilter		Bloom filter to push down to the outer scan
+ *								(NULL if not applicable)
+ *		hj_OuterAheadSlots		outer tuples read ahead of the probe
+ *								(NULL if not applicable)
+ *		hj_OuterAheadHashes		hash values of the outer tuples read ahead
+ *		hj_OuterAheadCount		number of outer tuples read ahead
+ *		hj_OuterAheadNext		next outer tuple read ahead to return
+ *		hj_OuterAheadDone		true if the end of the batch follows them
  * ----------------
  */
 
 /* these structs are defined in executor/hashjoin.h: */
 typedef struct HashJoinTupleData *HashJoinTuple;
 typedef struct HashJoinTableData *HashJoinTable;
+typedef struct HashRuntimeFilter HashRuntimeFilter;
 
 typedef struct HashJoinState
 {
@@ -1897,6 +1955,12 @@ typedef struct HashJoinState
 	int			hj_JoinState;
 	bool		hj_MatchedOuter;
 	bool		hj_OuterNotEmpty;
+	HashRuntimeFilter *hj_RuntimeFilter;
+	TupleTableSlot **hj_OuterAheadSlots;
+	uint32	   *hj_OuterAheadHashes;
+	int			hj_OuterAheadCount;
+	int			hj_OuterAheadNext;
+	bool		hj_OuterAheadDone;
 } HashJoinState;
 
 
@@ -1922,6 +1986,69 @@ typedef struct MaterialState
 	Tuplestorestate *tuplestorestate;
 } MaterialState;
 
+struct MemoizeEntry;
+struct MemoizeTuple;
+struct MemoizeKey;
+
+/* ----------------
+ *	 MemoizeInstrumentation information
+ * ----------------
+ */
+typedef struct MemoizeInstrumentation
+{
+	uint64		cache_hits;		/* number of rescans where we've found the
+								 * scan parameter values to be cached */
+	uint64		cache_misses;	/* number of rescans where we've not found the
+								 * scan parameter values to be cached. */
+	uint64		cache_evictions;	/* number of cache entries removed due to
+									 * the need to free memory */
+	uint64		cache_overflows;	/* number of times we've had to bypass the
+									 * cache when filling it due to not being
+									 * able to free enough space to store the
+									 * current scan's tuples. */
+	uint64		mem_peak;		/* peak memory usage in bytes */
+} MemoizeInstrumentation;
+
+/* ----------------
+ *	 MemoizeState information
+ *
+ *		memoize nodes are used to cache recent and commonly seen results from
+ *		a parameterized scan.  The cache is a hash table keyed by the values
+ *		of the parameters, and the least recently used entries are evicted
+ *		when it needs more than work_mem.
+ * ----------------
+ */
+typedef struct MemoizeState
+{
+	ScanState	ss;				/* its first field is NodeTag */
+	int			mstatus;		/* value of ExecMemoize state machine */
+	int			nkeys;			/* number of cache keys */
+	struct memoize_hash *hashtable; /* hash table for cache entries */
+	TupleDesc	hashkeydesc;	/* tuple descriptor for cache keys */
+	TupleTableSlot *tableslot;	/* min tuple slot for existing cache entries */
+	TupleTableSlot *probeslot;	/* virtual slot used for hash lookups */
+	ExprState  *cache_eq_expr;	/* Compare exec params to hash key */
+	ExprState **param_exprs;	/* exprs containing the parameters to this
+								 * node */
+	FmgrInfo   *hashfunctions;	/* lookup data for hash funcs nkeys in size */
+	Oid		   *collations;		/* collation for comparisons nkeys in size */
+	uint64		mem_used;		/* bytes of memory used by cache */
+	uint64		mem_limit;		/* memory limit in bytes for the cache */
+	MemoryContext tableContext; /* memory context to store cache data */
+	dlist_head	lru_list;		/* least recently used entry list */
+	struct MemoizeTuple *last_tuple;	/* Used to point to the last tuple
+										 * returned during a cache hit and the
+										 * tuple we last stored when
+										 * populating the cache. */
+	struct MemoizeEntry *entry; /* the entry that 'last_tuple' belongs to or
+								 * NULL if 'last_tuple' is NULL. */
+	bool		singlerow;		/* true if the cache entry is to be marked as
+								 * complete after caching the first tuple. */
+	MemoizeInstrumentation stats;	/* execution statistics */
+	Bitmapset  *keyparamids;	/* Param->paramids of expressions belonging to
+								 * param_exprs */
+} MemoizeState;
+
 /* ----------------
  *	 Shared memory container for per-worker sort information
  * ----------------
@@ -1950,6 +2077,31 @@ typedef struct SortState
 	SharedSortInfo *shared_info;	/* one entry per worker */
 } SortState;
 
+/* ----------------
+ *	 IncrementalSortState information
+ *
+ *		The input is sorted in batches, each consisting of one or more whole
+ *		groups of tuples with equal presorted columns.  group_pivot holds a
+ *		tuple of the current batch to compare the following ones with, and
+ *		transfer_tuple the first tuple of the next batch, which was read to
+ *		detect the end of the current one.
+ * ----------------
+ */
+typedef struct IncrementalSortState
+{
+	ScanState	ss;				/* its first field is NodeTag */
+	bool		bounded;		/* is the result set bounded? */
+	int64		bound;			/* if bounded, how many tuples are needed */
+	int64		bound_Done;		/* number of tuples already returned */
+	bool		outerNodeDone;	/* has the input been read entirely? */
+	bool		batch_sorted;	/* is the current batch ready to return? */
+	int64		n_batches;		/* number of batches sorted, for EXPLAIN */
+	ExprState  *presorted_eq;	/* equality of the presorted columns */
+	TupleTableSlot *group_pivot;	/* tuple to compare the input with */
+	TupleTableSlot *transfer_tuple; /* first tuple of the next batch */
+	void	   *tuplesortstate; /* private state of tuplesort.c */
+} IncrementalSortState;
+
 /* ---------------------
  *	GroupState information
  * ---------------------
@@ -2030,6 +2182,19 @@ typedef struct AggState
 	AggStatePerGroup *all_pergroups;	/* array of first ->pergroups, than
 										 * ->hash_pergroup */
 	ProjectionInfo *combinedproj;	/* projection machinery */
+	/* these fields are used when AGG_HASHED and AGG_MIXED spill to disk: */
+	MemoryContext hash_metacxt; /* memory for the hash tables themselves */
+	struct HashAggSpill *hash_spills;	/* per-hash-table spill partitions */
+	List	   *hash_batches;	/* spilled batches yet to be aggregated */
+	TupleTableSlot *hash_spill_slot;	/* slot for reading spilled tuples */
+	bool		hash_spill_mode;	/* spill input of groups not in memory? */
+	bool		hash_ever_spilled;	/* has anything been spilled since the
+									 * tables were last built? */
+	Size		hash_mem_limit; /* memory limit of the hash tables */
+	uint64		hash_ngroups_current;	/* number of groups in memory */
+	/* these fields are used by a Parallel HashAggregate: */
+	struct ParallelAggState *hash_shared;	/* shared state, or NULL */
+	struct SharedTuplestoreAccessor **hash_shared_partitions;	/* its input */
 } AggState;
 
 /* ----------------
@@ -2185,7 +2350,7 @@ typedef struct GatherMergeState
 	TupleTableSlot **gm_slots;	/* array with nreaders+1 entries */
 	struct TupleQueueReader **reader;	/* array with nreaders active entries */
 	struct GMReaderTupleBuffer *gm_tuple_buffers;	/* nreaders tuple buffers */
-	struct binaryheap *gm_heap; /* binary heap of slot indices */
+	struct losertree *gm_tree;	/* loser tree of slot indices */
 } GatherMergeState;
 
 /* ----------------
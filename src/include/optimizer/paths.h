@@ -17,11 +17,19 @@
 #include "nodes/pathnodes.h"
 
 
+/* possible values for join_search_method */
+typedef enum
+{
+	JOIN_SEARCH_ITERATIVE,		/* iterative dynamic programming */
+	JOIN_SEARCH_GENETIC			/* genetic query optimizer */
+}			JoinSearchMethod;
+
 /*
  * allpaths.c
  */
 extern PGDLLIMPORT bool enable_geqo;
 extern PGDLLIMPORT int geqo_threshold;
+extern PGDLLIMPORT int join_search_method;
 extern PGDLLIMPORT int min_parallel_table_scan_size;
 extern PGDLLIMPORT int min_parallel_index_scan_size;
 
@@ -183,6 +191,8 @@ typedef enum
 
 extern PathKeysComparison compare_pathkeys(List *keys1, List *keys2);
 extern bool pathkeys_contained_in(List *keys1, List *keys2);
+extern bool pathkeys_count_contained_in(List *keys1, List *keys2,
+										int *n_common);
 extern Path *get_cheapest_path_for_pathkeys(List *paths, List *pathkeys,
 											Relids required_outer,
 											CostSelector cost_criterion,
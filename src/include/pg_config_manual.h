@@ -234,6 +234,13 @@
  */
 #define PG_CACHE_LINE_SIZE		128
 
+/*
+ * Alignment of buffers used for direct I/O (see io_direct).  Memory, file
+ * offsets and lengths must all be multiples of the logical block size of the
+ * device; 4kB covers all common ones.
+ */
+#define PG_IO_ALIGN_SIZE		4096
+
 /*
  *------------------------------------------------------------------------
  * The following symbols are for enabling debugging code, not for
@@ -29,6 +29,8 @@
 #define PGSTAT_STAT_PERMANENT_DIRECTORY		"pg_stat"
 #define PGSTAT_STAT_PERMANENT_FILENAME		"pg_stat/global.stat"
 #define PGSTAT_STAT_PERMANENT_TMPFILE		"pg_stat/global.tmp"
+#define PGSTAT_OBJECTS_FILENAME				"pg_stat/objects.stat"
+#define PGSTAT_OBJECTS_TMPFILE				"pg_stat/objects.tmp"
 
 /* Default directory to store temporary statistics data in */
 #define PG_STAT_TMP_DIR		"pg_stat_tmp"
@@ -49,23 +51,19 @@ typedef enum StatMsgType
 {
 	PGSTAT_MTYPE_DUMMY,
 	PGSTAT_MTYPE_INQUIRY,
-	PGSTAT_MTYPE_TABSTAT,
-	PGSTAT_MTYPE_TABPURGE,
+	PGSTAT_MTYPE_DBSTAT,
 	PGSTAT_MTYPE_DROPDB,
 	PGSTAT_MTYPE_RESETCOUNTER,
 	PGSTAT_MTYPE_RESETSHAREDCOUNTER,
 	PGSTAT_MTYPE_RESETSINGLECOUNTER,
 	PGSTAT_MTYPE_AUTOVAC_START,
-	PGSTAT_MTYPE_VACUUM,
-	PGSTAT_MTYPE_ANALYZE,
 	PGSTAT_MTYPE_ARCHIVER,
 	PGSTAT_MTYPE_BGWRITER,
-	PGSTAT_MTYPE_FUNCSTAT,
-	PGSTAT_MTYPE_FUNCPURGE,
 	PGSTAT_MTYPE_RECOVERYCONFLICT,
 	PGSTAT_MTYPE_TEMPFILE,
 	PGSTAT_MTYPE_DEADLOCK,
-	PGSTAT_MTYPE_CHECKSUMFAILURE
+	PGSTAT_MTYPE_CHECKSUMFAILURE,
+	PGSTAT_MTYPE_IO
 } StatMsgType;
 
 /* ----------
@@ -78,9 +76,8 @@ typedef int64 PgStat_Counter;
  * PgStat_TableCounts			The actual per-table counts kept by a backend
  *
  * This struct should contain only actual event counters, because we memcmp
- * it against zeroes to detect whether there are any counts to transmit.
- * It is a component of PgStat_TableStatus (within-backend state) and
- * PgStat_TableEntry (the transmitted message format).
+ * it against zeroes to detect whether there are any counts to flush.
+ * It is a component of PgStat_TableStatus (within-backend state).
  *
  * Note: for a table, tuples_returned is the number of tuples successfully
  * fetched by heap_getnext, while tuples_fetched is the number of tuples
@@ -93,6 +90,10 @@ typedef int64 PgStat_Counter;
  * regardless of whether the transaction committed.  delta_live_tuples,
  * delta_dead_tuples, and changed_tuples are set depending on commit or abort.
  * Note that delta_live_tuples and delta_dead_tuples can be negative!
+ *
+ * The zheap_* counters are only advanced for zheap tables: TPD entries
+ * allocated, waits for a free transaction slot, pages pruned, and bytes of
+ * undo written.  Like hot_updated, they don't depend on commit or abort.
  * ----------
  */
 typedef struct PgStat_TableCounts
@@ -115,13 +116,19 @@ typedef struct PgStat_TableCounts
 
 	PgStat_Counter t_blocks_fetched;
 	PgStat_Counter t_blocks_hit;
+
+	PgStat_Counter t_zheap_tpd_allocs;
+	PgStat_Counter t_zheap_slot_waits;
+	PgStat_Counter t_zheap_prunes;
+	PgStat_Counter t_zheap_undo_bytes;
 } PgStat_TableCounts;
 
 /* Possible targets for resetting cluster-wide shared values */
 typedef enum PgStat_Shared_Reset_Target
 {
 	RESET_ARCHIVER,
-	RESET_BGWRITER
+	RESET_BGWRITER,
+	RESET_IO
 } PgStat_Shared_Reset_Target;
 
 /* Possible object types for resetting single counters */
@@ -157,7 +164,7 @@ typedef struct PgStat_TableStatus
 	Oid			t_id;			/* table's OID */
 	bool		t_shared;		/* is it a shared catalog? */
 	struct PgStat_TableXactStatus *trans;	/* lowest subxact's counts */
-	PgStat_TableCounts t_counts;	/* event counts to be sent */
+	PgStat_TableCounts t_counts;	/* event counts to be flushed */
 } PgStat_TableStatus;
 
 /* ----------
@@ -225,13 +232,12 @@ typedef struct PgStat_MsgDummy
 
 /* ----------
  * PgStat_MsgInquiry			Sent by a backend to ask the collector
- *								to write the stats file(s).
+ *								to write the stats file.
  *
- * Ordinarily, an inquiry message prompts writing of the global stats file,
- * the stats file for shared catalogs, and the stats file for the specified
- * database.  If databaseid is InvalidOid, only the first two are written.
+ * The request is for current data about the specified database, or only
+ * about cluster-wide stats if databaseid is InvalidOid.
  *
- * New file(s) will be written only if the existing file has a timestamp
+ * A new file will be written only if the existing file has a timestamp
  * older than the specified cutoff_time; this prevents duplicated effort
  * when multiple requests arrive at nearly the same time, assuming that
  * backends send requests with cutoff_times a little bit in the past.
@@ -252,53 +258,29 @@ typedef struct PgStat_MsgInquiry
 
 
 /* ----------
- * PgStat_TableEntry			Per-table info in a MsgTabstat
+ * PgStat_MsgDbstat				Sent by the backend to report the
+ *								database-wide sums of its transaction,
+ *								table and buffer access statistics.  The
+ *								per-table counts themselves go to shared
+ *								memory.
  * ----------
  */
-typedef struct PgStat_TableEntry
-{
-	Oid			t_id;
-	PgStat_TableCounts t_counts;
-} PgStat_TableEntry;
-
-/* ----------
- * PgStat_MsgTabstat			Sent by the backend to report table
- *								and buffer access statistics.
- * ----------
- */
-#define PGSTAT_NUM_TABENTRIES  \
-	((PGSTAT_MSG_PAYLOAD - sizeof(Oid) - 3 * sizeof(int) - 2 * sizeof(PgStat_Counter))	\
-	 / sizeof(PgStat_TableEntry))
-
-typedef struct PgStat_MsgTabstat
+typedef struct PgStat_MsgDbstat
 {
 	PgStat_MsgHdr m_hdr;
 	Oid			m_databaseid;
-	int			m_nentries;
 	int			m_xact_commit;
 	int			m_xact_rollback;
 	PgStat_Counter m_block_read_time;	/* times in microseconds */
 	PgStat_Counter m_block_write_time;
-	PgStat_TableEntry m_entry[PGSTAT_NUM_TABENTRIES];
-} PgStat_MsgTabstat;
-
-
-/* ----------
- * PgStat_MsgTabpurge			Sent by the backend to tell the collector
- *								about dead tables.
- * ----------
- */
-#define PGSTAT_NUM_TABPURGE  \
-	((PGSTAT_MSG_PAYLOAD - sizeof(Oid) - sizeof(int))  \
-	 / sizeof(Oid))
-
-typedef struct PgStat_MsgTabpurge
-{
-	PgStat_MsgHdr m_hdr;
-	Oid			m_databaseid;
-	int			m_nentries;
-	Oid			m_tableid[PGSTAT_NUM_TABPURGE];
-} PgStat_MsgTabpurge;
+	PgStat_Counter m_tuples_returned;
+	PgStat_Counter m_tuples_fetched;
+	PgStat_Counter m_tuples_inserted;
+	PgStat_Counter m_tuples_updated;
+	PgStat_Counter m_tuples_deleted;
+	PgStat_Counter m_blocks_fetched;
+	PgStat_Counter m_blocks_hit;
+} PgStat_MsgDbstat;
 
 
 /* ----------
@@ -361,41 +343,6 @@ typedef struct PgStat_MsgAutovacStart
 } PgStat_MsgAutovacStart;
 
 
-/* ----------
- * PgStat_MsgVacuum				Sent by the backend or autovacuum daemon
- *								after VACUUM
- * ----------
- */
-typedef struct PgStat_MsgVacuum
-{
-	PgStat_MsgHdr m_hdr;
-	Oid			m_databaseid;
-	Oid			m_tableoid;
-	bool		m_autovacuum;
-	TimestampTz m_vacuumtime;
-	PgStat_Counter m_live_tuples;
-	PgStat_Counter m_dead_tuples;
-} PgStat_MsgVacuum;
-
-
-/* ----------
- * PgStat_MsgAnalyze			Sent by the backend or autovacuum daemon
- *								after ANALYZE
- * ----------
- */
-typedef struct PgStat_MsgAnalyze
-{
-	PgStat_MsgHdr m_hdr;
-	Oid			m_databaseid;
-	Oid			m_tableoid;
-	bool		m_autovacuum;
-	bool		m_resetcounter;
-	TimestampTz m_analyzetime;
-	PgStat_Counter m_live_tuples;
-	PgStat_Counter m_dead_tuples;
-} PgStat_MsgAnalyze;
-
-
 /* ----------
  * PgStat_MsgArchiver			Sent by the archiver to update statistics.
  * ----------
@@ -459,7 +406,7 @@ typedef struct PgStat_MsgTempFile
  * it against zeroes to detect whether there are any counts to transmit.
  *
  * Note that the time counters are in instr_time format here.  We convert to
- * microseconds in PgStat_Counter format when transmitting to the collector.
+ * microseconds in PgStat_Counter format when adding them to shared memory.
  * ----------
  */
 typedef struct PgStat_FunctionCounts
@@ -480,74 +427,111 @@ typedef struct PgStat_BackendFunctionEntry
 } PgStat_BackendFunctionEntry;
 
 /* ----------
- * PgStat_FunctionEntry			Per-function info in a MsgFuncstat
+ * PgStat_MsgDeadlock			Sent by the backend to tell the collector
+ *								about a deadlock that occurred.
  * ----------
  */
-typedef struct PgStat_FunctionEntry
+typedef struct PgStat_MsgDeadlock
 {
-	Oid			f_id;
-	PgStat_Counter f_numcalls;
-	PgStat_Counter f_total_time;	/* times in microseconds */
-	PgStat_Counter f_self_time;
-} PgStat_FunctionEntry;
+	PgStat_MsgHdr m_hdr;
+	Oid			m_databaseid;
+} PgStat_MsgDeadlock;
 
 /* ----------
- * PgStat_MsgFuncstat			Sent by the backend to report function
- *								usage statistics.
+ * PgStat_MsgChecksumFailure	Sent by the backend to tell the collector
+ *								about checksum failures noticed.
  * ----------
  */
-#define PGSTAT_NUM_FUNCENTRIES	\
-	((PGSTAT_MSG_PAYLOAD - sizeof(Oid) - sizeof(int))  \
-	 / sizeof(PgStat_FunctionEntry))
-
-typedef struct PgStat_MsgFuncstat
+typedef struct PgStat_MsgChecksumFailure
 {
 	PgStat_MsgHdr m_hdr;
 	Oid			m_databaseid;
-	int			m_nentries;
-	PgStat_FunctionEntry m_entry[PGSTAT_NUM_FUNCENTRIES];
-} PgStat_MsgFuncstat;
+	int			m_failurecount;
+	TimestampTz m_failure_time;
+} PgStat_MsgChecksumFailure;
+
 
 /* ----------
- * PgStat_MsgFuncpurge			Sent by the backend to tell the collector
- *								about dead functions.
+ * I/O statistics are kept by the kind of process doing the I/O, the kind
+ * of object it is done on, and the context, which tells whether the buffer
+ * manager was using a buffer access strategy for it.  The contexts other
+ * than IOCONTEXT_NORMAL only apply to IOOBJECT_RELATION.
  * ----------
  */
-#define PGSTAT_NUM_FUNCPURGE  \
-	((PGSTAT_MSG_PAYLOAD - sizeof(Oid) - sizeof(int))  \
-	 / sizeof(Oid))
+typedef enum IOBackendType
+{
+	IOBACKEND_AUTOVAC_LAUNCHER,
+	IOBACKEND_AUTOVAC_WORKER,
+	IOBACKEND_BACKEND,
+	IOBACKEND_BG_WORKER,
+	IOBACKEND_BG_WRITER,
+	IOBACKEND_CHECKPOINTER,
+	IOBACKEND_STARTUP,
+	IOBACKEND_WAL_RECEIVER,
+	IOBACKEND_WAL_SENDER,
+	IOBACKEND_WAL_WRITER,
+	IOBACKEND_UNDO_LAUNCHER,
+	IOBACKEND_UNDO_WORKER,
+	IOBACKEND_DISCARD_WORKER
+} IOBackendType;
+
+#define IOBACKEND_NUM_TYPES		(IOBACKEND_DISCARD_WORKER + 1)
+
+typedef enum IOObject
+{
+	IOOBJECT_RELATION,			/* permanent relation data */
+	IOOBJECT_TEMP_RELATION,		/* temporary relation data */
+	IOOBJECT_UNDO,				/* undo logs */
+	IOOBJECT_TEMP_FILE,			/* temporary files of sorts, hashes etc. */
+	IOOBJECT_WAL				/* write-ahead log */
+} IOObject;
 
-typedef struct PgStat_MsgFuncpurge
+#define IOOBJECT_NUM_TYPES		(IOOBJECT_WAL + 1)
+
+typedef enum IOContext
 {
-	PgStat_MsgHdr m_hdr;
-	Oid			m_databaseid;
-	int			m_nentries;
-	Oid			m_functionid[PGSTAT_NUM_FUNCPURGE];
-} PgStat_MsgFuncpurge;
+	IOCONTEXT_NORMAL,
+	IOCONTEXT_VACUUM,
+	IOCONTEXT_BULKREAD,
+	IOCONTEXT_BULKWRITE
+} IOContext;
+
+#define IOCONTEXT_NUM_TYPES		(IOCONTEXT_BULKWRITE + 1)
+
+typedef enum IOOp
+{
+	IOOP_READ,
+	IOOP_WRITE,
+	IOOP_EXTEND,
+	IOOP_FSYNC
+} IOOp;
+
+#define IOOP_NUM_TYPES			(IOOP_FSYNC + 1)
 
 /* ----------
- * PgStat_MsgDeadlock			Sent by the backend to tell the collector
- *								about a deadlock that occurred.
+ * PgStat_IOCounts			I/O counts of one kind of object
+ *
+ * Times are in microseconds, and only measured with track_io_timing.
  * ----------
  */
-typedef struct PgStat_MsgDeadlock
+typedef struct PgStat_IOCounts
 {
-	PgStat_MsgHdr m_hdr;
-	Oid			m_databaseid;
-} PgStat_MsgDeadlock;
+	PgStat_Counter counts[IOCONTEXT_NUM_TYPES][IOOP_NUM_TYPES];
+	PgStat_Counter times[IOCONTEXT_NUM_TYPES][IOOP_NUM_TYPES];
+} PgStat_IOCounts;
 
 /* ----------
- * PgStat_MsgChecksumFailure	Sent by the backend to tell the collector
- *								about checksum failures noticed.
+ * PgStat_MsgIO				Sent by any process to report the I/O it has
+ *							done on one kind of object
  * ----------
  */
-typedef struct PgStat_MsgChecksumFailure
+typedef struct PgStat_MsgIO
 {
 	PgStat_MsgHdr m_hdr;
-	Oid			m_databaseid;
-	int			m_failurecount;
-	TimestampTz m_failure_time;
-} PgStat_MsgChecksumFailure;
+	IOBackendType m_backend_type;
+	IOObject	m_object;
+	PgStat_IOCounts m_counts;
+} PgStat_MsgIO;
 
 
 /* ----------
@@ -559,23 +543,19 @@ typedef union PgStat_Msg
 	PgStat_MsgHdr msg_hdr;
 	PgStat_MsgDummy msg_dummy;
 	PgStat_MsgInquiry msg_inquiry;
-	PgStat_MsgTabstat msg_tabstat;
-	PgStat_MsgTabpurge msg_tabpurge;
+	PgStat_MsgDbstat msg_dbstat;
 	PgStat_MsgDropdb msg_dropdb;
 	PgStat_MsgResetcounter msg_resetcounter;
 	PgStat_MsgResetsharedcounter msg_resetsharedcounter;
 	PgStat_MsgResetsinglecounter msg_resetsinglecounter;
 	PgStat_MsgAutovacStart msg_autovacuum_start;
-	PgStat_MsgVacuum msg_vacuum;
-	PgStat_MsgAnalyze msg_analyze;
 	PgStat_MsgArchiver msg_archiver;
 	PgStat_MsgBgWriter msg_bgwriter;
-	PgStat_MsgFuncstat msg_funcstat;
-	PgStat_MsgFuncpurge msg_funcpurge;
 	PgStat_MsgRecoveryConflict msg_recoveryconflict;
 	PgStat_MsgDeadlock msg_deadlock;
 	PgStat_MsgTempFile msg_tempfile;
 	PgStat_MsgChecksumFailure msg_checksumfailure;
+	PgStat_MsgIO msg_io;
 } PgStat_Msg;
 
 
@@ -587,7 +567,7 @@ typedef union PgStat_Msg
  * ------------------------------------------------------------
  */
 
-#define PGSTAT_FILE_FORMAT_ID	0x01A5BC9D
+#define PGSTAT_FILE_FORMAT_ID	0x01A5BCA1
 
 /* ----------
  * PgStat_StatDBEntry			The collector's data per database
@@ -621,18 +601,12 @@ typedef struct PgStat_StatDBEntry
 
 	TimestampTz stat_reset_timestamp;
 	TimestampTz stats_timestamp;	/* time of db stats file update */
-
-	/*
-	 * tables and functions must be last in the struct, because we don't write
-	 * the pointers out to the stats file.
-	 */
-	HTAB	   *tables;
-	HTAB	   *functions;
 } PgStat_StatDBEntry;
 
 
 /* ----------
- * PgStat_StatTabEntry			The collector's data per table (or index)
+ * PgStat_StatTabEntry			The cumulative data per table (or index),
+ *								kept in shared memory
  * ----------
  */
 typedef struct PgStat_StatTabEntry
@@ -658,6 +632,14 @@ typedef struct PgStat_StatTabEntry
 	PgStat_Counter blocks_fetched;
 	PgStat_Counter blocks_hit;
 
+	PgStat_Counter zheap_tpd_allocs;
+	PgStat_Counter zheap_slot_waits;
+	PgStat_Counter zheap_prunes;
+	PgStat_Counter zheap_undo_bytes;
+	/* the values of two of the above as of the latest vacuum */
+	PgStat_Counter zheap_tpd_allocs_at_vacuum;
+	PgStat_Counter zheap_undo_bytes_at_vacuum;
+
 	TimestampTz vacuum_timestamp;	/* user initiated vacuum */
 	PgStat_Counter vacuum_count;
 	TimestampTz autovac_vacuum_timestamp;	/* autovacuum initiated */
@@ -670,7 +652,8 @@ typedef struct PgStat_StatTabEntry
 
 
 /* ----------
- * PgStat_StatFuncEntry			The collector's data per function
+ * PgStat_StatFuncEntry			The cumulative data per function, kept in
+ *								shared memory
  * ----------
  */
 typedef struct PgStat_StatFuncEntry
@@ -719,6 +702,15 @@ typedef struct PgStat_GlobalStats
 	TimestampTz stat_reset_timestamp;
 } PgStat_GlobalStats;
 
+/*
+ * I/O statistics kept in the stats collector
+ */
+typedef struct PgStat_IOStats
+{
+	PgStat_IOCounts counts[IOBACKEND_NUM_TYPES][IOOBJECT_NUM_TYPES];
+	TimestampTz stat_reset_timestamp;
+} PgStat_IOStats;
+
 
 /* ----------
  * Backend types
@@ -781,13 +773,16 @@ typedef enum BackendState
  */
 typedef enum
 {
-	WAIT_EVENT_ARCHIVER_MAIN = PG_WAIT_ACTIVITY,
+	WAIT_EVENT_AIO_WORKER_MAIN = PG_WAIT_ACTIVITY,
+	WAIT_EVENT_ARCHIVER_MAIN,
 	WAIT_EVENT_AUTOVACUUM_MAIN,
 	WAIT_EVENT_BGWRITER_HIBERNATE,
 	WAIT_EVENT_BGWRITER_MAIN,
 	WAIT_EVENT_CHECKPOINTER_MAIN,
 	WAIT_EVENT_LOGICAL_APPLY_MAIN,
 	WAIT_EVENT_LOGICAL_LAUNCHER_MAIN,
+	WAIT_EVENT_LOGICAL_PARALLEL_APPLY_MAIN,
+	WAIT_EVENT_PARALLEL_WORKER_POOL_MAIN,
 	WAIT_EVENT_PGSTAT_MAIN,
 	WAIT_EVENT_RECOVERY_WAL_ALL,
 	WAIT_EVENT_RECOVERY_WAL_STREAM,
@@ -797,7 +792,8 @@ typedef enum
 	WAIT_EVENT_WAL_WRITER_MAIN,
 	WAIT_EVENT_UNDO_DISCARD_WORKER_MAIN,
 	WAIT_EVENT_UNDO_LAUNCHER_MAIN,
-	WAIT_EVENT_UNDO_WORKER_MAIN
+	WAIT_EVENT_UNDO_WORKER_MAIN,
+	WAIT_EVENT_WAL_SUMMARIZER_MAIN
 } WaitEventActivity;
 
 /* ----------
@@ -830,7 +826,8 @@ typedef enum
  */
 typedef enum
 {
-	WAIT_EVENT_BGWORKER_SHUTDOWN = PG_WAIT_IPC,
+	WAIT_EVENT_APPEND_READY = PG_WAIT_IPC,
+	WAIT_EVENT_BGWORKER_SHUTDOWN,
 	WAIT_EVENT_BGWORKER_STARTUP,
 	WAIT_EVENT_BTREE_PAGE,
 	WAIT_EVENT_CLOG_GROUP_UPDATE,
@@ -852,6 +849,8 @@ typedef enum
 	WAIT_EVENT_HASH_GROW_BUCKETS_ALLOCATING,
 	WAIT_EVENT_HASH_GROW_BUCKETS_ELECTING,
 	WAIT_EVENT_HASH_GROW_BUCKETS_REINSERTING,
+	WAIT_EVENT_HASHAGG_PARTITIONING,
+	WAIT_EVENT_LOGICAL_PARALLEL_APPLY_STATE_CHANGE,
 	WAIT_EVENT_LOGICAL_SYNC_DATA,
 	WAIT_EVENT_LOGICAL_SYNC_STATE_CHANGE,
 	WAIT_EVENT_MQ_INTERNAL,
@@ -859,14 +858,19 @@ typedef enum
 	WAIT_EVENT_MQ_RECEIVE,
 	WAIT_EVENT_MQ_SEND,
 	WAIT_EVENT_PARALLEL_BITMAP_SCAN,
+	WAIT_EVENT_PARALLEL_CLUSTER_SCAN,
+	WAIT_EVENT_PARALLEL_COPY_FREE,
+	WAIT_EVENT_PARALLEL_COPY_INPUT,
 	WAIT_EVENT_PARALLEL_CREATE_INDEX_SCAN,
 	WAIT_EVENT_PARALLEL_FINISH,
+	WAIT_EVENT_PARALLEL_ZHEAP_REWRITE,
 	WAIT_EVENT_PROCARRAY_GROUP_UPDATE,
 	WAIT_EVENT_PROMOTE,
 	WAIT_EVENT_REPLICATION_ORIGIN_DROP,
 	WAIT_EVENT_REPLICATION_SLOT_DROP,
 	WAIT_EVENT_SAFE_SNAPSHOT,
-	WAIT_EVENT_SYNC_REP
+	WAIT_EVENT_SYNC_REP,
+	WAIT_EVENT_WAL_SUMMARY_READY
 } WaitEventIPC;
 
 /* ----------
@@ -954,6 +958,8 @@ typedef enum
 	WAIT_EVENT_UNDO_FILE_WRITE,
 	WAIT_EVENT_UNDO_FILE_FLUSH,
 	WAIT_EVENT_UNDO_FILE_SYNC,
+	WAIT_EVENT_UNDO_SPOOL_READ,
+	WAIT_EVENT_UNDO_SPOOL_WRITE,
 	WAIT_EVENT_WALSENDER_TIMELINE_HISTORY_READ,
 	WAIT_EVENT_WAL_BOOTSTRAP_SYNC,
 	WAIT_EVENT_WAL_BOOTSTRAP_WRITE,
@@ -1242,6 +1248,12 @@ extern char *pgstat_stat_filename;
  */
 extern PgStat_MsgBgWriter BgWriterStats;
 
+/*
+ * I/O context of the buffer manager's current operation, for the smgr layer
+ * to count its I/O under
+ */
+extern IOContext pgStatIOContext;
+
 /*
  * Updated by pgstat_count_buffer_*_time macros
  */
@@ -1254,10 +1266,14 @@ extern PgStat_Counter pgStatBlockWriteTime;
  */
 extern Size BackendStatusShmemSize(void);
 extern void CreateSharedBackendStatus(void);
+extern Size PgStatShmemSize(void);
+extern void PgStatShmemInit(void);
 
 extern void pgstat_init(void);
 extern int	pgstat_start(void);
 extern void pgstat_reset_all(void);
+extern void pgstat_write_object_stats(void);
+extern void pgstat_read_object_stats(void);
 extern void allow_immediate_pgstat_restart(void);
 
 #ifdef EXEC_BACKEND
@@ -1411,6 +1427,26 @@ pgstat_report_wait_end(void)
 		if ((rel)->pgstat_info != NULL)								\
 			(rel)->pgstat_info->t_counts.t_blocks_hit++;			\
 	} while (0)
+#define pgstat_count_zheap_tpd_alloc(rel)							\
+	do {															\
+		if ((rel)->pgstat_info != NULL)								\
+			(rel)->pgstat_info->t_counts.t_zheap_tpd_allocs++;		\
+	} while (0)
+#define pgstat_count_zheap_slot_wait(rel)							\
+	do {															\
+		if ((rel)->pgstat_info != NULL)								\
+			(rel)->pgstat_info->t_counts.t_zheap_slot_waits++;		\
+	} while (0)
+#define pgstat_count_zheap_prune(rel)								\
+	do {															\
+		if ((rel)->pgstat_info != NULL)								\
+			(rel)->pgstat_info->t_counts.t_zheap_prunes++;			\
+	} while (0)
+#define pgstat_count_zheap_undo_bytes(rel, n)						\
+	do {															\
+		if ((rel)->pgstat_info != NULL)								\
+			(rel)->pgstat_info->t_counts.t_zheap_undo_bytes += (n);	\
+	} while (0)
 #define pgstat_count_buffer_read_time(n)							\
 	(pgStatBlockReadTime += (n))
 #define pgstat_count_buffer_write_time(n)							\
@@ -1442,6 +1478,14 @@ extern void pgstat_twophase_postabort(TransactionId xid, uint16 info,
 extern void pgstat_send_archiver(const char *xlog, bool failed);
 extern void pgstat_send_bgwriter(void);
 
+extern instr_time pgstat_io_start(void);
+extern void pgstat_count_io(IOObject io_object, IOContext io_context,
+							IOOp io_op, int cnt, instr_time start);
+extern void pgstat_send_io(bool force);
+extern const char *pgstat_get_io_backend_desc(IOBackendType type);
+extern const char *pgstat_get_io_object_desc(IOObject io_object);
+extern const char *pgstat_get_io_context_desc(IOContext io_context);
+
 /* ----------
  * Support functions for the SQL-callable functions to
  * generate the pgstat* views.
@@ -1449,11 +1493,14 @@ extern void pgstat_send_bgwriter(void);
  */
 extern PgStat_StatDBEntry *pgstat_fetch_stat_dbentry(Oid dbid);
 extern PgStat_StatTabEntry *pgstat_fetch_stat_tabentry(Oid relid);
+extern PgStat_StatTabEntry *pgstat_fetch_stat_tabentry_ext(bool shared,
+														   Oid relid);
 extern PgBackendStatus *pgstat_fetch_stat_beentry(int beid);
 extern LocalPgBackendStatus *pgstat_fetch_stat_local_beentry(int beid);
 extern PgStat_StatFuncEntry *pgstat_fetch_stat_funcentry(Oid funcid);
 extern int	pgstat_fetch_stat_numbackends(void);
 extern PgStat_ArchiverStats *pgstat_fetch_stat_archiver(void);
 extern PgStat_GlobalStats *pgstat_fetch_global(void);
+extern PgStat_IOStats *pgstat_fetch_stat_io(void);
 
 #endif							/* PGSTAT_H */
@@ -0,0 +1,52 @@
+/*-------------------------------------------------------------------------
+ *
+ * pg_iovec.h
+ *	  Header for vectored I/O functions, to use in place of <sys/uio.h>.
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * src/include/port/pg_iovec.h
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef PG_IOVEC_H
+#define PG_IOVEC_H
+
+#include <limits.h>
+
+#ifndef WIN32
+#include <sys/uio.h>
+#endif
+
+#ifdef WIN32
+/* POSIX requires at least 16 as a maximum iovcnt. */
+#define IOV_MAX 16
+
+/* Define our own POSIX-compatible iovec struct. */
+struct iovec
+{
+	void	   *iov_base;
+	size_t		iov_len;
+};
+#endif
+
+/* Define a reasonable maximum that is safe to use on the stack. */
+#if defined(IOV_MAX) && IOV_MAX < 32
+#define PG_IOV_MAX IOV_MAX
+#else
+#define PG_IOV_MAX 32
+#endif
+
+/*
+ * Like pg_pwrite(), the replacement function may change the current file
+ * position, so it gets a pg_ prefix.
+ */
+#ifdef HAVE_PWRITEV
+#define pg_pwritev pwritev
+#else
+extern ssize_t pg_pwritev(int fd, const struct iovec *iov, int iovcnt,
+						  off_t offset);
+#endif
+
+#endif							/* PG_IOVEC_H */
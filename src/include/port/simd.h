@@ -0,0 +1,122 @@
+/*-------------------------------------------------------------------------
+ *
+ * simd.h
+ *	  Support for platform-specific vector operations.
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * src/include/port/simd.h
+ *
+ * NOTES
+ * - On x86-64, SSE2 is part of the baseline instruction set, so it can be
+ *   used without a runtime check.  Elsewhere, a Vector8 is a uint64 and the
+ *   operations work on its bytes with ordinary bitwise arithmetic.
+ * - The operations only answer whether any byte of a vector has a property,
+ *   which is what scanning for special characters needs.
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef SIMD_H
+#define SIMD_H
+
+#if (defined(__x86_64__) || defined(_M_AMD64))
+#include <emmintrin.h>
+#define USE_SSE2
+typedef __m128i Vector8;
+#else
+#define USE_NO_SIMD
+typedef uint64 Vector8;
+#endif
+
+/*
+ * Load a chunk of memory into a vector.  The memory need not be aligned.
+ */
+static inline Vector8
+vector8_load(const uint8 *s)
+{
+#ifdef USE_SSE2
+	return _mm_loadu_si128((const __m128i *) s);
+#else
+	Vector8		v;
+
+	memcpy(&v, s, sizeof(Vector8));
+	return v;
+#endif
+}
+
+/*
+ * Create a vector with all bytes set to c.
+ */
+static inline Vector8
+vector8_broadcast(const uint8 c)
+{
+#ifdef USE_SSE2
+	return _mm_set1_epi8(c);
+#else
+	return ~UINT64CONST(0) / 0xFF * c;
+#endif
+}
+
+/*
+ * Return true if any byte of v is less than or equal to c.
+ */
+static inline bool
+vector8_has_le(const Vector8 v, const uint8 c)
+{
+#ifdef USE_SSE2
+	/* bytes equal to the unsigned minimum of themselves and c are <= c */
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(v, vector8_broadcast(c)),
+											v)) != 0;
+#else
+	/*
+	 * Bytes less than c + 1 can be found with bitwise arithmetic as long as c
+	 * + 1 is at most 128; see "Determine if a word has a byte less than n" in
+	 * Sean Eron Anderson's "Bit Twiddling Hacks".
+	 */
+	if (c < 0x80)
+		return ((v - vector8_broadcast(c + 1)) & ~v &
+				vector8_broadcast(0x80)) != 0;
+	else
+	{
+		int			i;
+
+		for (i = 0; i < sizeof(Vector8); i++)
+		{
+			if (((const uint8 *) &v)[i] <= c)
+				return true;
+		}
+		return false;
+	}
+#endif
+}
+
+/*
+ * Return true if any byte of v is equal to c.
+ */
+static inline bool
+vector8_has(const Vector8 v, const uint8 c)
+{
+#ifdef USE_SSE2
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(v, vector8_broadcast(c))) != 0;
+#else
+	/* bytes equal to c become zero */
+	return vector8_has_le(v ^ vector8_broadcast(c), 0);
+#endif
+}
+
+/*
+ * Return true if the high bit of any byte of v is set, that is, if a chunk
+ * of text has any non-ASCII bytes.
+ */
+static inline bool
+vector8_is_highbit_set(const Vector8 v)
+{
+#ifdef USE_SSE2
+	return _mm_movemask_epi8(v) != 0;
+#else
+	return (v & vector8_broadcast(0x80)) != 0;
+#endif
+}
+
+#endif							/* SIMD_H */
@@ -22,7 +22,9 @@
  */
 typedef enum
 {
-	AVW_BRINSummarizeRange
+	AVW_BRINSummarizeRange,
+	AVW_ZHeapPrunePage,
+	AVW_GINCleanPendingList
 } AutoVacuumWorkItemType;
 
 
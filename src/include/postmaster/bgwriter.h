@@ -21,17 +21,27 @@
 #include "storage/sync.h"
 
 
+/* Possible values for checkpoint_pacing */
+typedef enum CheckpointPacing
+{
+	CHECKPOINT_PACING_SCHEDULE,	/* by elapsed time and WAL only */
+	CHECKPOINT_PACING_ADAPTIVE	/* also by write latency, with early fsyncs */
+} CheckpointPacing;
+
 /* GUC options */
 extern int	BgWriterDelay;
 extern int	CheckPointTimeout;
 extern int	CheckPointWarning;
 extern double CheckPointCompletionTarget;
+extern int	CheckPointPacing;
 
 extern void BackgroundWriterMain(void) pg_attribute_noreturn();
 extern void CheckpointerMain(void) pg_attribute_noreturn();
 
 extern void RequestCheckpoint(int flags);
 extern void CheckpointWriteDelay(int flags, double progress);
+extern bool CheckpointWriteDelayWouldSleep(int flags, double progress);
+extern void CheckpointNoteWriteLatency(double msec);
 
 extern bool ForwardSyncRequest(const FileTag *ftag, SyncRequestType type);
 
@@ -0,0 +1,30 @@
+/*-------------------------------------------------------------------------
+ *
+ * proxy.h
+ *	  Exports from postmaster/proxy.c, the built-in connection pooler.
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ *
+ * src/include/postmaster/proxy.h
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef _PROXY_H
+#define _PROXY_H
+
+#include "libpq/libpq-be.h"
+
+/* Upper limit of connection_proxies */
+#define MAX_CONNECTION_PROXIES	64
+
+/* GUC options */
+extern int	connection_proxies;
+extern int	proxy_port;
+extern int	session_pool_size;
+
+extern void ProxyRegister(void);
+extern bool ProxyCanPoolSession(Port *port);
+extern bool ProxyHandOverSession(void);
+extern void ProxyMain(Datum main_arg) pg_attribute_noreturn();
+
+#endif							/* _PROXY_H */
@@ -0,0 +1,62 @@
+/*-------------------------------------------------------------------------
+ *
+ * walsummarizer.h
+ *	  Exports from postmaster/walsummarizer.c.
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ *
+ * src/include/postmaster/walsummarizer.h
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef _WALSUMMARIZER_H
+#define _WALSUMMARIZER_H
+
+#include "access/xlogdefs.h"
+#include "common/relpath.h"
+#include "storage/block.h"
+#include "storage/relfilenode.h"
+
+/* Directory holding the summary files, relative to the data directory */
+#define WAL_SUMMARY_DIR		"pg_wal/summaries"
+
+/* GUC options */
+extern bool summarize_wal;
+extern int	wal_summary_keep_time;
+
+/*
+ * A block reference table records, for each relation fork, the blocks that
+ * were modified in some range of WAL, and the "limit block": the fork was
+ * created or truncated to that length in the range, so older copies of the
+ * blocks at and beyond it are stale.  InvalidBlockNumber means no limit.
+ */
+typedef struct BlockRefTable BlockRefTable;
+
+extern BlockRefTable *CreateBlockRefTable(void);
+extern void BlockRefTableMarkBlock(BlockRefTable *brtab,
+								   const RelFileNode *rnode,
+								   ForkNumber forknum, BlockNumber blkno);
+extern void BlockRefTableSetLimit(BlockRefTable *brtab,
+								  const RelFileNode *rnode,
+								  ForkNumber forknum, BlockNumber limit);
+extern BlockNumber BlockRefTableGetLimit(BlockRefTable *brtab,
+										 const RelFileNode *rnode,
+										 ForkNumber forknum);
+extern int	BlockRefTableGetBlocks(BlockRefTable *brtab,
+								   const RelFileNode *rnode,
+								   ForkNumber forknum,
+								   BlockNumber start_blkno,
+								   BlockNumber stop_blkno,
+								   BlockNumber *blocks, int nblocks);
+
+extern Size WalSummarizerShmemSize(void);
+extern void WalSummarizerShmemInit(void);
+extern void WalSummarizerRegister(void);
+extern void WalSummarizerMain(Datum main_arg) pg_attribute_noreturn();
+
+extern XLogRecPtr GetOldestUnsummarizedLSN(void);
+extern void WaitForWalSummarization(XLogRecPtr lsn);
+extern BlockRefTable *LoadWalSummaries(TimeLineID tli, XLogRecPtr start_lsn,
+									   XLogRecPtr end_lsn);
+
+#endif							/* _WALSUMMARIZER_H */
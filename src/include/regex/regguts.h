@@ -474,9 +474,14 @@ struct guts
 	struct subre *lacons;		/* lookaround-constraint vector */
 	int			nlacons;		/* size of lacons[]; note that only slots
 								 * numbered 1 .. nlacons-1 are used */
+	struct dfa *searchdfa;		/* DFAs kept between executions, or NULL */
+	struct dfa *maindfa;
 };
 
 
 /* prototypes for functions that are exported from regcomp.c to regexec.c */
 extern void pg_set_regex_collation(Oid collation);
 extern color pg_reg_getcolor(struct colormap *cm, chr c);
+
+/* prototypes for functions that are exported from regexec.c to regcomp.c */
+extern void pg_reg_freedfas(struct guts *g);
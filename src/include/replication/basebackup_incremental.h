@@ -0,0 +1,47 @@
+/*-------------------------------------------------------------------------
+ *
+ * basebackup_incremental.h
+ *	  Format of the files that an incremental base backup sends in place of
+ *	  relation files; shared by the server and pg_combinebackup.
+ *
+ * An incremental backup sends a relation segment file "<name>" whose blocks
+ * have mostly not changed since the reference backup as a file named
+ * "INCREMENTAL.<name>" in the same directory.  It consists of an
+ * IncrementalFileHeader, then the header's nblocks block numbers, relative
+ * to the start of the segment and in ascending order, then the contents of
+ * those blocks, BLCKSZ bytes each, in the same order.
+ *
+ * To reconstruct the segment, it is given file_blocks blocks.  Those listed
+ * are taken from the incremental file.  The others are taken from the same
+ * file in the reference backup, reconstructed the same way if it is itself
+ * incremental, provided they lie before limit_block; the segment was created
+ * or truncated at limit_block since the reference backup was taken, so the
+ * reference backup's copies of later blocks are stale, and those blocks are
+ * filled with zeroes instead, as are blocks that the reference backup lacks.
+ *
+ * Portions Copyright (c) 2010-2019, PostgreSQL Global Development Group
+ *
+ * src/include/replication/basebackup_incremental.h
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef BASEBACKUP_INCREMENTAL_H
+#define BASEBACKUP_INCREMENTAL_H
+
+#define INCREMENTAL_PREFIX			"INCREMENTAL."
+#define INCREMENTAL_PREFIX_LENGTH	(sizeof(INCREMENTAL_PREFIX) - 1)
+
+#define INCREMENTAL_MAGIC			0xd3ae1f0d
+
+typedef struct IncrementalFileHeader
+{
+	uint32		magic;			/* INCREMENTAL_MAGIC */
+	uint32		nblocks;		/* number of blocks included */
+	uint32		file_blocks;	/* length of the segment, in blocks */
+	uint32		limit_block;	/* older copies of later blocks are stale */
+} IncrementalFileHeader;
+
+/* Line added to the backup_label of an incremental backup */
+#define INCREMENTAL_LABEL_LINE		"INCREMENTAL FROM LSN"
+
+#endif							/* BASEBACKUP_INCREMENTAL_H */
@@ -52,6 +52,13 @@ typedef struct LogicalDecodingContext
 	 */
 	bool		fast_forward;
 
+	/*
+	 * Does the output plugin support streaming of in-progress transactions,
+	 * and is it enabled?  Set if the plugin registers the stream callbacks;
+	 * the plugin may clear it in its startup callback.
+	 */
+	bool		streaming;
+
 	OutputPluginCallbacks callbacks;
 	OutputPluginOptions options;
 
@@ -55,6 +55,7 @@ extern XLogRecPtr replorigin_get_progress(RepOriginId node, bool flush);
 extern void replorigin_session_advance(XLogRecPtr remote_commit,
 									   XLogRecPtr local_commit);
 extern void replorigin_session_setup(RepOriginId node);
+extern void replorigin_session_attach(RepOriginId node, int acquired_by);
 extern void replorigin_session_reset(void);
 extern XLogRecPtr replorigin_session_get_progress(bool flush);
 
@@ -17,6 +17,9 @@
 #include "utils/snapshot.h"
 #include "utils/timestamp.h"
 
+/* GUC variable */
+extern PGDLLIMPORT int logical_decoding_work_mem;
+
 /* an individual tuple, stored in one chunk of memory */
 typedef struct ReorderBufferTupleBuf
 {
@@ -77,6 +80,9 @@ typedef struct ReorderBufferChange
 	/* The type of change. */
 	enum ReorderBufferChangeType action;
 
+	/* Transaction this change belongs to, for memory accounting. */
+	struct ReorderBufferTXN *txn;
+
 	RepOriginId origin_id;
 
 	/*
@@ -238,6 +244,29 @@ typedef struct ReorderBufferTXN
 	 */
 	bool		serialized;
 
+	/*
+	 * Have changes of this transaction already been sent to the output
+	 * plugin before its commit was decoded?  See ReorderBufferStreamTXN().
+	 * For subtransactions this is set once any of their changes have been
+	 * streamed as part of the toplevel transaction.
+	 */
+	bool		streamed;
+
+	/*
+	 * State carried over between the runs of a streamed toplevel
+	 * transaction: the snapshot and command id the last run ended with, and
+	 * a speculative insertion whose confirmation hadn't been decoded yet.
+	 */
+	Snapshot	stream_snapshot;
+	CommandId	stream_command_id;
+	struct ReorderBufferChange *stream_specinsert;
+
+	/*
+	 * Memory used by the changes of this transaction (not including its
+	 * subtransactions) that are currently held in memory.
+	 */
+	Size		size;
+
 	/*
 	 * List of ReorderBufferChange structs, including new Snapshots and new
 	 * CommandIds
@@ -326,6 +355,30 @@ typedef void (*ReorderBufferMessageCB) (
 										const char *prefix, Size sz,
 										const char *message);
 
+/* stream start callback signature */
+typedef void (*ReorderBufferStreamStartCB) (
+											ReorderBuffer *rb,
+											ReorderBufferTXN *txn,
+											XLogRecPtr first_lsn);
+
+/* stream stop callback signature */
+typedef void (*ReorderBufferStreamStopCB) (
+										   ReorderBuffer *rb,
+										   ReorderBufferTXN *txn,
+										   XLogRecPtr last_lsn);
+
+/* stream abort callback signature */
+typedef void (*ReorderBufferStreamAbortCB) (
+											ReorderBuffer *rb,
+											ReorderBufferTXN *txn,
+											XLogRecPtr abort_lsn);
+
+/* stream commit callback signature */
+typedef void (*ReorderBufferStreamCommitCB) (
+											 ReorderBuffer *rb,
+											 ReorderBufferTXN *txn,
+											 XLogRecPtr commit_lsn);
+
 struct ReorderBuffer
 {
 	/*
@@ -364,6 +417,19 @@ struct ReorderBuffer
 	ReorderBufferCommitCB commit;
 	ReorderBufferMessageCB message;
 
+	/*
+	 * Callbacks to be called when streaming an in-progress transaction, see
+	 * ReorderBufferStreamTXN().  The change, truncate and message callbacks
+	 * are called between stream_start and stream_stop.
+	 */
+	ReorderBufferStreamStartCB stream_start;
+	ReorderBufferStreamStopCB stream_stop;
+	ReorderBufferStreamAbortCB stream_abort;
+	ReorderBufferStreamCommitCB stream_commit;
+	ReorderBufferApplyChangeCB stream_change;
+	ReorderBufferApplyTruncateCB stream_truncate;
+	ReorderBufferMessageCB stream_message;
+
 	/*
 	 * Pointer that will be passed untouched to the callbacks.
 	 */
@@ -391,6 +457,9 @@ struct ReorderBuffer
 	/* buffer for disk<->memory conversions */
 	char	   *outbuf;
 	Size		outbufsize;
+
+	/* memory used by all the changes currently held in memory */
+	Size		size;
 };
 
 
@@ -400,7 +469,7 @@ void		ReorderBufferFree(ReorderBuffer *);
 ReorderBufferTupleBuf *ReorderBufferGetTupleBuf(ReorderBuffer *, Size tuple_len);
 void		ReorderBufferReturnTupleBuf(ReorderBuffer *, ReorderBufferTupleBuf *tuple);
 ReorderBufferChange *ReorderBufferGetChange(ReorderBuffer *);
-void		ReorderBufferReturnChange(ReorderBuffer *, ReorderBufferChange *);
+void		ReorderBufferReturnChange(ReorderBuffer *, ReorderBufferChange *, bool upd_mem);
 
 Oid		   *ReorderBufferGetRelids(ReorderBuffer *, int nrelids);
 void		ReorderBufferReturnRelids(ReorderBuffer *, Oid *relids);
@@ -17,6 +17,7 @@
 #include "access/xlogdefs.h"
 #include "catalog/pg_subscription.h"
 #include "datatype/timestamp.h"
+#include "lib/stringinfo.h"
 #include "storage/lock.h"
 
 typedef struct LogicalRepWorker
@@ -59,14 +60,19 @@ typedef struct LogicalRepWorker
 /* Main memory context for apply worker. Permanent during worker lifetime. */
 extern MemoryContext ApplyContext;
 
+/* Memory context reset after each replication protocol message. */
+extern MemoryContext ApplyMessageContext;
+
 /* libpqreceiver connection */
 extern struct WalReceiverConn *wrconn;
 
 /* Worker and subscription objects. */
 extern Subscription *MySubscription;
 extern LogicalRepWorker *MyLogicalRepWorker;
+extern bool MySubscriptionValid;
 
 extern bool in_remote_transaction;
+extern bool in_streamed_transaction;
 
 extern void logicalrep_worker_attach(int slot);
 extern LogicalRepWorker *logicalrep_worker_find(Oid subid, Oid relid,
@@ -85,6 +91,20 @@ extern char *LogicalRepSyncTableStart(XLogRecPtr *origin_startpos);
 void		process_syncing_tables(XLogRecPtr current_lsn);
 void		invalidate_syncing_table_states(Datum arg, int cacheid,
 											uint32 hashvalue);
+extern bool AllTablesyncsReady(void);
+
+extern void apply_dispatch(StringInfo s);
+extern void store_flush_position(XLogRecPtr remote_lsn, XLogRecPtr local_lsn);
+
+/* Parallel apply, see applyparallelworker.c */
+extern void pa_launch_workers(void);
+extern bool pa_enabled(void);
+extern bool pa_has_pending(void);
+extern void pa_dispatch(StringInfo s);
+extern void pa_process_completions(void);
+extern bool am_parallel_apply_worker(void);
+extern void pa_lock_transaction(void);
+extern void pa_commit_transaction(XLogRecPtr end_lsn, TimestampTz committime);
 
 static inline bool
 am_tablesync_worker(void)
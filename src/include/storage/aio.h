@@ -0,0 +1,68 @@
+/*-------------------------------------------------------------------------
+ *
+ * aio.h
+ *	  Asynchronous file I/O.
+ *
+ * Reads and writes are started with pgaio_start_io() (normally through
+ * FileStartRead/FileStartWrite in fd.c) and their outcome is collected with
+ * pgaio_wait().  Depending on io_method, the I/O is done synchronously at
+ * start, handed to a pool of I/O worker processes, or submitted to the
+ * kernel through io_uring.
+ *
+ * Portions Copyright (c) 1996-2019, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * src/include/storage/aio.h
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef AIO_H
+#define AIO_H
+
+/* Possible values for io_method */
+typedef enum IoMethod
+{
+	IOMETHOD_SYNC,				/* do the I/O at start */
+	IOMETHOD_WORKER,			/* hand the I/O to I/O worker processes */
+#ifdef USE_LIBURING
+	IOMETHOD_IO_URING			/* submit the I/O through io_uring */
+#endif
+} IoMethod;
+
+/* Upper limit of io_workers */
+#define MAX_IO_WORKERS			32
+
+/* An I/O that was started and not yet waited for; private to aio.c */
+typedef struct PgAioHandle PgAioHandle;
+
+/*
+ * Most I/Os a caller should keep in flight at once.  Buffer writers also need
+ * room for as many buffer I/O locks, so it is capped well below
+ * MAX_SIMUL_LWLOCKS.
+ */
+#define PGAIO_MAX_IN_FLIGHT		64
+
+/* GUC variables */
+extern int	io_method;
+extern int	io_workers;
+extern int	io_queue_depth;
+
+#ifndef FRONTEND
+extern Size AioShmemSize(void);
+extern void AioShmemInit(void);
+extern void AioWorkerRegister(void);
+extern void AioWorkerMain(Datum main_arg) pg_attribute_noreturn();
+#endif
+
+extern PgAioHandle *pgaio_start_io(bool is_write, int fd, const char *path,
+								   int flags, int mode, char *buffer,
+								   int amount, off_t offset,
+								   uint32 wait_event_info);
+extern PgAioHandle *pgaio_completed_io(int result, int error);
+extern int	pgaio_wait(PgAioHandle *io);
+extern void pgaio_submit(void);
+extern void pgaio_closing_fd(int fd);
+extern void pgaio_wait_all(void);
+extern int	pgaio_batch_size(void);
+
+#endif							/* AIO_H */
@@ -15,6 +15,7 @@
 #ifndef BUFMGR_INTERNALS_H
 #define BUFMGR_INTERNALS_H
 
+#include "pgstat.h"
 #include "storage/buf.h"
 #include "storage/bufmgr.h"
 #include "storage/latch.h"
@@ -165,6 +166,10 @@ typedef struct buftag
  * wait_backend_pid and setting flag bit BM_PIN_COUNT_WAITER.  At present,
  * there can be only one such waiter per buffer.
  *
+ * change_count is advanced whenever the content lock is acquired in
+ * exclusive mode, which allows the contents of a pinned buffer to be read
+ * without the content lock: see BufferBeginOptimisticRead.
+ *
  * We use this same struct for local buffer headers, but the locks are not
  * used and not all of the flag bits are useful either. To avoid unnecessary
  * overhead, manipulations of the state field should be done without actual
@@ -187,6 +192,7 @@ typedef struct BufferDesc
 	int			freeNext;		/* link in freelist chain */
 
 	LWLock		content_lock;	/* to lock access to buffer contents */
+	pg_atomic_uint32 change_count;	/* exclusive content locks taken */
 } BufferDesc;
 
 /*
@@ -289,6 +295,7 @@ extern BufferDesc *LocalBufferDescriptors;
 typedef struct CkptSortItem
 {
 	Oid			tsId;
+	Oid			dbNode;			/* to tell files apart for adaptive pacing */
 	Oid			relNode;
 	ForkNumber	forkNum;
 	BlockNumber blockNum;
@@ -307,16 +314,21 @@ extern void ScheduleBufferTagForWriteback(WritebackContext *context, BufferTag *
 
 /* freelist.c */
 extern BufferDesc *StrategyGetBuffer(BufferAccessStrategy strategy,
-									 uint32 *buf_state);
+									 uint32 *buf_state, bool undo);
 extern void StrategyFreeBuffer(BufferDesc *buf);
 extern bool StrategyRejectBuffer(BufferAccessStrategy strategy,
 								 BufferDesc *buf);
+extern IOContext StrategyIOContext(BufferAccessStrategy strategy);
 
-extern int	StrategySyncStart(uint32 *complete_passes, uint32 *num_buf_alloc);
+extern int	StrategySyncStart(uint32 *complete_passes, uint32 *num_buf_alloc,
+							  int *num_buffers);
 extern void StrategyNotifyBgWriter(int bgwprocno);
 
 extern Size StrategyShmemSize(void);
+extern void StrategyBindBufferMemory(void);
 extern void StrategyInitialize(bool init);
+extern int	StrategyMainPoolSize(void);
+extern void StrategyResizePool(int mainBuffers);
 extern bool have_free_buffer(void);
 
 /* buf_table.c */
@@ -324,6 +336,7 @@ extern Size BufTableShmemSize(int size);
 extern void InitBufTable(int size);
 extern uint32 BufTableHashCode(BufferTag *tagPtr);
 extern int	BufTableLookup(BufferTag *tagPtr, uint32 hashcode);
+extern int	BufTableLookupUnlocked(BufferTag *tagPtr, uint32 hashcode);
 extern int	BufTableInsert(BufferTag *tagPtr, uint32 hashcode, int buf_id);
 extern void BufTableDelete(BufferTag *tagPtr, uint32 hashcode);
 
@@ -52,6 +52,8 @@ struct WritebackContext;
 
 /* in globals.c ... this duplicates miscadmin.h */
 extern PGDLLIMPORT int NBuffers;
+extern PGDLLIMPORT int SharedBuffers;
+extern PGDLLIMPORT int NUndoBuffers;
 
 /* in bufmgr.c */
 extern bool zero_damaged_pages;
@@ -64,6 +66,9 @@ extern int	checkpoint_flush_after;
 extern int	backend_flush_after;
 extern int	bgwriter_flush_after;
 
+/* in freelist.c */
+extern bool numa_buffers;
+
 /* in buf_init.c */
 extern PGDLLIMPORT char *BufferBlocks;
 
@@ -165,8 +170,10 @@ extern PGDLLIMPORT int32 *LocalRefCount;
 extern bool ComputeIoConcurrency(int io_concurrency, double *target);
 extern void PrefetchBuffer(Relation reln, ForkNumber forkNum,
 						   BlockNumber blockNum);
-extern void PrefetchBufferWithoutRelcache(RelFileNode rnode, ForkNumber forkNum,
+extern bool PrefetchBufferWithoutRelcache(RelFileNode rnode, ForkNumber forkNum,
 										  BlockNumber blockNum, char relpersistence);
+extern bool BufferBlockIsResident(RelFileNode rnode, ForkNumber forkNum,
+								  BlockNumber blockNum);
 extern Buffer ReadBuffer(Relation reln, BlockNumber blockNum);
 extern Buffer ReadBufferExtended(Relation reln, ForkNumber forkNum,
 								 BlockNumber blockNum, ReadBufferMode mode,
@@ -219,6 +226,8 @@ extern void MarkBufferDirtyHint(Buffer buffer, bool buffer_std);
 extern void UnlockBuffers(void);
 extern void LockBuffer(Buffer buffer, int mode);
 extern bool ConditionalLockBuffer(Buffer buffer);
+extern bool BufferBeginOptimisticRead(Buffer buffer, uint32 *version);
+extern bool BufferEndOptimisticRead(Buffer buffer, uint32 version);
 extern void LockBufferForCleanup(Buffer buffer);
 extern bool ConditionalLockBufferForCleanup(Buffer buffer);
 extern bool IsBufferCleanupOK(Buffer buffer);
@@ -228,6 +237,8 @@ extern void AbortBufferIO(void);
 
 extern void BufmgrCommit(void);
 extern bool BgBufferSync(struct WritebackContext *wb_context);
+extern void ResizeBufferPool(void);
+extern bool DrainBufferPool(void);
 
 extern void AtProcExit_LocalBuffers(void);
 
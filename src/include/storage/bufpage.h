@@ -183,13 +183,19 @@ extern bool TransactionIdIsInProgress(TransactionId xid);
  * PD_PAGE_FULL is set if an UPDATE doesn't find enough free space in the
  * page for its new tuple version; this suggests that a prune is needed.
  * Again, this is just a hint.
+ *
+ * PD_UPDATES_GROW is set on a zheap page once an UPDATE couldn't be done in
+ * place because the tuple grew beyond the page's free space, even after
+ * pruning; inserts then leave some room on the page for further growth.
+ * Unlike PD_PAGE_FULL, pruning doesn't clear it.  Also just a hint.
  */
 #define PD_HAS_FREE_LINES	0x0001	/* are there any unused line pointers? */
 #define PD_PAGE_FULL		0x0002	/* not enough free space for new tuple? */
 #define PD_ALL_VISIBLE		0x0004	/* all tuples on page are visible to
 									 * everyone */
+#define PD_UPDATES_GROW		0x0008	/* updates outgrew the page (zheap)? */
 
-#define PD_VALID_FLAG_BITS	0x0007	/* OR of all valid pd_flags bits */
+#define PD_VALID_FLAG_BITS	0x000F	/* OR of all valid pd_flags bits */
 
 /*
  * Page layout version number 0 is for pre-7.3 Postgres releases.
@@ -401,6 +407,13 @@ PageValidateSpecialPointer(Page page)
 #define PageClearFull(page) \
 	(((PageHeader) (page))->pd_flags &= ~PD_PAGE_FULL)
 
+#define PageUpdatesGrow(page) \
+	(((PageHeader) (page))->pd_flags & PD_UPDATES_GROW)
+#define PageSetUpdatesGrow(page) \
+	(((PageHeader) (page))->pd_flags |= PD_UPDATES_GROW)
+#define PageClearUpdatesGrow(page) \
+	(((PageHeader) (page))->pd_flags &= ~PD_UPDATES_GROW)
+
 #define PageIsAllVisible(page) \
 	(((PageHeader) (page))->pd_flags & PD_ALL_VISIBLE)
 #define PageSetAllVisible(page) \
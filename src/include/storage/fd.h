@@ -41,6 +41,9 @@
 
 #include <dirent.h>
 
+#include "port/pg_iovec.h"
+#include "storage/aio.h"
+
 
 typedef int File;
 
@@ -49,6 +52,12 @@ typedef int File;
 extern PGDLLIMPORT int max_files_per_process;
 extern PGDLLIMPORT bool data_sync_retry;
 
+/* Values of io_direct_flags, set from the io_direct GUC */
+#define IO_DIRECT_DATA			0x01	/* relation and undo files */
+#define IO_DIRECT_WAL			0x02	/* WAL segments */
+
+extern int	io_direct_flags;
+
 /*
  * This is private to fd.c, but exported for save/restore_backend_variables()
  */
@@ -79,6 +88,11 @@ extern void FileClose(File file);
 extern int	FilePrefetch(File file, off_t offset, int amount, uint32 wait_event_info);
 extern int	FileRead(File file, char *buffer, int amount, off_t offset, uint32 wait_event_info);
 extern int	FileWrite(File file, char *buffer, int amount, off_t offset, uint32 wait_event_info);
+extern int	FileWriteV(File file, const struct iovec *iov, int iovcnt, off_t offset, uint32 wait_event_info);
+extern int	FileZero(File file, off_t offset, off_t amount, uint32 wait_event_info);
+extern int	FileFallocate(File file, off_t offset, off_t amount, uint32 wait_event_info);
+extern PgAioHandle *FileStartRead(File file, char *buffer, int amount, off_t offset, uint32 wait_event_info);
+extern PgAioHandle *FileStartWrite(File file, char *buffer, int amount, off_t offset, uint32 wait_event_info);
 extern int	FileSync(File file, uint32 wait_event_info);
 extern off_t FileSize(File file);
 extern int	FileTruncate(File file, off_t offset, uint32 wait_event_info);
@@ -202,14 +202,14 @@ typedef uint16 ItemLength;
  */
 static inline
 void
-ItemIdSetUnusedExtended(ItemId itemId, int trans_slot)
+ItemIdSetUnusedExtended(ItemId itemId, int trans_slot, int nslots)
 {
 	/*
 	 * The slots that belongs to TPD entry always point to last slot on the
-	 * page.
+	 * page, nslots being the number of slots on the page.
 	 */
-	if (trans_slot > ZHEAP_PAGE_TRANS_SLOTS)
-		trans_slot = ZHEAP_PAGE_TRANS_SLOTS;
+	if (trans_slot > nslots)
+		trans_slot = nslots;
 	itemId->lp_flags = LP_UNUSED;
 	itemId->lp_off = (itemId->lp_off & ~VISIBILTY_MASK) | ITEMID_XACT_PENDING;
 	itemId->lp_off = (itemId->lp_off & ~XACT_SLOT) | trans_slot << XACT_SLOT_MASK;
@@ -227,14 +227,14 @@ ItemIdSetUnusedExtended(ItemId itemId, int trans_slot)
 
 static inline
 void
-ItemIdSetDeadExtended(ItemId itemId, int trans_slot)
+ItemIdSetDeadExtended(ItemId itemId, int trans_slot, int nslots)
 {
 	/*
 	 * The slots that belongs to TPD entry always point to last slot on the
-	 * page.
+	 * page, nslots being the number of slots on the page.
 	 */
-	if (trans_slot > ZHEAP_PAGE_TRANS_SLOTS)
-		trans_slot = ZHEAP_PAGE_TRANS_SLOTS;
+	if (trans_slot > nslots)
+		trans_slot = nslots;
 	itemId->lp_flags = LP_DEAD;
 	itemId->lp_off = (itemId->lp_off & ~VISIBILTY_MASK) | ITEMID_XACT_PENDING;
 	itemId->lp_off = (itemId->lp_off & ~XACT_SLOT) | trans_slot << XACT_SLOT_MASK;
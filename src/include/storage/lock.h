@@ -157,6 +157,8 @@ typedef enum LockTagType
 
 	/* ID info for an transaction undoaction is transaction id */
 	LOCKTAG_TRANSACTION_UNDOACTION, /* transaction (waiting for undoaction) */
+	LOCKTAG_APPLY_TRANSACTION,	/* remote transaction being applied by a
+								 * logical replication parallel apply worker */
 
 	/*
 	 * Note: object ID has same representation as in pg_depend and
@@ -277,6 +279,19 @@ typedef struct LOCKTAG
 	 (locktag).locktag_type = LOCKTAG_TRANSACTION_UNDOACTION, \
 	 (locktag).locktag_lockmethodid = DEFAULT_LOCKMETHOD)
 
+/*
+ * ID info for a remote transaction applied in parallel is DB OID +
+ * subscription OID + the 48 low bits of the transaction's sequence number
+ * within the subscription's apply session.
+ */
+#define SET_LOCKTAG_APPLY_TRANSACTION(locktag,dboid,subid,seq) \
+	((locktag).locktag_field1 = (dboid), \
+	 (locktag).locktag_field2 = (subid), \
+	 (locktag).locktag_field3 = (uint32) (seq), \
+	 (locktag).locktag_field4 = (uint16) ((seq) >> 32), \
+	 (locktag).locktag_type = LOCKTAG_APPLY_TRANSACTION, \
+	 (locktag).locktag_lockmethodid = DEFAULT_LOCKMETHOD)
+
 /*
  * ID info for an object is DB OID + CLASS OID + OBJECT OID + SUBID
  *
@@ -151,6 +151,7 @@ extern void LWLockReleaseClearVar(LWLock *lock, uint64 *valptr, uint64 val);
 extern void LWLockReleaseAll(void);
 extern bool LWLockHeldByMe(LWLock *lock);
 extern bool LWLockHeldByMeInMode(LWLock *lock, LWLockMode mode);
+extern bool LWLockHeldExclusive(LWLock *lock);
 
 extern bool LWLockWaitForVar(LWLock *lock, uint64 *valptr, uint64 oldval, uint64 *newval);
 extern void LWLockUpdateVar(LWLock *lock, uint64 *valptr, uint64 value);
@@ -159,6 +160,10 @@ extern Size LWLockShmemSize(void);
 extern void CreateLWLocks(void);
 extern void InitLWLockAccess(void);
 
+extern Size LWLockStatsShmemSize(void);
+extern void LWLockStatsShmemInit(void);
+extern void LWLockResetStats(void);
+
 extern const char *GetLWLockIdentifier(uint32 classId, uint16 eventId);
 
 /*
@@ -223,6 +228,20 @@ typedef enum BuiltinTrancheIds
 	LWTRANCHE_UNDOLOG,
 	LWTRANCHE_UNDODISCARD,
 	LWTRANCHE_DISCARD_UPDATE,
+	LWTRANCHE_UNDO_RECORD_CACHE,
+	LWTRANCHE_ROLLBACK_REQUESTS,
+	LWTRANCHE_ZHEAP_KEYSHARE_LOCKS,
+	LWTRANCHE_ZHEAP_MULTILOCKER_CACHE,
+	LWTRANCHE_ZHEAP_SPEC_TOKENS,
+	LWTRANCHE_ZHEAP_FREED_PAGES,
+	LWTRANCHE_ZHEAP_PARALLEL_REWRITE,
+	LWTRANCHE_SMGR_SIZE,
+	LWTRANCHE_CLOG_BANK,
+	LWTRANCHE_SUBTRANS_BANK,
+	LWTRANCHE_SHARED_PLAN_CACHE,
+	LWTRANCHE_PGSTAT_DSA,
+	LWTRANCHE_PGSTAT_HASH,
+	LWTRANCHE_SEQUENCE_CACHE,
 	LWTRANCHE_FIRST_USER_DEFINED,
 }			BuiltinTrancheIds;
 
@@ -27,12 +27,27 @@ extern bool mdexists(SMgrRelation reln, ForkNumber forknum);
 extern void mdunlink(RelFileNodeBackend rnode, ForkNumber forknum, bool isRedo);
 extern void mdextend(SMgrRelation reln, ForkNumber forknum,
 					 BlockNumber blocknum, char *buffer, bool skipFsync);
+extern void mdzeroextend(SMgrRelation reln, ForkNumber forknum,
+						 BlockNumber blocknum, int nblocks, bool skipFsync);
 extern void mdprefetch(SMgrRelation reln, ForkNumber forknum,
 					   BlockNumber blocknum);
 extern void mdread(SMgrRelation reln, ForkNumber forknum, BlockNumber blocknum,
 				   char *buffer);
 extern void mdwrite(SMgrRelation reln, ForkNumber forknum,
 					BlockNumber blocknum, char *buffer, bool skipFsync);
+extern void mdwritev(SMgrRelation reln, ForkNumber forknum,
+					 BlockNumber blocknum, char **buffers, int nblocks,
+					 bool skipFsync);
+extern PgAioHandle *mdstartread(SMgrRelation reln, ForkNumber forknum,
+								BlockNumber blocknum, char *buffer);
+extern void mdfinishread(SMgrRelation reln, ForkNumber forknum,
+						 BlockNumber blocknum, char *buffer, PgAioHandle *io);
+extern PgAioHandle *mdstartwrite(SMgrRelation reln, ForkNumber forknum,
+								 BlockNumber blocknum, char *buffer,
+								 bool skipFsync);
+extern void mdfinishwrite(SMgrRelation reln, ForkNumber forknum,
+						  BlockNumber blocknum, char *buffer, bool skipFsync,
+						  PgAioHandle *io);
 extern void mdwriteback(SMgrRelation reln, ForkNumber forknum,
 						BlockNumber blocknum, BlockNumber nblocks);
 extern BlockNumber mdnblocks(SMgrRelation reln, ForkNumber forknum);
@@ -41,6 +56,8 @@ extern void mdtruncate(SMgrRelation reln, ForkNumber forknum,
 extern void mdimmedsync(SMgrRelation reln, ForkNumber forknum);
 
 extern void ForgetDatabaseSyncRequests(Oid dbid);
+extern void mdcheckpointfiledone(RelFileNode rnode, ForkNumber forknum,
+								 BlockNumber blocknum);
 extern void DropRelationFiles(RelFileNode *delrels, int ndelrels, bool isRedo);
 
 /* md sync callbacks */
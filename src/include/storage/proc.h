@@ -63,12 +63,25 @@ struct XidCache
 	(PROC_IN_VACUUM | PROC_IN_ANALYZE | PROC_VACUUM_FOR_WRAPAROUND)
 
 /*
- * We allow a small number of "weak" relation locks (AccesShareLock,
+ * We allow a limited number of "weak" relation locks (AccesShareLock,
  * RowShareLock, RowExclusiveLock) to be recorded in the PGPROC structure
  * rather than the main lock table.  This eases contention on the lock
  * manager LWLocks.  See storage/lmgr/README for additional details.
+ *
+ * The slots are organized in groups of FP_LOCK_SLOTS_PER_GROUP, a relation
+ * always going to the same group, so that a lookup only has to scan one
+ * group.  The number of groups is derived from max_locks_per_transaction at
+ * startup, see InitializeFastPathLocks().
  */
-#define		FP_LOCK_SLOTS_PER_BACKEND 16
+extern PGDLLIMPORT int FastPathLockGroupsPerBackend;
+
+#define		FP_LOCK_GROUPS_PER_BACKEND_MAX	1024
+#define		FP_LOCK_SLOTS_PER_GROUP			16	/* don't change */
+#define		FastPathLockSlotsPerBackend() \
+	(FP_LOCK_SLOTS_PER_GROUP * FastPathLockGroupsPerBackend)
+#define		FastPathLockShmemSizePerProc() \
+	(MAXALIGN(FastPathLockGroupsPerBackend * sizeof(uint64)) + \
+	 MAXALIGN(FastPathLockSlotsPerBackend() * sizeof(Oid)))
 
 /*
  * An invalid pgprocno.  Must be larger than the maximum number of PGPROC
@@ -190,8 +203,9 @@ struct PGPROC
 	LWLock		backendLock;
 
 	/* Lock manager data, recording fast-path locks taken by this backend. */
-	uint64		fpLockBits;		/* lock modes held for each fast-path slot */
-	Oid			fpRelId[FP_LOCK_SLOTS_PER_BACKEND]; /* slots for rel oids */
+	uint64	   *fpLockBits;		/* lock modes held for each fast-path slot,
+								 * one word per group */
+	Oid		   *fpRelId;		/* slots for rel oids */
 	bool		fpVXIDLock;		/* are we holding a fast-path VXID lock? */
 	LocalTransactionId fpLocalTransactionId;	/* lxid for fast-path VXID
 												 * lock */
@@ -274,6 +288,8 @@ typedef struct PROC_HDR
 	int			startupBufferPinWaitBufId;
 	/* Oldest transaction id which is having undo. */
 	pg_atomic_uint64 oldestXidWithEpochHavingUndo;
+	/* Newest horizon undo was discarded up to despite older snapshots. */
+	pg_atomic_uint64 undoRetentionHorizon;
 } PROC_HDR;
 
 extern PGDLLIMPORT PROC_HDR *ProcGlobal;
@@ -333,6 +349,7 @@ extern PGPROC *AuxiliaryPidGetProc(int pid);
 
 extern void BecomeLockGroupLeader(void);
 extern bool BecomeLockGroupMember(PGPROC *leader, int pid);
+extern bool LeaveLockGroup(void);
 
 static inline bool
 FullTransactionIdOlderThanAllUndo(FullTransactionId full_xid)
@@ -342,4 +359,20 @@ FullTransactionIdOlderThanAllUndo(FullTransactionId full_xid)
 	return U64FromFullTransactionId(full_xid) < cutoff;
 }
 
+/*
+ * Could undo needed by a snapshot with the given xmin have been discarded
+ * because of the undo retention limits?
+ */
+static inline bool
+UndoRetentionPassedXmin(TransactionId xmin)
+{
+	uint64		horizon = pg_atomic_read_u64(&ProcGlobal->undoRetentionHorizon);
+
+	if (horizon == 0)
+		return false;
+
+	return TransactionIdPrecedes(xmin,
+								 XidFromFullTransactionId(FullTransactionIdFromU64(horizon)));
+}
+
 #endif							/* PROC_H */
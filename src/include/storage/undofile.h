@@ -29,6 +29,9 @@ extern void undofile_unlink(RelFileNodeBackend rnode, ForkNumber forknum,
 extern void undofile_extend(SMgrRelation reln, ForkNumber forknum,
 							BlockNumber blocknum, char *buffer,
 							bool skipFsync);
+extern void undofile_zeroextend(SMgrRelation reln, ForkNumber forknum,
+								BlockNumber blocknum, int nblocks,
+								bool skipFsync);
 extern void undofile_prefetch(SMgrRelation reln, ForkNumber forknum,
 							  BlockNumber blocknum);
 extern void undofile_read(SMgrRelation reln, ForkNumber forknum,
@@ -36,6 +39,20 @@ extern void undofile_read(SMgrRelation reln, ForkNumber forknum,
 extern void undofile_write(SMgrRelation reln, ForkNumber forknum,
 						   BlockNumber blocknum, char *buffer,
 						   bool skipFsync);
+extern void undofile_writev(SMgrRelation reln, ForkNumber forknum,
+							BlockNumber blocknum, char **buffers, int nblocks,
+							bool skipFsync);
+extern PgAioHandle *undofile_startread(SMgrRelation reln, ForkNumber forknum,
+									  BlockNumber blocknum, char *buffer);
+extern void undofile_finishread(SMgrRelation reln, ForkNumber forknum,
+								BlockNumber blocknum, char *buffer,
+								PgAioHandle *io);
+extern PgAioHandle *undofile_startwrite(SMgrRelation reln, ForkNumber forknum,
+									   BlockNumber blocknum, char *buffer,
+									   bool skipFsync);
+extern void undofile_finishwrite(SMgrRelation reln, ForkNumber forknum,
+								 BlockNumber blocknum, char *buffer,
+								 bool skipFsync, PgAioHandle *io);
 extern void undofile_writeback(SMgrRelation reln, ForkNumber forknum,
 							   BlockNumber blocknum, BlockNumber nblocks);
 extern BlockNumber undofile_nblocks(SMgrRelation reln, ForkNumber forknum);
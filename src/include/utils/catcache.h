@@ -61,6 +61,11 @@ typedef struct catcache
 	slist_node	cc_next;		/* list link */
 	ScanKeyData cc_skey[CATCACHE_MAXKEYS];	/* precomputed key info for heap
 											 * scans */
+	int			cc_nnegative;	/* # of negative entries in this cache */
+	Size		cc_memory;		/* memory used by this cache's entries */
+	uint64		cc_nhits;		/* # of searches satisfied by an entry */
+	uint64		cc_nmisses;		/* # of searches that read the catalog */
+	uint64		cc_nevicted;	/* # of entries evicted to save memory */
 
 	/*
 	 * Keep these at the end, so that compiling catcache.c with CATCACHE_STATS
@@ -103,6 +108,13 @@ typedef struct catctup
 	 */
 	dlist_node	cache_elem;		/* list member of per-bucket list */
 
+	/*
+	 * All tuples of all caches are also members of a single LRU list, most
+	 * recently used first, from which entries are evicted when the caches
+	 * exceed catalog_cache_memory_target.
+	 */
+	dlist_node	lru_elem;		/* list member of CacheHdr->ch_lru */
+
 	/*
 	 * A tuple marked "dead" must not be returned by subsequent searches.
 	 * However, it won't be physically deleted from the cache until its
@@ -183,9 +195,15 @@ typedef struct catcacheheader
 {
 	slist_head	ch_caches;		/* head of list of CatCache structs */
 	int			ch_ntup;		/* # of tuples in all caches */
+	dlist_head	ch_lru;			/* CatCTups of all caches, in LRU order */
+	Size		ch_memory;		/* memory used by entries of all caches */
 } CatCacheHeader;
 
 
+/* GUC parameter */
+extern int	catalog_cache_memory_target;
+
+
 /* this extern duplicates utils/memutils.h... */
 extern PGDLLIMPORT MemoryContext CacheMemoryContext;
 
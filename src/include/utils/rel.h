@@ -117,6 +117,7 @@ typedef struct RelationData
 	Bitmapset  *rd_keyattr;		/* cols that can be ref'd by foreign keys */
 	Bitmapset  *rd_pkattr;		/* cols included in primary key */
 	Bitmapset  *rd_idattr;		/* included in replica identity index */
+	Bitmapset  *rd_nodelmarkattr;	/* used by indexes that can't delete-mark */
 
 	PublicationActions *rd_pubactions;	/* publication actions */
 
@@ -271,12 +272,52 @@ typedef struct StdRdOptions
 	int			parallel_workers;	/* max number of parallel workers */
 	bool		vacuum_index_cleanup;	/* enables index vacuuming and cleanup */
 	bool		vacuum_truncate;	/* enables vacuum to truncate a relation */
+	int			trans_slots;	/* transaction slots per zheap page */
+	int			insert_spread_blocks;	/* private zheap insertion range */
+	int			growth_reserve; /* zheap update headroom in percent */
+	bool		deduplicate_items;	/* btree posting list deduplication */
 	int			relstorage_offset;	/* see RELSTORAGE_xxx constants below */
 } StdRdOptions;
 
 #define HEAP_MIN_FILLFACTOR			10
 #define HEAP_DEFAULT_FILLFACTOR		100
 
+/*
+ * RelationGetTransSlots
+ *		Returns the relation's trans_slots.  Note multiple eval of argument!
+ *		This is only consulted when the relation's storage is created; the
+ *		zheap metapage records the value actually in use.
+ */
+#define RelationGetTransSlots(relation, defaultslots) \
+	((relation)->rd_options ? \
+	 ((StdRdOptions *) (relation)->rd_options)->trans_slots : (defaultslots))
+
+/*
+ * RelationGetInsertSpreadBlocks
+ *		Returns the relation's insert_spread_blocks.  Note multiple eval of argument!
+ */
+#define RelationGetInsertSpreadBlocks(relation) \
+	((relation)->rd_options ? \
+	 ((StdRdOptions *) (relation)->rd_options)->insert_spread_blocks : 0)
+
+/*
+ * RelationGetGrowthReserve
+ *		Returns the space to keep free on zheap pages whose updates grow
+ *		tuples, in bytes.  Note multiple eval of argument!
+ */
+#define RelationGetGrowthReserve(relation) \
+	((relation)->rd_options ? \
+	 (BLCKSZ * ((StdRdOptions *) (relation)->rd_options)->growth_reserve) / 100 : 0)
+
+/*
+ * RelationGetDeduplicateItems
+ *		Returns whether a btree index may deduplicate its leaf tuples.
+ *		Note multiple eval of argument!
+ */
+#define RelationGetDeduplicateItems(relation) \
+	((relation)->rd_options ? \
+	 ((StdRdOptions *) (relation)->rd_options)->deduplicate_items : true)
+
 /*
  * RelationGetToastTupleTarget
  *		Returns the relation's toast_tuple_target.  Note multiple eval of argument!
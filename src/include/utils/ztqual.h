@@ -26,6 +26,23 @@ typedef struct ZHeapTupleTransInfo
 	UndoRecPtr	urec_ptr;
 } ZHeapTupleTransInfo;
 
+/*
+ * Per-page cache of the visibility of transaction slots to an MVCC snapshot,
+ * used by page-at-a-time scans so that each slot of the page is checked
+ * against the snapshot only once.  Only slots stored on the page itself are
+ * cached, since the TPD slot of a tuple depends on its offset.  The cache is
+ * only valid while the buffer lock is held, as slots can't be reused until
+ * then.  Zero-initialize it before the first ZHeapTupleFetchPageMode call.
+ */
+#define ZSLOTVIS_UNKNOWN	0	/* not checked yet */
+#define ZSLOTVIS_VISIBLE	1	/* all changes of the slot are visible */
+#define ZSLOTVIS_CHECK		2	/* check each tuple in full */
+
+typedef struct ZHeapSlotVisCache
+{
+	uint8		status[ZHEAP_PAGE_TRANS_SLOTS + 1];	/* indexed by slot id */
+} ZHeapSlotVisCache;
+
 /* Result codes for ZHeapTupleSatisfiesOldestXmin */
 typedef enum
 {
@@ -70,7 +87,14 @@ extern ZHTSV_Result ZHeapTupleSatisfiesOldestXmin(ZHeapTuple zhtup,
 extern bool ZHeapTupleFetch(Relation rel, Buffer buffer, OffsetNumber offnum,
 							Snapshot snapshot, ZHeapTuple *visible_tuple,
 							ItemPointer new_ctid);
+extern bool ZHeapTupleFetchPageMode(Relation rel, Buffer buffer,
+									OffsetNumber offnum, Snapshot snapshot,
+									ZHeapTuple *visible_tuple,
+									ZHeapSlotVisCache *slotvis);
+extern bool ZHeapTransSlotIsVisible(ZHeapTupleTransInfo *zinfo,
+									Snapshot snapshot);
 
+extern bool ZHeapPageHasSerializableConflictOut(Buffer buffer);
 extern bool ZHeapTupleHasSerializableConflictOut(bool visible, Relation relation,
 												 ItemPointer tid, Buffer buffer,
 												 TransactionId *xid);
@@ -343,6 +343,10 @@ static const internalPQconninfoOption PQconninfoOptions[] = {
 		"Target-Session-Attrs", "", 11, /* sizeof("read-write") = 11 */
 	offsetof(struct pg_conn, target_session_attrs)},
 
+	{"compression", "PGCOMPRESSION", "off", NULL,
+		"Compression", "", 14,	/* sizeof("zstd,lz4,zlib") = 14 */
+	offsetof(struct pg_conn, compression)},
+
 	/* Terminating entry --- MUST BE LAST */
 	{NULL, NULL, NULL, NULL,
 	NULL, NULL, 0}
@@ -459,6 +463,13 @@ pqDropConnection(PGconn *conn, bool flushInput)
 	/* Always discard any unsent data */
 	conn->outCount = 0;
 
+	/* Compression, if any, starts afresh on the next connection */
+	if (conn->zstream)
+	{
+		zpq_free(conn->zstream);
+		conn->zstream = NULL;
+	}
+
 	/* Free authentication state */
 #ifdef ENABLE_GSS
 	{
@@ -1305,6 +1316,50 @@ connectOptions2(PGconn *conn)
 		}
 	}
 
+	/*
+	 * Validate compression option.  Besides "on" and "off", it can be a
+	 * comma-separated list of algorithms, all of which must be available.
+	 */
+	if (conn->compression && strcmp(conn->compression, "off") != 0)
+	{
+		if (strcmp(conn->compression, "on") == 0)
+		{
+			char		algorithms[ZPQ_ALGORITHMS_BUFSIZE];
+
+			zpq_supported_algorithms(algorithms, sizeof(algorithms));
+			if (algorithms[0] == '\0')
+			{
+				conn->status = CONNECTION_BAD;
+				printfPQExpBuffer(&conn->errorMessage,
+								  libpq_gettext("compression is not supported by this build\n"));
+				return false;
+			}
+		}
+		else
+		{
+			const char *p = conn->compression;
+
+			while (*p)
+			{
+				size_t		len = strcspn(p, ",");
+				char		algorithm[NAMEDATALEN];
+
+				strlcpy(algorithm, p, Min(len + 1, sizeof(algorithm)));
+				if (!zpq_algorithm_supported(algorithm))
+				{
+					conn->status = CONNECTION_BAD;
+					printfPQExpBuffer(&conn->errorMessage,
+									  libpq_gettext("invalid compression value: \"%s\"\n"),
+									  conn->compression);
+					return false;
+				}
+				p += len;
+				if (*p == ',')
+					p++;
+			}
+		}
+	}
+
 	/*
 	 * Only if we get this far is it appropriate to try to connect. (We need a
 	 * state flag, rather than just the boolean result of this function, in
@@ -2370,8 +2425,13 @@ keep_going:						/* We will come back to here until there is
 		/* Drop any PGresult we might have, too */
 		conn->asyncStatus = PGASYNC_IDLE;
 		conn->xactStatus = PQTRANS_IDLE;
+		conn->pipelineStatus = PQ_PIPELINE_OFF;
 		pqClearAsyncResult(conn);
 
+		/* ... and any commands queued for the old server */
+		pqFreeCommandQueue(conn->cmd_queue_head);
+		conn->cmd_queue_head = conn->cmd_queue_tail = NULL;
+
 		/* Reset conn->status to put the state machine in the right state */
 		conn->status = CONNECTION_NEEDED;
 
@@ -3099,10 +3159,14 @@ keep_going:						/* We will come back to here until there is
 
 				/*
 				 * Validate message type: we expect only an authentication
-				 * request or an error here.  Anything else probably means
-				 * it's not Postgres on the other end at all.
+				 * request or an error here, or an answer to our compression
+				 * request if we made one.  Anything else probably means it's
+				 * not Postgres on the other end at all.
 				 */
-				if (!(beresp == 'R' || beresp == 'E'))
+				if (!(beresp == 'R' || beresp == 'E' ||
+					  ((beresp == 'z' || beresp == 'v') &&
+					   conn->zstream == NULL && conn->compression &&
+					   strcmp(conn->compression, "off") != 0)))
 				{
 					appendPQExpBuffer(&conn->errorMessage,
 									  libpq_gettext(
@@ -3199,6 +3263,35 @@ keep_going:						/* We will come back to here until there is
 					return PGRES_POLLING_READING;
 				}
 
+				/*
+				 * The server's answer to our compression request names the
+				 * algorithm it picked, or is empty if it declined.
+				 */
+				if (beresp == 'z')
+				{
+					if (pqGets(&conn->workBuffer, conn))
+						goto error_return;
+					/* OK, we read the message; mark data consumed */
+					conn->inStart = conn->inCursor;
+
+					if (conn->workBuffer.data[0] != '\0' &&
+						!pqsecure_start_compression(conn, conn->workBuffer.data))
+						goto error_return;
+
+					goto keep_going;
+				}
+
+				/*
+				 * A NegotiateProtocolVersion message means the server doesn't
+				 * know about compression.  It carries on without it, and so
+				 * can we.
+				 */
+				if (beresp == 'v')
+				{
+					conn->inStart = conn->inCursor + msgLength;
+					goto keep_going;
+				}
+
 				/* Handle errors. */
 				if (beresp == 'E')
 				{
@@ -3803,6 +3896,7 @@ makeEmptyPGconn(void)
 	conn->status = CONNECTION_BAD;
 	conn->asyncStatus = PGASYNC_IDLE;
 	conn->xactStatus = PQTRANS_IDLE;
+	conn->pipelineStatus = PQ_PIPELINE_OFF;
 	conn->options_valid = false;
 	conn->nonblocking = false;
 	conn->setenv_state = SETENV_STATE_IDLE;
@@ -3974,8 +4068,6 @@ freePGconn(PGconn *conn)
 		free(conn->gsslib);
 #endif
 	/* Note that conn->Pfdebug is not ours to close or free */
-	if (conn->last_query)
-		free(conn->last_query);
 	if (conn->write_err_msg)
 		free(conn->write_err_msg);
 	if (conn->inBuffer)
@@ -3986,6 +4078,8 @@ freePGconn(PGconn *conn)
 		free(conn->rowBuf);
 	if (conn->target_session_attrs)
 		free(conn->target_session_attrs);
+	if (conn->compression)
+		free(conn->compression);
 	termPQExpBuffer(&conn->errorMessage);
 	termPQExpBuffer(&conn->workBuffer);
 
@@ -4065,8 +4159,15 @@ closePGconn(PGconn *conn)
 	conn->status = CONNECTION_BAD;	/* Well, not really _bad_ - just absent */
 	conn->asyncStatus = PGASYNC_IDLE;
 	conn->xactStatus = PQTRANS_IDLE;
+	conn->pipelineStatus = PQ_PIPELINE_OFF;
 	pqClearAsyncResult(conn);	/* deallocate result */
 	resetPQExpBuffer(&conn->errorMessage);
+
+	/* Forget any commands still queued, and the spare queue entries */
+	pqFreeCommandQueue(conn->cmd_queue_head);
+	conn->cmd_queue_head = conn->cmd_queue_tail = NULL;
+	pqFreeCommandQueue(conn->cmd_queue_recycle);
+	conn->cmd_queue_recycle = NULL;
 	release_conn_addrinfo(conn);
 
 	/* Reset all state obtained from server, too */
@@ -6539,6 +6640,15 @@ PQtransactionStatus(const PGconn *conn)
 	return conn->xactStatus;
 }
 
+PGpipelineStatus
+PQpipelineStatus(const PGconn *conn)
+{
+	if (!conn)
+		return PQ_PIPELINE_OFF;
+
+	return conn->pipelineStatus;
+}
+
 const char *
 PQparameterStatus(const PGconn *conn, const char *paramName)
 {
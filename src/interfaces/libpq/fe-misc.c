@@ -867,8 +867,11 @@ pqSendSome(PGconn *conn, int len)
 		return 0;
 	}
 
-	/* while there's still data to send */
-	while (len > 0)
+	/*
+	 * while there's still data to send, including compressed data that the
+	 * compression stream is holding on to
+	 */
+	while (len > 0 || pqsecure_write_pending(conn))
 	{
 		int			sent;
 
@@ -929,7 +932,7 @@ pqSendSome(PGconn *conn, int len)
 			remaining -= sent;
 		}
 
-		if (len > 0)
+		if (len > 0 || pqsecure_write_pending(conn))
 		{
 			/*
 			 * We didn't send it all, wait till we can send more.
@@ -1000,7 +1003,7 @@ pqFlush(PGconn *conn)
 	if (conn->Pfdebug)
 		fflush(conn->Pfdebug);
 
-	if (conn->outCount > 0)
+	if (conn->outCount > 0 || pqsecure_write_pending(conn))
 		return pqSendSome(conn, conn->outCount);
 
 	return 0;
@@ -1101,6 +1104,10 @@ pqSocketCheck(PGconn *conn, int forRead, int forWrite, time_t end_time)
 	}
 #endif
 
+	/* Likewise for data held in the compression stream */
+	if (forRead && conn->zstream && zpq_buffered_rx(conn->zstream))
+		return 1;
+
 	/* We will retry as long as we get EINTR */
 	do
 		result = pqSocketPoll(conn->sock, forRead, forWrite, end_time);
@@ -124,6 +124,10 @@ struct sigpipe_info
 #define RESTORE_SIGPIPE(conn, spinfo)
 #endif							/* WIN32 */
 
+static ssize_t pqsecure_transport_read(PGconn *conn, void *ptr, size_t len);
+static ssize_t pqsecure_transport_write(PGconn *conn, const void *ptr,
+										size_t len);
+
 /* ------------------------------------------------------------ */
 /*			 Procedures common to all secure sessions			*/
 /* ------------------------------------------------------------ */
@@ -211,6 +215,32 @@ pqsecure_close(PGconn *conn)
  */
 ssize_t
 pqsecure_read(PGconn *conn, void *ptr, size_t len)
+{
+	ssize_t		n;
+
+	if (conn->zstream)
+	{
+		n = zpq_read(conn->zstream, ptr, len);
+		if (n == ZPQ_DECOMPRESS_ERROR)
+		{
+			printfPQExpBuffer(&conn->errorMessage,
+							  libpq_gettext("could not decompress data from server: %s\n"),
+							  zpq_error(conn->zstream));
+			/* there's no way to resynchronize, so treat it as a lost connection */
+			SOCK_ERRNO_SET(ECONNRESET);
+			n = -1;
+		}
+		return n;
+	}
+
+	return pqsecure_transport_read(conn, ptr, len);
+}
+
+/*
+ *	Read data from the connection below any compression layer.
+ */
+static ssize_t
+pqsecure_transport_read(PGconn *conn, void *ptr, size_t len)
 {
 	ssize_t		n;
 
@@ -295,6 +325,31 @@ pqsecure_raw_read(PGconn *conn, void *ptr, size_t len)
  */
 ssize_t
 pqsecure_write(PGconn *conn, const void *ptr, size_t len)
+{
+	ssize_t		n;
+
+	if (conn->zstream)
+	{
+		n = zpq_write(conn->zstream, ptr, len);
+		if (n == ZPQ_COMPRESS_ERROR)
+		{
+			printfPQExpBuffer(&conn->errorMessage,
+							  libpq_gettext("could not compress data to send to server: %s\n"),
+							  zpq_error(conn->zstream));
+			SOCK_ERRNO_SET(EIO);
+			n = -1;
+		}
+		return n;
+	}
+
+	return pqsecure_transport_write(conn, ptr, len);
+}
+
+/*
+ *	Write data to the connection below any compression layer.
+ */
+static ssize_t
+pqsecure_transport_write(PGconn *conn, const void *ptr, size_t len)
 {
 	ssize_t		n;
 
@@ -404,6 +459,56 @@ retry_masked:
 	return n;
 }
 
+/* Transport callbacks for the compression stream */
+static ssize_t
+pqsecure_zpq_read(void *arg, void *ptr, size_t len)
+{
+	return pqsecure_transport_read((PGconn *) arg, ptr, len);
+}
+
+static ssize_t
+pqsecure_zpq_write(void *arg, const void *ptr, size_t len)
+{
+	return pqsecure_transport_write((PGconn *) arg, ptr, len);
+}
+
+/*
+ *	Start compressing traffic, using the algorithm the server picked.
+ *
+ * The server compresses everything it sends after its reply, so whatever
+ * we have already read beyond that must go through the compression stream
+ * too.  Returns false, with conn->errorMessage set, on failure.
+ */
+bool
+pqsecure_start_compression(PGconn *conn, const char *algorithm)
+{
+	Assert(conn->zstream == NULL);
+
+	conn->zstream = zpq_create(algorithm,
+							   pqsecure_zpq_write, pqsecure_zpq_read, conn,
+							   conn->inBuffer + conn->inStart,
+							   conn->inEnd - conn->inStart);
+	if (conn->zstream == NULL)
+	{
+		printfPQExpBuffer(&conn->errorMessage,
+						  libpq_gettext("could not start compression with algorithm \"%s\"\n"),
+						  algorithm);
+		return false;
+	}
+	conn->inEnd = conn->inCursor = conn->inStart;
+
+	return true;
+}
+
+/*
+ *	Is there compressed output the transport hasn't accepted yet?
+ */
+bool
+pqsecure_write_pending(PGconn *conn)
+{
+	return conn->zstream != NULL && zpq_buffered_tx(conn->zstream);
+}
+
 /* Dummy versions of SSL info functions, when built without SSL support */
 #ifndef USE_SSL
 
@@ -0,0 +1,27 @@
+# Write skew test on zheap.
+#
+# Two serializable transactions update all 'apple' rows to 'pear' and all
+# 'pear' rows to 'apple'.  Any overlap between them must cause a
+# serialization failure, whether the page they read still carries the
+# other transaction's slot or only the slot of the committed setup.
+
+setup
+{
+  CREATE TABLE test (i int PRIMARY KEY, t text) USING zheap;
+  INSERT INTO test VALUES (5, 'apple'), (7, 'pear'), (11, 'banana');
+}
+
+teardown
+{
+  DROP TABLE test;
+}
+
+session "s1"
+setup { BEGIN ISOLATION LEVEL SERIALIZABLE; }
+step "rwx1" { UPDATE test SET t = 'apple' WHERE t = 'pear'; }
+step "c1" { COMMIT; }
+
+session "s2"
+setup { BEGIN ISOLATION LEVEL SERIALIZABLE; }
+step "rwx2" { UPDATE test SET t = 'pear' WHERE t = 'apple'}
+step "c2" { COMMIT; }
@@ -0,0 +1,19 @@
+CREATE EXTENSION test_undo_bench;
+
+-- The throughput reports and the shape of the histograms vary from run to
+-- run, so only check that every operation is accounted for.
+SET client_min_messages = warning;
+
+SELECT operation, sum(count) FROM undo_bench_insert(100, 16) GROUP BY 1;
+SELECT operation, sum(count) FROM undo_bench_insert(10, 0, 'temporary') GROUP BY 1;
+SELECT operation, sum(count) FROM undo_bench_fetch(10, 20) GROUP BY 1;
+SELECT operation, sum(count) FROM undo_bench_bulk_fetch(100, 5) GROUP BY 1;
+SELECT operation, sum(count) FROM undo_bench_pack(100, 50) GROUP BY 1 ORDER BY 1;
+SELECT operation, sum(count) FROM undo_bench_pack(3000, 50) GROUP BY 1 ORDER BY 1;
+
+-- Histogram buckets are powers of two.
+SELECT count(*) FROM undo_bench_pack(10, 100)
+ WHERE lower_ns <> 0 AND upper_ns <> 2 * lower_ns;
+
+SELECT * FROM undo_bench_insert(1, 0, 'bogus');
+SELECT * FROM undo_bench_pack(100000, 1);
@@ -0,0 +1,31 @@
+/* src/test/modules/test_undo_bench/test_undo_bench--1.0.sql */
+
+-- complain if script is sourced in psql, rather than via CREATE EXTENSION
+\echo Use "CREATE EXTENSION test_undo_bench" to load this file. \quit
+
+CREATE FUNCTION undo_bench_insert(nrecords int, payload_len int DEFAULT 0,
+		persistence text DEFAULT 'unlogged',
+		OUT operation text, OUT lower_ns bigint, OUT upper_ns bigint,
+		OUT count bigint)
+RETURNS SETOF record STRICT
+AS 'MODULE_PATHNAME' LANGUAGE C;
+
+CREATE FUNCTION undo_bench_fetch(chain_length int, loops int,
+		persistence text DEFAULT 'unlogged',
+		OUT operation text, OUT lower_ns bigint, OUT upper_ns bigint,
+		OUT count bigint)
+RETURNS SETOF record STRICT
+AS 'MODULE_PATHNAME' LANGUAGE C;
+
+CREATE FUNCTION undo_bench_bulk_fetch(nrecords int, loops int,
+		persistence text DEFAULT 'unlogged',
+		OUT operation text, OUT lower_ns bigint, OUT upper_ns bigint,
+		OUT count bigint)
+RETURNS SETOF record STRICT
+AS 'MODULE_PATHNAME' LANGUAGE C;
+
+CREATE FUNCTION undo_bench_pack(payload_len int, loops int,
+		OUT operation text, OUT lower_ns bigint, OUT upper_ns bigint,
+		OUT count bigint)
+RETURNS SETOF record STRICT
+AS 'MODULE_PATHNAME' LANGUAGE C;
@@ -0,0 +1,498 @@
+/*--------------------------------------------------------------------------
+ *
+ * test_undo_bench.c
+ *		Micro-benchmarks for undo record insertion, fetching and packing.
+ *
+ * Each benchmark runs the operation being measured the requested number of
+ * times, reports the throughput with a NOTICE and returns a histogram of the
+ * latencies of the individual operations, in power-of-two nanosecond
+ * buckets.  The undo records are written by the benchmarking transaction
+ * itself, so they are discarded as usual once it ends.
+ *
+ * Copyright (c) 2019, PostgreSQL Global Development Group
+ *
+ * IDENTIFICATION
+ *		src/test/modules/test_undo_bench/test_undo_bench.c
+ *
+ * -------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "access/rmgr.h"
+#include "access/undoinsert.h"
+#include "access/undorecord.h"
+#include "access/undorequest.h"
+#include "access/xact.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "port/pg_bitutils.h"
+#include "portability/instr_time.h"
+#include "utils/builtins.h"
+#include "utils/memutils.h"
+
+PG_MODULE_MAGIC;
+
+PG_FUNCTION_INFO_V1(undo_bench_insert);
+PG_FUNCTION_INFO_V1(undo_bench_fetch);
+PG_FUNCTION_INFO_V1(undo_bench_bulk_fetch);
+PG_FUNCTION_INFO_V1(undo_bench_pack);
+
+/* Latencies of 2^39 ns (about 9 minutes) and more share the last bucket. */
+#define UNDO_BENCH_NBUCKETS		40
+
+/* Number of columns returned by the benchmark functions. */
+#define UNDO_BENCH_COLS			4
+
+/*
+ * Latency histogram of one benchmarked operation.
+ */
+typedef struct UndoBenchHistogram
+{
+	const char *operation;		/* name of the operation, for humans */
+	uint64		nops;			/* number of operations timed */
+	uint64		nrecords;		/* number of undo records processed */
+	double		total_ns;		/* total time spent in the operations */
+	uint64		buckets[UNDO_BENCH_NBUCKETS];
+} UndoBenchHistogram;
+
+static UndoPersistence
+undo_persistence_from_text(text *t)
+{
+	char	   *str = text_to_cstring(t);
+
+	if (strcmp(str, "permanent") == 0)
+		return UNDO_PERMANENT;
+	else if (strcmp(str, "temporary") == 0)
+		return UNDO_TEMP;
+	else if (strcmp(str, "unlogged") == 0)
+		return UNDO_UNLOGGED;
+	else
+		elog(ERROR, "unknown undo persistence level: %s", str);
+}
+
+static void
+undo_bench_hist_init(UndoBenchHistogram *hist, const char *operation)
+{
+	memset(hist, 0, sizeof(UndoBenchHistogram));
+	hist->operation = operation;
+}
+
+/*
+ * Account for one operation that took the time elapsed since start, and
+ * processed nrecords undo records.
+ */
+static void
+undo_bench_hist_add(UndoBenchHistogram *hist, instr_time start,
+					uint64 nrecords)
+{
+	instr_time	elapsed;
+	double		ns;
+	int			bucket = 0;
+
+	INSTR_TIME_SET_CURRENT(elapsed);
+	INSTR_TIME_SUBTRACT(elapsed, start);
+	ns = INSTR_TIME_GET_DOUBLE(elapsed) * 1000000000.0;
+
+	if (ns >= 1.0)
+		bucket = Min(pg_leftmost_one_pos64((uint64) ns),
+					 UNDO_BENCH_NBUCKETS - 1);
+
+	hist->buckets[bucket]++;
+	hist->nops++;
+	hist->nrecords += nrecords;
+	hist->total_ns += ns;
+}
+
+/*
+ * Report the throughput of the benchmarked operations, and return their
+ * histograms as the result set of the calling function.
+ */
+static void
+undo_bench_report(FunctionCallInfo fcinfo, UndoBenchHistogram *hists,
+				  int nhists)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+	int			i;
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not " \
+						"allowed in this context")));
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+	if (tupdesc->natts != UNDO_BENCH_COLS)
+		elog(ERROR, "incorrect number of output arguments");
+
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	for (i = 0; i < nhists; i++)
+	{
+		UndoBenchHistogram *hist = &hists[i];
+		int			bucket;
+
+		if (hist->total_ns > 0)
+			elog(NOTICE, "%s: " UINT64_FORMAT " records in %.3f ms, %.0f records/s",
+				 hist->operation, hist->nrecords, hist->total_ns / 1000000.0,
+				 hist->nrecords * 1000000000.0 / hist->total_ns);
+
+		for (bucket = 0; bucket < UNDO_BENCH_NBUCKETS; bucket++)
+		{
+			Datum		values[UNDO_BENCH_COLS];
+			bool		nulls[UNDO_BENCH_COLS];
+
+			if (hist->buckets[bucket] == 0)
+				continue;
+
+			memset(nulls, 0, sizeof(nulls));
+			values[0] = CStringGetTextDatum(hist->operation);
+			values[1] = Int64GetDatum(bucket == 0 ? 0 : INT64CONST(1) << bucket);
+			if (bucket == UNDO_BENCH_NBUCKETS - 1)
+				nulls[2] = true;
+			else
+				values[2] = Int64GetDatum(INT64CONST(1) << (bucket + 1));
+			values[3] = Int64GetDatum(hist->buckets[bucket]);
+
+			tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+		}
+	}
+
+	tuplestore_donestoring(tupstore);
+}
+
+/*
+ * Initialize an undo record of the benchmarking transaction, as an insertion
+ * undo record for the first item of block 0 of no relation in particular.
+ * Rolling it back is therefore a no-op.
+ */
+static void
+undo_bench_init_record(UnpackedUndoRecord *uur, char *payload, int payload_len)
+{
+	memset(uur, 0, sizeof(UnpackedUndoRecord));
+	uur->uur_rmid = RM_ZHEAP_ID;
+	uur->uur_type = UNDO_INSERT;
+	uur->uur_reloid = InvalidOid;
+	uur->uur_prevxid = FrozenTransactionId;
+	uur->uur_xid = GetTopTransactionId();
+	uur->uur_cid = GetCurrentCommandId(true);
+	uur->uur_fork = MAIN_FORKNUM;
+	uur->uur_blkprev = InvalidUndoRecPtr;
+	uur->uur_block = 0;
+	uur->uur_offset = FirstOffsetNumber;
+	uur->uur_buffer = InvalidBuffer;
+	uur->uur_next = InvalidUndoRecPtr;
+	uur->uur_payload.data = payload;
+	uur->uur_payload.len = payload_len;
+}
+
+/*
+ * Write nrecords undo records with payload_len bytes of payload each, chained
+ * together through uur_blkprev.  If hist is not NULL, each insertion is timed
+ * into it.
+ *
+ * Returns the pointer to the last record written, and the one to the first
+ * in *first.
+ *
+ * Real code would also need to WAL-log something that would redo this, but
+ * a benchmark of the undo layer doesn't bother.
+ */
+static UndoRecPtr
+undo_bench_write_records(int nrecords, int payload_len,
+						 UndoPersistence persistence, UndoBenchHistogram *hist,
+						 UndoRecPtr *first)
+{
+	FullTransactionId fxid = GetTopFullTransactionId();
+	MemoryContext bench_ctx;
+	MemoryContext oldcontext;
+	UndoRecPtr	urecptr = InvalidUndoRecPtr;
+	char	   *payload;
+	int			i;
+
+	bench_ctx = AllocSetContextCreate(CurrentMemoryContext,
+									  "undo bench",
+									  ALLOCSET_DEFAULT_SIZES);
+
+	payload = palloc(Max(payload_len, 1));
+	memset(payload, 'u', payload_len);
+
+	*first = InvalidUndoRecPtr;
+
+	for (i = 0; i < nrecords; i++)
+	{
+		UnpackedUndoRecord uur;
+		instr_time	start;
+
+		CHECK_FOR_INTERRUPTS();
+
+		oldcontext = MemoryContextSwitchTo(bench_ctx);
+
+		undo_bench_init_record(&uur, payload, payload_len);
+		uur.uur_blkprev = urecptr;
+
+		INSTR_TIME_SET_CURRENT(start);
+
+		urecptr = PrepareUndoInsert(&uur, fxid, persistence, NULL, NULL);
+
+		START_CRIT_SECTION();
+		InsertPreparedUndo();
+		END_CRIT_SECTION();
+
+		UnlockReleaseUndoBuffers();
+
+		if (hist)
+			undo_bench_hist_add(hist, start, 1);
+
+		MemoryContextSwitchTo(oldcontext);
+		MemoryContextReset(bench_ctx);
+
+		if (i == 0)
+			*first = urecptr;
+	}
+
+	pfree(payload);
+	MemoryContextDelete(bench_ctx);
+
+	return urecptr;
+}
+
+/*
+ * UndoFetchRecord callback that follows the chain down to its first record.
+ */
+static bool
+undo_bench_chain_end(UnpackedUndoRecord *urec, BlockNumber blkno,
+					 OffsetNumber offset, TransactionId xid)
+{
+	return !UndoRecPtrIsValid(urec->uur_blkprev);
+}
+
+/*
+ * Time PrepareUndoInsert and InsertPreparedUndo.
+ */
+Datum
+undo_bench_insert(PG_FUNCTION_ARGS)
+{
+	int			nrecords = PG_GETARG_INT32(0);
+	int			payload_len = PG_GETARG_INT32(1);
+	UndoPersistence persistence = undo_persistence_from_text(PG_GETARG_TEXT_PP(2));
+	UndoBenchHistogram hist;
+	UndoRecPtr	first;
+
+	if (payload_len < 0 || payload_len > BLCKSZ)
+		elog(ERROR, "payload length must be between 0 and %d", BLCKSZ);
+
+	undo_bench_hist_init(&hist, "insert");
+	undo_bench_write_records(nrecords, payload_len, persistence, &hist, &first);
+
+	undo_bench_report(fcinfo, &hist, 1);
+
+	return (Datum) 0;
+}
+
+/*
+ * Time UndoFetchRecord following a block chain of chain_length records
+ * from its newest record down to its oldest one, loops times.
+ */
+Datum
+undo_bench_fetch(PG_FUNCTION_ARGS)
+{
+	int			chain_length = PG_GETARG_INT32(0);
+	int			loops = PG_GETARG_INT32(1);
+	UndoPersistence persistence = undo_persistence_from_text(PG_GETARG_TEXT_PP(2));
+	UndoBenchHistogram hist;
+	TransactionId xid = GetTopTransactionId();
+	UndoRecPtr	first;
+	UndoRecPtr	last;
+	int			i;
+
+	if (chain_length < 1)
+		elog(ERROR, "chain length must be positive");
+
+	last = undo_bench_write_records(chain_length, 0, persistence, NULL,
+									&first);
+
+	undo_bench_hist_init(&hist, "fetch");
+
+	for (i = 0; i < loops; i++)
+	{
+		UnpackedUndoRecord *uur;
+		instr_time	start;
+
+		CHECK_FOR_INTERRUPTS();
+
+		INSTR_TIME_SET_CURRENT(start);
+
+		uur = UndoFetchRecord(last, 0, FirstOffsetNumber, xid, NULL,
+							  undo_bench_chain_end);
+		if (uur == NULL)
+			elog(ERROR, "could not fetch undo record chain");
+		UndoRecordRelease(uur);
+
+		undo_bench_hist_add(&hist, start, chain_length);
+	}
+
+	undo_bench_report(fcinfo, &hist, 1);
+
+	return (Datum) 0;
+}
+
+/*
+ * Time UndoRecordBulkFetch reading back the nrecords undo records of a
+ * chain, loops times.  Each call of UndoRecordBulkFetch is one operation;
+ * it returns up to maintenance_work_mem worth of records, just like when
+ * undo actions are applied.
+ */
+Datum
+undo_bench_bulk_fetch(PG_FUNCTION_ARGS)
+{
+	int			nrecords = PG_GETARG_INT32(0);
+	int			loops = PG_GETARG_INT32(1);
+	UndoPersistence persistence = undo_persistence_from_text(PG_GETARG_TEXT_PP(2));
+	int			undo_apply_size = maintenance_work_mem * 1024L;
+	UndoBenchHistogram hist;
+	UndoRecPtr	first;
+	UndoRecPtr	last;
+	int			i;
+
+	if (nrecords < 1)
+		elog(ERROR, "number of records must be positive");
+
+	last = undo_bench_write_records(nrecords, 0, persistence, NULL, &first);
+
+	undo_bench_hist_init(&hist, "bulk fetch");
+
+	for (i = 0; i < loops; i++)
+	{
+		UndoRecPtr	urecptr = last;
+
+		while (UndoRecPtrIsValid(urecptr))
+		{
+			UndoRecInfo *urp_array;
+			instr_time	start;
+			int			nfetched;
+			int			j;
+
+			CHECK_FOR_INTERRUPTS();
+
+			INSTR_TIME_SET_CURRENT(start);
+
+			urp_array = UndoRecordBulkFetch(&urecptr, first, undo_apply_size,
+											&nfetched, false);
+
+			undo_bench_hist_add(&hist, start, nfetched);
+
+			for (j = 0; j < nfetched; j++)
+				UndoRecordRelease(urp_array[j].uur);
+			pfree(urp_array);
+
+			if (nfetched == 0)
+				elog(ERROR, "could not fetch undo records");
+		}
+	}
+
+	undo_bench_report(fcinfo, &hist, 1);
+
+	return (Datum) 0;
+}
+
+/*
+ * Time InsertUndoRecord and UnpackUndoRecord on an undo record with
+ * payload_len bytes of payload, loops times.  The record is packed at the
+ * end of a local page, so that it's split across two pages if it doesn't
+ * fit, as large records often are in undo logs.
+ */
+Datum
+undo_bench_pack(PG_FUNCTION_ARGS)
+{
+	int			payload_len = PG_GETARG_INT32(0);
+	int			loops = PG_GETARG_INT32(1);
+	UndoBenchHistogram hists[2];
+	UnpackedUndoRecord uur;
+	MemoryContext bench_ctx;
+	MemoryContext oldcontext;
+	PGAlignedBlock pages[2];
+	Page		p1 = (Page) pages[0].data;
+	Page		p2 = (Page) pages[1].data;
+	char	   *payload;
+	Size		size;
+	int			start_byte;
+	int			i;
+
+	if (payload_len < 0 || payload_len > BLCKSZ / 2)
+		elog(ERROR, "payload length must be between 0 and %d", BLCKSZ / 2);
+
+	payload = palloc(Max(payload_len, 1));
+	memset(payload, 'u', payload_len);
+
+	undo_bench_init_record(&uur, payload, payload_len);
+	UndoRecordSetInfo(&uur);
+	size = UndoRecordExpectedSize(&uur);
+
+	/* Start the record so that it spans the boundary, if it's big enough. */
+	start_byte = Max(BLCKSZ - (int) size / 2, MAXALIGN(SizeOfPageHeaderData));
+
+	bench_ctx = AllocSetContextCreate(CurrentMemoryContext,
+									  "undo bench",
+									  ALLOCSET_DEFAULT_SIZES);
+
+	undo_bench_hist_init(&hists[0], "pack");
+	undo_bench_hist_init(&hists[1], "unpack");
+
+	memset(pages, 0, sizeof(pages));
+
+	for (i = 0; i < loops; i++)
+	{
+		UnpackedUndoRecord unpacked;
+		instr_time	start;
+		int			done = 0;
+
+		CHECK_FOR_INTERRUPTS();
+
+		oldcontext = MemoryContextSwitchTo(bench_ctx);
+
+		INSTR_TIME_SET_CURRENT(start);
+		if (!InsertUndoRecord(&uur, p1, start_byte, &done, 0, size, false) &&
+			!InsertUndoRecord(&uur, p2, MAXALIGN(SizeOfPageHeaderData), &done,
+							  0, size, false))
+			elog(ERROR, "undo record doesn't fit in two pages");
+		undo_bench_hist_add(&hists[0], start, 1);
+
+		memset(&unpacked, 0, sizeof(UnpackedUndoRecord));
+		done = 0;
+
+		INSTR_TIME_SET_CURRENT(start);
+		if (!UnpackUndoRecord(&unpacked, p1, start_byte, &done, false, false) &&
+			!UnpackUndoRecord(&unpacked, p2, MAXALIGN(SizeOfPageHeaderData),
+							  &done, false, false))
+			elog(ERROR, "could not unpack undo record");
+		undo_bench_hist_add(&hists[1], start, 1);
+
+		MemoryContextSwitchTo(oldcontext);
+		MemoryContextReset(bench_ctx);
+	}
+
+	MemoryContextDelete(bench_ctx);
+	pfree(payload);
+
+	undo_bench_report(fcinfo, hists, lengthof(hists));
+
+	return (Datum) 0;
+}
@@ -995,3 +995,15 @@ select v||'a', case when v||'a' = 'aa' then 1 else 0 end, count(*)
 explain (costs off)
   select 1 from tenk1
    where (hundred, thousand) in (select twothousand, twothousand from onek);
+
+-- Hash aggregation spilling to disk, when the planner underestimates the
+-- number of groups
+begin;
+set local work_mem = '64kB';
+set local enable_sort = false;
+select count(*) as groups, sum(k) as keys, sum(c) as rows,
+       sum(hi - lo) as spread, sum(total) as total
+  from (select g % 20000 as k, count(*) as c, min(g) as lo, max(g) as hi,
+               sum(g::numeric) as total
+          from generate_series(1, 40000) g group by g % 20000) s;
+rollback;
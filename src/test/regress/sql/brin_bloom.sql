@@ -0,0 +1,20 @@
+CREATE TABLE brin_bloom_test (a int4, b text, c uuid) WITH (fillfactor = 10);
+INSERT INTO brin_bloom_test
+	SELECT i, md5(i::text), md5(i::text)::uuid FROM generate_series(1, 1000) s(i);
+CREATE INDEX brin_bloom_idx ON brin_bloom_test
+	USING brin (a int4_bloom_ops, b text_bloom_ops, c uuid_bloom_ops)
+	WITH (pages_per_range = 2);
+SET enable_seqscan = off;
+-- Ensure the bloom index is used for equality searches
+EXPLAIN (COSTS OFF) SELECT * FROM brin_bloom_test WHERE a = 500;
+SELECT count(*) FROM brin_bloom_test WHERE a = 500;
+SELECT count(*) FROM brin_bloom_test WHERE a = 5000;
+SELECT count(*) FROM brin_bloom_test WHERE b = md5('500');
+SELECT count(*) FROM brin_bloom_test WHERE c = md5('500')::uuid;
+-- Values added to already summarized ranges must be found, too
+INSERT INTO brin_bloom_test VALUES (5000, 'five thousand', NULL);
+SELECT count(*) FROM brin_bloom_test WHERE a = 5000;
+SELECT count(*) FROM brin_bloom_test WHERE b = 'five thousand';
+SELECT count(*) FROM brin_bloom_test WHERE c IS NULL;
+RESET enable_seqscan;
+DROP TABLE brin_bloom_test;
@@ -0,0 +1,29 @@
+CREATE TABLE brin_multi_test (a int8, d timestamp, n numeric) WITH (fillfactor = 10);
+-- Mostly sequential values, with a few outliers
+INSERT INTO brin_multi_test
+	SELECT CASE WHEN i % 100 = 0 THEN 1000000 + i ELSE i END,
+		   '2019-01-01'::timestamp + i * interval '1 minute',
+		   i
+	FROM generate_series(1, 1000) s(i);
+CREATE INDEX brin_multi_idx ON brin_multi_test
+	USING brin (a int8_minmax_multi_ops, d timestamp_minmax_multi_ops,
+				n numeric_minmax_multi_ops)
+	WITH (pages_per_range = 1);
+SET enable_seqscan = off;
+EXPLAIN (COSTS OFF) SELECT * FROM brin_multi_test WHERE a = 500;
+SELECT count(*) FROM brin_multi_test WHERE a = 500;
+SELECT count(*) FROM brin_multi_test WHERE a = 500::int4;
+SELECT count(*) FROM brin_multi_test WHERE a < 10;
+SELECT count(*) FROM brin_multi_test WHERE a > 1000000;
+SELECT count(*) FROM brin_multi_test WHERE a BETWEEN 1000 AND 999999;
+SELECT count(*) FROM brin_multi_test WHERE d = '2019-01-01 08:20';
+SELECT count(*) FROM brin_multi_test WHERE d >= '2019-01-01 16:00';
+SELECT count(*) FROM brin_multi_test WHERE n = 250;
+SELECT count(*) FROM brin_multi_test WHERE n <= 10;
+-- Values added to already summarized ranges must be found, too
+INSERT INTO brin_multi_test VALUES (2000000, NULL, 0.5);
+SELECT count(*) FROM brin_multi_test WHERE a = 2000000;
+SELECT count(*) FROM brin_multi_test WHERE n < 1;
+SELECT count(*) FROM brin_multi_test WHERE d IS NULL;
+RESET enable_seqscan;
+DROP TABLE brin_multi_test;
@@ -140,3 +140,62 @@ VACUUM delete_test_table;
 -- The vacuum above should've turned the leaf page into a fast root. We just
 -- need to insert some rows to cause the fast root page to split.
 INSERT INTO delete_test_table SELECT i, 1, 2, 3 FROM generate_series(1,1000) i;
+
+--
+-- Test deduplication of duplicate keys into posting list tuples
+--
+create table btree_dedup_tbl (id int4, a int4, b text);
+insert into btree_dedup_tbl select g, g % 10, 'dup' from generate_series(1, 10000) g;
+create index btree_dedup_idx on btree_dedup_tbl (a);
+create index btree_nodedup_idx on btree_dedup_tbl (a) with (deduplicate_items = off);
+select pg_relation_size('btree_dedup_idx') * 2 < pg_relation_size('btree_nodedup_idx') as deduplicated;
+select reloptions from pg_class WHERE oid = 'btree_nodedup_idx'::regclass;
+drop index btree_nodedup_idx;
+-- Insertions deduplicate leaf pages before splitting them, and split posting
+-- lists when the new heap TID falls inside one
+create index btree_dedup_text_idx on btree_dedup_tbl (b);
+insert into btree_dedup_tbl select g, g % 10, 'dup' from generate_series(10001, 20000) g;
+-- Remove some of the heap TIDs of the posting lists, and all of others
+delete from btree_dedup_tbl where a = 3 or (id % 4 = 0 and a < 5);
+vacuum btree_dedup_tbl;
+set enable_seqscan = off;
+set enable_bitmapscan = off;
+select count(*) from btree_dedup_tbl where a = 5;
+select count(*) from btree_dedup_tbl where a = 3;
+select count(*) from btree_dedup_tbl where a = 2;
+select count(*) from btree_dedup_tbl where a > 7;
+select count(*) from btree_dedup_tbl where b = 'dup';
+select a from btree_dedup_tbl where a < 2 order by a desc limit 3;
+reset enable_seqscan;
+reset enable_bitmapscan;
+drop table btree_dedup_tbl;
+
+--
+-- Test skip scans, which visit each value of the first index column
+--
+create table btree_skip_tbl (a int4, b int4);
+insert into btree_skip_tbl select g % 5, g / 5 from generate_series(0, 9999) g;
+insert into btree_skip_tbl select null, g from generate_series(0, 99) g;
+create index btree_skip_idx on btree_skip_tbl (a, b);
+vacuum analyze btree_skip_tbl;
+set enable_seqscan = off;
+set enable_bitmapscan = off;
+explain (costs off)
+select a, b from btree_skip_tbl where b = 42;
+select a, b from btree_skip_tbl where b = 42;
+select a, b from btree_skip_tbl where b between 41 and 42 order by a desc, b desc;
+-- Bitmap scans skip, too
+set enable_indexscan = off;
+set enable_bitmapscan = on;
+select count(*) from btree_skip_tbl where b = 42;
+reset enable_indexscan;
+set enable_bitmapscan = off;
+-- Nulls come first in a descending index
+drop index btree_skip_idx;
+create index btree_skip_desc_idx on btree_skip_tbl (a desc, b);
+select a, b from btree_skip_tbl where b = 42;
+-- Contradictory quals end the scan right away
+select a, b from btree_skip_tbl where b = 42 and b = 43;
+reset enable_seqscan;
+reset enable_bitmapscan;
+drop table btree_skip_tbl;
@@ -0,0 +1,42 @@
+--
+-- Per-column compression of TOAST-able values
+--
+-- Only pglz is exercised here, since lz4 support depends on the build.
+
+SHOW default_toast_compression;
+
+CREATE TABLE cmdata (f1 text);
+INSERT INTO cmdata VALUES (repeat('1234567890', 1000));
+SELECT pg_column_compression(f1), length(f1) FROM cmdata;
+
+-- values too short to compress, and non-varlena values, show no method
+SELECT pg_column_compression('short'::text), pg_column_compression(42);
+
+ALTER TABLE cmdata ALTER COLUMN f1 SET COMPRESSION pglz;
+SELECT attcompression FROM pg_attribute
+  WHERE attrelid = 'cmdata'::regclass AND attname = 'f1';
+
+-- large enough to be compressed and moved to the TOAST table
+INSERT INTO cmdata VALUES (repeat('1234567890', 100000));
+SELECT pg_column_compression(f1), length(f1), substr(f1, 99995, 10)
+  FROM cmdata ORDER BY length(f1);
+
+-- the method is set on inheritance children too, unless ONLY is given
+CREATE TABLE cmchild () INHERITS (cmdata);
+ALTER TABLE cmdata ALTER f1 SET COMPRESSION pglz;
+SELECT attrelid::regclass, attcompression FROM pg_attribute
+  WHERE attrelid IN ('cmdata'::regclass, 'cmchild'::regclass)
+    AND attname = 'f1'
+  ORDER BY 1;
+ALTER TABLE ONLY cmdata ALTER COLUMN f1 SET COMPRESSION DEFAULT;
+SELECT attrelid::regclass, attcompression = '' AS is_default FROM pg_attribute
+  WHERE attrelid IN ('cmdata'::regclass, 'cmchild'::regclass)
+    AND attname = 'f1'
+  ORDER BY 1;
+
+-- errors
+ALTER TABLE cmdata ALTER COLUMN f1 SET COMPRESSION i_do_not_exist;
+CREATE TABLE cmint (f1 int);
+ALTER TABLE cmint ALTER COLUMN f1 SET COMPRESSION pglz;
+
+DROP TABLE cmchild, cmdata, cmint;
@@ -440,6 +440,24 @@ test1
 SELECT * FROM instead_of_insert_tbl;
 COMMIT;
 
+-- Test parallel COPY FROM; the results must not depend on whether any
+-- workers could be launched
+CREATE TABLE parallel_copy_tbl (a int PRIMARY KEY, b text DEFAULT 'x');
+COPY parallel_copy_tbl TO stdout (PARALLEL 2);
+COPY parallel_copy_tbl FROM stdin (FORMAT binary, PARALLEL 2);
+COPY parallel_copy_tbl FROM stdin (PARALLEL -1);
+COPY parallel_copy_tbl (a) FROM stdin (PARALLEL 2);
+1
+2
+\.
+COPY parallel_copy_tbl FROM stdin (FORMAT csv, HEADER, PARALLEL 2);
+a,b
+3,"multi
+line"
+4,
+\.
+SELECT * FROM parallel_copy_tbl ORDER BY a;
+
 -- clean up
 DROP TABLE forcetest;
 DROP TABLE vistest;
@@ -454,3 +472,4 @@ DROP TABLE instead_of_insert_tbl;
 DROP VIEW instead_of_insert_tbl_view;
 DROP VIEW instead_of_insert_tbl_view_2;
 DROP FUNCTION fun_instead_of_insert_tbl();
+DROP TABLE parallel_copy_tbl;
@@ -34,3 +34,31 @@ SELECT current_schema;
 SET search_path = 'pg_catalog';
 SELECT current_schema;
 RESET search_path;
+
+
+--
+-- Comparisons of columns evaluated by specialized steps
+--
+CREATE TEMP TABLE varcmp (i int4, b int8, f float8, d date, t timestamptz);
+INSERT INTO varcmp VALUES
+  (1, 10, 1.5, '2019-01-01', '2019-01-01 00:00+00'),
+  (2, 20, 'NaN', '2019-06-01', '2019-06-01 00:00+00'),
+  (3, NULL, NULL, NULL, NULL),
+  (NULL, 30, 'NaN', '2020-01-01', NULL);
+
+SELECT i FROM varcmp WHERE i >= 2 ORDER BY i;
+SELECT i FROM varcmp WHERE 2 > i ORDER BY i;
+SELECT i FROM varcmp WHERE b < 25 AND i <> 1 ORDER BY i;
+SELECT i FROM varcmp WHERE i < b ORDER BY i;
+-- NaN is equal to itself and greater than any other value
+SELECT i FROM varcmp WHERE f = 'NaN' ORDER BY i;
+SELECT i FROM varcmp WHERE f > 1e308 ORDER BY i;
+SELECT i FROM varcmp WHERE f = f ORDER BY i;
+SELECT i FROM varcmp WHERE d > '2019-03-01' ORDER BY i;
+SELECT i FROM varcmp WHERE t <= '2019-01-01 00:00+00' ORDER BY i;
+SELECT i FROM varcmp WHERE b IS NULL ORDER BY i;
+SELECT i FROM varcmp WHERE t IS NOT NULL ORDER BY i;
+SELECT i FROM varcmp WHERE CASE WHEN i = 1 THEN false ELSE b IS NULL END ORDER BY i;
+SELECT i, i > 1 AS gt, f = 'NaN' AS nan FROM varcmp ORDER BY i;
+
+DROP TABLE varcmp;
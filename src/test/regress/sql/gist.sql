@@ -37,6 +37,13 @@ vacuum analyze gist_point_tbl;
 alter index gist_pointidx SET (fillfactor = 40);
 reindex index gist_pointidx;
 
+-- check that the index, now built by sorting, finds the right rows
+set enable_seqscan = off;
+set enable_bitmapscan = off;
+select count(*) from gist_point_tbl where p <@ box(point(0,0), point(1000, 1000));
+reset enable_seqscan;
+reset enable_bitmapscan;
+
 --
 -- Test Index-only plans on GiST indexes
 --
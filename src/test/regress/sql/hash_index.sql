@@ -202,3 +202,18 @@ CREATE INDEX hash_f8_index2 ON hash_f8_heap USING hash (random float8_ops)
 	WITH (fillfactor=9);
 CREATE INDEX hash_f8_index2 ON hash_f8_heap USING hash (random float8_ops)
 	WITH (fillfactor=101);
+
+-- Bulk build from the sorted spool, with overflow pages for duplicate keys
+CREATE TABLE hash_build_heap (keycol int);
+INSERT INTO hash_build_heap SELECT a % 100 FROM generate_series(1, 20000) a;
+SET maintenance_work_mem = '1MB';
+CREATE INDEX hash_build_index ON hash_build_heap USING hash (keycol)
+	WITH (fillfactor = 10);
+RESET maintenance_work_mem;
+SET enable_seqscan = OFF;
+SELECT count(*) FROM hash_build_heap WHERE keycol = 42;
+SELECT count(*) FROM hash_build_heap WHERE keycol = 100;
+INSERT INTO hash_build_heap SELECT 42 FROM generate_series(1, 1000);
+SELECT count(*) FROM hash_build_heap WHERE keycol = 42;
+RESET enable_seqscan;
+DROP TABLE hash_build_heap;
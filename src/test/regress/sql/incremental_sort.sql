@@ -0,0 +1,43 @@
+--
+-- INCREMENTAL SORT
+--
+
+-- The table is stored in the order of a, in groups of ten rows
+create table incsort_tbl (a int, b int, c text);
+insert into incsort_tbl
+  select i / 10, (i * 7) % 10, 'row ' || i from generate_series(0, 9999) i;
+create index incsort_tbl_a_idx on incsort_tbl (a);
+analyze incsort_tbl;
+
+-- A sort by (a, b) only needs to sort the rows of equal a
+explain (costs off)
+select * from incsort_tbl order by a, b limit 10;
+select * from incsort_tbl order by a, b limit 5;
+
+-- The bound crosses the first batch of groups
+select a, b from incsort_tbl order by a, b offset 35 limit 10;
+
+-- Check that all batches come out in order
+set enable_sort = off;
+explain (costs off)
+select a, b from incsort_tbl order by a, b;
+with s as (
+  select a, b, row_number() over () as rn
+  from (select a, b from incsort_tbl order by a, b) ss
+)
+select count(*) as out_of_order
+from s s1 join s s2 on s2.rn = s1.rn + 1
+where (s2.a, s2.b) < (s1.a, s1.b);
+
+-- Descending keys, too
+explain (costs off)
+select a, b from incsort_tbl order by a desc, b desc limit 3;
+select a, b from incsort_tbl order by a desc, b desc limit 3;
+reset enable_sort;
+
+set enable_incrementalsort = off;
+explain (costs off)
+select * from incsort_tbl order by a, b limit 10;
+reset enable_incrementalsort;
+
+drop table incsort_tbl;
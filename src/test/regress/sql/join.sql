@@ -365,16 +365,33 @@ select count(*) from tenk1 x where
   x.unique1 = 0 and
   x.unique1 in (select aa.f1 from int4_tbl aa,float8_tbl bb where aa.f1=bb.f1);
 
--- try that with GEQO too
+-- try that with GEQO too, with both join search methods
 begin;
 set geqo = on;
 set geqo_threshold = 2;
+set join_search_method = genetic;
+select count(*) from tenk1 x where
+  x.unique1 in (select a.f1 from int4_tbl a,float8_tbl b where a.f1=b.f1) and
+  x.unique1 = 0 and
+  x.unique1 in (select aa.f1 from int4_tbl aa,float8_tbl bb where aa.f1=bb.f1);
+set join_search_method = iterative;
 select count(*) from tenk1 x where
   x.unique1 in (select a.f1 from int4_tbl a,float8_tbl b where a.f1=b.f1) and
   x.unique1 = 0 and
   x.unique1 in (select aa.f1 from int4_tbl aa,float8_tbl bb where aa.f1=bb.f1);
 rollback;
 
+-- the equivalence class joins every pair of these, so the iterative join
+-- search needs several rounds
+select count(*) from
+  int4_tbl t1, int4_tbl t2, int4_tbl t3, int4_tbl t4, int4_tbl t5,
+  int4_tbl t6, int4_tbl t7, int4_tbl t8, int4_tbl t9, int4_tbl t10,
+  int4_tbl t11, int4_tbl t12, int4_tbl t13, int4_tbl t14
+where t1.f1 = t2.f1 and t2.f1 = t3.f1 and t3.f1 = t4.f1 and t4.f1 = t5.f1 and
+  t5.f1 = t6.f1 and t6.f1 = t7.f1 and t7.f1 = t8.f1 and t8.f1 = t9.f1 and
+  t9.f1 = t10.f1 and t10.f1 = t11.f1 and t11.f1 = t12.f1 and
+  t12.f1 = t13.f1 and t13.f1 = t14.f1;
+
 --
 -- regression test: be sure we cope with proven-dummy append rels
 --
@@ -466,4 +466,73 @@ $$
 $$);
 rollback to settings;
 
+-- Bloom filter pushdown from the build side into the outer seq scan
+savepoint settings;
+set local max_parallel_workers_per_gather = 0;
+create table bloom_probe as select generate_series(1, 10000) as id;
+create table bloom_build as select generate_series(1, 10000, 100) as id;
+analyze bloom_probe;
+analyze bloom_build;
+create or replace function runtime_filter_removed(query text)
+returns bigint language plpgsql
+as
+$$
+declare
+  whole_plan json;
+  removed bigint;
+begin
+  for whole_plan in
+    execute 'explain (analyze, format ''json'') ' || query
+  loop
+    select coalesce(sum((m[1])::bigint), 0) into removed
+      from regexp_matches(whole_plan::text,
+                          '"Rows Removed by Runtime Filter": ([0-9]+)', 'g') m;
+  end loop;
+  return removed;
+end;
+$$;
+explain (costs off)
+  select count(*) from bloom_probe p join bloom_build b using (id);
+select count(*) from bloom_probe p join bloom_build b using (id);
+select runtime_filter_removed(
+$$
+  select count(*) from bloom_probe p join bloom_build b using (id);
+$$) > 9000 as filtered;
+-- outer joins must see every probe row
+select count(*) from bloom_probe p left join bloom_build b using (id);
+select runtime_filter_removed(
+$$
+  select count(*) from bloom_probe p left join bloom_build b using (id);
+$$) as filtered;
+set local enable_hashjoin_bloom = off;
+select runtime_filter_removed(
+$$
+  select count(*) from bloom_probe p join bloom_build b using (id);
+$$) as filtered;
+rollback to settings;
+
+-- multi-batch join with compressed batch files
+savepoint settings;
+set local max_parallel_workers_per_gather = 0;
+set local work_mem = '128kB';
+set local temp_file_compression = pglz;
+select count(*), sum(r.id), sum(length(s."?column?"))
+  from simple r join simple s using (id);
+select original > 1 as initially_multibatch
+  from hash_join_batches(
+$$
+  select count(*) from simple r join simple s using (id);
+$$);
+rollback to settings;
+
+-- probing a hash table too large for the CPU caches reads outer tuples
+-- ahead; check that none are lost at the end of the batch
+savepoint settings;
+set local max_parallel_workers_per_gather = 0;
+set local work_mem = '4MB';
+set local enable_mergejoin = off;
+select count(*), count(r.id), count(s.id)
+  from simple r full join simple s on r.id = s.id + 3;
+rollback to settings;
+
 rollback;
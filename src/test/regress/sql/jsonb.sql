@@ -1243,3 +1243,10 @@ select '12345.0000000000000000000000000000000000000000000005'::jsonb::float8;
 select '12345.0000000000000000000000000000000000000000000005'::jsonb::int2;
 select '12345.0000000000000000000000000000000000000000000005'::jsonb::int4;
 select '12345.0000000000000000000000000000000000000000000005'::jsonb::int8;
+
+-- nested containers and long strings
+select '{"a": [1, {"b": [true, null, "x"], "b": {"c": []}}, [[[]]]], "d": {"e": "f"}}'::jsonb;
+select '[{"a": 1}, [2, [3, [4, {"b": [5]}]]]]'::jsonb -> 1 -> 1 -> 1 -> 1 -> 'b';
+select '{"a": {"x": 1, "y": [1, 2]}, "b": [{"z": 1}]}'::jsonb @> '{"a": {"y": [2]}, "b": [{}]}';
+select ('"' || repeat('0123456789', 4) || '\"x\u0041"')::jsonb;
+select ('"' || repeat('x', 20) || chr(1) || '"')::jsonb;
@@ -0,0 +1,71 @@
+--
+-- MEMOIZE
+--
+
+-- The cache hit and miss counts are stable, but the memory usage may vary
+-- between machines, so replace it with 'N'.
+create function explain_memoize(query text) returns setof text
+language plpgsql as
+$$
+declare
+    ln text;
+begin
+    for ln in
+        execute format('explain (analyze, costs off, summary off, timing off) %s',
+            query)
+    loop
+        ln := regexp_replace(ln, 'Memory Usage: \d+', 'Memory Usage: N');
+        return next ln;
+    end loop;
+end;
+$$;
+
+-- A fact table referencing each of the 20 rows of a small dimension table
+-- 1000 times
+create table memo_dim (id int primary key, name text);
+insert into memo_dim select i, 'dim ' || i from generate_series(1, 20) i;
+create table memo_fact (dim_id int, val int);
+insert into memo_fact select i % 20 + 1, i from generate_series(1, 20000) i;
+analyze memo_dim;
+analyze memo_fact;
+
+-- Make sure the join is done by a nested loop
+set enable_hashjoin = off;
+set enable_mergejoin = off;
+set enable_bitmapscan = off;
+
+explain (costs off)
+select count(*), sum(length(d.name))
+from memo_fact f join memo_dim d on d.id = f.dim_id;
+select count(*), sum(length(d.name))
+from memo_fact f join memo_dim d on d.id = f.dim_id;
+
+-- Only the first lookup of each key scans the dimension table
+select explain_memoize('
+select count(*), sum(length(d.name))
+from memo_fact f join memo_dim d on d.id = f.dim_id');
+
+-- The results must not be affected by evictions when the cache is small
+create table memo_dim2 (id int primary key, filler text);
+insert into memo_dim2 select i, repeat('x', 500) || i from generate_series(1, 2000) i;
+create table memo_fact2 (dim_id int);
+insert into memo_fact2 select i % 2000 + 1 from generate_series(1, 10000) i;
+analyze memo_dim2;
+analyze memo_fact2;
+set work_mem = '64kB';
+select count(*), sum(length(d.filler))
+from memo_fact2 f join memo_dim2 d on d.id = f.dim_id;
+reset work_mem;
+
+-- Same results without enable_memoize
+set enable_memoize = off;
+select count(*), sum(length(d.name))
+from memo_fact f join memo_dim d on d.id = f.dim_id;
+reset enable_memoize;
+
+reset enable_hashjoin;
+reset enable_mergejoin;
+reset enable_bitmapscan;
+
+drop table memo_fact, memo_dim, memo_fact2, memo_dim2;
+drop function explain_memoize(text);
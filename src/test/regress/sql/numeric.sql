@@ -1043,3 +1043,12 @@ select scale(-13.000000000000000);
 -- cases that need carry propagation
 SELECT SUM(9999::numeric) FROM generate_series(1, 100000);
 SELECT SUM((-9999)::numeric) FROM generate_series(1, 100000);
+
+-- inputs mixing the scaled-integer fast path and arbitrary precision
+SELECT sum(x), avg(x)
+  FROM (VALUES (1.5::numeric), (2.25), (1e30), (-1e30), (0.001)) v(x);
+SELECT sum(x)
+  FROM (VALUES (123456789012.5::numeric), (0.000000000000000001),
+               (-123456789012.5)) v(x);
+SELECT x, sum(x) OVER (ORDER BY i ROWS BETWEEN 1 PRECEDING AND CURRENT ROW)
+  FROM (VALUES (1, 1.10::numeric), (2, 2.25), (3, 1e20), (4, 3.50)) v(i, x);
@@ -85,6 +85,20 @@ ROLLBACK PREPARED 'foo4';
 
 SELECT gid FROM pg_prepared_xacts;
 
+-- Test that the session that prepared a transaction keeps seeing it as
+-- running until it's committed.  Each statement takes a new snapshot here,
+-- after the xid of the transaction has been assigned.
+BEGIN;
+INSERT INTO pxtest1 VALUES ('ggg');
+SELECT * FROM pxtest1;
+PREPARE TRANSACTION 'foo6';
+
+SELECT * FROM pxtest1;
+
+COMMIT PREPARED 'foo6';
+
+SELECT * FROM pxtest1;
+
 -- Clean up
 DROP TABLE pxtest1;
 
@@ -139,3 +139,13 @@ select 'a' ~ '()+\1';
 select 'xyz' ~ 'x(\w)(?=\1)';  -- no backrefs in LACONs
 select 'xyz' ~ 'x(\w)(?=(\1))';
 select 'a' ~ '\x7fffffff';  -- invalid chr code
+
+-- Compiled regexes keep their DFA state caches between matches; the
+-- lookahead constraint must still be checked against each new string
+select s, s ~ 'a(?=b)' as m from (values ('ab'), ('ac'), ('xab'), ('a')) v(s);
+select s, regexp_match(s, 'b+(c|d)') from (values ('abbc'), ('bd'), ('xyz'), ('bbbbd')) v(s);
+-- Matching more distinct patterns than the cache holds
+set regex_cache_size = 2;
+select count(*) from generate_series(1, 10) g, generate_series(1, 10) h
+  where ('x' || g) ~ ('^x' || h || '$');
+reset regex_cache_size;
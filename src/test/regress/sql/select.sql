@@ -262,3 +262,15 @@ create table list_parted_tbl1 partition of list_parted_tbl
   for values in (1) partition by list(b);
 explain (costs off) select * from list_parted_tbl;
 drop table list_parted_tbl;
+
+-- Test quals evaluated a batch of tuples at a time by a seqscan, with
+-- enough rows to fill several batches
+create temp table batch_tbl as
+  select i as a, case when i % 10 = 0 then null else i % 7 end as b,
+         i::text as c
+  from generate_series(1, 3000) i;
+select count(*) from batch_tbl where b = 3;
+select count(*) from batch_tbl where b < a and 2000 < a;
+select count(*) from batch_tbl where 5 <= b and c like '%7';
+select a, b, c from batch_tbl where a > 2990 and b <> 1 order by a;
+drop table batch_tbl;
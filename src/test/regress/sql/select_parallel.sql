@@ -102,6 +102,16 @@ select length(stringu1) from tenk1 group by length(stringu1);
 explain (costs off)
 	select stringu1, count(*) from tenk1 group by stringu1 order by stringu1;
 
+-- each group must be returned by just one participant
+select count(*), min(c), max(c) from
+  (select stringu1, count(*) as c from tenk1 group by stringu1) ss;
+
+-- test that partial aggregation is used instead, when disabled
+set enable_parallel_hashagg = off;
+explain (costs off)
+	select stringu1, count(*) from tenk1 group by stringu1 order by stringu1;
+reset enable_parallel_hashagg;
+
 -- test that parallel plan for aggregates is not selected when
 -- target list contains parallel restricted clause.
 explain (costs off)
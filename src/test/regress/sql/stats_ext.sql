@@ -434,3 +434,27 @@ SELECT * FROM check_estimated_rows('SELECT * FROM mcv_lists_bool WHERE NOT a AND
 SELECT * FROM check_estimated_rows('SELECT * FROM mcv_lists_bool WHERE NOT a AND NOT b AND c');
 
 SELECT * FROM check_estimated_rows('SELECT * FROM mcv_lists_bool WHERE NOT a AND b AND NOT c');
+
+-- ndistinct statistics used for joins on correlated columns
+CREATE TABLE ndistinct_join1 (a INT, b INT);
+CREATE TABLE ndistinct_join2 (a INT, b INT);
+
+INSERT INTO ndistinct_join1 (a, b)
+     SELECT mod(i, 50), mod(i, 50) FROM generate_series(1, 1000) s(i);
+INSERT INTO ndistinct_join2 (a, b)
+     SELECT mod(i, 25), mod(i, 25) FROM generate_series(1, 1000) s(i);
+
+ANALYZE ndistinct_join1, ndistinct_join2;
+
+SELECT * FROM check_estimated_rows('SELECT * FROM ndistinct_join1 j1 JOIN ndistinct_join2 j2 ON (j1.a = j2.a AND j1.b = j2.b)');
+
+SELECT * FROM check_estimated_rows('SELECT * FROM ndistinct_join1 j1 WHERE EXISTS (SELECT 1 FROM ndistinct_join2 j2 WHERE j1.a = j2.a AND j1.b = j2.b)');
+
+CREATE STATISTICS ndistinct_join1_stats (ndistinct) ON a, b FROM ndistinct_join1;
+CREATE STATISTICS ndistinct_join2_stats (ndistinct) ON a, b FROM ndistinct_join2;
+
+ANALYZE ndistinct_join1, ndistinct_join2;
+
+SELECT * FROM check_estimated_rows('SELECT * FROM ndistinct_join1 j1 JOIN ndistinct_join2 j2 ON (j1.a = j2.a AND j1.b = j2.b)');
+
+SELECT * FROM check_estimated_rows('SELECT * FROM ndistinct_join1 j1 WHERE EXISTS (SELECT 1 FROM ndistinct_join2 j2 WHERE j1.a = j2.a AND j1.b = j2.b)');
@@ -26,6 +26,13 @@ select count(*) > 0 as ok from pg_hba_file_rules;
 -- There will surely be at least one active lock
 select count(*) > 0 as ok from pg_locks;
 
+-- Buffer content locks are taken for every table scan
+select acquisitions > 0 as ok from pg_stat_lwlocks
+  where tranche = 'buffer_content';
+
+-- There is a row for each backend type, object and context
+select count(*) > 0 as ok from pg_stat_io;
+
 -- We expect no prepared statements in this test; see also prepare.sql
 select count(*) = 0 as ok from pg_prepared_statements;
 
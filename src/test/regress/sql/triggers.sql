@@ -2154,3 +2154,30 @@ drop table self_ref;
 drop function dump_insert();
 drop function dump_update();
 drop function dump_delete();
+
+--
+-- Deferred events beyond work_mem are spilled to a temporary file
+--
+create table spill_pk (a int primary key);
+create table spill_fk (a int references spill_pk deferrable initially deferred);
+insert into spill_pk select generate_series(1, 20000);
+
+begin;
+set local work_mem = '64kB';
+insert into spill_fk select generate_series(1, 20000);
+savepoint s;
+insert into spill_fk select generate_series(1, 5000);
+insert into spill_fk values (0);
+rollback to s;
+insert into spill_fk select generate_series(1, 5000);
+commit;
+
+select count(*) from spill_fk;
+
+begin;
+set local work_mem = '64kB';
+insert into spill_fk select generate_series(1, 20000);
+insert into spill_fk values (0);
+commit;
+
+drop table spill_fk, spill_pk;
@@ -632,3 +632,20 @@ select websearch_to_tsquery('''');
 select websearch_to_tsquery('''abc''''def''');
 select websearch_to_tsquery('\abc');
 select websearch_to_tsquery('\');
+
+-- ranking a big out-of-line tsvector fetches only the entries it needs
+CREATE TEMP TABLE test_tsvector_ext (t tsvector);
+ALTER TABLE test_tsvector_ext ALTER COLUMN t SET STORAGE EXTERNAL;
+INSERT INTO test_tsvector_ext
+  SELECT (string_agg('w' || g || ':' || g ||
+                     CASE WHEN g % 3 = 0 THEN 'A' ELSE '' END, ' ') ||
+          ' nopos')::tsvector
+  FROM generate_series(1, 20000) g;
+SELECT q,
+       ts_rank(t, q) = ts_rank(t || ''::tsvector, q) AS rank,
+       ts_rank(t, q, 8) = ts_rank(t || ''::tsvector, q, 8) AS rank_uniq,
+       ts_rank_cd(t, q) = ts_rank_cd(t || ''::tsvector, q) AS rank_cd,
+       ts_rank_cd(t, q, 4|32) = ts_rank_cd(t || ''::tsvector, q, 4|32) AS rank_cd_norm
+  FROM test_tsvector_ext,
+       (VALUES ('w5'::tsquery), ('w5 & w19999'), ('w5 <-> w6'),
+               ('w1999:*'), ('w6:A | nosuch'), ('nosuch & nopos')) v(q);
@@ -360,3 +360,358 @@ SELECT * FROM test_multi_insert ORDER BY 1;
 ROLLBACK;
 SELECT * FROM test_multi_insert ORDER BY 1;
 DROP TABLE test_multi_insert;
+
+-- Test per-table number of transaction slots
+CREATE TABLE test_trans_slots(id int, val text) USING zheap WITH (trans_slots = 1);
+CREATE TABLE test_trans_slots(id int, val text) USING zheap WITH (trans_slots = 32);
+CREATE TABLE test_trans_slots(id int, val text) USING zheap WITH (trans_slots = 2);
+INSERT INTO test_trans_slots SELECT g, 'val' || g FROM generate_series(1, 5) g;
+BEGIN;
+UPDATE test_trans_slots SET val = 'new' || id WHERE id <= 2;
+DELETE FROM test_trans_slots WHERE id = 5;
+ROLLBACK;
+UPDATE test_trans_slots SET val = repeat('x', 20) WHERE id = 3;
+SELECT * FROM test_trans_slots ORDER BY id;
+ALTER TABLE test_trans_slots SET (trans_slots = 16);
+VACUUM FULL test_trans_slots;
+SELECT * FROM test_trans_slots ORDER BY id;
+DROP TABLE test_trans_slots;
+
+-- Test in-place updates of columns covered by a btree index
+CREATE TABLE test_delete_mark(id int, val int) USING zheap;
+CREATE INDEX test_delete_mark_val ON test_delete_mark(val);
+INSERT INTO test_delete_mark SELECT g, g FROM generate_series(1, 5) g;
+SET enable_seqscan = off;
+SET enable_bitmapscan = off;
+UPDATE test_delete_mark SET val = val + 10 WHERE id <= 2;
+SELECT * FROM test_delete_mark WHERE val = 1;
+SELECT * FROM test_delete_mark WHERE val > 10 ORDER BY val;
+BEGIN;
+UPDATE test_delete_mark SET val = 100 WHERE id = 3;
+ROLLBACK;
+SELECT * FROM test_delete_mark WHERE val = 100;
+SELECT * FROM test_delete_mark WHERE val = 3;
+UPDATE test_delete_mark SET val = 1 WHERE id = 1;
+SELECT * FROM test_delete_mark WHERE val = 1;
+SELECT val FROM test_delete_mark WHERE val < 20 ORDER BY val;
+-- VACUUM removes the entries for 2, 11 and 100 that no longer match any row
+VACUUM test_delete_mark;
+SELECT reltuples FROM pg_class WHERE relname = 'test_delete_mark_val';
+SELECT * FROM test_delete_mark WHERE val = 11;
+SELECT * FROM test_delete_mark WHERE val = 3;
+SELECT val FROM test_delete_mark WHERE val < 20 ORDER BY val;
+RESET enable_seqscan;
+RESET enable_bitmapscan;
+DROP TABLE test_delete_mark;
+
+-- Test undo of in-place updates of wide tuples, which only keeps the change
+CREATE TABLE test_inplace_undo(id int, counter bigint, pad text) USING zheap;
+INSERT INTO test_inplace_undo SELECT g, 0, repeat('x', 500) FROM generate_series(1, 3) g;
+BEGIN;
+UPDATE test_inplace_undo SET counter = counter + 1;
+UPDATE test_inplace_undo SET counter = counter + 1 WHERE id = 2;
+SELECT id, counter, length(pad) FROM test_inplace_undo ORDER BY id;
+ROLLBACK;
+SELECT id, counter, length(pad) FROM test_inplace_undo ORDER BY id;
+DROP TABLE test_inplace_undo;
+
+-- Test undo of wide, compressible tuples
+CREATE TABLE test_undo_compress(id int, pad text) USING zheap;
+INSERT INTO test_undo_compress SELECT g, repeat('abc', 300) FROM generate_series(1, 3) g;
+BEGIN;
+DECLARE c CURSOR FOR SELECT id, length(pad), md5(pad) FROM test_undo_compress ORDER BY id;
+UPDATE test_undo_compress SET pad = repeat('xyz', 200) WHERE id = 1;
+DELETE FROM test_undo_compress WHERE id = 2;
+FETCH ALL c;
+CLOSE c;
+ROLLBACK;
+SELECT id, length(pad), md5(pad) = md5(repeat('abc', 300)) AS unchanged
+FROM test_undo_compress ORDER BY id;
+DROP TABLE test_undo_compress;
+
+-- Test parallel index vacuuming
+CREATE TABLE test_par_vacuum(a int, b int, c text) USING zheap;
+CREATE INDEX test_par_vacuum_a ON test_par_vacuum(a);
+CREATE INDEX test_par_vacuum_b ON test_par_vacuum(b);
+CREATE INDEX test_par_vacuum_c ON test_par_vacuum(c);
+INSERT INTO test_par_vacuum SELECT g, g % 10, 'row' || g FROM generate_series(1, 1000) g;
+DELETE FROM test_par_vacuum WHERE a % 3 = 0;
+VACUUM (PARALLEL 2) test_par_vacuum;
+VACUUM (PARALLEL 0) test_par_vacuum;
+SET enable_seqscan = off;
+SET enable_bitmapscan = off;
+SELECT count(*) FROM test_par_vacuum WHERE a < 100;
+SELECT count(*) FROM test_par_vacuum WHERE b = 3;
+SELECT a FROM test_par_vacuum WHERE c = 'row301';
+RESET enable_seqscan;
+RESET enable_bitmapscan;
+VACUUM (PARALLEL) test_par_vacuum;
+VACUUM (PARALLEL -1) test_par_vacuum;
+VACUUM (FULL, PARALLEL 2) test_par_vacuum;
+DROP TABLE test_par_vacuum;
+
+-- Test vacuuming only the blocks of the undo spool
+CREATE TABLE test_spool_vacuum(a int, b text) USING zheap;
+CREATE INDEX test_spool_vacuum_a ON test_spool_vacuum(a);
+INSERT INTO test_spool_vacuum SELECT g, 'row' || g FROM generate_series(1, 500) g;
+DELETE FROM test_spool_vacuum WHERE a % 2 = 0;
+VACUUM (UNDO_SPOOL) test_spool_vacuum;
+VACUUM (UNDO_SPOOL false) test_spool_vacuum;
+SELECT count(*) FROM test_spool_vacuum;
+VACUUM (UNDO_SPOOL, FULL) test_spool_vacuum;
+VACUUM (UNDO_SPOOL, DISABLE_PAGE_SKIPPING) test_spool_vacuum;
+DROP TABLE test_spool_vacuum;
+
+-- Test spreading insertions over per-backend block ranges
+CREATE TABLE test_insert_spread(a int, b text) USING zheap WITH (insert_spread_blocks = 513);
+CREATE TABLE test_insert_spread(a int, b text) USING zheap WITH (insert_spread_blocks = 8);
+INSERT INTO test_insert_spread SELECT g, 'row' || g FROM generate_series(1, 100) g;
+SELECT pg_relation_size('test_insert_spread') / current_setting('block_size')::int AS blocks;
+INSERT INTO test_insert_spread SELECT g, repeat('x', 500) FROM generate_series(101, 200) g;
+SELECT pg_relation_size('test_insert_spread') / current_setting('block_size')::int AS blocks;
+SELECT count(*), sum(a) FROM test_insert_spread;
+ALTER TABLE test_insert_spread SET (insert_spread_blocks = 0);
+INSERT INTO test_insert_spread SELECT g, 'row' || g FROM generate_series(201, 300) g;
+SELECT count(*), sum(a) FROM test_insert_spread;
+DROP TABLE test_insert_spread;
+
+-- Test reusing an unchanged toasted value on update
+CREATE TABLE test_toast_reuse(id int, doc text) USING zheap;
+ALTER TABLE test_toast_reuse ALTER COLUMN doc SET STORAGE EXTERNAL;
+INSERT INTO test_toast_reuse VALUES (1, repeat('x', 10000));
+SELECT reltoastrelid::regclass AS toastrel FROM pg_class WHERE relname = 'test_toast_reuse' \gset
+SELECT chunk_id AS old_chunk_id FROM :toastrel LIMIT 1 \gset
+UPDATE test_toast_reuse SET doc = repeat('x', 10000);
+SELECT count(DISTINCT chunk_id) AS nvalues, bool_and(chunk_id = :old_chunk_id) AS reused FROM :toastrel;
+UPDATE test_toast_reuse SET doc = repeat('x', 9999) || 'y';
+SELECT count(DISTINCT chunk_id) AS nvalues, bool_and(chunk_id = :old_chunk_id) AS reused FROM :toastrel;
+SELECT length(doc), right(doc, 2) FROM test_toast_reuse;
+DROP TABLE test_toast_reuse;
+
+-- Test rolling back subtransactions with and without the local undo buffer
+CREATE TABLE test_local_undo(a int, b text) USING zheap;
+INSERT INTO test_local_undo SELECT g, 'row' || g FROM generate_series(1, 10) g;
+CREATE FUNCTION test_local_undo_fail(n int) RETURNS void LANGUAGE plpgsql AS $$
+BEGIN
+    FOR i IN 1..n LOOP
+        BEGIN
+            UPDATE test_local_undo SET b = 'updated' WHERE a = i;
+            DELETE FROM test_local_undo WHERE a = i + 1;
+            INSERT INTO test_local_undo VALUES (-i, 'inserted');
+            RAISE EXCEPTION 'fail';
+        EXCEPTION WHEN raise_exception THEN
+            NULL;
+        END;
+    END LOOP;
+END;
+$$;
+SELECT test_local_undo_fail(10);
+SET undo_local_buffer_size = 2;
+SELECT test_local_undo_fail(10);
+RESET undo_local_buffer_size;
+UPDATE test_local_undo SET b = repeat('z', 2000) WHERE a = 1;
+SELECT test_local_undo_fail(1);
+SELECT count(*), sum(a), max(length(b)) FROM test_local_undo;
+DROP FUNCTION test_local_undo_fail;
+DROP TABLE test_local_undo;
+
+-- Test parallel index builds
+CREATE TABLE test_par_build(a int, b text) USING zheap WITH (parallel_workers = 2);
+INSERT INTO test_par_build SELECT g, 'row' || g FROM generate_series(1, 2000) g;
+DELETE FROM test_par_build WHERE a % 5 = 0;
+SET max_parallel_maintenance_workers = 2;
+CREATE INDEX test_par_build_a ON test_par_build(a);
+CREATE UNIQUE INDEX test_par_build_b ON test_par_build(b);
+RESET max_parallel_maintenance_workers;
+SET enable_seqscan = off;
+SET enable_bitmapscan = off;
+SELECT count(*) FROM test_par_build WHERE a < 100;
+SELECT a FROM test_par_build WHERE b = 'row301';
+RESET enable_seqscan;
+RESET enable_bitmapscan;
+DROP TABLE test_par_build;
+
+-- Test keeping room for growing updates
+CREATE TABLE test_growth_reserve(a int, b text) USING zheap WITH (growth_reserve = 20);
+INSERT INTO test_growth_reserve SELECT g, 'x' FROM generate_series(1, 200) g;
+UPDATE test_growth_reserve SET b = repeat('x', 100);
+INSERT INTO test_growth_reserve SELECT g, 'y' FROM generate_series(201, 300) g;
+SELECT count(*), sum(length(b)) FROM test_growth_reserve;
+ALTER TABLE test_growth_reserve SET (growth_reserve = 60);
+ALTER TABLE test_growth_reserve RESET (growth_reserve);
+DROP TABLE test_growth_reserve;
+
+-- Test index scans returning several tuples of the same page
+CREATE TABLE test_index_batch(a int, b text) USING zheap;
+INSERT INTO test_index_batch SELECT g, 'row' || g FROM generate_series(1, 1000) g;
+CREATE INDEX test_index_batch_a ON test_index_batch(a);
+DELETE FROM test_index_batch WHERE a % 7 = 0;
+SET enable_seqscan = off;
+SET enable_bitmapscan = off;
+BEGIN;
+UPDATE test_index_batch SET b = 'new' WHERE a % 3 = 0;
+SELECT count(*), sum(a), count(*) FILTER (WHERE b = 'new') FROM test_index_batch WHERE a BETWEEN 100 AND 500;
+ROLLBACK;
+SELECT count(*), sum(a), count(*) FILTER (WHERE b = 'new') FROM test_index_batch WHERE a BETWEEN 100 AND 500;
+UPDATE test_index_batch SET a = a + 1000 WHERE a BETWEEN 100 AND 200;
+SELECT count(*), sum(a) FROM test_index_batch WHERE a BETWEEN 100 AND 1300;
+RESET enable_seqscan;
+RESET enable_bitmapscan;
+DROP TABLE test_index_batch;
+
+-- Test reading rows modified by the current transaction
+CREATE TABLE test_cid_map(a int, b int) USING zheap;
+BEGIN;
+INSERT INTO test_cid_map SELECT g, 0 FROM generate_series(1, 100) g;
+DECLARE c1 CURSOR FOR SELECT sum(b) FROM test_cid_map;
+UPDATE test_cid_map SET b = 1;
+FETCH c1;
+SELECT sum(b) FROM test_cid_map;
+SET LOCAL undo_local_cid_map_size = 0;
+DECLARE c2 CURSOR FOR SELECT sum(b) FROM test_cid_map;
+UPDATE test_cid_map SET b = 2;
+FETCH c2;
+SELECT sum(b) FROM test_cid_map;
+COMMIT;
+DROP TABLE test_cid_map;
+
+-- Test INSERT inserting its rows in batches
+CREATE TABLE test_batch_insert(a int PRIMARY KEY, b text) USING zheap;
+INSERT INTO test_batch_insert SELECT g, repeat('x', g % 50) FROM generate_series(1, 3000) g;
+SELECT count(*), sum(length(b)) FROM test_batch_insert;
+SET enable_seqscan = off;
+SELECT * FROM test_batch_insert WHERE a = 2525;
+RESET enable_seqscan;
+INSERT INTO test_batch_insert VALUES (3001, 'a'), (3002, 'b'), (3001, 'c');
+SELECT count(*) FROM test_batch_insert;
+-- a volatile function still sees the rows inserted before it's called
+CREATE FUNCTION test_batch_insert_count() RETURNS bigint VOLATILE
+	LANGUAGE sql AS 'SELECT count(*) FROM test_batch_insert';
+INSERT INTO test_batch_insert
+	SELECT 3000 + g, test_batch_insert_count()::text FROM generate_series(1, 3) g;
+SELECT * FROM test_batch_insert WHERE a > 3000 ORDER BY a;
+DROP FUNCTION test_batch_insert_count();
+DROP TABLE test_batch_insert;
+
+-- Test rolling back with the adaptive rollback policy
+CREATE TABLE test_rollback_policy(a int, b int) USING zheap;
+INSERT INTO test_rollback_policy SELECT g, g FROM generate_series(1, 1000) g;
+SET rollback_policy = adaptive;
+SET rollback_foreground_latency = 0;
+BEGIN;
+UPDATE test_rollback_policy SET b = 0;
+DELETE FROM test_rollback_policy WHERE a > 500;
+ROLLBACK;
+SELECT count(*), sum(b) FROM test_rollback_policy;
+RESET rollback_foreground_latency;
+RESET rollback_policy;
+DROP TABLE test_rollback_policy;
+
+-- Test reading undo records through memory mappings
+CREATE TABLE test_undo_mmap(a int, b int) USING zheap;
+INSERT INTO test_undo_mmap SELECT g, g FROM generate_series(1, 100) g;
+SET undo_read_mmap = on;
+BEGIN;
+DECLARE c1 CURSOR FOR SELECT sum(b) FROM test_undo_mmap;
+UPDATE test_undo_mmap SET b = b + 1;
+UPDATE test_undo_mmap SET b = b + 1;
+FETCH c1;
+SELECT sum(b) FROM test_undo_mmap;
+COMMIT;
+RESET undo_read_mmap;
+DROP TABLE test_undo_mmap;
+
+-- Test bitmap heap scans seeing deleted rows through undo
+CREATE TABLE test_bitmap_vis(a int, b int) USING zheap;
+INSERT INTO test_bitmap_vis SELECT g, g % 10 FROM generate_series(1, 1000) g;
+CREATE INDEX test_bitmap_vis_a ON test_bitmap_vis(a);
+CREATE INDEX test_bitmap_vis_b ON test_bitmap_vis(b);
+SET enable_seqscan = off;
+SET enable_indexscan = off;
+BEGIN;
+DECLARE c1 CURSOR FOR
+	SELECT count(*), sum(a) FROM test_bitmap_vis WHERE a < 100 OR b = 3;
+DELETE FROM test_bitmap_vis WHERE a % 2 = 0;
+FETCH c1;
+SELECT count(*), sum(a) FROM test_bitmap_vis WHERE a < 100 OR b = 3;
+COMMIT;
+RESET enable_indexscan;
+RESET enable_seqscan;
+DROP TABLE test_bitmap_vis;
+
+-- Test converting a table to zheap with ALTER TABLE SET ACCESS METHOD
+CREATE TABLE test_set_am(a int, b text) USING heap WITH (parallel_workers = 2);
+INSERT INTO test_set_am SELECT g, g::text FROM generate_series(1, 10000) g;
+INSERT INTO test_set_am
+	SELECT 0, string_agg(md5(g::text), '') FROM generate_series(1, 200) g;
+CREATE INDEX test_set_am_a ON test_set_am(a);
+ALTER TABLE test_set_am SET ACCESS METHOD zheap;
+SELECT amname FROM pg_class c JOIN pg_am am ON am.oid = c.relam
+	WHERE c.oid = 'test_set_am'::regclass;
+SELECT count(*), sum(a), sum(length(b)) FROM test_set_am;
+SET enable_seqscan = off;
+SELECT b FROM test_set_am WHERE a = 42;
+RESET enable_seqscan;
+DROP TABLE test_set_am;
+
+-- Test bitmap scans over pages with more tuples than a heap page can hold,
+-- whose offsets don't fit the TID bitmap's per-page bitmap
+CREATE TABLE test_bitmap_offsets(a int2, b int2) USING zheap;
+INSERT INTO test_bitmap_offsets
+	SELECT g / 100, g % 7 FROM generate_series(1, 10000) g;
+CREATE INDEX test_bitmap_offsets_a ON test_bitmap_offsets(a);
+CREATE INDEX test_bitmap_offsets_b ON test_bitmap_offsets(b);
+SET enable_seqscan = off;
+SET enable_indexscan = off;
+SELECT count(*), sum(a * 100 + b) FROM test_bitmap_offsets WHERE a = 5 AND b = 3;
+SELECT count(*) FROM test_bitmap_offsets WHERE a = 5 OR b = 3;
+SELECT count(*) FROM test_bitmap_offsets WHERE a BETWEEN 10 AND 12 OR a = 40;
+RESET enable_indexscan;
+RESET enable_seqscan;
+DROP TABLE test_bitmap_offsets;
+
+-- Test parallel index scans and index-only scans
+CREATE TABLE test_par_scan(a int, b text) USING zheap WITH (parallel_workers = 2);
+INSERT INTO test_par_scan SELECT g, repeat('x', g % 50) FROM generate_series(1, 20000) g;
+CREATE INDEX test_par_scan_a ON test_par_scan(a);
+DELETE FROM test_par_scan WHERE a % 10 = 0;
+ANALYZE test_par_scan;
+SET parallel_setup_cost = 0;
+SET parallel_tuple_cost = 0;
+SET min_parallel_index_scan_size = 0;
+SET max_parallel_workers_per_gather = 2;
+SET enable_seqscan = off;
+SET enable_bitmapscan = off;
+EXPLAIN (COSTS OFF)
+	SELECT count(*), sum(length(b)) FROM test_par_scan WHERE a < 15000;
+SELECT count(*), sum(length(b)) FROM test_par_scan WHERE a < 15000;
+EXPLAIN (COSTS OFF)
+	SELECT count(*), sum(a) FROM test_par_scan WHERE a >= 5000;
+SELECT count(*), sum(a) FROM test_par_scan WHERE a >= 5000;
+RESET enable_bitmapscan;
+RESET enable_seqscan;
+RESET max_parallel_workers_per_gather;
+RESET min_parallel_index_scan_size;
+RESET parallel_tuple_cost;
+RESET parallel_setup_cost;
+DROP TABLE test_par_scan;
+
+-- Test INSERT buffering the rows routed to each partition separately
+CREATE TABLE test_batch_part(a int, b int) PARTITION BY RANGE (a);
+CREATE TABLE test_batch_part1 PARTITION OF test_batch_part FOR VALUES FROM (0) TO (1000) USING zheap;
+CREATE TABLE test_batch_part2 PARTITION OF test_batch_part FOR VALUES FROM (1000) TO (2000) USING zheap;
+CREATE TABLE test_batch_part3 PARTITION OF test_batch_part FOR VALUES FROM (2000) TO (3000) USING zheap;
+INSERT INTO test_batch_part SELECT (g % 3) * 1000 + g / 3, g FROM generate_series(0, 2999) g;
+SELECT tableoid::regclass, count(*), min(a), max(a) FROM test_batch_part GROUP BY 1 ORDER BY 1;
+-- a partition with a row trigger sees the rows buffered for the others
+TRUNCATE test_batch_part;
+CREATE FUNCTION test_batch_part_trig() RETURNS trigger LANGUAGE plpgsql AS
+	$$ BEGIN NEW.b := (SELECT count(*) FROM test_batch_part1); RETURN NEW; END $$;
+CREATE TRIGGER test_batch_part_trig BEFORE INSERT ON test_batch_part3
+	FOR EACH ROW EXECUTE PROCEDURE test_batch_part_trig();
+INSERT INTO test_batch_part
+	SELECT g, 0 FROM generate_series(1, 10) g
+	UNION ALL SELECT 2000 + g, 0 FROM generate_series(1, 3) g;
+SELECT a, b FROM test_batch_part3 ORDER BY a;
+DROP TABLE test_batch_part;
+DROP FUNCTION test_batch_part_trig();
@@ -0,0 +1,84 @@
+# Tests for copying the initial data of a table in parallel
+use strict;
+use warnings;
+use PostgresNode;
+use TestLib;
+use Test::More tests => 4;
+
+# Initialize publisher node
+my $node_publisher = get_new_node('publisher');
+$node_publisher->init(allows_streaming => 'logical');
+$node_publisher->start;
+
+# Create subscriber node, copying tables in parts of any size
+my $node_subscriber = get_new_node('subscriber');
+$node_subscriber->init(allows_streaming => 'logical');
+$node_subscriber->append_conf(
+	'postgresql.conf', qq(
+wal_retrieve_retry_interval = 1ms
+max_parallel_sync_workers_per_table = 3
+min_parallel_table_scan_size = 0
+));
+$node_subscriber->start;
+
+$node_publisher->safe_psql(
+	'postgres', qq(
+CREATE TABLE tab_key (a int PRIMARY KEY, b text);
+INSERT INTO tab_key SELECT g, md5(g::text) FROM generate_series(1, 50000) g;
+CREATE TABLE tab_nokey (a int, b text);
+INSERT INTO tab_nokey SELECT g, md5(g::text) FROM generate_series(1, 50000) g;
+ANALYZE;
+));
+
+$node_subscriber->safe_psql(
+	'postgres', qq(
+CREATE TABLE tab_key (a int PRIMARY KEY, b text);
+CREATE TABLE tab_nokey (a int, b text);
+CREATE TABLE tab_seen (state "char");
+CREATE FUNCTION seen_trig() RETURNS trigger LANGUAGE plpgsql AS \$\$
+BEGIN
+  INSERT INTO tab_seen
+    SELECT srsubstate FROM pg_subscription_rel
+    WHERE srrelid = 'tab_key'::regclass;
+  RETURN NULL;
+END \$\$;
+CREATE TRIGGER seen AFTER INSERT ON tab_key
+  FOR EACH STATEMENT EXECUTE PROCEDURE seen_trig();
+ALTER TABLE tab_key ENABLE ALWAYS TRIGGER seen;
+));
+
+my $publisher_connstr = $node_publisher->connstr . ' dbname=postgres';
+$node_publisher->safe_psql('postgres',
+	"CREATE PUBLICATION tap_pub FOR ALL TABLES");
+$node_subscriber->safe_psql('postgres',
+	"CREATE SUBSCRIPTION tap_sub CONNECTION '$publisher_connstr' PUBLICATION tap_pub"
+);
+
+$node_publisher->wait_for_catchup('tap_sub');
+
+my $synced_query =
+  "SELECT count(1) = 0 FROM pg_subscription_rel WHERE srsubstate NOT IN ('r', 's');";
+$node_subscriber->poll_query_until('postgres', $synced_query)
+  or die "Timed out while waiting for subscriber to synchronize data";
+
+my $query = "SELECT count(*), sum(a), count(DISTINCT b) FROM";
+is( $node_subscriber->safe_psql('postgres', "$query tab_key"),
+	$node_publisher->safe_psql('postgres', "$query tab_key"),
+	'table with a key copied in parallel');
+is( $node_subscriber->safe_psql('postgres', "$query tab_nokey"),
+	$node_publisher->safe_psql('postgres', "$query tab_nokey"),
+	'table without a key copied');
+cmp_ok($node_subscriber->safe_psql('postgres', "SELECT count(*) FROM tab_seen"),
+	'>', 1, 'table with a key copied in several parts');
+
+# Changes are replicated as usual afterwards
+$node_publisher->safe_psql('postgres',
+	"UPDATE tab_key SET b = 'changed' WHERE a % 1000 = 0");
+$node_publisher->wait_for_catchup('tap_sub');
+is( $node_subscriber->safe_psql(
+		'postgres', "SELECT count(*) FROM tab_key WHERE b = 'changed'"),
+	'50',
+	'changes replicated after parallel copy');
+
+$node_subscriber->stop('fast');
+$node_publisher->stop('fast');